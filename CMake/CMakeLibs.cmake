@@ -163,6 +163,12 @@ macro(ADD_OSQUERY_LIBRARY IS_CORE TARGET)
   if(${IS_CORE} OR NOT OSQUERY_BUILD_SDK_ONLY)
     add_library(${TARGET} OBJECT ${ARGN})
     add_dependencies(${TARGET} osquery_extensions)
+    # Table implementations may include generated column indices.
+    if(${IS_CORE})
+      add_dependencies(${TARGET} osquery_utils_codegen)
+    else()
+      add_dependencies(${TARGET} osquery_additional_codegen)
+    endif()
     # TODO(#1985): For Windows, ignore the -static compiler flag
     if(WIN32)
       SET_OSQUERY_COMPILE(${TARGET} "${CXX_COMPILE_FLAGS} /EHsc /MD")
@@ -194,6 +200,11 @@ macro(ADD_OSQUERY_OBJCXX_LIBRARY IS_CORE TARGET)
   if(${IS_CORE} OR NOT OSQUERY_BUILD_SDK_ONLY)
     add_library(${TARGET} OBJECT ${ARGN})
     add_dependencies(${TARGET} osquery_extensions)
+    if(${IS_CORE})
+      add_dependencies(${TARGET} osquery_utils_codegen)
+    else()
+      add_dependencies(${TARGET} osquery_additional_codegen)
+    endif()
     # TODO(#1985): For Windows, ignore the -static compiler flag
     if(WIN32)
       SET_OSQUERY_COMPILE(${TARGET} "${CXX_COMPILE_FLAGS} ${OBJCXX_COMPILE_FLAGS} /EHsc /MD")
@@ -325,11 +336,25 @@ macro(GENERATE_TABLE TABLE_FILE FOREIGN NAME BASE_PATH OUTPUT)
     ${TABLE_FILE_GEN}
   )
 
+  # Table implementations include the column indices, foreign tables have none.
+  set(TABLE_FILE_HEADER "")
+  set(TABLE_FILE_HEADER_ARGS "")
+  if("${FOREIGN}" STREQUAL "")
+    string(REGEX REPLACE
+      ".*/specs.*/(.*)\\.table"
+      "${CMAKE_BINARY_DIR}/generated/columns/\\1.h"
+      TABLE_FILE_HEADER
+      ${TABLE_FILE}
+    )
+    set(TABLE_FILE_HEADER_ARGS "--header" "${TABLE_FILE_HEADER}")
+  endif()
+
   add_custom_command(
-    OUTPUT "${TABLE_FILE_GEN}"
+    OUTPUT "${TABLE_FILE_GEN}" ${TABLE_FILE_HEADER}
     COMMAND "${PYTHON_EXECUTABLE}"
       "${BASE_PATH}/tools/codegen/gentable.py"
       "${FOREIGN}"
+      ${TABLE_FILE_HEADER_ARGS}
       "${TABLE_FILE}"
       "${TABLE_FILE_GEN}"
       "$ENV{DISABLE_BLACKLIST}"
@@ -337,7 +362,7 @@ macro(GENERATE_TABLE TABLE_FILE FOREIGN NAME BASE_PATH OUTPUT)
     WORKING_DIRECTORY "${CMAKE_SOURCE_DIR}"
   )
 
-  list(APPEND ${OUTPUT} "${TABLE_FILE_GEN}")
+  list(APPEND ${OUTPUT} "${TABLE_FILE_GEN}" ${TABLE_FILE_HEADER})
 endmacro(GENERATE_TABLE)
 
 macro(AMALGAMATE BASE_PATH NAME OUTPUT)
@@ -373,8 +398,34 @@ macro(AMALGAMATE BASE_PATH NAME OUTPUT)
   )
 
   set(${OUTPUT} "${CMAKE_BINARY_DIR}/generated/${NAME}_amalgamation.cpp")
+
+  # Table implementations are compiled after their column indices.
+  add_custom_target(osquery_${NAME}_codegen DEPENDS ${GENERATED_TARGETS})
 endmacro(AMALGAMATE)
 
+# Generate a benchmark for each platform and utility table spec.
+macro(GENERATE_BENCHMARKS BASE_PATH OUTPUT)
+  GET_GENERATION_DEPS(${BASE_PATH})
+  get_property(TARGETS GLOBAL PROPERTY AMALGAMATE_TARGETS)
+  file(GLOB TABLE_FILES_UTILITY "${BASE_PATH}/specs/utility/*.table")
+  list(APPEND TARGETS ${TABLE_FILES_UTILITY})
+  list(REMOVE_DUPLICATES TARGETS)
+
+  add_custom_command(
+    OUTPUT "${CMAKE_BINARY_DIR}/generated/table_benchmarks.cpp"
+    COMMAND "${PYTHON_EXECUTABLE}"
+      "${BASE_PATH}/tools/codegen/genbenchmarks.py"
+      --specs "${BASE_PATH}/specs"
+      "${BASE_PATH}/tools/codegen/"
+      "${CMAKE_BINARY_DIR}/generated/table_benchmarks.cpp"
+      ${TARGETS}
+    DEPENDS ${TARGETS} ${GENERATION_DEPENDENCIES}
+    WORKING_DIRECTORY "${CMAKE_SOURCE_DIR}"
+  )
+
+  set(${OUTPUT} "${CMAKE_BINARY_DIR}/generated/table_benchmarks.cpp")
+endmacro(GENERATE_BENCHMARKS)
+
 function(JOIN VALUES GLUE OUTPUT)
   string(REPLACE ";" "${GLUE}" _TMP_STR "${VALUES}")
   set(${OUTPUT} "${_TMP_STR}" PARENT_SCOPE)
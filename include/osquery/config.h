@@ -13,6 +13,7 @@
 #include <list>
 #include <map>
 #include <memory>
+#include <set>
 #include <vector>
 
 #include <boost/iterator/filter_iterator.hpp>
@@ -94,6 +95,99 @@ class Config : private boost::noncopyable {
    */
   void recordQueryStart(const std::string& name);
 
+  /**
+   * @brief Record schedule timeliness information about a scheduled query.
+   *
+   * The scheduler computes due times from a monotonic clock. If a query starts
+   * late, or a due execution is skipped, the lateness is reported here and
+   * within the osquery_schedule table regardless of the schedule monitor.
+   *
+   * @param name The unique name of the scheduled item
+   * @param lateness Milliseconds after the due time the execution started,
+   * 0 if the execution was on time or did not start
+   * @param missed Number of due executions that were skipped
+   */
+  void recordQueryLateness(const std::string& name,
+                           size_t lateness,
+                           size_t missed);
+
+  /**
+   * @brief Record table generations a scheduled query reused.
+   *
+   * Scheduled queries due in the same schedule step may share the generated
+   * rows of tables they have in common, see schedule_share_tables.
+   *
+   * @param name The unique name of the scheduled item
+   * @param reused Number of table generations the execution did not repeat
+   */
+  void recordQuerySharedGenerations(const std::string& name, size_t reused);
+
+  /**
+   * @brief Record an execution given the results of an identical query.
+   *
+   * Identical queries due in the same schedule step may execute once, see
+   * schedule_share_queries. The execution is attributed to the first query.
+   *
+   * @param name The unique name of the scheduled item
+   */
+  void recordQuerySharedExecution(const std::string& name);
+
+  /**
+   * @brief Record the wall time and generated rows of a scheduled query.
+   *
+   * Unlike recordQueryPerformance these are recorded without the schedule
+   * monitor. Each execution is added to the query's histograms.
+   *
+   * @param name The unique name of the scheduled item
+   * @param wall_time Milliseconds the execution took
+   * @param rows Rows generated by the tables the execution scanned
+   */
+  void recordQueryLatency(const std::string& name,
+                          size_t wall_time,
+                          size_t rows);
+
+  /**
+   * @brief Record the heap allocations of a scheduled query's execution.
+   *
+   * Allocations are only counted by builds with ALLOCATION_TRACKING.
+   *
+   * @param name The unique name of the scheduled item
+   * @param allocations Number of allocations made by the execution
+   * @param bytes Bytes allocated by the execution
+   * @param peak The most bytes the execution had allocated at once
+   */
+  void recordQueryAllocations(const std::string& name,
+                              size_t allocations,
+                              size_t bytes,
+                              size_t peak);
+
+  /**
+   * @brief Record one cursor's generation of a table for a scheduled query.
+   *
+   * @param table The table name
+   * @param filters Number of scans made by the cursor
+   * @param rows Rows generated
+   * @param generate_time Microseconds spent generating
+   * @param allocations Number of allocations made generating
+   * @param allocated_bytes Bytes allocated generating
+   */
+  void recordTableGeneration(const std::string& table,
+                             size_t filters,
+                             size_t rows,
+                             size_t generate_time,
+                             size_t allocations,
+                             size_t allocated_bytes);
+
+  /**
+   * @brief Add a scheduled query to the schedule's blacklist.
+   *
+   * Blacklisted queries are skipped by scheduledQueries until the blacklist
+   * entry expires, a day after it was added.
+   *
+   * @param name The unique name of the scheduled item
+   */
+  void blacklistQuery(const std::string& name);
+
   /**
    * @brief Calculate the hash of the osquery config
    *
@@ -106,8 +200,9 @@ class Config : private boost::noncopyable {
    *
    * @param source is the place where the config content came from
    * @param content is the content of the config data for a given source
+   * @return true if the content differs from the source's previous content
    */
-  void hashSource(const std::string& source, const std::string& content);
+  bool hashSource(const std::string& source, const std::string& content);
 
   /// Whether or not the last loaded config was valid.
   bool isValid() const { return valid_; }
@@ -204,6 +299,15 @@ class Config : private boost::noncopyable {
       const std::string& name,
       std::function<void(const QueryPerformance& query)> predicate);
 
+  /**
+   * @brief Iterate the generation statistics of each table.
+   *
+   * @param predicate called with each table name and its statistics.
+   */
+  void tablePerformance(
+      std::function<void(const std::string& table,
+                         const TablePerformance& performance)> predicate);
+
   /**
    * @brief Helper to access config parsers via the registry
    *
@@ -225,9 +329,33 @@ class Config : private boost::noncopyable {
    */
   Status load();
 
-  /// A step method for Config::update.
+  /**
+   * @brief Apply the content of each source saved by a previous worker.
+   *
+   * The content of each source is saved as it changes, when
+   * config_respawn_snapshot is set. A worker respawned by the watcher applies
+   * it instead of waiting on the config plugin, then loads the config again in
+   * the background.
+   */
+  Status loadSnapshot();
+
+  /**
+   * @brief A step method for Config::update.
+   *
+   * Only packs and parser keys whose content changed since the source's
+   * previous update are applied again, unchanged packs remain scheduled.
+   */
   Status updateSource(const std::string& source, const std::string& json);
 
+  /**
+   * @brief Record the content hash of a source's pack.
+   *
+   * @return true if the pack should be added, it changed or is not scheduled.
+   */
+  bool updatePackHash(const std::string& source,
+                      const std::string& name,
+                      const std::string& hash);
+
   /**
    * @brief Generate pack content from a resource handled by the Plugin.
    *
@@ -277,6 +405,17 @@ class Config : private boost::noncopyable {
    */
   void purge();
 
+  /**
+   * @brief Offset scheduled queries such that expected cost is level.
+   *
+   * When schedule_splay_cost is enabled, each scheduled query without a saved
+   * offset is placed, most expensive first, at the offset within its splayed
+   * interval that minimizes the peak expected cost per schedule step. Costs
+   * are the recorded CPU time per execution when the monitor is enabled.
+   * Offsets are saved alongside the splayed interval and restored.
+   */
+  void levelSchedule();
+
   /**
    * @brief Reset the configuration state, reserved for testing only.
    */
@@ -289,6 +428,9 @@ class Config : private boost::noncopyable {
   /// A set of performance stats for each query in the schedule.
   std::map<std::string, QueryPerformance> performance_;
 
+  /// Generation stats for each table used by the schedule.
+  std::map<std::string, TablePerformance> table_performance_;
+
   /// A set of named categories filled with filesystem globbing paths.
   using FileCategories = std::map<std::string, std::vector<std::string>>;
   std::map<std::string, FileCategories> files_;
@@ -296,6 +438,15 @@ class Config : private boost::noncopyable {
   /// A set of hashes for each source of the config.
   std::map<std::string, std::string> hash_;
 
+  /// Content hashes of each source's packs, keyed by source and pack name.
+  std::map<std::string, std::string> pack_hashes_;
+
+  /// Hashes of the keys passed to each parser, keyed by source and parser.
+  std::map<std::string, std::string> parser_hashes_;
+
+  /// Sources with packs generated from resources, these are always updated.
+  std::set<std::string> generated_sources_;
+
   /// Check if the config received valid/parsable content from a config plugin.
   bool valid_{false};
 
@@ -315,6 +466,7 @@ class Config : private boost::noncopyable {
   friend class FileEventsTableTests;
   friend class DecoratorsConfigParserPluginTests;
   friend class SchedulerTests;
+  friend class KafkaTests;
   FRIEND_TEST(OptionsConfigParserPluginTests, test_get_option);
   FRIEND_TEST(EventsConfigParserPluginTests, test_get_event);
   FRIEND_TEST(PacksTests, test_discovery_cache);
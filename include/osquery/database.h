@@ -11,7 +11,10 @@
 #pragma once
 
 #include <atomic>
+#include <cstdint>
+#include <functional>
 #include <map>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -59,18 +62,24 @@ extern const std::string kEvents;
  */
 extern const std::string kLogs;
 
-/**
- * @brief A variant type for the SQLite type affinities.
- */
-using RowData = std::string;
+/// The "domain" where file digests are cached, see hashMultiFromFile.
+extern const std::string kHashes;
+
+/// A stable fingerprint of a Row's column names and values.
+using RowHash = uint64_t;
 
 /**
- * @brief A single row from a database query
+ * @brief Compute a stable fingerprint for a Row
+ *
+ * The fingerprint covers every column name and value, in the Row's (sorted)
+ * column order, and is stable across processes and platforms. Two equal Rows
+ * always have the same fingerprint, unequal Rows may collide.
+ *
+ * @param r the Row to fingerprint
  *
- * Row is a simple map where individual column names are keys, which map to
- * the Row's respective value
+ * @return a 64-bit fingerprint
  */
-using Row = std::map<std::string, RowData>;
+RowHash hashRow(const Row& r);
 
 /**
  * @brief Serialize a Row into a property tree
@@ -141,6 +150,19 @@ Status serializeQueryData(const QueryData& q,
  */
 Status serializeQueryDataJSON(const QueryData& q, std::string& json);
 
+/// A streaming JSON writer, see osquery/core/json.h.
+class JSONWriter;
+
+/**
+ * @brief Write a QueryData object as a JSON array value into a document
+ *
+ * An empty QueryData is written as an empty string, as a property tree would.
+ *
+ * @param q the QueryData to serialize
+ * @param writer the JSON writer of the output document
+ */
+void serializeQueryDataJSON(const QueryData& q, JSONWriter& writer);
+
 /// Inverse of serializeQueryData, convert property tree to QueryData.
 Status deserializeQueryData(const boost::property_tree::ptree& tree,
                             QueryData& qd);
@@ -148,13 +170,48 @@ Status deserializeQueryData(const boost::property_tree::ptree& tree,
 /// Inverse of serializeQueryDataJSON, convert a JSON string to QueryData.
 Status deserializeQueryDataJSON(const std::string& json, QueryData& qd);
 
+/**
+ * @brief Serialize a QueryData object into a compact binary string
+ *
+ * Column names are written once and rows refer to them by index. The content
+ * may contain NUL bytes, it is intended for in-process storage.
+ *
+ * @param q the QueryData to serialize
+ * @param binary the output binary string
+ *
+ * @return Status indicating the success or failure of the operation
+ */
+Status serializeQueryDataBinary(const QueryData& q, std::string& binary);
+
+/// Inverse of serializeQueryDataBinary, convert a binary string to QueryData.
+Status deserializeQueryDataBinary(const std::string& binary, QueryData& qd);
+
+/**
+ * @brief Serialize a QueryData object into a column dictionary encoded string
+ *
+ * The rows are written column by column. Each column's distinct values are
+ * written once, and each row refers to its value by index, so the repeated
+ * values of result sets are stored once and the content compresses well.
+ *
+ * @param q the QueryData to serialize
+ * @param binary the output binary string
+ *
+ * @return Status indicating the success or failure of the operation
+ */
+Status serializeQueryDataColumns(const QueryData& q, std::string& binary);
+
+/// Inverse of serializeQueryDataColumns, convert a binary string to QueryData.
+Status deserializeQueryDataColumns(const std::string& binary, QueryData& qd);
+
 /**
  * @brief Data structure representing the difference between the results of
  * two queries
  *
  * The representation of two diffed QueryData result sets. Given and old and
  * new QueryData, DiffResults indicates the "added" subset of rows and the
- * "removed" subset of rows.
+ * "removed" subset of rows. When a query declares key columns, see
+ * matchDiffKeys, an added and removed row sharing a key become one "changed"
+ * row instead.
  */
 struct DiffResults {
   /// vector of added rows
@@ -163,9 +220,18 @@ struct DiffResults {
   /// vector of removed rows
   QueryData removed;
 
+  /// vector of changed rows, the key and modified columns of each
+  QueryData changed;
+
   /// equals operator
   bool operator==(const DiffResults& comp) const {
-    return (comp.added == added) && (comp.removed == removed);
+    return (comp.added == added) && (comp.removed == removed) &&
+           (comp.changed == changed);
+  }
+
+  /// True if no rows were added, removed, or changed.
+  bool empty() const {
+    return added.empty() && removed.empty() && changed.empty();
   }
 
   /// not equals operator
@@ -197,6 +263,10 @@ Status serializeDiffResultsJSON(const DiffResults& d, std::string& json);
 /**
  * @brief Diff two QueryData objects and create a DiffResults object
  *
+ * Each Row is fingerprinted once using hashRow, and rows are matched as a
+ * multiset: a Row appearing twice in new_ but once in old_ is "added" once.
+ * Full Row comparisons only happen when fingerprints are equal.
+ *
  * @param old_ the "old" set of results
  * @param new_ the "new" set of results
  *
@@ -206,6 +276,42 @@ Status serializeDiffResultsJSON(const DiffResults& d, std::string& json);
  */
 DiffResults diff(const QueryData& old_, const QueryData& new_);
 
+/**
+ * @brief Replace added and removed rows sharing key columns with changes.
+ *
+ * Removed rows are indexed by the values of their key columns. Each added row
+ * is matched to the first unmatched removed row with the same key, and the
+ * pair becomes one "changed" row holding the key columns and the columns
+ * whose values differ, with their new values. Rows missing a key column and
+ * rows without a match are left as added or removed.
+ *
+ * @param dr the differential to rewrite
+ * @param keys the names of the key columns, no change is made if empty
+ */
+void matchDiffKeys(DiffResults& dr, const std::vector<std::string>& keys);
+
+/// The positions of the rows a diff reports, see diffIndexes.
+struct DiffIndexes {
+  /// Indexes into new_ of the added rows, in order.
+  std::vector<size_t> added;
+
+  /// Indexes into old_ of the removed rows, in order.
+  std::vector<size_t> removed;
+};
+
+/**
+ * @brief Diff two QueryData objects without copying their rows
+ *
+ * The same differential as diff, as indexes into the inputs. A caller that
+ * owns the inputs may move the added and removed rows into its results.
+ *
+ * @param old_ the "old" set of results
+ * @param new_ the "new" set of results
+ *
+ * @return the indexes of the added and removed rows
+ */
+DiffIndexes diffIndexes(const QueryData& old_, const QueryData& new_);
+
 /**
  * @brief Add a Row to a QueryData if the Row hasn't appeared in the QueryData
  * already
@@ -236,6 +342,44 @@ bool addUniqueRowToQueryData(QueryData& q, const Row& r);
  */
 void escapeQueryData(const QueryData& oldData, QueryData& newData);
 
+/**
+ * @brief A histogram of non-negative values with bounded relative error.
+ *
+ * Values below 16 are counted exactly, larger values are counted in one of 8
+ * buckets per power of two, so a percentile is within 12.5% of the recorded
+ * value. Buckets are allocated up to the largest recorded value, a histogram
+ * of values below a million uses at most 144 counters.
+ */
+class PerformanceHistogram {
+ public:
+  /// Count a value.
+  void record(unsigned long long value);
+
+  /**
+   * @brief The value at or below which a percentage of the values fall.
+   *
+   * @param percent between 0 and 100, 100 is the largest value.
+   * @return the upper bound of the percentile's bucket, 0 without values.
+   */
+  unsigned long long percentile(double percent) const;
+
+  /// Number of recorded values.
+  size_t count() const { return count_; }
+
+  /// The largest recorded value.
+  unsigned long long max() const { return max_; }
+
+ private:
+  /// Counts of the values within each bucket.
+  std::vector<size_t> buckets_;
+
+  /// Number of recorded values.
+  size_t count_{0};
+
+  /// The largest recorded value.
+  unsigned long long max_{0};
+};
+
 /**
  * @brief performance statistics about a query
  */
@@ -261,6 +405,36 @@ struct QueryPerformance {
   /// Total characters, bytes, generated by query.
   unsigned long long int output_size;
 
+  /// Number of executions started at least a second after they were due.
+  size_t late_executions;
+
+  /// Number of due executions skipped or coalesced into a later execution.
+  size_t missed_executions;
+
+  /// Total milliseconds late executions started after they were due.
+  unsigned long long int lateness;
+
+  /// Number of table generations reused from queries in the same step.
+  size_t shared_generations;
+
+  /// Number of executions given the results of an identical query.
+  size_t shared_executions;
+
+  /// Milliseconds of wall time of each execution.
+  PerformanceHistogram wall_time_histogram;
+
+  /// Rows generated by the query's tables in each execution.
+  PerformanceHistogram rows_histogram;
+
+  /// Total heap allocations, counted by builds with ALLOCATION_TRACKING.
+  unsigned long long int allocations;
+
+  /// Total bytes of heap allocations.
+  unsigned long long int allocated_bytes;
+
+  /// The most bytes an execution had allocated at once.
+  size_t peak_allocated_bytes;
+
   QueryPerformance()
       : executions(0),
         last_executed(0),
@@ -268,7 +442,47 @@ struct QueryPerformance {
         user_time(0),
         system_time(0),
         average_memory(0),
-        output_size(0) {}
+        output_size(0),
+        late_executions(0),
+        missed_executions(0),
+        lateness(0),
+        shared_generations(0),
+        shared_executions(0),
+        allocations(0),
+        allocated_bytes(0),
+        peak_allocated_bytes(0) {}
+};
+
+/// Generation statistics of a table used by scheduled queries.
+struct TablePerformance {
+  /// Number of cursors that scanned the table.
+  size_t generations;
+
+  /// Number of scans, a cursor is scanned again for each outer row of a JOIN.
+  size_t filters;
+
+  /// Total rows generated.
+  unsigned long long rows;
+
+  /// Total microseconds spent generating.
+  unsigned long long generate_time;
+
+  /// Microseconds spent generating by each cursor.
+  PerformanceHistogram generate_time_histogram;
+
+  /// Total heap allocations made generating.
+  unsigned long long allocations;
+
+  /// Total bytes of heap allocations made generating.
+  unsigned long long allocated_bytes;
+
+  TablePerformance()
+      : generations(0),
+        filters(0),
+        rows(0),
+        generate_time(0),
+        allocations(0),
+        allocated_bytes(0) {}
 };
 
 /**
@@ -287,10 +501,20 @@ struct ScheduledQuery {
   /// A temporary splayed internal.
   size_t splayed_interval;
 
+  /// The schedule step, modulo the splayed interval, when the query is due.
+  size_t splayed_offset;
+
   /// Set of query options.
   std::map<std::string, bool> options;
 
-  ScheduledQuery() : interval(0), splayed_interval(0) {}
+  /// Optional columns identifying a row across runs, see matchDiffKeys.
+  std::vector<std::string> key_columns;
+
+  /// True once the splayed offset was placed by the schedule leveling.
+  bool leveled;
+
+  ScheduledQuery()
+      : interval(0), splayed_interval(0), splayed_offset(0), leveled(false) {}
 
   /// equals operator
   bool operator==(const ScheduledQuery& comp) const {
@@ -330,6 +554,14 @@ struct QueryLogItem {
   /// A set of additional fields to emit with the log line.
   std::map<std::string, std::string> decorations;
 
+  /**
+   * @brief Optional, the decorations serialized as a JSON object.
+   *
+   * Set alongside the decorations by getDecorations and shared between log
+   * items, reset it if the decorations are changed.
+   */
+  std::shared_ptr<const std::string> decorations_json;
+
   /// equals operator
   bool operator==(const QueryLogItem& comp) const {
     return (comp.results == results) && (comp.name == name);
@@ -391,6 +623,12 @@ Status serializeQueryLogItemAsEvents(const QueryLogItem& item,
 Status serializeQueryLogItemAsEventsJSON(const QueryLogItem& i,
                                          std::vector<std::string>& items);
 
+/// A list of key and value pairs written to a database domain together.
+using DatabaseStringValueList = std::vector<std::pair<std::string, std::string>>;
+
+/// Called with each key found by a scan, return false to stop the scan.
+using DatabaseScanCallback = std::function<bool(const std::string& key)>;
+
 /**
  * @brief An osquery backing storage (database) type that persists executions.
  *
@@ -438,9 +676,66 @@ class DatabasePlugin : public Plugin {
                      const std::string& key,
                      const std::string& value) = 0;
 
+  /**
+   * @brief Store several values in a domain with a single write.
+   *
+   * Plugins supporting batched writes should override this, the default
+   * calls put for each value.
+   *
+   * @param domain A string value representing abstract storage indexing.
+   * @param data The key and value pairs to store.
+   * @return Failure if any of the data could not be stored.
+   */
+  virtual Status putBatch(const std::string& domain,
+                          const DatabaseStringValueList& data);
+
+  /**
+   * @brief Retrieve several values from a domain with a single read.
+   *
+   * Plugins supporting batched reads should override this, the default
+   * calls get for each key.
+   *
+   * @param domain A string value representing abstract storage indexing.
+   * @param keys The keys to retrieve.
+   * @param values The output values in the order of keys, a missing key has
+   * an empty value.
+   * @return Failure if the values could not be read.
+   */
+  virtual Status getBatch(const std::string& domain,
+                          const std::vector<std::string>& keys,
+                          std::vector<std::string>& values) const;
+
+  /**
+   * @brief Remove several keys from a domain with a single write.
+   *
+   * Plugins supporting batched writes should override this, the default
+   * calls remove for each key.
+   *
+   * @param domain A string value representing abstract storage indexing.
+   * @param keys The keys to remove.
+   * @return Failure if any of the keys could not be removed.
+   */
+  virtual Status removeBatch(const std::string& domain,
+                             const std::vector<std::string>& keys);
+
   /// Data removal method.
   virtual Status remove(const std::string& domain, const std::string& k) = 0;
 
+  /**
+   * @brief Remove every key from low (inclusive) to high (exclusive).
+   *
+   * Plugins with ordered keys should override this, the default scans the
+   * keys sharing the bounds' common prefix and calls remove for each.
+   *
+   * @param domain A string value representing abstract storage indexing.
+   * @param low The first key to remove.
+   * @param high The first key, after low, to keep.
+   * @return Failure if any of the keys could not be removed.
+   */
+  virtual Status removeRange(const std::string& domain,
+                             const std::string& low,
+                             const std::string& high);
+
   virtual Status scan(const std::string& domain,
                       std::vector<std::string>& results,
                       const std::string& prefix,
@@ -448,6 +743,33 @@ class DatabasePlugin : public Plugin {
     return Status(0, "Not used");
   }
 
+  /**
+   * @brief Call a function for each key with a prefix, without a key list.
+   *
+   * Plugins with ordered keys should override this to stream keys from an
+   * iterator, the default calls the callback for each key from scan.
+   *
+   * @param domain A string value representing abstract storage indexing.
+   * @param prefix Only keys starting with the prefix are found.
+   * @param callback Called with each key, return false to stop.
+   * @param max The maximum number of keys to find, 0 is unlimited.
+   * @return Failure if the keys could not be scanned.
+   */
+  virtual Status scan(const std::string& domain,
+                      const std::string& prefix,
+                      const DatabaseScanCallback& callback,
+                      size_t max = 0) const;
+
+  /**
+   * @brief Report backing storage statistics, such as compaction times.
+   *
+   * @param stats The output statistic names and values.
+   * @return Failure if the plugin does not keep statistics.
+   */
+  virtual Status statistics(std::map<std::string, std::string>& stats) const {
+    return Status(1, "Not supported");
+  }
+
   /**
    * @brief Shutdown the database and release initialization resources.
    *
@@ -548,20 +870,65 @@ Status setDatabaseValue(const std::string& domain,
                         const std::string& key,
                         const std::string& value);
 
+/**
+ * @brief Set several values in the active osquery DatabasePlugin storage.
+ *
+ * See DatabasePlugin::putBatch, the values are written together when the
+ * storage plugin supports it.
+ *
+ * @param domain A string value representing abstract storage indexing.
+ * @param data The key and value pairs to store.
+ * @return Storage operation status.
+ */
+Status setDatabaseBatch(const std::string& domain,
+                        const DatabaseStringValueList& data);
+
+/**
+ * @brief Get several values from the active osquery DatabasePlugin storage.
+ *
+ * See DatabasePlugin::getBatch, a missing key has an empty value.
+ *
+ * @param domain A string value representing abstract storage indexing.
+ * @param keys The keys to retrieve.
+ * @param values The output values, in the order of keys.
+ * @return Storage operation status.
+ */
+Status getDatabaseBatch(const std::string& domain,
+                        const std::vector<std::string>& keys,
+                        std::vector<std::string>& values);
+
 /// Remove a domain/key identified value from backing-store.
 Status deleteDatabaseValue(const std::string& domain, const std::string& key);
 
+/// Remove several keys from backing-store, see DatabasePlugin::removeBatch.
+Status deleteDatabaseBatch(const std::string& domain,
+                           const std::vector<std::string>& keys);
+
+/// Remove the keys from low (inclusive) to high (exclusive), see removeRange.
+Status deleteDatabaseRange(const std::string& domain,
+                           const std::string& low,
+                           const std::string& high);
+
 /// Get a list of keys for a given domain.
 Status scanDatabaseKeys(const std::string& domain,
                         std::vector<std::string>& keys,
                         size_t max = 0);
 
+/// Get the active DatabasePlugin's statistics, see DatabasePlugin::statistics.
+Status getDatabaseStatistics(std::map<std::string, std::string>& stats);
+
 /// Get a list of keys for a given domain.
 Status scanDatabaseKeys(const std::string& domain,
                         std::vector<std::string>& keys,
                         const std::string& prefix,
                         size_t max = 0);
 
+/// Call a function for each key with a prefix, see DatabasePlugin::scan.
+Status scanDatabaseKeys(const std::string& domain,
+                        const std::string& prefix,
+                        const DatabaseScanCallback& callback,
+                        size_t max = 0);
+
 /// Allow callers to scan each column family and print each value.
 void dumpDatabase();
 }
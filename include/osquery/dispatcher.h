@@ -25,6 +25,33 @@ namespace osquery {
 
 class Dispatcher;
 
+/**
+ * @brief The role of a daemon thread.
+ *
+ * Each class may be given a CPU and I/O scheduling policy with the
+ * thread_classes flag, so bulk work yields to event handling and to the
+ * host's workloads.
+ */
+enum ThreadClass {
+  /// Threads without a role keep the scheduling they are created with.
+  THREAD_CLASS_DEFAULT = 0,
+
+  /// Event publisher run loops and event dispatch.
+  THREAD_CLASS_EVENTS,
+
+  /// The scheduler, its workers, and distributed queries.
+  THREAD_CLASS_SCHEDULE,
+
+  /// Logger forwarders and flushers.
+  THREAD_CLASS_LOGGER,
+
+  /// Hashing, scanning, cache reconciliation, and expiration.
+  THREAD_CLASS_BULK,
+};
+
+/// Apply the configured policy of a thread class to the calling thread.
+void setThreadClass(ThreadClass thread_class);
+
 /// A throw/catch relay between a pause request and cancel event.
 struct RunnerInterruptError {};
 
@@ -126,6 +153,9 @@ class InternalRunnable : private boost::noncopyable,
   /// The runnable thread may optionally define a stop/interrupt point.
   virtual void stop() {}
 
+  /// The thread's role, its policy is applied before start.
+  virtual ThreadClass threadClass() const { return THREAD_CLASS_DEFAULT; }
+
  private:
   std::atomic<bool> run_{false};
 };
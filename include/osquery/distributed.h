@@ -10,6 +10,7 @@
 
 #pragma once
 
+#include <map>
 #include <string>
 #include <vector>
 
@@ -86,6 +87,19 @@ Status deserializeDistributedQueryRequestJSON(const std::string& json,
 // DistributedQueryResult
 /////////////////////////////////////////////////////////////////////////////
 
+/**
+ * @brief The estimated expense of a distributed query
+ *
+ * See Distributed::estimateCost, estimates are made before the query runs.
+ */
+struct DistributedQueryCost {
+  /// Rows generated by the query's tables.
+  double rows{0};
+
+  /// Milliseconds spent generating the query's tables.
+  double time{0};
+};
+
 /**
  * @brief Small struct containing the results of a distributed query
  */
@@ -95,6 +109,9 @@ struct DistributedQueryResult {
   explicit DistributedQueryResult(const DistributedQueryRequest& req,
                                   const QueryData& res)
       : request(req), results(res) {}
+  explicit DistributedQueryResult(const DistributedQueryRequest& req,
+                                  QueryData&& res)
+      : request(req), results(std::move(res)) {}
 
   /// equals operator
   bool operator==(const DistributedQueryResult& comp) const {
@@ -103,6 +120,24 @@ struct DistributedQueryResult {
 
   DistributedQueryRequest request;
   QueryData results;
+
+  /// True if the results are written in several parts, see chunk.
+  bool chunked{false};
+
+  /// The index of this part of the results.
+  size_t chunk{0};
+
+  /// True if more parts of the results follow this part.
+  bool more{false};
+
+  /// Why the results are incomplete, empty if every row is included.
+  std::string truncated;
+
+  /// Why the query was not executed, empty if it was, see admitQuery.
+  std::string rejected;
+
+  /// The query's estimated expense, set if it was rejected.
+  DistributedQueryCost cost;
 };
 
 /**
@@ -239,7 +274,12 @@ class Distributed {
   /// Serialize result data into a JSON string and clear the results
   Status serializeResults(std::string& json);
 
-  /// Process and execute queued queries
+  /**
+   * @brief Process and execute queued queries
+   *
+   * Queries run concurrently on up to `--distributed_workers` threads and the
+   * results of each query are written as soon as it completes.
+   */
   Status runQueries();
 
  protected:
@@ -247,7 +287,9 @@ class Distributed {
    * @brief Process several queries from a distributed plugin
    *
    * Given a response from a distributed plugin, parse the results and enqueue
-   * them in the internal state of the class
+   * them in the internal state of the class. Requests with the same query as
+   * an earlier request in the work are not enqueued, their ids receive the
+   * earlier request's results.
    *
    * @param work is the string from DistributedPlugin::getQueries
    * @return a Status indicating the success or failure of the operation
@@ -257,9 +299,64 @@ class Distributed {
   /**
    * @brief Pop a request object off of the queries_ member
    *
-   * @return a DistributedQueryRequest object which needs to be executed
+   * @param request is set to the DistributedQueryRequest to execute
+   * @return false if there are no pending requests
+   */
+  bool popRequest(DistributedQueryRequest& request);
+
+  /**
+   * @brief Pop a request and the ids of its deduplicated requests
+   *
+   * @param request is set to the DistributedQueryRequest to execute
+   * @param duplicates is set to the ids also receiving the results
+   * @return false if there are no pending requests
+   */
+  bool popRequest(DistributedQueryRequest& request,
+                  std::vector<std::string>& duplicates);
+
+  /**
+   * @brief Execute a request and queue its results, see addResult.
+   *
+   * Rows are streamed from the query. Results beyond `--distributed_max_rows`
+   * or `--distributed_max_bytes` are truncated, and every
+   * `--distributed_chunk_bytes` of results are written as a part.
+   */
+  void runQuery(DistributedQueryRequest&& request);
+
+  /// Execute a request, queueing a copy of its results for each duplicate id.
+  void runQuery(DistributedQueryRequest&& request,
+                const std::vector<std::string>& duplicates);
+
+  /**
+   * @brief Estimate the expense of a query from its plan
+   *
+   * The planner reports each table the query scans and, for tables with
+   * statistics hints, the rows expected from a scan. Tables used by the
+   * schedule are estimated from their average generation instead, see
+   * Config::tablePerformance. A table constrained by the rows of an outer
+   * table, such as the hash of each file, is counted once per outer row.
    */
-  DistributedQueryRequest popRequest();
+  static Status estimateCost(const std::string& query,
+                             DistributedQueryCost& cost);
+
+  /**
+   * @brief Check a request's estimated expense before executing it
+   *
+   * Queries estimated to generate more rows than
+   * `--distributed_max_estimated_rows`, or to take longer than
+   * `--distributed_max_estimated_time`, are not executed. Queries that
+   * cannot be planned are admitted, they fail when executed.
+   *
+   * @param request the request to check.
+   * @param cost output, the estimate, if one was needed.
+   * @return a failed status, "rejected: too expensive", if not admitted.
+   */
+  static Status admitQuery(const DistributedQueryRequest& request,
+                           DistributedQueryCost& cost);
+
+  /// Serialize a set of results, see serializeResults.
+  static Status serializeResults(
+      const std::vector<DistributedQueryResult>& results, std::string& json);
 
   /**
    * @brief Queue a result to be batch sent to the server
@@ -268,6 +365,14 @@ class Distributed {
    */
   void addResult(const DistributedQueryResult& result);
 
+  /// Queue a result and a copy for each of the duplicate request ids.
+  void addResult(const DistributedQueryResult& result,
+                 const std::vector<std::string>& duplicates);
+
+  /// See addResult, the result is moved into the queue then copied.
+  void addResult(DistributedQueryResult&& result,
+                 const std::vector<std::string>& duplicates);
+
   /**
    * @brief Flush all of the collected results to the server
    */
@@ -277,8 +382,15 @@ class Distributed {
   std::vector<DistributedQueryRequest> queries_;
   std::vector<DistributedQueryResult> results_;
 
+  /// The ids of deduplicated requests, by the id of the executed request.
+  std::map<std::string, std::vector<std::string>> duplicates_;
+
  private:
   friend class DistributedTests;
   FRIEND_TEST(DistributedTests, test_workflow);
+  FRIEND_TEST(DistributedTests, test_run_query);
+  FRIEND_TEST(DistributedTests, test_run_query_limits);
+  FRIEND_TEST(DistributedTests, test_deduplicate_queries);
+  FRIEND_TEST(DistributedTests, test_admit_query);
 };
 }
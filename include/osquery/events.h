@@ -11,7 +11,11 @@
 #pragma once
 
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <functional>
+#include <limits>
 #include <map>
 #include <memory>
 #include <mutex>
@@ -19,6 +23,7 @@
 #include <vector>
 
 #include <osquery/core.h>
+#include <osquery/database.h>
 #include <osquery/dispatcher.h>
 #include <osquery/registry.h>
 #include <osquery/status.h>
@@ -31,6 +36,7 @@ template <class SC, class EC>
 class EventPublisher;
 template <class PUB>
 class EventSubscriber;
+class EventSubscriberPlugin;
 class EventFactory;
 
 using EventPublisherID = const std::string;
@@ -154,6 +160,9 @@ struct Subscription : private boost::noncopyable {
   /// An EventSubscription member EventCallback method.
   EventCallback callback;
 
+  /// The named EventSubscriber, resolved when the subscription is added.
+  EventSubscriberRef subscriber;
+
   explicit Subscription(EventSubscriberID& name) : subscriber_name(name){};
 
   static SubscriptionRef create(EventSubscriberID& name) {
@@ -213,6 +222,16 @@ class EventPublisherPlugin : public Plugin, public InterruptableRunnable {
    */
   virtual Status run() { return Status(1, "No run loop required"); }
 
+  /**
+   * @brief A descriptor that is readable when `run` has events to read.
+   *
+   * With --events_reactor, publishers returning a descriptor do not get a run
+   * loop thread. A shared reactor thread waits on all of their descriptors
+   * and calls `run` when a descriptor is readable. Publishers that need `run`
+   * called periodically, e.g. to expire state, should return -1.
+   */
+  virtual int getDescriptor() const { return -1; }
+
   /**
    * @brief Allow the EventFactory to interrupt the run loop.
    *
@@ -232,7 +251,9 @@ class EventPublisherPlugin : public Plugin, public InterruptableRunnable {
    * @return If the Subscription is not appropriate (mismatched type) fail.
    */
   virtual Status addSubscription(const SubscriptionRef& subscription) {
+    WriteLock lock(subscriptions_lock_);
     subscriptions_.push_back(subscription);
+    publishSubscriptions();
     return Status(0);
   }
 
@@ -289,17 +310,57 @@ class EventPublisherPlugin : public Plugin, public InterruptableRunnable {
    */
   virtual void fire(const EventContextRef& ec, EventTime time = 0) final;
 
+  /**
+   * @brief Fire a batch of EventContext%s read together by the publisher.
+   *
+   * Equivalent to calling `fire` for each, in order, but the subscriptions
+   * and their subscribers are resolved once for the batch and every event
+   * shares the batch's default time.
+   *
+   * @param ecs The EventContext%s created by the EventPublisher.
+   * @param time The most accurate time associated with the events.
+   */
+  void fireBatch(const std::vector<EventContextRef>& ecs, EventTime time = 0);
+
   /// The internal fire method used by the typed EventPublisher.
   virtual void fireCallback(const SubscriptionRef& sub,
                             const EventContextRef& ec) const = 0;
 
+  /// Call fireCallback, attributing its allocations to the subscriber.
+  void fireAccounted(EventSubscriberPlugin* subscriber,
+                     const SubscriptionRef& sub,
+                     const EventContextRef& ec) const;
+
+  /**
+   * @brief Replace the subscriptions used by fire with a copy of the current.
+   *
+   * Call with the subscriptions lock held after changing subscriptions_.
+   * The fire method reads the published copy without locking.
+   */
+  void publishSubscriptions() {
+    std::atomic_store(&fire_subscriptions_,
+                      std::make_shared<const SubscriptionVector>(subscriptions_));
+  }
+
   /// The EventPublisher will keep track of Subscription%s that contain callins.
   SubscriptionVector subscriptions_;
 
+  /// A lock for changing the subscriptions.
+  Mutex subscriptions_lock_;
+
   /// An Event ID is assigned by the EventPublisher within the EventContext.
   /// This is not used to store event date in the backing store.
   std::atomic<EventContextID> next_ec_id_{0};
 
+ private:
+  /// Assign the next EventContext ID, and a time if the event has none.
+  void stampEvent(const EventContextRef& ec, EventTime time);
+
+  /// Queue or call a subscriber's callback for a fired event.
+  void dispatchEvent(BaseEventSubscriber* es,
+                     const SubscriptionRef& subscription,
+                     const EventContextRef& ec);
+
  private:
   /// Set ending to True to cause event type run loops to finish.
   std::atomic<bool> ending_{false};
@@ -307,8 +368,9 @@ class EventPublisherPlugin : public Plugin, public InterruptableRunnable {
   /// Set to indicate whether the event run loop ever started.
   std::atomic<bool> started_{false};
 
-  /// A lock for incrementing the next EventContextID.
-  std::mutex ec_id_lock_;
+  /// The subscriptions fire enumerates, replaced whenever they change.
+  std::shared_ptr<const SubscriptionVector> fire_subscriptions_{
+      std::make_shared<const SubscriptionVector>()};
 
   /// A helper count of event publisher runloop iterations.
   std::atomic<size_t> restart_count_{0};
@@ -317,9 +379,162 @@ class EventPublisherPlugin : public Plugin, public InterruptableRunnable {
   /// Enable event factory "callins" through static publisher callbacks.
   friend class EventFactory;
 
+  /// Queued events are dispatched through fireCallback.
+  friend class EventDispatchQueue;
+
  private:
   FRIEND_TEST(EventsTests, test_event_publisher);
   FRIEND_TEST(EventsTests, test_fire_event);
+  FRIEND_TEST(EventsTests, test_fire_allocations);
+};
+
+/**
+ * @brief A bounded queue of fired events serviced by its own thread.
+ *
+ * An EventSubscriber may use a dispatch queue to run its callbacks outside of
+ * the publisher's thread, see --events_queue_size. Publishers push events and
+ * a single thread pops them and calls the publisher's fireCallback. When the
+ * queue is full the publisher either blocks or the event is dropped.
+ */
+class EventDispatchQueue : private boost::noncopyable {
+ public:
+  /// Create a queue holding up to capacity events and start its thread.
+  EventDispatchQueue(size_t capacity, bool block);
+
+  /// Stopping dispatches all queued events.
+  ~EventDispatchQueue() { stop(); }
+
+  /**
+   * @brief Queue an event fired by a publisher for a subscription.
+   *
+   * The subscriber, if known, is credited with the callback's allocations.
+   *
+   * @return false if the queue was full (or stopped) and the event dropped.
+   */
+  bool push(const EventPublisherPlugin* publisher,
+            const SubscriptionRef& subscription,
+            const EventContextRef& ec,
+            EventSubscriberPlugin* subscriber = nullptr);
+
+  /// Dispatch the remaining events, then stop the queue's thread.
+  void stop();
+
+  /// The number of events waiting to be dispatched.
+  size_t depth() const;
+
+  /// The number of events dropped because the queue was full.
+  size_t drops() const { return drops_; }
+
+ private:
+  /// The queue thread's loop, popping and dispatching events.
+  void run();
+
+ private:
+  /// Everything needed to call the publisher's fireCallback.
+  struct QueuedEvent {
+    const EventPublisherPlugin* publisher{nullptr};
+    EventSubscriberPlugin* subscriber{nullptr};
+    SubscriptionRef subscription;
+    EventContextRef context;
+  };
+
+  /// A fixed ring of queued events.
+  std::vector<QueuedEvent> ring_;
+
+  /// Index of the oldest queued event.
+  size_t head_{0};
+
+  /// Number of queued events.
+  size_t size_{0};
+
+  /// Publishers wait for space rather than drop events.
+  bool block_{false};
+
+  /// Set when the queue is stopping, no new events are accepted.
+  bool stopping_{false};
+
+  /// Protects the ring and stopping state.
+  mutable Mutex mutex_;
+
+  /// Signaled when an event is pushed or the queue is stopping.
+  std::condition_variable not_empty_;
+
+  /// Signaled when an event is popped or the queue is stopping.
+  std::condition_variable not_full_;
+
+  /// Count of events dropped.
+  std::atomic<size_t> drops_{0};
+
+  /// The dispatching thread.
+  std::thread thread_;
+};
+
+/// A column's expected value, matched by prefix if configured with a '%'.
+struct EventFilterMatch {
+  std::string column;
+  std::string value;
+  bool prefix{false};
+};
+
+/// An event matches a filter if it matches each of the filter's columns.
+using EventFilter = std::vector<EventFilterMatch>;
+
+/// A subscriber with filters only stores events matching one of them.
+using EventFilterList = std::vector<EventFilter>;
+
+/**
+ * @brief Deliver only new events to a scheduled query while in scope.
+ *
+ * The scheduler runs a query with the "watermark" option within a scope.
+ * Each subscriber table the query selects without a 'time' constraint then
+ * returns only the events with an EventID above the query's watermark for
+ * that subscriber. Watermarks are read once per scope, such that a table
+ * scanned several times by one query returns the same events each time, and
+ * are only advanced by commit, once the results were logged.
+ *
+ * Watermarks are stored as 'watermark.<namespace>.<query>' in kEvents.
+ */
+class EventWatermarkScope : private boost::noncopyable {
+ public:
+  explicit EventWatermarkScope(const std::string& query);
+  ~EventWatermarkScope();
+
+  /// Store the EventIDs delivered within this scope as the new watermarks.
+  Status commit();
+
+  /// The scope active for the calling thread, or nullptr.
+  static EventWatermarkScope* current();
+
+ private:
+  struct Watermark {
+    /// The last EventID delivered before this scope.
+    size_t eid{0};
+
+    /// The time of the scope that delivered up to eid.
+    EventTime time{0};
+
+    /// The largest EventID delivered within this scope.
+    size_t delivered{0};
+  };
+
+  /// Get a subscriber's watermark, read from the backing store once.
+  Watermark& get(const std::string& db_namespace);
+
+ private:
+  /// The scheduled query name.
+  std::string query_;
+
+  /// The time this scope began, stored with each new watermark.
+  EventTime time_{0};
+
+  /// Watermarks keyed by subscriber namespace.
+  std::map<std::string, Watermark> watermarks_;
+
+  /// The scope this scope replaced for the calling thread.
+  EventWatermarkScope* previous_{nullptr};
+
+ private:
+  friend class EventSubscriberPlugin;
 };
 
 class EventSubscriberPlugin : public Plugin {
@@ -362,6 +577,20 @@ class EventSubscriberPlugin : public Plugin {
   virtual QueryData get(EventTime start, EventTime stop) final;
 
  private:
+  /**
+   * @brief Return the events within start, stop with an EventID after a mark.
+   *
+   * @param start Inclusive lower bound time limit.
+   * @param stop Inclusive upper bound time limit.
+   * @param after Only return EventIDs greater than this, 0 returns all.
+   * @param last Optional output, raised to the largest EventID returned.
+   * @return Set of event rows matching time limits.
+   */
+  QueryData getEvents(EventTime start,
+                      EventTime stop,
+                      size_t after,
+                      size_t* last);
+
   /*
    * @brief When `get`ing event results, return EventID%s from time indexes.
    *
@@ -386,6 +615,10 @@ class EventSubscriberPlugin : public Plugin {
    * indexing is required within-EventCallback consider an
    * EventSubscriber%-unique indexing, counting mechanic.
    *
+   * IDs are allocated from an in-memory counter. The backing store only holds
+   * the end of the current lease, a block of IDs written before any is used,
+   * such that a restarted subscriber continues after the lease.
+   *
    * @return A unique ID for backing storage.
    */
   EventID getEventID();
@@ -448,6 +681,84 @@ class EventSubscriberPlugin : public Plugin {
    */
   Status recordEvent(EventID& eid, EventTime time);
 
+  /**
+   * @brief Select events within a time range from time-ordered keys.
+   *
+   * With events_time_keys each event is stored once, as
+   * 'event.<namespace>.<time>.<eid>', so a time range is a key prefix scan
+   * and no index or record lists are maintained.
+   *
+   * @param start an inclusive time to begin searching.
+   * @param stop an inclusive time to end searching.
+   * @param after only return EventIDs greater than this, 0 returns all.
+   * @param last optional output, raised to the largest EventID returned.
+   *
+   * @return Set of event rows matching time limits.
+   */
+  QueryData getTimeKeys(EventTime start,
+                        EventTime stop,
+                        size_t after = 0,
+                        size_t* last = nullptr);
+
+  /// Expire time-ordered keys before the expire time or beyond events_max.
+  void expireTimeKeys();
+
+  /**
+   * @brief Add a time-ordered event to the subscriber's write buffer.
+   *
+   * The buffer is written as a single batch once it holds events_batch_size
+   * events or its oldest event has waited events_batch_milli.
+   */
+  Status bufferEvent(const std::string& key, std::string& data);
+
+  /// Write the subscriber's buffered events, see bufferEvent.
+  Status flushEvents();
+
+  /**
+   * @brief Keep a copy of an added event in the subscriber's hot tier.
+   *
+   * With events_hot_size the most recent events are also kept in memory as
+   * rows, the oldest is evicted once the tier is full. The backing store
+   * remains the durable copy and serves selects the tier cannot.
+   */
+  void addHotEvent(size_t eid, EventTime time, const Row& r);
+
+  /**
+   * @brief Select events from the hot tier.
+   *
+   * @param start an inclusive time to begin searching.
+   * @param stop an inclusive time to end searching.
+   * @param after only return EventIDs greater than this, 0 returns all.
+   * @param last optional output, raised to the largest EventID returned.
+   * @param results output, the selected events.
+   *
+   * @return false if events since start may have been evicted or were added
+   * before the tier began, the backing store must be read instead.
+   */
+  bool getHotEvents(EventTime start,
+                    EventTime stop,
+                    size_t after,
+                    size_t* last,
+                    QueryData& results);
+
+  /**
+   * @brief Encode an event row for storage.
+   *
+   * Rows are stored as a binary list of column IDs and values with varint
+   * lengths. Column IDs index the subscriber's column dictionary, stored as
+   * 'columns.<namespace>', which only ever has names appended.
+   */
+  Status encodeRow(const Row& r, std::string& data);
+
+  /// Decode a stored event row, rows stored as JSON are also accepted.
+  Status decodeRow(const std::string& data, Row& r);
+
+  /// Get the ID of a column name, adding it to the dictionary if needed.
+  size_t getColumnID(const std::string& name);
+
+  /// Read the column dictionary from the backing store once.
+  void loadColumns();
+
   /**
    * @brief Get the expiration timeout for this event type
    *
@@ -500,6 +811,49 @@ class EventSubscriberPlugin : public Plugin {
   /// The number of events this EventSubscriber has received.
   EventContextID numEvents() const { return event_count_; }
 
+  /// The number of events dropped by this EventSubscriber's filters.
+  size_t numFiltered() const { return filtered_count_; }
+
+  /// The number of events written to the backing store.
+  size_t numStored() const { return stored_count_; }
+
+  /// Heap allocations made by this EventSubscriber's callbacks.
+  unsigned long long numAllocations() const { return allocation_count_; }
+
+  /// Bytes of heap allocations made by this EventSubscriber's callbacks.
+  unsigned long long allocatedBytes() const { return allocated_bytes_; }
+
+  /**
+   * @brief Replace the filters applied to events before they are stored.
+   *
+   * See the "filters" key of the "events" configuration, an empty list keeps
+   * every event.
+   */
+  void setFilters(const EventFilterList& filters) {
+    std::atomic_store(&filters_,
+                      std::make_shared<const EventFilterList>(filters));
+  }
+
+  /// The filters applied to events before they are stored.
+  std::shared_ptr<const EventFilterList> getFilters() const {
+    return std::atomic_load(&filters_);
+  }
+
+  /**
+   * @brief The number of events waiting in this EventSubscriber's queues.
+   *
+   * This includes the dispatch queue, and may include the subscriber's own
+   * work queue if it defers work from its callbacks.
+   */
+  virtual size_t queueDepth() const {
+    return (dispatch_queue_ != nullptr) ? dispatch_queue_->depth() : 0;
+  }
+
+  /// The number of events dropped by this EventSubscriber's queues.
+  virtual size_t queueDrops() const {
+    return (dispatch_queue_ != nullptr) ? dispatch_queue_->drops() : 0;
+  }
+
  private:
   explicit EventSubscriberPlugin(EventSubscriberPlugin const&) = delete;
   EventSubscriberPlugin& operator=(EventSubscriberPlugin const&) = delete;
@@ -521,6 +875,9 @@ class EventSubscriberPlugin : public Plugin {
   /// Disable event expiration for this subscriber.
   void doNotExpire() { expire_events_ = false; }
 
+  /// Check an event row against the configured filters before it is added.
+  bool keepEvent(const Row& r) const;
+
   /// Trampoline into the EventFactory and lookup the name of the publisher.
   virtual EventPublisherID& getType() const = 0;
 
@@ -548,7 +905,69 @@ class EventSubscriberPlugin : public Plugin {
   EventTime expire_time_{0};
 
   /// Cached value of last generated EventID.
-  size_t last_eid_{0};
+  std::atomic<size_t> last_eid_{0};
+
+  /// The last EventID leased, persisted as the subscriber's "eid." key.
+  std::atomic<size_t> eid_lease_{0};
+
+  /// Serialized events waiting for a batched write, see bufferEvent.
+  DatabaseStringValueList event_buffer_;
+
+  /// When the oldest buffered event was added.
+  std::chrono::steady_clock::time_point event_buffer_time_;
+
+  /// Lock used when buffering or writing buffered events.
+  Mutex event_buffer_lock_;
+
+  /// A recent event kept in memory, see addHotEvent.
+  struct HotEvent {
+    size_t eid;
+    EventTime time;
+    Row row;
+  };
+
+  /// The hot tier, in EventID order.
+  std::deque<HotEvent> hot_events_;
+
+  /**
+   * @brief Every event with a time after this is in the hot tier.
+   *
+   * This is the time the tier began, raised to the time of each evicted
+   * event. Until the first event is kept no select is served from memory.
+   */
+  EventTime hot_floor_{std::numeric_limits<EventTime>::max()};
+
+  /// Lock used when adding, evicting, or selecting hot events.
+  Mutex hot_lock_;
+
+  /// Column names by the ID used to encode event rows.
+  std::vector<std::string> columns_;
+
+  /// Column IDs by name, the inverse of columns_.
+  std::map<std::string, size_t> column_ids_;
+
+  /// True once the column dictionary was read from the backing store.
+  bool columns_loaded_{false};
+
+  /// Lock used when reading or adding to the column dictionary.
+  Mutex column_lock_;
+
+  /// Optional queue running callbacks off the publisher thread.
+  std::unique_ptr<EventDispatchQueue> dispatch_queue_;
+
+  /// Configured filters, replaced as a whole when the configuration changes.
+  std::shared_ptr<const EventFilterList> filters_{
+      std::make_shared<const EventFilterList>()};
+
+  /// A count of events dropped by the filters.
+  std::atomic<size_t> filtered_count_{0};
+
+  /// A count of events written to the backing store, after any buffering.
+  std::atomic<size_t> stored_count_{0};
+
+  /// Allocations counted while running callbacks, see fireAccounted.
+  std::atomic<unsigned long long> allocation_count_{0};
+  std::atomic<unsigned long long> allocated_bytes_{0};
 
   /**
    * @brief Optimize subscriber selects by tracking the last select time.
@@ -571,11 +990,20 @@ class EventSubscriberPlugin : public Plugin {
 
  private:
   FRIEND_TEST(EventsDatabaseTests, test_event_module_id);
+  FRIEND_TEST(EventsDatabaseTests, test_event_id_lease);
   FRIEND_TEST(EventsDatabaseTests, test_record_indexing);
   FRIEND_TEST(EventsDatabaseTests, test_record_range);
   FRIEND_TEST(EventsDatabaseTests, test_record_expiration);
   FRIEND_TEST(EventsDatabaseTests, test_gentable);
   FRIEND_TEST(EventsDatabaseTests, test_expire_check);
+  FRIEND_TEST(EventsDatabaseTests, test_time_keys);
+  FRIEND_TEST(EventsDatabaseTests, test_time_keys_expiration);
+  FRIEND_TEST(EventsDatabaseTests, test_event_batching);
+  FRIEND_TEST(EventsDatabaseTests, test_row_encoding);
+  FRIEND_TEST(EventsDatabaseTests, test_gentable_time_constraints);
+  FRIEND_TEST(EventsDatabaseTests, test_event_filters);
+  FRIEND_TEST(EventsDatabaseTests, test_gentable_watermark);
+  FRIEND_TEST(EventsDatabaseTests, test_hot_events);
   friend class BenchmarkEventSubscriber;
 };
 
@@ -705,13 +1133,31 @@ class EventFactory : private boost::noncopyable {
   /// Optionally forward events to loggers.
   static void forwardEvent(const std::string& event);
 
+  /// Check if any logger receives forwarded events.
+  static bool hasForwarders();
+
  public:
   /// The dispatched event thread's entry-point (if needed).
   static Status run(EventPublisherID& type_id);
 
+  /**
+   * @brief The reactor thread's entry-point for descriptor-based publishers.
+   *
+   * @param reactor An epoll descriptor, closed when the reactor ends.
+   * @param type_ids The publishers whose descriptors were added to the
+   * reactor, the epoll event data is the index of the publisher.
+   */
+  static Status react(int reactor, std::vector<std::string> type_ids);
+
   /// An initializer's entry-point for spawning all event type run loops.
   static void delay();
 
+  /// Apply event expiration for each running subscriber.
+  static void expire();
+
+  /// Apply the configured event filters to each registered subscriber.
+  static void configureFilters();
+
   /// If a static EventPublisher callback wants to fire
   template <typename PUB>
   static void fire(const EventContextRef& ec) {
@@ -719,6 +1165,13 @@ class EventFactory : private boost::noncopyable {
     event_pub->fire(ec);
   }
 
+  /// If a static EventPublisher callback wants to fire a batch of events.
+  template <typename PUB>
+  static void fireBatch(const std::vector<EventContextRef>& ecs) {
+    auto event_pub = getEventPublisher(getType<PUB>());
+    event_pub->fireBatch(ecs);
+  }
+
   /**
    * @brief Return the publisher registry name given a type.
    *
@@ -868,6 +1321,7 @@ class EventPublisher : public EventPublisherPlugin {
   FRIEND_TEST(EventsTests, test_event_subscriber_subscribe);
   FRIEND_TEST(EventsTests, test_event_subscriber_context);
   FRIEND_TEST(EventsTests, test_fire_event);
+  FRIEND_TEST(EventsTests, test_fire_allocations);
 };
 
 /**
@@ -136,6 +136,52 @@ Status callExtension(const std::string& extension_path,
                      const PluginRequest& request,
                      PluginResponse& response);
 
+/**
+ * @brief Generate a table exposed by an Extension as typed columns.
+ *
+ * Extensions built with an SDK that does not support columnar responses fail
+ * this call and are not asked again, callers should fall back to
+ * callExtension with the same request.
+ *
+ * @param uuid Route UUID of the matched Extension
+ * @param table The table name.
+ * @param request The table plugin "generate" request.
+ * @param results The typed table results.
+ */
+Status callExtensionColumns(const RouteUUID uuid,
+                            const std::string& table,
+                            const PluginRequest& request,
+                            ColumnarData& results);
+
+/// Internal callExtensionColumns implementation using a UNIX domain socket.
+Status callExtensionColumns(const std::string& extension_path,
+                            const std::string& table,
+                            const PluginRequest& request,
+                            ColumnarData& results);
+
+/**
+ * @brief Open a cursor reading a table exposed by an Extension in batches.
+ *
+ * Each batch is requested as the returned generator is read, destroying the
+ * generator closes the cursor. Extensions that do not support cursors fail
+ * this call, callers should fall back to callExtensionColumns.
+ *
+ * @param uuid Route UUID of the matched Extension
+ * @param table The table name.
+ * @param request The table plugin "generate" request.
+ * @param batches The output batch generator.
+ */
+Status callExtensionCursor(const RouteUUID uuid,
+                           const std::string& table,
+                           const PluginRequest& request,
+                           ColumnarGeneratorRef& batches);
+
+/// Internal callExtensionCursor implementation using a UNIX domain socket.
+Status callExtensionCursor(const std::string& extension_path,
+                           const std::string& table,
+                           const PluginRequest& request,
+                           ColumnarGeneratorRef& batches);
+
 /// The main runloop entered by an Extension, start an ExtensionRunner thread.
 Status startExtension(const std::string& name, const std::string& version);
 
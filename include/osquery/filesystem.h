@@ -17,6 +17,7 @@
 
 #include <boost/filesystem/path.hpp>
 #include <boost/property_tree/ptree.hpp>
+#include <boost/utility/string_ref.hpp>
 
 #include <osquery/status.h>
 
@@ -79,6 +80,30 @@ Status readFile(
     bool preserve_time,
     std::function<void(std::string& buffer, size_t size)> predicate);
 
+/**
+ * @brief Read a file's content in place, without copying it into a string.
+ *
+ * The predicate is called once with the whole content of a regular file.
+ * Large files are mapped read-only, smaller files and files that cannot be
+ * mapped are read into a buffer. Special files are read in block_size parts
+ * into a single reused buffer. The spans are only valid during the
+ * predicate. The read limits of readFile apply.
+ *
+ * A file truncated while it is mapped reads as zeros past the new end and
+ * the read fails.
+ *
+ * @param path the path of the file that you would like to read.
+ * @param block_size the size of each part of a special file.
+ * @param preserve_time restore the atime and mtime after reading.
+ * @param predicate called with each span of content, in order.
+ *
+ * @return an instance of Status, indicating success or failure.
+ */
+Status readFileView(const boost::filesystem::path& path,
+                    size_t block_size,
+                    bool preserve_time,
+                    std::function<void(boost::string_ref content)> predicate);
+
 /**
  * @brief Write text to disk.
  *
@@ -100,6 +125,17 @@ Status isWritable(const boost::filesystem::path& path);
 /// Check if a path is readable.
 Status isReadable(const boost::filesystem::path& path);
 
+/**
+ * @brief Get a key that changes whenever a regular file's content may change.
+ *
+ * A file whose device, inode, size, and modification and change times are
+ * unchanged is assumed to have unchanged content. Any write updates the
+ * change time, including one that restores the modification time.
+ *
+ * @return false if the path is not a regular file.
+ */
+bool getFileChangeKey(const boost::filesystem::path& path, std::string& key);
+
 /**
  * @brief A helper to check if a path exists on disk or not.
  *
@@ -290,6 +326,8 @@ Status parsePlistContent(const std::string& content,
 /**
  * @brief Iterate over `/proc` process, returns a list of pids.
  *
+ * The list is shared for `--proc_snapshot_ttl` milliseconds.
+ *
  * @param processes output list of process pids as strings (int paths in proc).
  *
  * @return an instance of Status, indicating success or failure.
@@ -66,6 +66,7 @@ enum LoggerFeatures {
   LOGGER_FEATURE_BLANK = 0,
   LOGGER_FEATURE_LOGSTATUS = 1,
   LOGGER_FEATURE_LOGEVENT = 2,
+  LOGGER_FEATURE_LOGSTRINGS = 4,
 };
 
 /**
@@ -157,6 +158,24 @@ class LoggerPlugin : public Plugin {
    */
   virtual Status logString(const std::string& s) = 0;
 
+  /**
+   * @brief Optionally log several strings at once.
+   *
+   * The lines of an event-formatted query log item are forwarded together.
+   * Loggers with a per-write cost may write them in one operation, otherwise
+   * each string is forwarded to logString.
+   *
+   * @param strings The strings, in order.
+   * @return log status of the last string logged.
+   */
+  virtual Status logStrings(const std::vector<std::string>& strings) {
+    Status status;
+    for (const auto& s : strings) {
+      status = logString(s);
+    }
+    return status;
+  }
+
   /**
    * @brief Initialize the logger with the name of the binary and any status
    * logs generated between program launch and logger start.
@@ -264,6 +283,23 @@ Status logString(const std::string& message,
                  const std::string& category,
                  const std::string& receiver);
 
+/**
+ * @brief Log several strings using a specific logger receiver.
+ *
+ * Loggers, including extension loggers, that report the LOGSTRINGS feature
+ * receive every string with one registry call. Other loggers receive each
+ * string as if logString was called.
+ *
+ * @param messages the strings to log, without newlines
+ * @param category a category/metadata key
+ * @param receiver a string representing the log receiver to use
+ *
+ * @return Status indicating the success or failure of the operation
+ */
+Status logStrings(const std::vector<std::string>& messages,
+                  const std::string& category,
+                  const std::string& receiver);
+
 /**
  * @brief Log results of scheduled queries to the default receiver
  *
@@ -283,6 +319,18 @@ Status logQueryLogItem(const QueryLogItem& item);
  */
 Status logQueryLogItem(const QueryLogItem& item, const std::string& receiver);
 
+/**
+ * @brief Log results of scheduled queries, releasing them once serialized
+ *
+ * The item's rows are freed before the loggers are called, which may buffer
+ * or forward the serialized lines.
+ *
+ * @param item a struct representing the results of a scheduled query
+ *
+ * @return Status indicating the success or failure of the operation
+ */
+Status logQueryLogItem(QueryLogItem&& item);
+
 /**
  * @brief Log raw results from a query (or a snapshot scheduled query).
  *
@@ -292,6 +340,9 @@ Status logQueryLogItem(const QueryLogItem& item, const std::string& receiver);
  */
 Status logSnapshotQuery(const QueryLogItem& item);
 
+/// See logSnapshotQuery, the item's rows are freed once serialized.
+Status logSnapshotQuery(QueryLogItem&& item);
+
 /**
  * @brief Sink a set of buffered status logs.
  *
@@ -18,6 +18,7 @@
 #include <boost/property_tree/ptree.hpp>
 #include <boost/noncopyable.hpp>
 
+#include <osquery/core.h>
 #include <osquery/database.h>
 
 namespace osquery {
@@ -41,13 +42,21 @@ class Pack : private boost::noncopyable {
       : Pack(name, "", tree) {}
   Pack(const std::string& name,
        const std::string& source,
-       const boost::property_tree::ptree& tree) {
-    initialize(name, source, tree);
+       const boost::property_tree::ptree& tree,
+       const Pack* previous = nullptr) {
+    initialize(name, source, tree, previous);
   }
 
+  /**
+   * @brief Parse the pack content.
+   *
+   * When the pack replaces a previous version, queries with an unchanged
+   * definition keep their splayed interval and offset.
+   */
   void initialize(const std::string& name,
                   const std::string& source,
-                  const boost::property_tree::ptree& tree);
+                  const boost::property_tree::ptree& tree,
+                  const Pack* previous = nullptr);
   /**
    * @brief Getter for the pack's discovery query
    *
@@ -94,7 +103,12 @@ class Pack : private boost::noncopyable {
   /// Verify that a given version string is compatible
   bool checkVersion(const std::string& version) const;
 
-  /// Verify that a given discovery query returns the appropriate results
+  /**
+   * @brief Verify that each discovery query returns results.
+   *
+   * The results are shared by all packs, see PackDiscovery. A check is a
+   * cache miss if it executed a discovery query.
+   */
   bool checkDiscovery();
 
   const PackStats& getStats() const;
@@ -121,15 +135,16 @@ class Pack : private boost::noncopyable {
   /// Name of config source that created/added this pack.
   std::string source_;
 
-  /// Cached time and result from previous discovery step.
-  std::pair<size_t, bool> discovery_cache_;
-
   /// Aggregate appropriateness of pack for this host.
   std::atomic<bool> valid_{false};
 
   /// Pack discovery statistics.
   PackStats stats_;
 
+ private:
+  /// The config may level the schedule's splayed offsets.
+  friend class Config;
+
  private:
   /**
    * @brief Private default constructor
@@ -142,6 +157,81 @@ class Pack : private boost::noncopyable {
   FRIEND_TEST(PacksTests, test_check_platform);
 };
 
+/**
+ * @brief Discovery query results shared by every pack.
+ *
+ * Packs commonly repeat the same discovery queries. Each distinct query is
+ * executed at most once per pack_refresh_interval and its result is used by
+ * every pack with the query. A query without a result is executed when it is
+ * first checked. Once the discovery service is started, see
+ * startPackDiscovery, expired results are re-executed in the background and
+ * checks use the previous result until then, so the scheduler does not wait
+ * on discovery.
+ */
+class PackDiscovery : private boost::noncopyable {
+ public:
+  /// The shared discovery results.
+  static PackDiscovery& get();
+
+  /**
+   * @brief Check if a discovery query returns results.
+   *
+   * @param query the discovery query.
+   * @param executed set to true if this check executed the query.
+   * @return true if the query's most recent execution returned rows.
+   */
+  bool check(const std::string& query, bool& executed);
+
+  /**
+   * @brief Concurrently execute every expired query.
+   *
+   * Queries not checked since their previous execution are dropped instead,
+   * as they are no longer used by a pack.
+   */
+  void refresh();
+
+  /// Remove all results.
+  void reset();
+
+  /// Check results without waiting on expired queries.
+  void setBackground(bool background) { background_ = background; }
+
+  /// The number of distinct queries with results.
+  size_t size() const;
+
+ private:
+  /// The most recent execution of a discovery query.
+  struct Result {
+    /// Time of the execution.
+    size_t time{0};
+
+    /// The query returned rows.
+    bool rows{false};
+
+    /// The query was checked since the execution.
+    bool used{true};
+  };
+
+  /// Execute a discovery query, true if it succeeded and returned rows.
+  static bool execute(const std::string& query);
+
+ private:
+  /// Results by query.
+  std::map<std::string, Result> results_;
+
+  /// Expired results are refreshed by the discovery service.
+  std::atomic<bool> background_{false};
+
+  /// Protects results, queries are executed without the lock held.
+  mutable Mutex mutex_;
+
+ private:
+  FRIEND_TEST(PacksTests, test_discovery_shared);
+};
+
+/// Start the service refreshing pack discovery results in the background.
+void startPackDiscovery();
+
 /**
  * @brief Generate a splayed interval.
  *
@@ -170,4 +260,42 @@ size_t splayValue(size_t original, size_t splay_percent);
  * @return either the restored previous calculated splay, or a new splay.
  */
 size_t restoreSplayedValue(const std::string& name, size_t interval);
+
+/**
+ * @brief Choose a splayed offset that levels the expected schedule cost.
+ *
+ * The load is a ring of expected cost per schedule step. Each candidate offset
+ * within the interval is compared by the highest load of the steps where the
+ * query would execute, then by the total load of those steps. The query cost
+ * is added to the load of the chosen steps.
+ *
+ * @param interval the splayed interval in seconds.
+ * @param cost the expected cost of each execution.
+ * @param load the expected cost of each schedule step, modified.
+ * @return the step offset within the interval.
+ */
+size_t splayOffset(size_t interval, size_t cost, std::vector<size_t>& load);
+
+/**
+ * @brief Retrieve a previously-chosen splayed offset for a query name.
+ *
+ * The offset is saved alongside the splayed interval by saveSplayedOffset. It
+ * is only valid if the requested and splayed intervals have not changed.
+ *
+ * @param name the generated query name.
+ * @param interval the requested pre-splayed interval.
+ * @param splay the splayed interval.
+ * @param offset output, the restored offset.
+ * @return true if an offset was restored.
+ */
+bool restoreSplayedOffset(const std::string& name,
+                          size_t interval,
+                          size_t splay,
+                          size_t& offset);
+
+/// Save a chosen splayed offset for a query name, see restoreSplayedOffset.
+void saveSplayedOffset(const std::string& name,
+                       size_t interval,
+                       size_t splay,
+                       size_t offset);
 }
@@ -10,6 +10,8 @@
 
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
 #include <map>
 #include <mutex>
 #include <set>
@@ -19,6 +21,7 @@
 #include <boost/property_tree/ptree.hpp>
 
 #include <osquery/core.h>
+#include <osquery/row.h>
 
 namespace osquery {
 
@@ -106,8 +109,11 @@ namespace osquery {
  * key where the value is the action you want to perform on the plugin.
  * Refer to the registry's documentation for the actions supported by
  * each of its plugins.
+ *
+ * A request is a Row of keys and values, such that a table's QueryData is
+ * also a PluginResponse.
  */
-using PluginRequest = std::map<std::string, std::string>;
+using PluginRequest = Row;
 /**
  * @brief The response part of a plugin (registry item's) call.
  *
@@ -141,6 +147,13 @@ using ModuleInitalizer = void (*)(void);
 /// The registry includes a single optimization for table generation.
 struct QueryContext;
 
+/// Table generation may also use typed, column-major results.
+class ColumnarData;
+class ColumnarGenerator;
+
+/// Table generation may also stream rows.
+class RowGenerator;
+
 template <class PluginItem>
 class PluginFactory {};
 
@@ -393,6 +406,7 @@ class RegistryHelperCore : private boost::noncopyable {
 
  private:
   friend class RegistryFactory;
+  friend class RegistryHandle;
 };
 
 /**
@@ -544,6 +558,97 @@ class RegistryModuleLoader : private boost::noncopyable {
   FRIEND_TEST(RegistryTests, test_registry_modules);
 };
 
+/// A registry item resolved by a RegistryHandle.
+struct RegistryItem {
+  /// The plugin name.
+  std::string name;
+
+  /// The local plugin, nullptr for extension plugins and routes.
+  PluginRef plugin;
+
+  /// The UUID of the extension providing the plugin, or 0.
+  RouteUUID uuid{0};
+};
+
+/**
+ * @brief A registry plugin, or list of plugins, resolved for repeated calls.
+ *
+ * RegistryFactory::call finds the registry by name, and splits a multiplexed
+ * list of plugins, for every call. A handle keeps the resolved registry and
+ * plugins until the registries change, such as when a plugin or extension is
+ * added or removed or an active plugin is set. The logger, database, and
+ * virtual table calls made for every log line, value, and filter use handles.
+ *
+ * A handle may be shared between threads, it is resolved on first use.
+ */
+class RegistryHandle {
+ public:
+  RegistryHandle() {}
+
+  /// Resolve the registry's active plugin, or plugins.
+  explicit RegistryHandle(const std::string& registry_name)
+      : registry_name_(registry_name), active_(true) {}
+
+  /// Resolve a plugin, or a comma-separated list of plugins.
+  RegistryHandle(const std::string& registry_name,
+                 const std::string& item_name)
+      : registry_name_(registry_name), item_name_(item_name) {}
+
+ public:
+  /// Call every resolved plugin, see RegistryFactory::call.
+  Status call(const PluginRequest& request, PluginResponse& response) const;
+
+  /// Call every resolved plugin without a response.
+  Status call(const PluginRequest& request) const;
+
+  /// Call one item from the resolved items.
+  Status call(const RegistryItem& item,
+              const PluginRequest& request,
+              PluginResponse& response) const;
+
+  /// The resolved items.
+  std::vector<RegistryItem> items() const;
+
+  /// The single resolved local plugin, or nullptr.
+  template <class Type>
+  std::shared_ptr<Type> get() const {
+    auto resolved = resolve();
+    if (resolved->multiplex || resolved->items.empty()) {
+      return nullptr;
+    }
+    // Registries only hold plugins of the registry's type.
+    return std::static_pointer_cast<Type>(resolved->items[0].plugin);
+  }
+
+  /// Release the resolved plugins and registry.
+  void reset();
+
+ private:
+  struct Resolved {
+    /// The registries generation when resolved, see RegistryFactory.
+    size_t generation{0};
+
+    PluginRegistryHelperRef registry;
+    std::vector<RegistryItem> items;
+
+    /// Multiplexed calls ignore each plugin's status.
+    bool multiplex{false};
+  };
+
+  /// Return the resolved plugins, resolving again if the registries changed.
+  std::shared_ptr<const Resolved> resolve() const;
+
+ private:
+  std::string registry_name_;
+  std::string item_name_;
+
+  /// True if the handle resolves the registry's active plugin.
+  bool active_{false};
+
+  /// Accessed atomically, a handle may be shared by threads.
+  mutable std::shared_ptr<const Resolved> resolved_;
+};
+
 class RegistryFactory : private boost::noncopyable {
  public:
   static RegistryFactory& instance() {
@@ -578,6 +683,7 @@ class RegistryFactory : private boost::noncopyable {
         (PluginRegistryHelper*)new RegistryHelper<Type>(auto_setup));
     registry->setName(registry_name);
     instance().registries_[registry_name] = registry;
+    invalidate();
     return 0;
   }
 
@@ -631,6 +737,21 @@ class RegistryFactory : private boost::noncopyable {
   /// Given an extension UUID remove all external registry items.
   static Status removeBroadcast(const RouteUUID& uuid);
 
+  /// The number of external registry broadcasts added, see waitForBroadcast.
+  static size_t broadcasts();
+
+  /**
+   * @brief Wait for an extension to add its registry broadcast.
+   *
+   * Extensions register asynchronously, a caller waiting for an extension's
+   * plugin checks again as each registers instead of polling.
+   *
+   * @param seen The broadcasts count when the caller last checked.
+   * @param timeout The most milliseconds to wait.
+   * @return true if a broadcast was added since seen.
+   */
+  static bool waitForBroadcast(size_t seen, size_t timeout);
+
   /// Adds an alias for an internal registry item. This registry will only
   /// broadcast the alias name.
   static Status addAlias(const std::string& registry_name,
@@ -685,6 +806,58 @@ class RegistryFactory : private boost::noncopyable {
                           QueryContext& context,
                           PluginResponse& response);
 
+  /**
+   * @brief A helper call for typed, column-major table data generation.
+   *
+   * This only succeeds for local tables that generate ColumnarData natively,
+   * and for extension tables if the extension supports columnar responses.
+   * Callers should fall back to the PluginResponse callTable otherwise.
+   */
+  static Status callTable(const std::string& table_name,
+                          QueryContext& context,
+                          ColumnarData& results);
+
+  /**
+   * @brief A helper call for streaming table data generation.
+   *
+   * This only succeeds for local tables that implement a RowGenerator.
+   * Callers should fall back to the PluginResponse callTable otherwise.
+   * The context must outlive the generator.
+   */
+  static Status callTable(const std::string& table_name,
+                          QueryContext& context,
+                          std::unique_ptr<RowGenerator>& generator);
+
+  /**
+   * @brief A helper call for streaming typed batches of table data.
+   *
+   * This only succeeds for extension tables if the extension supports
+   * cursors. Callers should fall back to the other callTable helpers.
+   */
+  static Status callTable(const std::string& table_name,
+                          QueryContext& context,
+                          std::unique_ptr<ColumnarGenerator>& batches);
+
+  /// The callTable helpers using a table resolved by a RegistryHandle.
+  static Status callTable(const RegistryHandle& table,
+                          QueryContext& context,
+                          PluginResponse& response);
+
+  static Status callTable(const RegistryHandle& table,
+                          QueryContext& context,
+                          ColumnarData& results);
+
+  static Status callTable(const RegistryHandle& table,
+                          QueryContext& context,
+                          std::unique_ptr<RowGenerator>& generator);
+
+  static Status callTable(const RegistryHandle& table,
+                          QueryContext& context,
+                          std::unique_ptr<ColumnarGenerator>& batches);
+
+  /// Check if a table is local and only generates rows, see callTable.
+  static bool generatesRows(const RegistryHandle& table);
+
   /// Set a registry's active plugin.
   static Status setActive(const std::string& registry_name,
                           const std::string& item_name);
@@ -739,6 +912,9 @@ class RegistryFactory : private boost::noncopyable {
   /// Get the registry external status.
   static bool external() { return instance().external_; }
 
+  /// A counter incremented whenever a registry's plugins change.
+  static size_t generation() { return instance().generation_; }
+
  private:
   /// Access the current initializing module UUID.
   static RouteUUID getModule();
@@ -757,6 +933,9 @@ class RegistryFactory : private boost::noncopyable {
   /// Set the registry locked status.
   static void locked(bool locked) { instance().locked_ = locked; }
 
+  /// Require every RegistryHandle to resolve again.
+  static void invalidate() { instance().generation_++; }
+
  public:
   RegistryFactory(RegistryFactory const&) = delete;
   RegistryFactory& operator=(RegistryFactory const&) = delete;
@@ -808,6 +987,13 @@ class RegistryFactory : private boost::noncopyable {
   /// Protector for broadcast lookups and external registry mutations.
   mutable Mutex mutex_;
 
+  /// See generation, compared by each RegistryHandle.
+  std::atomic<size_t> generation_{0};
+
+  /// See broadcasts, counted and signaled while holding the mutex.
+  size_t broadcasts_{0};
+  std::condition_variable broadcast_added_;
+
  private:
   friend class RegistryHelperCore;
   friend class RegistryModuleLoader;
@@ -0,0 +1,210 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <initializer_list>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace osquery {
+
+/**
+ * @brief A variant type for the SQLite type affinities.
+ */
+using RowData = std::string;
+
+/**
+ * @brief A single row from a database query
+ *
+ * Row maps individual column names to the Row's respective values, and
+ * supports the std::map interface used by tables, loggers and the SQL layer.
+ * The columns are kept sorted by name within a single vector rather than a
+ * tree node each: a result holds many small rows that are built once then
+ * read, so one allocation per row replaces one per column.
+ *
+ * Inserting or erasing a column invalidates iterators and references to the
+ * Row's values. A Row converts to and from a std::map, such as the requests
+ * and responses of extensions.
+ */
+class Row {
+ public:
+  using key_type = std::string;
+  using mapped_type = RowData;
+  using value_type = std::pair<std::string, RowData>;
+  using size_type = size_t;
+  using iterator = std::vector<value_type>::iterator;
+  using const_iterator = std::vector<value_type>::const_iterator;
+  using reverse_iterator = std::vector<value_type>::reverse_iterator;
+  using const_reverse_iterator =
+      std::vector<value_type>::const_reverse_iterator;
+
+  Row() = default;
+
+  Row(std::initializer_list<value_type> columns) {
+    insert(columns.begin(), columns.end());
+  }
+
+  template <typename Iterator>
+  Row(Iterator first, Iterator last) {
+    insert(first, last);
+  }
+
+  /// Convert from and to the std::map a Row used to be.
+  Row(const std::map<std::string, RowData>& columns)
+      : columns_(columns.begin(), columns.end()) {}
+
+  operator std::map<std::string, RowData>() const {
+    return std::map<std::string, RowData>(columns_.begin(), columns_.end());
+  }
+
+  RowData& operator[](const std::string& name) {
+    auto it = lower_bound(name);
+    if (it == columns_.end() || it->first != name) {
+      it = columns_.insert(it, value_type(name, RowData()));
+    }
+    return it->second;
+  }
+
+  RowData& operator[](std::string&& name) {
+    auto it = lower_bound(name);
+    if (it == columns_.end() || it->first != name) {
+      it = columns_.insert(it, value_type(std::move(name), RowData()));
+    }
+    return it->second;
+  }
+
+  /// Access a column's value, throws std::out_of_range if it is missing.
+  RowData& at(const std::string& name) {
+    auto it = find(name);
+    if (it == columns_.end()) {
+      throw std::out_of_range("Row::at: " + name);
+    }
+    return it->second;
+  }
+
+  const RowData& at(const std::string& name) const {
+    auto it = find(name);
+    if (it == columns_.end()) {
+      throw std::out_of_range("Row::at: " + name);
+    }
+    return it->second;
+  }
+
+  iterator lower_bound(const std::string& name) {
+    return std::lower_bound(columns_.begin(), columns_.end(), name, nameLess);
+  }
+
+  const_iterator lower_bound(const std::string& name) const {
+    return std::lower_bound(columns_.begin(), columns_.end(), name, nameLess);
+  }
+
+  iterator find(const std::string& name) {
+    auto it = lower_bound(name);
+    return (it != columns_.end() && it->first == name) ? it : columns_.end();
+  }
+
+  const_iterator find(const std::string& name) const {
+    auto it = lower_bound(name);
+    return (it != columns_.end() && it->first == name) ? it : columns_.end();
+  }
+
+  size_type count(const std::string& name) const {
+    return (find(name) != columns_.end()) ? 1 : 0;
+  }
+
+  /// Insert a column if the Row does not have a value for its name.
+  std::pair<iterator, bool> insert(value_type&& column) {
+    auto it = lower_bound(column.first);
+    if (it != columns_.end() && it->first == column.first) {
+      return std::make_pair(it, false);
+    }
+    return std::make_pair(columns_.insert(it, std::move(column)), true);
+  }
+
+  std::pair<iterator, bool> insert(const value_type& column) {
+    return insert(value_type(column));
+  }
+
+  template <typename Iterator>
+  void insert(Iterator first, Iterator last) {
+    for (; first != last; ++first) {
+      insert(value_type(*first));
+    }
+  }
+
+  template <typename... Args>
+  std::pair<iterator, bool> emplace(Args&&... args) {
+    return insert(value_type(std::forward<Args>(args)...));
+  }
+
+  iterator erase(const_iterator position) {
+    return columns_.erase(position);
+  }
+
+  iterator erase(const_iterator first, const_iterator last) {
+    return columns_.erase(first, last);
+  }
+
+  size_type erase(const std::string& name) {
+    auto it = find(name);
+    if (it == columns_.end()) {
+      return 0;
+    }
+    columns_.erase(it);
+    return 1;
+  }
+
+  iterator begin() { return columns_.begin(); }
+  const_iterator begin() const { return columns_.begin(); }
+  const_iterator cbegin() const { return columns_.cbegin(); }
+  iterator end() { return columns_.end(); }
+  const_iterator end() const { return columns_.end(); }
+  const_iterator cend() const { return columns_.cend(); }
+  reverse_iterator rbegin() { return columns_.rbegin(); }
+  const_reverse_iterator rbegin() const { return columns_.rbegin(); }
+  reverse_iterator rend() { return columns_.rend(); }
+  const_reverse_iterator rend() const { return columns_.rend(); }
+
+  size_type size() const { return columns_.size(); }
+  bool empty() const { return columns_.empty(); }
+  void clear() { columns_.clear(); }
+
+  /// Allocate space for a number of columns.
+  void reserve(size_type columns) { columns_.reserve(columns); }
+
+  void swap(Row& other) { columns_.swap(other.columns_); }
+
+  friend bool operator==(const Row& lhs, const Row& rhs) {
+    return lhs.columns_ == rhs.columns_;
+  }
+
+  friend bool operator!=(const Row& lhs, const Row& rhs) {
+    return lhs.columns_ != rhs.columns_;
+  }
+
+  friend bool operator<(const Row& lhs, const Row& rhs) {
+    return lhs.columns_ < rhs.columns_;
+  }
+
+ private:
+  static bool nameLess(const value_type& column, const std::string& name) {
+    return column.first < name;
+  }
+
+ private:
+  /// Columns sorted by name.
+  std::vector<value_type> columns_;
+};
+}
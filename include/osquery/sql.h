@@ -56,6 +56,9 @@ class SQL {
    */
   const QueryData& rows() const;
 
+  /// Mutable rows, a caller may move the results out of a finished query.
+  QueryData& rows();
+
   /**
    * @brief Accessor to switch off of when checking the success of a query
    *
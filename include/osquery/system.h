@@ -17,6 +17,7 @@
 #include <vector>
 
 #include <boost/filesystem/path.hpp>
+#include <boost/noncopyable.hpp>
 
 #include <osquery/core.h>
 
@@ -236,6 +237,8 @@ class DropPrivileges : private boost::noncopyable {
 /**
  * @brief Getter for a host's current hostname
  *
+ * The hostname is looked up at most once a minute, see refreshHostIdentity.
+ *
  * @return a string representing the host's current hostname
  */
 std::string getHostname();
@@ -243,6 +246,8 @@ std::string getHostname();
 /**
  * @brief Getter for a host's uuid.
  *
+ * The persisted UUID is read from the database once per process.
+ *
  * @return ok on success and ident is set to the host's uuid, otherwise failure.
  */
 Status getHostUUID(std::string& ident);
@@ -257,10 +262,21 @@ std::string generateHostUUID();
 /**
  * @brief Get a configured UUID/name that uniquely identify this machine
  *
+ * The identifier is kept until `--host_identifier` changes or the host
+ * identity is refreshed, it is safe to call for every scheduled query.
+ *
  * @return string to identify this machine
  */
 std::string getHostIdentifier();
 
+/**
+ * @brief Drop the cached hostname, host UUID and host identifier.
+ *
+ * The next getters ask the system and database again. This is called when a
+ * configuration update is applied, as options may select another identifier.
+ */
+void refreshHostIdentity();
+
 /**
  * @brief Getter for the current UNIX time.
  *
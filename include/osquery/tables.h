@@ -11,13 +11,16 @@
 #pragma once
 
 #include <deque>
+#include <functional>
 #include <map>
 #include <memory>
 #include <vector>
 #include <set>
 #include <unordered_map>
+#include <unordered_set>
 
 #include <boost/lexical_cast.hpp>
+#include <boost/optional.hpp>
 #include <boost/property_tree/ptree.hpp>
 
 #include <osquery/registry.h>
@@ -231,6 +234,117 @@ using TableColumns =
 /// Alias for map of column alias sets.
 using ColumnAliasSet = std::map<std::string, std::set<std::string>>;
 
+/**
+ * @brief Planner hints describing the expense of generating a table.
+ *
+ * Tables may declare these in their spec using statistics(rows=, cost=).
+ * The SQLite xBestIndex method uses them to estimate the cost of a scan, such
+ * that expensive tables are used as the inner loop of a join.
+ */
+struct TableStatistics {
+  explicit TableStatistics(double _rows = 0, double _cost = 1)
+      : rows(_rows), cost(_cost) {}
+
+  /// Expected number of rows generated without constraints, 0 if unknown.
+  double rows{0};
+
+  /// The relative expense of generating a single row.
+  double cost{1};
+};
+
+/**
+ * @brief A typed view of the constraints for a column.
+ *
+ * The view parses a ConstraintList's expressions once, using the column
+ * affinity, into a set of equality values, an inclusive range, and the
+ * literal prefixes of LIKE and GLOB patterns. A table may then check every
+ * generated value without another string conversion per constraint.
+ *
+ * Multiple EQUALS constraints, such as those from an IN operator, match any
+ * of their values. Range and pattern constraints must all match. SQLite
+ * checks every constraint again for each row, so the view may match values
+ * the query does not: constraints it cannot parse or evaluate, including
+ * those on DOUBLE and BLOB columns, match every value.
+ */
+class ConstraintView {
+ public:
+  ConstraintView() = default;
+
+  /// Parse a column's constraints using the column affinity.
+  ConstraintView(const std::vector<struct Constraint>& constraints,
+                 ColumnType affinity);
+
+  /// Check if an integer value may match the constraints.
+  bool matches(long long value) const;
+
+  /// Check if a value, as a column literal string, may match the constraints.
+  bool matches(const std::string& value) const;
+
+  /// See ConstraintView::matches, for any literal type.
+  template <typename T>
+  bool matches(const T& value) const {
+    return matches(TEXT(value));
+  }
+
+  /// True if the constraints do not limit the values matched.
+  bool empty() const {
+    return !none_ && !equals_ && !lower_ && !upper_ && prefixes_.empty();
+  }
+
+  /// The EQUALS values of an integer column, as parsed.
+  const std::unordered_set<long long>& integers() const {
+    return integers_;
+  }
+
+  /// The EQUALS values of a text column.
+  const std::unordered_set<std::string>& texts() const {
+    return texts_;
+  }
+
+ private:
+  /// Apply a range constraint to an integer column.
+  void addRange(unsigned char op, long long value);
+
+  /// Apply a range constraint to a text column.
+  void addRange(unsigned char op, const std::string& value);
+
+  /// Map an integer to a value ordered as the column's integer type.
+  long long ordered(long long value) const;
+
+ private:
+  /// The column affinity stores integers.
+  bool integer_{false};
+
+  /// The integers are unsigned 64-bit values stored as their bit pattern.
+  bool unsigned_{false};
+
+  /// The range constraints cannot be satisfied.
+  bool none_{false};
+
+  /// Values must be one of the EQUALS values.
+  bool equals_{false};
+
+  /// There is a lower or an upper bound.
+  bool lower_{false};
+  bool upper_{false};
+
+  /// Inclusive integer bounds, see ConstraintView::ordered.
+  long long min_{0};
+  long long max_{0};
+
+  /// Text bounds, compared as bytes.
+  std::string text_min_;
+  std::string text_max_;
+  bool text_min_inclusive_{true};
+  bool text_max_inclusive_{true};
+
+  std::unordered_set<long long> integers_;
+  std::unordered_set<std::string> texts_;
+
+  /// Literal pattern prefixes and if they are compared ignoring ASCII case.
+  std::vector<std::pair<std::string, bool>> prefixes_;
+};
+
 /// Forward declaration of QueryContext for ConstraintList relationships.
 struct QueryContext;
 
@@ -260,6 +374,8 @@ struct ConstraintList : private boost::noncopyable {
    * If there are no predicate constraints in this list, all expression will
    * match. Constraints are limitations.
    *
+   * The check uses the list's ConstraintView, see ConstraintList::view.
+   *
    * @param expr a SQL type expression of the column literal type to check.
    * @return If the expression matched all constraints.
    */
@@ -280,6 +396,15 @@ struct ConstraintList : private boost::noncopyable {
     return matches(TEXT(expr));
   }
 
+  /**
+   * @brief The constraints parsed using the list affinity.
+   *
+   * The view is parsed once and kept until a constraint is added or the
+   * affinity changes. Tables checking many values should hold the view
+   * rather than call ConstraintList::matches for each.
+   */
+  const ConstraintView& view() const;
+
   /**
    * @brief Check and return if there are constraints on this column.
    *
@@ -321,12 +446,6 @@ struct ConstraintList : private boost::noncopyable {
     return (!exists() || matches(expr));
   }
 
-  /**
-   * @brief Helper templated function for ConstraintList::matches.
-   */
-  template <typename T>
-  bool literal_matches(const T& base_expr) const;
-
   /**
    * @brief Get all expressions for a given ConstraintOperator.
    *
@@ -342,9 +461,10 @@ struct ConstraintList : private boost::noncopyable {
   template <typename T>
   std::set<T> getAll(ConstraintOperator op) const {
     std::set<T> literal_matches;
-    auto matches = getAll(op);
-    for (const auto& match : matches) {
-      literal_matches.insert(AS_LITERAL(T, match));
+    for (const auto& constraint : constraints_) {
+      if (constraint.op == op) {
+        literal_matches.insert(AS_LITERAL(T, constraint.expr));
+      }
     }
     return literal_matches;
   }
@@ -381,6 +501,13 @@ struct ConstraintList : private boost::noncopyable {
   /// List of constraint operator/expressions.
   std::vector<struct Constraint> constraints_;
 
+  /// The parsed constraints, see ConstraintList::view.
+  mutable ConstraintView view_;
+
+  /// The number of constraints and affinity the view was parsed from.
+  mutable size_t view_size_{0};
+  mutable ColumnType view_affinity_{UNKNOWN_TYPE};
+
  private:
   friend struct QueryContext;
 
@@ -394,6 +521,9 @@ using ConstraintMap = std::map<std::string, struct ConstraintList>;
 /// Populate a constraint list from a query's parsed predicate.
 using ConstraintSet = std::vector<std::pair<std::string, struct Constraint>>;
 
+/// The set of column names referenced by a query.
+using UsedColumns = std::unordered_set<std::string>;
+
 /**
  * @brief osquery table content descriptor.
  *
@@ -412,6 +542,9 @@ struct VirtualTableContent {
   /// Friendly name for the table.
   TableName name;
 
+  /// The table plugin, resolved once for every filter.
+  RegistryHandle table;
+
   /// Table column structure, retrieved once via the TablePlugin call API.
   TableColumns columns;
 
@@ -424,9 +557,18 @@ struct VirtualTableContent {
    */
   std::map<std::string, size_t> aliases;
 
+  /// The index of the column holding each column's content, for aliases.
+  std::vector<size_t> sources;
+
+  /// Planner hints, retrieved once via the TablePlugin call API.
+  TableStatistics statistics;
+
   /// Transient set of virtual table access constraints.
   std::unordered_map<size_t, ConstraintSet> constraints;
 
+  /// Transient set of referenced columns, keyed like the constraints.
+  std::unordered_map<size_t, UsedColumns> colsUsed;
+
   /*
    * @brief A table implementation specific query result cache.
    *
@@ -547,6 +689,21 @@ struct QueryContext : private boost::noncopyable {
       std::function<Status(const std::string& constraint,
                            std::set<std::string>& output)> predicate);
 
+  /**
+   * @brief Check if a column is referenced by the query.
+   *
+   * Table implementations may skip expensive work for columns the query does
+   * not select, filter on, or order by. If the set of referenced columns is
+   * not known, every column is considered used.
+   *
+   * @param column The name of a column within this table.
+   * @return true if the column may be used by the query.
+   */
+  bool isColumnUsed(const std::string& column) const;
+
+  /// Check if any of a set of columns is referenced by the query.
+  bool isAnyColumnUsed(std::initializer_list<std::string> columns) const;
+
   /// Check if a table-defined index exists within the query cache.
   bool isCached(const std::string& index) {
     return (table_->cache.count(index) != 0);
@@ -582,6 +739,9 @@ struct QueryContext : private boost::noncopyable {
   /// Is the table allowed to "traverse" directories.
   bool traverse{false};
 
+  /// The columns referenced by the query, unset if that is not known.
+  boost::optional<UsedColumns> colsUsed;
+
  private:
   /// If false then the context is maintaining a ephemeral cache.
   bool enable_cache_{false};
@@ -596,6 +756,165 @@ struct QueryContext : private boost::noncopyable {
 using QueryContext = struct QueryContext;
 using Constraint = struct Constraint;
 
+/**
+ * @brief A typed, column-major table result set.
+ *
+ * QueryData stores every cell as a string within a per-row map, so each cell
+ * pays for a map node, a copy of the column name, and a heap-allocated value.
+ * ColumnarData keeps a shared column-name dictionary, one natively-typed
+ * vector per column, and a NULL bitmap per column.
+ *
+ * Table generators may opt into ColumnarData, see TablePlugin::generateColumns.
+ * The virtual table implementation reads the native types directly.
+ *
+ * @code{.cpp}
+ *   auto r = results.addRow();
+ *   results.setInteger(r, 0, pid);
+ *   results.setText(r, 1, name);
+ * @endcode
+ */
+class ColumnarData {
+ public:
+  ColumnarData() : names_(std::make_shared<std::vector<std::string>>()) {}
+
+  /// Create an empty result set for a table's column definition.
+  explicit ColumnarData(const TableColumns& columns);
+
+  /// Convert a legacy QueryData result set, using the column affinities.
+  static ColumnarData fromQueryData(const TableColumns& columns,
+                                    const QueryData& qd);
+
+  /// Convert to the legacy QueryData representation, NULL cells are omitted.
+  QueryData toQueryData() const;
+
+  /// Append a row with all NULL cells and return the row index.
+  size_t addRow();
+
+  /// Reserve space for an expected number of rows.
+  void reserve(size_t rows);
+
+  /// Number of rows.
+  size_t rows() const { return rows_; }
+
+  /// Number of columns.
+  size_t columns() const { return columns_.size(); }
+
+  /// The index of a column name, or columns() if the name is unknown.
+  size_t column(const std::string& name) const;
+
+  /// The name of a column index.
+  const std::string& name(size_t column) const { return (*names_)[column]; }
+
+  /// The SQLite affinity of a column index.
+  ColumnType type(size_t column) const { return columns_[column].type; }
+
+  /// Set an INTEGER or BIGINT cell, TEXT columns store the decimal string.
+  void setInteger(size_t row, size_t column, long long value);
+
+  /// Set a DOUBLE cell, TEXT columns store the decimal string.
+  void setDouble(size_t row, size_t column, double value);
+
+  /// Set a TEXT cell, numeric columns parse the value or store NULL.
+  void setText(size_t row, size_t column, std::string value);
+
+  /// Check if a cell was not set.
+  bool isNull(size_t row, size_t column) const {
+    return columns_[column].nulls[row];
+  }
+
+  /// Read an INTEGER, BIGINT, or UNSIGNED BIGINT cell.
+  long long getInteger(size_t row, size_t column) const {
+    return columns_[column].integers[row];
+  }
+
+  /// Read a DOUBLE cell.
+  double getDouble(size_t row, size_t column) const {
+    return columns_[column].doubles[row];
+  }
+
+  /// Read a TEXT (or BLOB/UNKNOWN) cell.
+  const std::string& getText(size_t row, size_t column) const {
+    return columns_[column].texts[row];
+  }
+
+  /// Represent any cell as a string, NULL is the empty string.
+  std::string getString(size_t row, size_t column) const;
+
+ private:
+  /// Storage for a single column, only the vector matching type is used.
+  struct Column {
+    ColumnType type{TEXT_TYPE};
+    std::vector<long long> integers;
+    std::vector<double> doubles;
+    std::vector<std::string> texts;
+    std::vector<bool> nulls;
+  };
+
+  /// Check if an affinity is stored using the integer vector.
+  static bool isIntegerType(ColumnType type) {
+    return type == INTEGER_TYPE || type == BIGINT_TYPE ||
+           type == UNSIGNED_BIGINT_TYPE;
+  }
+
+ private:
+  /// Column names, shared between copies of this result set.
+  std::shared_ptr<std::vector<std::string>> names_;
+
+  /// The typed column storage.
+  std::vector<Column> columns_;
+
+  /// Number of rows.
+  size_t rows_{0};
+};
+
+/**
+ * @brief A pull-based source of rows for streaming table generation.
+ *
+ * Tables that use a generator do not materialize their results. The virtual
+ * table cursor requests one row at a time from RowGenerator::next as SQLite
+ * steps through the result. When a query stops early, for example because of
+ * a LIMIT, the cursor is closed and the generator is destroyed without
+ * generating the remaining rows.
+ *
+ * The QueryContext used to create the generator remains valid until the
+ * generator is destroyed.
+ */
+class RowGenerator : private boost::noncopyable {
+ public:
+  virtual ~RowGenerator() {}
+
+  /**
+   * @brief Generate the next row.
+   *
+   * @param row The output row, provided empty.
+   * @return false if there are no more rows, row is ignored.
+   */
+  virtual bool next(Row& row) = 0;
+};
+
+using RowGeneratorRef = std::unique_ptr<RowGenerator>;
+
+/**
+ * @brief A pull-based source of typed row batches.
+ *
+ * Extension tables stream their results in batches, the virtual table cursor
+ * requests the next batch when SQLite steps past the rows of the last.
+ */
+class ColumnarGenerator : private boost::noncopyable {
+ public:
+  virtual ~ColumnarGenerator() {}
+
+  /**
+   * @brief Generate the next batch of rows.
+   *
+   * @param results The output batch, provided empty.
+   * @return false if there are no more rows, results is ignored.
+   */
+  virtual bool next(ColumnarData& results) = 0;
+};
+
+using ColumnarGeneratorRef = std::unique_ptr<ColumnarGenerator>;
+
 /**
  * @brief The TablePlugin defines the name, types, and column information.
  *
@@ -624,6 +943,9 @@ class TablePlugin : public Plugin {
   /// Define a map of target columns to optional aliases.
   virtual ColumnAliasSet columnAliases() const { return {}; }
 
+  /// Return optional planner hints for the table, see TableStatistics.
+  virtual TableStatistics statistics() const { return TableStatistics(); }
+
   /**
    * @brief Generate a complete table representation.
    *
@@ -643,6 +965,42 @@ class TablePlugin : public Plugin {
    */
   virtual QueryData generate(QueryContext& request) { return QueryData(); }
 
+  /**
+   * @brief Generate a typed, column-major table representation.
+   *
+   * Tables that return true from usesColumnarData implement this method
+   * instead of TablePlugin::generate. The results are created with the table's
+   * columns. Callers that require QueryData, such as the extensions API, are
+   * given an adapted copy.
+   *
+   * The default implementation adapts the results of TablePlugin::generate.
+   *
+   * @param request A query context filled in by SQLite's virtual table API.
+   * @param results The output typed results, created with the table columns.
+   */
+  virtual void generateColumns(QueryContext& request, ColumnarData& results);
+
+  /// True if the table implements generateColumns natively.
+  virtual bool usesColumnarData() const { return false; }
+
+  /**
+   * @brief Create a streaming row generator for this table.
+   *
+   * Tables that return true from usesGenerator implement this method instead
+   * of TablePlugin::generate. Callers that require QueryData are given the
+   * fully-drained results.
+   *
+   * @param request A query context, valid for the lifetime of the generator.
+   * @return A row generator, or nullptr if no rows will be generated.
+   */
+  virtual RowGeneratorRef generator(QueryContext& request) { return nullptr; }
+
+  /// True if the table implements generator.
+  virtual bool usesGenerator() const { return false; }
+
+  /// Generate rows, adapting ColumnarData or RowGenerator%s if used.
+  QueryData generateRows(QueryContext& request);
+
  protected:
   /// An SQL table containing the table definition/syntax.
   std::string columnDefinition() const;
@@ -688,6 +1046,52 @@ class TablePlugin : public Plugin {
   /// Similar to TablePlugin::getCache, if TablePlugin::generate is called.
   void setCache(size_t step, size_t interval, const QueryData& results);
 
+  /**
+   * @brief Generate a table's results once and keep them in memory.
+   *
+   * Tables with a memoize attribute report data that is constant until the
+   * host reboots, such as firmware tables, or until hardware is attached or
+   * removed. The first query generates every row and column without the
+   * query's constraints, later queries share those results and SQLite applies
+   * their constraints.
+   *
+   * Results of hardware tables are dropped by TablePlugin::hardwareChanged.
+   * They are only kept while an event publisher watching for hardware changes
+   * runs, otherwise a change could not be noticed.
+   *
+   * @param request The query context, ignored when results are kept.
+   * @param hardware True if the results change with attached hardware.
+   * @param generator The table's generate implementation.
+   * @return The table's rows.
+   */
+  QueryData memoize(QueryContext& request,
+                    bool hardware,
+                    const std::function<QueryData(QueryContext&)>& generator);
+
+ public:
+  /// Drop the memoized results of tables reporting attached hardware.
+  static void hardwareChanged();
+
+  /**
+   * @brief Mark an event publisher as watching for hardware changes.
+   *
+   * Publishers such as udev and IOKit watch while their run loop executes and
+   * call TablePlugin::hardwareChanged for each device event.
+   */
+  static void watchHardware(bool watching);
+
+  /**
+   * @brief The number of hardware changes noticed.
+   *
+   * Tables keeping their own hardware snapshots compare this to the number
+   * read when the snapshot was taken. A snapshot is only current while
+   * TablePlugin::watchingHardware is true.
+   */
+  static size_t hardwareGeneration();
+
+  /// True while an event publisher watches for hardware changes.
+  static bool watchingHardware();
+
  private:
   /// The last time in seconds the table data results were saved to cache.
   size_t last_cached_{0};
@@ -698,13 +1102,14 @@ class TablePlugin : public Plugin {
   /**
    * @brief The scheduled interval for the executing query.
    *
-   * Scheduled queries execute within a pseudo-mutex, and each may communicate
-   * their scheduled interval to internal TablePlugin implementations. If the
-   * table is cachable then the interval can be used to calculate freshness.
+   * Scheduled queries communicate their scheduled interval to internal
+   * TablePlugin implementations. If the table is cachable then the interval
+   * can be used to calculate freshness. Schedule workers may execute several
+   * queries concurrently so the interval is tracked per thread.
    */
-  static size_t kCacheInterval;
+  static thread_local size_t kCacheInterval;
   /// The schedule step, this is the current position of the schedule.
-  static size_t kCacheStep;
+  static thread_local size_t kCacheStep;
 
  public:
   /**
@@ -28,7 +28,7 @@
  *  A daemon may only connect to a kernel with the same communication version.
  *  Bump this number when changing or adding any event structs.
  */
-#define OSQUERY_KERNEL_COMMUNICATION_VERSION 4
+#define OSQUERY_KERNEL_COMMUNICATION_VERSION 6
 #ifdef KERNEL_TEST
 #define OSQUERY_KERNEL_COMM_VERSION \
   (OSQUERY_KERNEL_COMMUNICATION_VERSION | (1UL << 63))
@@ -176,15 +176,18 @@ enum osquery_options {
   OSQUERY_OPTIONS_NO_BLOCK = 1,
 };
 
+/// The maximum number of per-CPU rings within the shared buffer.
+#define OSQUERY_MAX_RINGS 64
+
 typedef struct {
   // Option such as OSQUERY_NO_BLOCK.
   int options;
 
-  // Offset of daemon read pointer.
-  size_t read_offset;
+  // Offset of daemon read pointer within each ring.
+  size_t read_offsets[OSQUERY_MAX_RINGS];
 
-  // (Output) Offset of max_read pointer.
-  size_t max_read_offset;
+  // (Output) Offset of max_read pointer within each ring.
+  size_t max_read_offsets[OSQUERY_MAX_RINGS];
 
   // (Output) Number of drops or negative on overflow.
   int drops;
@@ -197,8 +200,38 @@ typedef struct {
   void *buffer;
   // osquery kernel communication version.
   uint64_t version;
+  // (Output) Number of rings the buffer is split into.
+  uint32_t rings;
+  // (Output) Size of each ring, ring N starts at buffer + N * ring_size.
+  size_t ring_size;
 } osquery_buf_allocate_args_t;
 
+// Actions for filter rules.
+typedef enum {
+  // Remove all filter rules for the event type.
+  OSQUERY_FILTER_CLEAR = 0,
+  // Only publish events matching at least one include rule.
+  OSQUERY_FILTER_INCLUDE = 1,
+} osquery_filter_action_t;
+
+/// The maximum number of filter rules for each event type.
+#define OSQUERY_MAX_FILTERS 32
+
+typedef struct {
+  // The event type the rule applies to.
+  osquery_event_t event;
+
+  // Add an include rule, or clear the event type's rules.
+  osquery_filter_action_t action;
+
+  // Inclusive range of real user IDs, 0 through UINT64_MAX matches any user.
+  uint64_t uid_low;
+  uint64_t uid_high;
+
+  // Path prefix of the file or executable, empty matches any path.
+  char path[MAXPATHLEN];
+} osquery_filter_args_t;
+
 // TODO: Choose a proper IOCTL num.
 #define OSQUERY_IOCTL_NUM 0xFA
 #define OSQUERY_IOCTL_SUBSCRIPTION \
@@ -208,6 +241,9 @@ typedef struct {
 #define OSQUERY_IOCTL_BUF_ALLOCATE \
   _IOWR(OSQUERY_IOCTL_NUM, 0x3, osquery_buf_allocate_args_t)
 
+#define OSQUERY_IOCTL_FILTER \
+  _IOW(OSQUERY_IOCTL_NUM, 0x5, osquery_filter_args_t)
+
 #ifdef KERNEL_TEST
 #define OSQUERY_IOCTL_TEST _IOW(OSQUERY_IOCTL_NUM, 0x4, int)
 #endif // KERNEL_TEST
@@ -13,6 +13,7 @@
 #include <sys/proc.h>
 
 #include <kern/assert.h>
+#include <kern/cpu_number.h>
 
 #include "circular_queue_kern.h"
 
@@ -26,9 +27,17 @@ static inline void setup_queue_locks(osquery_cqueue_t *queue) {
   queue->lck_attr = lck_attr_alloc_init();
 
   queue->lck = lck_spin_alloc_init(queue->lck_grp, queue->lck_attr);
+
+  for (int i = 0; i < OSQUERY_MAX_RINGS; i++) {
+    queue->rings[i].lck = lck_spin_alloc_init(queue->lck_grp, queue->lck_attr);
+  }
 }
 
 static inline void teardown_queue_locks(osquery_cqueue_t *queue) {
+  for (int i = 0; i < OSQUERY_MAX_RINGS; i++) {
+    lck_spin_free(queue->rings[i].lck, queue->lck_grp);
+  }
+
   lck_spin_free(queue->lck, queue->lck_grp);
 
   lck_attr_free(queue->lck_attr);
@@ -38,18 +47,18 @@ static inline void teardown_queue_locks(osquery_cqueue_t *queue) {
   lck_grp_attr_free(queue->lck_grp_attr);
 }
 
-static inline void *advance_pointer(osquery_cqueue_t *queue, void *ptr,
+static inline void *advance_pointer(osquery_cqueue_ring_t *ring, void *ptr,
                                     size_t bytes) {
-  return ((uint8_t *)ptr + bytes - queue->buffer) % queue->size + queue->buffer;
+  return ((uint8_t *)ptr + bytes - ring->buffer) % ring->size + ring->buffer;
 }
 
-static inline size_t get_distance(osquery_cqueue_t *queue, void *lower,
+static inline size_t get_distance(osquery_cqueue_ring_t *ring, void *lower,
                                   void *upper, int cannot_be_empty) {
   ssize_t size = (uint8_t *)upper - (uint8_t *)lower;
   if (size == 0) {
-    return cannot_be_empty ? queue->size : 0;
+    return cannot_be_empty ? ring->size : 0;
   } else if (size < 0) {
-    return queue->size + size;
+    return ring->size + size;
   } else {
     return size;
   }
@@ -62,12 +71,12 @@ typedef enum {
   OSQUERY_NOT_IN_BUFFER = 1 << 2
 } osquery_between_t;
 
-static inline osquery_between_t is_between(osquery_cqueue_t *queue, void *ptr,
-                                           void *lower, void *upper,
+static inline osquery_between_t is_between(osquery_cqueue_ring_t *ring,
+                                           void *ptr, void *lower, void *upper,
                                            size_t size) {
   osquery_between_t b = OSQUERY_BETWEEN_INIT;
-  if (ptr < (void *)queue->buffer
-      || ((uint8_t *)ptr) + size > (queue->buffer + queue->size)) {
+  if (ptr < (void *)ring->buffer
+      || ((uint8_t *)ptr) + size > (ring->buffer + ring->size)) {
     b |= OSQUERY_NOT_IN_BUFFER;
   }
 
@@ -84,9 +93,33 @@ static inline osquery_between_t is_between(osquery_cqueue_t *queue, void *ptr,
   return b;
 }
 
+/** @brief Find the ring holding a reserved space.
+ *
+ *  A producer may move to another CPU between its reserve and commit, so the
+ *  ring is found by address rather than by the current CPU.
+ *
+ *  @return The ring, or NULL if the space is not within any ring.
+ */
+static inline osquery_cqueue_ring_t *find_ring(osquery_cqueue_t *queue,
+                                               void *space) {
+  for (uint32_t i = 0; i < queue->ring_count; i++) {
+    osquery_cqueue_ring_t *ring = &queue->rings[i];
+    if ((uint8_t *)space >= ring->buffer &&
+        (uint8_t *)space < ring->buffer + ring->size) {
+      return ring;
+    }
+  }
+  return NULL;
+}
+
 void osquery_cqueue_setup(osquery_cqueue_t *queue) {
   queue->last_destruction_time = 0;
   queue->initialized = 0;
+  queue->ring_count = 0;
+  queue->waiting = 0;
+  for (int i = 0; i < OSQUERY_MAX_RINGS; i++) {
+    queue->rings[i].initialized = 0;
+  }
   setup_queue_locks(queue);
 }
 
@@ -114,18 +147,46 @@ int osquery_cqueue_teardown(osquery_cqueue_t *queue) {
   }
 }
 
-void osquery_cqueue_init(osquery_cqueue_t *queue, void *buffer, size_t size) {
-  lck_spin_lock(queue->lck);
-  queue->buffer = (uint8_t *)buffer;
-  queue->size = size;
+void osquery_cqueue_init(osquery_cqueue_t *queue,
+                         void *buffer,
+                         size_t size,
+                         uint32_t rings) {
+  if (rings == 0) {
+    rings = 1;
+  } else if (rings > OSQUERY_MAX_RINGS) {
+    rings = OSQUERY_MAX_RINGS;
+  }
 
-  queue->write = queue->buffer;
-  queue->max_read = queue->buffer;
-  queue->read = queue->buffer;
+  // Each ring is page aligned and at least one page, a small buffer is split
+  // into fewer rings than requested.
+  if (size / rings < PAGE_SIZE) {
+    rings = (size < PAGE_SIZE) ? 1 : size / PAGE_SIZE;
+  }
+  size_t ring_size = size / rings;
+  if (rings > 1) {
+    ring_size &= ~((size_t)PAGE_SIZE - 1);
+  }
 
-  queue->drops = 0;
+  lck_spin_lock(queue->lck);
+  queue->ring_count = rings;
+  queue->ring_size = ring_size;
+  queue->waiting = 0;
+  for (uint32_t i = 0; i < rings; i++) {
+    osquery_cqueue_ring_t *ring = &queue->rings[i];
+    lck_spin_lock(ring->lck);
+    ring->buffer = (uint8_t *)buffer + i * ring_size;
+    ring->size = ring_size;
+
+    ring->write = ring->buffer;
+    ring->max_read = ring->buffer;
+    ring->read = ring->buffer;
+
+    ring->drops = 0;
+    ring->reservations = 0;
+    ring->initialized = 1;
+    lck_spin_unlock(ring->lck);
+  }
   queue->initialized = 1;
-  queue->reservations = 0;
   lck_spin_unlock(queue->lck);
 }
 
@@ -134,11 +195,20 @@ void osquery_cqueue_destroy(osquery_cqueue_t *queue) {
   if (queue->initialized) {
     queue->initialized = 0;
 
-    while (queue->reservations > 0) {
-      lck_spin_sleep(queue->lck, LCK_SLEEP_DEFAULT, &queue->reservations,
-                     THREAD_UNINT);
+    for (uint32_t i = 0; i < queue->ring_count; i++) {
+      osquery_cqueue_ring_t *ring = &queue->rings[i];
+      lck_spin_lock(ring->lck);
+      ring->initialized = 0;
+      while (ring->reservations > 0) {
+        lck_spin_sleep(ring->lck, LCK_SLEEP_DEFAULT, &ring->reservations,
+                       THREAD_UNINT);
+      }
+      lck_spin_unlock(ring->lck);
     }
 
+    // Wake a daemon waiting for data, it will notice the queue is gone.
+    wakeup(&queue->waiting);
+
     // Time is recorded so we can fail cqueue_teardown (destruction of cqueue
     // locks) for a short period of time.  This should allow pending event
     // callbacks to notice ths cqueue has been unitialized and error out before
@@ -150,66 +220,97 @@ void osquery_cqueue_destroy(osquery_cqueue_t *queue) {
   lck_spin_unlock(queue->lck);
 }
 
-int osquery_cqueue_advance_read(osquery_cqueue_t *queue, size_t read_offset,
-                                size_t *max_read_offset) {
+int osquery_cqueue_advance_read(osquery_cqueue_t *queue,
+                                const size_t *read_offsets,
+                                size_t *max_read_offsets) {
   int err = 0;
-  lck_spin_lock(queue->lck);
-
-  if (!queue->initialized) {
-    err = -1;
-    goto error_exit;
-  }
+  for (uint32_t i = 0; i < queue->ring_count; i++) {
+    osquery_cqueue_ring_t *ring = &queue->rings[i];
+    lck_spin_lock(ring->lck);
+    if (!ring->initialized) {
+      lck_spin_unlock(ring->lck);
+      return -1;
+    }
 
-  uint8_t *new_read = queue->buffer + read_offset;
-  if (OSQUERY_BETWEEN == is_between(queue, new_read, queue->read,
-                                    queue->max_read, 0)) {
-    queue->read = new_read;
-  } else {
-    queue->read = queue->max_read;
-    err = -1;
+    uint8_t *new_read = ring->buffer + read_offsets[i];
+    if (OSQUERY_BETWEEN == is_between(ring, new_read, ring->read,
+                                      ring->max_read, 0)) {
+      ring->read = new_read;
+    } else {
+      ring->read = ring->max_read;
+      err = -1;
+    }
+    max_read_offsets[i] = ring->max_read - ring->buffer;
+    lck_spin_unlock(ring->lck);
   }
-  *max_read_offset = queue->max_read - queue->buffer;
-
-error_exit:
-  lck_spin_unlock(queue->lck);
 
   return err;
 }
 
-ssize_t osquery_cqueue_wait_for_data(osquery_cqueue_t *queue) {
-  ssize_t offset = 0;
-  lck_spin_lock(queue->lck);
-
-  if (!queue->initialized) {
-    offset = -1;
-    goto error_exit;
+/** @brief Check each ring for readable data, recording the max_read offsets.
+ *
+ *  @return 1 if any ring has data, 0 if all are empty, negative on failure.
+ */
+static int check_for_data(osquery_cqueue_t *queue, size_t *max_read_offsets) {
+  int has_data = 0;
+  for (uint32_t i = 0; i < queue->ring_count; i++) {
+    osquery_cqueue_ring_t *ring = &queue->rings[i];
+    lck_spin_lock(ring->lck);
+    if (!ring->initialized) {
+      lck_spin_unlock(ring->lck);
+      return -1;
+    }
+    has_data |= (ring->max_read != ring->read);
+    max_read_offsets[i] = ring->max_read - ring->buffer;
+    lck_spin_unlock(ring->lck);
   }
+  return has_data;
+}
 
+int osquery_cqueue_wait_for_data(osquery_cqueue_t *queue,
+                                 size_t *max_read_offsets) {
+  int has_data = 0;
   wait_result_t wait_result = THREAD_AWAKENED;
-  while (wait_result == THREAD_AWAKENED && queue->max_read == queue->read) {
-    wait_result = lck_spin_sleep(queue->lck, LCK_SLEEP_DEFAULT,
-                                 &queue->max_read, THREAD_ABORTSAFE);
+  while ((has_data = check_for_data(queue, max_read_offsets)) == 0) {
+    // Producers only wake the daemon when it is waiting, and they do not take
+    // the queue lock. A wakeup between the check and the sleep is not lost
+    // for long, the sleep is bounded.
+    lck_spin_lock(queue->lck);
+    if (!queue->initialized) {
+      lck_spin_unlock(queue->lck);
+      return -1;
+    }
+    queue->waiting = 1;
+    uint64_t deadline;
+    clock_interval_to_deadline(100, kMillisecondScale, &deadline);
+    wait_result = lck_spin_sleep_deadline(queue->lck, LCK_SLEEP_DEFAULT,
+                                          &queue->waiting, THREAD_ABORTSAFE,
+                                          deadline);
+    queue->waiting = 0;
+    lck_spin_unlock(queue->lck);
+    if (wait_result != THREAD_AWAKENED && wait_result != THREAD_TIMED_OUT) {
+      // Interrupted, return the current (empty) offsets.
+      break;
+    }
   }
-  offset = queue->max_read - queue->buffer;
 
-error_exit:
-  lck_spin_unlock(queue->lck);
-  return offset;
+  return (has_data < 0) ? -1 : 0;
 }
 
 int osquery_cqueue_dropped_data(osquery_cqueue_t *queue) {
-  int drops;
-  lck_spin_lock(queue->lck);
-  if (!queue->initialized) {
-    drops = -1;
-    goto error_exit;
-  }
-
-  drops = queue->drops;
-  queue->drops = 0;
+  int drops = 0;
+  for (uint32_t i = 0; i < queue->ring_count; i++) {
+    osquery_cqueue_ring_t *ring = &queue->rings[i];
+    lck_spin_lock(ring->lck);
+    if (!ring->initialized) {
+      lck_spin_unlock(ring->lck);
+      return -1;
+    }
 
-error_exit:
-  lck_spin_unlock(queue->lck);
+    drops += ring->drops;
+    ring->drops = 0;
+    lck_spin_unlock(ring->lck);
+  }
 
   return drops;
 }
@@ -217,9 +318,16 @@ error_exit:
 void *osquery_cqueue_reserve(osquery_cqueue_t *queue,
                              osquery_event_t event,
                              size_t size) {
+  // The ring count is only set while initializing.
+  uint32_t rings = queue->ring_count;
+  if (rings == 0) {
+    return NULL;
+  }
+
+  osquery_cqueue_ring_t *ring = &queue->rings[cpu_number() % rings];
   void *ret = NULL;
-  lck_spin_lock(queue->lck);
-  if (!queue->initialized) {
+  lck_spin_lock(ring->lck);
+  if (!ring->initialized) {
     ret = NULL;
     goto error_exit;
   }
@@ -232,25 +340,25 @@ void *osquery_cqueue_reserve(osquery_cqueue_t *queue,
   // We do not want the write pointer to ever equal the read pointer unless
   // everything is empty.  Otherwise we need to track the empty states for the
   // buffer.
-  if (get_distance(queue, queue->write, queue->read, 1) > size) {
-    if (get_distance(queue, queue->write,
-                     queue->buffer + queue->size, 0) >= size) {
+  if (get_distance(ring, ring->write, ring->read, 1) > size) {
+    if (get_distance(ring, ring->write,
+                     ring->buffer + ring->size, 0) >= size) {
       // We can fit the allocation by advancing the write pointer.
-      header = (osquery_data_header_t *)queue->write;
-      queue->write = (uint8_t *)advance_pointer(queue, queue->write, size);
-    } else if (get_distance(queue, queue->buffer, queue->read, 0) > size) {
+      header = (osquery_data_header_t *)ring->write;
+      ring->write = (uint8_t *)advance_pointer(ring, ring->write, size);
+    } else if (get_distance(ring, ring->buffer, ring->read, 0) > size) {
       // We can fit the allocation by wrapping the write pointer.
-      if (get_distance(queue, queue->write, queue->buffer + queue->size, 0)
+      if (get_distance(ring, ring->write, ring->buffer + ring->size, 0)
           >= sizeof(osquery_data_header_t)) {
         // Signal a Null event ie. jump to beginning of buf.  If there
         // is not enough room to do so, this is ok because it will know to
         // skip to the beginning of the buffer based on the amount of space
         // left.
-        header = (osquery_data_header_t *)queue->write;
+        header = (osquery_data_header_t *)ring->write;
         header->event = END_OF_BUFFER_EVENT;
       }
-      header = (osquery_data_header_t *)queue->buffer;
-      queue->write = (uint8_t *)advance_pointer(queue, queue->buffer, size);
+      header = (osquery_data_header_t *)ring->buffer;
+      ring->write = (uint8_t *)advance_pointer(ring, ring->buffer, size);
     }
   }
 
@@ -261,15 +369,15 @@ void *osquery_cqueue_reserve(osquery_cqueue_t *queue,
 
     // Give them the pointer to the space not the header.
     ret = (void *)(header + 1);
-    queue->reservations++;
+    ring->reservations++;
   } else {
-    if (queue->drops >= 0) {
-      queue->drops += 1;
+    if (ring->drops >= 0) {
+      ring->drops += 1;
     }
     ret = NULL;
   }
 error_exit:
-  lck_spin_unlock(queue->lck);
+  lck_spin_unlock(ring->lck);
 
   return ret;
 }
@@ -277,47 +385,54 @@ error_exit:
 /** @brief Turn blocks that have been commited into readable space for user
  *  level process.
  *
- *  REQUIRES the lock.
+ *  REQUIRES the ring lock.
  *
- *  @param queue The queue to create readable space in.
- *  @return Void.
+ *  @param ring The ring to create readable space in.
+ *  @return 1 if space became readable.
  */
-static inline void coalesce_readable(osquery_cqueue_t *queue) {
-  osquery_data_header_t *header = (osquery_data_header_t *)queue->max_read;
+static inline int coalesce_readable(osquery_cqueue_ring_t *ring) {
+  osquery_data_header_t *header = (osquery_data_header_t *)ring->max_read;
   osquery_between_t b;
+  int readable = 0;
 
-  while (OSQUERY_BETWEEN & (b = is_between(queue, header, queue->max_read,
-                                       queue->write, sizeof(osquery_data_header_t)))) {
+  while (OSQUERY_BETWEEN & (b = is_between(ring, header, ring->max_read,
+                                       ring->write, sizeof(osquery_data_header_t)))) {
     if (b & OSQUERY_NOT_IN_BUFFER || header->event == END_OF_BUFFER_EVENT) {
-      queue->max_read = queue->buffer;
-      header = (osquery_data_header_t *)queue->max_read;
+      ring->max_read = ring->buffer;
+      header = (osquery_data_header_t *)ring->max_read;
       continue;
     } else if (!header->finished) {
       break;
     }
 
-    queue->max_read = (uint8_t *)advance_pointer(
-        queue, queue->max_read, header->size + sizeof(osquery_data_header_t));
+    ring->max_read = (uint8_t *)advance_pointer(
+        ring, ring->max_read, header->size + sizeof(osquery_data_header_t));
 
-    header = (osquery_data_header_t *)queue->max_read;
-    wakeup(&queue->max_read);
+    header = (osquery_data_header_t *)ring->max_read;
+    readable = 1;
 
-    lck_spin_unlock(queue->lck);
-    lck_spin_lock(queue->lck);
+    lck_spin_unlock(ring->lck);
+    lck_spin_lock(ring->lck);
   }
+  return readable;
 }
 
 int osquery_cqueue_commit(osquery_cqueue_t *queue, void *space) {
   int err = 0;
 
-  lck_spin_lock(queue->lck);
+  osquery_cqueue_ring_t *ring = find_ring(queue, space);
+  if (ring == NULL) {
+    return -1;  // Invalid space.
+  }
+
+  lck_spin_lock(ring->lck);
 
   // Retrieve the header for the initialized space.
   osquery_data_header_t *header = ((osquery_data_header_t *)space) - 1;
-  if (OSQUERY_BETWEEN != is_between(queue, header, queue->max_read,
-                                    queue->write,
+  if (OSQUERY_BETWEEN != is_between(ring, header, ring->max_read,
+                                    ring->write,
                                     sizeof(osquery_data_header_t)) ||
-      queue->reservations == 0 || header->event == END_OF_BUFFER_EVENT ||
+      ring->reservations == 0 || header->event == END_OF_BUFFER_EVENT ||
       header->finished) {
     err = -1;  // Invalid space.
     goto error_exit;
@@ -331,12 +446,14 @@ int osquery_cqueue_commit(osquery_cqueue_t *queue, void *space) {
   clock_get_system_microtime(&seconds, &microsecs);
   header->time.uptime = (uint64_t)seconds;
 
-  coalesce_readable(queue);
+  if (coalesce_readable(ring) && queue->waiting) {
+    // Only a waiting daemon is woken, see osquery_cqueue_wait_for_data.
+    wakeup(&queue->waiting);
+  }
 
-  queue->reservations--;
-  wakeup(&queue->reservations);
+  ring->reservations--;
+  wakeup(&ring->reservations);
 error_exit:
-  lck_spin_unlock(queue->lck);
+  lck_spin_unlock(ring->lck);
   return err;
 }
-
@@ -31,7 +31,7 @@
 extern "C" {
 #endif
 
-// Circular queue data structure.
+// A single producer ring within the circular queue.
 typedef struct {
   uint8_t *buffer;
   size_t size;
@@ -41,6 +41,21 @@ typedef struct {
   int drops;
   int initialized;
   uint32_t reservations;
+
+  lck_spin_t *lck;
+} osquery_cqueue_ring_t;
+
+// Circular queue data structure.
+//
+// The shared buffer is split into per-CPU rings, each with its own lock, so
+// producers on different CPUs do not contend. The queue lock only guards
+// initialization and waiting for data.
+typedef struct {
+  osquery_cqueue_ring_t rings[OSQUERY_MAX_RINGS];
+  uint32_t ring_count;
+  size_t ring_size;
+  int initialized;
+  int waiting;
   clock_sec_t last_destruction_time;
 
   lck_grp_attr_t *lck_grp_attr;
@@ -73,13 +88,18 @@ int osquery_cqueue_teardown(osquery_cqueue_t *queue);
 /** @brief Initialize a circular queue.
  *
  *  Initializes a circular queue given a preallocated buffer of a given size.
+ *  The buffer is split into equally sized, page aligned, rings.
  *
  *  @param queue The circular queue structure to initialize.
  *  @param buffer The buffer to use in the queue.
  *  @param size The size of the passed in buffer.
+ *  @param rings The number of rings, usually the number of CPUs.
  *  @return Void.
  */
-void osquery_cqueue_init(osquery_cqueue_t *queue, void *buffer, size_t size);
+void osquery_cqueue_init(osquery_cqueue_t *queue,
+                         void *buffer,
+                         size_t size,
+                         uint32_t rings);
 
 
 /** @brief Cleanup a cqueue.
@@ -99,23 +119,28 @@ void osquery_cqueue_init(osquery_cqueue_t *queue, void *buffer, size_t size);
 void osquery_cqueue_destroy(osquery_cqueue_t *queue);
 
 
-/** @brief Advance the read head in the buffer.
+/** @brief Advance the read head of each ring in the buffer.
+ *
+ *  Offsets are relative to the start of each ring.
  *
- *  @param queue The circular queue structure to advance the read head in.
- *  @param read_offset Offset of pointer to new location of read head.
- *  @param max_read_offset (Output) Output the offset of the max_read pointer.
+ *  @param queue The circular queue structure to advance the read heads in.
+ *  @param read_offsets Offsets of pointers to new locations of read heads.
+ *  @param max_read_offsets (Output) Output the offsets of the max_read pointers.
  *  @return Return negative on failure (invalid offset).
  */
-int osquery_cqueue_advance_read(osquery_cqueue_t *queue, size_t read_offset,
-                                size_t *max_read_offset);
+int osquery_cqueue_advance_read(osquery_cqueue_t *queue,
+                                const size_t *read_offsets,
+                                size_t *max_read_offsets);
 
 
-/** @brief Find the position of the max_read pointer.  Block if buffer is empty.
+/** @brief Find the positions of the max_read pointers.  Block if empty.
  *
- *  @param queue The queue to find the offset of the max_read pointer in.
- *  @return Return offset of max_read pointer.  Negative on failure.
+ *  @param queue The queue to find the offsets of the max_read pointers in.
+ *  @param max_read_offsets (Output) Output the offsets of the max_read pointers.
+ *  @return Return negative on failure.
  */
-ssize_t osquery_cqueue_wait_for_data(osquery_cqueue_t *queue);
+int osquery_cqueue_wait_for_data(osquery_cqueue_t *queue,
+                                 size_t *max_read_offsets);
 
 /** @brief Returns if the cqueue has dropped data.
  *
@@ -128,6 +153,7 @@ int osquery_cqueue_dropped_data(osquery_cqueue_t *queue);
 
 /** @brief Reserve space to store an event in the queue.
  *
+ *  The space is reserved in the ring of the current CPU.
  *  This gives you a brief moment to write data to the returned space.
  *  NOTE: You must call the commit function on your pointer shortly after
  *  reserving it.  Otherwise the buffer will become deadlocked.
@@ -0,0 +1,166 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <libkern/libkern.h>
+#include <libkern/OSMalloc.h>
+
+#include <sys/errno.h>
+#include <sys/lock.h>
+
+#include "filters.h"
+
+#define TAGNAME "com.facebook.security.osquery.filters"
+
+typedef struct {
+  uint64_t uid_low;
+  uint64_t uid_high;
+  size_t path_len;
+  char path[MAXPATHLEN];
+} osquery_filter_rule_t;
+
+static struct {
+  osquery_filter_rule_t *rules[OSQUERY_NUM_EVENTS][OSQUERY_MAX_FILTERS];
+  uint32_t counts[OSQUERY_NUM_EVENTS];
+
+  OSMallocTag malloc_tag;
+  lck_grp_attr_t *lck_grp_attr;
+  lck_grp_t *lck_grp;
+  lck_attr_t *lck_attr;
+  lck_rw_t *lck;
+} filters;
+
+void osquery_filters_setup(void) {
+  bzero(filters.rules, sizeof(filters.rules));
+  bzero(filters.counts, sizeof(filters.counts));
+
+  filters.malloc_tag = OSMalloc_Tagalloc(TAGNAME, OSMT_DEFAULT);
+
+  filters.lck_grp_attr = lck_grp_attr_alloc_init();
+  lck_grp_attr_setstat(filters.lck_grp_attr);
+  filters.lck_grp =
+      lck_grp_alloc_init("osquery filters", filters.lck_grp_attr);
+  filters.lck_attr = lck_attr_alloc_init();
+  filters.lck = lck_rw_alloc_init(filters.lck_grp, filters.lck_attr);
+}
+
+void osquery_filters_teardown(void) {
+  osquery_filters_reset();
+
+  lck_rw_free(filters.lck, filters.lck_grp);
+  lck_attr_free(filters.lck_attr);
+  lck_grp_free(filters.lck_grp);
+  lck_grp_attr_free(filters.lck_grp_attr);
+
+  if (filters.malloc_tag) {
+    OSMalloc_Tagfree(filters.malloc_tag);
+    filters.malloc_tag = NULL;
+  }
+}
+
+/** @brief Remove the rules of an event type.
+ *
+ *  The rules are unlinked while holding the lock, and freed after.
+ */
+static void clear_rules(osquery_event_t event) {
+  osquery_filter_rule_t *removed[OSQUERY_MAX_FILTERS];
+  uint32_t count = 0;
+
+  lck_rw_lock_exclusive(filters.lck);
+  count = filters.counts[event];
+  for (uint32_t i = 0; i < count; i++) {
+    removed[i] = filters.rules[event][i];
+    filters.rules[event][i] = NULL;
+  }
+  filters.counts[event] = 0;
+  lck_rw_unlock_exclusive(filters.lck);
+
+  for (uint32_t i = 0; i < count; i++) {
+    OSFree(removed[i], sizeof(osquery_filter_rule_t), filters.malloc_tag);
+  }
+}
+
+void osquery_filters_reset(void) {
+  for (int i = 0; i < OSQUERY_NUM_EVENTS; i++) {
+    clear_rules((osquery_event_t)i);
+  }
+}
+
+int osquery_filters_update(const osquery_filter_args_t *args) {
+  if (!(OSQUERY_NULL_EVENT < args->event && args->event < OSQUERY_NUM_EVENTS)) {
+    return -EINVAL;
+  }
+
+  if (args->action == OSQUERY_FILTER_CLEAR) {
+    clear_rules(args->event);
+    return 0;
+  } else if (args->action != OSQUERY_FILTER_INCLUDE) {
+    return -EINVAL;
+  }
+
+  if (args->uid_low > args->uid_high || filters.malloc_tag == NULL) {
+    return -EINVAL;
+  }
+
+  // Allocate before locking, callbacks only wait for the copy.
+  osquery_filter_rule_t *rule =
+      OSMalloc(sizeof(osquery_filter_rule_t), filters.malloc_tag);
+  if (rule == NULL) {
+    return -ENOMEM;
+  }
+
+  rule->uid_low = args->uid_low;
+  rule->uid_high = args->uid_high;
+  strlcpy(rule->path, args->path, MAXPATHLEN);
+  rule->path_len = strnlen(rule->path, MAXPATHLEN);
+
+  int err = 0;
+  lck_rw_lock_exclusive(filters.lck);
+  if (filters.counts[args->event] < OSQUERY_MAX_FILTERS) {
+    filters.rules[args->event][filters.counts[args->event]++] = rule;
+    rule = NULL;
+  } else {
+    err = -ENOSPC;
+  }
+  lck_rw_unlock_exclusive(filters.lck);
+
+  if (rule != NULL) {
+    OSFree(rule, sizeof(osquery_filter_rule_t), filters.malloc_tag);
+  }
+  return err;
+}
+
+int osquery_filters_active(osquery_event_t event) {
+  if (!(OSQUERY_NULL_EVENT < event && event < OSQUERY_NUM_EVENTS)) {
+    return 0;
+  }
+  return filters.counts[event] > 0;
+}
+
+int osquery_filters_match(osquery_event_t event,
+                          uint64_t uid,
+                          const char *path) {
+  if (!osquery_filters_active(event)) {
+    return 1;
+  }
+
+  int included = 0;
+  lck_rw_lock_shared(filters.lck);
+  for (uint32_t i = 0; i < filters.counts[event] && !included; i++) {
+    osquery_filter_rule_t *rule = filters.rules[event][i];
+    included = (uid >= rule->uid_low && uid <= rule->uid_high);
+    if (included && rule->path_len > 0) {
+      included = (path != NULL &&
+                  strncmp(path, rule->path, rule->path_len) == 0);
+    }
+  }
+  lck_rw_unlock_shared(filters.lck);
+
+  return included;
+}
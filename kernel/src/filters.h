@@ -0,0 +1,79 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+/** @brief Event filter rules pushed by the daemon.
+ *
+ *  Publishers check the rules for their event type before reserving space in
+ *  the circular queue, so events no subscriber wants are never copied to the
+ *  daemon.
+ *
+ *  If an event type has rules, its events are dropped unless they match at
+ *  least one.  A rule matches when the user ID is within its range and the
+ *  path starts with its prefix.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <feeds.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief Setup the filter rule locks.
+ *
+ *  @return Void.
+ */
+void osquery_filters_setup(void);
+
+/** @brief Remove all filter rules and free the locks.
+ *
+ *  @return Void.
+ */
+void osquery_filters_teardown(void);
+
+/** @brief Remove the filter rules of every event type.
+ *
+ *  @return Void.
+ */
+void osquery_filters_reset(void);
+
+/** @brief Add a filter rule, or clear the rules of an event type.
+ *
+ *  @param args The rule requested by the daemon.
+ *  @return 0 on success.  Negative for an invalid rule or too many rules.
+ */
+int osquery_filters_update(const osquery_filter_args_t *args);
+
+/** @brief Check if an event type has any filter rules.
+ *
+ *  This does not lock, publishers use it to avoid looking up an event's path
+ *  when there are no rules.
+ *
+ *  @param event The event type.
+ *  @return 1 if the event type has rules.
+ */
+int osquery_filters_active(osquery_event_t event);
+
+/** @brief Check an event against the rules of its type.
+ *
+ *  @param event The event type.
+ *  @param uid The real user ID of the event's process.
+ *  @param path The event's file or executable path, may be NULL.
+ *  @return 1 if the event should be published.
+ */
+int osquery_filters_match(osquery_event_t event,
+                          uint64_t uid,
+                          const char *path);
+
+#ifdef __cplusplus
+}  // end extern "c"
+#endif
@@ -16,6 +16,7 @@
 #include <sys/conf.h>
 #include <miscfs/devfs/devfs.h>
 #include <sys/vnode.h>
+#include <sys/sysctl.h>
 
 // IOKit headers
 #include <IOKit/IOMemoryDescriptor.h>
@@ -24,6 +25,7 @@
 #include "publishers.h"
 
 #include "circular_queue_kern.h"
+#include "filters.h"
 
 #ifdef DEBUG
 #define dbg_printf(...) printf("osquery kext: " __VA_ARGS__)
@@ -134,20 +136,17 @@ static int subscribe_to_event(osquery_event_t event, int subscribe) {
 }
 
 static int update_user_kernel_buffer(int options,
-                                     size_t read_offset,
-                                     size_t *max_read_offset,
+                                     const size_t *read_offsets,
+                                     size_t *max_read_offsets,
                                      int *drops) {
   if (osquery_cqueue_advance_read(
-          &osquery.cqueue, read_offset, max_read_offset)) {
+          &osquery.cqueue, read_offsets, max_read_offsets)) {
     return -EINVAL;
   }
   if (!(options & OSQUERY_OPTIONS_NO_BLOCK)) {
-    ssize_t offset = 0;
-    if ((offset = osquery_cqueue_wait_for_data(&osquery.cqueue)) < 0) {
+    if (osquery_cqueue_wait_for_data(&osquery.cqueue, max_read_offsets) < 0) {
       return -EINVAL;
     }
-
-    *max_read_offset = offset;
   }
   *drops = osquery_cqueue_dropped_data(&osquery.cqueue);
   return 0;
@@ -172,7 +171,19 @@ static void cleanup_user_kernel_buffer() {
   }
 }
 
-static int allocate_user_kernel_buffer(size_t size, void **buf) {
+static uint32_t get_cpu_count() {
+  int ncpu = 0;
+  size_t size = sizeof(ncpu);
+  if (sysctlbyname("hw.ncpu", &ncpu, &size, NULL, 0) != 0 || ncpu <= 0) {
+    return 1;
+  }
+  return (uint32_t)ncpu;
+}
+
+static int allocate_user_kernel_buffer(size_t size,
+                                       void **buf,
+                                       uint32_t *rings,
+                                       size_t *ring_size) {
   int err = 0;
 
   // The user space daemon is requesting a new circular queue.
@@ -217,7 +228,11 @@ static int allocate_user_kernel_buffer(size_t size, void **buf) {
   // The virtual address will be shared back to the user space queue manager.
   *buf = (void *)osquery.mm->getAddress();
   // Initialize the kernel space queue manager with the new buffer.
-  osquery_cqueue_init(&osquery.cqueue, osquery.buffer, osquery.buf_size);
+  // Each CPU writes to its own ring within the buffer.
+  osquery_cqueue_init(
+      &osquery.cqueue, osquery.buffer, osquery.buf_size, get_cpu_count());
+  *rings = osquery.cqueue.ring_count;
+  *ring_size = osquery.cqueue.ring_size;
 
   return 0;
 error_exit:
@@ -249,6 +264,7 @@ static int osquery_close(dev_t dev, int flag, int fmt, struct proc *p) {
   lck_mtx_lock(osquery.mtx);
   if (osquery.open_count == 1) {
     unsubscribe_all_events();
+    osquery_filters_reset();
     cleanup_user_kernel_buffer();
     osquery.open_count--;
   }
@@ -316,6 +332,13 @@ static int osquery_ioctl(
     }
     break;
 
+  // Daemon is requesting a filter rule for subscribed events.
+  case OSQUERY_IOCTL_FILTER:
+    if ((err = osquery_filters_update((osquery_filter_args_t *)data))) {
+      goto error_exit;
+    }
+    break;
+
   // Daemon is requesting a synchronization of readable queue space.
   case OSQUERY_IOCTL_BUF_SYNC:
     // The queue buffer cannot be synchronized if it has not been allocated.
@@ -328,8 +351,8 @@ static int osquery_ioctl(
     lck_mtx_unlock(osquery.mtx);
     sync = (osquery_buf_sync_args_t *)data;
     if ((err = update_user_kernel_buffer(sync->options,
-                                         sync->read_offset,
-                                         &(sync->max_read_offset),
+                                         sync->read_offsets,
+                                         sync->max_read_offsets,
                                          &(sync->drops)))) {
       lck_mtx_lock(osquery.mtx);
       goto error_exit;
@@ -355,12 +378,17 @@ static int osquery_ioctl(
     }
 
     // Attempt to allocation and set up the circular queue.
-    if ((err = allocate_user_kernel_buffer(alloc->size, &(alloc->buffer)))) {
+    if ((err = allocate_user_kernel_buffer(alloc->size,
+                                           &(alloc->buffer),
+                                           &(alloc->rings),
+                                           &(alloc->ring_size)))) {
       goto error_exit;
     }
 
-    dbg_printf(
-        "IOCTL alloc: size %lu, location %p\n", alloc->size, alloc->buffer);
+    dbg_printf("IOCTL alloc: size %lu, location %p, rings %u\n",
+               alloc->size,
+               alloc->buffer,
+               alloc->rings);
     break;
   default:
     err = -ENOTTY;
@@ -398,6 +426,7 @@ kern_return_t OsqueryStart(kmod_info_t *ki, void *d) {
   // Restart the queue and setup queue locks.
   // This does not allocate, share, or set the queue buffer or buffer values.
   osquery_cqueue_setup(&osquery.cqueue);
+  osquery_filters_setup();
 
   // Initialize the IOCTL (and more) device node.
   osquery.major_number = cdevsw_add(osquery.major_number, &osquery_cdevsw);
@@ -439,6 +468,7 @@ error_exit:
 
   // Reset the queue and remove the queue locks.
   osquery_cqueue_teardown(&osquery.cqueue);
+  osquery_filters_teardown();
   return KERN_FAILURE;
 }
 
@@ -460,6 +490,9 @@ kern_return_t OsqueryStop(kmod_info_t *ki, void *d) {
     return KERN_FAILURE;
   }
 
+  // Publishers are unsubscribed and no longer check the filter rules.
+  osquery_filters_teardown();
+
   // Remove the device node.
   devfs_remove(osquery.devfs);
   osquery.devfs = NULL;
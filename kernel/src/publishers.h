@@ -11,6 +11,7 @@
 #include <feeds.h>
 
 #include "circular_queue_kern.h"
+#include "filters.h"
 
 /** @brief Subscribe function type.
  *
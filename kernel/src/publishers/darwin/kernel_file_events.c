@@ -66,7 +66,9 @@ static int fileop_scope_callback(kauth_cred_t credential,
         break;
       }
     }
-    if (subscribed_to_event) {
+    if (subscribed_to_event &&
+        osquery_filters_match(
+            OSQUERY_FILE_EVENT, kauth_cred_getruid(credential), path)) {
       // Someone is using a file in a way that we are subscribed to.
       int path_len = MAXPATHLEN;
 
@@ -154,7 +156,12 @@ static int subscribe(osquery_cqueue_t *queue) {
     goto error_exit;
   }
 
-  sub->pathlen = strnlen(sub->subscription.path, MAXPATHLEN);
+  // The daemon selects paths using filter rules, subscribe to every path.
+  sub->subscription.actions =
+      OSQUERY_FILE_ACTION_OPEN | OSQUERY_FILE_ACTION_CLOSE |
+      OSQUERY_FILE_ACTION_CLOSE_MODIFIED;
+  sub->subscription.path[0] = '\0';
+  sub->pathlen = 0;
 
   // Check if we are already subscribed to this event.
   subscription_t *sub_entry = NULL;
@@ -54,6 +54,20 @@ static int process_cred_label_update_execvew(kauth_cred_t old_cred,
     goto error_exit;
   }
 
+  // Drop filtered executions before reserving queue space.
+  if (osquery_filters_active(OSQUERY_PROCESS_EVENT)) {
+    char filter_path[MAXPATHLEN];
+    if (vn_getpath(vp, filter_path, &path_len) != 0) {
+      filter_path[0] = '\0';
+    }
+    path_len = MAXPATHLEN;
+    if (!osquery_filters_match(OSQUERY_PROCESS_EVENT,
+                               kauth_cred_getruid(new_cred),
+                               filter_path)) {
+      goto error_exit;
+    }
+  }
+
   // Determine address of image_params based off of csflags pointer. (HACKY)
   struct image_params *img =
       (struct image_params *)((char *)csflags -
@@ -155,7 +169,8 @@ static struct mac_policy_conf policy_conf = {
 static int subscribe(osquery_cqueue_t *queue) {
   cqueue = queue;
   if (handle != 0) {
-    return -1;
+    // Already subscribed, the daemon may resubscribe after a config update.
+    return 0;
   }
 
   mac_policy_register(&policy_conf, &handle, NULL);
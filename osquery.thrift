@@ -21,6 +21,8 @@ struct InternalExtensionInfo {
   2:string version,
   3:string sdk_version,
   4:string min_sdk_version,
+  /// Optional shared memory ring for bulk logger requests to the extension.
+  5:string shared_ring,
 }
 
 /// Unique ID for each extension.
@@ -51,6 +53,31 @@ struct ExtensionResponse {
   2:ExtensionPluginResponse response,
 }
 
+/// A typed table column, only the list matching the column type is used.
+struct ExtensionColumn {
+  1:string name,
+  /// The column type name (e.g., TEXT, INTEGER, BIGINT, DOUBLE).
+  2:string type,
+  3:list<i64> integers,
+  4:list<double> doubles,
+  5:list<string> texts,
+  /// A bitmap with one bit for each row, set for NULL values.
+  6:binary nulls,
+}
+
+/// A column-oriented table result.
+struct ExtensionColumnarResponse {
+  1:ExtensionStatus status,
+  2:i64 rows,
+  3:list<ExtensionColumn> columns,
+}
+
+/// A table cursor, batches of rows are read using the cursor id.
+struct ExtensionCursor {
+  1:ExtensionStatus status,
+  2:i64 id,
+}
+
 exception ExtensionException {
   1:i32 code,
   2:string message,
@@ -68,6 +95,24 @@ service Extension {
     2:string item,
     /// The thrift-equivilent of an osquery::PluginRequest.
     3:ExtensionPluginRequest request),
+  /// Generate a table using typed columns, the request is a table "generate".
+  ExtensionColumnarResponse callColumns(
+    1:string registry,
+    2:string item,
+    3:ExtensionPluginRequest request),
+  /// Open a cursor generating a table in batches of typed columns.
+  ExtensionCursor openCursor(
+    1:string table,
+    /// The table plugin "generate" request.
+    2:ExtensionPluginRequest request,
+    /// The most rows returned in each batch.
+    3:i32 batch_rows),
+  /// Read the next batch of rows, an empty batch closes the cursor.
+  ExtensionColumnarResponse nextBatch(
+    1:i64 cursor),
+  /// Close a cursor before all rows were read.
+  void closeCursor(
+    1:i64 cursor),
   /// Request that an extension shutdown (does not apply to managers).
   void shutdown(),
 }
@@ -8,15 +8,18 @@
  *
  */
 
+#include <algorithm>
 #include <chrono>
 #include <mutex>
 #include <random>
+#include <set>
 
 #include <boost/algorithm/string/trim.hpp>
 #include <boost/property_tree/json_parser.hpp>
 
 #include <osquery/config.h>
 #include <osquery/database.h>
+#include <osquery/dispatcher.h>
 #include <osquery/filesystem.h>
 #include <osquery/flags.h>
 #include <osquery/hash.h>
@@ -27,6 +30,8 @@
 #include <osquery/tables.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/core/process.h"
+#include "osquery/database/query.h"
 
 namespace pt = boost::property_tree;
 
@@ -61,9 +66,15 @@ CLI_FLAG(bool,
 
 CLI_FLAG(bool, config_dump, false, "Dump the contents of the configuration");
 
+FLAG(bool,
+     config_respawn_snapshot,
+     false,
+     "Respawned workers start from the last config, then load it again");
+
 DECLARE_string(config_plugin);
 DECLARE_string(pack_delimiter);
 DECLARE_bool(disable_events);
+DECLARE_bool(schedule_splay_cost);
 
 /**
  * @brief The backing store key name for the executing query.
@@ -75,6 +86,18 @@ DECLARE_bool(disable_events);
 const std::string kExecutingQuery = "executing_query";
 const std::string kFailedQueries = "failed_queries";
 
+/**
+ * @brief The backing store key prefix for the last content of each source.
+ *
+ * The watcher sets OSQUERY_RESPAWN for every worker after the first. A
+ * respawned worker applies the saved content instead of waiting on the config
+ * plugin, see config_respawn_snapshot.
+ */
+const std::string kConfigSnapshotPrefix = "config_snapshot.";
+
+/// Number of schedule steps (seconds) considered when leveling query costs.
+const size_t kScheduleLoadSteps = 3600;
+
 // The config may be accessed and updated asynchronously; use mutexes.
 Mutex config_hash_mutex_;
 Mutex config_valid_mutex_;
@@ -89,6 +112,12 @@ RecursiveMutex config_performance_mutex_;
 
 using PackRef = std::shared_ptr<Pack>;
 
+/// Load the config in the background, after a worker applied the snapshot.
+class ConfigReloadRunner : public InternalRunnable {
+ public:
+  void start() override;
+};
+
 /**
  * The schedule is an iterable collection of Packs. When you iterate through
  * a schedule, you only get the packs that should be running on the host that
@@ -245,7 +274,15 @@ void Config::addPack(const std::string& name,
                      const pt::ptree& tree) {
   RecursiveLock wlock(config_schedule_mutex_);
   try {
-    schedule_->add(std::make_shared<Pack>(name, source, tree));
+    // A pack replacing a previous version keeps its unchanged queries.
+    PackRef previous;
+    for (const auto& pack : schedule_->packs_) {
+      if (pack->getName() == name && pack->getSource() == source) {
+        previous = pack;
+        break;
+      }
+    }
+    schedule_->add(std::make_shared<Pack>(name, source, tree, previous.get()));
     if (schedule_->last()->shouldPackExecute()) {
       applyParsers(source + FLAGS_pack_delimiter + name, tree, true);
     }
@@ -273,18 +310,23 @@ void Config::removeFiles(const std::string& source) {
   }
 }
 
+/// The scheduled query name may be synthetic, including the pack name.
+inline std::string scheduledQueryName(const PackRef& pack,
+                                      const std::string& query) {
+  if (pack->getName() != "main" && pack->getName() != "legacy_main") {
+    return "pack" + FLAGS_pack_delimiter + pack->getName() +
+           FLAGS_pack_delimiter + query;
+  }
+  return query;
+}
+
 void Config::scheduledQueries(
     std::function<void(const std::string& name, const ScheduledQuery& query)>
         predicate) {
   RecursiveLock lock(config_schedule_mutex_);
   for (const PackRef& pack : *schedule_) {
     for (const auto& it : pack->getSchedule()) {
-      std::string name = it.first;
-      // The query name may be synthetic.
-      if (pack->getName() != "main" && pack->getName() != "legacy_main") {
-        name = "pack" + FLAGS_pack_delimiter + pack->getName() +
-               FLAGS_pack_delimiter + it.first;
-      }
+      auto name = scheduledQueryName(pack, it.first);
       // They query may have failed and been added to the schedule's blacklist.
       if (schedule_->blacklist_.count(name) > 0) {
         auto blacklisted_query = schedule_->blacklist_.find(name);
@@ -311,6 +353,17 @@ void Config::packs(std::function<void(PackRef& pack)> predicate) {
 }
 
 Status Config::load() {
+  if (!loaded_ && FLAGS_config_respawn_snapshot &&
+      getEnvVar("OSQUERY_RESPAWN").is_initialized()) {
+    auto status = loadSnapshot();
+    if (status.ok()) {
+      // The config plugin's content replaces the snapshot once it loads.
+      Dispatcher::addService(std::make_shared<ConfigReloadRunner>());
+      return status;
+    }
+    VLOG(1) << "Cannot start from the config snapshot: " << status.what();
+  }
+
   valid_ = false;
   auto& config_plugin = Registry::getActive("config");
   if (!Registry::exists("config", config_plugin)) {
@@ -345,6 +398,44 @@ Status Config::load() {
   return status;
 }
 
+Status Config::loadSnapshot() {
+  std::vector<std::string> keys;
+  scanDatabaseKeys(kPersistentSettings, keys, kConfigSnapshotPrefix);
+  if (keys.empty()) {
+    return Status(1, "No config snapshot");
+  }
+
+  std::map<std::string, std::string> config;
+  for (const auto& key : keys) {
+    auto& content = config[key.substr(kConfigSnapshotPrefix.size())];
+    auto status = getDatabaseValue(kPersistentSettings, key, content);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+
+  valid_ = true;
+  auto status = update(config);
+  loaded_ = true;
+  return status;
+}
+
+void ConfigReloadRunner::start() {
+  std::map<std::string, std::string> config;
+  auto plugin = Registry::get("config", Registry::getActive("config"));
+  auto config_plugin = std::dynamic_pointer_cast<ConfigPlugin>(plugin);
+  if (config_plugin == nullptr || interrupted()) {
+    return;
+  }
+
+  auto status = config_plugin->genConfig(config);
+  if (!status.ok()) {
+    LOG(WARNING) << "Error reading config: " << status.toString();
+    return;
+  }
+  Config::getInstance().update(config);
+}
+
 /**
  * @brief Boost's 1.59 property tree based JSON parser does not accept comments.
  *
@@ -368,16 +459,45 @@ inline void stripConfigComments(std::string& json) {
   json = sink;
 }
 
-Status Config::updateSource(const std::string& source,
-                            const std::string& json) {
-  // Compute a 'synthesized' hash using the content before it is parsed.
-  hashSource(source, json);
+/// Hash a configuration subtree, used to find changed packs and parser keys.
+static std::string hashTree(const pt::ptree& tree) {
+  std::string content;
+  try {
+    std::stringstream stream;
+    pt::write_json(stream, tree, false);
+    content = stream.str();
+  } catch (const pt::json_parser::json_parser_error& e) {
+    // A value without children cannot be written as JSON.
+    content = tree.data();
+  }
+  return hashFromBuffer(HASH_TYPE_MD5, content.data(), content.size());
+}
+
+bool Config::updatePackHash(const std::string& source,
+                            const std::string& name,
+                            const std::string& hash) {
+  bool scheduled = false;
+  {
+    RecursiveLock lock(config_schedule_mutex_);
+    for (const auto& pack : schedule_->packs_) {
+      if (pack->getName() == name && pack->getSource() == source) {
+        scheduled = true;
+        break;
+      }
+    }
+  }
 
-  // Remove all packs from this source.
-  schedule_->removeAll(source);
-  // Remove all files from this source.
-  removeFiles(source);
+  WriteLock wlock(config_hash_mutex_);
+  auto& previous = pack_hashes_[source + FLAGS_pack_delimiter + name];
+  if (scheduled && previous == hash) {
+    return false;
+  }
+  previous = hash;
+  return true;
+}
 
+Status Config::updateSource(const std::string& source,
+                            const std::string& json) {
   // load the config (source.second) into a pt::ptree
   pt::ptree tree;
   try {
@@ -387,15 +507,41 @@ Status Config::updateSource(const std::string& source,
     json_stream << clone;
     pt::read_json(json_stream, tree);
   } catch (const pt::json_parser::json_parser_error& e) {
+    // Invalid content removes the source's packs and files, the same content
+    // should be parsed, and fail, again.
+    schedule_->removeAll(source);
+    removeFiles(source);
+    WriteLock wlock(config_hash_mutex_);
+    hash_.erase(source);
+    auto prefix = source + FLAGS_pack_delimiter;
+    for (auto* hashes : {&pack_hashes_, &parser_hashes_}) {
+      for (auto it = hashes->begin(); it != hashes->end();) {
+        if (it->first.compare(0, prefix.size(), prefix) == 0) {
+          it = hashes->erase(it);
+        } else {
+          ++it;
+        }
+      }
+    }
     return Status(1, "Error parsing the config JSON");
   }
 
+  // Packs within this source, packs that are no longer present are removed.
+  std::set<std::string> packs;
+  auto updatePack = [this, &source, &packs](const std::string& name,
+                                            const pt::ptree& pack) {
+    packs.insert(name);
+    if (updatePackHash(source, name, hashTree(pack))) {
+      addPack(name, source, pack);
+    }
+  };
+
   // extract the "schedule" key and store it as the main pack
   if (tree.count("schedule") > 0 && !Registry::external()) {
     auto& schedule = tree.get_child("schedule");
     pt::ptree main_pack;
     main_pack.add_child("queries", schedule);
-    addPack("main", source, main_pack);
+    updatePack("main", main_pack);
   }
 
   if (tree.count("scheduledQueries") > 0 && !Registry::external()) {
@@ -404,29 +550,56 @@ Status Config::updateSource(const std::string& source,
     for (const std::pair<std::string, pt::ptree>& query : scheduled_queries) {
       auto query_name = query.second.get<std::string>("name", "");
       if (query_name.empty()) {
+        WriteLock wlock(config_hash_mutex_);
+        hash_.erase(source);
         return Status(1, "Error getting name from legacy scheduled query");
       }
       queries.add_child(query_name, query.second);
     }
     pt::ptree legacy_pack;
     legacy_pack.add_child("queries", queries);
-    addPack("legacy_main", source, legacy_pack);
+    updatePack("legacy_main", legacy_pack);
   }
 
   // extract the "packs" key into additional pack objects
+  bool generated = false;
   if (tree.count("packs") > 0 && !Registry::external()) {
-    auto& packs = tree.get_child("packs");
-    for (const auto& pack : packs) {
-      auto value = packs.get<std::string>(pack.first, "");
+    auto& packs_tree = tree.get_child("packs");
+    for (const auto& pack : packs_tree) {
+      auto value = packs_tree.get<std::string>(pack.first, "");
       if (value.empty()) {
         // The pack is a JSON object, treat the content as pack data.
-        addPack(pack.first, source, pack.second);
+        updatePack(pack.first, pack.second);
       } else {
+        packs.insert(pack.first);
         genPack(pack.first, source, value);
+        generated = true;
       }
     }
   }
 
+  {
+    RecursiveLock lock(config_schedule_mutex_);
+    std::vector<std::string> removed;
+    for (const auto& pack : schedule_->packs_) {
+      if (pack->getSource() == source && packs.count(pack->getName()) == 0) {
+        removed.push_back(pack->getName());
+      }
+    }
+    for (const auto& name : removed) {
+      schedule_->remove(name, source);
+    }
+  }
+
+  {
+    WriteLock wlock(config_hash_mutex_);
+    if (generated) {
+      generated_sources_.insert(source);
+    } else {
+      generated_sources_.erase(source);
+    }
+  }
+
   applyParsers(source, tree, false);
   return Status(0, "OK");
 }
@@ -445,10 +618,17 @@ Status Config::genPack(const std::string& name,
     return Status(1, "Invalid plugin response");
   }
 
+  // Resources are read on every update, the content may be unchanged.
+  const auto& content = response[0][name];
+  auto hash = hashFromBuffer(HASH_TYPE_MD5, content.data(), content.size());
+  if (!updatePackHash(source, name, hash)) {
+    return Status(0);
+  }
+
   try {
     pt::ptree pack_tree;
     std::stringstream pack_stream;
-    pack_stream << response[0][name];
+    pack_stream << content;
     pt::read_json(pack_stream, pack_tree);
     addPack(name, source, pack_tree);
   } catch (const pt::json_parser::json_parser_error& e) {
@@ -474,12 +654,28 @@ void Config::applyParsers(const std::string& source,
 
     // For each key requested by the parser, add a property tree reference.
     std::map<std::string, pt::ptree> parser_config;
+    std::string hashes;
     for (const auto& key : parser->keys()) {
       if (tree.count(key) > 0) {
         parser_config[key] = tree.get_child(key);
       } else {
         parser_config[key] = pt::ptree();
       }
+      if (!pack) {
+        hashes += key + ":" + hashTree(parser_config[key]) + ",";
+      }
+    }
+
+    // A pack's parsers run when the pack is added, a source's parsers only
+    // run when their keys change.
+    if (!pack) {
+      WriteLock wlock(config_hash_mutex_);
+      auto& previous =
+          parser_hashes_[source + FLAGS_pack_delimiter + plugin.first];
+      if (previous == hashes) {
+        continue;
+      }
+      previous = hashes;
     }
     // The config parser plugin will receive a copy of each property tree for
     // each top-level-config key. The parser may choose to update the config's
@@ -506,17 +702,50 @@ Status Config::update(const std::map<std::string, std::string>& config) {
     }
   }
 
-  // Iterate though each source and overwrite config data.
+  // Compute a 'synthesized' hash using the content before it is parsed.
+  // Sources with unchanged content are not parsed again, unless their packs
+  // are generated from resources that may have changed.
+  std::vector<std::string> updated;
+  for (const auto& source : config) {
+    bool changed = hashSource(source.first, source.second);
+    if (!changed) {
+      WriteLock wlock(config_hash_mutex_);
+      changed = (generated_sources_.count(source.first) > 0);
+    }
+    if (changed) {
+      updated.push_back(source.first);
+    }
+  }
+
+  if (updated.empty()) {
+    return Status(0, "OK");
+  }
+
+  // Iterate though each changed source and overwrite config data.
   // This will add/overwrite pack data, append to the schedule, change watched
   // files, set options, etc.
   // Before this occurs, take an opportunity to purge stale state.
   purge();
 
-  for (const auto& source : config) {
-    auto status = updateSource(source.first, source.second);
+  for (const auto& source : updated) {
+    auto status = updateSource(source, config.at(source));
     if (!status.ok()) {
       return status;
     }
+
+    if (FLAGS_config_respawn_snapshot && !Registry::external()) {
+      // Only changed content is saved for a respawned worker.
+      setDatabaseValue(kPersistentSettings,
+                       kConfigSnapshotPrefix + source,
+                       config.at(source));
+    }
+  }
+
+  // Options from the new content may change how the host is identified.
+  refreshHostIdentity();
+
+  if (FLAGS_schedule_splay_cost && !Registry::external()) {
+    levelSchedule();
   }
 
   if (loaded_) {
@@ -558,9 +787,23 @@ void Config::purge() {
   };
 
   RecursiveLock lock(config_schedule_mutex_);
+  std::set<std::string> expired;
   // Iterate over each result set in the database.
-  for (const auto& saved_query : saved_queries) {
-    if (queryExists(saved_query)) {
+  for (const auto& saved_key : saved_queries) {
+    // Fingerprints, snapshot digests, and result chunks are stored alongside,
+    // and expire with, the query.
+    auto saved_query = saved_key;
+    if (saved_query.find(kQueryFingerprintsPrefix) == 0) {
+      saved_query = saved_query.substr(kQueryFingerprintsPrefix.size());
+    } else if (saved_query.find(kQuerySnapshotPrefix) == 0) {
+      saved_query = saved_query.substr(kQuerySnapshotPrefix.size());
+    } else if (saved_query.find(kQueryChunksPrefix) == 0) {
+      // Chunk keys end with the chunk's digest.
+      saved_query = saved_query.substr(kQueryChunksPrefix.size());
+      saved_query = saved_query.substr(0, saved_query.rfind('.'));
+    }
+
+    if (queryExists(saved_query) || expired.count(saved_query) > 0) {
       continue;
     }
 
@@ -587,19 +830,100 @@ void Config::purge() {
 
     if (last_executed < getUnixTime() - 592200) {
       // Query has not run in the last week, expire results and interval.
-      deleteDatabaseValue(kQueries, saved_query);
+      Query::deleteStoredResults(saved_query);
       deleteDatabaseValue(kPersistentSettings, "interval." + saved_query);
       deleteDatabaseValue(kPersistentSettings, "timestamp." + saved_query);
       VLOG(1) << "Expiring results for scheduled query: " << saved_query;
+      expired.insert(saved_query);
+    }
+  }
+}
+
+void Config::levelSchedule() {
+  RecursiveLock lock(config_schedule_mutex_);
+  RecursiveLock perf_lock(config_performance_mutex_);
+
+  // A scheduled query and the expected cost of each execution.
+  struct Placement {
+    std::string name;
+    ScheduledQuery* query;
+    size_t cost;
+  };
+
+  // Use the measured CPU time per execution, from the schedule monitor.
+  std::vector<Placement> queries;
+  size_t known_cost = 0;
+  size_t known = 0;
+  for (PackRef& pack : schedule_->packs_) {
+    for (auto& it : pack->schedule_) {
+      size_t cost = 0;
+      auto perf = performance_.find(scheduledQueryName(pack, it.first));
+      if (perf != performance_.end() && perf->second.executions > 0) {
+        cost = (perf->second.user_time + perf->second.system_time) /
+               perf->second.executions;
+        cost = std::max<size_t>(cost, 1);
+        known_cost += cost;
+        known++;
+      }
+      queries.push_back({it.first, &it.second, cost});
+    }
+  }
+
+  // Queries without measurements are expected to cost an average execution.
+  auto default_cost = (known > 0) ? known_cost / known : 1;
+  std::vector<size_t> load(kScheduleLoadSteps, 0);
+  std::vector<Placement> unplaced;
+  for (auto& placement : queries) {
+    if (placement.cost == 0) {
+      placement.cost = default_cost;
     }
+
+    // Restored offsets keep their place across restarts and config updates.
+    // Queries kept from a previous update were already placed.
+    auto& query = *placement.query;
+    size_t offset = query.splayed_offset;
+    if (query.leveled ||
+        restoreSplayedOffset(
+            placement.name, query.interval, query.splayed_interval, offset)) {
+      query.splayed_offset = offset;
+      query.leveled = true;
+      for (size_t step = offset; step < load.size();
+           step += query.splayed_interval) {
+        load[step] += placement.cost;
+      }
+    } else {
+      unplaced.push_back(placement);
+    }
+  }
+
+  // Place the most expensive queries first, they are the hardest to level.
+  std::stable_sort(unplaced.begin(),
+                   unplaced.end(),
+                   [](const Placement& a, const Placement& b) {
+                     return a.cost > b.cost;
+                   });
+  for (auto& placement : unplaced) {
+    auto& query = *placement.query;
+    query.splayed_offset =
+        splayOffset(query.splayed_interval, placement.cost, load);
+    query.leveled = true;
+    saveSplayedOffset(placement.name,
+                      query.interval,
+                      query.splayed_interval,
+                      query.splayed_offset);
   }
 }
 
 void Config::reset() {
   schedule_ = std::make_shared<Schedule>();
   std::map<std::string, QueryPerformance>().swap(performance_);
+  std::map<std::string, TablePerformance>().swap(table_performance_);
   std::map<std::string, FileCategories>().swap(files_);
   std::map<std::string, std::string>().swap(hash_);
+  std::map<std::string, std::string>().swap(pack_hashes_);
+  std::map<std::string, std::string>().swap(parser_hashes_);
+  std::set<std::string>().swap(generated_sources_);
+  PackDiscovery::get().reset();
   valid_ = false;
   loaded_ = false;
   start_time_ = 0;
@@ -685,19 +1009,101 @@ void Config::recordQueryStart(const std::string& name) {
       kPersistentSettings, "timestamp." + name, std::to_string(getUnixTime()));
 }
 
+void Config::recordQueryLateness(const std::string& name,
+                                 size_t lateness,
+                                 size_t missed) {
+  RecursiveLock lock(config_performance_mutex_);
+  auto& query = performance_[name];
+  if (lateness > 0) {
+    query.late_executions += 1;
+    query.lateness += lateness;
+  }
+  query.missed_executions += missed;
+}
+
+void Config::recordQuerySharedGenerations(const std::string& name,
+                                          size_t reused) {
+  RecursiveLock lock(config_performance_mutex_);
+  performance_[name].shared_generations += reused;
+}
+
+void Config::recordQuerySharedExecution(const std::string& name) {
+  RecursiveLock lock(config_performance_mutex_);
+  performance_[name].shared_executions++;
+}
+
+void Config::recordQueryLatency(const std::string& name,
+                                size_t wall_time,
+                                size_t rows) {
+  RecursiveLock lock(config_performance_mutex_);
+  auto& query = performance_[name];
+  query.wall_time_histogram.record(wall_time);
+  query.rows_histogram.record(rows);
+}
+
+void Config::recordQueryAllocations(const std::string& name,
+                                    size_t allocations,
+                                    size_t bytes,
+                                    size_t peak) {
+  RecursiveLock lock(config_performance_mutex_);
+  auto& query = performance_[name];
+  query.allocations += allocations;
+  query.allocated_bytes += bytes;
+  query.peak_allocated_bytes = std::max(query.peak_allocated_bytes, peak);
+}
+
+void Config::recordTableGeneration(const std::string& table,
+                                   size_t filters,
+                                   size_t rows,
+                                   size_t generate_time,
+                                   size_t allocations,
+                                   size_t allocated_bytes) {
+  RecursiveLock lock(config_performance_mutex_);
+  auto& performance = table_performance_[table];
+  performance.generations += 1;
+  performance.filters += filters;
+  performance.rows += rows;
+  performance.generate_time += generate_time;
+  performance.allocations += allocations;
+  performance.allocated_bytes += allocated_bytes;
+  performance.generate_time_histogram.record(generate_time);
+}
+
+void Config::blacklistQuery(const std::string& name) {
+  RecursiveLock lock(config_schedule_mutex_);
+  schedule_->blacklist_[name] = getUnixTime() + 86400;
+  saveScheduleBlacklist(schedule_->blacklist_);
+}
+
 void Config::getPerformanceStats(
     const std::string& name,
     std::function<void(const QueryPerformance& query)> predicate) {
+  // Executions may add performance entries concurrently, look up under lock.
+  RecursiveLock lock(config_performance_mutex_);
   if (performance_.count(name) > 0) {
-    RecursiveLock lock(config_performance_mutex_);
     predicate(performance_.at(name));
   }
 }
 
-void Config::hashSource(const std::string& source, const std::string& content) {
-  WriteLock wlock(config_hash_mutex_);
-  hash_[source] =
+void Config::tablePerformance(
+    std::function<void(const std::string& table,
+                       const TablePerformance& performance)> predicate) {
+  RecursiveLock lock(config_performance_mutex_);
+  for (const auto& table : table_performance_) {
+    predicate(table.first, table.second);
+  }
+}
+
+bool Config::hashSource(const std::string& source, const std::string& content) {
+  auto hash =
       hashFromBuffer(HASH_TYPE_MD5, &(content.c_str())[0], content.size());
+  WriteLock wlock(config_hash_mutex_);
+  auto& previous = hash_[source];
+  if (previous == hash) {
+    return false;
+  }
+  previous = std::move(hash);
+  return true;
 }
 
 Status Config::getMD5(std::string& hash) {
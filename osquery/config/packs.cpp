@@ -10,10 +10,12 @@
 
 #include <algorithm>
 #include <random>
+#include <thread>
 
 #include <boost/property_tree/json_parser.hpp>
 
 #include <osquery/core.h>
+#include <osquery/dispatcher.h>
 #include <osquery/logger.h>
 #include <osquery/hash.h>
 #include <osquery/packs.h>
@@ -33,8 +35,19 @@ FLAG(uint64,
 
 FLAG(string, pack_delimiter, "_", "Delimiter for pack and query names");
 
+/// Threads executing expired discovery queries during a refresh.
+const size_t kPackDiscoveryThreads = 4;
+
+/// The most seconds between checks for expired discovery results.
+const size_t kPackDiscoveryPause = 60;
+
 FLAG(uint64, schedule_splay_percent, 10, "Percent to splay config times");
 
+FLAG(bool,
+     schedule_splay_cost,
+     false,
+     "Offset scheduled queries to level expected cost per second");
+
 FLAG(uint64,
      schedule_default_interval,
      3600,
@@ -85,8 +98,9 @@ size_t restoreSplayedValue(const std::string& name, size_t interval) {
   getDatabaseValue(kPersistentSettings, "interval." + name, content);
   if (!content.empty()) {
     // This query name existed before, check the last requested interval.
+    // A third, optional, detail is the splayed offset.
     auto details = osquery::split(content, ":");
-    if (details.size() == 2) {
+    if (details.size() == 2 || details.size() == 3) {
       long last_interval, last_splay;
       if (safeStrtol(details[0], 10, last_interval) &&
           safeStrtol(details[1], 10, last_splay)) {
@@ -105,9 +119,77 @@ size_t restoreSplayedValue(const std::string& name, size_t interval) {
   return splay;
 }
 
+size_t splayOffset(size_t interval, size_t cost, std::vector<size_t>& load) {
+  if (interval <= 1 || load.empty()) {
+    return 0;
+  }
+
+  // Intervals longer than the load ring only differ by their first step.
+  auto candidates = std::min(interval, load.size());
+  size_t offset = 0;
+  size_t best_peak = 0;
+  size_t best_total = 0;
+  for (size_t candidate = 0; candidate < candidates; ++candidate) {
+    size_t peak = 0;
+    size_t total = 0;
+    for (size_t step = candidate; step < load.size(); step += interval) {
+      peak = std::max(peak, load[step]);
+      total += load[step];
+    }
+    if (candidate == 0 || peak < best_peak ||
+        (peak == best_peak && total < best_total)) {
+      offset = candidate;
+      best_peak = peak;
+      best_total = total;
+    }
+  }
+
+  for (size_t step = offset; step < load.size(); step += interval) {
+    load[step] += cost;
+  }
+  return offset;
+}
+
+bool restoreSplayedOffset(const std::string& name,
+                          size_t interval,
+                          size_t splay,
+                          size_t& offset) {
+  std::string content;
+  getDatabaseValue(kPersistentSettings, "interval." + name, content);
+  auto details = osquery::split(content, ":");
+  if (details.size() != 3) {
+    return false;
+  }
+
+  long last_interval, last_splay, last_offset;
+  if (!safeStrtol(details[0], 10, last_interval) ||
+      !safeStrtol(details[1], 10, last_splay) ||
+      !safeStrtol(details[2], 10, last_offset)) {
+    return false;
+  }
+
+  if (last_interval != static_cast<long>(interval) ||
+      last_splay != static_cast<long>(splay) || last_offset < 0 ||
+      last_offset >= last_splay) {
+    return false;
+  }
+  offset = static_cast<size_t>(last_offset);
+  return true;
+}
+
+void saveSplayedOffset(const std::string& name,
+                       size_t interval,
+                       size_t splay,
+                       size_t offset) {
+  auto content = std::to_string(interval) + ":" + std::to_string(splay) + ":" +
+                 std::to_string(offset);
+  setDatabaseValue(kPersistentSettings, "interval." + name, content);
+}
+
 void Pack::initialize(const std::string& name,
                       const std::string& source,
-                      const pt::ptree& tree) {
+                      const pt::ptree& tree,
+                      const Pack* previous) {
   name_ = name;
   source_ = source;
   // Check the shard limitation, shards falling below this value are included.
@@ -142,8 +224,6 @@ void Pack::initialize(const std::string& name,
     }
   }
 
-  // Initialize a discovery cache at time 0.
-  discovery_cache_ = std::make_pair<size_t, bool>(0, false);
   valid_ = true;
 
   // If the splay percent is less than 1 reset to a sane estimate.
@@ -188,9 +268,29 @@ void Pack::initialize(const std::string& name,
       continue;
     }
 
-    query.splayed_interval = restoreSplayedValue(q.first, query.interval);
     query.options["snapshot"] = q.second.get<bool>("snapshot", false);
     query.options["removed"] = q.second.get<bool>("removed", true);
+    query.options["fingerprint"] = q.second.get<bool>("fingerprint", false);
+    query.options["snapshot_if_changed"] =
+        q.second.get<bool>("snapshot_if_changed", false);
+    query.options["watermark"] = q.second.get<bool>("watermark", false);
+    for (auto& column : split(q.second.get<std::string>("key_columns", ""),
+                              ", ")) {
+      query.key_columns.push_back(std::move(column));
+    }
+
+    // An unchanged query keeps the splay of the pack it replaces.
+    if (previous != nullptr) {
+      auto last = previous->schedule_.find(q.first);
+      if (last != previous->schedule_.end() && last->second == query &&
+          last->second.options == query.options &&
+          last->second.key_columns == query.key_columns) {
+        schedule_[q.first] = last->second;
+        continue;
+      }
+    }
+
+    query.splayed_interval = restoreSplayedValue(q.first, query.interval);
     schedule_[q.first] = query;
   }
 }
@@ -270,28 +370,149 @@ bool Pack::checkVersion(const std::string& version) const {
 
 bool Pack::checkDiscovery() {
   stats_.total++;
-  size_t current = osquery::getUnixTime();
-  if ((current - discovery_cache_.first) < FLAGS_pack_refresh_interval) {
+  bool executed = false;
+  bool discovered = true;
+  auto& discovery = PackDiscovery::get();
+  for (const auto& q : discovery_queries_) {
+    bool query_executed = false;
+    discovered = discovery.check(q, query_executed);
+    executed = executed || query_executed;
+    if (!discovered) {
+      break;
+    }
+  }
+
+  if (executed) {
+    stats_.misses++;
+  } else {
     stats_.hits++;
-    return discovery_cache_.second;
   }
+  return discovered;
+}
 
-  stats_.misses++;
-  discovery_cache_.first = current;
-  discovery_cache_.second = true;
-  for (const auto& q : discovery_queries_) {
-    auto sql = SQL(q);
-    if (!sql.ok()) {
-      LOG(WARNING) << "Discovery query failed (" << q
-                   << "): " << sql.getMessageString();
-      discovery_cache_.second = false;
-      break;
+PackDiscovery& PackDiscovery::get() {
+  static PackDiscovery discovery;
+  return discovery;
+}
+
+bool PackDiscovery::execute(const std::string& query) {
+  auto sql = SQL(query);
+  if (!sql.ok()) {
+    LOG(WARNING) << "Discovery query failed (" << query
+                 << "): " << sql.getMessageString();
+    return false;
+  }
+  return !sql.rows().empty();
+}
+
+bool PackDiscovery::check(const std::string& query, bool& executed) {
+  size_t current = getUnixTime();
+  {
+    WriteLock lock(mutex_);
+    auto it = results_.find(query);
+    if (it != results_.end()) {
+      it->second.used = true;
+      // The discovery service replaces expired results.
+      if (background_ ||
+          current - it->second.time < FLAGS_pack_refresh_interval) {
+        return it->second.rows;
+      }
     }
-    if (sql.rows().size() == 0) {
-      discovery_cache_.second = false;
-      break;
+  }
+
+  // A concurrent check of the same query may also execute it.
+  executed = true;
+  Result result;
+  result.time = current;
+  result.rows = execute(query);
+
+  WriteLock lock(mutex_);
+  results_[query] = result;
+  return result.rows;
+}
+
+void PackDiscovery::refresh() {
+  std::vector<std::string> expired;
+  size_t current = getUnixTime();
+  {
+    WriteLock lock(mutex_);
+    for (auto it = results_.begin(); it != results_.end();) {
+      if (current - it->second.time < FLAGS_pack_refresh_interval) {
+        ++it;
+      } else if (!it->second.used) {
+        it = results_.erase(it);
+      } else {
+        expired.push_back(it->first);
+        ++it;
+      }
     }
   }
-  return discovery_cache_.second;
+
+  if (expired.empty()) {
+    return;
+  }
+
+  // Distinct queries are executed concurrently, each by one thread.
+  std::vector<char> rows(expired.size(), false);
+  std::atomic<size_t> next{0};
+  auto worker = [&expired, &rows, &next]() {
+    for (size_t i = next++; i < expired.size(); i = next++) {
+      rows[i] = execute(expired[i]);
+    }
+  };
+
+  std::vector<std::thread> threads;
+  auto count = std::min(kPackDiscoveryThreads, expired.size());
+  for (size_t i = 1; i < count; i++) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  WriteLock lock(mutex_);
+  for (size_t i = 0; i < expired.size(); i++) {
+    auto& result = results_[expired[i]];
+    result.time = current;
+    result.rows = rows[i];
+    result.used = false;
+  }
+}
+
+void PackDiscovery::reset() {
+  WriteLock lock(mutex_);
+  results_.clear();
+}
+
+size_t PackDiscovery::size() const {
+  WriteLock lock(mutex_);
+  return results_.size();
+}
+
+/// Refresh expired discovery results outside of the scheduler thread.
+class PackDiscoveryRunner : public InternalRunnable {
+ public:
+  void start() override {
+    PackDiscovery::get().setBackground(true);
+    while (!interrupted()) {
+      auto pause = std::min<size_t>(
+          std::max<size_t>(FLAGS_pack_refresh_interval, 1),
+          kPackDiscoveryPause);
+      pauseMilli(pause * 1000);
+      if (interrupted()) {
+        break;
+      }
+      PackDiscovery::get().refresh();
+    }
+    PackDiscovery::get().setBackground(false);
+  }
+
+ protected:
+  ThreadClass threadClass() const override { return THREAD_CLASS_BULK; }
+};
+
+void startPackDiscovery() {
+  Dispatcher::addService(std::make_shared<PackDiscoveryRunner>());
 }
 }
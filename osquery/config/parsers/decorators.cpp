@@ -8,17 +8,23 @@
  *
  */
 
+#include <chrono>
+
 #include <osquery/config.h>
 #include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/sql.h>
 
 #include "osquery/config/parsers/decorators.h"
+#include "osquery/core/json.h"
+#include "osquery/sql/sqlite_util.h"
 
 namespace pt = boost::property_tree;
 
 namespace osquery {
 
+DECLARE_uint64(table_max_staleness);
+
 FLAG(bool, disable_decorators, false, "Disable log result decoration");
 
 FLAG(bool,
@@ -26,6 +32,11 @@ FLAG(bool,
      false,
      "Add decorators as top level JSON objects");
 
+FLAG(uint64,
+     decorators_always_ttl,
+     0,
+     "Seconds to reuse the results of each 'always' decorator");
+
 /// Statically define the parser name to avoid mistakes.
 #define PARSER_NAME "decorators"
 
@@ -38,6 +49,14 @@ const std::map<DecorationPoint, std::string> kDecorationPointKeys = {
 using KeyValueMap = std::map<std::string, std::string>;
 using DecorationStore = std::map<std::string, KeyValueMap>;
 
+/// The decorations of every source, flattened and serialized once.
+struct DecorationSnapshot {
+  KeyValueMap decorations;
+  std::shared_ptr<const std::string> json;
+};
+
+using DecoratorClock = std::chrono::steady_clock;
+
 namespace {
 
 /**
@@ -95,14 +114,55 @@ class DecoratorsConfigParserPlugin : public ConfigParserPlugin {
   /// The result set of decorations, column names and their values.
   static DecorationStore kDecorations;
 
-  /// Protect additions to the decorator set.
+  /// When each source's "always" decorator queries must run again.
+  static std::map<std::string,
+                  std::map<std::string, DecoratorClock::time_point>>
+      kAlwaysExpires;
+
+  /// The decorations read by log items, replaced when a value changes.
+  static std::shared_ptr<const DecorationSnapshot> kSnapshot;
+
+  /// Incremented when decorators or decorations are cleared.
+  static size_t kGeneration;
+
+  /**
+   * @brief Protect the decorator and decoration sets.
+   *
+   * The lock is only held to copy or update the sets, never while decorator
+   * queries run.
+   */
   static Mutex kDecorationsMutex;
 };
 }
 
 DecorationStore DecoratorsConfigParserPlugin::kDecorations;
+std::map<std::string, std::map<std::string, DecoratorClock::time_point>>
+    DecoratorsConfigParserPlugin::kAlwaysExpires;
+std::shared_ptr<const DecorationSnapshot>
+    DecoratorsConfigParserPlugin::kSnapshot;
+size_t DecoratorsConfigParserPlugin::kGeneration{0};
 Mutex DecoratorsConfigParserPlugin::kDecorationsMutex;
 
+/// Rebuild the decoration snapshot, the decorations lock must be held.
+static void updateDecorationSnapshot() {
+  auto snapshot = std::make_shared<DecorationSnapshot>();
+  for (const auto& source : DecoratorsConfigParserPlugin::kDecorations) {
+    for (const auto& decoration : source.second) {
+      snapshot->decorations[decoration.first] = decoration.second;
+    }
+  }
+
+  auto json = std::make_shared<std::string>();
+  JSONWriter writer(*json);
+  writer.startObject();
+  for (const auto& decoration : snapshot->decorations) {
+    writer.member(decoration.first, decoration.second);
+  }
+  writer.endObject();
+  snapshot->json = json;
+  DecoratorsConfigParserPlugin::kSnapshot = snapshot;
+}
+
 Status DecoratorsConfigParserPlugin::setUp() {
   // Decorators are kept within customized data structures.
   // No need to define a key for the ::getData API.
@@ -127,6 +187,7 @@ Status DecoratorsConfigParserPlugin::update(const std::string& source,
 void DecoratorsConfigParserPlugin::clearSources(const std::string& source) {
   // Reset the internal data store.
   WriteLock lock(DecoratorsConfigParserPlugin::kDecorationsMutex);
+  DecoratorsConfigParserPlugin::kGeneration++;
   if (intervals_.count(source) > 0) {
     intervals_[source].clear();
   }
@@ -189,35 +250,41 @@ void DecoratorsConfigParserPlugin::updateDecorations(
   }
 }
 
-inline void addDecoration(const std::string& source,
-                          const std::string& name,
-                          const std::string& value) {
-  DecoratorsConfigParserPlugin::kDecorations[source][name] = value;
-}
+/// A decorator query to run, and the source it belongs to.
+struct DecoratorQuery {
+  std::string source;
+  std::string query;
+
+  /// The first result row, set once the query runs.
+  Row row;
+};
 
-inline void runDecorators(const std::string& source,
-                          const std::vector<std::string>& queries) {
-  for (const auto& query : queries) {
-    auto results = SQL(query);
+/// Run decorator queries, no lock is held.
+static void runDecoratorQueries(std::vector<DecoratorQuery>& queries) {
+  TableStalenessScope staleness(FLAGS_table_max_staleness);
+  for (auto& decorator : queries) {
+    auto results = SQL(decorator.query);
     if (results.rows().size() > 0) {
       // Notice the warning above about undefined behavior when:
       // 1: You include decorators that emit the same column name
       // 2: You include a query that returns more than 1 row.
-      for (const auto& column : results.rows()[0]) {
-        addDecoration(source, column.first, column.second);
-      }
+      decorator.row = results.rows()[0];
     }
 
     if (results.rows().size() > 1) {
       // Multiple rows exhibit undefined behavior.
-      LOG(WARNING) << "Multiple rows returned for decorator query: " << query;
+      LOG(WARNING) << "Multiple rows returned for decorator query: "
+                   << decorator.query;
     }
   }
 }
 
 void clearDecorations(const std::string& source) {
   WriteLock lock(DecoratorsConfigParserPlugin::kDecorationsMutex);
+  DecoratorsConfigParserPlugin::kGeneration++;
   DecoratorsConfigParserPlugin::kDecorations[source].clear();
+  DecoratorsConfigParserPlugin::kAlwaysExpires.erase(source);
+  updateDecorationSnapshot();
 }
 
 void runDecorators(DecorationPoint point,
@@ -235,30 +302,95 @@ void runDecorators(DecorationPoint point,
 
   // Abstract the use of the decorator parser API.
   auto dp = std::dynamic_pointer_cast<DecoratorsConfigParserPlugin>(parser);
-  WriteLock lock(DecoratorsConfigParserPlugin::kDecorationsMutex);
-  if (point == DECORATE_LOAD) {
-    for (const auto& target_source : dp->load_) {
-      if (source.empty() || target_source.first == source) {
-        runDecorators(target_source.first, target_source.second);
+  auto add = [](std::vector<DecoratorQuery>& queries,
+                const std::string& target,
+                const std::string& query) {
+    queries.push_back({target, query, Row()});
+  };
+
+  // Copy the queries to run, they run without holding the lock.
+  auto& always_expires = DecoratorsConfigParserPlugin::kAlwaysExpires;
+  std::vector<DecoratorQuery> queries;
+  size_t generation = 0;
+  auto now = DecoratorClock::now();
+  {
+    WriteLock lock(DecoratorsConfigParserPlugin::kDecorationsMutex);
+    generation = DecoratorsConfigParserPlugin::kGeneration;
+    if (point == DECORATE_LOAD) {
+      for (const auto& target_source : dp->load_) {
+        if (source.empty() || target_source.first == source) {
+          for (const auto& query : target_source.second) {
+            add(queries, target_source.first, query);
+          }
+        }
       }
-    }
-  } else if (point == DECORATE_ALWAYS) {
-    for (const auto& target_source : dp->always_) {
-      if (source.empty() || target_source.first == source) {
-        runDecorators(target_source.first, target_source.second);
+    } else if (point == DECORATE_ALWAYS) {
+      for (const auto& target_source : dp->always_) {
+        if (source.empty() || target_source.first == source) {
+          const auto& expires = always_expires[target_source.first];
+          for (const auto& query : target_source.second) {
+            // Results within their TTL are not refreshed.
+            auto expiry = expires.find(query);
+            if (expiry == expires.end() || expiry->second <= now) {
+              add(queries, target_source.first, query);
+            }
+          }
+        }
       }
-    }
-  } else if (point == DECORATE_INTERVAL) {
-    for (const auto& target_source : dp->intervals_) {
-      for (const auto& interval : target_source.second) {
-        if (time % interval.first == 0) {
-          if (source.empty() || target_source.first == source) {
-            runDecorators(target_source.first, interval.second);
+    } else if (point == DECORATE_INTERVAL) {
+      for (const auto& target_source : dp->intervals_) {
+        for (const auto& interval : target_source.second) {
+          if (time % interval.first == 0) {
+            if (source.empty() || target_source.first == source) {
+              for (const auto& query : interval.second) {
+                add(queries, target_source.first, query);
+              }
+            }
           }
         }
       }
     }
   }
+
+  if (queries.empty()) {
+    return;
+  }
+  runDecoratorQueries(queries);
+
+  WriteLock lock(DecoratorsConfigParserPlugin::kDecorationsMutex);
+  if (generation != DecoratorsConfigParserPlugin::kGeneration) {
+    // The decorators were updated or cleared while the queries ran.
+    return;
+  }
+
+  bool changed = false;
+  auto expires = now + std::chrono::seconds(FLAGS_decorators_always_ttl);
+  for (const auto& decorator : queries) {
+    if (point == DECORATE_ALWAYS && FLAGS_decorators_always_ttl > 0) {
+      always_expires[decorator.source][decorator.query] = expires;
+    }
+
+    auto& decorations =
+        DecoratorsConfigParserPlugin::kDecorations[decorator.source];
+    for (const auto& column : decorator.row) {
+      auto value = decorations.find(column.first);
+      if (value == decorations.end() || value->second != column.second) {
+        decorations[column.first] = column.second;
+        changed = true;
+      }
+    }
+  }
+
+  // Log items share the snapshot until a decoration changes.
+  if (changed || DecoratorsConfigParserPlugin::kSnapshot == nullptr) {
+    updateDecorationSnapshot();
+  }
+}
+
+/// Copy the current decoration snapshot.
+static std::shared_ptr<const DecorationSnapshot> getDecorationSnapshot() {
+  WriteLock lock(DecoratorsConfigParserPlugin::kDecorationsMutex);
+  return DecoratorsConfigParserPlugin::kSnapshot;
 }
 
 void getDecorations(std::map<std::string, std::string>& results) {
@@ -266,14 +398,36 @@ void getDecorations(std::map<std::string, std::string>& results) {
     return;
   }
 
-  WriteLock lock(DecoratorsConfigParserPlugin::kDecorationsMutex);
   // Copy the decorations into the log_item.
-  for (const auto& source : DecoratorsConfigParserPlugin::kDecorations) {
-    for (const auto& decoration : source.second) {
+  auto snapshot = getDecorationSnapshot();
+  if (snapshot != nullptr) {
+    for (const auto& decoration : snapshot->decorations) {
       results[decoration.first] = decoration.second;
     }
   }
 }
 
+void getDecorations(QueryLogItem& item) {
+  if (FLAGS_disable_decorators) {
+    return;
+  }
+
+  auto snapshot = getDecorationSnapshot();
+  if (snapshot == nullptr) {
+    return;
+  }
+
+  if (item.decorations.empty()) {
+    item.decorations = snapshot->decorations;
+    item.decorations_json = snapshot->json;
+  } else {
+    // Existing decorations are merged, the shared JSON does not apply.
+    for (const auto& decoration : snapshot->decorations) {
+      item.decorations[decoration.first] = decoration.second;
+    }
+    item.decorations_json.reset();
+  }
+}
+
 REGISTER_INTERNAL(DecoratorsConfigParserPlugin, "config_parser", PARSER_NAME);
 }
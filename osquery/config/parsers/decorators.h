@@ -34,6 +34,10 @@ extern const std::map<DecorationPoint, std::string> kDecorationPointKeys;
  * The configuration maintains various sources, each may contain a set of
  * decorators. The source tracking is abstracted for the decorator iterator.
  *
+ * Decorator queries run without holding the decoration lock, callers reading
+ * decorations are not blocked by a slow decorator. An "always" decorator's
+ * results are reused for `--decorators_always_ttl` seconds.
+ *
  * @param point request execution of decorators for this given point.
  * @param time an optional time for points using intervals.
  * @param source restrict run to a specific config source.
@@ -55,6 +59,14 @@ void runDecorators(DecorationPoint point,
  */
 void getDecorations(std::map<std::string, std::string>& results);
 
+/**
+ * @brief Set the decorations of a log item.
+ *
+ * Also shares the decorations' serialized JSON object with the item, written
+ * as-is into the log line when not using top level decorations.
+ */
+void getDecorations(QueryLogItem& item);
+
 /// Clear decorations for a source when it updates.
 void clearDecorations(const std::string& source);
 }
@@ -9,6 +9,7 @@
  */
 
 #include <osquery/config.h>
+#include <osquery/events.h>
 
 namespace pt = boost::property_tree;
 
@@ -36,6 +37,8 @@ Status EventsConfigParserPlugin::update(const std::string& source,
   if (config.count("events") > 0) {
     data_ = pt::ptree();
     data_.put_child("events", config.at("events"));
+    // Subscribers registered before this update use the new filters.
+    EventFactory::configureFilters();
   }
   return Status(0, "OK");
 }
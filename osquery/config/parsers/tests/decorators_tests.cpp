@@ -21,6 +21,7 @@ namespace osquery {
 
 DECLARE_bool(disable_decorators);
 DECLARE_bool(decorations_top_level);
+DECLARE_uint64(decorators_always_ttl);
 
 class DecoratorsConfigParserPluginTests : public testing::Test {
  public:
@@ -128,4 +129,39 @@ TEST_F(DecoratorsConfigParserPluginTests, test_decorators_run_load_top_level) {
   // disable top level decorations
   FLAGS_decorations_top_level = false;
 }
+
+TEST_F(DecoratorsConfigParserPluginTests, test_decorators_always_ttl) {
+  FLAGS_disable_decorators = false;
+  auto ttl = FLAGS_decorators_always_ttl;
+  FLAGS_decorators_always_ttl = 3600;
+  Config::getInstance().update(config_data_);
+  runDecorators(DECORATE_ALWAYS);
+
+  QueryLogItem item;
+  getDecorations(item);
+  EXPECT_EQ(item.decorations["always_test"], "test");
+  ASSERT_NE(item.decorations_json, nullptr);
+
+  // The shared JSON is written as the decorations object.
+  std::string log_line;
+  serializeQueryLogItemJSON(item, log_line);
+  EXPECT_NE(log_line.find("\"always_test\":\"test\""), std::string::npos);
+
+  // Unexpired and unchanged decorations reuse the same snapshot.
+  runDecorators(DECORATE_ALWAYS);
+  FLAGS_decorators_always_ttl = 0;
+  runDecorators(DECORATE_ALWAYS);
+  QueryLogItem second_item;
+  getDecorations(second_item);
+  EXPECT_EQ(second_item.decorations, item.decorations);
+  EXPECT_EQ(second_item.decorations_json, item.decorations_json);
+
+  // Clearing a source drops its decorations, the next run restores them.
+  clearDecorations("awesome");
+  runDecorators(DECORATE_ALWAYS);
+  QueryLogItem third_item;
+  getDecorations(third_item);
+  EXPECT_EQ(third_item.decorations["always_test"], "test");
+  FLAGS_decorators_always_ttl = ttl;
+}
 }
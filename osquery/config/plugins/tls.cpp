@@ -58,9 +58,29 @@ class TLSConfigPlugin : public ConfigPlugin,
   Status setUp() override;
   Status genConfig(std::map<std::string, std::string>& config) override;
 
+ protected:
+  /// Add, replace, and remove named items of the last config.
+  void applyDelta(const pt::ptree& delta);
+
  protected:
   /// Calculate the URL once and cache the result.
   std::string uri_;
+
+  /**
+   * @brief The config hash sent by the server with the last config.
+   *
+   * The hash is echoed back with each request. A server may then respond
+   * with config_unchanged, or with a config_delta of the named packs and
+   * queries added or removed since that config.
+   */
+  std::string hash_;
+
+  /// The last config, kept while the server sends a config hash.
+  pt::ptree config_;
+  std::string json_;
+
+  /// Refreshes and the initial config request may overlap.
+  Mutex mutex_;
 };
 
 class TLSConfigRefreshRunner : public InternalRunnable {
@@ -83,31 +103,96 @@ Status TLSConfigPlugin::setUp() {
   return Status(0, "OK");
 }
 
+void TLSConfigPlugin::applyDelta(const pt::ptree& delta) {
+  // Items are added or replaced by name within each section, such as packs.
+  for (const auto& section : delta.get_child("add", pt::ptree())) {
+    auto items = config_.find(section.first);
+    if (items == config_.not_found()) {
+      config_.push_back(std::make_pair(section.first, pt::ptree()));
+      items = config_.find(section.first);
+    }
+
+    for (const auto& item : section.second) {
+      items->second.erase(item.first);
+      items->second.push_back(item);
+    }
+  }
+
+  for (const auto& section : delta.get_child("remove", pt::ptree())) {
+    auto items = config_.find(section.first);
+    if (items == config_.not_found()) {
+      continue;
+    }
+
+    for (const auto& name : section.second) {
+      items->second.erase(name.second.data());
+    }
+  }
+}
+
 Status TLSConfigPlugin::genConfig(std::map<std::string, std::string>& config) {
-  std::string json;
+  WriteLock lock(mutex_);
+  pt::ptree params;
+  auto uri = uri_;
+  if (!hash_.empty()) {
+    if (FLAGS_tls_node_api) {
+      // The node API uses GET requests, the hash is a URI variable.
+      uri += ((uri.find("?") != std::string::npos) ? "&" : "?");
+      uri += "config_hash=" + hash_;
+    } else {
+      params.put("config_hash", hash_);
+    }
+  }
 
+  pt::ptree tree;
   auto s = TLSRequestHelper::go<JSONSerializer>(
-      uri_, json, FLAGS_config_tls_max_attempts);
+      uri, params, tree, FLAGS_config_tls_max_attempts);
   if (!s.ok()) {
     return s;
   }
 
-  if (FLAGS_tls_node_api) {
+  auto hash = tree.get("config_hash", "");
+  if (!hash_.empty() && tree.get("config_unchanged", false)) {
+    // The config was not sent again, the last config is still current.
+    config["tls_plugin"] = json_;
+    return s;
+  }
+
+  std::string json;
+  if (tree.count("config_delta") > 0) {
+    if (hash_.empty()) {
+      return Status(1, "Received a config delta without a config");
+    }
+    applyDelta(tree.get_child("config_delta"));
+    JSONSerializer().serialize(config_, json);
+  } else if (FLAGS_tls_node_api) {
     // The node API embeds configuration data (JSON escaped).
-    pt::ptree tree;
-    try {
-      std::stringstream input;
-      input << json;
-      pt::read_json(input, tree);
-    } catch (const pt::json_parser::json_parser_error& e) {
-      VLOG(1) << "Could not parse JSON from TLS node API";
+    json = unescapeUnicode(tree.get("config", ""));
+    if (!hash.empty()) {
+      try {
+        std::stringstream input;
+        input << json;
+        pt::read_json(input, config_);
+      } catch (const pt::json_parser::json_parser_error& e) {
+        VLOG(1) << "Could not parse JSON from TLS node API";
+        hash.clear();
+      }
     }
-
-    // Re-encode the config key into JSON.
-    config["tls_plugin"] = unescapeUnicode(tree.get("config", ""));
   } else {
-    config["tls_plugin"] = json;
+    tree.erase("config_hash");
+    tree.erase("config_unchanged");
+    JSONSerializer().serialize(tree, json);
+    config_ = std::move(tree);
   }
+
+  // Only a server sending hashes may send an unchanged config or a delta.
+  hash_ = hash;
+  json_ = (hash.empty()) ? "" : json;
+  if (hash.empty()) {
+    config_.clear();
+  }
+
+  config["tls_plugin"] = std::move(json);
   return s;
 }
 
@@ -9,6 +9,7 @@
  */
 
 #include <memory>
+#include <set>
 #include <vector>
 
 #include <boost/property_tree/json_parser.hpp>
@@ -17,6 +18,7 @@
 
 #include <osquery/config.h>
 #include <osquery/core.h>
+#include <osquery/database.h>
 #include <osquery/flags.h>
 #include <osquery/packs.h>
 #include <osquery/registry.h>
@@ -29,6 +31,9 @@ namespace pt = boost::property_tree;
 
 namespace osquery {
 
+DECLARE_bool(schedule_splay_cost);
+DECLARE_bool(config_respawn_snapshot);
+
 // Blacklist testing methods, internal to config implementations.
 extern void restoreScheduleBlacklist(std::map<std::string, size_t>& blacklist);
 extern void saveScheduleBlacklist(
@@ -46,7 +51,10 @@ class ConfigTests : public testing::Test {
 
  protected:
   Status load() { return Config::getInstance().load(); }
+  Status loadSnapshot() { return Config::getInstance().loadSnapshot(); }
+  void reset() { Config::getInstance().reset(); }
   void setLoaded() { Config::getInstance().loaded_ = true; }
+  void clearSourceHashes() { Config::getInstance().hash_.clear(); }
   Config& get() { return Config::getInstance(); }
 };
 
@@ -227,6 +235,80 @@ TEST_F(ConfigTests, test_content_update) {
   EXPECT_EQ(count, 0U);
 }
 
+TEST_F(ConfigTests, test_respawn_snapshot) {
+  FLAGS_config_respawn_snapshot = true;
+  std::string content;
+  readFile(kTestDataPath + "test_parse_items.conf", content);
+  get().update({{"awesome", content}});
+
+  // The source's content is saved as it changes.
+  std::string saved;
+  getDatabaseValue(kPersistentSettings, "config_snapshot.awesome", saved);
+  EXPECT_EQ(saved, content);
+
+  // A respawned worker applies the saved content without the config plugin.
+  reset();
+  EXPECT_TRUE(loadSnapshot().ok());
+  EXPECT_TRUE(get().isValid());
+  size_t count = 0;
+  get().packs(([&count](std::shared_ptr<Pack>& pack) { count++; }));
+  EXPECT_GT(count, 0U);
+
+  // Without a snapshot the config plugin is used.
+  deleteDatabaseValue(kPersistentSettings, "config_snapshot.awesome");
+  reset();
+  EXPECT_FALSE(loadSnapshot().ok());
+  FLAGS_config_respawn_snapshot = false;
+}
+
+TEST_F(ConfigTests, test_content_delta) {
+  std::string first =
+      "{\"packs\": {"
+      "\"kept\": {\"queries\": {\"q1\": {\"query\": \"select 1\", "
+      "\"interval\": 60}}},"
+      "\"changed\": {\"queries\": {\"q2\": {\"query\": \"select 2\", "
+      "\"interval\": 60}}},"
+      "\"removed\": {\"queries\": {\"q3\": {\"query\": \"select 3\", "
+      "\"interval\": 60}}}"
+      "}}";
+  EXPECT_TRUE(get().hashSource("delta_hash", first));
+  EXPECT_FALSE(get().hashSource("delta_hash", first));
+
+  std::map<std::string, std::shared_ptr<Pack>> packs;
+  auto collect = [&packs](std::shared_ptr<Pack>& pack) {
+    packs[pack->getName()] = pack;
+  };
+  get().update({{"delta", first}});
+  get().packs(collect);
+  ASSERT_EQ(packs.size(), 3U);
+  auto kept = packs.at("kept");
+  auto changed = packs.at("changed");
+
+  // Unchanged content is not applied again.
+  get().update({{"delta", first}});
+  packs.clear();
+  get().packs(collect);
+  ASSERT_EQ(packs.size(), 3U);
+  EXPECT_EQ(packs.at("kept"), kept);
+  EXPECT_EQ(packs.at("changed"), changed);
+
+  // Only changed packs are replaced, and missing packs are removed.
+  std::string second =
+      "{\"packs\": {"
+      "\"kept\": {\"queries\": {\"q1\": {\"query\": \"select 1\", "
+      "\"interval\": 60}}},"
+      "\"changed\": {\"queries\": {\"q2\": {\"query\": \"select 2\", "
+      "\"interval\": 120}}}"
+      "}}";
+  get().update({{"delta", second}});
+  packs.clear();
+  get().packs(collect);
+  ASSERT_EQ(packs.size(), 2U);
+  EXPECT_EQ(packs.at("kept"), kept);
+  EXPECT_NE(packs.at("changed"), changed);
+  EXPECT_EQ(packs.count("removed"), 0U);
+}
+
 TEST_F(ConfigTests, test_get_scheduled_queries) {
   std::vector<ScheduledQuery> queries;
   get().addPack("unrestricted_pack", "", getUnrestrictedPack());
@@ -237,6 +319,43 @@ TEST_F(ConfigTests, test_get_scheduled_queries) {
   EXPECT_EQ(queries.size(), getUnrestrictedPack().get_child("queries").size());
 }
 
+TEST_F(ConfigTests, test_level_schedule) {
+  auto splay_cost = FLAGS_schedule_splay_cost;
+  FLAGS_schedule_splay_cost = true;
+
+  std::string config =
+      "{"
+      "\"schedule\": {"
+      "\"level_1\": {\"query\": \"select * from time\", \"interval\": 60},"
+      "\"level_2\": {\"query\": \"select * from time\", \"interval\": 60},"
+      "\"level_3\": {\"query\": \"select * from time\", \"interval\": 60}"
+      "}"
+      "}";
+  get().update({{"data", config}});
+
+  std::map<std::string, size_t> offsets;
+  std::set<size_t> distinct;
+  get().scheduledQueries(
+      ([&offsets, &distinct](const std::string& name,
+                             const ScheduledQuery& query) {
+        EXPECT_LT(query.splayed_offset, query.splayed_interval);
+        offsets[name] = query.splayed_offset;
+        distinct.insert(query.splayed_offset);
+      }));
+  EXPECT_EQ(offsets.size(), 3U);
+  // Queries with the same expected cost are not placed onto the same step.
+  EXPECT_GT(distinct.size(), 1U);
+
+  // Offsets are restored when the configuration is reloaded.
+  get().update({{"data", config}});
+  get().scheduledQueries(
+      ([&offsets](const std::string& name, const ScheduledQuery& query) {
+        EXPECT_EQ(offsets[name], query.splayed_offset);
+      }));
+
+  FLAGS_schedule_splay_cost = splay_cost;
+}
+
 class TestConfigParserPlugin : public ConfigParserPlugin {
  public:
   std::vector<std::string> keys() const override {
@@ -271,9 +390,17 @@ bool TestConfigParserPlugin::update_called = false;
 TEST_F(ConfigTests, test_get_parser) {
   Registry::add<TestConfigParserPlugin>("config_parser", "test");
 
+  TestConfigParserPlugin::update_called = false;
   auto s = get().update(getTestConfigMap());
   EXPECT_TRUE(s.ok());
   EXPECT_EQ(s.toString(), "OK");
+  EXPECT_TRUE(TestConfigParserPlugin::update_called);
+
+  // Parsers are not updated again when their keys are unchanged.
+  TestConfigParserPlugin::update_called = false;
+  clearSourceHashes();
+  get().update(getTestConfigMap());
+  EXPECT_FALSE(TestConfigParserPlugin::update_called);
 
   auto plugin = get().getParser("test");
   EXPECT_TRUE(plugin != nullptr);
@@ -13,6 +13,7 @@
 #include <gtest/gtest.h>
 
 #include <osquery/core.h>
+#include <osquery/database.h>
 #include <osquery/filesystem.h>
 #include <osquery/flags.h>
 #include <osquery/packs.h>
@@ -24,7 +25,10 @@ namespace osquery {
 extern size_t getMachineShard(const std::string& hostname = "",
                               bool force = false);
 
-class PacksTests : public testing::Test {};
+class PacksTests : public testing::Test {
+ protected:
+  void SetUp() override { PackDiscovery::get().reset(); }
+};
 
 TEST_F(PacksTests, test_parse) {
   auto tree = getExamplePacksConfig();
@@ -151,6 +155,38 @@ TEST_F(PacksTests, test_discovery_cache) {
   c.reset();
 }
 
+TEST_F(PacksTests, test_discovery_shared) {
+  auto& discovery = PackDiscovery::get();
+
+  // Packs with the same discovery query execute it once.
+  Pack first("valid_discovery_pack", getPackWithValidDiscovery());
+  Pack second("valid_discovery_pack", getPackWithValidDiscovery());
+  EXPECT_TRUE(first.checkDiscovery());
+  EXPECT_TRUE(second.checkDiscovery());
+  EXPECT_EQ(first.getStats().misses, 1U);
+  EXPECT_EQ(second.getStats().misses, 0U);
+  EXPECT_EQ(second.getStats().hits, 1U);
+  ASSERT_EQ(discovery.size(), 1U);
+
+  // An expired result is used until the background refresh replaces it.
+  auto& result = discovery.results_.begin()->second;
+  result.time = 0;
+  result.rows = false;
+  discovery.setBackground(true);
+  EXPECT_FALSE(second.checkDiscovery());
+  EXPECT_EQ(second.getStats().misses, 0U);
+
+  discovery.refresh();
+  EXPECT_TRUE(second.checkDiscovery());
+
+  // A result not checked since it was refreshed is dropped once expired.
+  result.time = 0;
+  result.used = false;
+  discovery.refresh();
+  EXPECT_EQ(discovery.size(), 0U);
+  discovery.setBackground(false);
+}
+
 TEST_F(PacksTests, test_discovery_zero_state) {
   Pack pack("discovery_pack", getPackWithDiscovery());
   auto stats = pack.getStats();
@@ -196,4 +232,90 @@ TEST_F(PacksTests, test_restore_splay) {
   EXPECT_LE(splay3, 3600U * 10 + (360 * 10));
   EXPECT_NE(splay, splay3);
 }
+
+TEST_F(PacksTests, test_preserve_schedule) {
+  auto makeTree = [](const std::string& content) {
+    boost::property_tree::ptree tree;
+    std::stringstream json(content);
+    boost::property_tree::read_json(json, tree);
+    return tree;
+  };
+
+  auto first = makeTree(
+      "{\"queries\": {"
+      "\"preserve_kept\": {\"query\": \"select * from time\", "
+      "\"interval\": 3600},"
+      "\"preserve_changed\": {\"query\": \"select * from time\", "
+      "\"interval\": 3600}}}");
+  Pack previous("preserve_pack", "", first);
+
+  // Unchanged queries do not restore their splay from the database.
+  setDatabaseValue(kPersistentSettings, "interval.preserve_kept", "3600:1");
+  setDatabaseValue(kPersistentSettings, "interval.preserve_changed", "60:1");
+  auto second = makeTree(
+      "{\"queries\": {"
+      "\"preserve_kept\": {\"query\": \"select * from time\", "
+      "\"interval\": 3600},"
+      "\"preserve_changed\": {\"query\": \"select * from time\", "
+      "\"interval\": 60}}}");
+  Pack pack("preserve_pack", "", second, &previous);
+
+  const auto& schedule = pack.getSchedule();
+  ASSERT_EQ(schedule.size(), 2U);
+  EXPECT_EQ(schedule.at("preserve_kept").splayed_interval,
+            previous.getSchedule().at("preserve_kept").splayed_interval);
+  EXPECT_EQ(schedule.at("preserve_changed").splayed_interval, 1U);
+
+  deleteDatabaseValue(kPersistentSettings, "interval.preserve_kept");
+  deleteDatabaseValue(kPersistentSettings, "interval.preserve_changed");
+}
+
+TEST_F(PacksTests, test_key_columns) {
+  boost::property_tree::ptree tree;
+  std::stringstream json(
+      "{\"queries\": {\"keyed\": {\"query\": \"select * from processes\", "
+      "\"interval\": 60, \"key_columns\": \"pid, start_time\"}}}");
+  boost::property_tree::read_json(json, tree);
+  Pack pack("key_pack", "", tree);
+
+  const auto& query = pack.getSchedule().at("keyed");
+  std::vector<std::string> expected = {"pid", "start_time"};
+  EXPECT_EQ(query.key_columns, expected);
+}
+
+TEST_F(PacksTests, test_splay_offset) {
+  std::vector<size_t> load(60, 0);
+
+  // Two expensive queries on the same interval are placed apart.
+  auto first = splayOffset(10, 100, load);
+  auto second = splayOffset(10, 100, load);
+  EXPECT_LT(first, 10U);
+  EXPECT_LT(second, 10U);
+  EXPECT_NE(first, second);
+  EXPECT_EQ(load[first], 100U);
+  EXPECT_EQ(load[first + 10], 100U);
+
+  // A frequent query avoids the steps where the expensive queries execute.
+  auto frequent = splayOffset(5, 1, load);
+  EXPECT_NE(frequent, first);
+  EXPECT_NE(frequent, second);
+
+  // A single-second interval cannot be offset.
+  EXPECT_EQ(splayOffset(1, 1, load), 0U);
+
+  // Offsets are saved alongside the splayed interval.
+  auto splay = restoreSplayedValue("pack_test_offset_query", 600);
+  size_t offset = 0;
+  EXPECT_FALSE(restoreSplayedOffset("pack_test_offset_query", 600, splay,
+                                    offset));
+  saveSplayedOffset("pack_test_offset_query", 600, splay, 42);
+  EXPECT_TRUE(restoreSplayedOffset("pack_test_offset_query", 600, splay,
+                                   offset));
+  EXPECT_EQ(offset, 42U);
+  EXPECT_EQ(restoreSplayedValue("pack_test_offset_query", 600), splay);
+
+  // Changing the requested interval invalidates the offset.
+  EXPECT_FALSE(restoreSplayedOffset("pack_test_offset_query", 60, splay,
+                                    offset));
+}
 }
@@ -0,0 +1,88 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <cstdlib>
+#include <new>
+
+#if defined(__APPLE__)
+#include <malloc/malloc.h>
+#elif defined(__FreeBSD__)
+#include <malloc_np.h>
+#else
+#include <malloc.h>
+#endif
+
+#include "osquery/core/allocations.h"
+
+/**
+ * Replacements of the global operator new and delete that count allocations
+ * for the calling thread, see osquery/core/allocations.h.
+ *
+ * Only allocations made through operator new are counted, memory allocated
+ * with malloc, such as by SQLite, is not.
+ */
+
+namespace osquery {
+
+static size_t allocationSize(void* ptr) {
+#if defined(__APPLE__)
+  return malloc_size(ptr);
+#elif defined(WIN32)
+  return _msize(ptr);
+#else
+  return malloc_usable_size(ptr);
+#endif
+}
+
+static void* countedAllocation(size_t size) {
+  auto* ptr = std::malloc((size == 0) ? 1 : size);
+  if (ptr != nullptr) {
+    recordAllocation(allocationSize(ptr));
+  }
+  return ptr;
+}
+
+static void countedFree(void* ptr) {
+  if (ptr != nullptr) {
+    recordFree(allocationSize(ptr));
+    std::free(ptr);
+  }
+}
+}
+
+void* operator new(size_t size) {
+  auto* ptr = osquery::countedAllocation(size);
+  if (ptr == nullptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  return osquery::countedAllocation(size);
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+  return osquery::countedAllocation(size);
+}
+
+void operator delete(void* ptr) noexcept { osquery::countedFree(ptr); }
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+  osquery::countedFree(ptr);
+}
+
+void operator delete[](void* ptr) noexcept { osquery::countedFree(ptr); }
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept {
+  osquery::countedFree(ptr);
+}
@@ -0,0 +1,97 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <algorithm>
+
+#if defined(__APPLE__)
+#include <malloc/malloc.h>
+#elif defined(WIN32)
+#include <malloc.h>
+#elif defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+#include "osquery/core/allocations.h"
+
+namespace osquery {
+
+/// Zero-initialized without a constructor, so the hooks may count any time.
+static thread_local AllocationCounters kThreadAllocations;
+
+const AllocationCounters& threadAllocations() {
+  return kThreadAllocations;
+}
+
+void recordAllocation(size_t bytes) {
+  auto& counters = kThreadAllocations;
+  counters.allocations++;
+  counters.bytes += bytes;
+  counters.live += static_cast<long long>(bytes);
+  if (counters.live > counters.peak) {
+    counters.peak = counters.live;
+  }
+}
+
+void recordFree(size_t bytes) {
+  kThreadAllocations.live -= static_cast<long long>(bytes);
+}
+
+AllocationScope::AllocationScope() : start_(kThreadAllocations) {
+  kThreadAllocations.peak = kThreadAllocations.live;
+}
+
+AllocationScope::~AllocationScope() {
+  // Restore the outer scope's peak, including this scope's.
+  kThreadAllocations.peak = std::max(start_.peak, kThreadAllocations.peak);
+}
+
+unsigned long long AllocationScope::allocations() const {
+  return kThreadAllocations.allocations - start_.allocations;
+}
+
+unsigned long long AllocationScope::bytes() const {
+  return kThreadAllocations.bytes - start_.bytes;
+}
+
+unsigned long long AllocationScope::peakBytes() const {
+  auto peak = kThreadAllocations.peak - start_.live;
+  return (peak > 0) ? static_cast<unsigned long long>(peak) : 0;
+}
+
+bool getHeapStatistics(HeapStatistics& stats) {
+#if defined(__APPLE__)
+  malloc_statistics_t zones;
+  malloc_zone_statistics(nullptr, &zones);
+  stats.in_use = zones.size_in_use;
+  stats.free = zones.size_allocated - zones.size_in_use;
+  return true;
+#elif defined(__GLIBC__)
+  auto info = mallinfo();
+  // Large allocations are mapped individually, and are never free.
+  stats.in_use = static_cast<unsigned int>(info.uordblks) +
+                 static_cast<unsigned int>(info.hblkhd);
+  stats.free = static_cast<unsigned int>(info.fordblks);
+  return true;
+#else
+  return false;
+#endif
+}
+
+void releaseFreeHeap() {
+#if defined(__APPLE__)
+  malloc_zone_pressure_relief(nullptr, 0);
+#elif defined(WIN32)
+  _heapmin();
+#elif defined(__GLIBC__)
+  // Every thread's arena is trimmed, and free pages within them released.
+  malloc_trim(0);
+#endif
+}
+}
@@ -0,0 +1,103 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <cstddef>
+
+#include <boost/noncopyable.hpp>
+
+namespace osquery {
+
+/**
+ * @brief Heap allocations made by a thread.
+ *
+ * The counters are updated by the allocation hooks, a replacement of the
+ * global operator new and delete built into binaries when ALLOCATION_TRACKING
+ * is set, and into the table benchmarks. Without the hooks the counters stay
+ * zero. Memory freed by a thread other than its allocator lowers the freeing
+ * thread's live bytes, which may be negative.
+ */
+struct AllocationCounters {
+  /// Number of allocations.
+  unsigned long long allocations;
+
+  /// Total bytes allocated.
+  unsigned long long bytes;
+
+  /// Bytes allocated less bytes freed.
+  long long live;
+
+  /// The most live bytes since the innermost AllocationScope began.
+  long long peak;
+};
+
+/// The calling thread's allocation counters.
+const AllocationCounters& threadAllocations();
+
+/// Count an allocation of a number of bytes by the calling thread.
+void recordAllocation(size_t bytes);
+
+/// Count a release of a number of bytes by the calling thread.
+void recordFree(size_t bytes);
+
+/**
+ * @brief Attribute the calling thread's allocations to a scope.
+ *
+ * Scopes nest: an outer scope includes the allocations of inner scopes, and
+ * an inner scope does not hide a peak from its outer scope.
+ *
+ * @code{.cpp}
+ *   AllocationScope allocations;
+ *   auto sql = SQLInternal(query.query);
+ *   performance.allocations += allocations.allocations();
+ * @endcode
+ */
+class AllocationScope : private boost::noncopyable {
+ public:
+  AllocationScope();
+  ~AllocationScope();
+
+  /// Number of allocations made in scope.
+  unsigned long long allocations() const;
+
+  /// Total bytes allocated in scope.
+  unsigned long long bytes() const;
+
+  /// The most bytes allocated and not yet freed at once while in scope.
+  unsigned long long peakBytes() const;
+
+ private:
+  AllocationCounters start_;
+};
+
+/// The process heap's size, as reported by the system allocator.
+struct HeapStatistics {
+  /// Bytes of allocations not yet freed.
+  size_t in_use{0};
+
+  /// Bytes the allocator holds for reuse, freed but not given back.
+  size_t free{0};
+};
+
+/// Read the process heap's size, false if the allocator cannot report it.
+bool getHeapStatistics(HeapStatistics& stats);
+
+/**
+ * @brief Give the heap's free memory back to the system.
+ *
+ * Short-lived allocations, such as the rows and serialized results of a
+ * scheduled query, leave free memory scattered through the heap. The
+ * allocator keeps it resident for reuse, and a daemon's resident size grows
+ * as later allocations do not fit the holes left. Releasing the free pages
+ * after each query keeps the resident size near the live heap.
+ */
+void releaseFreeHeap();
+}
@@ -0,0 +1,100 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <benchmark/benchmark.h>
+
+#include "osquery/core/conversions.h"
+
+namespace osquery {
+
+/// Content shaped like /proc/net/tcp, a header and a line per socket.
+static std::string getSocketsContent(size_t lines) {
+  std::string content =
+      "  sl  local_address rem_address   st tx_queue rx_queue tr tm->when "
+      "retrnsmt   uid  timeout inode\n";
+  for (size_t i = 0; i < lines; i++) {
+    content +=
+        "   0: 0100007F:0CEA 00000000:0000 0A 00000000:00000000 00:00000000 "
+        "00000000     0        0 " +
+        std::to_string(10000 + i) +
+        " 1 0000000000000000 100 0 0 10 0\n";
+  }
+  return content;
+}
+
+static void CONVERSIONS_split(benchmark::State& state) {
+  auto content = getSocketsContent(state.range_x());
+  while (state.KeepRunning()) {
+    size_t fields = 0;
+    for (const auto& line : split(content, "\n")) {
+      fields += split(line, " ").size();
+    }
+    benchmark::DoNotOptimize(fields);
+  }
+}
+
+BENCHMARK(CONVERSIONS_split)->Arg(16)->Arg(1024);
+
+static void CONVERSIONS_tokenize(benchmark::State& state) {
+  auto content = getSocketsContent(state.range_x());
+  std::vector<boost::string_ref> fields;
+  while (state.KeepRunning()) {
+    size_t count = 0;
+    Tokenizer lines(content, "\n");
+    boost::string_ref line;
+    while (lines.next(line)) {
+      tokenize(line, " ", fields);
+      count += fields.size();
+    }
+    benchmark::DoNotOptimize(count);
+  }
+}
+
+BENCHMARK(CONVERSIONS_tokenize)->Arg(16)->Arg(1024);
+
+/// Binary content, such as an extended attribute or a carved file.
+static std::string getBinaryContent(size_t size) {
+  std::string content(size, '\0');
+  for (size_t i = 0; i < size; i++) {
+    content[i] = static_cast<char>(i * 7 + (i >> 8));
+  }
+  return content;
+}
+
+static void CONVERSIONS_base64_encode(benchmark::State& state) {
+  auto content = getBinaryContent(state.range_x());
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(base64Encode(content));
+  }
+  state.SetBytesProcessed(state.iterations() * content.size());
+}
+
+BENCHMARK(CONVERSIONS_base64_encode)->Arg(64)->Arg(4096)->Arg(4 << 20);
+
+static void CONVERSIONS_base64_decode(benchmark::State& state) {
+  auto encoded = base64Encode(getBinaryContent(state.range_x()));
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(base64Decode(encoded));
+  }
+  state.SetBytesProcessed(state.iterations() * encoded.size());
+}
+
+BENCHMARK(CONVERSIONS_base64_decode)->Arg(64)->Arg(4096)->Arg(4 << 20);
+
+static void CONVERSIONS_is_printable(benchmark::State& state) {
+  std::string content(state.range_x(), 'a');
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(isPrintable(content));
+  }
+  state.SetBytesProcessed(state.iterations() * content.size());
+}
+
+BENCHMARK(CONVERSIONS_is_printable)->Arg(64)->Arg(4096)->Arg(4 << 20);
+}
@@ -8,37 +8,237 @@
  *
  */
 
+#include <stdint.h>
+#include <string.h>
+
 #include <sstream>
 
 #include <boost/algorithm/string.hpp>
-#include <boost/archive/iterators/transform_width.hpp>
-#include <boost/archive/iterators/binary_from_base64.hpp>
-#include <boost/archive/iterators/base64_from_binary.hpp>
 
-#include "osquery/core/conversions.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
-namespace bai = boost::archive::iterators;
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define OSQUERY_CONVERSIONS_SSSE3
+#include <tmmintrin.h>
+#endif
+
+#include "osquery/core/conversions.h"
 
 namespace osquery {
 
-typedef bai::binary_from_base64<const char*> base64_str;
-typedef bai::transform_width<base64_str, 8, 6> base64_dec;
-typedef bai::transform_width<std::string::const_iterator, 6, 8> base64_enc;
-typedef bai::base64_from_binary<base64_enc> it_base64;
+const char kBase64Alphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 
-std::string base64Decode(const std::string& encoded) {
-  std::string is;
-  std::stringstream os;
+/// The value of each base64 character, kBase64Invalid for other characters.
+const uint8_t kBase64Invalid = 0xFF;
 
-  is = encoded;
-  boost::replace_all(is, "\r\n", "");
-  boost::replace_all(is, "\n", "");
-  size_t size = is.size();
+static const uint8_t* getBase64Values() {
+  static uint8_t values[256];
+  static bool init = ([]() {
+    memset(values, kBase64Invalid, sizeof(values));
+    for (uint8_t i = 0; i < 64; i++) {
+      values[static_cast<uint8_t>(kBase64Alphabet[i])] = i;
+    }
+    return true;
+  })();
+  (void)init;
+  return values;
+}
+
+/// Encode each complete group of 3 bytes, returns the bytes read.
+static size_t base64EncodeScalar(const uint8_t* in, size_t size, char* out) {
+  size_t i = 0;
+  for (; i + 3 <= size; i += 3) {
+    uint32_t group = (in[i] << 16) | (in[i + 1] << 8) | in[i + 2];
+    *out++ = kBase64Alphabet[(group >> 18) & 0x3F];
+    *out++ = kBase64Alphabet[(group >> 12) & 0x3F];
+    *out++ = kBase64Alphabet[(group >> 6) & 0x3F];
+    *out++ = kBase64Alphabet[group & 0x3F];
+  }
+  return i;
+}
+
+/**
+ * @brief Decode each complete group of 4 characters, returns the characters
+ * read.
+ *
+ * Decoding stops before a group with an invalid character.
+ */
+static size_t base64DecodeScalar(const char* in, size_t size, uint8_t* out) {
+  auto values = getBase64Values();
+  size_t i = 0;
+  for (; i + 4 <= size; i += 4) {
+    auto a = values[static_cast<uint8_t>(in[i])];
+    auto b = values[static_cast<uint8_t>(in[i + 1])];
+    auto c = values[static_cast<uint8_t>(in[i + 2])];
+    auto d = values[static_cast<uint8_t>(in[i + 3])];
+    if ((a | b | c | d) & 0xC0) {
+      break;
+    }
+    uint32_t group = (a << 18) | (b << 12) | (c << 6) | d;
+    *out++ = static_cast<uint8_t>(group >> 16);
+    *out++ = static_cast<uint8_t>(group >> 8);
+    *out++ = static_cast<uint8_t>(group);
+  }
+  return i;
+}
+
+#ifdef OSQUERY_CONVERSIONS_SSSE3
+/**
+ * @brief Encode 12 bytes into 16 characters at a time with SSSE3.
+ *
+ * Each 16 byte load uses its first 12 bytes, so the last bytes are left for
+ * base64EncodeScalar. See Wojciech Muła's "Base64 encoding with SIMD
+ * instructions".
+ */
+__attribute__((target("ssse3"))) static size_t base64EncodeSSSE3(
+    const uint8_t* in, size_t size, char* out) {
+  // Move the 3 bytes of each group into a 32-bit lane as [b, a, c, b].
+  const auto shuffle =
+      _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+  // The characters start at 'A', 'a' - 26, '0' - 52, '+' - 62 and '/' - 63.
+  const auto offsets = _mm_setr_epi8('a' - 26,
+                                     '0' - 52,
+                                     '0' - 52,
+                                     '0' - 52,
+                                     '0' - 52,
+                                     '0' - 52,
+                                     '0' - 52,
+                                     '0' - 52,
+                                     '0' - 52,
+                                     '0' - 52,
+                                     '0' - 52,
+                                     '+' - 62,
+                                     '/' - 63,
+                                     'A',
+                                     0,
+                                     0);
+
+  size_t i = 0;
+  for (; i + 16 <= size; i += 12) {
+    auto bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+    bytes = _mm_shuffle_epi8(bytes, shuffle);
+
+    // Split each lane's 24 bits into four 6-bit indices, one per byte.
+    auto t0 = _mm_and_si128(bytes, _mm_set1_epi32(0x0FC0FC00));
+    auto t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    auto t2 = _mm_and_si128(bytes, _mm_set1_epi32(0x003F03F0));
+    auto t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    auto indices = _mm_or_si128(t1, t3);
+
+    // Select the offset of each index's range and add it.
+    auto range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    auto upper = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+    range = _mm_or_si128(range, _mm_and_si128(upper, _mm_set1_epi8(13)));
+    auto chars = _mm_add_epi8(_mm_shuffle_epi8(offsets, range), indices);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), chars);
+    out += 16;
+  }
+  return i;
+}
+
+/**
+ * @brief Decode 16 characters into 12 bytes at a time with SSSE3.
+ *
+ * Each store writes 16 bytes, the output must have 4 bytes to spare.
+ * Decoding stops before a block with an invalid character, which
+ * base64DecodeScalar then finds.
+ */
+__attribute__((target("ssse3"))) static size_t base64DecodeSSSE3(
+    const char* in, size_t size, uint8_t* out) {
+  // Classify characters by nibble, a valid character's bits never overlap.
+  const auto lut_lo = _mm_setr_epi8(0x15,
+                                    0x11,
+                                    0x11,
+                                    0x11,
+                                    0x11,
+                                    0x11,
+                                    0x11,
+                                    0x11,
+                                    0x11,
+                                    0x11,
+                                    0x13,
+                                    0x1A,
+                                    0x1B,
+                                    0x1B,
+                                    0x1B,
+                                    0x1A);
+  const auto lut_hi = _mm_setr_epi8(0x10,
+                                    0x10,
+                                    0x01,
+                                    0x02,
+                                    0x04,
+                                    0x08,
+                                    0x04,
+                                    0x08,
+                                    0x10,
+                                    0x10,
+                                    0x10,
+                                    0x10,
+                                    0x10,
+                                    0x10,
+                                    0x10,
+                                    0x10);
+  // The value's offset from the character, by high nibble; '/' uses 1.
+  const auto lut_roll =
+      _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+  const auto nibble = _mm_set1_epi8(0x0F);
+  const auto slash = _mm_set1_epi8('/');
+  // The 3 bytes of each 32-bit lane, packed into the first 12 bytes.
+  const auto pack =
+      _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    auto chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+    auto hi_nibbles = _mm_and_si128(_mm_srli_epi32(chars, 4), nibble);
+    auto lo_nibbles = _mm_and_si128(chars, nibble);
+    auto lo = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+    auto hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+    auto invalid = _mm_cmpeq_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128());
+    if (_mm_movemask_epi8(invalid) != 0xFFFF) {
+      break;
+    }
+
+    auto is_slash = _mm_cmpeq_epi8(chars, slash);
+    auto roll =
+        _mm_shuffle_epi8(lut_roll, _mm_add_epi8(is_slash, hi_nibbles));
+    auto values = _mm_add_epi8(chars, roll);
+
+    // Merge the 6-bit values into 24 bits per lane, then pack the lanes.
+    auto merged = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+    merged = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+    merged = _mm_shuffle_epi8(merged, pack);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), merged);
+    out += 12;
+  }
+  return i;
+}
+
+static bool hasSSSE3() {
+  static bool supported = __builtin_cpu_supports("ssse3");
+  return supported;
+}
+#endif
+
+std::string base64Decode(const std::string& encoded) {
+  // Line breaks are ignored.
+  std::string stripped;
+  const std::string* input = &encoded;
+  if (memchr(encoded.data(), '\n', encoded.size()) != nullptr) {
+    stripped = encoded;
+    boost::replace_all(stripped, "\r\n", "");
+    boost::replace_all(stripped, "\n", "");
+    input = &stripped;
+  }
 
   // Remove the padding characters
-  if (size && is[size - 1] == '=') {
+  size_t size = input->size();
+  if (size && (*input)[size - 1] == '=') {
     --size;
-    if (size && is[size - 1] == '=') {
+    if (size && (*input)[size - 1] == '=') {
       --size;
     }
   }
@@ -47,30 +247,112 @@ std::string base64Decode(const std::string& encoded) {
     return "";
   }
 
-  std::copy(base64_dec(is.data()),
-            base64_dec(is.data() + size),
-            std::ostream_iterator<char>(os));
+  // A trailing character with less than 8 bits decodes to nothing.
+  auto decoded_size = size / 4 * 3 + (size % 4) * 3 / 4;
+  std::string decoded(decoded_size + 4, '\0');
+  auto in = input->data();
+  auto out = reinterpret_cast<uint8_t*>(&decoded[0]);
+
+  size_t i = 0;
+#ifdef OSQUERY_CONVERSIONS_SSSE3
+  if (hasSSSE3()) {
+    i = base64DecodeSSSE3(in, size, out);
+  }
+#endif
+  i += base64DecodeScalar(in + i, size - i, out + i / 4 * 3);
+  if (size - i >= 4) {
+    return "";
+  }
+
+  // Decode the last incomplete group.
+  auto values = getBase64Values();
+  uint32_t group = 0;
+  for (size_t j = i; j < size; j++) {
+    auto value = values[static_cast<uint8_t>(in[j])];
+    if (value == kBase64Invalid) {
+      return "";
+    }
+    group |= value << (18 - 6 * (j - i));
+  }
+  out += i / 4 * 3;
+  if (size - i >= 2) {
+    *out++ = static_cast<uint8_t>(group >> 16);
+  }
+  if (size - i == 3) {
+    *out++ = static_cast<uint8_t>(group >> 8);
+  }
 
-  return os.str();
+  decoded.resize(decoded_size);
+  return decoded;
 }
 
 std::string base64Encode(const std::string& unencoded) {
-  std::stringstream os;
-
   if (unencoded.size() == 0) {
     return std::string();
   }
 
-  size_t writePaddChars = (3U - unencoded.length() % 3U) % 3U;
-  std::string base64(it_base64(unencoded.begin()), it_base64(unencoded.end()));
-  base64.append(writePaddChars, '=');
-  os << base64;
-  return os.str();
+  auto size = unencoded.size();
+  std::string encoded((size + 2) / 3 * 4, '\0');
+  auto in = reinterpret_cast<const uint8_t*>(unencoded.data());
+  auto out = &encoded[0];
+
+  size_t i = 0;
+#ifdef OSQUERY_CONVERSIONS_SSSE3
+  if (hasSSSE3()) {
+    i = base64EncodeSSSE3(in, size, out);
+  }
+#endif
+  i += base64EncodeScalar(in + i, size - i, out + i / 3 * 4);
+
+  // Encode the last incomplete group, with padding.
+  if (i < size) {
+    out += i / 3 * 4;
+    uint32_t group = in[i] << 16;
+    if (i + 1 < size) {
+      group |= in[i + 1] << 8;
+    }
+    *out++ = kBase64Alphabet[(group >> 18) & 0x3F];
+    *out++ = kBase64Alphabet[(group >> 12) & 0x3F];
+    *out++ = (i + 1 < size) ? kBase64Alphabet[(group >> 6) & 0x3F] : '=';
+    *out++ = '=';
+  }
+  return encoded;
 }
 
 bool isPrintable(const std::string& check) {
-  for (const unsigned char ch : check) {
-    if (ch >= 0x7F || ch <= 0x1F) {
+  auto data = reinterpret_cast<const uint8_t*>(check.data());
+  auto size = check.size();
+  size_t i = 0;
+
+#if defined(__SSE2__)
+  // Bytes from 0x80 are negative, so a signed range check covers them.
+  const auto space = _mm_set1_epi8(0x1F);
+  const auto del = _mm_set1_epi8(0x7F);
+  for (; i + 16 <= size; i += 16) {
+    auto bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+    auto printable = _mm_and_si128(_mm_cmpgt_epi8(bytes, space),
+                                   _mm_cmplt_epi8(bytes, del));
+    if (_mm_movemask_epi8(printable) != 0xFFFF) {
+      return false;
+    }
+  }
+#else
+  // Check 8 bytes at a time for a byte below 0x20 or above 0x7E.
+  const uint64_t ones = 0x0101010101010101ULL;
+  const uint64_t highs = 0x8080808080808080ULL;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word;
+    memcpy(&word, data + i, sizeof(word));
+    auto below = (word - ones * 0x20) & ~word;
+    auto above = (word + ones) | word;
+    if ((below | above) & highs) {
+      return false;
+    }
+  }
+#endif
+
+  for (; i < size; i++) {
+    if (data[i] >= 0x7F || data[i] <= 0x1F) {
       return false;
     }
   }
@@ -113,7 +395,125 @@ std::vector<std::string> split(const std::string& s,
   return elems;
 }
 
+Tokenizer::Tokenizer(boost::string_ref text, boost::string_ref delims)
+    : text_(text) {
+  if (delims.size() == 1) {
+    delim_ = static_cast<unsigned char>(delims[0]);
+  }
+  for (const auto& c : delims) {
+    delims_.set(static_cast<unsigned char>(c));
+  }
+}
+
+size_t Tokenizer::find(size_t pos) const {
+  if (delim_ >= 0) {
+    auto found = memchr(text_.data() + pos, delim_, text_.size() - pos);
+    return (found == nullptr)
+               ? text_.size()
+               : static_cast<const char*>(found) - text_.data();
+  }
+
+  while (pos < text_.size() &&
+         !delims_.test(static_cast<unsigned char>(text_[pos]))) {
+    pos++;
+  }
+  return pos;
+}
+
+bool Tokenizer::next(boost::string_ref& token) {
+  while (pos_ < text_.size()) {
+    auto end = find(pos_);
+    auto start = pos_;
+    pos_ = end + 1;
+    if (end == start) {
+      // Empty tokens between delimiters are skipped.
+      continue;
+    }
+
+    // Trim as boost::algorithm::trim does in the classic locale.
+    while (start < end && isspace(static_cast<unsigned char>(text_[start]))) {
+      start++;
+    }
+    while (end > start &&
+           isspace(static_cast<unsigned char>(text_[end - 1]))) {
+      end--;
+    }
+    token = text_.substr(start, end - start);
+    return true;
+  }
+  return false;
+}
+
+void tokenize(boost::string_ref text,
+              boost::string_ref delims,
+              std::vector<boost::string_ref>& tokens) {
+  tokens.clear();
+  Tokenizer tokenizer(text, delims);
+  boost::string_ref token;
+  while (tokenizer.next(token)) {
+    tokens.push_back(token);
+  }
+}
+
 std::string join(const std::vector<std::string>& s, const std::string& tok) {
   return boost::algorithm::join(s, tok);
 }
+
+std::string join(const std::vector<boost::string_ref>& s,
+                 const std::string& tok) {
+  std::string joined;
+  for (size_t i = 0; i < s.size(); i++) {
+    if (i > 0) {
+      joined += tok;
+    }
+    joined.append(s[i].data(), s[i].size());
+  }
+  return joined;
+}
+
+/// The next character of a UTF-8 string, as SQLite's LIKE steps.
+static size_t nextLikeChar(boost::string_ref value, size_t pos) {
+  pos++;
+  while (pos < value.size() && (value[pos] & 0xC0) == 0x80) {
+    pos++;
+  }
+  return pos;
+}
+
+static char lowerLikeChar(char c) {
+  return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+bool likeMatches(boost::string_ref pattern, boost::string_ref value) {
+  size_t p = 0;
+  size_t v = 0;
+  // The pattern and value positions after the last '%'.
+  size_t star_p = boost::string_ref::npos;
+  size_t star_v = 0;
+  while (v < value.size()) {
+    if (p < pattern.size() && pattern[p] == '%') {
+      star_p = ++p;
+      star_v = v;
+    } else if (p < pattern.size() && pattern[p] == '_') {
+      p++;
+      v = nextLikeChar(value, v);
+    } else if (p < pattern.size() &&
+               lowerLikeChar(pattern[p]) == lowerLikeChar(value[v])) {
+      p++;
+      v++;
+    } else if (star_p != boost::string_ref::npos) {
+      // Let the last '%' consume one more character.
+      p = star_p;
+      star_v = nextLikeChar(value, star_v);
+      v = star_v;
+    } else {
+      return false;
+    }
+  }
+
+  while (p < pattern.size() && pattern[p] == '%') {
+    p++;
+  }
+  return p == pattern.size();
+}
 }
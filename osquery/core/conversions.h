@@ -12,12 +12,14 @@
 
 #include <limits.h>
 
+#include <bitset>
 #include <memory>
 #include <string>
 #include <vector>
 
 #include <boost/bind.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/utility/string_ref.hpp>
 
 #include <osquery/status.h>
 
@@ -77,6 +79,48 @@ std::vector<std::string> split(const std::string& s,
                                const std::string& delim,
                                size_t occurences);
 
+/**
+ * @brief Split text into tokens without copying them, as split does.
+ *
+ * Each token is a view of the text between any of the delimiters. As with
+ * split, empty tokens are skipped and each token has its whitespace trimmed.
+ * The text must outlive the tokens.
+ *
+ * A single delimiter, such as the newline between lines, is found with
+ * memchr, which the C library vectorizes.
+ */
+class Tokenizer {
+ public:
+  explicit Tokenizer(boost::string_ref text, boost::string_ref delims = "\t ");
+
+  /// Read the next token, false once the text is exhausted.
+  bool next(boost::string_ref& token);
+
+ private:
+  /// Find the next delimiter from the position, or the end of the text.
+  size_t find(size_t pos) const;
+
+ private:
+  boost::string_ref text_;
+
+  /// The position of the next token.
+  size_t pos_{0};
+
+  /// The delimiter when there is only one, otherwise the delimiter set.
+  int delim_{-1};
+  std::bitset<256> delims_;
+};
+
+/**
+ * @brief Split text into token views, see Tokenizer.
+ *
+ * The tokens replace the vector's contents, a vector reused for each line
+ * keeps its storage.
+ */
+void tokenize(boost::string_ref text,
+              boost::string_ref delims,
+              std::vector<boost::string_ref>& tokens);
+
 /**
  * @brief In-line replace all instances of from with to.
  *
@@ -108,9 +152,28 @@ inline void replaceAll(std::string& str,
  */
 std::string join(const std::vector<std::string>& s, const std::string& tok);
 
+/// See join, for the token views of tokenize.
+std::string join(const std::vector<boost::string_ref>& s,
+                 const std::string& tok);
+
+/**
+ * @brief Check if a string matches a SQL LIKE pattern.
+ *
+ * Matches as SQLite does without an ESCAPE clause: '%' matches any sequence,
+ * '_' matches one UTF-8 character, and ASCII letters match in either case.
+ *
+ * @param pattern the LIKE pattern.
+ * @param value the string to match.
+ * @return true if the value matches the pattern.
+ */
+bool likeMatches(boost::string_ref pattern, boost::string_ref value);
+
 /**
  * @brief Decode a base64 encoded string.
  *
+ * Line breaks are ignored, and input with any other invalid character
+ * decodes to an empty string.
+ *
  * @param encoded The encode base64 string.
  * @return Decoded string.
  */
@@ -8,16 +8,56 @@
  *
  */
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <iomanip>
+#include <memory>
 #include <sstream>
+#include <thread>
 #include <vector>
 
+#include <sys/stat.h>
+
+#include <boost/filesystem.hpp>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include <osquery/core.h>
+#include <osquery/database.h>
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/hash.h>
 #include <osquery/logger.h>
 
+#include "osquery/core/conversions.h"
+
 namespace osquery {
 
+FLAG(bool,
+     disable_hash_cache,
+     false,
+     "Disable caching file digests by inode, size, and times");
+
+FLAG(uint64,
+     hash_cache_max,
+     50000,
+     "Maximum number of cached file digests, the cache is cleared when full");
+
+FLAG(uint64,
+     hash_io_limit,
+     0,
+     "Maximum KB per second read when hashing files, 0 for no limit");
+
+FLAG(bool,
+     hash_drop_cache,
+     true,
+     "Drop pages read when hashing files that were not already cached");
+
 #ifdef __APPLE__
 #import <CommonCrypto/CommonDigest.h>
 #define __HASH_API(name) CC_##name
@@ -30,7 +70,10 @@ namespace osquery {
 #define SHA1_CTX SHA_CTX
 #endif
 
-#define HASH_CHUNK_SIZE 4096
+#define HASH_CHUNK_SIZE 65536
+
+/// Reads at least this large update each requested digest in a thread.
+const size_t kHashParallelSize = 1024 * 1024;
 
 Hash::~Hash() {
   if (ctx_ != nullptr) {
@@ -95,36 +138,232 @@ std::string hashFromBuffer(HashType hash_type,
   return hash.digest();
 }
 
-MultiHashes hashMultiFromFile(int mask, const std::string& path) {
-  std::map<HashType, std::shared_ptr<Hash>> hashes = {
-      {HASH_TYPE_MD5, std::make_shared<Hash>(HASH_TYPE_MD5)},
-      {HASH_TYPE_SHA1, std::make_shared<Hash>(HASH_TYPE_SHA1)},
-      {HASH_TYPE_SHA256, std::make_shared<Hash>(HASH_TYPE_SHA256)},
+/// The number of cached digests, counted from the database when first used.
+static std::atomic<int64_t> kHashCacheCount(-1);
+
+/// Protect counting the cached digests.
+static Mutex kHashCacheMutex;
+
+/// Read the cached digests of a file, the digests present are set in mask.
+static void getCachedHashes(const std::string& key, MultiHashes& mh) {
+  std::string value;
+  if (!getDatabaseValue(kHashes, key, value).ok()) {
+    return;
+  }
+
+  // Cached digests are stored as "md5,sha1,sha256", any may be empty.
+  auto digests = osquery::split(value, ",");
+  if (digests.size() != 3) {
+    return;
+  }
+  auto types = {HASH_TYPE_MD5, HASH_TYPE_SHA1, HASH_TYPE_SHA256};
+  std::string* values[] = {&mh.md5, &mh.sha1, &mh.sha256};
+  size_t i = 0;
+  for (const auto& type : types) {
+    if (!digests[i].empty() && digests[i] != "-") {
+      *values[i] = std::move(digests[i]);
+      mh.mask |= type;
+    }
+    i++;
+  }
+}
+
+/// Store the digests of a file, clearing the cache when it is full.
+static void setCachedHashes(const std::string& key, const MultiHashes& mh) {
+  auto count = kHashCacheCount.load();
+  if (count < 0) {
+    WriteLock lock(kHashCacheMutex);
+    std::vector<std::string> keys;
+    scanDatabaseKeys(kHashes, keys);
+    count = static_cast<int64_t>(keys.size());
+    kHashCacheCount = count;
+  }
+
+  if (static_cast<uint64_t>(count) >= FLAGS_hash_cache_max) {
+    // Digests are not ordered by use, start over rather than track an order.
+    deleteDatabaseRange(kHashes, "0", ":");
+    kHashCacheCount = 0;
+  }
+
+  // Empty digests are stored as "-" so each of the three fields is present.
+  auto field = [](const std::string& digest) {
+    return (digest.empty()) ? std::string("-") : digest;
   };
+  auto value = field(mh.md5) + "," + field(mh.sha1) + "," + field(mh.sha256);
+  if (setDatabaseValue(kHashes, key, value).ok()) {
+    kHashCacheCount++;
+  }
+}
 
-  readFile(path,
-           0,
-           HASH_CHUNK_SIZE,
-           false,
-           true,
-           ([&hashes, &mask](std::string& buffer, size_t size) {
-             for (auto& hash : hashes) {
-               if (mask & hash.first) {
-                 hash.second->update(&buffer[0], size);
-               }
-             }
-           }));
+/// The earliest time the next hashing read may start, see throttleHashRead.
+static std::chrono::steady_clock::time_point kHashReadNext;
 
+/// Protect the hashing read budget.
+static Mutex kHashReadMutex;
+
+/**
+ * @brief Wait until a read of `size` bytes fits the hashing read budget.
+ *
+ * Reads are paced by `--hash_io_limit`. Each read reserves the time its
+ * bytes take at the limit, concurrent readers wait for their reservations.
+ */
+static void throttleHashRead(const std::string& path) {
+  if (FLAGS_hash_io_limit == 0) {
+    return;
+  }
+
+  boost::system::error_code ec;
+  auto size = boost::filesystem::file_size(path, ec);
+  if (ec) {
+    return;
+  }
+
+  auto cost = std::chrono::microseconds(
+      static_cast<uint64_t>(size) * 1000000 / (FLAGS_hash_io_limit * 1024));
+  std::chrono::steady_clock::time_point start;
+  {
+    WriteLock lock(kHashReadMutex);
+    start = std::max(std::chrono::steady_clock::now(), kHashReadNext);
+    kHashReadNext = start + cost;
+  }
+  std::this_thread::sleep_until(start);
+}
+
+#ifdef __linux__
+/// True if any page of a file is in the page cache.
+static bool isFileCached(int fd, size_t size) {
+  auto map = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) {
+    // Assume the file is used by others, its pages are not dropped.
+    return true;
+  }
+
+  auto page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+  std::vector<unsigned char> pages((size + page - 1) / page);
+  bool cached = true;
+  if (::mincore(map, size, pages.data()) == 0) {
+    cached = std::any_of(
+        pages.begin(), pages.end(), [](unsigned char p) { return p & 1; });
+  }
+  ::munmap(map, size);
+  return cached;
+}
+#endif
+
+/// Update each digest with the same content, in parallel for large content.
+static void updateHashes(std::vector<std::unique_ptr<Hash>>& hashes,
+                         const void* buffer,
+                         size_t size) {
+  if (hashes.size() < 2 || size < kHashParallelSize) {
+    for (auto& hash : hashes) {
+      hash->update(buffer, size);
+    }
+    return;
+  }
+
+  // Each digest is sequential, but the digests are independent.
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < hashes.size(); i++) {
+    auto hash = hashes[i].get();
+    threads.emplace_back(
+        [hash, buffer, size]() { hash->update(buffer, size); });
+  }
+  hashes[0]->update(buffer, size);
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+/**
+ * @brief Hash a file's content without keeping it in the page cache.
+ *
+ * A scan of many files would otherwise replace the cached pages of the
+ * host's workloads. Files with pages already cached are in use by something
+ * else and are left as they are.
+ */
+static Status readHashedFile(const std::string& path,
+                             std::vector<std::unique_ptr<Hash>>& hashes) {
+  auto read = [&path, &hashes]() {
+    // Large files are mapped and hashed without a copy.
+    return readFileView(path,
+                        HASH_CHUNK_SIZE,
+                        true,
+                        ([&hashes](boost::string_ref content) {
+                          updateHashes(hashes, content.data(), content.size());
+                        }));
+  };
+
+#ifdef __linux__
+  if (FLAGS_hash_drop_cache) {
+    auto fd = ::open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    struct stat st;
+    if (fd >= 0 && ::fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+        st.st_size > 0 && !isFileCached(fd, st.st_size)) {
+      auto status = read();
+      ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+      ::close(fd);
+      return status;
+    }
+    if (fd >= 0) {
+      ::close(fd);
+    }
+  }
+#endif
+  return read();
+}
+
+MultiHashes hashMultiFromFile(int mask, const std::string& path) {
   MultiHashes mh;
+  mh.mask = 0;
+
+  // Digests of unchanged content are reused from the cache.
+  std::string key;
+  bool cache = !FLAGS_disable_hash_cache && getFileChangeKey(path, key);
+  if (cache) {
+    getCachedHashes(key, mh);
+  }
+
+  // Only the requested digests that are not cached are created and updated.
+  std::vector<HashType> types;
+  std::vector<std::unique_ptr<Hash>> hashes;
+  for (const auto& type : {HASH_TYPE_MD5, HASH_TYPE_SHA1, HASH_TYPE_SHA256}) {
+    if ((mask & type) && !(mh.mask & type)) {
+      types.push_back(type);
+      hashes.emplace_back(new Hash(type));
+    }
+  }
+
+  if (!hashes.empty()) {
+    throttleHashRead(path);
+    auto status = readHashedFile(path, hashes);
+
+    for (size_t i = 0; i < types.size(); i++) {
+      if (types[i] == HASH_TYPE_MD5) {
+        mh.md5 = hashes[i]->digest();
+      } else if (types[i] == HASH_TYPE_SHA1) {
+        mh.sha1 = hashes[i]->digest();
+      } else {
+        mh.sha256 = hashes[i]->digest();
+      }
+    }
+
+    // Only cache the digests if the file did not change while it was read.
+    std::string after;
+    if (cache && status.ok() && getFileChangeKey(path, after) && after == key) {
+      setCachedHashes(key, mh);
+    }
+  }
+
+  // Cached digests that were not requested are not returned.
   mh.mask = mask;
-  if (mask & HASH_TYPE_MD5) {
-    mh.md5 = hashes.at(HASH_TYPE_MD5)->digest();
+  if (!(mask & HASH_TYPE_MD5)) {
+    mh.md5.clear();
   }
-  if (mask & HASH_TYPE_SHA1) {
-    mh.sha1 = hashes.at(HASH_TYPE_SHA1)->digest();
+  if (!(mask & HASH_TYPE_SHA1)) {
+    mh.sha1.clear();
   }
-  if (mask & HASH_TYPE_SHA256) {
-    mh.sha256 = hashes.at(HASH_TYPE_SHA256)->digest();
+  if (!(mask & HASH_TYPE_SHA256)) {
+    mh.sha256.clear();
   }
   return mh;
 }
@@ -8,6 +8,7 @@
  *
  */
 
+#include <algorithm>
 #include <chrono>
 #include <iostream>
 #include <random>
@@ -33,8 +34,11 @@
 #include <osquery/registry.h>
 #include <osquery/system.h>
 
+#include "osquery/core/conversions.h"
 #include "osquery/core/watcher.h"
 #include "osquery/core/process.h"
+#include "osquery/core/startup.h"
+#include "osquery/core/tracing.h"
 
 #if defined(__linux__) || defined(__FreeBSD__)
 #include <sys/resource.h>
@@ -166,6 +170,13 @@ void signalHandler(int num) {
     // managed extension processes.
   }
 }
+
+#if defined(OSQUERY_TRACING)
+void traceSignalHandler(int num) {
+  // The spans are written by the scheduler, outside of the signal handler.
+  osquery::requestTraceDump();
+}
+#endif
 #endif
 }
 }
@@ -267,6 +278,7 @@ Initializer::Initializer(int& argc, char**& argv, ToolType tool)
       argv_(&argv),
       tool_(tool),
       binary_((tool == OSQUERY_TOOL_DAEMON) ? "osqueryd" : "osqueryi") {
+  beginStartupTimer();
   std::srand(chrono_clock::now().time_since_epoch().count());
 
   // Initialize registries and plugins
@@ -343,6 +355,9 @@ Initializer::Initializer(int& argc, char**& argv, ToolType tool)
   std::signal(SIGHUP, signalHandler);
   std::signal(SIGALRM, signalHandler);
   std::signal(SIGUSR1, signalHandler);
+#if defined(OSQUERY_TRACING)
+  std::signal(SIGUSR2, traceSignalHandler);
+#endif
 #endif
 
   // If the caller is checking configuration, disable the watchdog/worker.
@@ -515,6 +530,7 @@ void Initializer::initActivePlugin(const std::string& type,
   // Attempt to set the request plugin as active.
   Status status;
   do {
+    auto broadcasts = Registry::broadcasts();
     status = Registry::setActive(type, name);
     if (status.ok()) {
       // The plugin was found, and is not active.
@@ -525,9 +541,26 @@ void Initializer::initActivePlugin(const std::string& type,
       // The plugin was found locally, and is not active, problem.
       break;
     }
+
     // The plugin is not local and is not active, wait and retry.
-    delay += kExtensionInitializeLatencyUS;
-    sleepFor(kExtensionInitializeLatencyUS / 1000);
+    // An extension that registered the plugin starts serving shortly after,
+    // otherwise wait for the next extension to register.
+    bool registered = true;
+    for (const auto& item : osquery::split(name, ",")) {
+      registered = registered && Registry::exists(type, item);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    if (registered) {
+      sleepFor(kExtensionInitializeLatencyUS / 1000);
+    } else {
+      Registry::waitForBroadcast(broadcasts, (timeout - delay) / 1000);
+    }
+    delay += std::max<size_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start)
+            .count(),
+        kExtensionInitializeLatencyUS);
   } while (delay < timeout);
 
   LOG(ERROR) << "Cannot activate " << name << " " << type
@@ -536,8 +569,10 @@ void Initializer::initActivePlugin(const std::string& type,
 }
 
 void Initializer::start() const {
+  recordStartupPhase("initialize");
+
   // Load registry/extension modules before extensions.
-  osquery::loadModules();
+  runStartupPhase("modules", []() { osquery::loadModules(); });
 
   // Pre-extension manager initialization options checking.
   // If the shell or daemon does not need extensions and it will exit quickly,
@@ -551,27 +586,34 @@ void Initializer::start() const {
   // If there are spurious access then warning logs will be emitted since the
   // set-allow-open will never be called.
   if (!isWatcher()) {
-    DatabasePlugin::setAllowOpen(true);
-    // A daemon must always have R/W access to the database.
-    DatabasePlugin::setRequireWrite(tool_ == OSQUERY_TOOL_DAEMON);
-    if (!DatabasePlugin::initPlugin()) {
-      LOG(ERROR) << RLOG(1629) << binary_
-                 << " initialize failed: Could not initialize database";
-      auto retcode = (isWorker()) ? EXIT_CATASTROPHIC : EXIT_FAILURE;
-      requestShutdown(retcode);
-    }
+    runStartupPhase("database", [this]() {
+      DatabasePlugin::setAllowOpen(true);
+      // A daemon must always have R/W access to the database.
+      DatabasePlugin::setRequireWrite(tool_ == OSQUERY_TOOL_DAEMON);
+      if (!DatabasePlugin::initPlugin()) {
+        LOG(ERROR) << RLOG(1629) << binary_
+                   << " initialize failed: Could not initialize database";
+        auto retcode = (isWorker()) ? EXIT_CATASTROPHIC : EXIT_FAILURE;
+        requestShutdown(retcode);
+      }
+    });
   }
 
   // Bind to an extensions socket and wait for registry additions.
   // After starting the extension manager, osquery MUST shutdown using the
   // internal 'shutdown' method.
-  osquery::startExtensionManager();
-
-  // Then set the config plugin, which uses a single/active plugin.
-  initActivePlugin("config", FLAGS_config_plugin);
-
-  // Run the setup for all lazy registries (tables, SQL).
-  Registry::setUp();
+  runStartupPhase("extensions", []() { osquery::startExtensionManager(); });
+
+  // Then set the config plugin, which uses a single/active plugin, while the
+  // lazy registries (tables, SQL) run their setup. Plugins that fail to
+  // activate request a shutdown, which must happen on the main thread.
+  StartupGraph plugins;
+  plugins.add("config_plugin",
+              {},
+              [this]() { initActivePlugin("config", FLAGS_config_plugin); },
+              true);
+  plugins.add("registry", {}, []() { Registry::setUp(); });
+  plugins.run();
 
   if (FLAGS_config_check) {
     // The initiator requested an initialization and config check.
@@ -589,35 +631,54 @@ void Initializer::start() const {
     requestShutdown();
   }
 
-  // Load the osquery config using the default/active config plugin.
-  auto s = Config::getInstance().load();
-  if (!s.ok()) {
-    auto message = "Error reading config: " + s.toString();
-    if (tool_ == OSQUERY_TOOL_DAEMON) {
-      LOG(WARNING) << message;
-    } else {
-      LOG(INFO) << message;
-    }
-  }
-
-  // Initialize the status and result plugin logger.
-  if (!FLAGS_disable_logging) {
-    initActivePlugin("logger", FLAGS_logger_plugin);
-  }
-  initLogger(binary_);
-
+  // The config's options may set the flags used by every later phase, and
+  // the logger receives the status logs buffered until then. The remaining
+  // plugins are independent and set up concurrently.
+  StartupGraph services;
+  services.add("config",
+               {},
+               [this]() {
+                 // Load the osquery config using the default/active plugin.
+                 auto s = Config::getInstance().load();
+                 if (!s.ok()) {
+                   auto message = "Error reading config: " + s.toString();
+                   if (tool_ == OSQUERY_TOOL_DAEMON) {
+                     LOG(WARNING) << message;
+                   } else {
+                     LOG(INFO) << message;
+                   }
+                 }
+               },
+               true);
+  services.add("logger",
+               {"config"},
+               [this]() {
+                 // Initialize the status and result plugin logger.
+                 if (!FLAGS_disable_logging) {
+                   initActivePlugin("logger", FLAGS_logger_plugin);
+                 }
+                 initLogger(binary_);
+               },
+               true);
 #ifndef WIN32
-  // Initialize the distributed plugin, if necessary
-  if (!FLAGS_disable_distributed) {
-    if (Registry::exists("distributed", FLAGS_distributed_plugin)) {
-      initActivePlugin("distributed", FLAGS_distributed_plugin);
-    }
-  }
+  services.add("distributed",
+               {"logger"},
+               [this]() {
+                 // Initialize the distributed plugin, if necessary
+                 if (!FLAGS_disable_distributed &&
+                     Registry::exists("distributed",
+                                      FLAGS_distributed_plugin)) {
+                   initActivePlugin("distributed", FLAGS_distributed_plugin);
+                 }
+               },
+               true);
 #endif
-
-  // Start event threads.
-  osquery::attachEvents();
+  // Set up the event publishers, which start their threads after a delay.
+  services.add("events", {"logger"}, []() { osquery::attachEvents(); });
+  services.run();
   EventFactory::delay();
+
+  recordStartupPhase("start");
 }
 
 void Initializer::waitForShutdown() {
@@ -0,0 +1,470 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <string.h>
+
+#include "osquery/core/json.h"
+
+namespace osquery {
+
+/// Characters written as-is, every other character is escaped.
+static inline bool isJSONSafe(unsigned char c) {
+  return c >= 0x20 && c != '"' && c != '/' && c != '\\';
+}
+
+void JSONWriter::escape(const std::string& input, std::string& output) {
+  static const char* kHexDigits = "0123456789ABCDEF";
+
+  const char* data = input.data();
+  size_t size = input.size();
+  size_t run = 0;
+  for (size_t i = 0; i < size; i++) {
+    auto c = static_cast<unsigned char>(data[i]);
+    if (isJSONSafe(c)) {
+      continue;
+    }
+
+    // Append the run of safe characters before this one at once.
+    output.append(data + run, i - run);
+    run = i + 1;
+    switch (c) {
+    case '\b':
+      output += "\\b";
+      break;
+    case '\f':
+      output += "\\f";
+      break;
+    case '\n':
+      output += "\\n";
+      break;
+    case '\r':
+      output += "\\r";
+      break;
+    case '\t':
+      output += "\\t";
+      break;
+    case '/':
+      output += "\\/";
+      break;
+    case '"':
+      output += "\\\"";
+      break;
+    case '\\':
+      output += "\\\\";
+      break;
+    default:
+      output += "\\u00";
+      output += kHexDigits[c >> 4];
+      output += kHexDigits[c & 0x0F];
+      break;
+    }
+  }
+  output.append(data + run, size - run);
+}
+
+void JSONWriter::separate() {
+  if (after_key_) {
+    after_key_ = false;
+  } else if (!first_.empty()) {
+    if (first_.back()) {
+      first_.back() = false;
+    } else {
+      output_ += ',';
+    }
+  }
+}
+
+void JSONWriter::startObject() {
+  separate();
+  output_ += '{';
+  first_.push_back(true);
+}
+
+void JSONWriter::endObject() {
+  output_ += '}';
+  first_.pop_back();
+}
+
+void JSONWriter::startArray() {
+  separate();
+  output_ += '[';
+  first_.push_back(true);
+}
+
+void JSONWriter::endArray() {
+  output_ += ']';
+  first_.pop_back();
+}
+
+void JSONWriter::key(const std::string& name) {
+  separate();
+  output_ += '"';
+  escape(name, output_);
+  output_ += "\":";
+  after_key_ = true;
+}
+
+void JSONWriter::value(const std::string& value) {
+  separate();
+  output_ += '"';
+  escape(value, output_);
+  output_ += '"';
+}
+
+void JSONWriter::raw(const std::string& json) {
+  separate();
+  output_ += json;
+}
+
+const size_t kJSONMaxDepth = 512;
+
+namespace {
+
+/// A recursive descent parser emitting events to a JSONHandler.
+class JSONParser : private boost::noncopyable {
+ public:
+  JSONParser(const std::string& json, JSONHandler& handler)
+      : data_(json.data()), end_(json.data() + json.size()), handler_(handler) {
+    start_ = data_;
+  }
+
+  Status parse() {
+    skipSpace();
+    if (!parseValue(0)) {
+      return error();
+    }
+
+    skipSpace();
+    if (data_ != end_) {
+      error_ = "Unexpected content after the document";
+      return error();
+    }
+    return Status(0, "OK");
+  }
+
+ private:
+  Status error() const {
+    return Status(1,
+                  "JSON parse error at offset " +
+                      std::to_string(data_ - start_) + ": " + error_);
+  }
+
+  bool fail(const char* message) {
+    error_ = message;
+    return false;
+  }
+
+  void skipSpace() {
+    while (data_ != end_ &&
+           (*data_ == ' ' || *data_ == '\n' || *data_ == '\r' ||
+            *data_ == '\t')) {
+      data_++;
+    }
+  }
+
+  bool expect(char c) {
+    if (data_ == end_ || *data_ != c) {
+      return false;
+    }
+    data_++;
+    return true;
+  }
+
+  bool parseValue(size_t depth) {
+    if (data_ == end_) {
+      return fail("Unexpected end of the document");
+    }
+
+    switch (*data_) {
+    case '{':
+      return parseObject(depth + 1);
+    case '[':
+      return parseArray(depth + 1);
+    case '"':
+      if (!parseString(buffer_)) {
+        return false;
+      }
+      handler_.value(buffer_);
+      return true;
+    case 't':
+      return parseLiteral("true");
+    case 'f':
+      return parseLiteral("false");
+    case 'n':
+      return parseLiteral("null");
+    default:
+      return parseNumber();
+    }
+  }
+
+  bool parseObject(size_t depth) {
+    if (depth > kJSONMaxDepth) {
+      return fail("Document is nested too deeply");
+    }
+
+    data_++;
+    handler_.startObject();
+    skipSpace();
+    if (expect('}')) {
+      handler_.endObject();
+      return true;
+    }
+
+    while (true) {
+      if (data_ == end_ || *data_ != '"') {
+        return fail("Expected a member name");
+      }
+      if (!parseString(buffer_)) {
+        return false;
+      }
+      handler_.key(buffer_);
+
+      skipSpace();
+      if (!expect(':')) {
+        return fail("Expected ':' after a member name");
+      }
+      skipSpace();
+      if (!parseValue(depth)) {
+        return false;
+      }
+
+      skipSpace();
+      if (expect('}')) {
+        break;
+      }
+      if (!expect(',')) {
+        return fail("Expected ',' or '}' in an object");
+      }
+      skipSpace();
+    }
+    handler_.endObject();
+    return true;
+  }
+
+  bool parseArray(size_t depth) {
+    if (depth > kJSONMaxDepth) {
+      return fail("Document is nested too deeply");
+    }
+
+    data_++;
+    handler_.startArray();
+    skipSpace();
+    if (expect(']')) {
+      handler_.endArray();
+      return true;
+    }
+
+    while (true) {
+      if (!parseValue(depth)) {
+        return false;
+      }
+
+      skipSpace();
+      if (expect(']')) {
+        break;
+      }
+      if (!expect(',')) {
+        return fail("Expected ',' or ']' in an array");
+      }
+      skipSpace();
+    }
+    handler_.endArray();
+    return true;
+  }
+
+  bool parseLiteral(const char* literal) {
+    auto size = strlen(literal);
+    if (static_cast<size_t>(end_ - data_) < size ||
+        strncmp(data_, literal, size) != 0) {
+      return fail("Invalid literal");
+    }
+    buffer_.assign(data_, size);
+    data_ += size;
+    handler_.value(buffer_);
+    return true;
+  }
+
+  bool digits() {
+    auto start = data_;
+    while (data_ != end_ && *data_ >= '0' && *data_ <= '9') {
+      data_++;
+    }
+    return data_ != start;
+  }
+
+  bool parseNumber() {
+    auto start = data_;
+    expect('-');
+    if (expect('0')) {
+      // A leading zero is not followed by more digits.
+    } else if (!digits()) {
+      return fail("Invalid value");
+    }
+
+    if (expect('.') && !digits()) {
+      return fail("Expected digits after a decimal point");
+    }
+
+    if (data_ != end_ && (*data_ == 'e' || *data_ == 'E')) {
+      data_++;
+      if (!expect('+')) {
+        expect('-');
+      }
+      if (!digits()) {
+        return fail("Expected digits in an exponent");
+      }
+    }
+
+    buffer_.assign(start, data_ - start);
+    handler_.value(buffer_);
+    return true;
+  }
+
+  bool parseHex(unsigned int& codepoint) {
+    if (end_ - data_ < 4) {
+      return fail("Invalid unicode escape");
+    }
+
+    codepoint = 0;
+    for (size_t i = 0; i < 4; i++) {
+      char c = *data_++;
+      codepoint <<= 4;
+      if (c >= '0' && c <= '9') {
+        codepoint |= c - '0';
+      } else if (c >= 'a' && c <= 'f') {
+        codepoint |= c - 'a' + 10;
+      } else if (c >= 'A' && c <= 'F') {
+        codepoint |= c - 'A' + 10;
+      } else {
+        return fail("Invalid unicode escape");
+      }
+    }
+    return true;
+  }
+
+  static void appendUTF8(std::string& output, unsigned int codepoint) {
+    if (codepoint < 0x80) {
+      output += static_cast<char>(codepoint);
+    } else if (codepoint < 0x800) {
+      output += static_cast<char>(0xC0 | (codepoint >> 6));
+      output += static_cast<char>(0x80 | (codepoint & 0x3F));
+    } else if (codepoint < 0x10000) {
+      output += static_cast<char>(0xE0 | (codepoint >> 12));
+      output += static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F));
+      output += static_cast<char>(0x80 | (codepoint & 0x3F));
+    } else {
+      output += static_cast<char>(0xF0 | (codepoint >> 18));
+      output += static_cast<char>(0x80 | ((codepoint >> 12) & 0x3F));
+      output += static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F));
+      output += static_cast<char>(0x80 | (codepoint & 0x3F));
+    }
+  }
+
+  bool parseEscape(std::string& output) {
+    if (data_ == end_) {
+      return fail("Unterminated string");
+    }
+
+    char c = *data_++;
+    switch (c) {
+    case '"':
+    case '\\':
+    case '/':
+      output += c;
+      return true;
+    case 'b':
+      output += '\b';
+      return true;
+    case 'f':
+      output += '\f';
+      return true;
+    case 'n':
+      output += '\n';
+      return true;
+    case 'r':
+      output += '\r';
+      return true;
+    case 't':
+      output += '\t';
+      return true;
+    case 'u':
+      break;
+    default:
+      return fail("Invalid escape");
+    }
+
+    unsigned int codepoint = 0;
+    if (!parseHex(codepoint)) {
+      return false;
+    }
+
+    if (codepoint >= 0xDC00 && codepoint <= 0xDFFF) {
+      return fail("Unexpected low surrogate");
+    }
+
+    if (codepoint >= 0xD800 && codepoint <= 0xDBFF) {
+      // A high surrogate is followed by an escaped low surrogate.
+      unsigned int low = 0;
+      if (!expect('\\') || !expect('u') || !parseHex(low) || low < 0xDC00 ||
+          low > 0xDFFF) {
+        return fail("Expected a low surrogate");
+      }
+      codepoint = 0x10000 + ((codepoint - 0xD800) << 10) + (low - 0xDC00);
+    }
+    appendUTF8(output, codepoint);
+    return true;
+  }
+
+  bool parseString(std::string& output) {
+    output.clear();
+    data_++;
+    while (true) {
+      // Append the run of characters before a quote or escape at once.
+      auto run = data_;
+      while (data_ != end_ && *data_ != '"' && *data_ != '\\' &&
+             static_cast<unsigned char>(*data_) >= 0x20) {
+        data_++;
+      }
+      output.append(run, data_ - run);
+
+      if (data_ == end_) {
+        return fail("Unterminated string");
+      } else if (*data_ == '"') {
+        data_++;
+        return true;
+      } else if (*data_ == '\\') {
+        data_++;
+        if (!parseEscape(output)) {
+          return false;
+        }
+      } else {
+        return fail("Invalid control character in a string");
+      }
+    }
+  }
+
+ private:
+  const char* start_{nullptr};
+  const char* data_{nullptr};
+  const char* end_{nullptr};
+
+  JSONHandler& handler_;
+
+  /// The decoded key or value, reused for every string.
+  std::string buffer_;
+
+  std::string error_;
+};
+}
+
+Status parseJSON(const std::string& json, JSONHandler& handler) {
+  return JSONParser(json, handler).parse();
+}
+}
@@ -0,0 +1,129 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/status.h>
+
+namespace osquery {
+
+/**
+ * @brief A streaming JSON writer appending directly to a string.
+ *
+ * Results and events are serialized for every log line, building a property
+ * tree allocates a node per cell only to be written and thrown away. The
+ * writer appends to a caller-owned output string, which keeps its capacity
+ * when reused, and escapes strings a run of safe characters at a time.
+ *
+ * Strings are escaped as the property tree JSON writer escapes them, so the
+ * output of the serializers using this writer does not change.
+ */
+class JSONWriter : private boost::noncopyable {
+ public:
+  /// Append to an output string.
+  explicit JSONWriter(std::string& output) : output_(output) {}
+
+  /// Begin an object, as a value or array element.
+  void startObject();
+
+  /// End the most recent object.
+  void endObject();
+
+  /// Begin an array, as a value or array element.
+  void startArray();
+
+  /// End the most recent array.
+  void endArray();
+
+  /// Write an object member name, the next value belongs to it.
+  void key(const std::string& name);
+
+  /// Write a string value or array element.
+  void value(const std::string& value);
+
+  /// Write an object member with a string value.
+  void member(const std::string& name, const std::string& value) {
+    key(name);
+    this->value(value);
+  }
+
+  /// Write an already serialized value or array element.
+  void raw(const std::string& json);
+
+  /// End a document with a newline, as property tree's write_json.
+  void finish() { output_ += '\n'; }
+
+ public:
+  /// Append the escaped content of a JSON string, without quotes.
+  static void escape(const std::string& input, std::string& output);
+
+ private:
+  /// Write a separating comma unless this is the first value in a container.
+  void separate();
+
+ private:
+  /// The output, appended to.
+  std::string& output_;
+
+  /// For each open container, true until the first value is written.
+  std::vector<bool> first_;
+
+  /// True if a member name was written and its value is next.
+  bool after_key_{false};
+};
+
+/**
+ * @brief Callbacks for the events of a streaming JSON parse.
+ *
+ * A handler builds its own structures as the document is read, such as Rows,
+ * rather than copying them out of a property tree. Strings are provided in
+ * a buffer the handler may move from. Numbers, booleans, and null are values
+ * using their literal text, as they would be within a property tree.
+ */
+class JSONHandler {
+ public:
+  virtual ~JSONHandler() {}
+
+  /// An object member name, the member's value follows.
+  virtual void key(std::string& name) {}
+
+  /// A string, number, boolean, or null value.
+  virtual void value(std::string& value) {}
+
+  /// Begin an object.
+  virtual void startObject() {}
+
+  /// End the most recent object.
+  virtual void endObject() {}
+
+  /// Begin an array.
+  virtual void startArray() {}
+
+  /// End the most recent array.
+  virtual void endArray() {}
+};
+
+/// The maximum nesting of objects and arrays accepted by parseJSON.
+extern const size_t kJSONMaxDepth;
+
+/**
+ * @brief Parse a JSON document, without building a tree, into a handler.
+ *
+ * @param json The input document.
+ * @param handler Receives each key, value, and container in order.
+ * @return Failure and the error's offset if the document is not valid JSON.
+ */
+Status parseJSON(const std::string& json, JSONHandler& handler);
+}
@@ -8,6 +8,7 @@
  *
  */
 
+#include <algorithm>
 #include <string>
 
 #include <stdlib.h>
@@ -17,6 +18,15 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 
+#ifdef __linux__
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#elif defined(__APPLE__)
+#include <pthread.h>
+#include <sys/qos.h>
+#endif
+
 #include <boost/optional.hpp>
 
 #include "osquery/core/process.h"
@@ -74,4 +84,88 @@ ProcessState checkChildProcessStatus(const PlatformProcess& process,
 }
 
 void setToBackgroundPriority() { setpriority(PRIO_PGRP, 0, 10); }
+
+#ifdef __linux__
+/// The ioprio_set target and priority encoding, see linux/ioprio.h.
+const int kIOPrioWhoProcess = 1;
+const int kIOPrioClassShift = 13;
+const int kIOPrioClassBestEffort = 2;
+const int kIOPrioClassIdle = 3;
+#endif
+
+bool setThreadPolicy(ThreadPolicy policy, int nice) {
+  if (policy == THREAD_POLICY_DEFAULT) {
+    return true;
+  }
+  nice = std::min(std::max(nice, 1), 19);
+
+#ifdef __linux__
+  // The scheduling attributes of a thread ID apply to that thread only.
+  auto tid = static_cast<pid_t>(::syscall(SYS_gettid));
+  bool applied = true;
+  if (policy == THREAD_POLICY_NICE) {
+    applied = (::setpriority(PRIO_PROCESS, tid, nice) == 0);
+    // The best-effort I/O level follows the nice value, as CFQ's default.
+    auto ioprio =
+        (kIOPrioClassBestEffort << kIOPrioClassShift) | ((nice + 20) / 5);
+    applied =
+        (::syscall(SYS_ioprio_set, kIOPrioWhoProcess, tid, ioprio) == 0) &&
+        applied;
+  } else {
+    struct sched_param param;
+    param.sched_priority = 0;
+    auto scheduler = (policy == THREAD_POLICY_IDLE) ? SCHED_IDLE : SCHED_BATCH;
+    applied = (::sched_setscheduler(tid, scheduler, &param) == 0);
+    if (policy == THREAD_POLICY_IDLE) {
+      auto ioprio = kIOPrioClassIdle << kIOPrioClassShift;
+      applied =
+          (::syscall(SYS_ioprio_set, kIOPrioWhoProcess, tid, ioprio) == 0) &&
+          applied;
+    }
+  }
+  return applied;
+#elif defined(__APPLE__)
+  auto qos = (policy == THREAD_POLICY_IDLE) ? QOS_CLASS_BACKGROUND
+                                            : QOS_CLASS_UTILITY;
+  bool applied = (::pthread_set_qos_class_self_np(qos, 0) == 0);
+  if (policy == THREAD_POLICY_IDLE) {
+    applied = (::setiopolicy_np(IOPOL_TYPE_DISK,
+                                IOPOL_SCOPE_THREAD,
+                                IOPOL_THROTTLE) == 0) &&
+              applied;
+  }
+  return applied;
+#else
+  // Other platforms only set priorities for a whole process.
+  return false;
+#endif
+}
+
+bool getThreadResourceUsage(ProcessResourceUsage& usage) {
+  struct rusage ru;
+#ifdef RUSAGE_THREAD
+  if (::getrusage(RUSAGE_THREAD, &ru) != 0) {
+    return false;
+  }
+#else
+  if (::getrusage(RUSAGE_SELF, &ru) != 0) {
+    return false;
+  }
+#endif
+
+  usage.user_time = static_cast<unsigned long long int>(ru.ru_utime.tv_sec) *
+                        1000 +
+                    ru.ru_utime.tv_usec / 1000;
+  usage.system_time = static_cast<unsigned long long int>(ru.ru_stime.tv_sec) *
+                          1000 +
+                      ru.ru_stime.tv_usec / 1000;
+
+  // The maximum resident set size of a thread is that of the process.
+  usage.peak_resident_size = static_cast<unsigned long long int>(ru.ru_maxrss);
+#ifndef __APPLE__
+  // Linux and FreeBSD report kilobytes, Darwin reports bytes.
+  usage.peak_resident_size *= 1024;
+#endif
+  return true;
+}
 }
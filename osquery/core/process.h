@@ -127,6 +127,29 @@ class PlatformProcess : private boost::noncopyable {
   PlatformPidType id_;
 };
 
+/// CPU and memory usage, used to monitor scheduled query performance.
+struct ProcessResourceUsage {
+  /// Milliseconds of CPU time spent in user mode.
+  unsigned long long int user_time{0};
+
+  /// Milliseconds of CPU time spent in kernel mode.
+  unsigned long long int system_time{0};
+
+  /// Peak resident memory of the process in bytes.
+  unsigned long long int peak_resident_size{0};
+};
+
+/**
+ * @brief Read the resource usage of the calling thread.
+ *
+ * CPU times are reported for the calling thread where the platform allows,
+ * such that concurrent scheduled queries are measured independently.
+ * Otherwise CPU times are for the entire process. Memory is process-wide.
+ *
+ * This is a single system call, and much cheaper than the processes table.
+ */
+bool getThreadResourceUsage(ProcessResourceUsage& usage);
+
 /// Causes the current thread to sleep for a specified time in milliseconds
 void sleepFor(unsigned int msec);
 
@@ -156,4 +179,32 @@ void cleanupDefunctProcesses();
 
 /// Sets the current process to run with background scheduling priority
 void setToBackgroundPriority();
+
+/// CPU and I/O scheduling policies for a thread, see setThreadPolicy.
+enum ThreadPolicy {
+  /// Leave the thread's scheduling unchanged.
+  THREAD_POLICY_DEFAULT = 0,
+
+  /// Lower the thread's CPU and I/O priority by a nice value.
+  THREAD_POLICY_NICE,
+
+  /// Schedule the thread as non-interactive batch work.
+  THREAD_POLICY_BATCH,
+
+  /// Run the thread, and its disk I/O, only when the host is otherwise idle.
+  THREAD_POLICY_IDLE,
+};
+
+/**
+ * @brief Apply a scheduling policy to the calling thread.
+ *
+ * Linux uses SCHED_BATCH and SCHED_IDLE, the thread's nice value, and its
+ * ioprio. macOS uses quality of service classes and the thread's disk I/O
+ * policy. Windows uses thread priorities and background mode.
+ *
+ * @param policy The policy to apply.
+ * @param nice The nice value of THREAD_POLICY_NICE, from 1 to 19.
+ * @return false if the platform refused any part of the policy.
+ */
+bool setThreadPolicy(ThreadPolicy policy, int nice);
 }
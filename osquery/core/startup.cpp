@@ -0,0 +1,159 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <chrono>
+#include <condition_variable>
+#include <thread>
+
+#include <osquery/core.h>
+
+#include "osquery/core/startup.h"
+#include "osquery/core/tracing.h"
+
+namespace osquery {
+
+using startup_clock = std::chrono::steady_clock;
+
+static Mutex kStartupPhasesMutex;
+
+static std::vector<StartupPhase> kStartupPhases;
+
+/// The process began initializing, see beginStartupTimer.
+static startup_clock::time_point& getStartupEpoch() {
+  static auto epoch = startup_clock::now();
+  return epoch;
+}
+
+static unsigned long long getStartupMicros(startup_clock::time_point time) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             time - getStartupEpoch())
+      .count();
+}
+
+static void addStartupPhase(const char* name,
+                            startup_clock::time_point start,
+                            startup_clock::time_point end) {
+  StartupPhase phase;
+  phase.name = name;
+  phase.start = getStartupMicros(start);
+  phase.duration = std::chrono::duration_cast<std::chrono::microseconds>(
+                       end - start)
+                       .count();
+
+  WriteLock lock(kStartupPhasesMutex);
+  kStartupPhases.push_back(std::move(phase));
+}
+
+void beginStartupTimer() {
+  getStartupEpoch() = startup_clock::now();
+}
+
+void runStartupPhase(const char* name, const std::function<void()>& action) {
+  auto start = startup_clock::now();
+  {
+    OSQUERY_TRACE_SPAN(name);
+    action();
+  }
+  addStartupPhase(name, start, startup_clock::now());
+}
+
+void recordStartupPhase(const char* name) {
+  addStartupPhase(name, getStartupEpoch(), startup_clock::now());
+}
+
+std::vector<StartupPhase> getStartupPhases() {
+  WriteLock lock(kStartupPhasesMutex);
+  return kStartupPhases;
+}
+
+Status StartupGraph::add(const char* name,
+                         const std::vector<std::string>& depends,
+                         std::function<void()> action,
+                         bool main_thread) {
+  Action added;
+  added.name = name;
+  added.action = std::move(action);
+  added.main_thread = main_thread;
+  for (const auto& depend : depends) {
+    size_t index = 0;
+    while (index < actions_.size() && depend != actions_[index].name) {
+      index++;
+    }
+    if (index == actions_.size()) {
+      return Status(1, "Unknown startup action: " + depend);
+    }
+    added.depends.push_back(index);
+  }
+
+  actions_.push_back(std::move(added));
+  return Status(0, "OK");
+}
+
+void StartupGraph::run() {
+  std::mutex mutex;
+  std::condition_variable finished;
+  std::vector<std::thread> threads;
+  std::vector<bool> started(actions_.size(), false);
+  std::vector<bool> done(actions_.size(), false);
+  size_t remaining = actions_.size();
+
+  std::unique_lock<std::mutex> lock(mutex);
+  while (remaining > 0) {
+    // Start every ready action, and find a main thread action to run.
+    auto main_action = actions_.size();
+    for (size_t i = 0; i < actions_.size(); i++) {
+      if (started[i]) {
+        continue;
+      }
+
+      bool ready = true;
+      for (const auto& depend : actions_[i].depends) {
+        ready = ready && done[depend];
+      }
+      if (!ready) {
+        continue;
+      }
+
+      if (actions_[i].main_thread) {
+        if (main_action == actions_.size()) {
+          main_action = i;
+          started[i] = true;
+        }
+        continue;
+      }
+
+      started[i] = true;
+      threads.emplace_back([this, i, &mutex, &finished, &done, &remaining]() {
+        runStartupPhase(actions_[i].name, actions_[i].action);
+        std::lock_guard<std::mutex> done_lock(mutex);
+        done[i] = true;
+        remaining--;
+        finished.notify_all();
+      });
+    }
+
+    if (main_action != actions_.size()) {
+      lock.unlock();
+      runStartupPhase(actions_[main_action].name, actions_[main_action].action);
+      lock.lock();
+      done[main_action] = true;
+      remaining--;
+    } else if (remaining > 0) {
+      // Dependencies are added first, so a started action is still running.
+      finished.wait(lock);
+    }
+  }
+  lock.unlock();
+
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+}
@@ -0,0 +1,85 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/status.h>
+
+namespace osquery {
+
+/// The duration of a startup phase, see the osquery_startup table.
+struct StartupPhase {
+  std::string name;
+
+  /// Microseconds after the process began initializing that the phase began.
+  unsigned long long start{0};
+
+  /// Microseconds the phase took.
+  unsigned long long duration{0};
+};
+
+/// Begin counting startup time, the Initializer calls this first.
+void beginStartupTimer();
+
+/// Run an action as a startup phase and record its duration.
+void runStartupPhase(const char* name, const std::function<void()>& action);
+
+/// Record a phase that began with the startup timer and ends now.
+void recordStartupPhase(const char* name);
+
+/// The startup phases recorded, in the order they finished.
+std::vector<StartupPhase> getStartupPhases();
+
+/**
+ * @brief Startup actions and the actions each depends on.
+ *
+ * Each action runs once every action it depends on has finished, actions
+ * ready at the same time run concurrently on their own threads. An action
+ * that must run on the thread calling run, such as one that may request a
+ * shutdown, is marked as a main thread action.
+ *
+ * Each action runs as a startup phase, with its duration recorded.
+ */
+class StartupGraph : private boost::noncopyable {
+ public:
+  /**
+   * @brief Add an action, the name must be a string literal.
+   *
+   * The actions an action depends on must be added before it, so the graph
+   * has no cycles.
+   */
+  Status add(const char* name,
+             const std::vector<std::string>& depends,
+             std::function<void()> action,
+             bool main_thread = false);
+
+  /// Run the actions, returns once every action has finished.
+  void run();
+
+ private:
+  struct Action {
+    const char* name;
+
+    /// The indexes of the actions this action depends on.
+    std::vector<size_t> depends;
+
+    std::function<void()> action;
+    bool main_thread{false};
+  };
+
+  std::vector<Action> actions_;
+};
+}
@@ -26,6 +26,7 @@
 #include <WinSock2.h>
 #endif
 
+#include <chrono>
 #include <ctime>
 #include <sstream>
 
@@ -66,7 +67,28 @@ FLAG(string,
 
 FLAG(bool, utc, false, "Convert all UNIX times to UTC");
 
-std::string getHostname() {
+/// Seconds a looked up hostname is used before asking the system again.
+const size_t kHostnameCacheSeconds = 60;
+
+using HostIdentityClock = std::chrono::steady_clock;
+
+/// The process-wide host identity, see refreshHostIdentity.
+struct HostIdentity {
+  std::string hostname;
+  HostIdentityClock::time_point hostname_expires;
+
+  /// The persisted host UUID, empty until it is read or generated.
+  std::string uuid;
+
+  /// The identifier and the `--host_identifier` value it was chosen for.
+  std::string identifier;
+  std::string identifier_source;
+};
+
+static HostIdentity kHostIdentity;
+static Mutex kHostIdentityMutex;
+
+static std::string lookupHostname() {
 #ifdef WIN32
   long size = 256;
 #else
@@ -86,6 +108,26 @@ std::string getHostname() {
   return hostname_string;
 }
 
+std::string getHostname() {
+  auto now = HostIdentityClock::now();
+  {
+    WriteLock lock(kHostIdentityMutex);
+    if (!kHostIdentity.hostname.empty() &&
+        kHostIdentity.hostname_expires > now) {
+      return kHostIdentity.hostname;
+    }
+  }
+
+  // The lookup is not made under the lock, a resolver stall only holds back
+  // the callers that found the cached hostname expired.
+  auto hostname = lookupHostname();
+  WriteLock lock(kHostIdentityMutex);
+  kHostIdentity.hostname = hostname;
+  kHostIdentity.hostname_expires =
+      now + std::chrono::seconds(kHostnameCacheSeconds);
+  return hostname;
+}
+
 std::string generateNewUUID() {
   boost::uuids::uuid uuid = boost::uuids::random_generator()();
   return boost::uuids::to_string(uuid);
@@ -114,32 +156,60 @@ std::string generateHostUUID() {
 }
 
 Status getHostUUID(std::string& ident) {
+  WriteLock lock(kHostIdentityMutex);
+  if (!kHostIdentity.uuid.empty()) {
+    ident = kHostIdentity.uuid;
+    return Status(0, "OK");
+  }
+
   // Lookup the host identifier (UUID) previously generated and stored.
+  // The lock is held so concurrent first callers agree on a generated UUID.
+  ident.clear();
   auto status = getDatabaseValue(kPersistentSettings, "hostIdentifier", ident);
   if (ident.size() == 0) {
     // There was no UUID stored in the database, generate one and store it.
     ident = osquery::generateHostUUID();
     VLOG(1) << "Using UUID " << ident << " as host identifier";
-    return setDatabaseValue(kPersistentSettings, "hostIdentifier", ident);
+    status = setDatabaseValue(kPersistentSettings, "hostIdentifier", ident);
   }
 
+  // Only a UUID that was read or persisted is kept, a failed write is retried.
+  if (status.ok()) {
+    kHostIdentity.uuid = ident;
+  }
   return status;
 }
 
 std::string getHostIdentifier() {
-  if (FLAGS_host_identifier != "uuid") {
-    // use the hostname as the default machine identifier
-    return osquery::getHostname();
+  {
+    WriteLock lock(kHostIdentityMutex);
+    if (!kHostIdentity.identifier.empty() &&
+        kHostIdentity.identifier_source == FLAGS_host_identifier) {
+      return kHostIdentity.identifier;
+    }
   }
 
-  // Generate a identifier/UUID for this application launch, and persist.
-  static std::string ident;
-  if (ident.size() == 0) {
+  std::string source = FLAGS_host_identifier;
+  std::string ident;
+  if (source != "uuid") {
+    // use the hostname as the default machine identifier
+    ident = osquery::getHostname();
+  } else {
+    // Generate a identifier/UUID for this application launch, and persist.
     getHostUUID(ident);
   }
+
+  WriteLock lock(kHostIdentityMutex);
+  kHostIdentity.identifier = ident;
+  kHostIdentity.identifier_source = source;
   return ident;
 }
 
+void refreshHostIdentity() {
+  WriteLock lock(kHostIdentityMutex);
+  kHostIdentity = HostIdentity();
+}
+
 std::string getAsciiTime() {
   auto result = std::time(nullptr);
 
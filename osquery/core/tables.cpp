@@ -8,6 +8,14 @@
  *
  */
 
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <list>
+#include <unordered_map>
+
+#include <boost/noncopyable.hpp>
 #include <boost/property_tree/json_parser.hpp>
 
 #include <osquery/database.h>
@@ -15,14 +23,31 @@
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
+#include "osquery/core/conversions.h"
+
 namespace pt = boost::property_tree;
 
 namespace osquery {
 
 FLAG(bool, disable_caching, false, "Disable scheduled query caching");
 
-size_t TablePlugin::kCacheInterval = 0;
-size_t TablePlugin::kCacheStep = 0;
+FLAG(uint64,
+     table_cache_memory,
+     16 * 1024 * 1024,
+     "Maximum bytes of cached table results kept in memory");
+
+FLAG(bool,
+     table_cache_spill,
+     false,
+     "Persist cached table results evicted from memory to the database");
+
+FLAG(bool,
+     table_memoize,
+     true,
+     "Keep results of tables constant until reboot or a hardware change");
+
+thread_local size_t TablePlugin::kCacheInterval = 0;
+thread_local size_t TablePlugin::kCacheStep = 0;
 
 const std::map<ColumnType, std::string> kColumnTypeNames = {
     {UNKNOWN_TYPE, "UNKNOWN"},
@@ -70,6 +95,15 @@ void TablePlugin::setRequestFromContext(const QueryContext& context,
   }
   tree.add_child("constraints", constraints);
 
+  // The set of referenced columns is optional, absent means all are used.
+  if (context.colsUsed) {
+    pt::ptree colsUsed;
+    for (const auto& column : *context.colsUsed) {
+      colsUsed.push_back(std::make_pair("", pt::ptree(column)));
+    }
+    tree.add_child("colsUsed", colsUsed);
+  }
+
   // Write the property tree as a JSON string into the PluginRequest.
   std::ostringstream output;
   try {
@@ -102,6 +136,14 @@ void TablePlugin::setContextFromRequest(const PluginRequest& request,
     auto column_name = constraint.second.get<std::string>("name");
     context.constraints[column_name].unserialize(constraint.second);
   }
+
+  if (tree.count("colsUsed") > 0) {
+    UsedColumns colsUsed;
+    for (const auto& column : tree.get_child("colsUsed")) {
+      colsUsed.insert(column.second.data());
+    }
+    context.colsUsed = std::move(colsUsed);
+  }
 }
 
 Status TablePlugin::call(const PluginRequest& request,
@@ -122,7 +164,7 @@ Status TablePlugin::call(const PluginRequest& request,
     if (request.count("context") > 0) {
       setContextFromRequest(request, context);
     }
-    response = generate(context);
+    response = generateRows(context);
   } else if (request.at("action") == "columns") {
     // The "columns" action returns a PluginRequest filled with column
     // information such as name and type.
@@ -138,6 +180,30 @@ Status TablePlugin::call(const PluginRequest& request,
   return Status(0, "OK");
 }
 
+void TablePlugin::generateColumns(QueryContext& request, ColumnarData& results) {
+  results = ColumnarData::fromQueryData(columns(), generate(request));
+}
+
+QueryData TablePlugin::generateRows(QueryContext& request) {
+  if (usesColumnarData()) {
+    ColumnarData results(columns());
+    generateColumns(request, results);
+    return results.toQueryData();
+  }
+
+  if (usesGenerator()) {
+    QueryData results;
+    auto rows = generator(request);
+    Row r;
+    while (rows != nullptr && rows->next(r)) {
+      results.push_back(std::move(r));
+      r.clear();
+    }
+    return results;
+  }
+  return generate(request);
+}
+
 std::string TablePlugin::columnDefinition() const {
   return osquery::columnDefinition(columns());
 }
@@ -165,35 +231,225 @@ PluginResponse TablePlugin::routeInfo() const {
           {{"id", "columnAlias"}, {"name", alias}, {"target", target.first}});
     }
   }
+
+  // Planner hints are optional, the defaults do not need to be sent.
+  auto stats = statistics();
+  if (stats.rows > 0 || stats.cost != 1) {
+    response.push_back({{"id", "statistics"},
+                        {"rows", std::to_string(stats.rows)},
+                        {"cost", std::to_string(stats.cost)}});
+  }
   return response;
 }
 
+/**
+ * @brief In-process storage for cacheable table results.
+ *
+ * Results are kept in a compact binary encoding within a memory budget. The
+ * least recently used results are evicted first, and are optionally spilled
+ * to the database such that they may still be used within their interval.
+ */
+class TableCacheStore : private boost::noncopyable {
+ public:
+  static TableCacheStore& instance() {
+    static TableCacheStore store;
+    return store;
+  }
+
+  /// Check if results for a table are in memory or were spilled.
+  bool exists(const std::string& table) {
+    WriteLock lock(mutex_);
+    return (entries_.count(table) > 0 || spilled_.count(table) > 0);
+  }
+
+  /// Retrieve the encoded results for a table.
+  bool get(const std::string& table, std::string& content) {
+    WriteLock lock(mutex_);
+    auto entry = entries_.find(table);
+    if (entry != entries_.end()) {
+      // Mark the results as the most recently used.
+      lru_.splice(lru_.begin(), lru_, entry->second.second);
+      content = entry->second.first;
+      return true;
+    }
+
+    if (spilled_.count(table) == 0) {
+      return false;
+    }
+    std::string encoded;
+    if (!getDatabaseValue(kQueries, "cache." + table, encoded)) {
+      return false;
+    }
+    content = base64Decode(encoded);
+    return true;
+  }
+
+  /// Store encoded results, evicting other tables to remain within budget.
+  bool set(const std::string& table, std::string content) {
+    WriteLock lock(mutex_);
+    spilled_.erase(table);
+    erase(table);
+
+    size_t budget = FLAGS_table_cache_memory;
+    if (content.size() > budget) {
+      return spill(table, content);
+    }
+
+    while (size_ + content.size() > budget && !lru_.empty()) {
+      auto evicted = lru_.back();
+      spill(evicted, entries_.at(evicted).first);
+      erase(evicted);
+    }
+
+    size_ += content.size();
+    lru_.push_front(table);
+    entries_[table] = std::make_pair(std::move(content), lru_.begin());
+    return true;
+  }
+
+ private:
+  /// Remove a table's in-memory results, the lock must be held.
+  void erase(const std::string& table) {
+    auto entry = entries_.find(table);
+    if (entry != entries_.end()) {
+      size_ -= entry->second.first.size();
+      lru_.erase(entry->second.second);
+      entries_.erase(entry);
+    }
+  }
+
+  /// Optionally persist results evicted from memory.
+  bool spill(const std::string& table, const std::string& content) {
+    if (!FLAGS_table_cache_spill) {
+      return false;
+    }
+    // Database values must not contain NUL bytes.
+    if (!setDatabaseValue(kQueries, "cache." + table, base64Encode(content))) {
+      return false;
+    }
+    spilled_.insert(table);
+    return true;
+  }
+
+ private:
+  /// Encoded results, with a position in the least recently used order.
+  std::unordered_map<std::string,
+                     std::pair<std::string, std::list<std::string>::iterator>>
+      entries_;
+
+  /// Table names, most recently used first.
+  std::list<std::string> lru_;
+
+  /// Table names with results spilled to the database.
+  std::set<std::string> spilled_;
+
+  /// Total bytes of encoded results in memory.
+  size_t size_{0};
+
+  Mutex mutex_;
+};
+
 bool TablePlugin::isCached(size_t step) {
-  return (!FLAGS_disable_caching && step < last_cached_ + last_interval_);
+  return (!FLAGS_disable_caching && step < last_cached_ + last_interval_ &&
+          TableCacheStore::instance().exists(getName()));
 }
 
 QueryData TablePlugin::getCache() const {
   VLOG(1) << "Retrieving results from cache for table: " << getName();
-  // Lookup results from database and deserialize.
+  // Lookup results from the cache store and deserialize.
   std::string content;
-  getDatabaseValue(kQueries, "cache." + getName(), content);
   QueryData results;
-  deserializeQueryDataJSON(content, results);
+  if (TableCacheStore::instance().get(getName(), content)) {
+    deserializeQueryDataBinary(content, results);
+  }
   return results;
 }
 
 void TablePlugin::setCache(size_t step,
                            size_t interval,
                            const QueryData& results) {
-  // Serialize QueryData and save to database.
+  // Serialize QueryData and save to the cache store.
   std::string content;
-  if (!FLAGS_disable_caching && serializeQueryDataJSON(results, content)) {
+  if (!FLAGS_disable_caching && serializeQueryDataBinary(results, content) &&
+      TableCacheStore::instance().set(getName(), std::move(content))) {
     last_cached_ = step;
     last_interval_ = interval;
-    setDatabaseValue(kQueries, "cache." + getName(), content);
   }
 }
 
+/// Memoized table results, with the hardware generation they were built in.
+struct MemoizedResults {
+  size_t generation{0};
+  bool hardware{false};
+  QueryData rows;
+};
+
+static Mutex kMemoizedMutex;
+static std::unordered_map<std::string, MemoizedResults> kMemoized;
+
+/// Incremented for each hardware change.
+static std::atomic<size_t> kHardwareGeneration{0};
+
+/// The number of running publishers watching for hardware changes.
+static std::atomic<size_t> kHardwareWatchers{0};
+
+QueryData TablePlugin::memoize(
+    QueryContext& request,
+    bool hardware,
+    const std::function<QueryData(QueryContext&)>& generator) {
+  if (!FLAGS_table_memoize || (hardware && kHardwareWatchers == 0)) {
+    return generator(request);
+  }
+
+  {
+    WriteLock lock(kMemoizedMutex);
+    auto it = kMemoized.find(getName());
+    if (it != kMemoized.end() &&
+        (!hardware || it->second.generation == kHardwareGeneration)) {
+      return it->second.rows;
+    }
+  }
+
+  // A change while the results are generated leaves them out of date.
+  size_t generation = kHardwareGeneration;
+  QueryContext context;
+  auto results = generator(context);
+
+  WriteLock lock(kMemoizedMutex);
+  auto& memoized = kMemoized[getName()];
+  memoized.generation = generation;
+  memoized.hardware = hardware;
+  memoized.rows = results;
+  return results;
+}
+
+void TablePlugin::hardwareChanged() {
+  kHardwareGeneration++;
+
+  WriteLock lock(kMemoizedMutex);
+  for (auto it = kMemoized.begin(); it != kMemoized.end();) {
+    it = (it->second.hardware) ? kMemoized.erase(it) : std::next(it);
+  }
+}
+
+void TablePlugin::watchHardware(bool watching) {
+  if (watching) {
+    kHardwareWatchers++;
+  } else if (kHardwareWatchers > 0) {
+    kHardwareWatchers--;
+    // Changes are not noticed until a publisher watches again.
+    hardwareChanged();
+  }
+}
+
+size_t TablePlugin::hardwareGeneration() {
+  return kHardwareGeneration;
+}
+
+bool TablePlugin::watchingHardware() {
+  return kHardwareWatchers > 0;
+}
+
 std::string columnDefinition(const TableColumns& columns) {
   std::map<std::string, bool> epilog;
   std::string statement = "(";
@@ -264,6 +520,340 @@ ColumnType columnTypeName(const std::string& type) {
   return UNKNOWN_TYPE;
 }
 
+ColumnarData::ColumnarData(const TableColumns& columns)
+    : names_(std::make_shared<std::vector<std::string>>()) {
+  names_->reserve(columns.size());
+  columns_.resize(columns.size());
+  for (size_t i = 0; i < columns.size(); i++) {
+    names_->push_back(std::get<0>(columns[i]));
+    columns_[i].type = std::get<1>(columns[i]);
+  }
+}
+
+ColumnarData ColumnarData::fromQueryData(const TableColumns& columns,
+                                         const QueryData& qd) {
+  ColumnarData results(columns);
+  results.reserve(qd.size());
+  for (const auto& row : qd) {
+    auto r = results.addRow();
+    for (size_t i = 0; i < results.columns(); i++) {
+      auto cell = row.find(results.name(i));
+      if (cell != row.end()) {
+        results.setText(r, i, cell->second);
+      }
+    }
+  }
+  return results;
+}
+
+QueryData ColumnarData::toQueryData() const {
+  QueryData qd(rows_);
+  for (auto& row : qd) {
+    row.reserve(columns_.size());
+  }
+  for (size_t i = 0; i < columns_.size(); i++) {
+    for (size_t r = 0; r < rows_; r++) {
+      if (!isNull(r, i)) {
+        qd[r][name(i)] = getString(r, i);
+      }
+    }
+  }
+  return qd;
+}
+
+size_t ColumnarData::addRow() {
+  for (auto& column : columns_) {
+    if (isIntegerType(column.type)) {
+      column.integers.push_back(0);
+    } else if (column.type == DOUBLE_TYPE) {
+      column.doubles.push_back(0);
+    } else {
+      column.texts.emplace_back();
+    }
+    column.nulls.push_back(true);
+  }
+  return rows_++;
+}
+
+void ColumnarData::reserve(size_t rows) {
+  for (auto& column : columns_) {
+    if (isIntegerType(column.type)) {
+      column.integers.reserve(rows);
+    } else if (column.type == DOUBLE_TYPE) {
+      column.doubles.reserve(rows);
+    } else {
+      column.texts.reserve(rows);
+    }
+    column.nulls.reserve(rows);
+  }
+}
+
+size_t ColumnarData::column(const std::string& name) const {
+  for (size_t i = 0; i < names_->size(); i++) {
+    if ((*names_)[i] == name) {
+      return i;
+    }
+  }
+  return names_->size();
+}
+
+void ColumnarData::setInteger(size_t row, size_t column, long long value) {
+  auto& c = columns_[column];
+  if (isIntegerType(c.type)) {
+    c.integers[row] = value;
+  } else if (c.type == DOUBLE_TYPE) {
+    c.doubles[row] = static_cast<double>(value);
+  } else {
+    c.texts[row] = std::to_string(value);
+  }
+  c.nulls[row] = false;
+}
+
+void ColumnarData::setDouble(size_t row, size_t column, double value) {
+  auto& c = columns_[column];
+  if (isIntegerType(c.type)) {
+    c.integers[row] = static_cast<long long>(value);
+  } else if (c.type == DOUBLE_TYPE) {
+    c.doubles[row] = value;
+  } else {
+    c.texts[row] = DOUBLE(value);
+  }
+  c.nulls[row] = false;
+}
+
+void ColumnarData::setText(size_t row, size_t column, std::string value) {
+  auto& c = columns_[column];
+  if (isIntegerType(c.type)) {
+    long long afinite;
+    if (!safeStrtoll(value, 10, afinite)) {
+      // Keep the legacy behavior, uncastable values are NULL.
+      return;
+    }
+    c.integers[row] = afinite;
+  } else if (c.type == DOUBLE_TYPE) {
+    char* end = nullptr;
+    double afinite = strtod(value.c_str(), &end);
+    if (end == nullptr || end == value.c_str() || *end != '\0') {
+      return;
+    }
+    c.doubles[row] = afinite;
+  } else {
+    c.texts[row] = std::move(value);
+  }
+  c.nulls[row] = false;
+}
+
+std::string ColumnarData::getString(size_t row, size_t column) const {
+  if (isNull(row, column)) {
+    return SQL_NULL_RESULT;
+  }
+
+  const auto& c = columns_[column];
+  if (isIntegerType(c.type)) {
+    return std::to_string(c.integers[row]);
+  } else if (c.type == DOUBLE_TYPE) {
+    return DOUBLE(c.doubles[row]);
+  }
+  return c.texts[row];
+}
+
+/// The literal prefix of a LIKE or GLOB pattern, before any wildcard.
+static std::string patternPrefix(const std::string& pattern, bool like) {
+  auto wildcards = (like) ? "%_" : "*?[";
+  return pattern.substr(0, pattern.find_first_of(wildcards));
+}
+
+/// Lowercase ASCII characters, LIKE ignores the case of only these.
+static std::string asciiLower(const std::string& value) {
+  auto lower = value;
+  for (auto& c : lower) {
+    if (c >= 'A' && c <= 'Z') {
+      c = c - 'A' + 'a';
+    }
+  }
+  return lower;
+}
+
+/// Parse an integer constraint expression as the column's integer type.
+static bool parseInteger(const std::string& expr,
+                         bool is_unsigned,
+                         long long& value) {
+  if (!is_unsigned) {
+    return safeStrtoll(expr, 10, value).ok();
+  }
+
+  if (expr.empty() || expr[0] == '-') {
+    return false;
+  }
+  char* end{nullptr};
+  errno = 0;
+  auto uvalue = strtoull(expr.c_str(), &end, 10);
+  if (end == expr.c_str() || *end != '\0' || errno == ERANGE) {
+    return false;
+  }
+  value = static_cast<long long>(uvalue);
+  return true;
+}
+
+ConstraintView::ConstraintView(
+    const std::vector<struct Constraint>& constraints, ColumnType affinity) {
+  integer_ = (affinity == INTEGER_TYPE || affinity == BIGINT_TYPE ||
+              affinity == UNSIGNED_BIGINT_TYPE);
+  unsigned_ = (affinity == UNSIGNED_BIGINT_TYPE);
+  if (!integer_ && affinity != TEXT_TYPE) {
+    // Other affinities are not compared, every value may match.
+    return;
+  }
+
+  // An unparsable EQUALS value may match anything.
+  bool any_equals = false;
+  for (const auto& constraint : constraints) {
+    if (constraint.op == LIKE || constraint.op == GLOB) {
+      auto prefix = patternPrefix(constraint.expr, constraint.op == LIKE);
+      if (!integer_ && !prefix.empty()) {
+        bool ignore_case = (constraint.op == LIKE);
+        prefixes_.push_back(
+            std::make_pair((ignore_case) ? asciiLower(prefix) : prefix,
+                           ignore_case));
+      }
+      continue;
+    }
+
+    if (!integer_) {
+      if (constraint.op == EQUALS) {
+        equals_ = true;
+        texts_.insert(constraint.expr);
+      } else {
+        addRange(constraint.op, constraint.expr);
+      }
+      continue;
+    }
+
+    long long value = 0;
+    if (!parseInteger(constraint.expr, unsigned_, value)) {
+      any_equals = any_equals || (constraint.op == EQUALS);
+      continue;
+    }
+    if (constraint.op == EQUALS) {
+      equals_ = true;
+      integers_.insert(value);
+    } else {
+      addRange(constraint.op, ordered(value));
+    }
+  }
+
+  if (any_equals) {
+    equals_ = false;
+  }
+}
+
+long long ConstraintView::ordered(long long value) const {
+  // Flipping the sign bit orders unsigned values as signed integers.
+  if (unsigned_) {
+    return static_cast<long long>(static_cast<unsigned long long>(value) ^
+                                  (1ULL << 63));
+  }
+  return value;
+}
+
+void ConstraintView::addRange(unsigned char op, long long value) {
+  if (op == GREATER_THAN || op == GREATER_THAN_OR_EQUALS) {
+    if (op == GREATER_THAN) {
+      if (value == LLONG_MAX) {
+        none_ = true;
+        return;
+      }
+      value++;
+    }
+    min_ = (lower_) ? std::max(min_, value) : value;
+    lower_ = true;
+  } else if (op == LESS_THAN || op == LESS_THAN_OR_EQUALS) {
+    if (op == LESS_THAN) {
+      if (value == LLONG_MIN) {
+        none_ = true;
+        return;
+      }
+      value--;
+    }
+    max_ = (upper_) ? std::min(max_, value) : value;
+    upper_ = true;
+  } else {
+    // Other operators are not evaluated.
+    return;
+  }
+  none_ = none_ || (lower_ && upper_ && min_ > max_);
+}
+
+void ConstraintView::addRange(unsigned char op, const std::string& value) {
+  if (op == GREATER_THAN || op == GREATER_THAN_OR_EQUALS) {
+    bool inclusive = (op == GREATER_THAN_OR_EQUALS);
+    if (!lower_ || value > text_min_ ||
+        (value == text_min_ && !inclusive)) {
+      text_min_ = value;
+      text_min_inclusive_ = inclusive;
+    }
+    lower_ = true;
+  } else if (op == LESS_THAN || op == LESS_THAN_OR_EQUALS) {
+    bool inclusive = (op == LESS_THAN_OR_EQUALS);
+    if (!upper_ || value < text_max_ ||
+        (value == text_max_ && !inclusive)) {
+      text_max_ = value;
+      text_max_inclusive_ = inclusive;
+    }
+    upper_ = true;
+  }
+}
+
+bool ConstraintView::matches(long long value) const {
+  if (!integer_) {
+    return matches(std::to_string(value));
+  }
+  if (none_) {
+    return false;
+  }
+  if (equals_ && integers_.count(value) == 0) {
+    return false;
+  }
+  auto key = ordered(value);
+  return (!lower_ || key >= min_) && (!upper_ || key <= max_);
+}
+
+bool ConstraintView::matches(const std::string& value) const {
+  if (integer_) {
+    long long parsed = 0;
+    if (!parseInteger(value, unsigned_, parsed)) {
+      // The value cannot be compared as an integer.
+      return !none_;
+    }
+    return matches(parsed);
+  }
+
+  if (none_) {
+    return false;
+  }
+  if (equals_ && texts_.count(value) == 0) {
+    return false;
+  }
+  if (lower_ && (value < text_min_ ||
+                 (value == text_min_ && !text_min_inclusive_))) {
+    return false;
+  }
+  if (upper_ && (value > text_max_ ||
+                 (value == text_max_ && !text_max_inclusive_))) {
+    return false;
+  }
+  for (const auto& prefix : prefixes_) {
+    if (value.size() < prefix.first.size()) {
+      return false;
+    }
+    auto head = value.substr(0, prefix.first.size());
+    if (((prefix.second) ? asciiLower(head) : head) != prefix.first) {
+      return false;
+    }
+  }
+  return true;
+}
+
 bool ConstraintList::exists(const ConstraintOperatorFlag ops) const {
   if (ops == ANY_OP) {
     return (constraints_.size() > 0);
@@ -278,49 +868,19 @@ bool ConstraintList::exists(const ConstraintOperatorFlag ops) const {
 }
 
 bool ConstraintList::matches(const std::string& expr) const {
-  // Support each SQL affinity type casting.
-  if (affinity == TEXT_TYPE) {
-    return literal_matches<TEXT_LITERAL>(expr);
-  } else if (affinity == INTEGER_TYPE) {
-    INTEGER_LITERAL lexpr = AS_LITERAL(INTEGER_LITERAL, expr);
-    return literal_matches<INTEGER_LITERAL>(lexpr);
-  } else if (affinity == BIGINT_TYPE) {
-    BIGINT_LITERAL lexpr = AS_LITERAL(BIGINT_LITERAL, expr);
-    return literal_matches<BIGINT_LITERAL>(lexpr);
-  } else if (affinity == UNSIGNED_BIGINT_TYPE) {
-    UNSIGNED_BIGINT_LITERAL lexpr = AS_LITERAL(UNSIGNED_BIGINT_LITERAL, expr);
-    return literal_matches<UNSIGNED_BIGINT_LITERAL>(lexpr);
-  } else {
-    // Unsupported affinity type.
-    return false;
+  if (constraints_.empty()) {
+    return true;
   }
+  return view().matches(expr);
 }
 
-template <typename T>
-bool ConstraintList::literal_matches(const T& base_expr) const {
-  bool aggregate = true;
-  for (size_t i = 0; i < constraints_.size(); ++i) {
-    T constraint_expr = AS_LITERAL(T, constraints_[i].expr);
-    if (constraints_[i].op == EQUALS) {
-      aggregate = aggregate && (base_expr == constraint_expr);
-    } else if (constraints_[i].op == GREATER_THAN) {
-      aggregate = aggregate && (base_expr > constraint_expr);
-    } else if (constraints_[i].op == LESS_THAN) {
-      aggregate = aggregate && (base_expr < constraint_expr);
-    } else if (constraints_[i].op == GREATER_THAN_OR_EQUALS) {
-      aggregate = aggregate && (base_expr >= constraint_expr);
-    } else if (constraints_[i].op == LESS_THAN_OR_EQUALS) {
-      aggregate = aggregate && (base_expr <= constraint_expr);
-    } else {
-      // Unsupported constraint.
-      return false;
-    }
-    if (!aggregate) {
-      // Speed up comparison.
-      return false;
-    }
+const ConstraintView& ConstraintList::view() const {
+  if (view_size_ != constraints_.size() || view_affinity_ != affinity) {
+    view_ = ConstraintView(constraints_, affinity);
+    view_size_ = constraints_.size();
+    view_affinity_ = affinity;
   }
-  return true;
+  return view_;
 }
 
 std::set<std::string> ConstraintList::getAll(ConstraintOperator op) const {
@@ -379,4 +939,18 @@ Status QueryContext::expandConstraints(
   }
   return Status(0);
 }
+
+bool QueryContext::isColumnUsed(const std::string& column) const {
+  return !colsUsed || colsUsed->count(column) > 0;
+}
+
+bool QueryContext::isAnyColumnUsed(
+    std::initializer_list<std::string> columns) const {
+  for (const auto& column : columns) {
+    if (isColumnUsed(column)) {
+      return true;
+    }
+  }
+  return false;
+}
 }
@@ -0,0 +1,80 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "osquery/core/allocations.h"
+
+namespace osquery {
+
+class AllocationsTests : public testing::Test {};
+
+TEST_F(AllocationsTests, test_allocation_scope) {
+  // Test binaries may also be built with the allocation hooks.
+  AllocationScope outer;
+  recordAllocation(100);
+  {
+    AllocationScope inner;
+    recordAllocation(50);
+    recordFree(50);
+    recordAllocation(10);
+    EXPECT_GE(inner.allocations(), 2U);
+    EXPECT_GE(inner.bytes(), 60U);
+    EXPECT_GE(inner.peakBytes(), 50U);
+    recordFree(10);
+  }
+  recordFree(100);
+
+  // The inner scope's peak is kept by the outer scope.
+  EXPECT_GE(outer.allocations(), 3U);
+  EXPECT_GE(outer.bytes(), 160U);
+  EXPECT_GE(outer.peakBytes(), 150U);
+}
+
+TEST_F(AllocationsTests, test_allocation_scope_peak) {
+  recordAllocation(1000);
+  recordFree(1000);
+
+  // A scope's peak does not include earlier allocations.
+  AllocationScope scope;
+  recordAllocation(10);
+  recordFree(10);
+  EXPECT_GE(scope.peakBytes(), 10U);
+  EXPECT_LT(scope.peakBytes(), 1000U);
+}
+
+TEST_F(AllocationsTests, test_release_free_heap) {
+  HeapStatistics before;
+  if (!getHeapStatistics(before)) {
+    // The platform's allocator does not report its size.
+    return;
+  }
+
+  // Free many small allocations, leaving free memory within the heap.
+  {
+    std::vector<std::string> lines;
+    for (size_t i = 0; i < 10000; i++) {
+      lines.push_back(std::string(200, 'a'));
+    }
+  }
+
+  HeapStatistics freed;
+  ASSERT_TRUE(getHeapStatistics(freed));
+  EXPECT_GT(freed.free, 0U);
+
+  releaseFreeHeap();
+  HeapStatistics after;
+  ASSERT_TRUE(getHeapStatistics(after));
+  EXPECT_LE(after.free, freed.free);
+}
+}
@@ -69,6 +69,33 @@ TEST_F(ConversionsTests, test_base64) {
   EXPECT_EQ(unencoded, unencoded2);
 }
 
+TEST_F(ConversionsTests, test_base64_blocks) {
+  EXPECT_EQ(base64Encode("f"), "Zg==");
+  EXPECT_EQ(base64Encode("fo"), "Zm8=");
+  EXPECT_EQ(base64Encode("foo"), "Zm9v");
+  EXPECT_EQ(base64Decode("Zm9vYg=="), "foob");
+  EXPECT_EQ(base64Decode("Zm9v\r\nYmE="), "fooba");
+
+  // Every byte value, across both the vectorized blocks and the remainder.
+  std::string content;
+  for (size_t i = 0; i < 1024 + 7; i++) {
+    content += static_cast<char>(i * 7);
+  }
+  for (size_t size = 0; size < content.size(); size += 13) {
+    auto unencoded = content.substr(0, size);
+    auto encoded = base64Encode(unencoded);
+    EXPECT_EQ(encoded.size(), (size + 2) / 3 * 4);
+    EXPECT_TRUE(isPrintable(encoded));
+    EXPECT_EQ(base64Decode(encoded), unencoded);
+  }
+
+  // Any invalid character, within a block or the remainder, decodes nothing.
+  auto encoded = base64Encode(content);
+  EXPECT_EQ(base64Decode(encoded.substr(0, 20) + "*" + encoded.substr(21)),
+            "");
+  EXPECT_EQ(base64Decode(encoded.substr(0, encoded.size() - 2) + "!="), "");
+}
+
 TEST_F(ConversionsTests, test_ascii_true) {
   std::string unencoded = "HELLO";
   auto result = isPrintable(unencoded);
@@ -79,6 +106,17 @@ TEST_F(ConversionsTests, test_ascii_false) {
   std::string unencoded = "こんにちは";
   auto result = isPrintable(unencoded);
   EXPECT_FALSE(result);
+
+  // A single non-printable byte at any position of a long string.
+  std::string printable(67, 'a');
+  EXPECT_TRUE(isPrintable(printable));
+  for (size_t i = 0; i < printable.size(); i++) {
+    for (const auto& c : {'\x1F', '\x7F', '\x80', '\xFF'}) {
+      auto check = printable;
+      check[i] = c;
+      EXPECT_FALSE(isPrintable(check));
+    }
+  }
 }
 
 TEST_F(ConversionsTests, test_unicode_unescape) {
@@ -101,6 +139,38 @@ TEST_F(ConversionsTests, test_split) {
   }
 }
 
+TEST_F(ConversionsTests, test_tokenize) {
+  std::vector<boost::string_ref> tokens;
+  for (const auto& i : generateSplitStringTestData()) {
+    tokenize(i.test_string, "\t ", tokens);
+    EXPECT_EQ(tokens.size(), i.test_vector.size());
+    EXPECT_EQ(join(tokens, ","), join(i.test_vector, ","));
+  }
+
+  // Tokens are trimmed and empty tokens are skipped, as with split.
+  std::vector<std::string> content = {
+      "", ",,", " a , b,,c ", "a:b,c", "\n\nline one\n  \nline two",
+  };
+  for (const auto& text : content) {
+    for (const auto& delims : {",", ":,", "\n"}) {
+      tokenize(text, delims, tokens);
+      EXPECT_EQ(join(tokens, "|"), join(split(text, delims), "|"));
+    }
+  }
+
+  // The tokens are views of the text.
+  std::string line = "tcp 6 TCP";
+  Tokenizer tokenizer(line);
+  boost::string_ref token;
+  ASSERT_TRUE(tokenizer.next(token));
+  EXPECT_EQ(token.data(), line.data());
+  ASSERT_TRUE(tokenizer.next(token));
+  EXPECT_EQ(token, "6");
+  ASSERT_TRUE(tokenizer.next(token));
+  EXPECT_EQ(token, "TCP");
+  EXPECT_FALSE(tokenizer.next(token));
+}
+
 TEST_F(ConversionsTests, test_join) {
   std::vector<std::string> content = {
       "one", "two", "three",
@@ -115,4 +185,20 @@ TEST_F(ConversionsTests, test_split_occurences) {
   };
   EXPECT_EQ(split(content, ":", 1), expected);
 }
+
+TEST_F(ConversionsTests, test_like_matches) {
+  EXPECT_TRUE(likeMatches("%libssl%", "/usr/lib/libssl.so.1.0.0"));
+  EXPECT_TRUE(likeMatches("%LIBSSL%", "/usr/lib/libssl.so"));
+  EXPECT_FALSE(likeMatches("%libssl", "/usr/lib/libssl.so"));
+  EXPECT_TRUE(likeMatches("/usr/%/lib_sl.so", "/usr/a/b/libssl.so"));
+  EXPECT_TRUE(likeMatches("%a%b%c", "xxaybzzc"));
+  EXPECT_FALSE(likeMatches("%a%b%c", "xxaybzz"));
+
+  // An empty value only matches wildcards that may be empty.
+  EXPECT_TRUE(likeMatches("%", ""));
+  EXPECT_FALSE(likeMatches("_", ""));
+
+  // A '_' matches a multi-byte character.
+  EXPECT_TRUE(likeMatches("a_c", "a\xc3\xa9" "c"));
+}
 }
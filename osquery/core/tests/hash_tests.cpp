@@ -10,6 +10,8 @@
 
 #include <gtest/gtest.h>
 
+#include <osquery/database.h>
+#include <osquery/filesystem.h>
 #include <osquery/hash.h>
 
 #include "osquery/tests/test_util.h"
@@ -46,4 +48,52 @@ TEST_F(HashTests, test_file_hashing) {
   auto digest = hashFromFile(HASH_TYPE_MD5, kTestDataPath + "test_hashing.bin");
   EXPECT_EQ(digest, "88ee11f2aa7903f34b8b8785d92208b1");
 }
+
+TEST_F(HashTests, test_multi_file_hashing) {
+  // Large files update each digest in parallel.
+  std::string content(3 * 1024 * 1024 + 7, '\0');
+  for (size_t i = 0; i < content.size(); i++) {
+    content[i] = static_cast<char>(i % 251);
+  }
+  auto path = kTestWorkingDirectory + "test_multi_hashing.bin";
+  ASSERT_TRUE(writeTextFile(path, content).ok());
+
+  auto mask = HASH_TYPE_MD5 | HASH_TYPE_SHA1 | HASH_TYPE_SHA256;
+  auto hashes = hashMultiFromFile(mask, path);
+  EXPECT_EQ(hashes.mask, mask);
+  EXPECT_EQ(hashes.md5,
+            hashFromBuffer(HASH_TYPE_MD5, content.data(), content.size()));
+  EXPECT_EQ(hashes.sha1,
+            hashFromBuffer(HASH_TYPE_SHA1, content.data(), content.size()));
+  EXPECT_EQ(hashes.sha256,
+            hashFromBuffer(HASH_TYPE_SHA256, content.data(), content.size()));
+
+  // Digests that are not requested are empty.
+  hashes = hashMultiFromFile(HASH_TYPE_SHA1, path);
+  EXPECT_TRUE(hashes.md5.empty());
+  EXPECT_FALSE(hashes.sha1.empty());
+  EXPECT_TRUE(hashes.sha256.empty());
+  osquery::remove(path);
+}
+
+TEST_F(HashTests, test_hash_cache) {
+  auto path = kTestWorkingDirectory + "test_hash_cache.txt";
+  ASSERT_TRUE(writeTextFile(path, "cached").ok());
+  auto expected = hashFromBuffer(HASH_TYPE_SHA256, "cached", 6);
+
+  // The first hash of a file stores the digests in the cache.
+  auto hashes = hashMultiFromFile(HASH_TYPE_SHA256, path);
+  EXPECT_EQ(hashes.sha256, expected);
+  std::vector<std::string> keys;
+  scanDatabaseKeys(kHashes, keys);
+  EXPECT_FALSE(keys.empty());
+
+  // Changed content, of the same size, is hashed again.
+  ASSERT_TRUE(writeTextFile(path, "change").ok());
+  hashes = hashMultiFromFile(HASH_TYPE_SHA256 | HASH_TYPE_MD5, path);
+  EXPECT_EQ(hashes.sha256, hashFromBuffer(HASH_TYPE_SHA256, "change", 6));
+  EXPECT_EQ(hashes.md5, hashFromBuffer(HASH_TYPE_MD5, "change", 6));
+  EXPECT_TRUE(hashes.sha1.empty());
+  osquery::remove(path);
+}
 }
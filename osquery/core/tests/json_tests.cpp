@@ -0,0 +1,133 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <sstream>
+
+#include <gtest/gtest.h>
+
+#include <boost/property_tree/json_parser.hpp>
+
+#include "osquery/core/json.h"
+
+namespace pt = boost::property_tree;
+
+namespace osquery {
+
+class JSONTests : public testing::Test {};
+
+TEST_F(JSONTests, test_writer) {
+  std::string json;
+  JSONWriter writer(json);
+  writer.startObject();
+  writer.member("a", "1");
+  writer.key("b");
+  writer.startArray();
+  writer.value("2");
+  writer.startObject();
+  writer.endObject();
+  writer.endArray();
+  writer.member("c", "");
+  writer.endObject();
+  writer.finish();
+  EXPECT_EQ(json, "{\"a\":\"1\",\"b\":[\"2\",{}],\"c\":\"\"}\n");
+}
+
+TEST_F(JSONTests, test_escape) {
+  // Every character is escaped as the property tree writer escapes it.
+  std::string input;
+  for (size_t c = 1; c < 256; c++) {
+    input += static_cast<char>(c);
+  }
+  input += "\"quoted\" C:\\path /usr/bin";
+
+  pt::ptree tree;
+  tree.put(pt::ptree::path_type("key\t\"", '\0'), input);
+  std::ostringstream output;
+  pt::write_json(output, tree, false);
+
+  std::string json;
+  JSONWriter writer(json);
+  writer.startObject();
+  writer.member("key\t\"", input);
+  writer.endObject();
+  writer.finish();
+  EXPECT_EQ(json, output.str());
+}
+
+/// Record the parse events as a compact string.
+class RecordingJSONHandler : public JSONHandler {
+ public:
+  void key(std::string& name) override { events += "k:" + name + ","; }
+  void value(std::string& value) override { events += "v:" + value + ","; }
+  void startObject() override { events += "{"; }
+  void endObject() override { events += "}"; }
+  void startArray() override { events += "["; }
+  void endArray() override { events += "]"; }
+
+  std::string events;
+};
+
+TEST_F(JSONTests, test_parse) {
+  RecordingJSONHandler handler;
+  auto status = parseJSON(
+      " {\"a\": [1, -2.5e+3, true, null], \"b\" : {}, \"\": \"x\"} ", handler);
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(handler.events,
+            "{k:a,[v:1,v:-2.5e+3,v:true,v:null,]k:b,{}k:,v:x,}");
+
+  // Escapes are decoded, including surrogate pairs.
+  handler.events.clear();
+  status = parseJSON("[\"\\\"\\/\\n\\u00e9\\ud83d\\ude00\"]", handler);
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(handler.events, "[v:\"/\n\xC3\xA9\xF0\x9F\x98\x80,]");
+}
+
+TEST_F(JSONTests, test_parse_errors) {
+  std::vector<std::string> invalid = {
+      "",
+      "{",
+      "{\"a\"}",
+      "{\"a\":1,}",
+      "[1 2]",
+      "[01]",
+      "[1.]",
+      "[\"\\x\"]",
+      "[\"\\ud83d\"]",
+      "[\"unterminated]",
+      "[\"\t\"]",
+      "[tru]",
+      "{} {}",
+      std::string(kJSONMaxDepth + 1, '['),
+  };
+
+  for (const auto& json : invalid) {
+    RecordingJSONHandler handler;
+    EXPECT_FALSE(parseJSON(json, handler).ok()) << json;
+  }
+}
+
+TEST_F(JSONTests, test_round_trip) {
+  std::string input;
+  for (size_t c = 1; c < 256; c++) {
+    input += static_cast<char>(c);
+  }
+
+  std::string json;
+  JSONWriter writer(json);
+  writer.startArray();
+  writer.value(input);
+  writer.endArray();
+  writer.finish();
+
+  RecordingJSONHandler handler;
+  EXPECT_TRUE(parseJSON(json, handler).ok());
+  EXPECT_EQ(handler.events, "[v:" + input + ",]");
+}
+}
@@ -0,0 +1,81 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <atomic>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include <osquery/core.h>
+
+#include "osquery/core/startup.h"
+
+namespace osquery {
+
+class StartupTests : public testing::Test {};
+
+TEST_F(StartupTests, test_startup_graph_order) {
+  std::vector<std::string> order;
+  Mutex order_mutex;
+  auto append = [&order, &order_mutex](const std::string& name) {
+    WriteLock lock(order_mutex);
+    order.push_back(name);
+  };
+
+  StartupGraph graph;
+  EXPECT_TRUE(graph.add("test_a", {}, [&]() { append("a"); }, true).ok());
+  EXPECT_TRUE(graph.add("test_b", {"test_a"}, [&]() { append("b"); }).ok());
+  EXPECT_TRUE(
+      graph.add("test_c", {"test_a"}, [&]() { append("c"); }, true).ok());
+  EXPECT_TRUE(
+      graph.add("test_d", {"test_b", "test_c"}, [&]() { append("d"); }).ok());
+
+  // Dependencies must be added first.
+  EXPECT_FALSE(graph.add("test_e", {"test_f"}, []() {}).ok());
+  graph.run();
+
+  ASSERT_EQ(order.size(), 4U);
+  EXPECT_EQ(order.front(), "a");
+  EXPECT_EQ(order.back(), "d");
+}
+
+TEST_F(StartupTests, test_startup_graph_concurrent) {
+  // Both actions wait for the other to start, so they must run together.
+  std::atomic<size_t> running{0};
+  auto action = [&running]() {
+    running++;
+    for (size_t i = 0; i < 1000 && running < 2; i++) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  };
+
+  std::thread::id main_id;
+  StartupGraph graph;
+  graph.add("test_first", {}, action);
+  graph.add("test_second", {}, action, true);
+  graph.add("test_main",
+            {"test_first", "test_second"},
+            [&main_id]() { main_id = std::this_thread::get_id(); },
+            true);
+  graph.run();
+  EXPECT_EQ(running, 2U);
+  EXPECT_EQ(main_id, std::this_thread::get_id());
+
+  // Each action is recorded as a startup phase.
+  size_t recorded = 0;
+  for (const auto& phase : getStartupPhases()) {
+    if (phase.name == "test_first" || phase.name == "test_second") {
+      recorded++;
+      EXPECT_GE(phase.duration, 0U);
+    }
+  }
+  EXPECT_EQ(recorded, 2U);
+}
+}
@@ -10,10 +10,13 @@
 
 #include <gtest/gtest.h>
 
+#include <osquery/flags.h>
 #include <osquery/tables.h>
 
 namespace osquery {
 
+DECLARE_uint64(table_cache_memory);
+
 class TablesTests : public testing::Test {};
 
 TEST_F(TablesTests, test_constraint) {
@@ -106,6 +109,63 @@ TEST_F(TablesTests, test_constraint_matching) {
   EXPECT_TRUE(cl3.matches(1));
 }
 
+TEST_F(TablesTests, test_constraint_view) {
+  // Values of an IN operator match any of the values.
+  ConstraintList pids;
+  pids.affinity = INTEGER_TYPE;
+  pids.add(Constraint(EQUALS, "1"));
+  pids.add(Constraint(EQUALS, "3"));
+  const auto& view = pids.view();
+  EXPECT_FALSE(view.empty());
+  EXPECT_EQ(view.integers().size(), 2U);
+  EXPECT_TRUE(view.matches(1));
+  EXPECT_TRUE(view.matches("3"));
+  EXPECT_FALSE(view.matches(2));
+  EXPECT_TRUE(pids.matches(3));
+
+  // A range is inclusive of its bounds and may be empty.
+  ConstraintList ranges;
+  ranges.affinity = BIGINT_TYPE;
+  ranges.add(Constraint(GREATER_THAN, "-5"));
+  ranges.add(Constraint(LESS_THAN_OR_EQUALS, "5"));
+  EXPECT_FALSE(ranges.view().matches(-5));
+  EXPECT_TRUE(ranges.view().matches(-4));
+  EXPECT_TRUE(ranges.view().matches(5));
+  EXPECT_FALSE(ranges.view().matches(6));
+  ranges.add(Constraint(GREATER_THAN, "10"));
+  EXPECT_FALSE(ranges.view().matches(5));
+  EXPECT_FALSE(ranges.view().matches(11));
+
+  // Unsigned values are ordered above the signed maximum.
+  ConstraintList sizes;
+  sizes.affinity = UNSIGNED_BIGINT_TYPE;
+  sizes.add(Constraint(GREATER_THAN, "9223372036854775807"));
+  EXPECT_TRUE(sizes.matches("18446744073709551615"));
+  EXPECT_FALSE(sizes.matches("1"));
+
+  // Only the literal prefix of a LIKE pattern is checked, ignoring case.
+  ConstraintList paths;
+  paths.add(Constraint(LIKE, "/Usr/%/bin"));
+  EXPECT_TRUE(paths.matches("/usr/local/bin"));
+  EXPECT_TRUE(paths.matches("/usr/local/sbin"));
+  EXPECT_FALSE(paths.matches("/opt/bin"));
+  EXPECT_TRUE(paths.view().texts().empty());
+
+  // Constraints that cannot be evaluated match every value.
+  ConstraintList unparsable;
+  unparsable.affinity = INTEGER_TYPE;
+  unparsable.add(Constraint(EQUALS, "one"));
+  unparsable.add(Constraint(EQUALS, "2"));
+  EXPECT_TRUE(unparsable.matches(1));
+  EXPECT_TRUE(unparsable.matches("not_an_integer"));
+
+  ConstraintList doubles;
+  doubles.affinity = DOUBLE_TYPE;
+  doubles.add(Constraint(GREATER_THAN, "1.5"));
+  EXPECT_TRUE(doubles.view().empty());
+  EXPECT_TRUE(doubles.matches("1.0"));
+}
+
 TEST_F(TablesTests, test_constraint_map) {
   ConstraintMap cm;
 
@@ -136,9 +196,42 @@ class TestTablePlugin : public TablePlugin {
     setCache(step, interval, r);
   }
 
+  void testSetCache(size_t step, size_t interval, const QueryData& r) {
+    setCache(step, interval, r);
+  }
+
   bool testIsCached(size_t interval) { return isCached(interval); }
+
+  QueryData testGetCache() const { return getCache(); }
+
+  QueryData testMemoize(QueryContext& request, bool hardware) {
+    return memoize(request, hardware, [this](QueryContext& context) {
+      generated++;
+      // Memoized results are generated without constraints.
+      EXPECT_EQ(context.constraints.size(), 0U);
+      return QueryData({{{"generated", std::to_string(generated)}}});
+    });
+  }
+
+  size_t generated{0};
 };
 
+TEST_F(TablesTests, test_columns_used) {
+  QueryContext context;
+  // Without a referenced column set every column is considered used.
+  EXPECT_TRUE(context.isColumnUsed("path"));
+
+  context.colsUsed = UsedColumns({"path"});
+  EXPECT_TRUE(context.isColumnUsed("path"));
+  EXPECT_FALSE(context.isColumnUsed("size"));
+  EXPECT_TRUE(context.isAnyColumnUsed({"size", "path"}));
+  EXPECT_FALSE(context.isAnyColumnUsed({"size", "mode"}));
+
+  // An empty set, such as from count(*), references no columns.
+  context.colsUsed = UsedColumns();
+  EXPECT_FALSE(context.isColumnUsed("path"));
+}
+
 TEST_F(TablesTests, test_caching) {
   TestTablePlugin test;
   // By default the interval and step is 0, so a step of 5 will not be cached.
@@ -164,4 +257,104 @@ TEST_F(TablesTests, test_caching) {
   EXPECT_TRUE(test.testIsCached(6));
   EXPECT_FALSE(test.testIsCached(7));
 }
+
+TEST_F(TablesTests, test_columnar_data) {
+  TableColumns columns = {
+      std::make_tuple("pid", BIGINT_TYPE, DEFAULT),
+      std::make_tuple("name", TEXT_TYPE, DEFAULT),
+      std::make_tuple("load", DOUBLE_TYPE, DEFAULT),
+  };
+
+  ColumnarData data(columns);
+  EXPECT_EQ(data.columns(), 3U);
+  EXPECT_EQ(data.column("name"), 1U);
+  EXPECT_EQ(data.column("missing"), 3U);
+
+  auto r = data.addRow();
+  data.setInteger(r, 0, 100);
+  data.setText(r, 1, "osqueryd");
+  EXPECT_EQ(data.getInteger(r, 0), 100);
+  EXPECT_EQ(data.getText(r, 1), "osqueryd");
+  EXPECT_TRUE(data.isNull(r, 2));
+
+  // Uncastable text for a numeric column is NULL.
+  r = data.addRow();
+  data.setText(r, 0, "not_a_number");
+  data.setText(r, 2, "1.5");
+  EXPECT_TRUE(data.isNull(r, 0));
+  EXPECT_EQ(data.getDouble(r, 2), 1.5);
+
+  // NULL cells are omitted from the legacy representation.
+  auto qd = data.toQueryData();
+  ASSERT_EQ(qd.size(), 2U);
+  EXPECT_EQ(qd[0], Row({{"pid", "100"}, {"name", "osqueryd"}}));
+  EXPECT_EQ(qd[1].count("pid"), 0U);
+
+  // The adapter is lossless for castable rows.
+  auto adapted = ColumnarData::fromQueryData(columns, {qd[0]});
+  EXPECT_EQ(adapted.toQueryData(), QueryData({qd[0]}));
+}
+
+TEST_F(TablesTests, test_caching_memory_budget) {
+  auto memory = FLAGS_table_cache_memory;
+  FLAGS_table_cache_memory = 128;
+
+  TestTablePlugin first;
+  first.setName("cache_first");
+  TestTablePlugin second;
+  second.setName("cache_second");
+
+  QueryData results = {{{"data", std::string(64, 'a')}}};
+  first.testSetCache(1, 5, results);
+  EXPECT_TRUE(first.testIsCached(2));
+  EXPECT_EQ(first.testGetCache(), results);
+
+  // Both results do not fit within the budget, the oldest is evicted.
+  second.testSetCache(1, 5, results);
+  EXPECT_FALSE(first.testIsCached(2));
+  EXPECT_TRUE(second.testIsCached(2));
+  EXPECT_EQ(second.testGetCache(), results);
+
+  // Results larger than the budget are not cached.
+  QueryData large = {{{"data", std::string(256, 'a')}}};
+  first.testSetCache(2, 5, large);
+  EXPECT_FALSE(first.testIsCached(3));
+  FLAGS_table_cache_memory = memory;
+}
+
+TEST_F(TablesTests, test_memoize) {
+  TestTablePlugin boot;
+  boot.setName("memoize_boot");
+  TestTablePlugin hardware;
+  hardware.setName("memoize_hardware");
+
+  QueryContext context;
+  context.constraints["column"].add(Constraint(EQUALS, "value"));
+  auto results = boot.testMemoize(context, false);
+  EXPECT_EQ(boot.testMemoize(context, false), results);
+  EXPECT_EQ(boot.generated, 1U);
+
+  // Without a publisher watching for changes hardware tables are generated.
+  QueryContext unconstrained;
+  hardware.testMemoize(unconstrained, true);
+  hardware.testMemoize(unconstrained, true);
+  EXPECT_EQ(hardware.generated, 2U);
+
+  EXPECT_FALSE(TablePlugin::watchingHardware());
+  TablePlugin::watchHardware(true);
+  EXPECT_TRUE(TablePlugin::watchingHardware());
+  hardware.testMemoize(unconstrained, true);
+  hardware.testMemoize(unconstrained, true);
+  EXPECT_EQ(hardware.generated, 3U);
+
+  // A change drops hardware results only.
+  auto generation = TablePlugin::hardwareGeneration();
+  TablePlugin::hardwareChanged();
+  EXPECT_EQ(TablePlugin::hardwareGeneration(), generation + 1);
+  hardware.testMemoize(unconstrained, true);
+  boot.testMemoize(unconstrained, false);
+  EXPECT_EQ(hardware.generated, 4U);
+  EXPECT_EQ(boot.generated, 1U);
+  TablePlugin::watchHardware(false);
+}
 }
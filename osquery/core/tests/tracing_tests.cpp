@@ -0,0 +1,75 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <set>
+#include <sstream>
+#include <thread>
+
+#include <boost/property_tree/json_parser.hpp>
+
+#include <gtest/gtest.h>
+
+#include "osquery/core/tracing.h"
+
+namespace pt = boost::property_tree;
+
+namespace osquery {
+
+class TracingTests : public testing::Test {};
+
+/// Count the events of a span name and the threads that recorded them.
+static size_t countSpans(const std::string& name, std::set<int>& threads) {
+  std::string json;
+  getTraceJSON(json);
+
+  pt::ptree tree;
+  std::stringstream input(json);
+  pt::read_json(input, tree);
+
+  size_t count = 0;
+  for (const auto& event : tree.get_child("traceEvents")) {
+    if (event.second.get<std::string>("name") == name) {
+      EXPECT_EQ(event.second.get<std::string>("ph"), "X");
+      EXPECT_GE(event.second.get<double>("dur"), 0);
+      threads.insert(event.second.get<int>("tid"));
+      count++;
+    }
+  }
+  return count;
+}
+
+TEST_F(TracingTests, test_trace_spans) {
+  { TraceSpan span("test_trace_spans"); }
+  std::thread thread([]() {
+    for (size_t i = 0; i < 2; ++i) {
+      TraceSpan span("test_trace_spans");
+    }
+  });
+  thread.join();
+
+  // Each thread records to its own buffer.
+  std::set<int> threads;
+  EXPECT_EQ(countSpans("test_trace_spans", threads), 3U);
+  EXPECT_EQ(threads.size(), 2U);
+}
+
+TEST_F(TracingTests, test_trace_ring) {
+  std::thread thread([]() {
+    for (size_t i = 0; i < kTraceBufferSpans + 10; ++i) {
+      TraceSpan span("test_trace_ring");
+    }
+  });
+  thread.join();
+
+  // Only the most recent spans of a thread are kept.
+  std::set<int> threads;
+  EXPECT_EQ(countSpans("test_trace_ring", threads), kTraceBufferSpans);
+}
+}
@@ -0,0 +1,82 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <gtest/gtest.h>
+
+#include "osquery/core/watcher.h"
+
+namespace osquery {
+
+class WatcherTests : public testing::Test {};
+
+/// Create a sample some milliseconds after a base time.
+static ProcessSample makeSample(std::chrono::steady_clock::time_point base,
+                                size_t milli,
+                                size_t user_time,
+                                size_t system_time) {
+  ProcessSample sample;
+  sample.time = base + std::chrono::milliseconds(milli);
+  sample.user_time = user_time;
+  sample.system_time = system_time;
+  return sample;
+}
+
+TEST_F(WatcherTests, test_window_utilization) {
+  auto base = std::chrono::steady_clock::now();
+  std::deque<ProcessSample> samples;
+
+  // Nothing is reported until the samples span the window.
+  EXPECT_EQ(windowUtilization(samples, makeSample(base, 0, 0, 0), 1000), 0U);
+  EXPECT_EQ(windowUtilization(samples, makeSample(base, 500, 500, 0), 1000),
+            0U);
+
+  // Half a second of CPU per second of wall time.
+  EXPECT_EQ(windowUtilization(samples, makeSample(base, 1000, 500, 0), 1000),
+            50U);
+
+  // The window slides, the oldest samples no longer count.
+  EXPECT_EQ(
+      windowUtilization(samples, makeSample(base, 1500, 1400, 100), 1000),
+      90U);
+  EXPECT_EQ(samples.size(), 3U);
+
+  // System time is compared separately.
+  EXPECT_EQ(
+      windowUtilization(samples, makeSample(base, 2500, 1400, 900), 1000),
+      80U);
+
+  // Counters moving backward restart the window.
+  EXPECT_EQ(windowUtilization(samples, makeSample(base, 3000, 0, 0), 1000),
+            0U);
+  EXPECT_EQ(samples.size(), 1U);
+}
+
+#ifdef __linux__
+TEST_F(WatcherTests, test_sample_process) {
+  ProcessSample sample;
+  EXPECT_TRUE(sampleProcess(getpid(), sample));
+  EXPECT_EQ(sample.parent, getppid());
+  EXPECT_GT(sample.resident_size, 0U);
+}
+
+TEST_F(WatcherTests, test_set_child_cgroup) {
+  auto cgroup = FLAGS_watchdog_cgroup;
+
+  // Children are not moved unless a cgroup is configured.
+  FLAGS_watchdog_cgroup = "";
+  EXPECT_FALSE(setChildCgroup("worker", getpid()).ok());
+
+  // A cgroup without delegated controllers cannot hold limited children.
+  FLAGS_watchdog_cgroup = "/osquery/does/not/exist";
+  EXPECT_FALSE(setChildCgroup("worker", getpid()).ok());
+  FLAGS_watchdog_cgroup = cgroup;
+}
+#endif
+}
@@ -0,0 +1,188 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#include <osquery/core.h>
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+
+#include "osquery/core/json.h"
+#include "osquery/core/process.h"
+#include "osquery/core/tracing.h"
+
+namespace osquery {
+
+HIDDEN_FLAG(string,
+            trace_path,
+            "/var/osquery/osquery.trace.json",
+            "Path to write tracing spans when a dump is requested");
+
+/// A completed span, times are nanoseconds since the trace epoch.
+struct TraceEvent {
+  const char* name;
+  unsigned long long start;
+  unsigned long long duration;
+};
+
+/**
+ * @brief A thread's ring of recent spans.
+ *
+ * Only the owning thread writes events. The count of written events is
+ * published after each event so a reader copies complete events, unless the
+ * writer laps the reader.
+ */
+struct TraceBuffer {
+  std::array<TraceEvent, kTraceBufferSpans> events;
+
+  /// Number of events written, the next event is at next % size.
+  std::atomic<size_t> next{0};
+
+  /// The trace's thread id for events in this buffer.
+  size_t tid{0};
+};
+
+/// Every buffer ever used, buffers are reused but not freed.
+static std::vector<std::unique_ptr<TraceBuffer>> kTraceBuffers;
+
+/// Buffers of threads that exited, kept for their events and reused.
+static std::vector<TraceBuffer*> kFreeTraceBuffers;
+
+static Mutex kTraceBuffersMutex;
+
+static std::atomic<bool> kTraceDumpRequested{false};
+
+static const auto kTraceEpoch = std::chrono::steady_clock::now();
+
+/// Return a thread's buffer to the free list when the thread exits.
+struct TraceBufferOwner {
+  TraceBuffer* buffer{nullptr};
+
+  ~TraceBufferOwner() {
+    if (buffer != nullptr) {
+      WriteLock lock(kTraceBuffersMutex);
+      kFreeTraceBuffers.push_back(buffer);
+    }
+  }
+};
+
+static thread_local TraceBufferOwner kTraceBuffer;
+
+/// The calling thread's buffer, taken on the thread's first span.
+static TraceBuffer* getTraceBuffer() {
+  if (kTraceBuffer.buffer != nullptr) {
+    return kTraceBuffer.buffer;
+  }
+
+  WriteLock lock(kTraceBuffersMutex);
+  if (!kFreeTraceBuffers.empty()) {
+    kTraceBuffer.buffer = kFreeTraceBuffers.back();
+    kFreeTraceBuffers.pop_back();
+  } else {
+    kTraceBuffers.emplace_back(new TraceBuffer());
+    kTraceBuffer.buffer = kTraceBuffers.back().get();
+    kTraceBuffer.buffer->tid = kTraceBuffers.size();
+  }
+  return kTraceBuffer.buffer;
+}
+
+static unsigned long long traceNow() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now() - kTraceEpoch)
+      .count();
+}
+
+TraceSpan::TraceSpan(const char* name) : name_(name), start_(traceNow()) {}
+
+TraceSpan::~TraceSpan() {
+  auto end = traceNow();
+  auto* buffer = getTraceBuffer();
+  auto next = buffer->next.load(std::memory_order_relaxed);
+  auto& event = buffer->events[next % kTraceBufferSpans];
+  event.name = name_;
+  event.start = start_;
+  event.duration = end - start_;
+  buffer->next.store(next + 1, std::memory_order_release);
+}
+
+/// Chrome trace times are microseconds, keep the nanosecond precision.
+static std::string traceMicroseconds(unsigned long long nanoseconds) {
+  auto fraction = std::to_string(nanoseconds % 1000);
+  return std::to_string(nanoseconds / 1000) + "." +
+         std::string(3 - fraction.size(), '0') + fraction;
+}
+
+void getTraceJSON(std::string& json) {
+  std::vector<std::pair<size_t, TraceEvent>> events;
+  {
+    WriteLock lock(kTraceBuffersMutex);
+    for (const auto& buffer : kTraceBuffers) {
+      auto next = buffer->next.load(std::memory_order_acquire);
+      auto first = (next > kTraceBufferSpans) ? next - kTraceBufferSpans : 0;
+      for (auto i = first; i < next; ++i) {
+        events.push_back(std::make_pair(
+            buffer->tid, buffer->events[i % kTraceBufferSpans]));
+      }
+    }
+  }
+
+  auto pid = std::to_string(PlatformProcess::getCurrentProcess()->pid());
+  json.clear();
+  JSONWriter writer(json);
+  writer.startObject();
+  writer.key("traceEvents");
+  writer.startArray();
+  for (const auto& event : events) {
+    writer.startObject();
+    writer.member("name", event.second.name);
+    writer.member("ph", "X");
+    writer.key("ts");
+    writer.raw(traceMicroseconds(event.second.start));
+    writer.key("dur");
+    writer.raw(traceMicroseconds(event.second.duration));
+    writer.key("pid");
+    writer.raw(pid);
+    writer.key("tid");
+    writer.raw(std::to_string(event.first));
+    writer.endObject();
+  }
+  writer.endArray();
+  writer.member("displayTimeUnit", "ns");
+  writer.endObject();
+  writer.finish();
+}
+
+Status dumpTrace(const std::string& path) {
+  std::string json;
+  getTraceJSON(json);
+  return writeTextFile(path, json, 0600);
+}
+
+void requestTraceDump() { kTraceDumpRequested = true; }
+
+void checkTraceDump() {
+  if (!kTraceDumpRequested.exchange(false)) {
+    return;
+  }
+
+  auto status = dumpTrace(FLAGS_trace_path);
+  if (status.ok()) {
+    LOG(INFO) << "Wrote tracing spans to " << FLAGS_trace_path;
+  } else {
+    LOG(WARNING) << "Cannot write tracing spans to " << FLAGS_trace_path
+                 << ": " << status.getMessage();
+  }
+}
+}
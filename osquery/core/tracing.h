@@ -0,0 +1,84 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <string>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/status.h>
+
+namespace osquery {
+
+/// The number of most-recent spans kept for each thread.
+const size_t kTraceBufferSpans = 4096;
+
+/**
+ * @brief Record the duration of a scope as a tracing span.
+ *
+ * Spans are written to a ring buffer owned by the calling thread, only a
+ * thread's first span locks to take a buffer. Use the OSQUERY_TRACE_SPAN
+ * macro so the spans are compiled out of builds without OSQUERY_TRACING.
+ *
+ * @code{.cpp}
+ *   Status Query::addNewResults(...) {
+ *     OSQUERY_TRACE_SPAN("Query::addNewResults");
+ *     ...
+ *   }
+ * @endcode
+ */
+class TraceSpan : private boost::noncopyable {
+ public:
+  /// Begin a span, the name must be a string literal.
+  explicit TraceSpan(const char* name);
+
+  /// End the span and record it.
+  ~TraceSpan();
+
+ private:
+  const char* name_;
+
+  /// Nanoseconds since the trace epoch when the span began.
+  unsigned long long start_;
+};
+
+/**
+ * @brief Render the recorded spans of every thread as Chrome trace JSON.
+ *
+ * The output is the JSON object format read by chrome://tracing and
+ * Perfetto, with one complete ("X") event per span. Spans are copied while
+ * threads keep recording; a span overwritten during the copy may be torn.
+ */
+void getTraceJSON(std::string& json);
+
+/// Write the recorded spans as Chrome trace JSON, see getTraceJSON.
+Status dumpTrace(const std::string& path);
+
+/**
+ * @brief Request a dump of the recorded spans to `--trace_path`.
+ *
+ * This is safe to call from a signal handler, the daemon's scheduler checks
+ * for a request once per schedule step, see checkTraceDump.
+ */
+void requestTraceDump();
+
+/// Dump the recorded spans if a dump was requested.
+void checkTraceDump();
+}
+
+#if defined(OSQUERY_TRACING)
+#define OSQUERY_TRACE_CONCAT_(a, b) a##b
+#define OSQUERY_TRACE_CONCAT(a, b) OSQUERY_TRACE_CONCAT_(a, b)
+#define OSQUERY_TRACE_SPAN(name) \
+  ::osquery::TraceSpan OSQUERY_TRACE_CONCAT(trace_span_, __LINE__)(name)
+#else
+#define OSQUERY_TRACE_SPAN(name)
+#endif
@@ -8,13 +8,17 @@
  *
  */
 
+#include <cerrno>
 #include <cstring>
 
 #include <math.h>
 #include <signal.h>
 
 #ifndef WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
+#include <unistd.h>
 #endif
 
 #include <boost/filesystem.hpp>
@@ -63,12 +67,45 @@ CLI_FLAG(int32,
 
 CLI_FLAG(bool, disable_watchdog, false, "Disable userland watchdog process");
 
+CLI_FLAG(uint64,
+         watchdog_sample_milli,
+         0,
+         "Milliseconds between watchdog samples, 0 uses the watchdog interval");
+
+CLI_FLAG(string,
+         watchdog_cgroup,
+         "",
+         "Limit the worker and extensions in child cgroups of this cgroup v2");
+
+DECLARE_uint64(database_cache_size);
+
+/// The cgroup v2 cpu.max period in microseconds.
+const size_t kCgroupCPUPeriod = 100000;
+
+/// A child's memory limit in bytes, the worker also holds the block cache.
+static size_t getMemoryLimit(bool worker) {
+  auto limit = getWorkerLimit(MEMORY_LIMIT);
+  if (worker) {
+    limit += FLAGS_database_cache_size;
+  }
+  return limit * 1024 * 1024;
+}
+
+/// The delay between watch loop iterations, each samples every child.
+static size_t getSampleMilli() {
+  if (FLAGS_watchdog_sample_milli > 0) {
+    return FLAGS_watchdog_sample_milli;
+  }
+  return getWorkerLimit(INTERVAL) * 1000;
+}
+
 void Watcher::resetWorkerCounters(size_t respawn_time) {
   // Reset the monitoring counters for the watcher.
   auto& state = instance().state_;
   state.sustained_latency = 0;
   state.user_time = 0;
   state.system_time = 0;
+  state.samples.clear();
   state.last_respawn_time = respawn_time;
 }
 
@@ -79,6 +116,7 @@ void Watcher::resetExtensionCounters(const std::string& extension,
   state.sustained_latency = 0;
   state.user_time = 0;
   state.system_time = 0;
+  state.samples.clear();
   state.last_respawn_time = respawn_time;
 }
 
@@ -186,7 +224,7 @@ void WatcherRunner::start() {
     for (const auto& failed_extension : failing_extensions) {
       Watcher::removeExtensionPath(failed_extension);
     }
-    pauseMilli(getWorkerLimit(INTERVAL) * 1000);
+    pauseMilli(getSampleMilli());
   } while (!interrupted() && ok());
 }
 
@@ -226,23 +264,279 @@ void WatcherRunner::stopChild(const PlatformProcess& child) const {
   cleanupDefunctProcesses();
 }
 
-bool WatcherRunner::isChildSane(const PlatformProcess& child) const {
-  auto rows =
-      SQL::selectAllFrom("processes", "pid", EQUALS, INTEGER(child.pid()));
-  if (rows.size() == 0) {
-    // Could not find worker process?
+#ifdef __linux__
+/**
+ * @brief Read a small procfs or cgroupfs file into a fixed buffer.
+ *
+ * The watcher samples at a high rate, this avoids the stat and allocations
+ * of readFile.
+ */
+static bool readCounterFile(const std::string& path, char* buffer, size_t size) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  auto bytes = ::read(fd, buffer, size - 1);
+  ::close(fd);
+  if (bytes <= 0) {
+    return false;
+  }
+  buffer[bytes] = 0;
+  return true;
+}
+
+/// Find the cgroup v2 directory dedicated to a process, if any.
+static std::string getDedicatedCgroup(pid_t pid) {
+  char buffer[4096];
+  auto proc = "/proc/" + std::to_string(pid);
+  if (!readCounterFile(proc + "/cgroup", buffer, sizeof(buffer))) {
+    return "";
+  }
+
+  // The unified hierarchy is listed as "0::<path>".
+  auto unified = std::strstr(buffer, "0::/");
+  if (unified == nullptr || (unified != buffer && unified[-1] != '\n')) {
+    return "";
+  }
+  std::string path(unified + 3, std::strcspn(unified + 3, "\n"));
+  if (path == "/") {
+    return "";
+  }
+
+  // Counters only describe the process if it is the cgroup's only member.
+  auto cgroup = "/sys/fs/cgroup" + path;
+  if (!readCounterFile(cgroup + "/cgroup.procs", buffer, sizeof(buffer))) {
+    return "";
+  }
+  char* end = nullptr;
+  auto member = std::strtoull(buffer, &end, 10);
+  if (member != static_cast<unsigned long long>(pid) ||
+      std::strspn(end, "\n") != std::strlen(end)) {
+    return "";
+  }
+  return cgroup;
+}
+
+/// Apply a dedicated cgroup's v2 CPU and memory counters to a sample.
+static void sampleCgroup(const std::string& cgroup, ProcessSample& sample) {
+  char buffer[1024];
+  if (readCounterFile(cgroup + "/memory.current", buffer, sizeof(buffer))) {
+    sample.resident_size = std::strtoull(buffer, nullptr, 10);
+  }
+
+  if (readCounterFile(cgroup + "/cpu.stat", buffer, sizeof(buffer))) {
+    auto user = std::strstr(buffer, "user_usec ");
+    auto system = std::strstr(buffer, "system_usec ");
+    if (user != nullptr && system != nullptr) {
+      sample.user_time = std::strtoull(user + 10, nullptr, 10) / 1000;
+      sample.system_time = std::strtoull(system + 12, nullptr, 10) / 1000;
+    }
+  }
+}
+#endif
+
+#ifdef __linux__
+/// Write a value to a cgroup control file.
+static Status writeCgroupFile(const std::string& path,
+                              const std::string& value) {
+  int fd = ::open(path.c_str(), O_WRONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return Status(1, "Cannot open " + path + ": " + std::strerror(errno));
+  }
+  auto bytes = ::write(fd, value.c_str(), value.size());
+  auto error = errno;
+  ::close(fd);
+  if (bytes != static_cast<ssize_t>(value.size())) {
+    return Status(1, "Cannot write " + path + ": " + std::strerror(error));
+  }
+  return Status(0, "OK");
+}
+#endif
+
+Status setChildCgroup(const std::string& name, pid_t pid) {
+#ifdef __linux__
+  if (FLAGS_watchdog_cgroup.empty()) {
+    return Status(1, "No watchdog cgroup");
+  }
+
+  // The child cgroups need the CPU and memory controllers delegated.
+  auto status = writeCgroupFile(FLAGS_watchdog_cgroup + "/cgroup.subtree_control",
+                                "+cpu +memory");
+  if (!status.ok()) {
+    return status;
+  }
+
+  auto cgroup = FLAGS_watchdog_cgroup + "/" + name;
+  if (::mkdir(cgroup.c_str(), 0755) != 0 && errno != EEXIST) {
+    return Status(1, "Cannot create " + cgroup + ": " + std::strerror(errno));
+  }
+
+  // Apply the same limits the watcher enforces, the kernel throttles rather
+  // than the watcher restarting the child.
+  std::string cpu_max = "max";
+  std::string memory_high = "max";
+  if (FLAGS_watchdog_level != -1) {
+    auto quota = getWorkerLimit(UTILIZATION_LIMIT) * kCgroupCPUPeriod / 100;
+    cpu_max = std::to_string(quota);
+    memory_high = std::to_string(getMemoryLimit(name == "worker"));
+  }
+
+  status = writeCgroupFile(cgroup + "/cpu.max",
+                           cpu_max + " " + std::to_string(kCgroupCPUPeriod));
+  if (!status.ok()) {
+    return status;
+  }
+
+  status = writeCgroupFile(cgroup + "/memory.high", memory_high);
+  if (!status.ok()) {
+    return status;
+  }
+  return writeCgroupFile(cgroup + "/cgroup.procs", std::to_string(pid));
+#else
+  return Status(1, "Not supported");
+#endif
+}
+
+/// Place a newly-created child in its cgroup, if configured.
+static void placeChild(const std::string& name, const PlatformProcess& child) {
+  if (FLAGS_watchdog_cgroup.empty()) {
+    return;
+  }
+
+  auto status = setChildCgroup(name, child.pid());
+  if (!status.ok()) {
+    LOG(WARNING) << "Cannot limit child (" << child.pid()
+                 << ") within a cgroup: " << status.getMessage();
+  }
+}
+
+bool sampleProcess(pid_t pid, ProcessSample& sample) {
+#ifdef __linux__
+  static const auto kTicks = static_cast<size_t>(sysconf(_SC_CLK_TCK));
+  static const auto kPageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+
+  char buffer[1024];
+  auto proc = "/proc/" + std::to_string(pid);
+  if (!readCounterFile(proc + "/stat", buffer, sizeof(buffer))) {
+    return false;
+  }
+
+  // The command name may contain spaces, parse fields after ") <state>".
+  auto fields = std::strrchr(buffer, ')');
+  if (fields == nullptr || fields[1] != ' ' || fields[2] == 0) {
+    return false;
+  }
+
+  // Parse from the parent, field 4, through stime, field 15.
+  char* position = fields + 3;
+  unsigned long long values[12] = {0};
+  for (size_t i = 0; i < 12; i++) {
+    char* end = nullptr;
+    values[i] = std::strtoull(position, &end, 10);
+    if (end == position) {
+      return false;
+    }
+    position = end;
+  }
+  sample.parent = static_cast<pid_t>(values[0]);
+  sample.user_time = values[10] * 1000 / std::max(kTicks, (size_t)1);
+  sample.system_time = values[11] * 1000 / std::max(kTicks, (size_t)1);
+
+  // The second field of statm is the resident set in pages.
+  if (!readCounterFile(proc + "/statm", buffer, sizeof(buffer))) {
     return false;
   }
+  char* end = nullptr;
+  std::strtoull(buffer, &end, 10);
+  sample.resident_size = std::strtoull(end, nullptr, 10) * kPageSize;
+
+  auto cgroup = getDedicatedCgroup(pid);
+  if (!cgroup.empty()) {
+    sampleCgroup(cgroup, sample);
+  }
+  sample.time = std::chrono::steady_clock::now();
+  return true;
+#else
+  return false;
+#endif
+}
+
+size_t windowUtilization(std::deque<ProcessSample>& samples,
+                         const ProcessSample& sample,
+                         size_t window) {
+  if (!samples.empty() && (sample.user_time < samples.back().user_time ||
+                           sample.system_time < samples.back().system_time)) {
+    // Counters went backward, the process was replaced.
+    samples.clear();
+  }
+  samples.push_back(sample);
+
+  // Keep the newest sample that still spans the window as the oldest.
+  auto span = std::chrono::milliseconds(window);
+  while (samples.size() > 2 && sample.time - samples[1].time >= span) {
+    samples.pop_front();
+  }
+
+  const auto& first = samples.front();
+  auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                     sample.time - first.time)
+                     .count();
+  if (samples.size() < 2 || elapsed <= 0 ||
+      static_cast<size_t>(elapsed) < window) {
+    return 0;
+  }
+
+  auto cpu = std::max(sample.user_time - first.user_time,
+                      sample.system_time - first.system_time);
+  return cpu * 100 / static_cast<size_t>(elapsed);
+}
+
+/**
+ * @brief Set the memory footprint as the amount of resident bytes allocated
+ * since the process image was created (estimate).
+ *
+ * A more-meaningful check would limit this to writable regions.
+ */
+static size_t getFootprint(PerformanceState& state, size_t footprint) {
+  if (state.initial_footprint == 0) {
+    state.initial_footprint = footprint;
+  }
 
-  // Get the performance state for the worker or extension.
-  size_t sustained_latency = 0;
-  // Compare CPU utilization since last check.
+  // Set the measured/limit-applied footprint to the post-launch allocations.
+  if (footprint < state.initial_footprint) {
+    return 0;
+  }
+  return footprint - state.initial_footprint;
+}
+
+bool WatcherRunner::isChildSane(const PlatformProcess& child) const {
+  // Set if the CPU utilization was sustained above the limit.
+  bool utilization_exceeded = false;
+  // Resident bytes allocated since the first check.
   size_t footprint = 0;
   pid_t parent = 0;
-  // IV is the check interval in seconds, and utilization is set per-second.
-  auto iv = std::max(getWorkerLimit(INTERVAL), (size_t)1);
 
-  {
+  ProcessSample sample;
+  if (sampleProcess(child.pid(), sample)) {
+    // The utilization across the latency limit is compared to the limit.
+    WatcherLocker locker;
+    auto& state = Watcher::getState(child);
+    auto utilization = windowUtilization(
+        state.samples, sample, getWorkerLimit(LATENCY_LIMIT) * 1000);
+    utilization_exceeded = utilization > getWorkerLimit(UTILIZATION_LIMIT);
+    parent = sample.parent;
+    footprint = getFootprint(state, sample.resident_size);
+  } else {
+    auto rows =
+        SQL::selectAllFrom("processes", "pid", EQUALS, INTEGER(child.pid()));
+    if (rows.size() == 0) {
+      // Could not find worker process?
+      return false;
+    }
+
+    // IV is the check interval in seconds, and utilization is set per-second.
+    auto iv = std::max(getWorkerLimit(INTERVAL), (size_t)1);
+
     WatcherLocker locker;
     auto& state = Watcher::getState(child);
     UNSIGNED_BIGINT_LITERAL user_time = 0, system_time = 0;
@@ -267,21 +561,10 @@ bool WatcherRunner::isChildSane(const PlatformProcess& child) const {
     state.system_time = system_time;
 
     // Check if the sustained difference exceeded the acceptable latency limit.
-    sustained_latency = state.sustained_latency;
-
-    // Set the memory footprint as the amount of resident bytes allocated
-    // since the process image was created (estimate).
-    // A more-meaningful check would limit this to writable regions.
-    if (state.initial_footprint == 0) {
-      state.initial_footprint = footprint;
-    }
-
-    // Set the measured/limit-applied footprint to the post-launch allocations.
-    if (footprint < state.initial_footprint) {
-      footprint = 0;
-    } else {
-      footprint = footprint - state.initial_footprint;
-    }
+    utilization_exceeded =
+        state.sustained_latency > 0 &&
+        state.sustained_latency * iv >= getWorkerLimit(LATENCY_LIMIT);
+    footprint = getFootprint(state, footprint);
   }
 
   // Only make a decision about the child sanity if it is still the watcher's
@@ -293,14 +576,14 @@ bool WatcherRunner::isChildSane(const PlatformProcess& child) const {
     return true;
   }
 
-  if (sustained_latency > 0 &&
-      sustained_latency * iv >= getWorkerLimit(LATENCY_LIMIT)) {
+  if (utilization_exceeded) {
     LOG(WARNING) << "osqueryd worker (" << child.pid()
                  << ") system performance limits exceeded";
     return false;
   }
   // Check if the private memory exceeds a memory limit.
-  if (footprint > 0 && footprint > getWorkerLimit(MEMORY_LIMIT) * 1024 * 1024) {
+  auto worker = Watcher::getExtensionPath(child).empty();
+  if (footprint > 0 && footprint > getMemoryLimit(worker)) {
     LOG(WARNING) << "osqueryd worker (" << child.pid()
                  << ") memory limits exceeded: " << footprint;
     return false;
@@ -349,6 +632,12 @@ void WatcherRunner::createWorker() {
     setEnvVar("OSQUERY_EXTENSIONS", "true");
   }
 
+  // Every worker after the first is a respawn, which may start from the
+  // state saved by the previous worker instead of waiting on remote plugins.
+  if (Watcher::getState(Watcher::getWorker()).last_respawn_time > 0) {
+    setEnvVar("OSQUERY_RESPAWN", "true");
+  }
+
   // Get the complete path of the osquery process binary.
   boost::system::error_code ec;
   auto exec_path = fs::system_complete(fs::path(qd[0]["path"]), ec);
@@ -369,6 +658,7 @@ void WatcherRunner::createWorker() {
     return;
   }
 
+  placeChild("worker", *worker);
   Watcher::setWorker(worker);
   Watcher::resetWorkerCounters(getUnixTime());
   VLOG(1) << "osqueryd watcher (" << PlatformProcess::getCurrentProcess()->pid()
@@ -410,6 +700,7 @@ bool WatcherRunner::createExtension(const std::string& extension) {
     Initializer::shutdown(EXIT_FAILURE);
   }
 
+  placeChild("extension." + exec_path.filename().string(), *ext_process);
   Watcher::setExtension(extension, ext_process);
   Watcher::resetExtensionCounters(extension, getUnixTime());
   VLOG(1) << "Created and monitoring extension child (" << ext_process->pid()
@@ -11,6 +11,8 @@
 #pragma once
 
 #include <atomic>
+#include <chrono>
+#include <deque>
 #include <string>
 
 #ifndef WIN32
@@ -30,6 +32,8 @@ using ExtensionMap = std::map<std::string, std::shared_ptr<PlatformProcess>>;
 
 DECLARE_bool(disable_watchdog);
 DECLARE_int32(watchdog_level);
+DECLARE_uint64(watchdog_sample_milli);
+DECLARE_string(watchdog_cgroup);
 
 class WatcherRunner;
 
@@ -50,6 +54,26 @@ enum WatchdogLimitType {
   INTERVAL,
 };
 
+/**
+ * @brief A native sample of a watched process's CPU time and memory.
+ *
+ * On Linux the watcher reads /proc/<pid>/stat and statm, or the cgroup v2
+ * counters of a cgroup dedicated to the process, instead of the processes
+ * table.
+ */
+struct ProcessSample {
+  /// When the sample was taken.
+  std::chrono::steady_clock::time_point time;
+  /// The process's parent process ID.
+  pid_t parent{0};
+  /// Cumulative user CPU time in milliseconds.
+  size_t user_time{0};
+  /// Cumulative system CPU time in milliseconds.
+  size_t system_time{0};
+  /// Resident memory in bytes.
+  size_t resident_size{0};
+};
+
 /**
  * @brief A performance state structure for an autoloaded extension or worker.
  *
@@ -69,6 +93,9 @@ struct PerformanceState {
   /// The initial (or as close as possible) process image footprint.
   size_t initial_footprint;
 
+  /// Native samples within the sliding CPU utilization window.
+  std::deque<ProcessSample> samples;
+
   PerformanceState() {
     sustained_latency = 0;
     user_time = 0;
@@ -296,5 +323,43 @@ class WatcherWatcherRunner : public InternalRunnable {
 
 /// Get a performance limit by name and optional level.
 size_t getWorkerLimit(WatchdogLimitType limit);
+
+/**
+ * @brief Move a watched child into a dedicated cgroup v2 with limits applied.
+ *
+ * The cgroup is created as `name` within the watchdog_cgroup directory, with
+ * cpu.max and memory.high set from the UTILIZATION_LIMIT and MEMORY_LIMIT.
+ * The watcher's checks remain, as a last resort, if the kernel's throttling
+ * does not keep the child within its limits.
+ *
+ * @param name The child cgroup's name.
+ * @param pid The process to move.
+ * @return Success if the process was moved and limited.
+ */
+Status setChildCgroup(const std::string& name, pid_t pid);
+
+/**
+ * @brief Sample a process's CPU time and memory without the processes table.
+ *
+ * @param pid The process to sample.
+ * @param sample Output, the process's counters.
+ * @return true if native sampling is supported and the process was read.
+ */
+bool sampleProcess(pid_t pid, ProcessSample& sample);
+
+/**
+ * @brief Add a sample to a sliding window and compute CPU utilization.
+ *
+ * Samples older than needed to span the window are removed.
+ *
+ * @param samples The window of previous samples for a process.
+ * @param sample The newest sample.
+ * @param window The window length in milliseconds.
+ * @return The greater of the user and system CPU percent across the window,
+ * 0 until the samples span the whole window.
+ */
+size_t windowUtilization(std::deque<ProcessSample>& samples,
+                         const ProcessSample& sample,
+                         size_t window);
 }
 
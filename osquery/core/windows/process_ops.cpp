@@ -85,5 +85,41 @@ ProcessState checkChildProcessStatus(const PlatformProcess &process,
 }
 
 void setToBackgroundPriority() {}
+
+bool setThreadPolicy(ThreadPolicy policy, int nice) {
+  auto thread = ::GetCurrentThread();
+  if (policy == THREAD_POLICY_DEFAULT) {
+    return true;
+  } else if (policy == THREAD_POLICY_IDLE) {
+    // Background mode also lowers the thread's I/O and memory priorities.
+    return (::SetThreadPriority(thread, THREAD_MODE_BACKGROUND_BEGIN) != 0);
+  }
+
+  auto priority = (policy == THREAD_POLICY_NICE && nice >= 10)
+                      ? THREAD_PRIORITY_LOWEST
+                      : THREAD_PRIORITY_BELOW_NORMAL;
+  return (::SetThreadPriority(thread, priority) != 0);
+}
+
+bool getThreadResourceUsage(ProcessResourceUsage &usage) {
+  FILETIME creation, exit, kernel, user;
+  if (!::GetThreadTimes(
+          ::GetCurrentThread(), &creation, &exit, &kernel, &user)) {
+    return false;
+  }
+
+  // Thread times are reported in 100-nanosecond units.
+  auto to_milli = [](const FILETIME &time) {
+    ULARGE_INTEGER value;
+    value.LowPart = time.dwLowDateTime;
+    value.HighPart = time.dwHighDateTime;
+    return value.QuadPart / 10000;
+  };
+  usage.user_time = to_milli(user);
+  usage.system_time = to_milli(kernel);
+  // The peak working set requires psapi, memory is not reported.
+  usage.peak_resident_size = 0;
+  return true;
+}
 }
 
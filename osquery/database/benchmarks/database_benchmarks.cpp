@@ -8,11 +8,17 @@
  *
  */
 
+#include <algorithm>
+#include <sstream>
+
 #include <benchmark/benchmark.h>
 
+#include <boost/property_tree/json_parser.hpp>
+
 #include <osquery/database.h>
 #include <osquery/filesystem.h>
 
+#include "osquery/core/allocations.h"
 #include "osquery/tests/test_util.h"
 #include "osquery/database/query.h"
 
@@ -33,6 +39,19 @@ QueryData getExampleQueryData(size_t x, size_t y) {
   return qd;
 }
 
+QueryData getExampleUniqueQueryData(size_t x, size_t y) {
+  QueryData qd;
+  for (size_t j = 0; j < y; j++) {
+    Row r;
+    // Fill in a row with x, make each row unique using y;
+    for (size_t i = 0; i < x; i++) {
+      r["key" + std::to_string(i)] = std::to_string(i) + std::to_string(j);
+    }
+    qd.push_back(r);
+  }
+  return qd;
+}
+
 static void DATABASE_serialize(benchmark::State& state) {
   auto qd = getExampleQueryData(state.range_x(), state.range_y());
   while (state.KeepRunning()) {
@@ -56,6 +75,74 @@ BENCHMARK(DATABASE_serialize_json)
     ->ArgPair(10, 10)
     ->ArgPair(10, 100);
 
+static void DATABASE_serialize_json_ptree(benchmark::State& state) {
+  // The previous serialization, building a property tree then writing it.
+  auto qd = getExampleQueryData(state.range_x(), state.range_y());
+  while (state.KeepRunning()) {
+    boost::property_tree::ptree tree;
+    serializeQueryData(qd, tree);
+    std::ostringstream output;
+    boost::property_tree::write_json(output, tree, false);
+    auto content = output.str();
+  }
+}
+
+BENCHMARK(DATABASE_serialize_json_ptree)
+    ->ArgPair(1, 1)
+    ->ArgPair(10, 10)
+    ->ArgPair(10, 100);
+
+static void DATABASE_serialize_json_reused(benchmark::State& state) {
+  // Serializers append to the output, a reused output keeps its capacity.
+  auto qd = getExampleQueryData(state.range_x(), state.range_y());
+  std::string content;
+  while (state.KeepRunning()) {
+    serializeQueryDataJSON(qd, content);
+  }
+}
+
+BENCHMARK(DATABASE_serialize_json_reused)
+    ->ArgPair(1, 1)
+    ->ArgPair(10, 10)
+    ->ArgPair(10, 100);
+
+static void DATABASE_serialize_log_item_json(benchmark::State& state) {
+  QueryLogItem item;
+  item.results.added =
+      getExampleUniqueQueryData(state.range_x(), state.range_y());
+  item.name = "benchmark";
+  item.identifier = "host";
+  item.decorations["hostname"] = "host.example.com";
+  std::string content;
+  while (state.KeepRunning()) {
+    serializeQueryLogItemJSON(item, content);
+  }
+}
+
+BENCHMARK(DATABASE_serialize_log_item_json)
+    ->ArgPair(10, 10)
+    ->ArgPair(10, 100);
+
+static void DATABASE_serialize_log_item_json_ptree(benchmark::State& state) {
+  QueryLogItem item;
+  item.results.added =
+      getExampleUniqueQueryData(state.range_x(), state.range_y());
+  item.name = "benchmark";
+  item.identifier = "host";
+  item.decorations["hostname"] = "host.example.com";
+  while (state.KeepRunning()) {
+    boost::property_tree::ptree tree;
+    serializeQueryLogItem(item, tree);
+    std::ostringstream output;
+    boost::property_tree::write_json(output, tree, false);
+    auto content = output.str();
+  }
+}
+
+BENCHMARK(DATABASE_serialize_log_item_json_ptree)
+    ->ArgPair(10, 10)
+    ->ArgPair(10, 100);
+
 static void DATABASE_diff(benchmark::State& state) {
   auto qd = getExampleQueryData(state.range_x(), state.range_y());
   while (state.KeepRunning()) {
@@ -63,7 +150,30 @@ static void DATABASE_diff(benchmark::State& state) {
   }
 }
 
-BENCHMARK(DATABASE_diff)->ArgPair(1, 1)->ArgPair(10, 10)->ArgPair(10, 100);
+BENCHMARK(DATABASE_diff)
+    ->ArgPair(1, 1)
+    ->ArgPair(10, 10)
+    ->ArgPair(10, 100)
+    ->ArgPair(10, 10000)
+    ->ArgPair(10, 100000);
+
+static void DATABASE_diff_unique(benchmark::State& state) {
+  auto old_qd = getExampleUniqueQueryData(state.range_x(), state.range_y());
+  // Replace the first tenth of the rows to produce both added and removed.
+  auto new_qd = old_qd;
+  for (size_t i = 0; i < new_qd.size() / 10; i++) {
+    new_qd[i]["key0"] = "changed";
+  }
+
+  while (state.KeepRunning()) {
+    auto d = diff(old_qd, new_qd);
+  }
+}
+
+BENCHMARK(DATABASE_diff_unique)
+    ->ArgPair(10, 100)
+    ->ArgPair(10, 10000)
+    ->ArgPair(10, 100000);
 
 static void DATABASE_query_results(benchmark::State& state) {
   auto qd = getExampleQueryData(state.range_x(), state.range_y());
@@ -80,6 +190,131 @@ BENCHMARK(DATABASE_query_results)
     ->ArgPair(10, 10)
     ->ArgPair(10, 100);
 
+/**
+ * @brief Store results that all differ from the last run, then log them.
+ *
+ * Follows the scheduler's hand-off from the query results to a QueryLogItem,
+ * copying or moving the rows. The label holds the most bytes an iteration had
+ * allocated at once, beyond the query results themselves.
+ */
+static void benchmarkResultsHandoff(benchmark::State& state, bool move) {
+  auto query = getOsqueryScheduledQuery();
+  auto dbq = Query(move ? "handoff_move" : "handoff_copy", query);
+  size_t run = 0;
+  unsigned long long peak = 0;
+  while (state.KeepRunning()) {
+    state.PauseTiming();
+    auto qd = getExampleUniqueQueryData(state.range_x(), state.range_y());
+    for (auto& row : qd) {
+      row["key0"] = std::to_string(run);
+    }
+    run++;
+    state.ResumeTiming();
+
+    AllocationScope scope;
+    {
+      DiffResults diff_results;
+      QueryLogItem item;
+      if (move) {
+        dbq.addNewResults(std::move(qd), diff_results);
+        item.results = std::move(diff_results);
+      } else {
+        dbq.addNewResults(qd, diff_results);
+        item.results = diff_results;
+      }
+      std::string json;
+      serializeQueryLogItemJSON(item, json);
+    }
+    peak = std::max(peak, scope.peakBytes());
+  }
+  state.SetLabel("peak_bytes=" + std::to_string(peak));
+}
+
+static void DATABASE_results_handoff_copy(benchmark::State& state) {
+  benchmarkResultsHandoff(state, false);
+}
+
+BENCHMARK(DATABASE_results_handoff_copy)
+    ->ArgPair(10, 100)
+    ->ArgPair(10, 10000);
+
+static void DATABASE_results_handoff_move(benchmark::State& state) {
+  benchmarkResultsHandoff(state, true);
+}
+
+BENCHMARK(DATABASE_results_handoff_move)
+    ->ArgPair(10, 100)
+    ->ArgPair(10, 10000);
+
+static void DATABASE_previous_results(benchmark::State& state) {
+  auto qd = getExampleUniqueQueryData(state.range_x(), state.range_y());
+  auto query = getOsqueryScheduledQuery();
+  auto dbq = Query("previous", query);
+  DiffResults diff_results;
+  dbq.addNewResults(qd, diff_results);
+  while (state.KeepRunning()) {
+    QueryData previous;
+    dbq.getPreviousQueryResults(previous);
+  }
+}
+
+BENCHMARK(DATABASE_previous_results)
+    ->ArgPair(10, 100)
+    ->ArgPair(10, 10000)
+    ->ArgPair(10, 50000);
+
+static void DATABASE_changed_results(benchmark::State& state) {
+  // Each run changes one row of a large result set.
+  auto qd = getExampleUniqueQueryData(state.range_x(), state.range_y());
+  auto query = getOsqueryScheduledQuery();
+  auto dbq = Query("changed", query);
+  DiffResults diff_results;
+  dbq.addNewResults(qd, diff_results);
+  size_t k = 0;
+  while (state.KeepRunning()) {
+    qd[k % qd.size()]["changed"] = std::to_string(k);
+    DiffResults changed;
+    dbq.addNewResults(qd, changed);
+    k++;
+  }
+}
+
+BENCHMARK(DATABASE_changed_results)
+    ->ArgPair(10, 100)
+    ->ArgPair(10, 10000);
+
+static void DATABASE_deserialize_json(benchmark::State& state) {
+  auto qd = getExampleUniqueQueryData(state.range_x(), state.range_y());
+  std::string content;
+  serializeQueryDataJSON(qd, content);
+  while (state.KeepRunning()) {
+    QueryData results;
+    deserializeQueryDataJSON(content, results);
+  }
+}
+
+BENCHMARK(DATABASE_deserialize_json)
+    ->ArgPair(10, 100)
+    ->ArgPair(10, 10000);
+
+static void DATABASE_deserialize_json_ptree(benchmark::State& state) {
+  // The previous deserialization, reading a property tree then copying it.
+  auto qd = getExampleUniqueQueryData(state.range_x(), state.range_y());
+  std::string content;
+  serializeQueryDataJSON(qd, content);
+  while (state.KeepRunning()) {
+    boost::property_tree::ptree tree;
+    std::stringstream input(content);
+    boost::property_tree::read_json(input, tree);
+    QueryData results;
+    deserializeQueryData(tree, results);
+  }
+}
+
+BENCHMARK(DATABASE_deserialize_json_ptree)
+    ->ArgPair(10, 100)
+    ->ArgPair(10, 10000);
+
 static void DATABASE_get(benchmark::State& state) {
   setDatabaseValue(kPersistentSettings, "benchmark", "1");
   while (state.KeepRunning()) {
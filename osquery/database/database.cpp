@@ -8,7 +8,12 @@
  *
  */
 
-#include <set>
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <unordered_map>
 
 #include <boost/lexical_cast.hpp>
 #include <boost/property_tree/json_parser.hpp>
@@ -16,6 +21,9 @@
 #include <osquery/database.h>
 #include <osquery/logger.h>
 
+#include "osquery/core/json.h"
+#include "osquery/core/tracing.h"
+
 namespace pt = boost::property_tree;
 
 namespace osquery {
@@ -38,6 +46,11 @@ CLI_FLAG(bool,
 FLAG_ALIAS(bool, use_in_memory_database, database_in_memory);
 
 FLAG(bool, disable_database, false, "Disable the persistent RocksDB storage");
+
+CLI_FLAG(uint64,
+         database_cache_size,
+         0,
+         "MB of block cache shared by the RocksDB domains (0 = per-table)");
 DECLARE_bool(decorations_top_level);
 
 #if defined(SKIP_ROCKSDB)
@@ -51,9 +64,10 @@ const std::string kPersistentSettings = "configurations";
 const std::string kQueries = "queries";
 const std::string kEvents = "events";
 const std::string kLogs = "logs";
+const std::string kHashes = "hashes";
 
-const std::vector<std::string> kDomains = {kPersistentSettings, kQueries,
-                                           kEvents, kLogs};
+const std::vector<std::string> kDomains = {
+    kPersistentSettings, kQueries, kEvents, kLogs, kHashes};
 
 bool DatabasePlugin::kDBHandleOptionAllowOpen(false);
 bool DatabasePlugin::kDBHandleOptionRequireWrite(false);
@@ -65,6 +79,36 @@ std::atomic<bool> DatabasePlugin::kCheckingDB(false);
 // respective value
 /////////////////////////////////////////////////////////////////////////////
 
+/// FNV-1a 64-bit parameters.
+const RowHash kRowHashOffset = 0xcbf29ce484222325ULL;
+const RowHash kRowHashPrime = 0x100000001b3ULL;
+
+static inline void hashRowBytes(RowHash& h, const char* data, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    h ^= static_cast<unsigned char>(data[i]);
+    h *= kRowHashPrime;
+  }
+}
+
+static inline void hashRowString(RowHash& h, const std::string& s) {
+  // Prefix with the length so adjacent fields cannot shift into each other.
+  auto size = static_cast<uint64_t>(s.size());
+  for (size_t i = 0; i < sizeof(size); i++) {
+    h ^= static_cast<unsigned char>((size >> (i * 8)) & 0xFF);
+    h *= kRowHashPrime;
+  }
+  hashRowBytes(h, s.data(), s.size());
+}
+
+RowHash hashRow(const Row& r) {
+  RowHash h = kRowHashOffset;
+  for (const auto& column : r) {
+    hashRowString(h, column.first);
+    hashRowString(h, column.second);
+  }
+  return h;
+}
+
 Status serializeRow(const Row& r, pt::ptree& tree) {
   try {
     for (auto& i : r) {
@@ -76,21 +120,50 @@ Status serializeRow(const Row& r, pt::ptree& tree) {
   return Status(0, "OK");
 }
 
-Status serializeRowJSON(const Row& r, std::string& json) {
-  pt::ptree tree;
-  auto status = serializeRow(r, tree);
-  if (!status.ok()) {
-    return status;
+/**
+ * @brief Write the members of a row into an open JSON object.
+ *
+ * The JSON serializers write directly, without building a property tree, and
+ * produce the same output as the property tree writer. Like a property tree,
+ * an empty row or result set nested within a document is an empty string.
+ */
+static void writeRowMembers(JSONWriter& writer, const Row& r) {
+  for (const auto& column : r) {
+    writer.member(column.first, column.second);
   }
+}
 
-  std::ostringstream output;
-  try {
-    pt::write_json(output, tree, false);
-  } catch (const pt::json_parser::json_parser_error& e) {
-    // The content could not be represented as JSON.
-    return Status(1, e.what());
+static void writeRowJSON(JSONWriter& writer, const Row& r) {
+  if (r.empty()) {
+    writer.value("");
+    return;
+  }
+
+  writer.startObject();
+  writeRowMembers(writer, r);
+  writer.endObject();
+}
+
+void serializeQueryDataJSON(const QueryData& q, JSONWriter& writer) {
+  if (q.empty()) {
+    writer.value("");
+    return;
+  }
+
+  writer.startArray();
+  for (const auto& r : q) {
+    writeRowJSON(writer, r);
   }
-  json = output.str();
+  writer.endArray();
+}
+
+Status serializeRowJSON(const Row& r, std::string& json) {
+  json.clear();
+  JSONWriter writer(json);
+  writer.startObject();
+  writeRowMembers(writer, r);
+  writer.endObject();
+  writer.finish();
   return Status(0, "OK");
 }
 
@@ -103,16 +176,91 @@ Status deserializeRow(const pt::ptree& tree, Row& r) {
   return Status(0, "OK");
 }
 
+/**
+ * @brief Build rows while parsing, without an intermediate property tree.
+ *
+ * Rows are the objects at a given depth, each member at the next depth is a
+ * column. As with deserializeRow, members without a name are skipped and a
+ * nested object or array is an empty column. Other values at the row depth,
+ * such as the empty string written for an empty row, are empty rows.
+ */
+class RowsJSONHandler : public JSONHandler {
+ public:
+  /**
+   * @param depth The depth of rows, 1 if the document is a row.
+   * @param rows The output rows.
+   */
+  RowsJSONHandler(size_t depth, QueryData& rows)
+      : row_depth_(depth), rows_(rows) {}
+
+  void key(std::string& name) override {
+    if (depth_ == row_depth_) {
+      column_ = std::move(name);
+    }
+  }
+
+  void value(std::string& value) override {
+    if (depth_ == row_depth_) {
+      setColumn(std::move(value));
+    } else if (depth_ + 1 == row_depth_) {
+      rows_.push_back(Row());
+    }
+  }
+
+  void startObject() override { start(); }
+
+  void endObject() override { depth_--; }
+
+  void startArray() override { start(); }
+
+  void endArray() override { depth_--; }
+
+ private:
+  void start() {
+    if (depth_ == row_depth_) {
+      setColumn("");
+    } else if (depth_ + 1 == row_depth_) {
+      rows_.push_back(Row());
+    }
+    depth_++;
+  }
+
+  void setColumn(std::string&& value) {
+    // Values within an array have no name, a name is used once.
+    if (!column_.empty() && !rows_.empty()) {
+      rows_.back()[column_] = std::move(value);
+    }
+    column_.clear();
+  }
+
+ private:
+  /// The depth of the containers currently open.
+  size_t depth_{0};
+
+  /// The depth of a row's columns.
+  size_t row_depth_{0};
+
+  /// The name of the next column.
+  std::string column_;
+
+  QueryData& rows_;
+};
+
 Status deserializeRowJSON(const std::string& json, Row& r) {
-  pt::ptree tree;
-  try {
-    std::stringstream input;
-    input << json;
-    pt::read_json(input, tree);
-  } catch (const pt::json_parser::json_parser_error& e) {
-    return Status(1, e.what());
+  // The document is a single row, the root container.
+  QueryData rows;
+  RowsJSONHandler handler(1, rows);
+  auto status = parseJSON(json, handler);
+  if (!status.ok()) {
+    return status;
+  }
+
+  if (!rows.empty()) {
+    for (auto& column : rows.front()) {
+      r[column.first] = std::move(column.second);
+    }
   }
-  return deserializeRow(tree, r);
+  return Status(0, "OK");
 }
 
 /////////////////////////////////////////////////////////////////////////////
@@ -133,20 +281,17 @@ Status serializeQueryData(const QueryData& q, pt::ptree& tree) {
 }
 
 Status serializeQueryDataJSON(const QueryData& q, std::string& json) {
-  pt::ptree tree;
-  auto status = serializeQueryData(q, tree);
-  if (!status.ok()) {
-    return status;
-  }
+  json.clear();
+  JSONWriter writer(json);
 
-  std::ostringstream output;
-  try {
-    pt::write_json(output, tree, false);
-  } catch (const pt::json_parser::json_parser_error& e) {
-    // The content could not be represented as JSON.
-    return Status(1, e.what());
+  // A property tree document root is an object, rows have empty names.
+  writer.startObject();
+  for (const auto& r : q) {
+    writer.key("");
+    writeRowJSON(writer, r);
   }
-  json = output.str();
+  writer.endObject();
+  writer.finish();
   return Status(0, "OK");
 }
 
@@ -163,15 +308,235 @@ Status deserializeQueryData(const pt::ptree& tree, QueryData& qd) {
 }
 
 Status deserializeQueryDataJSON(const std::string& json, QueryData& qd) {
-  pt::ptree tree;
-  try {
-    std::stringstream input;
-    input << json;
-    pt::read_json(input, tree);
-  } catch (const pt::json_parser::json_parser_error& e) {
-    return Status(1, e.what());
+  // The document is an object or array of rows.
+  QueryData rows;
+  RowsJSONHandler handler(2, rows);
+  auto status = parseJSON(json, handler);
+  if (!status.ok()) {
+    return status;
+  }
+
+  if (qd.empty()) {
+    qd = std::move(rows);
+  } else {
+    std::move(rows.begin(), rows.end(), std::back_inserter(qd));
+  }
+  return Status(0, "OK");
+}
+
+/// Append an unsigned LEB128 varint.
+static inline void writeVarint(std::string& out, size_t value) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<char>(value));
+}
+
+/// Read an unsigned LEB128 varint, advancing the offset.
+static inline bool readVarint(const std::string& in,
+                              size_t& offset,
+                              size_t& value) {
+  value = 0;
+  for (size_t shift = 0; offset < in.size() && shift < 64; shift += 7) {
+    auto byte = static_cast<unsigned char>(in[offset++]);
+    value |= static_cast<size_t>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
   }
-  return deserializeQueryData(tree, qd);
+  return false;
+}
+
+/// Read a varint length-prefixed string, advancing the offset.
+static inline bool readBytes(const std::string& in,
+                             size_t& offset,
+                             std::string& value) {
+  size_t size = 0;
+  if (!readVarint(in, offset, size) || size > in.size() - offset) {
+    return false;
+  }
+  value.assign(in, offset, size);
+  offset += size;
+  return true;
+}
+
+Status serializeQueryDataBinary(const QueryData& q, std::string& binary) {
+  // Column names are written once, rows refer to them by index.
+  std::unordered_map<std::string, size_t> names;
+  std::vector<const std::string*> ordered;
+  for (const auto& r : q) {
+    for (const auto& column : r) {
+      if (names.emplace(column.first, ordered.size()).second) {
+        ordered.push_back(&column.first);
+      }
+    }
+  }
+
+  binary.clear();
+  writeVarint(binary, ordered.size());
+  for (const auto& name : ordered) {
+    writeVarint(binary, name->size());
+    binary.append(*name);
+  }
+
+  writeVarint(binary, q.size());
+  for (const auto& r : q) {
+    writeVarint(binary, r.size());
+    for (const auto& column : r) {
+      writeVarint(binary, names.at(column.first));
+      writeVarint(binary, column.second.size());
+      binary.append(column.second);
+    }
+  }
+  return Status(0, "OK");
+}
+
+Status deserializeQueryDataBinary(const std::string& binary, QueryData& qd) {
+  size_t offset = 0;
+  size_t count = 0;
+  if (!readVarint(binary, offset, count) || count > binary.size()) {
+    return Status(1, "Invalid column count");
+  }
+
+  std::vector<std::string> names(count);
+  for (auto& name : names) {
+    if (!readBytes(binary, offset, name)) {
+      return Status(1, "Invalid column name");
+    }
+  }
+
+  if (!readVarint(binary, offset, count) || count > binary.size()) {
+    return Status(1, "Invalid row count");
+  }
+
+  QueryData results;
+  results.reserve(count);
+  for (size_t i = 0; i < count; i++) {
+    size_t columns = 0;
+    if (!readVarint(binary, offset, columns)) {
+      return Status(1, "Invalid row");
+    }
+
+    Row r;
+    for (size_t j = 0; j < columns; j++) {
+      size_t index = 0;
+      if (!readVarint(binary, offset, index) || index >= names.size() ||
+          !readBytes(binary, offset, r[names[index]])) {
+        return Status(1, "Invalid row column");
+      }
+    }
+    results.push_back(std::move(r));
+  }
+
+  if (offset != binary.size()) {
+    return Status(1, "Unexpected trailing content");
+  }
+  qd = std::move(results);
+  return Status(0, "OK");
+}
+
+Status serializeQueryDataColumns(const QueryData& q, std::string& binary) {
+  std::map<std::string, size_t> names;
+  for (const auto& r : q) {
+    for (const auto& column : r) {
+      names.emplace(column.first, names.size());
+    }
+  }
+
+  binary.clear();
+  writeVarint(binary, names.size());
+  for (const auto& name : names) {
+    writeVarint(binary, name.first.size());
+    binary.append(name.first);
+  }
+  writeVarint(binary, q.size());
+
+  // Each column is a dictionary of its values, then each row's value index.
+  // Index 0 is a row without the column.
+  std::unordered_map<std::string, size_t> dictionary;
+  std::vector<const std::string*> values;
+  std::vector<size_t> indexes;
+  for (const auto& name : names) {
+    dictionary.clear();
+    values.clear();
+    indexes.clear();
+    indexes.reserve(q.size());
+    for (const auto& r : q) {
+      auto column = r.find(name.first);
+      if (column == r.end()) {
+        indexes.push_back(0);
+        continue;
+      }
+      auto value = dictionary.emplace(column->second, values.size() + 1);
+      if (value.second) {
+        values.push_back(&column->second);
+      }
+      indexes.push_back(value.first->second);
+    }
+
+    writeVarint(binary, values.size());
+    for (const auto& value : values) {
+      writeVarint(binary, value->size());
+      binary.append(*value);
+    }
+    for (const auto& index : indexes) {
+      writeVarint(binary, index);
+    }
+  }
+  return Status(0, "OK");
+}
+
+Status deserializeQueryDataColumns(const std::string& binary, QueryData& qd) {
+  size_t offset = 0;
+  size_t count = 0;
+  if (!readVarint(binary, offset, count) || count > binary.size()) {
+    return Status(1, "Invalid column count");
+  }
+
+  std::vector<std::string> names(count);
+  for (auto& name : names) {
+    if (!readBytes(binary, offset, name)) {
+      return Status(1, "Invalid column name");
+    }
+  }
+
+  // Every row has an index in every column, unless no row has columns.
+  size_t max_rows = (names.empty()) ? (1 << 20) : binary.size();
+  if (!readVarint(binary, offset, count) || count > max_rows) {
+    return Status(1, "Invalid row count");
+  }
+  QueryData results(count);
+
+  std::vector<std::string> values;
+  for (const auto& name : names) {
+    size_t size = 0;
+    if (!readVarint(binary, offset, size) || size > binary.size()) {
+      return Status(1, "Invalid column dictionary");
+    }
+    values.resize(size);
+    for (auto& value : values) {
+      if (!readBytes(binary, offset, value)) {
+        return Status(1, "Invalid column value");
+      }
+    }
+
+    for (auto& r : results) {
+      size_t index = 0;
+      if (!readVarint(binary, offset, index) || index > values.size()) {
+        return Status(1, "Invalid row column");
+      }
+      if (index > 0) {
+        r[name] = values[index - 1];
+      }
+    }
+  }
+
+  if (offset != binary.size()) {
+    return Status(1, "Unexpected trailing content");
+  }
+  qd = std::move(results);
+  return Status(0, "OK");
 }
 
 /////////////////////////////////////////////////////////////////////////////
@@ -194,6 +559,16 @@ Status serializeDiffResults(const DiffResults& d, pt::ptree& tree) {
     return status;
   }
   tree.add_child("removed", removed);
+
+  // Only queries with key columns have changed rows, keep the others as-is.
+  if (!d.changed.empty()) {
+    pt::ptree changed;
+    status = serializeQueryData(d.changed, changed);
+    if (!status.ok()) {
+      return status;
+    }
+    tree.add_child("changed", changed);
+  }
   return Status(0, "OK");
 }
 
@@ -211,48 +586,180 @@ Status deserializeDiffResults(const pt::ptree& tree, DiffResults& dr) {
       return status;
     }
   }
+
+  if (tree.count("changed") > 0) {
+    auto status = deserializeQueryData(tree.get_child("changed"), dr.changed);
+    if (!status.ok()) {
+      return status;
+    }
+  }
   return Status(0, "OK");
 }
 
+static void writeDiffResultsMembers(JSONWriter& writer, const DiffResults& d) {
+  writer.key("added");
+  serializeQueryDataJSON(d.added, writer);
+  writer.key("removed");
+  serializeQueryDataJSON(d.removed, writer);
+  if (!d.changed.empty()) {
+    writer.key("changed");
+    serializeQueryDataJSON(d.changed, writer);
+  }
+}
+
 Status serializeDiffResultsJSON(const DiffResults& d, std::string& json) {
-  pt::ptree tree;
-  auto status = serializeDiffResults(d, tree);
-  if (!status.ok()) {
-    return status;
+  json.clear();
+  JSONWriter writer(json);
+  writer.startObject();
+  writeDiffResultsMembers(writer, d);
+  writer.endObject();
+  writer.finish();
+  return Status(0, "OK");
+}
+
+DiffIndexes diffIndexes(const QueryData& old, const QueryData& current) {
+  DiffIndexes r;
+
+  // Fingerprint each previous row once, mapping a fingerprint to the indexes
+  // of all previous rows sharing it (duplicate rows or hash collisions).
+  std::unordered_map<RowHash, std::vector<size_t>> old_index;
+  old_index.reserve(old.size());
+  for (size_t i = 0; i < old.size(); i++) {
+    old_index[hashRow(old[i])].push_back(i);
   }
 
-  std::ostringstream output;
-  try {
-    pt::write_json(output, tree, false);
-  } catch (const pt::json_parser::json_parser_error& e) {
-    // The content could not be represented as JSON.
-    return Status(1, e.what());
+  for (size_t i = 0; i < current.size(); i++) {
+    const auto& row = current[i];
+    auto bucket = old_index.find(hashRow(row));
+    if (bucket == old_index.end()) {
+      r.added.push_back(i);
+      continue;
+    }
+
+    // Resolve collisions with a full comparison, consuming the matched row.
+    auto& indexes = bucket->second;
+    auto match = std::find_if(indexes.begin(),
+                              indexes.end(),
+                              [&old, &row](size_t i) { return old[i] == row; });
+    if (match == indexes.end()) {
+      r.added.push_back(i);
+      continue;
+    }
+
+    *match = indexes.back();
+    indexes.pop_back();
+    if (indexes.empty()) {
+      old_index.erase(bucket);
+    }
   }
-  json = output.str();
-  return Status(0, "OK");
+
+  // Any previous rows left unmatched were removed, report them in order.
+  for (const auto& bucket : old_index) {
+    r.removed.insert(
+        r.removed.end(), bucket.second.begin(), bucket.second.end());
+  }
+  std::sort(r.removed.begin(), r.removed.end());
+  return r;
 }
 
 DiffResults diff(const QueryData& old, const QueryData& current) {
+  auto indexes = diffIndexes(old, current);
   DiffResults r;
-  QueryData overlap;
+  r.added.reserve(indexes.added.size());
+  for (const auto& i : indexes.added) {
+    r.added.push_back(current[i]);
+  }
+  r.removed.reserve(indexes.removed.size());
+  for (const auto& i : indexes.removed) {
+    r.removed.push_back(old[i]);
+  }
+  return r;
+}
 
-  for (const auto& i : current) {
-    auto item = std::find(old.begin(), old.end(), i);
-    if (item != old.end()) {
-      overlap.push_back(i);
-    } else {
-      r.added.push_back(i);
+/**
+ * @brief Encode the key columns of a row as one string.
+ *
+ * Each value is prefixed with its length so that keys cannot collide across
+ * column boundaries. Returns false if the row is missing a key column.
+ */
+static bool rowKey(const Row& row,
+                   const std::vector<std::string>& keys,
+                   std::string& key) {
+  key.clear();
+  for (const auto& column : keys) {
+    auto value = row.find(column);
+    if (value == row.end()) {
+      return false;
+    }
+    key += std::to_string(value->second.size());
+    key += ':';
+    key += value->second;
+  }
+  return true;
+}
+
+/// Move the rows not marked as matched to the front, preserving their order.
+static void eraseMatched(QueryData& rows, const std::vector<bool>& matched) {
+  size_t kept = 0;
+  for (size_t i = 0; i < rows.size(); i++) {
+    if (!matched[i]) {
+      if (kept != i) {
+        rows[kept] = std::move(rows[i]);
+      }
+      kept++;
     }
   }
+  rows.resize(kept);
+}
 
-  std::multiset<Row> overlap_set(overlap.begin(), overlap.end());
-  std::multiset<Row> old_set(old.begin(), old.end());
-  std::set_difference(old_set.begin(),
-                      old_set.end(),
-                      overlap_set.begin(),
-                      overlap_set.end(),
-                      std::back_inserter(r.removed));
-  return r;
+void matchDiffKeys(DiffResults& dr, const std::vector<std::string>& keys) {
+  if (keys.empty() || dr.added.empty() || dr.removed.empty()) {
+    return;
+  }
+
+  // Index the removed rows by key, with the earliest row of a key last so
+  // that equal keys are matched in order.
+  std::unordered_map<std::string, std::vector<size_t>> removed_index;
+  removed_index.reserve(dr.removed.size());
+  std::string key;
+  for (size_t i = dr.removed.size(); i > 0; i--) {
+    if (rowKey(dr.removed[i - 1], keys, key)) {
+      removed_index[key].push_back(i - 1);
+    }
+  }
+
+  std::vector<bool> added_matched(dr.added.size(), false);
+  std::vector<bool> removed_matched(dr.removed.size(), false);
+  for (size_t i = 0; i < dr.added.size(); i++) {
+    if (!rowKey(dr.added[i], keys, key)) {
+      continue;
+    }
+    auto bucket = removed_index.find(key);
+    if (bucket == removed_index.end() || bucket->second.empty()) {
+      continue;
+    }
+
+    // Consume the earliest removed row with this key.
+    auto& indexes = bucket->second;
+    const auto& previous = dr.removed[indexes.back()];
+    removed_matched[indexes.back()] = true;
+    indexes.pop_back();
+    added_matched[i] = true;
+
+    // The rows differ, keep the key columns and the modified columns.
+    Row change;
+    for (auto& column : dr.added[i]) {
+      auto value = previous.find(column.first);
+      if (value == previous.end() || value->second != column.second ||
+          std::find(keys.begin(), keys.end(), column.first) != keys.end()) {
+        change.emplace(column.first, std::move(column.second));
+      }
+    }
+    dr.changed.push_back(std::move(change));
+  }
+
+  eraseMatched(dr.added, added_matched);
+  eraseMatched(dr.removed, removed_matched);
 }
 
 /////////////////////////////////////////////////////////////////////////////
@@ -298,7 +805,7 @@ inline void getLegacyFieldsAndDecorations(const pt::ptree& tree,
 
 Status serializeQueryLogItem(const QueryLogItem& item, pt::ptree& tree) {
   pt::ptree results_tree;
-  if (item.results.added.size() > 0 || item.results.removed.size() > 0) {
+  if (!item.results.empty()) {
     auto status = serializeDiffResults(item.results, results_tree);
     if (!status.ok()) {
       return status;
@@ -317,21 +824,84 @@ Status serializeQueryLogItem(const QueryLogItem& item, pt::ptree& tree) {
   return Status(0, "OK");
 }
 
-Status serializeQueryLogItemJSON(const QueryLogItem& i, std::string& json) {
-  pt::ptree tree;
-  auto status = serializeQueryLogItem(i, tree);
-  if (!status.ok()) {
-    return status;
+/**
+ * @brief Write the legacy fields and decorations of a log item.
+ *
+ * The writer equivalent of addLegacyFieldsAndDecorations. Top level
+ * decorations replace the value of a field with the same name, as a property
+ * tree put would, and are otherwise written after the fields.
+ *
+ * @param written The member names already written into the object.
+ */
+static void writeLegacyFieldsAndDecorations(
+    JSONWriter& writer,
+    const QueryLogItem& item,
+    std::vector<std::string> written) {
+  const auto& decorations = item.decorations;
+  auto field = [&](const std::string& name, const std::string& value) {
+    auto decoration = decorations.find(name);
+    if (FLAGS_decorations_top_level && decoration != decorations.end()) {
+      writer.member(name, decoration->second);
+    } else {
+      writer.member(name, value);
+    }
+    written.push_back(name);
+  };
+
+  field("name", item.name);
+  field("hostIdentifier", item.identifier);
+  field("calendarTime", item.calendar_time);
+  field("unixTime", std::to_string(static_cast<int>(item.time)));
+
+  if (decorations.empty()) {
+    return;
   }
 
-  std::ostringstream output;
-  try {
-    pt::write_json(output, tree, false);
-  } catch (const pt::json_parser::json_parser_error& e) {
-    // The content could not be represented as JSON.
-    return Status(1, e.what());
+  if (!FLAGS_decorations_top_level) {
+    writer.key("decorations");
+    if (item.decorations_json != nullptr) {
+      writer.raw(*item.decorations_json);
+      return;
+    }
+    writer.startObject();
+    for (const auto& name : decorations) {
+      writer.member(name.first, name.second);
+    }
+    writer.endObject();
+    return;
+  }
+
+  for (const auto& name : decorations) {
+    if (std::find(written.begin(), written.end(), name.first) ==
+        written.end()) {
+      writer.member(name.first, name.second);
+    }
+  }
+}
+
+Status serializeQueryLogItemJSON(const QueryLogItem& i, std::string& json) {
+  OSQUERY_TRACE_SPAN("serializeQueryLogItemJSON");
+  json.clear();
+  JSONWriter writer(json);
+  writer.startObject();
+  if (!i.results.empty()) {
+    writer.key("diffResults");
+    writer.startObject();
+    writeDiffResultsMembers(writer, i.results);
+    writer.endObject();
+    writeLegacyFieldsAndDecorations(writer, i, {"diffResults"});
+  } else {
+    writer.key("snapshot");
+    serializeQueryDataJSON(i.snapshot_results, writer);
+    auto action = i.decorations.find("action");
+    writer.member("action",
+                  (FLAGS_decorations_top_level && action != i.decorations.end())
+                      ? action->second
+                      : "snapshot");
+    writeLegacyFieldsAndDecorations(writer, i, {"snapshot", "action"});
   }
-  json = output.str();
+  writer.endObject();
+  writer.finish();
   return Status(0, "OK");
 }
 
@@ -405,21 +975,35 @@ Status serializeQueryLogItemAsEvents(const QueryLogItem& i, pt::ptree& tree) {
 
 Status serializeQueryLogItemAsEventsJSON(const QueryLogItem& i,
                                          std::vector<std::string>& items) {
-  pt::ptree tree;
-  auto status = serializeQueryLogItemAsEvents(i, tree);
-  if (!status.ok()) {
-    return status;
+  // The fields and decorations are shared by every event, write them once.
+  std::string envelope;
+  {
+    JSONWriter writer(envelope);
+    writer.startObject();
+    writeLegacyFieldsAndDecorations(writer, i, {"columns", "action"});
+    writer.key("columns");
   }
 
-  for (auto& event : tree) {
-    std::ostringstream output;
-    try {
-      pt::write_json(output, event.second, false);
-    } catch (const pt::json_parser::json_parser_error& e) {
-      return Status(1, e.what());
+  // Each event is the envelope, the row's columns, and the action.
+  auto serialize = [&envelope, &items](const QueryData& q,
+                                       const std::string& action) {
+    auto suffix = ",\"action\":\"" + action + "\"}\n";
+    for (const auto& r : q) {
+      std::string json;
+      json.reserve(envelope.size() + suffix.size() + r.size() * 32);
+      json += envelope;
+      JSONWriter writer(json);
+      writeRowJSON(writer, r);
+      json += suffix;
+      items.push_back(std::move(json));
     }
-    items.push_back(output.str());
-  }
+  };
+
+  items.reserve(items.size() + i.results.added.size() +
+                i.results.removed.size() + i.results.changed.size());
+  serialize(i.results.added, "added");
+  serialize(i.results.removed, "removed");
+  serialize(i.results.changed, "changed");
   return Status(0, "OK");
 }
 
@@ -431,6 +1015,75 @@ bool addUniqueRowToQueryData(QueryData& q, const Row& r) {
   return true;
 }
 
+/// Values below this are counted exactly, see PerformanceHistogram.
+const unsigned long long kHistogramExactValues = 16;
+
+/// The number of buckets for each power of two above the exact values.
+const size_t kHistogramSubBuckets = 8;
+
+static size_t histogramBucket(unsigned long long value) {
+  if (value < kHistogramExactValues) {
+    return static_cast<size_t>(value);
+  }
+
+  // The bucket is chosen by the highest set bit and the following 3 bits.
+  size_t exponent = 4;
+  while (exponent < 63 && (value >> (exponent + 1)) > 0) {
+    exponent++;
+  }
+  auto sub = static_cast<size_t>(value >> (exponent - 3)) &
+             (kHistogramSubBuckets - 1);
+  return kHistogramExactValues + (exponent - 4) * kHistogramSubBuckets + sub;
+}
+
+static unsigned long long histogramBucketUpper(size_t bucket) {
+  if (bucket < kHistogramExactValues) {
+    return bucket;
+  }
+
+  size_t exponent = (bucket - kHistogramExactValues) / kHistogramSubBuckets + 4;
+  unsigned long long sub =
+      (bucket - kHistogramExactValues) % kHistogramSubBuckets;
+  unsigned long long width = 1ULL << (exponent - 3);
+  return (kHistogramSubBuckets + sub) * width + width - 1;
+}
+
+void PerformanceHistogram::record(unsigned long long value) {
+  auto bucket = histogramBucket(value);
+  if (bucket >= buckets_.size()) {
+    buckets_.resize(bucket + 1, 0);
+  }
+  buckets_[bucket]++;
+  count_++;
+  max_ = std::max(max_, value);
+}
+
+unsigned long long PerformanceHistogram::percentile(double percent) const {
+  if (count_ == 0) {
+    return 0;
+  }
+
+  // The rank of the value within the sorted values, starting at 1.
+  auto rank = static_cast<size_t>(std::ceil(percent / 100 * count_));
+  rank = std::min(std::max(rank, static_cast<size_t>(1)), count_);
+  size_t seen = 0;
+  for (size_t bucket = 0; bucket < buckets_.size(); ++bucket) {
+    seen += buckets_[bucket];
+    if (seen >= rank) {
+      return std::min(histogramBucketUpper(bucket), max_);
+    }
+  }
+  return max_;
+}
+
+/**
+ * @brief The resolved active database plugin.
+ *
+ * Every event and log line reads or writes the database, the registry lookup
+ * is repeated only when the registry changes.
+ */
+static RegistryHandle kActiveDatabasePlugin("database");
+
 bool DatabasePlugin::initPlugin() {
   // Initialize the database plugin using the flag.
   auto plugin = (FLAGS_disable_database) ? "ephemeral" : kInternalDatabase;
@@ -438,6 +1091,8 @@ bool DatabasePlugin::initPlugin() {
 }
 
 void DatabasePlugin::shutdown() {
+  // Release the resolved plugin with the registry's references.
+  kActiveDatabasePlugin.reset();
   auto datbase_registry = Registry::registry("database");
   for (auto& plugin : datbase_registry->names()) {
     datbase_registry->remove(plugin);
@@ -508,13 +1163,100 @@ Status DatabasePlugin::call(const PluginRequest& request,
   return Status(1, "Unknown database plugin action");
 }
 
-static inline std::shared_ptr<DatabasePlugin> getDatabasePlugin() {
-  if (!Registry::exists("database", Registry::getActive("database"), true)) {
-    return nullptr;
+Status DatabasePlugin::putBatch(const std::string& domain,
+                                const DatabaseStringValueList& data) {
+  for (const auto& item : data) {
+    auto status = put(domain, item.first, item.second);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  return Status(0, "OK");
+}
+
+Status DatabasePlugin::scan(const std::string& domain,
+                            const std::string& prefix,
+                            const DatabaseScanCallback& callback,
+                            size_t max) const {
+  std::vector<std::string> keys;
+  auto status = scan(domain, keys, prefix, max);
+  for (const auto& key : keys) {
+    if (!callback(key)) {
+      break;
+    }
+  }
+  return status;
+}
+
+Status DatabasePlugin::getBatch(const std::string& domain,
+                                const std::vector<std::string>& keys,
+                                std::vector<std::string>& values) const {
+  values.assign(keys.size(), "");
+  for (size_t i = 0; i < keys.size(); i++) {
+    // A missing key leaves an empty value.
+    get(domain, keys[i], values[i]);
   }
+  return Status(0, "OK");
+}
 
-  auto plugin = Registry::get("database", Registry::getActive("database"));
-  return std::dynamic_pointer_cast<DatabasePlugin>(plugin);
+Status DatabasePlugin::removeBatch(const std::string& domain,
+                                   const std::vector<std::string>& keys) {
+  for (const auto& key : keys) {
+    auto status = remove(domain, key);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  return Status(0, "OK");
+}
+
+/// The keys from low (inclusive) to high (exclusive) using a prefix scan.
+static Status scanRange(const DatabasePlugin* plugin,
+                        const std::string& domain,
+                        const std::string& low,
+                        const std::string& high,
+                        std::vector<std::string>& keys) {
+  size_t common = 0;
+  while (common < low.size() && common < high.size() &&
+         low[common] == high[common]) {
+    common++;
+  }
+
+  std::vector<std::string> scanned;
+  Status status;
+  if (plugin != nullptr) {
+    status = plugin->scan(domain, scanned, low.substr(0, common));
+  } else {
+    status = scanDatabaseKeys(domain, scanned, low.substr(0, common));
+  }
+  for (auto& key : scanned) {
+    if (key >= low && key < high) {
+      keys.push_back(std::move(key));
+    }
+  }
+  return status;
+}
+
+Status DatabasePlugin::removeRange(const std::string& domain,
+                                   const std::string& low,
+                                   const std::string& high) {
+  std::vector<std::string> keys;
+  auto status = scanRange(this, domain, low, high, keys);
+  if (!status.ok()) {
+    return status;
+  }
+
+  for (const auto& key : keys) {
+    status = remove(domain, key);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  return Status(0, "OK");
+}
+
+static inline std::shared_ptr<DatabasePlugin> getDatabasePlugin() {
+  return kActiveDatabasePlugin.get<DatabasePlugin>();
 }
 
 Status getDatabaseValue(const std::string& domain,
@@ -526,7 +1268,7 @@ Status getDatabaseValue(const std::string& domain,
     PluginRequest request = {
         {"action", "get"}, {"domain", domain}, {"key", key}};
     PluginResponse response;
-    auto status = Registry::call("database", request, response);
+    auto status = kActiveDatabasePlugin.call(request, response);
     if (status.ok()) {
       // Set value from the internally-known "v" key.
       if (response.size() > 0 && response[0].count("v") > 0) {
@@ -540,6 +1282,20 @@ Status getDatabaseValue(const std::string& domain,
   }
 }
 
+Status getDatabaseBatch(const std::string& domain,
+                        const std::vector<std::string>& keys,
+                        std::vector<std::string>& values) {
+  if (Registry::external()) {
+    // Extensions request each value, there is no batched registry action.
+    values.assign(keys.size(), "");
+    for (size_t i = 0; i < keys.size(); i++) {
+      getDatabaseValue(domain, keys[i], values[i]);
+    }
+    return Status(0, "OK");
+  }
+  return getDatabasePlugin()->getBatch(domain, keys, values);
+}
+
 Status setDatabaseValue(const std::string& domain,
                         const std::string& key,
                         const std::string& value) {
@@ -548,26 +1304,92 @@ Status setDatabaseValue(const std::string& domain,
     // It is not possible to use an extension-based database.
     PluginRequest request = {
         {"action", "put"}, {"domain", domain}, {"key", key}, {"value", value}};
-    return Registry::call("database", request);
+    return kActiveDatabasePlugin.call(request);
   } else {
     auto plugin = getDatabasePlugin();
     return plugin->put(domain, key, value);
   }
 }
 
+Status setDatabaseBatch(const std::string& domain,
+                        const DatabaseStringValueList& data) {
+  if (Registry::external()) {
+    // Extensions forward each value, there is no batched registry action.
+    for (const auto& item : data) {
+      auto status = setDatabaseValue(domain, item.first, item.second);
+      if (!status.ok()) {
+        return status;
+      }
+    }
+    return Status(0, "OK");
+  } else {
+    auto plugin = getDatabasePlugin();
+    return plugin->putBatch(domain, data);
+  }
+}
+
 Status deleteDatabaseValue(const std::string& domain, const std::string& key) {
   if (Registry::external()) {
     // External registries (extensions) do not have databases active.
     // It is not possible to use an extension-based database.
     PluginRequest request = {
         {"action", "remove"}, {"domain", domain}, {"key", key}};
-    return Registry::call("database", request);
+    return kActiveDatabasePlugin.call(request);
   } else {
     auto plugin = getDatabasePlugin();
     return plugin->remove(domain, key);
   }
 }
 
+Status deleteDatabaseBatch(const std::string& domain,
+                           const std::vector<std::string>& keys) {
+  if (Registry::external()) {
+    // Extensions forward each removal, there is no batched registry action.
+    for (const auto& key : keys) {
+      auto status = deleteDatabaseValue(domain, key);
+      if (!status.ok()) {
+        return status;
+      }
+    }
+    return Status(0, "OK");
+  } else {
+    auto plugin = getDatabasePlugin();
+    return plugin->removeBatch(domain, keys);
+  }
+}
+
+Status deleteDatabaseRange(const std::string& domain,
+                           const std::string& low,
+                           const std::string& high) {
+  if (Registry::external()) {
+    // Extensions forward each removal, there is no range registry action.
+    std::vector<std::string> keys;
+    auto status = scanRange(nullptr, domain, low, high, keys);
+    for (const auto& key : keys) {
+      if (!status.ok()) {
+        break;
+      }
+      status = deleteDatabaseValue(domain, key);
+    }
+    return status;
+  } else {
+    auto plugin = getDatabasePlugin();
+    return plugin->removeRange(domain, low, high);
+  }
+}
+
+Status getDatabaseStatistics(std::map<std::string, std::string>& stats) {
+  if (Registry::external()) {
+    return Status(1, "Database statistics are not available to extensions");
+  }
+
+  auto plugin = getDatabasePlugin();
+  if (plugin == nullptr) {
+    return Status(1, "No active database plugin");
+  }
+  return plugin->statistics(stats);
+}
+
 Status scanDatabaseKeys(const std::string& domain,
                         std::vector<std::string>& keys,
                         size_t max) {
@@ -587,7 +1409,7 @@ Status scanDatabaseKeys(const std::string& domain,
                              {"prefix", prefix},
                              {"max", std::to_string(max)}};
     PluginResponse response;
-    auto status = Registry::call("database", request, response);
+    auto status = kActiveDatabasePlugin.call(request, response);
 
     for (const auto& item : response) {
       if (item.count("k") > 0) {
@@ -601,6 +1423,24 @@ Status scanDatabaseKeys(const std::string& domain,
   }
 }
 
+Status scanDatabaseKeys(const std::string& domain,
+                        const std::string& prefix,
+                        const DatabaseScanCallback& callback,
+                        size_t max) {
+  if (Registry::external()) {
+    // Extensions receive the keys as a list.
+    std::vector<std::string> keys;
+    auto status = scanDatabaseKeys(domain, keys, prefix, max);
+    for (const auto& key : keys) {
+      if (!callback(key)) {
+        break;
+      }
+    }
+    return status;
+  }
+  return getDatabasePlugin()->scan(domain, prefix, callback, max);
+}
+
 void dumpDatabase() {
   for (const auto& domain : kDomains) {
     std::vector<std::string> keys;
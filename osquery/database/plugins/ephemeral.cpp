@@ -8,6 +8,13 @@
  *
  */
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <functional>
+#include <memory>
+
+#include <osquery/core.h>
 #include <osquery/database.h>
 #include <osquery/logger.h>
 
@@ -16,8 +23,38 @@ namespace osquery {
 DECLARE_string(database_path);
 DECLARE_bool(database_in_memory);
 
+/// Number of independently locked key ranges within each domain.
+const size_t kEphemeralStripes = 16;
+
 class EphemeralDatabasePlugin : public DatabasePlugin {
-  using DBType = std::map<std::string, std::map<std::string, std::string> >;
+  /// A stripe's keys, ordered for prefix scans.
+  struct Stripe {
+    Mutex lock;
+    std::map<std::string, std::string> data;
+  };
+
+  /**
+   * @brief A domain's keys, spread across stripes by a hash of each key.
+   *
+   * A key is always found in the same stripe, so a write only contends with
+   * the writes and reads of keys sharing its stripe. Scans visit each stripe
+   * in turn and merge the ordered keys.
+   */
+  struct Domain {
+    std::array<Stripe, kEphemeralStripes> stripes;
+
+    /// Bytes of keys and values stored.
+    std::atomic<size_t> bytes{0};
+
+    /// Number of keys stored.
+    std::atomic<size_t> keys{0};
+
+    Stripe& stripe(const std::string& key) {
+      return stripes[std::hash<std::string>()(key) % kEphemeralStripes];
+    }
+  };
+
+  using DomainRef = std::shared_ptr<Domain>;
 
  public:
   /// Data retrieval method.
@@ -25,55 +62,230 @@ class EphemeralDatabasePlugin : public DatabasePlugin {
              const std::string& key,
              std::string& value) const override;
 
+  /// Batched data retrieval method.
+  Status getBatch(const std::string& domain,
+                  const std::vector<std::string>& keys,
+                  std::vector<std::string>& values) const override;
+
   /// Data storage method.
   Status put(const std::string& domain,
              const std::string& key,
              const std::string& value) override;
 
+  /// Batched data storage method.
+  Status putBatch(const std::string& domain,
+                  const DatabaseStringValueList& data) override;
+
   /// Data removal method.
   Status remove(const std::string& domain, const std::string& k) override;
 
+  /// Batched data removal method.
+  Status removeBatch(const std::string& domain,
+                     const std::vector<std::string>& keys) override;
+
+  /// Ordered range removal, applied to each stripe.
+  Status removeRange(const std::string& domain,
+                     const std::string& low,
+                     const std::string& high) override;
+
   /// Key/index lookup method.
   Status scan(const std::string& domain,
               std::vector<std::string>& results,
               const std::string& prefix,
               size_t max = 0) const override;
 
+  /// Report the keys and bytes stored in each domain.
+  Status statistics(std::map<std::string, std::string>& stats) const override;
+
  public:
   /// Database workflow: open and setup.
   Status setUp() override {
-    DBType().swap(db_);
+    WriteLock lock(domains_lock_);
+    domains_.clear();
     return Status(0);
   }
 
  private:
-  DBType db_;
+  /// Find a domain, or nullptr if it has no keys yet.
+  DomainRef getDomain(const std::string& domain) const;
+
+  /// Find or create a domain.
+  DomainRef addDomain(const std::string& domain);
+
+  /// Store a key within a locked stripe, updating the domain's accounting.
+  static void putLocked(Domain& d,
+                        Stripe& stripe,
+                        const std::string& key,
+                        const std::string& value);
+
+  /// Remove a key from a locked stripe, updating the domain's accounting.
+  static void removeLocked(Domain& d,
+                           Stripe& stripe,
+                           std::map<std::string, std::string>::iterator it);
+
+ private:
+  /// Domains are only added or cleared under this lock, never removed.
+  mutable Mutex domains_lock_;
+
+  std::map<std::string, DomainRef> domains_;
 };
 
 /// Backing-storage provider for osquery internal/core.
 REGISTER_INTERNAL(EphemeralDatabasePlugin, "database", "ephemeral");
 
+EphemeralDatabasePlugin::DomainRef EphemeralDatabasePlugin::getDomain(
+    const std::string& domain) const {
+  WriteLock lock(domains_lock_);
+  auto it = domains_.find(domain);
+  return (it == domains_.end()) ? nullptr : it->second;
+}
+
+EphemeralDatabasePlugin::DomainRef EphemeralDatabasePlugin::addDomain(
+    const std::string& domain) {
+  WriteLock lock(domains_lock_);
+  auto& d = domains_[domain];
+  if (d == nullptr) {
+    d = std::make_shared<Domain>();
+  }
+  return d;
+}
+
+void EphemeralDatabasePlugin::putLocked(Domain& d,
+                                        Stripe& stripe,
+                                        const std::string& key,
+                                        const std::string& value) {
+  auto it = stripe.data.find(key);
+  if (it == stripe.data.end()) {
+    stripe.data.emplace(key, value);
+    d.keys++;
+    d.bytes += key.size() + value.size();
+    return;
+  }
+  d.bytes -= it->second.size();
+  d.bytes += value.size();
+  it->second = value;
+}
+
+void EphemeralDatabasePlugin::removeLocked(
+    Domain& d,
+    Stripe& stripe,
+    std::map<std::string, std::string>::iterator it) {
+  d.keys--;
+  d.bytes -= it->first.size() + it->second.size();
+  stripe.data.erase(it);
+}
+
 Status EphemeralDatabasePlugin::get(const std::string& domain,
                                     const std::string& key,
                                     std::string& value) const {
-  if (db_.count(domain) > 0 && db_.at(domain).count(key) > 0) {
-    value = db_.at(domain).at(key);
-    return Status(0);
-  } else {
+  auto d = getDomain(domain);
+  if (d == nullptr) {
     return Status(1);
   }
+
+  auto& stripe = d->stripe(key);
+  WriteLock lock(stripe.lock);
+  auto it = stripe.data.find(key);
+  if (it == stripe.data.end()) {
+    return Status(1);
+  }
+  value = it->second;
+  return Status(0);
+}
+
+Status EphemeralDatabasePlugin::getBatch(
+    const std::string& domain,
+    const std::vector<std::string>& keys,
+    std::vector<std::string>& values) const {
+  values.assign(keys.size(), "");
+  auto d = getDomain(domain);
+  if (d == nullptr) {
+    return Status(0);
+  }
+
+  for (size_t i = 0; i < keys.size(); i++) {
+    auto& stripe = d->stripe(keys[i]);
+    WriteLock lock(stripe.lock);
+    auto it = stripe.data.find(keys[i]);
+    if (it != stripe.data.end()) {
+      values[i] = it->second;
+    }
+  }
+  return Status(0);
 }
 
 Status EphemeralDatabasePlugin::put(const std::string& domain,
                                     const std::string& key,
                                     const std::string& value) {
-  db_[domain][key] = value;
+  auto d = addDomain(domain);
+  auto& stripe = d->stripe(key);
+  WriteLock lock(stripe.lock);
+  putLocked(*d, stripe, key, value);
+  return Status(0);
+}
+
+Status EphemeralDatabasePlugin::putBatch(const std::string& domain,
+                                         const DatabaseStringValueList& data) {
+  auto d = addDomain(domain);
+  for (const auto& item : data) {
+    auto& stripe = d->stripe(item.first);
+    WriteLock lock(stripe.lock);
+    putLocked(*d, stripe, item.first, item.second);
+  }
   return Status(0);
 }
 
 Status EphemeralDatabasePlugin::remove(const std::string& domain,
                                        const std::string& k) {
-  db_[domain].erase(k);
+  auto d = getDomain(domain);
+  if (d == nullptr) {
+    return Status(0);
+  }
+
+  auto& stripe = d->stripe(k);
+  WriteLock lock(stripe.lock);
+  auto it = stripe.data.find(k);
+  if (it != stripe.data.end()) {
+    removeLocked(*d, stripe, it);
+  }
+  return Status(0);
+}
+
+Status EphemeralDatabasePlugin::removeBatch(
+    const std::string& domain, const std::vector<std::string>& keys) {
+  auto d = getDomain(domain);
+  if (d == nullptr) {
+    return Status(0);
+  }
+
+  for (const auto& key : keys) {
+    auto& stripe = d->stripe(key);
+    WriteLock lock(stripe.lock);
+    auto it = stripe.data.find(key);
+    if (it != stripe.data.end()) {
+      removeLocked(*d, stripe, it);
+    }
+  }
+  return Status(0);
+}
+
+Status EphemeralDatabasePlugin::removeRange(const std::string& domain,
+                                            const std::string& low,
+                                            const std::string& high) {
+  auto d = getDomain(domain);
+  if (d == nullptr || high <= low) {
+    return Status(0);
+  }
+
+  for (auto& stripe : d->stripes) {
+    WriteLock lock(stripe.lock);
+    auto it = stripe.data.lower_bound(low);
+    while (it != stripe.data.end() && it->first < high) {
+      auto next = std::next(it);
+      removeLocked(*d, stripe, it);
+      it = next;
+    }
+  }
   return Status(0);
 }
 
@@ -81,21 +293,54 @@ Status EphemeralDatabasePlugin::scan(const std::string& domain,
                                      std::vector<std::string>& results,
                                      const std::string& prefix,
                                      size_t max) const {
-  if (db_.count(domain) == 0) {
+  auto d = getDomain(domain);
+  if (d == nullptr) {
     return Status(0);
   }
 
-  for (const auto& key : db_.at(domain)) {
-    if (!prefix.empty() &&
-        !(std::mismatch(prefix.begin(), prefix.end(), key.first.begin())
-              .first == prefix.end())) {
-      continue;
-    }
-    results.push_back(key.first);
-    if (max > 0 && results.size() >= max) {
-      break;
+  // Each stripe contributes its first max keys from the prefix onward.
+  std::vector<std::string> keys;
+  for (auto& stripe : d->stripes) {
+    WriteLock lock(stripe.lock);
+    size_t found = 0;
+    for (auto it = stripe.data.lower_bound(prefix); it != stripe.data.end();
+         ++it) {
+      if (it->first.compare(0, prefix.size(), prefix) != 0) {
+        break;
+      }
+      keys.push_back(it->first);
+      if (max > 0 && ++found >= max) {
+        break;
+      }
     }
   }
+
+  std::sort(keys.begin(), keys.end());
+  if (max > 0 && keys.size() > max) {
+    keys.resize(max);
+  }
+  results.insert(results.end(),
+                 std::make_move_iterator(keys.begin()),
+                 std::make_move_iterator(keys.end()));
   return Status(0);
 }
+
+Status EphemeralDatabasePlugin::statistics(
+    std::map<std::string, std::string>& stats) const {
+  size_t bytes = 0;
+  size_t keys = 0;
+  WriteLock lock(domains_lock_);
+  for (const auto& domain : domains_) {
+    auto& d = *domain.second;
+    stats["osquery.database.ephemeral." + domain.first + ".bytes"] =
+        std::to_string(d.bytes.load());
+    stats["osquery.database.ephemeral." + domain.first + ".keys"] =
+        std::to_string(d.keys.load());
+    bytes += d.bytes;
+    keys += d.keys;
+  }
+  stats["osquery.database.ephemeral.bytes"] = std::to_string(bytes);
+  stats["osquery.database.ephemeral.keys"] = std::to_string(keys);
+  return Status(0, "OK");
+}
 }
@@ -8,18 +8,33 @@
  *
  */
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
 #include <mutex>
+#include <thread>
 
 #include <sys/stat.h>
 
 #include <snappy.h>
 
+#include <rocksdb/cache.h>
 #include <rocksdb/db.h>
 #include <rocksdb/env.h>
+#include <rocksdb/filter_policy.h>
 #include <rocksdb/options.h>
+#include <rocksdb/slice_transform.h>
+#include <rocksdb/statistics.h>
+#include <rocksdb/table.h>
+#include <rocksdb/write_batch.h>
+
+#include <boost/algorithm/string.hpp>
 
 #include <osquery/database.h>
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 
 #include "osquery/filesystem/fileops.h"
@@ -28,6 +43,79 @@ namespace osquery {
 
 DECLARE_string(database_path);
 DECLARE_bool(database_in_memory);
+DECLARE_uint64(database_cache_size);
+
+CLI_FLAG(string,
+         database_profile,
+         "default",
+         "RocksDB column family tuning profile: default, workload");
+
+CLI_FLAG(uint64,
+         database_events_max_size,
+         256,
+         "With the workload profile, MB of event data kept by FIFO compaction");
+
+CLI_FLAG(uint64,
+         database_sync_milli,
+         0,
+         "Group commit RocksDB writes, syncing every N milliseconds");
+
+CLI_FLAG(string,
+         database_sync_domains,
+         "",
+         "Comma-separated domain:policy overrides (always, group, none)");
+
+CLI_FLAG(string,
+         database_compression,
+         "none",
+         "RocksDB compression: none, snappy, lz4, zstd");
+
+CLI_FLAG(string,
+         database_compression_domains,
+         "",
+         "Comma-separated domain:compression overrides");
+
+CLI_FLAG(uint64,
+         database_compression_dict,
+         0,
+         "KB of sampled data used as a compression dictionary for rows");
+
+const std::map<std::string, rocksdb::CompressionType> kRocksDBCompressions = {
+    {"none", rocksdb::kNoCompression},
+    {"snappy", rocksdb::kSnappyCompression},
+    {"lz4", rocksdb::kLZ4Compression},
+    {"zstd", rocksdb::kZSTD},
+};
+
+/// The durability of a domain's writes, see database_sync_milli.
+enum RocksDBSyncPolicy {
+  /// Each write is synced before it completes.
+  ROCKSDB_SYNC_ALWAYS,
+
+  /// Writes are synced together within database_sync_milli.
+  ROCKSDB_SYNC_GROUP,
+
+  /// Writes are synced when RocksDB chooses, or when the database closes.
+  ROCKSDB_SYNC_NONE,
+};
+
+const std::map<std::string, RocksDBSyncPolicy> kRocksDBSyncPolicies = {
+    {"always", ROCKSDB_SYNC_ALWAYS},
+    {"group", ROCKSDB_SYNC_GROUP},
+    {"none", ROCKSDB_SYNC_NONE},
+};
+
+/// Length of the key prefixes indexed by prefix filters, see getDomainOptions.
+const size_t kRocksDBPrefixLength = 16;
+
+/// Per-domain properties reported with the RocksDB statistics.
+const std::vector<std::string> kRocksDBDomainProperties = {
+    "rocksdb.estimate-num-keys",
+    "rocksdb.total-sst-files-size",
+    "rocksdb.cur-size-all-mem-tables",
+    "rocksdb.num-immutable-mem-table",
+    "rocksdb.estimate-pending-compaction-bytes",
+};
 
 class GlogRocksDBLogger : public rocksdb::Logger {
  public:
@@ -43,20 +131,47 @@ class RocksDBDatabasePlugin : public DatabasePlugin {
              const std::string& key,
              std::string& value) const override;
 
+  /// Batched data retrieval method, a single MultiGet.
+  Status getBatch(const std::string& domain,
+                  const std::vector<std::string>& keys,
+                  std::vector<std::string>& values) const override;
+
   /// Data storage method.
   Status put(const std::string& domain,
              const std::string& key,
              const std::string& value) override;
 
+  /// Batched data storage method.
+  Status putBatch(const std::string& domain,
+                  const DatabaseStringValueList& data) override;
+
   /// Data removal method.
   Status remove(const std::string& domain, const std::string& k) override;
 
+  /// Batched data removal method.
+  Status removeBatch(const std::string& domain,
+                     const std::vector<std::string>& keys) override;
+
+  /// Ranged data removal method, a single range tombstone.
+  Status removeRange(const std::string& domain,
+                     const std::string& low,
+                     const std::string& high) override;
+
   /// Key/index lookup method.
   Status scan(const std::string& domain,
               std::vector<std::string>& results,
               const std::string& prefix,
               size_t max = 0) const override;
 
+  /// Streaming key lookup, bounded by the prefix.
+  Status scan(const std::string& domain,
+              const std::string& prefix,
+              const DatabaseScanCallback& callback,
+              size_t max = 0) const override;
+
+  /// RocksDB tickers, histograms, and per-domain properties.
+  Status statistics(std::map<std::string, std::string>& stats) const override;
+
  public:
   /// Database workflow: open and setup.
   Status setUp() override;
@@ -71,6 +186,26 @@ class RocksDBDatabasePlugin : public DatabasePlugin {
   /// Obtain a close lock and release resources.
   void close();
 
+  /// The compression of a domain, using the database_compression flags.
+  rocksdb::CompressionType getDomainCompression(
+      const std::string& domain) const;
+
+  /// Read the durability policy of each domain from the sync flags.
+  void setSyncPolicies();
+
+  /// Write options for a domain, using its durability policy.
+  rocksdb::WriteOptions getWriteOptions(const std::string& domain);
+
+  /// The group commit loop, syncing writes made since the last sync.
+  void syncLoop();
+
+  /// Sync the WAL if there were group committed writes.
+  void syncWAL();
+
+  /// Column family options for a domain, using the database_profile.
+  rocksdb::ColumnFamilyOptions getDomainOptions(
+      const std::string& domain) const;
+
   /**
    * @brief Private helper around accessing the column family handle for a
    * specific column family, based on its name
@@ -104,8 +239,30 @@ class RocksDBDatabasePlugin : public DatabasePlugin {
   /// The RocksDB connection options that are used to connect to RocksDB
   rocksdb::Options options_;
 
+  /// The block cache shared by every domain, see database_cache_size.
+  std::shared_ptr<rocksdb::Cache> block_cache_{nullptr};
+
   /// Deconstruction mutex.
   std::mutex close_mutex_;
+
+  /// The durability policy of each domain.
+  std::map<std::string, RocksDBSyncPolicy> sync_policies_;
+
+  /// Set when a group committed write has not been synced.
+  std::atomic<bool> sync_pending_{false};
+
+  /// The group commit thread, running when database_sync_milli is set.
+  std::thread sync_thread_;
+
+  /// Wakes the group commit thread when the database closes.
+  std::condition_variable sync_cv_;
+  std::mutex sync_mutex_;
+  bool sync_stop_{false};
+
+  /// Group commit WAL syncs, and their total and maximum latency.
+  std::atomic<size_t> sync_count_{0};
+  std::atomic<size_t> sync_micros_{0};
+  std::atomic<size_t> sync_max_micros_{0};
 };
 
 /// Backing-storage provider for osquery internal/core.
@@ -156,6 +313,7 @@ Status RocksDBDatabasePlugin::setUp() {
     options_.min_write_buffer_number_to_merge = 1;
     options_.max_background_compactions = 2;
     options_.max_background_flushes = 2;
+    options_.statistics = rocksdb::CreateDBStatistics();
 
     // Create an environment to replace the default logger.
     if (logger_ == nullptr) {
@@ -163,12 +321,25 @@ Status RocksDBDatabasePlugin::setUp() {
     }
     options_.info_log = logger_;
 
+    if (FLAGS_database_cache_size > 0) {
+      block_cache_ =
+          rocksdb::NewLRUCache(FLAGS_database_cache_size * 1024 * 1024);
+    }
+
+    if (FLAGS_database_profile != "default" &&
+        FLAGS_database_profile != "workload") {
+      LOG(WARNING) << "Unknown database profile: " << FLAGS_database_profile;
+    }
+
+    // Domains use the handle at their index, see getHandleForColumnFamily.
+    // The family at index 0 is the default, so tune each by the handle index.
     column_families_.push_back(rocksdb::ColumnFamilyDescriptor(
-        rocksdb::kDefaultColumnFamilyName, options_));
+        rocksdb::kDefaultColumnFamilyName, getDomainOptions(kDomains[0])));
 
-    for (const auto& cf_name : kDomains) {
-      column_families_.push_back(
-          rocksdb::ColumnFamilyDescriptor(cf_name, options_));
+    for (size_t i = 0; i < kDomains.size(); i++) {
+      auto domain = (i + 1 < kDomains.size()) ? kDomains[i + 1] : "";
+      column_families_.push_back(rocksdb::ColumnFamilyDescriptor(
+          kDomains[i], getDomainOptions(domain)));
     }
   }
 
@@ -223,10 +394,190 @@ Status RocksDBDatabasePlugin::setUp() {
   if (!read_only_ && platformChmod(path_, S_IRWXU) == false) {
     return Status(1, "Cannot set permissions on RocksDB path: " + path_);
   }
+
+  setSyncPolicies();
+  if (!read_only_ && FLAGS_database_sync_milli > 0) {
+    sync_stop_ = false;
+    sync_thread_ = std::thread(&RocksDBDatabasePlugin::syncLoop, this);
+  }
   return Status(0);
 }
 
+/// Parse a comma-separated list of domain:value overrides.
+static std::map<std::string, std::string> getDomainOverrides(
+    const std::string& flag) {
+  std::map<std::string, std::string> overrides;
+  std::vector<std::string> items;
+  boost::split(items, flag, boost::is_any_of(","));
+  for (const auto& item : items) {
+    if (item.empty()) {
+      continue;
+    }
+
+    auto delim = item.find(':');
+    auto domain = item.substr(0, delim);
+    if (delim == std::string::npos ||
+        std::find(kDomains.begin(), kDomains.end(), domain) == kDomains.end()) {
+      LOG(WARNING) << "Unknown database domain override: " << item;
+      continue;
+    }
+    overrides[domain] = item.substr(delim + 1);
+  }
+  return overrides;
+}
+
+void RocksDBDatabasePlugin::setSyncPolicies() {
+  // Events should be fast, and do not need to force syncs.
+  auto policy = ROCKSDB_SYNC_ALWAYS;
+  if (FLAGS_database_sync_milli > 0) {
+    policy = ROCKSDB_SYNC_GROUP;
+  }
+  sync_policies_.clear();
+  for (const auto& domain : kDomains) {
+    sync_policies_[domain] = (domain == kEvents) ? ROCKSDB_SYNC_NONE : policy;
+  }
+
+  for (const auto& item : getDomainOverrides(FLAGS_database_sync_domains)) {
+    if (kRocksDBSyncPolicies.count(item.second) == 0) {
+      LOG(WARNING) << "Unknown database sync policy: " << item.second;
+      continue;
+    }
+
+    auto override_policy = kRocksDBSyncPolicies.at(item.second);
+    if (override_policy == ROCKSDB_SYNC_GROUP &&
+        FLAGS_database_sync_milli == 0) {
+      // Without a group commit there is no latency bound, sync each write.
+      override_policy = ROCKSDB_SYNC_ALWAYS;
+    }
+    sync_policies_[item.first] = override_policy;
+  }
+}
+
+rocksdb::WriteOptions RocksDBDatabasePlugin::getWriteOptions(
+    const std::string& domain) {
+  auto options = rocksdb::WriteOptions();
+  auto policy = sync_policies_.find(domain);
+  if (policy == sync_policies_.end() ||
+      policy->second == ROCKSDB_SYNC_ALWAYS) {
+    options.sync = true;
+  } else if (policy->second == ROCKSDB_SYNC_GROUP) {
+    // The write is in the WAL, the group commit thread syncs it.
+    sync_pending_ = true;
+  }
+  return options;
+}
+
+void RocksDBDatabasePlugin::syncLoop() {
+  auto period = std::chrono::milliseconds(FLAGS_database_sync_milli);
+  std::unique_lock<std::mutex> lock(sync_mutex_);
+  while (!sync_stop_) {
+    sync_cv_.wait_for(lock, period, [this]() { return sync_stop_; });
+    lock.unlock();
+    syncWAL();
+    lock.lock();
+  }
+}
+
+void RocksDBDatabasePlugin::syncWAL() {
+  std::unique_lock<std::mutex> lock(close_mutex_);
+  if (db_ == nullptr || !sync_pending_.exchange(false)) {
+    return;
+  }
+
+  // A single sync covers every writer since the last sync.
+  auto start = std::chrono::steady_clock::now();
+  auto s = db_->SyncWAL();
+  if (!s.ok()) {
+    sync_pending_ = true;
+    LOG(WARNING) << "Cannot sync RocksDB WAL: " << s.ToString();
+    return;
+  }
+
+  size_t micros = std::chrono::duration_cast<std::chrono::microseconds>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+  sync_count_++;
+  sync_micros_ += micros;
+  if (micros > sync_max_micros_) {
+    sync_max_micros_ = micros;
+  }
+}
+
+rocksdb::CompressionType RocksDBDatabasePlugin::getDomainCompression(
+    const std::string& domain) const {
+  auto name = FLAGS_database_compression;
+  auto overrides = getDomainOverrides(FLAGS_database_compression_domains);
+  if (overrides.count(domain) > 0) {
+    name = overrides.at(domain);
+  }
+
+  if (kRocksDBCompressions.count(name) == 0) {
+    LOG(WARNING) << "Unknown database compression: " << name;
+    return rocksdb::kNoCompression;
+  }
+  return kRocksDBCompressions.at(name);
+}
+
+rocksdb::ColumnFamilyOptions RocksDBDatabasePlugin::getDomainOptions(
+    const std::string& domain) const {
+  rocksdb::ColumnFamilyOptions options(options_);
+  options.compression = getDomainCompression(domain);
+  if (FLAGS_database_compression_dict > 0 &&
+      (domain == kEvents || domain == kLogs || domain == kQueries)) {
+    // Rows and results are repetitive JSON, a dictionary sampled from the
+    // data compresses each small block with the shared field names.
+    options.compression_opts.max_dict_bytes =
+        static_cast<uint32_t>(FLAGS_database_compression_dict * 1024);
+  }
+
+  // Every domain reads through the shared block cache, when configured.
+  rocksdb::BlockBasedTableOptions table_options;
+  table_options.block_cache = block_cache_;
+  if (FLAGS_database_profile != "workload") {
+    options.table_factory.reset(
+        rocksdb::NewBlockBasedTableFactory(table_options));
+    return options;
+  }
+
+  if (domain == kEvents || domain == kLogs) {
+    // Events and buffered logs are scanned by key prefix, prefix filters skip
+    // files without the prefix. Shorter scan prefixes use a total order seek.
+    options.prefix_extractor.reset(
+        rocksdb::NewCappedPrefixTransform(kRocksDBPrefixLength));
+    table_options.filter_policy.reset(rocksdb::NewBloomFilterPolicy(10));
+  }
+
+  if (domain == kEvents) {
+    // Events are appended then expired oldest-first, FIFO compaction drops
+    // the oldest files rather than rewriting them.
+    options.compaction_style = rocksdb::kCompactionStyleFIFO;
+    options.compaction_options_fifo.max_table_files_size =
+        FLAGS_database_events_max_size * 1024 * 1024;
+    options.write_buffer_size = 4 * 1024 * 1024;
+    options.max_write_buffer_number = 4;
+  } else if (domain == kQueries || domain == kPersistentSettings) {
+    // Results and settings are read by key, filters skip unrelated files.
+    table_options.filter_policy.reset(rocksdb::NewBloomFilterPolicy(10));
+    options.write_buffer_size = 1024 * 1024;
+  }
+  options.table_factory.reset(
+      rocksdb::NewBlockBasedTableFactory(table_options));
+  return options;
+}
+
 void RocksDBDatabasePlugin::close() {
+  if (sync_thread_.joinable()) {
+    {
+      std::unique_lock<std::mutex> sync_lock(sync_mutex_);
+      sync_stop_ = true;
+    }
+    sync_cv_.notify_all();
+    sync_thread_.join();
+  }
+
+  // Writes waiting for a group commit are synced before closing.
+  syncWAL();
+
   std::unique_lock<std::mutex> lock(close_mutex_);
   for (auto handle : handles_) {
     delete handle;
@@ -269,6 +620,33 @@ Status RocksDBDatabasePlugin::get(const std::string& domain,
   return Status(s.code(), s.ToString());
 }
 
+Status RocksDBDatabasePlugin::getBatch(const std::string& domain,
+                                       const std::vector<std::string>& keys,
+                                       std::vector<std::string>& values) const {
+  if (getDB() == nullptr) {
+    return Status(1, "Database not opened");
+  }
+  auto cfh = getHandleForColumnFamily(domain);
+  if (cfh == nullptr) {
+    return Status(1, "Could not get column family for " + domain);
+  }
+
+  // The lookups share a single memtable and version reference.
+  std::vector<rocksdb::ColumnFamilyHandle*> handles(keys.size(), cfh);
+  std::vector<rocksdb::Slice> slices(keys.begin(), keys.end());
+  values.clear();
+  auto statuses =
+      getDB()->MultiGet(rocksdb::ReadOptions(), handles, slices, &values);
+  for (size_t i = 0; i < statuses.size(); i++) {
+    if (statuses[i].IsNotFound()) {
+      values[i].clear();
+    } else if (!statuses[i].ok()) {
+      return Status(statuses[i].code(), statuses[i].ToString());
+    }
+  }
+  return Status(0, "OK");
+}
+
 Status RocksDBDatabasePlugin::put(const std::string& domain,
                                   const std::string& key,
                                   const std::string& value) {
@@ -281,11 +659,7 @@ Status RocksDBDatabasePlugin::put(const std::string& domain,
     return Status(1, "Could not get column family for " + domain);
   }
 
-  auto options = rocksdb::WriteOptions();
-  // Events should be fast, and do not need to force syncs.
-  if (kEvents != domain) {
-    options.sync = true;
-  }
+  auto options = getWriteOptions(domain);
   auto s = getDB()->Put(options, cfh, key, value);
   if (s.code() != 0 && s.IsIOError()) {
     // An error occurred, check if it is an IO error and remove the offending
@@ -299,6 +673,28 @@ Status RocksDBDatabasePlugin::put(const std::string& domain,
   return Status(s.code(), s.ToString());
 }
 
+Status RocksDBDatabasePlugin::putBatch(const std::string& domain,
+                                       const DatabaseStringValueList& data) {
+  if (read_only_) {
+    return Status(0, "Database in readonly mode");
+  }
+
+  auto cfh = getHandleForColumnFamily(domain);
+  if (cfh == nullptr) {
+    return Status(1, "Could not get column family for " + domain);
+  }
+
+  // The values share a single write, and WAL record.
+  rocksdb::WriteBatch batch;
+  for (const auto& item : data) {
+    batch.Put(cfh, item.first, item.second);
+  }
+
+  auto options = getWriteOptions(domain);
+  auto s = getDB()->Write(options, &batch);
+  return Status(s.code(), s.ToString());
+}
+
 Status RocksDBDatabasePlugin::remove(const std::string& domain,
                                      const std::string& key) {
   if (read_only_) {
@@ -309,14 +705,48 @@ Status RocksDBDatabasePlugin::remove(const std::string& domain,
   if (cfh == nullptr) {
     return Status(1, "Could not get column family for " + domain);
   }
-  auto options = rocksdb::WriteOptions();
+  // Large deletes, such as event expirations, are not synced by default.
+  auto options = getWriteOptions(domain);
+  auto s = getDB()->Delete(options, cfh, key);
+  return Status(s.code(), s.ToString());
+}
 
-  // We could sync here, but large deletes will cause multi-syncs.
-  // For example: event record expirations found in an expired index.
-  if (kEvents != domain) {
-    options.sync = true;
+Status RocksDBDatabasePlugin::removeBatch(
+    const std::string& domain, const std::vector<std::string>& keys) {
+  if (read_only_) {
+    return Status(0, "Database in readonly mode");
   }
-  auto s = getDB()->Delete(options, cfh, key);
+
+  auto cfh = getHandleForColumnFamily(domain);
+  if (cfh == nullptr) {
+    return Status(1, "Could not get column family for " + domain);
+  }
+
+  rocksdb::WriteBatch batch;
+  for (const auto& key : keys) {
+    batch.Delete(cfh, key);
+  }
+
+  auto options = getWriteOptions(domain);
+  auto s = getDB()->Write(options, &batch);
+  return Status(s.code(), s.ToString());
+}
+
+Status RocksDBDatabasePlugin::removeRange(const std::string& domain,
+                                          const std::string& low,
+                                          const std::string& high) {
+  if (read_only_) {
+    return Status(0, "Database in readonly mode");
+  }
+
+  auto cfh = getHandleForColumnFamily(domain);
+  if (cfh == nullptr) {
+    return Status(1, "Could not get column family for " + domain);
+  }
+  auto options = getWriteOptions(domain);
+
+  // The keys are not read, compaction drops the covered values.
+  auto s = getDB()->DeleteRange(options, cfh, low, high);
   return Status(s.code(), s.ToString());
 }
 
@@ -324,6 +754,32 @@ Status RocksDBDatabasePlugin::scan(const std::string& domain,
                                    std::vector<std::string>& results,
                                    const std::string& prefix,
                                    size_t max) const {
+  return scan(domain,
+              prefix,
+              [&results](const std::string& key) {
+                results.push_back(key);
+                return true;
+              },
+              max);
+}
+
+/// The first key after every key starting with prefix, empty if unbounded.
+static std::string getPrefixUpperBound(const std::string& prefix) {
+  auto bound = prefix;
+  while (!bound.empty()) {
+    if (static_cast<unsigned char>(bound.back()) != 0xff) {
+      bound.back()++;
+      break;
+    }
+    bound.pop_back();
+  }
+  return bound;
+}
+
+Status RocksDBDatabasePlugin::scan(const std::string& domain,
+                                   const std::string& prefix,
+                                   const DatabaseScanCallback& callback,
+                                   size_t max) const {
   if (getDB() == nullptr) {
     return Status(1, "Database not opened");
   }
@@ -332,25 +788,90 @@ Status RocksDBDatabasePlugin::scan(const std::string& domain,
   if (cfh == nullptr) {
     return Status(1, "Could not get column family for " + domain);
   }
+
+  // The iterator stops at the end of the prefix, rather than reading the next
+  // key to compare it.
+  auto bound = getPrefixUpperBound(prefix);
+  rocksdb::Slice upper_bound(bound);
   auto options = rocksdb::ReadOptions();
   options.verify_checksums = false;
   options.fill_cache = false;
-  auto it = getDB()->NewIterator(options, cfh);
+  if (!bound.empty()) {
+    options.iterate_upper_bound = &upper_bound;
+  }
+  // Prefix filters apply to prefixes at least as long as the extracted prefix.
+  options.total_order_seek = (prefix.size() < kRocksDBPrefixLength);
+
+  std::unique_ptr<rocksdb::Iterator> it(getDB()->NewIterator(options, cfh));
   if (it == nullptr) {
     return Status(1, "Could not get iterator for " + domain);
   }
 
+  // Keys are ordered, seek to the first with the prefix.
+  std::string key;
   size_t count = 0;
-  for (it->SeekToFirst(); it->Valid(); it->Next()) {
-    auto key = it->key().ToString();
-    if (key.find(prefix) == 0) {
-      results.push_back(std::move(key));
-      if (max > 0 && ++count >= max) {
-        break;
+  for (it->Seek(prefix); it->Valid(); it->Next()) {
+    key.assign(it->key().data(), it->key().size());
+    if (!callback(key) || (max > 0 && ++count >= max)) {
+      break;
+    }
+  }
+
+  if (!it->status().ok()) {
+    return Status(1,
+                  "Could not scan " + domain + ": " + it->status().ToString());
+  }
+  return Status(0, "OK");
+}
+
+Status RocksDBDatabasePlugin::statistics(
+    std::map<std::string, std::string>& stats) const {
+  if (getDB() == nullptr) {
+    return Status(1, "Database not opened");
+  }
+
+  if (options_.statistics != nullptr) {
+    for (const auto& ticker : rocksdb::TickersNameMap) {
+      stats[ticker.second] =
+          std::to_string(options_.statistics->getTickerCount(ticker.first));
+    }
+
+    // Histograms include rocksdb.compaction.times.micros.
+    for (const auto& histogram : rocksdb::HistogramsNameMap) {
+      rocksdb::HistogramData data;
+      options_.statistics->histogramData(histogram.first, &data);
+      stats[histogram.second + ".average"] = std::to_string(data.average);
+      stats[histogram.second + ".p99"] = std::to_string(data.percentile99);
+    }
+  }
+
+  if (block_cache_ != nullptr) {
+    stats["osquery.database.block_cache.usage"] =
+        std::to_string(block_cache_->GetUsage());
+    stats["osquery.database.block_cache.capacity"] =
+        std::to_string(block_cache_->GetCapacity());
+  }
+
+  // Syncs from database_sync_milli, per-write syncs are in rocksdb.wal.synced.
+  stats["osquery.database.group_syncs"] = std::to_string(sync_count_.load());
+  stats["osquery.database.group_sync.micros"] =
+      std::to_string(sync_micros_.load());
+  stats["osquery.database.group_sync.max.micros"] =
+      std::to_string(sync_max_micros_.load());
+
+  for (const auto& domain : kDomains) {
+    auto cfh = getHandleForColumnFamily(domain);
+    if (cfh == nullptr) {
+      continue;
+    }
+
+    uint64_t value = 0;
+    for (const auto& property : kRocksDBDomainProperties) {
+      if (getDB()->GetIntProperty(cfh, property, &value)) {
+        stats[domain + "." + property] = std::to_string(value);
       }
     }
   }
-  delete it;
   return Status(0, "OK");
 }
 }
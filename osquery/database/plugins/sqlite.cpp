@@ -8,6 +8,7 @@
  *
  */
 
+#include <algorithm>
 #include <mutex>
 
 #include <sqlite3.h>
@@ -16,6 +17,7 @@
 
 #include <osquery/database.h>
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 
 #include "osquery/filesystem/fileops.h"
@@ -25,6 +27,11 @@ namespace osquery {
 DECLARE_string(database_path);
 DECLARE_bool(database_in_memory);
 
+CLI_FLAG(bool,
+         database_sqlite_wal,
+         false,
+         "Use write-ahead logging in the SQLite backing store");
+
 const std::map<std::string, std::string> kDBSettings = {
     {"synchronous", "OFF"},      {"count_changes", "OFF"},
     {"default_temp_store", "2"}, {"auto_vacuum", "FULL"},
@@ -32,6 +39,21 @@ const std::map<std::string, std::string> kDBSettings = {
     {"page_count", "1000"},
 };
 
+/// Settings replacing kDBSettings with database_sqlite_wal.
+const std::map<std::string, std::string> kDBWALSettings = {
+    {"journal_mode", "WAL"}, {"synchronous", "NORMAL"},
+};
+
+/// The statements prepared once for each domain, see getStatements.
+struct SQLiteDomainStatements {
+  sqlite3_stmt* get{nullptr};
+  sqlite3_stmt* put{nullptr};
+  sqlite3_stmt* remove{nullptr};
+  sqlite3_stmt* remove_range{nullptr};
+  sqlite3_stmt* scan{nullptr};
+  sqlite3_stmt* scan_range{nullptr};
+};
+
 class SQLiteDatabasePlugin : public DatabasePlugin {
  public:
   /// Data retrieval method.
@@ -39,14 +61,32 @@ class SQLiteDatabasePlugin : public DatabasePlugin {
              const std::string& key,
              std::string& value) const override;
 
+  /// Batched data retrieval method, a single prepared statement.
+  Status getBatch(const std::string& domain,
+                  const std::vector<std::string>& keys,
+                  std::vector<std::string>& values) const override;
+
   /// Data storage method.
   Status put(const std::string& domain,
              const std::string& key,
              const std::string& value) override;
 
+  /// Batched data storage method, a single transaction.
+  Status putBatch(const std::string& domain,
+                  const DatabaseStringValueList& data) override;
+
   /// Data removal method.
   Status remove(const std::string& domain, const std::string& k) override;
 
+  /// Batched data removal method, a single transaction.
+  Status removeBatch(const std::string& domain,
+                     const std::vector<std::string>& keys) override;
+
+  /// Ordered range removal, a single indexed delete.
+  Status removeRange(const std::string& domain,
+                     const std::string& low,
+                     const std::string& high) override;
+
   /// Key/index lookup method.
   Status scan(const std::string& domain,
               std::vector<std::string>& results,
@@ -66,10 +106,35 @@ class SQLiteDatabasePlugin : public DatabasePlugin {
  private:
   void close();
 
+  /**
+   * @brief Get a domain's prepared statements, preparing them on first use.
+   *
+   * The statements are kept until the database is closed. The caller must
+   * hold statement_mutex_ while using them.
+   *
+   * @return nullptr if the domain is unknown or a statement cannot be
+   * prepared.
+   */
+  SQLiteDomainStatements* getStatements(const std::string& domain) const;
+
+  /// Bind each key, and optionally value, to stmt within a transaction.
+  Status writeBatch(sqlite3_stmt* stmt,
+                    const std::vector<std::string>& keys,
+                    const DatabaseStringValueList& data);
+
  private:
   /// The long-lived sqlite3 database.
   sqlite3* db_{nullptr};
 
+  /// True if the database uses write-ahead logging.
+  bool wal_{false};
+
+  /// Prepared statements by domain.
+  mutable std::map<std::string, SQLiteDomainStatements> statements_;
+
+  /// Prepared statements are used by one caller at a time.
+  mutable std::mutex statement_mutex_;
+
   /// Deconstruction mutex.
   std::mutex close_mutex_;
 };
@@ -131,8 +196,16 @@ Status SQLiteDatabasePlugin::setUp() {
       }
     }
 
+    auto db_settings = kDBSettings;
+    wal_ = FLAGS_database_sqlite_wal && !in_memory_;
+    if (wal_) {
+      for (const auto& setting : kDBWALSettings) {
+        db_settings[setting.first] = setting.second;
+      }
+    }
+
     std::string settings;
-    for (const auto& setting : kDBSettings) {
+    for (const auto& setting : db_settings) {
       settings += "PRAGMA " + setting.first + "=" + setting.second + "; ";
     }
     sqlite3_exec(db_, settings.c_str(), nullptr, nullptr, nullptr);
@@ -148,12 +221,100 @@ Status SQLiteDatabasePlugin::setUp() {
 
 void SQLiteDatabasePlugin::close() {
   std::unique_lock<std::mutex> lock(close_mutex_);
+  {
+    std::unique_lock<std::mutex> statement_lock(statement_mutex_);
+    for (auto& domain : statements_) {
+      auto& s = domain.second;
+      for (auto stmt : {s.get, s.put, s.remove, s.remove_range, s.scan,
+                        s.scan_range}) {
+        sqlite3_finalize(stmt);
+      }
+    }
+    statements_.clear();
+  }
+
   if (db_ != nullptr) {
     sqlite3_close(db_);
     db_ = nullptr;
   }
 }
 
+SQLiteDomainStatements* SQLiteDatabasePlugin::getStatements(
+    const std::string& domain) const {
+  auto it = statements_.find(domain);
+  if (it != statements_.end()) {
+    return &it->second;
+  }
+
+  // Domains are table names, only the known domains have tables.
+  if (db_ == nullptr ||
+      std::find(kDomains.begin(), kDomains.end(), domain) == kDomains.end()) {
+    return nullptr;
+  }
+
+  SQLiteDomainStatements s;
+  auto prepare = [this](const std::string& q, sqlite3_stmt** stmt) {
+    return sqlite3_prepare_v2(db_, q.c_str(), -1, stmt, nullptr) == SQLITE_OK;
+  };
+  // Range bounds use the primary key index, unlike a LIKE prefix.
+  bool prepared =
+      prepare("select value from " + domain + " where key = ?1;", &s.get) &&
+      prepare("insert or replace into " + domain + " values (?1, ?2);",
+              &s.put) &&
+      prepare("delete from " + domain + " where key = ?1;", &s.remove) &&
+      prepare("delete from " + domain + " where key >= ?1 and key < ?2;",
+              &s.remove_range) &&
+      prepare("select key from " + domain +
+                  " where key >= ?1 order by key limit ?2;",
+              &s.scan) &&
+      prepare("select key from " + domain +
+                  " where key >= ?1 and key < ?2 order by key limit ?3;",
+              &s.scan_range);
+  if (!prepared) {
+    LOG(ERROR) << "Cannot prepare statements for domain " << domain << ": "
+               << sqlite3_errmsg(db_);
+    for (auto stmt : {s.get, s.put, s.remove, s.remove_range, s.scan,
+                      s.scan_range}) {
+      sqlite3_finalize(stmt);
+    }
+    return nullptr;
+  }
+  return &(statements_[domain] = s);
+}
+
+/// Bind a string's bytes, which may include NULs, as text.
+static void bindString(sqlite3_stmt* stmt, int index, const std::string& s) {
+  sqlite3_bind_text(stmt, index, s.data(), s.size(), SQLITE_STATIC);
+}
+
+/// Read a text column's bytes, which may include NULs.
+static std::string columnString(sqlite3_stmt* stmt, int index) {
+  auto data = sqlite3_column_text(stmt, index);
+  if (data == nullptr) {
+    return "";
+  }
+  return std::string(reinterpret_cast<const char*>(data),
+                     sqlite3_column_bytes(stmt, index));
+}
+
+/**
+ * @brief The first key after every key starting with prefix.
+ *
+ * The last byte below 0xff is incremented and the bytes after it dropped.
+ * Returns false if there is no such key, every byte is 0xff.
+ */
+static bool prefixUpperBound(std::string prefix, std::string& bound) {
+  while (!prefix.empty() && static_cast<unsigned char>(prefix.back()) == 0xff) {
+    prefix.pop_back();
+  }
+  if (prefix.empty()) {
+    return false;
+  }
+  prefix.back() = static_cast<char>(prefix.back() + 1);
+  bound = std::move(prefix);
+  return true;
+}
+
 static int getData(void* argument, int argc, char* argv[], char* column[]) {
   if (argument == nullptr) {
     return SQLITE_MISUSE;
@@ -173,20 +334,20 @@ static int getData(void* argument, int argc, char* argv[], char* column[]) {
 Status SQLiteDatabasePlugin::get(const std::string& domain,
                                  const std::string& key,
                                  std::string& value) const {
-  QueryData results;
-  char* err = nullptr;
-  std::string q = "select value from " + domain + " where key = '" + key + "';";
-  sqlite3_exec(db_, q.c_str(), getData, &results, &err);
-  if (err != nullptr) {
-    sqlite3_free(err);
+  std::unique_lock<std::mutex> lock(statement_mutex_);
+  auto s = getStatements(domain);
+  if (s == nullptr) {
+    return Status(1);
   }
 
   // Only assign value if the query found a result.
-  if (results.size() > 0) {
-    value = std::move(results[0]["value"]);
-    return Status(0);
+  bindString(s->get, 1, key);
+  bool found = (sqlite3_step(s->get) == SQLITE_ROW);
+  if (found) {
+    value = columnString(s->get, 0);
   }
-  return Status(1);
+  sqlite3_reset(s->get);
+  return Status((found) ? 0 : 1);
 }
 
 static void tryVacuum(sqlite3* db) {
@@ -204,6 +365,13 @@ static void tryVacuum(sqlite3* db) {
   }
 }
 
+/// Step a write statement with its bound values, then reset it.
+static bool stepWrite(sqlite3_stmt* stmt) {
+  auto rc = sqlite3_step(stmt);
+  sqlite3_reset(stmt);
+  return rc == SQLITE_DONE;
+}
+
 Status SQLiteDatabasePlugin::put(const std::string& domain,
                                  const std::string& key,
                                  const std::string& value) {
@@ -211,19 +379,20 @@ Status SQLiteDatabasePlugin::put(const std::string& domain,
     return Status(0, "Database in readonly mode");
   }
 
-  sqlite3_stmt* stmt = nullptr;
-  std::string q = "insert or replace into " + domain + " values (?1, ?2);";
-  sqlite3_prepare_v2(db_, q.c_str(), -1, &stmt, nullptr);
+  std::unique_lock<std::mutex> lock(statement_mutex_);
+  auto s = getStatements(domain);
+  if (s == nullptr) {
+    return Status(1, "Unknown domain: " + domain);
+  }
 
-  sqlite3_bind_text(stmt, 1, key.c_str(), -1, SQLITE_STATIC);
-  sqlite3_bind_text(stmt, 2, value.c_str(), -1, SQLITE_STATIC);
-  auto rc = sqlite3_step(stmt);
-  if (rc != SQLITE_DONE) {
+  bindString(s->put, 1, key);
+  bindString(s->put, 2, value);
+  if (!stepWrite(s->put)) {
     return Status(1);
   }
 
-  sqlite3_finalize(stmt);
-  if (rand() % 10 == 0) {
+  // Write-ahead logs are checkpointed rather than vacuumed.
+  if (!wal_ && rand() % 10 == 0) {
     tryVacuum(db_);
   }
   return Status(0);
@@ -235,45 +404,146 @@ Status SQLiteDatabasePlugin::remove(const std::string& domain,
     return Status(0, "Database in readonly mode");
   }
 
-  sqlite3_stmt* stmt = nullptr;
-  std::string q = "delete from " + domain + " where key IN (?1);";
-  sqlite3_prepare_v2(db_, q.c_str(), -1, &stmt, nullptr);
+  std::unique_lock<std::mutex> lock(statement_mutex_);
+  auto s = getStatements(domain);
+  if (s == nullptr) {
+    return Status(1, "Unknown domain: " + domain);
+  }
 
-  sqlite3_bind_text(stmt, 1, key.c_str(), -1, SQLITE_STATIC);
-  auto rc = sqlite3_step(stmt);
-  if (rc != SQLITE_DONE) {
+  bindString(s->remove, 1, key);
+  if (!stepWrite(s->remove)) {
     return Status(1);
   }
 
-  sqlite3_finalize(stmt);
-  if (rand() % 10 == 0) {
+  if (!wal_ && rand() % 10 == 0) {
     tryVacuum(db_);
   }
   return Status(0);
 }
 
+Status SQLiteDatabasePlugin::getBatch(const std::string& domain,
+                                      const std::vector<std::string>& keys,
+                                      std::vector<std::string>& values) const {
+  values.assign(keys.size(), "");
+
+  std::unique_lock<std::mutex> lock(statement_mutex_);
+  auto s = getStatements(domain);
+  if (s == nullptr) {
+    return Status(1, "Cannot prepare batched read");
+  }
+
+  for (size_t i = 0; i < keys.size(); i++) {
+    bindString(s->get, 1, keys[i]);
+    if (sqlite3_step(s->get) == SQLITE_ROW) {
+      values[i] = columnString(s->get, 0);
+    }
+    sqlite3_reset(s->get);
+  }
+  return Status(0, "OK");
+}
+
+Status SQLiteDatabasePlugin::writeBatch(sqlite3_stmt* stmt,
+                                        const std::vector<std::string>& keys,
+                                        const DatabaseStringValueList& data) {
+  // Each statement would otherwise be its own implicit transaction.
+  // An immediate transaction takes the write lock before the first write.
+  sqlite3_exec(db_, "begin immediate transaction;", nullptr, nullptr, nullptr);
+  auto status = Status(0, "OK");
+  auto count = (data.empty()) ? keys.size() : data.size();
+  for (size_t i = 0; i < count; i++) {
+    bindString(stmt, 1, (data.empty()) ? keys[i] : data[i].first);
+    if (!data.empty()) {
+      bindString(stmt, 2, data[i].second);
+    }
+    if (!stepWrite(stmt)) {
+      status = Status(1, "Cannot complete batched write");
+      break;
+    }
+  }
+
+  auto end = (status.ok()) ? "commit;" : "rollback;";
+  sqlite3_exec(db_, end, nullptr, nullptr, nullptr);
+  if (!wal_ && status.ok() && rand() % 10 == 0) {
+    tryVacuum(db_);
+  }
+  return status;
+}
+
+Status SQLiteDatabasePlugin::putBatch(const std::string& domain,
+                                      const DatabaseStringValueList& data) {
+  if (read_only_) {
+    return Status(0, "Database in readonly mode");
+  }
+
+  std::unique_lock<std::mutex> lock(statement_mutex_);
+  auto s = getStatements(domain);
+  if (s == nullptr) {
+    return Status(1, "Cannot prepare batched write");
+  }
+  return writeBatch(s->put, {}, data);
+}
+
+Status SQLiteDatabasePlugin::removeBatch(const std::string& domain,
+                                         const std::vector<std::string>& keys) {
+  if (read_only_) {
+    return Status(0, "Database in readonly mode");
+  }
+
+  std::unique_lock<std::mutex> lock(statement_mutex_);
+  auto s = getStatements(domain);
+  if (s == nullptr) {
+    return Status(1, "Cannot prepare batched write");
+  }
+  return writeBatch(s->remove, keys, {});
+}
+
+Status SQLiteDatabasePlugin::removeRange(const std::string& domain,
+                                         const std::string& low,
+                                         const std::string& high) {
+  if (read_only_) {
+    return Status(0, "Database in readonly mode");
+  }
+
+  std::unique_lock<std::mutex> lock(statement_mutex_);
+  auto s = getStatements(domain);
+  if (s == nullptr) {
+    return Status(1, "Unknown domain: " + domain);
+  }
+
+  bindString(s->remove_range, 1, low);
+  bindString(s->remove_range, 2, high);
+  if (!stepWrite(s->remove_range)) {
+    return Status(1, "Cannot remove range");
+  }
+  return Status(0, "OK");
+}
+
 Status SQLiteDatabasePlugin::scan(const std::string& domain,
                                   std::vector<std::string>& results,
                                   const std::string& prefix,
                                   size_t max) const {
-  QueryData _results;
-  char* err = nullptr;
-
-  std::string q =
-      "select key from " + domain + " where key LIKE '" + prefix + "%'";
-  if (max > 0) {
-    q += " limit " + std::to_string(max);
-  }
-  sqlite3_exec(db_, q.c_str(), getData, &_results, &err);
-  if (err != nullptr) {
-    sqlite3_free(err);
+  std::unique_lock<std::mutex> lock(statement_mutex_);
+  auto s = getStatements(domain);
+  if (s == nullptr) {
+    return Status(0, "OK");
   }
 
-  // Only assign value if the query found a result.
-  for (auto& r : _results) {
-    results.push_back(std::move(r["key"]));
+  // A prefix is the range from itself to the first key after its keys.
+  std::string bound;
+  auto stmt = s->scan;
+  if (prefixUpperBound(prefix, bound)) {
+    stmt = s->scan_range;
+    bindString(stmt, 2, bound);
   }
-
+  bindString(stmt, 1, prefix);
+  // A negative limit is unlimited.
+  sqlite3_bind_int64(stmt,
+                     (stmt == s->scan) ? 2 : 3,
+                     (max > 0) ? static_cast<sqlite3_int64>(max) : -1);
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    results.push_back(columnString(stmt, 0));
+  }
+  sqlite3_reset(stmt);
   return Status(0, "OK");
 }
 }
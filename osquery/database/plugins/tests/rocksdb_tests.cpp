@@ -31,4 +31,17 @@ TEST_F(RocksDBDatabasePluginTests, test_rocksdb_loglevel) {
   auto details = SQL::selectAllFrom("file", "path", EQUALS, path_ + "/LOG");
   ASSERT_EQ(details.size(), 0U);
 }
+
+TEST_F(RocksDBDatabasePluginTests, test_rocksdb_statistics) {
+  auto plugin = std::dynamic_pointer_cast<DatabasePlugin>(
+      Registry::get("database", "rocksdb"));
+  plugin->put(kEvents, "test_statistics", "value");
+
+  std::map<std::string, std::string> stats;
+  auto s = plugin->statistics(stats);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(stats.count("rocksdb.stall.micros"), 1U);
+  EXPECT_EQ(stats.count("rocksdb.compaction.times.micros.average"), 1U);
+  EXPECT_EQ(stats.count(kEvents + ".rocksdb.estimate-num-keys"), 1U);
+}
 }
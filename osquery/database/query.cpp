@@ -9,11 +9,166 @@
  */
 
 #include <algorithm>
+#include <cstdio>
+#include <set>
+#include <unordered_map>
 
+#include <snappy.h>
+
+#include <osquery/flags.h>
+
+#include "osquery/core/tracing.h"
 #include "osquery/database/query.h"
 
 namespace osquery {
 
+FLAG(uint64,
+     results_chunk_rows,
+     256,
+     "Average rows in each stored chunk of previous results, 0 stores JSON");
+
+const std::string kQueryFingerprintsPrefix = "hashes.";
+
+const std::string kQuerySnapshotPrefix = "snapshot.";
+
+const std::string kQueryChunksPrefix = "chunks.";
+
+/// Each fingerprint is stored as fixed-width hex.
+const size_t kFingerprintWidth = sizeof(RowHash) * 2;
+
+/// The start of stored results holding a list of chunk digests, not JSON.
+const std::string kQueryChunksMagic = "chunks:1:";
+
+/// The first byte of a stored chunk, the chunk's compression.
+const char kChunkSnappy = 's';
+const char kChunkRaw = 'r';
+
+/// FNV-1a, mixing each byte of a 64bit value.
+static void mixDigest(uint64_t& digest, uint64_t value) {
+  for (size_t i = 0; i < sizeof(value); i++) {
+    digest ^= (value >> (i * 8)) & 0xff;
+    digest *= 1099511628211ULL;
+  }
+}
+
+const uint64_t kDigestBasis = 14695981039346656037ULL;
+
+static std::vector<RowHash> getFingerprints(const QueryData& qd) {
+  std::vector<RowHash> hashes;
+  hashes.reserve(qd.size());
+  for (const auto& row : qd) {
+    hashes.push_back(hashRow(row));
+  }
+  return hashes;
+}
+
+/// Encode hashes as fixed-width hex, in order.
+static std::string encodeHashes(const std::vector<RowHash>& hashes) {
+  std::string encoded(hashes.size() * kFingerprintWidth, '0');
+  char buffer[kFingerprintWidth + 1];
+  for (size_t i = 0; i < hashes.size(); i++) {
+    snprintf(buffer,
+             sizeof(buffer),
+             "%016llx",
+             static_cast<unsigned long long>(hashes[i]));
+    encoded.replace(i * kFingerprintWidth, kFingerprintWidth, buffer);
+  }
+  return encoded;
+}
+
+static std::string encodeFingerprints(std::vector<RowHash> hashes) {
+  std::sort(hashes.begin(), hashes.end());
+  return encodeHashes(hashes);
+}
+
+static Status decodeFingerprints(const std::string& encoded,
+                                 std::vector<RowHash>& hashes) {
+  if (encoded.size() % kFingerprintWidth != 0) {
+    return Status(1, "Invalid fingerprint encoding");
+  }
+
+  hashes.reserve(encoded.size() / kFingerprintWidth);
+  for (size_t i = 0; i < encoded.size(); i += kFingerprintWidth) {
+    char field[kFingerprintWidth + 1] = {0};
+    encoded.copy(field, kFingerprintWidth, i);
+    char* end = nullptr;
+    auto hash = strtoull(field, &end, 16);
+    if (end != field + kFingerprintWidth) {
+      return Status(1, "Invalid fingerprint encoding");
+    }
+    hashes.push_back(static_cast<RowHash>(hash));
+  }
+  return Status(0, "OK");
+}
+
+static std::string encodeDigest(std::vector<RowHash> hashes) {
+  std::sort(hashes.begin(), hashes.end());
+  // FNV-1a over the sorted fingerprints, then the row count.
+  uint64_t digest = kDigestBasis;
+  for (const auto& hash : hashes) {
+    mixDigest(digest, static_cast<uint64_t>(hash));
+  }
+  mixDigest(digest, hashes.size());
+
+  char buffer[kFingerprintWidth + 1];
+  snprintf(buffer,
+           sizeof(buffer),
+           "%016llx",
+           static_cast<unsigned long long>(digest));
+  return std::string(buffer);
+}
+
+/// The key of a query's chunk, by the chunk's digest.
+static std::string getChunkKey(const std::string& name, RowHash digest) {
+  return kQueryChunksPrefix + name + "." + encodeHashes({digest});
+}
+
+/// Decode the chunk digests of stored results, false if stored as JSON.
+static bool decodeChunkList(const std::string& raw,
+                            std::vector<RowHash>& digests) {
+  if (raw.compare(0, kQueryChunksMagic.size(), kQueryChunksMagic) != 0) {
+    return false;
+  }
+  return decodeFingerprints(raw.substr(kQueryChunksMagic.size()), digests)
+      .ok();
+}
+
+static Status encodeChunk(const QueryData& rows, std::string& chunk) {
+  std::string encoded;
+  auto status = serializeQueryDataColumns(rows, encoded);
+  if (!status.ok()) {
+    return status;
+  }
+
+  // Keep the encoded chunk if it does not compress.
+  std::string compressed;
+  snappy::Compress(encoded.data(), encoded.size(), &compressed);
+  if (compressed.size() < encoded.size()) {
+    chunk = kChunkSnappy + compressed;
+  } else {
+    chunk = kChunkRaw + encoded;
+  }
+  return Status(0, "OK");
+}
+
+static Status decodeChunk(const std::string& chunk, QueryData& rows) {
+  if (chunk.empty()) {
+    return Status(1, "Missing stored results chunk");
+  }
+
+  if (chunk[0] == kChunkRaw) {
+    return deserializeQueryDataColumns(chunk.substr(1), rows);
+  } else if (chunk[0] != kChunkSnappy) {
+    return Status(1, "Unknown stored results chunk compression");
+  }
+
+  std::string encoded;
+  if (!snappy::Uncompress(chunk.data() + 1, chunk.size() - 1, &encoded)) {
+    return Status(1, "Invalid stored results chunk compression");
+  }
+  return deserializeQueryDataColumns(encoded, rows);
+}
+
 Status Query::getPreviousQueryResults(QueryData& results) {
   if (!isQueryNameInDatabase()) {
     return Status(0, "Query name not found in database");
@@ -25,10 +180,29 @@ Status Query::getPreviousQueryResults(QueryData& results) {
     return status;
   }
 
-  status = deserializeQueryDataJSON(raw, results);
+  std::vector<RowHash> digests;
+  if (!decodeChunkList(raw, digests)) {
+    return deserializeQueryDataJSON(raw, results);
+  }
+
+  std::vector<std::string> keys;
+  for (const auto& digest : digests) {
+    keys.push_back(getChunkKey(name_, digest));
+  }
+  std::vector<std::string> chunks;
+  status = getDatabaseBatch(kQueries, keys, chunks);
   if (!status.ok()) {
     return status;
   }
+
+  for (const auto& chunk : chunks) {
+    QueryData rows;
+    status = decodeChunk(chunk, rows);
+    if (!status.ok()) {
+      return status;
+    }
+    std::move(rows.begin(), rows.end(), std::back_inserter(results));
+  }
   return Status(0, "OK");
 }
 
@@ -38,23 +212,147 @@ std::vector<std::string> Query::getStoredQueryNames() {
   return results;
 }
 
+Status Query::deleteStoredResults(const std::string& name) {
+  std::vector<std::string> keys = {
+      name, kQueryFingerprintsPrefix + name, kQuerySnapshotPrefix + name};
+
+  // Chunk keys end with the digest, a name may contain the separator.
+  auto prefix = kQueryChunksPrefix + name + ".";
+  std::vector<std::string> chunks;
+  scanDatabaseKeys(kQueries, chunks, prefix);
+  for (auto& key : chunks) {
+    if (key.size() == prefix.size() + kFingerprintWidth &&
+        key.find('.', prefix.size()) == std::string::npos) {
+      keys.push_back(std::move(key));
+    }
+  }
+  return deleteDatabaseBatch(kQueries, keys);
+}
+
 bool Query::isQueryNameInDatabase() {
-  auto names = Query::getStoredQueryNames();
+  // Only the keys starting with the name are scanned, not every chunk.
+  std::vector<std::string> names;
+  scanDatabaseKeys(kQueries, names, name_);
   return std::find(names.begin(), names.end(), name_) != names.end();
 }
 
+Status Query::storeResults(const QueryData& qd,
+                           const std::vector<RowHash>& hashes,
+                           DatabaseStringValueList& batch,
+                           std::vector<std::string>& stale) {
+  std::string raw;
+  std::vector<RowHash> previous;
+  if (getDatabaseValue(kQueries, name_, raw).ok()) {
+    decodeChunkList(raw, previous);
+  }
+
+  std::vector<RowHash> digests;
+  if (FLAGS_results_chunk_rows > 0) {
+    // A row whose fingerprint is a multiple of the target ends a chunk.
+    auto target = FLAGS_results_chunk_rows;
+    std::set<RowHash> stored(previous.begin(), previous.end());
+    size_t start = 0;
+    auto digest = kDigestBasis;
+    for (size_t i = 0; i < qd.size(); i++) {
+      mixDigest(digest, static_cast<uint64_t>(hashes[i]));
+      auto rows = i + 1 - start;
+      if (i + 1 < qd.size() && rows < target * 4 &&
+          (rows < target / 4 || hashes[i] % target != 0)) {
+        continue;
+      }
+
+      mixDigest(digest, rows);
+      digests.push_back(digest);
+      if (stored.insert(digest).second) {
+        std::string chunk;
+        auto status = encodeChunk(
+            QueryData(qd.begin() + start, qd.begin() + i + 1), chunk);
+        if (!status.ok()) {
+          return status;
+        }
+        batch.emplace_back(getChunkKey(name_, digest), std::move(chunk));
+      }
+      start = i + 1;
+      digest = kDigestBasis;
+    }
+    batch.emplace_back(name_, kQueryChunksMagic + encodeHashes(digests));
+  } else {
+    std::string json;
+    auto status = serializeQueryDataJSON(qd, json);
+    if (!status.ok()) {
+      return status;
+    }
+    batch.emplace_back(name_, std::move(json));
+  }
+
+  // The previous chunks no longer used are removed after the write.
+  std::set<RowHash> current(digests.begin(), digests.end());
+  std::set<RowHash> removed;
+  for (const auto& digest : previous) {
+    if (current.count(digest) == 0 && removed.insert(digest).second) {
+      stale.push_back(getChunkKey(name_, digest));
+    }
+  }
+  return Status(0, "OK");
+}
+
+Status Query::storeResults(const QueryData& qd) {
+  DatabaseStringValueList batch;
+  std::vector<std::string> stale;
+  auto status = storeResults(qd, getFingerprints(qd), batch, stale);
+  if (!status.ok()) {
+    return status;
+  }
+
+  status = setDatabaseBatch(kQueries, batch);
+  if (status.ok() && !stale.empty()) {
+    status = deleteDatabaseBatch(kQueries, stale);
+  }
+  return status;
+}
+
 Status Query::addNewResults(const QueryData& qd) {
   DiffResults dr;
-  return addNewResults(qd, dr, false);
+  return addNewResults(qd, dr, false, nullptr);
 }
 
 Status Query::addNewResults(const QueryData& qd, DiffResults& dr) {
-  return addNewResults(qd, dr, true);
+  auto status = addNewResults(qd, dr, true, nullptr);
+  matchDiffKeys(dr, query_.key_columns);
+  return status;
+}
+
+Status Query::addNewResults(QueryData&& qd, DiffResults& dr) {
+  std::vector<size_t> added;
+  auto status = addNewResults(qd, dr, true, &added);
+  dr.added.reserve(dr.added.size() + added.size());
+  for (const auto& i : added) {
+    dr.added.push_back(std::move(qd[i]));
+  }
+  // Release the remaining rows now, not when the caller's results expire.
+  QueryData().swap(qd);
+  matchDiffKeys(dr, query_.key_columns);
+  return status;
+}
+
+bool Query::isFingerprinted() const {
+  return query_.options.count("fingerprint") > 0 &&
+         query_.options.at("fingerprint");
+}
+
+bool Query::logsRemoved() const {
+  return query_.options.count("removed") == 0 || query_.options.at("removed");
 }
 
 Status Query::addNewResults(const QueryData& current_qd,
                             DiffResults& dr,
-                            bool calculate_diff) {
+                            bool calculate_diff,
+                            std::vector<size_t>* added) {
+  OSQUERY_TRACE_SPAN("Query::addNewResults");
+  if (isFingerprinted()) {
+    return addNewFingerprintedResults(current_qd, dr, calculate_diff, added);
+  }
+
   // Get the rows from the last run of this query name.
   QueryData previous_qd;
   auto status = getPreviousQueryResults(previous_qd);
@@ -63,24 +361,125 @@ Status Query::addNewResults(const QueryData& current_qd,
   }
 
   // Calculate the differential between previous and current query results.
+  bool changed = previous_qd.empty();
   if (calculate_diff) {
-    dr = diff(previous_qd, current_qd);
+    auto indexes = diffIndexes(previous_qd, current_qd);
+    changed = changed || !indexes.added.empty() || !indexes.removed.empty();
+    if (added != nullptr) {
+      *added = std::move(indexes.added);
+    } else {
+      for (const auto& i : indexes.added) {
+        dr.added.push_back(current_qd[i]);
+      }
+    }
+    // The previous rows are not needed after the differential.
+    for (const auto& i : indexes.removed) {
+      dr.removed.push_back(std::move(previous_qd[i]));
+    }
   }
 
-  if (previous_qd.size() == 0 || dr.added.size() != 0 ||
-      dr.removed.size() != 0) {
+  if (changed) {
     // Replace the "previous" query data with the current.
-    std::string json;
-    status = serializeQueryDataJSON(current_qd, json);
+    status = storeResults(current_qd);
     if (!status.ok()) {
       return status;
     }
+  }
+  return Status(0, "OK");
+}
+
+Status Query::addNewFingerprintedResults(const QueryData& current_qd,
+                                         DiffResults& dr,
+                                         bool calculate_diff,
+                                         std::vector<size_t>* added) {
+  auto current_hashes = getFingerprints(current_qd);
+  auto encoded = encodeFingerprints(current_hashes);
+
+  std::string previous_encoded;
+  auto key = kQueryFingerprintsPrefix + name_;
+  auto status = getDatabaseValue(kQueries, key, previous_encoded);
+  bool first_run = !status.ok();
+  if (!first_run && previous_encoded == encoded) {
+    // The fast path: nothing changed, nothing to parse or write.
+    return Status(0, "OK");
+  }
+
+  std::vector<RowHash> previous_hashes;
+  if (!first_run && !decodeFingerprints(previous_encoded, previous_hashes)) {
+    // Treat corrupted fingerprints as a first run.
+    previous_hashes.clear();
+  }
+
+  if (calculate_diff) {
+    // Count each previous fingerprint, then consume them with the current.
+    std::unordered_map<RowHash, size_t> previous_counts;
+    previous_counts.reserve(previous_hashes.size());
+    for (const auto& hash : previous_hashes) {
+      previous_counts[hash]++;
+    }
+
+    for (size_t i = 0; i < current_qd.size(); i++) {
+      auto count = previous_counts.find(current_hashes[i]);
+      if (count == previous_counts.end() || count->second == 0) {
+        if (added != nullptr) {
+          added->push_back(i);
+        } else {
+          dr.added.push_back(current_qd[i]);
+        }
+      } else {
+        count->second--;
+      }
+    }
+
+    bool removed = std::any_of(
+        previous_counts.begin(),
+        previous_counts.end(),
+        [](const std::pair<const RowHash, size_t>& c) { return c.second > 0; });
+    if (removed && logsRemoved()) {
+      // Only now are the previous row bodies needed.
+      QueryData previous_qd;
+      status = getPreviousQueryResults(previous_qd);
+      if (!status.ok()) {
+        return status;
+      }
+      for (auto& row : previous_qd) {
+        auto count = previous_counts.find(hashRow(row));
+        if (count != previous_counts.end() && count->second > 0) {
+          dr.removed.push_back(std::move(row));
+          count->second--;
+        }
+      }
+    }
+  }
 
-    status = setDatabaseValue(kQueries, name_, json);
+  // The fingerprints and row bodies are written together.
+  DatabaseStringValueList batch = {{key, std::move(encoded)}};
+  std::vector<std::string> stale;
+  if (logsRemoved()) {
+    // Row bodies are kept only to emit "removed" rows.
+    status = storeResults(current_qd, current_hashes, batch, stale);
     if (!status.ok()) {
       return status;
     }
   }
-  return Status(0, "OK");
+
+  status = setDatabaseBatch(kQueries, batch);
+  if (status.ok() && !stale.empty()) {
+    status = deleteDatabaseBatch(kQueries, stale);
+  }
+  return status;
+}
+
+Status Query::addSnapshotDigest(const QueryData& qd, bool& changed) {
+  auto digest = encodeDigest(getFingerprints(qd));
+  auto key = kQuerySnapshotPrefix + name_;
+
+  std::string previous;
+  auto status = getDatabaseValue(kQueries, key, previous);
+  changed = !status.ok() || previous != digest;
+  if (!changed) {
+    return Status(0, "OK");
+  }
+  return setDatabaseValue(kQueries, key, digest);
 }
 }
@@ -22,6 +22,15 @@ namespace osquery {
 /// Error message used when a query name isn't found in the database
 extern const std::string kQueryNameNotFoundError;
 
+/// Key prefix, within kQueries, for the fingerprints of a query's results.
+extern const std::string kQueryFingerprintsPrefix;
+
+/// Key prefix, within kQueries, for the digest of a query's snapshot results.
+extern const std::string kQuerySnapshotPrefix;
+
+/// Key prefix, within kQueries, for the chunks of a query's stored results.
+extern const std::string kQueryChunksPrefix;
+
 /**
  * @brief A class that is used to interact with the historical on-disk storage
  * for a given query.
@@ -69,6 +78,18 @@ class Query {
    */
   static std::vector<std::string> getStoredQueryNames();
 
+  /**
+   * @brief Remove everything stored for a query name.
+   *
+   * The stored results, their chunks, fingerprints, and snapshot digest are
+   * removed, such as when a query has been removed from the schedule.
+   *
+   * @param name the scheduled query name
+   *
+   * @return the success or failure of the operation
+   */
+  static Status deleteStoredResults(const std::string& name);
+
  public:
   /**
    * @brief Accessor method for checking if a given scheduled query exists in
@@ -101,7 +122,8 @@ class Query {
    *
    * Given the results of an execution of a scheduled query, add the results
    * to the database using addNewResults and get back a data structure
-   * indicating what rows in the query's results have changed.
+   * indicating what rows in the query's results have changed. If the query
+   * declares key columns the rows are matched by key, see matchDiffKeys.
    *
    * @param qd the QueryData object containing query results to store
    * @param dr an output to a DiffResults object populated based on last run
@@ -110,22 +132,101 @@ class Query {
    */
   Status addNewResults(const QueryData& qd, DiffResults& dr);
 
+  /**
+   * @brief Add a new set of results, moving the added rows into the diff.
+   *
+   * The same as Query::addNewResults, but the added rows are moved rather than
+   * copied from qd, which is left empty.
+   *
+   * @param qd the query results to store, consumed
+   * @param dr an output to a DiffResults object populated based on last run
+   *
+   * @return the success or failure of the operation
+   */
+  Status addNewResults(QueryData&& qd, DiffResults& dr);
+
  private:
   /**
    * @brief Add a new set of results to the persistent storage and get back
-   * the differential results, using a custom database handle.
+   * the differential results.
    *
-   * This method is the same as Query::addNewResults, but with the addition of a
-   * parameter which allows you to pass a custom RocksDB database handle
+   * Removed rows are always moved out of the previous results. If added is
+   * set, the indexes of the added rows within qd are returned instead of
+   * copying the rows into dr.
    *
    * @param qd the QueryData object containing query results to store
    * @param dr an output to a DiffResults object populated based on last run
+   * @param calculate_diff false if only storing the results
+   * @param added optional output, the indexes of the added rows
    *
    * @return the success or failure of the operation
    */
   Status addNewResults(const QueryData& qd,
                        DiffResults& dr,
-                       bool calculate_diff);
+                       bool calculate_diff,
+                       std::vector<size_t>* added = nullptr);
+
+  /**
+   * @brief The 'fingerprint' storage variant of addNewResults.
+   *
+   * The persisted state is a sorted list of row fingerprints (see hashRow).
+   * When the current results have the same fingerprints as the last run the
+   * stored state is neither parsed nor re-written. Row bodies are only stored,
+   * and parsed, when the query logs "removed" rows.
+   *
+   * Fingerprint equality is treated as Row equality in this mode.
+   */
+  Status addNewFingerprintedResults(const QueryData& qd,
+                                    DiffResults& dr,
+                                    bool calculate_diff,
+                                    std::vector<size_t>* added);
+
+  /**
+   * @brief Add the writes that store a result set to a batch.
+   *
+   * Results are stored as chunks of rows, see `--results_chunk_rows`, under
+   * the key of their digest, and the query's key holds the list of digests.
+   * Chunk boundaries are chosen by the rows' fingerprints, so a row added or
+   * removed changes the chunk around it and not the chunks after it. Only the
+   * chunks missing from the previous list are encoded and written.
+   *
+   * Each chunk is column dictionary encoded, see serializeQueryDataColumns,
+   * and compressed. Previous results stored as JSON are still read.
+   *
+   * @param qd the results to store
+   * @param hashes the fingerprint of each row, see hashRow
+   * @param batch output, the keys and values to write
+   * @param stale output, the chunk keys to remove once the batch is written
+   *
+   * @return the success or failure of the operation
+   */
+  Status storeResults(const QueryData& qd,
+                      const std::vector<RowHash>& hashes,
+                      DatabaseStringValueList& batch,
+                      std::vector<std::string>& stale);
+
+  /// Store a result set, writing the batch of storeResults.
+  Status storeResults(const QueryData& qd);
+
+  /// True if the scheduled query opted into fingerprint storage.
+  bool isFingerprinted() const;
+
+  /// True if the scheduled query logs "removed" rows.
+  bool logsRemoved() const;
+
+ public:
+  /**
+   * @brief Store the digest of a snapshot result set and compare it to the last.
+   *
+   * The digest combines the sorted fingerprints of each row (see hashRow), so
+   * it does not depend on row order. Only the digest is stored, never rows.
+   *
+   * @param qd the snapshot results
+   * @param changed output, false if the digest matches the last snapshot
+   *
+   * @return the success or failure of the operation
+   */
+  Status addSnapshotDigest(const QueryData& qd, bool& changed);
 
  public:
   /**
@@ -160,5 +261,8 @@ class Query {
   FRIEND_TEST(QueryTests, test_get_executions);
   FRIEND_TEST(QueryTests, test_get_query_results);
   FRIEND_TEST(QueryTests, test_query_name_not_found_in_db);
+  FRIEND_TEST(QueryTests, test_fingerprinted_results);
+  FRIEND_TEST(QueryTests, test_fingerprinted_results_without_removed);
+  FRIEND_TEST(QueryTests, test_snapshot_digest);
 };
 }
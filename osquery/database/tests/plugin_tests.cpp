@@ -8,6 +8,8 @@
  *
  */
 
+#include <thread>
+
 #include "osquery/database/tests/plugin_tests.h"
 
 namespace osquery {
@@ -20,6 +22,65 @@ class EphemeralDatabasePluginTests : public DatabasePluginTests {
 // Define the default set of database plugin operation tests.
 CREATE_DATABASE_TESTS(EphemeralDatabasePluginTests);
 
+TEST_F(EphemeralDatabasePluginTests, test_concurrent_scan_order) {
+  auto plugin = std::dynamic_pointer_cast<DatabasePlugin>(
+      Registry::get("database", "ephemeral"));
+
+  // Writers share a domain, each key is written once.
+  std::vector<std::thread> writers;
+  for (size_t i = 0; i < 4; i++) {
+    writers.emplace_back([plugin, i]() {
+      for (size_t j = 0; j < 100; j++) {
+        auto key = "key." + std::to_string(j * 4 + i + 1000);
+        plugin->put(kEvents, key, "value");
+      }
+    });
+  }
+  for (auto& writer : writers) {
+    writer.join();
+  }
+
+  // Scans merge the stripes in key order.
+  std::vector<std::string> keys;
+  EXPECT_TRUE(plugin->scan(kEvents, keys, "key.", 0));
+  EXPECT_EQ(keys.size(), 400U);
+  EXPECT_TRUE(std::is_sorted(keys.begin(), keys.end()));
+
+  keys.clear();
+  EXPECT_TRUE(plugin->scan(kEvents, keys, "key.", 3));
+  std::vector<std::string> expected = {"key.1000", "key.1001", "key.1002"};
+  EXPECT_EQ(keys, expected);
+
+  // Ranges are removed from every stripe.
+  EXPECT_TRUE(plugin->removeRange(kEvents, "key.1000", "key.1200"));
+  keys.clear();
+  plugin->scan(kEvents, keys, "key.", 0);
+  EXPECT_EQ(keys.size(), 200U);
+  EXPECT_EQ(keys.front(), "key.1200");
+}
+
+TEST_F(EphemeralDatabasePluginTests, test_statistics) {
+  auto plugin = std::dynamic_pointer_cast<DatabasePlugin>(
+      Registry::get("database", "ephemeral"));
+  plugin->put(kQueries, "stat_key", "value");
+  plugin->put(kQueries, "stat_key", "longer value");
+  plugin->put(kQueries, "stat_other", "v");
+
+  std::map<std::string, std::string> stats;
+  EXPECT_TRUE(plugin->statistics(stats));
+  auto bytes = std::string("stat_key").size() +
+               std::string("longer value").size() +
+               std::string("stat_other").size() + 1;
+  EXPECT_EQ(stats["osquery.database.ephemeral.queries.keys"], "2");
+  EXPECT_EQ(stats["osquery.database.ephemeral.queries.bytes"],
+            std::to_string(bytes));
+
+  plugin->remove(kQueries, "stat_key");
+  stats.clear();
+  plugin->statistics(stats);
+  EXPECT_EQ(stats["osquery.database.ephemeral.queries.keys"], "1");
+}
+
 void DatabasePluginTests::testPluginCheck() {
   // Do not worry about multiple set-active calls.
   // For testing purposes they should be idempotent.
@@ -57,6 +118,23 @@ void DatabasePluginTests::testDelete() {
   EXPECT_EQ(s.getMessage(), "OK");
 }
 
+void DatabasePluginTests::testDeleteRange() {
+  getPlugin()->put(kQueries, "test_range_1", "baz");
+  getPlugin()->put(kQueries, "test_range_2", "baz");
+  getPlugin()->put(kQueries, "test_range_3", "baz");
+  getPlugin()->put(kQueries, "test_rangf", "baz");
+
+  // The low bound is removed and the high bound is kept.
+  auto s = getPlugin()->removeRange(kQueries, "test_range_1", "test_range_3");
+  EXPECT_TRUE(s.ok());
+
+  std::vector<std::string> keys;
+  getPlugin()->scan(kQueries, keys, "test_rang");
+  std::sort(keys.begin(), keys.end());
+  std::vector<std::string> expected = {"test_range_3", "test_rangf"};
+  EXPECT_EQ(keys, expected);
+}
+
 void DatabasePluginTests::testScan() {
   getPlugin()->put(kQueries, "test_scan_foo1", "baz");
   getPlugin()->put(kQueries, "test_scan_foo2", "baz");
@@ -85,4 +163,51 @@ void DatabasePluginTests::testScanLimit() {
   EXPECT_EQ(s.getMessage(), "OK");
   EXPECT_EQ(keys.size(), 2U);
 }
+
+void DatabasePluginTests::testScanCallback() {
+  getPlugin()->put(kQueries, "test_scan_foo1", "baz");
+  getPlugin()->put(kQueries, "test_scan_foo2", "baz");
+  getPlugin()->put(kQueries, "test_scan_fop", "baz");
+
+  // Only keys with the prefix are found.
+  std::vector<std::string> keys;
+  auto s = getPlugin()->scan(kQueries,
+                             "test_scan_foo",
+                             [&keys](const std::string& key) {
+                               keys.push_back(key);
+                               return true;
+                             });
+  EXPECT_TRUE(s.ok());
+  std::sort(keys.begin(), keys.end());
+  EXPECT_EQ(keys,
+            std::vector<std::string>({"test_scan_foo1", "test_scan_foo2"}));
+
+  // The callback may stop the scan.
+  size_t count = 0;
+  s = getPlugin()->scan(kQueries, "test_scan_", [&count](const std::string&) {
+    count++;
+    return false;
+  });
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(count, 1U);
+}
+
+void DatabasePluginTests::testBatch() {
+  auto s = getPlugin()->putBatch(
+      kQueries, {{"test_batch_1", "one"}, {"test_batch_2", "two"}});
+  EXPECT_TRUE(s.ok());
+
+  // Values are returned in key order, a missing key has an empty value.
+  std::vector<std::string> values;
+  s = getPlugin()->getBatch(
+      kQueries, {"test_batch_2", "test_batch_none", "test_batch_1"}, values);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(values, std::vector<std::string>({"two", "", "one"}));
+
+  s = getPlugin()->removeBatch(kQueries, {"test_batch_1", "test_batch_2"});
+  EXPECT_TRUE(s.ok());
+  std::string value;
+  EXPECT_FALSE(getPlugin()->get(kQueries, "test_batch_1", value).ok());
+  EXPECT_FALSE(getPlugin()->get(kQueries, "test_batch_2", value).ok());
+}
 }
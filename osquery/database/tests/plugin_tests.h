@@ -20,13 +20,16 @@
 #include "osquery/tests/test_util.h"
 
 /// The following test macros allow pretty test output.
-#define CREATE_DATABASE_TESTS(n)                      \
-  TEST_F(n, test_plugin_check) { testPluginCheck(); } \
-  TEST_F(n, test_put) { testPut(); }                  \
-  TEST_F(n, test_get) { testGet(); }                  \
-  TEST_F(n, test_delete) { testDelete(); }            \
-  TEST_F(n, test_scan) { testScan(); }                \
-  TEST_F(n, test_scan_limit) { testScanLimit(); }
+#define CREATE_DATABASE_TESTS(n)                        \
+  TEST_F(n, test_plugin_check) { testPluginCheck(); }   \
+  TEST_F(n, test_put) { testPut(); }                    \
+  TEST_F(n, test_get) { testGet(); }                    \
+  TEST_F(n, test_delete) { testDelete(); }              \
+  TEST_F(n, test_delete_range) { testDeleteRange(); }   \
+  TEST_F(n, test_scan) { testScan(); }                  \
+  TEST_F(n, test_scan_limit) { testScanLimit(); }       \
+  TEST_F(n, test_scan_callback) { testScanCallback(); } \
+  TEST_F(n, test_batch) { testBatch(); }
 
 namespace osquery {
 
@@ -80,7 +83,10 @@ class DatabasePluginTests : public testing::Test {
   void testPut();
   void testGet();
   void testDelete();
+  void testDeleteRange();
   void testScan();
   void testScanLimit();
+  void testScanCallback();
+  void testBatch();
 };
 }
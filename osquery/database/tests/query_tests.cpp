@@ -16,11 +16,15 @@
 
 #include <gtest/gtest.h>
 
+#include <osquery/flags.h>
+
 #include "osquery/tests/test_util.h"
 #include "osquery/database/query.h"
 
 namespace osquery {
 
+DECLARE_uint64(results_chunk_rows);
+
 class QueryTests : public testing::Test {};
 
 TEST_F(QueryTests, test_private_members) {
@@ -108,4 +112,179 @@ TEST_F(QueryTests, test_get_stored_query_names) {
   auto in_vector = std::find(names.begin(), names.end(), "foobar");
   EXPECT_NE(in_vector, names.end());
 }
+
+TEST_F(QueryTests, test_add_new_results_move) {
+  auto query = getOsqueryScheduledQuery();
+  auto cf = Query("moved", query);
+
+  for (auto result : getTestDBResultStream()) {
+    QueryData previous_qd;
+    cf.getPreviousQueryResults(previous_qd);
+    auto expected = diff(previous_qd, result.second);
+
+    // Moved results yield the same differential and leave the input empty.
+    auto current = result.second;
+    DiffResults dr;
+    auto status = cf.addNewResults(std::move(current), dr);
+    EXPECT_TRUE(status.ok());
+    EXPECT_EQ(dr, expected);
+    EXPECT_TRUE(current.empty());
+
+    QueryData stored;
+    cf.getPreviousQueryResults(stored);
+    EXPECT_EQ(stored, result.second);
+  }
+}
+
+TEST_F(QueryTests, test_fingerprinted_results) {
+  auto query = getOsqueryScheduledQuery();
+  query.options["fingerprint"] = true;
+  auto cf = Query("fingerprinted", query);
+  EXPECT_TRUE(cf.isFingerprinted());
+
+  auto status = cf.addNewResults(getTestDBExpectedResults());
+  EXPECT_TRUE(status.ok());
+
+  // The fingerprinted differentials must match the Row-exact differentials.
+  for (auto result : getTestDBResultStream()) {
+    QueryData previous_qd;
+    cf.getPreviousQueryResults(previous_qd);
+
+    DiffResults dr;
+    status = cf.addNewResults(result.second, dr, true);
+    EXPECT_TRUE(status.ok());
+    auto expected = diff(previous_qd, result.second);
+    EXPECT_EQ(dr.added, expected.added);
+    EXPECT_EQ(dr.removed.size(), expected.removed.size());
+
+    // An unchanged result set yields no differential.
+    DiffResults unchanged;
+    status = cf.addNewResults(result.second, unchanged, true);
+    EXPECT_TRUE(status.ok());
+    EXPECT_TRUE(unchanged.added.empty());
+    EXPECT_TRUE(unchanged.removed.empty());
+  }
+}
+
+TEST_F(QueryTests, test_fingerprinted_results_without_removed) {
+  auto query = getOsqueryScheduledQuery();
+  query.options["fingerprint"] = true;
+  query.options["removed"] = false;
+  auto cf = Query("fingerprinted_no_removed", query);
+
+  QueryData qd = {{{"foo", "bar"}}, {{"foo", "baz"}}};
+  DiffResults dr;
+  auto status = cf.addNewResults(qd, dr, true);
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(dr.added, qd);
+
+  // Row bodies are not stored when removed rows are not logged.
+  EXPECT_FALSE(cf.isQueryNameInDatabase());
+
+  qd.pop_back();
+  qd.push_back({{"foo", "qux"}});
+  DiffResults next;
+  status = cf.addNewResults(qd, next, true);
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(next.added, QueryData({{{"foo", "qux"}}}));
+  EXPECT_TRUE(next.removed.empty());
+}
+
+/// The keys of a query's stored chunks.
+static std::vector<std::string> getChunkKeys(const std::string& name) {
+  std::vector<std::string> keys;
+  scanDatabaseKeys(kQueries, keys, kQueryChunksPrefix + name + ".");
+  return keys;
+}
+
+TEST_F(QueryTests, test_chunked_results) {
+  auto chunk_rows = FLAGS_results_chunk_rows;
+  FLAGS_results_chunk_rows = 4;
+
+  auto query = getOsqueryScheduledQuery();
+  auto cf = Query("chunked", query);
+  QueryData qd;
+  for (size_t i = 0; i < 100; i++) {
+    qd.push_back({{"id", std::to_string(i)}, {"name", "example"}});
+  }
+  DiffResults dr;
+  auto status = cf.addNewResults(qd, dr);
+  EXPECT_TRUE(status.ok());
+
+  // The rows are stored in several chunks, and read in order.
+  auto chunks = getChunkKeys("chunked");
+  EXPECT_GT(chunks.size(), 4U);
+  QueryData previous;
+  EXPECT_TRUE(cf.getPreviousQueryResults(previous).ok());
+  EXPECT_EQ(previous, qd);
+
+  // A small change rewrites a few chunks, and removes the replaced chunks.
+  qd[50]["name"] = "changed";
+  DiffResults changed;
+  status = cf.addNewResults(qd, changed);
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(changed.added.size(), 1U);
+  EXPECT_EQ(changed.removed.size(), 1U);
+
+  auto rewritten = getChunkKeys("chunked");
+  size_t kept = 0;
+  for (const auto& key : rewritten) {
+    kept += std::count(chunks.begin(), chunks.end(), key);
+  }
+  EXPECT_GT(kept, chunks.size() / 2);
+  EXPECT_LE(rewritten.size(), chunks.size() + 2);
+  previous.clear();
+  EXPECT_TRUE(cf.getPreviousQueryResults(previous).ok());
+  EXPECT_EQ(previous, qd);
+
+  // Storing JSON again removes every chunk.
+  FLAGS_results_chunk_rows = 0;
+  qd.pop_back();
+  status = cf.addNewResults(qd, changed);
+  EXPECT_TRUE(status.ok());
+  EXPECT_TRUE(getChunkKeys("chunked").empty());
+  previous.clear();
+  EXPECT_TRUE(cf.getPreviousQueryResults(previous).ok());
+  EXPECT_EQ(previous, qd);
+
+  // Everything stored for the query is removed together.
+  FLAGS_results_chunk_rows = 4;
+  status = cf.addNewResults(qd, changed);
+  EXPECT_FALSE(getChunkKeys("chunked").empty());
+  EXPECT_TRUE(Query::deleteStoredResults("chunked").ok());
+  EXPECT_TRUE(getChunkKeys("chunked").empty());
+  EXPECT_FALSE(cf.isQueryNameInDatabase());
+  FLAGS_results_chunk_rows = chunk_rows;
+}
+
+TEST_F(QueryTests, test_snapshot_digest) {
+  auto query = getOsqueryScheduledQuery();
+  query.options["snapshot_if_changed"] = true;
+  auto cf = Query("snapshot_digest", query);
+
+  // The first snapshot is always a change.
+  QueryData qd = {{{"foo", "bar"}}, {{"foo", "baz"}}};
+  bool changed = false;
+  auto status = cf.addSnapshotDigest(qd, changed);
+  EXPECT_TRUE(status.ok());
+  EXPECT_TRUE(changed);
+
+  // Row order does not matter.
+  QueryData reordered = {{{"foo", "baz"}}, {{"foo", "bar"}}};
+  status = cf.addSnapshotDigest(reordered, changed);
+  EXPECT_TRUE(status.ok());
+  EXPECT_FALSE(changed);
+
+  // Duplicated rows are a change.
+  reordered.push_back({{"foo", "bar"}});
+  status = cf.addSnapshotDigest(reordered, changed);
+  EXPECT_TRUE(status.ok());
+  EXPECT_TRUE(changed);
+
+  // Only the digest is stored.
+  EXPECT_FALSE(cf.isQueryNameInDatabase());
+  std::string digest;
+  getDatabaseValue(kQueries, kQuerySnapshotPrefix + "snapshot_digest", digest);
+  EXPECT_EQ(digest.size(), 16U);
+}
 }
@@ -14,6 +14,8 @@
 
 #include <gtest/gtest.h>
 
+#include <boost/property_tree/json_parser.hpp>
+
 #include <osquery/database.h>
 #include <osquery/logger.h>
 
@@ -23,6 +25,8 @@ namespace pt = boost::property_tree;
 
 namespace osquery {
 
+DECLARE_bool(decorations_top_level);
+
 class ResultsTests : public testing::Test {};
 
 TEST_F(ResultsTests, test_simple_diff) {
@@ -38,6 +42,119 @@ TEST_F(ResultsTests, test_simple_diff) {
   EXPECT_EQ(results.removed, o);
 }
 
+TEST_F(ResultsTests, test_diff_duplicates) {
+  Row r1 = {{"foo", "bar"}};
+  Row r2 = {{"foo", "baz"}};
+
+  // Rows are compared as a multiset, the duplicate r1 is one addition.
+  QueryData o = {r1, r2};
+  QueryData n = {r1, r1};
+  auto results = diff(o, n);
+  EXPECT_EQ(results.added, QueryData({r1}));
+  EXPECT_EQ(results.removed, QueryData({r2}));
+
+  results = diff(n, o);
+  EXPECT_EQ(results.added, QueryData({r2}));
+  EXPECT_EQ(results.removed, QueryData({r1}));
+
+  results = diff(o, o);
+  EXPECT_TRUE(results.added.empty());
+  EXPECT_TRUE(results.removed.empty());
+}
+
+TEST_F(ResultsTests, test_match_diff_keys) {
+  Row r1 = {{"pid", "1"}, {"name", "init"}, {"resident_size", "10"}};
+  Row r2 = {{"pid", "2"}, {"name", "bash"}, {"resident_size", "20"}};
+  Row r1_grown = {{"pid", "1"}, {"name", "init"}, {"resident_size", "11"}};
+  Row r3 = {{"pid", "3"}, {"name", "ssh"}, {"resident_size", "30"}};
+
+  // A modified row is one change of its key and modified columns.
+  auto results = diff({r1, r2}, {r1_grown, r3});
+  matchDiffKeys(results, {"pid"});
+  EXPECT_EQ(results.added, QueryData({r3}));
+  EXPECT_EQ(results.removed, QueryData({r2}));
+  Row change = {{"pid", "1"}, {"resident_size", "11"}};
+  EXPECT_EQ(results.changed, QueryData({change}));
+
+  // Without key columns the differential is unchanged.
+  auto unkeyed = diff({r1, r2}, {r1_grown, r3});
+  matchDiffKeys(unkeyed, {});
+  EXPECT_EQ(unkeyed, diff({r1, r2}, {r1_grown, r3}));
+
+  // Rows missing a key column are not matched.
+  results = diff({r1}, {r1_grown});
+  matchDiffKeys(results, {"pid", "start_time"});
+  EXPECT_TRUE(results.changed.empty());
+  EXPECT_EQ(results.added.size(), 1U);
+  EXPECT_EQ(results.removed.size(), 1U);
+
+  // Equal keys are matched in order.
+  Row d1 = {{"k", "a"}, {"v", "1"}};
+  Row d2 = {{"k", "a"}, {"v", "2"}};
+  Row d3 = {{"k", "a"}, {"v", "3"}};
+  results = diff({d1, d2}, {d3});
+  matchDiffKeys(results, {"k"});
+  EXPECT_EQ(results.changed, QueryData({d3}));
+  EXPECT_EQ(results.removed, QueryData({d2}));
+  EXPECT_TRUE(results.added.empty());
+}
+
+TEST_F(ResultsTests, test_serialize_diff_results_changed) {
+  DiffResults dr;
+  dr.changed.push_back({{"pid", "1"}, {"resident_size", "11"}});
+
+  std::string json;
+  auto status = serializeDiffResultsJSON(dr, json);
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(json,
+            "{\"added\":[],\"removed\":[],"
+            "\"changed\":[{\"pid\":\"1\",\"resident_size\":\"11\"}]}\n");
+
+  std::vector<std::string> events;
+  QueryLogItem item;
+  item.results = dr;
+  status = serializeQueryLogItemAsEventsJSON(item, events);
+  EXPECT_TRUE(status.ok());
+  ASSERT_EQ(events.size(), 1U);
+  EXPECT_NE(events[0].find("\"action\":\"changed\""), std::string::npos);
+}
+
+TEST_F(ResultsTests, test_row_columns) {
+  Row r = {{"b", "2"}, {"a", "1"}};
+  r["c"] = "3";
+  EXPECT_EQ(r.size(), 3U);
+
+  // Columns are iterated in name order, as a std::map would.
+  std::vector<std::string> names;
+  for (const auto& column : r) {
+    names.push_back(column.first);
+  }
+  EXPECT_EQ(names, std::vector<std::string>({"a", "b", "c"}));
+
+  // Inserting an existing column does not replace its value.
+  EXPECT_FALSE(r.insert(std::make_pair("a", "0")).second);
+  EXPECT_EQ(r.at("a"), "1");
+  EXPECT_EQ(r.count("d"), 0U);
+  EXPECT_THROW(r.at("d"), std::out_of_range);
+
+  EXPECT_EQ(r.erase("b"), 1U);
+  EXPECT_TRUE(r.find("b") == r.end());
+  EXPECT_EQ(r, Row({{"a", "1"}, {"c", "3"}}));
+
+  // A Row converts to and from a std::map.
+  std::map<std::string, std::string> m = r;
+  EXPECT_EQ(m.size(), 2U);
+  EXPECT_EQ(Row(m), r);
+}
+
+TEST_F(ResultsTests, test_hash_row) {
+  Row r1 = {{"a", "bc"}};
+  Row r2 = {{"ab", "c"}};
+  EXPECT_EQ(hashRow(r1), hashRow(Row({{"a", "bc"}})));
+  EXPECT_NE(hashRow(r1), hashRow(r2));
+  EXPECT_NE(hashRow(Row()), hashRow(Row({{"", ""}})));
+}
+
 TEST_F(ResultsTests, test_serialize_row) {
   auto results = getSerializedRow();
   pt::ptree tree;
@@ -89,6 +206,56 @@ TEST_F(ResultsTests, test_deserialize_query_data_json) {
   EXPECT_EQ(output, results.second);
 }
 
+TEST_F(ResultsTests, test_serialize_query_data_binary) {
+  auto results = getSerializedQueryDataJSON();
+  // Binary content may include NUL bytes and empty values.
+  results.second.push_back({{"name", std::string("a\0b", 3)}, {"empty", ""}});
+
+  std::string binary;
+  auto s = serializeQueryDataBinary(results.second, binary);
+  EXPECT_TRUE(s.ok());
+  EXPECT_LT(binary.size(), results.first.size());
+
+  QueryData output;
+  s = deserializeQueryDataBinary(binary, output);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(output, results.second);
+
+  // Truncated content is rejected.
+  s = deserializeQueryDataBinary(binary.substr(0, binary.size() - 1), output);
+  EXPECT_FALSE(s.ok());
+}
+
+TEST_F(ResultsTests, test_serialize_query_data_columns) {
+  auto results = getSerializedQueryDataJSON();
+  // Rows may be missing columns, and values may include NUL bytes.
+  results.second.push_back({{"name", std::string("a\0b", 3)}, {"empty", ""}});
+  results.second.push_back({{"name", std::string("a\0b", 3)}});
+
+  std::string binary;
+  auto s = serializeQueryDataColumns(results.second, binary);
+  EXPECT_TRUE(s.ok());
+  EXPECT_LT(binary.size(), results.first.size());
+
+  QueryData output;
+  s = deserializeQueryDataColumns(binary, output);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(output, results.second);
+
+  // Truncated content is rejected.
+  s = deserializeQueryDataColumns(binary.substr(0, binary.size() - 1), output);
+  EXPECT_FALSE(s.ok());
+
+  // Repeated values are stored once.
+  QueryData repeated(100, {{"path", "/usr/local/lib/libexample.dylib"}});
+  s = serializeQueryDataColumns(repeated, binary);
+  EXPECT_TRUE(s.ok());
+  EXPECT_LT(binary.size(), 200U);
+  s = deserializeQueryDataColumns(binary, output);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(output, repeated);
+}
+
 TEST_F(ResultsTests, test_serialize_diff_results) {
   auto results = getSerializedDiffResults();
   pt::ptree tree;
@@ -136,6 +303,106 @@ TEST_F(ResultsTests, test_deserialize_query_log_item_json) {
   EXPECT_EQ(output, results.second);
 }
 
+/// Serialize using a property tree, as the JSON serializers once did.
+static std::string writeTree(const pt::ptree& tree) {
+  std::ostringstream output;
+  pt::write_json(output, tree, false);
+  return output.str();
+}
+
+TEST_F(ResultsTests, test_serialize_json_writer) {
+  Row r1;
+  r1["path"] = "/usr/bin/\"sh\"";
+  r1["cmdline"] = "a\tb\nc\x01\\";
+  Row r2;
+  r2["path"] = "";
+
+  QueryLogItem item;
+  item.results.added = {r1, Row(), r2};
+  item.name = "foo/bar";
+  item.identifier = "host";
+  item.calendar_time = "Mon Aug 25 12:10:57 2014";
+  item.time = 1408993857;
+  item.decorations["name"] = "decorated";
+  item.decorations["zone"] = "us\\east";
+
+  // The writer serializers match the property tree serializers.
+  std::string json;
+  pt::ptree tree;
+  serializeRowJSON(r1, json);
+  serializeRow(r1, tree);
+  EXPECT_EQ(json, writeTree(tree));
+
+  for (const auto& qd : {QueryData(), item.results.added}) {
+    tree.clear();
+    serializeQueryDataJSON(qd, json);
+    serializeQueryData(qd, tree);
+    EXPECT_EQ(json, writeTree(tree));
+  }
+
+  tree.clear();
+  serializeDiffResultsJSON(item.results, json);
+  serializeDiffResults(item.results, tree);
+  EXPECT_EQ(json, writeTree(tree));
+
+  auto snapshot = item;
+  snapshot.snapshot_results = snapshot.results.added;
+  snapshot.results = DiffResults();
+  for (auto top_level : {false, true}) {
+    FLAGS_decorations_top_level = top_level;
+    for (const auto& i : {item, snapshot}) {
+      tree.clear();
+      serializeQueryLogItemJSON(i, json);
+      serializeQueryLogItem(i, tree);
+      EXPECT_EQ(json, writeTree(tree));
+    }
+
+    std::vector<std::string> events;
+    serializeQueryLogItemAsEventsJSON(item, events);
+    tree.clear();
+    serializeQueryLogItemAsEvents(item, tree);
+    ASSERT_EQ(events.size(), tree.size());
+    size_t index = 0;
+    for (const auto& event : tree) {
+      EXPECT_EQ(events[index++], writeTree(event.second));
+    }
+  }
+  FLAGS_decorations_top_level = false;
+}
+
+TEST_F(ResultsTests, test_deserialize_json_parser) {
+  std::vector<std::string> documents = {
+      "{\"\":{\"a\":\"1\",\"b\":\"x\\/y\"},\"\":\"\",\"\":{\"n\":{\"x\":\"1\"},"
+      "\"\":\"skip\",\"c\":2,\"c\":true}}\n",
+      "[{\"a\":\"1\"},\"str\",[1],{}]",
+      "{}",
+      "\"value\"",
+  };
+
+  // Parsing directly into rows matches reading through a property tree.
+  for (const auto& json : documents) {
+    pt::ptree tree;
+    std::stringstream input(json);
+    pt::read_json(input, tree);
+
+    QueryData expected;
+    deserializeQueryData(tree, expected);
+    QueryData qd;
+    EXPECT_TRUE(deserializeQueryDataJSON(json, qd).ok());
+    EXPECT_EQ(qd, expected) << json;
+
+    Row expected_row;
+    deserializeRow(tree, expected_row);
+    Row r;
+    EXPECT_TRUE(deserializeRowJSON(json, r).ok());
+    EXPECT_EQ(r, expected_row) << json;
+  }
+
+  QueryData qd;
+  EXPECT_FALSE(deserializeQueryDataJSON("{\"\":{\"a\":}", qd).ok());
+  EXPECT_TRUE(qd.empty());
+}
+
 TEST_F(ResultsTests, test_adding_duplicate_rows_to_query_data) {
   Row r1, r2, r3;
   r1["foo"] = "bar";
@@ -162,4 +429,28 @@ TEST_F(ResultsTests, test_adding_duplicate_rows_to_query_data) {
   EXPECT_FALSE(s);
   EXPECT_EQ(q.size(), 2U);
 }
+
+TEST_F(ResultsTests, test_performance_histogram) {
+  PerformanceHistogram histogram;
+  EXPECT_EQ(histogram.percentile(50), 0U);
+
+  for (size_t i = 1; i <= 1000; ++i) {
+    histogram.record(i);
+  }
+  EXPECT_EQ(histogram.count(), 1000U);
+  EXPECT_EQ(histogram.max(), 1000U);
+
+  // Percentiles are the upper bound of a bucket, within an eighth above.
+  EXPECT_GE(histogram.percentile(50), 500U);
+  EXPECT_LE(histogram.percentile(50), 500U + 500U / 8);
+  EXPECT_GE(histogram.percentile(99), 990U);
+  EXPECT_EQ(histogram.percentile(100), 1000U);
+
+  // Small values are counted exactly.
+  PerformanceHistogram small;
+  small.record(3);
+  small.record(7);
+  EXPECT_EQ(small.percentile(50), 3U);
+  EXPECT_EQ(small.percentile(100), 7U);
+}
 }
@@ -64,6 +64,23 @@ void prettyPrint(const QueryData& results,
                  const std::vector<std::string>& columns,
                  std::map<std::string, size_t>& lengths);
 
+/**
+ * @brief Pretty print the header and first rows of a result
+ *
+ * The columns are sized using the supplied rows. Later rows may be printed
+ * with generateRow and the returned separator closes the table, so a shell
+ * only needs to keep the first rows of a large result.
+ *
+ * @param results The first rows to print
+ * @param columns The order of the keys (since maps are unordered)
+ * @param lengths A mutable set of column lengths
+ *
+ * @return The separator to print after the last row, empty without rows
+ */
+std::string prettyPrintHead(const QueryData& results,
+                            const std::vector<std::string>& columns,
+                            std::map<std::string, size_t>& lengths);
+
 /**
  * @brief JSON print a QueryData object
  *
@@ -74,6 +91,22 @@ void prettyPrint(const QueryData& results,
  */
 void jsonPrint(const QueryData& q);
 
+/**
+ * @brief JSON print one row of a JSON array
+ *
+ * Rows after the first are preceded by a comma, the caller prints the
+ * enclosing brackets.
+ *
+ * @param r The row to print
+ * @param first True if no row of the array has been printed
+ *
+ * @return true if the row was printed
+ */
+bool jsonPrintRow(const Row& r, bool first);
+
+/// JSON print one row as a single line, see the 'jsonl' shell mode.
+void jsonLinePrint(const Row& r);
+
 /**
  * @brief Compute a map of metadata about the supplied QueryData object
  *
@@ -90,11 +90,11 @@ std::string generateRow(const Row& r,
       size = column.size() - utf8StringSize(FLAGS_nullvalue);
       out += FLAGS_nullvalue;
     } else {
+      // A value longer than its column, possible once the columns are sized
+      // from the first rows only, is printed whole and shifts the row.
       int buffer_size = lengths.at(column) - utf8StringSize(r.at(column));
-      if (buffer_size >= 0) {
-        size = static_cast<size_t>(buffer_size);
-        out += r.at(column);
-      }
+      size = (buffer_size > 0) ? static_cast<size_t>(buffer_size) : 0;
+      out += r.at(column);
     }
     out += std::string(size + 1, ' ');
   }
@@ -107,11 +107,11 @@ std::string generateRow(const Row& r,
   return out;
 }
 
-void prettyPrint(const QueryData& results,
-                 const std::vector<std::string>& columns,
-                 std::map<std::string, size_t>& lengths) {
+std::string prettyPrintHead(const QueryData& results,
+                            const std::vector<std::string>& columns,
+                            std::map<std::string, size_t>& lengths) {
   if (results.size() == 0) {
-    return;
+    return "";
   }
 
   // Call a final compute using the column names as minimum lengths.
@@ -126,25 +126,46 @@ void prettyPrint(const QueryData& results,
   for (const auto& row : results) {
     printf("%s", generateRow(row, lengths, columns).c_str());
   }
+  return separator;
+}
+
+void prettyPrint(const QueryData& results,
+                 const std::vector<std::string>& columns,
+                 std::map<std::string, size_t>& lengths) {
+  auto separator = prettyPrintHead(results, columns, lengths);
   printf("%s", separator.c_str());
 }
 
+bool jsonPrintRow(const Row& r, bool first) {
+  std::string row_string;
+  if (!serializeRowJSON(r, row_string).ok()) {
+    return false;
+  }
+
+  row_string.pop_back();
+  printf("%s  %s", (first) ? "" : ",\n", row_string.c_str());
+  return true;
+}
+
 void jsonPrint(const QueryData& q) {
   printf("[\n");
-  for (size_t i = 0; i < q.size(); ++i) {
-    std::string row_string;
-
-    if (serializeRowJSON(q[i], row_string).ok()) {
-      row_string.pop_back();
-      printf("  %s", row_string.c_str());
-      if (i < q.size() - 1) {
-        printf(",\n");
-      }
+  bool first = true;
+  for (const auto& row : q) {
+    if (jsonPrintRow(row, first)) {
+      first = false;
     }
   }
   printf("\n]\n");
 }
 
+void jsonLinePrint(const Row& r) {
+  std::string row_string;
+  if (serializeRowJSON(r, row_string).ok()) {
+    // The serialized row ends with a newline.
+    printf("%s", row_string.c_str());
+  }
+}
+
 void computeRowLengths(const Row& r,
                        std::map<std::string, size_t>& lengths,
                        bool use_columns) {
@@ -18,6 +18,9 @@
 #include <sys/resource.h>
 #include <sys/time.h>
 
+#include <algorithm>
+#include <memory>
+
 #include <readline/history.h>
 #include <readline/readline.h>
 
@@ -31,6 +34,7 @@
 #include <osquery/flags.h>
 #include <osquery/packs.h>
 
+#include "osquery/core/tracing.h"
 #include "osquery/devtools/devtools.h"
 #include "osquery/sql/virtual_table.h"
 
@@ -48,6 +52,10 @@ SHELL_FLAG(bool, list, false, "Set output mode to 'list'");
 SHELL_FLAG(string, separator, "|", "Set output field separator, default '|'");
 SHELL_FLAG(bool, header, true, "Toggle column headers true/false");
 SHELL_FLAG(string, pack, "", "Run all queries in a pack");
+SHELL_FLAG(uint64,
+           pretty_rows,
+           1024,
+           "Rows used to size pretty columns, 0 sizes from every row");
 
 /// Define short-hand shell switches.
 SHELL_FLAG(bool, L, false, "List all table names");
@@ -71,13 +79,17 @@ static char zHelp[] =
     "                     column   Left-aligned columns.  (See .width)\n"
     "                     line     One value per line\n"
     "                     list     Values delimited by .separator string\n"
+    "                     json     JSON array, printed as rows are read\n"
+    "                     jsonl    One JSON object per line\n"
     "                     pretty   Pretty printed SQL results\n"
     ".nullvalue STR     Use STRING in place of NULL values\n"
     ".print STR...      Print literal STRING\n"
+    ".profile ON|OFF    Report the generation cost of each table cursor\n"
     ".quit              Exit this program\n"
     ".schema [TABLE]    Show the CREATE statements\n"
     ".separator STR     Change separator used by output mode and .import\n"
     ".show              Show the current values for various settings\n"
+    ".spans FILE        Write tracing spans as Chrome trace JSON\n"
     ".tables [TABLE]    List names of tables\n"
     ".trace FILE|off    Output each SQL statement as it is run\n"
     ".width [NUM1]+     Set column widths for \"column\" mode\n";
@@ -92,9 +104,11 @@ static char zTimerHelp[] =
 #define MODE_Semi 3 // Same as MODE_List but append ";" to each line
 #define MODE_Csv 4 // Quote strings, numbers are plain
 #define MODE_Pretty 5 // Pretty print the SQL results
+#define MODE_Json 6 // A JSON array of objects, one per record
+#define MODE_JsonLines 7 // One JSON object per line
 
 static const char *modeDescr[] = {
-    "line", "column", "list", "semi", "csv", "pretty",
+    "line", "column", "list", "semi", "csv", "pretty", "json", "jsonl",
 };
 
 // Make sure isatty() has a prototype.
@@ -269,9 +283,13 @@ static char *one_input_line(FILE *in, char *zPrior, int isContinuation) {
 ** Pretty print structure
  */
 struct prettyprint_data {
+  /// The rows kept to size the columns, at most `--pretty_rows`.
   osquery::QueryData results;
   std::vector<std::string> columns;
   std::map<std::string, size_t> lengths;
+
+  /// Set once the header is printed, later rows are printed as they are read.
+  std::string separator;
 };
 
 /*
@@ -299,6 +317,7 @@ struct callback_data {
   int *aiIndent; /* Array of indents used in MODE_Explain */
   int nIndent; /* Size of array aiIndent[] */
   int iIndent; /* Index of current op in aiIndent[] */
+  int profileOn; /* True to report table cursor costs after each statement */
 
   /* Additional attributes to be used in pretty mode */
   struct prettyprint_data *prettyPrint;
@@ -429,6 +448,90 @@ static void interrupt_handler(int signal) {
 }
 #endif
 
+/*
+** Copy a result row into an osquery row, NULL values use the nullvalue.
+*/
+static osquery::Row shell_row(int nArg, char **azArg, char **azCol) {
+  osquery::Row r;
+  for (int i = 0; i < nArg; ++i) {
+    if (azCol[i] != nullptr) {
+      r[std::string(azCol[i])] = (azArg[i] == nullptr)
+                                     ? osquery::FLAGS_nullvalue
+                                     : std::string(azArg[i]);
+    }
+  }
+  return r;
+}
+
+/*
+** Print the rows kept to size the pretty columns and the header.
+*/
+static void print_pretty_head(struct prettyprint_data *pretty) {
+  pretty->separator = osquery::prettyPrintHead(
+      pretty->results, pretty->columns, pretty->lengths);
+  pretty->results.clear();
+}
+
+/*
+** Finish printing the results of a statement in the pretty and JSON modes,
+** the other modes print each row as it is read.
+*/
+static void finish_results(struct callback_data *p, int nCol) {
+  if (p->mode == MODE_Pretty) {
+    auto pretty = p->prettyPrint;
+    if (pretty->separator.empty()) {
+      print_pretty_head(pretty);
+    }
+    printf("%s", pretty->separator.c_str());
+    pretty->results.clear();
+    pretty->columns.clear();
+    pretty->lengths.clear();
+    pretty->separator.clear();
+  } else if (p->mode == MODE_Json && nCol > 0) {
+    printf("%s\n]\n", (p->cnt == 0) ? "[\n" : "");
+  }
+}
+
+/*
+** Report the cost of each table cursor used by a statement, the most
+** expensive first, followed by the statement's totals.
+*/
+static void print_profile(const osquery::QueryProfileScope &profile) {
+  std::vector<const osquery::CursorProfile *> cursors;
+  osquery::CursorProfile total;
+  total.table = "total";
+  for (const auto &cursor : profile.cursors()) {
+    cursors.push_back(&cursor.second);
+    total.filters += cursor.second.filters;
+    total.rows_generated += cursor.second.rows_generated;
+    total.rows_returned += cursor.second.rows_returned;
+    total.generate_time += cursor.second.generate_time;
+    total.bytes += cursor.second.bytes;
+  }
+  if (cursors.empty()) {
+    return;
+  }
+
+  std::stable_sort(cursors.begin(),
+                   cursors.end(),
+                   [](const osquery::CursorProfile *left,
+                      const osquery::CursorProfile *right) {
+                     return left->generate_time > right->generate_time;
+                   });
+  cursors.push_back(&total);
+  for (const auto *cursor : cursors) {
+    fprintf(stderr,
+            "osquery profile: %s filters=%zu generated=%zu returned=%zu "
+            "time=%.3fms bytes=%zu\n",
+            cursor->table.c_str(),
+            cursor->filters,
+            cursor->rows_generated,
+            cursor->rows_returned,
+            cursor->generate_time / 1000.0,
+            cursor->bytes);
+  }
+}
+
 /*
 ** This is the callback routine that the shell
 ** invokes for each row of a query result.
@@ -440,22 +543,40 @@ static int shell_callback(
 
   switch (p->mode) {
   case MODE_Pretty: {
-    if (p->prettyPrint->columns.size() == 0) {
+    auto pretty = p->prettyPrint;
+    if (pretty->columns.size() == 0) {
       for (i = 0; i < nArg; i++) {
-        p->prettyPrint->columns.push_back(std::string(azCol[i]));
+        pretty->columns.push_back(std::string(azCol[i]));
       }
     }
 
-    osquery::Row r;
-    for (i = 0; i < nArg; ++i) {
-      if (azCol[i] != nullptr) {
-        r[std::string(azCol[i])] = (azArg[i] == nullptr)
-                                       ? osquery::FLAGS_nullvalue
-                                       : std::string(azArg[i]);
-      }
+    auto r = shell_row(nArg, azArg, azCol);
+    if (!pretty->separator.empty()) {
+      // The columns are sized, print the row without keeping it.
+      auto line = osquery::generateRow(r, pretty->lengths, pretty->columns);
+      printf("%s", line.c_str());
+      break;
+    }
+
+    osquery::computeRowLengths(r, pretty->lengths);
+    pretty->results.push_back(std::move(r));
+    if (osquery::FLAGS_pretty_rows > 0 &&
+        pretty->results.size() >= osquery::FLAGS_pretty_rows) {
+      print_pretty_head(pretty);
     }
-    osquery::computeRowLengths(r, p->prettyPrint->lengths);
-    p->prettyPrint->results.push_back(r);
+    break;
+  }
+  case MODE_Json: {
+    if (p->cnt == 0) {
+      printf("[\n");
+    }
+    if (osquery::jsonPrintRow(shell_row(nArg, azArg, azCol), p->cnt == 0)) {
+      p->cnt++;
+    }
+    break;
+  }
+  case MODE_JsonLines: {
+    osquery::jsonLinePrint(shell_row(nArg, azArg, azCol));
     break;
   }
   case MODE_Line: {
@@ -739,6 +860,12 @@ static int shell_exec(
         pArg->cnt = 0;
       }
 
+      /* profile the statement's table cursors until it is finalized */
+      std::unique_ptr<osquery::QueryProfileScope> profile;
+      if (pArg && pArg->profileOn) {
+        profile.reset(new osquery::QueryProfileScope());
+      }
+
       /* echo the sql statement if echo on */
       if (pArg && pArg->echoOn) {
         const char *zStmtSql = sqlite3_sql(pStmt);
@@ -798,6 +925,11 @@ static int shell_exec(
         }
       }
 
+      /* Print the end of the statement's results, if the mode needs it. */
+      if (pArg) {
+        finish_results(pArg, sqlite3_column_count(pStmt));
+      }
+
       /* Finalize the statement just executed. If this fails, save a
       ** copy of the error message. Otherwise, set zSql to point to the
       ** next statement to execute. */
@@ -805,6 +937,9 @@ static int shell_exec(
       if (rc != SQLITE_NOMEM) {
         rc = rc2;
       }
+      if (profile != nullptr) {
+        print_profile(*profile);
+      }
       if (rc == SQLITE_OK) {
         zSql = zLeftover;
         while (IsSpace(zSql[0])) {
@@ -821,20 +956,6 @@ static int shell_exec(
     }
   } /* end while */
   dbc->clearAffectedTables();
-
-  if (pArg && pArg->mode == MODE_Pretty) {
-    if (osquery::FLAGS_json) {
-      osquery::jsonPrint(pArg->prettyPrint->results);
-    } else {
-      osquery::prettyPrint(pArg->prettyPrint->results,
-                           pArg->prettyPrint->columns,
-                           pArg->prettyPrint->lengths);
-    }
-    pArg->prettyPrint->results.clear();
-    pArg->prettyPrint->columns.clear();
-    pArg->prettyPrint->lengths.clear();
-  }
-
   return rc;
 }
 
@@ -1137,13 +1258,17 @@ static int do_meta_command(char *zLine, struct callback_data *p) {
       p->mode = MODE_List;
     } else if (n2 == 6 && strncmp(azArg[1], "pretty", n2) == 0) {
       p->mode = MODE_Pretty;
+    } else if (n2 == 4 && strncmp(azArg[1], "json", n2) == 0) {
+      p->mode = MODE_Json;
+    } else if (n2 == 5 && strncmp(azArg[1], "jsonl", n2) == 0) {
+      p->mode = MODE_JsonLines;
     } else if (n2 == 3 && strncmp(azArg[1], "csv", n2) == 0) {
       p->mode = MODE_Csv;
       sqlite3_snprintf(sizeof(p->separator), p->separator, ",");
     } else {
       fprintf(stderr,
               "Error: mode should be one of: "
-              "column csv line list pretty\n");
+              "column csv json jsonl line list pretty\n");
       rc = 1;
     }
   } else if (c == 'n' && strncmp(azArg[0], "nullvalue", n) == 0 && nArg == 2) {
@@ -1161,6 +1286,9 @@ static int do_meta_command(char *zLine, struct callback_data *p) {
       fprintf(p->out, "%s", azArg[i]);
     }
     fprintf(p->out, "\n");
+  } else if (c == 'p' && n >= 4 && strncmp(azArg[0], "profile", n) == 0 &&
+             nArg == 2) {
+    p->profileOn = booleanValue(azArg[1]);
   } else if (c == 'q' && strncmp(azArg[0], "quit", n) == 0 && nArg == 1) {
     rc = 2;
   } else if (c == 's' && strncmp(azArg[0], "schema", n) == 0 && nArg < 3) {
@@ -1176,6 +1304,7 @@ static int do_meta_command(char *zLine, struct callback_data *p) {
     fprintf(p->out, "%9.9s: %s\n", "echo", p->echoOn ? "on" : "off");
     fprintf(p->out, "%9.9s: %s\n", "headers", p->showHeader ? "on" : "off");
     fprintf(p->out, "%9.9s: %s\n", "mode", modeDescr[p->mode]);
+    fprintf(p->out, "%9.9s: %s\n", "profile", p->profileOn ? "on" : "off");
     fprintf(p->out, "%9.9s: ", "nullvalue");
     output_c_string(p->out, p->nullvalue);
     fprintf(p->out, "\n");
@@ -1191,6 +1320,15 @@ static int do_meta_command(char *zLine, struct callback_data *p) {
       fprintf(p->out, "%d ", p->colWidth[i]);
     }
     fprintf(p->out, "\n");
+  } else if (c == 's' && strncmp(azArg[0], "spans", n) == 0 && nArg == 2) {
+#if !defined(OSQUERY_TRACING)
+    fprintf(stderr, "Warning: spans are only recorded by TRACING builds\n");
+#endif
+    auto status = osquery::dumpTrace(azArg[1]);
+    if (!status.ok()) {
+      fprintf(stderr, "Error: %s\n", status.getMessage().c_str());
+      rc = 1;
+    }
   } else if (c == 't' && n > 1 && strncmp(azArg[0], "tables", n) == 0 &&
              nArg < 3) {
     meta_tables(nArg, azArg);
@@ -1451,6 +1589,8 @@ int launchIntoShell(int argc, char **argv) {
   } else if (FLAGS_csv) {
     data.mode = MODE_Csv;
     data.separator[0] = ',';
+  } else if (FLAGS_json) {
+    data.mode = MODE_Json;
   } else {
     data.mode = MODE_Pretty;
   }
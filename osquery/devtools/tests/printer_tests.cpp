@@ -95,6 +95,17 @@ TEST_F(PrinterTests, test_generate_row) {
   EXPECT_EQ(results, expected);
 }
 
+TEST_F(PrinterTests, test_generate_row_longer_than_column) {
+  // Columns sized from the first row, as the shell does for large results.
+  std::map<std::string, size_t> lengths;
+  computeRowLengths(q.front(), lengths);
+  computeRowLengths(q.front(), lengths, true);
+
+  auto results = generateRow(q[1], lengths, order);
+  auto expected = "| John Smith | 44  | peanut butter and jelly | 2      |\n";
+  EXPECT_EQ(results, expected);
+}
+
 TEST_F(PrinterTests, test_unicode) {
   Row r = {{"name", "Àlex Smith"}};
   std::map<std::string, size_t> lengths;
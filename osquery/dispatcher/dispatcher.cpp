@@ -9,6 +9,8 @@
  */
 
 #include <chrono>
+#include <map>
+#include <string>
 
 #include <osquery/dispatcher.h>
 #include <osquery/flags.h>
@@ -22,6 +24,59 @@ namespace osquery {
 /// The worker_threads define the default thread pool size.
 FLAG(int32, worker_threads, 4, "Number of work dispatch threads");
 
+FLAG(string,
+     thread_classes,
+     "",
+     "Comma-separated thread class policies, such as bulk:idle,logger:nice:5");
+
+/// The thread_classes name of each ThreadClass.
+const std::map<ThreadClass, std::string> kThreadClassNames = {
+    {THREAD_CLASS_DEFAULT, "default"},
+    {THREAD_CLASS_EVENTS, "events"},
+    {THREAD_CLASS_SCHEDULE, "schedule"},
+    {THREAD_CLASS_LOGGER, "logger"},
+    {THREAD_CLASS_BULK, "bulk"},
+};
+
+void setThreadClass(ThreadClass thread_class) {
+  if (FLAGS_thread_classes.empty()) {
+    return;
+  }
+
+  // Each item is a class name, a policy, and the nice policy's value.
+  const auto& name = kThreadClassNames.at(thread_class);
+  for (const auto& item : osquery::split(FLAGS_thread_classes, ",")) {
+    auto parts = osquery::split(item, ":");
+    if (parts.size() < 2 || parts[0] != name) {
+      continue;
+    }
+
+    auto policy = THREAD_POLICY_DEFAULT;
+    int nice = 10;
+    if (parts[1] == "idle") {
+      policy = THREAD_POLICY_IDLE;
+    } else if (parts[1] == "batch") {
+      policy = THREAD_POLICY_BATCH;
+    } else if (parts[1] == "nice") {
+      policy = THREAD_POLICY_NICE;
+      long int value = 0;
+      if (parts.size() > 2 && safeStrtol(parts[2], 10, value).ok()) {
+        nice = static_cast<int>(value);
+      }
+    } else {
+      LOG(WARNING) << "Unknown policy for thread class " << name << ": "
+                   << parts[1];
+      return;
+    }
+
+    if (!setThreadPolicy(policy, nice)) {
+      VLOG(1) << "Cannot apply the " << parts[1] << " policy to a " << name
+              << " thread";
+    }
+    return;
+  }
+}
+
 /// Cancel the pause request.
 void RunnerInterruptPoint::cancel() {
   WriteLock lock(mutex_);
@@ -64,6 +119,7 @@ void InterruptableRunnable::pauseMilli(std::chrono::milliseconds milli) {
 
 void InternalRunnable::run() {
   run_ = true;
+  setThreadClass(threadClass());
   start();
 
   // The service is complete.
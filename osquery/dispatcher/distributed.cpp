@@ -8,6 +8,8 @@
  *
  */
 
+#include <chrono>
+
 #include <osquery/distributed.h>
 #include <osquery/flags.h>
 
@@ -22,15 +24,36 @@ FLAG(uint64,
 
 DECLARE_bool(disable_distributed);
 DECLARE_string(distributed_plugin);
+DECLARE_uint64(distributed_long_poll);
 
 void DistributedRunner::start() {
   auto dist = Distributed();
   while (!interrupted()) {
+    auto started = std::chrono::steady_clock::now();
     dist.pullUpdates();
+    bool ran = false;
     if (dist.getPendingQueryCount() > 0) {
       dist.runQueries();
+      ran = true;
+    }
+
+    if (FLAGS_distributed_long_poll == 0) {
+      pauseMilli(FLAGS_distributed_interval * 1000);
+      continue;
+    } else if (ran) {
+      // More live queries may follow, wait on the server immediately.
+      continue;
+    }
+
+    // The server held the request until the wait ended, and that time counts
+    // toward the interval. A server that does not hold requests, or a failed
+    // request, is still only retried once each interval.
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - started);
+    auto interval = std::chrono::seconds(FLAGS_distributed_interval);
+    if (elapsed < interval) {
+      pauseMilli(interval - elapsed);
     }
-    pauseMilli(FLAGS_distributed_interval * 1000);
   }
 }
 
@@ -23,6 +23,10 @@ class DistributedRunner : public InternalRunnable {
  public:
   /// The Dispatcher thread entry point.
   void start();
+
+ protected:
+  /// Distributed queries run in the schedule thread class.
+  ThreadClass threadClass() const override { return THREAD_CLASS_SCHEDULE; }
 };
 
 Status startDistributed();
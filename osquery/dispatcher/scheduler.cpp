@@ -8,17 +8,26 @@
  *
  */
 
+#include <cctype>
+#include <chrono>
 #include <ctime>
+#include <sstream>
+
+#include <boost/property_tree/json_parser.hpp>
 
 #include <osquery/config.h>
 #include <osquery/core.h>
 #include <osquery/database.h>
+#include <osquery/events.h>
 #include <osquery/flags.h>
 #include <osquery/logger.h>
+#include <osquery/packs.h>
 #include <osquery/system.h>
 
 #include "osquery/config/parsers/decorators.h"
+#include "osquery/core/allocations.h"
 #include "osquery/core/process.h"
+#include "osquery/core/tracing.h"
 #include "osquery/database/query.h"
 #include "osquery/dispatcher/scheduler.h"
 #include "osquery/sql/sqlite_util.h"
@@ -29,17 +38,85 @@ FLAG(bool, enable_monitor, false, "Enable the schedule monitor");
 
 FLAG(uint64, schedule_timeout, 0, "Limit the schedule, 0 for no limit")
 
+FLAG(uint64,
+     schedule_workers,
+     0,
+     "Number of threads executing scheduled queries, 0 runs them serially");
+
+FLAG(bool,
+     schedule_coalesce,
+     false,
+     "Run a late scheduled query once instead of once per missed interval");
+
+FLAG(bool,
+     schedule_share_tables,
+     false,
+     "Generate tables used by several queries in a schedule step once");
+
+FLAG(bool,
+     schedule_share_queries,
+     false,
+     "Execute identical queries due in the same schedule step once");
+
+FLAG(uint64,
+     schedule_max_rows,
+     0,
+     "Blacklist a scheduled query generating more rows, 0 for no limit");
+
+FLAG(uint64,
+     schedule_max_bytes,
+     0,
+     "Blacklist a scheduled query generating more bytes, 0 for no limit");
+
+FLAG(uint64,
+     schedule_max_time,
+     0,
+     "Blacklist a scheduled query running more milliseconds, 0 for no limit");
+
+FLAG(uint64,
+     schedule_telemetry_interval,
+     0,
+     "Seconds between logs of scheduled query percentiles, 0 to disable");
+
+FLAG(bool,
+     schedule_release_memory,
+     false,
+     "Give freed heap memory back to the system after each scheduled query");
+
+/// Executions starting this many milliseconds after their due time are late.
+const size_t kScheduleLateMilli = 1000;
+
+inline void recordLateness(const std::string& name,
+                           std::chrono::steady_clock::time_point due) {
+  auto lateness = std::chrono::duration_cast<std::chrono::milliseconds>(
+                      std::chrono::steady_clock::now() - due)
+                      .count();
+  if (lateness >= static_cast<long long>(kScheduleLateMilli)) {
+    Config::getInstance().recordQueryLateness(name, lateness, 0);
+  }
+}
+
+/// Represent resource usage using the processes table columns used by Config.
+inline Row usageRow(const ProcessResourceUsage& usage) {
+  Row r;
+  r["user_time"] = BIGINT(usage.user_time);
+  r["system_time"] = BIGINT(usage.system_time);
+  r["resident_size"] = BIGINT(usage.peak_resident_size);
+  return r;
+}
+
 inline SQL monitor(const std::string& name, const ScheduledQuery& query) {
   // Snapshot the performance and times for the worker before running.
-  auto pid = std::to_string(PlatformProcess::getCurrentProcess()->pid());
-  auto r0 = SQL::selectAllFrom("processes", "pid", EQUALS, pid);
+  // The thread's resource usage is read directly, not via the processes table.
+  ProcessResourceUsage r0;
+  bool usage = getThreadResourceUsage(r0);
   auto t0 = getUnixTime();
   Config::getInstance().recordQueryStart(name);
   auto sql = SQLInternal(query.query);
   // Snapshot the performance after, and compare.
   auto t1 = getUnixTime();
-  auto r1 = SQL::selectAllFrom("processes", "pid", EQUALS, pid);
-  if (r0.size() > 0 && r1.size() > 0) {
+  ProcessResourceUsage r1;
+  if (usage && getThreadResourceUsage(r1)) {
     // Calculate a size as the expected byte output of results.
     // This does not dedup result differentials and is not aware of snapshots.
     size_t size = 0;
@@ -49,26 +126,60 @@ inline SQL monitor(const std::string& name, const ScheduledQuery& query) {
         size += column.second.size();
       }
     }
-    // Always called while processes table is working.
-    Config::getInstance().recordQueryPerformance(name, t1 - t0, size, r0[0],
-                                                 r1[0]);
+    // Memory is reported as the change in peak resident size.
+    Config::getInstance().recordQueryPerformance(
+        name, t1 - t0, size, usageRow(r0), usageRow(r1));
   }
   return sql;
 }
 
-inline void launchQuery(const std::string& name, const ScheduledQuery& query) {
-  // Execute the scheduled query and create a named query object.
-  VLOG(1) << "Executing query: " << query.query;
-  runDecorators(DECORATE_ALWAYS);
+/// Execute a scheduled query, recording its latency and table generations.
+SQL profiledQuery(const std::string& name, const ScheduledQuery& query) {
+  QueryProfileScope profile;
+  AllocationScope allocations;
+  auto t0 = std::chrono::steady_clock::now();
   auto sql =
       (FLAGS_enable_monitor) ? monitor(name, query) : SQLInternal(query.query);
-
+  auto wall_time = std::chrono::duration_cast<std::chrono::milliseconds>(
+                       std::chrono::steady_clock::now() - t0)
+                       .count();
   if (!sql.ok()) {
-    LOG(ERROR) << "Error executing query (" << query.query
-               << "): " << sql.getMessageString();
-    return;
+    return sql;
+  }
+
+  size_t rows = 0;
+  for (const auto& cursor : profile.cursors()) {
+    const auto& table = cursor.second;
+    rows += table.rows_generated;
+    Config::getInstance().recordTableGeneration(table.table,
+                                                table.filters,
+                                                table.rows_generated,
+                                                table.generate_time,
+                                                table.allocations,
+                                                table.allocated_bytes);
   }
+  Config::getInstance().recordQueryLatency(name, wall_time, rows);
+  Config::getInstance().recordQueryAllocations(name,
+                                               allocations.allocations(),
+                                               allocations.bytes(),
+                                               allocations.peakBytes());
+  return sql;
+}
 
+/// True if a differential query opted into event watermarks.
+inline bool isWatermarked(const ScheduledQuery& query) {
+  auto option = [&query](const std::string& name) {
+    return query.options.count(name) > 0 && query.options.at(name);
+  };
+  return option("watermark") && !option("snapshot") &&
+         !option("snapshot_if_changed");
+}
+
+/// Log the results of a scheduled query's execution, as snapshot or diff.
+inline void logQueryResults(const std::string& name,
+                            const ScheduledQuery& query,
+                            SQL sql,
+                            EventWatermarkScope* watermarks) {
   // Fill in a host identifier fields based on configuration or availability.
   std::string ident = getHostIdentifier();
 
@@ -79,25 +190,62 @@ inline void launchQuery(const std::string& name, const ScheduledQuery& query) {
   item.identifier = ident;
   item.time = osquery::getUnixTime();
   item.calendar_time = osquery::getAsciiTime();
-  getDecorations(item.decorations);
+  getDecorations(item);
 
-  if (query.options.count("snapshot") && query.options.at("snapshot")) {
+  bool if_changed = query.options.count("snapshot_if_changed") &&
+                    query.options.at("snapshot_if_changed");
+  if (if_changed ||
+      (query.options.count("snapshot") && query.options.at("snapshot"))) {
     // This is a snapshot query, emit results with a differential or state.
     item.snapshot_results = std::move(sql.rows());
-    logSnapshotQuery(item);
+    if (if_changed) {
+      // Only emit the snapshot if the results differ from the last snapshot.
+      bool changed = true;
+      auto status =
+          Query(name, query).addSnapshotDigest(item.snapshot_results, changed);
+      if (!status.ok()) {
+        LOG(ERROR) << "Error storing the snapshot digest for query (" << name
+                   << "): " << status.what();
+      } else if (!changed) {
+        VLOG(1) << "Snapshot results unchanged for query (" << name << ")";
+        return;
+      }
+    }
+    logSnapshotQuery(std::move(item));
     return;
   }
 
-  // Create a database-backed set of query results.
-  auto dbQuery = Query(name, query);
   // Comparisons and stores must include escaped data.
   sql.escapeResults();
+  if (watermarks != nullptr) {
+    // Every row is a new event, there are no previous results to compare.
+    if (sql.rows().empty()) {
+      return;
+    }
+    item.results.added = std::move(sql.rows());
+    auto status = logQueryLogItem(std::move(item));
+    if (!status.ok()) {
+      // The watermarks are kept, the events are delivered again next time.
+      LOG(ERROR) << "Error logging the results of query (" << query.query
+                 << "): " << status.toString();
+      return;
+    }
+    status = watermarks->commit();
+    if (!status.ok()) {
+      LOG(ERROR) << "Error storing the watermarks of query (" << name
+                 << "): " << status.what();
+    }
+    return;
+  }
+
+  // Create a database-backed set of query results.
+  auto dbQuery = Query(name, query);
 
   DiffResults diff_results;
   // Add this execution's set of results to the database-tracked named query.
   // We can then ask for a differential from the last time this named query
   // was executed by exact matching each row.
-  auto status = dbQuery.addNewResults(sql.rows(), diff_results);
+  auto status = dbQuery.addNewResults(std::move(sql.rows()), diff_results);
   if (!status.ok()) {
     std::string line = "Error adding new results to database: " + status.what();
     LOG(ERROR) << line;
@@ -106,51 +254,466 @@ inline void launchQuery(const std::string& name, const ScheduledQuery& query) {
     Initializer::requestShutdown(EXIT_CATASTROPHIC, line);
   }
 
-  if (diff_results.added.size() == 0 && diff_results.removed.size() == 0) {
+  if (diff_results.empty()) {
     // No diff results or events to emit.
     return;
   }
 
   VLOG(1) << "Found results for query (" << name << ") for host: " << ident;
-  item.results = diff_results;
+  item.results = std::move(diff_results);
   if (query.options.count("removed") && !query.options.at("removed")) {
     item.results.removed.clear();
   }
 
-  status = logQueryLogItem(item);
+  status = logQueryLogItem(std::move(item));
   if (!status.ok()) {
     LOG(ERROR) << "Error logging the results of query (" << query.query
                << "): " << status.toString();
   }
 }
 
+inline void launchQuery(const std::string& name,
+                        const ScheduledQuery& query,
+                        const SharedQueries& shared) {
+  // Execute the scheduled query and create a named query object.
+  VLOG(1) << "Executing query: " << query.query;
+  runDecorators(DECORATE_ALWAYS);
+
+  // Event tables return only the events this query was not yet delivered.
+  std::unique_ptr<EventWatermarkScope> watermarks;
+  if (isWatermarked(query)) {
+    watermarks.reset(new EventWatermarkScope(name));
+  }
+  auto sql = profiledQuery(name, query);
+
+  if (!sql.ok()) {
+    LOG(ERROR) << "Error executing query (" << query.query
+               << "): " << sql.getMessageString();
+    return;
+  }
+
+  // Each identical query keeps its own differential state and log item.
+  for (const auto& other : shared) {
+    Config::getInstance().recordQuerySharedExecution(other.first);
+    logQueryResults(other.first, other.second, sql, nullptr);
+  }
+  logQueryResults(name, query, std::move(sql), watermarks.get());
+}
+
+SharedQueryList shareIdenticalQueries(
+    std::vector<std::pair<std::string, ScheduledQuery>>& queries) {
+  SharedQueryList shared;
+  std::vector<std::pair<std::string, ScheduledQuery>> executed;
+  std::map<std::string, size_t> first;
+  for (auto& query : queries) {
+    // The rows of watermarked event tables are particular to the query.
+    if (!isWatermarked(query.second)) {
+      auto it = first.find(query.second.query);
+      if (it != first.end()) {
+        shared[it->second].push_back(std::move(query));
+        continue;
+      }
+      first[query.second.query] = executed.size();
+    }
+    executed.push_back(std::move(query));
+    shared.emplace_back();
+  }
+  queries.swap(executed);
+  return shared;
+}
+
+/**
+ * @brief Give the memory freed by a scheduled query back to the system.
+ *
+ * A query's rows, differentials, and serialized log lines are freed once it
+ * is logged. The heap's size before and after the release is logged to show
+ * the memory the allocator was holding.
+ */
+inline void releaseQueryMemory(const std::string& name) {
+  HeapStatistics before;
+  auto stats = getHeapStatistics(before);
+  releaseFreeHeap();
+
+  HeapStatistics after;
+  if (stats && getHeapStatistics(after)) {
+    VLOG(1) << "Released heap memory after query (" << name
+            << "): " << before.in_use << " bytes in use, " << before.free
+            << " bytes free before, " << after.free << " bytes free after";
+  }
+}
+
+/// Execute a due query, optionally sharing the step's table generations.
+inline void runScheduledQuery(const std::string& name,
+                              const ScheduledQuery& query,
+                              size_t step,
+                              std::chrono::steady_clock::time_point due,
+                              const std::shared_ptr<TableSnapshot>& snapshot,
+                              const SharedQueries& shared) {
+  // The cache interval and step are tracked per thread.
+  TablePlugin::kCacheInterval = query.splayed_interval;
+  TablePlugin::kCacheStep = step;
+  recordLateness(name, due);
+
+  QueryBudget limits;
+  limits.max_rows = FLAGS_schedule_max_rows;
+  limits.max_bytes = FLAGS_schedule_max_bytes;
+  limits.max_time = FLAGS_schedule_max_time;
+  std::unique_ptr<QueryBudgetScope> budget;
+  if (!limits.empty()) {
+    budget.reset(new QueryBudgetScope(limits));
+  }
+
+  for (const auto& other : shared) {
+    recordLateness(other.first, due);
+  }
+
+  if (snapshot == nullptr || isWatermarked(query)) {
+    // The rows of watermarked event tables are particular to the query.
+    launchQuery(name, query, shared);
+  } else {
+    TableSnapshotScope scope(snapshot);
+    launchQuery(name, query, shared);
+    if (scope.saved() > 0) {
+      Config::getInstance().recordQuerySharedGenerations(name, scope.saved());
+    }
+  }
+
+  if (FLAGS_schedule_release_memory) {
+    releaseQueryMemory(name);
+  }
+
+  if (budget != nullptr && budget->exceeded()) {
+    // Only the offending query, and its identical queries, were aborted.
+    LOG(WARNING) << "Scheduled query " << name << " " << budget->reason()
+                 << ", adding it to the schedule blacklist";
+    Config::getInstance().blacklistQuery(name);
+    for (const auto& other : shared) {
+      Config::getInstance().blacklistQuery(other.first);
+    }
+  }
+}
+
+/**
+ * @brief Log the latency and rows percentiles of the scheduled queries.
+ *
+ * Only queries executed since they were last reported are included, the
+ * telemetry is a single status log line of JSON keyed by query name.
+ */
+void logScheduleTelemetry(std::map<std::string, size_t>& reported) {
+  // Collect the names first, performance is not read under the schedule lock.
+  std::vector<std::string> names;
+  Config::getInstance().scheduledQueries(
+      [&names](const std::string& name, const ScheduledQuery& query) {
+        names.push_back(name);
+      });
+
+  boost::property_tree::ptree tree;
+  for (const auto& name : names) {
+    Config::getInstance().getPerformanceStats(
+        name, [&name, &reported, &tree](const QueryPerformance& perf) {
+          const auto& latency = perf.wall_time_histogram;
+          auto& count = reported[name];
+          if (latency.count() == count) {
+            // The query has not executed since the last telemetry.
+            return;
+          }
+          count = latency.count();
+
+          boost::property_tree::ptree query;
+          query.put("executions", latency.count());
+          query.put("wall_time_p50", latency.percentile(50));
+          query.put("wall_time_p95", latency.percentile(95));
+          query.put("wall_time_p99", latency.percentile(99));
+          query.put("wall_time_max", latency.max());
+          query.put("rows_p50", perf.rows_histogram.percentile(50));
+          query.put("rows_p99", perf.rows_histogram.percentile(99));
+          // Query names may contain the ptree path separator.
+          tree.push_back(std::make_pair(name, query));
+        });
+  }
+
+  if (!tree.empty()) {
+    std::stringstream json;
+    boost::property_tree::write_json(json, tree, false);
+    auto line = json.str();
+    if (!line.empty() && line.back() == '\n') {
+      line.pop_back();
+    }
+    LOG(INFO) << "Schedule telemetry: " << line;
+  }
+}
+
+/**
+ * @brief Find the tables referenced by more than one due query.
+ *
+ * This is a lexical approximation, any identifier naming a table counts as a
+ * reference. A false positive only means a table's generation is kept, with
+ * every column, until the step completes.
+ */
+std::set<std::string> getSharedTables(
+    const std::vector<std::pair<std::string, ScheduledQuery>>& queries) {
+  auto names = Registry::names("table");
+  std::set<std::string> tables(names.begin(), names.end());
+
+  std::map<std::string, size_t> references;
+  for (const auto& query : queries) {
+    std::set<std::string> referenced;
+    std::string token;
+    // Append a terminator such that the last identifier is checked.
+    for (const auto& c : query.second.query + " ") {
+      if (std::isalnum(static_cast<unsigned char>(c)) || c == '_') {
+        token += static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        continue;
+      }
+      if (!token.empty() && tables.count(token) > 0) {
+        referenced.insert(token);
+      }
+      token.clear();
+    }
+    for (const auto& table : referenced) {
+      references[table]++;
+    }
+  }
+
+  std::set<std::string> shared;
+  for (const auto& table : references) {
+    if (table.second > 1) {
+      shared.insert(table.first);
+    }
+  }
+  return shared;
+}
+
+bool SchedulerRunner::schedule(const std::string& name,
+                               const ScheduledQuery& query,
+                               size_t step,
+                               std::chrono::steady_clock::time_point due,
+                               std::shared_ptr<TableSnapshot> snapshot,
+                               const SharedQueries& shared) {
+  // The first of the query and its identical queries not still executing
+  // runs for the rest.
+  SharedQueries queries = {std::make_pair(name, query)};
+  queries.insert(queries.end(), shared.begin(), shared.end());
+  std::vector<std::string> skipped;
+
+  std::unique_lock<std::mutex> lock(queue_mutex_);
+  ScheduledTask task;
+  for (auto& member : queries) {
+    if (pending_.count(member.first) > 0) {
+      skipped.push_back(member.first);
+    } else if (task.name.empty()) {
+      task.name = member.first;
+      task.query = std::move(member.second);
+    } else {
+      task.shared.push_back(std::move(member));
+    }
+  }
+
+  if (!task.name.empty()) {
+    task.step = step;
+    task.due = due;
+    task.snapshot = std::move(snapshot);
+    task.deadline = step + task.query.splayed_interval;
+    if (costs_.count(task.name) > 0) {
+      task.cost = costs_.at(task.name);
+    }
+
+    pending_.insert(task.name);
+    for (const auto& other : task.shared) {
+      pending_.insert(other.first);
+    }
+    queue_.push(std::move(task));
+  }
+  lock.unlock();
+
+  for (const auto& missed : skipped) {
+    // The previous execution has not completed, skip this step.
+    VLOG(1) << "Scheduled query still executing: " << missed;
+    Config::getInstance().recordQueryLateness(missed, 0, 1);
+  }
+  if (skipped.size() == queries.size()) {
+    return false;
+  }
+  queue_cv_.notify_one();
+  return true;
+}
+
+void SchedulerRunner::worker() {
+  setThreadClass(threadClass());
+  while (true) {
+    ScheduledTask task;
+    {
+      std::unique_lock<std::mutex> lock(queue_mutex_);
+      queue_cv_.wait(lock, [this]() { return stopping_ || !queue_.empty(); });
+      if (queue_.empty()) {
+        return;
+      }
+      task = queue_.top();
+      queue_.pop();
+    }
+
+    auto t0 = std::chrono::steady_clock::now();
+    runScheduledQuery(task.name,
+                      task.query,
+                      task.step,
+                      task.due,
+                      task.snapshot,
+                      task.shared);
+    auto delay = std::chrono::duration_cast<std::chrono::milliseconds>(
+                     std::chrono::steady_clock::now() - t0)
+                     .count();
+
+    {
+      std::unique_lock<std::mutex> lock(queue_mutex_);
+      // Keep a running average, weighted toward the most-recent execution.
+      auto& cost = costs_[task.name];
+      cost = (cost == 0) ? delay : (cost + delay) / 2;
+      pending_.erase(task.name);
+      for (const auto& other : task.shared) {
+        pending_.erase(other.first);
+      }
+    }
+    queue_cv_.notify_all();
+  }
+}
+
+void SchedulerRunner::startWorkers(size_t count) {
+  {
+    std::unique_lock<std::mutex> lock(queue_mutex_);
+    stopping_ = false;
+  }
+  for (size_t i = 0; i < count; ++i) {
+    workers_.emplace_back(&SchedulerRunner::worker, this);
+  }
+}
+
+void SchedulerRunner::stopWorkers(bool drain) {
+  {
+    std::unique_lock<std::mutex> lock(queue_mutex_);
+    if (drain && !workers_.empty()) {
+      queue_cv_.wait(lock, [this]() { return pending_.empty(); });
+    }
+    stopping_ = true;
+    // Tasks not yet started are discarded, the next step will requeue them.
+    while (!queue_.empty()) {
+      pending_.erase(queue_.top().name);
+      for (const auto& other : queue_.top().shared) {
+        pending_.erase(other.first);
+      }
+      queue_.pop();
+    }
+  }
+  queue_cv_.notify_all();
+
+  for (auto& thread : workers_) {
+    if (thread.joinable()) {
+      thread.join();
+    }
+  }
+  workers_.clear();
+}
+
+void SchedulerRunner::stop() {
+  {
+    std::unique_lock<std::mutex> lock(queue_mutex_);
+    stopping_ = true;
+  }
+  queue_cv_.notify_all();
+}
+
 void SchedulerRunner::start() {
-  // Start the counter at the second.
-  auto i = osquery::getUnixTime();
+  startWorkers(FLAGS_schedule_workers);
+  bool parallel = !workers_.empty();
+
+  // Due times are computed from a monotonic clock, relative to the first step,
+  // such that time spent executing queries does not accumulate as drift.
+  auto begin = osquery::getUnixTime();
+  auto start = std::chrono::steady_clock::now();
+  auto interval = std::chrono::seconds(interval_);
+  auto i = begin;
+  // Executions of each query included in the last telemetry log.
+  std::map<std::string, size_t> reported;
   for (; (timeout_ == 0) || (i <= timeout_); ++i) {
+    auto due = start + (i - begin) * interval;
+    // The most recent step that is due, later than i if the schedule is late.
+    auto current = i;
+    if (interval_ > 0) {
+      current = begin + (std::chrono::steady_clock::now() - start) / interval;
+    }
+
+    // Collect the queries due in this step, then execute them.
+    std::vector<std::pair<std::string, ScheduledQuery>> queries;
     Config::getInstance().scheduledQueries(
-        ([&i](const std::string& name, const ScheduledQuery& query) {
-          if (query.splayed_interval > 0 && i % query.splayed_interval == 0) {
-            TablePlugin::kCacheInterval = query.splayed_interval;
-            TablePlugin::kCacheStep = i;
-            launchQuery(name, query);
+        ([&queries, &i, current](const std::string& name,
+                                 const ScheduledQuery& query) {
+          if (query.splayed_interval > 0 &&
+              i % query.splayed_interval == query.splayed_offset) {
+            if (FLAGS_schedule_coalesce &&
+                i + query.splayed_interval <= current) {
+              // A later execution of this query is already due.
+              Config::getInstance().recordQueryLateness(name, 0, 1);
+              return;
+            }
+            queries.push_back(std::make_pair(name, query));
           }
         }));
+
+    // Queries in this step referencing the same tables may share generations.
+    std::shared_ptr<TableSnapshot> snapshot;
+    if (FLAGS_schedule_share_tables && queries.size() > 1) {
+      auto tables = getSharedTables(queries);
+      if (!tables.empty()) {
+        snapshot = std::make_shared<TableSnapshot>(std::move(tables));
+      }
+    }
+
+    // Identical queries may be executed once, sharing the results.
+    SharedQueryList shared(queries.size());
+    if (FLAGS_schedule_share_queries && queries.size() > 1) {
+      shared = shareIdenticalQueries(queries);
+    }
+
+    for (size_t q = 0; q < queries.size(); ++q) {
+      const auto& query = queries[q];
+      if (parallel) {
+        schedule(query.first, query.second, i, due, snapshot, shared[q]);
+      } else {
+        runScheduledQuery(
+            query.first, query.second, i, due, snapshot, shared[q]);
+      }
+    }
     // Configuration decorators run on 60 second intervals only.
     if (i % 60 == 0) {
       runDecorators(DECORATE_INTERVAL, i);
     }
-    // Put the thread into an interruptible sleep without a config instance.
-    pauseMilli(interval_ * 1000);
+    if (FLAGS_schedule_telemetry_interval > 0 &&
+        i % FLAGS_schedule_telemetry_interval == 0) {
+      logScheduleTelemetry(reported);
+    }
+    // A tracing dump may be requested by signal.
+    checkTraceDump();
+    // Put the thread into an interruptible sleep until the next step is due.
+    // If the schedule is late the following steps run without pausing.
+    auto next = start + (i + 1 - begin) * interval;
+    auto now = std::chrono::steady_clock::now();
+    if (next > now) {
+      pauseMilli(
+          std::chrono::duration_cast<std::chrono::milliseconds>(next - now));
+    }
     if (interrupted()) {
       break;
     }
   }
+
+  // Allow queued queries to finish unless the scheduler was interrupted.
+  stopWorkers(!interrupted());
 }
 
 void startScheduler() { startScheduler(FLAGS_schedule_timeout, 1); }
 
 void startScheduler(unsigned long int timeout, size_t interval) {
+  // Discovery queries are refreshed by their own service.
+  startPackDiscovery();
   Dispatcher::addService(std::make_shared<SchedulerRunner>(timeout, interval));
 }
 }
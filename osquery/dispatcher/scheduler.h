@@ -10,12 +10,70 @@
 
 #pragma once
 
+#include <chrono>
+#include <condition_variable>
 #include <map>
+#include <mutex>
+#include <queue>
+#include <set>
+#include <thread>
+#include <vector>
 
+#include <osquery/database.h>
 #include <osquery/dispatcher.h>
 
+#include "osquery/sql/sqlite_util.h"
+
 namespace osquery {
 
+/// A due scheduled query waiting for a schedule worker.
+/// Scheduled queries, by name, given the results of another's execution.
+using SharedQueries = std::vector<std::pair<std::string, ScheduledQuery>>;
+
+/// The identical queries sharing each due query's execution.
+using SharedQueryList = std::vector<SharedQueries>;
+
+struct ScheduledTask {
+  /// The scheduled query name.
+  std::string name;
+
+  /// A copy of the scheduled query, the config may update while queued.
+  ScheduledQuery query;
+
+  /// The schedule step when the query became due.
+  size_t step{0};
+
+  /// The monotonic time when the query became due.
+  std::chrono::steady_clock::time_point due;
+
+  /// The step before which the query should complete (its next due step).
+  size_t deadline{0};
+
+  /// Expected execution time in milliseconds, from previous executions.
+  size_t cost{0};
+
+  /// Table generations shared with other queries due in the same step.
+  std::shared_ptr<TableSnapshot> snapshot;
+
+  /// Identical queries due in the same step, given this task's results.
+  SharedQueries shared;
+};
+
+/**
+ * @brief Order scheduled tasks by earliest deadline, then cheapest first.
+ *
+ * A std::priority_queue pops its "largest" element, so a task compares less
+ * than another if it should run later.
+ */
+struct ScheduledTaskCompare {
+  bool operator()(const ScheduledTask& a, const ScheduledTask& b) const {
+    if (a.deadline != b.deadline) {
+      return a.deadline > b.deadline;
+    }
+    return a.cost > b.cost;
+  }
+};
+
 /// A Dispatcher service thread that watches an ExtensionManagerHandler.
 class SchedulerRunner : public InternalRunnable {
  public:
@@ -27,7 +85,36 @@ class SchedulerRunner : public InternalRunnable {
   void start() override;
 
   /// The Dispatcher interrupt point.
-  void stop() override {}
+  void stop() override;
+
+ protected:
+  /// Scheduled queries run in the schedule thread class.
+  ThreadClass threadClass() const override { return THREAD_CLASS_SCHEDULE; }
+
+  /**
+   * @brief Queue a due query for the schedule workers.
+   *
+   * A query is never queued while a previous execution is queued or running.
+   * If that previous execution has not finished, this step is skipped and
+   * recorded as a missed execution.
+   *
+   * @return true if the query was queued, otherwise false.
+   */
+  bool schedule(const std::string& name,
+                const ScheduledQuery& query,
+                size_t step,
+                std::chrono::steady_clock::time_point due,
+                std::shared_ptr<TableSnapshot> snapshot = nullptr,
+                const SharedQueries& shared = {});
+
+  /// Start a number of schedule worker threads.
+  void startWorkers(size_t count);
+
+  /// Stop and join the schedule workers, optionally finishing queued queries.
+  void stopWorkers(bool drain);
+
+  /// The schedule worker thread entry point.
+  void worker();
 
  protected:
   /// The UNIX domain socket path for the ExtensionManager.
@@ -38,6 +125,36 @@ class SchedulerRunner : public InternalRunnable {
 
   /// Maximum number of steps.
   unsigned long int timeout_;
+
+ private:
+  /// Due queries, ordered by ScheduledTaskCompare.
+  std::priority_queue<ScheduledTask,
+                      std::vector<ScheduledTask>,
+                      ScheduledTaskCompare>
+      queue_;
+
+  /// The names of queued or running queries.
+  std::set<std::string> pending_;
+
+  /// Average execution times in milliseconds, by query name.
+  std::map<std::string, size_t> costs_;
+
+  /// The schedule worker threads, empty when running serially.
+  std::vector<std::thread> workers_;
+
+  /// Signal to the schedule workers that they should exit.
+  bool stopping_{false};
+
+  /// Protection around the queue, pending, costs and stopping state.
+  std::mutex queue_mutex_;
+
+  /// Wake the schedule workers when tasks are queued or they should exit.
+  std::condition_variable queue_cv_;
+
+ private:
+  FRIEND_TEST(SchedulerTests, test_scheduler_queue);
+  FRIEND_TEST(SchedulerTests, test_scheduler_shared_queue);
+  FRIEND_TEST(SchedulerTests, test_scheduler_workers);
 };
 
 /// Start querying according to the config's schedule
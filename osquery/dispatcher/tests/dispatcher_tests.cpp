@@ -10,10 +10,19 @@
 
 #include <gtest/gtest.h>
 
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 #include <osquery/dispatcher.h>
+#include <osquery/flags.h>
 
 namespace osquery {
 
+DECLARE_string(thread_classes);
+
 class DispatcherTests : public testing::Test {
   void TearDown() override {}
 };
@@ -30,4 +39,37 @@ class TestRunnable : public InternalRunnable {
   explicit TestRunnable(int* i) : i(i) {}
   virtual void start() { ++*i; }
 };
+
+#ifdef __linux__
+class BulkRunnable : public InternalRunnable {
+ public:
+  int nice{0};
+
+ protected:
+  void start() override {
+    auto tid = static_cast<id_t>(::syscall(SYS_gettid));
+    nice = ::getpriority(PRIO_PROCESS, tid);
+  }
+
+  ThreadClass threadClass() const override { return THREAD_CLASS_BULK; }
+};
+
+TEST_F(DispatcherTests, test_thread_class) {
+  // Raising a thread's nice value needs no privileges.
+  auto nice = ::getpriority(PRIO_PROCESS, 0);
+  if (nice >= 15) {
+    return;
+  }
+
+  FLAGS_thread_classes = "logger:idle,bulk:nice:15";
+  auto runnable = std::make_shared<BulkRunnable>();
+  std::thread thread(&InternalRunnable::run, runnable.get());
+  thread.join();
+  FLAGS_thread_classes = "";
+
+  // Only the runnable's thread was given its class's policy.
+  EXPECT_EQ(runnable->nice, 15);
+  EXPECT_EQ(::getpriority(PRIO_PROCESS, 0), nice);
+}
+#endif
 }
@@ -20,8 +20,15 @@
 namespace osquery {
 
 DECLARE_bool(disable_logging);
+DECLARE_uint64(schedule_workers);
+DECLARE_bool(schedule_share_queries);
 
 extern SQL monitor(const std::string& name, const ScheduledQuery& query);
+extern SQL profiledQuery(const std::string& name, const ScheduledQuery& query);
+extern std::set<std::string> getSharedTables(
+    const std::vector<std::pair<std::string, ScheduledQuery>>& queries);
+extern SharedQueryList shareIdenticalQueries(
+    std::vector<std::pair<std::string, ScheduledQuery>>& queries);
 
 class SchedulerTests : public testing::Test {
   void SetUp() override {
@@ -166,4 +173,271 @@ TEST_F(SchedulerTests, test_scheduler) {
   // If a query was executed the cache step will have been advanced.
   EXPECT_GT(TablePlugin::kCacheStep, now);
 }
+
+TEST_F(SchedulerTests, test_scheduler_queue) {
+  SchedulerRunner runner(0, 1);
+
+  ScheduledQuery query;
+  query.query = "select * from time";
+  query.splayed_interval = 10;
+  auto due = std::chrono::steady_clock::now();
+
+  // A query is not queued again while a previous execution is pending.
+  EXPECT_TRUE(runner.schedule("slow", query, 100, due));
+  EXPECT_FALSE(runner.schedule("slow", query, 110, due));
+
+  // The skipped execution is reported as missed.
+  QueryPerformance perf;
+  Config::getInstance().getPerformanceStats(
+      "slow", ([&perf](const QueryPerformance& r) { perf = r; }));
+  EXPECT_EQ(perf.missed_executions, 1U);
+
+  // A shorter interval has an earlier deadline.
+  query.splayed_interval = 5;
+  EXPECT_TRUE(runner.schedule("short", query, 100, due));
+
+  // With the same deadline the query expected to complete first runs first.
+  query.splayed_interval = 10;
+  runner.costs_["fast"] = 1;
+  runner.costs_["slower"] = 1000;
+  EXPECT_TRUE(runner.schedule("slower", query, 100, due));
+  EXPECT_TRUE(runner.schedule("fast", query, 100, due));
+
+  std::vector<std::string> order;
+  auto queue = runner.queue_;
+  while (!queue.empty()) {
+    order.push_back(queue.top().name);
+    queue.pop();
+  }
+  std::vector<std::string> expected = {"short", "slow", "fast", "slower"};
+  EXPECT_EQ(order, expected);
+
+  // Stopping without draining discards queued tasks.
+  runner.stopWorkers(false);
+  EXPECT_TRUE(runner.pending_.empty());
+  EXPECT_TRUE(runner.schedule("slow", query, 110, due));
+}
+
+TEST_F(SchedulerTests, test_scheduler_workers) {
+  auto workers = FLAGS_schedule_workers;
+  FLAGS_schedule_workers = 2;
+
+  std::string config =
+      "{"
+      "\"packs\": {"
+      "\"workers\": {"
+      "\"queries\": {"
+      "\"1\": {\"query\": \"select * from time\", \"interval\": 1},"
+      "\"2\": {\"query\": \"select * from osquery_info\", \"interval\": 1}"
+      "}"
+      "}"
+      "}"
+      "}";
+  Config::getInstance().update({{"data", config}});
+
+  auto now = osquery::getUnixTime();
+  SchedulerRunner runner(now + 1, 1);
+  runner.start();
+  FLAGS_schedule_workers = workers;
+
+  // Both queries were executed by workers and stored results.
+  std::string content;
+  getDatabaseValue(kQueries, "pack_workers_1", content);
+  EXPECT_FALSE(content.empty());
+  content.clear();
+  getDatabaseValue(kQueries, "pack_workers_2", content);
+  EXPECT_FALSE(content.empty());
+
+  // All workers were joined.
+  EXPECT_TRUE(runner.workers_.empty());
+  EXPECT_TRUE(runner.pending_.empty());
+}
+
+TEST_F(SchedulerTests, test_scheduler_lateness) {
+  std::string name = "pack_test_late_query";
+  Config::getInstance().recordQueryLateness(name, 0, 0);
+  Config::getInstance().recordQueryLateness(name, 1500, 0);
+  Config::getInstance().recordQueryLateness(name, 2500, 0);
+  Config::getInstance().recordQueryLateness(name, 0, 3);
+
+  QueryPerformance perf;
+  Config::getInstance().getPerformanceStats(
+      name, ([&perf](const QueryPerformance& r) { perf = r; }));
+  EXPECT_EQ(perf.late_executions, 2U);
+  EXPECT_EQ(perf.lateness, 4000U);
+  EXPECT_EQ(perf.missed_executions, 3U);
+  // Lateness is tracked without the schedule monitor.
+  EXPECT_EQ(perf.executions, 0U);
+}
+
+TEST_F(SchedulerTests, test_scheduler_histograms) {
+  ScheduledQuery query;
+  query.interval = 10;
+  query.query = "select * from time";
+  std::string name = "pack_test_histogram_query";
+  for (size_t i = 0; i < 3; ++i) {
+    auto results = profiledQuery(name, query);
+    EXPECT_EQ(results.rows().size(), 1U);
+  }
+
+  // Latency and rows are recorded without the schedule monitor.
+  QueryPerformance perf;
+  Config::getInstance().getPerformanceStats(
+      name, ([&perf](const QueryPerformance& r) { perf = r; }));
+  EXPECT_EQ(perf.executions, 0U);
+  EXPECT_EQ(perf.wall_time_histogram.count(), 3U);
+  EXPECT_EQ(perf.rows_histogram.count(), 3U);
+  EXPECT_EQ(perf.rows_histogram.percentile(99), 1U);
+
+  // Each execution's generation of the table is recorded.
+  TablePerformance generation;
+  Config::getInstance().tablePerformance(
+      [&generation](const std::string& table, const TablePerformance& r) {
+        if (table == "time") {
+          generation = r;
+        }
+      });
+  EXPECT_EQ(generation.generations, 3U);
+  EXPECT_EQ(generation.filters, 3U);
+  EXPECT_EQ(generation.rows, 3U);
+  EXPECT_EQ(generation.generate_time_histogram.count(), 3U);
+}
+
+TEST_F(SchedulerTests, test_scheduler_drift) {
+  std::string config =
+      "{"
+      "\"packs\": {"
+      "\"drift\": {"
+      "\"queries\": {"
+      "\"1\": {\"query\": \"select * from time\", \"interval\": 1}"
+      "}"
+      "}"
+      "}"
+      "}";
+  Config::getInstance().update({{"data", config}});
+
+  // Three steps, each due a second apart, pause until the step after the last.
+  // Time spent executing the query is not added to the pauses.
+  auto now = osquery::getUnixTime();
+  auto t0 = std::chrono::steady_clock::now();
+  SchedulerRunner runner(now + 2, 1);
+  runner.start();
+  auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                     std::chrono::steady_clock::now() - t0)
+                     .count();
+  EXPECT_GE(elapsed, 2900);
+  EXPECT_LT(elapsed, 4000);
+}
+
+TEST_F(SchedulerTests, test_shared_tables) {
+  std::vector<std::pair<std::string, ScheduledQuery>> queries;
+  ScheduledQuery query;
+  query.query = "select * from time";
+  queries.push_back(std::make_pair("1", query));
+  query.query = "SELECT hour FROM TIME t, osquery_info i";
+  queries.push_back(std::make_pair("2", query));
+  query.query = "select pid from processes where name = 'osquery_info'";
+  queries.push_back(std::make_pair("3", query));
+  query.query = "select * from processes p join processes q using (pid)";
+  queries.push_back(std::make_pair("4", query));
+
+  // Each table is counted once per query, identifiers are case-insensitive.
+  // The lexical match also counts a string literal naming a table.
+  std::set<std::string> expected = {"osquery_info", "processes", "time"};
+  EXPECT_EQ(getSharedTables(queries), expected);
+
+  queries.pop_back();
+  queries.pop_back();
+  expected = {"time"};
+  EXPECT_EQ(getSharedTables(queries), expected);
+}
+
+TEST_F(SchedulerTests, test_share_identical_queries) {
+  std::vector<std::pair<std::string, ScheduledQuery>> queries;
+  ScheduledQuery query;
+  query.query = "select * from time";
+  queries.push_back(std::make_pair("1", query));
+  query.query = "select * from osquery_info";
+  queries.push_back(std::make_pair("2", query));
+  query.query = "select * from time";
+  query.interval = 60;
+  queries.push_back(std::make_pair("3", query));
+  // Watermarked queries are never shared.
+  query.options["watermark"] = true;
+  queries.push_back(std::make_pair("4", query));
+
+  auto shared = shareIdenticalQueries(queries);
+  ASSERT_EQ(queries.size(), 3U);
+  ASSERT_EQ(shared.size(), 3U);
+  EXPECT_EQ(queries[0].first, "1");
+  EXPECT_EQ(queries[1].first, "2");
+  EXPECT_EQ(queries[2].first, "4");
+  ASSERT_EQ(shared[0].size(), 1U);
+  EXPECT_EQ(shared[0][0].first, "3");
+  EXPECT_EQ(shared[0][0].second.interval, 60U);
+  EXPECT_TRUE(shared[1].empty());
+  EXPECT_TRUE(shared[2].empty());
+}
+
+TEST_F(SchedulerTests, test_scheduler_shared_queue) {
+  SchedulerRunner runner(0, 1);
+
+  ScheduledQuery query;
+  query.query = "select * from time";
+  query.splayed_interval = 10;
+  auto due = std::chrono::steady_clock::now();
+
+  // Identical queries are queued as one task, all are pending.
+  SharedQueries shared = {std::make_pair("b", query)};
+  EXPECT_TRUE(runner.schedule("a", query, 100, due, nullptr, shared));
+  ASSERT_EQ(runner.queue_.size(), 1U);
+  EXPECT_EQ(runner.queue_.top().shared.size(), 1U);
+  EXPECT_EQ(runner.pending_.count("b"), 1U);
+  EXPECT_FALSE(runner.schedule("b", query, 110, due));
+
+  // A pending query misses the step, the next identical query runs instead.
+  shared = {std::make_pair("c", query)};
+  EXPECT_TRUE(runner.schedule("a", query, 110, due, nullptr, shared));
+  EXPECT_EQ(runner.pending_.count("c"), 1U);
+
+  QueryPerformance perf;
+  Config::getInstance().getPerformanceStats(
+      "a", ([&perf](const QueryPerformance& r) { perf = r; }));
+  EXPECT_EQ(perf.missed_executions, 1U);
+
+  runner.stopWorkers(false);
+  EXPECT_TRUE(runner.pending_.empty());
+}
+
+TEST_F(SchedulerTests, test_scheduler_shared_queries) {
+  std::string config =
+      "{"
+      "\"packs\": {"
+      "\"shared\": {"
+      "\"queries\": {"
+      "\"1\": {\"query\": \"select * from time\", \"interval\": 1},"
+      "\"2\": {\"query\": \"select * from time\", \"interval\": 1}"
+      "}"
+      "}"
+      "}"
+      "}";
+  Config::getInstance().update({{"data", config}});
+
+  // Each step executes the identical queries once.
+  FLAGS_schedule_share_queries = true;
+  auto now = osquery::getUnixTime();
+  SchedulerRunner runner(now + 1, 1);
+  runner.start();
+  FLAGS_schedule_share_queries = false;
+
+  size_t shared = 0;
+  Config::getInstance().scheduledQueries(
+      [&shared](const std::string& name, const ScheduledQuery& query) {
+        Config::getInstance().getPerformanceStats(
+            name, [&shared](const QueryPerformance& perf) {
+              shared += perf.shared_executions;
+            });
+      });
+  EXPECT_GE(shared, 1U);
+}
 }
@@ -8,20 +8,33 @@
  *
  */
 
+#include <algorithm>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <set>
 #include <sstream>
+#include <thread>
 #include <utility>
 
+#include <boost/noncopyable.hpp>
 #include <boost/property_tree/json_parser.hpp>
 
+#include <osquery/config.h>
 #include <osquery/core.h>
 #include <osquery/distributed.h>
 #include <osquery/logger.h>
 #include <osquery/sql.h>
 
+#include "osquery/core/json.h"
+#include "osquery/sql/sqlite_util.h"
+
 namespace pt = boost::property_tree;
 
 namespace osquery {
 
+DECLARE_uint64(table_max_staleness);
+
 CREATE_REGISTRY(DistributedPlugin, "distributed");
 
 FLAG(string, distributed_plugin, "tls", "Distributed plugin name");
@@ -31,8 +44,123 @@ FLAG(bool,
      true,
      "Disable distributed queries (default true)");
 
+FLAG(uint64,
+     distributed_long_poll,
+     0,
+     "Seconds the server may hold a query retrieval open, 0 to disable");
+
+FLAG(uint64,
+     distributed_workers,
+     4,
+     "Number of threads executing distributed queries (default 4)");
+
+FLAG(uint64,
+     distributed_max_time,
+     0,
+     "Milliseconds a distributed query may execute, 0 for no limit");
+
+FLAG(uint64,
+     distributed_max_rows,
+     0,
+     "Truncate distributed query results after rows, 0 for no limit");
+
+FLAG(uint64,
+     distributed_max_bytes,
+     0,
+     "Truncate distributed query results after bytes, 0 for no limit");
+
+FLAG(uint64,
+     distributed_chunk_bytes,
+     0,
+     "Write distributed query results in parts of bytes, 0 for one write");
+
+FLAG(uint64,
+     distributed_max_cpu_time,
+     0,
+     "Milliseconds of CPU a distributed query may use, 0 for no limit");
+
+FLAG(uint64,
+     distributed_max_estimated_rows,
+     0,
+     "Reject distributed queries estimated to generate more rows");
+
+FLAG(uint64,
+     distributed_max_estimated_time,
+     0,
+     "Reject distributed queries estimated to take more milliseconds");
+
+FLAG(uint64,
+     distributed_max_concurrent_time,
+     0,
+     "Estimated milliseconds of distributed queries executing at once");
+
 Mutex distributed_queries_mutex_;
 Mutex distributed_results_mutex_;
+Mutex distributed_flush_mutex_;
+
+/// Microseconds estimated for a row of cost 1 without a table's history.
+const double kDistributedRowMicros = 10;
+
+/**
+ * @brief Admit a query within `--distributed_max_concurrent_time`
+ *
+ * The query waits while the estimated time of the executing queries and its
+ * own exceeds the limit. A query exceeding the limit by itself executes
+ * alone.
+ */
+class DistributedConcurrency : private boost::noncopyable {
+ public:
+  explicit DistributedConcurrency(double time);
+  ~DistributedConcurrency();
+
+ private:
+  /// The estimated time of the admitted query.
+  double time_{0};
+
+  /// Set if the query was counted as executing.
+  bool admitted_{false};
+
+  static std::mutex mutex_;
+  static std::condition_variable condition_;
+
+  /// The estimated time, and the number, of executing queries.
+  static double running_time_;
+  static size_t running_;
+};
+
+std::mutex DistributedConcurrency::mutex_;
+std::condition_variable DistributedConcurrency::condition_;
+double DistributedConcurrency::running_time_{0};
+size_t DistributedConcurrency::running_{0};
+
+DistributedConcurrency::DistributedConcurrency(double time) {
+  if (FLAGS_distributed_max_concurrent_time == 0) {
+    return;
+  }
+
+  auto limit = static_cast<double>(FLAGS_distributed_max_concurrent_time);
+  std::unique_lock<std::mutex> lock(mutex_);
+  condition_.wait(lock, [time, limit]() {
+    return running_ == 0 || running_time_ + time <= limit;
+  });
+  time_ = time;
+  admitted_ = true;
+  running_time_ += time;
+  running_++;
+}
+
+DistributedConcurrency::~DistributedConcurrency() {
+  if (!admitted_) {
+    return;
+  }
+
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    running_time_ = std::max(running_time_ - time_, 0.0);
+    running_--;
+  }
+  condition_.notify_all();
+}
 
 Status DistributedPlugin::call(const PluginRequest& request,
                                PluginResponse& response) {
@@ -87,31 +215,90 @@ size_t Distributed::getCompletedCount() {
 }
 
 Status Distributed::serializeResults(std::string& json) {
-  pt::ptree tree;
+  WriteLock lock(distributed_results_mutex_);
+  return serializeResults(results_, json);
+}
 
-  {
-    WriteLock lock(distributed_results_mutex_);
-    for (const auto& result : results_) {
-      pt::ptree qd;
-      auto s = serializeQueryData(result.results, qd);
-      if (!s.ok()) {
-        return s;
+Status Distributed::serializeResults(
+    const std::vector<DistributedQueryResult>& results, std::string& json) {
+  json.clear();
+  JSONWriter writer(json);
+  writer.startObject();
+  writer.key("queries");
+
+  if (results.empty()) {
+    // Match the property tree output for an empty set of queries.
+    writer.value("");
+  } else {
+    writer.startObject();
+    for (const auto& result : results) {
+      writer.key(result.request.id);
+      serializeQueryDataJSON(result.results, writer);
+    }
+    writer.endObject();
+  }
+
+  // Results written in parts, or incomplete results, are marked by query.
+  auto chunked = std::any_of(
+      results.begin(), results.end(), [](const DistributedQueryResult& r) {
+        return r.chunked;
+      });
+  if (chunked) {
+    writer.key("chunks");
+    writer.startObject();
+    for (const auto& result : results) {
+      if (result.chunked) {
+        writer.key(result.request.id);
+        writer.startObject();
+        writer.member("index", std::to_string(result.chunk));
+        writer.member("more", (result.more) ? "true" : "false");
+        writer.endObject();
       }
-      tree.add_child(result.request.id, qd);
     }
+    writer.endObject();
   }
 
-  pt::ptree results;
-  results.add_child("queries", tree);
+  auto rejected = std::any_of(
+      results.begin(), results.end(), [](const DistributedQueryResult& r) {
+        return !r.rejected.empty();
+      });
+  if (rejected) {
+    // Rejected queries were not executed, their results are empty.
+    writer.key("rejected");
+    writer.startObject();
+    for (const auto& result : results) {
+      if (!result.rejected.empty()) {
+        writer.key(result.request.id);
+        writer.startObject();
+        writer.member("reason", "too expensive");
+        writer.member("message", result.rejected);
+        writer.member("estimated_rows",
+                      std::to_string(static_cast<size_t>(result.cost.rows)));
+        writer.member("estimated_time",
+                      std::to_string(static_cast<size_t>(result.cost.time)));
+        writer.endObject();
+      }
+    }
+    writer.endObject();
+  }
 
-  std::stringstream ss;
-  try {
-    pt::write_json(ss, results, false);
-  } catch (const pt::ptree_error& e) {
-    return Status(1, "Error writing JSON: " + std::string(e.what()));
+  auto truncated = std::any_of(
+      results.begin(), results.end(), [](const DistributedQueryResult& r) {
+        return !r.truncated.empty();
+      });
+  if (truncated) {
+    writer.key("truncated");
+    writer.startObject();
+    for (const auto& result : results) {
+      if (!result.truncated.empty()) {
+        writer.member(result.request.id, result.truncated);
+      }
+    }
+    writer.endObject();
   }
-  json = ss.str();
 
+  writer.endObject();
+  writer.finish();
   return Status(0, "OK");
 }
 
@@ -120,81 +307,430 @@ void Distributed::addResult(const DistributedQueryResult& result) {
   results_.push_back(result);
 }
 
+void Distributed::addResult(const DistributedQueryResult& result,
+                            const std::vector<std::string>& duplicates) {
+  WriteLock wlock_results(distributed_results_mutex_);
+  results_.push_back(result);
+  for (const auto& id : duplicates) {
+    results_.push_back(result);
+    results_.back().request.id = id;
+  }
+}
+
+void Distributed::addResult(DistributedQueryResult&& result,
+                            const std::vector<std::string>& duplicates) {
+  WriteLock wlock_results(distributed_results_mutex_);
+  results_.push_back(std::move(result));
+  auto moved = results_.size() - 1;
+  for (const auto& id : duplicates) {
+    results_.push_back(results_[moved]);
+    results_.back().request.id = id;
+  }
+}
+
+void Distributed::runQuery(DistributedQueryRequest&& query) {
+  runQuery(std::move(query), {});
+}
+
+Status Distributed::estimateCost(const std::string& query,
+                                 DistributedQueryCost& cost) {
+  std::vector<QueryScanEstimate> scans;
+  Status status;
+  {
+    auto dbc = SQLiteDBManager::get();
+    status = getQueryScans(query, scans, dbc->db());
+    // Planning recorded constraints for tables that are not filtered.
+    dbc->clearAffectedTables();
+  }
+  if (!status.ok()) {
+    return status;
+  }
+
+  // The average rows and milliseconds of a generation of each scanned table.
+  std::map<std::string, std::pair<double, double>> history;
+  for (const auto& scan : scans) {
+    history[scan.table];
+  }
+  Config::getInstance().tablePerformance(
+      [&history](const std::string& table, const TablePerformance& perf) {
+        auto it = history.find(table);
+        if (it != history.end() && perf.generations > 0) {
+          auto generations = static_cast<double>(perf.generations);
+          it->second.first = perf.rows / generations;
+          it->second.second = perf.generate_time / generations / 1000;
+        }
+      });
+
+  // Scans are nested loops, a dependent scan is filtered for each outer row.
+  cost = DistributedQueryCost();
+  double loops = 1;
+  for (const auto& scan : scans) {
+    auto rows = scan.rows;
+    auto time = rows * scan.cost * kDistributedRowMicros / 1000;
+    const auto& known = history[scan.table];
+    if (known.first > 0 || known.second > 0) {
+      // The planner's rows account for constraints, history does not.
+      rows = (rows > 0) ? rows : known.first;
+      time = known.second;
+    }
+
+    auto filters = (scan.dependent) ? loops : 1;
+    cost.rows += rows * filters;
+    cost.time += time * filters;
+    loops *= std::max(rows, 1.0);
+  }
+  return Status(0, "OK");
+}
+
+Status Distributed::admitQuery(const DistributedQueryRequest& request,
+                               DistributedQueryCost& cost) {
+  cost = DistributedQueryCost();
+  if (FLAGS_distributed_max_estimated_rows == 0 &&
+      FLAGS_distributed_max_estimated_time == 0 &&
+      FLAGS_distributed_max_concurrent_time == 0) {
+    return Status(0, "OK");
+  }
+
+  if (!estimateCost(request.query, cost).ok()) {
+    // The query fails when executed, and reports its error.
+    return Status(0, "OK");
+  }
+
+  if (FLAGS_distributed_max_estimated_rows > 0 &&
+      cost.rows > FLAGS_distributed_max_estimated_rows) {
+    return Status(1,
+                  "rejected: too expensive, estimated " +
+                      std::to_string(static_cast<size_t>(cost.rows)) +
+                      " rows");
+  }
+
+  if (FLAGS_distributed_max_estimated_time > 0 &&
+      cost.time > FLAGS_distributed_max_estimated_time) {
+    return Status(1,
+                  "rejected: too expensive, estimated " +
+                      std::to_string(static_cast<size_t>(cost.time)) + "ms");
+  }
+  return Status(0, "OK");
+}
+
+void Distributed::runQuery(DistributedQueryRequest&& query,
+                           const std::vector<std::string>& duplicates) {
+  DistributedQueryCost cost;
+  auto admitted = admitQuery(query, cost);
+  if (!admitted.ok()) {
+    LOG(WARNING) << "Distributed query[" << query.id << "] "
+                 << admitted.getMessage() << ": " << query.query;
+    DistributedQueryResult rejected(query, QueryData());
+    rejected.rejected = admitted.getMessage();
+    rejected.cost = cost;
+    addResult(std::move(rejected), duplicates);
+    return;
+  }
+
+  // Wait for expensive queries executing on other workers.
+  DistributedConcurrency concurrency(cost.time);
+  VLOG(1) << "Executing distributed query[" << query.id
+          << "]: " << query.query;
+
+  QueryBudget limits;
+  limits.max_time = FLAGS_distributed_max_time;
+  limits.max_cpu_time = FLAGS_distributed_max_cpu_time;
+  std::unique_ptr<QueryBudgetScope> budget;
+  if (!limits.empty()) {
+    budget.reset(new QueryBudgetScope(limits));
+  }
+
+  // Rows are streamed, a large result set is never held in memory at once.
+  DistributedQueryResult part(query, QueryData());
+  size_t rows = 0;
+  size_t bytes = 0;
+  size_t part_bytes = 0;
+  auto callback = [&](Row&& row) -> bool {
+    size_t row_bytes = 0;
+    for (const auto& column : row) {
+      row_bytes += column.first.size() + column.second.size();
+    }
+
+    if (FLAGS_distributed_max_rows > 0 && rows >= FLAGS_distributed_max_rows) {
+      part.truncated = "exceeded " + std::to_string(rows) + " rows";
+      return false;
+    } else if (FLAGS_distributed_max_bytes > 0 &&
+               bytes + row_bytes > FLAGS_distributed_max_bytes) {
+      part.truncated = "exceeded " +
+                       std::to_string(FLAGS_distributed_max_bytes) + " bytes";
+      return false;
+    }
+
+    rows++;
+    bytes += row_bytes;
+    part_bytes += row_bytes;
+    part.results.push_back(std::move(row));
+    if (FLAGS_distributed_chunk_bytes > 0 &&
+        part_bytes >= FLAGS_distributed_chunk_bytes) {
+      // Write this part, the next part continues the results.
+      DistributedQueryResult next(query, QueryData());
+      next.chunked = true;
+      next.chunk = part.chunk + 1;
+      part.chunked = true;
+      part.more = true;
+      std::swap(part, next);
+      addResult(std::move(next), duplicates);
+      flushCompleted();
+      part_bytes = 0;
+    }
+    return true;
+  };
+
+  Status status;
+  {
+    // Tables scanned by the schedule may be reused, see RecentGenerations.
+    TableStalenessScope staleness(FLAGS_table_max_staleness);
+    auto dbc = SQLiteDBManager::get();
+    status = queryInternal(query.query, callback, dbc->db());
+    dbc->clearAffectedTables();
+  }
+
+  if (budget != nullptr && budget->exceeded()) {
+    LOG(ERROR) << "Distributed query[" << query.id << "] "
+               << budget->reason() << ": " << query.query;
+    status = Status(1, budget->reason());
+  } else if (!status.ok()) {
+    LOG(ERROR) << "Error running distributed query[" << query.id
+               << "]: " << query.query;
+  }
+
+  if (!status.ok()) {
+    if (!part.chunked) {
+      return;
+    }
+    // Parts were already written, end the results with the failure.
+    part.results.clear();
+    part.truncated = status.getMessage();
+  } else if (!part.truncated.empty()) {
+    LOG(WARNING) << "Distributed query[" << query.id << "] results "
+                 << part.truncated << ", truncating";
+  }
+  addResult(std::move(part), duplicates);
+}
+
 Status Distributed::runQueries() {
-  while (getPendingQueryCount() > 0) {
-    auto query = popRequest();
-    VLOG(1) << "Executing distributed query[" << query.id
-            << "]: " << query.query;
-
-    auto sql = SQL(query.query);
-    if (!sql.getStatus().ok()) {
-      LOG(ERROR) << "Error running distributed query[" << query.id
-                 << "]: " << query.query;
-      continue;
+  // Each worker writes a query's results as soon as the query completes, a
+  // slow query does not delay the results of the others.
+  auto worker = [this]() {
+    DistributedQueryRequest query;
+    std::vector<std::string> duplicates;
+    while (popRequest(query, duplicates)) {
+      runQuery(std::move(query), duplicates);
+      auto status = flushCompleted();
+      if (!status.ok()) {
+        VLOG(1) << "Cannot write distributed results: " << status.getMessage();
+      }
     }
+  };
 
-    DistributedQueryResult result(std::move(query), std::move(sql.rows()));
-    addResult(result);
+  auto threads = std::max<size_t>(FLAGS_distributed_workers, 1);
+  threads = std::min(threads, getPendingQueryCount());
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < threads; i++) {
+    workers.emplace_back(worker);
   }
+  worker();
+  for (auto& thread : workers) {
+    thread.join();
+  }
+
+  // Retry results the workers could not write.
   return flushCompleted();
 }
 
 Status Distributed::flushCompleted() {
-  if (getCompletedCount() == 0) {
-    return Status(0, "OK");
+  // Results completed while another thread writes are sent by the next flush.
+  WriteLock flush_lock(distributed_flush_mutex_);
+  std::vector<DistributedQueryResult> results;
+  {
+    WriteLock lock(distributed_results_mutex_);
+    results.swap(results_);
   }
 
   auto& distributed_plugin = Registry::getActive("distributed");
-  if (!Registry::exists("distributed", distributed_plugin)) {
-    return Status(1, "Missing distributed plugin " + distributed_plugin);
-  }
+  Status s;
+  while (!results.empty() && s.ok()) {
+    // A write includes at most one part of each query's results, later parts
+    // of the same query are written next.
+    std::vector<DistributedQueryResult> batch;
+    std::vector<DistributedQueryResult> remaining;
+    std::set<std::string> ids;
+    for (auto& result : results) {
+      if (ids.insert(result.request.id).second) {
+        batch.push_back(std::move(result));
+      } else {
+        remaining.push_back(std::move(result));
+      }
+    }
 
-  std::string results;
-  auto s = serializeResults(results);
-  if (!s.ok()) {
-    return s;
+    std::string json;
+    s = serializeResults(batch, json);
+    if (s.ok() && !Registry::exists("distributed", distributed_plugin)) {
+      s = Status(1, "Missing distributed plugin " + distributed_plugin);
+    }
+
+    if (s.ok()) {
+      PluginResponse response;
+      s = Registry::call("distributed",
+                         {{"action", "writeResults"}, {"results", json}},
+                         response);
+    }
+
+    if (!s.ok()) {
+      // Keep the results for the next flush, in order.
+      remaining.insert(remaining.begin(),
+                       std::make_move_iterator(batch.begin()),
+                       std::make_move_iterator(batch.end()));
+    }
+    results = std::move(remaining);
   }
 
-  PluginResponse response;
-  s = Registry::call("distributed",
-                     {{"action", "writeResults"}, {"results", results}},
-                     response);
-  if (s.ok()) {
-    results_.clear();
+  if (!results.empty()) {
+    WriteLock lock(distributed_results_mutex_);
+    results_.insert(results_.begin(),
+                    std::make_move_iterator(results.begin()),
+                    std::make_move_iterator(results.end()));
   }
   return s;
 }
 
+/// Read the distributed queries, a map of IDs to SQL, from a work response.
+class WorkJSONHandler : public JSONHandler {
+ public:
+  explicit WorkJSONHandler(std::vector<DistributedQueryRequest>& requests)
+      : requests_(requests) {}
+
+  void key(std::string& name) override {
+    if (depth_ == 1 && name == "queries" && !found_) {
+      found_ = true;
+      queries_ = true;
+    } else if (depth_ == 2 && in_queries_) {
+      id_ = std::move(name);
+    }
+  }
+
+  void value(std::string& value) override {
+    if (depth_ == 2 && in_queries_) {
+      add(std::move(value));
+    }
+    queries_ = false;
+  }
+
+  void startObject() override { start(); }
+
+  void endObject() override { end(); }
+
+  void startArray() override { start(); }
+
+  void endArray() override { end(); }
+
+  /// True if the response included queries.
+  bool found() const { return found_; }
+
+ private:
+  void start() {
+    if (depth_ == 2 && in_queries_) {
+      // A query that is not a string has no SQL.
+      add("");
+    }
+    in_queries_ = (depth_ == 1 && queries_) || (in_queries_ && depth_ > 1);
+    queries_ = false;
+    depth_++;
+  }
+
+  void end() {
+    depth_--;
+    if (depth_ <= 1) {
+      in_queries_ = false;
+    }
+  }
+
+  void add(std::string&& query) {
+    DistributedQueryRequest request;
+    request.id = std::move(id_);
+    request.query = std::move(query);
+    requests_.push_back(std::move(request));
+    id_.clear();
+  }
+
+ private:
+  size_t depth_{0};
+
+  /// The next value is the queries member.
+  bool queries_{false};
+
+  /// Within the queries member.
+  bool in_queries_{false};
+
+  bool found_{false};
+
+  /// The ID of the next query.
+  std::string id_;
+
+  std::vector<DistributedQueryRequest>& requests_;
+};
+
 Status Distributed::acceptWork(const std::string& work) {
-  pt::ptree tree;
-  std::stringstream ss(work);
-  try {
-    pt::read_json(ss, tree);
+  std::vector<DistributedQueryRequest> requests;
+  WorkJSONHandler handler(requests);
+  auto status = parseJSON(work, handler);
+  if (!status.ok()) {
+    return Status(1, "Error parsing JSON: " + status.getMessage());
+  } else if (!handler.found()) {
+    return Status(1, "Error parsing JSON: No such node (queries)");
+  }
 
-    auto& queries = tree.get_child("queries");
-    for (const auto& node : queries) {
-      DistributedQueryRequest request;
-      request.id = node.first;
-      request.query = queries.get<std::string>(node.first, "");
-      if (request.query.empty() || request.id.empty()) {
-        return Status(1,
-                      "Distributed query does not have complete attributes.");
-      }
-      WriteLock wlock(distributed_queries_mutex_);
-      queries_.push_back(request);
+  // Identical query text within the work is executed once, the results are
+  // written for each of the ids.
+  std::map<std::string, std::string> first_ids;
+  size_t duplicates = 0;
+  for (auto& request : requests) {
+    if (request.query.empty() || request.id.empty()) {
+      return Status(1, "Distributed query does not have complete attributes.");
     }
-  } catch (const pt::ptree_error& e) {
-    return Status(1, "Error parsing JSON: " + std::string(e.what()));
+    WriteLock wlock(distributed_queries_mutex_);
+    auto first = first_ids.find(request.query);
+    if (first != first_ids.end()) {
+      duplicates_[first->second].push_back(std::move(request.id));
+      duplicates++;
+      continue;
+    }
+    first_ids[request.query] = request.id;
+    queries_.push_back(std::move(request));
   }
 
+  if (duplicates > 0) {
+    VLOG(1) << "Deduplicated " << duplicates << " distributed queries";
+  }
   return Status(0, "OK");
 }
 
-DistributedQueryRequest Distributed::popRequest() {
+bool Distributed::popRequest(DistributedQueryRequest& request,
+                             std::vector<std::string>& duplicates) {
   WriteLock wlock_queries(distributed_queries_mutex_);
-  auto q = queries_[0];
+  if (queries_.empty()) {
+    return false;
+  }
+  request = std::move(queries_[0]);
   queries_.erase(queries_.begin());
-  return q;
+
+  duplicates.clear();
+  auto it = duplicates_.find(request.id);
+  if (it != duplicates_.end()) {
+    duplicates = std::move(it->second);
+    duplicates_.erase(it);
+  }
+  return true;
+}
+
+bool Distributed::popRequest(DistributedQueryRequest& request) {
+  std::vector<std::string> duplicates;
+  return popRequest(request, duplicates);
 }
 
 Status serializeDistributedQueryRequest(const DistributedQueryRequest& r,
@@ -26,6 +26,7 @@
 
 #include "osquery/remote/requests.h"
 #include "osquery/remote/serializers/json.h"
+#include "osquery/remote/serializers/msgpack.h"
 #include "osquery/remote/utility.h"
 
 namespace pt = boost::property_tree;
@@ -33,6 +34,7 @@ namespace pt = boost::property_tree;
 namespace osquery {
 
 DECLARE_bool(tls_node_api);
+DECLARE_uint64(distributed_long_poll);
 
 FLAG(string,
      distributed_tls_read_endpoint,
@@ -49,6 +51,19 @@ FLAG(uint64,
      3,
      "Number of times to attempt a request")
 
+FLAG(string,
+     distributed_tls_compression,
+     "",
+     "Compress distributed query results using gzip or zstd");
+
+FLAG(string,
+     distributed_tls_write_format,
+     "json",
+     "Serialize distributed query results as json or msgpack");
+
+/// Seconds beyond the long poll to wait for the server's response.
+const size_t kLongPollSlack = 4;
+
 class TLSDistributedPlugin : public DistributedPlugin {
  public:
   Status setUp();
@@ -65,18 +80,26 @@ REGISTER(TLSDistributedPlugin, "distributed", "tls");
 Status TLSDistributedPlugin::setUp() {
   read_uri_ = TLSRequestHelper::makeURI(FLAGS_distributed_tls_read_endpoint);
   write_uri_ = TLSRequestHelper::makeURI(FLAGS_distributed_tls_write_endpoint);
+  if (FLAGS_distributed_tls_write_format != "json" &&
+      FLAGS_distributed_tls_write_format != "msgpack") {
+    LOG(WARNING) << "Unknown distributed TLS write format: "
+                 << FLAGS_distributed_tls_write_format << ", using json";
+  }
   return Status(0, "OK");
 }
 
 Status TLSDistributedPlugin::getQueries(std::string& json) {
+  pt::ptree params;
   if (FLAGS_tls_node_api) {
-    pt::ptree params;
     params.put("verb", "POST");
-    return TLSRequestHelper::go<JSONSerializer>(
-        read_uri_, params, json, FLAGS_distributed_tls_max_attempts);
+  }
+  if (FLAGS_distributed_long_poll > 0) {
+    // The server responds once it has queries, or when the wait is over.
+    params.put("long_poll", FLAGS_distributed_long_poll);
+    params.put("timeout", FLAGS_distributed_long_poll + kLongPollSlack);
   }
   return TLSRequestHelper::go<JSONSerializer>(
-      read_uri_, json, FLAGS_distributed_tls_max_attempts);
+      read_uri_, params, json, FLAGS_distributed_tls_max_attempts);
 }
 
 Status TLSDistributedPlugin::writeResults(const std::string& json) {
@@ -87,12 +110,19 @@ Status TLSDistributedPlugin::writeResults(const std::string& json) {
     if (FLAGS_tls_node_api) {
       params.put("verb", "POST");
     }
+    if (!FLAGS_distributed_tls_compression.empty()) {
+      params.put("compression", FLAGS_distributed_tls_compression);
+    }
   } catch (const pt::ptree_error& e) {
     return Status(1, "Error parsing JSON: " + std::string(e.what()));
   }
 
   // The response is ignored.
   std::string response;
+  if (FLAGS_distributed_tls_write_format == "msgpack") {
+    return TLSRequestHelper::go<MessagePackSerializer>(
+        write_uri_, params, response, FLAGS_distributed_tls_max_attempts);
+  }
   return TLSRequestHelper::go<JSONSerializer>(
       write_uri_, params, response, FLAGS_distributed_tls_max_attempts);
 }
@@ -15,10 +15,12 @@
 
 #include <gtest/gtest.h>
 
+#include <osquery/config.h>
 #include <osquery/core.h>
 #include <osquery/distributed.h>
 #include <osquery/enroll.h>
 #include <osquery/sql.h>
+#include <osquery/tables.h>
 
 #include "osquery/tests/test_util.h"
 
@@ -28,6 +30,10 @@ namespace pt = boost::property_tree;
 
 DECLARE_string(distributed_tls_read_endpoint);
 DECLARE_string(distributed_tls_write_endpoint);
+DECLARE_uint64(distributed_max_time);
+DECLARE_uint64(distributed_max_rows);
+DECLARE_uint64(distributed_chunk_bytes);
+DECLARE_uint64(distributed_max_estimated_time);
 
 namespace osquery {
 
@@ -185,4 +191,150 @@ TEST_F(DistributedTests, test_workflow) {
   EXPECT_EQ(dist.getPendingQueryCount(), 0U);
   EXPECT_EQ(dist.results_.size(), 0U);
 }
+
+TEST_F(DistributedTests, test_run_query) {
+  auto dist = Distributed();
+  DistributedQueryRequest request;
+  request.id = "fast";
+  request.query = "SELECT 1 AS one";
+  dist.runQuery(std::move(request));
+  ASSERT_EQ(dist.results_.size(), 1U);
+  EXPECT_EQ(dist.results_[0].request.id, "fast");
+
+  // A query exceeding its time limit is aborted without results.
+  FLAGS_distributed_max_time = 1;
+  request.id = "slow";
+  request.query =
+      "WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c) "
+      "SELECT count(*) FROM c";
+  dist.runQuery(std::move(request));
+  FLAGS_distributed_max_time = 0;
+  EXPECT_EQ(dist.results_.size(), 1U);
+
+  // Pending requests are popped until none remain.
+  EXPECT_TRUE(dist.acceptWork("{\"queries\": {\"a\": \"SELECT 1\"}}").ok());
+  EXPECT_TRUE(dist.popRequest(request));
+  EXPECT_EQ(request.id, "a");
+  EXPECT_FALSE(dist.popRequest(request));
+}
+
+TEST_F(DistributedTests, test_run_query_limits) {
+  auto dist = Distributed();
+  DistributedQueryRequest request;
+  request.id = "many";
+  request.query =
+      "WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c "
+      "LIMIT 10) SELECT x FROM c";
+
+  // Results beyond the row limit are dropped and the result is marked.
+  FLAGS_distributed_max_rows = 4;
+  dist.runQuery(DistributedQueryRequest(request));
+  FLAGS_distributed_max_rows = 0;
+  ASSERT_EQ(dist.results_.size(), 1U);
+  EXPECT_EQ(dist.results_[0].results.size(), 4U);
+  EXPECT_FALSE(dist.results_[0].truncated.empty());
+  EXPECT_FALSE(dist.results_[0].chunked);
+
+  std::string json;
+  EXPECT_TRUE(Distributed::serializeResults(dist.results_, json).ok());
+  EXPECT_NE(json.find("\"truncated\""), std::string::npos);
+  EXPECT_EQ(json.find("\"chunks\""), std::string::npos);
+  dist.results_.clear();
+
+  // Each part is kept, in order, when the distributed plugin cannot write.
+  FLAGS_distributed_chunk_bytes = 1;
+  dist.runQuery(DistributedQueryRequest(request));
+  FLAGS_distributed_chunk_bytes = 0;
+  ASSERT_EQ(dist.results_.size(), 11U);
+  for (size_t i = 0; i < dist.results_.size(); i++) {
+    EXPECT_TRUE(dist.results_[i].chunked);
+    EXPECT_EQ(dist.results_[i].chunk, i);
+    EXPECT_EQ(dist.results_[i].more, i + 1 < dist.results_.size());
+  }
+  EXPECT_TRUE(dist.results_.back().results.empty());
+}
+
+TEST_F(DistributedTests, test_deduplicate_queries) {
+  auto dist = Distributed();
+  std::string work =
+      "{\"queries\": {\"a\": \"SELECT 1 AS one\", "
+      "\"b\": \"SELECT 2 AS two\", \"c\": \"SELECT 1 AS one\"}}";
+  EXPECT_TRUE(dist.acceptWork(work).ok());
+  EXPECT_EQ(dist.getPendingQueryCount(), 2U);
+
+  DistributedQueryRequest request;
+  std::vector<std::string> duplicates;
+  ASSERT_TRUE(dist.popRequest(request, duplicates));
+  EXPECT_EQ(request.id, "a");
+  ASSERT_EQ(duplicates.size(), 1U);
+  EXPECT_EQ(duplicates[0], "c");
+
+  // The results of the executed request are queued for each id.
+  dist.runQuery(std::move(request), duplicates);
+  ASSERT_EQ(dist.results_.size(), 2U);
+  EXPECT_EQ(dist.results_[0].request.id, "a");
+  EXPECT_EQ(dist.results_[1].request.id, "c");
+  EXPECT_EQ(dist.results_[0].results, dist.results_[1].results);
+
+  ASSERT_TRUE(dist.popRequest(request, duplicates));
+  EXPECT_EQ(request.id, "b");
+  EXPECT_TRUE(duplicates.empty());
+}
+
+class costlyTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const override {
+    return {
+        std::make_tuple("id", INTEGER_TYPE, INDEX),
+    };
+  }
+
+  TableStatistics statistics() const override {
+    return TableStatistics(1000, 100);
+  }
+};
+
+TEST_F(DistributedTests, test_admit_query) {
+  Registry::add<costlyTablePlugin>("table", "costly");
+  Registry::call("sql", "sql", {{"action", "attach"}, {"table", "costly"}});
+
+  // The hints estimate 1000 rows of cost 100, without generation history.
+  DistributedQueryCost cost;
+  ASSERT_TRUE(Distributed::estimateCost("SELECT * FROM costly", cost).ok());
+  EXPECT_EQ(cost.rows, 1000);
+  EXPECT_EQ(cost.time, 1000);
+
+  // A scan constrained by an outer table is filtered for each outer row.
+  DistributedQueryCost joined;
+  ASSERT_TRUE(Distributed::estimateCost(
+                  "SELECT * FROM costly a JOIN costly b ON a.id = b.id", joined)
+                  .ok());
+  EXPECT_GT(joined.time, cost.time);
+
+  // Queries estimated beyond the budget are rejected without executing.
+  FLAGS_distributed_max_estimated_time = 100;
+  DistributedQueryRequest request("SELECT 1 AS one", "cheap");
+  EXPECT_TRUE(Distributed::admitQuery(request, cost).ok());
+  request = DistributedQueryRequest("SELECT * FROM costly", "costly");
+  auto status = Distributed::admitQuery(request, cost);
+  EXPECT_FALSE(status.ok());
+  EXPECT_EQ(status.getMessage().find("rejected: too expensive"), 0U);
+
+  auto dist = Distributed();
+  dist.runQuery(DistributedQueryRequest(request));
+  ASSERT_EQ(dist.results_.size(), 1U);
+  EXPECT_TRUE(dist.results_[0].results.empty());
+  EXPECT_EQ(dist.results_[0].rejected, status.getMessage());
+
+  std::string json;
+  EXPECT_TRUE(Distributed::serializeResults(dist.results_, json).ok());
+  EXPECT_NE(json.find("\"rejected\""), std::string::npos);
+  EXPECT_NE(json.find("\"too expensive\""), std::string::npos);
+
+  // The generations of scheduled queries replace the hints.
+  Config::getInstance().recordTableGeneration("costly", 1, 10, 5000, 0, 0);
+  EXPECT_TRUE(Distributed::admitQuery(request, cost).ok());
+  EXPECT_EQ(cost.time, 5);
+  FLAGS_distributed_max_estimated_time = 0;
+}
 }
@@ -68,6 +68,13 @@ class BenchmarkEventSubscriber
   }
 
   void benchmarkGet(int low, int high) { auto results = get(low, high); }
+
+  void benchmarkEncode(const Row& r) {
+    std::string data;
+    encodeRow(r, data);
+    Row decoded;
+    decodeRow(data, decoded);
+  }
 };
 
 static void EVENTS_subscribe_fire(benchmark::State& state) {
@@ -133,4 +140,40 @@ BENCHMARK(EVENTS_retrieve_events)
     ->ArgPair(0, 50)
     ->ArgPair(0, 100)
     ->ArgPair(0, 1000);
+
+/// A row shaped like a process event.
+static Row getBenchmarkRow() {
+  Row r;
+  r["pid"] = "4123";
+  r["parent"] = "1";
+  r["path"] = "/usr/bin/python2.7";
+  r["cmdline"] = "python -c 'import sys; print(sys.argv)' --verbose";
+  r["cwd"] = "/home/user";
+  r["auid"] = "1000";
+  r["uptime"] = "103312";
+  r["time"] = "1476403200";
+  return r;
+}
+
+static void EVENTS_encode_row(benchmark::State& state) {
+  auto sub = std::make_shared<BenchmarkEventSubscriber>();
+  auto r = getBenchmarkRow();
+  while (state.KeepRunning()) {
+    sub->benchmarkEncode(r);
+  }
+}
+
+BENCHMARK(EVENTS_encode_row);
+
+static void EVENTS_serialize_row_json(benchmark::State& state) {
+  auto r = getBenchmarkRow();
+  while (state.KeepRunning()) {
+    std::string data;
+    serializeRowJSON(r, data);
+    Row decoded;
+    deserializeRowJSON(data, decoded);
+  }
+}
+
+BENCHMARK(EVENTS_serialize_row_json);
 }
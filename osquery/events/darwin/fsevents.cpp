@@ -8,6 +8,9 @@
  *
  */
 
+#include <algorithm>
+#include <unordered_map>
+
 #include <fnmatch.h>
 
 #include <boost/filesystem.hpp>
@@ -94,10 +97,13 @@ void FSEventsEventPublisher::restart() {
       flags |= kFSEventStreamCreateFlagIgnoreSelf;
     }
 
+    // The callback fires each batch through this publisher.
+    FSEventStreamContext context = {0, this, nullptr, nullptr, nullptr};
+
     // Create the FSEvent stream.
     stream_ = FSEventStreamCreate(nullptr,
                                   &FSEventsEventPublisher::Callback,
-                                  nullptr,
+                                  &context,
                                   watch_list,
                                   kFSEventStreamEventIdSinceNow,
                                   1,
@@ -195,14 +201,18 @@ void FSEventsEventPublisher::configure() {
   {
     WriteLock lock(mutex_);
     paths_.clear();
+    auto matcher = std::make_shared<FSEventsPathMatcher>();
     for (auto& sub : subscriptions_) {
       auto sc = getSubscriptionContext(sub->context);
-      if (sc->discovered_.size() > 0) {
-        continue;
+      if (sc->discovered_.size() == 0) {
+        auto paths = transformSubscription(sc);
+        paths_.insert(paths.begin(), paths.end());
       }
-      auto paths = transformSubscription(sc);
-      paths_.insert(paths.begin(), paths.end());
+      // Index the transformed path, events are matched once per batch.
+      matcher->add(sc);
     }
+    std::atomic_store(&matcher_,
+                      std::shared_ptr<const FSEventsPathMatcher>(matcher));
   }
 
   restart();
@@ -228,49 +238,113 @@ void FSEventsEventPublisher::Callback(
     void* event_paths,
     const FSEventStreamEventFlags fsevent_flags[],
     const FSEventStreamEventId fsevent_ids[]) {
+  auto pub = static_cast<FSEventsEventPublisher*>(callback_info);
+  if (pub == nullptr) {
+    return;
+  }
+
+  auto contexts =
+      pub->createEventContexts(stream,
+                               num_events,
+                               static_cast<const char* const*>(event_paths),
+                               fsevent_flags,
+                               fsevent_ids);
+  pub->fireBatch(
+      std::vector<EventContextRef>(contexts.begin(), contexts.end()));
+}
+
+FSEventsEventContextVector FSEventsEventPublisher::createEventContexts(
+    ConstFSEventStreamRef stream,
+    size_t num_events,
+    const char* const event_paths[],
+    const FSEventStreamEventFlags fsevent_flags[],
+    const FSEventStreamEventId fsevent_ids[]) const {
+  FSEventsEventContextVector contexts;
+  auto matcher = std::atomic_load(&matcher_);
+
+  // The first context for each path and action, and each path's matches.
+  std::unordered_map<std::string, size_t> seen;
+  std::unordered_map<std::string, PathMatchVector> matched;
   for (size_t i = 0; i < num_events; ++i) {
-    auto ec = createEventContext();
-    ec->fsevent_stream = stream;
-    ec->fsevent_flags = fsevent_flags[i];
-    ec->transaction_id = fsevent_ids[i];
-    ec->path = std::string(((char**)event_paths)[i]);
+    std::string path(event_paths[i]);
+    auto flags = fsevent_flags[i];
 
-    if (ec->fsevent_flags & kFSEventStreamEventFlagMustScanSubDirs) {
+    if (flags & kFSEventStreamEventFlagMustScanSubDirs) {
       // The FSEvents thread coalesced events within and will report a root.
-      TLOG << "FSEvents collision, root: " << ec->path;
+      TLOG << "FSEvents collision, root: " << path;
     }
 
-    if (ec->fsevent_flags & kFSEventStreamEventFlagRootChanged) {
+    if (flags & kFSEventStreamEventFlagRootChanged) {
       // Must rescan for the changed root.
     }
 
-    if (ec->fsevent_flags & kFSEventStreamEventFlagUnmount) {
+    if (flags & kFSEventStreamEventFlagUnmount) {
       // Should remove the watch on this path.
     }
 
-    // Record the string-version of the first matched mask bit.
-    bool has_action = false;
+    // Actions may be multiplexed. Fire an event for each matched mask bit,
+    // or an unknown action if no bit was matched.
+    std::vector<std::string> actions;
     for (const auto& action : kMaskActions) {
-      if (ec->fsevent_flags & action.first) {
-        // Actions may be multiplexed. Fire and event for each.
-        ec->action = action.second;
-        EventFactory::fire<FSEventsEventPublisher>(ec);
-        has_action = true;
+      if ((flags & action.first) &&
+          std::find(actions.begin(), actions.end(), action.second) ==
+              actions.end()) {
+        actions.push_back(action.second);
       }
     }
+    if (actions.empty()) {
+      actions.push_back("UNKNOWN");
+    }
 
-    if (!has_action) {
-      // If no action was matched for this path event, fire and unknown.
-      ec->action = "UNKNOWN";
-      EventFactory::fire<FSEventsEventPublisher>(ec);
+    PathMatchVector* matches = nullptr;
+    if (matcher != nullptr) {
+      auto it = matched.find(path);
+      if (it == matched.end()) {
+        it = matched.emplace(path, PathMatchVector()).first;
+        matcher->match(path, it->second);
+      }
+      matches = &it->second;
+    }
+
+    for (const auto& action : actions) {
+      auto key = path + '\0' + action;
+      auto duplicate = seen.find(key);
+      if (duplicate != seen.end()) {
+        // A repeated path and action within the batch adds to the first.
+        auto& ec = contexts[duplicate->second];
+        ec->fsevent_flags |= flags;
+        ec->transaction_id = std::max(ec->transaction_id, fsevent_ids[i]);
+        ec->count++;
+        continue;
+      }
+
+      auto ec = createEventContext();
+      ec->fsevent_stream = stream;
+      ec->fsevent_flags = flags;
+      ec->transaction_id = fsevent_ids[i];
+      ec->path = path;
+      ec->action = action;
+      if (matches != nullptr) {
+        ec->matcher = matcher;
+        ec->matches = *matches;
+      }
+      seen[key] = contexts.size();
+      contexts.push_back(ec);
     }
   }
+  return contexts;
 }
 
 bool FSEventsEventPublisher::shouldFire(
     const FSEventsSubscriptionContextRef& sc,
     const FSEventsEventContextRef& ec) const {
-  if (sc->recursive && !sc->recursive_match) {
+  if (ec->matcher != nullptr && ec->matcher->indexed(sc.get())) {
+    // The publisher matched the event path when reading the batch.
+    if (!std::binary_search(
+            ec->matches.begin(), ec->matches.end(), sc.get())) {
+      return false;
+    }
+  } else if (sc->recursive && !sc->recursive_match) {
     ssize_t found = ec->path.find(sc->path);
     if (found != 0) {
       return false;
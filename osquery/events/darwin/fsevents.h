@@ -21,6 +21,8 @@
 #include <osquery/events.h>
 #include <osquery/status.h>
 
+#include "osquery/events/pathmatcher.h"
+
 namespace osquery {
 
 struct FSEventsSubscriptionContext : public SubscriptionContext {
@@ -61,8 +63,11 @@ struct FSEventsSubscriptionContext : public SubscriptionContext {
 
  private:
   friend class FSEventsEventPublisher;
+  friend class FSEventsPathMatcher;
 };
 
+class FSEventsPathMatcher;
+
 struct FSEventsEventContext : public EventContext {
  public:
   ConstFSEventStreamRef fsevent_stream{nullptr};
@@ -71,12 +76,31 @@ struct FSEventsEventContext : public EventContext {
 
   std::string path;
   std::string action;
+
+  /// The publisher's path index when the event batch was read.
+  std::shared_ptr<const FSEventsPathMatcher> matcher{nullptr};
+
+  /// The indexed subscriptions matching the event path.
+  PathMatchVector matches;
+
+  /// The number of events in the batch for the path and action.
+  size_t count{1};
 };
 
 using FSEventsEventContextRef = std::shared_ptr<FSEventsEventContext>;
+using FSEventsEventContextVector = std::vector<FSEventsEventContextRef>;
 using FSEventsSubscriptionContextRef =
     std::shared_ptr<FSEventsSubscriptionContext>;
 
+/// The shared path index, see PathMatcher, for FSEvents subscriptions.
+class FSEventsPathMatcher : public PathMatcher {
+ public:
+  /// Index a subscription, after its path was transformed by configure.
+  void add(const FSEventsSubscriptionContextRef& sc) {
+    PathMatcher::add(sc, sc->path, sc->recursive, sc->recursive_match);
+  }
+};
+
 /**
  * @brief An osquery EventPublisher for the Apple FSEvents notification API.
  *
@@ -99,7 +123,12 @@ class FSEventsEventPublisher
   Status run() override;
 
  public:
-  /// FSEvents registers a client callback instead of using a select/poll loop.
+  /**
+   * @brief FSEvents registers a client callback instead of a select/poll loop.
+   *
+   * Each callback delivers a batch of events, the batch is fired together,
+   * see createEventContexts.
+   */
   static void Callback(ConstFSEventStreamRef fsevent_stream,
                        void* callback_info,
                        size_t num_events,
@@ -112,6 +141,20 @@ class FSEventsEventPublisher
                   const FSEventsEventContextRef& ec) const override;
 
  private:
+  /**
+   * @brief Create the event contexts for a batch of FSEvents.
+   *
+   * An event is fired once for each action in its flags. Repeated actions
+   * for a path within the batch are merged into the first, and each distinct
+   * path is matched against the indexed subscriptions once.
+   */
+  FSEventsEventContextVector createEventContexts(
+      ConstFSEventStreamRef fsevent_stream,
+      size_t num_events,
+      const char* const event_paths[],
+      const FSEventStreamEventFlags fsevent_flags[],
+      const FSEventStreamEventId fsevent_ids[]) const;
+
   /// Restart the run loop.
   void restart();
 
@@ -155,6 +198,9 @@ class FSEventsEventPublisher
   /// Reference to the run loop for this thread.
   CFRunLoopRef run_loop_{nullptr};
 
+  /// The subscription path index, replaced when configured.
+  std::shared_ptr<const FSEventsPathMatcher> matcher_{nullptr};
+
  private:
   /// For testing only, ask the event stream to publish events immediately.
   bool no_defer_{false};
@@ -174,5 +220,6 @@ class FSEventsEventPublisher
   FRIEND_TEST(FSEventsTests, test_fsevents_fire_event);
   FRIEND_TEST(FSEventsTests, test_fsevents_event_action);
   FRIEND_TEST(FSEventsTests, test_fsevents_embedded_wildcards);
+  FRIEND_TEST(FSEventsTests, test_fsevents_batch_contexts);
 };
 }
@@ -82,6 +82,7 @@ void IOKitEventPublisher::restart() {
 
 void IOKitEventPublisher::newEvent(const io_service_t& device,
                                    IOKitEventContext::Action action) {
+  TablePlugin::hardwareChanged();
   auto ec = createEventContext();
   ec->action = action;
 
@@ -202,6 +203,11 @@ Status IOKitEventPublisher::run() {
     run_loop_ = CFRunLoopGetCurrent();
     // Restart the stream creation.
     restart();
+
+    // Hardware tables may keep their results while devices are monitored.
+    if (!watching_.exchange(true)) {
+      TablePlugin::watchHardware(true);
+    }
   }
 
   // Start the run loop, it may be removed with a tearDown.
@@ -253,6 +259,9 @@ void IOKitEventPublisher::stop() {
 
 void IOKitEventPublisher::tearDown() {
   stop();
+  if (watching_.exchange(false)) {
+    TablePlugin::watchHardware(false);
+  }
 
   // Do not keep a reference to the run loop.
   run_loop_ = nullptr;
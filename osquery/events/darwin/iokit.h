@@ -101,5 +101,8 @@ class IOKitEventPublisher
    * The publisher started boolean is set after a successful restart.
    */
   std::atomic<bool> publisher_started_{false};
+
+  /// Set once the run loop starts, see TablePlugin::watchHardware.
+  std::atomic<bool> watching_{false};
 };
 }
@@ -376,4 +376,50 @@ TEST_F(FSEventsTests, test_fsevents_embedded_wildcards) {
   std::set<std::string> expected = {real_test_dir + "/2/1/"};
   EXPECT_EQ(event_pub_->paths_, expected);
 }
+
+TEST_F(FSEventsTests, test_fsevents_batch_contexts) {
+  auto pub = std::make_shared<FSEventsEventPublisher>();
+  EventFactory::registerEventPublisher(pub);
+
+  auto recursive_sc = std::make_shared<FSEventsSubscriptionContext>();
+  recursive_sc->path = "/tmp/osquery-fsevents/**";
+  auto file_sc = std::make_shared<FSEventsSubscriptionContext>();
+  file_sc->path = "/tmp/osquery-fsevents/a/*.txt";
+  EventFactory::addSubscription("fsevents",
+                                Subscription::create("Sub", recursive_sc));
+  EventFactory::addSubscription("fsevents",
+                                Subscription::create("Sub", file_sc));
+  pub->configure();
+
+  // A repeated path and action is merged, a second action is its own event.
+  const char* paths[] = {
+      "/tmp/osquery-fsevents/a/1.txt",
+      "/tmp/osquery-fsevents/a/1.txt",
+      "/tmp/osquery-fsevents/b",
+      "/tmp/osquery-fsevents/a/1.txt",
+  };
+  const FSEventStreamEventFlags flags[] = {
+      kFSEventStreamEventFlagItemCreated,
+      kFSEventStreamEventFlagItemModified,
+      kFSEventStreamEventFlagItemModified,
+      kFSEventStreamEventFlagItemModified | kFSEventStreamEventFlagItemCreated,
+  };
+  const FSEventStreamEventId ids[] = {1, 2, 3, 4};
+  auto contexts = pub->createEventContexts(nullptr, 4, paths, flags, ids);
+  ASSERT_EQ(contexts.size(), 3U);
+
+  EXPECT_EQ(contexts[0]->action, "CREATED");
+  EXPECT_EQ(contexts[0]->count, 2U);
+  EXPECT_EQ(contexts[0]->transaction_id, 4U);
+  EXPECT_EQ(contexts[1]->action, "UPDATED");
+  EXPECT_EQ(contexts[1]->count, 2U);
+  EXPECT_EQ(contexts[2]->path, "/tmp/osquery-fsevents/b");
+
+  // Matched once per path, the file pattern only matches the first path.
+  EXPECT_TRUE(pub->shouldFire(recursive_sc, contexts[0]));
+  EXPECT_TRUE(pub->shouldFire(file_sc, contexts[0]));
+  EXPECT_TRUE(pub->shouldFire(recursive_sc, contexts[2]));
+  EXPECT_FALSE(pub->shouldFire(file_sc, contexts[2]));
+  EventFactory::deregisterEventPublisher("fsevents");
+}
 }
@@ -8,10 +8,20 @@
  *
  */
 
+#include <algorithm>
 #include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
 #include <exception>
 #include <thread>
 
+#ifdef __linux__
+#include <errno.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+#endif
+
 #include <boost/algorithm/string.hpp>
 #include <boost/algorithm/string/classification.hpp>
 #include <boost/lexical_cast.hpp>
@@ -23,7 +33,11 @@
 #include <osquery/logger.h>
 #include <osquery/system.h>
 
+#include "osquery/core/allocations.h"
 #include "osquery/core/conversions.h"
+#include "osquery/core/tracing.h"
+
+namespace pt = boost::property_tree;
 
 namespace osquery {
 
@@ -51,6 +65,66 @@ FLAG(uint64,
 // overriding in subclasses
 FLAG(uint64, events_max, 1000, "Maximum number of events per type to buffer");
 
+FLAG(bool,
+     events_time_keys,
+     false,
+     "Store each event under a single time-ordered key, without indexes");
+
+FLAG(uint64,
+     events_batch_size,
+     0,
+     "Buffer this many events per subscriber for a batched write, 0 disables");
+
+FLAG(uint64,
+     events_batch_milli,
+     1000,
+     "Maximum milliseconds an event waits in a subscriber's write buffer");
+
+FLAG(uint64,
+     events_hot_size,
+     0,
+     "Keep this many recent events per subscriber in memory for selects");
+
+FLAG(uint64,
+     events_queue_size,
+     0,
+     "Queue up to this many events per subscriber for a dispatch thread");
+
+FLAG(bool,
+     events_queue_block,
+     false,
+     "Block publishers on a full subscriber queue instead of dropping events");
+
+FLAG(uint64,
+     events_maintenance_interval,
+     60,
+     "Seconds between background expirations of time-ordered events");
+
+FLAG(bool,
+     events_reactor,
+     false,
+     "Run descriptor-based publishers from one shared thread (Linux only)");
+
+/// Number of EventIDs reserved with each write of a subscriber's "eid." key.
+const size_t kEventIDLease = 10000;
+
+/// Milliseconds the reactor waits for descriptors before checking for an end.
+const int kEventReactorMLatency = 1000;
+
+/// Width of the zero-padded time and EventID components of time-ordered keys.
+const size_t kEventKeyWidth = 10;
+
+/**
+ * @brief Seconds before a watermark's time that are searched for new events.
+ *
+ * Events are indexed by the time they occurred, which a publisher may report
+ * slightly before the event was added. EventIDs decide what is new.
+ */
+const EventTime kEventWatermarkSlack = 60;
+
+/// The watermark scope active for this thread, see EventWatermarkScope.
+static thread_local EventWatermarkScope* kEventWatermarkScope{nullptr};
+
 const std::vector<size_t> kEventTimeLists = {
     1 * 60 * 60, // 1 hour
     1 * 60, // 1 minute
@@ -66,26 +140,208 @@ static inline EventTime timeFromRecord(const std::string& record) {
   return afinite;
 }
 
+/// Leading byte of binary-encoded event rows, JSON rows begin with '{'.
+const char kEventRowBinary = '\x01';
+
+/// Append an unsigned LEB128 varint.
+static inline void putVarint(std::string& out, size_t value) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<char>(value));
+}
+
+/// Read an unsigned LEB128 varint, advancing the position.
+static inline bool getVarint(const std::string& in, size_t& pos, size_t& value) {
+  value = 0;
+  for (size_t shift = 0; pos < in.size() && shift < 64; shift += 7) {
+    auto byte = static_cast<unsigned char>(in[pos++]);
+    value |= static_cast<size_t>(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/// Zero-pad a number such that keys sort in numeric order.
+static inline std::string padEventKey(const std::string& value) {
+  if (value.size() >= kEventKeyWidth) {
+    return value;
+  }
+  return std::string(kEventKeyWidth - value.size(), '0') + value;
+}
+
+/**
+ * @brief The first key to keep when expiring sorted time-ordered event keys.
+ *
+ * @param prefix The subscriber's time-ordered key prefix.
+ * @param keys The sorted keys with this prefix.
+ * @param expired The number of oldest keys to expire.
+ * @return The exclusive high bound for a range removal.
+ */
+static inline std::string timeKeysBound(const std::string& prefix,
+                                        const std::vector<std::string>& keys,
+                                        size_t expired) {
+  if (expired < keys.size()) {
+    return keys[expired];
+  }
+  // Every key expired, the bound follows all keys with the prefix.
+  auto bound = prefix;
+  bound.back()++;
+  return bound;
+}
+
+/**
+ * @brief Apply 'time' constraints to an inclusive range of event times.
+ *
+ * Expressions may be real values, such as the result of arithmetic on
+ * strftime, and are rounded toward the inside of the range. Expressions that
+ * are not numbers are left for SQLite to filter.
+ *
+ * @return false if the constraints cannot match any event.
+ */
+static bool getTimeRange(const ConstraintList& constraints,
+                         EventTime& start,
+                         EventTime& stop) {
+  double low = start, high = stop;
+  for (const auto& constraint : constraints.getAll()) {
+    char* end = nullptr;
+    double expr = std::strtod(constraint.expr.c_str(), &end);
+    if (constraint.expr.empty() || end == nullptr || *end != 0) {
+      continue;
+    }
+
+    if (constraint.op == EQUALS) {
+      low = std::max(low, std::ceil(expr));
+      high = std::min(high, std::floor(expr));
+    } else if (constraint.op == GREATER_THAN) {
+      low = std::max(low, std::floor(expr) + 1);
+    } else if (constraint.op == GREATER_THAN_OR_EQUALS) {
+      low = std::max(low, std::ceil(expr));
+    } else if (constraint.op == LESS_THAN) {
+      high = std::min(high, std::ceil(expr) - 1);
+    } else if (constraint.op == LESS_THAN_OR_EQUALS) {
+      high = std::min(high, std::floor(expr));
+    }
+  }
+
+  // Events are never stored with a 0-time, and a 0 stop means no limit.
+  if (low > high || high < 1) {
+    return false;
+  }
+  start = static_cast<EventTime>(low);
+  stop = static_cast<EventTime>(high);
+  return true;
+}
+
+/**
+ * @brief Cover an inclusive range of times with decimal key prefixes.
+ *
+ * Time-ordered keys are scanned by prefix, a range such as [1995, 2100] is
+ * covered by the prefixes of 1995-1999, 20xx and 2100.
+ */
+static std::vector<std::string> getTimeKeyPrefixes(EventTime start,
+                                                   EventTime stop) {
+  std::vector<std::string> prefixes;
+  uint64_t low = start, high = stop;
+  if (stop == std::numeric_limits<EventTime>::max()) {
+    // No times follow the end of time, a wider range needs fewer prefixes.
+    high = 9999999999ULL;
+  }
+  while (low <= high) {
+    // Use the shortest prefix starting at low that does not pass high.
+    size_t digits = 0;
+    uint64_t span = 1;
+    while (digits < kEventKeyWidth && low % (span * 10) == 0 &&
+           low + (span * 10) - 1 <= high) {
+      span *= 10;
+      digits++;
+    }
+    prefixes.push_back(padEventKey(std::to_string(low))
+                           .substr(0, kEventKeyWidth - digits));
+    low += span;
+  }
+  return prefixes;
+}
+
+static size_t eventIDFromString(const std::string& eid) {
+  long long value = 0;
+  if (!safeStrtoll(eid, 10, value) || value < 0) {
+    return 0;
+  }
+  return static_cast<size_t>(value);
+}
+
+EventWatermarkScope::EventWatermarkScope(const std::string& query)
+    : query_(query), time_(getUnixTime()), previous_(kEventWatermarkScope) {
+  kEventWatermarkScope = this;
+}
+
+EventWatermarkScope::~EventWatermarkScope() {
+  kEventWatermarkScope = previous_;
+}
+
+EventWatermarkScope* EventWatermarkScope::current() {
+  return kEventWatermarkScope;
+}
+
+EventWatermarkScope::Watermark& EventWatermarkScope::get(
+    const std::string& db_namespace) {
+  auto watermark = watermarks_.find(db_namespace);
+  if (watermark != watermarks_.end()) {
+    return watermark->second;
+  }
+
+  // The stored watermark is 'eid:time', a query without one sees every event.
+  auto& value = watermarks_[db_namespace];
+  std::string content;
+  getDatabaseValue(
+      kEvents, "watermark." + db_namespace + "." + query_, content);
+  auto details = split(content, ":");
+  if (details.size() == 2) {
+    value.eid = eventIDFromString(details[0]);
+    value.time = timeFromRecord(details[1]);
+  }
+  value.delivered = value.eid;
+  return value;
+}
+
+Status EventWatermarkScope::commit() {
+  DatabaseStringValueList batch;
+  for (const auto& watermark : watermarks_) {
+    if (watermark.second.delivered == watermark.second.eid) {
+      // Nothing new was delivered, keep the previous time as well.
+      continue;
+    }
+    batch.emplace_back(
+        "watermark." + watermark.first + "." + query_,
+        std::to_string(watermark.second.delivered) + ":" +
+            std::to_string(time_));
+  }
+  if (batch.empty()) {
+    return Status(0, "OK");
+  }
+  return setDatabaseBatch(kEvents, batch);
+}
+
 QueryData EventSubscriberPlugin::genTable(QueryContext& context) {
   // Stop is an unsigned (-1), our end of time equivalent.
   EventTime start = 0, stop = -1;
+  auto watermarks = EventWatermarkScope::current();
   if (context.constraints["time"].getAll().size() > 0) {
     // Use the 'time' constraint to optimize backing-store lookups.
-    for (const auto& constraint : context.constraints["time"].getAll()) {
-      EventTime expr = timeFromRecord(constraint.expr);
-      if (constraint.op == EQUALS) {
-        stop = start = expr;
-        break;
-      } else if (constraint.op == GREATER_THAN) {
-        start = std::max(start, expr + 1);
-      } else if (constraint.op == GREATER_THAN_OR_EQUALS) {
-        start = std::max(start, expr);
-      } else if (constraint.op == LESS_THAN) {
-        stop = std::min(stop, expr - 1);
-      } else if (constraint.op == LESS_THAN_OR_EQUALS) {
-        stop = std::min(stop, expr);
-      }
+    if (!getTimeRange(context.constraints["time"], start, stop)) {
+      return {};
+    }
+  } else if (watermarks != nullptr) {
+    // A watermarked scheduled query selects only events it was not delivered.
+    auto& watermark = watermarks->get(dbNamespace());
+    if (watermark.time > kEventWatermarkSlack) {
+      start = watermark.time - kEventWatermarkSlack;
     }
+    return getEvents(start, stop, watermark.eid, &watermark.delivered);
   } else if (kToolType == OSQUERY_TOOL_DAEMON && FLAGS_events_optimize) {
     // If the daemon is querying a subscriber without a 'time' constraint and
     // allows optimization, only emit events since the last query.
@@ -101,17 +357,9 @@ QueryData EventSubscriberPlugin::genTable(QueryContext& context) {
   return get(start, stop);
 }
 
-void EventPublisherPlugin::fire(const EventContextRef& ec, EventTime time) {
-  if (isEnding()) {
-    // Cannot emit/fire while ending
-    return;
-  }
-
-  EventContextID ec_id = 0;
-  {
-    WriteLock lock(ec_id_lock_);
-    ec_id = next_ec_id_++;
-  }
+void EventPublisherPlugin::stampEvent(const EventContextRef& ec,
+                                      EventTime time) {
+  EventContextID ec_id = next_ec_id_++;
 
   // Fill in EventContext ID and time if needed.
   if (ec != nullptr) {
@@ -123,13 +371,159 @@ void EventPublisherPlugin::fire(const EventContextRef& ec, EventTime time) {
       ec->time = time;
     }
   }
+}
 
-  for (const auto& subscription : subscriptions_) {
-    auto es = EventFactory::getEventSubscriber(subscription->subscriber_name);
-    if (es != nullptr && es->state() == SUBSCRIBER_RUNNING) {
-      es->event_count_++;
-      fireCallback(subscription, ec);
+void EventPublisherPlugin::dispatchEvent(BaseEventSubscriber* es,
+                                         const SubscriptionRef& subscription,
+                                         const EventContextRef& ec) {
+  if (es != nullptr && es->state() == SUBSCRIBER_RUNNING) {
+    es->event_count_++;
+    if (es->dispatch_queue_ != nullptr) {
+      // The subscriber's callbacks run on its dispatch queue's thread.
+      es->dispatch_queue_->push(this, subscription, ec, es);
+    } else {
+      fireAccounted(es, subscription, ec);
+    }
+  }
+}
+
+/// Find a subscription's subscriber, holding a reference if it was named.
+static BaseEventSubscriber* getSubscriber(const SubscriptionRef& subscription,
+                                          EventSubscriberRef& named) {
+  auto es = subscription->subscriber.get();
+  if (es == nullptr) {
+    // The subscription was added before its subscriber was registered.
+    named = EventFactory::getEventSubscriber(subscription->subscriber_name);
+    es = named.get();
+  }
+  return es;
+}
+
+void EventPublisherPlugin::fire(const EventContextRef& ec, EventTime time) {
+  if (isEnding()) {
+    // Cannot emit/fire while ending
+    return;
+  }
+
+  stampEvent(ec, time);
+
+  // Subscriptions are replaced, never changed, while events fire.
+  auto subscriptions = std::atomic_load(&fire_subscriptions_);
+  for (const auto& subscription : *subscriptions) {
+    EventSubscriberRef named;
+    dispatchEvent(getSubscriber(subscription, named), subscription, ec);
+  }
+}
+
+void EventPublisherPlugin::fireBatch(const std::vector<EventContextRef>& ecs,
+                                     EventTime time) {
+  if (isEnding() || ecs.empty()) {
+    return;
+  }
+
+  if (time == 0) {
+    time = getUnixTime();
+  }
+
+  auto subscriptions = std::atomic_load(&fire_subscriptions_);
+  std::vector<EventSubscriberRef> named(subscriptions->size());
+  std::vector<BaseEventSubscriber*> subscribers;
+  subscribers.reserve(subscriptions->size());
+  for (size_t i = 0; i < subscriptions->size(); ++i) {
+    subscribers.push_back(getSubscriber((*subscriptions)[i], named[i]));
+  }
+
+  for (const auto& ec : ecs) {
+    stampEvent(ec, time);
+    for (size_t i = 0; i < subscriptions->size(); ++i) {
+      dispatchEvent(subscribers[i], (*subscriptions)[i], ec);
+    }
+  }
+}
+
+EventDispatchQueue::EventDispatchQueue(size_t capacity, bool block)
+    : ring_((capacity > 0) ? capacity : 1), block_(block) {
+  thread_ = std::thread(&EventDispatchQueue::run, this);
+}
+
+void EventPublisherPlugin::fireAccounted(EventSubscriberPlugin* subscriber,
+                                         const SubscriptionRef& sub,
+                                         const EventContextRef& ec) const {
+  if (subscriber == nullptr) {
+    fireCallback(sub, ec);
+    return;
+  }
+
+  AllocationScope allocations;
+  fireCallback(sub, ec);
+  subscriber->allocation_count_ += allocations.allocations();
+  subscriber->allocated_bytes_ += allocations.bytes();
+}
+
+bool EventDispatchQueue::push(const EventPublisherPlugin* publisher,
+                              const SubscriptionRef& subscription,
+                              const EventContextRef& ec,
+                              EventSubscriberPlugin* subscriber) {
+  std::unique_lock<Mutex> lock(mutex_);
+  if (block_) {
+    not_full_.wait(lock,
+                   [this]() { return stopping_ || size_ < ring_.size(); });
+  }
+
+  if (stopping_ || size_ == ring_.size()) {
+    drops_++;
+    return false;
+  }
+
+  auto& item = ring_[(head_ + size_) % ring_.size()];
+  item.publisher = publisher;
+  item.subscriber = subscriber;
+  item.subscription = subscription;
+  item.context = ec;
+  size_++;
+  lock.unlock();
+  not_empty_.notify_one();
+  return true;
+}
+
+void EventDispatchQueue::stop() {
+  {
+    WriteLock lock(mutex_);
+    stopping_ = true;
+  }
+  not_empty_.notify_all();
+  not_full_.notify_all();
+
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+size_t EventDispatchQueue::depth() const {
+  WriteLock lock(mutex_);
+  return size_;
+}
+
+void EventDispatchQueue::run() {
+  setThreadClass(THREAD_CLASS_EVENTS);
+  while (true) {
+    QueuedEvent item;
+    {
+      std::unique_lock<Mutex> lock(mutex_);
+      not_empty_.wait(lock, [this]() { return stopping_ || size_ > 0; });
+      if (size_ == 0) {
+        // Stopping and every queued event was dispatched.
+        break;
+      }
+
+      // Move the event out of the ring so the slot holds no references.
+      std::swap(item, ring_[head_]);
+      head_ = (head_ + 1) % ring_.size();
+      size_--;
     }
+    not_full_.notify_one();
+    item.publisher->fireAccounted(
+        item.subscriber, item.subscription, item.context);
   }
 }
 
@@ -245,16 +639,18 @@ void EventSubscriberPlugin::expireRecords(const std::string& list_type,
 
   // If the expirations is not removing all records, rewrite the persisting.
   std::vector<std::string> persisting_records;
+  std::vector<std::string> expired_data;
   // Request all records within this list-size + bin offset.
   auto expired_records = getRecords({list_type + "." + index});
   for (const auto& record : expired_records) {
     if (all || record.second <= expire_time_) {
-      deleteDatabaseValue(kEvents, data_key + "." + record.first);
+      expired_data.push_back(data_key + "." + record.first);
     } else {
       persisting_records.push_back(record.first + ":" +
                                    std::to_string(record.second));
     }
   }
+  deleteDatabaseBatch(kEvents, expired_data);
 
   // Either drop or overwrite the record list.
   if (all) {
@@ -288,38 +684,46 @@ void EventSubscriberPlugin::expireIndexes(
 }
 
 void EventSubscriberPlugin::expireCheck(bool cleanup) {
+  if (FLAGS_events_time_keys) {
+    // Time-ordered keys are expired oldest-first, there are no zombie IDs.
+    expireTimeKeys();
+    return;
+  }
+
   auto data_key = "data." + dbNamespace();
-  auto eid_key = "eid." + dbNamespace();
   // Min key will be the last surviving key.
   size_t min_key = 0;
 
   {
-    std::vector<std::string> keys;
-    scanDatabaseKeys(kEvents, keys, data_key);
-    if (keys.size() <= getEventsMax()) {
+    // Only the EventID of each key is kept while scanning.
+    std::vector<size_t> eids;
+    scanDatabaseKeys(kEvents, data_key + ".", [&eids](const std::string& key) {
+      eids.push_back(
+          std::strtoull(key.c_str() + key.rfind('.') + 1, nullptr, 10));
+      return true;
+    });
+    if (eids.size() <= getEventsMax()) {
       return;
     }
 
     // There is an overflow of events buffered for this subscriber.
     LOG(WARNING) << "Expiring events for subscriber: " << getName()
                  << " limit (" << getEventsMax()
-                 << ") exceeded: " << keys.size();
+                 << ") exceeded: " << eids.size();
     // Inspect the N-FLAGS_events_max -th event's value and expire before the
     // time within the content.
-    std::string last_key;
-    getDatabaseValue(kEvents, eid_key, last_key);
-    // The EID is the next-index.
-    // EID - events_max is the most last-recent event to keep.
-    min_key = boost::lexical_cast<size_t>(last_key) - getEventsMax();
+    // The stored EID is a leased high-water mark, not the last EID, so the
+    // most last-recent event to keep is found from the keys.
+    std::sort(eids.begin(), eids.end());
+    min_key = eids[eids.size() - getEventsMax()];
 
     if (cleanup) {
-      // Scan each of the keys in keys, if their ID portion is < min_key.
-      // Nix them, this requires lots of conversions, use with care.
-      for (const auto& key : keys) {
-        if (std::stoul(key.substr(key.rfind('.') + 1)) < min_key) {
-          deleteDatabaseValue(kEvents, key);
-        }
+      // Nix each of the keys whose ID portion is < min_key.
+      std::vector<std::string> expired_data;
+      for (size_t i = 0; i < eids.size() && eids[i] < min_key; i++) {
+        expired_data.push_back(data_key + "." + std::to_string(eids[i]));
       }
+      deleteDatabaseBatch(kEvents, expired_data);
     }
   }
 
@@ -331,7 +735,7 @@ void EventSubscriberPlugin::expireCheck(bool cleanup) {
 
   // Decode the value into a row structure to extract the time.
   Row r;
-  if (!deserializeRowJSON(content, r) || r.count("time") == 0) {
+  if (!decodeRow(content, r) || r.count("time") == 0) {
     return;
   }
 
@@ -346,6 +750,100 @@ void EventSubscriberPlugin::expireCheck(bool cleanup) {
   getIndexes(expire_time_, 0);
 }
 
+void EventSubscriberPlugin::expireTimeKeys() {
+  auto prefix = "event." + dbNamespace() + ".";
+  std::vector<std::string> keys;
+  scanDatabaseKeys(kEvents, keys, prefix);
+  // Not every backing store scans in key order.
+  std::sort(keys.begin(), keys.end());
+
+  // Count the events at or before the expiration time, these are the oldest.
+  size_t expired = 0;
+  if (expire_events_ && expire_time_ > 0) {
+    while (expired < keys.size() &&
+           timeFromRecord(keys[expired].substr(
+               prefix.size(), kEventKeyWidth)) <= expire_time_) {
+      expired++;
+    }
+  }
+
+  if (keys.size() - expired > getEventsMax()) {
+    // There is an overflow of events buffered for this subscriber.
+    LOG(WARNING) << "Expiring events for subscriber: " << getName()
+                 << " limit (" << getEventsMax()
+                 << ") exceeded: " << keys.size() - expired;
+    expired = keys.size() - getEventsMax();
+  }
+
+  if (expired > 0) {
+    // Keys are time-ordered, the expired events are removed as one range.
+    deleteDatabaseRange(kEvents, prefix, timeKeysBound(prefix, keys, expired));
+  }
+}
+
+QueryData EventSubscriberPlugin::getTimeKeys(EventTime start,
+                                             EventTime stop,
+                                             size_t after,
+                                             size_t* last) {
+  QueryData results;
+
+  // Scan only the keys within the range, using a cover of time prefixes.
+  auto prefix = "event." + dbNamespace() + ".";
+  std::vector<std::string> keys;
+  for (const auto& time_prefix : getTimeKeyPrefixes(start, stop)) {
+    scanDatabaseKeys(kEvents, keys, prefix + time_prefix);
+  }
+  std::sort(keys.begin(), keys.end());
+
+  std::vector<std::string> selected;
+  size_t expired = 0;
+  for (const auto& key : keys) {
+    auto time = timeFromRecord(key.substr(prefix.size(), kEventKeyWidth));
+    if (expire_events_ && expire_time_ > 0 && time <= expire_time_) {
+      // Events are expired as they are found, the oldest keys are first.
+      expired++;
+      continue;
+    }
+
+    if (time < start || (time > stop && stop != 0)) {
+      continue;
+    }
+
+    if (after > 0 || last != nullptr) {
+      // The EventID follows the time component of the key.
+      auto eid =
+          eventIDFromString(key.substr(prefix.size() + kEventKeyWidth + 1));
+      if (eid <= after) {
+        continue;
+      }
+      if (last != nullptr && eid > *last) {
+        *last = eid;
+      }
+    }
+    selected.push_back(key);
+  }
+
+  // Read the selected events together.
+  std::vector<std::string> values;
+  getDatabaseBatch(kEvents, selected, values);
+  for (auto& data_value : values) {
+    Row r;
+    if (data_value.empty()) {
+      continue;
+    }
+    auto status = decodeRow(data_value, r);
+    std::string().swap(data_value);
+    if (status.ok()) {
+      results.push_back(std::move(r));
+    }
+  }
+
+  if (expired > 0) {
+    deleteDatabaseRange(kEvents, prefix, timeKeysBound(prefix, keys, expired));
+  }
+  return results;
+}
+
 std::vector<EventRecord> EventSubscriberPlugin::getRecords(
     const std::set<std::string>& indexes) {
   auto record_key = "records." + dbNamespace();
@@ -438,33 +936,233 @@ size_t EventSubscriberPlugin::getEventsExpiry() { return FLAGS_events_expiry; }
 size_t EventSubscriberPlugin::getEventsMax() { return FLAGS_events_max; }
 
 EventID EventSubscriberPlugin::getEventID() {
-  Status status;
-  // First get an event ID from the meta key.
+  // IDs are allocated from memory within a lease persisted to the database.
+  size_t eid = 0;
+  if (eid_lease_ > 0) {
+    eid = ++last_eid_;
+    if (eid <= eid_lease_) {
+      return std::to_string(eid);
+    }
+  }
+
+  WriteLock lock(event_id_lock_);
   std::string eid_key = "eid." + dbNamespace();
-  std::string last_eid_value;
-  std::string eid_value;
+  if (eid == 0) {
+    if (eid_lease_ == 0) {
+      // Continue after the previous high-water mark, never reusing an ID.
+      std::string last_eid_value;
+      auto status = getDatabaseValue(kEvents, eid_key, last_eid_value);
+      long long last_eid = 0;
+      if (status.ok() && !last_eid_value.empty()) {
+        safeStrtoll(last_eid_value, 10, last_eid);
+      }
+      last_eid_ = static_cast<size_t>(last_eid);
+    }
+    eid = ++last_eid_;
+  }
+
+  if (eid > eid_lease_) {
+    // Persist the end of the next block of IDs before any are used.
+    auto lease = eid + kEventIDLease - 1;
+    auto status = setDatabaseValue(kEvents, eid_key, std::to_string(lease));
+    if (!status.ok()) {
+      return "0";
+    }
+    eid_lease_ = lease;
+  }
+  return std::to_string(eid);
+}
 
+Status EventSubscriberPlugin::bufferEvent(const std::string& key,
+                                          std::string& data) {
+  bool flush = false;
   {
-    WriteLock lock(event_id_lock_);
-    status = getDatabaseValue(kEvents, eid_key, last_eid_value);
-    if (!status.ok() || last_eid_value.empty()) {
-      last_eid_value = "0";
+    WriteLock lock(event_buffer_lock_);
+    auto now = std::chrono::steady_clock::now();
+    if (event_buffer_.empty()) {
+      event_buffer_time_ = now;
     }
+    event_buffer_.push_back(std::make_pair(key, std::move(data)));
+
+    // Flush on the size threshold or once the oldest event is too stale.
+    auto staleness = std::chrono::duration_cast<std::chrono::milliseconds>(
+        now - event_buffer_time_);
+    flush = event_buffer_.size() >= FLAGS_events_batch_size ||
+            static_cast<size_t>(staleness.count()) >= FLAGS_events_batch_milli;
+  }
+  return (flush) ? flushEvents() : Status(0, "OK");
+}
 
-    last_eid_ = boost::lexical_cast<size_t>(last_eid_value) + 1;
-    eid_value = boost::lexical_cast<std::string>(last_eid_);
-    status = setDatabaseValue(kEvents, eid_key, eid_value);
+Status EventSubscriberPlugin::flushEvents() {
+  WriteLock lock(event_buffer_lock_);
+  if (event_buffer_.empty()) {
+    return Status(0, "OK");
   }
 
+  auto status = setDatabaseBatch(kEvents, event_buffer_);
   if (!status.ok()) {
-    return "0";
+    LOG(ERROR) << "Could not write buffered events for " << getName() << ": "
+               << status.getMessage();
+  } else {
+    stored_count_ += event_buffer_.size();
+  }
+  event_buffer_.clear();
+  return status;
+}
+
+void EventSubscriberPlugin::loadColumns() {
+  if (columns_loaded_) {
+    return;
   }
 
-  return eid_value;
+  std::string content;
+  getDatabaseValue(kEvents, "columns." + dbNamespace(), content);
+  if (!content.empty()) {
+    boost::split(columns_, content, boost::is_any_of(","));
+  }
+  for (size_t i = 0; i < columns_.size(); i++) {
+    column_ids_[columns_[i]] = i;
+  }
+  columns_loaded_ = true;
+}
+
+size_t EventSubscriberPlugin::getColumnID(const std::string& name) {
+  auto column = column_ids_.find(name);
+  if (column != column_ids_.end()) {
+    return column->second;
+  }
+
+  // Persist the new name before any row using its ID is stored.
+  columns_.push_back(name);
+  column_ids_[name] = columns_.size() - 1;
+  setDatabaseValue(kEvents,
+                   "columns." + dbNamespace(),
+                   boost::algorithm::join(columns_, ","));
+  return columns_.size() - 1;
+}
+
+Status EventSubscriberPlugin::encodeRow(const Row& r, std::string& data) {
+  data.clear();
+  data.push_back(kEventRowBinary);
+  putVarint(data, r.size());
+
+  WriteLock lock(column_lock_);
+  loadColumns();
+  for (const auto& column : r) {
+    if (column.first.empty() || column.first.find(',') != std::string::npos) {
+      return Status(1, "Invalid event column name: " + column.first);
+    }
+    putVarint(data, getColumnID(column.first));
+    putVarint(data, column.second.size());
+    data.append(column.second);
+  }
+  return Status(0, "OK");
+}
+
+Status EventSubscriberPlugin::decodeRow(const std::string& data, Row& r) {
+  if (data.empty() || data[0] != kEventRowBinary) {
+    // Events stored before the binary encoding.
+    return deserializeRowJSON(data, r);
+  }
+
+  size_t pos = 1;
+  size_t count = 0;
+  if (!getVarint(data, pos, count)) {
+    return Status(1, "Invalid event row");
+  }
+
+  WriteLock lock(column_lock_);
+  loadColumns();
+  for (size_t i = 0; i < count; i++) {
+    size_t id = 0;
+    size_t size = 0;
+    if (!getVarint(data, pos, id) || !getVarint(data, pos, size) ||
+        size > data.size() - pos) {
+      return Status(1, "Invalid event row");
+    }
+    if (id >= columns_.size()) {
+      return Status(1, "Unknown event column ID: " + std::to_string(id));
+    }
+    r[columns_[id]] = data.substr(pos, size);
+    pos += size;
+  }
+  return Status(0, "OK");
 }
 
 QueryData EventSubscriberPlugin::get(EventTime start, EventTime stop) {
+  return getEvents(start, stop, 0, nullptr);
+}
+
+void EventSubscriberPlugin::addHotEvent(size_t eid,
+                                        EventTime time,
+                                        const Row& r) {
+  WriteLock lock(hot_lock_);
+  if (hot_floor_ == std::numeric_limits<EventTime>::max()) {
+    // Events stored before now may only be in the backing store.
+    hot_floor_ = getUnixTime();
+  }
+
+  hot_events_.push_back({eid, time, r});
+  while (hot_events_.size() > FLAGS_events_hot_size) {
+    hot_floor_ = std::max(hot_floor_, hot_events_.front().time);
+    hot_events_.pop_front();
+  }
+}
+
+bool EventSubscriberPlugin::getHotEvents(EventTime start,
+                                         EventTime stop,
+                                         size_t after,
+                                         size_t* last,
+                                         QueryData& results) {
+  WriteLock lock(hot_lock_);
+  if (start <= hot_floor_) {
+    return false;
+  }
+
+  // EventIDs are increasing, skip the events already delivered.
+  auto it = std::upper_bound(
+      hot_events_.begin(),
+      hot_events_.end(),
+      after,
+      [](size_t eid, const HotEvent& event) { return eid < event.eid; });
+  for (; it != hot_events_.end(); ++it) {
+    if (expire_events_ && expire_time_ > 0 && it->time <= expire_time_) {
+      continue;
+    }
+    if (it->time < start || (it->time > stop && stop != 0)) {
+      continue;
+    }
+    if (last != nullptr && it->eid > *last) {
+      *last = it->eid;
+    }
+    results.push_back(it->row);
+  }
+  return true;
+}
+
+QueryData EventSubscriberPlugin::getEvents(EventTime start,
+                                           EventTime stop,
+                                           size_t after,
+                                           size_t* last) {
   QueryData results;
+  if (FLAGS_events_hot_size > 0 &&
+      getHotEvents(start, stop, after, last, results)) {
+    // Recent events are served from memory, buffered writes may wait.
+    if (getEventsExpiry() > 0) {
+      expire_time_ = getUnixTime() - getEventsExpiry();
+    }
+    return results;
+  }
+
+  if (FLAGS_events_time_keys) {
+    // Buffered events are written before selecting, queries see every event.
+    flushEvents();
+    results = getTimeKeys(start, stop, after, last);
+    if (getEventsExpiry() > 0) {
+      expire_time_ = getUnixTime() - getEventsExpiry();
+    }
+    return results;
+  }
 
   // Get the records for this time range.
   auto indexes = getIndexes(start, stop);
@@ -473,22 +1171,32 @@ QueryData EventSubscriberPlugin::get(EventTime start, EventTime stop) {
 
   std::vector<std::string> mapped_records;
   for (const auto& record : records) {
-    if (record.second >= start && (record.second <= stop || stop == 0)) {
-      mapped_records.push_back(events_key + "." + record.first);
+    if (record.second < start || (record.second > stop && stop != 0)) {
+      continue;
     }
+    if (after > 0 || last != nullptr) {
+      auto eid = eventIDFromString(record.first);
+      if (eid <= after) {
+        continue;
+      }
+      if (last != nullptr && eid > *last) {
+        *last = eid;
+      }
+    }
+    mapped_records.push_back(events_key + "." + record.first);
   }
 
   // Select mapped_records using event_ids as keys.
-  std::string data_value;
-  for (const auto& record : mapped_records) {
+  std::vector<std::string> values;
+  getDatabaseBatch(kEvents, mapped_records, values);
+  for (auto& data_value : values) {
     Row r;
-    auto status = getDatabaseValue(kEvents, record, data_value);
     if (data_value.length() == 0) {
       // There is no record here, interesting error case.
       continue;
     }
-    status = deserializeRowJSON(data_value, r);
-    data_value.clear();
+    auto status = decodeRow(data_value, r);
+    std::string().swap(data_value);
     if (status.ok()) {
       results.push_back(std::move(r));
     }
@@ -502,35 +1210,100 @@ QueryData EventSubscriberPlugin::get(EventTime start, EventTime stop) {
   return results;
 }
 
+bool EventSubscriberPlugin::keepEvent(const Row& r) const {
+  auto filters = std::atomic_load(&filters_);
+  if (filters->empty()) {
+    return true;
+  }
+
+  for (const auto& filter : *filters) {
+    bool matched = true;
+    for (const auto& match : filter) {
+      auto column = r.find(match.column);
+      if (column == r.end()) {
+        matched = false;
+      } else if (match.prefix) {
+        matched = (column->second.compare(
+                       0, match.value.size(), match.value) == 0);
+      } else {
+        matched = (column->second == match.value);
+      }
+      if (!matched) {
+        break;
+      }
+    }
+    if (matched) {
+      return true;
+    }
+  }
+  return false;
+}
+
 Status EventSubscriberPlugin::add(Row& r, EventTime event_time) {
+  OSQUERY_TRACE_SPAN("EventSubscriberPlugin::add");
+  // Filtered events do not use an EventID, and are never encoded or stored.
+  if (!keepEvent(r)) {
+    filtered_count_++;
+    return Status(0, "Filtered");
+  }
+
   // Get and increment the EID for this module.
   EventID eid = getEventID();
   // Without encouraging a missing event time, do not support a 0-time.
-  r["time"] = std::to_string((event_time == 0) ? getUnixTime() : event_time);
-  // Serialize and store the row data, for query-time retrieval.
+  EventTime row_time = (event_time == 0) ? getUnixTime() : event_time;
+  auto time = std::to_string(row_time);
+  r["time"] = time;
+  // Encode and store the row data, for query-time retrieval.
   std::string data;
-  auto status = serializeRowJSON(r, data);
+  auto status = encodeRow(r, data);
   if (!status.ok()) {
     return status;
   }
-  // Then remove the newline.
-  if (data.size() > 0 && data.back() == '\n') {
-    data.pop_back();
+
+  if (FLAGS_events_hot_size > 0) {
+    addHotEvent(eventIDFromString(eid), row_time, r);
   }
 
   // Use the last EventID and a checkpoint bucket size to periodically apply
   // buffer eviction. Eviction occurs if the total count exceeds events_max.
-  if (last_eid_ % EVENTS_CHECKPOINT == 0) {
+  // Time-ordered keys are expired by the maintenance thread instead.
+  if (!FLAGS_events_time_keys && last_eid_ % EVENTS_CHECKPOINT == 0) {
     expireCheck();
   }
 
-  // Logger plugins may request events to be forwarded directly.
+  // Logger plugins may request events to be forwarded directly, as JSON.
   // If no active logger is marked 'usesLogEvent' then this is a no-op.
-  EventFactory::forwardEvent(data);
+  if (EventFactory::hasForwarders()) {
+    std::string json;
+    if (serializeRowJSON(r, json).ok()) {
+      // Then remove the newline.
+      if (json.size() > 0 && json.back() == '\n') {
+        json.pop_back();
+      }
+      EventFactory::forwardEvent(json);
+    }
+  }
+
+  if (FLAGS_events_time_keys) {
+    // A single put, the key orders the event by time then EventID.
+    auto event_key = "event." + dbNamespace() + "." + padEventKey(time) + "." +
+                     padEventKey(eid);
+    if (FLAGS_events_batch_size > 0) {
+      return bufferEvent(event_key, data);
+    }
+    status = setDatabaseValue(kEvents, event_key, data);
+    if (status.ok()) {
+      stored_count_++;
+    }
+    return status;
+  }
 
   // Store the event data.
   std::string event_key = "data." + dbNamespace() + "." + eid;
   status = setDatabaseValue(kEvents, event_key, data);
+  if (status.ok()) {
+    stored_count_++;
+  }
   // Record the event in the indexing bins, using the index time.
   recordEvent(eid, event_time);
   return status;
@@ -545,25 +1318,149 @@ void EventSubscriberPlugin::removeSubscriptions() {
   getPublisher()->removeSubscriptions(getName());
 }
 
+/**
+ * @brief Expire subscriber events outside of the add path.
+ *
+ * Time-ordered event keys are expired with range removals from this service,
+ * every events_maintenance_interval seconds.
+ */
+class EventMaintenanceRunner : public InternalRunnable {
+ public:
+  /// A simple wait/interruptible lock.
+  void start() override;
+
+ protected:
+  ThreadClass threadClass() const override { return THREAD_CLASS_BULK; }
+};
+
+void EventMaintenanceRunner::start() {
+  while (!interrupted()) {
+    pauseMilli(FLAGS_events_maintenance_interval * 1000);
+    if (interrupted()) {
+      return;
+    }
+    EventFactory::expire();
+  }
+}
+
+void EventFactory::expire() {
+  auto& ef = EventFactory::getInstance();
+  WriteLock lock(ef.factory_lock_);
+  for (const auto& subscriber : ef.event_subs_) {
+    if (subscriber.second->state() == SUBSCRIBER_RUNNING) {
+      // Selects served from the hot tier do not flush buffered writes.
+      subscriber.second->flushEvents();
+      subscriber.second->expireCheck();
+    }
+  }
+}
+
+/**
+ * @brief Read a subscriber's filters from the "events" configuration.
+ *
+ * The filters are a list of objects, each mapping columns to values:
+ * {"filters": {"process_events": [{"path": "/usr/bin/%", "uid": "0"}]}}.
+ * A value ending with '%' matches columns starting with the rest of the value.
+ */
+static EventFilterList getSubscriberFilters(const pt::ptree& data,
+                                            const std::string& name) {
+  EventFilterList filters;
+  auto subscriber = data.get_child_optional("events.filters." + name);
+  if (!subscriber) {
+    return filters;
+  }
+
+  for (const auto& item : *subscriber) {
+    EventFilter filter;
+    for (const auto& column : item.second) {
+      EventFilterMatch match;
+      match.column = column.first;
+      match.value = column.second.data();
+      if (!match.value.empty() && match.value.back() == '%') {
+        match.value.pop_back();
+        match.prefix = true;
+      }
+      filter.push_back(std::move(match));
+    }
+    if (!filter.empty()) {
+      filters.push_back(std::move(filter));
+    }
+  }
+  return filters;
+}
+
+void EventFactory::configureFilters() {
+  auto plugin = Config::getInstance().getParser("events");
+  if (plugin == nullptr || plugin.get() == nullptr) {
+    return;
+  }
+
+  const auto& data = plugin->getData();
+  auto& ef = EventFactory::getInstance();
+  WriteLock lock(ef.factory_lock_);
+  for (const auto& subscriber : ef.event_subs_) {
+    subscriber.second->setFilters(
+        getSubscriberFilters(data, subscriber.first));
+  }
+}
+
 void EventFactory::delay() {
   // Caller may disable event publisher threads.
   if (FLAGS_disable_events) {
     return;
   }
 
-  // Create a thread for each event publisher.
+  if (FLAGS_events_time_keys && FLAGS_events_maintenance_interval > 0) {
+    Dispatcher::addService(std::make_shared<EventMaintenanceRunner>());
+  }
+
+  int reactor = -1;
+#ifdef __linux__
+  if (FLAGS_events_reactor) {
+    reactor = ::epoll_create1(EPOLL_CLOEXEC);
+  }
+#endif
+
+  // Create a thread for each event publisher, or share the reactor's thread.
   auto& ef = EventFactory::getInstance();
+  std::vector<std::string> reacting;
   for (const auto& publisher : EventFactory::getInstance().event_pubs_) {
     // Publishers that did not set up correctly are put into an ending state.
-    if (!publisher.second->isEnding()) {
-      auto thread_ = std::make_shared<std::thread>(
-          boost::bind(&EventFactory::run, publisher.first));
-      ef.threads_.push_back(thread_);
+    if (publisher.second->isEnding()) {
+      continue;
     }
+
+    if (reactor >= 0 && publisher.second->getDescriptor() >= 0) {
+#ifdef __linux__
+      struct epoll_event event;
+      event.events = EPOLLIN;
+      event.data.u64 = reacting.size();
+      if (::epoll_ctl(reactor,
+                      EPOLL_CTL_ADD,
+                      publisher.second->getDescriptor(),
+                      &event) == 0) {
+        reacting.push_back(publisher.first);
+        continue;
+      }
+#endif
+    }
+
+    auto thread_ = std::make_shared<std::thread>(
+        boost::bind(&EventFactory::run, publisher.first));
+    ef.threads_.push_back(thread_);
+  }
+
+  if (!reacting.empty()) {
+    auto thread_ = std::make_shared<std::thread>(
+        boost::bind(&EventFactory::react, reactor, reacting));
+    ef.threads_.push_back(thread_);
+  } else if (reactor >= 0) {
+    ::close(reactor);
   }
 }
 
 void EventPublisherPlugin::removeSubscriptions(const std::string& subscriber) {
+  WriteLock lock(subscriptions_lock_);
   auto end =
       std::remove_if(subscriptions_.begin(),
                      subscriptions_.end(),
@@ -571,12 +1468,15 @@ void EventPublisherPlugin::removeSubscriptions(const std::string& subscriber) {
                        return (subscription->subscriber_name == subscriber);
                      });
   subscriptions_.erase(end, subscriptions_.end());
+  publishSubscriptions();
 }
 
 void EventFactory::addForwarder(const std::string& logger) {
   getInstance().loggers_.push_back(logger);
 }
 
+bool EventFactory::hasForwarders() { return !getInstance().loggers_.empty(); }
+
 void EventFactory::forwardEvent(const std::string& event) {
   for (const auto& logger : getInstance().loggers_) {
     Registry::call("logger", logger, {{"event", event}});
@@ -607,6 +1507,7 @@ Status EventFactory::run(EventPublisherID& type_id) {
   }
   VLOG(1) << "Starting event publisher run loop: " + type_id;
   publisher->hasStarted(true);
+  setThreadClass(THREAD_CLASS_EVENTS);
 
   auto status = Status(0, "OK");
   while (!publisher->isEnding()) {
@@ -636,6 +1537,81 @@ Status EventFactory::run(EventPublisherID& type_id) {
   return Status(0, "OK");
 }
 
+Status EventFactory::react(int reactor, std::vector<std::string> type_ids) {
+#ifdef __linux__
+  std::vector<EventPublisherRef> publishers;
+  {
+    WriteLock lock(getInstance().factory_lock_);
+    for (const auto& type_id : type_ids) {
+      auto publisher = getInstance().getEventPublisher(type_id);
+      if (publisher != nullptr && !publisher->hasStarted()) {
+        VLOG(1) << "Starting event publisher in the reactor: " + type_id;
+        publisher->hasStarted(true);
+      } else {
+        publisher = nullptr;
+      }
+      publishers.push_back(publisher);
+    }
+  }
+
+  auto stopPublisher = [reactor](EventPublisherRef& publisher) {
+    ::epoll_ctl(reactor, EPOLL_CTL_DEL, publisher->getDescriptor(), nullptr);
+    publisher->tearDown();
+    publisher = nullptr;
+  };
+
+  // Each publisher's run is called only when its descriptor is readable.
+  setThreadClass(THREAD_CLASS_EVENTS);
+  struct epoll_event events[16];
+  auto running = std::count_if(
+      publishers.begin(),
+      publishers.end(),
+      [](const EventPublisherRef& publisher) { return publisher != nullptr; });
+  while (running > 0) {
+    int count = ::epoll_wait(reactor, events, 16, kEventReactorMLatency);
+    if (count < 0 && errno != EINTR) {
+      LOG(WARNING) << "Event reactor wait failed";
+      break;
+    }
+
+    for (int i = 0; i < count; i++) {
+      auto& publisher = publishers[events[i].data.u64];
+      if (publisher == nullptr || publisher->isEnding()) {
+        continue;
+      }
+
+      auto status = publisher->run();
+      if (!status.ok()) {
+        VLOG(1) << "Event publisher " << publisher->type()
+                << " run loop terminated for reason: " << status.getMessage();
+        stopPublisher(publisher);
+        running--;
+        continue;
+      }
+      publisher->restart_count_++;
+    }
+
+    for (auto& publisher : publishers) {
+      if (publisher != nullptr && publisher->isEnding()) {
+        stopPublisher(publisher);
+        running--;
+      }
+    }
+  }
+
+  // Publishers auto tear down when the reactor stops.
+  for (auto& publisher : publishers) {
+    if (publisher != nullptr) {
+      stopPublisher(publisher);
+    }
+  }
+  ::close(reactor);
+  return Status(0, "OK");
+#else
+  return Status(1, "Event reactor is not supported");
+#endif
+}
+
 // There's no reason for the event factory to keep multiple instances.
 EventFactory& EventFactory::getInstance() {
   static EventFactory ef;
@@ -658,13 +1634,17 @@ Status EventFactory::registerEventPublisher(const PluginRef& pub) {
 
   auto& ef = EventFactory::getInstance();
   auto type_id = specialized_pub->type();
-  if (ef.event_pubs_.count(type_id) != 0) {
-    // This is a duplicate event publisher.
-    return Status(1, "Duplicate publisher type");
+  {
+    // Publishers may register concurrently, see attachEvents.
+    WriteLock lock(ef.factory_lock_);
+    if (ef.event_pubs_.count(type_id) != 0) {
+      // This is a duplicate event publisher.
+      return Status(1, "Duplicate publisher type");
+    }
+    ef.event_pubs_[type_id] = specialized_pub;
   }
 
   // Do not set up event publisher if events are disabled.
-  ef.event_pubs_[type_id] = specialized_pub;
   if (!FLAGS_disable_events) {
     auto status = specialized_pub->setUp();
     if (!status.ok()) {
@@ -717,11 +1697,21 @@ Status EventFactory::registerEventSubscriber(const PluginRef& sub) {
         }
       }
     }
+    specialized_sub->setFilters(getSubscriberFilters(data, name));
   }
 
+  // Register before initializing, so subscriptions can resolve the subscriber.
+  auto& ef = EventFactory::getInstance();
+  ef.event_subs_[name] = specialized_sub;
+
   // Let the module initialize any Subscriptions.
   auto status = Status(0, "OK");
   if (!FLAGS_disable_events && !specialized_sub->disabled) {
+    if (FLAGS_events_queue_size > 0 &&
+        specialized_sub->dispatch_queue_ == nullptr) {
+      specialized_sub->dispatch_queue_.reset(new EventDispatchQueue(
+          FLAGS_events_queue_size, FLAGS_events_queue_block));
+    }
     specialized_sub->expireCheck(true);
     status = specialized_sub->init();
     specialized_sub->state(SUBSCRIBER_RUNNING);
@@ -729,9 +1719,6 @@ Status EventFactory::registerEventSubscriber(const PluginRef& sub) {
     specialized_sub->state(SUBSCRIBER_PAUSED);
   }
 
-  auto& ef = EventFactory::getInstance();
-  ef.event_subs_[name] = specialized_sub;
-
   // Restore optimize times for a daemon.
   if (kToolType == OSQUERY_TOOL_DAEMON && FLAGS_events_optimize) {
     auto index_key = "optimize." + specialized_sub->dbNamespace();
@@ -767,6 +1754,13 @@ Status EventFactory::addSubscription(EventPublisherID& type_id,
     return Status(1, "Unknown event publisher");
   }
 
+  // Resolve the subscriber once, rather than for each fired event.
+  if (subscription->subscriber == nullptr &&
+      exists(subscription->subscriber_name)) {
+    subscription->subscriber =
+        getInstance().event_subs_.at(subscription->subscriber_name);
+  }
+
   // The event factory is responsible for configuring the event types.
   return publisher->addSubscription(subscription);
 }
@@ -872,6 +1866,16 @@ void EventFactory::end(bool join) {
       ef.threads_.clear();
     }
 
+    // Dispatch queued events, while their publishers exist, then write any
+    // buffered events before releasing subscribers.
+    for (const auto& subscriber : ef.event_subs_) {
+      if (subscriber.second->dispatch_queue_ != nullptr) {
+        subscriber.second->dispatch_queue_->stop();
+        subscriber.second->dispatch_queue_.reset();
+      }
+      subscriber.second->flushEvents();
+    }
+
     // Threads may still be executing, when they finish, release publishers.
     ef.event_pubs_.clear();
     ef.event_subs_.clear();
@@ -879,9 +1883,21 @@ void EventFactory::end(bool join) {
 }
 
 void attachEvents() {
+  // Each publisher's setUp opens its own event source, and most wait on the
+  // kernel or a service, so the publishers are set up concurrently.
   const auto& publishers = Registry::all("event_publisher");
+  std::vector<std::thread> setups;
   for (const auto& publisher : publishers) {
-    EventFactory::registerEventPublisher(publisher.second);
+    if (FLAGS_disable_events) {
+      EventFactory::registerEventPublisher(publisher.second);
+      continue;
+    }
+    const auto& plugin = publisher.second;
+    setups.emplace_back(
+        [plugin]() { EventFactory::registerEventPublisher(plugin); });
+  }
+  for (auto& setup : setups) {
+    setup.join();
   }
 
   const auto& subscribers = Registry::all("event_subscriber");
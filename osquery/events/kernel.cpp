@@ -8,25 +8,47 @@
  *
  */
 
+#include <algorithm>
+#include <map>
+
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
+#include <osquery/system.h>
 
+#include "osquery/core/conversions.h"
 #include "osquery/events/kernel.h"
 
 namespace osquery {
 
 FLAG(bool, disable_kernel, false, "Disable osquery kernel extension");
 
+FLAG(bool,
+     kernel_queue_resize,
+     false,
+     "Resize the kernel shared buffer by its fill level and drops");
+
 const std::string kKernelDevice = "/dev/osquery";
 
 /// Kernel shared buffer size in bytes.
 static const size_t kKernelQueueSize = (20 * (1 << 20));
 
-/// Handle a maximum of 1000 events before requesting a resync.
-static const int kKernelEventsSyncMax = 1000;
+/// The smallest shared buffer size used when resizing.
+static const size_t kKernelQueueMinSize = (1 << 20);
+
+/// The largest shared buffer size accepted by the kernel.
+static const size_t kKernelQueueMaxSize = (20 * (1 << 20));
+
+/// Grow the shared buffer if a ring is fuller than this percent.
+static const size_t kKernelQueueGrowFill = 75;
+
+/// Shrink the shared buffer if no ring is fuller than this percent.
+static const size_t kKernelQueueShrinkFill = 10;
 
-/// Handle a maximum of 10 events before request another lock.
-static const int kKernelEventsIterate = 10;
+/// Seconds of fill levels considered before shrinking the shared buffer.
+static const size_t kKernelQueueResizeWindow = 60;
+
+/// Handle a maximum of 1000 events, as one batch, before requesting a resync.
+static const size_t kKernelEventsSyncMax = 1000;
 
 REGISTER(KernelEventPublisher, "event_publisher", "kernel");
 
@@ -49,6 +71,9 @@ Status KernelEventPublisher::setUp() {
   try {
     WriteLock lock(mutex_);
     queue_ = new CQueue(kKernelDevice, kKernelQueueSize);
+    stats_.size = queue_->size();
+    stats_.rings = queue_->rings();
+    window_start_ = getUnixTime();
   } catch (const CQueueException &e) {
     queue_ = nullptr;
     return Status(1, e.what());
@@ -61,14 +86,194 @@ Status KernelEventPublisher::setUp() {
   return Status(0, "OK");
 }
 
+osquery_filter_args_t createKernelFilter(osquery_event_t event,
+                                         osquery_filter_action_t action,
+                                         const std::string &path,
+                                         uint64_t uid_low,
+                                         uint64_t uid_high) {
+  osquery_filter_args_t filter;
+  memset(&filter, 0, sizeof(filter));
+  filter.event = event;
+  filter.action = action;
+  filter.uid_low = uid_low;
+  filter.uid_high = uid_high;
+  strncpy(filter.path, path.c_str(), MAXPATHLEN - 1);
+  return filter;
+}
+
+std::vector<osquery_filter_args_t> getKernelFilters(
+    osquery_event_t event, const EventFilterList &filters) {
+  std::vector<osquery_filter_args_t> rules;
+  for (const auto &filter : filters) {
+    auto rule = createKernelFilter(event, OSQUERY_FILTER_INCLUDE, "");
+    bool translated = false;
+    for (const auto &match : filter) {
+      if (match.column == "path" && match.value.size() < MAXPATHLEN) {
+        // An exact path is also a prefix of itself.
+        strncpy(rule.path, match.value.c_str(), MAXPATHLEN - 1);
+        translated = true;
+      } else if (match.column == "uid" && !match.prefix) {
+        long long uid = 0;
+        if (safeStrtoll(match.value, 10, uid).ok() && uid >= 0) {
+          rule.uid_low = rule.uid_high = static_cast<uint64_t>(uid);
+          translated = true;
+        }
+      }
+    }
+
+    if (!translated) {
+      // This filter keeps events the kernel cannot select.
+      return {};
+    }
+    rules.push_back(rule);
+  }
+  return rules;
+}
+
+/// Compare filter rules, ignoring the event type.
+static bool isSameFilter(const osquery_filter_args_t &l,
+                         const osquery_filter_args_t &r) {
+  return l.action == r.action && l.uid_low == r.uid_low &&
+         l.uid_high == r.uid_high && strncmp(l.path, r.path, MAXPATHLEN) == 0;
+}
+
+std::vector<osquery_filter_args_t> KernelEventPublisher::mergeFilters(
+    const std::vector<KernelSubscriptionContextRef> &subscriptions) {
+  std::vector<osquery_filter_args_t> filters;
+  for (const auto &sc : subscriptions) {
+    // A subscription without rules wants every event.
+    if (sc->filters.empty()) {
+      return {};
+    }
+
+    for (const auto &filter : sc->filters) {
+      if (filter.action != OSQUERY_FILTER_INCLUDE) {
+        continue;
+      }
+      auto same = [&filter](const osquery_filter_args_t &f) {
+        return isSameFilter(f, filter);
+      };
+      if (std::none_of(filters.begin(), filters.end(), same)) {
+        filters.push_back(filter);
+      }
+    }
+  }
+
+  if (filters.size() > OSQUERY_MAX_FILTERS) {
+    filters.clear();
+  }
+  return filters;
+}
+
 void KernelEventPublisher::configure() {
   WriteLock lock(mutex_);
+  if (queue_ == nullptr) {
+    return;
+  }
+  configureQueue();
+}
+
+void KernelEventPublisher::configureQueue() {
+  std::map<osquery_event_t, std::vector<KernelSubscriptionContextRef>> types;
   for (const auto &sub : subscriptions_) {
-    if (queue_ != nullptr) {
-      auto sc = getSubscriptionContext(sub->context);
-      queue_->subscribe(sc->event_type);
+    auto sc = getSubscriptionContext(sub->context);
+    queue_->subscribe(sc->event_type);
+    types[sc->event_type].push_back(sc);
+  }
+
+  // Replace the kernel's filter rules for each subscribed event type.
+  for (const auto &type : types) {
+    auto clear = createKernelFilter(type.first, OSQUERY_FILTER_CLEAR, "");
+    try {
+      queue_->filter(clear);
+      for (auto filter : mergeFilters(type.second)) {
+        filter.event = type.first;
+        queue_->filter(filter);
+      }
+    } catch (const CQueueException &e) {
+      LOG(WARNING) << "Cannot filter kernel events: " << e.what();
+      // Partial rules may drop events a subscription wants.
+      try {
+        queue_->filter(clear);
+      } catch (const CQueueException &) {
+      }
+    }
+  }
+}
+
+size_t KernelEventPublisher::adaptQueueSize(size_t size,
+                                            size_t peak_fill,
+                                            size_t drops) {
+  size_t adapted = size;
+  if (drops > 0 || peak_fill > kKernelQueueGrowFill) {
+    adapted = std::min(size * 2, kKernelQueueMaxSize);
+  } else if (peak_fill < kKernelQueueShrinkFill) {
+    adapted = std::max(size / 2, kKernelQueueMinSize);
+  }
+  return adapted;
+}
+
+KernelQueueStats KernelEventPublisher::stats() const {
+  WriteLock lock(mutex_);
+  return stats_;
+}
+
+Status KernelEventPublisher::resizeQueue(size_t size) {
+  auto previous = queue_->size();
+  delete queue_;
+  queue_ = nullptr;
+
+  try {
+    queue_ = new CQueue(kKernelDevice, size);
+  } catch (const CQueueException &e) {
+    LOG(WARNING) << "Cannot resize the kernel queue: " << e.what();
+    try {
+      queue_ = new CQueue(kKernelDevice, previous);
+    } catch (const CQueueException &e) {
+      queue_ = nullptr;
+      return Status(1, e.what());
     }
   }
+
+  // The kernel forgets subscriptions and filters when the device is closed.
+  configureQueue();
+  stats_.size = queue_->size();
+  stats_.rings = queue_->rings();
+  stats_.resizes++;
+  return Status(0, "OK");
+}
+
+void KernelEventPublisher::adaptQueue(int drops, bool drained) {
+  auto now = getUnixTime();
+  auto fill = queue_->fill();
+  stats_.syncs++;
+  stats_.fill = fill;
+  stats_.peak_fill = std::max(stats_.peak_fill, fill);
+  if (drops > 0) {
+    stats_.drops += drops;
+    stats_.last_drop = now;
+    window_drops_ += drops;
+  }
+
+  if (!FLAGS_kernel_queue_resize || !drained) {
+    // The events read by the kernel's last sync must be dequeued first.
+    return;
+  }
+
+  // Drops grow the buffer immediately, shrinking waits for a whole window.
+  bool window = now >= window_start_ + kKernelQueueResizeWindow;
+  if (window_drops_ == 0 && !window) {
+    return;
+  }
+
+  auto size = adaptQueueSize(queue_->size(), stats_.peak_fill, window_drops_);
+  window_drops_ = 0;
+  window_start_ = now;
+  stats_.peak_fill = fill;
+  if (size != queue_->size()) {
+    VLOG(1) << "Resizing the kernel queue to " << size << " bytes";
+    resizeQueue(size);
+  }
 }
 
 void KernelEventPublisher::stop() {
@@ -80,74 +285,63 @@ void KernelEventPublisher::stop() {
 }
 
 Status KernelEventPublisher::run() {
+  // Contexts are created while holding the lock, then fired without it.
+  std::vector<KernelEventContextRef> contexts;
   {
     WriteLock lock(mutex_);
+    // The kernel publisher may have been torn down.
     if (queue_ == nullptr) {
       return Status(1, "No kernel communication");
     }
-  }
 
-  // Perform queue read min/max synchronization.
-  try {
+    // Perform queue read min/max synchronization, releasing the last batch.
     int drops = 0;
-    WriteLock lock(mutex_);
-    if ((drops = queue_->kernelSync(OSQUERY_OPTIONS_NO_BLOCK)) > 0 &&
-        kToolType == OSQUERY_TOOL_DAEMON) {
-      LOG(WARNING) << "Dropping " << drops << " kernel events";
-    }
-  } catch (const CQueueException &e) {
-    LOG(WARNING) << "Queue synchronization error: " << e.what();
-  }
-
-  auto dequeueEvents = [this]() {
-    // Dequeue several events while holding the lock.
-    int max_before_lock = kKernelEventsIterate;
-    while (max_before_lock > 0) {
-      // Request an event from the synchronized, safe, portion of the queue.
-      CQueue::event *event = nullptr;
-      auto event_type = queue_->dequeue(&event);
-      if (event_type == OSQUERY_NULL_EVENT) {
-        return false;
+    try {
+      if ((drops = queue_->kernelSync(OSQUERY_OPTIONS_NO_BLOCK)) > 0 &&
+          kToolType == OSQUERY_TOOL_DAEMON) {
+        LOG(WARNING) << "Dropping " << drops << " kernel events";
       }
+    } catch (const CQueueException &e) {
+      LOG(WARNING) << "Queue synchronization error: " << e.what();
+    }
 
+    // Dequeue a batch from the synchronized, safe, portion of the queue.
+    queue_->dequeue(batch_, kKernelEventsSyncMax);
+    stats_.events += batch_.size();
+    contexts.reserve(batch_.size());
+    for (const auto &event : batch_) {
       // Each event type may use a specific event type structure.
-      KernelEventContextRef ec = nullptr;
-      switch (event_type) {
+      switch (event.first) {
       case OSQUERY_PROCESS_EVENT:
-        ec = createEventContextFrom<osquery_process_event_t>(event_type, event);
-        fire(ec);
+        contexts.push_back(createEventContextFrom<osquery_process_event_t>(
+            event.first, event.second));
         break;
       case OSQUERY_FILE_EVENT:
-        ec = createEventContextFrom<osquery_file_event_t>(event_type, event);
-        fire(ec);
+        contexts.push_back(createEventContextFrom<osquery_file_event_t>(
+            event.first, event.second));
         break;
       default:
-        LOG(WARNING) << "Unknown kernel event received: " << event_type;
+        LOG(WARNING) << "Unknown kernel event received: " << event.first;
         break;
       }
-      max_before_lock--;
     }
-    return true;
-  };
 
-  // Iterate over each event type in the queue and appropriately fire each.
-  int max_before_sync = kKernelEventsSyncMax;
-  while (max_before_sync > 0) {
-    WriteLock lock(mutex_);
-    // The kernel publisher may have been torn down.
+    // The contexts are copies, a drained queue may be replaced.
+    adaptQueue(drops, batch_.size() < kKernelEventsSyncMax);
     if (queue_ == nullptr) {
-      break;
+      return Status(1, "Cannot allocate the kernel queue");
     }
-    // A NULL event occurred, stop dequeuing.
-    if (!dequeueEvents()) {
-      break;
-    }
-    // Append the number of dequeue events to the synchronization counter.
-    max_before_sync -= kKernelEventsIterate;
   }
 
-  // Pause for a cool-off since we implement comms in a no-blocking mode.
-  pauseMilli(1000);
+  for (const auto &ec : contexts) {
+    fire(ec);
+  }
+
+  // Continue reading a full queue, otherwise pause for a cool-off since we
+  // implement comms in a no-blocking mode.
+  if (batch_.size() < kKernelEventsSyncMax) {
+    pauseMilli(1000);
+  }
   return Status(0, "Continue");
 }
 
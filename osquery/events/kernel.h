@@ -10,6 +10,8 @@
 
 #pragma once
 
+#include <limits>
+#include <string>
 #include <vector>
 
 #include <osquery/events.h>
@@ -41,8 +43,47 @@ struct KernelSubscriptionContext : public SubscriptionContext {
 
   /// Optional category passed to the callback.
   std::string category;
+
+  /**
+   * @brief Optional kernel filter rules for the subscription.
+   *
+   * With rules, only events matching one of them are copied from the
+   * kernel, see getKernelFilters. The rules of all subscriptions to an event
+   * type are merged, see KernelEventPublisher::mergeFilters.
+   */
+  std::vector<osquery_filter_args_t> filters;
 };
 
+/**
+ * @brief Create a kernel filter rule.
+ *
+ * @param event The event type the rule applies to.
+ * @param action Include events matching the rule, or clear all rules.
+ * @param path A file or executable path prefix, empty matches any path.
+ * @param uid_low The first real user ID matched.
+ * @param uid_high The last real user ID matched.
+ */
+osquery_filter_args_t createKernelFilter(
+    osquery_event_t event,
+    osquery_filter_action_t action,
+    const std::string &path,
+    uint64_t uid_low = 0,
+    uint64_t uid_high = std::numeric_limits<uint64_t>::max());
+
+/**
+ * @brief Translate a subscriber's configured filters into kernel rules.
+ *
+ * The kernel matches a path prefix and a user ID, see the "filters" key of
+ * the "events" configuration. Other columns are checked after the event is
+ * published, so each rule may match more events than its filter. If a filter
+ * has neither column no rules are returned, the kernel cannot drop events.
+ *
+ * @param event The event type of the rules.
+ * @param filters The subscriber's configured filters.
+ */
+std::vector<osquery_filter_args_t> getKernelFilters(
+    osquery_event_t event, const EventFilterList &filters);
+
 /**
  * @brief Event details for a KernelEventPubliser events.
  */
@@ -62,6 +103,33 @@ struct TypedKernelEventContext : public KernelEventContext {
   std::vector<char> flexible_data;
 };
 
+/**
+ * @brief Statistics of the kernel shared buffer, see the kernel_queue_stats
+ * table.
+ */
+struct KernelQueueStats {
+  /// The size of the shared buffer in bytes, and its number of rings.
+  size_t size{0};
+  size_t rings{0};
+
+  /// The fill percent of the fullest ring at the last sync.
+  size_t fill{0};
+
+  /// The highest fill percent since the last resize window started.
+  size_t peak_fill{0};
+
+  /// Syncs, dequeued events, and events dropped by the kernel.
+  size_t syncs{0};
+  size_t events{0};
+  size_t drops{0};
+
+  /// The UNIX time of the last sync reporting drops.
+  size_t last_drop{0};
+
+  /// The number of times the shared buffer was resized.
+  size_t resizes{0};
+};
+
 using KernelSubscriptionContextRef = std::shared_ptr<KernelSubscriptionContext>;
 using KernelEventContextRef = std::shared_ptr<KernelEventContext>;
 
@@ -114,12 +182,67 @@ class KernelEventPublisher
    */
   Status run() override;
 
+  /**
+   * @brief Merge the filter rules of subscriptions to the same event type.
+   *
+   * Kernel rules apply to every subscription, so the merge may only drop
+   * events that all subscriptions would discard. The include rules of all
+   * subscriptions are kept if every subscription has them. A subscription
+   * without rules, or too many rules, disables filtering.
+   */
+  static std::vector<osquery_filter_args_t> mergeFilters(
+      const std::vector<KernelSubscriptionContextRef> &subscriptions);
+
+  /**
+   * @brief Choose a shared buffer size for the observed fill and drops.
+   *
+   * Drops, or a peak fill above 75 percent, double the size. A peak fill
+   * below 10 percent without drops halves it. The size stays within the
+   * bounds accepted by the kernel.
+   *
+   * @param size The current shared buffer size.
+   * @param peak_fill The highest fill percent observed.
+   * @param drops The events dropped while observing.
+   * @return The new size, or size if the buffer should not be resized.
+   */
+  static size_t adaptQueueSize(size_t size, size_t peak_fill, size_t drops);
+
+  /// A copy of the shared buffer statistics.
+  KernelQueueStats stats() const;
+
+ private:
+  /// Subscribe to and filter the event types of the subscriptions.
+  void configureQueue();
+
+  /**
+   * @brief Replace the shared buffer with one of a new size.
+   *
+   * The kernel only shares a single buffer, the device is closed and opened
+   * again. Events written after the last sync, and while the subscriptions
+   * are replaced, are lost.
+   * If the new size cannot be allocated the previous size is restored.
+   */
+  Status resizeQueue(size_t size);
+
+  /// Update the statistics after a sync, and resize the queue if needed.
+  void adaptQueue(int drops, bool drained);
+
  private:
   /// Queue access mutex.
-  Mutex mutex_;
+  mutable Mutex mutex_;
+
+  /// Shared buffer statistics, protected by the queue mutex.
+  KernelQueueStats stats_;
+
+  /// Drops within the current resize window, and the window's start time.
+  size_t window_drops_{0};
+  size_t window_start_{0};
 
   CQueue *queue_{nullptr};
 
+  /// The most recently dequeued events, reused between runs.
+  std::vector<CQueue::record> batch_;
+
   /// Check whether the subscription matches the event.
   bool shouldFire(const KernelSubscriptionContextRef &sc,
                   const KernelEventContextRef &ec) const override;
@@ -12,6 +12,9 @@
 #include <fcntl.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <vector>
+
 #include <benchmark/benchmark.h>
 
 #include <osquery/dispatcher.h>
@@ -69,6 +72,77 @@ static inline void producerThread(benchmark::State &state) {
   state.SetLabel(label);
 }
 
+static inline void batchProducerThread(benchmark::State &state) {
+  std::unique_ptr<CQueue> queue = nullptr;
+  try {
+    queue = std::unique_ptr<CQueue>(new CQueue(kKernelDevice, 8 * (1 << 20)));
+  } catch (const CQueueException &e) {
+    // The device interface cannot be found or cannot be opened.
+  }
+
+  std::vector<CQueue::record> events;
+  int drops = 0;
+  size_t reads = 0;
+  size_t syncs = 0;
+  while (state.KeepRunning()) {
+    if (queue == nullptr) {
+      continue;
+    }
+    drops += queue->kernelSync(OSQUERY_OPTIONS_NO_BLOCK);
+    syncs++;
+    reads += queue->dequeue(events, state.range_x());
+  }
+
+  state.SetItemsProcessed(reads);
+  auto label = std::string("dropped: ") + std::to_string(drops) + "  syncs: " +
+               std::to_string(syncs);
+  state.SetLabel(label);
+}
+
+static inline void burstProducerThread(benchmark::State &state) {
+  std::unique_ptr<CQueue> queue = nullptr;
+  try {
+    queue = std::unique_ptr<CQueue>(new CQueue(kKernelDevice, state.range_x()));
+  } catch (const CQueueException &e) {
+    // The device interface cannot be found or cannot be opened.
+  }
+
+  // Sync as the publisher does, pausing between syncs that drain the queue.
+  std::vector<CQueue::record> events;
+  int drops = 0;
+  size_t reads = 0;
+  size_t peak_fill = 0;
+  while (state.KeepRunning()) {
+    if (queue == nullptr) {
+      continue;
+    }
+    drops += queue->kernelSync(OSQUERY_OPTIONS_NO_BLOCK);
+    peak_fill = std::max(peak_fill, queue->fill());
+    reads += queue->dequeue(events, 1000);
+    if (events.size() < 1000) {
+      ::usleep(10 * 1000);
+    }
+  }
+
+  state.SetItemsProcessed(reads);
+  auto label = std::string("dropped: ") + std::to_string(drops) +
+               "  peak fill: " + std::to_string(peak_fill);
+  state.SetLabel(label);
+}
+
+static inline void burstConsumerThread(benchmark::State &state) {
+  // Publish bursts of events, as when many processes start at once.
+  int fd = open(kKernelDevice.c_str(), O_RDWR);
+  int type = state.thread_index % 2;
+  while (state.KeepRunning()) {
+    for (int i = 0; i < state.range_y(); i++) {
+      ioctl(fd, OSQUERY_IOCTL_TEST, &type);
+    }
+    ::usleep(50 * 1000);
+  }
+  close(fd);
+}
+
 static inline void consumerThread(benchmark::State &state) {
   int fd = open(kKernelDevice.c_str(), O_RDWR);
   int type = state.thread_index % 2;
@@ -88,5 +162,37 @@ static void CommunicationBenchmark(benchmark::State &state) {
 
 BENCHMARK(CommunicationBenchmark)->UseRealTime()->ThreadRange(2, 32);
 
+static void CommunicationBatchBenchmark(benchmark::State &state) {
+  if (state.thread_index == 0) {
+    batchProducerThread(state);
+  } else {
+    consumerThread(state);
+  }
+}
+
+BENCHMARK(CommunicationBatchBenchmark)
+    ->UseRealTime()
+    ->Arg(100)
+    ->Arg(1000)
+    ->Arg(10000)
+    ->ThreadRange(2, 32);
+
+static void CommunicationBurstBenchmark(benchmark::State &state) {
+  if (state.thread_index == 0) {
+    burstProducerThread(state);
+  } else {
+    burstConsumerThread(state);
+  }
+}
+
+// Shared buffer sizes and events per burst, the label reports the drops.
+BENCHMARK(CommunicationBurstBenchmark)
+    ->UseRealTime()
+    ->ArgPair(1 << 20, 1000)
+    ->ArgPair(1 << 20, 10000)
+    ->ArgPair(4 * (1 << 20), 10000)
+    ->ArgPair(20 * (1 << 20), 10000)
+    ->ThreadRange(2, 16);
+
 #endif // KERNEL_TEST
 }
@@ -12,15 +12,19 @@
 #include <fcntl.h>
 #include <unistd.h>
 
+#include <algorithm>
+
 #include "osquery/events/kernel/circular_queue_user.h"
 
 namespace osquery {
 
-CQueue::CQueue(const std::string &device, size_t size) {
+CQueue::CQueue(const std::string &device, size_t size) : size_(size) {
   osquery_buf_allocate_args_t alloc;
   alloc.size = size;
   alloc.buffer = nullptr;
   alloc.version = OSQUERY_KERNEL_COMM_VERSION;
+  alloc.rings = 0;
+  alloc.ring_size = 0;
 
   fd_ = open(device.c_str(), O_RDWR);
   if (fd_ < 0) {
@@ -31,10 +35,19 @@ CQueue::CQueue(const std::string &device, size_t size) {
     throw CQueueException("Could not allocate shared buffer");
   }
 
-  buffer_ = (uint8_t *)alloc.buffer;
-  size_ = size;
-  read_ = (uint8_t *)alloc.buffer;
-  max_read_ = (uint8_t *)alloc.buffer;
+  if (alloc.rings == 0 || alloc.rings > OSQUERY_MAX_RINGS ||
+      alloc.ring_size == 0 || alloc.rings * alloc.ring_size > size) {
+    throw CQueueException("Shared buffer rings are invalid");
+  }
+
+  rings_.resize(alloc.rings);
+  for (size_t i = 0; i < rings_.size(); i++) {
+    auto &r = rings_[i];
+    r.buffer = (uint8_t *)alloc.buffer + i * alloc.ring_size;
+    r.size = alloc.ring_size;
+    r.read = r.buffer;
+    r.max_read = r.buffer;
+  }
 }
 
 CQueue::~CQueue() {
@@ -54,41 +67,99 @@ void CQueue::subscribe(osquery_event_t event) {
   }
 }
 
+void CQueue::filter(const osquery_filter_args_t &filter) {
+  if (ioctl(fd_, OSQUERY_IOCTL_FILTER, &filter)) {
+    throw CQueueException("Could not add event filter");
+  }
+}
+
+osquery_data_header_t *CQueue::peek(CQueue::ring &r) {
+  if (r.read == r.max_read) {
+    return nullptr;
+  }
+  osquery_data_header_t *header = (osquery_data_header_t *)r.read;
+  if (r.read + sizeof(osquery_data_header_t) > r.buffer + r.size ||
+      header->event == END_OF_BUFFER_EVENT) {
+    r.read = r.buffer;
+    if (r.read == r.max_read) {
+      return nullptr;
+    }
+  }
+  header = (osquery_data_header_t *)r.read;
+  return (header->event == END_OF_BUFFER_EVENT) ? nullptr : header;
+}
+
 osquery_event_t CQueue::dequeue(CQueue::event **event) {
-  if (read_ == max_read_ || event == nullptr) {
+  if (event == nullptr) {
     return (osquery_event_t)0;
   }
-  osquery_data_header_t *header = (osquery_data_header_t *)read_;
-  if (read_ + sizeof(osquery_data_header_t) > buffer_ + size_ ||
-      header->event == END_OF_BUFFER_EVENT) {
-    read_ = buffer_;
-    if (read_ == max_read_) {
-      return (osquery_event_t)0;
+
+  // Select the oldest event at the read head of any ring.
+  ring *next = nullptr;
+  osquery_data_header_t *header = nullptr;
+  for (auto &r : rings_) {
+    auto candidate = peek(r);
+    if (candidate == nullptr) {
+      continue;
+    }
+    if (header == nullptr || candidate->time.time < header->time.time ||
+        (candidate->time.time == header->time.time &&
+         candidate->time.uptime < header->time.uptime)) {
+      next = &r;
+      header = candidate;
     }
   }
-  header = (osquery_data_header_t *)read_;
-  if (header->event != END_OF_BUFFER_EVENT) {
-    size_t size = header->size + sizeof(osquery_data_header_t);
-    read_ = (read_ + size - buffer_) % size_ + buffer_;
+
+  if (header == nullptr) {
+    return (osquery_event_t)0;
   }
 
+  size_t size = header->size + sizeof(osquery_data_header_t);
+  next->read = (next->read + size - next->buffer) % next->size + next->buffer;
+
   *event = (CQueue::event *)&(header->size);
   return header->event;
 }
 
+size_t CQueue::dequeue(std::vector<CQueue::record> &events,
+                       size_t max_events) {
+  events.clear();
+  CQueue::event *event = nullptr;
+  osquery_event_t event_type;
+  while (events.size() < max_events && (event_type = dequeue(&event))) {
+    events.emplace_back(event_type, event);
+  }
+  return events.size();
+}
+
+size_t CQueue::fill() const {
+  size_t fill = 0;
+  for (const auto &r : rings_) {
+    size_t unread = (r.max_read + r.size - r.read) % r.size;
+    fill = std::max(fill, unread * 100 / r.size);
+  }
+  return fill;
+}
+
 int CQueue::kernelSync(int options) {
   // A positive return indicates drops, 0 is all good in the hood.
   // Options are listed in kernel feeds; primarily OSQUERY_OPTIONS_NO_BLOCK.
   osquery_buf_sync_args_t sync;
-  sync.read_offset = read_ - buffer_;
+  for (size_t i = 0; i < rings_.size(); i++) {
+    sync.read_offsets[i] = rings_[i].read - rings_[i].buffer;
+  }
   sync.options = options;
 
   int err = 0;
   err = ioctl(fd_, OSQUERY_IOCTL_BUF_SYNC, &sync);
-  uint8_t *new_max_read = sync.max_read_offset + buffer_;
-  max_read_ = new_max_read;
+  for (size_t i = 0; i < rings_.size(); i++) {
+    auto &r = rings_[i];
+    r.max_read = sync.max_read_offsets[i] + r.buffer;
+    if (err) {
+      r.read = r.max_read;
+    }
+  }
   if (err) {
-    read_ = max_read_;
     throw CQueueException("Could not sync buffer with kernel properly");
   }
 
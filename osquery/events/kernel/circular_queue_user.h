@@ -12,6 +12,8 @@
 
 #include <stdexcept>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include <boost/noncopyable.hpp>
 
@@ -37,6 +39,9 @@ class CQueue : private boost::noncopyable {
     char buf[];
   };
 
+  /// A dequeued event type and its event, within the shared buffer.
+  using record = std::pair<osquery_event_t, event *>;
+
   /**
    * @brief Creates cqueue.
    *
@@ -66,15 +71,40 @@ class CQueue : private boost::noncopyable {
    */
   void subscribe(osquery_event_t event);
 
+  /**
+   * @brief Sends a filter rule to the kernel extension.
+   *
+   * Events dropped by the kernel's filter rules are never copied into the
+   * shared buffer, see OSQUERY_IOCTL_FILTER.
+   *
+   * @param filter The rule to add, or a request to clear an event's rules.
+   */
+  void filter(const osquery_filter_args_t &filter);
+
   /**
    * @brief Dequeue's an event from the shared buffer.
    *
+   * Each CPU writes to its own ring. The rings are merged, the oldest event
+   * of all rings is dequeued first.
+   *
    * @param event (output) A pointer to the event dequeue if any.
    * @return Returns 0 if queue is empty, otherwise the number of the event put
    * into event.
    */
   osquery_event_t dequeue(event **event);
 
+  /**
+   * @brief Dequeue several events from the shared buffer.
+   *
+   * Events are not copied. They are read from the synchronized portion of the
+   * buffer, and remain valid until the next kernelSync.
+   *
+   * @param events (output) Cleared, then filled with the dequeued events.
+   * @param max_events The maximum number of events to dequeue.
+   * @return Returns the number of events dequeued, 0 if the queue is empty.
+   */
+  size_t dequeue(std::vector<record> &events, size_t max_events);
+
   /**
    * @brief Sync the cqueue structure with the cqueue structure in the kernel.
    *
@@ -87,11 +117,43 @@ class CQueue : private boost::noncopyable {
    */
   int kernelSync(int options);
 
+  /// The size of the shared buffer, as requested.
+  size_t size() const { return size_; }
+
+  /// The number of per-CPU rings within the shared buffer.
+  size_t rings() const { return rings_.size(); }
+
+  /**
+   * @brief The percent of the fullest ring not yet dequeued.
+   *
+   * The kernel drops events written to a full ring, a fill level near 100
+   * after a kernelSync means the buffer is too small for the event rate.
+   */
+  size_t fill() const;
+
+ private:
+  /// One per-CPU ring within the shared buffer.
+  struct ring {
+    uint8_t *buffer{nullptr};
+    size_t size{0};
+    uint8_t *max_read{nullptr};
+    uint8_t *read{nullptr};
+  };
+
+  /**
+   * @brief Find the header of the next readable event within a ring.
+   *
+   * This skips the ring's read pointer past the end of the buffer if the
+   * kernel wrapped its writes.
+   *
+   * @return The header, or nullptr if the ring is empty.
+   */
+  osquery_data_header_t *peek(ring &r);
+
  private:
-  uint8_t *buffer_{nullptr};
+  /// The shared buffer is split into per-CPU rings by the kernel.
+  std::vector<ring> rings_;
   size_t size_{0};
-  uint8_t *max_read_{nullptr};
-  uint8_t *read_{nullptr};
   int fd_{-1};
 };
 
@@ -89,5 +89,99 @@ TEST_F(KernelCommunicationTests, test_communication) {
 
   EXPECT_EQ(num_threads * events_per_thread, reads + drops);
 }
+TEST_F(KernelCommunicationTests, test_communication_batch) {
+  unsigned int num_threads = 4;
+  unsigned int events_per_thread = 100000;
+  unsigned int drops = 0;
+  unsigned int reads = 0;
+
+  CQueue queue(kKernelDevice, 8 * (1 << 20));
+
+  auto& dispatcher = Dispatcher::instance();
+
+  for (unsigned int c = 0; c < num_threads; ++c) {
+    dispatcher.addService(
+        std::make_shared<KernelProducerRunnable>(events_per_thread, c % 2));
+  }
+
+  std::vector<CQueue::record> events;
+  unsigned int tasks = 0;
+  do {
+    tasks = dispatcher.serviceCount();
+    drops += queue.kernelSync(OSQUERY_OPTIONS_NO_BLOCK);
+    // Each batch is limited, the remaining events are read after a sync.
+    EXPECT_LE(queue.dequeue(events, 2000), 2000U);
+    for (const auto& event : events) {
+      EXPECT_TRUE(event.first == OSQUERY_TEST_EVENT_0 ||
+                  event.first == OSQUERY_TEST_EVENT_1);
+      EXPECT_NE(event.second, nullptr);
+    }
+    reads += events.size();
+  } while (tasks > 0 || !events.empty());
+
+  EXPECT_EQ(num_threads * events_per_thread, reads + drops);
+}
 #endif // KERNEL_TEST
+
+TEST_F(KernelCommunicationTests, test_kernel_filters) {
+  EventFilterList filters = {
+      {{"path", "/usr/bin/", true}},
+      {{"path", "/bin/ls", false}, {"uid", "501", false}},
+  };
+
+  auto rules = getKernelFilters(OSQUERY_PROCESS_EVENT, filters);
+  ASSERT_EQ(rules.size(), 2U);
+  EXPECT_EQ(rules[0].event, OSQUERY_PROCESS_EVENT);
+  EXPECT_EQ(rules[0].action, OSQUERY_FILTER_INCLUDE);
+  EXPECT_EQ(std::string(rules[0].path), "/usr/bin/");
+  EXPECT_EQ(rules[0].uid_low, 0U);
+  EXPECT_EQ(rules[0].uid_high, std::numeric_limits<uint64_t>::max());
+  EXPECT_EQ(std::string(rules[1].path), "/bin/ls");
+  EXPECT_EQ(rules[1].uid_low, 501U);
+  EXPECT_EQ(rules[1].uid_high, 501U);
+
+  // A filter without a path or uid cannot be applied in the kernel.
+  filters.push_back({{"cmdline", "ls", false}});
+  EXPECT_TRUE(getKernelFilters(OSQUERY_PROCESS_EVENT, filters).empty());
+}
+
+TEST_F(KernelCommunicationTests, test_merge_kernel_filters) {
+  auto first = std::make_shared<KernelSubscriptionContext>();
+  first->filters.push_back(
+      createKernelFilter(OSQUERY_FILE_EVENT, OSQUERY_FILTER_INCLUDE, "/etc/"));
+  auto second = std::make_shared<KernelSubscriptionContext>();
+  second->filters.push_back(
+      createKernelFilter(OSQUERY_FILE_EVENT, OSQUERY_FILTER_INCLUDE, "/tmp/"));
+  second->filters.push_back(
+      createKernelFilter(OSQUERY_FILE_EVENT, OSQUERY_FILTER_INCLUDE, "/etc/"));
+
+  // Rules are merged, duplicates are removed.
+  auto rules = KernelEventPublisher::mergeFilters({first, second});
+  ASSERT_EQ(rules.size(), 2U);
+  EXPECT_EQ(std::string(rules[0].path), "/etc/");
+  EXPECT_EQ(std::string(rules[1].path), "/tmp/");
+
+  // A subscription without rules receives every event.
+  auto third = std::make_shared<KernelSubscriptionContext>();
+  EXPECT_TRUE(KernelEventPublisher::mergeFilters({first, third}).empty());
+}
+
+TEST_F(KernelCommunicationTests, test_adapt_queue_size) {
+  size_t size = 4 * (1 << 20);
+  // A moderately full buffer keeps its size.
+  EXPECT_EQ(KernelEventPublisher::adaptQueueSize(size, 50, 0), size);
+
+  // Drops or a nearly full ring double the size.
+  EXPECT_EQ(KernelEventPublisher::adaptQueueSize(size, 10, 1), size * 2);
+  EXPECT_EQ(KernelEventPublisher::adaptQueueSize(size, 90, 0), size * 2);
+
+  // A mostly empty buffer is halved.
+  EXPECT_EQ(KernelEventPublisher::adaptQueueSize(size, 5, 0), size / 2);
+
+  // The size stays within the kernel's bounds.
+  size_t max = 20 * (1 << 20);
+  EXPECT_EQ(KernelEventPublisher::adaptQueueSize(max, 100, 10), max);
+  EXPECT_EQ(KernelEventPublisher::adaptQueueSize(1 << 20, 0, 0),
+            (size_t)(1 << 20));
+}
 }
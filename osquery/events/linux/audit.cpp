@@ -8,6 +8,13 @@
  *
  */
 
+#include <cstring>
+#include <stdexcept>
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
 #include <boost/algorithm/string/classification.hpp>
 #include <boost/algorithm/string/split.hpp>
 #include <boost/filesystem.hpp>
@@ -36,6 +43,18 @@ FLAG(bool,
      false,
      "Allow the audit publisher to change auditing configuration");
 
+/// Read many netlink messages per system call, waiting with epoll.
+FLAG(bool,
+     audit_batch_reads,
+     false,
+     "Read batches of audit netlink messages with recvmmsg");
+
+/// Allow more messages to wait in the kernel while events are handled.
+FLAG(uint64,
+     audit_socket_buffer,
+     0,
+     "Audit netlink socket receive buffer in bytes, 0 keeps the default");
+
 REGISTER(AuditEventPublisher, "event_publisher", "audit");
 
 enum AuditStatus {
@@ -46,6 +65,26 @@ enum AuditStatus {
 
 static const int kAuditMLatency = 1000;
 
+/// The number of netlink messages read with each batched read.
+static const size_t kAuditBatchSize = 64;
+
+/// Parse the serial from a record preamble: audit(1440542781.644:403030).
+static inline uint64_t getAuditSerial(const std::string& preamble) {
+  uint64_t serial = 0;
+  auto separator = preamble.rfind(':');
+  if (separator == std::string::npos) {
+    return 0;
+  }
+
+  for (size_t i = separator + 1; i < preamble.size(); i++) {
+    if (preamble[i] < '0' || preamble[i] > '9') {
+      break;
+    }
+    serial = serial * 10 + (preamble[i] - '0');
+  }
+  return serial;
+}
+
 Status AuditEventPublisher::setUp() {
   handle_ = audit_open();
   if (handle_ <= 0) {
@@ -53,6 +92,33 @@ Status AuditEventPublisher::setUp() {
     return Status(1, "Could not open audit subsystem");
   }
 
+  if (FLAGS_audit_socket_buffer > 0) {
+    // The forced size requires privileges and ignores the system maximum.
+    int size = static_cast<int>(FLAGS_audit_socket_buffer);
+    if (setsockopt(handle_, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) <
+            0 &&
+        setsockopt(handle_, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) < 0) {
+      VLOG(1) << "Cannot set the audit socket receive buffer size";
+    }
+  }
+
+  if (FLAGS_audit_batch_reads) {
+    epoll_ = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = handle_;
+    if (epoll_ < 0 || epoll_ctl(epoll_, EPOLL_CTL_ADD, handle_, &event) < 0) {
+      VLOG(1) << "Cannot wait for audit replies, using unbatched reads";
+      if (epoll_ >= 0) {
+        close(epoll_);
+      }
+      epoll_ = -1;
+    } else {
+      batch_buffer_.resize(kAuditBatchSize * MAX_AUDIT_MESSAGE_LENGTH);
+    }
+  }
+
   // The setup can try to enable auditing.
   if (!FLAGS_disable_audit && FLAGS_audit_allow_config) {
     audit_set_enabled(handle_, AUDIT_ENABLED);
@@ -92,6 +158,12 @@ void AuditEventPublisher::configure() {
   // Able to issue libaudit API calls.
   struct AuditRuleInternal rule;
 
+  // Records are only correlated if a subscription will receive them.
+  correlate_ = false;
+  for (auto& sub : subscriptions_) {
+    correlate_ |= getSubscriptionContext(sub->context)->records;
+  }
+
   // Before reply data is ever filled in, assure an empty message.
   memset(&reply_, 0, sizeof(struct audit_reply));
 
@@ -157,6 +229,10 @@ void AuditEventPublisher::tearDown() {
     }
   }
 
+  if (epoll_ >= 0) {
+    close(epoll_);
+    epoll_ = -1;
+  }
   audit_close(handle_);
 }
 
@@ -164,69 +240,118 @@ inline void handleAuditConfigChange(const struct audit_reply& reply) {
   // Another daemon may have taken control.
 }
 
+void AuditFields::parse(const char* data, size_t size) {
+  message_.assign(data, size);
+  fields_.clear();
+
+  // Find each token's delimiters with memchr rather than per character:
+  // key=value, key="value with spaces", or a key alone, separated by spaces.
+  const char* begin = message_.data();
+  const char* end = begin + message_.size();
+  const char* p = begin;
+  while (p < end) {
+    if (*p == ' ') {
+      p++;
+      continue;
+    }
+
+    const char* token_end =
+        static_cast<const char*>(memchr(p, ' ', end - p));
+    if (token_end == nullptr) {
+      token_end = end;
+    }
+
+    Field field;
+    field.key = static_cast<uint32_t>(p - begin);
+    const char* assignment =
+        static_cast<const char*>(memchr(p, '=', token_end - p));
+    if (assignment == nullptr) {
+      field.key_size = static_cast<uint32_t>(token_end - p);
+      field.value = static_cast<uint32_t>(token_end - begin);
+      p = token_end;
+    } else {
+      field.key_size = static_cast<uint32_t>(assignment - p);
+      const char* value = assignment + 1;
+      const char* value_end = token_end;
+      if (value < end && *value == '"') {
+        // An enclosed value includes its quotes and may contain spaces.
+        auto close = static_cast<const char*>(
+            memchr(value + 1, '"', end - value - 1));
+        value_end = (close == nullptr) ? end : close + 1;
+      }
+      field.value = static_cast<uint32_t>(value - begin);
+      field.value_size = static_cast<uint32_t>(value_end - value);
+      p = value_end;
+    }
+
+    if (field.key_size > 0) {
+      fields_.push_back(field);
+    }
+  }
+}
+
+size_t AuditFields::find(const std::string& key) const {
+  // Later fields replace earlier fields with the same key.
+  for (size_t i = fields_.size(); i > 0; i--) {
+    if (this->key(i - 1) == key) {
+      return i - 1;
+    }
+  }
+  return fields_.size();
+}
+
+size_t AuditFields::count(const std::string& key) const {
+  return (find(key) < fields_.size()) ? 1 : 0;
+}
+
+std::string AuditFields::at(const std::string& key) const {
+  auto i = find(key);
+  if (i == fields_.size()) {
+    throw std::out_of_range("No audit field: " + key);
+  }
+  return value(i).to_string();
+}
+
+std::string AuditFields::get(const std::string& key) const {
+  return getRef(key).to_string();
+}
+
+boost::string_ref AuditFields::getRef(const std::string& key) const {
+  auto i = find(key);
+  return (i < fields_.size()) ? value(i) : boost::string_ref();
+}
+
 inline bool handleAuditReply(const struct audit_reply& reply,
                              AuditEventContextRef& ec) {
   // Build an event context around this reply.
   ec->type = reply.type;
 
   // Tokenize the message.
-  auto message = std::string(reply.message, reply.len);
+  if (reply.message == nullptr || reply.len <= 0) {
+    return false;
+  }
+  boost::string_ref message(reply.message, reply.len);
   auto preamble_end = message.find("): ");
-  if (preamble_end == std::string::npos) {
+  if (preamble_end == boost::string_ref::npos) {
     return false;
-  } else {
-    ec->preamble = message.substr(0, preamble_end + 1);
-    message = message.substr(preamble_end + 3);
-  }
-
-  // The linear search will construct series of key value pairs.
-  std::string key, value;
-  // There are several ways of representing value data (enclosed strings, etc).
-  bool found_assignment{false}, found_enclose{false};
-  for (const auto& c : message) {
-    // Iterate over each character in the audit message.
-    if ((found_enclose && c == '"') || (!found_enclose && c == ' ')) {
-      if (c == '"') {
-        value += c;
-      }
-      // This is a terminating sequence, the end of an enclosure or space tok.
-      if (!key.empty()) {
-        // Multiple space tokens are supported.
-        ec->fields[key] = value;
-      }
-      found_enclose = false;
-      found_assignment = false;
-      key.clear();
-      value.clear();
-    } else if (!found_assignment && c == ' ') {
-      // A field tokenizer.
-    } else if (found_assignment) {
-      // Enclosure sequences appear immediately following assignment.
-      if (c == '"') {
-        found_enclose = true;
-      }
-      value += c;
-    } else if (c == '=') {
-      found_assignment = true;
-    } else {
-      key += c;
-    }
   }
+  ec->preamble = message.substr(0, preamble_end + 1).to_string();
 
-  // Last step, if there was no trailing tokenizer.
-  if (!key.empty()) {
-    ec->fields[key] = value;
-  }
+  // The reply buffer is reused, the fields keep their own copy.
+  ec->fields.parse(message.data() + preamble_end + 3,
+                   message.size() - preamble_end - 3);
 
   // There is a special field for syscalls.
-  if (ec->fields.count("syscall") == 1) {
-    const auto& syscall_string = ec->fields.at("syscall").c_str();
-    long long syscall{0};
-    if (!safeStrtoll(syscall_string, 10, syscall)) {
+  auto syscall_string = ec->fields.getRef("syscall");
+  long long syscall{0};
+  for (const auto& c : syscall_string) {
+    if (c < '0' || c > '9') {
       syscall = 0;
+      break;
     }
-    ec->syscall = syscall;
+    syscall = syscall * 10 + (c - '0');
   }
+  ec->syscall = syscall;
 
   return true;
 }
@@ -243,73 +368,10 @@ Status AuditEventPublisher::run() {
     audit_request_status(handle_);
   }
 
-  // Reset the reply data.
-  int result = 0;
-  bool handle_reply = false;
-  while (true) {
-    handle_reply = false;
-
-    // Request a reply in a non-blocking mode.
-    // This allows the publisher's run loop to periodically request an audit
-    // status update. These updates can check for other processes attempting to
-    // gain control over the audit sink.
-    // This non-blocking also allows faster receipt of multi-message events.
-    result = audit_get_reply(handle_, &reply_, GET_REPLY_NONBLOCKING, 0);
-    if (result > 0) {
-      switch (reply_.type) {
-      case NLMSG_NOOP:
-      case NLMSG_DONE:
-      case NLMSG_ERROR:
-        // Not handled, request another reply.
-        break;
-      case AUDIT_LIST_RULES:
-        // Build rules cache.
-        handleListRules();
-        break;
-      case AUDIT_GET:
-        // Make a copy of the status reply and store as the most-recent.
-        if (reply_.status != nullptr) {
-          memcpy(&status_, reply_.status, sizeof(struct audit_status));
-        }
-        break;
-      case AUDIT_FIRST_USER_MSG... AUDIT_LAST_USER_MSG:
-        handle_reply = true;
-        break;
-      case (AUDIT_GET + 1)...(AUDIT_LIST_RULES - 1):
-      case (AUDIT_LIST_RULES + 1)...(AUDIT_FIRST_USER_MSG - 1):
-        // Not interested in handling meta-commands and actions.
-        break;
-      case AUDIT_DAEMON_START... AUDIT_DAEMON_CONFIG: // 1200 - 1203
-      case AUDIT_CONFIG_CHANGE:
-        handleAuditConfigChange(reply_);
-        break;
-      case AUDIT_SYSCALL: // 1300
-        // A monitored syscall was issued, most likely part of a multi-record.
-        handle_reply = true;
-        break;
-      case AUDIT_CWD: // 1307
-      case AUDIT_PATH: // 1302
-      case AUDIT_EXECVE: // // 1309 (execve arguments).
-        handle_reply = true;
-      case AUDIT_EOE: // 1320 (multi-record event).
-        break;
-      default:
-        // All other cases, pass to reply.
-        handle_reply = true;
-      }
-    } else {
-      // Fall through to the run loop cool down.
-      break;
-    }
-
-    // Replies are 'handled' as potential events for several audit types.
-    if (handle_reply) {
-      auto ec = createEventContext();
-      // Build the event context from the reply type and parse the message.
-      if (handleAuditReply(reply_, ec)) {
-        fire(ec);
-      }
-    }
+  if (epoll_ >= 0) {
+    readBatches();
+  } else {
+    readReplies();
   }
 
   if (static_cast<pid_t>(status_.pid) != getpid()) {
@@ -328,12 +390,216 @@ Status AuditEventPublisher::run() {
   }
 
   // Only apply a cool down if the reply request failed.
-  pauseMilli(kAuditMLatency);
+  if (epoll_ < 0) {
+    pauseMilli(kAuditMLatency);
+  }
   return Status(0, "OK");
 }
 
+void AuditEventPublisher::pause() {
+  if (epoll_ < 0) {
+    EventPublisher::pause();
+  }
+}
+
+void AuditEventPublisher::readReplies() {
+  while (true) {
+    // Request a reply in a non-blocking mode.
+    // This allows the publisher's run loop to periodically request an audit
+    // status update. These updates can check for other processes attempting to
+    // gain control over the audit sink.
+    // This non-blocking also allows faster receipt of multi-message events.
+    if (audit_get_reply(handle_, &reply_, GET_REPLY_NONBLOCKING, 0) <= 0) {
+      // Fall through to the run loop cool down.
+      break;
+    }
+    handleReply(reply_);
+  }
+
+  // An event missing its end record is fired after a second empty read.
+  if (!records_.empty() && records_idle_++ > 0) {
+    auto ec = endRecords();
+    fire(ec);
+  }
+}
+
+void AuditEventPublisher::readBatches() {
+  struct epoll_event event;
+  int ready = epoll_wait(epoll_, &event, 1, kAuditMLatency);
+  if (ready <= 0) {
+    // An event missing its end record is fired after a wait without replies.
+    if (!records_.empty()) {
+      auto ec = endRecords();
+      fire(ec);
+    }
+    return;
+  }
+
+  struct mmsghdr messages[kAuditBatchSize];
+  struct iovec vectors[kAuditBatchSize];
+  struct sockaddr_nl addresses[kAuditBatchSize];
+  // The reply's large message buffer is not used, only its union pointer.
+  struct audit_reply reply;
+
+  while (!isEnding()) {
+    memset(messages, 0, sizeof(messages));
+    for (size_t i = 0; i < kAuditBatchSize; i++) {
+      vectors[i].iov_base = &batch_buffer_[i * MAX_AUDIT_MESSAGE_LENGTH];
+      vectors[i].iov_len = MAX_AUDIT_MESSAGE_LENGTH;
+      messages[i].msg_hdr.msg_iov = &vectors[i];
+      messages[i].msg_hdr.msg_iovlen = 1;
+      messages[i].msg_hdr.msg_name = &addresses[i];
+      messages[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_nl);
+    }
+
+    int count =
+        recvmmsg(handle_, messages, kAuditBatchSize, MSG_DONTWAIT, nullptr);
+    if (count <= 0) {
+      // The socket was drained.
+      break;
+    }
+
+    for (int i = 0; i < count; i++) {
+      // Only accept messages from the kernel.
+      if (addresses[i].nl_pid != 0) {
+        continue;
+      }
+
+      auto nlh = reinterpret_cast<struct nlmsghdr*>(
+          &batch_buffer_[i * MAX_AUDIT_MESSAGE_LENGTH]);
+      auto size = static_cast<int>(messages[i].msg_len);
+      for (; NLMSG_OK(nlh, size); nlh = NLMSG_NEXT(nlh, size)) {
+        reply.type = nlh->nlmsg_type;
+        reply.len = static_cast<int>(nlh->nlmsg_len - NLMSG_HDRLEN);
+        reply.nlh = nlh;
+        // The message shares a union with the status and rule pointers.
+        reply.message = static_cast<char*>(NLMSG_DATA(nlh));
+        handleReply(reply);
+      }
+    }
+
+    if (static_cast<size_t>(count) < kAuditBatchSize) {
+      break;
+    }
+  }
+}
+
+void AuditEventPublisher::handleReply(const struct audit_reply& reply) {
+  bool handle_reply = false;
+  switch (reply.type) {
+  case NLMSG_NOOP:
+  case NLMSG_DONE:
+  case NLMSG_ERROR:
+    // Not handled, request another reply.
+    break;
+  case AUDIT_LIST_RULES:
+    // Build rules cache.
+    handleListRules();
+    break;
+  case AUDIT_GET:
+    // Make a copy of the status reply and store as the most-recent.
+    if (reply.status != nullptr) {
+      memcpy(&status_, reply.status, sizeof(struct audit_status));
+    }
+    break;
+  case AUDIT_FIRST_USER_MSG... AUDIT_LAST_USER_MSG:
+    handle_reply = true;
+    break;
+  case (AUDIT_GET + 1)...(AUDIT_LIST_RULES - 1):
+  case (AUDIT_LIST_RULES + 1)...(AUDIT_FIRST_USER_MSG - 1):
+    // Not interested in handling meta-commands and actions.
+    break;
+  case AUDIT_DAEMON_START... AUDIT_DAEMON_CONFIG: // 1200 - 1203
+  case AUDIT_CONFIG_CHANGE:
+    handleAuditConfigChange(reply);
+    break;
+  case AUDIT_SYSCALL: // 1300
+    // A monitored syscall was issued, most likely part of a multi-record.
+    handle_reply = true;
+    break;
+  case AUDIT_CWD: // 1307
+  case AUDIT_PATH: // 1302
+  case AUDIT_EXECVE: // // 1309 (execve arguments).
+    handle_reply = true;
+    break;
+  case AUDIT_EOE: // 1320 (multi-record event).
+    // The end of a multi-record event is only used to correlate.
+    handle_reply = correlate_;
+    break;
+  default:
+    // All other cases, pass to reply.
+    handle_reply = true;
+  }
+
+  // Replies are 'handled' as potential events for several audit types.
+  if (!handle_reply) {
+    return;
+  }
+
+  auto ec = createEventContext();
+  // Build the event context from the reply type and parse the message.
+  if (!handleAuditReply(reply, ec)) {
+    return;
+  }
+
+  AuditEventContextRef correlated;
+  if (correlate_) {
+    correlated = correlateRecord(ec);
+  }
+
+  if (ec->type != AUDIT_EOE) {
+    fire(ec);
+  }
+  if (correlated != nullptr) {
+    fire(correlated);
+  }
+}
+
+AuditEventContextRef AuditEventPublisher::correlateRecord(
+    const AuditEventContextRef& ec) {
+  records_idle_ = 0;
+  auto serial = getAuditSerial(ec->preamble);
+  if (ec->type == AUDIT_SYSCALL) {
+    // A syscall starts a new event, ending any event missing its end record.
+    auto ended = endRecords();
+    records_serial_ = serial;
+    records_.push_back(ec);
+    return ended;
+  }
+
+  if (records_.empty() || serial != records_serial_) {
+    // This record is not part of a syscall event.
+    return nullptr;
+  }
+
+  if (ec->type == AUDIT_EOE) {
+    return endRecords();
+  }
+  records_.push_back(ec);
+  return nullptr;
+}
+
+AuditEventContextRef AuditEventPublisher::endRecords() {
+  if (records_.empty()) {
+    return nullptr;
+  }
+
+  // The event is matched to subscriptions as its SYSCALL record.
+  auto ec = createEventContext();
+  ec->type = records_.front()->type;
+  ec->syscall = records_.front()->syscall;
+  ec->preamble = records_.front()->preamble;
+  ec->records.swap(records_);
+  return ec;
+}
+
 bool AuditEventPublisher::shouldFire(const AuditSubscriptionContextRef& sc,
                                      const AuditEventContextRef& ec) const {
+  // Correlated events are only fired to subscriptions requesting records.
+  if (sc->records != !ec->records.empty()) {
+    return false;
+  }
+
   // User messages allow a catch all configuration.
   if (sc->user_types &&
       (ec->type >= AUDIT_FIRST_USER_MSG && ec->type <= AUDIT_LAST_USER_MSG)) {
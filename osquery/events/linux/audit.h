@@ -14,6 +14,9 @@
 #include <set>
 #include <vector>
 
+#include <boost/container/small_vector.hpp>
+#include <boost/utility/string_ref.hpp>
+
 #include <libaudit.h>
 
 #include <osquery/events.h>
@@ -67,11 +70,63 @@ struct AuditRuleInternal {
  * and a null-delimited set of path messages follow and complete the set of
  * information.
  */
-enum AuditProcessEventState {
-  STATE_SYSCALL = AUDIT_SYSCALL,
-  STATE_EXECVE = AUDIT_EXECVE,
-  STATE_CWD = AUDIT_CWD,
-  STATE_PATH = AUDIT_PATH,
+/**
+ * @brief The key=value fields of an audit message.
+ *
+ * The message is copied once and each field is kept as offsets into the copy,
+ * in message order. Strings are only created for the fields a subscriber
+ * reads, lookups are linear since messages have few fields.
+ */
+class AuditFields {
+ public:
+  /// A field's key and value, as offsets into the message copy.
+  struct Field {
+    uint32_t key{0};
+    uint32_t key_size{0};
+    uint32_t value{0};
+    uint32_t value_size{0};
+  };
+
+  /// Replace the fields with those tokenized from a message body.
+  void parse(const char* data, size_t size);
+
+  /// The number of fields.
+  size_t size() const { return fields_.size(); }
+
+  /// The number of fields named key, 0 or 1.
+  size_t count(const std::string& key) const;
+
+  /// The value of a field, which must exist.
+  std::string at(const std::string& key) const;
+
+  /// The value of a field, or an empty string.
+  std::string get(const std::string& key) const;
+
+  /// A view of the value of a field, empty if it does not exist.
+  boost::string_ref getRef(const std::string& key) const;
+
+  /// A view of the key at a field index.
+  boost::string_ref key(size_t i) const {
+    return boost::string_ref(message_.data() + fields_[i].key,
+                             fields_[i].key_size);
+  }
+
+  /// A view of the value at a field index.
+  boost::string_ref value(size_t i) const {
+    return boost::string_ref(message_.data() + fields_[i].value,
+                             fields_[i].value_size);
+  }
+
+ private:
+  /// The index of the last field named key, or size() if there is none.
+  size_t find(const std::string& key) const;
+
+ private:
+  /// The copied message body.
+  std::string message_;
+
+  /// Field offsets, most messages fit in the inline capacity.
+  boost::container::small_vector<Field, 16> fields_;
 };
 
 struct AuditSubscriptionContext : public SubscriptionContext {
@@ -97,6 +152,16 @@ struct AuditSubscriptionContext : public SubscriptionContext {
   /// Macro for all types related to user messages.
   bool user_types{false};
 
+  /**
+   * @brief Receive each syscall's records as a single event.
+   *
+   * The publisher correlates the records sharing a SYSCALL record's serial,
+   * such as EXECVE, CWD, and PATH, until the end-of-event record. These
+   * subscriptions receive one event, with the records in order, instead of
+   * each record.
+   */
+  bool records{false};
+
  private:
   friend class AuditEventPublisher;
 };
@@ -115,10 +180,13 @@ struct AuditEventContext : public EventContext {
    * If the field contained a space in the value the data will be hex encoded.
    * It is the responsibility of the subscription callback/handler to parse.
    */
-  std::map<std::string, std::string> fields;
+  AuditFields fields;
 
   /// Each message will contain the audit time.
   std::string preamble;
+
+  /// For correlated events, each record starting with the SYSCALL record.
+  std::vector<std::shared_ptr<AuditEventContext>> records;
 };
 
 using AuditEventContextRef = std::shared_ptr<AuditEventContext>;
@@ -158,6 +226,9 @@ class AuditEventPublisher
   /// Poll for replies to the netlink handle in a non-blocking mode.
   Status run() override;
 
+  /// Batched reads wait for replies in run, without a run loop cool-off.
+  void pause() override;
+
  public:
   AuditEventPublisher() : EventPublisher(){};
 
@@ -165,6 +236,25 @@ class AuditEventPublisher
   /// Maintain a list of audit rule data for displaying or deleting.
   void handleListRules();
 
+  /// Read replies one at a time using the audit library.
+  void readReplies();
+
+  /// Wait for and read batches of netlink messages from the audit handle.
+  void readBatches();
+
+  /// Handle a single reply, firing events for the audit record types.
+  void handleReply(const struct audit_reply& reply);
+
+  /**
+   * @brief Add a record to the syscall event being correlated.
+   *
+   * @return A complete event when this record ended one, or nullptr.
+   */
+  AuditEventContextRef correlateRecord(const AuditEventContextRef& ec);
+
+  /// End the event being correlated, nullptr if there are no records.
+  AuditEventContextRef endRecords();
+
   /// Apply normal subscription to event matching logic.
   bool shouldFire(const AuditSubscriptionContextRef& mc,
                   const AuditEventContextRef& ec) const override;
@@ -201,5 +291,27 @@ class AuditEventPublisher
 
   /// Track all rule data added by the publisher.
   std::vector<struct AuditRuleInternal> transient_rules_;
+
+  /// Set if a subscription requested correlated records.
+  bool correlate_{false};
+
+  /// The records of the syscall event being correlated.
+  std::vector<AuditEventContextRef> records_;
+
+  /// The serial shared by the correlated records.
+  uint64_t records_serial_{0};
+
+  /// Number of empty reads while records were waiting for their end.
+  size_t records_idle_{0};
+
+  /// An epoll descriptor for the audit handle, when using batched reads.
+  int epoll_{-1};
+
+  /// Space for a batch of netlink messages.
+  std::vector<char> batch_buffer_;
+
+ private:
+  FRIEND_TEST(AuditTests, test_correlate_records);
+  friend class AuditReplayPublisher;
 };
 }
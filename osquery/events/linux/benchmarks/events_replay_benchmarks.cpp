@@ -0,0 +1,534 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/noncopyable.hpp>
+
+#include <benchmark/benchmark.h>
+
+#include <osquery/config.h>
+#include <osquery/events.h>
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
+#include <osquery/registry.h>
+
+#include "osquery/core/conversions.h"
+#include "osquery/events/linux/audit.h"
+#include "osquery/events/linux/inotify.h"
+#include "osquery/events/linux/syslog.h"
+#include "osquery/tests/test_util.h"
+
+namespace fs = boost::filesystem;
+
+namespace osquery {
+
+DECLARE_string(database_path);
+DECLARE_string(syslog_pipe_path);
+DECLARE_bool(disable_fanotify);
+
+/// Stop waiting for a replay's events once none were stored for this long.
+const size_t kReplayIdleMilli = 500;
+
+using ReplayClock = std::chrono::steady_clock;
+
+/**
+ * @brief Store events in RocksDB, as the daemon does.
+ *
+ * The benchmarks otherwise use the ephemeral database plugin. A new RocksDB
+ * database is opened in the testing directory until this is destroyed.
+ */
+class ReplayDatabase : private boost::noncopyable {
+ public:
+  ReplayDatabase() {
+    existing_ = Registry::getActive("database");
+    Registry::get("database", existing_)->tearDown();
+
+    path_ = FLAGS_database_path;
+    FLAGS_database_path = kTestWorkingDirectory + "events-replay.db";
+    fs::remove_all(FLAGS_database_path);
+    status_ = Registry::setActive("database", "rocksdb");
+  }
+
+  ~ReplayDatabase() {
+    if (status_.ok()) {
+      Registry::get("database", "rocksdb")->tearDown();
+    }
+    fs::remove_all(FLAGS_database_path);
+    FLAGS_database_path = path_;
+    Registry::setActive("database", existing_);
+  }
+
+  /// The RocksDB database status, it is not available in every build.
+  const Status& status() const { return status_; }
+
+ private:
+  std::string existing_;
+  std::string path_;
+  Status status_;
+};
+
+/**
+ * @brief Time replayed events until a subscriber has stored them.
+ *
+ * A sampler thread records each change of the subscriber's stored count. The
+ * n-th of N replayed events is matched with the stored count reaching n * S / N
+ * of the S stored events, so the latencies assume events are stored in replay
+ * order, and are accurate to the sampling period. A replayed operation, such as
+ * a file write, may store several events.
+ */
+class ReplayMeter : private boost::noncopyable {
+ public:
+  /**
+   * @brief Start sampling a subscriber's stored events.
+   *
+   * @param subscriber the subscriber storing the replayed events.
+   * @param each_stored set if each replayed event should store one event,
+   * replayed events that were not stored are then counted as drops.
+   */
+  ReplayMeter(const EventSubscriberPlugin& subscriber, bool each_stored)
+      : subscriber_(subscriber),
+        each_stored_(each_stored),
+        start_(subscriber.numStored()) {
+    sampler_ = std::thread([this]() { sample(); });
+  }
+
+  ~ReplayMeter() {
+    done_ = true;
+    sampler_.join();
+  }
+
+  /// Record that an event was replayed.
+  void replayed() {
+    auto now = ReplayClock::now();
+    if (replayed_.size() == settled_) {
+      replay_start_ = now;
+    }
+    replayed_.push_back(now);
+  }
+
+  /// Wait for the events replayed since the last settle to be stored.
+  void settle();
+
+  /// Report the items processed and a label with the latency and drops.
+  void report(benchmark::State& state, size_t drops);
+
+ private:
+  /// The sampler thread's loop.
+  void sample();
+
+  /// The events stored since the meter started.
+  size_t stored() const { return subscriber_.numStored() - start_; }
+
+ private:
+  const EventSubscriberPlugin& subscriber_;
+
+  /// Set if each replayed event should store one event.
+  bool each_stored_{false};
+
+  /// The subscriber's stored count when the meter started.
+  size_t start_{0};
+
+  /// The time each event was replayed.
+  std::vector<ReplayClock::time_point> replayed_;
+
+  /// The number of replayed events at the last settle.
+  size_t settled_{0};
+
+  /// The time of the first event replayed since the last settle.
+  ReplayClock::time_point replay_start_;
+
+  /// The time from replaying to storing the last event, over all settles.
+  ReplayClock::duration busy_{0};
+
+  /// Each change of the stored count, as the time and the new count.
+  std::vector<std::pair<ReplayClock::time_point, size_t>> samples_;
+
+  /// Protects the samples from the sampler thread.
+  Mutex samples_lock_;
+
+  std::atomic<bool> done_{false};
+  std::thread sampler_;
+};
+
+void ReplayMeter::sample() {
+  size_t last = 0;
+  while (!done_) {
+    auto count = stored();
+    if (count != last) {
+      WriteLock lock(samples_lock_);
+      samples_.push_back(std::make_pair(ReplayClock::now(), count));
+      last = count;
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(10));
+  }
+}
+
+void ReplayMeter::settle() {
+  auto last = stored();
+  auto changed = ReplayClock::now();
+  while (!each_stored_ || last < replayed_.size()) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    auto now = ReplayClock::now();
+    auto count = stored();
+    if (count != last) {
+      last = count;
+      changed = now;
+    } else if (now - changed >= std::chrono::milliseconds(kReplayIdleMilli)) {
+      // The remaining events were dropped, or are not stored.
+      break;
+    }
+  }
+
+  if (replayed_.size() > settled_) {
+    WriteLock lock(samples_lock_);
+    if (!samples_.empty() && samples_.back().first > replay_start_) {
+      busy_ += samples_.back().first - replay_start_;
+    }
+  }
+  settled_ = replayed_.size();
+}
+
+void ReplayMeter::report(benchmark::State& state, size_t drops) {
+  WriteLock lock(samples_lock_);
+  size_t stored = (samples_.empty()) ? 0 : samples_.back().second;
+  if (each_stored_ && replayed_.size() > stored) {
+    drops += replayed_.size() - stored;
+  }
+
+  std::vector<long long> latencies;
+  for (size_t i = 0; stored > 0 && i < replayed_.size(); i++) {
+    // The stored count matching this replayed event.
+    size_t target = std::max<size_t>(1, (i + 1) * stored / replayed_.size());
+    auto sample =
+        std::lower_bound(samples_.begin(),
+                         samples_.end(),
+                         target,
+                         [](const std::pair<ReplayClock::time_point, size_t>& s,
+                            size_t count) { return s.second < count; });
+    if (sample == samples_.end()) {
+      break;
+    }
+    auto latency = std::chrono::duration_cast<std::chrono::microseconds>(
+        sample->first - replayed_[i]);
+    latencies.push_back(std::max<long long>(0, latency.count()));
+  }
+
+  long long p99 = 0;
+  if (!latencies.empty()) {
+    std::sort(latencies.begin(), latencies.end());
+    p99 = latencies[(latencies.size() - 1) * 99 / 100];
+  }
+
+  auto busy = std::chrono::duration<double>(busy_).count();
+  state.SetItemsProcessed(stored);
+  std::stringstream label;
+  label << "events_per_sec="
+        << static_cast<size_t>((busy > 0) ? stored / busy : 0)
+        << " p99_latency_us=" << p99 << " drops=" << drops
+        << " drop_rate=" << std::fixed << std::setprecision(4)
+        << ((stored + drops > 0)
+                ? static_cast<double>(drops) / (stored + drops)
+                : 0.0);
+  state.SetLabel(label.str());
+}
+
+/// Read the non-empty lines of a recorded event stream.
+static std::vector<std::string> getReplayLines(const std::string& name) {
+  std::string content;
+  readFile(kTestDataPath + name, content);
+  return split(content, "\n");
+}
+
+/// Report a benchmark that could not replay.
+static void skipReplay(benchmark::State& state, const Status& status) {
+  state.SetLabel("error=\"" + status.getMessage() + "\"");
+  while (state.KeepRunning()) {
+  }
+}
+
+/// Register a table's event subscriber, such as process_events.
+static std::shared_ptr<EventSubscriberPlugin> registerReplaySubscriber(
+    const std::string& name) {
+  // Subscribers check the events configuration when registering.
+  Config::getInstance().getParser("events")->setUp();
+  if (!Registry::exists("event_subscriber", name)) {
+    return nullptr;
+  }
+
+  auto plugin = Registry::get("event_subscriber", name);
+  if (!EventFactory::registerEventSubscriber(plugin).ok()) {
+    return nullptr;
+  }
+  return std::dynamic_pointer_cast<EventSubscriberPlugin>(plugin);
+}
+
+/// An audit publisher handling recorded records instead of netlink replies.
+class AuditReplayPublisher : public AuditEventPublisher {
+ public:
+  /// Do not open the audit netlink socket.
+  Status setUp() override { return Status(0, "OK"); }
+
+  /// Handle a record as though the kernel had replied with it.
+  void replay(int type, const std::string& message) {
+    struct audit_reply reply;
+    memset(&reply, 0, sizeof(struct audit_reply));
+    reply.type = type;
+    reply.len = static_cast<int>(message.size());
+    reply.message = const_cast<char*>(message.c_str());
+    handleReply(reply);
+  }
+};
+
+/// An audit record, as logged by auditd.
+struct AuditReplayRecord {
+  int type;
+  std::string message;
+};
+
+/// Parse auditd log lines, a type= field then the netlink message.
+static std::vector<AuditReplayRecord> getAuditReplayRecords() {
+  std::vector<AuditReplayRecord> records;
+  for (const auto& line : getReplayLines("test_replay_audit.log")) {
+    auto type_end = line.find(' ');
+    auto message_start = line.find("msg=");
+    if (line.compare(0, 5, "type=") != 0 ||
+        message_start == std::string::npos) {
+      continue;
+    }
+
+    AuditReplayRecord record;
+    record.type = audit_name_to_msg_type(line.substr(5, type_end - 5).c_str());
+    record.message = line.substr(message_start + 4);
+    // Records without fields, such as EOE, are logged without a trailing
+    // space.
+    if (!record.message.empty() && record.message.back() == ':') {
+      record.message += ' ';
+    }
+    if (record.type > 0) {
+      records.push_back(std::move(record));
+    }
+  }
+  return records;
+}
+
+/**
+ * @brief Replay audit records through a publisher and process_events.
+ *
+ * The records are handled by audit publisher's reply handler, which correlates
+ * each execve's records, without the netlink socket and its kernel backlog.
+ * Each recorded syscall is an execve stored by process_events.
+ */
+static void EVENTS_replay_audit(benchmark::State& state) {
+  ReplayDatabase database;
+  if (!database.status().ok()) {
+    skipReplay(state, database.status());
+    return;
+  }
+
+  auto pub = std::make_shared<AuditReplayPublisher>();
+  EventFactory::registerEventPublisher(pub);
+  auto sub = registerReplaySubscriber("process_events");
+  if (sub == nullptr) {
+    skipReplay(state, Status(1, "Cannot register process_events"));
+    EventFactory::end(true);
+    return;
+  }
+  pub->configure();
+
+  auto records = getAuditReplayRecords();
+  {
+    ReplayMeter meter(*sub, true);
+    while (state.KeepRunning()) {
+      for (int i = 0; i < state.range_x(); i++) {
+        for (const auto& record : records) {
+          if (record.type == AUDIT_EOE) {
+            // An execve is fired once its records end.
+            meter.replayed();
+          }
+          pub->replay(record.type, record.message);
+        }
+      }
+      meter.settle();
+    }
+    meter.report(state, sub->queueDrops());
+  }
+  EventFactory::end(true);
+}
+
+BENCHMARK(EVENTS_replay_audit)->Arg(1)->Arg(100);
+
+/**
+ * @brief Replay rsyslog lines through the syslog pipe and subscriber.
+ *
+ * Each line is written to the publisher's named pipe, as rsyslog forwards
+ * messages, and read by the publisher's run loop.
+ */
+static void EVENTS_replay_syslog(benchmark::State& state) {
+  ReplayDatabase database;
+  if (!database.status().ok()) {
+    skipReplay(state, database.status());
+    return;
+  }
+
+  // The publisher does not create the pipe, which requires a syslog group.
+  auto pipe_path = FLAGS_syslog_pipe_path;
+  FLAGS_syslog_pipe_path = kTestWorkingDirectory + "events-replay.pipe";
+  fs::remove(FLAGS_syslog_pipe_path);
+  mkfifo(FLAGS_syslog_pipe_path.c_str(), 0600);
+
+  auto pub = std::make_shared<SyslogEventPublisher>();
+  auto status = EventFactory::registerEventPublisher(pub);
+  auto pipe = ::open(FLAGS_syslog_pipe_path.c_str(), O_WRONLY | O_CLOEXEC);
+  auto sub = registerReplaySubscriber("syslog");
+  if (!status.ok() || pipe < 0) {
+    skipReplay(state, Status(1, "Cannot open pipe: " + status.getMessage()));
+    EventFactory::end(true);
+  } else if (sub == nullptr) {
+    skipReplay(state, Status(1, "Cannot register syslog"));
+    EventFactory::end(true);
+  } else {
+    std::thread runner([]() {
+      EventPublisherID type = "syslog";
+      EventFactory::run(type);
+    });
+
+    auto lines = getReplayLines("test_replay_syslog.txt");
+    {
+      ReplayMeter meter(*sub, true);
+      while (state.KeepRunning()) {
+        for (int i = 0; i < state.range_x(); i++) {
+          for (const auto& line : lines) {
+            auto message = line + '\n';
+            meter.replayed();
+            if (::write(pipe, message.c_str(), message.size()) < 0) {
+              break;
+            }
+          }
+        }
+        meter.settle();
+      }
+      meter.report(state, pub->dropped() + sub->queueDrops());
+    }
+    EventFactory::end(true);
+    runner.join();
+  }
+
+  if (pipe >= 0) {
+    ::close(pipe);
+  }
+  fs::remove(FLAGS_syslog_pipe_path);
+  FLAGS_syslog_pipe_path = pipe_path;
+}
+
+BENCHMARK(EVENTS_replay_syslog)->Arg(1)->Arg(100);
+
+/// Apply a recorded file operation within a directory.
+static void replayFileOperation(const std::string& root,
+                                const std::vector<std::string>& operation) {
+  if (operation.size() < 2) {
+    return;
+  }
+
+  auto path = root + operation[1];
+  if (operation[0] == "create") {
+    std::ofstream file(path);
+  } else if (operation[0] == "modify") {
+    std::ofstream file(path, std::ios::app);
+    file << "osquery\n";
+  } else if (operation[0] == "move" && operation.size() > 2) {
+    boost::system::error_code ec;
+    fs::rename(path, root + operation[2], ec);
+  } else if (operation[0] == "delete") {
+    boost::system::error_code ec;
+    fs::remove(path, ec);
+  }
+}
+
+/**
+ * @brief Replay file operations through inotify and file_events.
+ *
+ * The operations are applied to a monitored directory, so the kernel publishes
+ * the inotify events. An operation may publish several events, which may be
+ * coalesced by the publisher, so drops only include the subscriber's queues.
+ */
+static void EVENTS_replay_inotify(benchmark::State& state) {
+  ReplayDatabase database;
+  if (!database.status().ok()) {
+    skipReplay(state, database.status());
+    return;
+  }
+
+  auto disable_fanotify = FLAGS_disable_fanotify;
+  FLAGS_disable_fanotify = true;
+  auto root = kTestWorkingDirectory + "events-replay/";
+  fs::remove_all(root);
+  fs::create_directories(root);
+  Config::getInstance().update(
+      {{"data", "{\"file_paths\": {\"replay\": [\"" + root + "\"]}}"}});
+
+  auto pub = std::make_shared<INotifyEventPublisher>();
+  auto status = EventFactory::registerEventPublisher(pub);
+  auto sub = registerReplaySubscriber("file_events");
+  if (!status.ok()) {
+    skipReplay(state, status);
+    EventFactory::end(true);
+  } else if (sub == nullptr) {
+    skipReplay(state, Status(1, "Cannot register file_events"));
+    EventFactory::end(true);
+  } else {
+    pub->configure();
+    std::thread runner([]() {
+      EventPublisherID type = "inotify";
+      EventFactory::run(type);
+    });
+
+    std::vector<std::vector<std::string>> operations;
+    for (const auto& line : getReplayLines("test_replay_inotify.txt")) {
+      operations.push_back(split(line, " "));
+    }
+
+    {
+      ReplayMeter meter(*sub, false);
+      while (state.KeepRunning()) {
+        for (int i = 0; i < state.range_x(); i++) {
+          for (const auto& operation : operations) {
+            meter.replayed();
+            replayFileOperation(root, operation);
+          }
+        }
+        meter.settle();
+      }
+      meter.report(state, sub->queueDrops());
+    }
+    EventFactory::end(true);
+    runner.join();
+  }
+
+  Config::getInstance().update({{"data", "{}"}});
+  fs::remove_all(root);
+  FLAGS_disable_fanotify = disable_fanotify;
+}
+
+BENCHMARK(EVENTS_replay_inotify)->Arg(1)->Arg(100);
+}
@@ -0,0 +1,691 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <string.h>
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <boost/algorithm/string/trim.hpp>
+
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+
+#include "osquery/core/conversions.h"
+#include "osquery/events/linux/bpf.h"
+
+namespace osquery {
+
+/// Loading BPF programs requires root and traces every process.
+FLAG(bool,
+     disable_bpf,
+     true,
+     "Disable receiving process and socket events from eBPF programs");
+
+REGISTER(BPFEventPublisher, "event_publisher", "bpf");
+
+/// Milliseconds to wait for the perf buffers before reading them anyway.
+static const int kBPFMLatency = 200;
+
+/// Data pages mapped for each CPU's perf buffer, a power of 2.
+static const size_t kBPFPerfPages = 64;
+
+/// Bytes written to a perf buffer before the run loop is woken.
+static const uint32_t kBPFWakeupBytes = 16 * 1024;
+
+/// Threads that may be within an accept at once.
+static const uint32_t kBPFAcceptEntries = 10240;
+
+/// Entry records kept while waiting for exits, threads may die mid-syscall.
+static const size_t kBPFMaxPending = 4096;
+
+/// Sizes of the records written by the programs.
+static const int kBPFHeaderSize = 32;
+static const int kBPFFilenameSize = 256;
+static const int kBPFAddressSize = 32;
+static const int kBPFExecSize = kBPFHeaderSize + kBPFFilenameSize;
+static const int kBPFExitSize = kBPFHeaderSize + 8;
+static const int kBPFSocketSize = kBPFHeaderSize + 8 + kBPFAddressSize;
+
+/// The largest socket address read, a sockaddr_in6.
+static const int kBPFSockaddrSize = 28;
+
+/// Offsets of the syscall arguments and result within tracepoint contexts.
+static const int16_t kBPFArg0 = 16;
+static const int16_t kBPFArg1 = 24;
+static const int16_t kBPFResult = 16;
+
+/// Locations of the syscall tracepoints.
+static const std::vector<std::string> kBPFTracepointPaths = {
+    "/sys/kernel/debug/tracing/events/syscalls/",
+    "/sys/kernel/tracing/events/syscalls/",
+};
+
+static inline uint64_t ptrToU64(const void* ptr) {
+  return static_cast<uint64_t>(reinterpret_cast<uintptr_t>(ptr));
+}
+
+static inline int bpf(int cmd, union bpf_attr* attr) {
+  return static_cast<int>(::syscall(__NR_bpf, cmd, attr, sizeof(*attr)));
+}
+
+static inline int perfEventOpen(struct perf_event_attr* attr, int cpu) {
+  return static_cast<int>(::syscall(
+      __NR_perf_event_open, attr, -1, cpu, -1, PERF_FLAG_FD_CLOEXEC));
+}
+
+static int createMap(bpf_map_type type,
+                     uint32_t key_size,
+                     uint32_t value_size,
+                     uint32_t entries) {
+  union bpf_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.map_type = type;
+  attr.key_size = key_size;
+  attr.value_size = value_size;
+  attr.max_entries = entries;
+  return bpf(BPF_MAP_CREATE, &attr);
+}
+
+static int updateMap(int map, const void* key, const void* value) {
+  union bpf_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.map_fd = map;
+  attr.key = ptrToU64(key);
+  attr.value = ptrToU64(value);
+  attr.flags = BPF_ANY;
+  return bpf(BPF_MAP_UPDATE_ELEM, &attr);
+}
+
+void BPFProgram::emit(
+    uint8_t code, int dst, int src, int16_t off, int32_t imm) {
+  struct bpf_insn insn;
+  memset(&insn, 0, sizeof(insn));
+  insn.code = code;
+  insn.dst_reg = dst;
+  insn.src_reg = src;
+  insn.off = off;
+  insn.imm = imm;
+  insns_.push_back(insn);
+}
+
+void BPFProgram::mov(int dst, int src) {
+  emit(BPF_ALU64 | BPF_MOV | BPF_X, dst, src, 0, 0);
+}
+
+void BPFProgram::movImm(int dst, int32_t imm) {
+  emit(BPF_ALU64 | BPF_MOV | BPF_K, dst, 0, 0, imm);
+}
+
+void BPFProgram::movImm32(int dst, int32_t imm) {
+  emit(BPF_ALU | BPF_MOV | BPF_K, dst, 0, 0, imm);
+}
+
+void BPFProgram::addImm(int dst, int32_t imm) {
+  emit(BPF_ALU64 | BPF_ADD | BPF_K, dst, 0, 0, imm);
+}
+
+void BPFProgram::load(int dst, int src, int16_t off) {
+  emit(BPF_LDX | BPF_MEM | BPF_DW, dst, src, off, 0);
+}
+
+void BPFProgram::store(int dst, int16_t off, int src) {
+  emit(BPF_STX | BPF_MEM | BPF_DW, dst, src, off, 0);
+}
+
+void BPFProgram::storeImm(int dst, int16_t off, int32_t imm) {
+  emit(BPF_ST | BPF_MEM | BPF_DW, dst, 0, off, imm);
+}
+
+void BPFProgram::loadMap(int dst, int fd) {
+  emit(BPF_LD | BPF_DW | BPF_IMM, dst, BPF_PSEUDO_MAP_FD, 0, fd);
+  emit(0, 0, 0, 0, 0);
+}
+
+void BPFProgram::call(int helper) {
+  emit(BPF_JMP | BPF_CALL, 0, 0, 0, helper);
+}
+
+void BPFProgram::jumpImm(uint8_t op,
+                         int dst,
+                         int32_t imm,
+                         const std::string& label) {
+  jumps_.push_back(std::make_pair(insns_.size(), label));
+  emit(BPF_JMP | op | BPF_K, dst, 0, 0, imm);
+}
+
+void BPFProgram::jump(const std::string& label) {
+  jumps_.push_back(std::make_pair(insns_.size(), label));
+  emit(BPF_JMP | BPF_JA, 0, 0, 0, 0);
+}
+
+void BPFProgram::label(const std::string& label) {
+  labels_[label] = insns_.size();
+}
+
+void BPFProgram::exit() {
+  emit(BPF_JMP | BPF_EXIT, 0, 0, 0, 0);
+}
+
+bool BPFProgram::resolve() {
+  for (const auto& jump : jumps_) {
+    auto label = labels_.find(jump.second);
+    if (label == labels_.end()) {
+      return false;
+    }
+    // Offsets are relative to the instruction after the jump.
+    insns_[jump.first].off =
+        static_cast<int16_t>(label->second) - jump.first - 1;
+  }
+  jumps_.clear();
+  return true;
+}
+
+/**
+ * @brief Begin a record on the stack, saving the context in r6.
+ *
+ * The record header is the type, pid_tgid, uid_gid, and time.
+ */
+static void genRecordHeader(BPFProgram& p, BPFRecordType type, int size) {
+  p.mov(BPF_REG_6, BPF_REG_1);
+  p.storeImm(BPF_REG_10, -size, type);
+  p.call(BPF_FUNC_get_current_pid_tgid);
+  p.store(BPF_REG_10, -size + 8, BPF_REG_0);
+  p.call(BPF_FUNC_get_current_uid_gid);
+  p.store(BPF_REG_10, -size + 16, BPF_REG_0);
+  p.call(BPF_FUNC_ktime_get_ns);
+  p.store(BPF_REG_10, -size + 24, BPF_REG_0);
+}
+
+/// Write the record on the stack to this CPU's perf buffer, and return.
+static void genRecordOutput(BPFProgram& p, int perf_map, int size) {
+  p.label("output");
+  p.mov(BPF_REG_1, BPF_REG_6);
+  p.loadMap(BPF_REG_2, perf_map);
+  // BPF_F_CURRENT_CPU, zero extended.
+  p.movImm32(BPF_REG_3, -1);
+  p.mov(BPF_REG_4, BPF_REG_10);
+  p.addImm(BPF_REG_4, -size);
+  p.movImm(BPF_REG_5, size);
+  p.call(BPF_FUNC_perf_event_output);
+  p.label("exit");
+  p.movImm(BPF_REG_0, 0);
+  p.exit();
+}
+
+/// Zero the socket address of a record, it may be read partially.
+static void genZeroAddress(BPFProgram& p, int size) {
+  for (int i = 0; i < kBPFAddressSize; i += 8) {
+    p.storeImm(BPF_REG_10, -size + kBPFHeaderSize + 8 + i, 0);
+  }
+}
+
+BPFProgram BPFEventPublisher::genExecEnter(int perf_map) {
+  BPFProgram p;
+  genRecordHeader(p, BPF_RECORD_EXEC_ENTER, kBPFExecSize);
+  p.mov(BPF_REG_1, BPF_REG_10);
+  p.addImm(BPF_REG_1, -kBPFExecSize + kBPFHeaderSize);
+  p.movImm(BPF_REG_2, kBPFFilenameSize);
+  p.load(BPF_REG_3, BPF_REG_6, kBPFArg0);
+  p.call(BPF_FUNC_probe_read_str);
+  genRecordOutput(p, perf_map, kBPFExecSize);
+  p.resolve();
+  return p;
+}
+
+BPFProgram BPFEventPublisher::genSyscallExit(BPFRecordType type,
+                                             int perf_map) {
+  BPFProgram p;
+  genRecordHeader(p, type, kBPFExitSize);
+  p.load(BPF_REG_1, BPF_REG_6, kBPFResult);
+  p.store(BPF_REG_10, -kBPFExitSize + kBPFHeaderSize, BPF_REG_1);
+  genRecordOutput(p, perf_map, kBPFExitSize);
+  p.resolve();
+  return p;
+}
+
+BPFProgram BPFEventPublisher::genSocketEnter(BPFRecordType type,
+                                             int perf_map) {
+  BPFProgram p;
+  genRecordHeader(p, type, kBPFSocketSize);
+  p.load(BPF_REG_1, BPF_REG_6, kBPFArg0);
+  p.store(BPF_REG_10, -kBPFSocketSize + kBPFHeaderSize, BPF_REG_1);
+  genZeroAddress(p, kBPFSocketSize);
+
+  // Read the largest address, if that faults read a sockaddr_in.
+  p.mov(BPF_REG_1, BPF_REG_10);
+  p.addImm(BPF_REG_1, -kBPFSocketSize + kBPFHeaderSize + 8);
+  p.movImm(BPF_REG_2, kBPFSockaddrSize);
+  p.load(BPF_REG_3, BPF_REG_6, kBPFArg1);
+  p.call(BPF_FUNC_probe_read);
+  p.jumpImm(BPF_JEQ, BPF_REG_0, 0, "output");
+  p.mov(BPF_REG_1, BPF_REG_10);
+  p.addImm(BPF_REG_1, -kBPFSocketSize + kBPFHeaderSize + 8);
+  p.movImm(BPF_REG_2, 16);
+  p.load(BPF_REG_3, BPF_REG_6, kBPFArg1);
+  p.call(BPF_FUNC_probe_read);
+  genRecordOutput(p, perf_map, kBPFSocketSize);
+  p.resolve();
+  return p;
+}
+
+BPFProgram BPFEventPublisher::genAcceptEnter(int accept_map) {
+  // The peer address is written by the kernel, save its pointer for the exit.
+  BPFProgram p;
+  p.mov(BPF_REG_6, BPF_REG_1);
+  p.call(BPF_FUNC_get_current_pid_tgid);
+  p.store(BPF_REG_10, -8, BPF_REG_0);
+  p.load(BPF_REG_1, BPF_REG_6, kBPFArg1);
+  p.store(BPF_REG_10, -16, BPF_REG_1);
+  p.loadMap(BPF_REG_1, accept_map);
+  p.mov(BPF_REG_2, BPF_REG_10);
+  p.addImm(BPF_REG_2, -8);
+  p.mov(BPF_REG_3, BPF_REG_10);
+  p.addImm(BPF_REG_3, -16);
+  p.movImm(BPF_REG_4, BPF_ANY);
+  p.call(BPF_FUNC_map_update_elem);
+  p.movImm(BPF_REG_0, 0);
+  p.exit();
+  p.resolve();
+  return p;
+}
+
+BPFProgram BPFEventPublisher::genAcceptExit(int perf_map, int accept_map) {
+  BPFProgram p;
+  genRecordHeader(p, BPF_RECORD_ACCEPT_EXIT, kBPFSocketSize);
+  p.load(BPF_REG_1, BPF_REG_6, kBPFResult);
+  p.store(BPF_REG_10, -kBPFSocketSize + kBPFHeaderSize, BPF_REG_1);
+  genZeroAddress(p, kBPFSocketSize);
+
+  // Find and forget the peer address pointer saved on entry.
+  p.loadMap(BPF_REG_1, accept_map);
+  p.mov(BPF_REG_2, BPF_REG_10);
+  p.addImm(BPF_REG_2, -kBPFSocketSize + 8);
+  p.call(BPF_FUNC_map_lookup_elem);
+  p.jumpImm(BPF_JEQ, BPF_REG_0, 0, "exit");
+  p.load(BPF_REG_7, BPF_REG_0, 0);
+  p.loadMap(BPF_REG_1, accept_map);
+  p.mov(BPF_REG_2, BPF_REG_10);
+  p.addImm(BPF_REG_2, -kBPFSocketSize + 8);
+  p.call(BPF_FUNC_map_delete_elem);
+
+  // Only successful accepts are recorded, the address may not be requested.
+  p.load(BPF_REG_1, BPF_REG_10, -kBPFSocketSize + kBPFHeaderSize);
+  p.jumpImm(BPF_JSGE, BPF_REG_1, 0, "accepted");
+  p.jump("exit");
+  p.label("accepted");
+  p.jumpImm(BPF_JEQ, BPF_REG_7, 0, "output");
+  p.mov(BPF_REG_1, BPF_REG_10);
+  p.addImm(BPF_REG_1, -kBPFSocketSize + kBPFHeaderSize + 8);
+  p.movImm(BPF_REG_2, kBPFSockaddrSize);
+  p.mov(BPF_REG_3, BPF_REG_7);
+  p.call(BPF_FUNC_probe_read);
+  genRecordOutput(p, perf_map, kBPFSocketSize);
+  p.resolve();
+  return p;
+}
+
+Status BPFEventPublisher::attach(const std::string& tracepoint,
+                                 const BPFProgram& program) {
+  std::string id;
+  for (const auto& path : kBPFTracepointPaths) {
+    if (readFile(path + tracepoint + "/id", id).ok()) {
+      break;
+    }
+  }
+
+  long long config = 0;
+  boost::trim(id);
+  if (id.empty() || !safeStrtoll(id, 10, config).ok()) {
+    return Status(1, "Cannot find tracepoint: " + tracepoint);
+  }
+
+  static const char* kLicense = "GPL";
+  std::vector<char> log(64 * 1024, 0);
+  const auto& insns = program.instructions();
+
+  union bpf_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.prog_type = BPF_PROG_TYPE_TRACEPOINT;
+  attr.insn_cnt = static_cast<uint32_t>(insns.size());
+  attr.insns = ptrToU64(insns.data());
+  attr.license = ptrToU64(kLicense);
+  attr.log_buf = ptrToU64(log.data());
+  attr.log_size = static_cast<uint32_t>(log.size());
+  attr.log_level = 1;
+  int prog = bpf(BPF_PROG_LOAD, &attr);
+  if (prog < 0) {
+    VLOG(1) << "BPF verifier output for " << tracepoint << ": " << log.data();
+    return Status(1, "Cannot load BPF program for: " + tracepoint);
+  }
+  programs_.push_back(prog);
+
+  struct perf_event_attr pattr;
+  memset(&pattr, 0, sizeof(pattr));
+  pattr.type = PERF_TYPE_TRACEPOINT;
+  pattr.size = sizeof(pattr);
+  pattr.config = static_cast<uint64_t>(config);
+  pattr.sample_period = 1;
+  pattr.wakeup_events = 1;
+
+  // Programs attached to a tracepoint run on every CPU.
+  int event = perfEventOpen(&pattr, 0);
+  if (event < 0) {
+    return Status(1, "Cannot open tracepoint: " + tracepoint);
+  }
+  tracepoints_.push_back(event);
+
+  if (::ioctl(event, PERF_EVENT_IOC_SET_BPF, prog) != 0 ||
+      ::ioctl(event, PERF_EVENT_IOC_ENABLE, 0) != 0) {
+    return Status(1, "Cannot attach BPF program to: " + tracepoint);
+  }
+  return Status(0, "OK");
+}
+
+Status BPFEventPublisher::setUp() {
+  if (FLAGS_disable_bpf) {
+    return Status(1, "Publisher disabled via configuration");
+  }
+
+  auto cpus = ::sysconf(_SC_NPROCESSORS_CONF);
+  perf_map_ = createMap(BPF_MAP_TYPE_PERF_EVENT_ARRAY,
+                        sizeof(uint32_t),
+                        sizeof(uint32_t),
+                        static_cast<uint32_t>(cpus));
+  accept_map_ = createMap(
+      BPF_MAP_TYPE_HASH, sizeof(uint64_t), sizeof(uint64_t), kBPFAcceptEntries);
+  epoll_ = ::epoll_create1(EPOLL_CLOEXEC);
+  if (perf_map_ < 0 || accept_map_ < 0 || epoll_ < 0) {
+    tearDown();
+    return Status(1, "Cannot create BPF maps");
+  }
+
+  // Each CPU writes records to its own buffer.
+  auto page_size = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+  for (uint32_t cpu = 0; cpu < static_cast<uint32_t>(cpus); cpu++) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_SOFTWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_SW_BPF_OUTPUT;
+    attr.sample_type = PERF_SAMPLE_RAW;
+    attr.sample_period = 1;
+    attr.watermark = 1;
+    attr.wakeup_watermark = kBPFWakeupBytes;
+
+    BPFPerfBuffer buffer;
+    buffer.fd = perfEventOpen(&attr, static_cast<int>(cpu));
+    if (buffer.fd < 0) {
+      // The CPU may be offline.
+      continue;
+    }
+
+    buffer.size = kBPFPerfPages * page_size;
+    buffer.base = ::mmap(nullptr,
+                         buffer.size + page_size,
+                         PROT_READ | PROT_WRITE,
+                         MAP_SHARED,
+                         buffer.fd,
+                         0);
+    if (buffer.base == MAP_FAILED) {
+      ::close(buffer.fd);
+      continue;
+    }
+    buffers_.push_back(buffer);
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = buffer.fd;
+    if (updateMap(perf_map_, &cpu, &buffer.fd) != 0 ||
+        ::ioctl(buffer.fd, PERF_EVENT_IOC_ENABLE, 0) != 0 ||
+        ::epoll_ctl(epoll_, EPOLL_CTL_ADD, buffer.fd, &ev) != 0) {
+      tearDown();
+      return Status(1, "Cannot enable BPF perf buffers");
+    }
+  }
+
+  if (buffers_.empty()) {
+    tearDown();
+    return Status(1, "Cannot open BPF perf buffers");
+  }
+
+  std::vector<std::pair<std::string, BPFProgram>> programs = {
+      {"sys_enter_execve", genExecEnter(perf_map_)},
+      {"sys_exit_execve", genSyscallExit(BPF_RECORD_EXEC_EXIT, perf_map_)},
+      {"sys_enter_connect",
+       genSocketEnter(BPF_RECORD_CONNECT_ENTER, perf_map_)},
+      {"sys_exit_connect",
+       genSyscallExit(BPF_RECORD_CONNECT_EXIT, perf_map_)},
+      {"sys_enter_bind", genSocketEnter(BPF_RECORD_BIND_ENTER, perf_map_)},
+      {"sys_exit_bind", genSyscallExit(BPF_RECORD_BIND_EXIT, perf_map_)},
+      {"sys_enter_accept", genAcceptEnter(accept_map_)},
+      {"sys_exit_accept", genAcceptExit(perf_map_, accept_map_)},
+      {"sys_enter_accept4", genAcceptEnter(accept_map_)},
+      {"sys_exit_accept4", genAcceptExit(perf_map_, accept_map_)},
+  };
+
+  for (const auto& program : programs) {
+    auto status = attach(program.first, program.second);
+    if (!status.ok()) {
+      tearDown();
+      return status;
+    }
+  }
+  return Status(0, "OK");
+}
+
+void BPFEventPublisher::tearDown() {
+  // Closing the tracepoints detaches the programs.
+  for (const auto& fd : tracepoints_) {
+    ::close(fd);
+  }
+  tracepoints_.clear();
+
+  for (const auto& fd : programs_) {
+    ::close(fd);
+  }
+  programs_.clear();
+
+  auto page_size = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+  for (const auto& buffer : buffers_) {
+    ::munmap(buffer.base, buffer.size + page_size);
+    ::close(buffer.fd);
+  }
+  buffers_.clear();
+
+  for (auto fd : {&perf_map_, &accept_map_, &epoll_}) {
+    if (*fd >= 0) {
+      ::close(*fd);
+    }
+    *fd = -1;
+  }
+}
+
+Status BPFEventPublisher::run() {
+  struct epoll_event events[16];
+  auto count = ::epoll_wait(epoll_, events, 16, kBPFMLatency);
+  if (count < 0 && errno != EINTR) {
+    return Status(1, "BPF perf buffer wait failed");
+  }
+
+  // Read every buffer, on a timeout buffers below the watermark are read.
+  for (auto& buffer : buffers_) {
+    readBuffer(buffer);
+  }
+  return Status(0, "OK");
+}
+
+/// Copy bytes from a ring buffer, which may wrap at its end.
+static void copyFromRing(const char* ring,
+                         size_t size,
+                         uint64_t offset,
+                         size_t length,
+                         char* out) {
+  auto start = offset % size;
+  auto first = std::min(length, size - start);
+  memcpy(out, ring + start, first);
+  if (first < length) {
+    memcpy(out + first, ring, length - first);
+  }
+}
+
+void BPFEventPublisher::readBuffer(BPFPerfBuffer& buffer) {
+  auto page_size = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+  auto header = static_cast<struct perf_event_mmap_page*>(buffer.base);
+  auto ring = static_cast<const char*>(buffer.base) + page_size;
+
+  uint64_t head = __atomic_load_n(&header->data_head, __ATOMIC_ACQUIRE);
+  uint64_t tail = header->data_tail;
+
+  std::vector<char> event;
+  while (tail < head) {
+    struct perf_event_header event_header;
+    copyFromRing(ring,
+                 buffer.size,
+                 tail,
+                 sizeof(event_header),
+                 reinterpret_cast<char*>(&event_header));
+    if (event_header.size < sizeof(event_header)) {
+      break;
+    }
+
+    event.resize(event_header.size);
+    copyFromRing(ring, buffer.size, tail, event_header.size, event.data());
+    tail += event_header.size;
+
+    if (event_header.type == PERF_RECORD_SAMPLE) {
+      // A raw sample is the header, a u32 size, and the program's record.
+      uint32_t raw_size = 0;
+      if (event.size() < sizeof(event_header) + sizeof(raw_size)) {
+        continue;
+      }
+      memcpy(&raw_size, event.data() + sizeof(event_header), sizeof(raw_size));
+      auto raw = event.data() + sizeof(event_header) + sizeof(raw_size);
+      raw_size = std::min<uint32_t>(
+          raw_size, event.size() - sizeof(event_header) - sizeof(raw_size));
+
+      BPFRecord record;
+      if (parseRecord(raw, raw_size, record)) {
+        handleRecord(std::move(record));
+      }
+    } else if (event_header.type == PERF_RECORD_LOST) {
+      uint64_t lost[2] = {0, 0};
+      if (event.size() >= sizeof(event_header) + sizeof(lost)) {
+        memcpy(lost, event.data() + sizeof(event_header), sizeof(lost));
+        lost_ += lost[1];
+        VLOG(1) << "BPF perf buffer lost " << lost[1] << " records";
+      }
+    }
+  }
+
+  __atomic_store_n(&header->data_tail, tail, __ATOMIC_RELEASE);
+}
+
+bool BPFEventPublisher::parseRecord(const char* data,
+                                    size_t size,
+                                    BPFRecord& record) {
+  if (size < static_cast<size_t>(kBPFExitSize)) {
+    return false;
+  }
+
+  memcpy(&record.type, data, sizeof(record.type));
+  memcpy(&record.pid_tgid, data + 8, sizeof(record.pid_tgid));
+  memcpy(&record.uid_gid, data + 16, sizeof(record.uid_gid));
+  memcpy(&record.ktime, data + 24, sizeof(record.ktime));
+
+  auto payload = data + kBPFHeaderSize;
+  switch (record.type) {
+  case BPF_RECORD_EXEC_ENTER:
+    if (size < static_cast<size_t>(kBPFExecSize)) {
+      return false;
+    }
+    record.data.assign(payload, strnlen(payload, kBPFFilenameSize));
+    return true;
+  case BPF_RECORD_CONNECT_ENTER:
+  case BPF_RECORD_BIND_ENTER:
+  case BPF_RECORD_ACCEPT_EXIT:
+    if (size < static_cast<size_t>(kBPFSocketSize)) {
+      return false;
+    }
+    memcpy(&record.value, payload, sizeof(record.value));
+    record.data.assign(payload + 8, kBPFAddressSize);
+    return true;
+  case BPF_RECORD_EXEC_EXIT:
+  case BPF_RECORD_CONNECT_EXIT:
+  case BPF_RECORD_BIND_EXIT:
+    memcpy(&record.value, payload, sizeof(record.value));
+    return true;
+  default:
+    return false;
+  }
+}
+
+void BPFEventPublisher::handleRecord(BPFRecord&& record) {
+  uint64_t tgid = record.pid_tgid >> 32;
+  // A thread calling execve becomes the thread group leader, pair by process.
+  auto thread = (record.type == BPF_RECORD_EXEC_ENTER ||
+                 record.type == BPF_RECORD_EXEC_EXIT)
+                    ? tgid
+                    : record.pid_tgid;
+
+  if (record.type == BPF_RECORD_EXEC_ENTER ||
+      record.type == BPF_RECORD_CONNECT_ENTER ||
+      record.type == BPF_RECORD_BIND_ENTER) {
+    if (pending_.size() >= kBPFMaxPending) {
+      pending_.clear();
+    }
+    pending_[std::make_pair(thread, record.type)] = std::move(record);
+    return;
+  }
+
+  auto ec = createEventContext();
+  if (record.type == BPF_RECORD_ACCEPT_EXIT) {
+    ec->type = BPF_EVENT_ACCEPT;
+    ec->fd = record.value;
+    ec->address = std::move(record.data);
+  } else {
+    // The exit record is one more than its entry record.
+    auto entry = pending_.find(std::make_pair(thread, record.type - 1));
+    if (entry == pending_.end()) {
+      return;
+    }
+
+    if (record.type == BPF_RECORD_EXEC_EXIT) {
+      ec->type = BPF_EVENT_EXEC;
+      ec->path = std::move(entry->second.data);
+    } else {
+      ec->type = (record.type == BPF_RECORD_CONNECT_EXIT) ? BPF_EVENT_CONNECT
+                                                          : BPF_EVENT_BIND;
+      ec->fd = entry->second.value;
+      ec->address = std::move(entry->second.data);
+    }
+    pending_.erase(entry);
+  }
+
+  ec->result = record.value;
+  ec->pid = static_cast<pid_t>(tgid);
+  ec->tid = static_cast<pid_t>(record.pid_tgid & 0xffffffff);
+  ec->uid = static_cast<uid_t>(record.uid_gid & 0xffffffff);
+  ec->gid = static_cast<gid_t>(record.uid_gid >> 32);
+  fire(ec);
+}
+
+bool BPFEventPublisher::shouldFire(const BPFSubscriptionContextRef& sc,
+                                   const BPFEventContextRef& ec) const {
+  return sc->types.empty() || sc->types.count(ec->type) > 0;
+}
+}
@@ -0,0 +1,273 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <linux/bpf.h>
+
+#include <osquery/events.h>
+
+namespace osquery {
+
+/// The process and socket actions published by the BPFEventPublisher.
+enum BPFEventType {
+  BPF_EVENT_EXEC = 1,
+  BPF_EVENT_CONNECT = 2,
+  BPF_EVENT_BIND = 3,
+  BPF_EVENT_ACCEPT = 4,
+};
+
+/**
+ * @brief The raw records written by the publisher's BPF programs.
+ *
+ * Each syscall is traced on entry and exit, the publisher pairs the records
+ * of a thread into a single event. Accepts are written once, on exit.
+ */
+enum BPFRecordType {
+  BPF_RECORD_EXEC_ENTER = 1,
+  BPF_RECORD_EXEC_EXIT = 2,
+  BPF_RECORD_CONNECT_ENTER = 3,
+  BPF_RECORD_CONNECT_EXIT = 4,
+  BPF_RECORD_BIND_ENTER = 5,
+  BPF_RECORD_BIND_EXIT = 6,
+  BPF_RECORD_ACCEPT_EXIT = 7,
+};
+
+/// A record read from the perf buffers, see BPFRecordType.
+struct BPFRecord {
+  /// The BPFRecordType.
+  uint64_t type{0};
+
+  /// The thread group (upper 32 bits) and thread (lower 32 bits) IDs.
+  uint64_t pid_tgid{0};
+
+  /// The group (upper 32 bits) and user (lower 32 bits) IDs.
+  uint64_t uid_gid{0};
+
+  /// Kernel monotonic time in nanoseconds.
+  uint64_t ktime{0};
+
+  /// The syscall result on exit, or the socket descriptor on entry.
+  int64_t value{0};
+
+  /// The executed filename, or the raw socket address structure.
+  std::string data;
+};
+
+/**
+ * @brief Subscription details for BPFEventPublisher events.
+ *
+ * Subscribers select the event types they receive, or all if empty.
+ */
+struct BPFSubscriptionContext : public SubscriptionContext {
+  std::set<BPFEventType> types;
+};
+
+/**
+ * @brief Event details for BPFEventPublisher events.
+ */
+struct BPFEventContext : public EventContext {
+  /// The traced action.
+  BPFEventType type{BPF_EVENT_EXEC};
+
+  /// The process (thread group) ID.
+  pid_t pid{0};
+
+  /// The thread ID.
+  pid_t tid{0};
+
+  /// The real user and group IDs.
+  uid_t uid{0};
+  gid_t gid{0};
+
+  /// The syscall result, or the accepted descriptor.
+  int64_t result{0};
+
+  /// The socket descriptor for connects and binds.
+  int64_t fd{-1};
+
+  /// The executed filename as requested by the process.
+  std::string path;
+
+  /// The raw socket address structure for socket events.
+  std::string address;
+};
+
+using BPFEventContextRef = std::shared_ptr<BPFEventContext>;
+using BPFSubscriptionContextRef = std::shared_ptr<BPFSubscriptionContext>;
+
+/**
+ * @brief A small assembler for eBPF programs.
+ *
+ * Jumps may use labels, resolved once the program is complete.
+ */
+class BPFProgram {
+ public:
+  /// dst = src.
+  void mov(int dst, int src);
+
+  /// dst = imm, sign extended.
+  void movImm(int dst, int32_t imm);
+
+  /// dst = imm, zero extended.
+  void movImm32(int dst, int32_t imm);
+
+  /// dst += imm.
+  void addImm(int dst, int32_t imm);
+
+  /// dst = *(u64*)(src + off).
+  void load(int dst, int src, int16_t off);
+
+  /// *(u64*)(dst + off) = src.
+  void store(int dst, int16_t off, int src);
+
+  /// *(u64*)(dst + off) = imm.
+  void storeImm(int dst, int16_t off, int32_t imm);
+
+  /// dst = map, using two instructions.
+  void loadMap(int dst, int fd);
+
+  /// Call a BPF helper function.
+  void call(int helper);
+
+  /// Jump to a label if the comparison of dst and imm is true.
+  void jumpImm(uint8_t op, int dst, int32_t imm, const std::string& label);
+
+  /// Jump to a label.
+  void jump(const std::string& label);
+
+  /// Mark the location of the next instruction.
+  void label(const std::string& label);
+
+  /// Return from the program.
+  void exit();
+
+  /// Resolve jumps to labels, false if a label is missing.
+  bool resolve();
+
+  /// The program instructions.
+  const std::vector<struct bpf_insn>& instructions() const { return insns_; }
+
+ private:
+  /// Append an instruction.
+  void emit(uint8_t code, int dst, int src, int16_t off, int32_t imm);
+
+ private:
+  std::vector<struct bpf_insn> insns_;
+
+  /// Instruction index for each label.
+  std::map<std::string, size_t> labels_;
+
+  /// Jump instruction indexes and their labels.
+  std::vector<std::pair<size_t, std::string>> jumps_;
+};
+
+/// A mapped perf event buffer for one CPU.
+struct BPFPerfBuffer {
+  int fd{-1};
+  void* base{nullptr};
+  size_t size{0};
+};
+
+/**
+ * @brief A Linux eBPF EventPublisher for process and socket events.
+ *
+ * Small tracepoint programs, assembled when the publisher is set up, are
+ * attached to the execve, connect, bind, accept, and accept4 syscalls. They
+ * write fixed-size records to a per-CPU perf event buffer. The run loop waits
+ * on all buffers, reads every available record in one pass, and pairs entry
+ * and exit records into events. There is no netlink parsing, and there is no
+ * conflict with auditd.
+ *
+ * Loading programs requires root and a kernel with syscall tracepoints.
+ */
+class BPFEventPublisher
+    : public EventPublisher<BPFSubscriptionContext, BPFEventContext> {
+  DECLARE_PUBLISHER("bpf");
+
+ public:
+  /// Create maps, load and attach programs, and map the perf buffers.
+  Status setUp() override;
+
+  /// Detach programs and release all descriptors.
+  void tearDown() override;
+
+  /// Read all available records from the perf buffers.
+  Status run() override;
+
+ public:
+  /// Read a record written by a BPF program.
+  static bool parseRecord(const char* data, size_t size, BPFRecord& record);
+
+ private:
+  /// Pair a record with its thread's entry record, firing complete events.
+  void handleRecord(BPFRecord&& record);
+
+  /// Read the records from one perf buffer.
+  void readBuffer(BPFPerfBuffer& buffer);
+
+  /// Load a tracepoint program and attach it to a syscalls tracepoint.
+  Status attach(const std::string& tracepoint, const BPFProgram& program);
+
+  bool shouldFire(const BPFSubscriptionContextRef& sc,
+                  const BPFEventContextRef& ec) const override;
+
+ private:
+  /// Generate the execve entry program, recording the filename.
+  static BPFProgram genExecEnter(int perf_map);
+
+  /// Generate a syscall exit program, recording the result.
+  static BPFProgram genSyscallExit(BPFRecordType type, int perf_map);
+
+  /// Generate a connect or bind entry program, recording the address.
+  static BPFProgram genSocketEnter(BPFRecordType type, int perf_map);
+
+  /// Generate the accept entry program, saving the peer address pointer.
+  static BPFProgram genAcceptEnter(int accept_map);
+
+  /// Generate the accept exit program, recording the peer address.
+  static BPFProgram genAcceptExit(int perf_map, int accept_map);
+
+ private:
+  /// The per-CPU perf event array written by the programs.
+  int perf_map_{-1};
+
+  /// Peer address pointers of threads within accept.
+  int accept_map_{-1};
+
+  /// Loaded program descriptors.
+  std::vector<int> programs_;
+
+  /// Tracepoint perf event descriptors with attached programs.
+  std::vector<int> tracepoints_;
+
+  /// The per-CPU perf buffers.
+  std::vector<BPFPerfBuffer> buffers_;
+
+  /// Waits on all perf buffers.
+  int epoll_{-1};
+
+  /// Entry records waiting for their exit record, by thread and type.
+  std::map<std::pair<uint64_t, uint64_t>, BPFRecord> pending_;
+
+  /// Records the kernel could not write to a full perf buffer.
+  size_t lost_{0};
+
+ private:
+  FRIEND_TEST(BPFTests, test_bpf_program_labels);
+  FRIEND_TEST(BPFTests, test_bpf_programs);
+  FRIEND_TEST(BPFTests, test_bpf_pair_records);
+};
+}
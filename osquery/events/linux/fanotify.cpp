@@ -0,0 +1,307 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <algorithm>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <sys/select.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+
+#include "osquery/events/linux/fanotify.h"
+
+namespace osquery {
+
+/// Whole-filesystem monitoring requires CAP_SYS_ADMIN and replaces inotify.
+FLAG(bool,
+     disable_fanotify,
+     true,
+     "Disable file events from fanotify, use inotify watches instead");
+
+// Filesystem marks were added in Linux 4.20, fall back to mount marks.
+#ifndef FAN_MARK_FILESYSTEM
+#define FAN_MARK_FILESYSTEM 0x00000100
+#endif
+
+static const size_t kFANotifyBufferSize = 64 * 1024;
+
+/// Event masks with equivalent inotify and fanotify bits.
+static const std::vector<std::pair<uint32_t, uint64_t>> kFANotifyMasks = {
+    {IN_ACCESS, FAN_ACCESS},
+    {IN_MODIFY, FAN_MODIFY},
+    {IN_CLOSE_WRITE, FAN_CLOSE_WRITE},
+    {IN_OPEN, FAN_OPEN},
+};
+
+REGISTER(FANotifyEventPublisher, "event_publisher", "fanotify");
+
+uint64_t FANotifyEventPublisher::getMarkMask(uint32_t mask) {
+  if (mask == 0) {
+    mask = kFileDefaultMasks;
+  }
+
+  uint64_t mark_mask = 0;
+  for (const auto& bits : kFANotifyMasks) {
+    if (mask & bits.first) {
+      mark_mask |= bits.second;
+    }
+  }
+  return mark_mask;
+}
+
+uint32_t FANotifyEventPublisher::getINotifyMask(uint64_t mask) {
+  uint32_t inotify_mask = 0;
+  for (const auto& bits : kFANotifyMasks) {
+    if (mask & bits.second) {
+      inotify_mask |= bits.first;
+    }
+  }
+  return inotify_mask;
+}
+
+Status FANotifyEventPublisher::setUp() {
+  if (FLAGS_disable_fanotify) {
+    return Status(1, "Publisher disabled via configuration");
+  }
+
+  fanotify_handle_ = ::fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC,
+                                     O_RDONLY | O_LARGEFILE | O_CLOEXEC);
+  if (fanotify_handle_ == -1) {
+    return Status(1, "Could not start fanotify: fanotify_init failed");
+  }
+  return Status(0, "OK");
+}
+
+void FANotifyEventPublisher::optimizeSubscription(
+    INotifySubscriptionContextRef& sc) const {
+  if (sc->path.find("**") != std::string::npos) {
+    sc->recursive = true;
+    sc->path = sc->path.substr(0, sc->path.find("**"));
+  }
+
+  if (sc->path.find('*') != std::string::npos) {
+    // A wildcard within the tree (stem) matches leading directories if the
+    // subscription is also recursive.
+    auto stem = sc->path.substr(0, sc->path.rfind('/') + 1);
+    if (stem.find('*') != std::string::npos) {
+      sc->recursive_match = sc->recursive;
+    }
+  } else if (isDirectory(sc->path) && sc->path.back() != '/') {
+    sc->path += '/';
+  }
+  sc->discovered_ = sc->path;
+}
+
+std::string FANotifyEventPublisher::getMarkPath(const std::string& path) {
+  auto mark = path.substr(0, path.find_first_of("*?["));
+  mark = mark.substr(0, mark.rfind('/') + 1);
+
+  // The mark is applied to the filesystem of the nearest existing directory.
+  while (mark.size() > 1 && !isDirectory(mark).ok()) {
+    mark = mark.substr(0, mark.rfind('/', mark.size() - 2) + 1);
+  }
+  return (mark.empty()) ? "/" : mark;
+}
+
+bool FANotifyEventPublisher::addMark(const std::string& path, uint64_t mask) {
+  struct stat st;
+  if (::stat(path.c_str(), &st) != 0) {
+    return false;
+  }
+
+  WriteLock lock(mutex_);
+  auto& marked = marks_[st.st_dev];
+  if ((marked & mask) == mask) {
+    // The filesystem is already marked for these events.
+    return true;
+  }
+
+  int result = ::fanotify_mark(fanotify_handle_,
+                               FAN_MARK_ADD | FAN_MARK_FILESYSTEM,
+                               mask,
+                               AT_FDCWD,
+                               path.c_str());
+  if (result != 0 && errno == EINVAL) {
+    result = ::fanotify_mark(fanotify_handle_,
+                             FAN_MARK_ADD | FAN_MARK_MOUNT,
+                             mask,
+                             AT_FDCWD,
+                             path.c_str());
+  }
+
+  if (result != 0) {
+    LOG(WARNING) << "Could not add fanotify mark on: " << path;
+    return false;
+  }
+  marked |= mask;
+  return true;
+}
+
+void FANotifyEventPublisher::configure() {
+  if (!isHandleOpen()) {
+    return;
+  }
+
+  auto matcher = std::make_shared<INotifyPathMatcher>();
+  std::map<std::string, uint64_t> marks;
+  for (auto& sub : subscriptions_) {
+    auto sc = getSubscriptionContext(sub->context);
+    if (sc->discovered_.size() == 0) {
+      optimizeSubscription(sc);
+    }
+    marks[getMarkPath(sc->path)] |= getMarkMask(sc->mask);
+    matcher->add(sc);
+  }
+
+  // Marks filter events by mask in the kernel, paths are matched here.
+  for (const auto& mark : marks) {
+    addMark(mark.first, mark.second);
+  }
+  std::atomic_store(&matcher_,
+                    std::shared_ptr<const INotifyPathMatcher>(matcher));
+}
+
+void FANotifyEventPublisher::tearDown() {
+  if (isHandleOpen()) {
+    ::close(fanotify_handle_);
+  }
+  fanotify_handle_ = -1;
+}
+
+/// Resolve the path of a file descriptor opened by fanotify.
+static std::string getDescriptorPath(int fd) {
+  char path[PATH_MAX] = {0};
+  auto link = "/proc/self/fd/" + std::to_string(fd);
+  auto size = ::readlink(link.c_str(), path, sizeof(path) - 1);
+  if (size <= 0) {
+    return "";
+  }
+  return std::string(path, size);
+}
+
+Status FANotifyEventPublisher::run() {
+  fd_set set;
+  FD_ZERO(&set);
+  FD_SET(fanotify_handle_, &set);
+
+  struct timeval timeout = {1, 0};
+  int selector =
+      ::select(fanotify_handle_ + 1, &set, nullptr, nullptr, &timeout);
+  if (selector == -1) {
+    LOG(WARNING) << "Could not read fanotify handle";
+    return Status(1, "fanotify handle failed");
+  }
+
+  if (selector == 0) {
+    // Read timeout.
+    return Status(0, "Continue");
+  }
+
+  alignas(struct fanotify_event_metadata) char buffer[kFANotifyBufferSize];
+  auto length = ::read(fanotify_handle_, buffer, sizeof(buffer));
+  if (length <= 0) {
+    return (errno == EAGAIN) ? Status(0, "Continue")
+                             : Status(1, "fanotify read failed");
+  }
+
+  auto pid = ::getpid();
+  auto metadata = reinterpret_cast<struct fanotify_event_metadata*>(buffer);
+  for (; FAN_EVENT_OK(metadata, length);
+       metadata = FAN_EVENT_NEXT(metadata, length)) {
+    if (metadata->vers != FANOTIFY_METADATA_VERSION) {
+      return Status(1, "fanotify metadata version mismatch");
+    }
+
+    if (metadata->fd < 0) {
+      if (metadata->mask & FAN_Q_OVERFLOW) {
+        VLOG(1) << "fanotify event queue overflowed";
+      }
+      continue;
+    }
+
+    // Events caused by this process, such as hashing, are not published.
+    if (metadata->pid != pid) {
+      auto path = getDescriptorPath(metadata->fd);
+      if (!path.empty()) {
+        auto ec = createEventContextFrom(metadata->mask, path);
+        if (!ec->action.empty() && !ec->matches.empty()) {
+          fire(ec);
+        }
+      }
+    }
+    ::close(metadata->fd);
+  }
+  return Status(0, "OK");
+}
+
+INotifyEventContextRef FANotifyEventPublisher::createEventContextFrom(
+    uint64_t mask, const std::string& path) const {
+  // Subscribers read the inotify event structure.
+  auto event = std::make_shared<struct inotify_event>();
+  event->wd = -1;
+  event->mask = getINotifyMask(mask);
+
+  auto ec = createEventContext();
+  ec->event = event;
+  ec->path = path;
+  for (const auto& action : kMaskActions) {
+    if (event->mask & action.first) {
+      ec->action = action.second;
+      break;
+    }
+  }
+
+  ec->matcher = std::atomic_load(&matcher_);
+  if (ec->matcher != nullptr && !ec->action.empty()) {
+    ec->matcher->match(ec->path, ec->matches);
+  }
+  return ec;
+}
+
+bool FANotifyEventPublisher::shouldFire(
+    const INotifySubscriptionContextRef& sc,
+    const INotifyEventContextRef& ec) const {
+  // The subscription may supply a required event mask.
+  if (sc->mask != 0 && !(ec->event->mask & sc->mask)) {
+    return false;
+  }
+
+  // Every subscription is indexed when the publisher is configured.
+  if (ec->matcher == nullptr || !ec->matcher->indexed(sc.get())) {
+    return false;
+  }
+  return std::binary_search(ec->matches.begin(), ec->matches.end(), sc.get());
+}
+
+void FANotifyEventPublisher::removeSubscriptions(
+    const std::string& subscriber) {
+  if (isHandleOpen()) {
+    WriteLock lock(mutex_);
+    ::fanotify_mark(fanotify_handle_,
+                    FAN_MARK_FLUSH | FAN_MARK_FILESYSTEM,
+                    0,
+                    AT_FDCWD,
+                    nullptr);
+    ::fanotify_mark(fanotify_handle_,
+                    FAN_MARK_FLUSH | FAN_MARK_MOUNT,
+                    0,
+                    AT_FDCWD,
+                    nullptr);
+    marks_.clear();
+  }
+  EventPublisherPlugin::removeSubscriptions(subscriber);
+}
+}
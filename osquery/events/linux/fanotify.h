@@ -0,0 +1,114 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <map>
+
+#include <sys/fanotify.h>
+
+#include <osquery/events.h>
+
+#include "osquery/events/linux/inotify.h"
+
+namespace osquery {
+
+/**
+ * @brief A Linux `fanotify` EventPublisher for whole-filesystem monitoring.
+ *
+ * This EventPublisher uses the INotifySubscriptionContext and
+ * INotifyEventContext of the INotifyEventPublisher, so subscribers written
+ * for `inotify` may receive events from either publisher, see
+ * --disable_fanotify.
+ *
+ * Rather than a watch per directory, a single mark is added for each
+ * filesystem (or mount, on older kernels) containing a subscribed path.
+ * The kernel filters events by the union of the subscription masks and the
+ * publisher matches event paths against the subscriptions in userspace,
+ * using the same INotifyPathMatcher as the `inotify` publisher.
+ *
+ * Notification-class fanotify does not report directory entry changes, only
+ * updates, accesses and opens of files are published.
+ */
+class FANotifyEventPublisher
+    : public EventPublisher<INotifySubscriptionContext, INotifyEventContext> {
+  DECLARE_PUBLISHER("fanotify");
+
+ public:
+  /// Create the `fanotify` notification group.
+  Status setUp() override;
+
+  /// Mark the filesystems containing subscribed paths and index the paths.
+  void configure() override;
+
+  /// Release the `fanotify` notification group.
+  void tearDown() override;
+
+  /// Read and publish filesystem events.
+  Status run() override;
+
+  /// The `fanotify` notification group is readable when events are queued.
+  int getDescriptor() const override { return fanotify_handle_; }
+
+  /// Remove all marks and subscriptions.
+  void removeSubscriptions(const std::string& subscriber) override;
+
+ public:
+  /// Translate `inotify` subscription masks to the `fanotify` event mask.
+  static uint64_t getMarkMask(uint32_t mask);
+
+  /// Translate a `fanotify` event mask to the equivalent `inotify` mask.
+  static uint32_t getINotifyMask(uint64_t mask);
+
+ private:
+  /// Create an event context from a `fanotify` event and its file.
+  INotifyEventContextRef createEventContextFrom(uint64_t mask,
+                                                const std::string& path) const;
+
+  /**
+   * @brief Prepare a subscription's path for matching.
+   *
+   * Applies the path conventions of the INotifyEventPublisher: a "**" suffix
+   * requests a recursive match and directories end with a "/".
+   */
+  void optimizeSubscription(INotifySubscriptionContextRef& sc) const;
+
+  /// The existing directory before any wildcard in a path, used to mark.
+  static std::string getMarkPath(const std::string& path);
+
+  /// Mark the filesystem containing a path for the masked events.
+  bool addMark(const std::string& path, uint64_t mask);
+
+  /// Given a SubscriptionContext and INotifyEventContext match path and action.
+  bool shouldFire(const INotifySubscriptionContextRef& sc,
+                  const INotifyEventContextRef& ec) const override;
+
+  /// Check if the `fanotify` notification group is open.
+  bool isHandleOpen() const { return fanotify_handle_ > 0; }
+
+ private:
+  /// The `fanotify` notification group descriptor.
+  std::atomic<int> fanotify_handle_{-1};
+
+  /// The marked devices with their marked event masks.
+  std::map<dev_t, uint64_t> marks_;
+
+  /// The index of subscription paths, replaced when configured.
+  std::shared_ptr<const INotifyPathMatcher> matcher_{nullptr};
+
+  /// Access to the marks.
+  mutable Mutex mutex_;
+
+ public:
+  FRIEND_TEST(FANotifyTests, test_fanotify_mark_path);
+  FRIEND_TEST(FANotifyTests, test_fanotify_optimize_subscription);
+  FRIEND_TEST(FANotifyTests, test_fanotify_should_fire);
+};
+}
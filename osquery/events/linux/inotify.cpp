@@ -8,11 +8,21 @@
  *
  */
 
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
 #include <sstream>
+#include <thread>
+#include <unordered_set>
 
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <fnmatch.h>
 #include <linux/limits.h>
+#include <stdlib.h>
 
+#include <boost/algorithm/string/trim.hpp>
 #include <boost/filesystem.hpp>
 
 #include <osquery/filesystem.h>
@@ -25,10 +35,28 @@ namespace fs = boost::filesystem;
 
 namespace osquery {
 
+/// Repeated events for a path and action may be merged into one event.
+FLAG(uint64,
+     inotify_coalesce_milli,
+     0,
+     "Merge repeated inotify events for a path within this many milliseconds");
+
+/// Recursive watches are added by several threads walking the directories.
+FLAG(uint64,
+     inotify_walk_threads,
+     4,
+     "Threads walking directories to add recursive inotify watches");
+
 static const int kINotifyMLatency = 200;
 static const uint32_t kINotifyBufferSize =
     (10 * ((sizeof(struct inotify_event)) + NAME_MAX + 1));
 
+/// The read buffer doubles after each overflow, up to this size.
+static const uint32_t kINotifyMaxBufferSize = 32 * kINotifyBufferSize;
+
+/// Rescan the roots at most once within this many seconds.
+static const int kINotifyRescanInterval = 10;
+
 std::map<int, std::string> kMaskActions = {
     {IN_ACCESS, "ACCESSED"},       {IN_ATTRIB, "ATTRIBUTES_MODIFIED"},
     {IN_CLOSE_WRITE, "UPDATED"},   {IN_CREATE, "CREATED"},
@@ -42,9 +70,122 @@ const uint32_t kFileDefaultMasks = IN_MOVED_TO | IN_MOVED_FROM | IN_MODIFY |
                                    IN_ATTRIB;
 const uint32_t kFileAccessMasks = IN_OPEN | IN_ACCESS;
 
+/// The per-user inotify watch budget.
+static const std::string kINotifyMaxWatches =
+    "/proc/sys/fs/inotify/max_user_watches";
+
+/// Report a recursive walk's progress every this many directories.
+static const size_t kINotifyWalkProgress = 10000;
+
 REGISTER(INotifyEventPublisher, "event_publisher", "inotify");
 
+void INotifyEventCoalescer::add(const INotifyEventContextRef& ec,
+                                Clock::time_point now,
+                                INotifyEventContextVector& ready) {
+  if (window_.count() == 0) {
+    ready.push_back(ec);
+    return;
+  }
+
+  auto pending = pending_.find(ec->path);
+  if (pending != pending_.end()) {
+    auto& held = pending->second.ec;
+    if (held->action == ec->action) {
+      held->count += ec->count;
+      held->event->mask |= ec->event->mask;
+      return;
+    }
+    // A different action ends the held event for this path.
+    ready.push_back(held);
+    pending_.erase(pending);
+  }
+
+  // The event time is when the first event arrived, not when it is fired.
+  if (ec->time == 0) {
+    ec->time = getUnixTime();
+  }
+  PendingEvent held;
+  held.ec = ec;
+  held.first = now;
+  held.sequence = sequence_++;
+  pending_.emplace(ec->path, std::move(held));
+}
+
+void INotifyEventCoalescer::expire(Clock::time_point now,
+                                   INotifyEventContextVector& ready) {
+  std::vector<std::pair<size_t, INotifyEventContextRef>> expired;
+  for (auto it = pending_.begin(); it != pending_.end();) {
+    if (now - it->second.first >= window_) {
+      expired.push_back(std::make_pair(it->second.sequence, it->second.ec));
+      it = pending_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  std::sort(expired.begin(),
+            expired.end(),
+            [](const std::pair<size_t, INotifyEventContextRef>& l,
+               const std::pair<size_t, INotifyEventContextRef>& r) {
+              return l.first < r.first;
+            });
+  for (const auto& event : expired) {
+    ready.push_back(event.second);
+  }
+}
+
+/**
+ * @brief Match watched paths against a set of roots.
+ *
+ * A watch belongs to a root with its path, or to a recursive root that is a
+ * parent directory of its path. Recursive roots are also matched by their
+ * canonical path, which the walk below them uses.
+ */
+class INotifyRootMatcher : private boost::noncopyable {
+ public:
+  explicit INotifyRootMatcher(const INotifyRootMap& roots) {
+    for (const auto& root : roots) {
+      const auto& path = root.first.first;
+      paths_.insert(path);
+      if (!root.first.second || path.empty()) {
+        continue;
+      }
+
+      parents_.insert((path.back() == '/') ? path : path + '/');
+      boost::system::error_code ec;
+      auto canonical = fs::canonical(path, ec).string();
+      if (!ec && !canonical.empty()) {
+        parents_.insert((canonical.back() == '/') ? canonical
+                                                  : canonical + '/');
+      }
+    }
+  }
+
+  /// Check if a watched path belongs to any of the roots.
+  bool matches(const std::string& path) const {
+    if (paths_.count(path) > 0) {
+      return true;
+    }
+    for (auto i = path.find('/'); i != std::string::npos && i + 1 < path.size();
+         i = path.find('/', i + 1)) {
+      if (parents_.count(path.substr(0, i + 1)) > 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+ private:
+  /// Each root's path.
+  std::unordered_set<std::string> paths_;
+
+  /// The directories of recursive roots, with a trailing slash.
+  std::unordered_set<std::string> parents_;
+};
+
 Status INotifyEventPublisher::setUp() {
+  coalescer_.setWindow(FLAGS_inotify_coalesce_milli);
+  buffer_.resize(kINotifyBufferSize);
   inotify_handle_ = ::inotify_init();
   // If this does not work throw an exception.
   if (inotify_handle_ == -1) {
@@ -55,6 +196,28 @@ Status INotifyEventPublisher::setUp() {
 
 bool INotifyEventPublisher::monitorSubscription(
     INotifySubscriptionContextRef& sc, bool add_watch) {
+  INotifyRootMap roots;
+  addSubscriptionRoots(sc, roots);
+  bool added = true;
+  for (const auto& root : roots) {
+    added = addMonitor(
+                root.first.first, root.second, root.first.second, add_watch) &&
+            added;
+  }
+  return added;
+}
+
+/// Add a root, the masks of subscriptions sharing a root are combined.
+static void addRoot(INotifyRootMap& roots,
+                    const std::string& path,
+                    uint32_t mask,
+                    bool recursive) {
+  roots[std::make_pair(path, recursive)] |=
+      (mask == 0) ? kFileDefaultMasks : mask;
+}
+
+void INotifyEventPublisher::addSubscriptionRoots(
+    INotifySubscriptionContextRef& sc, INotifyRootMap& roots) {
   sc->discovered_ = sc->path;
   if (sc->path.find("**") != std::string::npos) {
     sc->recursive = true;
@@ -76,10 +239,10 @@ bool INotifyEventPublisher::monitorSubscription(
       std::vector<std::string> paths;
       resolveFilePattern(sc->discovered_, paths);
       for (const auto& _path : paths) {
-        addMonitor(_path, sc->mask, sc->recursive, add_watch);
+        addRoot(roots, _path, sc->mask, sc->recursive);
       }
       sc->recursive_match = sc->recursive;
-      return true;
+      return;
     }
   }
 
@@ -87,89 +250,194 @@ bool INotifyEventPublisher::monitorSubscription(
     sc->path += '/';
     sc->discovered_ += '/';
   }
-  return addMonitor(sc->discovered_, sc->mask, sc->recursive, add_watch);
+  addRoot(roots, sc->discovered_, sc->mask, sc->recursive);
 }
 
 void INotifyEventPublisher::configure() {
+  // Anytime a configure is called, find the roots of all subscriptions.
+  // Configure is called as a response to removing/adding subscriptions, the
+  // watches are changed by the difference to the previous roots.
+  INotifyRootMap roots;
+  auto matcher = std::make_shared<INotifyPathMatcher>();
   for (auto& sub : subscriptions_) {
-    // Anytime a configure is called, try to monitor all subscriptions.
-    // Configure is called as a response to removing/adding subscriptions.
-    // This means recalculating all monitored paths.
     auto sc = getSubscriptionContext(sub->context);
-    if (sc->discovered_.size() > 0) {
+    addSubscriptionRoots(sc, roots);
+    // Index the optimized path, events are matched against all subscriptions.
+    matcher->add(sc);
+  }
+  reconcileMonitors(roots);
+  std::atomic_store(&matcher_,
+                    std::shared_ptr<const INotifyPathMatcher>(matcher));
+}
+
+void INotifyEventPublisher::reconcileMonitors(const INotifyRootMap& roots) {
+  INotifyRootMap previous;
+  {
+    WriteLock lock(mutex_);
+    previous.swap(roots_);
+    roots_ = roots;
+  }
+
+  // Remove the watches only belonging to roots that were removed.
+  INotifyRootMap removed;
+  for (const auto& root : previous) {
+    if (roots.count(root.first) == 0) {
+      removed.insert(root);
+    }
+  }
+  if (!removed.empty()) {
+    INotifyRootMatcher removed_roots(removed);
+    INotifyRootMatcher current_roots(roots);
+    std::vector<std::string> paths;
+    {
+      WriteLock lock(mutex_);
+      for (const auto& watch : path_descriptors_) {
+        if (removed_roots.matches(watch.first) &&
+            !current_roots.matches(watch.first)) {
+          paths.push_back(watch.first);
+        }
+      }
+    }
+    for (const auto& path : paths) {
+      removeMonitor(path, true);
+    }
+    VLOG(1) << "Removed " << paths.size() << " inotify watches of "
+            << removed.size() << " removed paths";
+  }
+
+  for (const auto& root : roots) {
+    const auto& path = root.first.first;
+    auto known = previous.find(root.first);
+    bool watched = false;
+    {
+      WriteLock lock(mutex_);
+      watched = path_descriptors_.count(path) > 0;
+    }
+    if (known == previous.end() || !watched) {
+      // A new root, or one whose watch was removed.
+      addMonitor(path, root.second, root.first.second);
+      continue;
+    }
+    if (known->second == root.second) {
       continue;
     }
-    monitorSubscription(sc);
+
+    // Add the new mask to the root's existing watches.
+    for (const auto& watch : getRootMonitors(root)) {
+      ::inotify_add_watch(
+          getHandle(), watch.c_str(), root.second | IN_MASK_ADD);
+    }
   }
 }
 
-void INotifyEventPublisher::tearDown() {
-  ::close(inotify_handle_);
-  inotify_handle_ = -1;
-}
+std::vector<std::string> INotifyEventPublisher::getRootMonitors(
+    const INotifyRootMap::value_type& root) const {
+  INotifyRootMap roots;
+  roots.insert(root);
+  INotifyRootMatcher matcher(roots);
 
-Status INotifyEventPublisher::restartMonitoring() {
-  if (last_restart_ != 0 && getUnixTime() - last_restart_ < 10) {
-    return Status(1, "Overflow");
+  std::vector<std::string> paths;
+  WriteLock lock(mutex_);
+  for (const auto& watch : path_descriptors_) {
+    if (matcher.matches(watch.first)) {
+      paths.push_back(watch.first);
+    }
   }
+  return paths;
+}
 
+void INotifyEventPublisher::recoverOverflow() {
   last_restart_ = getUnixTime();
-  VLOG(1) << "inotify was overflown, attempting to restart handle";
-
-  // Create a copy of the descriptors, then remove each.
-  auto descriptors = descriptors_;
-  for (const auto& desc : descriptors) {
-    removeMonitor(desc, true);
-  }
+  overflowed_ = false;
 
+  INotifyRootMap roots;
   {
-    // Then remove all path/descriptor mappings.
     WriteLock lock(mutex_);
-    path_descriptors_.clear();
-    descriptor_paths_.clear();
+    roots = roots_;
   }
 
-  // Reconfigure ourself, the subscribers will not reconfigure.
-  configure();
-  return Status(0, "OK");
+  size_t removed = 0;
+  for (const auto& root : roots) {
+    if (!root.first.second) {
+      continue;
+    }
+
+    // Watches of directories removed while events were dropped.
+    for (const auto& directory : getRootMonitors(root)) {
+      if (!isDirectory(directory).ok()) {
+        removeMonitor(directory, true);
+        removed++;
+      }
+    }
+
+    // Watch directories created while events were dropped.
+    addMonitor(root.first.first, root.second, true);
+  }
+  VLOG(1) << "Rescanned inotify watches after an overflow, removed " << removed
+          << " watches of removed directories";
+}
+
+void INotifyEventPublisher::tearDown() {
+  ::close(inotify_handle_);
+  inotify_handle_ = -1;
+}
+
+int INotifyEventPublisher::getDescriptor() const {
+  // Held events are released by a read timeout, which needs a run loop.
+  return (FLAGS_inotify_coalesce_milli > 0) ? -1 : getHandle();
 }
 
 Status INotifyEventPublisher::run() {
+  // Rescan after an overflow, at most once within the rescan interval.
+  if (overflowed_ && getUnixTime() - last_restart_ >= kINotifyRescanInterval) {
+    recoverOverflow();
+  }
+
   // Get a while wrapper for free.
-  char buffer[kINotifyBufferSize];
+  if (buffer_.empty()) {
+    buffer_.resize(kINotifyBufferSize);
+  }
   fd_set set;
 
   FD_ZERO(&set);
   FD_SET(getHandle(), &set);
 
+  // Wake to release coalesced events once their window passes.
   struct timeval timeout = {1, 0};
+  if (!coalescer_.empty() && FLAGS_inotify_coalesce_milli < 1000) {
+    timeout.tv_sec = 0;
+    timeout.tv_usec = FLAGS_inotify_coalesce_milli * 1000;
+  }
+
   int selector = ::select(getHandle() + 1, &set, nullptr, nullptr, &timeout);
   if (selector == -1) {
     LOG(WARNING) << "Could not read inotify handle";
     return Status(1, "INotify handle failed");
   }
 
+  INotifyEventContextVector ready;
   if (selector == 0) {
     // Read timeout.
+    coalescer_.expire(INotifyEventCoalescer::Clock::now(), ready);
+    for (const auto& ec : ready) {
+      fire(ec);
+    }
     return Status(0, "Continue");
   }
-  ssize_t record_num = ::read(getHandle(), buffer, kINotifyBufferSize);
+  char* buffer = buffer_.data();
+  ssize_t record_num = ::read(getHandle(), buffer, buffer_.size());
   if (record_num == 0 || record_num == -1) {
     return Status(1, "INotify read failed");
   }
 
+  bool overflow = false;
   for (char* p = buffer; p < buffer + record_num;) {
     // Cast the inotify struct, make shared pointer, and append to contexts.
     auto event = reinterpret_cast<struct inotify_event*>(p);
     if (event->mask & IN_Q_OVERFLOW) {
-      // The inotify queue was overflown (remove all paths).
-      Status stat = restartMonitoring();
-      if (!stat.ok()) {
-        return stat;
-      }
-    }
-
-    if (event->mask & IN_IGNORED) {
+      // Events were dropped, read more at once and rescan the recursive roots.
+      overflow = true;
+    } else if (event->mask & IN_IGNORED) {
       // This inotify watch was removed.
       removeMonitor(event->wd, false);
     } else if (event->mask & IN_MOVE_SELF) {
@@ -181,13 +449,29 @@ Status INotifyEventPublisher::run() {
     } else {
       auto ec = createEventContextFrom(event);
       if (!ec->action.empty()) {
-        fire(ec);
+        coalescer_.add(ec, INotifyEventCoalescer::Clock::now(), ready);
       }
     }
     // Continue to iterate
     p += (sizeof(struct inotify_event)) + event->len;
   }
 
+  coalescer_.expire(INotifyEventCoalescer::Clock::now(), ready);
+  for (const auto& ec : ready) {
+    fire(ec);
+  }
+
+  if (overflow) {
+    if (!overflowed_) {
+      LOG(WARNING) << "The inotify event queue overflowed";
+    }
+    overflowed_ = true;
+    if (buffer_.size() < kINotifyMaxBufferSize) {
+      buffer_.resize(std::min(buffer_.size() * 2,
+                              static_cast<size_t>(kINotifyMaxBufferSize)));
+    }
+  }
+
   pauseMilli(kINotifyMLatency);
   return Status(0, "OK");
 }
@@ -210,6 +494,12 @@ INotifyEventContextRef INotifyEventPublisher::createEventContextFrom(
       break;
     }
   }
+
+  // Match the path against every indexed subscription once.
+  ec->matcher = std::atomic_load(&matcher_);
+  if (ec->matcher != nullptr && !ec->action.empty()) {
+    ec->matcher->match(ec->path, ec->matches);
+  }
   return ec;
 }
 
@@ -220,7 +510,13 @@ bool INotifyEventPublisher::shouldFire(const INotifySubscriptionContextRef& sc,
     return false;
   }
 
-  if (sc->recursive && !sc->recursive_match) {
+  if (ec->matcher != nullptr && ec->matcher->indexed(sc.get())) {
+    // The publisher matched the event path when creating the event.
+    if (!std::binary_search(
+            ec->matches.begin(), ec->matches.end(), sc.get())) {
+      return false;
+    }
+  } else if (sc->recursive && !sc->recursive_match) {
     ssize_t found = ec->path.find(sc->path);
     if (found != 0) {
       return false;
@@ -269,18 +565,184 @@ bool INotifyEventPublisher::addMonitor(const std::string& path,
   }
 
   if (recursive && isDirectory(path).ok()) {
+    addRecursiveMonitors(path, mask, add_watch);
+  }
+
+  return true;
+}
+
+/// List the canonical paths of a directory's child directories.
+static void listChildDirectories(const std::string& path,
+                                 std::vector<std::string>& children) {
+  auto dir = ::opendir(path.c_str());
+  if (dir == nullptr) {
+    return;
+  }
+
+  // The parent is canonical, only symbolic links need to be resolved.
+  struct dirent* entry = nullptr;
+  while ((entry = ::readdir(dir)) != nullptr) {
+    std::string name = entry->d_name;
+    if (name == "." || name == "..") {
+      continue;
+    }
+
+    auto type = entry->d_type;
+    if (type == DT_UNKNOWN) {
+      // Some filesystems do not report entry types.
+      struct stat st;
+      if (::fstatat(::dirfd(dir), entry->d_name, &st, AT_SYMLINK_NOFOLLOW)) {
+        continue;
+      }
+      if (S_ISDIR(st.st_mode)) {
+        type = DT_DIR;
+      } else if (S_ISLNK(st.st_mode)) {
+        type = DT_LNK;
+      }
+    }
+
+    if (type == DT_DIR) {
+      children.push_back(path + name + '/');
+    } else if (type == DT_LNK) {
+      char resolved[PATH_MAX] = {0};
+      if (::realpath((path + name).c_str(), resolved) != nullptr &&
+          isDirectory(resolved).ok()) {
+        children.push_back(std::string(resolved) + '/');
+      }
+    }
+  }
+  ::closedir(dir);
+}
+
+void INotifyEventPublisher::addRecursiveMonitors(const std::string& path,
+                                                 uint32_t mask,
+                                                 bool add_watch) {
+  std::deque<std::string> pending;
+  std::unordered_set<std::string> seen;
+  std::mutex walk_mutex;
+  std::condition_variable walk_cv;
+  size_t active = 0;
+  size_t directories = 0;
+  size_t watches = 0;
+  bool exhausted = false;
+
+  // Each directory is walked once, even if reached through links.
+  boost::system::error_code ec;
+  auto root = fs::canonical(path, ec).string();
+  if (ec) {
+    return;
+  }
+  root += (root.back() == '/') ? "" : "/";
+  pending.push_back(root);
+  seen.insert(root);
+
+  auto walker = [&]() {
     std::vector<std::string> children;
-    // Get a list of children of this directory (requested recursive watches).
-    listDirectoriesInDirectory(path, children, true);
+    std::vector<std::pair<std::string, int>> added;
+    std::unique_lock<std::mutex> lock(walk_mutex);
+    while (true) {
+      walk_cv.wait(lock, [&]() {
+        return !pending.empty() || active == 0 || exhausted;
+      });
+      if (pending.empty() || exhausted) {
+        // Either every walker is idle with nothing pending, or watches ran out.
+        walk_cv.notify_all();
+        break;
+      }
+
+      auto directory = pending.front();
+      pending.pop_front();
+      active++;
+      lock.unlock();
+
+      children.clear();
+      listChildDirectories(directory, children);
+      lock.lock();
+      children.erase(std::remove_if(children.begin(),
+                                    children.end(),
+                                    [&seen](const std::string& child) {
+                                      return !seen.insert(child).second;
+                                    }),
+                     children.end());
+      lock.unlock();
+
+      {
+        // Skip children that are already watched.
+        WriteLock monitor_lock(mutex_);
+        children.erase(std::remove_if(children.begin(),
+                                      children.end(),
+                                      [this](const std::string& child) {
+                                        return path_descriptors_.count(child) >
+                                               0;
+                                      }),
+                       children.end());
+      }
+
+      added.clear();
+      bool no_space = false;
+      for (const auto& child : children) {
+        int watch = ::inotify_add_watch(
+            getHandle(),
+            child.c_str(),
+            ((mask == 0) ? kFileDefaultMasks : mask));
+        if (watch == -1 && errno == ENOSPC) {
+          no_space = true;
+          break;
+        } else if (add_watch && watch == -1) {
+          LOG(WARNING) << "Could not add inotify watch on: " << child;
+          continue;
+        }
+        added.push_back(std::make_pair(child, watch));
+      }
+
+      {
+        // Record the directory's watches in bulk.
+        WriteLock monitor_lock(mutex_);
+        for (const auto& watch : added) {
+          descriptors_.push_back(watch.second);
+          path_descriptors_[watch.first] = watch.second;
+          descriptor_paths_[watch.second] = watch.first;
+        }
+      }
 
-    boost::system::error_code ec;
-    for (const auto& child : children) {
-      auto canonicalized = fs::canonical(child, ec).string() + '/';
-      addMonitor(canonicalized, mask, false);
+      lock.lock();
+      for (const auto& child : children) {
+        pending.push_back(child);
+      }
+      active--;
+      watches += added.size();
+      exhausted = exhausted || no_space;
+      if (++directories % kINotifyWalkProgress == 0) {
+        VLOG(1) << "Walked " << directories << " directories below " << root
+                << " adding " << watches << " inotify watches";
+      }
+      walk_cv.notify_all();
     }
+  };
+
+  size_t threads = (FLAGS_inotify_walk_threads > 0)
+                       ? static_cast<size_t>(FLAGS_inotify_walk_threads)
+                       : 1;
+  std::vector<std::thread> walkers;
+  for (size_t i = 1; i < threads; i++) {
+    walkers.emplace_back(walker);
+  }
+  walker();
+  for (auto& thread : walkers) {
+    thread.join();
   }
 
-  return true;
+  // Report the watches used against the user's inotify budget.
+  std::string budget = "unknown";
+  if (readFile(kINotifyMaxWatches, budget).ok()) {
+    boost::trim(budget);
+  }
+  if (exhausted) {
+    LOG(WARNING) << "The inotify watch budget (" << budget << ") was exhausted "
+                 << "while adding recursive watches below: " << root;
+  }
+  VLOG(1) << "Added " << watches << " inotify watches below " << root << " ("
+          << numDescriptors() << " of " << budget << " used)";
 }
 
 bool INotifyEventPublisher::removeMonitor(const std::string& path, bool force) {
@@ -321,14 +783,6 @@ bool INotifyEventPublisher::removeMonitor(int watch, bool force) {
   return removeMonitor(path, force);
 }
 
-void INotifyEventPublisher::removeSubscriptions(const std::string& subscriber) {
-  auto paths = descriptor_paths_;
-  for (const auto& path : paths) {
-    removeMonitor(path.first, true);
-  }
-  EventPublisherPlugin::removeSubscriptions(subscriber);
-}
-
 bool INotifyEventPublisher::isPathMonitored(const std::string& path) const {
   WriteLock lock(mutex_);
   std::string parent_path;
@@ -10,7 +10,9 @@
 
 #pragma once
 
+#include <chrono>
 #include <map>
+#include <unordered_map>
 #include <vector>
 
 #include <sys/inotify.h>
@@ -18,6 +20,8 @@
 
 #include <osquery/events.h>
 
+#include "osquery/events/pathmatcher.h"
+
 namespace osquery {
 
 extern std::map<int, std::string> kMaskActions;
@@ -73,6 +77,23 @@ struct INotifySubscriptionContext : public SubscriptionContext {
 
  private:
   friend class INotifyEventPublisher;
+  friend class INotifyPathMatcher;
+  friend class FANotifyEventPublisher;
+};
+
+using INotifySubscriptionContextRef =
+    std::shared_ptr<INotifySubscriptionContext>;
+
+/// Subscriptions matching an event path, sorted by address.
+using INotifyMatchVector = PathMatchVector;
+
+/// The shared path index, see PathMatcher, for inotify subscriptions.
+class INotifyPathMatcher : public PathMatcher {
+ public:
+  /// Index a subscription, after its path was optimized by configure.
+  void add(const INotifySubscriptionContextRef& sc) {
+    PathMatcher::add(sc, sc->path, sc->recursive, sc->recursive_match);
+  }
 };
 
 /**
@@ -90,17 +111,76 @@ struct INotifyEventContext : public EventContext {
 
   /// A no-op event transaction id.
   uint32_t transaction_id{0};
+
+  /// The publisher's path index when the event was created.
+  std::shared_ptr<const INotifyPathMatcher> matcher{nullptr};
+
+  /// The indexed subscriptions matching the event path.
+  INotifyMatchVector matches;
+
+  /// The number of events for the path and action merged into this event.
+  size_t count{1};
 };
 
 using INotifyEventContextRef = std::shared_ptr<INotifyEventContext>;
-using INotifySubscriptionContextRef =
-    std::shared_ptr<INotifySubscriptionContext>;
+using INotifyEventContextVector = std::vector<INotifyEventContextRef>;
+
+/**
+ * @brief Merge repeated events for a path and action within a time window.
+ *
+ * A large write to a single file produces a burst of IN_MODIFY events. With a
+ * window, see --inotify_coalesce_milli, the first event for a path is held and
+ * later events with the same action increment its count. The held event is
+ * released once the window passes or when an event with a different action
+ * arrives for the path, keeping the order of actions for each path.
+ */
+class INotifyEventCoalescer : private boost::noncopyable {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  /// Set the window in milliseconds, 0 releases every event immediately.
+  void setWindow(size_t milli) { window_ = std::chrono::milliseconds(milli); }
+
+  /// Check if events are held within the window.
+  bool empty() const { return pending_.empty(); }
+
+  /// Add an event, events that can no longer be merged are added to ready.
+  void add(const INotifyEventContextRef& ec,
+           Clock::time_point now,
+           INotifyEventContextVector& ready);
+
+  /// Add events held for the window to ready, in the order they arrived.
+  void expire(Clock::time_point now, INotifyEventContextVector& ready);
+
+ private:
+  /// An event held since its first occurrence.
+  struct PendingEvent {
+    INotifyEventContextRef ec;
+    Clock::time_point first;
+    size_t sequence{0};
+  };
+
+  /// The held event for each path.
+  std::unordered_map<std::string, PendingEvent> pending_;
+
+  /// Arrival order of held events.
+  size_t sequence_{0};
+
+  /// The coalescing window.
+  std::chrono::milliseconds window_{0};
+};
 
 // Publisher containers
 using DescriptorVector = std::vector<int>;
 using PathDescriptorMap = std::map<std::string, int>;
 using DescriptorPathMap = std::map<int, std::string>;
 
+/// A path to watch, and whether its subdirectories are also watched.
+using INotifyRoot = std::pair<std::string, bool>;
+
+/// The watch mask of each root the subscriptions need.
+using INotifyRootMap = std::map<INotifyRoot, uint32_t>;
+
 /**
  * @brief A Linux `inotify` EventPublisher.
  *
@@ -130,8 +210,8 @@ class INotifyEventPublisher
   /// The calling for beginning the thread's run loop.
   Status run() override;
 
-  /// Remove all monitors and subscriptions.
-  void removeSubscriptions(const std::string& subscriber) override;
+  /// The inotify handle, unless coalesced events must be expired.
+  int getDescriptor() const override;
 
  private:
   /// Helper/specialized event context creation.
@@ -164,10 +244,54 @@ class INotifyEventPublisher
                   bool recursive,
                   bool add_watch = true);
 
+  /**
+   * @brief Add INotify watches to every directory below a path.
+   *
+   * Directories are walked iteratively by --inotify_walk_threads threads.
+   * Each directory is listed once, only symbolic links are canonicalized, and
+   * the watches added for a directory's children are recorded together.
+   * The walk stops if the inotify watch budget is exhausted.
+   */
+  void addRecursiveMonitors(const std::string& path,
+                            uint32_t mask,
+                            bool add_watch);
+
   /// Helper method to parse a subscription and add an equivalent monitor.
   bool monitorSubscription(INotifySubscriptionContextRef& sc,
                            bool add_watch = true);
 
+  /**
+   * @brief Optimize a subscription's path and add the roots it watches.
+   *
+   * Patterns within the path's directories are resolved, each match is a
+   * root. This may be repeated, a subscription's path is only optimized once.
+   */
+  void addSubscriptionRoots(INotifySubscriptionContextRef& sc,
+                            INotifyRootMap& roots);
+
+  /**
+   * @brief Change the watches to those of a new set of roots.
+   *
+   * Only the difference is applied. Watches shared with a remaining root are
+   * kept, as are the descriptors of roots in both sets, and only new roots are
+   * walked. A root whose mask changed has the new mask added to its watches.
+   */
+  void reconcileMonitors(const INotifyRootMap& roots);
+
+  /**
+   * @brief Rescan the recursive roots after the inotify queue overflowed.
+   *
+   * The watches survive an overflow but the events were dropped, such as the
+   * creation of a directory that needs a watch. Watches of directories that
+   * were removed are dropped and new directories below each recursive root
+   * are watched; other roots are not affected.
+   */
+  void recoverOverflow();
+
+  /// The watched paths belonging to a root.
+  std::vector<std::string> getRootMonitors(
+      const INotifyRootMap::value_type& root) const;
+
   /// Remove an INotify watch (monitor) from our tracking.
   bool removeMonitor(const std::string& path, bool force = false);
   bool removeMonitor(int watch, bool force = false);
@@ -182,22 +306,34 @@ class INotifyEventPublisher
   /// Get the number of actual INotify active descriptors.
   size_t numDescriptors() const { return descriptors_.size(); }
 
-  /// If we overflow, try and restart the monitor
-  Status restartMonitoring();
-
-  // Consider an event queue if separating buffering from firing/servicing.
+  // Subscribers may service fired events on a queue, see events_queue_size.
   DescriptorVector descriptors_;
 
+  /// The index of subscription paths, replaced when configured.
+  std::shared_ptr<const INotifyPathMatcher> matcher_{nullptr};
+
+  /// Repeated events are merged before firing, used by the run loop only.
+  INotifyEventCoalescer coalescer_;
+
   /// Map of watched path string to inotify watch file descriptor.
   PathDescriptorMap path_descriptors_;
 
   /// Map of inotify watch file descriptor to watched path string.
   DescriptorPathMap descriptor_paths_;
 
+  /// The roots of the configured subscriptions.
+  INotifyRootMap roots_;
+
+  /// The read buffer, which grows when the inotify queue overflows.
+  std::vector<char> buffer_;
+
+  /// Set when the queue overflowed until the roots are rescanned.
+  bool overflowed_{false};
+
   /// The inotify file descriptor handle.
   std::atomic<int> inotify_handle_{-1};
 
-  /// Time in seconds of the last inotify restart.
+  /// Time in seconds of the last rescan after an overflow.
   std::atomic<int> last_restart_{-1};
 
   /// Access to path and descriptor mappings.
@@ -210,5 +346,8 @@ class INotifyEventPublisher
   FRIEND_TEST(INotifyTests, test_inotify_recursion);
   FRIEND_TEST(INotifyTests, test_inotify_match_subscription);
   FRIEND_TEST(INotifyTests, test_inotify_embedded_wildcards);
+  FRIEND_TEST(INotifyTests, test_inotify_path_matcher);
+  FRIEND_TEST(INotifyTests, test_inotify_reconfigure);
+  FRIEND_TEST(INotifyTests, test_inotify_overflow_rescan);
 };
 }
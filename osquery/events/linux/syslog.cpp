@@ -8,22 +8,24 @@
  *
  */
 
+#include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <grp.h>
+#include <string.h>
 #include <sys/file.h>
+#include <sys/select.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
 
-#include <istream>
 #include <string>
 
 #include <boost/algorithm/string/trim.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/property_tree/json_parser.hpp>
-#include <boost/tokenizer.hpp>
 
 #include <osquery/logger.h>
 #include <osquery/filesystem.h>
@@ -48,9 +50,14 @@ const std::string kPipeGroupName = "syslog";
 const char* kTimeFormat = "%Y-%m-%dT%H:%M:%S";
 const std::vector<std::string> kCsvFields = {"time",     "host", "severity",
                                              "facility", "tag",  "message"};
-const size_t kMaxLogsPerRun = 10;
 const size_t kErrorThreshold = 10;
 
+/// Size of the pipe read buffer, the longest line that can be read.
+const size_t kSyslogBufferSize = 256 * 1024;
+
+/// Reads of a full buffer per run, to periodically check for an end.
+const size_t kSyslogMaxReadsPerRun = 64;
+
 Status SyslogEventPublisher::setUp() {
   Status s;
   if (!pathExists(FLAGS_syslog_pipe_path)) {
@@ -76,14 +83,15 @@ Status SyslogEventPublisher::setUp() {
 
   // Opening with both flags appears to be the only way to open the pipe
   // without blocking for a writer. We won't ever write to the pipe, but we
-  // don't want to block here and will instead block waiting for a read in the
-  // run() method
-  readStream_.open(FLAGS_syslog_pipe_path,
-                   std::ifstream::in | std::ifstream::out);
-  if (!readStream_.good()) {
+  // don't want to block here and will instead wait for a read in the run()
+  // method
+  readFd_ = ::open(
+      FLAGS_syslog_pipe_path.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+  if (readFd_ == -1) {
     return Status(1,
                   "Error opening pipe for reading: " + FLAGS_syslog_pipe_path);
   }
+  buffer_.resize(kSyslogBufferSize);
   VLOG(1) << "Successfully opened pipe for syslog ingestion";
 
   return Status(0, "OK");
@@ -137,63 +145,177 @@ void SyslogEventPublisher::unlockPipe() {
 }
 
 Status SyslogEventPublisher::run() {
-  // This run function will be called by the event factory with ~100ms pause
-  // (see InterruptableRunnable::pause()) between runs. In case something goes
-  // weird and there is a huge amount of input, we limit how many logs we
-  // take in per run to avoid pegging the CPU.
-  for (size_t i = 0; i < kMaxLogsPerRun; ++i) {
-    if (readStream_.rdbuf()->in_avail() == 0) {
-      // If there is no pending data, we have flushed everything and can wait
-      // until the next time EventFactory calls run(). This also allows the
-      // thread to join when it is stopped by EventFactory.
-      return Status(0, "OK");
-    }
-    std::string line;
-    std::getline(readStream_, line);
-    auto ec = createEventContext();
-    Status status = populateEventContext(line, ec);
-    if (status.ok()) {
-      fire(ec);
-      if (errorCount_ > 0) {
-        --errorCount_;
+  fd_set set;
+  FD_ZERO(&set);
+  FD_SET(readFd_, &set);
+
+  struct timeval timeout = {1, 0};
+  int selector = ::select(readFd_ + 1, &set, nullptr, nullptr, &timeout);
+  if (selector == -1 && errno != EINTR) {
+    return Status(1, "Syslog pipe failed");
+  }
+
+  // Drain the pipe, each read may hold many lines.
+  for (size_t i = 0; selector > 0 && i < kSyslogMaxReadsPerRun; ++i) {
+    if (buffered_ == buffer_.size()) {
+      // The buffer holds part of a single line, drop the line.
+      buffered_ = 0;
+      if (!discarding_) {
+        dropped_++;
+        discarding_ = true;
       }
-    } else {
-      LOG(ERROR) << status.getMessage() << " in line: " << line;
-      ++errorCount_;
-      if (errorCount_ >= kErrorThreshold) {
-        return Status(1, "Too many errors in syslog parsing.");
+    }
+
+    auto size = ::read(
+        readFd_, buffer_.data() + buffered_, buffer_.size() - buffered_);
+    if (size < 0 && errno == EINTR) {
+      continue;
+    } else if (size <= 0) {
+      // The pipe would block.
+      break;
+    }
+
+    auto status = readLines(buffered_ + size);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+
+  if (dropped_ != dropped_logged_) {
+    LOG(WARNING) << "Syslog pipe dropped " << dropped_ - dropped_logged_
+                 << " lines longer than " << buffer_.size() << " bytes";
+    dropped_logged_ = dropped_;
+  }
+  return Status(0, "OK");
+}
+
+Status SyslogEventPublisher::readLines(size_t size) {
+  // Parse every complete line first, then publish them as a batch.
+  std::vector<SyslogEventContextRef> batch;
+  char* line = buffer_.data();
+  char* end = line + size;
+  char* next = nullptr;
+  while ((next = static_cast<char*>(memchr(line, '\n', end - line)))) {
+    if (discarding_) {
+      // The end of a dropped line.
+      discarding_ = false;
+    } else if (next > line) {
+      auto ec = createEventContext();
+      auto status = populateEventContext(line, next - line, ec);
+      if (status.ok()) {
+        batch.push_back(ec);
+        if (errorCount_ > 0) {
+          --errorCount_;
+        }
+      } else {
+        LOG(ERROR) << status.getMessage()
+                   << " in line: " << std::string(line, next - line);
+        ++errorCount_;
       }
     }
+    line = next + 1;
+  }
+
+  // Keep the incomplete line at the start of the buffer.
+  buffered_ = end - line;
+  if (line != buffer_.data() && buffered_ > 0) {
+    memmove(buffer_.data(), line, buffered_);
+  }
+
+  for (const auto& ec : batch) {
+    fire(ec);
+  }
+
+  if (errorCount_ >= kErrorThreshold) {
+    return Status(1, "Too many errors in syslog parsing.");
   }
   return Status(0, "OK");
 }
 
-void SyslogEventPublisher::tearDown() { unlockPipe(); }
+void SyslogEventPublisher::tearDown() {
+  if (readFd_ != -1) {
+    ::close(readFd_);
+    readFd_ = -1;
+  }
+  unlockPipe();
+}
+
+
+void splitRsyslogCsv(char* line,
+                     size_t size,
+                     std::vector<boost::string_ref>& fields) {
+  fields.clear();
+  if (size == 0) {
+    return;
+  }
+
+  // Unescaped characters are written behind the read position.
+  bool in_quote = false;
+  char* field = line;
+  char* out = line;
+  for (size_t i = 0; i < size; ++i) {
+    if (line[i] == ',' && !in_quote) {
+      fields.emplace_back(field, out - field);
+      field = out;
+    } else if (line[i] == '"') {
+      if (!in_quote) {
+        in_quote = true;
+      } else if (i + 1 < size && line[i + 1] == '"') {
+        // rsyslog escapes " with "", so reverse this by inserting "
+        *out++ = '"';
+        ++i;
+      } else {
+        in_quote = false;
+      }
+    } else {
+      *out++ = line[i];
+    }
+  }
+  fields.emplace_back(field, out - field);
+}
+
+/// Remove surrounding whitespace from a field.
+static void trimField(boost::string_ref& field) {
+  while (!field.empty() && isspace(static_cast<unsigned char>(field.front()))) {
+    field.remove_prefix(1);
+  }
+  while (!field.empty() && isspace(static_cast<unsigned char>(field.back()))) {
+    field.remove_suffix(1);
+  }
+}
 
 Status SyslogEventPublisher::populateEventContext(const std::string& line,
                                                   SyslogEventContextRef& ec) {
-  boost::tokenizer<RsyslogCsvSeparator> tokenizer(line);
-  auto key = kCsvFields.begin();
-  for (std::string value : tokenizer) {
-    if (key == kCsvFields.end()) {
-      return Status(1, "Received more fields than expected");
-    }
-    boost::trim(value);
-    if (*key == "time") {
-      ec->time = parseTimeString(value);
-    } else if (*key == "tag" && !value.empty() && value.back() == ':') {
+  std::vector<char> copy(line.begin(), line.end());
+  return populateEventContext(copy.data(), copy.size(), ec);
+}
+
+Status SyslogEventPublisher::populateEventContext(char* line,
+                                                  size_t size,
+                                                  SyslogEventContextRef& ec) {
+  std::vector<boost::string_ref> fields;
+  fields.reserve(kCsvFields.size() + 1);
+  splitRsyslogCsv(line, size, fields);
+  if (fields.size() > kCsvFields.size()) {
+    return Status(1, "Received more fields than expected");
+  } else if (fields.size() < kCsvFields.size()) {
+    return Status(1, "Received fewer fields than expected");
+  }
+
+  for (size_t i = 0; i < fields.size(); ++i) {
+    auto& value = fields[i];
+    const auto& key = kCsvFields[i];
+    trimField(value);
+    if (key == "time") {
+      ec->time = parseTimeString(value.to_string());
+    } else if (key == "tag" && !value.empty() && value.back() == ':') {
       // rsyslog sends "tag" with a trailing colon that we don't need
-      ec->fields.emplace(*key, value.substr(0, value.size() - 1));
+      ec->fields.emplace(key, value.substr(0, value.size() - 1).to_string());
     } else {
-      ec->fields.emplace(*key, value);
+      ec->fields.emplace(key, value.to_string());
     }
-    ++key;
-  }
-  if (key == kCsvFields.end()) {
-    return Status(0, "OK");
-  } else {
-    return Status(1, "Received fewer fields than expected");
   }
+  return Status(0, "OK");
 }
 
 time_t SyslogEventPublisher::parseTimeString(const std::string& time_str) {
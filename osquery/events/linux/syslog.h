@@ -12,10 +12,11 @@
 
 #include <stdio.h>
 
-#include <fstream>
 #include <map>
+#include <vector>
 
 #include <boost/property_tree/ptree.hpp>
+#include <boost/utility/string_ref.hpp>
 
 #include <osquery/events.h>
 
@@ -55,6 +56,10 @@ using SyslogSubscriptionContextRef = std::shared_ptr<SyslogSubscriptionContext>;
  * publishes them to it's subscribers. In order for it to function properly,
  * rsyslog must be configured to forward JSON to a named pipe that this
  * publisher will read from.
+ *
+ * The pipe is read with large non-blocking reads into a buffer. Each read
+ * pass splits every complete line in place and publishes the batch, so
+ * rsyslog is not blocked by a slow line-by-line reader.
  */
 class SyslogEventPublisher
     : public EventPublisher<SyslogSubscriptionContext, SyslogEventContext> {
@@ -69,8 +74,11 @@ class SyslogEventPublisher
 
   Status run() override;
 
- public:
-  SyslogEventPublisher() : EventPublisher(), errorCount_(0), lockFd_(-1) {}
+  /// The pipe is readable when rsyslog has forwarded lines.
+  int getDescriptor() const override { return readFd_; }
+
+  /// The number of lines dropped because they did not fit the read buffer.
+  size_t dropped() const { return dropped_; }
 
  private:
   /// Apply normal subscription to event matching logic.
@@ -114,15 +122,34 @@ class SyslogEventPublisher
   static Status populateEventContext(const std::string& line,
                                      SyslogEventContextRef& ec);
 
+  /// Populate the SyslogEventContext from a line, which is split in place.
+  static Status populateEventContext(char* line,
+                                     size_t size,
+                                     SyslogEventContextRef& ec);
+
+  /// Split and publish the complete lines in the read buffer.
+  Status readLines(size_t size);
+
   /**
    * @brief Parse a time string from rsyslog into time_t.
    */
   static time_t parseTimeString(const std::string& time_str);
 
-  /**
-   * @brief Input stream for reading from the pipe.
-   */
-  std::fstream readStream_;
+  /// Non-blocking descriptor for reading from the pipe.
+  int readFd_{-1};
+
+  /// Lines read from the pipe, the end may be an incomplete line.
+  std::vector<char> buffer_;
+
+  /// Bytes from the pipe waiting in the buffer for the end of their line.
+  size_t buffered_{0};
+
+  /// The buffer filled without a complete line, drop until the next line.
+  bool discarding_{false};
+
+  /// Lines dropped, and the count when last logged.
+  size_t dropped_{0};
+  size_t dropped_logged_{0};
 
   /**
    * @brief Counter used to shut down thread when too many errors occur.
@@ -132,19 +159,20 @@ class SyslogEventPublisher
    * thread will return a nonzero status and stop, preventing us from flooding
    * the logs when things are in a bad state.
    */
-  size_t errorCount_;
+  size_t errorCount_{0};
 
   /**
    * @brief File descriptor used to lock the pipe for reading.
    *
    * This fd should not be used for reading from the pipe, instead use
-   * readStream_.
+   * readFd_.
    */
-  int lockFd_;
+  int lockFd_{-1};
 
  private:
   FRIEND_TEST(SyslogTests, test_populate_event_context);
   FRIEND_TEST(SyslogTests, test_parse_time_string);
+  FRIEND_TEST(SyslogTests, test_read_lines);
 };
 
 /**
@@ -209,4 +237,19 @@ class RsyslogCsvSeparator {
  private:
   bool last_;
 };
+
+/**
+ * @brief Split a line of rsyslog CSV data in place.
+ *
+ * This follows the RsyslogCsvSeparator rules without copying each field:
+ * quoted fields are unescaped within the line, which only shrinks them, and
+ * the returned fields refer to the line.
+ *
+ * @param line The line, modified while splitting.
+ * @param size The size of the line.
+ * @param fields Output fields, referring to the line.
+ */
+void splitRsyslogCsv(char* line,
+                     size_t size,
+                     std::vector<boost::string_ref>& fields);
 }
@@ -26,7 +26,6 @@ extern bool handleAuditReply(const struct audit_reply& reply,
 
 /// Internal audit subscriber (process events) testable methods.
 extern std::string decodeAuditValue(const std::string& e);
-extern Status validAuditState(int type, AuditProcessEventState& state);
 
 /// Internal audit subscriber (socket events) testable methods.
 extern void parseSockAddr(const std::string& saddr, Row& r, bool local);
@@ -62,10 +61,47 @@ TEST_F(AuditTests, test_handle_reply) {
   EXPECT_EQ(ec->preamble, "audit(1440542781.644:403030)");
   EXPECT_EQ(ec->fields.size(), 4U);
   EXPECT_EQ(ec->fields.count("argc"), 1U);
-  EXPECT_EQ(ec->fields["argc"], "3");
-  EXPECT_EQ(ec->fields["a0"], "\"H=1 \"");
-  EXPECT_EQ(ec->fields["a1"], "\"/bin/sh\"");
-  EXPECT_EQ(ec->fields["a2"], "c");
+  EXPECT_EQ(ec->fields.get("argc"), "3");
+  EXPECT_EQ(ec->fields.get("a0"), "\"H=1 \"");
+  EXPECT_EQ(ec->fields.get("a1"), "\"/bin/sh\"");
+  EXPECT_EQ(ec->fields.get("a2"), "c");
+  EXPECT_EQ(ec->syscall, 0);
+}
+
+TEST_F(AuditTests, test_audit_fields) {
+  AuditFields fields;
+  std::string message =
+      "arch=c000003e  syscall=59 success=yes flag a1=\"x y\" a0=1 a0=2 "
+      "msg='op=PAM:auth acct=root' a2=\"open";
+  fields.parse(message.data(), message.size());
+
+  // Fields keep message order, repeated spaces are ignored.
+  ASSERT_EQ(fields.size(), 10U);
+  EXPECT_EQ(fields.key(0), "arch");
+  EXPECT_EQ(fields.value(0), "c000003e");
+  EXPECT_EQ(fields.key(3), "flag");
+  EXPECT_EQ(fields.value(3), "");
+
+  // Enclosed values include their quotes and spaces.
+  EXPECT_EQ(fields.get("a1"), "\"x y\"");
+  // The last of several fields with the same key is used.
+  EXPECT_EQ(fields.get("a0"), "2");
+  // An assignment within a value is part of the value.
+  EXPECT_EQ(fields.get("msg"), "'op=PAM:auth");
+  EXPECT_EQ(fields.get("acct"), "root'");
+  // An unterminated enclosure ends with the message.
+  EXPECT_EQ(fields.get("a2"), "\"open");
+
+  EXPECT_EQ(fields.count("syscall"), 1U);
+  EXPECT_EQ(fields.count("missing"), 0U);
+  EXPECT_EQ(fields.get("missing"), "");
+  EXPECT_THROW(fields.at("missing"), std::out_of_range);
+
+  // Parsing replaces the previous fields.
+  message = "pid=1";
+  fields.parse(message.data(), message.size());
+  EXPECT_EQ(fields.size(), 1U);
+  EXPECT_EQ(fields.at("pid"), "1");
 }
 
 TEST_F(AuditTests, test_audit_value_decode) {
@@ -82,59 +118,50 @@ TEST_F(AuditTests, test_audit_value_decode) {
   EXPECT_EQ(decoded_fail, "7");
 }
 
-TEST_F(AuditTests, test_valid_audit_state) {
-  AuditProcessEventState state = STATE_SYSCALL;
-
-  // The first state must be a syscall.
-  EXPECT_TRUE(validAuditState(STATE_SYSCALL, state));
-  EXPECT_EQ(state, STATE_EXECVE);
-
-  // Followed by an EXECVE, CWD, or PATH
-  EXPECT_TRUE(validAuditState(STATE_EXECVE, state));
-  EXPECT_EQ(state, STATE_CWD);
-  EXPECT_TRUE(validAuditState(STATE_CWD, state));
-  EXPECT_EQ(state, STATE_PATH);
-  EXPECT_TRUE(validAuditState(STATE_PATH, state));
-  // Finally, the state is reset to syscall.
-  EXPECT_EQ(state, STATE_SYSCALL);
-}
-
-TEST_F(AuditTests, test_valid_audit_state_exceptions) {
-  AuditProcessEventState state = STATE_SYSCALL;
-  validAuditState(STATE_SYSCALL, state);
-
-  // Now allow for other acceptable transitions.
-  EXPECT_TRUE(validAuditState(STATE_PATH, state));
-  EXPECT_EQ(state, STATE_SYSCALL);
-
-  state = STATE_SYSCALL;
-  validAuditState(STATE_SYSCALL, state);
-  EXPECT_TRUE(validAuditState(STATE_PATH, state));
-  EXPECT_EQ(state, STATE_SYSCALL);
+/// Create a record context for a type and serial.
+static AuditEventContextRef makeAuditRecord(int type,
+                                           const std::string& serial) {
+  auto ec = std::make_shared<AuditEventContext>();
+  ec->type = type;
+  ec->preamble = "audit(1440542781.644:" + serial + ")";
+  return ec;
 }
 
-TEST_F(AuditTests, test_valid_audit_state_failues) {
-  // Now check invalid states.
-  AuditProcessEventState state = STATE_SYSCALL;
-  EXPECT_FALSE(validAuditState(STATE_EXECVE, state));
-  EXPECT_FALSE(validAuditState(STATE_CWD, state));
-  EXPECT_FALSE(validAuditState(STATE_PATH, state));
-
-  // Two syscalls in a row: invalid.
-  state = STATE_SYSCALL;
-  validAuditState(STATE_SYSCALL, state);
-  EXPECT_FALSE(validAuditState(STATE_SYSCALL, state));
-
-  // A cwd must come after an exec.
-  state = STATE_SYSCALL;
-  validAuditState(STATE_SYSCALL, state);
-  EXPECT_FALSE(validAuditState(STATE_CWD, state));
-
-  // Two execs in a row: invalid.
-  state = STATE_SYSCALL;
-  validAuditState(STATE_SYSCALL, state);
-  validAuditState(STATE_EXECVE, state);
-  EXPECT_FALSE(validAuditState(STATE_EXECVE, state));
+TEST_F(AuditTests, test_correlate_records) {
+  AuditEventPublisher pub;
+  pub.correlate_ = true;
+
+  // Records sharing the syscall's serial are collected until the end record.
+  EXPECT_EQ(pub.correlateRecord(makeAuditRecord(AUDIT_SYSCALL, "1")), nullptr);
+  EXPECT_EQ(pub.correlateRecord(makeAuditRecord(AUDIT_EXECVE, "1")), nullptr);
+  // Records with other serials are not part of the event.
+  EXPECT_EQ(pub.correlateRecord(makeAuditRecord(AUDIT_USER, "2")), nullptr);
+  EXPECT_EQ(pub.correlateRecord(makeAuditRecord(AUDIT_PATH, "1")), nullptr);
+
+  auto ec = pub.correlateRecord(makeAuditRecord(AUDIT_EOE, "1"));
+  ASSERT_NE(ec, nullptr);
+  EXPECT_EQ(ec->type, AUDIT_SYSCALL);
+  ASSERT_EQ(ec->records.size(), 3U);
+  EXPECT_EQ(ec->records[0]->type, AUDIT_SYSCALL);
+  EXPECT_EQ(ec->records[1]->type, AUDIT_EXECVE);
+  EXPECT_EQ(ec->records[2]->type, AUDIT_PATH);
+  EXPECT_EQ(pub.endRecords(), nullptr);
+
+  // A syscall ends an event that is missing its end record.
+  pub.correlateRecord(makeAuditRecord(AUDIT_SYSCALL, "3"));
+  ec = pub.correlateRecord(makeAuditRecord(AUDIT_SYSCALL, "4"));
+  ASSERT_NE(ec, nullptr);
+  EXPECT_EQ(ec->records.size(), 1U);
+  EXPECT_EQ(ec->preamble, "audit(1440542781.644:3)");
+
+  // Only subscriptions requesting records receive correlated events.
+  auto sc = std::make_shared<AuditSubscriptionContext>();
+  sc->types = {AUDIT_SYSCALL};
+  EXPECT_FALSE(pub.shouldFire(sc, ec));
+  EXPECT_TRUE(pub.shouldFire(sc, makeAuditRecord(AUDIT_SYSCALL, "5")));
+  sc->records = true;
+  EXPECT_TRUE(pub.shouldFire(sc, ec));
+  EXPECT_FALSE(pub.shouldFire(sc, makeAuditRecord(AUDIT_SYSCALL, "5")));
 }
 
 TEST_F(AuditTests, test_parse_sock_addr) {
@@ -0,0 +1,158 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <string.h>
+
+#include <gtest/gtest.h>
+
+#include <osquery/events.h>
+
+#include "osquery/events/linux/bpf.h"
+
+namespace osquery {
+
+class BPFTests : public testing::Test {};
+
+/// Build a raw record as written by the BPF programs.
+static std::string makeBPFRecord(uint64_t type,
+                                 uint64_t pid_tgid,
+                                 int64_t value,
+                                 const std::string& data) {
+  std::string record(32, '\0');
+  uint64_t uid_gid = (20ULL << 32) | 10;
+  memcpy(&record[0], &type, sizeof(type));
+  memcpy(&record[8], &pid_tgid, sizeof(pid_tgid));
+  memcpy(&record[16], &uid_gid, sizeof(uid_gid));
+  if (type == BPF_RECORD_EXEC_ENTER) {
+    auto filename = data;
+    filename.resize(256, '\0');
+    record += filename;
+  } else {
+    record.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    if (!data.empty()) {
+      auto address = data;
+      address.resize(32, '\0');
+      record += address;
+    }
+  }
+  return record;
+}
+
+TEST_F(BPFTests, test_bpf_program_labels) {
+  BPFProgram p;
+  p.jumpImm(BPF_JEQ, BPF_REG_1, 0, "end");
+  p.movImm(BPF_REG_0, 1);
+  p.jump("end");
+  p.movImm(BPF_REG_0, 2);
+  p.label("end");
+  p.exit();
+  EXPECT_TRUE(p.resolve());
+
+  // Offsets are relative to the next instruction.
+  const auto& insns = p.instructions();
+  ASSERT_EQ(insns.size(), 5U);
+  EXPECT_EQ(insns[0].off, 3);
+  EXPECT_EQ(insns[2].off, 1);
+
+  BPFProgram missing;
+  missing.jump("none");
+  EXPECT_FALSE(missing.resolve());
+}
+
+TEST_F(BPFTests, test_bpf_programs) {
+  std::vector<BPFProgram> programs = {
+      BPFEventPublisher::genExecEnter(3),
+      BPFEventPublisher::genSyscallExit(BPF_RECORD_EXEC_EXIT, 3),
+      BPFEventPublisher::genSocketEnter(BPF_RECORD_CONNECT_ENTER, 3),
+      BPFEventPublisher::genAcceptEnter(4),
+      BPFEventPublisher::genAcceptExit(3, 4),
+  };
+
+  for (auto& p : programs) {
+    // Every label is defined and every program returns.
+    EXPECT_TRUE(p.resolve());
+    const auto& insns = p.instructions();
+    ASSERT_FALSE(insns.empty());
+    EXPECT_EQ(insns.back().code, BPF_JMP | BPF_EXIT);
+
+    for (size_t i = 0; i < insns.size(); i++) {
+      if (insns[i].code == (BPF_LD | BPF_DW | BPF_IMM)) {
+        // Map loads use two slots.
+        EXPECT_EQ(insns[i].src_reg, BPF_PSEUDO_MAP_FD);
+        ASSERT_LT(i + 1, insns.size());
+        EXPECT_EQ(insns[++i].code, 0);
+      } else if ((insns[i].code & 0x07) == BPF_JMP &&
+                 insns[i].code != (BPF_JMP | BPF_CALL) &&
+                 insns[i].code != (BPF_JMP | BPF_EXIT)) {
+        // Jumps stay within the program.
+        auto target = static_cast<int>(i) + 1 + insns[i].off;
+        EXPECT_GT(target, static_cast<int>(i));
+        EXPECT_LT(target, static_cast<int>(insns.size()));
+      }
+    }
+  }
+}
+
+TEST_F(BPFTests, test_bpf_parse_records) {
+  BPFRecord record;
+  auto raw = makeBPFRecord(BPF_RECORD_EXEC_ENTER, 1, 0, "/bin/ls");
+  ASSERT_TRUE(BPFEventPublisher::parseRecord(raw.data(), raw.size(), record));
+  EXPECT_EQ(record.type, static_cast<uint64_t>(BPF_RECORD_EXEC_ENTER));
+  EXPECT_EQ(record.data, "/bin/ls");
+  EXPECT_EQ(record.uid_gid & 0xffffffff, 10U);
+
+  // Raw samples may be padded.
+  raw = makeBPFRecord(BPF_RECORD_CONNECT_EXIT, 1, -115, "") + "\0\0\0\0";
+  ASSERT_TRUE(BPFEventPublisher::parseRecord(raw.data(), raw.size(), record));
+  EXPECT_EQ(record.value, -115);
+
+  raw = makeBPFRecord(BPF_RECORD_BIND_ENTER, 1, 5, "\x02");
+  ASSERT_TRUE(BPFEventPublisher::parseRecord(raw.data(), raw.size(), record));
+  EXPECT_EQ(record.value, 5);
+  EXPECT_EQ(record.data.size(), 32U);
+
+  // Truncated and unknown records are dropped.
+  EXPECT_FALSE(BPFEventPublisher::parseRecord(raw.data(), 16, record));
+  raw = makeBPFRecord(99, 1, 0, "");
+  EXPECT_FALSE(BPFEventPublisher::parseRecord(raw.data(), raw.size(), record));
+}
+
+TEST_F(BPFTests, test_bpf_pair_records) {
+  BPFEventPublisher pub;
+
+  // A thread's entry record waits for the thread's exit.
+  BPFRecord enter;
+  enter.type = BPF_RECORD_CONNECT_ENTER;
+  enter.pid_tgid = (100ULL << 32) | 101;
+  pub.handleRecord(std::move(enter));
+  EXPECT_EQ(pub.pending_.size(), 1U);
+
+  // The exit of another thread does not complete the event.
+  BPFRecord exit;
+  exit.type = BPF_RECORD_CONNECT_EXIT;
+  exit.pid_tgid = (100ULL << 32) | 102;
+  pub.handleRecord(std::move(exit));
+  EXPECT_EQ(pub.pending_.size(), 1U);
+
+  exit.type = BPF_RECORD_CONNECT_EXIT;
+  exit.pid_tgid = (100ULL << 32) | 101;
+  pub.handleRecord(std::move(exit));
+  EXPECT_EQ(pub.pending_.size(), 0U);
+
+  // A thread calling execve exits as the thread group leader.
+  enter.type = BPF_RECORD_EXEC_ENTER;
+  enter.pid_tgid = (100ULL << 32) | 101;
+  pub.handleRecord(std::move(enter));
+  exit.type = BPF_RECORD_EXEC_EXIT;
+  exit.pid_tgid = (100ULL << 32) | 100;
+  pub.handleRecord(std::move(exit));
+  EXPECT_EQ(pub.pending_.size(), 0U);
+}
+}
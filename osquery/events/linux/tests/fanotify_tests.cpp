@@ -0,0 +1,106 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <gtest/gtest.h>
+
+#include <osquery/events.h>
+
+#include "osquery/events/linux/fanotify.h"
+
+namespace osquery {
+
+class FANotifyTests : public testing::Test {};
+
+TEST_F(FANotifyTests, test_fanotify_masks) {
+  // The default inotify masks request updates.
+  auto mask = FANotifyEventPublisher::getMarkMask(0);
+  EXPECT_EQ(mask, static_cast<uint64_t>(FAN_MODIFY | FAN_CLOSE_WRITE));
+
+  mask = FANotifyEventPublisher::getMarkMask(kFileDefaultMasks |
+                                             kFileAccessMasks);
+  EXPECT_EQ(mask,
+            static_cast<uint64_t>(FAN_MODIFY | FAN_CLOSE_WRITE | FAN_ACCESS |
+                                  FAN_OPEN));
+
+  // Directory entry changes have no notification-class equivalent.
+  EXPECT_EQ(FANotifyEventPublisher::getMarkMask(IN_CREATE | IN_DELETE), 0U);
+
+  EXPECT_EQ(FANotifyEventPublisher::getINotifyMask(FAN_CLOSE_WRITE),
+            static_cast<uint32_t>(IN_CLOSE_WRITE));
+  EXPECT_EQ(FANotifyEventPublisher::getINotifyMask(FAN_OPEN | FAN_ACCESS),
+            static_cast<uint32_t>(IN_OPEN | IN_ACCESS));
+}
+
+TEST_F(FANotifyTests, test_fanotify_mark_path) {
+  EXPECT_EQ(FANotifyEventPublisher::getMarkPath("/etc/passwd"), "/etc/");
+  EXPECT_EQ(FANotifyEventPublisher::getMarkPath("/etc/"), "/etc/");
+  EXPECT_EQ(FANotifyEventPublisher::getMarkPath("/etc/*/config"), "/etc/");
+  EXPECT_EQ(FANotifyEventPublisher::getMarkPath("/"), "/");
+
+  // Paths that do not exist are marked on their nearest existing directory.
+  EXPECT_EQ(FANotifyEventPublisher::getMarkPath("/etc/osquery-none/a/b"),
+            "/etc/");
+}
+
+TEST_F(FANotifyTests, test_fanotify_optimize_subscription) {
+  FANotifyEventPublisher pub;
+
+  auto sc = pub.createSubscriptionContext();
+  sc->path = "/etc/**";
+  pub.optimizeSubscription(sc);
+  EXPECT_TRUE(sc->recursive);
+  EXPECT_EQ(sc->path, "/etc/");
+
+  sc = pub.createSubscriptionContext();
+  sc->path = "/etc";
+  pub.optimizeSubscription(sc);
+  EXPECT_FALSE(sc->recursive);
+  EXPECT_EQ(sc->path, "/etc/");
+
+  sc = pub.createSubscriptionContext();
+  sc->path = "/home/*/.ssh/**";
+  pub.optimizeSubscription(sc);
+  EXPECT_TRUE(sc->recursive);
+  EXPECT_EQ(sc->path, "/home/*/.ssh/");
+}
+
+TEST_F(FANotifyTests, test_fanotify_should_fire) {
+  FANotifyEventPublisher pub;
+
+  auto sc = pub.createSubscriptionContext();
+  sc->path = "/etc/**";
+  pub.optimizeSubscription(sc);
+
+  auto access_sc = pub.createSubscriptionContext();
+  access_sc->path = "/var/log/*";
+  access_sc->mask = kFileAccessMasks;
+  pub.optimizeSubscription(access_sc);
+
+  auto matcher = std::make_shared<INotifyPathMatcher>();
+  matcher->add(sc);
+  matcher->add(access_sc);
+  pub.matcher_ = matcher;
+
+  auto ec = pub.createEventContextFrom(FAN_CLOSE_WRITE, "/etc/ssh/sshd_config");
+  EXPECT_EQ(ec->action, "UPDATED");
+  EXPECT_TRUE(pub.shouldFire(sc, ec));
+  EXPECT_FALSE(pub.shouldFire(access_sc, ec));
+
+  ec = pub.createEventContextFrom(FAN_OPEN, "/var/log/syslog");
+  EXPECT_EQ(ec->action, "OPENED");
+  EXPECT_FALSE(pub.shouldFire(sc, ec));
+  EXPECT_TRUE(pub.shouldFire(access_sc, ec));
+
+  // Subscriptions that were not indexed are not matched.
+  auto other_sc = pub.createSubscriptionContext();
+  other_sc->path = "/var/log/";
+  EXPECT_FALSE(pub.shouldFire(other_sc, ec));
+}
+}
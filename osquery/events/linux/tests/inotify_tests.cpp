@@ -230,6 +230,135 @@ TEST_F(INotifyTests, test_inotify_match_subscription) {
   }
 }
 
+TEST_F(INotifyTests, test_inotify_path_matcher) {
+  auto pub = std::make_shared<INotifyEventPublisher>();
+
+  // Subscriptions covering each matching behavior.
+  std::vector<std::pair<std::string, bool>> paths = {
+      {"/etc", false},
+      {"/etc/pass*", false},
+      {"/etc/**", false},
+      {"/ETC/hosts", false},
+      {"/e?c/*/", false},
+      {"/var/log/", true},
+      {"/*/", true},
+  };
+
+  auto matcher = std::make_shared<INotifyPathMatcher>();
+  std::vector<INotifySubscriptionContextRef> subscriptions;
+  for (const auto& path : paths) {
+    auto sc = pub->createSubscriptionContext();
+    sc->path = path.first;
+    sc->recursive = path.second;
+    pub->monitorSubscription(sc, false);
+    matcher->add(sc);
+    subscriptions.push_back(sc);
+  }
+  EXPECT_EQ(matcher->size(), paths.size());
+
+  // The index must agree with each subscription's individual match.
+  std::vector<std::string> events = {
+      "/etc/",
+      "/etc/passwd",
+      "/etc/PASSWD",
+      "/etc/shadow",
+      "/etc/hosts",
+      "/etc/ssh/sshd_config",
+      "/etc/ssh/",
+      "/var/log/syslog",
+      "/var/log/apt/history.log",
+      "/var/logs",
+      "/tmp/file",
+      "/",
+  };
+
+  for (const auto& path : events) {
+    auto ec = pub->createEventContext();
+    ec->path = path;
+    ec->action = "UPDATED";
+
+    auto indexed_ec = pub->createEventContext();
+    indexed_ec->path = path;
+    indexed_ec->action = "UPDATED";
+    indexed_ec->matcher = matcher;
+    matcher->match(path, indexed_ec->matches);
+
+    for (const auto& sc : subscriptions) {
+      EXPECT_TRUE(matcher->indexed(sc.get()));
+      EXPECT_EQ(pub->shouldFire(sc, ec), pub->shouldFire(sc, indexed_ec))
+          << path << " subscribed by " << sc->path;
+    }
+  }
+
+  // Subscriptions not indexed are matched alone.
+  auto sc = pub->createSubscriptionContext();
+  sc->path = "/tmp/";
+  EXPECT_FALSE(matcher->indexed(sc.get()));
+  auto ec = pub->createEventContext();
+  ec->path = "/tmp/file";
+  ec->matcher = matcher;
+  matcher->match(ec->path, ec->matches);
+  EXPECT_TRUE(pub->shouldFire(sc, ec));
+}
+
+TEST_F(INotifyTests, test_inotify_coalesce_events) {
+  auto make_event = [](const std::string& path,
+                       const std::string& action,
+                       uint32_t mask) {
+    auto ec = std::make_shared<INotifyEventContext>();
+    ec->event = std::make_shared<struct inotify_event>();
+    ec->event->mask = mask;
+    ec->path = path;
+    ec->action = action;
+    return ec;
+  };
+
+  INotifyEventContextVector ready;
+  INotifyEventCoalescer coalescer;
+  auto now = INotifyEventCoalescer::Clock::now();
+
+  // Without a window every event is ready.
+  coalescer.add(make_event("/tmp/a", "UPDATED", IN_MODIFY), now, ready);
+  EXPECT_EQ(ready.size(), 1U);
+  EXPECT_TRUE(coalescer.empty());
+  ready.clear();
+
+  coalescer.setWindow(100);
+  for (size_t i = 0; i < 10; i++) {
+    coalescer.add(make_event("/tmp/a", "UPDATED", IN_MODIFY), now, ready);
+  }
+  coalescer.add(make_event("/tmp/a", "UPDATED", IN_CLOSE_WRITE), now, ready);
+  coalescer.add(make_event("/tmp/b", "UPDATED", IN_MODIFY), now, ready);
+  EXPECT_TRUE(ready.empty());
+
+  // Events are held until the window passes.
+  coalescer.expire(now + std::chrono::milliseconds(50), ready);
+  EXPECT_TRUE(ready.empty());
+  coalescer.expire(now + std::chrono::milliseconds(100), ready);
+  ASSERT_EQ(ready.size(), 2U);
+  EXPECT_TRUE(coalescer.empty());
+  EXPECT_EQ(ready[0]->path, "/tmp/a");
+  EXPECT_EQ(ready[0]->count, 11U);
+  EXPECT_EQ(ready[0]->event->mask,
+            static_cast<uint32_t>(IN_MODIFY | IN_CLOSE_WRITE));
+  EXPECT_NE(ready[0]->time, 0U);
+  EXPECT_EQ(ready[1]->path, "/tmp/b");
+  EXPECT_EQ(ready[1]->count, 1U);
+  ready.clear();
+
+  // A different action for a path releases the held event, keeping order.
+  coalescer.add(make_event("/tmp/a", "CREATED", IN_CREATE), now, ready);
+  coalescer.add(make_event("/tmp/a", "UPDATED", IN_MODIFY), now, ready);
+  coalescer.add(make_event("/tmp/a", "UPDATED", IN_MODIFY), now, ready);
+  coalescer.add(make_event("/tmp/a", "DELETED", IN_DELETE), now, ready);
+  coalescer.expire(now + std::chrono::milliseconds(100), ready);
+  ASSERT_EQ(ready.size(), 3U);
+  EXPECT_EQ(ready[0]->action, "CREATED");
+  EXPECT_EQ(ready[1]->action, "UPDATED");
+  EXPECT_EQ(ready[1]->count, 2U);
+  EXPECT_EQ(ready[2]->action, "DELETED");
+}
+
 class TestINotifyEventSubscriber
     : public EventSubscriber<INotifyEventPublisher> {
  public:
@@ -290,6 +419,8 @@ class TestINotifyEventSubscriber
   FRIEND_TEST(INotifyTests, test_inotify_optimization);
   FRIEND_TEST(INotifyTests, test_inotify_directory_watch);
   FRIEND_TEST(INotifyTests, test_inotify_recursion);
+  FRIEND_TEST(INotifyTests, test_inotify_reconfigure);
+  FRIEND_TEST(INotifyTests, test_inotify_overflow_rescan);
   FRIEND_TEST(INotifyTests, test_inotify_embedded_wildcards);
 };
 
@@ -463,6 +594,74 @@ TEST_F(INotifyTests, test_inotify_recursion) {
   EventFactory::deregisterEventPublisher("inotify");
 }
 
+TEST_F(INotifyTests, test_inotify_reconfigure) {
+  auto pub = std::make_shared<INotifyEventPublisher>();
+  EventFactory::registerEventPublisher(pub);
+  auto sub = std::make_shared<TestINotifyEventSubscriber>();
+  createMockFileStructure();
+  auto root = fs::canonical(kFakeDirectory).string();
+
+  auto sc = sub->createSubscriptionContext();
+  sc->path = kFakeDirectory + "/**";
+  sub->subscribe(&TestINotifyEventSubscriber::Callback, sc);
+  pub->configure();
+  ASSERT_EQ(pub->path_descriptors_.size(), 6U);
+  auto watches = pub->path_descriptors_;
+
+  // Reconfiguring the same subscriptions keeps every descriptor.
+  pub->configure();
+  EXPECT_EQ(pub->path_descriptors_, watches);
+
+  // A subscription to a directory below the recursive root shares its watch.
+  auto sc2 = sub->createSubscriptionContext();
+  sc2->path = root + "/deep1/";
+  sub->subscribe(&TestINotifyEventSubscriber::Callback, sc2);
+  pub->configure();
+  EXPECT_EQ(pub->path_descriptors_, watches);
+
+  // Without the recursive root only the remaining root's watch is kept.
+  pub->subscriptions_.clear();
+  sub->subscribe(&TestINotifyEventSubscriber::Callback, sc2);
+  pub->configure();
+  ASSERT_EQ(pub->path_descriptors_.size(), 1U);
+  EXPECT_EQ(pub->path_descriptors_.at(root + "/deep1/"),
+            watches.at(root + "/deep1/"));
+
+  RemoveAll(pub);
+  tearDownMockFileStructure();
+  EventFactory::deregisterEventPublisher("inotify");
+}
+
+TEST_F(INotifyTests, test_inotify_overflow_rescan) {
+  auto pub = std::make_shared<INotifyEventPublisher>();
+  EventFactory::registerEventPublisher(pub);
+  auto sub = std::make_shared<TestINotifyEventSubscriber>();
+  createMockFileStructure();
+  auto root = fs::canonical(kFakeDirectory).string();
+
+  auto sc = sub->createSubscriptionContext();
+  sc->path = kFakeDirectory + "/**";
+  sub->subscribe(&TestINotifyEventSubscriber::Callback, sc);
+  pub->configure();
+  ASSERT_EQ(pub->path_descriptors_.size(), 6U);
+  auto watches = pub->path_descriptors_;
+
+  // Change the tree without reading its events, as if they were dropped.
+  fs::remove_all(kFakeDirectory + "/deep1");
+  fs::create_directories(kFakeDirectory + "/deep12/deep2");
+  pub->recoverOverflow();
+
+  EXPECT_EQ(pub->path_descriptors_.size(), 6U);
+  EXPECT_EQ(pub->path_descriptors_.count(root + "/deep1/"), 0U);
+  EXPECT_EQ(pub->path_descriptors_.count(root + "/deep12/deep2/"), 1U);
+  EXPECT_EQ(pub->path_descriptors_.at(root + "/deep11/"),
+            watches.at(root + "/deep11/"));
+
+  RemoveAll(pub);
+  tearDownMockFileStructure();
+  EventFactory::deregisterEventPublisher("inotify");
+}
+
 TEST_F(INotifyTests, test_inotify_embedded_wildcards) {
   // Assume event type is not registered.
   event_pub_ = std::make_shared<INotifyEventPublisher>();
@@ -8,6 +8,8 @@
  *
  */
 
+#include <string.h>
+
 #include <vector>
 
 #include <gtest/gtest.h>
@@ -86,4 +88,51 @@ TEST_F(SyslogTests, test_csv_separator) {
   ASSERT_EQ(std::vector<std::string>({"\",f\\ø\"o,", "\",bá\\'r", "baz\\,\""}),
             splitCsv(R"(""",f\ø""o,",""",bá\'r","baz\,""")"));
 }
+
+TEST_F(SyslogTests, test_split_csv_in_place) {
+  // The in-place splitter must agree with the tokenizer.
+  std::vector<std::string> lines = {
+      ",,,,",
+      "foo,bar,baz",
+      R"("foo","bar","baz")",
+      R"(""",f\o""o,",""",ba\'r","baz\,""")",
+      R"("a",)",
+  };
+  for (const auto& line : lines) {
+    std::vector<char> data(line.begin(), line.end());
+    std::vector<boost::string_ref> fields;
+    splitRsyslogCsv(data.data(), data.size(), fields);
+    std::vector<std::string> result;
+    for (const auto& field : fields) {
+      result.push_back(field.to_string());
+    }
+    EXPECT_EQ(splitCsv(line), result);
+  }
+}
+
+TEST_F(SyslogTests, test_read_lines) {
+  std::string line =
+      R"("2016-03-22T21:17:01.701882+00:00","host","6","cron","CRON:","msg")";
+  std::string data = line + "\n" + line + "\n" + line.substr(0, 10);
+
+  SyslogEventPublisher pub;
+  pub.buffer_.resize(1024);
+  memcpy(pub.buffer_.data(), data.data(), data.size());
+  EXPECT_TRUE(pub.readLines(data.size()).ok());
+  EXPECT_EQ(pub.errorCount_, 0U);
+
+  // The incomplete line is kept for the next read.
+  ASSERT_EQ(pub.buffered_, 10U);
+  EXPECT_EQ(std::string(pub.buffer_.data(), 10), line.substr(0, 10));
+
+  // The end of a dropped line is not parsed.
+  data = line.substr(10) + "\n";
+  pub.discarding_ = true;
+  pub.buffered_ = 0;
+  memcpy(pub.buffer_.data(), data.data(), data.size());
+  EXPECT_TRUE(pub.readLines(data.size()).ok());
+  EXPECT_FALSE(pub.discarding_);
+  EXPECT_EQ(pub.buffered_, 0U);
+  EXPECT_EQ(pub.errorCount_, 0U);
+}
 }
@@ -0,0 +1,53 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <gtest/gtest.h>
+
+#include "osquery/events/linux/udev.h"
+#include "osquery/tests/test_util.h"
+
+namespace osquery {
+
+class UdevTests : public testing::Test {
+ protected:
+  SubscriptionRef subscription(const std::string& subsystem,
+                               const std::string& devtype = "") {
+    auto sc = std::make_shared<UdevSubscriptionContext>();
+    sc->action = UDEV_EVENT_ACTION_ALL;
+    sc->subsystem = subsystem;
+    sc->devtype = devtype;
+    return Subscription::create("TestSubscriber", sc);
+  }
+};
+
+TEST_F(UdevTests, test_get_filters) {
+  std::set<UdevFilter> filters;
+  EXPECT_FALSE(UdevEventPublisher::getFilters({}, filters));
+
+  SubscriptionVector subscriptions = {
+      subscription("usb", "usb_device"), subscription("block", "disk"),
+  };
+  EXPECT_TRUE(UdevEventPublisher::getFilters(subscriptions, filters));
+  std::set<UdevFilter> expected = {{"block", "disk"}, {"usb", "usb_device"}};
+  EXPECT_EQ(filters, expected);
+
+  // A subsystem subscription includes the subsystem's devtype filters.
+  subscriptions.push_back(subscription("usb"));
+  filters.clear();
+  EXPECT_TRUE(UdevEventPublisher::getFilters(subscriptions, filters));
+  expected = {{"block", "disk"}, {"usb", ""}};
+  EXPECT_EQ(filters, expected);
+
+  // A subscription for every subsystem needs every event.
+  subscriptions.push_back(subscription(""));
+  filters.clear();
+  EXPECT_FALSE(UdevEventPublisher::getFilters(subscriptions, filters));
+}
+}
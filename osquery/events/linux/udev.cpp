@@ -11,6 +11,7 @@
 #include <osquery/events.h>
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
+#include <osquery/tables.h>
 
 #include "osquery/events/linux/udev.h"
 
@@ -43,10 +44,46 @@ Status UdevEventPublisher::setUp() {
   return Status(0, "OK");
 }
 
-void UdevEventPublisher::configure() {}
+void UdevEventPublisher::configure() {
+  std::set<UdevFilter> filters;
+  {
+    WriteLock lock(subscriptions_lock_);
+    if (!getFilters(subscriptions_, filters)) {
+      filters.clear();
+    }
+  }
+
+  WriteLock lock(mutex_);
+  if (monitor_ == nullptr || filters == filters_) {
+    return;
+  }
+
+  udev_monitor_filter_remove(monitor_);
+  for (const auto& filter : filters) {
+    udev_monitor_filter_add_match_subsystem_devtype(
+        monitor_,
+        filter.first.c_str(),
+        (filter.second.empty()) ? nullptr : filter.second.c_str());
+  }
+  if (udev_monitor_filter_update(monitor_) < 0) {
+    LOG(WARNING) << "Could not update the udev monitor filters";
+  }
+  filters_ = std::move(filters);
+
+  // A filtered monitor does not see every device change.
+  if (watching_ && !filters_.empty()) {
+    TablePlugin::watchHardware(false);
+    watching_ = false;
+  }
+}
 
 void UdevEventPublisher::tearDown() {
   WriteLock lock(mutex_);
+  if (watching_) {
+    TablePlugin::watchHardware(false);
+    watching_ = false;
+  }
+
   if (monitor_ != nullptr) {
     udev_monitor_unref(monitor_);
     monitor_ = nullptr;
@@ -58,6 +95,11 @@ void UdevEventPublisher::tearDown() {
   }
 }
 
+int UdevEventPublisher::getDescriptor() const {
+  WriteLock lock(mutex_);
+  return (monitor_ == nullptr) ? -1 : udev_monitor_get_fd(monitor_);
+}
+
 Status UdevEventPublisher::run() {
   int fd = 0;
   fd_set set;
@@ -68,6 +110,12 @@ Status UdevEventPublisher::run() {
       return Status(1);
     }
     fd = udev_monitor_get_fd(monitor_);
+
+    // Hardware tables may keep their results while devices are monitored.
+    if (!watching_ && filters_.empty()) {
+      TablePlugin::watchHardware(true);
+      watching_ = true;
+    }
   }
 
   FD_ZERO(&set);
@@ -91,8 +139,12 @@ Status UdevEventPublisher::run() {
     return Status(1, "udev monitor failed.");
   }
 
+  TablePlugin::hardwareChanged();
   auto ec = createEventContextFrom(device);
-  fire(ec);
+  if (isAccepted(ec)) {
+    fillEventContext(ec);
+    fire(ec);
+  }
 
   udev_device_unref(device);
 
@@ -133,13 +185,17 @@ UdevEventContextRef UdevEventPublisher::createEventContextFrom(
     ec->action = UDEV_EVENT_ACTION_CHANGE;
   }
 
-  // Set the subscription-aware variables for the event.
   auto value = udev_device_get_subsystem(device);
   if (value != nullptr) {
     ec->subsystem = std::string(value);
   }
+  return ec;
+}
 
-  value = udev_device_get_devnode(device);
+void UdevEventPublisher::fillEventContext(const UdevEventContextRef& ec) {
+  // Set the remaining subscription-aware variables for the event.
+  auto device = ec->device;
+  auto value = udev_device_get_devnode(device);
   if (value != nullptr) {
     ec->devnode = std::string(value);
   }
@@ -153,8 +209,39 @@ UdevEventContextRef UdevEventPublisher::createEventContextFrom(
   if (value != nullptr) {
     ec->driver = std::string(value);
   }
+}
 
-  return ec;
+bool UdevEventPublisher::getFilters(const SubscriptionVector& subscriptions,
+                                    std::set<UdevFilter>& filters) {
+  for (const auto& sub : subscriptions) {
+    auto sc = getSubscriptionContext(sub->context);
+    if (sc->subsystem.empty()) {
+      return false;
+    }
+    filters.insert(std::make_pair(sc->subsystem, sc->devtype));
+  }
+
+  // A subsystem matched without a devtype includes its devtype filters.
+  for (auto it = filters.begin(); it != filters.end();) {
+    if (!it->second.empty() && filters.count({it->first, ""}) > 0) {
+      it = filters.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  return !filters.empty();
+}
+
+bool UdevEventPublisher::isAccepted(const UdevEventContextRef& ec) {
+  WriteLock lock(subscriptions_lock_);
+  for (const auto& sub : subscriptions_) {
+    auto sc = getSubscriptionContext(sub->context);
+    if ((sc->action == UDEV_EVENT_ACTION_ALL || sc->action == ec->action) &&
+        (sc->subsystem.empty() || sc->subsystem == ec->subsystem)) {
+      return true;
+    }
+  }
+  return false;
 }
 
 bool UdevEventPublisher::shouldFire(const UdevSubscriptionContextRef& sc,
@@ -10,6 +10,10 @@
 
 #pragma once
 
+#include <set>
+#include <string>
+#include <utility>
+
 #include <libudev.h>
 
 #include <osquery/events.h>
@@ -70,6 +74,9 @@ struct UdevEventContext : public EventContext {
 using UdevEventContextRef = std::shared_ptr<UdevEventContext>;
 using UdevSubscriptionContextRef = std::shared_ptr<UdevSubscriptionContext>;
 
+/// A monitor filter, a subsystem and an optional devtype.
+using UdevFilter = std::pair<std::string, std::string>;
+
 /**
  * @brief A Linux `udev` EventPublisher.
  *
@@ -81,12 +88,16 @@ class UdevEventPublisher
  public:
   Status setUp() override;
 
+  /// Install monitor filters for the subscribed subsystems.
   void configure() override;
 
   void tearDown() override;
 
   Status run() override;
 
+  /// The udev monitor's netlink socket.
+  int getDescriptor() const override;
+
   UdevEventPublisher() : EventPublisher(){};
 
   /**
@@ -109,6 +120,19 @@ class UdevEventPublisher
   static std::string getAttr(struct udev_device* device,
                              const std::string& attr);
 
+  /**
+   * @brief Find the monitor filters accepting every subscribed event.
+   *
+   * The kernel only delivers events matching a filter to the monitor. If any
+   * subscription accepts all subsystems no filters may be installed.
+   *
+   * @param subscriptions the publisher's subscriptions.
+   * @param filters output the subsystem and devtype pairs to match.
+   * @return true if the filters were found, false if every event is needed.
+   */
+  static bool getFilters(const SubscriptionVector& subscriptions,
+                         std::set<UdevFilter>& filters);
+
  private:
   /// udev handle (socket descriptor contained within).
   struct udev* handle_{nullptr};
@@ -116,15 +140,32 @@ class UdevEventPublisher
   /// udev monitor.
   struct udev_monitor* monitor_{nullptr};
 
+  /// Set once the run loop executes, see TablePlugin::watchHardware.
+  bool watching_{false};
+
+  /// The installed monitor filters, empty if every event is received.
+  std::set<UdevFilter> filters_;
+
   /// Protection around udev resources.
-  Mutex mutex_;
+  mutable Mutex mutex_;
 
  private:
   /// Check subscription details.
   bool shouldFire(const UdevSubscriptionContextRef& mc,
                   const UdevEventContextRef& ec) const override;
 
+  /**
+   * @brief Check if any subscription accepts an event's action and subsystem.
+   *
+   * These are read for every event, the remaining details are only read
+   * from the device for events a subscription may accept.
+   */
+  bool isAccepted(const UdevEventContextRef& ec);
+
   /// Helper function to create an EventContext using a udev_device pointer.
   UdevEventContextRef createEventContextFrom(struct udev_device* device);
+
+  /// Read the device node, type, and driver into the EventContext.
+  void fillEventContext(const UdevEventContextRef& ec);
 };
 }
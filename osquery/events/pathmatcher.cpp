@@ -0,0 +1,181 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <algorithm>
+
+#include <fnmatch.h>
+
+#include <boost/algorithm/string/case_conv.hpp>
+
+#include "osquery/events/pathmatcher.h"
+
+namespace osquery {
+
+/// Split a path into components, keeping empty leading and trailing names.
+static std::vector<std::string> getPathComponents(const std::string& path) {
+  std::vector<std::string> components;
+  size_t start = 0;
+  while (true) {
+    auto end = path.find('/', start);
+    if (end == std::string::npos) {
+      components.push_back(path.substr(start));
+      break;
+    }
+    components.push_back(path.substr(start, end - start));
+    start = end + 1;
+  }
+  return components;
+}
+
+/// Check if a pattern component needs fnmatch or can be compared.
+static inline bool isWildcardComponent(const std::string& component) {
+  return component.find_first_of("*?[\\") != std::string::npos;
+}
+
+PathMatcher::PathMatcher() : prefixes_(1), patterns_(1) {}
+
+void PathMatcher::add(const SubscriptionContextRef& sc,
+                      const std::string& path,
+                      bool recursive,
+                      bool recursive_match) {
+  subscriptions_.push_back(sc);
+  indexed_.insert(
+      std::upper_bound(indexed_.begin(), indexed_.end(), sc.get()), sc.get());
+
+  if (recursive && !recursive_match) {
+    // Recursive subscriptions match any event path beginning with their path.
+    size_t node = 0;
+    for (const auto& c : path) {
+      auto child = prefixes_[node].children.find(c);
+      if (child == prefixes_[node].children.end()) {
+        prefixes_.emplace_back();
+        child = prefixes_[node].children.emplace(c, prefixes_.size() - 1).first;
+      }
+      node = child->second;
+    }
+    prefixes_[node].subscriptions.push_back(sc.get());
+    return;
+  }
+
+  exact_[path].push_back(sc.get());
+
+  // The pattern matches the subscription path with a trailing wildcard.
+  size_t node = 0;
+  for (const auto& component : getPathComponents(path + '*')) {
+    size_t next = 0;
+    if (isWildcardComponent(component)) {
+      auto& wildcards = patterns_[node].wildcards;
+      auto it = std::find_if(
+          wildcards.begin(),
+          wildcards.end(),
+          [&component](const std::pair<std::string, size_t>& wildcard) {
+            return wildcard.first == component;
+          });
+      if (it != wildcards.end()) {
+        next = it->second;
+      } else {
+        patterns_.emplace_back();
+        next = patterns_.size() - 1;
+        patterns_[node].wildcards.push_back(std::make_pair(component, next));
+      }
+    } else {
+      auto key = boost::to_lower_copy(component);
+      auto it = patterns_[node].literals.find(key);
+      if (it != patterns_[node].literals.end()) {
+        next = it->second;
+      } else {
+        patterns_.emplace_back();
+        next = patterns_.size() - 1;
+        patterns_[node].literals[key] = next;
+      }
+    }
+    node = next;
+  }
+
+  // Only recursive subscriptions with a wildcard stem match leading dirs.
+  if (recursive_match) {
+    patterns_[node].leading.push_back(sc.get());
+  } else {
+    patterns_[node].subscriptions.push_back(sc.get());
+  }
+}
+
+bool PathMatcher::indexed(const SubscriptionContext* sc) const {
+  return std::binary_search(indexed_.begin(), indexed_.end(), sc);
+}
+
+void PathMatcher::match(const std::string& path,
+                        PathMatchVector& matches) const {
+  matches.clear();
+
+  // Walk the prefix trie along the path.
+  size_t node = 0;
+  for (size_t i = 0;; ++i) {
+    const auto& prefix = prefixes_[node];
+    matches.insert(matches.end(),
+                   prefix.subscriptions.begin(),
+                   prefix.subscriptions.end());
+    if (i == path.size()) {
+      break;
+    }
+    auto child = prefix.children.find(path[i]);
+    if (child == prefix.children.end()) {
+      break;
+    }
+    node = child->second;
+  }
+
+  auto exact = exact_.find(path);
+  if (exact != exact_.end()) {
+    matches.insert(matches.end(), exact->second.begin(), exact->second.end());
+  }
+
+  // Walk the component trie, wildcard components may follow several nodes.
+  auto components = getPathComponents(path);
+  std::vector<size_t> nodes = {0};
+  std::vector<size_t> next;
+  for (size_t i = 0; i < components.size() && !nodes.empty(); ++i) {
+    const auto& component = components[i];
+    auto key = boost::to_lower_copy(component);
+    next.clear();
+    for (const auto& n : nodes) {
+      const auto& pattern = patterns_[n];
+      auto literal = pattern.literals.find(key);
+      if (literal != pattern.literals.end()) {
+        next.push_back(literal->second);
+      }
+      for (const auto& wildcard : pattern.wildcards) {
+        if (fnmatch(wildcard.first.c_str(),
+                    component.c_str(),
+                    FNM_PATHNAME | FNM_CASEFOLD) == 0) {
+          next.push_back(wildcard.second);
+        }
+      }
+    }
+    nodes.swap(next);
+
+    bool last = (i + 1 == components.size());
+    for (const auto& n : nodes) {
+      const auto& pattern = patterns_[n];
+      if (last) {
+        matches.insert(matches.end(),
+                       pattern.subscriptions.begin(),
+                       pattern.subscriptions.end());
+      }
+      // Leading directory patterns also match when more components follow.
+      matches.insert(
+          matches.end(), pattern.leading.begin(), pattern.leading.end());
+    }
+  }
+
+  std::sort(matches.begin(), matches.end());
+  matches.erase(std::unique(matches.begin(), matches.end()), matches.end());
+}
+}
@@ -0,0 +1,108 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/events.h>
+
+namespace osquery {
+
+/// Subscriptions matching an event path, sorted by address.
+using PathMatchVector = std::vector<const SubscriptionContext*>;
+
+/**
+ * @brief An index of configured subscription paths.
+ *
+ * Filesystem publishers compile every subscription path into this index when
+ * configured. Matching an event path walks the index once and returns all
+ * matching subscriptions, rather than comparing or fnmatch-ing each
+ * subscription's path in turn.
+ *
+ * Three subscription behaviors are indexed, equivalent to the per-subscription
+ * checks in the publishers' shouldFire:
+ *   - recursive paths match any event path they prefix (a character trie),
+ *   - other paths match themselves exactly,
+ *   - other paths are patterns, a trailing "*" is appended, following
+ *     fnmatch(FNM_PATHNAME | FNM_CASEFOLD) semantics (a trie of path
+ *     components). Literal components are looked up by their lowercase name,
+ *     only wildcard components are tested with fnmatch.
+ */
+class PathMatcher : private boost::noncopyable {
+ public:
+  PathMatcher();
+
+  /**
+   * @brief Index a subscription, after its path was optimized by configure.
+   *
+   * @param sc The subscription, kept alive by the index.
+   * @param path The subscription's configured path or pattern.
+   * @param recursive The path matches every path it prefixes.
+   * @param recursive_match A recursive pattern, it matches leading dirs.
+   */
+  void add(const SubscriptionContextRef& sc,
+           const std::string& path,
+           bool recursive,
+           bool recursive_match);
+
+  /// Check if a subscription was indexed, otherwise it must be checked alone.
+  bool indexed(const SubscriptionContext* sc) const;
+
+  /// Collect all indexed subscriptions matching an event path.
+  void match(const std::string& path, PathMatchVector& matches) const;
+
+  /// The number of indexed subscriptions.
+  size_t size() const { return subscriptions_.size(); }
+
+ private:
+  /// A character trie node for recursive path prefixes.
+  struct PrefixNode {
+    std::map<char, size_t> children;
+    PathMatchVector subscriptions;
+  };
+
+  /// A path component trie node for patterns.
+  struct PatternNode {
+    /// Children for literal components, keyed by the lowercase component.
+    std::unordered_map<std::string, size_t> literals;
+
+    /// Children for components containing wildcards.
+    std::vector<std::pair<std::string, size_t>> wildcards;
+
+    /// Patterns ending at this component.
+    PathMatchVector subscriptions;
+
+    /// Patterns ending at this component that also match leading directories.
+    PathMatchVector leading;
+  };
+
+ private:
+  /// Every indexed subscription, sorted by address for indexed().
+  PathMatchVector indexed_;
+
+  /// References to the indexed subscriptions, keeping the addresses unique.
+  std::vector<SubscriptionContextRef> subscriptions_;
+
+  /// Recursive path prefixes, node 0 is the root.
+  std::vector<PrefixNode> prefixes_;
+
+  /// Patterns, node 0 is the root.
+  std::vector<PatternNode> patterns_;
+
+  /// Paths matching themselves exactly.
+  std::unordered_map<std::string, PathMatchVector> exact_;
+};
+}
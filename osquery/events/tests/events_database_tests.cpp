@@ -13,6 +13,7 @@
 
 #include <gtest/gtest.h>
 
+#include <osquery/config.h>
 #include <osquery/core.h>
 #include <osquery/database.h>
 #include <osquery/events.h>
@@ -24,6 +25,10 @@ namespace osquery {
 
 DECLARE_uint64(events_expiry);
 DECLARE_uint64(events_max);
+DECLARE_bool(events_time_keys);
+DECLARE_uint64(events_batch_size);
+DECLARE_uint64(events_batch_milli);
+DECLARE_uint64(events_hot_size);
 
 class EventsDatabaseTests : public ::testing::Test {
   void SetUp() override { Registry::registry("config_parser")->setUp(); }
@@ -47,6 +52,24 @@ class DBFakeEventSubscriber : public EventSubscriber<DBFakeEventPublisher> {
   }
 };
 
+/// A subscriber with its own namespace, using time-ordered keys.
+class DBTimeKeysEventSubscriber : public DBFakeEventSubscriber {
+ public:
+  DBTimeKeysEventSubscriber() { setName("DBTimeKeysSubscriber"); }
+};
+
+/// A subscriber with its own namespace, for the in-memory hot tier.
+class DBHotEventSubscriber : public DBFakeEventSubscriber {
+ public:
+  DBHotEventSubscriber() { setName("DBHotSubscriber"); }
+};
+
+/// A subscriber with its own namespace, for per-query watermarks.
+class DBWatermarkEventSubscriber : public DBFakeEventSubscriber {
+ public:
+  DBWatermarkEventSubscriber() { setName("DBWatermarkSubscriber"); }
+};
+
 TEST_F(EventsDatabaseTests, test_event_module_id) {
   auto sub = std::make_shared<DBFakeEventSubscriber>();
   sub->doNotExpire();
@@ -58,6 +81,30 @@ TEST_F(EventsDatabaseTests, test_event_module_id) {
   EXPECT_EQ(event_id2, "2");
 }
 
+TEST_F(EventsDatabaseTests, test_event_id_lease) {
+  auto sub = std::make_shared<DBFakeEventSubscriber>();
+  sub->setName("DBLeaseSubscriber");
+  EXPECT_EQ(sub->getEventID(), "1");
+  EXPECT_EQ(sub->getEventID(), "2");
+
+  // Only the end of the lease is stored.
+  std::string lease;
+  getDatabaseValue(kEvents, "eid." + sub->dbNamespace(), lease);
+  EXPECT_EQ(lease, "10000");
+
+  // A restarted subscriber continues after the lease.
+  auto restarted = std::make_shared<DBFakeEventSubscriber>();
+  restarted->setName("DBLeaseSubscriber");
+  EXPECT_EQ(restarted->getEventID(), "10001");
+  getDatabaseValue(kEvents, "eid." + sub->dbNamespace(), lease);
+  EXPECT_EQ(lease, "20000");
+
+  // IDs within a lease do not write the backing store.
+  EXPECT_EQ(sub->getEventID(), "3");
+  getDatabaseValue(kEvents, "eid." + sub->dbNamespace(), lease);
+  EXPECT_EQ(lease, "20000");
+}
+
 TEST_F(EventsDatabaseTests, test_event_add) {
   auto sub = std::make_shared<DBFakeEventSubscriber>();
   auto status = sub->testAdd(1);
@@ -265,4 +312,325 @@ TEST_F(EventsDatabaseTests, test_expire_check) {
     }
   }
 }
+
+TEST_F(EventsDatabaseTests, test_time_keys) {
+  FLAGS_events_time_keys = true;
+  auto sub = std::make_shared<DBTimeKeysEventSubscriber>();
+  sub->doNotExpire();
+  sub->testAdd(2);
+  sub->testAdd(11);
+  sub->testAdd(61);
+  sub->testAdd(3601);
+  sub->testAdd(7201);
+
+  // Each event is a single key, no index or record lists are written.
+  std::vector<std::string> keys;
+  scanDatabaseKeys(kEvents, keys, "event." + sub->dbNamespace() + ".");
+  EXPECT_EQ(keys.size(), 5U);
+  keys.clear();
+  scanDatabaseKeys(kEvents, keys, "indexes." + sub->dbNamespace());
+  scanDatabaseKeys(kEvents, keys, "records." + sub->dbNamespace());
+  scanDatabaseKeys(kEvents, keys, "data." + sub->dbNamespace());
+  EXPECT_EQ(keys.size(), 0U);
+
+  // Ranges are inclusive and results are ordered by time.
+  auto results = sub->getTimeKeys(10, 3601);
+  ASSERT_EQ(results.size(), 3U);
+  EXPECT_EQ(results[0]["time"], "11");
+  EXPECT_EQ(results[2]["time"], "3601");
+
+  results = sub->getTimeKeys(0, -1);
+  EXPECT_EQ(results.size(), 5U);
+
+  results = sub->getTimeKeys(61, 61);
+  EXPECT_EQ(results.size(), 1U);
+
+  results = sub->getTimeKeys(7202, 10000);
+  EXPECT_EQ(results.size(), 0U);
+  FLAGS_events_time_keys = false;
+}
+
+TEST_F(EventsDatabaseTests, test_time_keys_expiration) {
+  FLAGS_events_time_keys = true;
+  auto sub = std::make_shared<DBTimeKeysEventSubscriber>();
+  sub->expire_events_ = true;
+  sub->expire_time_ = 0;
+  auto max = FLAGS_events_max;
+
+  // Events at or before the expire time are removed when found.
+  sub->expire_time_ = 61;
+  auto results = sub->getTimeKeys(0, -1);
+  EXPECT_EQ(results.size(), 2U);
+  std::vector<std::string> keys;
+  scanDatabaseKeys(kEvents, keys, "event." + sub->dbNamespace() + ".");
+  EXPECT_EQ(keys.size(), 2U);
+
+  // The oldest events are expired beyond the events_max.
+  sub->expire_time_ = 0;
+  FLAGS_events_max = 1;
+  sub->expireCheck();
+  results = sub->getTimeKeys(0, -1);
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0]["time"], "7201");
+
+  // The expired range may cover every event.
+  FLAGS_events_max = max;
+  sub->expire_time_ = 7201;
+  sub->expireCheck();
+  keys.clear();
+  scanDatabaseKeys(kEvents, keys, "event." + sub->dbNamespace() + ".");
+  EXPECT_TRUE(keys.empty());
+
+  FLAGS_events_time_keys = false;
+}
+
+TEST_F(EventsDatabaseTests, test_event_batching) {
+  FLAGS_events_time_keys = true;
+  FLAGS_events_batch_size = 3;
+  auto milli = FLAGS_events_batch_milli;
+  FLAGS_events_batch_milli = 60 * 1000;
+
+  auto sub = std::make_shared<DBFakeEventSubscriber>();
+  sub->setName("DBBatchSubscriber");
+  sub->doNotExpire();
+  auto prefix = "event." + sub->dbNamespace() + ".";
+
+  // Events are buffered until the batch size.
+  sub->testAdd(1);
+  sub->testAdd(2);
+  std::vector<std::string> keys;
+  scanDatabaseKeys(kEvents, keys, prefix);
+  EXPECT_EQ(keys.size(), 0U);
+
+  // Selecting writes the buffer first.
+  auto results = sub->get(0, -1);
+  EXPECT_EQ(results.size(), 2U);
+  scanDatabaseKeys(kEvents, keys, prefix);
+  EXPECT_EQ(keys.size(), 2U);
+
+  // A full buffer is written as one batch.
+  sub->testAdd(3);
+  sub->testAdd(4);
+  sub->testAdd(5);
+  keys.clear();
+  scanDatabaseKeys(kEvents, keys, prefix);
+  EXPECT_EQ(keys.size(), 5U);
+
+  // A stale buffer is written with the next event.
+  FLAGS_events_batch_milli = 0;
+  sub->testAdd(6);
+  keys.clear();
+  scanDatabaseKeys(kEvents, keys, prefix);
+  EXPECT_EQ(keys.size(), 6U);
+
+  FLAGS_events_batch_milli = milli;
+  FLAGS_events_batch_size = 0;
+  FLAGS_events_time_keys = false;
+}
+
+TEST_F(EventsDatabaseTests, test_row_encoding) {
+  auto sub = std::make_shared<DBFakeEventSubscriber>();
+  sub->setName("DBEncodingSubscriber");
+
+  Row r;
+  r["path"] = "/bin/ls";
+  r["cmdline"] = std::string(300, 'a');
+  r["binary"] = std::string("\x00\x01\xff", 3);
+  r["empty"] = "";
+
+  std::string data;
+  ASSERT_TRUE(sub->encodeRow(r, data).ok());
+  Row decoded;
+  ASSERT_TRUE(sub->decodeRow(data, decoded).ok());
+  EXPECT_EQ(decoded, r);
+
+  // The column dictionary is restored by a restarted subscriber.
+  auto restarted = std::make_shared<DBFakeEventSubscriber>();
+  restarted->setName("DBEncodingSubscriber");
+  decoded.clear();
+  ASSERT_TRUE(restarted->decodeRow(data, decoded).ok());
+  EXPECT_EQ(decoded, r);
+
+  // Rows stored as JSON are still decoded.
+  std::string json;
+  serializeRowJSON({{"path", "/bin/ls"}}, json);
+  decoded.clear();
+  ASSERT_TRUE(sub->decodeRow(json, decoded).ok());
+  EXPECT_EQ(decoded["path"], "/bin/ls");
+
+  // Truncated rows are rejected.
+  decoded.clear();
+  EXPECT_FALSE(sub->decodeRow(data.substr(0, data.size() - 1), decoded).ok());
+
+  // Column names cannot contain the dictionary delimiter.
+  Row invalid = {{"a,b", "1"}};
+  EXPECT_FALSE(sub->encodeRow(invalid, data).ok());
+}
+
+TEST_F(EventsDatabaseTests, test_gentable_watermark) {
+  auto sub = std::make_shared<DBWatermarkEventSubscriber>();
+  auto expiry = FLAGS_events_expiry;
+  FLAGS_events_expiry = 0;
+
+  auto now = getUnixTime();
+  sub->testAdd(now);
+  sub->testAdd(now);
+
+  QueryContext context;
+  {
+    // A query without a watermark is delivered every event.
+    EventWatermarkScope scope("watermark_query");
+    EXPECT_EQ(sub->genTable(context).size(), 2U);
+    // Scanning again within the scope returns the same events.
+    EXPECT_EQ(sub->genTable(context).size(), 2U);
+  }
+
+  {
+    // Without a commit the watermark did not advance.
+    EventWatermarkScope scope("watermark_query");
+    EXPECT_EQ(sub->genTable(context).size(), 2U);
+    EXPECT_TRUE(scope.commit().ok());
+  }
+
+  sub->testAdd(now);
+  {
+    EventWatermarkScope scope("watermark_query");
+    EXPECT_EQ(sub->genTable(context).size(), 1U);
+    EXPECT_TRUE(scope.commit().ok());
+
+    // Watermarks are kept per query.
+    EventWatermarkScope other("other_watermark_query");
+    EXPECT_EQ(sub->genTable(context).size(), 3U);
+  }
+
+  {
+    EventWatermarkScope scope("watermark_query");
+    EXPECT_TRUE(sub->genTable(context).empty());
+  }
+
+  // Outside of a scope every event is selected.
+  EXPECT_EQ(EventWatermarkScope::current(), nullptr);
+  EXPECT_EQ(sub->genTable(context).size(), 3U);
+  FLAGS_events_expiry = expiry;
+}
+
+TEST_F(EventsDatabaseTests, test_hot_events) {
+  auto sub = std::make_shared<DBHotEventSubscriber>();
+  auto expiry = FLAGS_events_expiry;
+  FLAGS_events_expiry = 0;
+  FLAGS_events_hot_size = 2;
+
+  // The tier begins now, use later event times to select only the tier.
+  auto now = getUnixTime();
+  sub->testAdd(now + 10);
+  sub->testAdd(now + 11);
+
+  // Remove the stored events, selects served from memory do not read them.
+  std::vector<std::string> keys;
+  scanDatabaseKeys(kEvents, keys, "data.DBFakePublisher.DBHotSubscriber");
+  for (const auto& key : keys) {
+    deleteDatabaseValue(kEvents, key);
+  }
+
+  QueryData results;
+  EXPECT_TRUE(sub->getHotEvents(now + 5, 0, 0, nullptr, results));
+  EXPECT_EQ(results.size(), 2U);
+  EXPECT_EQ(sub->get(now + 5, 0).size(), 2U);
+
+  // Events before the tier began are only in the backing store.
+  results.clear();
+  EXPECT_FALSE(sub->getHotEvents(0, 0, 0, nullptr, results));
+  EXPECT_TRUE(sub->get(0, 0).empty());
+
+  // Evicting an event raises the times served from memory.
+  sub->testAdd(now + 20);
+  EXPECT_EQ(sub->hot_events_.size(), 2U);
+  EXPECT_FALSE(sub->getHotEvents(now + 10, 0, 0, nullptr, results));
+  EXPECT_TRUE(sub->getHotEvents(now + 11, 0, 0, nullptr, results));
+  EXPECT_EQ(results.size(), 2U);
+
+  // Only events after an EventID are returned.
+  results.clear();
+  size_t last = 0;
+  auto after = sub->hot_events_.back().eid - 1;
+  EXPECT_TRUE(sub->getHotEvents(now + 11, 0, after, &last, results));
+  EXPECT_EQ(results.size(), 1U);
+  EXPECT_EQ(last, sub->hot_events_.back().eid);
+
+  FLAGS_events_hot_size = 0;
+  FLAGS_events_expiry = expiry;
+}
+
+TEST_F(EventsDatabaseTests, test_gentable_time_constraints) {
+  FLAGS_events_time_keys = true;
+  auto sub = std::make_shared<DBFakeEventSubscriber>();
+  sub->setName("DBConstraintsSubscriber");
+  sub->doNotExpire();
+  for (int t = 1995; t <= 2105; t++) {
+    sub->testAdd(t);
+  }
+
+  // Ranges spanning several key prefixes are complete.
+  QueryContext context;
+  context.constraints["time"].add(Constraint(GREATER_THAN_OR_EQUALS, "1998"));
+  context.constraints["time"].add(Constraint(LESS_THAN, "2101"));
+  auto results = sub->genTable(context);
+  EXPECT_EQ(results.size(), 103U);
+
+  // Real-valued expressions are rounded toward the inside of the range.
+  QueryContext real_context;
+  real_context.constraints["time"].add(Constraint(GREATER_THAN, "2100.5"));
+  real_context.constraints["time"].add(Constraint(LESS_THAN, "2102.5"));
+  results = sub->genTable(real_context);
+  ASSERT_EQ(results.size(), 2U);
+  EXPECT_EQ(results[0]["time"], "2101");
+
+  // Contradictory constraints select nothing.
+  QueryContext empty_context;
+  empty_context.constraints["time"].add(Constraint(GREATER_THAN, "2000"));
+  empty_context.constraints["time"].add(Constraint(LESS_THAN, "1999"));
+  results = sub->genTable(empty_context);
+  EXPECT_EQ(results.size(), 0U);
+
+  // Open ranges include the newest events.
+  QueryContext open_context;
+  open_context.constraints["time"].add(Constraint(GREATER_THAN, "2103"));
+  results = sub->genTable(open_context);
+  EXPECT_EQ(results.size(), 2U);
+  FLAGS_events_time_keys = false;
+}
+
+TEST_F(EventsDatabaseTests, test_event_filters) {
+  auto sub = std::make_shared<DBFakeEventSubscriber>();
+  sub->setName("DBFilteredSubscriber");
+  sub->doNotExpire();
+  EventFactory::registerEventSubscriber(sub);
+
+  // Without filters every event is added.
+  EXPECT_EQ(sub->testAdd(1).getMessage(), "OK");
+  EXPECT_EQ(sub->numFiltered(), 0U);
+
+  // Each filter matches all of its columns, an event is kept by any filter.
+  Config::getInstance().update(
+      {{"data",
+        "{\"events\": {\"filters\": {\"DBFilteredSubscriber\": ["
+        "{\"testing\": \"hello%\", \"uptime\": \"10\"},"
+        "{\"testing\": \"other\"}]}}}"}});
+  EXPECT_EQ(sub->testAdd(2).getMessage(), "OK");
+
+  Row r = {{"testing", "hello"}, {"uptime", "11"}};
+  EXPECT_EQ(sub->add(r, 3).getMessage(), "Filtered");
+  r = {{"testing", "other"}};
+  EXPECT_EQ(sub->add(r, 4).getMessage(), "OK");
+  r = {{"uptime", "10"}};
+  EXPECT_EQ(sub->add(r, 5).getMessage(), "Filtered");
+  EXPECT_EQ(sub->numFiltered(), 2U);
+
+  // Filtered events do not use an EventID, and are not stored.
+  EXPECT_EQ(sub->getEventID(), "4");
+  EXPECT_EQ(sub->numStored(), 3U);
+
+  Config::getInstance().update({{"data", "{}"}});
+  EventFactory::end(true);
+}
 }
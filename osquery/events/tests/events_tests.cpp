@@ -8,6 +8,16 @@
  *
  */
 
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <unistd.h>
+#endif
+
 #include <boost/filesystem/operations.hpp>
 
 #include <gtest/gtest.h>
@@ -16,6 +26,8 @@
 #include <osquery/events.h>
 #include <osquery/tables.h>
 
+#include "osquery/core/allocations.h"
+
 namespace osquery {
 
 class EventsTests : public ::testing::Test {
@@ -356,11 +368,12 @@ TEST_F(EventsTests, test_event_subscriber_configure) {
   EXPECT_EQ(sub->timesConfigured, 0U);
   // Force the config into a loaded state.
   Config::getInstance().loaded_ = true;
-  Config::getInstance().update({{"data", "{}"}});
+  // Unchanged sources are not reapplied, use content this source has not had.
+  Config::getInstance().update({{"events_configure", "{\"options\": {}}"}});
   EXPECT_EQ(sub->timesConfigured, 1U);
 
   registry->remove(sub->getName());
-  Config::getInstance().update({{"data", "{}"}});
+  Config::getInstance().update({{"events_configure", "{}"}});
   EXPECT_EQ(sub->timesConfigured, 1U);
 }
 
@@ -378,6 +391,9 @@ TEST_F(EventsTests, test_fire_event) {
   status = EventFactory::addSubscription("publisher", subscription);
   pub->configure();
 
+  // The subscriber is resolved once, when the subscription is added.
+  EXPECT_NE(subscription->subscriber, nullptr);
+
   // The event context creation would normally happen in the event type.
   auto ec = pub->createEventContext();
   pub->fire(ec, 0);
@@ -397,6 +413,146 @@ TEST_F(EventsTests, test_fire_event) {
   EXPECT_EQ(kBellHathTolled, 4);
 }
 
+TEST_F(EventsTests, test_fire_allocations) {
+  auto pub = std::make_shared<BasicEventPublisher>();
+  EventFactory::registerEventPublisher(pub);
+
+  auto sub = std::make_shared<FakeEventSubscriber>();
+  EventFactory::registerEventSubscriber(sub);
+
+  auto subscription = Subscription::create("FakeSubscriber");
+  subscription->callback = [](const EventContextRef& ec,
+                              const SubscriptionContextRef& sc) {
+    recordAllocation(64);
+    recordFree(64);
+    return Status(0, "OK");
+  };
+  EventFactory::addSubscription("publisher", subscription);
+  pub->configure();
+
+  // The callback's allocations are attributed to its subscriber.
+  pub->fire(pub->createEventContext(), 0);
+  EXPECT_GE(sub->numAllocations(), 1U);
+  EXPECT_GE(sub->allocatedBytes(), 64U);
+}
+
+TEST_F(EventsTests, test_dispatch_queue) {
+  auto pub = std::make_shared<BasicEventPublisher>();
+  auto subscription = Subscription::create("FakeSubscriber");
+
+  // The callback holds the queue's thread until released.
+  std::mutex release_lock;
+  std::condition_variable release;
+  bool released = false;
+  std::atomic<size_t> dispatched{0};
+  subscription->callback = [&](const EventContextRef& ec,
+                               const SubscriptionContextRef& sc) {
+    std::unique_lock<std::mutex> lock(release_lock);
+    release.wait(lock, [&released]() { return released; });
+    dispatched++;
+    return Status(0, "OK");
+  };
+
+  EventDispatchQueue queue(2, false);
+  auto ec = pub->createEventContext();
+  EXPECT_TRUE(queue.push(pub.get(), subscription, ec));
+  // Wait for the thread to pop the first event.
+  while (queue.depth() > 0) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  // Fill the queue, the next event is dropped.
+  EXPECT_TRUE(queue.push(pub.get(), subscription, ec));
+  EXPECT_TRUE(queue.push(pub.get(), subscription, ec));
+  EXPECT_FALSE(queue.push(pub.get(), subscription, ec));
+  EXPECT_EQ(queue.depth(), 2U);
+  EXPECT_EQ(queue.drops(), 1U);
+
+  {
+    std::lock_guard<std::mutex> lock(release_lock);
+    released = true;
+  }
+  release.notify_all();
+
+  // Stopping dispatches the queued events then refuses new events.
+  queue.stop();
+  EXPECT_EQ(dispatched, 3U);
+  EXPECT_EQ(queue.depth(), 0U);
+  EXPECT_FALSE(queue.push(pub.get(), subscription, ec));
+}
+
+#ifdef __linux__
+class ReactorEventPublisher
+    : public EventPublisher<SubscriptionContext, EventContext> {
+  DECLARE_PUBLISHER("ReactorPublisher");
+
+ public:
+  Status setUp() override {
+    return (::pipe(pipe_) == 0) ? Status(0, "OK") : Status(1, "No pipe");
+  }
+
+  void tearDown() override {
+    ::close(pipe_[0]);
+    ::close(pipe_[1]);
+    torn_down = true;
+  }
+
+  int getDescriptor() const override { return pipe_[0]; }
+
+  Status run() override {
+    char c = 0;
+    if (::read(pipe_[0], &c, 1) == 1) {
+      runs++;
+    }
+    return Status(0, "OK");
+  }
+
+  void notify() {
+    char c = 0;
+    EXPECT_EQ(::write(pipe_[1], &c, 1), 1);
+  }
+
+ public:
+  std::atomic<size_t> runs{0};
+  std::atomic<bool> torn_down{false};
+
+ private:
+  int pipe_[2] = {-1, -1};
+};
+
+TEST_F(EventsTests, test_event_reactor) {
+  auto pub = std::make_shared<ReactorEventPublisher>();
+  ASSERT_TRUE(EventFactory::registerEventPublisher(pub).ok());
+
+  int reactor = ::epoll_create1(EPOLL_CLOEXEC);
+  ASSERT_GE(reactor, 0);
+  struct epoll_event event;
+  event.events = EPOLLIN;
+  event.data.u64 = 0;
+  ASSERT_EQ(
+      ::epoll_ctl(reactor, EPOLL_CTL_ADD, pub->getDescriptor(), &event), 0);
+  std::thread thread(EventFactory::react,
+                     reactor,
+                     std::vector<std::string>{"ReactorPublisher"});
+
+  // The publisher only runs when its descriptor is readable.
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_EQ(pub->runs, 0U);
+  pub->notify();
+  pub->notify();
+  for (size_t i = 0; i < 1000 && pub->runs < 2; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  EXPECT_EQ(pub->runs, 2U);
+  EXPECT_TRUE(pub->hasStarted());
+
+  // Ending the publisher stops the reactor, which tears down the publisher.
+  EventFactory::deregisterEventPublisher("ReactorPublisher");
+  thread.join();
+  EXPECT_TRUE(pub->torn_down);
+}
+#endif
+
 class SubFakeEventSubscriber : public FakeEventSubscriber {
  public:
   SubFakeEventSubscriber() { setName("SubFakeSubscriber"); }
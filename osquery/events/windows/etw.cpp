@@ -0,0 +1,427 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+#include "osquery/events/windows/etw.h"
+
+#include <tdh.h>
+
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+
+namespace osquery {
+
+FLAG(bool,
+     disable_etw,
+     true,
+     "Disable receiving events from Event Tracing for Windows");
+
+REGISTER(EtwEventPublisher, "event_publisher", "etw");
+
+/// The real-time session owned by the publisher.
+const wchar_t* kEtwSessionName = L"osquery-etw";
+
+/// Microsoft-Windows-Kernel-Process.
+const GUID kEtwKernelProcessProvider = {
+    0x22fb2cd6,
+    0x0e7b,
+    0x422b,
+    {0xa0, 0xc7, 0x2f, 0xad, 0x1f, 0xd0, 0xe7, 0x16}};
+
+/// Microsoft-Windows-Kernel-Network.
+const GUID kEtwKernelNetworkProvider = {
+    0x7dd42a49,
+    0x5329,
+    0x4832,
+    {0x8d, 0xfd, 0x43, 0xd9, 0x79, 0x15, 0x3a, 0x88}};
+
+/// The kernel process provider's process and image keywords.
+const ULONGLONG kEtwKeywordProcess = 0x10;
+const ULONGLONG kEtwKeywordImage = 0x40;
+
+/// The kernel network provider's IPv4 and IPv6 keywords.
+const ULONGLONG kEtwKeywordNetwork = 0x10 | 0x20;
+
+/// The kernel process provider's event identifiers.
+const USHORT kEtwProcessStartId = 1;
+const USHORT kEtwProcessStopId = 2;
+const USHORT kEtwImageLoadId = 5;
+
+/// The kernel network provider's TCP event identifiers.
+const USHORT kEtwConnectIPv4Id = 12;
+const USHORT kEtwAcceptIPv4Id = 15;
+const USHORT kEtwConnectIPv6Id = 28;
+const USHORT kEtwAcceptIPv6Id = 31;
+
+/// FILETIME intervals between 1601 and the UNIX epoch.
+const ULONGLONG kEtwEpochDifference = 116444736000000000ULL;
+
+/// FILETIME intervals per second.
+const ULONGLONG kEtwTicksPerSecond = 10000000ULL;
+
+static std::string wideToString(const wchar_t* src, size_t length) {
+  if (src == nullptr || length == 0) {
+    return "";
+  }
+
+  auto size = ::WideCharToMultiByte(CP_UTF8,
+                                    0,
+                                    src,
+                                    static_cast<int>(length),
+                                    nullptr,
+                                    0,
+                                    nullptr,
+                                    nullptr);
+  if (size <= 0) {
+    return "";
+  }
+
+  std::string result(size, '\0');
+  ::WideCharToMultiByte(CP_UTF8,
+                        0,
+                        src,
+                        static_cast<int>(length),
+                        &result[0],
+                        size,
+                        nullptr,
+                        nullptr);
+  return result;
+}
+
+/// Read a named property of an event, false if the event has none.
+static bool getEventProperty(PEVENT_RECORD record,
+                             const wchar_t* name,
+                             std::vector<BYTE>& data) {
+  PROPERTY_DATA_DESCRIPTOR descriptor;
+  descriptor.PropertyName = reinterpret_cast<ULONGLONG>(name);
+  descriptor.ArrayIndex = ULONG_MAX;
+  descriptor.Reserved = 0;
+
+  ULONG size = 0;
+  if (::TdhGetPropertySize(record, 0, nullptr, 1, &descriptor, &size) !=
+          ERROR_SUCCESS ||
+      size == 0) {
+    return false;
+  }
+
+  data.resize(size);
+  return ::TdhGetProperty(
+             record, 0, nullptr, 1, &descriptor, size, data.data()) ==
+         ERROR_SUCCESS;
+}
+
+/// Read a named integer property, 0 if the event has none.
+template <typename T>
+static T getEventInteger(PEVENT_RECORD record, const wchar_t* name) {
+  std::vector<BYTE> data;
+  T value = 0;
+  if (getEventProperty(record, name, data) && data.size() >= sizeof(T)) {
+    memcpy(&value, data.data(), sizeof(T));
+  }
+  return value;
+}
+
+/// Read a named string property, empty if the event has none.
+static std::string getEventString(PEVENT_RECORD record, const wchar_t* name) {
+  std::vector<BYTE> data;
+  if (!getEventProperty(record, name, data)) {
+    return "";
+  }
+
+  auto value = reinterpret_cast<const wchar_t*>(data.data());
+  return wideToString(value, wcsnlen(value, data.size() / sizeof(wchar_t)));
+}
+
+/// Read a named address property of a TCP event.
+static std::string getEventAddress(PEVENT_RECORD record,
+                                   const wchar_t* name,
+                                   int family) {
+  std::vector<BYTE> data;
+  size_t size = (family == AF_INET) ? 4 : 16;
+  char address[INET6_ADDRSTRLEN] = {0};
+  if (!getEventProperty(record, name, data) || data.size() < size ||
+      ::inet_ntop(family, data.data(), address, sizeof(address)) == nullptr) {
+    return "";
+  }
+  return address;
+}
+
+Status EtwEventPublisher::setUp() {
+  if (FLAGS_disable_etw) {
+    return Status(1, "Publisher disabled via configuration");
+  }
+
+  WriteLock lock(mutex_);
+  auto status = ::StartTraceW(&session_, kEtwSessionName, getProperties());
+  if (status == ERROR_ALREADY_EXISTS) {
+    // The session outlived a previous osquery process.
+    ::ControlTraceW(
+        0, kEtwSessionName, getProperties(), EVENT_TRACE_CONTROL_STOP);
+    status = ::StartTraceW(&session_, kEtwSessionName, getProperties());
+  }
+
+  if (status != ERROR_SUCCESS) {
+    session_ = 0;
+    return Status(1, "Cannot start the ETW session: " + std::to_string(status));
+  }
+
+  // Provider events name files by kernel device.
+  wchar_t drive[] = L"A:";
+  std::vector<wchar_t> device(MAX_PATH);
+  for (wchar_t letter = L'A'; letter <= L'Z'; letter++) {
+    drive[0] = letter;
+    auto size = ::QueryDosDeviceW(
+        drive, device.data(), static_cast<DWORD>(device.size()));
+    if (size > 0) {
+      devices_[wideToString(device.data(), wcslen(device.data()))] =
+          wideToString(drive, 2);
+    }
+  }
+  return Status(0, "OK");
+}
+
+PEVENT_TRACE_PROPERTIES EtwEventPublisher::getProperties() {
+  // The session name follows the properties, where StartTrace copies it.
+  auto name_size = (wcslen(kEtwSessionName) + 1) * sizeof(wchar_t);
+  properties_.assign(sizeof(EVENT_TRACE_PROPERTIES) + name_size, 0);
+  auto properties =
+      reinterpret_cast<PEVENT_TRACE_PROPERTIES>(properties_.data());
+  properties->Wnode.BufferSize = static_cast<ULONG>(properties_.size());
+  properties->Wnode.Flags = WNODE_FLAG_TRACED_GUID;
+  // Event timestamps are system times.
+  properties->Wnode.ClientContext = 2;
+  properties->LogFileMode = EVENT_TRACE_REAL_TIME_MODE;
+  properties->LoggerNameOffset = sizeof(EVENT_TRACE_PROPERTIES);
+  // Partially filled buffers are delivered every second.
+  properties->FlushTimer = 1;
+  properties->BufferSize = 64;
+  return properties;
+}
+
+void EtwEventPublisher::enableProvider(const GUID& provider,
+                                       ULONGLONG keywords,
+                                       bool enable) {
+  auto status = ::EnableTraceEx2(session_,
+                                 &provider,
+                                 (enable) ? EVENT_CONTROL_CODE_ENABLE_PROVIDER
+                                          : EVENT_CONTROL_CODE_DISABLE_PROVIDER,
+                                 TRACE_LEVEL_INFORMATION,
+                                 keywords,
+                                 0,
+                                 0,
+                                 nullptr);
+  if (status != ERROR_SUCCESS) {
+    VLOG(1) << "Cannot change an ETW provider: " << status;
+  }
+}
+
+void EtwEventPublisher::configure() {
+  std::set<EtwEventType> types;
+  {
+    WriteLock lock(subscriptions_lock_);
+    for (auto& sub : subscriptions_) {
+      auto sc = getSubscriptionContext(sub->context);
+      if (sc->types.empty()) {
+        types = {ETW_EVENT_PROCESS_START,
+                 ETW_EVENT_PROCESS_STOP,
+                 ETW_EVENT_IMAGE_LOAD,
+                 ETW_EVENT_CONNECT,
+                 ETW_EVENT_ACCEPT};
+        break;
+      }
+      types.insert(sc->types.begin(), sc->types.end());
+    }
+  }
+
+  WriteLock lock(mutex_);
+  if (session_ == 0 || types == enabled_) {
+    return;
+  }
+
+  // Image loads are frequent, they are only enabled when subscribed.
+  ULONGLONG process = 0;
+  if (types.count(ETW_EVENT_PROCESS_START) > 0 ||
+      types.count(ETW_EVENT_PROCESS_STOP) > 0) {
+    process |= kEtwKeywordProcess;
+  }
+  if (types.count(ETW_EVENT_IMAGE_LOAD) > 0) {
+    process |= kEtwKeywordImage;
+  }
+  enableProvider(kEtwKernelProcessProvider, process, process != 0);
+
+  auto network = types.count(ETW_EVENT_CONNECT) > 0 ||
+                 types.count(ETW_EVENT_ACCEPT) > 0;
+  enableProvider(kEtwKernelNetworkProvider, kEtwKeywordNetwork, network);
+  enabled_ = std::move(types);
+}
+
+void EtwEventPublisher::tearDown() {
+  stop();
+
+  WriteLock lock(mutex_);
+  if (session_ != 0) {
+    ::ControlTraceW(
+        session_, nullptr, getProperties(), EVENT_TRACE_CONTROL_STOP);
+    session_ = 0;
+  }
+  enabled_.clear();
+}
+
+void EtwEventPublisher::stop() {
+  WriteLock lock(mutex_);
+  if (consumer_ != INVALID_PROCESSTRACE_HANDLE) {
+    // ProcessTrace returns once the buffers being delivered are consumed.
+    ::CloseTrace(consumer_);
+    consumer_ = INVALID_PROCESSTRACE_HANDLE;
+  }
+}
+
+Status EtwEventPublisher::run() {
+  TRACEHANDLE consumer = INVALID_PROCESSTRACE_HANDLE;
+  {
+    WriteLock lock(mutex_);
+    if (session_ == 0) {
+      return Status(1, "No ETW session");
+    }
+
+    EVENT_TRACE_LOGFILEW logfile;
+    memset(&logfile, 0, sizeof(logfile));
+    logfile.LoggerName = const_cast<LPWSTR>(kEtwSessionName);
+    logfile.ProcessTraceMode =
+        PROCESS_TRACE_MODE_REAL_TIME | PROCESS_TRACE_MODE_EVENT_RECORD;
+    logfile.EventRecordCallback = &EtwEventPublisher::onEventRecord;
+    logfile.BufferCallback = &EtwEventPublisher::onBuffer;
+    logfile.Context = this;
+
+    consumer_ = ::OpenTraceW(&logfile);
+    if (consumer_ == INVALID_PROCESSTRACE_HANDLE) {
+      return Status(1, "Cannot consume the ETW session");
+    }
+    consumer = consumer_;
+  }
+
+  // Events are delivered on this thread until stop closes the consumer.
+  auto status = ::ProcessTrace(&consumer, 1, nullptr, nullptr);
+  stop();
+  if (status != ERROR_SUCCESS && status != ERROR_CANCELLED &&
+      !isEnding()) {
+    return Status(1, "ETW session consumer failed: " + std::to_string(status));
+  }
+  return Status(0, "OK");
+}
+
+VOID WINAPI EtwEventPublisher::onEventRecord(PEVENT_RECORD record) {
+  auto publisher = static_cast<EtwEventPublisher*>(record->UserContext);
+  auto ec = publisher->createEventContextFrom(record);
+  if (ec != nullptr) {
+    publisher->batch_.push_back(ec);
+  }
+}
+
+ULONG WINAPI EtwEventPublisher::onBuffer(PEVENT_TRACE_LOGFILEW logfile) {
+  auto publisher = static_cast<EtwEventPublisher*>(logfile->Context);
+  if (!publisher->batch_.empty()) {
+    publisher->fireBatch(publisher->batch_);
+    publisher->batch_.clear();
+  }
+  // Returning FALSE ends ProcessTrace.
+  return (publisher->isEnding()) ? FALSE : TRUE;
+}
+
+std::string EtwEventPublisher::getDosPath(const std::string& path) const {
+  // Paths may also use the \??\ prefix of DOS device names.
+  if (path.compare(0, 4, "\\??\\") == 0) {
+    return path.substr(4);
+  }
+
+  for (const auto& device : devices_) {
+    if (path.size() > device.first.size() &&
+        path.compare(0, device.first.size(), device.first) == 0 &&
+        path[device.first.size()] == '\\') {
+      return device.second + path.substr(device.first.size());
+    }
+  }
+  return path;
+}
+
+EtwEventContextRef EtwEventPublisher::createEventContextFrom(
+    PEVENT_RECORD record) {
+  const auto& header = record->EventHeader;
+  auto id = header.EventDescriptor.Id;
+
+  EtwEventType type;
+  if (IsEqualGUID(header.ProviderId, kEtwKernelProcessProvider)) {
+    if (id == kEtwProcessStartId) {
+      type = ETW_EVENT_PROCESS_START;
+    } else if (id == kEtwProcessStopId) {
+      type = ETW_EVENT_PROCESS_STOP;
+    } else if (id == kEtwImageLoadId) {
+      type = ETW_EVENT_IMAGE_LOAD;
+    } else {
+      return nullptr;
+    }
+  } else if (IsEqualGUID(header.ProviderId, kEtwKernelNetworkProvider)) {
+    if (id == kEtwConnectIPv4Id || id == kEtwConnectIPv6Id) {
+      type = ETW_EVENT_CONNECT;
+    } else if (id == kEtwAcceptIPv4Id || id == kEtwAcceptIPv6Id) {
+      type = ETW_EVENT_ACCEPT;
+    } else {
+      return nullptr;
+    }
+  } else {
+    return nullptr;
+  }
+
+  {
+    WriteLock lock(mutex_);
+    if (enabled_.count(type) == 0) {
+      // A keyword enables other events of the same provider.
+      return nullptr;
+    }
+  }
+
+  auto ec = createEventContext();
+  ec->type = type;
+  auto timestamp = static_cast<ULONGLONG>(header.TimeStamp.QuadPart);
+  if (timestamp > kEtwEpochDifference) {
+    ec->time = (timestamp - kEtwEpochDifference) / kEtwTicksPerSecond;
+  }
+  ec->uptime = ::GetTickCount64() / 1000;
+
+  if (type == ETW_EVENT_CONNECT || type == ETW_EVENT_ACCEPT) {
+    ec->pid = getEventInteger<ULONG>(record, L"PID");
+    ec->family = (id == kEtwConnectIPv4Id || id == kEtwAcceptIPv4Id)
+                     ? AF_INET
+                     : AF_INET6;
+    // The addresses and ports are those of the local host, and its peer.
+    ec->local_address = getEventAddress(record, L"saddr", ec->family);
+    ec->remote_address = getEventAddress(record, L"daddr", ec->family);
+    ec->local_port = ntohs(getEventInteger<USHORT>(record, L"sport"));
+    ec->remote_port = ntohs(getEventInteger<USHORT>(record, L"dport"));
+    return ec;
+  }
+
+  ec->pid = getEventInteger<ULONG>(record, L"ProcessID");
+  ec->path = getDosPath(getEventString(record, L"ImageName"));
+  if (type == ETW_EVENT_PROCESS_START) {
+    ec->parent = getEventInteger<ULONG>(record, L"ParentProcessID");
+  } else if (type == ETW_EVENT_PROCESS_STOP) {
+    ec->exit_code = getEventInteger<ULONG>(record, L"ExitCode");
+  }
+  return ec;
+}
+
+bool EtwEventPublisher::shouldFire(const EtwSubscriptionContextRef& sc,
+                                   const EtwEventContextRef& ec) const {
+  return sc->types.empty() || sc->types.count(ec->type) > 0;
+}
+}
@@ -0,0 +1,161 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+
+#include <evntrace.h>
+#include <evntcons.h>
+
+#include <osquery/events.h>
+#include <osquery/status.h>
+
+namespace osquery {
+
+/// The published events, each is parsed from a kernel provider's event.
+enum EtwEventType {
+  ETW_EVENT_PROCESS_START = 1,
+  ETW_EVENT_PROCESS_STOP = 2,
+  ETW_EVENT_IMAGE_LOAD = 3,
+  ETW_EVENT_CONNECT = 4,
+  ETW_EVENT_ACCEPT = 5,
+};
+
+/**
+ * @brief Subscription details for EtwEventPublisher events.
+ */
+struct EtwSubscriptionContext : public SubscriptionContext {
+  /// The published events to receive, empty receives every event.
+  std::set<EtwEventType> types;
+};
+
+/**
+ * @brief Event details for EtwEventPublisher events.
+ *
+ * The members filled in depend on the event type: process events fill the
+ * process and path members, network events fill the process and address
+ * members.
+ */
+struct EtwEventContext : public EventContext {
+  /// The traced action.
+  EtwEventType type{ETW_EVENT_PROCESS_START};
+
+  unsigned long pid{0};
+
+  /// The parent of a started process.
+  unsigned long parent{0};
+
+  /// The process or loaded image, translated to a drive letter path.
+  std::string path;
+
+  /// The stopped process's exit code.
+  unsigned long exit_code{0};
+
+  /// AF_INET or AF_INET6 for network events.
+  int family{0};
+
+  std::string local_address;
+  unsigned short local_port{0};
+  std::string remote_address;
+  unsigned short remote_port{0};
+
+  /// The seconds since boot the event was received.
+  unsigned long long uptime{0};
+};
+
+using EtwEventContextRef = std::shared_ptr<EtwEventContext>;
+using EtwSubscriptionContextRef = std::shared_ptr<EtwSubscriptionContext>;
+
+/**
+ * @brief A Windows Event Tracing (ETW) EventPublisher.
+ *
+ * The publisher owns a real-time trace session with the kernel process
+ * provider, for process starts, stops and image loads, and the kernel network
+ * provider, for TCP/IP connects and accepts. Only the providers and keywords
+ * needed by the subscriptions are enabled.
+ *
+ * ETW delivers events one buffer at a time. The events of a buffer are
+ * collected as they are parsed and fired as a batch once the buffer has been
+ * delivered, so the subscribers are resolved once per buffer.
+ */
+class EtwEventPublisher
+    : public EventPublisher<EtwSubscriptionContext, EtwEventContext> {
+  DECLARE_PUBLISHER("etw");
+
+ public:
+  /// Start the trace session.
+  Status setUp() override;
+
+  /// Enable the providers needed by the subscriptions.
+  void configure() override;
+
+  /// Stop the trace session.
+  void tearDown() override;
+
+  /// Consume the session's events until it is stopped.
+  Status run() override;
+
+  /// Close the session's consumer, its run returns.
+  void stop() override;
+
+ public:
+  /// Translate a kernel device path, such as \Device\HarddiskVolume2\...
+  std::string getDosPath(const std::string& path) const;
+
+  /// Parse an event record into an EventContext, nullptr if not published.
+  EtwEventContextRef createEventContextFrom(PEVENT_RECORD record);
+
+ private:
+  /// Check subscription details.
+  bool shouldFire(const EtwSubscriptionContextRef& sc,
+                  const EtwEventContextRef& ec) const override;
+
+  /// Reset the session properties, which trace calls use and overwrite.
+  PEVENT_TRACE_PROPERTIES getProperties();
+
+  /// Enable or disable a provider's keywords in the session.
+  void enableProvider(const GUID& provider, ULONGLONG keywords, bool enable);
+
+  /// Called by ETW for each event record.
+  static VOID WINAPI onEventRecord(PEVENT_RECORD record);
+
+  /// Called by ETW after the events of a buffer were delivered.
+  static ULONG WINAPI onBuffer(PEVENT_TRACE_LOGFILEW logfile);
+
+ private:
+  /// The trace session, used to enable providers and stop the session.
+  TRACEHANDLE session_{0};
+
+  /// The session's real-time consumer.
+  TRACEHANDLE consumer_{INVALID_PROCESSTRACE_HANDLE};
+
+  /// The session properties, followed by space for the session name.
+  std::vector<char> properties_;
+
+  /// The published events enabled in the session.
+  std::set<EtwEventType> enabled_;
+
+  /// The events of the buffer being delivered.
+  std::vector<EventContextRef> batch_;
+
+  /// Drive letters by kernel device name, such as \Device\HarddiskVolume2.
+  std::map<std::string, std::string> devices_;
+
+  /// Protect the session handles.
+  mutable Mutex mutex_;
+};
+}
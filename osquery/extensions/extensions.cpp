@@ -8,7 +8,14 @@
  *
  */
 
+#include <algorithm>
+#include <chrono>
 #include <csignal>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
 
 #include <boost/algorithm/string/trim.hpp>
 
@@ -23,6 +30,7 @@
 #include "osquery/core/process.h"
 #include "osquery/core/watcher.h"
 #include "osquery/extensions/interface.h"
+#include "osquery/extensions/shared_ring.h"
 
 using namespace osquery::extensions;
 
@@ -72,6 +80,21 @@ CLI_FLAG(string,
          "3",
          "Seconds delay between connectivity checks")
 
+CLI_FLAG(uint64,
+         extensions_server_threads,
+         16,
+         "Threads serving extension API connections (0 for one each)");
+
+CLI_FLAG(uint64,
+         extensions_concurrency,
+         4,
+         "Most concurrent requests to each extension");
+
+CLI_FLAG(uint64,
+         extensions_ring_size,
+         0,
+         "KB of shared memory for extension logger requests (0 to disable)");
+
 CLI_FLAG(string,
          modules_autoload,
          "/etc/osquery/modules.load",
@@ -89,6 +112,118 @@ CLI_FLAG(string,
 EXTENSION_FLAG_ALIAS(socket, extensions_socket);
 EXTENSION_FLAG_ALIAS(timeout, extensions_timeout);
 EXTENSION_FLAG_ALIAS(interval, extensions_interval);
+EXTENSION_FLAG_ALIAS(ring_size, extensions_ring_size);
+
+/// The most idle clients kept connected to each extension.
+const size_t kExtensionMaxIdleClients = 4;
+
+Status extensionPathActive(const std::string& path, bool use_timeout = false);
+
+Status EXClientPool::get(const std::string& path, EXClientRef& client) {
+  auto& pool = instance();
+  std::unique_lock<std::mutex> lock(pool.mutex_);
+  auto limit = std::max<size_t>(FLAGS_extensions_concurrency, 1);
+  auto timeout = std::chrono::seconds(atoi(FLAGS_extensions_timeout.c_str()));
+  if (!pool.released_.wait_for(lock, timeout, [&pool, &path, limit]() {
+        return pool.requests_[path] < limit;
+      })) {
+    return Status(1, "Extension has too many requests: " + path);
+  }
+  pool.requests_[path]++;
+
+  client = nullptr;
+  auto clients = pool.clients_.find(path);
+  if (clients != pool.clients_.end() && !clients->second.empty()) {
+    client = std::move(clients->second.back());
+    clients->second.pop_back();
+  }
+  return Status(0, "OK");
+}
+
+void EXClientPool::release(const std::string& path, EXClientRef&& client) {
+  auto& pool = instance();
+  {
+    std::lock_guard<std::mutex> lock(pool.mutex_);
+    auto& requests = pool.requests_[path];
+    if (requests > 0) {
+      requests--;
+    }
+    auto& clients = pool.clients_[path];
+    if (client != nullptr && clients.size() < kExtensionMaxIdleClients) {
+      clients.push_back(std::move(client));
+    }
+  }
+  pool.released_.notify_one();
+}
+
+void EXClientPool::remove(const std::string& path) {
+  std::vector<EXClientRef> clients;
+  {
+    auto& pool = instance();
+    std::lock_guard<std::mutex> lock(pool.mutex_);
+    auto it = pool.clients_.find(path);
+    if (it == pool.clients_.end()) {
+      return;
+    }
+    clients.swap(it->second);
+    pool.clients_.erase(it);
+  }
+  // The clients are closed outside of the pool lock.
+}
+
+size_t EXClientPool::count(const std::string& path) {
+  auto& pool = instance();
+  std::lock_guard<std::mutex> lock(pool.mutex_);
+  auto clients = pool.clients_.find(path);
+  return (clients == pool.clients_.end()) ? 0 : clients->second.size();
+}
+
+/**
+ * @brief Call an extension using a persistent client.
+ *
+ * An idle client may have been closed by the extension. If a borrowed client
+ * fails in the transport the clients are closed and the call is attempted
+ * once more using a new connection.
+ */
+static Status callWithClient(const std::string& path,
+                             std::function<void(EXClient&)> call) {
+  EXClientRef client;
+  auto status = EXClientPool::get(path, client);
+  if (!status.ok()) {
+    return status;
+  }
+
+  bool reused = (client != nullptr);
+  if (!reused) {
+    // Make sure the extension path exists, and is writable.
+    status = extensionPathActive(path);
+  }
+
+  while (status.ok()) {
+    try {
+      if (client == nullptr) {
+        client = std::make_shared<EXClient>(path);
+      }
+      call(*client);
+      break;
+    } catch (const TTransportException& e) {
+      status = Status(1, "Extension call failed: " + std::string(e.what()));
+      if (reused) {
+        EXClientPool::remove(path);
+        status = Status(0, "OK");
+        reused = false;
+      }
+      client = nullptr;
+    } catch (const std::exception& e) {
+      status = Status(1, "Extension call failed: " + std::string(e.what()));
+      client = nullptr;
+    }
+  }
+
+  // Failed clients are not returned to the pool.
+  EXClientPool::release(path, std::move(client));
+  return status;
+}
 
 void ExtensionWatcher::start() {
   // Watch the manager, if the socket is removed then the extension will die.
@@ -110,8 +245,10 @@ void ExtensionManagerWatcher::start() {
   // When interrupted, request each extension tear down.
   const auto uuids = Registry::routeUUIDs();
   for (const auto& uuid : uuids) {
+    auto path = getExtensionSocket(uuid);
+    // Idle clients would keep the extension's server from stopping.
+    EXClientPool::remove(path);
     try {
-      auto path = getExtensionSocket(uuid);
       auto client = EXClient(path);
       client.get()->shutdown();
     } catch (const std::exception& e) {
@@ -162,36 +299,54 @@ void ExtensionManagerWatcher::watch() {
   // will be deregistered.
   const auto uuids = Registry::routeUUIDs();
 
-  ExtensionStatus status;
-  for (const auto& uuid : uuids) {
-    auto path = getExtensionSocket(uuid);
-    if (isWritable(path)) {
-      try {
-        auto client = EXClient(path);
-        // Ping the extension until it goes down.
-        client.get()->ping(status);
-      } catch (const std::exception& e) {
-        failures_[uuid] += 1;
-        continue;
+  // Extensions are pinged concurrently, so an extension that is slow to
+  // respond, or still starting, does not delay the others.
+  std::vector<size_t> failures(uuids.size(), 0);
+  std::vector<std::thread> pings;
+  for (size_t i = 0; i < uuids.size(); i++) {
+    pings.emplace_back([&uuids, &failures, i]() {
+      auto path = getExtensionSocket(uuids[i]);
+      if (!isWritable(path)) {
+        // Immediate fail non-writable paths.
+        EXClientPool::remove(path);
+        failures[i] = 3;
+        return;
       }
-    } else {
-      // Immediate fail non-writable paths.
-      failures_[uuid] = 3;
-      continue;
-    }
 
-    if (status.code != ExtensionCode::EXT_SUCCESS) {
-      LOG(INFO) << "Extension UUID " << uuid << " ping failed";
-      failures_[uuid] += 1;
+      // Ping the extension until it goes down, this also checks the health
+      // of the persistent clients.
+      ExtensionStatus status;
+      auto ping = callWithClient(
+          path, ([&status](EXClient& client) { client.get()->ping(status); }));
+      if (!ping.ok()) {
+        EXClientPool::remove(path);
+        failures[i] = 1;
+      } else if (status.code != ExtensionCode::EXT_SUCCESS) {
+        LOG(INFO) << "Extension UUID " << uuids[i] << " ping failed";
+        failures[i] = 1;
+      }
+    });
+  }
+  for (auto& ping : pings) {
+    ping.join();
+  }
+
+  for (size_t i = 0; i < uuids.size(); i++) {
+    if (failures[i] == 3) {
+      failures_[uuids[i]] = 3;
+    } else if (failures[i] > 0) {
+      failures_[uuids[i]] += 1;
     } else {
-      failures_[uuid] = 0;
+      failures_[uuids[i]] = 0;
     }
   }
 
   for (const auto& uuid : failures_) {
     if (uuid.second >= 3) {
       LOG(INFO) << "Extension UUID " << uuid.first << " has gone away";
+      EXClientPool::remove(getExtensionSocket(uuid.first));
       Registry::removeBroadcast(uuid.first);
+      detachExtensionRing(uuid.first);
       failures_[uuid.first] = 0;
     }
   }
@@ -311,7 +466,7 @@ Status loadModules(const std::string& loadfile) {
   return Status(1, "Failed reading: " + loadfile);
 }
 
-Status extensionPathActive(const std::string& path, bool use_timeout = false) {
+Status extensionPathActive(const std::string& path, bool use_timeout) {
   // Make sure the extension manager path exists, and is writable.
   size_t delay = 0;
   // The timeout is given in seconds, but checked interval is microseconds.
@@ -384,6 +539,18 @@ Status startExtension(const std::string& manager_path,
   info.sdk_version = sdk_version;
   info.min_sdk_version = min_sdk_version;
 
+  // Optionally receive bulk logger requests through shared memory.
+  std::shared_ptr<SharedRing> ring;
+  if (FLAGS_extensions_ring_size > 0) {
+    status = SharedRing::create(FLAGS_extensions_ring_size * 1024, ring);
+    if (status.ok()) {
+      info.shared_ring = ring->name();
+    } else {
+      LOG(WARNING) << "Extension ring not used: " << status.getMessage();
+      ring = nullptr;
+    }
+  }
+
   // If registration is successful, we will also request the manager's options.
   InternalOptionList options;
   // Register the extension's registry broadcast with the manager.
@@ -404,6 +571,11 @@ Status startExtension(const std::string& manager_path,
     return Status(1, "Extension register failed: " + std::string(e.what()));
   }
 
+  // The manager has mapped the ring, the name is no longer needed.
+  if (ring != nullptr) {
+    ring->unlink();
+  }
+
   // Now that the uuid is known, try to clean up stale socket paths.
   auto extension_path = getExtensionSocket(ext_status.uuid, manager_path);
   status = socketWritable(extension_path);
@@ -421,6 +593,9 @@ Status startExtension(const std::string& manager_path,
   // Start the extension's Thrift server
   Dispatcher::addService(
       std::make_shared<ExtensionRunner>(manager_path, ext_status.uuid));
+  if (ring != nullptr) {
+    Dispatcher::addService(std::make_shared<ExtensionRingRunner>(ring));
+  }
   VLOG(1) << "Extension (" << name << ", " << ext_status.uuid << ", " << version
           << ", " << sdk_version << ") registered";
   return Status(0, std::to_string(ext_status.uuid));
@@ -492,20 +667,14 @@ Status pingExtension(const std::string& path) {
     return Status(1, "Extensions disabled");
   }
 
-  // Make sure the extension path exists, and is writable.
-  auto status = extensionPathActive(path);
+  ExtensionStatus ext_status;
+  auto status = callWithClient(
+      path,
+      ([&ext_status](EXClient& client) { client.get()->ping(ext_status); }));
   if (!status.ok()) {
     return status;
   }
 
-  ExtensionStatus ext_status;
-  try {
-    auto client = EXClient(path);
-    client.get()->ping(ext_status);
-  } catch (const std::exception& e) {
-    return Status(1, "Extension call failed: " + std::string(e.what()));
-  }
-
   return Status(ext_status.code, ext_status.message);
 }
 
@@ -553,6 +722,13 @@ Status callExtension(const RouteUUID uuid,
   if (FLAGS_disable_extensions) {
     return Status(1, "Extensions disabled");
   }
+
+  // Result lines skip Thrift when the extension's ring has space.
+  if (registry == "logger" && request.size() == 1 &&
+      (request.count("string") > 0 || request.count("strings") > 0) &&
+      writeExtensionRing(uuid, item, request)) {
+    return Status(0, "OK");
+  }
   return callExtension(
       getExtensionSocket(uuid), registry, item, request, response);
 }
@@ -562,20 +738,17 @@ Status callExtension(const std::string& extension_path,
                      const std::string& item,
                      const PluginRequest& request,
                      PluginResponse& response) {
-  // Make sure the extension manager path exists, and is writable.
-  auto status = extensionPathActive(extension_path);
+  // Extension table and logger calls reuse a persistent client.
+  ExtensionResponse ext_response;
+  auto status = callWithClient(
+      extension_path,
+      ([&ext_response, &registry, &item, &request](EXClient& client) {
+        client.get()->call(ext_response, registry, item, request);
+      }));
   if (!status.ok()) {
     return status;
   }
 
-  ExtensionResponse ext_response;
-  try {
-    auto client = EXClient(extension_path);
-    client.get()->call(ext_response, registry, item, request);
-  } catch (const std::exception& e) {
-    return Status(1, "Extension call failed: " + std::string(e.what()));
-  }
-
   // Convert from Thrift-internal list type to PluginResponse type.
   if (ext_response.status.code == ExtensionCode::EXT_SUCCESS) {
     for (const auto& item : ext_response.response) {
@@ -585,6 +758,174 @@ Status callExtension(const std::string& extension_path,
   return Status(ext_response.status.code, ext_response.status.message);
 }
 
+Status callExtensionColumns(const RouteUUID uuid,
+                            const std::string& table,
+                            const PluginRequest& request,
+                            ColumnarData& results) {
+  if (FLAGS_disable_extensions) {
+    return Status(1, "Extensions disabled");
+  }
+  return callExtensionColumns(
+      getExtensionSocket(uuid), table, request, results);
+}
+
+/// Extension sockets and the optional API methods they do not implement.
+static std::set<std::pair<std::string, std::string>> kExtensionUnsupported;
+static std::mutex kExtensionUnsupportedMutex;
+
+/// Check if an extension replied that an optional API method is unknown.
+static bool extensionUnsupported(const std::string& path,
+                                 const std::string& method) {
+  std::lock_guard<std::mutex> lock(kExtensionUnsupportedMutex);
+  return (kExtensionUnsupported.count(std::make_pair(path, method)) > 0);
+}
+
+/// Remember an extension does not implement an optional API method.
+static void setExtensionUnsupported(const std::string& path,
+                                    const std::string& method) {
+  std::lock_guard<std::mutex> lock(kExtensionUnsupportedMutex);
+  kExtensionUnsupported.insert(std::make_pair(path, method));
+}
+
+Status callExtensionColumns(const std::string& extension_path,
+                            const std::string& table,
+                            const PluginRequest& request,
+                            ColumnarData& results) {
+  if (extensionUnsupported(extension_path, "callColumns")) {
+    return Status(1, "Extension does not support columns");
+  }
+
+  ExtensionColumnarResponse ext_response;
+  bool unsupported = false;
+  auto status = callWithClient(
+      extension_path,
+      ([&ext_response, &unsupported, &table, &request](EXClient& client) {
+        try {
+          client.get()->callColumns(ext_response, "table", table, request);
+        } catch (const TApplicationException& e) {
+          // Older extensions reply that the method is unknown.
+          if (e.getType() != TApplicationException::UNKNOWN_METHOD) {
+            throw;
+          }
+          unsupported = true;
+        }
+      }));
+  if (!status.ok()) {
+    return status;
+  }
+
+  if (unsupported) {
+    setExtensionUnsupported(extension_path, "callColumns");
+    return Status(1, "Extension does not support columns");
+  }
+
+  if (ext_response.status.code != ExtensionCode::EXT_SUCCESS) {
+    return Status(ext_response.status.code, ext_response.status.message);
+  }
+  return deserializeColumnarData(ext_response, results);
+}
+
+/// The most rows in each batch read from an extension table cursor.
+const int32_t kExtensionCursorBatchRows = 1024;
+
+/// Read the batches of an extension table cursor.
+class ExtensionCursorGenerator : public ColumnarGenerator {
+ public:
+  ExtensionCursorGenerator(const std::string& path, int64_t cursor)
+      : path_(path), cursor_(cursor) {}
+
+  ~ExtensionCursorGenerator() {
+    if (!done_) {
+      // The query stopped early, release the extension's cursor.
+      auto cursor = cursor_;
+      callWithClient(path_, ([cursor](EXClient& client) {
+                       client.get()->closeCursor(cursor);
+                     }));
+    }
+  }
+
+  bool next(ColumnarData& results) override {
+    if (done_) {
+      return false;
+    }
+
+    ExtensionColumnarResponse response;
+    auto cursor = cursor_;
+    auto status = callWithClient(
+        path_, ([&response, cursor](EXClient& client) {
+          client.get()->nextBatch(response, cursor);
+        }));
+    if (status.ok() && response.status.code != ExtensionCode::EXT_SUCCESS) {
+      status = Status(response.status.code, response.status.message);
+    }
+    if (status.ok()) {
+      status = deserializeColumnarData(response, results);
+    }
+
+    if (!status.ok()) {
+      VLOG(1) << "Extension cursor failed: " << status.getMessage();
+    }
+    done_ = (!status.ok() || results.rows() == 0);
+    return !done_;
+  }
+
+ private:
+  std::string path_;
+  int64_t cursor_{0};
+
+  /// True once the extension closed the cursor.
+  bool done_{false};
+};
+
+Status callExtensionCursor(const RouteUUID uuid,
+                           const std::string& table,
+                           const PluginRequest& request,
+                           ColumnarGeneratorRef& batches) {
+  if (FLAGS_disable_extensions) {
+    return Status(1, "Extensions disabled");
+  }
+  return callExtensionCursor(getExtensionSocket(uuid), table, request, batches);
+}
+
+Status callExtensionCursor(const std::string& extension_path,
+                           const std::string& table,
+                           const PluginRequest& request,
+                           ColumnarGeneratorRef& batches) {
+  if (extensionUnsupported(extension_path, "openCursor")) {
+    return Status(1, "Extension does not support cursors");
+  }
+
+  ExtensionCursor cursor;
+  bool unsupported = false;
+  auto status = callWithClient(
+      extension_path,
+      ([&cursor, &unsupported, &table, &request](EXClient& client) {
+        try {
+          client.get()->openCursor(
+              cursor, table, request, kExtensionCursorBatchRows);
+        } catch (const TApplicationException& e) {
+          if (e.getType() != TApplicationException::UNKNOWN_METHOD) {
+            throw;
+          }
+          unsupported = true;
+        }
+      }));
+  if (!status.ok()) {
+    return status;
+  }
+
+  if (unsupported) {
+    setExtensionUnsupported(extension_path, "openCursor");
+    return Status(1, "Extension does not support cursors");
+  }
+
+  if (cursor.status.code != ExtensionCode::EXT_SUCCESS) {
+    return Status(cursor.status.code, cursor.status.message);
+  }
+  batches.reset(new ExtensionCursorGenerator(extension_path, cursor.id));
+  return Status(0, "OK");
+}
+
 Status startExtensionWatcher(const std::string& manager_path,
                              size_t interval,
                              bool fatal) {
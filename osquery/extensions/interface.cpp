@@ -8,16 +8,96 @@
  *
  */
 
+#include <algorithm>
+
 #include <osquery/core.h>
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
 #include <osquery/system.h>
 
 #include "osquery/extensions/interface.h"
+#include "osquery/extensions/shared_ring.h"
 
 using namespace osquery::extensions;
 
 namespace osquery {
+
+DECLARE_uint64(extensions_server_threads);
+DECLARE_uint64(extensions_concurrency);
+
+void serializeColumnarData(const ColumnarData& results,
+                           ExtensionColumnarResponse& response) {
+  response.rows = static_cast<int64_t>(results.rows());
+  response.columns.resize(results.columns());
+  for (size_t i = 0; i < results.columns(); i++) {
+    auto& column = response.columns[i];
+    auto type = results.type(i);
+    column.name = results.name(i);
+    column.type = columnTypeName(type);
+    column.nulls.assign((results.rows() + 7) / 8, '\0');
+    for (size_t r = 0; r < results.rows(); r++) {
+      if (results.isNull(r, i)) {
+        column.nulls[r / 8] |= static_cast<char>(1 << (r % 8));
+      }
+      if (type == INTEGER_TYPE || type == BIGINT_TYPE ||
+          type == UNSIGNED_BIGINT_TYPE) {
+        column.integers.push_back(results.getInteger(r, i));
+      } else if (type == DOUBLE_TYPE) {
+        column.doubles.push_back(results.getDouble(r, i));
+      } else {
+        column.texts.push_back(results.getText(r, i));
+      }
+    }
+  }
+}
+
+Status deserializeColumnarData(const ExtensionColumnarResponse& response,
+                               ColumnarData& results) {
+  if (response.rows < 0) {
+    return Status(1, "Invalid columnar response");
+  }
+
+  auto rows = static_cast<size_t>(response.rows);
+  TableColumns columns;
+  for (const auto& column : response.columns) {
+    columns.push_back(
+        std::make_tuple(column.name, columnTypeName(column.type), DEFAULT));
+  }
+
+  results = ColumnarData(columns);
+  results.reserve(rows);
+  for (size_t r = 0; r < rows; r++) {
+    results.addRow();
+  }
+
+  for (size_t i = 0; i < response.columns.size(); i++) {
+    const auto& column = response.columns[i];
+    auto type = results.type(i);
+    bool integers = (type == INTEGER_TYPE || type == BIGINT_TYPE ||
+                     type == UNSIGNED_BIGINT_TYPE);
+    size_t values = (integers) ? column.integers.size()
+                               : (type == DOUBLE_TYPE) ? column.doubles.size()
+                                                       : column.texts.size();
+    if (values != rows || column.nulls.size() < (rows + 7) / 8) {
+      return Status(1, "Invalid columnar response column: " + column.name);
+    }
+
+    for (size_t r = 0; r < rows; r++) {
+      if (column.nulls[r / 8] & (1 << (r % 8))) {
+        continue;
+      }
+      if (integers) {
+        results.setInteger(r, i, column.integers[r]);
+      } else if (type == DOUBLE_TYPE) {
+        results.setDouble(r, i, column.doubles[r]);
+      } else {
+        results.setText(r, i, column.texts[r]);
+      }
+    }
+  }
+  return Status(0, "OK");
+}
+
 namespace extensions {
 
 void ExtensionHandler::ping(ExtensionStatus& _return) {
@@ -58,6 +138,188 @@ void ExtensionHandler::call(ExtensionResponse& _return,
   }
 }
 
+void ExtensionHandler::callColumns(ExtensionColumnarResponse& _return,
+                                   const std::string& registry,
+                                   const std::string& item,
+                                   const ExtensionPluginRequest& request) {
+  _return.status.uuid = uuid_;
+  _return.rows = 0;
+  auto local_item = Registry::getAlias(registry, item);
+  std::shared_ptr<TablePlugin> table;
+  if (registry == "table" && Registry::exists(registry, local_item, true)) {
+    table = std::dynamic_pointer_cast<TablePlugin>(
+        Registry::get(registry, local_item));
+  }
+
+  if (table == nullptr || request.count("action") == 0 ||
+      request.at("action") != "generate") {
+    _return.status.code = ExtensionCode::EXT_FAILED;
+    _return.status.message = "Columns are only generated by local tables";
+    return;
+  }
+
+  PluginRequest plugin_request;
+  for (const auto& request_item : request) {
+    plugin_request[request_item.first] = request_item.second;
+  }
+
+  QueryContext context;
+  if (plugin_request.count("context") > 0) {
+    TablePlugin::setContextFromRequest(plugin_request, context);
+  }
+
+  // Tables that do not generate typed columns are converted once, here.
+  ColumnarData results(table->columns());
+  if (table->usesColumnarData()) {
+    table->generateColumns(context, results);
+  } else {
+    results = ColumnarData::fromQueryData(table->columns(),
+                                          table->generateRows(context));
+  }
+
+  serializeColumnarData(results, _return);
+  _return.status.code = ExtensionCode::EXT_SUCCESS;
+  _return.status.message = "OK";
+}
+
+/// The most cursors kept open by an extension, the oldest is closed first.
+const size_t kExtensionMaxCursors = 32;
+
+void ExtensionHandler::openCursor(ExtensionCursor& _return,
+                                  const std::string& table,
+                                  const ExtensionPluginRequest& request,
+                                  int32_t batch_rows) {
+  _return.status.uuid = uuid_;
+  _return.id = 0;
+  auto local_item = Registry::getAlias("table", table);
+  auto cursor = std::make_shared<Cursor>();
+  if (Registry::exists("table", local_item, true)) {
+    cursor->table = std::dynamic_pointer_cast<TablePlugin>(
+        Registry::get("table", local_item));
+  }
+
+  if (cursor->table == nullptr || batch_rows <= 0) {
+    _return.status.code = ExtensionCode::EXT_FAILED;
+    _return.status.message = "Cursors are only opened for local tables";
+    return;
+  }
+
+  PluginRequest plugin_request;
+  for (const auto& request_item : request) {
+    plugin_request[request_item.first] = request_item.second;
+  }
+
+  cursor->context.reset(new QueryContext());
+  if (plugin_request.count("context") > 0) {
+    TablePlugin::setContextFromRequest(plugin_request, *cursor->context);
+  }
+
+  // Only tables using a generator produce rows as batches are read.
+  cursor->batch_rows = static_cast<size_t>(batch_rows);
+  if (cursor->table->usesGenerator()) {
+    cursor->generator = cursor->table->generator(*cursor->context);
+  } else if (cursor->table->usesColumnarData()) {
+    cursor->results = ColumnarData(cursor->table->columns());
+    cursor->table->generateColumns(*cursor->context, cursor->results);
+  } else {
+    auto& context = *cursor->context;
+    cursor->results = ColumnarData::fromQueryData(
+        cursor->table->columns(), cursor->table->generateRows(context));
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(cursors_mutex_);
+    if (cursors_.size() >= kExtensionMaxCursors) {
+      // The caller may have gone away without closing the cursor.
+      cursors_.erase(cursors_.begin());
+    }
+    _return.id = next_cursor_++;
+    cursors_[_return.id] = cursor;
+  }
+
+  _return.status.code = ExtensionCode::EXT_SUCCESS;
+  _return.status.message = "OK";
+}
+
+void ExtensionHandler::nextBatch(ExtensionColumnarResponse& _return,
+                                 int64_t cursor) {
+  _return.status.uuid = uuid_;
+  _return.rows = 0;
+  std::shared_ptr<Cursor> state;
+  {
+    std::lock_guard<std::mutex> lock(cursors_mutex_);
+    auto it = cursors_.find(cursor);
+    if (it != cursors_.end()) {
+      state = it->second;
+    }
+  }
+
+  if (state == nullptr) {
+    _return.status.code = ExtensionCode::EXT_FAILED;
+    _return.status.message = "Unknown cursor: " + std::to_string(cursor);
+    return;
+  }
+
+  ColumnarData batch(state->table->columns());
+  if (state->generator != nullptr) {
+    Row r;
+    while (batch.rows() < state->batch_rows && state->generator->next(r)) {
+      auto row = batch.addRow();
+      for (size_t i = 0; i < batch.columns(); i++) {
+        auto cell = r.find(batch.name(i));
+        if (cell != r.end()) {
+          batch.setText(row, i, std::move(cell->second));
+        }
+      }
+      r.clear();
+    }
+  } else {
+    const auto& results = state->results;
+    auto end = std::min(results.rows(), state->row + state->batch_rows);
+    batch.reserve(end - state->row);
+    for (; state->row < end; state->row++) {
+      auto row = batch.addRow();
+      for (size_t i = 0; i < batch.columns(); i++) {
+        if (results.isNull(state->row, i)) {
+          continue;
+        }
+        auto type = results.type(i);
+        if (type == INTEGER_TYPE || type == BIGINT_TYPE ||
+            type == UNSIGNED_BIGINT_TYPE) {
+          batch.setInteger(row, i, results.getInteger(state->row, i));
+        } else if (type == DOUBLE_TYPE) {
+          batch.setDouble(row, i, results.getDouble(state->row, i));
+        } else {
+          batch.setText(row, i, results.getText(state->row, i));
+        }
+      }
+    }
+  }
+
+  if (batch.rows() == 0) {
+    // The last, empty, batch closes the cursor.
+    closeCursor(cursor);
+  }
+
+  serializeColumnarData(batch, _return);
+  _return.status.code = ExtensionCode::EXT_SUCCESS;
+  _return.status.message = "OK";
+}
+
+void ExtensionHandler::closeCursor(int64_t cursor) {
+  std::shared_ptr<Cursor> state;
+  {
+    std::lock_guard<std::mutex> lock(cursors_mutex_);
+    auto it = cursors_.find(cursor);
+    if (it == cursors_.end()) {
+      return;
+    }
+    state = std::move(it->second);
+    cursors_.erase(it);
+  }
+  // The cursor's generator is destroyed outside of the lock.
+}
+
 void ExtensionHandler::shutdown() {
   // Request a graceful shutdown of the Thrift listener.
   VLOG(1) << "Extension " << uuid_ << " requested shutdown";
@@ -65,6 +327,7 @@ void ExtensionHandler::shutdown() {
 }
 
 void ExtensionManagerHandler::extensions(InternalExtensionList& _return) {
+  WriteLock lock(extensions_mutex_);
   refresh();
   _return = extensions_;
 }
@@ -82,6 +345,7 @@ void ExtensionManagerHandler::registerExtension(
     ExtensionStatus& _return,
     const InternalExtensionInfo& info,
     const ExtensionRegistry& registry) {
+  WriteLock lock(extensions_mutex_);
   if (exists(info.name)) {
     LOG(WARNING) << "Refusing to register duplicate extension " << info.name;
     _return.code = ExtensionCode::EXT_FAILED;
@@ -103,6 +367,15 @@ void ExtensionManagerHandler::registerExtension(
     return;
   }
 
+  // Bulk logger requests use the extension's ring if one can be mapped.
+  if (!info.shared_ring.empty()) {
+    auto status = attachExtensionRing(uuid, info.shared_ring);
+    if (!status.ok()) {
+      LOG(WARNING) << "Extension (" << info.name << ", " << uuid
+                   << ") ring not used: " << status.getMessage();
+    }
+  }
+
   extensions_[uuid] = info;
   _return.code = ExtensionCode::EXT_SUCCESS;
   _return.message = "OK";
@@ -111,6 +384,7 @@ void ExtensionManagerHandler::registerExtension(
 
 void ExtensionManagerHandler::deregisterExtension(
     ExtensionStatus& _return, const ExtensionRouteUUID uuid) {
+  WriteLock lock(extensions_mutex_);
   if (extensions_.count(uuid) == 0) {
     _return.code = ExtensionCode::EXT_FAILED;
     _return.message = "No extension UUID registered";
@@ -120,6 +394,7 @@ void ExtensionManagerHandler::deregisterExtension(
 
   // On success return the uuid of the now de-registered extension.
   Registry::removeBroadcast(uuid);
+  detachExtensionRing(uuid);
   extensions_.erase(uuid);
   _return.code = ExtensionCode::EXT_SUCCESS;
   _return.uuid = uuid;
@@ -188,6 +463,8 @@ bool ExtensionManagerHandler::exists(const std::string& name) {
 ExtensionRunnerCore::~ExtensionRunnerCore() { remove(path_); }
 
 void ExtensionRunnerCore::stop() {
+  // Persistent clients to this server are closed so the server may stop.
+  EXClientPool::remove(path_);
   {
     std::unique_lock<std::mutex> lock(service_start_);
     service_stopping_ = true;
@@ -228,8 +505,21 @@ void ExtensionRunnerCore::startServer(TProcessorRef processor) {
     auto protocol_fac = TProtocolFactoryRef(new TBinaryProtocolFactory());
 
     // Start the Thrift server's run loop.
-    server_ = TThreadedServerRef(new TThreadedServer(
-        processor, transport_, transport_fac, protocol_fac));
+    if (FLAGS_extensions_server_threads == 0) {
+      server_ = TServerRef(new TThreadedServer(
+          processor, transport_, transport_fac, protocol_fac));
+    } else {
+      // Each worker serves one connection at a time, the persistent clients
+      // and a watcher ping from the core must not use every worker.
+      auto workers = std::max<size_t>(FLAGS_extensions_server_threads,
+                                      FLAGS_extensions_concurrency + 2);
+      auto manager = ThreadManager::newSimpleThreadManager(workers);
+      manager->threadFactory(SHARED_PTR_IMPL<PlatformThreadFactory>(
+          new PlatformThreadFactory()));
+      manager->start();
+      server_ = TServerRef(new TThreadPoolServer(
+          processor, transport_, transport_fac, protocol_fac, manager));
+    }
   }
 
   server_->serve();
@@ -10,19 +10,29 @@
 
 #pragma once
 
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
 #include <osquery/dispatcher.h>
 #include <osquery/extensions.h>
+#include <osquery/tables.h>
 
 // osquery is built with various versions of thrift that use different search
 // paths for their includes. Unfortunately, changing include paths is not
 // possible in every build system.
 // clang-format off
 #include CONCAT(OSQUERY_THRIFT_SERVER_LIB,/TThreadedServer.h)
+#include CONCAT(OSQUERY_THRIFT_SERVER_LIB,/TThreadPoolServer.h)
 #include CONCAT(OSQUERY_THRIFT_LIB,/protocol/TBinaryProtocol.h)
 #include CONCAT(OSQUERY_THRIFT_LIB,/transport/TServerSocket.h)
 #include CONCAT(OSQUERY_THRIFT_LIB,/transport/TBufferTransports.h)
 #include CONCAT(OSQUERY_THRIFT_LIB,/transport/TSocket.h)
 #include CONCAT(OSQUERY_THRIFT_LIB,/concurrency/ThreadManager.h)
+#include CONCAT(OSQUERY_THRIFT_LIB,/concurrency/PlatformThreadFactory.h)
 
 // Include intermediate Thrift-generated interface definitions.
 #include CONCAT(OSQUERY_THRIFT,Extension.h)
@@ -53,7 +63,16 @@ typedef SHARED_PTR_IMPL<ThreadManager> TThreadManagerRef;
 typedef SHARED_PTR_IMPL<PosixThreadFactory> PosixThreadFactoryRef;
 #endif
 
-using TThreadedServerRef = std::shared_ptr<TThreadedServer>;
+using TServerRef = std::shared_ptr<TServer>;
+
+/// Copy typed table results into a Thrift columnar response.
+void serializeColumnarData(const ColumnarData& results,
+                           extensions::ExtensionColumnarResponse& response);
+
+/// Copy a Thrift columnar response into typed table results.
+Status deserializeColumnarData(
+    const extensions::ExtensionColumnarResponse& response,
+    ColumnarData& results);
 
 namespace extensions {
 
@@ -86,12 +105,73 @@ class ExtensionHandler : virtual public ExtensionIf {
             const std::string& item,
             const ExtensionPluginRequest& request);
 
+  /**
+   * @brief The Thrift API used to generate an extension table as columns.
+   *
+   * Table rows are returned with the column names once, a typed list of
+   * values for each column, and NULL bitmaps. Only the "table" registry
+   * supports columns, callers may fall back to call.
+   *
+   * @param _return The return response (combo Status and typed columns).
+   * @param registry The name of the Extension registry.
+   * @param item The Extension table name.
+   * @param request The table plugin "generate" request.
+   */
+  void callColumns(ExtensionColumnarResponse& _return,
+                   const std::string& registry,
+                   const std::string& item,
+                   const ExtensionPluginRequest& request);
+
+  /**
+   * @brief Open a cursor generating an extension table in batches.
+   *
+   * Tables using a RowGenerator are generated as batches are read, other
+   * tables are generated when the cursor is opened.
+   *
+   * @param _return The return status and cursor id.
+   * @param table The Extension table name.
+   * @param request The table plugin "generate" request.
+   * @param batch_rows The most rows returned in each batch.
+   */
+  void openCursor(ExtensionCursor& _return,
+                  const std::string& table,
+                  const ExtensionPluginRequest& request,
+                  int32_t batch_rows);
+
+  /// Read the next batch of rows from a cursor.
+  void nextBatch(ExtensionColumnarResponse& _return, int64_t cursor);
+
+  /// Close a cursor before all rows were read.
+  void closeCursor(int64_t cursor);
+
   /// Request an extension to shutdown.
   void shutdown();
 
  protected:
   /// Transient UUID assigned to the extension after registering.
   RouteUUID uuid_;
+
+ private:
+  /// The state of a table cursor.
+  struct Cursor {
+    std::shared_ptr<TablePlugin> table;
+    std::unique_ptr<QueryContext> context;
+    RowGeneratorRef generator;
+    /// Rows generated when the cursor was opened, if not using a generator.
+    ColumnarData results;
+    /// The next row within results.
+    size_t row{0};
+    size_t batch_rows{0};
+  };
+
+  /// Open cursors by id.
+  std::map<int64_t, std::shared_ptr<Cursor>> cursors_;
+
+  /// The id of the next opened cursor.
+  int64_t next_cursor_{1};
+
+  /// Protect the open cursors.
+  std::mutex cursors_mutex_;
 };
 
 /**
@@ -197,6 +277,14 @@ class ExtensionManagerHandler : virtual public ExtensionManagerIf,
 
   /// Maintain a map of extension UUID to metadata for tracking deregistration.
   InternalExtensionList extensions_;
+
+  /**
+   * @brief Protect the extension metadata.
+   *
+   * Autoloaded extensions start together and register concurrently, each
+   * from its own server thread.
+   */
+  Mutex extensions_mutex_;
 };
 
 typedef SHARED_PTR_IMPL<ExtensionHandler> ExtensionHandlerRef;
@@ -272,7 +360,7 @@ class ExtensionRunnerCore : public InternalRunnable {
   TServerTransportRef transport_{nullptr};
 
   /// Server instance, will be stopped if thread service is removed.
-  TThreadedServerRef server_{nullptr};
+  TServerRef server_{nullptr};
 
   /// Protect the service start and stop, this mutex protects server creation.
   std::mutex service_start_;
@@ -356,6 +444,58 @@ class EXClient : public EXInternal {
   std::shared_ptr<extensions::ExtensionClient> client_;
 };
 
+using EXClientRef = std::shared_ptr<EXClient>;
+
+/**
+ * @brief Persistent clients to extensions, by extension socket path.
+ *
+ * Calls routed to an extension borrow an idle, connected client and return it
+ * when the call succeeds. A client is used by one call at a time, concurrent
+ * calls will each connect a client, up to a limit for each extension. Clients
+ * that fail are not returned, and the clients for an extension are closed when
+ * the extension goes away.
+ */
+class EXClientPool : private boost::noncopyable {
+ public:
+  /**
+   * @brief Start a request, borrowing an idle client if one is connected.
+   *
+   * This waits while the extension has too many concurrent requests. The
+   * client is nullptr if none is idle, the caller should connect a client.
+   */
+  static Status get(const std::string& path, EXClientRef& client);
+
+  /// End a request, returning the client or nullptr if the client failed.
+  static void release(const std::string& path, EXClientRef&& client);
+
+  /// Close the idle clients to an extension.
+  static void remove(const std::string& path);
+
+  /// The number of idle clients to an extension.
+  static size_t count(const std::string& path);
+
+ private:
+  static EXClientPool& instance() {
+    static EXClientPool pool;
+    return pool;
+  }
+
+  EXClientPool() {}
+
+ private:
+  /// Idle clients by extension socket path.
+  std::map<std::string, std::vector<EXClientRef>> clients_;
+
+  /// Requests in progress by extension socket path.
+  std::map<std::string, size_t> requests_;
+
+  /// Protect the idle clients and requests.
+  std::mutex mutex_;
+
+  /// Signaled when a request ends.
+  std::condition_variable released_;
+};
+
 /// Internal accessor for a client to an extension manager (from an extension).
 class EXManagerClient : public EXInternal {
  public:
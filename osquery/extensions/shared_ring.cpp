@@ -0,0 +1,347 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+
+#include <string.h>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <osquery/logger.h>
+
+#include "osquery/extensions/shared_ring.h"
+
+namespace osquery {
+
+/// Identify a mapped ring and its layout.
+const uint32_t kSharedRingMagic = 0x6f737172;
+const uint32_t kSharedRingVersion = 1;
+
+/// Records are length-prefixed and aligned to the size of the length.
+const size_t kSharedRingAlign = sizeof(uint32_t);
+
+/// A length marking the unused end of the ring, the next record is at 0.
+const uint32_t kSharedRingWrap = 0xffffffff;
+
+/// The reader's most milliseconds between checks of an empty ring.
+const size_t kSharedRingMaxPause = 50;
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2,
+              "Shared memory rings require lock-free 64-bit atomics");
+
+struct SharedRingHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t size;
+
+  /// Total bytes written, only the writer stores.
+  alignas(64) std::atomic<uint64_t> head;
+
+  /// Total bytes read, only the reader stores.
+  alignas(64) std::atomic<uint64_t> tail;
+};
+
+/// Extension rings mapped by the extension manager.
+static std::map<RouteUUID, std::shared_ptr<SharedRing>> kExtensionRings;
+
+/// Protect the extension ring map.
+static std::mutex kExtensionRingsMutex;
+
+static size_t alignRecord(size_t size) {
+  return (size + kSharedRingAlign - 1) & ~(kSharedRingAlign - 1);
+}
+
+#ifndef WIN32
+Status SharedRing::create(size_t size, std::shared_ptr<SharedRing>& ring) {
+  size = alignRecord(size);
+  if (size < 4096) {
+    return Status(1, "Shared ring size is too small");
+  }
+
+  ring = std::shared_ptr<SharedRing>(new SharedRing());
+  ring->name_ = "/osquery." + std::to_string(getpid()) + "." +
+                std::to_string(rand());
+  auto fd = ::shm_open(ring->name_.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0) {
+    return Status(1, "Cannot create shared ring: " + ring->name_);
+  }
+  ring->owner_ = true;
+
+  auto total = sizeof(SharedRingHeader) + size;
+  if (::ftruncate(fd, total) != 0) {
+    ::close(fd);
+    return Status(1, "Cannot size shared ring: " + ring->name_);
+  }
+
+  auto status = ring->map(fd, total);
+  if (status.ok()) {
+    ring->header_->magic = kSharedRingMagic;
+    ring->header_->version = kSharedRingVersion;
+    ring->header_->size = size;
+    ring->header_->head.store(0);
+    ring->header_->tail.store(0);
+  }
+  return status;
+}
+
+Status SharedRing::open(const std::string& name,
+                        std::shared_ptr<SharedRing>& ring) {
+  ring = std::shared_ptr<SharedRing>(new SharedRing());
+  ring->name_ = name;
+  auto fd = ::shm_open(name.c_str(), O_RDWR, 0);
+  if (fd < 0) {
+    return Status(1, "Cannot open shared ring: " + name);
+  }
+
+  struct stat st;
+  if (::fstat(fd, &st) != 0 ||
+      static_cast<size_t>(st.st_size) <= sizeof(SharedRingHeader)) {
+    ::close(fd);
+    return Status(1, "Invalid shared ring: " + name);
+  }
+
+  auto status = ring->map(fd, st.st_size);
+  if (!status.ok()) {
+    return status;
+  }
+
+  // The mapping size, not the header, bounds the record data.
+  if (ring->header_->magic != kSharedRingMagic ||
+      ring->header_->version != kSharedRingVersion ||
+      ring->header_->size != ring->size_ || ring->size_ % kSharedRingAlign) {
+    return Status(1, "Unsupported shared ring: " + name);
+  }
+  return Status(0, "OK");
+}
+
+Status SharedRing::map(int fd, size_t size) {
+  auto base =
+      ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (base == MAP_FAILED) {
+    return Status(1, "Cannot map shared ring: " + name_);
+  }
+
+  header_ = static_cast<SharedRingHeader*>(base);
+  data_ = static_cast<char*>(base) + sizeof(SharedRingHeader);
+  size_ = size - sizeof(SharedRingHeader);
+  return Status(0, "OK");
+}
+
+SharedRing::~SharedRing() {
+  if (header_ != nullptr) {
+    ::munmap(header_, sizeof(SharedRingHeader) + size_);
+  }
+  unlink();
+}
+
+void SharedRing::unlink() {
+  if (owner_) {
+    ::shm_unlink(name_.c_str());
+    owner_ = false;
+  }
+}
+#else
+Status SharedRing::create(size_t size, std::shared_ptr<SharedRing>& ring) {
+  return Status(1, "Shared rings are not supported");
+}
+
+Status SharedRing::open(const std::string& name,
+                        std::shared_ptr<SharedRing>& ring) {
+  return Status(1, "Shared rings are not supported");
+}
+
+Status SharedRing::map(int fd, size_t size) {
+  return Status(1, "Shared rings are not supported");
+}
+
+SharedRing::~SharedRing() {}
+
+void SharedRing::unlink() {}
+#endif
+
+bool SharedRing::write(const std::string& record) {
+  auto needed = sizeof(uint32_t) + alignRecord(record.size());
+  if (header_ == nullptr || needed > size_) {
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto head = header_->head.load(std::memory_order_relaxed);
+  auto tail = header_->tail.load(std::memory_order_acquire);
+  auto offset = head % size_;
+  // A record does not wrap, an aligned remainder always fits the marker.
+  size_t skip = (size_ - offset < needed) ? size_ - offset : 0;
+  if (head < tail || head + skip + needed - tail > size_) {
+    return false;
+  }
+
+  if (skip > 0) {
+    memcpy(data_ + offset, &kSharedRingWrap, sizeof(kSharedRingWrap));
+    offset = 0;
+  }
+
+  auto length = static_cast<uint32_t>(record.size());
+  memcpy(data_ + offset, &length, sizeof(length));
+  memcpy(data_ + offset + sizeof(length), record.data(), record.size());
+  header_->head.store(head + skip + needed, std::memory_order_release);
+  return true;
+}
+
+bool SharedRing::read(std::string& record) {
+  if (header_ == nullptr) {
+    return false;
+  }
+
+  auto tail = header_->tail.load(std::memory_order_relaxed);
+  auto head = header_->head.load(std::memory_order_acquire);
+  if (tail == head) {
+    return false;
+  }
+
+  auto offset = tail % size_;
+  uint32_t length = 0;
+  memcpy(&length, data_ + offset, sizeof(length));
+  if (length == kSharedRingWrap) {
+    tail += size_ - offset;
+    offset = 0;
+    memcpy(&length, data_, sizeof(length));
+  }
+
+  auto needed = sizeof(length) + alignRecord(length);
+  if (needed > size_ - offset || tail + needed > head) {
+    // The writer is not trusted, drop everything written.
+    LOG(WARNING) << "Discarding corrupt shared ring: " << name_;
+    header_->tail.store(head, std::memory_order_release);
+    return false;
+  }
+
+  record.assign(data_ + offset + sizeof(length), length);
+  header_->tail.store(tail + needed, std::memory_order_release);
+  return true;
+}
+
+static void appendRingString(std::string& record, const std::string& value) {
+  auto length = static_cast<uint32_t>(value.size());
+  record.append(reinterpret_cast<const char*>(&length), sizeof(length));
+  record.append(value);
+}
+
+static bool readRingString(const std::string& record,
+                           size_t& offset,
+                           std::string& value) {
+  uint32_t length = 0;
+  if (record.size() - offset < sizeof(length)) {
+    return false;
+  }
+  memcpy(&length, record.data() + offset, sizeof(length));
+  offset += sizeof(length);
+  if (record.size() - offset < length) {
+    return false;
+  }
+  value = record.substr(offset, length);
+  offset += length;
+  return true;
+}
+
+std::string serializeRingRequest(const std::string& item,
+                                 const PluginRequest& request) {
+  size_t size = item.size() + sizeof(uint32_t);
+  for (const auto& value : request) {
+    size += value.first.size() + value.second.size() + 2 * sizeof(uint32_t);
+  }
+
+  std::string record;
+  record.reserve(size);
+  appendRingString(record, item);
+  for (const auto& value : request) {
+    appendRingString(record, value.first);
+    appendRingString(record, value.second);
+  }
+  return record;
+}
+
+Status deserializeRingRequest(const std::string& record,
+                              std::string& item,
+                              PluginRequest& request) {
+  size_t offset = 0;
+  if (!readRingString(record, offset, item)) {
+    return Status(1, "Invalid ring request");
+  }
+
+  while (offset < record.size()) {
+    std::string key;
+    std::string value;
+    if (!readRingString(record, offset, key) ||
+        !readRingString(record, offset, value)) {
+      return Status(1, "Invalid ring request");
+    }
+    request[key] = std::move(value);
+  }
+  return Status(0, "OK");
+}
+
+Status attachExtensionRing(RouteUUID uuid, const std::string& name) {
+  std::shared_ptr<SharedRing> ring;
+  auto status = SharedRing::open(name, ring);
+  if (status.ok()) {
+    std::lock_guard<std::mutex> lock(kExtensionRingsMutex);
+    kExtensionRings[uuid] = ring;
+  }
+  return status;
+}
+
+void detachExtensionRing(RouteUUID uuid) {
+  std::lock_guard<std::mutex> lock(kExtensionRingsMutex);
+  kExtensionRings.erase(uuid);
+}
+
+bool writeExtensionRing(RouteUUID uuid,
+                        const std::string& item,
+                        const PluginRequest& request) {
+  std::shared_ptr<SharedRing> ring;
+  {
+    std::lock_guard<std::mutex> lock(kExtensionRingsMutex);
+    auto it = kExtensionRings.find(uuid);
+    if (it == kExtensionRings.end()) {
+      return false;
+    }
+    ring = it->second;
+  }
+  return ring->write(serializeRingRequest(item, request));
+}
+
+void ExtensionRingRunner::start() {
+  size_t delay = 1;
+  std::string record;
+  while (!interrupted()) {
+    if (!ring_->read(record)) {
+      // Back off while the ring is empty.
+      pauseMilli(delay);
+      delay = std::min(delay * 2, kSharedRingMaxPause);
+      continue;
+    }
+
+    delay = 1;
+    std::string item;
+    PluginRequest request;
+    if (deserializeRingRequest(record, item, request).ok()) {
+      Registry::call("logger", item, request);
+    }
+  }
+}
+}
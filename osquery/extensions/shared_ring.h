@@ -0,0 +1,118 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <osquery/dispatcher.h>
+#include <osquery/registry.h>
+
+namespace osquery {
+
+struct SharedRingHeader;
+
+/**
+ * @brief A single-reader shared memory ring of length-prefixed records.
+ *
+ * An extension may create a ring when it registers, the extension manager
+ * maps the ring and writes bulk logger requests to it instead of calling the
+ * extension's Thrift API. Writers within a process are serialized, there is
+ * one reader. Every position read from the mapped header is bounded by the
+ * size of the mapping, a misbehaving peer cannot cause an out-of-bounds copy.
+ */
+class SharedRing : private boost::noncopyable {
+ public:
+  /// Create and map a new named ring with `size` bytes of record data.
+  static Status create(size_t size, std::shared_ptr<SharedRing>& ring);
+
+  /// Map an existing ring created by another process.
+  static Status open(const std::string& name,
+                     std::shared_ptr<SharedRing>& ring);
+
+  ~SharedRing();
+
+ public:
+  /// Append a record, false if the ring does not have space.
+  bool write(const std::string& record);
+
+  /// Remove the next record, false if the ring is empty.
+  bool read(std::string& record);
+
+  /// Remove the ring's name, existing mappings remain usable.
+  void unlink();
+
+  /// The name used to open the ring.
+  const std::string& name() const { return name_; }
+
+ private:
+  SharedRing() {}
+
+  /// Map a descriptor of `size` total bytes.
+  Status map(int fd, size_t size);
+
+ private:
+  std::string name_;
+
+  /// True if this process created, and should unlink, the name.
+  bool owner_{false};
+
+  /// The mapped header followed by the record data.
+  SharedRingHeader* header_{nullptr};
+  char* data_{nullptr};
+
+  /// Bytes of record data, the header's copy is not trusted.
+  size_t size_{0};
+
+  /// Serialize writers within this process.
+  std::mutex mutex_;
+};
+
+/// Encode a registry item and request as a ring record.
+std::string serializeRingRequest(const std::string& item,
+                                 const PluginRequest& request);
+
+/// Decode a ring record, see serializeRingRequest.
+Status deserializeRingRequest(const std::string& record,
+                              std::string& item,
+                              PluginRequest& request);
+
+/// Map the ring a registering extension created.
+Status attachExtensionRing(RouteUUID uuid, const std::string& name);
+
+/// Release the ring of an extension that has gone away.
+void detachExtensionRing(RouteUUID uuid);
+
+/**
+ * @brief Write a logger request to an extension's ring.
+ *
+ * Returns false if the extension has no ring or the ring is full, in which
+ * case the caller uses the extension's Thrift API.
+ */
+bool writeExtensionRing(RouteUUID uuid,
+                        const std::string& item,
+                        const PluginRequest& request);
+
+/// A Dispatcher service thread that calls loggers with ring requests.
+class ExtensionRingRunner : public InternalRunnable {
+ public:
+  explicit ExtensionRingRunner(std::shared_ptr<SharedRing> ring)
+      : ring_(std::move(ring)) {}
+
+ public:
+  /// The Dispatcher thread entry point.
+  void start() override;
+
+ private:
+  std::shared_ptr<SharedRing> ring_;
+};
+}
@@ -18,11 +18,15 @@
 #include "osquery/core/process.h"
 #include "osquery/tests/test_util.h"
 #include "osquery/extensions/interface.h"
+#include "osquery/extensions/shared_ring.h"
 
 using namespace osquery::extensions;
 
 namespace osquery {
 
+DECLARE_string(extensions_timeout);
+DECLARE_uint64(extensions_concurrency);
+
 const int kDelayUS = 2000;
 const int kTimeoutUS = 1000000;
 
@@ -230,10 +234,186 @@ TEST_F(ExtensionsTest, test_extension_broadcast) {
   EXPECT_EQ(response.size(), 1U);
   EXPECT_EQ(response[0]["test_key"], "test_value");
 
+  // The client is kept connected and reused by the next call.
+  EXPECT_EQ(EXClientPool::count(ext_socket), 1U);
+  response.clear();
+  status = callExtension(ext_socket,
+                         "extension_test",
+                         "test_alias",
+                         {{"test_key", "test_value"}},
+                         response);
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(response.size(), 1U);
+  EXPECT_EQ(EXClientPool::count(ext_socket), 1U);
+
+  EXClientPool::remove(ext_socket);
+  EXPECT_EQ(EXClientPool::count(ext_socket), 0U);
+
   Registry::removeBroadcast(uuid);
   Registry::allowDuplicates(false);
 }
 
+TEST_F(ExtensionsTest, test_columnar_response) {
+  TableColumns columns = {
+      std::make_tuple("number", INTEGER_TYPE, DEFAULT),
+      std::make_tuple("ratio", DOUBLE_TYPE, DEFAULT),
+      std::make_tuple("name", TEXT_TYPE, DEFAULT),
+  };
+  ColumnarData results(columns);
+  for (size_t i = 0; i < 10; i++) {
+    auto r = results.addRow();
+    results.setInteger(r, 0, i);
+    results.setDouble(r, 1, i / 2.0);
+    if (i != 9) {
+      results.setText(r, 2, "row" + std::to_string(i));
+    }
+  }
+
+  ExtensionColumnarResponse response;
+  serializeColumnarData(results, response);
+  EXPECT_EQ(response.rows, 10);
+  ASSERT_EQ(response.columns.size(), 3U);
+  EXPECT_EQ(response.columns[0].type, "INTEGER");
+  EXPECT_EQ(response.columns[0].integers.size(), 10U);
+  EXPECT_TRUE(response.columns[2].texts[9].empty());
+
+  ColumnarData copy;
+  ASSERT_TRUE(deserializeColumnarData(response, copy).ok());
+  ASSERT_EQ(copy.rows(), 10U);
+  ASSERT_EQ(copy.columns(), 3U);
+  EXPECT_EQ(copy.type(1), DOUBLE_TYPE);
+  EXPECT_EQ(copy.getInteger(3, 0), 3);
+  EXPECT_EQ(copy.getDouble(3, 1), 1.5);
+  EXPECT_EQ(copy.getText(3, 2), "row3");
+  // The NULL bitmap spans more than a single byte.
+  EXPECT_FALSE(copy.isNull(8, 2));
+  EXPECT_TRUE(copy.isNull(9, 2));
+
+  // Columns must include a value for each row.
+  response.columns[1].doubles.pop_back();
+  EXPECT_FALSE(deserializeColumnarData(response, copy).ok());
+}
+
+TEST_F(ExtensionsTest, test_extension_concurrency) {
+  auto concurrency = FLAGS_extensions_concurrency;
+  auto timeout = FLAGS_extensions_timeout;
+  FLAGS_extensions_concurrency = 1;
+  FLAGS_extensions_timeout = "0";
+
+  // Requests to an extension beyond the limit wait, then fail.
+  EXClientRef client;
+  EXPECT_TRUE(EXClientPool::get(socket_path, client).ok());
+  EXPECT_EQ(client, nullptr);
+  EXPECT_FALSE(EXClientPool::get(socket_path, client).ok());
+
+  // Other extensions are not limited.
+  EXPECT_TRUE(EXClientPool::get(socket_path + ".1", client).ok());
+  EXClientPool::release(socket_path + ".1", nullptr);
+
+  // A failed request (without a client) ends the request.
+  EXClientPool::release(socket_path, nullptr);
+  EXPECT_TRUE(EXClientPool::get(socket_path, client).ok());
+  EXClientPool::release(socket_path, nullptr);
+  EXPECT_EQ(EXClientPool::count(socket_path), 0U);
+
+  FLAGS_extensions_concurrency = concurrency;
+  FLAGS_extensions_timeout = timeout;
+}
+
+class cursorTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const override {
+    return {
+        std::make_tuple("id", INTEGER_TYPE, DEFAULT),
+        std::make_tuple("name", TEXT_TYPE, DEFAULT),
+    };
+  }
+
+  QueryData generate(QueryContext& context) override {
+    QueryData results;
+    for (size_t i = 0; i < 5; i++) {
+      results.push_back({{"id", INTEGER(i)}, {"name", "row" + INTEGER(i)}});
+    }
+    return results;
+  }
+};
+
+TEST_F(ExtensionsTest, test_extension_cursor) {
+  Registry::add<cursorTablePlugin>("table", "cursor_test");
+  ExtensionHandler handler;
+
+  ExtensionCursor cursor;
+  handler.openCursor(cursor, "cursor_test", {{"action", "generate"}}, 2);
+  ASSERT_EQ(cursor.status.code, ExtensionCode::EXT_SUCCESS);
+
+  // Batches include at most the requested rows.
+  std::vector<size_t> batches;
+  ColumnarData results;
+  while (true) {
+    ExtensionColumnarResponse response;
+    handler.nextBatch(response, cursor.id);
+    ASSERT_EQ(response.status.code, ExtensionCode::EXT_SUCCESS);
+    if (response.rows == 0) {
+      break;
+    }
+    batches.push_back(response.rows);
+    ASSERT_TRUE(deserializeColumnarData(response, results).ok());
+  }
+  EXPECT_EQ(batches, std::vector<size_t>({2, 2, 1}));
+  ASSERT_EQ(results.rows(), 1U);
+  EXPECT_EQ(results.getInteger(0, 0), 4);
+  EXPECT_EQ(results.getText(0, 1), "row4");
+
+  // The empty batch closed the cursor.
+  ExtensionColumnarResponse response;
+  handler.nextBatch(response, cursor.id);
+  EXPECT_EQ(response.status.code, ExtensionCode::EXT_FAILED);
+
+  // Cursors are only opened for tables.
+  handler.openCursor(cursor, "not_a_table", {{"action", "generate"}}, 2);
+  EXPECT_EQ(cursor.status.code, ExtensionCode::EXT_FAILED);
+}
+
+TEST_F(ExtensionsTest, test_shared_ring) {
+  std::shared_ptr<SharedRing> reader;
+  ASSERT_TRUE(SharedRing::create(4096, reader).ok());
+  std::shared_ptr<SharedRing> writer;
+  ASSERT_TRUE(SharedRing::open(reader->name(), writer).ok());
+  reader->unlink();
+
+  // Records are read in order and the ring wraps as records are read.
+  std::string record;
+  EXPECT_FALSE(reader->read(record));
+  for (size_t i = 0; i < 100; i++) {
+    auto value = std::string(i * 7 % 301, 'a') + std::to_string(i);
+    ASSERT_TRUE(writer->write(value));
+    ASSERT_TRUE(reader->read(record));
+    EXPECT_EQ(record, value);
+  }
+
+  // A full ring refuses records, callers fall back to the extension API.
+  size_t written = 0;
+  while (writer->write(std::string(100, 'b'))) {
+    written++;
+  }
+  EXPECT_GT(written, 0U);
+  EXPECT_FALSE(writer->write(std::string(8192, 'c')));
+  for (size_t i = 0; i < written; i++) {
+    ASSERT_TRUE(reader->read(record));
+  }
+  EXPECT_FALSE(reader->read(record));
+
+  PluginRequest request = {{"strings", "line1\nline2"}};
+  std::string item;
+  PluginRequest decoded;
+  auto encoded = serializeRingRequest("test_logger", request);
+  ASSERT_TRUE(deserializeRingRequest(encoded, item, decoded).ok());
+  EXPECT_EQ(item, "test_logger");
+  EXPECT_EQ(decoded, request);
+  EXPECT_FALSE(
+      deserializeRingRequest(encoded.substr(0, 10), item, decoded).ok());
+}
+
 TEST_F(ExtensionsTest, test_extension_module_search) {
   createMockFileStructure();
   EXPECT_FALSE(loadModules(kFakeDirectory + "/root.txt"));
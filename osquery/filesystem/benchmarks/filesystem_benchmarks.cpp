@@ -0,0 +1,39 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
+
+namespace osquery {
+
+DECLARE_uint64(glob_threads);
+
+static void FILESYSTEM_resolve_pattern(benchmark::State& state) {
+  while (state.KeepRunning()) {
+    std::vector<std::string> results;
+    resolveFilePattern("/usr/include/%/%.h", results, GLOB_FILES);
+  }
+}
+
+BENCHMARK(FILESYSTEM_resolve_pattern);
+
+static void FILESYSTEM_resolve_recursive(benchmark::State& state) {
+  FLAGS_glob_threads = state.range_x();
+  while (state.KeepRunning()) {
+    std::vector<std::string> results;
+    resolveFilePattern("/usr/include/%%", results);
+  }
+  FLAGS_glob_threads = 4;
+}
+
+BENCHMARK(FILESYSTEM_resolve_recursive)->Arg(1)->Arg(4);
+}
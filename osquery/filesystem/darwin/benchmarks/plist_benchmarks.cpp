@@ -15,6 +15,7 @@
 #include <osquery/filesystem.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/filesystem/darwin/plist_parser.h"
 #include "osquery/tests/test_util.h"
 
 namespace fs = boost::filesystem;
@@ -35,12 +36,56 @@ static void PLIST_parse_content(benchmark::State& state) {
 
 BENCHMARK(PLIST_parse_content);
 
+/// The XML and binary property lists, selected by the benchmark argument.
+static const std::vector<std::string> kPlistBenchmarkFiles = {
+    "test.plist", "test_binary.plist",
+};
+
+static void PLIST_parse_data(benchmark::State& state) {
+  // Decode the buffered content natively, without Foundation objects.
+  std::string content;
+  readFile(kTestDataPath + kPlistBenchmarkFiles[state.range_x()], content);
+
+  while (state.KeepRunning()) {
+    pt::ptree tree;
+    auto status = parsePlistData(content.data(), content.size(), tree);
+  }
+}
+
+BENCHMARK(PLIST_parse_data)->Arg(0)->Arg(1);
+
 static void PLIST_parse_file(benchmark::State& state) {
+  // Parse a new copy each iteration, bypassing the cache.
+  std::string content;
+  readFile(kTestDataPath + kPlistBenchmarkFiles[state.range_x()], content);
+
+  size_t copy = 0;
+  while (state.KeepRunning()) {
+    state.PauseTiming();
+    auto path = kTestWorkingDirectory + "benchmark" + std::to_string(copy++) +
+                ".plist";
+    writeTextFile(path, content);
+    state.ResumeTiming();
+
+    pt::ptree tree;
+    auto status = parsePlist(path, tree);
+
+    state.PauseTiming();
+    fs::remove(path);
+    state.ResumeTiming();
+  }
+}
+
+BENCHMARK(PLIST_parse_file)->Arg(0)->Arg(1);
+
+static void PLIST_parse_file_cached(benchmark::State& state) {
+  // Parse the unchanged file, the tree is served from the cache.
+  auto path = kTestDataPath + kPlistBenchmarkFiles[state.range_x()];
   while (state.KeepRunning()) {
     pt::ptree tree;
-    auto status = parsePlist(kTestDataPath + "test.plist", tree);
+    auto status = parsePlist(path, tree);
   }
 }
 
-BENCHMARK(PLIST_parse_file);
+BENCHMARK(PLIST_parse_file_cached)->Arg(0)->Arg(1);
 }
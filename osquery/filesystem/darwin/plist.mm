@@ -8,22 +8,50 @@
  *
  */
 
+#include <map>
 #include <sstream>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #import <Foundation/Foundation.h>
 
 #include <boost/filesystem/path.hpp>
 #include <boost/property_tree/json_parser.hpp>
 
+#include <osquery/core.h>
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/system.h>
 
+#include "osquery/filesystem/darwin/plist_parser.h"
+
 namespace fs = boost::filesystem;
 namespace pt = boost::property_tree;
 
 namespace osquery {
 
+DECLARE_uint64(read_max);
+
+/// The number of parsed property list files kept.
+const size_t kPlistCacheSize = 1024;
+
+/// A parsed property list file, reused while the file is unchanged.
+struct PlistCacheEntry {
+  struct timespec mtime;
+  off_t size{0};
+  pt::ptree tree;
+};
+
+/// Parsed property lists by path.
+static std::map<std::string, PlistCacheEntry> kPlistCache;
+
+/// Protect the parsed property lists, tables parse from many threads.
+static Mutex kPlistCacheMutex;
+
 /**
  * @brief Filter selected data types from deserialized property list.
  *
@@ -136,10 +164,16 @@ static inline Status filterPlist(NSData* plist, pt::ptree& tree) {
   return Status(0, "OK");
 }
 
-Status parsePlistContent(const std::string& content, pt::ptree& tree) {
+/// Parse with NSPropertyListSerialization, for content the native parser
+/// does not decode, such as the older ASCII format.
+static Status parseSerializedPlist(const char* content,
+                                   size_t size,
+                                   pt::ptree& tree) {
   tree.clear();
   @autoreleasepool {
-    id data = [NSData dataWithBytes:content.c_str() length:content.size()];
+    id data = [NSData dataWithBytesNoCopy:const_cast<char*>(content)
+                                   length:size
+                             freeWhenDone:NO];
     if (data == nil) {
       return Status(1, "Unable to create plist content");
     }
@@ -161,41 +195,100 @@ Status parsePlistContent(const std::string& content, pt::ptree& tree) {
   }
 }
 
+/// Parse binary and XML content natively, anything else is serialized.
+static Status parsePlistBuffer(const char* content,
+                               size_t size,
+                               pt::ptree& tree) {
+  auto status = parsePlistData(content, size, tree);
+  if (!status.ok()) {
+    status = parseSerializedPlist(content, size, tree);
+  }
+  return status;
+}
+
+Status parsePlistContent(const std::string& content, pt::ptree& tree) {
+  return parsePlistBuffer(content.data(), content.size(), tree);
+}
+
+static bool getCachedPlist(const std::string& path,
+                           const struct stat& file,
+                           pt::ptree& tree) {
+  WriteLock lock(kPlistCacheMutex);
+  auto cached = kPlistCache.find(path);
+  if (cached == kPlistCache.end()) {
+    return false;
+  }
+
+  const auto& entry = cached->second;
+  if (entry.size != file.st_size ||
+      entry.mtime.tv_sec != file.st_mtimespec.tv_sec ||
+      entry.mtime.tv_nsec != file.st_mtimespec.tv_nsec) {
+    kPlistCache.erase(cached);
+    return false;
+  }
+  tree = entry.tree;
+  return true;
+}
+
+static void setCachedPlist(const std::string& path,
+                           const struct stat& file,
+                           const pt::ptree& tree) {
+  WriteLock lock(kPlistCacheMutex);
+  if (kPlistCache.size() >= kPlistCacheSize &&
+      kPlistCache.count(path) == 0) {
+    kPlistCache.erase(kPlistCache.begin());
+  }
+
+  auto& entry = kPlistCache[path];
+  entry.mtime = file.st_mtimespec;
+  entry.size = file.st_size;
+  entry.tree = tree;
+}
+
 Status parsePlist(const fs::path& path, pt::ptree& tree) {
   tree.clear();
   // Drop privileges, if needed, before parsing plist data.
   auto dropper = DropPrivileges::get();
   dropper->dropToParent(path);
 
-  auto status = readFile(path);
-  if (!status.ok()) {
-    return status;
+  // The most common error is lack of read permissions.
+  auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return Status(1, "Unable to read plist: " + path.string());
   }
 
-  @autoreleasepool {
-    id ns_path = [NSString stringWithUTF8String:path.string().c_str()];
-    id stream = [NSInputStream inputStreamWithFileAtPath:ns_path];
-    if (stream == nil) {
-      return Status(1, "Unable to read plist: " + path.string());
-    }
+  struct stat file;
+  if (::fstat(fd, &file) < 0 || !S_ISREG(file.st_mode)) {
+    ::close(fd);
+    return Status(1, "Unable to read plist: " + path.string());
+  }
 
-    // Read file content into a data object, containing potential plist data.
-    NSError* error = nil;
-    [stream open];
-    id plist_data = [NSPropertyListSerialization propertyListWithStream:stream
-                                                                options:0
-                                                                 format:NULL
-                                                                  error:&error];
-    if (plist_data == nil) {
-      // The most common error is lack of read permissions.
-      std::string error_message([[error localizedFailureReason] UTF8String]);
-      VLOG(1) << error_message;
-      [stream close];
-      return Status(1, error_message);
-    }
-    // Parse the plist data into a core foundation dictionary-literal.
-    status = filterPlist(plist_data, tree);
-    [stream close];
+  // The parsed tree is reused while the size and modification time match.
+  if (getCachedPlist(path.string(), file, tree)) {
+    ::close(fd);
+    return Status(0, "OK");
+  }
+
+  if (file.st_size == 0) {
+    ::close(fd);
+    return Status(1, "Unable to read plist: " + path.string());
+  } else if (static_cast<uint64_t>(file.st_size) > FLAGS_read_max) {
+    ::close(fd);
+    return Status(1, "File exceeds read limits");
+  }
+
+  // The content is decoded from the mapped file rather than a copy.
+  auto size = static_cast<size_t>(file.st_size);
+  auto content = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (content == MAP_FAILED) {
+    return Status(1, "Unable to read plist: " + path.string());
+  }
+
+  auto status = parsePlistBuffer(static_cast<const char*>(content), size, tree);
+  ::munmap(content, size);
+  if (status.ok()) {
+    setCachedPlist(path.string(), file, tree);
   }
   return status;
 }
@@ -0,0 +1,682 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <streambuf>
+#include <string>
+
+#include <boost/algorithm/string/trim.hpp>
+#include <boost/property_tree/xml_parser.hpp>
+
+#include "osquery/core/conversions.h"
+#include "osquery/filesystem/darwin/plist_parser.h"
+
+namespace pt = boost::property_tree;
+
+namespace osquery {
+
+/// Binary property lists start with this magic and version.
+const std::string kBinaryPlistMagic = "bplist00";
+
+/// The trailer ending a binary property list.
+const size_t kBinaryPlistTrailerSize = 32;
+
+/// Binary property list dates are seconds since 2001-01-01 00:00:00 UTC.
+const double kBinaryPlistEpoch = 978307200.0;
+
+/// Nested containers deeper than this are malformed, or reference a parent.
+const size_t kPlistMaxDepth = 256;
+
+/// Binary property list object markers, the high nibble of the marker byte.
+enum BinaryPlistType {
+  BPLIST_SIMPLE = 0x0,
+  BPLIST_INT = 0x1,
+  BPLIST_REAL = 0x2,
+  BPLIST_DATE = 0x3,
+  BPLIST_DATA = 0x4,
+  BPLIST_ASCII = 0x5,
+  BPLIST_UNICODE = 0x6,
+  BPLIST_UID = 0x8,
+  BPLIST_ARRAY = 0xA,
+  BPLIST_SET = 0xC,
+  BPLIST_DICT = 0xD,
+};
+
+/// Format a number as NSNumber's stringValue, the shortest exact digits.
+static std::string getRealValue(double value) {
+  if (value > -1e15 && value < 1e15 &&
+      value == static_cast<double>(static_cast<long long>(value))) {
+    return std::to_string(static_cast<long long>(value));
+  }
+
+  char buffer[32] = {0};
+  for (int precision = 1; precision <= 17; precision++) {
+    snprintf(buffer, sizeof(buffer), "%.*g", precision, value);
+    if (strtod(buffer, nullptr) == value) {
+      break;
+    }
+  }
+  return buffer;
+}
+
+/// Append a code point as UTF-8.
+static void appendUTF8(uint32_t code, std::string& value) {
+  if (code < 0x80) {
+    value += static_cast<char>(code);
+  } else if (code < 0x800) {
+    value += static_cast<char>(0xC0 | (code >> 6));
+    value += static_cast<char>(0x80 | (code & 0x3F));
+  } else if (code < 0x10000) {
+    value += static_cast<char>(0xE0 | (code >> 12));
+    value += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+    value += static_cast<char>(0x80 | (code & 0x3F));
+  } else {
+    value += static_cast<char>(0xF0 | (code >> 18));
+    value += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+    value += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+    value += static_cast<char>(0x80 | (code & 0x3F));
+  }
+}
+
+/**
+ * @brief A binary property list, decoded from its content in place.
+ *
+ * The trailer locates the offset table, which locates each object by its
+ * reference number. Containers hold the reference numbers of their members.
+ */
+class BinaryPlist {
+ public:
+  BinaryPlist(const char* data, size_t size)
+      : data_(reinterpret_cast<const unsigned char*>(data)), size_(size) {}
+
+  /// Read the trailer and decode the top object into the tree.
+  Status parse(pt::ptree& tree);
+
+ private:
+  /// See filterDictionary in plist.mm, this decodes a dict object.
+  Status filterDictionary(uint64_t ref, pt::ptree& tree, size_t depth);
+
+  /// See filterArray in plist.mm, this decodes an array or set object.
+  Status filterArray(uint64_t ref,
+                     const std::string& root,
+                     pt::ptree& tree,
+                     size_t depth);
+
+  /// Find an object's type and the offset of its content.
+  bool getObject(uint64_t ref,
+                 BinaryPlistType& type,
+                 uint8_t& info,
+                 size_t& offset) const;
+
+  /// Read a sized object's count, which may follow the marker as an int.
+  bool getCount(uint8_t info, size_t& offset, uint64_t& count) const;
+
+  /// Decode a scalar object as a string.
+  bool getValue(BinaryPlistType type,
+                uint8_t info,
+                size_t offset,
+                std::string& value) const;
+
+  /// Decode a string object, used for dictionary keys.
+  bool getString(uint64_t ref, std::string& value) const;
+
+  /// Read the reference number at a container's member index.
+  bool getRef(size_t offset, uint64_t index, uint64_t& ref) const;
+
+  /// Read a big-endian unsigned integer.
+  bool readInt(size_t offset, size_t width, uint64_t& value) const;
+
+ private:
+  const unsigned char* data_{nullptr};
+  size_t size_{0};
+
+  size_t offset_size_{0};
+  size_t ref_size_{0};
+  uint64_t objects_{0};
+  uint64_t table_offset_{0};
+};
+
+bool BinaryPlist::readInt(size_t offset, size_t width, uint64_t& value) const {
+  if (width == 0 || width > 8 || offset > size_ || size_ - offset < width) {
+    return false;
+  }
+
+  value = 0;
+  for (size_t i = 0; i < width; i++) {
+    value = (value << 8) | data_[offset + i];
+  }
+  return true;
+}
+
+Status BinaryPlist::parse(pt::ptree& tree) {
+  if (size_ < kBinaryPlistMagic.size() + kBinaryPlistTrailerSize ||
+      memcmp(data_, kBinaryPlistMagic.data(), kBinaryPlistMagic.size()) != 0) {
+    return Status(1, "Not a binary property list");
+  }
+
+  // The trailer: 6 unused bytes, the offset and reference sizes, then the
+  // object count, top object, and offset table offset as 64 bit integers.
+  auto trailer = size_ - kBinaryPlistTrailerSize;
+  offset_size_ = data_[trailer + 6];
+  ref_size_ = data_[trailer + 7];
+  uint64_t top = 0;
+  if (!readInt(trailer + 8, 8, objects_) || !readInt(trailer + 16, 8, top) ||
+      !readInt(trailer + 24, 8, table_offset_)) {
+    return Status(1, "Malformed binary property list trailer");
+  }
+
+  if (offset_size_ == 0 || offset_size_ > 8 || ref_size_ == 0 ||
+      ref_size_ > 8 || top >= objects_ || table_offset_ > trailer ||
+      objects_ > (trailer - table_offset_) / offset_size_) {
+    return Status(1, "Malformed binary property list trailer");
+  }
+
+  BinaryPlistType type;
+  uint8_t info = 0;
+  size_t offset = 0;
+  if (!getObject(top, type, info, offset)) {
+    return Status(1, "Malformed binary property list object");
+  }
+
+  if (type == BPLIST_DICT) {
+    return filterDictionary(top, tree, 0);
+  } else if (type == BPLIST_ARRAY || type == BPLIST_SET) {
+    return filterArray(top, "root", tree, 0);
+  }
+
+  std::string value;
+  if (!getValue(type, info, offset, value)) {
+    return Status(1, "Malformed binary property list object");
+  }
+  tree.push_back(pt::ptree::value_type("root", pt::ptree(value)));
+  return Status(0, "OK");
+}
+
+bool BinaryPlist::getObject(uint64_t ref,
+                            BinaryPlistType& type,
+                            uint8_t& info,
+                            size_t& offset) const {
+  uint64_t object = 0;
+  if (ref >= objects_ ||
+      !readInt(table_offset_ + ref * offset_size_, offset_size_, object) ||
+      object < kBinaryPlistMagic.size() || object >= table_offset_) {
+    return false;
+  }
+
+  auto marker = data_[object];
+  type = static_cast<BinaryPlistType>(marker >> 4);
+  info = marker & 0x0F;
+  offset = object + 1;
+  return true;
+}
+
+bool BinaryPlist::getCount(uint8_t info,
+                           size_t& offset,
+                           uint64_t& count) const {
+  if (info != 0x0F) {
+    count = info;
+    return true;
+  }
+
+  // Larger counts follow as an int object.
+  if (offset >= size_ || (data_[offset] >> 4) != BPLIST_INT) {
+    return false;
+  }
+  size_t width = static_cast<size_t>(1) << (data_[offset] & 0x0F);
+  if (!readInt(offset + 1, width, count)) {
+    return false;
+  }
+  offset += 1 + width;
+  return true;
+}
+
+bool BinaryPlist::getRef(size_t offset, uint64_t index, uint64_t& ref) const {
+  if (offset > size_ || index > (size_ - offset) / ref_size_) {
+    return false;
+  }
+  return readInt(offset + index * ref_size_, ref_size_, ref);
+}
+
+bool BinaryPlist::getValue(BinaryPlistType type,
+                           uint8_t info,
+                           size_t offset,
+                           std::string& value) const {
+  value.clear();
+  switch (type) {
+  case BPLIST_SIMPLE:
+    // NSNumber's stringValue of a boolean is 1 or 0, null and fill are empty.
+    if (info == 0x08) {
+      value = "0";
+    } else if (info == 0x09) {
+      value = "1";
+    }
+    return true;
+  case BPLIST_INT: {
+    if (info > 4) {
+      return false;
+    }
+    uint64_t number = 0;
+    if (info == 4) {
+      // A 128 bit integer holds an unsigned 64 bit value in its low half.
+      if (!readInt(offset + 8, 8, number)) {
+        return false;
+      }
+      value = std::to_string(number);
+    } else if (!readInt(offset, static_cast<size_t>(1) << info, number)) {
+      return false;
+    } else if (info == 3) {
+      // Only 64 bit integers are signed.
+      value = std::to_string(static_cast<int64_t>(number));
+    } else {
+      value = std::to_string(number);
+    }
+    return true;
+  }
+  case BPLIST_REAL:
+  case BPLIST_DATE: {
+    uint64_t bits = 0;
+    double real = 0;
+    if (info == 2 && readInt(offset, 4, bits)) {
+      uint32_t single = static_cast<uint32_t>(bits);
+      float number = 0;
+      memcpy(&number, &single, sizeof(number));
+      real = number;
+    } else if (info == 3 && readInt(offset, 8, bits)) {
+      memcpy(&real, &bits, sizeof(real));
+    } else {
+      return false;
+    }
+    value = getRealValue((type == BPLIST_DATE) ? real + kBinaryPlistEpoch
+                                               : real);
+    return true;
+  }
+  case BPLIST_DATA:
+  case BPLIST_ASCII:
+  case BPLIST_UNICODE: {
+    uint64_t count = 0;
+    if (!getCount(info, offset, count)) {
+      return false;
+    }
+    auto width = (type == BPLIST_UNICODE) ? 2 : 1;
+    if (offset > size_ || count > (size_ - offset) / width) {
+      return false;
+    }
+
+    auto content = reinterpret_cast<const char*>(data_ + offset);
+    if (type == BPLIST_DATA) {
+      value = base64Encode(std::string(content, count));
+    } else if (type == BPLIST_ASCII) {
+      value.assign(content, count);
+    } else {
+      // UTF-16 big-endian code units, with surrogate pairs.
+      value.reserve(count);
+      for (uint64_t i = 0; i < count; i++) {
+        auto unit = data_ + offset + i * 2;
+        uint32_t code = (unit[0] << 8) | unit[1];
+        if (code >= 0xD800 && code <= 0xDBFF && i + 1 < count) {
+          uint32_t low = (unit[2] << 8) | unit[3];
+          if (low >= 0xDC00 && low <= 0xDFFF) {
+            code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+            i++;
+          }
+        }
+        appendUTF8(code, value);
+      }
+    }
+    return true;
+  }
+  case BPLIST_UID:
+    // Keyed archiver UIDs are not a JSON type, as with plist.mm.
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool BinaryPlist::getString(uint64_t ref, std::string& value) const {
+  BinaryPlistType type;
+  uint8_t info = 0;
+  size_t offset = 0;
+  if (!getObject(ref, type, info, offset) ||
+      (type != BPLIST_ASCII && type != BPLIST_UNICODE)) {
+    return false;
+  }
+  return getValue(type, info, offset, value);
+}
+
+Status BinaryPlist::filterDictionary(uint64_t ref,
+                                     pt::ptree& tree,
+                                     size_t depth) {
+  BinaryPlistType type;
+  uint8_t info = 0;
+  size_t offset = 0;
+  uint64_t count = 0;
+  if (depth > kPlistMaxDepth || !getObject(ref, type, info, offset) ||
+      type != BPLIST_DICT || !getCount(info, offset, count)) {
+    return Status(1, "Malformed binary property list dictionary");
+  }
+
+  // The key references are followed by the value references.
+  Status total_status = Status(0, "OK");
+  for (uint64_t i = 0; i < count; i++) {
+    uint64_t key_ref = 0;
+    uint64_t value_ref = 0;
+    if (!getRef(offset, i, key_ref) || !getRef(offset, count + i, value_ref)) {
+      return Status(1, "Malformed binary property list dictionary");
+    }
+
+    std::string path_node;
+    if (!getString(key_ref, path_node)) {
+      // Unknown type as dictionary key, most likely a malformed plist.
+      continue;
+    }
+
+    BinaryPlistType value_type;
+    uint8_t value_info = 0;
+    size_t value_offset = 0;
+    if (!getObject(value_ref, value_type, value_info, value_offset)) {
+      return Status(1, "Malformed binary property list object");
+    }
+
+    if (value_type == BPLIST_ARRAY || value_type == BPLIST_SET) {
+      auto status = filterArray(value_ref, path_node, tree, depth + 1);
+      if (!status.ok()) {
+        total_status = status;
+      }
+    } else if (value_type == BPLIST_DICT) {
+      pt::ptree child;
+      auto status = filterDictionary(value_ref, child, depth + 1);
+      if (!status.ok()) {
+        total_status = status;
+      }
+      tree.push_back(pt::ptree::value_type(path_node, std::move(child)));
+    } else {
+      std::string value;
+      if (!getValue(value_type, value_info, value_offset, value)) {
+        return Status(1, "Malformed binary property list object");
+      }
+      tree.push_back(pt::ptree::value_type(path_node, pt::ptree(value)));
+    }
+  }
+  return total_status;
+}
+
+Status BinaryPlist::filterArray(uint64_t ref,
+                                const std::string& root,
+                                pt::ptree& tree,
+                                size_t depth) {
+  BinaryPlistType type;
+  uint8_t info = 0;
+  size_t offset = 0;
+  uint64_t count = 0;
+  if (depth > kPlistMaxDepth || !getObject(ref, type, info, offset) ||
+      (type != BPLIST_ARRAY && type != BPLIST_SET) ||
+      !getCount(info, offset, count)) {
+    return Status(1, "Malformed binary property list array");
+  }
+
+  Status total_status = Status(0, "OK");
+  pt::ptree child_tree;
+  for (uint64_t i = 0; i < count; i++) {
+    uint64_t value_ref = 0;
+    BinaryPlistType value_type;
+    uint8_t value_info = 0;
+    size_t value_offset = 0;
+    if (!getRef(offset, i, value_ref) ||
+        !getObject(value_ref, value_type, value_info, value_offset)) {
+      return Status(1, "Malformed binary property list array");
+    }
+
+    pt::ptree child;
+    if (value_type == BPLIST_ARRAY || value_type == BPLIST_SET) {
+      auto status = filterArray(value_ref, "", child, depth + 1);
+      if (!status.ok()) {
+        total_status = status;
+      }
+    } else if (value_type == BPLIST_DICT) {
+      auto status = filterDictionary(value_ref, child, depth + 1);
+      if (!status.ok()) {
+        total_status = status;
+      }
+    } else {
+      std::string value;
+      if (!getValue(value_type, value_info, value_offset, value)) {
+        return Status(1, "Malformed binary property list object");
+      }
+      child.put_value(value);
+    }
+    child_tree.push_back(std::make_pair("", std::move(child)));
+  }
+  tree.push_back(pt::ptree::value_type(root, std::move(child_tree)));
+  return total_status;
+}
+
+/// Read the XML content without copying it into a string stream.
+class PlistBuffer : public std::streambuf {
+ public:
+  PlistBuffer(const char* data, size_t size) {
+    auto begin = const_cast<char*>(data);
+    setg(begin, begin, begin + size);
+  }
+};
+
+static Status filterXMLDictionary(const pt::ptree& dict,
+                                  pt::ptree& tree,
+                                  size_t depth);
+
+static Status filterXMLArray(const pt::ptree& array,
+                             const std::string& root,
+                             pt::ptree& tree,
+                             size_t depth);
+
+static bool getXMLValue(const std::string& type,
+                        const pt::ptree& node,
+                        std::string& value) {
+  const auto& text = node.data();
+  if (type == "string") {
+    value = text;
+  } else if (type == "integer") {
+    value = boost::algorithm::trim_copy(text);
+  } else if (type == "real") {
+    value = getRealValue(strtod(text.c_str(), nullptr));
+  } else if (type == "true") {
+    value = "1";
+  } else if (type == "false") {
+    value = "0";
+  } else if (type == "date") {
+    // Dates are ISO 8601 in UTC: 2016-01-01T00:00:00Z.
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    if (sscanf(text.c_str(),
+               " %4d-%2d-%2dT%2d:%2d:%2dZ",
+               &tm.tm_year,
+               &tm.tm_mon,
+               &tm.tm_mday,
+               &tm.tm_hour,
+               &tm.tm_min,
+               &tm.tm_sec) != 6) {
+      return false;
+    }
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    value = std::to_string(timegm(&tm));
+  } else if (type == "data") {
+    // Data is base64 with whitespace, encode it again as one line.
+    std::string encoded;
+    for (const auto& c : text) {
+      if (!isspace(static_cast<unsigned char>(c))) {
+        encoded += c;
+      }
+    }
+    value = base64Encode(base64Decode(encoded));
+  } else {
+    return false;
+  }
+  return true;
+}
+
+static Status filterXMLDictionary(const pt::ptree& dict,
+                                  pt::ptree& tree,
+                                  size_t depth) {
+  if (depth > kPlistMaxDepth) {
+    return Status(1, "Malformed XML property list dictionary");
+  }
+
+  // The members alternate between a key element and the value element.
+  Status total_status = Status(0, "OK");
+  const std::string* key = nullptr;
+  for (const auto& node : dict) {
+    if (node.first == "<xmlattr>" || node.first == "<xmlcomment>") {
+      continue;
+    }
+
+    if (key == nullptr) {
+      if (node.first != "key") {
+        return Status(1, "Malformed XML property list dictionary");
+      }
+      key = &node.second.data();
+      continue;
+    }
+
+    const auto& path_node = *key;
+    key = nullptr;
+    if (node.first == "array") {
+      auto status = filterXMLArray(node.second, path_node, tree, depth + 1);
+      if (!status.ok()) {
+        total_status = status;
+      }
+    } else if (node.first == "dict") {
+      pt::ptree child;
+      auto status = filterXMLDictionary(node.second, child, depth + 1);
+      if (!status.ok()) {
+        total_status = status;
+      }
+      tree.push_back(pt::ptree::value_type(path_node, std::move(child)));
+    } else {
+      std::string value;
+      if (!getXMLValue(node.first, node.second, value)) {
+        return Status(1, "Malformed XML property list value");
+      }
+      tree.push_back(pt::ptree::value_type(path_node, pt::ptree(value)));
+    }
+  }
+  return total_status;
+}
+
+static Status filterXMLArray(const pt::ptree& array,
+                             const std::string& root,
+                             pt::ptree& tree,
+                             size_t depth) {
+  if (depth > kPlistMaxDepth) {
+    return Status(1, "Malformed XML property list array");
+  }
+
+  Status total_status = Status(0, "OK");
+  pt::ptree child_tree;
+  for (const auto& node : array) {
+    if (node.first == "<xmlattr>" || node.first == "<xmlcomment>") {
+      continue;
+    }
+
+    pt::ptree child;
+    if (node.first == "array") {
+      auto status = filterXMLArray(node.second, "", child, depth + 1);
+      if (!status.ok()) {
+        total_status = status;
+      }
+    } else if (node.first == "dict") {
+      auto status = filterXMLDictionary(node.second, child, depth + 1);
+      if (!status.ok()) {
+        total_status = status;
+      }
+    } else {
+      std::string value;
+      if (!getXMLValue(node.first, node.second, value)) {
+        return Status(1, "Malformed XML property list value");
+      }
+      child.put_value(value);
+    }
+    child_tree.push_back(std::make_pair("", std::move(child)));
+  }
+  tree.push_back(pt::ptree::value_type(root, std::move(child_tree)));
+  return total_status;
+}
+
+static Status parseXMLPlist(const char* data, size_t size, pt::ptree& tree) {
+  pt::ptree document;
+  try {
+    PlistBuffer buffer(data, size);
+    std::istream stream(&buffer);
+    pt::read_xml(stream, document);
+  } catch (const pt::ptree_error& e) {
+    return Status(1, "Malformed XML property list");
+  }
+
+  auto plist = document.get_child_optional("plist");
+  if (!plist) {
+    return Status(1, "Not an XML property list");
+  }
+
+  for (const auto& node : *plist) {
+    if (node.first == "<xmlattr>" || node.first == "<xmlcomment>") {
+      continue;
+    }
+
+    // The first element is the top object.
+    if (node.first == "dict") {
+      return filterXMLDictionary(node.second, tree, 0);
+    } else if (node.first == "array") {
+      return filterXMLArray(node.second, "root", tree, 0);
+    }
+
+    std::string value;
+    if (!getXMLValue(node.first, node.second, value)) {
+      return Status(1, "Malformed XML property list value");
+    }
+    tree.push_back(pt::ptree::value_type("root", pt::ptree(value)));
+    return Status(0, "OK");
+  }
+  return Status(1, "Empty XML property list");
+}
+
+Status parsePlistData(const char* data, size_t size, pt::ptree& tree) {
+  tree.clear();
+  if (size >= kBinaryPlistMagic.size() &&
+      memcmp(data, kBinaryPlistMagic.data(), kBinaryPlistMagic.size()) == 0) {
+    auto status = BinaryPlist(data, size).parse(tree);
+    if (!status.ok()) {
+      tree.clear();
+    }
+    return status;
+  }
+
+  // Skip a byte order mark and whitespace before looking for an XML prolog.
+  size_t start = 0;
+  if (size >= 3 && memcmp(data, "\xEF\xBB\xBF", 3) == 0) {
+    start = 3;
+  }
+  while (start < size && isspace(static_cast<unsigned char>(data[start]))) {
+    start++;
+  }
+  if (start == size || data[start] != '<') {
+    return Status(1, "Not a binary or XML property list");
+  }
+
+  auto status = parseXMLPlist(data + start, size - start, tree);
+  if (!status.ok()) {
+    tree.clear();
+  }
+  return status;
+}
+}
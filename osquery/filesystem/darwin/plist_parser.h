@@ -0,0 +1,41 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+#include <boost/property_tree/ptree.hpp>
+
+#include <osquery/status.h>
+
+namespace osquery {
+
+/**
+ * @brief Decode binary or XML property list content into a property tree.
+ *
+ * The content is decoded in place, typically from a mapped file, without
+ * creating Foundation objects. The tree matches the one parsePlist builds
+ * from NSPropertyListSerialization: dictionaries are nodes keyed by their
+ * keys, arrays are nodes with anonymous children, a top-level array is the
+ * "root" child, booleans are "1" or "0", dates are seconds since the epoch,
+ * and data is base64 encoded.
+ *
+ * @param data the property list content.
+ * @param size the content size.
+ * @param tree the output property tree.
+ *
+ * @return failure if the content is not a binary (bplist00) or XML property
+ * list, or is malformed. The older ASCII format is not decoded.
+ */
+Status parsePlistData(const char* data,
+                      size_t size,
+                      boost::property_tree::ptree& tree);
+}
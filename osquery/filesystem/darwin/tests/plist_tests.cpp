@@ -10,12 +10,14 @@
 
 #include <gtest/gtest.h>
 
+#include <boost/algorithm/string/replace.hpp>
 #include <boost/filesystem.hpp>
 
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/filesystem/darwin/plist_parser.h"
 #include "osquery/tests/test_util.h"
 
 namespace fs = boost::filesystem;
@@ -102,4 +104,67 @@ TEST_F(PlistTests, test_parse_plist_content_with_blobs) {
   // Verify we parsed the binary blob correctly
   EXPECT_NE(alias.find("Applications/Flux.app"), std::string::npos);
 }
+
+TEST_F(PlistTests, test_parse_plist_data) {
+  // The native parser decodes both the XML and binary formats.
+  std::string content;
+  readFile(kTestDataPath + "test.plist", content);
+
+  pt::ptree tree;
+  auto s = parsePlistData(content.data(), content.size(), tree);
+  ASSERT_TRUE(s.ok());
+  EXPECT_EQ(tree.size(), 8U);
+  EXPECT_EQ(tree.get<bool>("Disabled"), true);
+  EXPECT_EQ(tree.get("inetdCompatibility.Wait", ""), "0");
+  EXPECT_EQ(tree.get_child("ProgramArguments").size(), 4U);
+
+  readFile(kTestDataPath + "test_binary.plist", content);
+  s = parsePlistData(content.data(), content.size(), tree);
+  ASSERT_TRUE(s.ok());
+  EXPECT_EQ(tree.get<std::string>("SessionItems.Controller"),
+            "CustomListItems");
+  auto first_element =
+      tree.get_child("SessionItems.CustomListItems").begin()->second;
+  EXPECT_EQ(first_element.get<std::string>("Name"), "Flux");
+  std::string alias = base64Decode(first_element.get<std::string>("Alias"));
+  EXPECT_NE(alias.find("Applications/Flux.app"), std::string::npos);
+
+  // A top-level array is the root child.
+  readFile(kTestDataPath + "test_array.plist", content);
+  s = parsePlistData(content.data(), content.size(), tree);
+  ASSERT_TRUE(s.ok());
+  EXPECT_EQ(tree.count("root"), 1U);
+
+  // Truncated content is malformed, other formats are not decoded.
+  readFile(kTestDataPath + "test_binary.plist", content);
+  s = parsePlistData(content.data(), content.size() / 2, tree);
+  EXPECT_FALSE(s.ok());
+  EXPECT_TRUE(tree.empty());
+
+  content = "{ Disabled = YES; }";
+  s = parsePlistData(content.data(), content.size(), tree);
+  EXPECT_FALSE(s.ok());
+}
+
+TEST_F(PlistTests, test_parse_plist_cache) {
+  auto path = kTestWorkingDirectory + "test_cache.plist";
+  std::string content;
+  readFile(kTestDataPath + "test.plist", content);
+  writeTextFile(path, content);
+
+  pt::ptree tree;
+  ASSERT_TRUE(parsePlist(path, tree).ok());
+  EXPECT_EQ(tree.get<std::string>("Label"), "com.apple.FileSyncAgent.sshd");
+
+  // A changed file is parsed again rather than served from the cache.
+  boost::replace_all(content, "FileSyncAgent.sshd", "FileSyncAgent.sshd-2");
+  writeTextFile(path, content);
+  ASSERT_TRUE(parsePlist(path, tree).ok());
+  EXPECT_EQ(tree.get<std::string>("Label"), "com.apple.FileSyncAgent.sshd-2");
+
+  // An unchanged file is served from the cache.
+  ASSERT_TRUE(parsePlist(path, tree).ok());
+  EXPECT_EQ(tree.get<std::string>("Label"), "com.apple.FileSyncAgent.sshd-2");
+  fs::remove(path);
+}
 }
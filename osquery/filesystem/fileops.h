@@ -99,6 +99,9 @@ const PlatformHandle kInvalidHandle = (PlatformHandle)-1;
 #define PF_NONBLOCK 0x0020
 #define PF_APPEND 0x0040
 
+/// Hint that the file is read once from start to end, so it is read ahead.
+#define PF_SEQUENTIAL 0x0080
+
 /**
  * @brief Modes for seeking through a file.
  *
@@ -202,6 +205,26 @@ class PlatformFile {
 
   ssize_t write(const void* buf, size_t nbyte);
 
+  /**
+   * @brief Read up to nbyte bytes into buf with reads of block_size bytes.
+   *
+   * The read stops at the end of the file. On Windows a file opened with
+   * PF_NONBLOCK keeps several overlapped block reads outstanding, each read
+   * directly into its part of buf; other files read one block at a time.
+   *
+   * @return the number of bytes read, or -1 if nothing could be read.
+   */
+  ssize_t readBlocks(void* buf, size_t nbyte, size_t block_size);
+
+  /**
+   * @brief Write several buffers, in order, with as few writes as possible.
+   *
+   * Partial writes are continued until every buffer is written.
+   *
+   * @return the number of bytes written, or -1 on error.
+   */
+  ssize_t write(const std::vector<std::string>& buffers);
+
   off_t seek(off_t offset, SeekMode mode);
 
   size_t size() const;
@@ -8,6 +8,8 @@
  *
  */
 
+#include <atomic>
+#include <mutex>
 #include <sstream>
 
 #include <fcntl.h>
@@ -16,7 +18,11 @@
 #ifndef WIN32
 #include <glob.h>
 #include <pwd.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
 #include <sys/time.h>
+#include <unistd.h>
 #endif
 
 #include <boost/algorithm/string.hpp>
@@ -31,6 +37,7 @@
 #include <osquery/system.h>
 
 #include "osquery/filesystem/fileops.h"
+#include "osquery/filesystem/glob.h"
 
 namespace pt = boost::property_tree;
 namespace fs = boost::filesystem;
@@ -47,7 +54,14 @@ HIDDEN_FLAG(bool, allow_unsafe, false, "Allow unsafe executable permissions");
 /// Disable forensics (atime/mtime preserving) file reads.
 HIDDEN_FLAG(bool, disable_forensic, true, "Disable atime/mtime preservation");
 
-static const size_t kMaxRecursiveGlobs = 64;
+/// Read files into buffers instead of mapping them, see readFileView.
+HIDDEN_FLAG(bool, disable_read_mmap, false, "Do not map files to read them");
+
+/// Smaller files are read, copying them costs less than a mapping.
+const off_t kReadMapMinimum = 256 * 1024;
+
+/// Regular files are read in blocks of this size, see readBlocks.
+const size_t kReadBlockSize = 1024 * 1024;
 
 Status writeTextFile(const fs::path& path,
                      const std::string& content,
@@ -83,8 +97,9 @@ struct OpenReadableFile {
     if (dropper_->dropToParent(path)) {
 #endif
       // Open the file descriptor and allow caller to perform error checking.
-      fd.reset(new PlatformFile(path.string(),
-                                PF_OPEN_EXISTING | PF_READ | PF_NONBLOCK));
+      fd.reset(new PlatformFile(
+          path.string(),
+          PF_OPEN_EXISTING | PF_READ | PF_NONBLOCK | PF_SEQUENTIAL));
 #ifndef WIN32
     }
 #endif
@@ -100,32 +115,47 @@ struct OpenReadableFile {
 #endif
 };
 
-Status readFile(
-    const fs::path& path,
-    size_t size,
-    size_t block_size,
-    bool dry_run,
-    bool preserve_time,
-    std::function<void(std::string& buffer, size_t size)> predicate) {
-  OpenReadableFile handle(path);
+/// Check the size of an opened file against the read limits.
+static Status checkReadLimits(const fs::path& path,
+                              const OpenReadableFile& handle,
+                              size_t size,
+                              off_t& file_size,
+                              off_t& read_max) {
   if (handle.fd == nullptr || !handle.fd->isValid()) {
     return Status(1, "Cannot open file for reading: " + path.string());
   }
 
-  off_t file_size = handle.fd->size();
+  file_size = handle.fd->size();
   if (handle.fd->isSpecialFile() && size > 0) {
     file_size = static_cast<off_t>(size);
   }
 
   // Apply the max byte-read based on file/link target ownership.
-  off_t read_max = (handle.fd->isOwnerRoot().ok())
-                       ? FLAGS_read_max
-                       : std::min(FLAGS_read_max, FLAGS_read_user_max);
+  read_max = (handle.fd->isOwnerRoot().ok())
+                 ? FLAGS_read_max
+                 : std::min(FLAGS_read_max, FLAGS_read_user_max);
   if (file_size > read_max) {
     VLOG(1) << "Cannot read " << path << " size exceeds limit: " << file_size
             << " > " << read_max;
     return Status(1, "File exceeds read limits");
   }
+  return Status(0, "OK");
+}
+
+Status readFile(
+    const fs::path& path,
+    size_t size,
+    size_t block_size,
+    bool dry_run,
+    bool preserve_time,
+    std::function<void(std::string& buffer, size_t size)> predicate) {
+  OpenReadableFile handle(path);
+  off_t file_size = 0;
+  off_t read_max = 0;
+  auto status = checkReadLimits(path, handle, size, file_size, read_max);
+  if (!status.ok()) {
+    return status;
+  }
 
   if (dry_run) {
     // The caller is only interested in performing file read checks.
@@ -140,7 +170,7 @@ Status readFile(
     off_t total_bytes = 0;
     ssize_t part_bytes = 0;
     do {
-      auto part = std::string(4096, '\0');
+      auto part = std::string(block_size, '\0');
       part_bytes = handle.fd->read(&part[0], block_size);
       if (part_bytes > 0) {
         total_bytes += part_bytes;
@@ -153,8 +183,8 @@ Status readFile(
     } while (part_bytes > 0);
   } else {
     auto content = std::string(file_size, '\0');
-    handle.fd->read(&content[0], file_size);
-    predicate(content, file_size);
+    auto bytes = handle.fd->readBlocks(&content[0], file_size, kReadBlockSize);
+    predicate(content, (bytes > 0) ? bytes : 0);
   }
 
   // Attempt to restore the atime and mtime before the file read.
@@ -164,6 +194,168 @@ Status readFile(
   return Status(0, "OK");
 }
 
+#ifndef WIN32
+/// Most files mapped at once, a file is read when there is no free slot.
+const size_t kMappedReadSlots = 64;
+
+/**
+ * @brief The mappings being read, checked by the SIGBUS handler.
+ *
+ * A mapping is read by the predicate's threads, so the handler cannot use
+ * thread-local state, and it cannot take locks.
+ */
+static std::atomic<const char*> kMappedReads[kMappedReadSlots];
+static std::atomic<size_t> kMappedReadSizes[kMappedReadSlots];
+static std::atomic<bool> kMappedReadTruncated[kMappedReadSlots];
+
+static struct sigaction kPreviousBusAction;
+static uintptr_t kMappedReadPageSize{4096};
+
+/// Replace the pages of a truncated mapping with zeros.
+static void handleMappedReadFault(int sig, siginfo_t* info, void* context) {
+  auto address = static_cast<const char*>(info->si_addr);
+  for (size_t i = 0; i < kMappedReadSlots; i++) {
+    // A reserved slot, with the address 1, is not yet mapped.
+    auto start = kMappedReads[i].load();
+    if (reinterpret_cast<uintptr_t>(start) > 1 && address >= start &&
+        address < start + kMappedReadSizes[i].load()) {
+      auto page = reinterpret_cast<uintptr_t>(address) &
+                  ~(kMappedReadPageSize - 1);
+      ::mmap(reinterpret_cast<void*>(page),
+             kMappedReadPageSize,
+             PROT_READ,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED,
+             -1,
+             0);
+      kMappedReadTruncated[i] = true;
+      return;
+    }
+  }
+
+  // The fault is not within a mapped read.
+  if (kPreviousBusAction.sa_flags & SA_SIGINFO) {
+    kPreviousBusAction.sa_sigaction(sig, info, context);
+  } else if (kPreviousBusAction.sa_handler != SIG_DFL &&
+             kPreviousBusAction.sa_handler != SIG_IGN) {
+    kPreviousBusAction.sa_handler(sig);
+  } else {
+    ::signal(SIGBUS, SIG_DFL);
+    ::raise(sig);
+  }
+}
+
+static void installMappedReadHandler() {
+  static std::once_flag once;
+  std::call_once(once, []() {
+    kMappedReadPageSize = static_cast<uintptr_t>(::sysconf(_SC_PAGESIZE));
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = handleMappedReadFault;
+    action.sa_flags = SA_SIGINFO | SA_NODEFER;
+    sigemptyset(&action.sa_mask);
+    ::sigaction(SIGBUS, &action, &kPreviousBusAction);
+  });
+}
+
+/**
+ * @brief Call the predicate with a read-only mapping of the file.
+ *
+ * @return false if the file could not be mapped and must be read.
+ */
+static bool readMappedFile(const fs::path& path,
+                           int fd,
+                           size_t size,
+                           std::function<void(boost::string_ref)>& predicate,
+                           Status& status) {
+  installMappedReadHandler();
+  size_t slot = 0;
+  const char* expected = nullptr;
+  auto reserved = reinterpret_cast<const char*>(1);
+  while (slot < kMappedReadSlots &&
+         !kMappedReads[slot].compare_exchange_strong(expected, reserved)) {
+    expected = nullptr;
+    slot++;
+  }
+  if (slot == kMappedReadSlots) {
+    return false;
+  }
+
+  auto data = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  if (data == MAP_FAILED) {
+    kMappedReads[slot] = nullptr;
+    return false;
+  }
+  ::madvise(data, size, MADV_SEQUENTIAL);
+
+  auto content = static_cast<const char*>(data);
+  kMappedReadSizes[slot] = size;
+  kMappedReadTruncated[slot] = false;
+  kMappedReads[slot] = content;
+  predicate(boost::string_ref(content, size));
+  kMappedReads[slot] = nullptr;
+  ::munmap(data, size);
+
+  if (kMappedReadTruncated[slot]) {
+    status = Status(1, "File was truncated while reading: " + path.string());
+  }
+  return true;
+}
+#endif
+
+Status readFileView(const fs::path& path,
+                    size_t block_size,
+                    bool preserve_time,
+                    std::function<void(boost::string_ref content)> predicate) {
+  OpenReadableFile handle(path);
+  off_t file_size = 0;
+  off_t read_max = 0;
+  auto status = checkReadLimits(path, handle, 0, file_size, read_max);
+  if (!status.ok()) {
+    return status;
+  }
+
+  PlatformTime times;
+  handle.fd->getFileTimes(times);
+
+  bool mapped = false;
+#ifndef WIN32
+  if (!FLAGS_disable_read_mmap && !handle.fd->isSpecialFile() &&
+      file_size >= kReadMapMinimum) {
+    mapped = readMappedFile(path,
+                            handle.fd->nativeHandle(),
+                            static_cast<size_t>(file_size),
+                            predicate,
+                            status);
+  }
+#endif
+
+  if (!mapped && file_size > 0 && !handle.fd->isSpecialFile()) {
+    // A regular file is still passed as a single span.
+    std::string content(file_size, '\0');
+    auto bytes = handle.fd->readBlocks(&content[0], file_size, kReadBlockSize);
+    predicate(boost::string_ref(content.data(), (bytes > 0) ? bytes : 0));
+  } else if (!mapped) {
+    // Parts are read into one buffer, the predicate does not own it.
+    std::string buffer(block_size, '\0');
+    off_t total_bytes = 0;
+    ssize_t part_bytes = 0;
+    while ((part_bytes = handle.fd->read(&buffer[0], block_size)) > 0) {
+      total_bytes += part_bytes;
+      if (total_bytes > read_max) {
+        status = Status(1, "File exceeds read limits");
+        break;
+      }
+      predicate(boost::string_ref(buffer.data(), part_bytes));
+    }
+  }
+
+  // Attempt to restore the atime and mtime before the file read.
+  if (preserve_time && !FLAGS_disable_forensic) {
+    handle.fd->setFileTimes(times);
+  }
+  return status;
+}
+
 Status readFile(const fs::path& path,
                 std::string& content,
                 size_t size,
@@ -218,6 +410,30 @@ Status isReadable(const fs::path& path) {
   return Status(1, "Path is not readable: " + path.string());
 }
 
+bool getFileChangeKey(const fs::path& path, std::string& key) {
+#ifdef WIN32
+  return false;
+#else
+  struct stat st;
+  if (::stat(path.string().c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+    return false;
+  }
+
+#ifdef __APPLE__
+  auto& mtime = st.st_mtimespec;
+  auto& ctime = st.st_ctimespec;
+#else
+  auto& mtime = st.st_mtim;
+  auto& ctime = st.st_ctim;
+#endif
+  key = std::to_string(st.st_dev) + "." + std::to_string(st.st_ino) + "." +
+        std::to_string(st.st_size) + "." + std::to_string(mtime.tv_sec) + "." +
+        std::to_string(mtime.tv_nsec) + "." + std::to_string(ctime.tv_sec) +
+        "." + std::to_string(ctime.tv_nsec);
+  return true;
+#endif
+}
+
 Status pathExists(const fs::path& path) {
   boost::system::error_code ec;
   if (path.empty()) {
@@ -242,6 +458,9 @@ static void genGlobs(std::string path,
   // Use our helped escape/replace for wildcards.
   replaceGlobWildcards(path, limits);
 
+#ifndef WIN32
+  resolveGlob(path, limits, results);
+#else
   // Generate a glob set and recurse for double star.
   size_t glob_index = 0;
   while (++glob_index < kMaxRecursiveGlobs) {
@@ -272,6 +491,7 @@ static void genGlobs(std::string path,
                                         limits & GLOB_FILES));
                             });
   results.erase(end, results.end());
+#endif
 }
 
 Status resolveFilePattern(const fs::path& fs_path,
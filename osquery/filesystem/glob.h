@@ -0,0 +1,54 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <osquery/filesystem.h>
+
+namespace osquery {
+
+/// The most directory levels a recursive wildcard descends.
+const size_t kMaxRecursiveGlobs = 64;
+
+/**
+ * @brief Expand csh-style braces into each alternative pattern.
+ *
+ * Braces nest and an alternative may be empty: "a{b,c{d,}}" expands to "ab",
+ * "acd" and "ac". A brace without a match is kept as a literal.
+ */
+std::vector<std::string> expandGlobBraces(const std::string& pattern);
+
+/**
+ * @brief Resolve a filesystem glob pattern by walking the matched directories.
+ *
+ * The pattern uses shell wildcards, see replaceGlobWildcards. Components
+ * without wildcards are opened directly and other components are matched
+ * against directory entries, so only directories on a matching path are
+ * read. Entry types come from the directory listing, a file is only stat'd
+ * when it is a link or the filesystem does not report types.
+ *
+ * A pattern ending in "**" also matches every descendant of its matches,
+ * up to kMaxRecursiveGlobs levels. Subtrees are walked by
+ * `--glob_threads` threads.
+ *
+ * Directories are returned with a trailing '/'. Results are sorted within
+ * each brace alternative, matches of a recursive pattern are ordered by depth.
+ *
+ * @param pattern the glob pattern.
+ * @param limits the types of matches to return.
+ * @param results the output matching paths.
+ */
+void resolveGlob(const std::string& pattern,
+                 GlobLimits limits,
+                 std::vector<std::string>& results);
+}
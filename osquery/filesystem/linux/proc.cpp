@@ -8,27 +8,115 @@
  *
  */
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iterator>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <linux/limits.h>
 #include <unistd.h>
 
 #include <boost/filesystem.hpp>
 
+#include <osquery/core.h>
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 
+#include "osquery/filesystem/linux/proc.h"
+
 namespace osquery {
 
+FLAG(uint64,
+     proc_scan_threads,
+     4,
+     "Number of threads reading /proc for process tables, 1 to disable");
+
+FLAG(uint64,
+     proc_snapshot_ttl,
+     1000,
+     "Milliseconds process tables share /proc reads, 0 to disable");
+
+DECLARE_uint64(read_max);
+
 const std::string kLinuxProcPath = "/proc";
 
+/// The initial size of a scanning thread's read buffer.
+const size_t kProcReadBufferSize = 4096;
+
+/// Processes taken from the cursor at once by a scanning thread.
+const size_t kProcScanBatch = 16;
+
+/// The process files kept in a snapshot, the others are always read.
+const std::set<std::string> kProcSnapshotFiles = {"stat", "status"};
+
+/**
+ * @brief Reads of /proc shared by the process tables for a short time.
+ *
+ * Queries joining several process tables, or tables generated through SQL
+ * from another process table, enumerate and read the same processes. Every
+ * read within `--proc_snapshot_ttl` of the first is served from memory.
+ */
+struct ProcSnapshot {
+  std::chrono::steady_clock::time_point expires;
+
+  /// The lifetime the snapshot was created with.
+  size_t ttl{0};
+
+  /// True if the process list was enumerated.
+  bool has_processes{false};
+  std::set<std::string> processes;
+
+  /// Contents of snapshot files, by "pid/file".
+  std::map<std::string, std::string> files;
+
+  /// Descriptor link targets, by pid.
+  std::map<std::string, std::map<std::string, std::string>> descriptors;
+};
+
+static ProcSnapshot kProcSnapshot;
+
+/// Protect the snapshot.
+static Mutex kProcSnapshotMutex;
+
+/// Return the current snapshot, call while holding the snapshot lock.
+static ProcSnapshot& getProcSnapshot() {
+  // A changed lifetime applies immediately.
+  auto now = std::chrono::steady_clock::now();
+  if (now >= kProcSnapshot.expires ||
+      kProcSnapshot.ttl != FLAGS_proc_snapshot_ttl) {
+    kProcSnapshot = ProcSnapshot();
+    kProcSnapshot.ttl = FLAGS_proc_snapshot_ttl;
+    kProcSnapshot.expires =
+        now + std::chrono::milliseconds(FLAGS_proc_snapshot_ttl);
+  }
+  return kProcSnapshot;
+}
+
 Status procProcesses(std::set<std::string>& processes) {
+  if (FLAGS_proc_snapshot_ttl > 0) {
+    WriteLock lock(kProcSnapshotMutex);
+    auto& snapshot = getProcSnapshot();
+    if (snapshot.has_processes) {
+      processes.insert(snapshot.processes.begin(), snapshot.processes.end());
+      return Status(0, "OK");
+    }
+  }
+
   // Iterate over each process-like directory in proc.
+  std::set<std::string> found;
   boost::filesystem::directory_iterator it(kLinuxProcPath), end;
   try {
     for (; it != end; ++it) {
       if (boost::filesystem::is_directory(it->status())) {
         // See #792: std::regex is incomplete until GCC 4.9
         if (std::atoll(it->path().leaf().string().c_str()) > 0) {
-          processes.insert(it->path().leaf().string());
+          found.insert(it->path().leaf().string());
         }
       }
     }
@@ -37,6 +125,13 @@ Status procProcesses(std::set<std::string>& processes) {
     return Status(1, e.what());
   }
 
+  processes.insert(found.begin(), found.end());
+  if (FLAGS_proc_snapshot_ttl > 0) {
+    WriteLock lock(kProcSnapshotMutex);
+    auto& snapshot = getProcSnapshot();
+    snapshot.has_processes = true;
+    snapshot.processes = std::move(found);
+  }
   return Status(0, "OK");
 }
 
@@ -77,4 +172,176 @@ Status procReadDescriptor(const std::string& process,
     return Status(1, "Could not read path");
   }
 }
+
+ProcessDirectory::ProcessDirectory(int proc_fd,
+                                   const std::string& pid,
+                                   std::string& buffer)
+    : pid_(pid), buffer_(buffer) {
+  // Constrained pids are not trusted to name a process directory.
+  if (pid.empty() || pid.find_first_not_of("0123456789") != std::string::npos) {
+    return;
+  }
+  fd_ = ::openat(proc_fd, pid.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+ProcessDirectory::~ProcessDirectory() {
+  if (fd_ >= 0) {
+    ::close(fd_);
+  }
+}
+
+Status ProcessDirectory::read(const char* name, std::string& content) const {
+  content.clear();
+  auto snapshot = FLAGS_proc_snapshot_ttl > 0 && kProcSnapshotFiles.count(name);
+  if (snapshot) {
+    WriteLock lock(kProcSnapshotMutex);
+    auto& files = getProcSnapshot().files;
+    auto it = files.find(pid_ + "/" + name);
+    if (it != files.end()) {
+      content = it->second;
+      return Status(0, "OK");
+    }
+  }
+
+  auto fd = ::openat(fd_, name, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return Status(1, "Cannot open " + pid_ + "/" + name);
+  }
+
+  // Files in /proc report a size of 0, read until the end.
+  if (buffer_.size() < kProcReadBufferSize) {
+    buffer_.resize(kProcReadBufferSize);
+  }
+  size_t size = 0;
+  while (size < FLAGS_read_max) {
+    if (size == buffer_.size()) {
+      buffer_.resize(buffer_.size() * 2);
+    }
+    auto bytes = ::read(fd, &buffer_[size], buffer_.size() - size);
+    if (bytes < 0 && errno == EINTR) {
+      continue;
+    } else if (bytes <= 0) {
+      break;
+    }
+    size += bytes;
+  }
+  ::close(fd);
+
+  content.assign(buffer_.data(), std::min<size_t>(size, FLAGS_read_max));
+  if (snapshot) {
+    WriteLock lock(kProcSnapshotMutex);
+    getProcSnapshot().files[pid_ + "/" + name] = content;
+  }
+  return Status(0, "OK");
+}
+
+Status ProcessDirectory::readLink(const char* name, std::string& target) const {
+  char link_path[PATH_MAX] = {0};
+  auto size = ::readlinkat(fd_, name, link_path, sizeof(link_path) - 1);
+  if (size < 0) {
+    return Status(1, "Could not read path");
+  }
+  target.assign(link_path, size);
+  return Status(0, "OK");
+}
+
+Status ProcessDirectory::descriptors(
+    std::map<std::string, std::string>& descriptors) const {
+  if (FLAGS_proc_snapshot_ttl > 0) {
+    WriteLock lock(kProcSnapshotMutex);
+    auto& snapshot = getProcSnapshot().descriptors;
+    auto it = snapshot.find(pid_);
+    if (it != snapshot.end()) {
+      descriptors = it->second;
+      return Status(0, "OK");
+    }
+  }
+
+  // Access to the process' /fd may be restricted.
+  auto fd = ::openat(fd_, "fd", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) {
+    return Status(1, "Cannot access descriptors for " + pid_);
+  }
+
+  auto dir = ::fdopendir(fd);
+  if (dir == nullptr) {
+    ::close(fd);
+    return Status(1, "Cannot access descriptors for " + pid_);
+  }
+
+  char link_path[PATH_MAX] = {0};
+  struct dirent* entry = nullptr;
+  while ((entry = ::readdir(dir)) != nullptr) {
+    if (entry->d_name[0] == '.') {
+      continue;
+    }
+    auto size =
+        ::readlinkat(fd, entry->d_name, link_path, sizeof(link_path) - 1);
+    if (size >= 0) {
+      descriptors[entry->d_name] = std::string(link_path, size);
+    }
+  }
+  // Closing the directory stream closes the descriptor.
+  ::closedir(dir);
+
+  if (FLAGS_proc_snapshot_ttl > 0) {
+    WriteLock lock(kProcSnapshotMutex);
+    getProcSnapshot().descriptors[pid_] = descriptors;
+  }
+  return Status(0, "OK");
+}
+
+void procScan(const std::set<std::string>& processes,
+              const ProcessScanCallback& callback,
+              QueryData& results,
+              const std::atomic<bool>* done) {
+  auto proc_fd =
+      ::open(kLinuxProcPath.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (proc_fd < 0) {
+    VLOG(1) << "Cannot open " << kLinuxProcPath;
+    return;
+  }
+
+  // Each process's rows are kept separately to preserve the process order.
+  std::vector<std::string> pids(processes.begin(), processes.end());
+  std::vector<QueryData> rows(pids.size());
+  std::atomic<size_t> cursor(0);
+  auto scanner = [&]() {
+    std::string buffer;
+    while (true) {
+      auto start = cursor.fetch_add(kProcScanBatch);
+      if (start >= pids.size()) {
+        break;
+      }
+      auto end = std::min(start + kProcScanBatch, pids.size());
+      for (auto i = start; i < end; i++) {
+        if (done != nullptr && done->load()) {
+          return;
+        }
+        ProcessDirectory process(proc_fd, pids[i], buffer);
+        if (process.valid()) {
+          callback(process, rows[i]);
+        }
+      }
+    }
+  };
+
+  auto threads = std::max<size_t>(FLAGS_proc_scan_threads, 1);
+  threads = std::min(threads, pids.size() / kProcScanBatch + 1);
+  std::vector<std::thread> scanners;
+  for (size_t i = 1; i < threads; i++) {
+    scanners.emplace_back(scanner);
+  }
+  scanner();
+  for (auto& thread : scanners) {
+    thread.join();
+  }
+  ::close(proc_fd);
+
+  for (auto& process_rows : rows) {
+    std::move(process_rows.begin(),
+              process_rows.end(),
+              std::back_inserter(results));
+  }
+}
 }
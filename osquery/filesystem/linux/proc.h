@@ -0,0 +1,93 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <set>
+#include <string>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/database.h>
+#include <osquery/status.h>
+
+namespace osquery {
+
+/**
+ * @brief A process directory in `/proc`, opened once and read relative to.
+ *
+ * Reads use openat and readlinkat with the directory's descriptor, so each
+ * file costs a single path lookup within the process directory. The read
+ * buffer is owned by the scanning thread and reused across processes.
+ *
+ * The "stat" and "status" files and the descriptors are kept in a snapshot
+ * for `--proc_snapshot_ttl` milliseconds, the process tables used by a query
+ * read each process once.
+ */
+class ProcessDirectory : private boost::noncopyable {
+ public:
+  /// Open a process directory relative to an open `/proc` descriptor.
+  ProcessDirectory(int proc_fd, const std::string& pid, std::string& buffer);
+
+  ~ProcessDirectory();
+
+ public:
+  /// True if the process directory was opened.
+  bool valid() const { return fd_ >= 0; }
+
+  /// The process's pid as a string.
+  const std::string& pid() const { return pid_; }
+
+  /// Read a file in the process directory, such as "stat" or "cmdline".
+  Status read(const char* name, std::string& content) const;
+
+  /// Read the target of a link in the process directory, such as "exe".
+  Status readLink(const char* name, std::string& target) const;
+
+  /// Read the targets of each descriptor, see procDescriptors.
+  Status descriptors(std::map<std::string, std::string>& descriptors) const;
+
+ private:
+  /// The process directory descriptor, -1 if the process has exited.
+  int fd_{-1};
+
+  std::string pid_;
+
+  /// The scanning thread's reusable read buffer.
+  std::string& buffer_;
+};
+
+/// Generate rows for one process.
+using ProcessScanCallback =
+    std::function<void(const ProcessDirectory& process, QueryData& results)>;
+
+/**
+ * @brief Call a generator for each process using a pool of scanning threads.
+ *
+ * Threads take the next unscanned process from a shared cursor, a thread
+ * slowed by a large process does not hold back the others. The results are
+ * appended in the order of the process set; processes that exit before they
+ * are scanned are skipped. The number of threads is `--proc_scan_threads`.
+ *
+ * The callback is called concurrently and must not use the SQL interfaces.
+ *
+ * @param processes the string pids to scan, see procProcesses.
+ * @param callback called with each opened process directory.
+ * @param results the output rows.
+ * @param done optional, once true the remaining processes are not scanned.
+ */
+void procScan(const std::set<std::string>& processes,
+              const ProcessScanCallback& callback,
+              QueryData& results,
+              const std::atomic<bool>* done = nullptr);
+}
@@ -8,7 +8,9 @@
  *
  */
 
+#include <fcntl.h>
 #include <glob.h>
+#include <limits.h>
 #include <pwd.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -16,6 +18,7 @@
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
 #include <boost/filesystem.hpp>
 #include <boost/optional.hpp>
@@ -83,6 +86,12 @@ PlatformFile::PlatformFile(const std::string& path, int mode, int perms) {
   } else {
     handle_ = ::open(path.c_str(), oflag, perms);
   }
+
+#ifdef POSIX_FADV_SEQUENTIAL
+  if (handle_ != kInvalidHandle && (mode & PF_SEQUENTIAL) == PF_SEQUENTIAL) {
+    ::posix_fadvise(handle_, 0, 0, POSIX_FADV_SEQUENTIAL);
+  }
+#endif
 }
 
 PlatformFile::~PlatformFile() {
@@ -206,6 +215,24 @@ ssize_t PlatformFile::read(void* buf, size_t nbyte) {
   return ret;
 }
 
+ssize_t PlatformFile::readBlocks(void* buf, size_t nbyte, size_t block_size) {
+  size_t total = 0;
+  while (total < nbyte) {
+    auto part = read(static_cast<char*>(buf) + total,
+                     std::min(block_size, nbyte - total));
+    if (part < 0 && errno == EINTR) {
+      continue;
+    } else if (part <= 0) {
+      if (part < 0 && total == 0) {
+        return -1;
+      }
+      break;
+    }
+    total += part;
+  }
+  return total;
+}
+
 ssize_t PlatformFile::write(const void* buf, size_t nbyte) {
   if (!isValid()) {
     return -1;
@@ -220,6 +247,54 @@ ssize_t PlatformFile::write(const void* buf, size_t nbyte) {
   return ret;
 }
 
+ssize_t PlatformFile::write(const std::vector<std::string>& buffers) {
+  if (!isValid()) {
+    return -1;
+  }
+
+  has_pending_io_ = false;
+
+  // The next buffer to write and the bytes of it already written.
+  size_t index = 0;
+  size_t offset = 0;
+  ssize_t total = 0;
+  std::vector<struct iovec> iov;
+  while (index < buffers.size()) {
+    iov.clear();
+    for (auto i = index; i < buffers.size() && iov.size() < IOV_MAX; i++) {
+      auto skip = (i == index) ? offset : 0;
+      if (buffers[i].size() > skip) {
+        iov.push_back({const_cast<char*>(buffers[i].data()) + skip,
+                       buffers[i].size() - skip});
+      }
+    }
+    if (iov.empty()) {
+      break;
+    }
+
+    auto ret = ::writev(handle_, iov.data(), static_cast<int>(iov.size()));
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      has_pending_io_ = (errno == EAGAIN);
+      return -1;
+    }
+
+    // Advance past the completely written buffers.
+    total += ret;
+    auto written = static_cast<size_t>(ret);
+    while (index < buffers.size() &&
+           written >= buffers[index].size() - offset) {
+      written -= buffers[index].size() - offset;
+      offset = 0;
+      index++;
+    }
+    offset += written;
+  }
+  return total;
+}
+
 off_t PlatformFile::seek(off_t offset, SeekMode mode) {
   if (!isValid()) {
     return -1;
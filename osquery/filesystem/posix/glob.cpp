@@ -0,0 +1,472 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <pwd.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#include <osquery/flags.h>
+
+#include "osquery/filesystem/fileops.h"
+#include "osquery/filesystem/glob.h"
+
+namespace osquery {
+
+FLAG(uint64,
+     glob_threads,
+     4,
+     "Number of threads walking recursive file patterns, 1 to disable");
+
+/// Subtrees to collect before the remaining directories are shared.
+const size_t kGlobParallelTasks = 16;
+
+/// A pattern component, simple wildcards are matched without fnmatch.
+struct GlobComponent {
+  enum Kind { LITERAL, ANY, PREFIX, SUFFIX, PATTERN };
+
+  Kind kind{ANY};
+
+  /// The literal name, the prefix or suffix, or the fnmatch pattern.
+  std::string text;
+
+  /// Match a directory entry name, hidden entries must be matched by a '.'.
+  bool matches(const char* name, size_t length) const {
+    switch (kind) {
+    case LITERAL:
+      return text == name;
+    case ANY:
+      return name[0] != '.';
+    case PREFIX:
+      return length >= text.size() &&
+             memcmp(name, text.data(), text.size()) == 0;
+    case SUFFIX:
+      return name[0] != '.' && length >= text.size() &&
+             memcmp(name + length - text.size(), text.data(), text.size()) ==
+                 0;
+    case PATTERN:
+      return ::fnmatch(text.c_str(), name, FNM_PERIOD) == 0;
+    }
+    return false;
+  }
+};
+
+/// Matches every entry below a recursive wildcard.
+static const GlobComponent kGlobDescendants;
+
+struct GlobPattern {
+  /// "/" for an absolute pattern, otherwise empty.
+  std::string root;
+
+  std::vector<GlobComponent> components;
+
+  /// The last component ends in "**" and matches descendants.
+  bool recursive{false};
+
+  /// The pattern ends in '/' and the last component matches directories.
+  bool directories{false};
+
+  GlobLimits limits{GLOB_ALL};
+};
+
+/// A directory to walk, the path is empty or ends in '/'.
+struct GlobTask {
+  std::string path;
+
+  /// The component matched within the directory.
+  size_t index;
+
+  /// The levels descended below a recursive component.
+  size_t depth;
+};
+
+/// A matched path and the recursive level it was found at.
+struct GlobMatch {
+  size_t depth;
+  std::string path;
+};
+
+static GlobComponent compileComponent(const std::string& text) {
+  GlobComponent component;
+  component.text = text;
+  if (text.find_first_of("?[\\") != std::string::npos) {
+    component.kind = GlobComponent::PATTERN;
+    return component;
+  }
+
+  auto first = text.find('*');
+  if (first == std::string::npos) {
+    component.kind = GlobComponent::LITERAL;
+    return component;
+  }
+
+  // Only a single run of stars at either end avoids fnmatch.
+  auto last = text.find_last_of('*');
+  if (text.find_first_not_of('*', first) < last) {
+    component.kind = GlobComponent::PATTERN;
+  } else if (first == 0 && last == text.size() - 1) {
+    component.kind = GlobComponent::ANY;
+  } else if (first == 0) {
+    component.kind = GlobComponent::SUFFIX;
+    component.text = text.substr(last + 1);
+  } else if (last == text.size() - 1) {
+    component.kind = GlobComponent::PREFIX;
+    component.text = text.substr(0, first);
+  } else {
+    component.kind = GlobComponent::PATTERN;
+  }
+  return component;
+}
+
+/// Replace a leading "~" or "~user" with the home directory.
+static void expandTilde(std::string& pattern) {
+  if (pattern.empty() || pattern[0] != '~') {
+    return;
+  }
+
+  auto end = pattern.find('/');
+  auto user = pattern.substr(1, (end == std::string::npos) ? end : end - 1);
+  std::string home;
+  if (user.empty()) {
+    auto directory = getHomeDirectory();
+    if (directory.is_initialized()) {
+      home = *directory;
+    }
+  } else {
+    auto entry = ::getpwnam(user.c_str());
+    if (entry != nullptr && entry->pw_dir != nullptr) {
+      home = entry->pw_dir;
+    }
+  }
+
+  if (!home.empty()) {
+    pattern = home + ((end == std::string::npos) ? "" : pattern.substr(end));
+  }
+}
+
+static void compilePattern(std::string text,
+                           GlobLimits limits,
+                           GlobPattern& pattern) {
+  expandTilde(text);
+  pattern.limits = limits;
+  if (text.empty()) {
+    return;
+  }
+
+  pattern.root = (text[0] == '/') ? "/" : "";
+  pattern.directories = (text.back() == '/');
+  std::string last;
+  size_t start = 0;
+  while (start < text.size()) {
+    auto end = text.find('/', start);
+    if (end == std::string::npos) {
+      end = text.size();
+    }
+    if (end > start) {
+      last = text.substr(start, end - start);
+      pattern.components.push_back(compileComponent(last));
+    }
+    start = end + 1;
+  }
+
+  pattern.recursive =
+      (last.size() >= 2 && last.compare(last.size() - 2, 2, "**") == 0);
+}
+
+/// True if an entry is a directory, links are followed.
+static bool isEntryDirectory(int dir_fd, const struct dirent* entry) {
+  if (entry->d_type == DT_DIR) {
+    return true;
+  } else if (entry->d_type != DT_LNK && entry->d_type != DT_UNKNOWN) {
+    return false;
+  }
+
+  struct stat entry_stat;
+  return ::fstatat(dir_fd, entry->d_name, &entry_stat, 0) == 0 &&
+         S_ISDIR(entry_stat.st_mode);
+}
+
+static void addMatch(const GlobPattern& pattern,
+                     std::string path,
+                     bool directory,
+                     size_t depth,
+                     std::vector<GlobMatch>& matches) {
+  if (directory) {
+    if ((pattern.limits & GLOB_FOLDERS) == 0) {
+      return;
+    }
+    path += '/';
+  } else if ((pattern.limits & GLOB_FILES) == 0) {
+    return;
+  }
+  matches.push_back({depth, std::move(path)});
+}
+
+static void walkGlob(const GlobPattern& pattern,
+                     int dir_fd,
+                     const GlobTask& task,
+                     std::vector<GlobMatch>& matches,
+                     std::vector<GlobTask>* tasks);
+
+/// Walk a matched directory now, or leave it for the thread pool.
+static void descend(const GlobPattern& pattern,
+                    int dir_fd,
+                    const char* name,
+                    GlobTask child,
+                    std::vector<GlobMatch>& matches,
+                    std::vector<GlobTask>* tasks) {
+  if (tasks != nullptr) {
+    tasks->push_back(std::move(child));
+    return;
+  }
+
+  auto child_fd = ::openat(dir_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (child_fd >= 0) {
+    walkGlob(pattern, child_fd, child, matches, nullptr);
+  }
+}
+
+/**
+ * @brief Match a task's component within its directory.
+ *
+ * Matching subdirectories are walked depth-first, or appended to tasks when
+ * the caller is collecting subtrees for the thread pool.
+ */
+static void walkGlob(const GlobPattern& pattern,
+                     int dir_fd,
+                     const GlobTask& task,
+                     std::vector<GlobMatch>& matches,
+                     std::vector<GlobTask>* tasks) {
+  auto last = pattern.components.size() - 1;
+  const auto& component = (task.index <= last)
+                              ? pattern.components[task.index]
+                              : kGlobDescendants;
+  bool final = (task.index >= last);
+  bool descendants = pattern.recursive && task.depth + 1 < kMaxRecursiveGlobs;
+
+  if (component.kind == GlobComponent::LITERAL) {
+    // A literal component is opened without reading the directory.
+    const auto& name = component.text;
+    if (!final) {
+      descend(pattern,
+              dir_fd,
+              name.c_str(),
+              {task.path + name + '/', task.index + 1, task.depth},
+              matches,
+              tasks);
+    } else {
+      struct stat entry_stat;
+      if (::fstatat(dir_fd, name.c_str(), &entry_stat, 0) == 0) {
+        if (S_ISDIR(entry_stat.st_mode) || !pattern.directories) {
+          addMatch(pattern,
+                   task.path + name,
+                   S_ISDIR(entry_stat.st_mode),
+                   task.depth,
+                   matches);
+        }
+      } else if (!pattern.directories &&
+                 ::fstatat(dir_fd,
+                           name.c_str(),
+                           &entry_stat,
+                           AT_SYMLINK_NOFOLLOW) == 0) {
+        // A dangling link still matches.
+        addMatch(pattern, task.path + name, false, task.depth, matches);
+      }
+    }
+    ::close(dir_fd);
+    return;
+  }
+
+  auto dir = ::fdopendir(dir_fd);
+  if (dir == nullptr) {
+    ::close(dir_fd);
+    return;
+  }
+
+  struct dirent* entry = nullptr;
+  while ((entry = ::readdir(dir)) != nullptr) {
+    const char* name = entry->d_name;
+    if (name[0] == '.' &&
+        (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+      continue;
+    }
+
+    if (!component.matches(name, strlen(name))) {
+      continue;
+    }
+
+    if (!final) {
+      if (isEntryDirectory(dir_fd, entry)) {
+        descend(pattern,
+                dir_fd,
+                name,
+                {task.path + name + '/', task.index + 1, task.depth},
+                matches,
+                tasks);
+      }
+      continue;
+    }
+
+    auto directory = isEntryDirectory(dir_fd, entry);
+    if (task.index == last && pattern.directories && !directory) {
+      continue;
+    }
+
+    addMatch(pattern, task.path + name, directory, task.depth, matches);
+    if (directory && descendants) {
+      descend(pattern,
+              dir_fd,
+              name,
+              {task.path + name + '/', last + 1, task.depth + 1},
+              matches,
+              tasks);
+    }
+  }
+  ::closedir(dir);
+}
+
+static int openTask(const GlobTask& task) {
+  auto path = (task.path.empty()) ? "." : task.path.c_str();
+  return ::open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+static void resolvePattern(const GlobPattern& pattern,
+                           std::vector<GlobMatch>& matches) {
+  auto threads = std::max<size_t>(FLAGS_glob_threads, 1);
+  std::vector<GlobTask> tasks = {{pattern.root, 0, 0}};
+
+  // Walk levels serially until there are enough subtrees to share.
+  while (threads > 1 && !tasks.empty() && tasks.size() < kGlobParallelTasks) {
+    std::vector<GlobTask> next;
+    for (const auto& task : tasks) {
+      auto dir_fd = openTask(task);
+      if (dir_fd >= 0) {
+        walkGlob(pattern, dir_fd, task, matches, &next);
+      }
+    }
+    tasks.swap(next);
+  }
+
+  std::vector<std::vector<GlobMatch>> task_matches(tasks.size());
+  std::atomic<size_t> cursor(0);
+  auto walker = [&]() {
+    while (true) {
+      auto index = cursor.fetch_add(1);
+      if (index >= tasks.size()) {
+        break;
+      }
+      auto dir_fd = openTask(tasks[index]);
+      if (dir_fd >= 0) {
+        walkGlob(pattern, dir_fd, tasks[index], task_matches[index], nullptr);
+      }
+    }
+  };
+
+  threads = std::min(threads, tasks.size());
+  std::vector<std::thread> walkers;
+  for (size_t i = 1; i < threads; i++) {
+    walkers.emplace_back(walker);
+  }
+  walker();
+  for (auto& thread : walkers) {
+    thread.join();
+  }
+
+  for (auto& subtree : task_matches) {
+    std::move(subtree.begin(), subtree.end(), std::back_inserter(matches));
+  }
+}
+
+std::vector<std::string> expandGlobBraces(const std::string& pattern) {
+  for (auto open = pattern.find('{'); open != std::string::npos;
+       open = pattern.find('{', open + 1)) {
+    if (open > 0 && pattern[open - 1] == '\\') {
+      continue;
+    }
+
+    // Find the matching close and the top-level separators.
+    size_t depth = 0;
+    size_t close = std::string::npos;
+    std::vector<size_t> separators;
+    for (auto i = open + 1; i < pattern.size(); i++) {
+      if (pattern[i] == '\\') {
+        i++;
+      } else if (pattern[i] == '{') {
+        depth++;
+      } else if (pattern[i] == '}') {
+        if (depth == 0) {
+          close = i;
+          break;
+        }
+        depth--;
+      } else if (pattern[i] == ',' && depth == 0) {
+        separators.push_back(i);
+      }
+    }
+
+    if (close == std::string::npos || close == open + 1) {
+      continue;
+    }
+
+    std::vector<std::string> expanded;
+    auto prefix = pattern.substr(0, open);
+    auto suffix = pattern.substr(close + 1);
+    separators.push_back(close);
+    auto start = open + 1;
+    for (const auto& end : separators) {
+      auto alternative = prefix + pattern.substr(start, end - start) + suffix;
+      for (auto& result : expandGlobBraces(alternative)) {
+        expanded.push_back(std::move(result));
+      }
+      start = end + 1;
+    }
+    return expanded;
+  }
+  return {pattern};
+}
+
+void resolveGlob(const std::string& pattern,
+                 GlobLimits limits,
+                 std::vector<std::string>& results) {
+  for (const auto& alternative : expandGlobBraces(pattern)) {
+    GlobPattern compiled;
+    compilePattern(alternative, limits, compiled);
+
+    std::vector<GlobMatch> matches;
+    if (compiled.components.empty()) {
+      // Only the root directory remains.
+      if (!compiled.root.empty() && (limits & GLOB_FOLDERS)) {
+        results.push_back(compiled.root);
+      }
+      continue;
+    }
+    resolvePattern(compiled, matches);
+
+    // Each recursive level is sorted, as if globbed level by level.
+    std::sort(matches.begin(),
+              matches.end(),
+              [](const GlobMatch& left, const GlobMatch& right) {
+                return (left.depth != right.depth) ? left.depth < right.depth
+                                                   : left.path < right.path;
+              });
+    for (auto& match : matches) {
+      results.push_back(std::move(match.path));
+    }
+  }
+}
+}
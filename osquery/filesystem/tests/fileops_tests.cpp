@@ -129,6 +129,59 @@ TEST_F(FileOpsTests, test_fileIo) {
   }
 }
 
+TEST_F(FileOpsTests, test_readBlocks) {
+  TempFile tmp_file;
+  std::string path = tmp_file.path();
+
+  // More blocks than are read at once, and a partial last block.
+  std::string expected;
+  for (size_t i = 0; expected.size() < 10 * 4096 + 100; i++) {
+    expected += std::to_string(i) + "\n";
+  }
+
+  {
+    PlatformFile fd(path, PF_CREATE_NEW | PF_WRITE);
+    EXPECT_TRUE(fd.isValid());
+    EXPECT_EQ(static_cast<ssize_t>(expected.size()),
+              fd.write(expected.data(), expected.size()));
+  }
+
+  for (auto mode : {PF_READ, PF_READ | PF_NONBLOCK | PF_SEQUENTIAL}) {
+    // The buffer is larger than the file, the read stops at its end.
+    std::string buffer(expected.size() + 4096, '\0');
+    PlatformFile fd(path, PF_OPEN_EXISTING | mode);
+    EXPECT_TRUE(fd.isValid());
+    EXPECT_EQ(static_cast<ssize_t>(expected.size()),
+              fd.readBlocks(&buffer[0], buffer.size(), 4096));
+    EXPECT_EQ(expected, buffer.substr(0, expected.size()));
+    EXPECT_EQ(0, fd.readBlocks(&buffer[0], buffer.size(), 4096));
+  }
+}
+
+TEST_F(FileOpsTests, test_gatherWrite) {
+  TempFile tmp_file;
+  std::string path = tmp_file.path();
+
+  // More buffers than a single gathering write accepts, some empty.
+  std::vector<std::string> buffers;
+  std::string expected;
+  for (size_t i = 0; i < 2048; i++) {
+    buffers.push_back((i % 3 == 0) ? "" : std::to_string(i) + "\n");
+    expected += buffers.back();
+  }
+
+  {
+    PlatformFile fd(path, PF_CREATE_NEW | PF_WRITE | PF_APPEND);
+    EXPECT_TRUE(fd.isValid());
+    EXPECT_EQ(static_cast<ssize_t>(expected.size()), fd.write(buffers));
+    EXPECT_EQ(0, fd.write(std::vector<std::string>()));
+  }
+
+  std::string content;
+  EXPECT_TRUE(readFile(path, content));
+  EXPECT_EQ(expected, content);
+}
+
 TEST_F(FileOpsTests, test_asyncIo) {
   TempFile tmp_file;
   std::string path = tmp_file.path();
@@ -23,6 +23,18 @@
 
 #include "osquery/tests/test_util.h"
 
+#ifndef WIN32
+#include "osquery/filesystem/glob.h"
+#endif
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "osquery/filesystem/linux/proc.h"
+#endif
+
 namespace fs = boost::filesystem;
 namespace pt = boost::property_tree;
 
@@ -30,6 +42,13 @@ namespace osquery {
 
 DECLARE_uint64(read_max);
 DECLARE_uint64(read_user_max);
+DECLARE_bool(disable_read_mmap);
+#ifndef WIN32
+DECLARE_uint64(glob_threads);
+#endif
+#ifdef __linux__
+DECLARE_uint64(proc_snapshot_ttl);
+#endif
 
 #ifdef WIN32
 auto raw_drive = getEnvVar("SystemDrive");
@@ -88,6 +107,45 @@ TEST_F(FilesystemTests, test_read_file) {
   remove(kTestWorkingDirectory + "fstests-file");
 }
 
+TEST_F(FilesystemTests, test_read_file_view) {
+  // Large enough to be mapped.
+  auto path = kTestWorkingDirectory + "fstests-view";
+  std::string expected;
+  for (size_t i = 0; i < 512 * 1024; i++) {
+    expected += static_cast<char>('a' + i % 26);
+  }
+  writeTextFile(path, expected);
+
+  for (const auto& disable : {false, true}) {
+    FLAGS_disable_read_mmap = disable;
+    std::string content;
+    size_t parts = 0;
+    auto status = readFileView(path, 4096, false, [&](boost::string_ref part) {
+      content.append(part.data(), part.size());
+      parts++;
+    });
+    EXPECT_TRUE(status.ok());
+    EXPECT_EQ(content, expected);
+    EXPECT_EQ(parts, 1U);
+  }
+  FLAGS_disable_read_mmap = false;
+
+#ifndef WIN32
+  // A file truncated while mapped reads zeros and fails, without a SIGBUS.
+  size_t zeros = 0;
+  auto status = readFileView(path, 4096, false, [&](boost::string_ref part) {
+    ::truncate(path.c_str(), 0);
+    for (const auto& c : part) {
+      zeros += (c == '\0') ? 1 : 0;
+    }
+  });
+  EXPECT_FALSE(status.ok());
+  EXPECT_EQ(zeros, expected.size());
+#endif
+
+  remove(path);
+}
+
 TEST_F(FilesystemTests, test_read_limit) {
   auto max = FLAGS_read_max;
   auto user_max = FLAGS_read_user_max;
@@ -301,6 +359,47 @@ TEST_F(FilesystemTests, test_wildcard_invalid_path) {
   EXPECT_EQ(results.size(), 0U);
 }
 
+#ifndef WIN32
+TEST_F(FilesystemTests, test_glob_braces) {
+  std::vector<std::string> expected = {"ab", "acd", "ac"};
+  EXPECT_EQ(expandGlobBraces("a{b,c{d,}}"), expected);
+
+  // Escaped, empty, and unmatched braces are literals.
+  expected = {"\\{a,b}"};
+  EXPECT_EQ(expandGlobBraces("\\{a,b}"), expected);
+  expected = {"a{}"};
+  EXPECT_EQ(expandGlobBraces("a{}"), expected);
+  expected = {"{ab", "{ac"};
+  EXPECT_EQ(expandGlobBraces("{a{b,c}"), expected);
+}
+
+TEST_F(FilesystemTests, test_wildcard_trailing_slash) {
+  // A trailing slash only matches directories.
+  std::vector<std::string> results;
+  resolveFilePattern(kFakeDirectory + "/%/", results);
+  EXPECT_EQ(results.size(), 2U);
+  EXPECT_TRUE(contains(results, kFakeDirectory + "/deep1/"));
+}
+
+TEST_F(FilesystemTests, test_wildcard_double_order) {
+  // Each level of a recursive pattern is returned before the next.
+  std::vector<std::string> results;
+  resolveFilePattern(kFakeDirectory + "/deep1%%", results);
+  ASSERT_EQ(results.size(), 11U);
+  EXPECT_EQ(results[0], kFakeDirectory + "/deep1/");
+  EXPECT_EQ(results[1], kFakeDirectory + "/deep11/");
+  EXPECT_EQ(results.back(), kFakeDirectory + "/deep11/deep2/deep3/level3.txt");
+
+  // Subtrees walked by a single thread produce the same matches.
+  auto threads = FLAGS_glob_threads;
+  FLAGS_glob_threads = 1;
+  std::vector<std::string> serial;
+  resolveFilePattern(kFakeDirectory + "/deep1%%", serial);
+  FLAGS_glob_threads = threads;
+  EXPECT_EQ(results, serial);
+}
+#endif
+
 TEST_F(FilesystemTests, test_wildcard_dotdot_files) {
   std::vector<std::string> results;
   auto status = resolveFilePattern(
@@ -365,6 +464,86 @@ TEST_F(FilesystemTests, test_read_proc) {
   EXPECT_TRUE(readFile("/proc/" + std::to_string(getpid()) + "/stat", content));
   EXPECT_GT(content.size(), 0U);
 }
+
+TEST_F(FilesystemTests, test_proc_scan) {
+  std::set<std::string> processes;
+  EXPECT_TRUE(procProcesses(processes).ok());
+  auto self = std::to_string(getpid());
+  ASSERT_EQ(processes.count(self), 1U);
+
+  // Processes are scanned concurrently and the rows are in process order.
+  processes.insert("0");
+  processes.insert("../self");
+  QueryData results;
+  procScan(processes,
+           [](const ProcessDirectory& process, QueryData& rows) {
+             std::string stat;
+             std::string exe;
+             if (process.read("stat", stat).ok() &&
+                 process.readLink("exe", exe).ok()) {
+               rows.push_back({{"pid", process.pid()}, {"stat", stat}});
+             }
+           },
+           results);
+  ASSERT_FALSE(results.empty());
+  EXPECT_TRUE(std::is_sorted(
+      results.begin(), results.end(), [](const Row& a, const Row& b) {
+        return a.at("pid") < b.at("pid");
+      }));
+
+  // Invalid pids, and pids without a process, are skipped.
+  auto self_row = std::find_if(
+      results.begin(), results.end(), [&self](const Row& r) {
+        return r.at("pid") == self;
+      });
+  ASSERT_NE(self_row, results.end());
+  EXPECT_EQ(self_row->at("stat").find(self + " "), 0U);
+  for (const auto& r : results) {
+    EXPECT_NE(r.at("pid"), "0");
+    EXPECT_NE(r.at("pid"), "../self");
+  }
+
+  // The descriptors of this process include the standard streams.
+  std::string buffer;
+  auto proc_fd = ::open("/proc", O_RDONLY | O_DIRECTORY);
+  ASSERT_GE(proc_fd, 0);
+  {
+    ProcessDirectory process(proc_fd, self, buffer);
+    std::map<std::string, std::string> descriptors;
+    EXPECT_TRUE(process.descriptors(descriptors).ok());
+    EXPECT_EQ(descriptors.count("0"), 1U);
+  }
+  ::close(proc_fd);
+}
+
+TEST_F(FilesystemTests, test_proc_snapshot) {
+  auto ttl = FLAGS_proc_snapshot_ttl;
+  FLAGS_proc_snapshot_ttl = 60 * 1000;
+  std::set<std::string> before;
+  EXPECT_TRUE(procProcesses(before).ok());
+
+  auto child = ::fork();
+  if (child == 0) {
+    ::pause();
+    ::_exit(0);
+  }
+  ASSERT_GT(child, 0);
+
+  // A process started within the snapshot's lifetime is not listed.
+  std::set<std::string> cached;
+  EXPECT_TRUE(procProcesses(cached).ok());
+  EXPECT_EQ(cached, before);
+  EXPECT_EQ(cached.count(std::to_string(child)), 0U);
+
+  FLAGS_proc_snapshot_ttl = 0;
+  std::set<std::string> current;
+  EXPECT_TRUE(procProcesses(current).ok());
+  EXPECT_EQ(current.count(std::to_string(child)), 1U);
+
+  ::kill(child, SIGKILL);
+  ::waitpid(child, nullptr, 0);
+  FLAGS_proc_snapshot_ttl = ttl;
+}
 #endif
 
 #ifndef WIN32
@@ -409,6 +409,10 @@ PlatformFile::PlatformFile(const std::string &path, int mode, int perms) {
     is_nonblock_ = true;
   }
 
+  if ((mode & PF_SEQUENTIAL) == PF_SEQUENTIAL) {
+    flags_and_attrs |= FILE_FLAG_SEQUENTIAL_SCAN;
+  }
+
   if (perms != -1) {
     // TODO(#2001): set up a security descriptor based off the perms
   }
@@ -823,6 +827,123 @@ ssize_t PlatformFile::read(void *buf, size_t nbyte) {
   return nret;
 }
 
+/// Overlapped block reads kept outstanding by readBlocks.
+const size_t kOverlappedReads = 4;
+
+/// An overlapped read of one block by readBlocks.
+struct BlockRead {
+  OVERLAPPED overlapped;
+  DWORD size{0};
+  bool active{false};
+};
+
+ssize_t PlatformFile::readBlocks(void *buf, size_t nbyte, size_t block_size) {
+  if (!isValid()) {
+    return -1;
+  }
+
+  size_t total = 0;
+  if (!is_nonblock_ || last_read_.is_active_) {
+    // Without overlapped reads, or while a read is pending, read in order.
+    while (total < nbyte) {
+      auto part = read(static_cast<char *>(buf) + total,
+                       min(block_size, nbyte - total));
+      if (part <= 0) {
+        if (part < 0 && total == 0) {
+          return -1;
+        }
+        break;
+      }
+      total += part;
+    }
+    return total;
+  }
+
+  has_pending_io_ = false;
+  ULONGLONG start = static_cast<ULONGLONG>(cursor_);
+  size_t issued = 0;
+  bool done = false;
+  bool failed = false;
+
+  // Start the read of the block following the blocks already requested.
+  auto issue = [&](BlockRead &block) {
+    if (done || issued >= nbyte) {
+      return false;
+    }
+
+    ULARGE_INTEGER position;
+    position.QuadPart = start + issued;
+    block.overlapped.Offset = position.LowPart;
+    block.overlapped.OffsetHigh = position.HighPart;
+    block.size = static_cast<DWORD>(min(block_size, nbyte - issued));
+    ::ResetEvent(block.overlapped.hEvent);
+    if (!::ReadFile(handle_,
+                    static_cast<char *>(buf) + issued,
+                    block.size,
+                    nullptr,
+                    &block.overlapped)) {
+      auto error = ::GetLastError();
+      if (error != ERROR_IO_PENDING) {
+        failed = (error != ERROR_HANDLE_EOF);
+        done = true;
+        return false;
+      }
+    }
+    block.active = true;
+    issued += block.size;
+    return true;
+  };
+
+  std::vector<BlockRead> blocks(kOverlappedReads);
+  for (auto &block : blocks) {
+    ::memset(&block.overlapped, 0, sizeof(block.overlapped));
+    block.overlapped.hEvent = ::CreateEventA(nullptr, TRUE, FALSE, nullptr);
+  }
+  for (auto &block : blocks) {
+    if (block.overlapped.hEvent == nullptr || !issue(block)) {
+      break;
+    }
+  }
+
+  // Blocks are requested and completed in file order around the ring.
+  size_t next = 0;
+  while (blocks[next].active) {
+    auto &block = blocks[next];
+    DWORD bytes = 0;
+    if (!::GetOverlappedResult(handle_, &block.overlapped, &bytes, TRUE)) {
+      failed = (::GetLastError() != ERROR_HANDLE_EOF);
+      bytes = 0;
+    }
+    block.active = false;
+    total += bytes;
+    if (failed || bytes < block.size) {
+      // A short read is the end of the file.
+      done = true;
+      break;
+    }
+    issue(block);
+    next = (next + 1) % blocks.size();
+  }
+
+  // Reads past the end are cancelled, buf is in use until they complete.
+  for (auto &block : blocks) {
+    if (block.active) {
+      DWORD bytes = 0;
+      ::CancelIoEx(handle_, &block.overlapped);
+      ::GetOverlappedResult(handle_, &block.overlapped, &bytes, TRUE);
+    }
+    if (block.overlapped.hEvent != nullptr) {
+      ::CloseHandle(block.overlapped.hEvent);
+    }
+  }
+
+  cursor_ += static_cast<int>(total);
+  if (failed && total == 0) {
+    return -1;
+  }
+  return total;
+}
+
 ssize_t PlatformFile::write(const void *buf, size_t nbyte) {
   if (!isValid()) {
     return -1;
@@ -874,6 +995,23 @@ ssize_t PlatformFile::write(const void *buf, size_t nbyte) {
   return nret;
 }
 
+ssize_t PlatformFile::write(const std::vector<std::string>& buffers) {
+  // There is no gathering write for buffered files, write each in turn.
+  ssize_t total = 0;
+  for (const auto& buffer : buffers) {
+    size_t offset = 0;
+    while (offset < buffer.size()) {
+      auto ret = write(buffer.data() + offset, buffer.size() - offset);
+      if (ret <= 0) {
+        return -1;
+      }
+      offset += ret;
+    }
+    total += offset;
+  }
+  return total;
+}
+
 off_t PlatformFile::seek(off_t offset, SeekMode mode) {
   if (!isValid()) {
     return -1;
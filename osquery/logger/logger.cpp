@@ -13,11 +13,15 @@
 #endif
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <set>
 #include <thread>
 
 #include <boost/noncopyable.hpp>
 #include <boost/property_tree/json_parser.hpp>
 
+#include <osquery/dispatcher.h>
 #include <osquery/events.h>
 #include <osquery/extensions.h>
 #include <osquery/filesystem.h>
@@ -41,6 +45,28 @@ FLAG(string, logger_plugin, "filesystem", "Logger plugin name");
 
 FLAG(bool, log_result_events, true, "Log scheduled results as events");
 
+FLAG(uint64,
+     logger_status_relay_milli,
+     0,
+     "Milliseconds between batched status log relays, 0 to send each log");
+
+FLAG(uint64,
+     logger_status_max_rate,
+     0,
+     "Status logs relayed each second before dropping, 0 for no limit");
+
+/// Relayed status logs are dropped while this many are queued.
+const size_t kStatusLogsQueued = 10000;
+
+/// Set while the calling thread relays status logs.
+static thread_local bool kRelayingStatus{false};
+
+/// Loggers, including extension loggers, accepting batched strings.
+static std::set<std::string> kBatchLoggers;
+
+/// The active loggers, resolved once for every log line.
+static RegistryHandle kActiveLoggers("logger");
+
 class LoggerDisabler;
 
 /**
@@ -118,6 +144,18 @@ class BufferedLogSink : public google::LogSink, private boost::noncopyable {
     return instance().sinks_;
   }
 
+  /**
+   * @brief Send the queued status logs to the enabled loggers as one batch.
+   *
+   * With `--logger_status_relay_milli`, forwarded status logs are queued
+   * instead of serialized and sent by the logging thread. The relay sends the
+   * queue and a warning counting the logs dropped by the rate limit.
+   */
+  static void relay();
+
+  /// Start relaying queued status logs on a logger thread, once.
+  static void startRelay();
+
  public:
   BufferedLogSink(BufferedLogSink const&) = delete;
   void operator=(BufferedLogSink const&) = delete;
@@ -129,10 +167,19 @@ class BufferedLogSink : public google::LogSink, private boost::noncopyable {
   /// Remove the log sink.
   ~BufferedLogSink() { disable(); }
 
+  /// Queue a forwarded status log for the relay, or count it as dropped.
+  void queue(StatusLogLine&& line);
+
+  /// Send status logs to each enabled logger.
+  static void forwardLogs(const std::vector<StatusLogLine>& log);
+
  private:
   /// Intermediate log storage until an osquery logger is initialized.
   std::vector<StatusLogLine> logs_;
 
+  /// Protect the intermediate log storage.
+  Mutex mutex_;
+
   /// Should the sending act in a forwarding mode.
   bool forward_{false};
   bool enabled_{false};
@@ -140,10 +187,40 @@ class BufferedLogSink : public google::LogSink, private boost::noncopyable {
   /// Track multiple loggers that should receive sinks from the send forwarder.
   std::vector<std::string> sinks_;
 
+  /// Forwarded status logs queued for the relay.
+  std::vector<StatusLogLine> queued_;
+
+  /// Status logs dropped since the last relay.
+  size_t dropped_{0};
+
+  /// The start of the rate limit's second, and the logs queued within it.
+  std::chrono::steady_clock::time_point second_;
+  size_t second_logs_{0};
+
+  /// Protect the queue, any thread may log.
+  Mutex queue_mutex_;
+
+  /// Set once the relay service is started.
+  std::atomic<bool> relaying_{false};
+
  private:
   friend class LoggerDisabler;
 };
 
+/// Relay the queued status logs each interval, and once more when interrupted.
+class StatusLogRelay : public InternalRunnable {
+ public:
+  void start() override {
+    while (!interrupted()) {
+      pauseMilli(FLAGS_logger_status_relay_milli);
+      BufferedLogSink::relay();
+    }
+  }
+
+ protected:
+  ThreadClass threadClass() const override { return THREAD_CLASS_LOGGER; }
+};
+
 /// Scoped helper to perform logging actions without races.
 class LoggerDisabler {
  public:
@@ -288,6 +365,9 @@ void initLogger(const std::string& name, bool forward_all) {
       // To support multiple plugins we only add the names of plugins that
       // return a success status after initialization.
       BufferedLogSink::addPlugin(logger);
+      if (FLAGS_logger_status_relay_milli > 0) {
+        BufferedLogSink::startRelay();
+      }
     }
 
     request = {{"action", "features"}};
@@ -295,6 +375,9 @@ void initLogger(const std::string& name, bool forward_all) {
     if ((status.getCode() & LOGGER_FEATURE_LOGEVENT) > 0) {
       EventFactory::addForwarder(logger);
     }
+    if ((status.getCode() & LOGGER_FEATURE_LOGSTRINGS) > 0) {
+      kBatchLoggers.insert(logger);
+    }
   }
 }
 
@@ -306,35 +389,112 @@ void BufferedLogSink::send(google::LogSeverity severity,
                            const char* message,
                            size_t message_len) {
   // Either forward the log to an enabled logger or buffer until one exists.
-  if (forward_) {
-    const auto& logger_plugin = Registry::getActive("logger");
-    for (const auto& logger : osquery::split(logger_plugin, ",")) {
-      auto& enabled = BufferedLogSink::enabledPlugins();
-      if (std::find(enabled.begin(), enabled.end(), logger) != enabled.end()) {
-        // May use the logs_ storage to buffer/delay sending logs.
-        std::vector<StatusLogLine> log;
-        log.push_back({(StatusLogSeverity)severity, std::string(base_filename),
-                       line, std::string(message, message_len)});
-        PluginRequest request = {{"status", "true"}};
-        serializeIntermediateLog(log, request);
-        if (!request["log"].empty()) {
-          request["log"].pop_back();
-        }
-        Registry::call("logger", logger, request);
-      }
+  if (forward_ && FLAGS_logger_status_relay_milli > 0) {
+    // Logs written while relaying are not relayed again.
+    if (!kRelayingStatus) {
+      queue({(StatusLogSeverity)severity, std::string(base_filename), line,
+             std::string(message, message_len)});
     }
+  } else if (forward_) {
+    forwardLogs({{(StatusLogSeverity)severity, std::string(base_filename),
+                  line, std::string(message, message_len)}});
   } else {
+    // Startup phases may log concurrently before the logger is initialized.
+    WriteLock lock(mutex_);
     logs_.push_back({(StatusLogSeverity)severity, std::string(base_filename),
                      line, std::string(message, message_len)});
   }
 }
 
+void BufferedLogSink::forwardLogs(const std::vector<StatusLogLine>& log) {
+  PluginRequest request = {{"status", "true"}};
+  serializeIntermediateLog(log, request);
+  if (!request["log"].empty()) {
+    request["log"].pop_back();
+  }
+
+  const auto& logger_plugin = Registry::getActive("logger");
+  for (const auto& logger : osquery::split(logger_plugin, ",")) {
+    auto& enabled = BufferedLogSink::enabledPlugins();
+    if (std::find(enabled.begin(), enabled.end(), logger) != enabled.end()) {
+      Registry::call("logger", logger, request);
+    }
+  }
+}
+
+void BufferedLogSink::queue(StatusLogLine&& line) {
+  WriteLock lock(queue_mutex_);
+  if (FLAGS_logger_status_max_rate > 0) {
+    auto now = std::chrono::steady_clock::now();
+    if (now - second_ >= std::chrono::seconds(1)) {
+      second_ = now;
+      second_logs_ = 0;
+    }
+    if (second_logs_ >= FLAGS_logger_status_max_rate) {
+      dropped_++;
+      return;
+    }
+    second_logs_++;
+  }
+
+  if (queued_.size() >= kStatusLogsQueued) {
+    dropped_++;
+    return;
+  }
+  queued_.push_back(std::move(line));
+}
+
+void BufferedLogSink::relay() {
+  auto& self = instance();
+  std::vector<StatusLogLine> log;
+  size_t dropped = 0;
+  {
+    WriteLock lock(self.queue_mutex_);
+    std::swap(log, self.queued_);
+    std::swap(dropped, self.dropped_);
+  }
+
+  if (dropped > 0) {
+    log.push_back({O_WARNING,
+                   "logger.cpp",
+                   __LINE__,
+                   "Dropped " + std::to_string(dropped) + " status logs"});
+  }
+  if (log.empty()) {
+    return;
+  }
+
+  kRelayingStatus = true;
+  forwardLogs(log);
+  kRelayingStatus = false;
+}
+
+void BufferedLogSink::startRelay() {
+  if (!instance().relaying_.exchange(true)) {
+    Dispatcher::addService(std::make_shared<StatusLogRelay>());
+  }
+}
+
 Status LoggerPlugin::call(const PluginRequest& request,
                           PluginResponse& response) {
   QueryLogItem item;
   std::vector<StatusLogLine> intermediate_logs;
   if (request.count("string") > 0) {
     return this->logString(request.at("string"));
+  } else if (request.count("strings") > 0) {
+    // Batched lines are newline-separated, a JSON line has no raw newlines.
+    std::vector<std::string> strings;
+    const auto& batch = request.at("strings");
+    size_t start = 0;
+    while (start <= batch.size()) {
+      auto end = batch.find('\n', start);
+      if (end == std::string::npos) {
+        end = batch.size();
+      }
+      strings.push_back(batch.substr(start, end - start));
+      start = end + 1;
+    }
+    return this->logStrings(strings);
   } else if (request.count("snapshot") > 0) {
     return this->logSnapshot(request.at("snapshot"));
   } else if (request.count("init") > 0) {
@@ -350,6 +510,7 @@ Status LoggerPlugin::call(const PluginRequest& request,
     size_t features = 0;
     features |= (usesLogStatus()) ? LOGGER_FEATURE_LOGSTATUS : 0;
     features |= (usesLogEvent()) ? LOGGER_FEATURE_LOGEVENT : 0;
+    features |= LOGGER_FEATURE_LOGSTRINGS;
     return Status(features);
   } else {
     return Status(1, "Unsupported call to logger plugin");
@@ -357,7 +518,11 @@ Status LoggerPlugin::call(const PluginRequest& request,
 }
 
 Status logString(const std::string& message, const std::string& category) {
-  return logString(message, category, Registry::getActive("logger"));
+  if (FLAGS_disable_logging) {
+    return Status(0, "Logging disabled");
+  }
+
+  return kActiveLoggers.call({{"string", message}, {"category", category}});
 }
 
 Status logString(const std::string& message,
@@ -371,24 +536,53 @@ Status logString(const std::string& message,
       "logger", receiver, {{"string", message}, {"category", category}});
 }
 
-Status logQueryLogItem(const QueryLogItem& results) {
-  return logQueryLogItem(results, Registry::getActive("logger"));
-}
-
-Status logQueryLogItem(const QueryLogItem& results,
-                       const std::string& receiver) {
+static Status logStrings(const std::vector<std::string>& messages,
+                         const std::string& category,
+                         const RegistryHandle& loggers) {
   if (FLAGS_disable_logging) {
     return Status(0, "Logging disabled");
   }
 
-  std::vector<std::string> json_items;
+  // Batches are newline-separated, see LoggerPlugin::call.
+  std::string batch;
+  Status status;
+  for (const auto& logger : loggers.items()) {
+    PluginResponse response;
+    if (messages.size() > 1 &&
+        (logger.plugin != nullptr || kBatchLoggers.count(logger.name) > 0)) {
+      if (batch.empty()) {
+        batch = osquery::join(messages, "\n");
+      }
+      status = loggers.call(
+          logger, {{"strings", batch}, {"category", category}}, response);
+      continue;
+    }
+
+    // Loggers from older extensions do not understand batches.
+    for (const auto& message : messages) {
+      status = loggers.call(
+          logger, {{"string", message}, {"category", category}}, response);
+    }
+  }
+  return status;
+}
+
+Status logStrings(const std::vector<std::string>& messages,
+                  const std::string& category,
+                  const std::string& receiver) {
+  return logStrings(messages, category, RegistryHandle("logger", receiver));
+}
+
+/// Serialize a log item as the result lines sent to loggers.
+static Status serializeLogLines(const QueryLogItem& results,
+                                std::vector<std::string>& json_items) {
   Status status;
   if (FLAGS_log_result_events) {
     status = serializeQueryLogItemAsEventsJSON(results, json_items);
   } else {
     std::string json;
     status = serializeQueryLogItemJSON(results, json);
-    json_items.push_back(json);
+    json_items.push_back(std::move(json));
   }
   if (!status.ok()) {
     return status;
@@ -397,10 +591,59 @@ Status logQueryLogItem(const QueryLogItem& results,
   for (auto& json : json_items) {
     if (!json.empty() && json.back() == '\n') {
       json.pop_back();
-      status = logString(json, "event", receiver);
     }
   }
-  return status;
+  return Status(0, "OK");
+}
+
+static Status logQueryLogItem(const QueryLogItem& results,
+                              const RegistryHandle& loggers) {
+  if (FLAGS_disable_logging) {
+    return Status(0, "Logging disabled");
+  }
+
+  std::vector<std::string> json_items;
+  auto status = serializeLogLines(results, json_items);
+  if (!status.ok()) {
+    return status;
+  }
+  return logStrings(json_items, "event", loggers);
+}
+
+Status logQueryLogItem(const QueryLogItem& results) {
+  return logQueryLogItem(results, kActiveLoggers);
+}
+
+Status logQueryLogItem(QueryLogItem&& results) {
+  if (FLAGS_disable_logging) {
+    return Status(0, "Logging disabled");
+  }
+
+  std::vector<std::string> json_items;
+  {
+    // The rows are released before the loggers are called.
+    auto item = std::move(results);
+    auto status = serializeLogLines(item, json_items);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  return logStrings(json_items, "event", kActiveLoggers);
+}
+
+Status logQueryLogItem(const QueryLogItem& results,
+                       const std::string& receiver) {
+  return logQueryLogItem(results, RegistryHandle("logger", receiver));
+}
+
+/// Send a serialized snapshot line to the active loggers.
+static Status logSnapshotLine(std::string json) {
+  if (!json.empty() && json.back() == '\n') {
+    json.pop_back();
+  }
+  PluginRequest request;
+  request["snapshot"] = std::move(json);
+  return kActiveLoggers.call(request);
 }
 
 Status logSnapshotQuery(const QueryLogItem& item) {
@@ -412,10 +655,23 @@ Status logSnapshotQuery(const QueryLogItem& item) {
   if (!serializeQueryLogItemJSON(item, json)) {
     return Status(1, "Could not serialize snapshot");
   }
-  if (!json.empty() && json.back() == '\n') {
-    json.pop_back();
+  return logSnapshotLine(std::move(json));
+}
+
+Status logSnapshotQuery(QueryLogItem&& item) {
+  if (FLAGS_disable_logging) {
+    return Status(0, "Logging disabled");
+  }
+
+  std::string json;
+  {
+    // The rows are released before the loggers are called.
+    auto snapshot = std::move(item);
+    if (!serializeQueryLogItemJSON(snapshot, json)) {
+      return Status(1, "Could not serialize snapshot");
+    }
   }
-  return Registry::call("logger", {{"snapshot", json}});
+  return logSnapshotLine(std::move(json));
 }
 
 void relayStatusLogs() {
@@ -423,15 +679,18 @@ void relayStatusLogs() {
     return;
   }
 
+  // Forwarded logs queued for the relay are sent first.
+  BufferedLogSink::relay();
+  auto& status_logs = BufferedLogSink::dump();
+  if (status_logs.size() == 0) {
+    return;
+  }
+
   // Prevent our dumping and registry calling from producing additional logs.
   LoggerDisabler disabler;
 
   // Construct a status log plugin request.
   PluginRequest request = {{"status", "true"}};
-  auto& status_logs = BufferedLogSink::dump();
-  if (status_logs.size() == 0) {
-    return;
-  }
   serializeIntermediateLog(status_logs, request);
   if (!request["log"].empty()) {
     request["log"].pop_back();
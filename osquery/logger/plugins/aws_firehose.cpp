@@ -35,11 +35,23 @@ FLAG(uint64,
      10,
      "Seconds between flushing logs to Firehose (default 10)");
 FLAG(string, aws_firehose_stream, "", "Name of Firehose stream for logging")
+FLAG(uint64,
+     aws_firehose_in_flight,
+     1,
+     "Max concurrent Firehose requests (default 1)");
 
 // This is the max per AWS docs
 const size_t FirehoseLogForwarder::kFirehoseMaxRecords = 500;
 // Max size of log + partition key is 1MB. Max size of partition key is 256B.
 const size_t FirehoseLogForwarder::kFirehoseMaxLogBytes = 1000000 - 256;
+// Max size of all records in a request is 4MiB.
+const size_t FirehoseLogForwarder::kFirehoseMaxRequestBytes = 4 * 1024 * 1024;
+
+/// Attempts to put the records that failed in the previous response.
+const size_t kFirehoseMaxRetries = 3;
+
+/// Milliseconds before retrying the failed records, doubling each attempt.
+const size_t kFirehoseRetryMilli = 100;
 
 Status FirehoseLoggerPlugin::setUp() {
   initAwsSdk();
@@ -57,13 +69,40 @@ Status FirehoseLoggerPlugin::logString(const std::string& s) {
   return forwarder_->logString(s);
 }
 
+Status FirehoseLoggerPlugin::logStrings(
+    const std::vector<std::string>& strings) {
+  return forwarder_->logStrings(strings);
+}
+
+FirehoseLogForwarder::FirehoseLogForwarder()
+    : BufferedLogForwarder("firehose",
+                           std::chrono::seconds(FLAGS_aws_firehose_period),
+                           kFirehoseMaxRecords) {
+  // Concurrent sends leave room for the last record within a request.
+  max_log_bytes_ = kFirehoseMaxRequestBytes - kFirehoseMaxLogBytes;
+  max_in_flight_ = FLAGS_aws_firehose_in_flight;
+}
+
 Status FirehoseLogForwarder::send(std::vector<std::string>& log_data,
                                   const std::string& log_type) {
   std::vector<Aws::Firehose::Model::Record> records;
+  size_t request_bytes = 0;
   for (const std::string& log : log_data) {
     if (log.size() + 1 > kFirehoseMaxLogBytes) {
       LOG(ERROR) << "Firehose log too big, discarding!";
+      continue;
+    }
+
+    // Split the lines into requests within the record count and size limits.
+    if (records.size() == kFirehoseMaxRecords ||
+        request_bytes + log.size() + 1 > kFirehoseMaxRequestBytes) {
+      auto s = putRecordBatch(records);
+      if (!s.ok()) {
+        return s;
+      }
+      request_bytes = 0;
     }
+
     Aws::Firehose::Model::Record record;
     auto buffer =
         Aws::Utils::ByteBuffer((unsigned char*)log.c_str(), log.length() + 1);
@@ -73,28 +112,56 @@ Status FirehoseLogForwarder::send(std::vector<std::string>& log_data,
     buffer[log.length()] = '\n';
     record.SetData(buffer);
     records.push_back(std::move(record));
+    request_bytes += log.size() + 1;
+  }
+
+  if (records.empty()) {
+    return Status(0);
   }
+  return putRecordBatch(records);
+}
+
+Status FirehoseLogForwarder::putRecordBatch(
+    std::vector<Aws::Firehose::Model::Record>& records) {
+  size_t sent = records.size();
+  for (size_t attempt = 0;; attempt++) {
+    Aws::Firehose::Model::PutRecordBatchRequest request;
+    request.WithDeliveryStreamName(FLAGS_aws_firehose_stream)
+        .WithRecords(records);
+
+    auto outcome = client_->PutRecordBatch(request);
+    if (!outcome.IsSuccess()) {
+      records.clear();
+      return Status(1, outcome.GetError().GetMessage());
+    }
 
-  Aws::Firehose::Model::PutRecordBatchRequest request;
-  request.WithDeliveryStreamName(FLAGS_aws_firehose_stream)
-      .WithRecords(std::move(records));
-
-  Aws::Firehose::Model::PutRecordBatchOutcome outcome =
-      client_->PutRecordBatch(request);
-  Aws::Firehose::Model::PutRecordBatchResult result = outcome.GetResult();
-  if (result.GetFailedPutCount() != 0) {
-    for (const auto& record : result.GetRequestResponses()) {
-      if (!record.GetErrorMessage().empty()) {
-        VLOG(1) << "Firehose write for " << result.GetFailedPutCount() << " of "
-                << result.GetRequestResponses().size()
-                << " records failed with error " << record.GetErrorMessage();
-        return Status(1, record.GetErrorMessage());
+    // Only the records that failed, such as when throttled, are sent again.
+    const auto& result = outcome.GetResult();
+    std::vector<Aws::Firehose::Model::Record> failed;
+    std::string error;
+    const auto& responses = result.GetRequestResponses();
+    for (size_t i = 0; i < responses.size() && i < records.size(); i++) {
+      if (!responses[i].GetErrorCode().empty()) {
+        error = responses[i].GetErrorMessage();
+        failed.push_back(std::move(records[i]));
       }
     }
+
+    records = std::move(failed);
+    if (records.empty()) {
+      break;
+    }
+
+    if (attempt == kFirehoseMaxRetries || interrupted()) {
+      VLOG(1) << "Firehose write for " << records.size() << " of " << sent
+              << " records failed with error " << error;
+      records.clear();
+      return Status(1, error);
+    }
+    pauseMilli(kFirehoseRetryMilli << attempt);
   }
 
-  VLOG(1) << "Successfully sent " << result.GetRequestResponses().size()
-          << " logs to Firehose.";
+  VLOG(1) << "Successfully sent " << sent << " logs to Firehose.";
   return Status(0);
 }
 
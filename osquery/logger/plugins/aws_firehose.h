@@ -15,6 +15,7 @@
 #include <vector>
 
 #include <aws/firehose/FirehoseClient.h>
+#include <aws/firehose/model/Record.h>
 
 #include <osquery/core.h>
 #include <osquery/dispatcher.h>
@@ -30,22 +31,32 @@ class FirehoseLogForwarder : public BufferedLogForwarder {
  private:
   static const size_t kFirehoseMaxLogBytes;
   static const size_t kFirehoseMaxRecords;
+  static const size_t kFirehoseMaxRequestBytes;
 
  public:
-  FirehoseLogForwarder()
-      : BufferedLogForwarder("firehose",
-                             std::chrono::seconds(FLAGS_aws_firehose_period),
-                             kFirehoseMaxRecords) {}
+  FirehoseLogForwarder();
   Status setUp() override;
 
  protected:
+  /**
+   * @brief Send log lines using as many PutRecordBatch requests as needed.
+   *
+   * Lines are split into requests within the API's record count and size
+   * limits. Records that fail are retried alone rather than resending the
+   * request.
+   */
   Status send(std::vector<std::string>& log_data,
               const std::string& log_type) override;
 
+ private:
+  /// Put a batch of records, retrying failed records. Clears records.
+  Status putRecordBatch(std::vector<Aws::Firehose::Model::Record>& records);
+
  private:
   std::shared_ptr<Aws::Firehose::FirehoseClient> client_{nullptr};
 
   FRIEND_TEST(FirehoseTests, test_send);
+  FRIEND_TEST(FirehoseTests, test_send_retry);
 };
 
 class FirehoseLoggerPlugin : public LoggerPlugin {
@@ -60,6 +71,9 @@ class FirehoseLoggerPlugin : public LoggerPlugin {
 
   Status logString(const std::string& s) override;
 
+  /// Log several result strings with one buffered write.
+  Status logStrings(const std::vector<std::string>& strings) override;
+
  private:
   std::shared_ptr<FirehoseLogForwarder> forwarder_{nullptr};
 };
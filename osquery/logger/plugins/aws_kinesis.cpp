@@ -41,11 +41,27 @@ FLAG(bool,
      aws_kinesis_random_partition_key,
      false,
      "Enable random kinesis partition keys");
+FLAG(uint64,
+     aws_kinesis_partition_keys,
+     1,
+     "Partition keys per host, spreading records across shards (default 1)");
+FLAG(uint64,
+     aws_kinesis_in_flight,
+     1,
+     "Max concurrent Kinesis requests (default 1)");
 
 // This is the max per AWS docs
 const size_t KinesisLogForwarder::kKinesisMaxRecords = 500;
 // Max size of log + partition key is 1MB. Max size of partition key is 256B.
 const size_t KinesisLogForwarder::kKinesisMaxLogBytes = 1000000 - 256;
+// Max size of all records and partition keys in a request is 5MB.
+const size_t KinesisLogForwarder::kKinesisMaxRequestBytes = 5000000;
+
+/// Attempts to put the records that failed in the previous response.
+const size_t kKinesisMaxRetries = 3;
+
+/// Milliseconds before retrying the failed records, doubling each attempt.
+const size_t kKinesisRetryMilli = 100;
 
 Status KinesisLoggerPlugin::setUp() {
   initAwsSdk();
@@ -63,43 +79,108 @@ Status KinesisLoggerPlugin::logString(const std::string& s) {
   return forwarder_->logString(s);
 }
 
+Status KinesisLoggerPlugin::logStrings(
+    const std::vector<std::string>& strings) {
+  return forwarder_->logStrings(strings);
+}
+
+KinesisLogForwarder::KinesisLogForwarder()
+    : BufferedLogForwarder("kinesis",
+                           std::chrono::seconds(FLAGS_aws_kinesis_period),
+                           kKinesisMaxRecords) {
+  // Concurrent sends leave room for the last record within a request.
+  max_log_bytes_ = kKinesisMaxRequestBytes - kKinesisMaxLogBytes;
+  max_in_flight_ = FLAGS_aws_kinesis_in_flight;
+}
+
+std::string KinesisLogForwarder::getPartitionKey() {
+  if (FLAGS_aws_kinesis_random_partition_key) {
+    boost::uuids::uuid uuid = boost::uuids::random_generator()();
+    return boost::uuids::to_string(uuid);
+  }
+
+  if (FLAGS_aws_kinesis_partition_keys > 1) {
+    // Records of the host are spread across partition keys, thus shards.
+    auto key = partition_key_count_++ % FLAGS_aws_kinesis_partition_keys;
+    return partition_key_ + "-" + std::to_string(key);
+  }
+  return partition_key_;
+}
+
 Status KinesisLogForwarder::send(std::vector<std::string>& log_data,
                                  const std::string& log_type) {
   std::vector<Aws::Kinesis::Model::PutRecordsRequestEntry> entries;
+  size_t request_bytes = 0;
   for (const std::string& log : log_data) {
-    if (log.size() > kKinesisMaxLogBytes) {
+    auto key = getPartitionKey();
+    if (log.size() + key.size() > kKinesisMaxLogBytes) {
       LOG(ERROR) << "Kinesis log too big, discarding!";
+      continue;
     }
-    Aws::Kinesis::Model::PutRecordsRequestEntry entry;
-    if (FLAGS_aws_kinesis_random_partition_key) {
-      boost::uuids::uuid uuid = boost::uuids::random_generator()();
-      partition_key_ = boost::uuids::to_string(uuid);
+
+    // Split the lines into requests within the record count and size limits.
+    if (entries.size() == kKinesisMaxRecords ||
+        request_bytes + log.size() + key.size() > kKinesisMaxRequestBytes) {
+      auto s = putRecords(entries);
+      if (!s.ok()) {
+        return s;
+      }
+      request_bytes = 0;
     }
-    entry.WithPartitionKey(partition_key_)
-        .WithData(
-            Aws::Utils::ByteBuffer((unsigned char*)log.c_str(), log.length()));
+
+    Aws::Kinesis::Model::PutRecordsRequestEntry entry;
+    entry.WithPartitionKey(key).WithData(
+        Aws::Utils::ByteBuffer((unsigned char*)log.c_str(), log.length()));
     entries.push_back(std::move(entry));
+    request_bytes += log.size() + key.size();
   }
 
-  Aws::Kinesis::Model::PutRecordsRequest request;
-  request.WithStreamName(FLAGS_aws_kinesis_stream)
-      .WithRecords(std::move(entries));
-
-  Aws::Kinesis::Model::PutRecordsOutcome outcome = client_->PutRecords(request);
-  Aws::Kinesis::Model::PutRecordsResult result = outcome.GetResult();
-  if (result.GetFailedRecordCount() != 0) {
-    for (const auto& record : result.GetRecords()) {
-      if (!record.GetErrorMessage().empty()) {
-        LOG(ERROR) << "Kinesis write for " << result.GetFailedRecordCount()
-                   << " of " << result.GetRecords().size()
-                   << " records failed with error " << record.GetErrorMessage();
-        return Status(1, record.GetErrorMessage());
+  if (entries.empty()) {
+    return Status(0);
+  }
+  return putRecords(entries);
+}
+
+Status KinesisLogForwarder::putRecords(
+    std::vector<Aws::Kinesis::Model::PutRecordsRequestEntry>& entries) {
+  size_t sent = entries.size();
+  for (size_t attempt = 0;; attempt++) {
+    Aws::Kinesis::Model::PutRecordsRequest request;
+    request.WithStreamName(FLAGS_aws_kinesis_stream).WithRecords(entries);
+
+    auto outcome = client_->PutRecords(request);
+    if (!outcome.IsSuccess()) {
+      entries.clear();
+      return Status(1, outcome.GetError().GetMessage());
+    }
+
+    // Only the records that failed, such as when throttled, are sent again.
+    const auto& result = outcome.GetResult();
+    std::vector<Aws::Kinesis::Model::PutRecordsRequestEntry> failed;
+    std::string error;
+    const auto& records = result.GetRecords();
+    for (size_t i = 0; i < records.size() && i < entries.size(); i++) {
+      if (!records[i].GetErrorCode().empty()) {
+        error = records[i].GetErrorMessage();
+        failed.push_back(std::move(entries[i]));
       }
     }
+
+    entries = std::move(failed);
+    if (entries.empty()) {
+      break;
+    }
+
+    if (attempt == kKinesisMaxRetries || interrupted()) {
+      LOG(ERROR) << "Kinesis write for " << entries.size() << " of " << sent
+                 << " records failed with error " << error;
+      entries.clear();
+      return Status(1, error);
+    }
+    pauseMilli(kKinesisRetryMilli << attempt);
   }
 
-  VLOG(1) << "Successfully sent " << result.GetRecords().size()
-          << " logs to Kinesis.";
+  VLOG(1) << "Successfully sent " << sent << " logs to Kinesis.";
   return Status(0);
 }
 
@@ -10,11 +10,13 @@
 
 #pragma once
 
+#include <atomic>
 #include <chrono>
 #include <memory>
 #include <vector>
 
 #include <aws/kinesis/KinesisClient.h>
+#include <aws/kinesis/model/PutRecordsRequestEntry.h>
 
 #include <osquery/core.h>
 #include <osquery/dispatcher.h>
@@ -30,23 +32,40 @@ class KinesisLogForwarder : public BufferedLogForwarder {
  private:
   static const size_t kKinesisMaxLogBytes;
   static const size_t kKinesisMaxRecords;
+  static const size_t kKinesisMaxRequestBytes;
 
  public:
-  KinesisLogForwarder()
-      : BufferedLogForwarder("kinesis",
-                             std::chrono::seconds(FLAGS_aws_kinesis_period),
-                             kKinesisMaxRecords) {}
+  KinesisLogForwarder();
   Status setUp() override;
 
  protected:
+  /**
+   * @brief Send log lines using as many PutRecords requests as needed.
+   *
+   * Lines are split into requests within the API's record count and size
+   * limits. Records that fail, such as when a shard is throttled, are retried
+   * alone rather than resending the request.
+   */
   Status send(std::vector<std::string>& log_data,
               const std::string& log_type) override;
 
+ private:
+  /// Put the records of a request, retrying failed records. Clears entries.
+  Status putRecords(
+      std::vector<Aws::Kinesis::Model::PutRecordsRequestEntry>& entries);
+
+  /// The partition key of the next record.
+  std::string getPartitionKey();
+
  private:
   std::string partition_key_;
   std::shared_ptr<Aws::Kinesis::KinesisClient> client_{nullptr};
 
+  /// Records assigned a partition key, when using several keys.
+  std::atomic<size_t> partition_key_count_{0};
+
   FRIEND_TEST(KinesisTests, test_send);
+  FRIEND_TEST(KinesisTests, test_send_retry);
 };
 
 class KinesisLoggerPlugin : public LoggerPlugin {
@@ -61,6 +80,9 @@ class KinesisLoggerPlugin : public LoggerPlugin {
 
   Status logString(const std::string& s) override;
 
+  /// Log several result strings with one buffered write.
+  Status logStrings(const std::vector<std::string>& strings) override;
+
  private:
   std::shared_ptr<KinesisLogForwarder> forwarder_{nullptr};
 };
@@ -8,7 +8,9 @@
  *
  */
 
+#include <algorithm>
 #include <chrono>
+#include <future>
 #include <thread>
 
 #include <boost/property_tree/json_parser.hpp>
@@ -21,74 +23,319 @@
 #include <osquery/system.h>
 
 #include "osquery/config/parsers/decorators.h"
+#include "osquery/core/conversions.h"
+#include "osquery/core/tracing.h"
 #include "osquery/logger/plugins/buffered.h"
 
 namespace pt = boost::property_tree;
 
 namespace osquery {
 
+FLAG(bool,
+     logger_memory_buffer,
+     false,
+     "Hold buffered logs in memory, storing them only when sends fail");
+
+FLAG(uint64,
+     logger_memory_max,
+     16 * 1024 * 1024,
+     "Max bytes of logs held in memory before they are stored");
+
+FLAG(bool,
+     logger_memory_persist,
+     true,
+     "Store the logs held in memory when the logger stops");
+
 const auto BufferedLogForwarder::kLogPeriod = std::chrono::seconds(4);
 const size_t BufferedLogForwarder::kMaxLogLines = 1024;
 
+/// Width of the zero-padded sequences, keys sort in sequence order.
+static const size_t kSequenceWidth = 20;
+
 void BufferedLogForwarder::check() {
-  // Get a list of all the buffered log items, with a max of 1024 lines.
+  OSQUERY_TRACE_SPAN("BufferedLogForwarder::check");
+  recover();
+  backlog_ = false;
+  send_failed_ = false;
+
+  // Results are read first, statuses use the remaining lines.
+  auto count = flush(true, max_log_lines_);
+  if (max_log_lines_ == 0 || count < max_log_lines_) {
+    flush(false, (max_log_lines_ == 0) ? 0 : max_log_lines_ - count);
+  } else {
+    backlog_ = true;
+  }
+
+  if (send_failed_) {
+    // Lines held in memory are stored until sends succeed again.
+    std::lock_guard<std::mutex> lock(append_mutex_);
+    spill(true);
+    spill(false);
+  }
+}
+
+size_t BufferedLogForwarder::flush(bool results, size_t max) {
+  auto i = (results) ? 0 : 1;
+  auto& cursor = cursors_[i];
+  auto start = cursor;
+
+  // Each in-flight send may carry up to max lines.
+  auto in_flight = std::max(max_in_flight_, (size_t)1);
+  size_t available = 0;
+  size_t end = 0;
+  size_t stored = 0;
+  std::vector<std::string> held;
+  {
+    // Every sequence below the next has been written.
+    std::lock_guard<std::mutex> lock(append_mutex_);
+    available = sequences_[i];
+    end = available;
+    if (max > 0 && end - cursor > max * in_flight) {
+      end = cursor + max * in_flight;
+    }
+
+    // The lines held in memory follow the stored lines, and are kept until
+    // they are sent.
+    stored = available - memory_[i].size();
+    for (auto seq = std::max(cursor, stored); seq < end; seq++) {
+      held.push_back(memory_[i][seq - stored]);
+    }
+  }
+  if (end <= cursor) {
+    return 0;
+  }
+
+  // The unsent lines are contiguous from the cursor.
   std::vector<std::string> indexes;
-  auto status = scanDatabaseKeys(kLogs, indexes, index_name_, max_log_lines_);
-
-  // For each index, accumulate the log line into the result or status set.
-  std::vector<std::string> results, statuses;
-  iterate(indexes, ([&results, &statuses, this](std::string& index) {
-            std::string value;
-            auto& target = isResultIndex(index) ? results : statuses;
-            if (getDatabaseValue(kLogs, index, value)) {
-              target.push_back(std::move(value));
-            }
-          }));
+  for (auto seq = cursor; seq < std::min(end, stored); seq++) {
+    indexes.push_back(genIndex(results, seq));
+  }
 
-  // If any results/statuses were found in the flushed buffer, send.
-  if (results.size() > 0) {
-    status = send(results, "result");
-    if (!status.ok()) {
-      VLOG(1) << "Error sending results to logger: " << status.getMessage();
-    } else {
-      // Clear the results logs once they were sent.
-      iterate(indexes, ([&results, this](std::string& index) {
-                if (!isResultIndex(index)) {
-                  return;
-                }
-                deleteDatabaseValue(kLogs, index);
-              }));
+  std::vector<std::string> values;
+  if (!indexes.empty()) {
+    getDatabaseBatch(kLogs, indexes, values);
+  }
+  values.insert(values.end(),
+                std::make_move_iterator(held.begin()),
+                std::make_move_iterator(held.end()));
+
+  // Split the lines into sends by line count and target size.
+  struct LogBatch {
+    std::vector<std::string> lines;
+    size_t bytes{0};
+    size_t end{0};
+    Status status;
+  };
+  std::vector<LogBatch> batches(1);
+  for (size_t i = 0; i < values.size(); i++) {
+    auto& batch = batches.back();
+    auto full = (max > 0 && batch.lines.size() >= max) ||
+                (max_log_bytes_ > 0 && batch.bytes >= max_log_bytes_);
+    if (full) {
+      if (batches.size() == in_flight) {
+        break;
+      }
+      batches.emplace_back();
+    }
+
+    // A line that could not be written is skipped.
+    auto& current = batches.back();
+    current.end = cursor + i + 1;
+    if (!values[i].empty()) {
+      current.bytes += values[i].size();
+      current.lines.push_back(std::move(values[i]));
     }
   }
 
-  if (statuses.size() > 0) {
-    status = send(statuses, "status");
-    if (!status.ok()) {
-      VLOG(1) << "Error sending status to logger: " << status.getMessage();
-    } else {
-      // Clear the status logs once they were sent.
-      iterate(indexes, ([&results, this](std::string& index) {
-                if (!isStatusIndex(index)) {
-                  return;
-                }
-                deleteDatabaseValue(kLogs, index);
-              }));
+  auto type = (results) ? "result" : "status";
+  if (batches.size() == 1) {
+    if (!batches[0].lines.empty()) {
+      batches[0].status = send(batches[0].lines, type);
+    }
+  } else {
+    // Sends are concurrent, and acknowledged in order.
+    std::vector<std::future<Status>> sends;
+    for (auto& batch : batches) {
+      sends.push_back(std::async(std::launch::async, [this, &batch, type]() {
+        return (batch.lines.empty()) ? Status(0) : send(batch.lines, type);
+      }));
+    }
+    for (size_t i = 0; i < batches.size(); i++) {
+      batches[i].status = sends[i].get();
+    }
+  }
+
+  // The cursor moves past the leading sent batches, later sends are retried.
+  auto sent = cursor;
+  for (const auto& batch : batches) {
+    if (!batch.status.ok()) {
+      VLOG(1) << "Error sending " << type
+              << " to logger: " << batch.status.getMessage();
+      send_failed_ = true;
+      break;
+    }
+    sent = batch.end;
+  }
+
+  if (sent > cursor) {
+    std::lock_guard<std::mutex> lock(append_mutex_);
+    auto& memory = memory_[i];
+    stored = sequences_[i] - memory.size();
+    for (auto seq = stored; seq < sent && !memory.empty(); seq++) {
+      memory_bytes_ -= memory.front().size();
+      memory.pop_front();
+    }
+
+    // Move the cursor past the sent lines, then clear those stored.
+    cursor = sent;
+    if (start < stored) {
+      setDatabaseValue(kLogs, getCursorKey(results), std::to_string(cursor));
+      deleteDatabaseRange(
+          kLogs, getPrefix(results), genIndex(results, cursor));
+    }
+  }
+  if (!send_failed_ && cursor < available) {
+    backlog_ = true;
+  }
+  return batches.back().end - start;
+}
+
+void BufferedLogForwarder::recover() {
+  std::call_once(recovered_, [this]() {
+    for (const auto results : {true, false}) {
+      auto i = (results) ? 0 : 1;
+      std::string cursor;
+      long long value = 0;
+      getDatabaseValue(kLogs, getCursorKey(results), cursor);
+      if (!cursor.empty() && safeStrtoll(cursor, 10, value) && value > 0) {
+        cursors_[i] = static_cast<size_t>(value);
+      }
+      sequences_[i] = cursors_[i];
+
+      // Continue after the last buffered line.
+      std::vector<std::string> legacy;
+      scanDatabaseKeys(
+          kLogs,
+          getPrefix(results),
+          [this, results, i, &legacy](const std::string& index) {
+            size_t seq = 0;
+            if (!getSequence(index, results, seq)) {
+              legacy.push_back(index);
+            } else if (seq >= sequences_[i]) {
+              sequences_[i] = seq + 1;
+            }
+            return true;
+          });
+      if (legacy.empty()) {
+        continue;
+      }
+
+      // Append lines buffered by time-based indexes.
+      std::vector<std::string> values;
+      getDatabaseBatch(kLogs, legacy, values);
+      DatabaseStringValueList data;
+      std::lock_guard<std::mutex> lock(append_mutex_);
+      for (auto& value : values) {
+        if (!value.empty()) {
+          data.emplace_back(genIndex(results), std::move(value));
+        }
+      }
+      if (setDatabaseBatch(kLogs, data).ok()) {
+        deleteDatabaseBatch(kLogs, legacy);
+      }
     }
+  });
+}
+
+void BufferedLogForwarder::hold(bool results, std::string line) {
+  auto i = (results) ? 0 : 1;
+  sequences_[i]++;
+  memory_bytes_ += line.size();
+  memory_[i].push_back(std::move(line));
+  if (memory_bytes_ > FLAGS_logger_memory_max) {
+    spill(true);
+    spill(false);
   }
 }
 
+void BufferedLogForwarder::spill(bool results) {
+  auto i = (results) ? 0 : 1;
+  auto& memory = memory_[i];
+  if (memory.empty()) {
+    return;
+  }
+
+  DatabaseStringValueList data;
+  auto seq = sequences_[i] - memory.size();
+  if (cursors_[i] == seq) {
+    // Without stored lines the stored cursor is not moved by sends.
+    data.emplace_back(getCursorKey(results), std::to_string(seq));
+  }
+  for (auto& line : memory) {
+    memory_bytes_ -= line.size();
+    data.emplace_back(genIndex(results, seq++), std::move(line));
+  }
+  memory.clear();
+  setDatabaseBatch(kLogs, data);
+}
+
 void BufferedLogForwarder::start() {
   while (!interrupted()) {
     check();
 
-    // Cool off and time wait the configured period.
-    pauseMilli(log_period_);
+    if (send_failed_) {
+      // Back off while sends fail, doubling up to the max backoff.
+      backoff_ = (backoff_.count() == 0) ? log_period_ : backoff_ * 2;
+      backoff_ = std::max(std::min(backoff_, max_backoff_), log_period_);
+      pauseMilli(backoff_);
+    } else if (!backlog_) {
+      // Cool off and time wait the configured period.
+      backoff_ = std::chrono::seconds(0);
+      pauseMilli(log_period_);
+    } else {
+      // Keep draining a backlog while sends succeed.
+      backoff_ = std::chrono::seconds(0);
+    }
+  }
+
+  if (FLAGS_logger_memory_persist) {
+    std::lock_guard<std::mutex> lock(append_mutex_);
+    spill(true);
+    spill(false);
   }
 }
 
 Status BufferedLogForwarder::logString(const std::string& s) {
-  std::string index = genResultIndex();
-  return setDatabaseValue(kLogs, index, s);
+  recover();
+  std::lock_guard<std::mutex> lock(append_mutex_);
+  if (FLAGS_logger_memory_buffer) {
+    hold(true, s);
+    return Status(0);
+  }
+
+  // Stored lines follow the lines held in memory.
+  spill(true);
+  return setDatabaseValue(kLogs, genResultIndex(), s);
+}
+
+Status BufferedLogForwarder::logStrings(
+    const std::vector<std::string>& strings) {
+  recover();
+  std::lock_guard<std::mutex> lock(append_mutex_);
+  if (FLAGS_logger_memory_buffer) {
+    for (const auto& s : strings) {
+      hold(true, s);
+    }
+    return Status(0);
+  }
+
+  spill(true);
+  DatabaseStringValueList data;
+  data.reserve(strings.size());
+  for (const auto& s : strings) {
+    data.emplace_back(genResultIndex(), s);
+  }
+  return setDatabaseBatch(kLogs, data);
 }
 
 Status BufferedLogForwarder::logStatus(const std::vector<StatusLogLine>& log) {
@@ -101,6 +348,8 @@ Status BufferedLogForwarder::logStatus(const std::vector<StatusLogLine>& log) {
     dtree.put(decoration.first, decoration.second);
   }
 
+  // The status lines are written together.
+  DatabaseStringValueList data;
   for (const auto& item : log) {
     // Convert the StatusLogLine into ptree format, to convert to JSON.
     pt::ptree buffer;
@@ -128,15 +377,23 @@ Status BufferedLogForwarder::logStatus(const std::vector<StatusLogLine>& log) {
     if (!json.empty()) {
       json.pop_back();
     }
-    std::string index = genStatusIndex();
-    Status status = setDatabaseValue(kLogs, index, json);
-    if (!status.ok()) {
-      // Do not continue if any line fails.
-      return status;
+    data.emplace_back("", std::move(json));
+  }
+
+  recover();
+  std::lock_guard<std::mutex> lock(append_mutex_);
+  if (FLAGS_logger_memory_buffer) {
+    for (auto& item : data) {
+      hold(false, std::move(item.second));
     }
+    return Status(0);
   }
 
-  return Status(0);
+  spill(false);
+  for (auto& item : data) {
+    item.first = genStatusIndex();
+  }
+  return setDatabaseBatch(kLogs, data);
 }
 
 bool BufferedLogForwarder::isIndex(const std::string& index, bool results) {
@@ -157,7 +414,36 @@ std::string BufferedLogForwarder::genResultIndex() { return genIndex(true); }
 std::string BufferedLogForwarder::genStatusIndex() { return genIndex(false); }
 
 std::string BufferedLogForwarder::genIndex(bool results) {
-  return index_name_ + "_" + ((results) ? "r" : "s") + "_" +
-         std::to_string(getUnixTime()) + "_" + std::to_string(++log_index_);
+  return genIndex(results, sequences_[(results) ? 0 : 1]++);
+}
+
+std::string BufferedLogForwarder::genIndex(bool results, size_t seq) const {
+  auto sequence = std::to_string(seq);
+  if (sequence.size() < kSequenceWidth) {
+    sequence.insert(0, kSequenceWidth - sequence.size(), '0');
+  }
+  return getPrefix(results) + sequence;
+}
+
+std::string BufferedLogForwarder::getPrefix(bool results) const {
+  return index_name_ + "_" + ((results) ? "r" : "s") + "_";
+}
+
+std::string BufferedLogForwarder::getCursorKey(bool results) const {
+  return index_name_ + "_cursor_" + ((results) ? "r" : "s");
+}
+
+bool BufferedLogForwarder::getSequence(const std::string& index,
+                                       bool results,
+                                       size_t& seq) const {
+  auto prefix = getPrefix(results);
+  if (index.size() != prefix.size() + kSequenceWidth ||
+      index.compare(0, prefix.size(), prefix) != 0 ||
+      index.find_first_not_of("0123456789", prefix.size()) !=
+          std::string::npos) {
+    return false;
+  }
+  seq = std::stoull(index.substr(prefix.size()));
+  return true;
 }
 }
@@ -11,7 +11,9 @@
 #pragma once
 
 #include <chrono>
+#include <deque>
 #include <functional>
+#include <mutex>
 #include <string>
 #include <thread>
 #include <vector>
@@ -44,6 +46,16 @@ inline void iterate(std::vector<std::string>& input,
  * status and result logs. Subclasses take advantage of this reliable sending
  * logic, and implement their own methods for actually sending logs.
  *
+ * Results and statuses are each an append log of sequence-numbered keys. A
+ * persisted cursor per log marks the first unsent line: a flush reads the
+ * lines from the cursor with a single batched read, and a successful send
+ * moves the cursor then drops every line below it with a range delete.
+ *
+ * With logger_memory_buffer the newest lines of each log are held in memory
+ * instead, and are sent without being written. They are stored, after the
+ * lines already stored, when a send fails, when more than logger_memory_max
+ * bytes are held, and when the forwarder stops.
+ *
  * Subclasses must define the send() method
  */
 class BufferedLogForwarder : public InternalRunnable {
@@ -82,6 +94,9 @@ class BufferedLogForwarder : public InternalRunnable {
   /// A simple wait lock, and flush based on settings.
   void start() override;
 
+  /// Forwarders run in the logger thread class.
+  ThreadClass threadClass() const override { return THREAD_CLASS_LOGGER; }
+
   /// Set up the forwarder. May be used to initialize remote clients, etc.
   virtual Status setUp() { return Status(0); }
 
@@ -96,6 +111,15 @@ class BufferedLogForwarder : public InternalRunnable {
    */
   Status logString(const std::string& s);
 
+  /**
+   * @brief Log several results strings
+   *
+   * Writes the strings to the backing store with one batch, see logString.
+   *
+   * @param strings Results strings to log
+   */
+  Status logStrings(const std::vector<std::string>& strings);
+
   /**
    * @brief Log a vector of status lines
    *
@@ -121,24 +145,55 @@ class BufferedLogForwarder : public InternalRunnable {
   /**
    * @brief Check for new logs and send.
    *
-   * Scan the logs domain for up to max_log_lines_ log lines.
-   * Sort those lines into status and request types then forward (send) each
-   * set. On success, clear the data and indexes.
+   * Read up to max_log_lines_ log lines, results first, from each log's
+   * cursor then forward (send) each set. On success, move the cursor and
+   * clear the sent lines.
+   *
+   * The run loop checks again without waiting while a backlog remains.
    */
   void check();
 
+ private:
+  /// Send the lines of one log from its cursor, returning the lines read.
+  size_t flush(bool results, size_t max);
+
+  /**
+   * @brief Load the cursors and continue the sequence of a previous run.
+   *
+   * Lines buffered with the previous time-based indexes are moved to the end
+   * of the logs.
+   */
+  void recover();
+
+  /// The key prefix of the result or status log.
+  std::string getPrefix(bool results) const;
+
+  /// The key of the result or status log cursor.
+  std::string getCursorKey(bool results) const;
+
+  /// Hold a line in memory, the caller must hold append_mutex_.
+  void hold(bool results, std::string line);
+
+  /// Store the lines held in memory, the caller must hold append_mutex_.
+  void spill(bool results);
+
  protected:
   /// Return whether the string is a result index
   bool isResultIndex(const std::string& index);
   /// Return whether the string is a status index
   bool isStatusIndex(const std::string& index);
 
+  /// The sequence of an index, false if the index is not sequenced.
+  /// A sequenced index is the log's prefix and a zero-padded sequence.
+  bool getSequence(const std::string& index, bool results, size_t& seq) const;
+
  private:
   /// Helper for isResultIndex/isStatusIndex
   bool isIndex(const std::string& index, bool results);
 
  protected:
   /// Generate a result index string to use with the backing store
+  /// The caller must hold append_mutex_ until the line is written.
   std::string genResultIndex();
   /// Generate a status index string to use with the backing store
   std::string genStatusIndex();
@@ -146,6 +201,9 @@ class BufferedLogForwarder : public InternalRunnable {
  private:
   std::string genIndex(bool results);
 
+  /// The index of a log line with the given sequence.
+  std::string genIndex(bool results, size_t seq) const;
+
  protected:
   /// Seconds between flushing logs
   std::chrono::seconds log_period_;
@@ -153,8 +211,53 @@ class BufferedLogForwarder : public InternalRunnable {
   /// Max number of logs to flush per check
   size_t max_log_lines_;
 
-  /// Hold an incrementing index for buffering logs
-  size_t log_index_{0};
+  /// Target bytes per send, a send ends with the line reaching the target.
+  size_t max_log_bytes_{0};
+
+  /**
+   * @brief Max concurrent sends per check.
+   *
+   * Each send carries up to max_log_lines_ lines. The cursor moves past the
+   * leading successful sends, lines after a failed send are sent again.
+   */
+  size_t max_in_flight_{1};
+
+  /// Max seconds between checks while sends fail, doubling from log_period_.
+  std::chrono::seconds max_backoff_{0};
+
+  /// Set by a check when lines remain after successful sends.
+  bool backlog_{false};
+
+  /// Set by a check when a send failed.
+  bool send_failed_{false};
+
+ private:
+  /// The current delay after failed sends.
+  std::chrono::seconds backoff_{0};
+
+ protected:
+  /// The next sequence of the result and status logs.
+  size_t sequences_[2] = {0, 0};
+
+  /// The first unsent sequence of the result and status logs.
+  size_t cursors_[2] = {0, 0};
+
+  /// Recover the cursors and sequences once.
+  std::once_flag recovered_;
+
+  /// Protects the sequences, a line is written before the next is assigned.
+  std::mutex append_mutex_;
+
+  /**
+   * @brief The newest lines of the result and status logs, not yet stored.
+   *
+   * The lines held are the sequences below the next sequence, every earlier
+   * unsent line is stored. Protected by the append_mutex_.
+   */
+  std::deque<std::string> memory_[2];
+
+  /// The bytes of the lines held in memory.
+  size_t memory_bytes_{0};
 
   /**
    * @brief Name to use in index
@@ -8,11 +8,19 @@
  *
  */
 
+#include <algorithm>
 #include <exception>
+#include <fstream>
 
+#include <zlib.h>
+
+#include <osquery/dispatcher.h>
 #include <osquery/filesystem.h>
 #include <osquery/flags.h>
 #include <osquery/logger.h>
+#include <osquery/system.h>
+
+#include "osquery/filesystem/fileops.h"
 
 namespace fs = boost::filesystem;
 
@@ -33,9 +41,128 @@ FLAG_ALIAS(std::string, osquery_log_dir, logger_path);
 
 FLAG(int32, logger_mode, 0640, "Decimal mode for log files (default '0640')");
 
+FLAG(uint64,
+     logger_flush_interval,
+     0,
+     "Milliseconds to buffer filesystem result lines (default 0, no buffer)");
+
+FLAG(bool, logger_rotate, false, "Rotate the filesystem results logs");
+
+FLAG(uint64,
+     logger_rotate_size,
+     25 * 1024 * 1024,
+     "Rotate a filesystem results log at this size in bytes");
+
+FLAG(uint64,
+     logger_rotate_period,
+     0,
+     "Rotate a filesystem results log after this many seconds (default 0)");
+
+FLAG(uint64,
+     logger_rotate_max_files,
+     25,
+     "Rotated filesystem results logs to keep (default 25, 0 keeps all)");
+
+FLAG(bool,
+     logger_rotate_compress,
+     false,
+     "Compress rotated filesystem results logs with gzip");
+
 const std::string kFilesystemLoggerFilename = "osqueryd.results.log";
 const std::string kFilesystemLoggerSnapshots = "osqueryd.snapshots.log";
 
+/// Buffered lines are written once they reach this many bytes.
+const size_t kFilesystemLoggerMaxBuffer = 1024 * 1024;
+
+/**
+ * @brief An append-only results log file.
+ *
+ * The file stays open between writes. Lines are buffered and written
+ * together with a single gathering write, immediately or periodically when
+ * `logger_flush_interval` is set. A file moved by an external tool is
+ * re-created on the next write.
+ *
+ * With `logger_rotate` the file is renamed with a timestamp suffix when it
+ * grows past `logger_rotate_size` or becomes older than
+ * `logger_rotate_period`. Then the rotated file is optionally compressed
+ * and the oldest rotated files are removed.
+ */
+class FilesystemLogFile : private boost::noncopyable {
+ public:
+  explicit FilesystemLogFile(const fs::path& path) : path_(path) {}
+
+  /// Create the file if it does not exist.
+  Status open();
+
+  /// Buffer lines, writing them unless the flush interval allows waiting.
+  Status append(const std::vector<std::string>& lines);
+
+  /// Write all buffered lines.
+  Status flush();
+
+  /// The path of the active file.
+  const fs::path& path() const { return path_; }
+
+ private:
+  /// Write the buffered lines and rotate, the caller holds mutex_.
+  Status write(std::string& rotated);
+
+  /// Open the file if it is closed or was moved, the caller holds mutex_.
+  Status ensureOpen();
+
+  /// Rename the file and create a new one, the caller holds mutex_.
+  Status rotate(std::string& rotated);
+
+  /// Compress a rotated file and remove the oldest rotated files.
+  void finishRotation(const std::string& rotated);
+
+ private:
+  /// The active file path.
+  fs::path path_;
+
+  /// The open file, if any.
+  std::unique_ptr<PlatformFile> file_{nullptr};
+
+  /// Buffered lines, including their newlines.
+  std::vector<std::string> pending_;
+
+  /// The size of the buffered lines.
+  size_t pending_bytes_{0};
+
+  /// The time the active file was opened, for time-based rotation.
+  size_t opened_{0};
+
+  /// Protects the file and buffer.
+  Mutex mutex_;
+
+  /// Serializes compression and removal of rotated files.
+  Mutex rotation_mutex_;
+};
+
+/// Periodically write the buffered lines of filesystem results logs.
+class FilesystemLogFlusher : public InternalRunnable {
+ public:
+  explicit FilesystemLogFlusher(
+      std::vector<std::shared_ptr<FilesystemLogFile>> files)
+      : files_(std::move(files)) {}
+
+  /// Flush every interval, and once more when interrupted.
+  void start() override {
+    while (!interrupted()) {
+      pauseMilli(FLAGS_logger_flush_interval);
+      for (const auto& file : files_) {
+        file->flush();
+      }
+    }
+  }
+
+ protected:
+  ThreadClass threadClass() const override { return THREAD_CLASS_LOGGER; }
+
+ private:
+  std::vector<std::shared_ptr<FilesystemLogFile>> files_;
+};
+
 class FilesystemLoggerPlugin : public LoggerPlugin {
  public:
   Status setUp() override;
@@ -43,6 +170,9 @@ class FilesystemLoggerPlugin : public LoggerPlugin {
   /// Log results (differential) to a distinct path.
   Status logString(const std::string& s) override;
 
+  /// Write several result lines with one file write.
+  Status logStrings(const std::vector<std::string>& strings) override;
+
   /// Log snapshot data to a distinct path.
   Status logSnapshot(const std::string& s) override;
 
@@ -59,18 +189,18 @@ class FilesystemLoggerPlugin : public LoggerPlugin {
   /// Write a status to Glog.
   Status logStatus(const std::vector<StatusLogLine>& log) override;
 
- private:
-  /// The plugin-internal filesystem writer method.
-  Status logStringToFile(const std::string& s,
-                         const std::string& filename,
-                         bool empty = false);
-
  private:
   /// The folder where Glog and the result/snapshot files are written.
   fs::path log_path_;
 
-  /// Filesystem writer mutex.
-  Mutex mutex_;
+  /// The results log.
+  std::shared_ptr<FilesystemLogFile> results_{nullptr};
+
+  /// The snapshots log.
+  std::shared_ptr<FilesystemLogFile> snapshots_{nullptr};
+
+  /// Writes buffered lines when a flush interval is used.
+  std::shared_ptr<FilesystemLogFlusher> flusher_{nullptr};
 
  private:
   FRIEND_TEST(FilesystemLoggerTests, test_filesystem_init);
@@ -78,6 +208,200 @@ class FilesystemLoggerPlugin : public LoggerPlugin {
 
 REGISTER(FilesystemLoggerPlugin, "logger", "filesystem");
 
+/// Compress a file into a gzip file.
+static Status compressLogFile(const std::string& from, const std::string& to) {
+  std::ifstream input(from, std::ios::binary);
+  if (!input) {
+    return Status(1, "Cannot read log: " + from);
+  }
+
+  PlatformFile output(to, PF_CREATE_NEW | PF_WRITE, FLAGS_logger_mode);
+  if (!output.isValid()) {
+    return Status(1, "Cannot create compressed log: " + to);
+  }
+
+  // A window of 15 bits, plus 16 to write a gzip header and trailer.
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    return Status(1, "Cannot start compression");
+  }
+
+  std::vector<char> in(64 * 1024);
+  std::vector<char> out(64 * 1024);
+  int flush = Z_NO_FLUSH;
+  Status status;
+  while (status.ok() && flush != Z_FINISH) {
+    input.read(in.data(), in.size());
+    zs.next_in = reinterpret_cast<Bytef*>(in.data());
+    zs.avail_in = static_cast<uInt>(input.gcount());
+    flush = (input.eof()) ? Z_FINISH : Z_NO_FLUSH;
+    do {
+      zs.next_out = reinterpret_cast<Bytef*>(out.data());
+      zs.avail_out = static_cast<uInt>(out.size());
+      deflate(&zs, flush);
+      auto size = out.size() - zs.avail_out;
+      if (output.write(out.data(), size) != static_cast<ssize_t>(size)) {
+        status = Status(1, "Cannot write compressed log: " + to);
+        break;
+      }
+    } while (zs.avail_out == 0);
+  }
+  deflateEnd(&zs);
+  return status;
+}
+
+Status FilesystemLogFile::open() {
+  WriteLock lock(mutex_);
+  return ensureOpen();
+}
+
+Status FilesystemLogFile::ensureOpen() {
+  boost::system::error_code ec;
+  if (file_ != nullptr && fs::exists(path_, ec)) {
+    return Status(0, "OK");
+  }
+
+  file_.reset(new PlatformFile(path_.string(),
+                               PF_CREATE_ALWAYS | PF_WRITE | PF_APPEND,
+                               FLAGS_logger_mode));
+  if (!file_->isValid()) {
+    file_.reset();
+    return Status(1, "Could not create file: " + path_.string());
+  }
+
+  // If the file existed with different permissions they must be restricted.
+  if (!platformChmod(path_.string(), FLAGS_logger_mode)) {
+    file_.reset();
+    return Status(1, "Failed to change permissions for file: " +
+                         path_.string());
+  }
+  opened_ = getUnixTime();
+  return Status(0, "OK");
+}
+
+Status FilesystemLogFile::append(const std::vector<std::string>& lines) {
+  std::string rotated;
+  Status status;
+  {
+    WriteLock lock(mutex_);
+    for (const auto& line : lines) {
+      pending_.push_back(line);
+      pending_.back() += '\n';
+      pending_bytes_ += pending_.back().size();
+    }
+
+    if (FLAGS_logger_flush_interval == 0 ||
+        pending_bytes_ >= kFilesystemLoggerMaxBuffer) {
+      status = write(rotated);
+    }
+  }
+
+  // Compression does not block writers.
+  if (!rotated.empty()) {
+    finishRotation(rotated);
+  }
+  return status;
+}
+
+Status FilesystemLogFile::flush() {
+  std::string rotated;
+  Status status;
+  {
+    WriteLock lock(mutex_);
+    status = write(rotated);
+  }
+
+  if (!rotated.empty()) {
+    finishRotation(rotated);
+  }
+  return status;
+}
+
+Status FilesystemLogFile::write(std::string& rotated) {
+  if (pending_.empty()) {
+    return Status(0, "OK");
+  }
+
+  // Lines that cannot be written are dropped, as a failed write would.
+  auto status = ensureOpen();
+  if (status.ok()) {
+    auto bytes = file_->write(pending_);
+    if (bytes < 0 || static_cast<size_t>(bytes) != pending_bytes_) {
+      status = Status(1, "Failed to write contents to file: " + path_.string());
+    }
+  }
+  pending_.clear();
+  pending_bytes_ = 0;
+  if (!status.ok() || !FLAGS_logger_rotate) {
+    return status;
+  }
+
+  if (file_->size() >= FLAGS_logger_rotate_size ||
+      (FLAGS_logger_rotate_period > 0 &&
+       getUnixTime() - opened_ >= FLAGS_logger_rotate_period)) {
+    return rotate(rotated);
+  }
+  return status;
+}
+
+Status FilesystemLogFile::rotate(std::string& rotated) {
+  file_.reset();
+
+  // Rotated files sort by their time of rotation.
+  auto base = path_.string() + "." + std::to_string(getUnixTime());
+  rotated = base;
+  boost::system::error_code ec;
+  for (size_t i = 1; fs::exists(rotated, ec) ||
+                     fs::exists(rotated + ".gz", ec);
+       i++) {
+    rotated = base + "-" + std::to_string(i);
+  }
+
+  fs::rename(path_, rotated, ec);
+  if (ec) {
+    rotated.clear();
+  }
+  return ensureOpen();
+}
+
+void FilesystemLogFile::finishRotation(const std::string& rotated) {
+  WriteLock lock(rotation_mutex_);
+  if (FLAGS_logger_rotate_compress) {
+    boost::system::error_code ec;
+    auto status = compressLogFile(rotated, rotated + ".gz");
+    if (status.ok()) {
+      fs::remove(rotated, ec);
+    } else {
+      fs::remove(rotated + ".gz", ec);
+      LOG(WARNING) << "Cannot compress rotated log: " << status.getMessage();
+    }
+  }
+
+  if (FLAGS_logger_rotate_max_files == 0) {
+    return;
+  }
+
+  // Find the rotated files of this log, oldest first.
+  auto prefix = path_.filename().string() + ".";
+  std::vector<std::string> files;
+  boost::system::error_code ec;
+  for (fs::directory_iterator it(path_.parent_path(), ec), end;
+       !ec && it != end;
+       it.increment(ec)) {
+    auto name = it->path().filename().string();
+    if (name.compare(0, prefix.size(), prefix) == 0) {
+      files.push_back(it->path().string());
+    }
+  }
+  std::sort(files.begin(), files.end());
+  while (files.size() > FLAGS_logger_rotate_max_files) {
+    fs::remove(files.front(), ec);
+    files.erase(files.begin());
+  }
+}
+
 Status FilesystemLoggerPlugin::setUp() {
   log_path_ = fs::path(FLAGS_logger_path);
 
@@ -85,28 +409,32 @@ Status FilesystemLoggerPlugin::setUp() {
   // Glog 0.3.4 does not support a logfile mode.
   // FLAGS_logfile_mode = FLAGS_logger_mode;
 
+  // The files are replaced if the logger path changes.
+  if (results_ == nullptr ||
+      results_->path() != log_path_ / kFilesystemLoggerFilename) {
+    results_ = std::make_shared<FilesystemLogFile>(log_path_ /
+                                                   kFilesystemLoggerFilename);
+    snapshots_ = std::make_shared<FilesystemLogFile>(
+        log_path_ / kFilesystemLoggerSnapshots);
+    if (FLAGS_logger_flush_interval > 0) {
+      flusher_ = std::make_shared<FilesystemLogFlusher>(
+          std::vector<std::shared_ptr<FilesystemLogFile>>{results_,
+                                                          snapshots_});
+      Dispatcher::addService(flusher_);
+    }
+  }
+
   // Ensure that we create the results log here.
-  return logStringToFile("", kFilesystemLoggerFilename, true);
+  return results_->open();
 }
 
 Status FilesystemLoggerPlugin::logString(const std::string& s) {
-  return logStringToFile(s, kFilesystemLoggerFilename);
+  return results_->append({s});
 }
 
-Status FilesystemLoggerPlugin::logStringToFile(const std::string& s,
-                                               const std::string& filename,
-                                               bool empty) {
-  WriteLock lock(mutex_);
-  Status status;
-  try {
-    status = writeTextFile((log_path_ / filename).string(),
-                           (empty) ? "" : s + '\n',
-                           FLAGS_logger_mode,
-                           true);
-  } catch (const std::exception& e) {
-    return Status(1, e.what());
-  }
-  return status;
+Status FilesystemLoggerPlugin::logStrings(
+    const std::vector<std::string>& strings) {
+  return results_->append(strings);
 }
 
 Status FilesystemLoggerPlugin::logStatus(
@@ -124,7 +452,7 @@ Status FilesystemLoggerPlugin::logStatus(
 
 Status FilesystemLoggerPlugin::logSnapshot(const std::string& s) {
   // Send the snapshot data to a separate filename.
-  return logStringToFile(s, kFilesystemLoggerSnapshots);
+  return snapshots_->append({s});
 }
 
 void FilesystemLoggerPlugin::init(const std::string& name,
@@ -0,0 +1,387 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <osquery/config.h>
+#include <osquery/flags.h>
+#include <osquery/registry.h>
+#include <osquery/system.h>
+
+#include "osquery/core/json.h"
+#include "osquery/logger/plugins/kafka_producer.h"
+
+namespace osquery {
+
+REGISTER(KafkaLoggerPlugin, "logger", "kafka_producer");
+
+FLAG(string,
+     logger_kafka_brokers,
+     "",
+     "Comma-separated Kafka bootstrap brokers, host:port");
+
+FLAG(string,
+     logger_kafka_topic,
+     "osquery",
+     "Kafka topic of results not routed by the kafka_topics config");
+
+FLAG(uint64,
+     logger_kafka_period,
+     2,
+     "Seconds between flushing logs to Kafka (default 2)");
+
+FLAG(uint64,
+     logger_kafka_linger_ms,
+     100,
+     "Milliseconds the producer waits to fill a batch (default 100)");
+
+FLAG(uint64,
+     logger_kafka_batch_size,
+     10000,
+     "Max messages per Kafka batch (default 10000)");
+
+FLAG(string,
+     logger_kafka_compression,
+     "none",
+     "Compress Kafka batches using none, gzip, snappy, or lz4");
+
+FLAG(string,
+     logger_kafka_acks,
+     "all",
+     "Broker acknowledgements for a delivery: 0, 1, or all (default all)");
+
+FLAG(uint64,
+     logger_kafka_timeout,
+     30,
+     "Seconds allowed to deliver a message, including retries (default 30)");
+
+const size_t KafkaLogForwarder::kKafkaMaxLogLines = 4096;
+
+/// Milliseconds to poll the producer for delivery reports.
+const int kKafkaPollMilli = 100;
+
+/// Milliseconds to wait for queued messages when the producer is destroyed.
+const int kKafkaFlushMilli = 1000;
+
+/// Protects the topics of queries routed to a topic of their own.
+static Mutex kafka_topics_mutex;
+
+/// Topics by query name, from the kafka_topics config.
+static std::map<std::string, std::string> kafka_query_topics;
+
+namespace {
+
+/// Read the query name of a result log line.
+class QueryNameJSONHandler : public JSONHandler {
+ public:
+  void key(std::string& name) override {
+    is_name_ = (depth_ == 1 && name == "name");
+  }
+
+  void value(std::string& value) override {
+    if (is_name_) {
+      name = std::move(value);
+    }
+    is_name_ = false;
+  }
+
+  void startObject() override {
+    depth_++;
+    is_name_ = false;
+  }
+
+  void endObject() override { depth_--; }
+
+  void startArray() override {
+    depth_++;
+    is_name_ = false;
+  }
+
+  void endArray() override { depth_--; }
+
+ public:
+  std::string name;
+
+ private:
+  size_t depth_{0};
+  bool is_name_{false};
+};
+}
+
+/**
+ * @brief A ConfigParserPlugin for the "kafka_topics" dictionary key.
+ *
+ * Each topic lists the names of the queries whose results are produced to
+ * it, such as {"kafka_topics": {"process_events": ["process_events"]}}.
+ */
+class KafkaTopicsConfigParserPlugin : public ConfigParserPlugin {
+ public:
+  std::vector<std::string> keys() const override { return {"kafka_topics"}; }
+
+  Status setUp() override { return Status(0); }
+
+  Status update(const std::string& source, const ParserConfig& config) override;
+
+ protected:
+  /// Stop routing queries when the config is reset.
+  void reset() override;
+};
+
+void KafkaTopicsConfigParserPlugin::reset() {
+  KafkaLogForwarder::setTopics({});
+  ConfigParserPlugin::reset();
+}
+
+Status KafkaTopicsConfigParserPlugin::update(const std::string& source,
+                                             const ParserConfig& config) {
+  if (config.count("kafka_topics") == 0) {
+    return Status(0, "OK");
+  }
+
+  std::map<std::string, std::string> topics;
+  data_.put_child("kafka_topics", config.at("kafka_topics"));
+  for (const auto& topic : config.at("kafka_topics")) {
+    for (const auto& query : topic.second) {
+      topics[query.second.data()] = topic.first;
+    }
+  }
+  KafkaLogForwarder::setTopics(std::move(topics));
+  return Status(0, "OK");
+}
+
+REGISTER_INTERNAL(KafkaTopicsConfigParserPlugin,
+                  "config_parser",
+                  "kafka_topics");
+
+Status KafkaLoggerPlugin::setUp() {
+  forwarder_ = std::make_shared<KafkaLogForwarder>();
+  Status s = forwarder_->setUp();
+  if (!s.ok()) {
+    LOG(ERROR) << "Error initializing Kafka logger: " << s.getMessage();
+    return s;
+  }
+  Dispatcher::addService(forwarder_);
+  return Status(0, "OK");
+}
+
+Status KafkaLoggerPlugin::logString(const std::string& s) {
+  return forwarder_->logString(s);
+}
+
+Status KafkaLoggerPlugin::logStrings(const std::vector<std::string>& strings) {
+  return forwarder_->logStrings(strings);
+}
+
+KafkaLogForwarder::KafkaLogForwarder()
+    : BufferedLogForwarder("kafka",
+                           std::chrono::seconds(FLAGS_logger_kafka_period),
+                           kKafkaMaxLogLines) {}
+
+KafkaLogForwarder::~KafkaLogForwarder() {
+  if (producer_ == nullptr) {
+    return;
+  }
+
+  rd_kafka_flush(producer_, kKafkaFlushMilli);
+  for (auto& topic : topics_) {
+    rd_kafka_topic_destroy(topic.second);
+  }
+  rd_kafka_destroy(producer_);
+}
+
+std::string KafkaLogForwarder::getTopic(const std::string& line) {
+  {
+    WriteLock lock(kafka_topics_mutex);
+    if (kafka_query_topics.empty()) {
+      return FLAGS_logger_kafka_topic;
+    }
+  }
+
+  // Lines are only parsed when queries are routed to their own topics.
+  QueryNameJSONHandler handler;
+  if (parseJSON(line, handler).ok()) {
+    WriteLock lock(kafka_topics_mutex);
+    auto topic = kafka_query_topics.find(handler.name);
+    if (topic != kafka_query_topics.end()) {
+      return topic->second;
+    }
+  }
+  return FLAGS_logger_kafka_topic;
+}
+
+void KafkaLogForwarder::setTopics(std::map<std::string, std::string> topics) {
+  WriteLock lock(kafka_topics_mutex);
+  kafka_query_topics = std::move(topics);
+}
+
+rd_kafka_topic_t* KafkaLogForwarder::getTopicHandle(const std::string& topic) {
+  WriteLock lock(topics_mutex_);
+  auto handle = topics_.find(topic);
+  if (handle != topics_.end()) {
+    return handle->second;
+  }
+
+  // Topics use the producer's default topic configuration.
+  auto created = rd_kafka_topic_new(producer_, topic.c_str(), nullptr);
+  if (created != nullptr) {
+    topics_[topic] = created;
+  }
+  return created;
+}
+
+void KafkaLogForwarder::onDelivery(rd_kafka_t* producer,
+                                   const rd_kafka_message_t* message,
+                                   void* opaque) {
+  auto delivery = static_cast<std::shared_ptr<KafkaDelivery>*>(
+      message->_private);
+  if (delivery == nullptr) {
+    return;
+  }
+
+  // Oversized messages cannot be delivered and are dropped, not retried.
+  if (message->err == RD_KAFKA_RESP_ERR_MSG_SIZE_TOO_LARGE) {
+    LOG(ERROR) << "Kafka log too big, discarding!";
+  } else if (message->err != RD_KAFKA_RESP_ERR_NO_ERROR) {
+    (*delivery)->error = message->err;
+    (*delivery)->failed++;
+  }
+  (*delivery)->pending--;
+  delete delivery;
+}
+
+Status KafkaLogForwarder::send(std::vector<std::string>& log_data,
+                               const std::string& log_type) {
+  // Reports may arrive after an interrupted send returns, each message holds
+  // a reference to the send's delivery counts.
+  auto delivery = std::make_shared<KafkaDelivery>();
+  for (auto& line : log_data) {
+    auto topic = getTopicHandle(getTopic(line));
+    if (topic == nullptr) {
+      return Status(1, "Cannot create Kafka topic handle");
+    }
+
+    auto opaque = new std::shared_ptr<KafkaDelivery>(delivery);
+    delivery->pending++;
+    while (rd_kafka_produce(topic,
+                            RD_KAFKA_PARTITION_UA,
+                            RD_KAFKA_MSG_F_COPY,
+                            const_cast<char*>(line.data()),
+                            line.size(),
+                            message_key_.data(),
+                            message_key_.size(),
+                            opaque) == -1) {
+      auto error = rd_kafka_last_error();
+      if (error == RD_KAFKA_RESP_ERR__QUEUE_FULL && !interrupted()) {
+        // Wait for queued messages to be delivered.
+        rd_kafka_poll(producer_, kKafkaPollMilli);
+        continue;
+      }
+
+      delivery->pending--;
+      delete opaque;
+      if (error == RD_KAFKA_RESP_ERR_MSG_SIZE_TOO_LARGE) {
+        LOG(ERROR) << "Kafka log too big, discarding!";
+        break;
+      }
+      return Status(1, std::string("Kafka produce error: ") +
+                           rd_kafka_err2str(error));
+    }
+
+    // Serve the reports of earlier batches while producing.
+    rd_kafka_poll(producer_, 0);
+  }
+
+  // The message timeout bounds the wait, including the producer's retries.
+  while (delivery->pending > 0 && !interrupted()) {
+    rd_kafka_poll(producer_, kKafkaPollMilli);
+  }
+
+  if (delivery->pending > 0) {
+    return Status(1, "Kafka delivery interrupted");
+  }
+
+  if (delivery->failed > 0) {
+    auto error = static_cast<rd_kafka_resp_err_t>(delivery->error.load());
+    LOG(ERROR) << "Kafka delivery for " << delivery->failed << " of "
+               << log_data.size()
+               << " records failed with error: " << rd_kafka_err2str(error);
+    return Status(1, rd_kafka_err2str(error));
+  }
+
+  VLOG(1) << "Successfully sent " << log_data.size() << " logs to Kafka.";
+  return Status(0);
+}
+
+Status KafkaLogForwarder::setUp() {
+  if (FLAGS_logger_kafka_brokers.empty()) {
+    return Status(1, "Brokers must be specified with --logger_kafka_brokers");
+  }
+
+  auto acks = FLAGS_logger_kafka_acks;
+  if (acks == "all") {
+    acks = "-1";
+  }
+
+  char error[512] = {0};
+  auto conf = rd_kafka_conf_new();
+  auto topic_conf = rd_kafka_topic_conf_new();
+  const std::vector<std::pair<std::string, std::string>> settings = {
+      {"bootstrap.servers", FLAGS_logger_kafka_brokers},
+      {"client.id", getHostIdentifier()},
+      {"queue.buffering.max.ms", std::to_string(FLAGS_logger_kafka_linger_ms)},
+      {"batch.num.messages", std::to_string(FLAGS_logger_kafka_batch_size)},
+      {"compression.codec", FLAGS_logger_kafka_compression},
+  };
+  const std::vector<std::pair<std::string, std::string>> topic_settings = {
+      {"request.required.acks", acks},
+      {"message.timeout.ms",
+       std::to_string(FLAGS_logger_kafka_timeout * 1000)},
+  };
+
+  Status s;
+  for (const auto& setting : settings) {
+    if (rd_kafka_conf_set(conf,
+                          setting.first.c_str(),
+                          setting.second.c_str(),
+                          error,
+                          sizeof(error)) != RD_KAFKA_CONF_OK) {
+      s = Status(1, "Invalid Kafka setting " + setting.first + ": " + error);
+      break;
+    }
+  }
+  for (size_t i = 0; s.ok() && i < topic_settings.size(); i++) {
+    const auto& setting = topic_settings[i];
+    if (rd_kafka_topic_conf_set(topic_conf,
+                                setting.first.c_str(),
+                                setting.second.c_str(),
+                                error,
+                                sizeof(error)) != RD_KAFKA_CONF_OK) {
+      s = Status(1, "Invalid Kafka setting " + setting.first + ": " + error);
+    }
+  }
+  if (!s.ok()) {
+    rd_kafka_topic_conf_destroy(topic_conf);
+    rd_kafka_conf_destroy(conf);
+    return s;
+  }
+
+  // The configuration owns the topic configuration, the producer owns both.
+  rd_kafka_conf_set_default_topic_conf(conf, topic_conf);
+  rd_kafka_conf_set_dr_msg_cb(conf, onDelivery);
+  producer_ = rd_kafka_new(RD_KAFKA_PRODUCER, conf, error, sizeof(error));
+  if (producer_ == nullptr) {
+    rd_kafka_conf_destroy(conf);
+    return Status(1, std::string("Cannot create Kafka producer: ") + error);
+  }
+
+  message_key_ = getHostIdentifier();
+  VLOG(1) << "Kafka logging initialized with brokers: "
+          << FLAGS_logger_kafka_brokers;
+  return Status(0);
+}
+}
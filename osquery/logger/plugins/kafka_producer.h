@@ -0,0 +1,113 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <librdkafka/rdkafka.h>
+
+#include <osquery/core.h>
+#include <osquery/dispatcher.h>
+#include <osquery/logger.h>
+
+#include "osquery/logger/plugins/buffered.h"
+
+namespace osquery {
+
+DECLARE_string(logger_kafka_topic);
+
+/// The delivery reports outstanding for the messages of one send.
+struct KafkaDelivery {
+  std::atomic<size_t> pending{0};
+  std::atomic<size_t> failed{0};
+
+  /// The error of a failed delivery.
+  std::atomic<int> error{RD_KAFKA_RESP_ERR_NO_ERROR};
+};
+
+/**
+ * @brief Produce result logs to Kafka topics.
+ *
+ * A send queues every line with the asynchronous producer, which batches and
+ * compresses messages per partition. The send then waits for the delivery
+ * report of each message. If any message is not delivered, after the
+ * producer's own retries, the send fails and the buffered lines are sent
+ * again. Lines are thus delivered at least once.
+ *
+ * Results are produced to the topic configured for their query in the
+ * "kafka_topics" config key, or to the logger_kafka_topic.
+ */
+class KafkaLogForwarder : public BufferedLogForwarder {
+ private:
+  static const size_t kKafkaMaxLogLines;
+
+ public:
+  KafkaLogForwarder();
+  ~KafkaLogForwarder() override;
+
+  Status setUp() override;
+
+  /// The topic of a result log line, chosen by the line's query name.
+  static std::string getTopic(const std::string& line);
+
+  /// Replace the topics of the queries routed to a topic of their own.
+  static void setTopics(std::map<std::string, std::string> topics);
+
+ protected:
+  /// Produce the lines then wait for their delivery reports.
+  Status send(std::vector<std::string>& log_data,
+              const std::string& log_type) override;
+
+ private:
+  /// The producer's handle of a topic, created when first used.
+  rd_kafka_topic_t* getTopicHandle(const std::string& topic);
+
+  /// Count a message's delivery report, called while polling the producer.
+  static void onDelivery(rd_kafka_t* producer,
+                         const rd_kafka_message_t* message,
+                         void* opaque);
+
+ private:
+  rd_kafka_t* producer_{nullptr};
+
+  /// Topic handles by name, owned by the producer.
+  std::map<std::string, rd_kafka_topic_t*> topics_;
+  Mutex topics_mutex_;
+
+  /// Messages are keyed by host, a host's messages are kept in order.
+  std::string message_key_;
+
+  FRIEND_TEST(KafkaTests, test_send_undelivered);
+};
+
+class KafkaLoggerPlugin : public LoggerPlugin {
+ public:
+  KafkaLoggerPlugin() : LoggerPlugin() {}
+
+  Status setUp() override;
+
+ private:
+  void init(const std::string& name,
+            const std::vector<StatusLogLine>& log) override {}
+
+  Status logString(const std::string& s) override;
+
+  /// Log several result strings with one buffered write.
+  Status logStrings(const std::vector<std::string>& strings) override;
+
+ private:
+  std::shared_ptr<KafkaLogForwarder> forwarder_{nullptr};
+};
+}
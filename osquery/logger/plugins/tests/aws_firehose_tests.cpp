@@ -54,8 +54,9 @@ TEST_F(FirehoseTests, test_send) {
   forwarder.client_ = client;
 
   std::vector<std::string> logs{"foo"};
-  Aws::Firehose::Model::PutRecordBatchOutcome outcome;
-  outcome.GetResult().SetFailedPutCount(0);
+  Aws::Firehose::Model::PutRecordBatchResult result;
+  result.SetFailedPutCount(0);
+  Aws::Firehose::Model::PutRecordBatchOutcome outcome(result);
   EXPECT_CALL(*client,
               PutRecordBatch(Property(
                   &Aws::Firehose::Model::PutRecordBatchRequest::GetRecords,
@@ -65,17 +66,60 @@ TEST_F(FirehoseTests, test_send) {
 
   logs = {"bar", "foo"};
   Aws::Firehose::Model::PutRecordBatchResponseEntry entry;
-  outcome.GetResult().AddRequestResponses(entry);
+  result.AddRequestResponses(entry);
   entry.SetErrorCode("foo");
   entry.SetErrorMessage("Foo error");
-  outcome.GetResult().SetFailedPutCount(1);
-  outcome.GetResult().AddRequestResponses(entry);
+  result.SetFailedPutCount(1);
+  result.AddRequestResponses(entry);
 
+  // The failed record is retried until the attempts are exhausted.
+  Aws::Firehose::Model::PutRecordBatchResult failed;
+  failed.SetFailedPutCount(1);
+  failed.AddRequestResponses(entry);
   EXPECT_CALL(*client,
               PutRecordBatch(Property(
                   &Aws::Firehose::Model::PutRecordBatchRequest::GetRecords,
                   ElementsAre(MatchesEntry("bar\n"), MatchesEntry("foo\n")))))
-      .WillOnce(Return(outcome));
+      .WillOnce(Return(Aws::Firehose::Model::PutRecordBatchOutcome(result)));
+  EXPECT_CALL(*client,
+              PutRecordBatch(Property(
+                  &Aws::Firehose::Model::PutRecordBatchRequest::GetRecords,
+                  ElementsAre(MatchesEntry("foo\n")))))
+      .Times(3)
+      .WillRepeatedly(
+          Return(Aws::Firehose::Model::PutRecordBatchOutcome(failed)));
   EXPECT_EQ(Status(1, "Foo error"), forwarder.send(logs, "results"));
 }
+
+TEST_F(FirehoseTests, test_send_retry) {
+  FirehoseLogForwarder forwarder;
+  auto client = std::make_shared<StrictMock<MockFirehoseClient>>();
+  forwarder.client_ = client;
+
+  // Only the failed record is sent again.
+  std::vector<std::string> logs{"bar", "foo"};
+  Aws::Firehose::Model::PutRecordBatchResponseEntry entry;
+  Aws::Firehose::Model::PutRecordBatchResult result;
+  entry.SetErrorCode("ServiceUnavailableException");
+  result.AddRequestResponses(entry);
+  entry.SetErrorCode("");
+  result.AddRequestResponses(entry);
+  result.SetFailedPutCount(1);
+
+  Aws::Firehose::Model::PutRecordBatchResult retried;
+  retried.SetFailedPutCount(0);
+
+  InSequence ordered;
+  EXPECT_CALL(*client,
+              PutRecordBatch(Property(
+                  &Aws::Firehose::Model::PutRecordBatchRequest::GetRecords,
+                  ElementsAre(MatchesEntry("bar\n"), MatchesEntry("foo\n")))))
+      .WillOnce(Return(Aws::Firehose::Model::PutRecordBatchOutcome(result)));
+  EXPECT_CALL(*client,
+              PutRecordBatch(Property(
+                  &Aws::Firehose::Model::PutRecordBatchRequest::GetRecords,
+                  ElementsAre(MatchesEntry("bar\n")))))
+      .WillOnce(Return(Aws::Firehose::Model::PutRecordBatchOutcome(retried)));
+  EXPECT_EQ(Status(0), forwarder.send(logs, "results"));
+}
 }
@@ -54,8 +54,9 @@ TEST_F(KinesisTests, test_send) {
   forwarder.client_ = client;
 
   std::vector<std::string> logs{"foo"};
-  Aws::Kinesis::Model::PutRecordsOutcome outcome;
-  outcome.GetResult().SetFailedRecordCount(0);
+  Aws::Kinesis::Model::PutRecordsResult result;
+  result.SetFailedRecordCount(0);
+  Aws::Kinesis::Model::PutRecordsOutcome outcome(result);
   EXPECT_CALL(*client,
               PutRecords(Property(
                   &Aws::Kinesis::Model::PutRecordsRequest::GetRecords,
@@ -65,18 +66,78 @@ TEST_F(KinesisTests, test_send) {
 
   logs = {"bar", "foo"};
   Aws::Kinesis::Model::PutRecordsResultEntry entry;
-  outcome.GetResult().AddRecords(entry);
+  result.AddRecords(entry);
   entry.SetErrorCode("foo");
   entry.SetErrorMessage("Foo error");
-  outcome.GetResult().SetFailedRecordCount(1);
-  outcome.GetResult().AddRecords(entry);
+  result.SetFailedRecordCount(1);
+  result.AddRecords(entry);
 
+  // The failed record is retried until the attempts are exhausted.
+  Aws::Kinesis::Model::PutRecordsResult failed;
+  failed.SetFailedRecordCount(1);
+  failed.AddRecords(entry);
   EXPECT_CALL(*client,
               PutRecords(Property(
                   &Aws::Kinesis::Model::PutRecordsRequest::GetRecords,
                   ElementsAre(MatchesEntry("bar", "fake_partition_key"),
                               MatchesEntry("foo", "fake_partition_key")))))
-      .WillOnce(Return(outcome));
+      .WillOnce(Return(Aws::Kinesis::Model::PutRecordsOutcome(result)));
+  EXPECT_CALL(*client,
+              PutRecords(Property(
+                  &Aws::Kinesis::Model::PutRecordsRequest::GetRecords,
+                  ElementsAre(MatchesEntry("foo", "fake_partition_key")))))
+      .Times(3)
+      .WillRepeatedly(Return(Aws::Kinesis::Model::PutRecordsOutcome(failed)));
   EXPECT_EQ(Status(1, "Foo error"), forwarder.send(logs, "results"));
 }
+
+TEST_F(KinesisTests, test_send_retry) {
+  KinesisLogForwarder forwarder;
+  forwarder.partition_key_ = "fake_partition_key";
+  auto client = std::make_shared<StrictMock<MockKinesisClient>>();
+  forwarder.client_ = client;
+
+  // Only the failed record is sent again.
+  std::vector<std::string> logs{"bar", "foo"};
+  Aws::Kinesis::Model::PutRecordsResultEntry entry;
+  Aws::Kinesis::Model::PutRecordsResult result;
+  result.AddRecords(entry);
+  entry.SetErrorCode("ProvisionedThroughputExceededException");
+  result.AddRecords(entry);
+  result.SetFailedRecordCount(1);
+
+  Aws::Kinesis::Model::PutRecordsResult retried;
+  retried.AddRecords(Aws::Kinesis::Model::PutRecordsResultEntry());
+  retried.SetFailedRecordCount(0);
+
+  InSequence ordered;
+  EXPECT_CALL(*client,
+              PutRecords(Property(
+                  &Aws::Kinesis::Model::PutRecordsRequest::GetRecords,
+                  ElementsAre(MatchesEntry("bar", "fake_partition_key"),
+                              MatchesEntry("foo", "fake_partition_key")))))
+      .WillOnce(Return(Aws::Kinesis::Model::PutRecordsOutcome(result)));
+  EXPECT_CALL(*client,
+              PutRecords(Property(
+                  &Aws::Kinesis::Model::PutRecordsRequest::GetRecords,
+                  ElementsAre(MatchesEntry("foo", "fake_partition_key")))))
+      .WillOnce(Return(Aws::Kinesis::Model::PutRecordsOutcome(retried)));
+  EXPECT_EQ(Status(0), forwarder.send(logs, "results"));
+
+  // Lines are split into requests within the record count limit.
+  logs = std::vector<std::string>(501, "foo");
+  Aws::Kinesis::Model::PutRecordsResult success;
+  success.SetFailedRecordCount(0);
+  EXPECT_CALL(*client,
+              PutRecords(Property(
+                  &Aws::Kinesis::Model::PutRecordsRequest::GetRecords,
+                  SizeIs(500))))
+      .WillOnce(Return(Aws::Kinesis::Model::PutRecordsOutcome(success)));
+  EXPECT_CALL(*client,
+              PutRecords(Property(
+                  &Aws::Kinesis::Model::PutRecordsRequest::GetRecords,
+                  SizeIs(1))))
+      .WillOnce(Return(Aws::Kinesis::Model::PutRecordsOutcome(success)));
+  EXPECT_EQ(Status(0), forwarder.send(logs, "results"));
+}
 }
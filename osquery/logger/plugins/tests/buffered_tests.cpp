@@ -17,6 +17,7 @@
 #include <boost/property_tree/json_parser.hpp>
 #include <boost/property_tree/ptree.hpp>
 
+#include <osquery/database.h>
 #include <osquery/dispatcher.h>
 #include <osquery/logger.h>
 
@@ -28,6 +29,9 @@ namespace pt = boost::property_tree;
 
 namespace osquery {
 
+DECLARE_bool(logger_memory_buffer);
+DECLARE_uint64(logger_memory_max);
+
 // Check that the string matches the StatusLogLine
 MATCHER_P(MatchesStatus, expected, "") {
   pt::ptree actual;
@@ -74,14 +78,24 @@ class MockBufferedLogForwarder : public BufferedLogForwarder {
   FRIEND_TEST(BufferedLogForwarderTests, test_multiple);
   FRIEND_TEST(BufferedLogForwarderTests, test_async);
   FRIEND_TEST(BufferedLogForwarderTests, test_split);
+  FRIEND_TEST(BufferedLogForwarderTests, test_recover);
+  FRIEND_TEST(BufferedLogForwarderTests, test_in_flight);
+  FRIEND_TEST(BufferedLogForwarderTests, test_memory);
+  FRIEND_TEST(BufferedLogForwarderTests, test_memory_spill);
 };
 
 TEST_F(BufferedLogForwarderTests, test_index) {
   MockBufferedLogForwarder runner;
-  EXPECT_THAT(runner.genResultIndex(), ContainsRegex("mock_r_[0-9]+_1"));
-  EXPECT_THAT(runner.genStatusIndex(), ContainsRegex("mock_s_[0-9]+_2"));
-  EXPECT_THAT(runner.genResultIndex(), ContainsRegex("mock_r_[0-9]+_3"));
-  EXPECT_THAT(runner.genStatusIndex(), ContainsRegex("mock_s_[0-9]+_4"));
+  EXPECT_EQ(runner.genResultIndex(), "mock_r_00000000000000000000");
+  EXPECT_EQ(runner.genStatusIndex(), "mock_s_00000000000000000000");
+  EXPECT_EQ(runner.genResultIndex(), "mock_r_00000000000000000001");
+  EXPECT_EQ(runner.genStatusIndex(), "mock_s_00000000000000000001");
+
+  size_t seq = 0;
+  EXPECT_TRUE(runner.getSequence("mock_r_00000000000000000012", true, seq));
+  EXPECT_EQ(seq, 12U);
+  EXPECT_FALSE(runner.getSequence("mock_r_00000000000000000012", false, seq));
+  EXPECT_FALSE(runner.getSequence("mock_r_1476400000_1", true, seq));
 
   EXPECT_TRUE(runner.isResultIndex(runner.genResultIndex()));
   EXPECT_FALSE(runner.isResultIndex(runner.genStatusIndex()));
@@ -271,4 +285,133 @@ TEST_F(BufferedLogForwarderTests, test_split) {
       .WillOnce(Return(Status(0)));
   runner2.check();
 }
+
+TEST_F(BufferedLogForwarderTests, test_recover) {
+  // A line buffered with a time-based index by a previous version.
+  setDatabaseValue(kLogs, "mock_recover_r_1476400000_1", "old");
+
+  {
+    StrictMock<MockBufferedLogForwarder> runner("mock_recover");
+    runner.logString("foo");
+    EXPECT_CALL(runner, send(ElementsAre("old", "foo"), "result"))
+        .WillOnce(Return(Status(0)));
+    runner.check();
+    runner.logString("bar");
+  }
+
+  // A new forwarder continues from the persisted cursor.
+  StrictMock<MockBufferedLogForwarder> runner("mock_recover");
+  runner.logString("baz");
+  EXPECT_CALL(runner, send(ElementsAre("bar", "baz"), "result"))
+      .WillOnce(Return(Status(0)));
+  runner.check();
+  runner.check();
+
+  std::vector<std::string> keys;
+  scanDatabaseKeys(kLogs, keys, "mock_recover_r_");
+  EXPECT_TRUE(keys.empty());
+}
+
+TEST_F(BufferedLogForwarderTests, test_in_flight) {
+  StrictMock<MockBufferedLogForwarder> runner("mock_in_flight", kLogPeriod, 4);
+  runner.max_log_bytes_ = 6;
+  runner.max_in_flight_ = 2;
+  runner.logString("foo");
+  runner.logString("bar");
+  runner.logString("baz");
+  runner.logString("qux");
+  runner.logString("quux");
+
+  // Sends end at the target size, and only two are in flight.
+  EXPECT_CALL(runner, send(ElementsAre("foo", "bar"), "result"))
+      .WillOnce(Return(Status(1, "fail")));
+  EXPECT_CALL(runner, send(ElementsAre("baz", "qux"), "result"))
+      .WillOnce(Return(Status(0)));
+  runner.check();
+  EXPECT_TRUE(runner.send_failed_);
+
+  // The failed send is acknowledged first, later lines are sent again.
+  EXPECT_CALL(runner, send(ElementsAre("foo", "bar"), "result"))
+      .WillOnce(Return(Status(0)));
+  EXPECT_CALL(runner, send(ElementsAre("baz", "qux"), "result"))
+      .WillOnce(Return(Status(0)));
+  runner.check();
+  EXPECT_FALSE(runner.send_failed_);
+  EXPECT_TRUE(runner.backlog_);
+
+  EXPECT_CALL(runner, send(ElementsAre("quux"), "result"))
+      .WillOnce(Return(Status(0)));
+  runner.check();
+  EXPECT_FALSE(runner.backlog_);
+}
+
+TEST_F(BufferedLogForwarderTests, test_memory) {
+  FLAGS_logger_memory_buffer = true;
+  StrictMock<MockBufferedLogForwarder> runner("mock_memory");
+
+  // Lines held in memory are sent without being stored.
+  runner.logString("foo");
+  runner.logStatus({makeStatusLogLine(O_INFO, "foo", 1, "foo status")});
+  std::vector<std::string> keys;
+  scanDatabaseKeys(kLogs, keys, "mock_memory_");
+  EXPECT_TRUE(keys.empty());
+
+  EXPECT_CALL(runner, send(ElementsAre("foo"), "result"))
+      .WillOnce(Return(Status(0)));
+  EXPECT_CALL(runner, send(SizeIs(1), "status")).WillOnce(Return(Status(0)));
+  runner.check();
+  EXPECT_TRUE(runner.memory_[0].empty());
+  EXPECT_EQ(runner.memory_bytes_, 0U);
+  scanDatabaseKeys(kLogs, keys, "mock_memory_");
+  EXPECT_TRUE(keys.empty());
+
+  // A failed send stores the lines, they are sent from the database.
+  runner.logString("bar");
+  EXPECT_CALL(runner, send(ElementsAre("bar"), "result"))
+      .WillOnce(Return(Status(1, "fail")));
+  runner.check();
+  EXPECT_TRUE(runner.memory_[0].empty());
+  scanDatabaseKeys(kLogs, keys, "mock_memory_r_");
+  EXPECT_EQ(keys.size(), 1U);
+
+  // Stored lines are sent before the lines held since.
+  runner.logString("baz");
+  EXPECT_CALL(runner, send(ElementsAre("bar", "baz"), "result"))
+      .WillOnce(Return(Status(0)));
+  runner.check();
+  runner.check();
+  scanDatabaseKeys(kLogs, keys, "mock_memory_r_");
+  EXPECT_TRUE(keys.empty());
+  FLAGS_logger_memory_buffer = false;
+}
+
+TEST_F(BufferedLogForwarderTests, test_memory_spill) {
+  FLAGS_logger_memory_buffer = true;
+  auto memory_max = FLAGS_logger_memory_max;
+  FLAGS_logger_memory_max = 5;
+
+  {
+    // Lines are stored once more than the max bytes are held.
+    StrictMock<MockBufferedLogForwarder> runner("mock_memory_spill");
+    runner.logString("foo");
+    EXPECT_EQ(runner.memory_[0].size(), 1U);
+    runner.logString("bar");
+    EXPECT_TRUE(runner.memory_[0].empty());
+    runner.logString("baz");
+
+    // The held line is stored when the forwarder stops.
+    runner.interrupt();
+    runner.start();
+    EXPECT_TRUE(runner.memory_[0].empty());
+  }
+
+  // A new forwarder sends the stored lines.
+  StrictMock<MockBufferedLogForwarder> runner("mock_memory_spill");
+  EXPECT_CALL(runner, send(ElementsAre("foo", "bar", "baz"), "result"))
+      .WillOnce(Return(Status(0)));
+  runner.check();
+
+  FLAGS_logger_memory_max = memory_max;
+  FLAGS_logger_memory_buffer = false;
+}
 }
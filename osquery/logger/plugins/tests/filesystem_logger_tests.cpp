@@ -21,6 +21,10 @@ namespace fs = boost::filesystem;
 namespace osquery {
 
 DECLARE_string(logger_path);
+DECLARE_bool(logger_rotate);
+DECLARE_uint64(logger_rotate_size);
+DECLARE_uint64(logger_rotate_max_files);
+DECLARE_bool(logger_rotate_compress);
 
 class FilesystemLoggerTests : public testing::Test {
  public:
@@ -97,4 +101,68 @@ TEST_F(FilesystemLoggerTests, test_log_snapshot) {
       "\"unixTime\":\"0\"}\n";
   EXPECT_EQ(content, expected);
 }
+
+TEST_F(FilesystemLoggerTests, test_filesystem_rotate) {
+  auto rotate_path = fs::path(kTestWorkingDirectory) / "unittests.rotate";
+  fs::remove_all(rotate_path);
+  fs::create_directories(rotate_path);
+  FLAGS_logger_path = rotate_path.string();
+  FLAGS_logger_rotate = true;
+  FLAGS_logger_rotate_size = 16;
+  FLAGS_logger_rotate_max_files = 2;
+
+  auto plugin = Registry::get("logger", "filesystem");
+  ASSERT_TRUE(plugin->setUp());
+
+  // Every write is larger than the rotation size.
+  PluginRequest request = {{"strings", "first line\nsecond line"}};
+  for (size_t i = 0; i < 3; i++) {
+    EXPECT_TRUE(Registry::call("logger", "filesystem", request));
+  }
+
+  std::string content;
+  auto log = (rotate_path / "osqueryd.results.log").string();
+  EXPECT_TRUE(readFile(log, content));
+  EXPECT_EQ(content, "");
+
+  // Only the newest rotated files are kept.
+  auto rotated = [&rotate_path]() {
+    std::vector<std::string> files;
+    for (fs::directory_iterator it(rotate_path), end; it != end; ++it) {
+      if (it->path().filename().string().find("osqueryd.results.log.") == 0) {
+        files.push_back(it->path().string());
+      }
+    }
+    return files;
+  };
+  auto files = rotated();
+  ASSERT_EQ(files.size(), 2U);
+  for (const auto& file : files) {
+    EXPECT_TRUE(readFile(file, content));
+    EXPECT_EQ(content, "first line\nsecond line\n");
+  }
+
+  // Rotated files may be compressed.
+  FLAGS_logger_rotate_compress = true;
+  EXPECT_TRUE(Registry::call("logger", "filesystem", request));
+  files = rotated();
+  EXPECT_EQ(files.size(), 2U);
+  size_t compressed = 0;
+  for (const auto& file : files) {
+    if (file.size() > 3 && file.substr(file.size() - 3) == ".gz") {
+      EXPECT_TRUE(readFile(file, content));
+      ASSERT_GT(content.size(), 2U);
+      EXPECT_EQ(content.substr(0, 2), "\x1f\x8b");
+      compressed++;
+    }
+  }
+  EXPECT_EQ(compressed, 1U);
+
+  FLAGS_logger_rotate = false;
+  FLAGS_logger_rotate_size = 25 * 1024 * 1024;
+  FLAGS_logger_rotate_max_files = 25;
+  FLAGS_logger_rotate_compress = false;
+  SetUp();
+  EXPECT_TRUE(plugin->setUp());
+}
 }
@@ -0,0 +1,72 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <gtest/gtest.h>
+
+#include <osquery/config.h>
+#include <osquery/flags.h>
+
+#include "osquery/logger/plugins/kafka_producer.h"
+
+namespace osquery {
+
+DECLARE_string(logger_kafka_brokers);
+DECLARE_uint64(logger_kafka_timeout);
+
+class KafkaTests : public testing::Test {
+ public:
+  void TearDown() override { Config::getInstance().reset(); }
+};
+
+TEST_F(KafkaTests, test_topics) {
+  std::string line =
+      "{\"snapshot\":[{\"name\":\"launchd\"}],\"name\":\"processes\"}";
+  EXPECT_EQ(KafkaLogForwarder::getTopic(line), FLAGS_logger_kafka_topic);
+
+  // Queries are routed to their topic by the query name, not column names.
+  Config::getInstance().update(
+      {{"kafka_source",
+        "{\"kafka_topics\": {\"process_topic\": [\"processes\"], "
+        "\"launchd_topic\": [\"launchd\"]}}"}});
+  EXPECT_EQ(KafkaLogForwarder::getTopic(line), "process_topic");
+  EXPECT_EQ(KafkaLogForwarder::getTopic("{\"name\":\"launchd\"}"),
+            "launchd_topic");
+
+  // Other queries, and lines that cannot be parsed, use the default topic.
+  EXPECT_EQ(KafkaLogForwarder::getTopic("{\"name\":\"other\"}"),
+            FLAGS_logger_kafka_topic);
+  EXPECT_EQ(KafkaLogForwarder::getTopic("{\"name\":"),
+            FLAGS_logger_kafka_topic);
+}
+
+TEST_F(KafkaTests, test_set_up) {
+  auto brokers = FLAGS_logger_kafka_brokers;
+  FLAGS_logger_kafka_brokers = "";
+  KafkaLogForwarder forwarder;
+  EXPECT_FALSE(forwarder.setUp().ok());
+  FLAGS_logger_kafka_brokers = brokers;
+}
+
+TEST_F(KafkaTests, test_send_undelivered) {
+  auto brokers = FLAGS_logger_kafka_brokers;
+  auto timeout = FLAGS_logger_kafka_timeout;
+  FLAGS_logger_kafka_brokers = "127.0.0.1:1";
+  FLAGS_logger_kafka_timeout = 1;
+
+  // A send fails once its messages time out, the lines are sent again.
+  KafkaLogForwarder forwarder;
+  ASSERT_TRUE(forwarder.setUp().ok());
+  std::vector<std::string> logs{"{\"name\":\"foo\"}", "{\"name\":\"bar\"}"};
+  EXPECT_FALSE(forwarder.send(logs, "result").ok());
+
+  FLAGS_logger_kafka_brokers = brokers;
+  FLAGS_logger_kafka_timeout = timeout;
+}
+}
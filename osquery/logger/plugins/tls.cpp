@@ -16,6 +16,7 @@
 #include <osquery/registry.h>
 
 #include "osquery/remote/serializers/json.h"
+#include "osquery/remote/serializers/msgpack.h"
 #include "osquery/remote/utility.h"
 
 #include "osquery/config/parsers/decorators.h"
@@ -41,6 +42,31 @@ FLAG(uint64,
 
 FLAG(bool, logger_tls_compress, false, "GZip compress TLS/HTTPS request body");
 
+FLAG(string,
+     logger_tls_compression,
+     "",
+     "Compress TLS/HTTPS request bodies using gzip or zstd");
+
+FLAG(uint64,
+     logger_tls_request_bytes,
+     0,
+     "Target bytes of log lines per TLS/HTTPS request (0 = line count only)");
+
+FLAG(uint64,
+     logger_tls_in_flight,
+     1,
+     "Max concurrent TLS/HTTPS log requests");
+
+FLAG(uint64,
+     logger_tls_max_backoff,
+     300,
+     "Max seconds between TLS/HTTPS log flushes while requests fail");
+
+FLAG(string,
+     logger_tls_format,
+     "json",
+     "Serialize TLS/HTTPS log requests as json or msgpack");
+
 REGISTER(TLSLoggerPlugin, "logger", "tls");
 
 TLSLogForwarder::TLSLogForwarder(const std::string& node_key)
@@ -49,12 +75,19 @@ TLSLogForwarder::TLSLogForwarder(const std::string& node_key)
                            kTLSMaxLogLines),
       node_key_(node_key) {
   uri_ = TLSRequestHelper::makeURI(FLAGS_logger_tls_endpoint);
+  max_log_bytes_ = FLAGS_logger_tls_request_bytes;
+  max_in_flight_ = FLAGS_logger_tls_in_flight;
+  max_backoff_ = std::chrono::seconds(FLAGS_logger_tls_max_backoff);
 }
 
 Status TLSLoggerPlugin::logString(const std::string& s) {
   return forwarder_->logString(s);
 }
 
+Status TLSLoggerPlugin::logStrings(const std::vector<std::string>& strings) {
+  return forwarder_->logStrings(strings);
+}
+
 Status TLSLoggerPlugin::logStatus(const std::vector<StatusLogLine>& log) {
   return forwarder_->logStatus(log);
 }
@@ -65,6 +98,12 @@ Status TLSLoggerPlugin::setUp() {
     // Could not generate a node key, continue logging to stderr.
     return Status(1, "No node key, TLS logging disabled.");
   }
+  if (FLAGS_logger_tls_format != "json" &&
+      FLAGS_logger_tls_format != "msgpack") {
+    LOG(WARNING) << "Unknown TLS logger format: " << FLAGS_logger_tls_format
+                 << ", using json";
+  }
+
   // Start the log forwarding/flushing thread.
   forwarder_ = std::make_shared<TLSLogForwarder>(node_key);
   Dispatcher::addService(forwarder_);
@@ -79,6 +118,19 @@ void TLSLoggerPlugin::init(const std::string& name,
   logStatus(log);
 }
 
+/// Send a log request, the serializer selects the request's content type.
+template <class TSerializer>
+static Status sendLogRequest(const std::string& uri, const pt::ptree& params) {
+  auto request = Request<TLSTransport, TSerializer>(uri);
+  request.setOption("hostname", FLAGS_tls_hostname);
+  if (!FLAGS_logger_tls_compression.empty()) {
+    request.setOption("compression", FLAGS_logger_tls_compression);
+  } else if (FLAGS_logger_tls_compress) {
+    request.setOption("compress", true);
+  }
+  return request.call(params);
+}
+
 Status TLSLogForwarder::send(std::vector<std::string>& log_data,
                              const std::string& log_type) {
   pt::ptree params;
@@ -112,11 +164,9 @@ Status TLSLogForwarder::send(std::vector<std::string>& log_data,
     params.add_child("data", std::move(children));
   }
 
-  auto request = Request<TLSTransport, JSONSerializer>(uri_);
-  request.setOption("hostname", FLAGS_tls_hostname);
-  if (FLAGS_logger_tls_compress) {
-    request.setOption("compress", true);
+  if (FLAGS_logger_tls_format == "msgpack") {
+    return sendLogRequest<MessagePackSerializer>(uri_, params);
   }
-  return request.call(params);
+  return sendLogRequest<JSONSerializer>(uri_, params);
 }
 }
@@ -65,6 +65,9 @@ class TLSLoggerPlugin : public LoggerPlugin {
   /// Log a result string. This is the basic catch-all for snapshots and events.
   Status logString(const std::string& s) override;
 
+  /// Log several result strings with one buffered write.
+  Status logStrings(const std::vector<std::string>& strings) override;
+
   /// Log a status (ERROR/WARNING/INFO) message.
   Status logStatus(const std::vector<StatusLogLine>& log) override;
 
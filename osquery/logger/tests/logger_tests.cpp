@@ -15,6 +15,9 @@
 
 namespace osquery {
 
+DECLARE_uint64(logger_status_relay_milli);
+DECLARE_uint64(logger_status_max_rate);
+
 class LoggerTests : public testing::Test {
  public:
   void SetUp() {
@@ -26,6 +29,8 @@ class LoggerTests : public testing::Test {
     log_lines.clear();
     status_messages.clear();
     statuses_logged = 0;
+    status_lines_logged = 0;
+    batches_logged = 0;
     last_status = {O_INFO, "", -1, ""};
   }
 
@@ -38,9 +43,12 @@ class LoggerTests : public testing::Test {
   static StatusLogLine last_status;
   static std::vector<std::string> status_messages;
 
-  // Count calls to logStatus
+  // Count calls to logStatus, and the lines of those calls
   static int statuses_logged;
+  static int status_lines_logged;
   static int events_logged;
+  // Count calls to logStrings
+  static int batches_logged;
   // Count added and removed snapshot rows
   static int snapshot_rows_added;
   static int snapshot_rows_removed;
@@ -54,7 +62,9 @@ std::vector<std::string> LoggerTests::log_lines;
 StatusLogLine LoggerTests::last_status;
 std::vector<std::string> LoggerTests::status_messages;
 int LoggerTests::statuses_logged = 0;
+int LoggerTests::status_lines_logged = 0;
 int LoggerTests::events_logged = 0;
+int LoggerTests::batches_logged = 0;
 int LoggerTests::snapshot_rows_added = 0;
 int LoggerTests::snapshot_rows_removed = 0;
 
@@ -73,6 +83,11 @@ class TestLoggerPlugin : public LoggerPlugin {
     return Status(0, s);
   }
 
+  Status logStrings(const std::vector<std::string>& strings) override {
+    ++LoggerTests::batches_logged;
+    return LoggerPlugin::logStrings(strings);
+  }
+
   void init(const std::string& name,
             const std::vector<StatusLogLine>& log) override {
     for (const auto& status : log) {
@@ -86,6 +101,10 @@ class TestLoggerPlugin : public LoggerPlugin {
 
   Status logStatus(const std::vector<StatusLogLine>& log) override {
     ++LoggerTests::statuses_logged;
+    LoggerTests::status_lines_logged += static_cast<int>(log.size());
+    if (log.size() > 0) {
+      LoggerTests::last_status = log.back();
+    }
     return Status(0, "OK");
   }
 
@@ -169,11 +188,25 @@ TEST_F(LoggerTests, test_feature_request) {
   logger->shouldLogEvent = false;
   logger->shouldLogStatus = false;
   auto status = Registry::call("logger", "test", {{"action", "features"}});
-  EXPECT_EQ(status.getCode(), 0);
+  // Every logger accepts batched strings.
+  EXPECT_EQ(status.getCode(), LOGGER_FEATURE_LOGSTRINGS);
 
   logger->shouldLogStatus = true;
   status = Registry::call("logger", "test", {{"action", "features"}});
-  EXPECT_EQ(status.getCode(), LOGGER_FEATURE_LOGSTATUS);
+  EXPECT_EQ(status.getCode(),
+            LOGGER_FEATURE_LOGSTATUS | LOGGER_FEATURE_LOGSTRINGS);
+}
+
+TEST_F(LoggerTests, test_log_strings) {
+  EXPECT_TRUE(logStrings({"first", "", "third"}, "event", "test"));
+  EXPECT_EQ(LoggerTests::batches_logged, 1);
+  std::vector<std::string> expected = {"first", "", "third"};
+  EXPECT_EQ(LoggerTests::log_lines, expected);
+
+  // A single string is not batched.
+  EXPECT_TRUE(logStrings({"fourth"}, "event", "test"));
+  EXPECT_EQ(LoggerTests::batches_logged, 1);
+  EXPECT_EQ(LoggerTests::log_lines.size(), 4U);
 }
 
 TEST_F(LoggerTests, test_logger_variations) {
@@ -257,6 +290,8 @@ TEST_F(LoggerTests, test_logger_scheduled_query) {
   item.results.removed.push_back({{"test_column", "test_new_value\n"}});
   logQueryLogItem(item);
   ASSERT_EQ(LoggerTests::log_lines.size(), 3U);
+  // The event lines of an item are logged with a single call.
+  EXPECT_EQ(LoggerTests::batches_logged, 1);
 
   // Make sure the JSON output does not have a newline.
   std::string expected =
@@ -265,4 +300,35 @@ TEST_F(LoggerTests, test_logger_scheduled_query) {
       "column\":\"test_new_value\\n\"},\"action\":\"removed\"}";
   EXPECT_EQ(LoggerTests::log_lines.back(), expected);
 }
+
+TEST_F(LoggerTests, test_status_relay) {
+  auto relay_milli = FLAGS_logger_status_relay_milli;
+  auto max_rate = FLAGS_logger_status_max_rate;
+
+  // Forwarded status logs are queued, then relayed as one batch.
+  FLAGS_logger_status_relay_milli = 60000;
+  LOG(WARNING) << "Logger test is generating a relayed status (1)";
+  LOG(WARNING) << "Logger test is generating a relayed status (2)";
+  EXPECT_EQ(LoggerTests::statuses_logged, 0);
+  relayStatusLogs();
+  EXPECT_EQ(LoggerTests::statuses_logged, 1);
+  EXPECT_EQ(LoggerTests::status_lines_logged, 2);
+
+  // Logs beyond the rate limit are dropped, and the drops are reported.
+  FLAGS_logger_status_max_rate = 1;
+  LOG(WARNING) << "Logger test is generating a relayed status (3)";
+  LOG(WARNING) << "Logger test is generating a dropped status (4)";
+  LOG(WARNING) << "Logger test is generating a dropped status (5)";
+  relayStatusLogs();
+  EXPECT_EQ(LoggerTests::statuses_logged, 2);
+  EXPECT_EQ(LoggerTests::status_lines_logged, 4);
+  EXPECT_EQ(LoggerTests::last_status.message, "Dropped 2 status logs");
+
+  // Nothing is relayed while the queue is empty.
+  relayStatusLogs();
+  EXPECT_EQ(LoggerTests::statuses_logged, 2);
+
+  FLAGS_logger_status_max_rate = max_rate;
+  FLAGS_logger_status_relay_milli = relay_milli;
+}
 }
@@ -0,0 +1,88 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <algorithm>
+#include <sstream>
+
+#include <benchmark/benchmark.h>
+
+#include <osquery/flags.h>
+
+#include "osquery/core/allocations.h"
+#include "osquery/sql/sqlite_util.h"
+#include "osquery/tests/test_util.h"
+
+namespace osquery {
+
+DECLARE_bool(disable_caching);
+DECLARE_bool(table_memoize);
+
+/**
+ * @brief Generate a table's rows through SQLite, as a scheduled query would.
+ *
+ * Reports rows per second as items per second. The label holds the rows and
+ * allocations of an average iteration and the most bytes an iteration had
+ * allocated at once, so they are included in the JSON and CSV benchmark
+ * formats. The benchmarks are built with the allocation hooks, see
+ * osquery/core/allocations.h.
+ */
+void benchmarkTable(benchmark::State& state, const std::string& query) {
+  auto dbc = SQLiteDBManager::get();
+  {
+    // Report queries that cannot run, such as tables missing a dependency.
+    QueryData results;
+    auto status = queryInternal(query, results, dbc->db());
+    dbc->clearAffectedTables();
+    if (!status.ok()) {
+      state.SetLabel("error=\"" + status.getMessage() + "\"");
+      while (state.KeepRunning()) {
+      }
+      return;
+    }
+  }
+
+  size_t rows = 0;
+  size_t iterations = 0;
+  unsigned long long allocations = 0;
+  unsigned long long peak = 0;
+  while (state.KeepRunning()) {
+    AllocationScope scope;
+    {
+      QueryData results;
+      queryInternal(query, results, dbc->db());
+      dbc->clearAffectedTables();
+      rows += results.size();
+    }
+
+    allocations += scope.allocations();
+    peak = std::max(peak, scope.peakBytes());
+    iterations++;
+  }
+
+  state.SetItemsProcessed(rows);
+  if (iterations > 0) {
+    std::stringstream label;
+    label << "rows=" << rows / iterations
+          << " allocations=" << allocations / iterations
+          << " peak_bytes=" << peak;
+    state.SetLabel(label.str());
+  }
+}
+}
+
+int main(int argc, char* argv[]) {
+  osquery::initTesting();
+  // Measure the table generators, not the cache of scheduled results.
+  osquery::FLAGS_disable_caching = true;
+  osquery::FLAGS_table_memoize = false;
+  ::benchmark::Initialize(&argc, argv);
+  ::benchmark::RunSpecifiedBenchmarks();
+  return 0;
+}
@@ -8,6 +8,7 @@
  *
  */
 
+#include <chrono>
 #include <cstdlib>
 #include <sstream>
 
@@ -46,6 +47,7 @@ void RegistryHelperCore::remove(const std::string& item_name) {
   for (const auto& alias : removed_aliases) {
     aliases_.erase(alias);
   }
+  RegistryFactory::invalidate();
 }
 
 bool RegistryHelperCore::isInternal(const std::string& item_name) const {
@@ -66,6 +68,7 @@ Status RegistryHelperCore::setActive(const std::string& item_name) {
 
   Status status(0, "OK");
   active_ = item_name;
+  RegistryFactory::invalidate();
   // The active plugin is setup when initialized.
   for (const auto& item : osquery::split(item_name, ",")) {
     if (exists(item, true)) {
@@ -161,6 +164,7 @@ Status RegistryHelperCore::add(const std::string& item_name, bool internal) {
     modules_[item_name] = RegistryFactory::getModule();
   }
 
+  RegistryFactory::invalidate();
   return Status(0, "OK");
 }
 
@@ -209,6 +213,7 @@ Status RegistryHelperCore::addExternal(const RouteUUID& uuid,
     routes_[route.first] = route.second;
     auto status = addExternalPlugin(route.first, route.second);
     external_[route.first] = uuid;
+    RegistryFactory::invalidate();
     if (!status.ok()) {
       return status;
     }
@@ -231,6 +236,7 @@ void RegistryHelperCore::removeExternal(const RouteUUID& uuid) {
     external_.erase(item);
     routes_.erase(item);
   }
+  RegistryFactory::invalidate();
 }
 
 /// Facility method to check if a registry item exists.
@@ -332,11 +338,29 @@ Status RegistryFactory::addBroadcast(const RouteUUID& uuid,
     for (const auto& registry : broadcast) {
       Registry::registry(registry.first)->removeExternal(uuid);
     }
+  } else {
+    self.broadcasts_++;
+    self.broadcast_added_.notify_all();
   }
   self.extensions_.insert(uuid);
   return status;
 }
 
+size_t RegistryFactory::broadcasts() {
+  auto& self = instance();
+  WriteLock lock(self.mutex_);
+  return self.broadcasts_;
+}
+
+bool RegistryFactory::waitForBroadcast(size_t seen, size_t timeout) {
+  auto& self = instance();
+  std::unique_lock<Mutex> lock(self.mutex_);
+  return self.broadcast_added_.wait_for(
+      lock, std::chrono::milliseconds(timeout), [&self, seen]() {
+        return self.broadcasts_ != seen;
+      });
+}
+
 Status RegistryFactory::removeBroadcast(const RouteUUID& uuid) {
   auto& self = instance();
   WriteLock lock(self.mutex_);
@@ -371,21 +395,13 @@ const std::string& RegistryFactory::getAlias(const std::string& registry_name,
   return instance().registries_.at(registry_name)->getAlias(alias);
 }
 
-Status RegistryFactory::call(const std::string& registry_name,
-                             const std::string& item_name,
-                             const PluginRequest& request,
-                             PluginResponse& response) {
-  // Forward factory call to the registry.
+/// Call a plugin, logging and optionally allowing plugin exceptions.
+template <typename Function>
+static Status callPlugin(const std::string& registry_name,
+                         const std::string& item_name,
+                         Function function) {
   try {
-    if (item_name.find(",") != std::string::npos) {
-      // Call is multiplexing plugins (usually for multiple loggers).
-      for (const auto& item : osquery::split(item_name, ",")) {
-        registry(registry_name)->call(item, request, response);
-      }
-      // All multiplexed items are called without regard for statuses.
-      return Status(0);
-    }
-    return registry(registry_name)->call(item_name, request, response);
+    return function();
   } catch (const std::exception& e) {
     LOG(ERROR) << registry_name << " registry " << item_name
                << " plugin caused exception: " << e.what();
@@ -403,6 +419,110 @@ Status RegistryFactory::call(const std::string& registry_name,
   }
 }
 
+std::shared_ptr<const RegistryHandle::Resolved> RegistryHandle::resolve()
+    const {
+  auto resolved = std::atomic_load(&resolved_);
+  // Read the generation first, a concurrent change resolves again later.
+  auto generation = RegistryFactory::generation();
+  if (resolved != nullptr && resolved->generation == generation) {
+    return resolved;
+  }
+
+  auto next = std::make_shared<Resolved>();
+  next->generation = generation;
+  next->registry = RegistryFactory::registry(registry_name_);
+  const auto& registry = *next->registry;
+  const auto& item_name = (active_) ? registry.getActive() : item_name_;
+  next->multiplex = (item_name.find(",") != std::string::npos);
+  auto names = (next->multiplex) ? osquery::split(item_name, ",")
+                                 : std::vector<std::string>{item_name};
+  for (auto& name : names) {
+    RegistryItem item;
+    auto plugin = registry.items_.find(name);
+    if (plugin != registry.items_.end()) {
+      item.plugin = plugin->second;
+    }
+    auto external = registry.external_.find(name);
+    if (external != registry.external_.end()) {
+      item.uuid = external->second;
+    }
+    item.name = std::move(name);
+    next->items.push_back(std::move(item));
+  }
+
+  std::atomic_store(&resolved_, std::shared_ptr<const Resolved>(next));
+  return next;
+}
+
+Status RegistryHandle::call(const RegistryItem& item,
+                            const PluginRequest& request,
+                            PluginResponse& response) const {
+  return callPlugin(registry_name_, item.name, [&]() -> Status {
+    if (item.plugin != nullptr) {
+      return item.plugin->call(request, response);
+    }
+    // Extension plugins and routes are found by the registry.
+    return resolve()->registry->call(item.name, request, response);
+  });
+}
+
+Status RegistryHandle::call(const PluginRequest& request,
+                            PluginResponse& response) const {
+  const auto& item_name = (active_) ? "active" : item_name_;
+  return callPlugin(registry_name_, item_name, [&]() -> Status {
+    auto resolved = resolve();
+    if (resolved->multiplex) {
+      // Call is multiplexing plugins (usually for multiple loggers).
+      for (const auto& item : resolved->items) {
+        if (item.plugin != nullptr) {
+          item.plugin->call(request, response);
+        } else {
+          resolved->registry->call(item.name, request, response);
+        }
+      }
+      // All multiplexed items are called without regard for statuses.
+      return Status(0);
+    }
+
+    const auto& item = resolved->items[0];
+    if (item.plugin != nullptr) {
+      return item.plugin->call(request, response);
+    }
+    return resolved->registry->call(item.name, request, response);
+  });
+}
+
+Status RegistryHandle::call(const PluginRequest& request) const {
+  PluginResponse response;
+  return call(request, response);
+}
+
+std::vector<RegistryItem> RegistryHandle::items() const {
+  return resolve()->items;
+}
+
+void RegistryHandle::reset() {
+  std::atomic_store(&resolved_, std::shared_ptr<const Resolved>());
+}
+
+Status RegistryFactory::call(const std::string& registry_name,
+                             const std::string& item_name,
+                             const PluginRequest& request,
+                             PluginResponse& response) {
+  // Forward factory call to the registry.
+  return callPlugin(registry_name, item_name, [&]() -> Status {
+    if (item_name.find(",") != std::string::npos) {
+      // Call is multiplexing plugins (usually for multiple loggers).
+      for (const auto& item : osquery::split(item_name, ",")) {
+        registry(registry_name)->call(item, request, response);
+      }
+      // All multiplexed items are called without regard for statuses.
+      return Status(0);
+    }
+    return registry(registry_name)->call(item_name, request, response);
+  });
+}
+
 Status RegistryFactory::call(const std::string& registry_name,
                              const std::string& item_name,
                              const PluginRequest& request) {
@@ -427,20 +547,96 @@ Status RegistryFactory::call(const std::string& registry_name,
 Status RegistryFactory::callTable(const std::string& table_name,
                                   QueryContext& context,
                                   PluginResponse& response) {
-  auto& tables = registry("table")->items_;
+  return callTable(RegistryHandle("table", table_name), context, response);
+}
+
+Status RegistryFactory::callTable(const std::string& table_name,
+                                  QueryContext& context,
+                                  ColumnarData& results) {
+  return callTable(RegistryHandle("table", table_name), context, results);
+}
+
+Status RegistryFactory::callTable(const std::string& table_name,
+                                  QueryContext& context,
+                                  std::unique_ptr<RowGenerator>& generator) {
+  return callTable(RegistryHandle("table", table_name), context, generator);
+}
+
+Status RegistryFactory::callTable(const std::string& table_name,
+                                  QueryContext& context,
+                                  std::unique_ptr<ColumnarGenerator>& batches) {
+  return callTable(RegistryHandle("table", table_name), context, batches);
+}
+
+Status RegistryFactory::callTable(const RegistryHandle& table,
+                                  QueryContext& context,
+                                  PluginResponse& response) {
   // This only works for local tables.
-  if (tables.count(table_name) > 0) {
-    auto plugin = std::dynamic_pointer_cast<TablePlugin>(tables.at(table_name));
-    response = plugin->generate(context);
+  auto plugin = table.get<TablePlugin>();
+  if (plugin != nullptr) {
+    response = plugin->generateRows(context);
     return Status(0);
   } else {
     // If the table is not local then it does not benefit from complex contexts.
     PluginRequest request = {{"action", "generate"}};
     TablePlugin::setRequestFromContext(context, request);
-    return call("table", table_name, request, response);
+    return table.call(request, response);
   }
 }
 
+Status RegistryFactory::callTable(const RegistryHandle& table,
+                                  QueryContext& context,
+                                  ColumnarData& results) {
+  auto plugin = table.get<TablePlugin>();
+  if (plugin != nullptr) {
+    if (plugin->usesColumnarData()) {
+      results = ColumnarData(plugin->columns());
+      plugin->generateColumns(context, results);
+      return Status(0);
+    }
+    return Status(1, "Table does not generate columnar data");
+  }
+
+  // Extension tables may return typed columns instead of rows.
+  auto items = table.items();
+  if (items.size() == 1 && items[0].uuid != 0) {
+    PluginRequest request = {{"action", "generate"}};
+    TablePlugin::setRequestFromContext(context, request);
+    return callExtensionColumns(
+        items[0].uuid, items[0].name, request, results);
+  }
+  return Status(1, "Table does not generate columnar data");
+}
+
+Status RegistryFactory::callTable(const RegistryHandle& table,
+                                  QueryContext& context,
+                                  std::unique_ptr<RowGenerator>& generator) {
+  auto plugin = table.get<TablePlugin>();
+  if (plugin != nullptr && plugin->usesGenerator()) {
+    generator = plugin->generator(context);
+    return Status(0);
+  }
+  return Status(1, "Table does not use a generator");
+}
+
+Status RegistryFactory::callTable(const RegistryHandle& table,
+                                  QueryContext& context,
+                                  std::unique_ptr<ColumnarGenerator>& batches) {
+  auto items = table.items();
+  if (items.size() == 1 && items[0].uuid != 0) {
+    PluginRequest request = {{"action", "generate"}};
+    TablePlugin::setRequestFromContext(context, request);
+    return callExtensionCursor(items[0].uuid, items[0].name, request, batches);
+  }
+  return Status(1, "Table does not stream batches");
+}
+
+bool RegistryFactory::generatesRows(const RegistryHandle& table) {
+  auto plugin = table.get<TablePlugin>();
+  return plugin != nullptr && !plugin->usesColumnarData() &&
+         !plugin->usesGenerator();
+}
+
 Status RegistryFactory::setActive(const std::string& registry_name,
                                   const std::string& item_name) {
   return registry(registry_name)->setActive(item_name);
@@ -8,6 +8,9 @@
  *
  */
 
+#include <chrono>
+#include <thread>
+
 #include <gtest/gtest.h>
 
 #include <osquery/logger.h>
@@ -216,6 +219,67 @@ TEST_F(RegistryTests, test_registry_api) {
   EXPECT_EQ(response[0].at("secret_power"), "magic");
 }
 
+TEST_F(RegistryTests, test_registry_handle) {
+  auto AutoHandleRegistry = TestCoreRegistry::create<WidgetPlugin>("handles");
+  UNUSED(AutoHandleRegistry);
+  TestCoreRegistry::add<SpecialWidget>("handles", "first");
+
+  RegistryHandle first("handles", "first");
+  PluginResponse response;
+  EXPECT_TRUE(first.call({{"secret_power", "magic"}}, response).ok());
+  ASSERT_EQ(response.size(), 1U);
+  EXPECT_EQ(response[0].at("from"), "first");
+  EXPECT_EQ(first.get<WidgetPlugin>(),
+            TestCoreRegistry::get("handles", "first"));
+
+  // A plugin added after the handle resolved is found.
+  RegistryHandle both("handles", "first,second");
+  EXPECT_EQ(both.items().size(), 2U);
+  EXPECT_EQ(both.items()[1].plugin, nullptr);
+  EXPECT_EQ(both.get<WidgetPlugin>(), nullptr);
+  TestCoreRegistry::add<SpecialWidget>("handles", "second");
+  ASSERT_EQ(both.items().size(), 2U);
+  EXPECT_NE(both.items()[1].plugin, nullptr);
+
+  // Multiplexed plugins are each called.
+  response.clear();
+  EXPECT_TRUE(both.call({}, response).ok());
+  EXPECT_EQ(response.size(), 2U);
+
+  // The active handle follows the active plugin.
+  RegistryHandle active("handles");
+  EXPECT_TRUE(TestCoreRegistry::setActive("handles", "first").ok());
+  EXPECT_EQ(active.get<WidgetPlugin>(),
+            TestCoreRegistry::get("handles", "first"));
+  EXPECT_TRUE(TestCoreRegistry::setActive("handles", "second").ok());
+  EXPECT_EQ(active.get<WidgetPlugin>(),
+            TestCoreRegistry::get("handles", "second"));
+
+  // A removed plugin is released.
+  TestCoreRegistry::registry("handles")->remove("first");
+  EXPECT_EQ(first.get<WidgetPlugin>(), nullptr);
+  EXPECT_FALSE(first.call({}, response).ok());
+}
+
+TEST_F(RegistryTests, test_wait_for_broadcast) {
+  // Without a new broadcast the wait times out.
+  auto seen = Registry::broadcasts();
+  EXPECT_FALSE(Registry::waitForBroadcast(seen, 10));
+
+  // A broadcast added while waiting wakes the waiter.
+  std::thread adder([]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    Registry::addBroadcast(9091, RegistryBroadcast());
+  });
+  EXPECT_TRUE(Registry::waitForBroadcast(seen, 5000));
+  adder.join();
+  EXPECT_EQ(Registry::broadcasts(), seen + 1);
+
+  // A broadcast added before waiting is not waited for.
+  EXPECT_TRUE(Registry::waitForBroadcast(seen, 5000));
+  Registry::removeBroadcast(9091);
+}
+
 TEST_F(RegistryTests, test_real_registry) {
   EXPECT_TRUE(Registry::count() > 0U);
 
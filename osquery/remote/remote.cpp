@@ -10,51 +10,181 @@
 
 #include <string>
 #include <cstring>
+#include <mutex>
 
 #include <zlib.h>
+#include <zstd.h>
+
+#include <osquery/flags.h>
+
+#include "osquery/core/conversions.h"
+#include "osquery/remote/requests.h"
 
 namespace osquery {
 
 #define MOD_GZIP_ZLIB_WINDOWSIZE 15
 #define MOD_GZIP_ZLIB_CFACTOR 9
 
-std::string compressString(const std::string& data) {
-  z_stream zs;
-  memset(&zs, 0, sizeof(zs));
+/// The size of the uncompressed input buffered before compressing.
+const size_t kCompressionBufferSize = 16384;
+
+/// The zstd level, favoring speed as payloads are compressed while sent.
+const int kZstdCompressionLevel = 3;
+
+FLAG(string,
+     tls_compression_dictionary,
+     "",
+     "Base64-encoded zstd dictionary for compressed TLS request bodies");
 
-  if (deflateInit2(&zs,
-                   Z_BEST_COMPRESSION,
-                   Z_DEFLATED,
-                   MOD_GZIP_ZLIB_WINDOWSIZE + 16,
-                   MOD_GZIP_ZLIB_CFACTOR,
-                   Z_DEFAULT_STRATEGY) != Z_OK) {
-    return std::string();
+/// Decoded dictionary for the configured tls_compression_dictionary.
+static std::mutex kDictionaryMutex;
+static std::string kDictionaryEncoded;
+static std::string kDictionary;
+
+std::string getCompressionDictionary(const std::string& encoding) {
+  if (encoding != "zstd" || FLAGS_tls_compression_dictionary.empty()) {
+    return "";
   }
 
-  zs.next_in = (Bytef*)data.data();
-  zs.avail_in = data.size();
+  // The option may be updated by the config, decode once for each value.
+  std::lock_guard<std::mutex> lock(kDictionaryMutex);
+  if (kDictionaryEncoded != FLAGS_tls_compression_dictionary) {
+    kDictionaryEncoded = FLAGS_tls_compression_dictionary;
+    kDictionary = base64Decode(kDictionaryEncoded);
+  }
+  return kDictionary;
+}
 
-  int ret = Z_OK;
-  std::string output;
+CompressionStreamBuffer::CompressionStreamBuffer(const std::string& encoding,
+                                                 std::string& output,
+                                                 const std::string& dictionary)
+    : encoding_(encoding),
+      output_(output),
+      input_(kCompressionBufferSize),
+      chunk_(kCompressionBufferSize) {
+  if (encoding_ == "gzip") {
+    zlib_ = new z_stream();
+    memset(zlib_, 0, sizeof(z_stream));
+    valid_ = (deflateInit2(zlib_,
+                           Z_BEST_COMPRESSION,
+                           Z_DEFLATED,
+                           MOD_GZIP_ZLIB_WINDOWSIZE + 16,
+                           MOD_GZIP_ZLIB_CFACTOR,
+                           Z_DEFAULT_STRATEGY) == Z_OK);
+  } else if (encoding_ == "zstd") {
+    auto stream = ZSTD_createCStream();
+    zstd_ = stream;
+    if (stream != nullptr) {
+      auto ret = (dictionary.empty())
+                     ? ZSTD_initCStream(stream, kZstdCompressionLevel)
+                     : ZSTD_initCStream_usingDict(stream,
+                                                  dictionary.data(),
+                                                  dictionary.size(),
+                                                  kZstdCompressionLevel);
+      valid_ = !ZSTD_isError(ret);
+    }
+  }
 
-  {
-    char buffer[16384] = {0};
-    while (ret == Z_OK) {
-      zs.next_out = reinterpret_cast<Bytef*>(buffer);
-      zs.avail_out = sizeof(output);
-
-      ret = deflate(&zs, Z_FINISH);
-      if (output.size() < zs.total_out) {
-        output.append(buffer, zs.total_out - output.size());
+  setp(input_.data(), input_.data() + input_.size());
+}
+
+CompressionStreamBuffer::~CompressionStreamBuffer() {
+  if (zlib_ != nullptr) {
+    deflateEnd(zlib_);
+    delete zlib_;
+  }
+
+  if (zstd_ != nullptr) {
+    ZSTD_freeCStream(static_cast<ZSTD_CStream*>(zstd_));
+  }
+}
+
+CompressionStreamBuffer::int_type CompressionStreamBuffer::overflow(
+    int_type c) {
+  if (!compress(false)) {
+    return traits_type::eof();
+  }
+
+  if (!traits_type::eq_int_type(c, traits_type::eof())) {
+    *pptr() = traits_type::to_char_type(c);
+    pbump(1);
+  }
+  return traits_type::not_eof(c);
+}
+
+bool CompressionStreamBuffer::compress(bool finish) {
+  if (!valid_ || finished_) {
+    return false;
+  }
+
+  auto size = static_cast<size_t>(pptr() - pbase());
+  if (zlib_ != nullptr) {
+    zlib_->next_in = reinterpret_cast<Bytef*>(pbase());
+    zlib_->avail_in = static_cast<uInt>(size);
+    int ret = Z_OK;
+    do {
+      zlib_->next_out = reinterpret_cast<Bytef*>(chunk_.data());
+      zlib_->avail_out = static_cast<uInt>(chunk_.size());
+      ret = deflate(zlib_, (finish) ? Z_FINISH : Z_NO_FLUSH);
+      if (ret == Z_STREAM_ERROR) {
+        valid_ = false;
+        return false;
+      }
+      output_.append(chunk_.data(), chunk_.size() - zlib_->avail_out);
+    } while (zlib_->avail_out == 0 || (finish && ret != Z_STREAM_END));
+  } else {
+    auto stream = static_cast<ZSTD_CStream*>(zstd_);
+    ZSTD_inBuffer in = {pbase(), size, 0};
+    while (in.pos < in.size) {
+      ZSTD_outBuffer out = {chunk_.data(), chunk_.size(), 0};
+      auto ret = ZSTD_compressStream(stream, &out, &in);
+      if (ZSTD_isError(ret)) {
+        valid_ = false;
+        return false;
       }
+      output_.append(chunk_.data(), out.pos);
     }
+
+    size_t remaining = 0;
+    do {
+      if (!finish) {
+        break;
+      }
+      ZSTD_outBuffer out = {chunk_.data(), chunk_.size(), 0};
+      remaining = ZSTD_endStream(stream, &out);
+      if (ZSTD_isError(remaining)) {
+        valid_ = false;
+        return false;
+      }
+      output_.append(chunk_.data(), out.pos);
+    } while (remaining > 0);
   }
 
-  deflateEnd(&zs);
-  if (ret != Z_STREAM_END) {
-    return std::string();
+  setp(input_.data(), input_.data() + input_.size());
+  finished_ = finish;
+  return true;
+}
+
+Status CompressionStreamBuffer::finish() {
+  if (!valid_) {
+    return Status(1, "Cannot compress using encoding: " + encoding_);
   }
 
+  if (!compress(true)) {
+    return Status(1, "Failed to compress using encoding: " + encoding_);
+  }
+  return Status(0, "OK");
+}
+
+std::string compressString(const std::string& data) {
+  std::string output;
+  {
+    CompressionStreamBuffer buffer("gzip", output);
+    buffer.sputn(data.data(), data.size());
+    if (!buffer.finish().ok()) {
+      return std::string();
+    }
+  }
   return output;
 }
 }
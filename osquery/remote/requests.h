@@ -11,9 +11,13 @@
 #pragma once
 
 #include <memory>
+#include <ostream>
+#include <streambuf>
 #include <utility>
 #include <string>
+#include <vector>
 
+#include <boost/noncopyable.hpp>
 #include <boost/property_tree/ptree.hpp>
 
 #include <osquery/logger.h>
@@ -34,6 +38,62 @@ class Serializer;
  */
 std::string compressString(const std::string& data);
 
+/**
+ * @brief A stream buffer compressing everything written through it.
+ *
+ * Serializers write into an ostream using this buffer, the payload is
+ * compressed as it is serialized and the uncompressed payload is never held
+ * in memory. The encoding is either gzip or zstd, zstd may use a dictionary
+ * trained on the repetitive result and status logs.
+ */
+class CompressionStreamBuffer : public std::streambuf,
+                                private boost::noncopyable {
+ public:
+  /**
+   * @brief Create a compressing stream buffer.
+   *
+   * @param encoding The HTTP content encoding, gzip or zstd.
+   * @param output The compressed output, appended as input is written.
+   * @param dictionary An optional zstd dictionary.
+   */
+  CompressionStreamBuffer(const std::string& encoding,
+                          std::string& output,
+                          const std::string& dictionary = "");
+
+  ~CompressionStreamBuffer() override;
+
+  /// Compress the remaining input and end the compressed stream.
+  Status finish();
+
+ protected:
+  /// Compress the full input buffer.
+  int_type overflow(int_type c) override;
+
+ private:
+  /// Compress the buffered input, optionally ending the stream.
+  bool compress(bool finish);
+
+ private:
+  std::string encoding_;
+
+  /// The compressed output.
+  std::string& output_;
+
+  /// Input buffered before compressing, and compressed output chunks.
+  std::vector<char> input_;
+  std::vector<char> chunk_;
+
+  /// The gzip (zlib) or zstd stream.
+  struct z_stream_s* zlib_{nullptr};
+  void* zstd_{nullptr};
+
+  bool valid_{false};
+  bool finished_{false};
+};
+
+/// The zstd dictionary configured for request bodies, if any.
+std::string getCompressionDictionary(const std::string& encoding);
+
 /**
  * @brief Abstract base class for remote transport implementations
  *
@@ -156,6 +216,26 @@ class Serializer {
   virtual Status serialize(const boost::property_tree::ptree& params,
                            std::string& serialized) = 0;
 
+  /**
+   * @brief Serialize a property tree into a stream
+   *
+   * Serializers able to write incrementally should override this, such as
+   * into a compressing stream. The default serializes into a string.
+   *
+   * @param params A property tree of parameters
+   * @param output the output stream
+   * @return success or failure of the operation
+   */
+  virtual Status serializeStream(const boost::property_tree::ptree& params,
+                                 std::ostream& output) {
+    std::string serialized;
+    auto s = serialize(params, serialized);
+    if (s.ok()) {
+      output.write(serialized.data(), serialized.size());
+    }
+    return s;
+  }
+
   /**
    * @brief Deserialize a property tree into a property tree
    *
@@ -227,13 +307,36 @@ class Request {
    * @return success or failure of the operation
    */
   Status call(const boost::property_tree::ptree& params) {
-    std::string serialized;
-    auto s = serializer_->serialize(params, serialized);
-    if (!s.ok()) {
-      return s;
+    auto compression = options_.get<std::string>("compression", "");
+    if (compression.empty() && options_.get("compress", false)) {
+      compression = "gzip";
+    }
+
+    if (compression.empty()) {
+      std::string serialized;
+      auto s = serializer_->serialize(params, serialized);
+      if (!s.ok()) {
+        return s;
+      }
+      return transport_->sendRequest(serialized, false);
     }
 
-    return transport_->sendRequest(serialized, options_.get("compress", false));
+    // Compress while serializing, the transport receives the encoded body.
+    std::string compressed;
+    {
+      CompressionStreamBuffer buffer(
+          compression, compressed, getCompressionDictionary(compression));
+      std::ostream output(&buffer);
+      auto s = serializer_->serializeStream(params, output);
+      if (s.ok()) {
+        s = buffer.finish();
+      }
+      if (!s.ok()) {
+        return s;
+      }
+    }
+    transport_->setOption("content_encoding", compression);
+    return transport_->sendRequest(compressed, false);
   }
 
   /**
@@ -28,6 +28,17 @@ Status JSONSerializer::serialize(const pt::ptree& params,
   return Status(0, "OK");
 }
 
+Status JSONSerializer::serializeStream(const pt::ptree& params,
+                                       std::ostream& output) {
+  try {
+    pt::write_json(output, params, false);
+  } catch (const pt::json_parser::json_parser_error& e) {
+    return Status(1, std::string("JSON serialize error: ") + e.what());
+  }
+  return (output.good()) ? Status(0, "OK")
+                         : Status(1, "JSON serialize error: stream failed");
+}
+
 Status JSONSerializer::deserialize(const std::string& serialized,
                                    pt::ptree& params) {
   if (serialized.empty()) {
@@ -32,6 +32,19 @@ class JSONSerializer : public Serializer {
   Status serialize(const boost::property_tree::ptree& params,
                    std::string& serialized);
 
+  /**
+   * @brief Serialize a property tree into a stream, as it is written
+   *
+   * @param params A property tree of parameters
+   *
+   * @param output The stream to write the serialized params into
+   *
+   * @return An instance of osquery::Status indicating the success or failure
+   * of the operation
+   */
+  Status serializeStream(const boost::property_tree::ptree& params,
+                         std::ostream& output) override;
+
   /**
    * @brief Deerialize a property tree into a property tree
    *
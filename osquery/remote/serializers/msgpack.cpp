@@ -0,0 +1,307 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <cstring>
+#include <sstream>
+
+#include "osquery/remote/serializers/msgpack.h"
+
+namespace pt = boost::property_tree;
+
+namespace osquery {
+
+/// Nested maps and arrays deeper than this are not deserialized.
+const size_t kMessagePackMaxDepth = 128;
+
+/// Write a type byte followed by a big-endian length or value.
+static void writeHeader(std::ostream& output,
+                        unsigned char type,
+                        uint64_t value,
+                        size_t bytes) {
+  char header[9];
+  header[0] = static_cast<char>(type);
+  for (size_t i = 0; i < bytes; i++) {
+    header[bytes - i] = static_cast<char>((value >> (i * 8)) & 0xFF);
+  }
+  output.write(header, bytes + 1);
+}
+
+/// Write the header of a string, array (0x90), or map (0x80).
+static void writeLength(std::ostream& output,
+                        unsigned char fixed,
+                        size_t fixed_max,
+                        unsigned char sized,
+                        bool has_8bit,
+                        size_t length) {
+  if (length < fixed_max) {
+    writeHeader(output, fixed | static_cast<unsigned char>(length), 0, 0);
+  } else if (has_8bit && length <= 0xFF) {
+    writeHeader(output, sized, length, 1);
+  } else if (length <= 0xFFFF) {
+    writeHeader(output, sized + ((has_8bit) ? 1 : 0), length, 2);
+  } else {
+    writeHeader(output, sized + ((has_8bit) ? 2 : 1), length, 4);
+  }
+}
+
+static void writeString(std::ostream& output, const std::string& value) {
+  writeLength(output, 0xa0, 32, 0xd9, true, value.size());
+  output.write(value.data(), value.size());
+}
+
+static void writeTree(std::ostream& output, const pt::ptree& tree) {
+  if (tree.empty()) {
+    writeString(output, tree.data());
+    return;
+  }
+
+  // As with JSON, a node with unnamed children is an array.
+  bool array = true;
+  for (const auto& child : tree) {
+    if (!child.first.empty()) {
+      array = false;
+      break;
+    }
+  }
+
+  if (array) {
+    writeLength(output, 0x90, 16, 0xdc, false, tree.size());
+  } else {
+    writeLength(output, 0x80, 16, 0xde, false, tree.size());
+  }
+  for (const auto& child : tree) {
+    if (!array) {
+      writeString(output, child.first);
+    }
+    writeTree(output, child.second);
+  }
+}
+
+Status MessagePackSerializer::serialize(const pt::ptree& params,
+                                        std::string& serialized) {
+  std::ostringstream output;
+  auto s = serializeStream(params, output);
+  if (s.ok()) {
+    serialized = output.str();
+  }
+  return s;
+}
+
+Status MessagePackSerializer::serializeStream(const pt::ptree& params,
+                                              std::ostream& output) {
+  writeTree(output, params);
+  return (output.good())
+             ? Status(0, "OK")
+             : Status(1, "MessagePack serialize error: stream failed");
+}
+
+namespace {
+
+/// A bounds-checked reader of a serialized MessagePack document.
+class MessagePackReader {
+ public:
+  explicit MessagePackReader(const std::string& serialized)
+      : data_(serialized.data()), size_(serialized.size()) {}
+
+  /// Read one value, and its children, into a node.
+  Status read(pt::ptree& node, size_t depth);
+
+  /// True if every byte was read.
+  bool done() const { return offset_ == size_; }
+
+ private:
+  bool readBytes(size_t count, const char*& bytes);
+  bool readUnsigned(size_t bytes, uint64_t& value);
+  Status readString(size_t length, std::string& value);
+  Status readKey(std::string& key, size_t depth);
+  Status readItems(pt::ptree& node, size_t count, bool map, size_t depth);
+
+ private:
+  const char* data_;
+  size_t size_;
+  size_t offset_{0};
+};
+
+bool MessagePackReader::readBytes(size_t count, const char*& bytes) {
+  if (count > size_ - offset_) {
+    return false;
+  }
+  bytes = data_ + offset_;
+  offset_ += count;
+  return true;
+}
+
+bool MessagePackReader::readUnsigned(size_t bytes, uint64_t& value) {
+  const char* input = nullptr;
+  if (!readBytes(bytes, input)) {
+    return false;
+  }
+
+  value = 0;
+  for (size_t i = 0; i < bytes; i++) {
+    value = (value << 8) | static_cast<unsigned char>(input[i]);
+  }
+  return true;
+}
+
+Status MessagePackReader::readString(size_t length, std::string& value) {
+  const char* input = nullptr;
+  if (!readBytes(length, input)) {
+    return Status(1, "MessagePack deserialize error: truncated string");
+  }
+  value.assign(input, length);
+  return Status(0, "OK");
+}
+
+Status MessagePackReader::readKey(std::string& key, size_t depth) {
+  if (offset_ < size_) {
+    // Most keys are short strings, read them without a temporary node.
+    auto type = static_cast<unsigned char>(data_[offset_]);
+    if (type >= 0xa0 && type <= 0xbf) {
+      offset_++;
+      return readString(type & 0x1f, key);
+    }
+  }
+
+  // Otherwise keys are scalars, such as integers, used as their spelling.
+  pt::ptree key_node;
+  auto s = read(key_node, depth);
+  if (s.ok() && !key_node.empty()) {
+    return Status(1, "MessagePack deserialize error: invalid map key");
+  }
+  key = std::move(key_node.data());
+  return s;
+}
+
+Status MessagePackReader::readItems(pt::ptree& node,
+                                    size_t count,
+                                    bool map,
+                                    size_t depth) {
+  if (depth >= kMessagePackMaxDepth) {
+    return Status(1, "MessagePack deserialize error: nested too deeply");
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    std::string key;
+    if (map) {
+      auto s = readKey(key, depth + 1);
+      if (!s.ok()) {
+        return s;
+      }
+    }
+
+    // The child is read in place, trees are costly to move.
+    auto child = node.push_back(std::make_pair(std::move(key), pt::ptree()));
+    auto s = read(child->second, depth + 1);
+    if (!s.ok()) {
+      return s;
+    }
+  }
+  return Status(0, "OK");
+}
+
+Status MessagePackReader::read(pt::ptree& node, size_t depth) {
+  uint64_t type = 0;
+  if (!readUnsigned(1, type)) {
+    return Status(1, "MessagePack deserialize error: truncated input");
+  }
+
+  uint64_t value = 0;
+  if (type <= 0x7f) {
+    node.data() = std::to_string(type);
+  } else if (type >= 0xe0) {
+    node.data() = std::to_string(static_cast<int>(type) - 0x100);
+  } else if (type <= 0x8f) {
+    return readItems(node, type & 0x0f, true, depth);
+  } else if (type <= 0x9f) {
+    return readItems(node, type & 0x0f, false, depth);
+  } else if (type <= 0xbf) {
+    return readString(type & 0x1f, node.data());
+  } else if (type == 0xc0) {
+    node.data() = "null";
+  } else if (type == 0xc2 || type == 0xc3) {
+    node.data() = (type == 0xc3) ? "true" : "false";
+  } else if (type >= 0xc4 && type <= 0xc6) {
+    // Binary values are kept as their bytes.
+    if (!readUnsigned(size_t(1) << (type - 0xc4), value)) {
+      return Status(1, "MessagePack deserialize error: truncated input");
+    }
+    return readString(value, node.data());
+  } else if (type == 0xca || type == 0xcb) {
+    if (!readUnsigned((type == 0xca) ? 4 : 8, value)) {
+      return Status(1, "MessagePack deserialize error: truncated input");
+    }
+
+    std::ostringstream number;
+    number.precision((type == 0xca) ? 9 : 17);
+    if (type == 0xca) {
+      auto bits = static_cast<uint32_t>(value);
+      float real;
+      memcpy(&real, &bits, sizeof(real));
+      number << real;
+    } else {
+      double real;
+      memcpy(&real, &value, sizeof(real));
+      number << real;
+    }
+    node.data() = number.str();
+  } else if (type >= 0xcc && type <= 0xcf) {
+    if (!readUnsigned(size_t(1) << (type - 0xcc), value)) {
+      return Status(1, "MessagePack deserialize error: truncated input");
+    }
+    node.data() = std::to_string(value);
+  } else if (type >= 0xd0 && type <= 0xd3) {
+    auto bytes = size_t(1) << (type - 0xd0);
+    if (!readUnsigned(bytes, value)) {
+      return Status(1, "MessagePack deserialize error: truncated input");
+    }
+
+    // Sign extend the value from its encoded width.
+    auto shift = 64 - bytes * 8;
+    auto signed_value =
+        static_cast<int64_t>(value << shift) >> static_cast<int>(shift);
+    node.data() = std::to_string(signed_value);
+  } else if (type >= 0xd9 && type <= 0xdb) {
+    if (!readUnsigned(size_t(1) << (type - 0xd9), value)) {
+      return Status(1, "MessagePack deserialize error: truncated input");
+    }
+    return readString(value, node.data());
+  } else if (type == 0xdc || type == 0xdd || type == 0xde || type == 0xdf) {
+    if (!readUnsigned((type == 0xdc || type == 0xde) ? 2 : 4, value)) {
+      return Status(1, "MessagePack deserialize error: truncated input");
+    }
+    return readItems(node, value, type >= 0xde, depth);
+  } else {
+    // Extension types, and the unused 0xc1, have no tree representation.
+    return Status(1, "MessagePack deserialize error: unsupported type");
+  }
+  return Status(0, "OK");
+}
+}
+
+Status MessagePackSerializer::deserialize(const std::string& serialized,
+                                          pt::ptree& params) {
+  params = pt::ptree();
+  if (serialized.empty()) {
+    // As with JSON, an endpoint may accept a payload without responding.
+    return Status(0, "OK");
+  }
+
+  MessagePackReader reader(serialized);
+  auto s = reader.read(params, 0);
+  if (s.ok() && !reader.done()) {
+    s = Status(1, "MessagePack deserialize error: trailing input");
+  }
+  if (!s.ok()) {
+    params = pt::ptree();
+  }
+  return s;
+}
+}
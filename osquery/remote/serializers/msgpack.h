@@ -0,0 +1,78 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include "osquery/remote/requests.h"
+
+namespace osquery {
+
+/**
+ * @brief MessagePack Serializer
+ *
+ * Property trees are encoded the way the JSON serializer writes them: a node
+ * with keyed children is a map, a node with unnamed children is an array, and
+ * every value is a string. The encoding is written to the output as the tree
+ * is walked, such as into a compressing stream.
+ *
+ * Deserialized numbers, booleans, and nil become their JSON spelling.
+ */
+class MessagePackSerializer : public Serializer {
+ public:
+  /**
+   * @brief Serialize a property tree into a string
+   *
+   * @param params A property tree of parameters
+   *
+   * @param serialized The string to populate the final serialized params into
+   *
+   * @return An instance of osquery::Status indicating the success or failure
+   * of the operation
+   */
+  Status serialize(const boost::property_tree::ptree& params,
+                   std::string& serialized) override;
+
+  /**
+   * @brief Serialize a property tree into a stream, as it is written
+   *
+   * @param params A property tree of parameters
+   *
+   * @param output The stream to write the serialized params into
+   *
+   * @return An instance of osquery::Status indicating the success or failure
+   * of the operation
+   */
+  Status serializeStream(const boost::property_tree::ptree& params,
+                         std::ostream& output) override;
+
+  /**
+   * @brief Deserialize a string into a property tree
+   *
+   * @param serialized A string of serialized parameters
+   *
+   * @param params The property tree to populate the final deserialized
+   * params into
+   *
+   * @return An instance of osquery::Status indicating the success or failure
+   * of the operation
+   */
+  Status deserialize(const std::string& serialized,
+                     boost::property_tree::ptree& params) override;
+
+  /**
+   * @brief Returns the HTTP content type, for HTTP/TLS transport
+   *
+   * @return The content type
+   */
+  std::string getContentType() const override {
+    return "application/msgpack";
+  }
+};
+}
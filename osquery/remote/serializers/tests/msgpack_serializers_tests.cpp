@@ -0,0 +1,125 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <gtest/gtest.h>
+
+#include "osquery/remote/serializers/msgpack.h"
+
+namespace osquery {
+
+class MessagePackSerializersTests : public testing::Test {};
+
+TEST_F(MessagePackSerializersTests, test_serialize) {
+  auto msgpack = MessagePackSerializer();
+  boost::property_tree::ptree params;
+  params.put<std::string>("foo", "bar");
+
+  std::string serialized;
+  auto s = msgpack.serialize(params, serialized);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(serialized, std::string("\x81\xa3" "foo\xa3" "bar"));
+
+  // Unnamed children are an array.
+  boost::property_tree::ptree data;
+  data.push_back(std::make_pair("", params));
+  data.push_back(std::make_pair("", params));
+  boost::property_tree::ptree log;
+  log.add_child("data", data);
+  s = msgpack.serialize(log, serialized);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(serialized,
+            std::string("\x81\xa4" "data\x92\x81\xa3" "foo\xa3"
+                        "bar\x81\xa3" "foo\xa3" "bar"));
+}
+
+TEST_F(MessagePackSerializersTests, test_serialize_lengths) {
+  auto msgpack = MessagePackSerializer();
+  boost::property_tree::ptree params;
+  params.put<std::string>("short", std::string(31, 'a'));
+  params.put<std::string>("str8", std::string(255, 'b'));
+  params.put<std::string>("str16", std::string(65535, 'c'));
+  params.put<std::string>("str32", std::string(65536, 'd'));
+  boost::property_tree::ptree items;
+  for (size_t i = 0; i < 16; i++) {
+    items.push_back(std::make_pair("", boost::property_tree::ptree("1")));
+  }
+  params.add_child("array16", items);
+
+  std::string serialized;
+  EXPECT_TRUE(msgpack.serialize(params, serialized).ok());
+  EXPECT_EQ(serialized.find(std::string("\xbf") + std::string(31, 'a')), 7U);
+  EXPECT_NE(serialized.find(std::string("\xd9\xff") + "bbb"),
+            std::string::npos);
+  EXPECT_NE(serialized.find(std::string("\xda\xff\xff") + "ccc"),
+            std::string::npos);
+  EXPECT_NE(serialized.find(std::string("\xdb\x00\x01\x00\x00", 5) + "ddd"),
+            std::string::npos);
+  EXPECT_NE(serialized.find(std::string("\xdc\x00\x10\xa1", 4) + "1"),
+            std::string::npos);
+
+  // Every length reads back.
+  boost::property_tree::ptree output;
+  EXPECT_TRUE(msgpack.deserialize(serialized, output).ok());
+  EXPECT_EQ(output, params);
+}
+
+TEST_F(MessagePackSerializersTests, test_deserialize) {
+  auto msgpack = MessagePackSerializer();
+  boost::property_tree::ptree params;
+  std::string serialized("\x81\xa3" "foo\xa3" "bar");
+  auto s = msgpack.deserialize(serialized, params);
+
+  boost::property_tree::ptree expected;
+  expected.put<std::string>("foo", "bar");
+
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(params, expected);
+
+  // Scalars that are not strings use their JSON spelling.
+  serialized = std::string(
+      "\x87\xa1" "a\x05\xa1" "b\xff\xa1" "c\xc3\xa1" "d\xc0\xa1"
+      "e\xcd\x01\x00\xa1" "f\xd1\xff\x00\xa1" "g\xcb\x3f\xf8\x00\x00\x00\x00"
+      "\x00\x00",
+      34);
+  s = msgpack.deserialize(serialized, params);
+  ASSERT_TRUE(s.ok());
+  EXPECT_EQ(params.get<std::string>("a"), "5");
+  EXPECT_EQ(params.get<std::string>("b"), "-1");
+  EXPECT_EQ(params.get<std::string>("c"), "true");
+  EXPECT_EQ(params.get<std::string>("d"), "null");
+  EXPECT_EQ(params.get<std::string>("e"), "256");
+  EXPECT_EQ(params.get<std::string>("f"), "-256");
+  EXPECT_EQ(params.get<std::string>("g"), "1.5");
+
+  // An accepted payload without a response.
+  EXPECT_TRUE(msgpack.deserialize("", params).ok());
+  EXPECT_TRUE(params.empty());
+}
+
+TEST_F(MessagePackSerializersTests, test_deserialize_invalid) {
+  auto msgpack = MessagePackSerializer();
+  boost::property_tree::ptree params;
+
+  // Truncated strings and maps.
+  EXPECT_FALSE(msgpack.deserialize("\x81\xa3" "foo\xa3" "ba", params).ok());
+  EXPECT_FALSE(msgpack.deserialize("\x82\xa1" "a\xa1" "b", params).ok());
+  EXPECT_TRUE(params.empty());
+
+  // A length larger than the input.
+  EXPECT_FALSE(msgpack.deserialize("\xdb\xff\xff\xff\xff", params).ok());
+
+  // Trailing bytes and extension types.
+  EXPECT_FALSE(msgpack.deserialize("\x80\x80", params).ok());
+  EXPECT_FALSE(msgpack.deserialize("\xd4\x01\x00", params).ok());
+
+  // Deeply nested arrays.
+  EXPECT_FALSE(msgpack.deserialize(std::string(1024, '\x91'), params).ok());
+}
+}
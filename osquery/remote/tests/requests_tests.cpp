@@ -8,6 +8,10 @@
  *
  */
 
+#include <sstream>
+
+#include <zstd.h>
+
 #include <gtest/gtest.h>
 
 #include "osquery/remote/requests.h"
@@ -139,4 +143,51 @@ TEST_F(RequestsTests, test_compression) {
   EXPECT_EQ(compressed, expected);
   EXPECT_LT(compressed.size(), uncompressed.size());
 }
+
+TEST_F(RequestsTests, test_compression_zstd) {
+  auto req = Request<CopyTransport, JSONSerializer>("foobar");
+  req.setOption("compression", std::string("zstd"));
+
+  boost::property_tree::ptree params;
+  for (size_t i = 0; i < 1000; i++) {
+    params.put<std::string>("key" + std::to_string(i), "stringstring");
+  }
+  req.call(params);
+
+  std::string compressed;
+  {
+    boost::property_tree::ptree response;
+    compressed = req.getResponse(response).getMessage();
+  }
+
+  // The body is compressed as it is serialized, across stream buffers.
+  std::string serialized;
+  JSONSerializer().serialize(params, serialized);
+  EXPECT_LT(compressed.size(), serialized.size());
+
+  std::string decompressed(serialized.size(), '\0');
+  auto size = ZSTD_decompress(&decompressed[0],
+                              decompressed.size(),
+                              compressed.data(),
+                              compressed.size());
+  ASSERT_FALSE(ZSTD_isError(size));
+  decompressed.resize(size);
+  EXPECT_EQ(decompressed, serialized);
+}
+
+TEST_F(RequestsTests, test_compression_stream) {
+  std::string output;
+  CompressionStreamBuffer invalid("unknown", output);
+  EXPECT_FALSE(invalid.finish().ok());
+
+  // The gzip stream matches a single compressed string.
+  std::string input(100000, 'a');
+  {
+    CompressionStreamBuffer buffer("gzip", output);
+    std::ostream stream(&buffer);
+    stream << input;
+    EXPECT_TRUE(buffer.finish().ok());
+  }
+  EXPECT_EQ(output, compressString(input));
+}
 }
@@ -46,7 +46,11 @@ class TLSTransportsTests : public testing::Test {
     port_ = TLSServerRunner::port();
   }
 
-  void TearDown() override { TLSServerRunner::stop(); }
+  void TearDown() override {
+    // Each test server is new, do not reuse connections to a previous one.
+    TLSTransport::resetClients();
+    TLSServerRunner::stop();
+  }
 
  protected:
   std::string port_;
@@ -157,4 +161,42 @@ TEST_F(TLSTransportsTests, test_call_client_auth) {
     EXPECT_TRUE(status.ok());
   }
 }
+
+TEST_F(TLSTransportsTests, test_client_reuse) {
+  auto t1 = std::make_shared<TLSTransport>();
+  t1->disableVerifyPeer();
+  auto t2 = std::make_shared<TLSTransport>();
+  t2->disableVerifyPeer();
+
+  // Transports with the same TLS options share a client.
+  auto client = t1->getClient();
+  EXPECT_FALSE(t1->client_reused_);
+  EXPECT_EQ(client, t2->getClient());
+  EXPECT_TRUE(t2->client_reused_);
+
+  auto t3 = std::make_shared<TLSTransport>();
+  EXPECT_NE(client, t3->getClient());
+
+  // A failed connection is not shared again.
+  t2->resetClient();
+  EXPECT_NE(client, t1->getClient());
+
+  // A long-polling request uses a client with its own timeout.
+  auto t4 = std::make_shared<TLSTransport>();
+  t4->disableVerifyPeer();
+  t4->setOption("timeout", 30U);
+  EXPECT_EQ(t4->getTimeout(), 30U);
+  EXPECT_NE(t1->getClient(), t4->getClient());
+
+  auto url = "https://localhost:" + port_;
+  auto r1 = Request<TLSTransport, JSONSerializer>(url, t1);
+  auto r2 = Request<TLSTransport, JSONSerializer>(url, t2);
+  Status status;
+  ASSERT_NO_THROW(status = r1.call());
+  if (verify(status)) {
+    EXPECT_TRUE(status.ok());
+    ASSERT_NO_THROW(status = r2.call());
+    EXPECT_TRUE(status.ok());
+  }
+}
 }
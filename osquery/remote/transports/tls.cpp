@@ -8,8 +8,13 @@
  *
  */
 
+#include <map>
+#include <mutex>
+
 #include <osquery/filesystem.h>
+#include <osquery/system.h>
 
+#include "osquery/core/tracing.h"
 #include "osquery/remote/transports/tls.h"
 
 namespace http = boost::network::http;
@@ -47,6 +52,9 @@ const std::string kTLSCiphers =
     "DH+3DES:RSA+AESGCM:RSA+AES:RSA+3DES:!aNULL:!MD5";
 const std::string kTLSUserAgentBase = "osquery/";
 
+/// Seconds to wait for a response, unless a request sets a timeout option.
+const size_t kTLSRequestTimeout = 4;
+
 /// TLS server hostname.
 CLI_FLAG(string,
          tls_hostname,
@@ -80,11 +88,36 @@ HIDDEN_FLAG(bool,
 
 HIDDEN_FLAG(bool, tls_dump, false, "Print remote requests and responses");
 
+CLI_FLAG(bool,
+         tls_session_reuse,
+         true,
+         "Reuse TLS sessions and keep-alive connections between requests");
+
+CLI_FLAG(uint32,
+         tls_session_timeout,
+         3600,
+         "Seconds to reuse a TLS session and its connections (0 = no limit)");
+
 /// Undocumented feature to override TLS endpoints.
 HIDDEN_FLAG(bool, tls_node_api, false, "Use node key as TLS endpoints");
 
 DECLARE_bool(verbose);
 
+/// A client shared by transports with the same TLS options.
+struct TLSClient {
+  std::shared_ptr<http::client> client;
+
+  /// The time the client was created.
+  size_t created{0};
+
+  /// Requests sent using the client.
+  size_t requests{0};
+};
+
+/// Shared clients, keyed by their TLS options.
+static std::map<std::string, TLSClient> kTLSClients;
+static std::mutex kTLSClientsMutex;
+
 TLSTransport::TLSTransport() : verify_peer_(true) {
   if (FLAGS_tls_server_certs.size() > 0) {
     server_certificate_file_ = FLAGS_tls_server_certs;
@@ -97,16 +130,84 @@ TLSTransport::TLSTransport() : verify_peer_(true) {
 }
 
 void TLSTransport::decorateRequest(http::client::request& r) {
-  r << boost::network::header("Connection", "close");
+  r << boost::network::header(
+      "Connection", (FLAGS_tls_session_reuse) ? "keep-alive" : "close");
   r << boost::network::header("Content-Type", serializer_->getContentType());
   r << boost::network::header("Accept", serializer_->getContentType());
   r << boost::network::header("Host", FLAGS_tls_hostname);
   r << boost::network::header("User-Agent", kTLSUserAgentBase + kVersion);
 }
 
-http::client TLSTransport::getClient() {
+std::string TLSTransport::getClientKey() const {
+  std::string key = (verify_peer_) ? "1" : "0";
+  key += "\n" + server_certificate_file_;
+  key += "\n" + client_certificate_file_;
+  key += "\n" + client_private_key_file_;
+  key += "\n" + options_.get<std::string>("hostname", "");
+  key += "\n" + std::to_string(getTimeout());
+  return key;
+}
+
+size_t TLSTransport::getTimeout() const {
+  // Long-polling requests allow the server to hold the response.
+  return options_.get<size_t>("timeout", kTLSRequestTimeout);
+}
+
+std::shared_ptr<http::client> TLSTransport::getClient() {
+  client_reused_ = false;
+  if (!FLAGS_tls_session_reuse) {
+    client_ = makeClient();
+    return client_;
+  }
+
+  auto key = getClientKey();
+  auto now = getUnixTime();
+  {
+    std::lock_guard<std::mutex> lock(kTLSClientsMutex);
+    auto& shared = kTLSClients[key];
+    if (shared.client == nullptr ||
+        (FLAGS_tls_session_timeout > 0 &&
+         now >= shared.created + FLAGS_tls_session_timeout)) {
+      shared.client = nullptr;
+    } else {
+      client_reused_ = (shared.requests++ > 0);
+      client_ = shared.client;
+      return client_;
+    }
+  }
+
+  // Building a client reads certificates, do not block other transports.
+  auto client = makeClient();
+  std::lock_guard<std::mutex> lock(kTLSClientsMutex);
+  auto& shared = kTLSClients[key];
+  if (shared.client == nullptr) {
+    shared.client = client;
+    shared.created = now;
+    shared.requests = 0;
+  }
+  client_reused_ = (shared.requests++ > 0);
+  client_ = shared.client;
+  return client_;
+}
+
+void TLSTransport::resetClient() {
+  std::lock_guard<std::mutex> lock(kTLSClientsMutex);
+  auto shared = kTLSClients.find(getClientKey());
+  if (shared != kTLSClients.end() && shared->second.client == client_) {
+    kTLSClients.erase(shared);
+  }
+  client_ = nullptr;
+}
+
+void TLSTransport::resetClients() {
+  std::lock_guard<std::mutex> lock(kTLSClientsMutex);
+  kTLSClients.clear();
+}
+
+std::shared_ptr<http::client> TLSTransport::makeClient() {
   http::client::options options;
-  options.follow_redirects(true).always_verify_peer(verify_peer_).timeout(4);
+  options.follow_redirects(true).always_verify_peer(verify_peer_).timeout(
+      getTimeout());
 
   std::string ciphers = kTLSCiphers;
 // Some Ubuntu 12.04 clients exhaust their cipher suites without SHA.
@@ -158,8 +259,12 @@ http::client TLSTransport::getClient() {
 #endif
   }
 
-  http::client client(options);
-  return client;
+#if BOOST_NETLIB_VERSION_MINOR >= 11
+  // Shared clients keep resolved endpoints with their connections.
+  options.cache_resolved(FLAGS_tls_session_reuse);
+#endif
+
+  return std::make_shared<http::client>(options);
 }
 
 inline bool tlsFailure(const std::string& what) {
@@ -170,47 +275,75 @@ inline bool tlsFailure(const std::string& what) {
 }
 
 Status TLSTransport::sendRequest() {
+  OSQUERY_TRACE_SPAN("TLSTransport::sendRequest");
   if (destination_.find("https://") == std::string::npos) {
     return Status(1, "Cannot create TLS request for non-HTTPS protocol URI");
   }
 
-  auto client = getClient();
   http::client::request r(destination_);
   decorateRequest(r);
 
   VLOG(1) << "TLS/HTTPS GET request to URI: " << destination_;
-  try {
-    response_ = client.get(r);
-    const auto& response_body = body(response_);
-    if (FLAGS_verbose && FLAGS_tls_dump) {
-      fprintf(stdout, "%s\n", std::string(response_body).c_str());
+  return send(HTTP_GET, r, "");
+}
+
+Status TLSTransport::send(HTTPVerb verb,
+                          const http::client::request& r,
+                          const std::string& params) {
+  // A reused keep-alive connection may have been closed by the server.
+  for (size_t attempt = 0;; attempt++) {
+    auto client = getClient();
+    try {
+      if (verb == HTTP_GET) {
+        response_ = client->get(r);
+      } else if (verb == HTTP_POST) {
+        response_ = client->post(r, params);
+      } else {
+        response_ = client->put(r, params);
+      }
+
+      const auto& response_body = body(response_);
+      if (FLAGS_verbose && FLAGS_tls_dump) {
+        fprintf(stdout, "%s\n", std::string(response_body).c_str());
+      }
+      response_status_ =
+          serializer_->deserialize(response_body, response_params_);
+      return response_status_;
+    } catch (const std::exception& e) {
+      bool retry = (client_reused_ && attempt == 0);
+      resetClient();
+      if (!retry) {
+        return Status((tlsFailure(e.what())) ? 2 : 1,
+                      std::string("Request error: ") + e.what());
+      }
+      VLOG(1) << "TLS/HTTPS request on a reused connection failed: "
+              << e.what();
     }
-    response_status_ =
-        serializer_->deserialize(response_body, response_params_);
-  } catch (const std::exception& e) {
-    return Status((tlsFailure(e.what())) ? 2 : 1,
-                  std::string("Request error: ") + e.what());
   }
-  return response_status_;
 }
 
 Status TLSTransport::sendRequest(const std::string& params, bool compress) {
+  OSQUERY_TRACE_SPAN("TLSTransport::sendRequest");
   if (destination_.find("https://") == std::string::npos) {
     return Status(1, "Cannot create TLS request for non-HTTPS protocol URI");
   }
 
-  auto client = getClient();
   http::client::request r(destination_);
   decorateRequest(r);
   if (compress) {
     // Later, when posting/putting, the data will be optionally compressed.
     r << boost::network::header("Content-Encoding", "gzip");
+  } else if (options_.count("content_encoding") > 0) {
+    // The request compressed the body while serializing.
+    r << boost::network::header(
+        "Content-Encoding", options_.get<std::string>("content_encoding"));
   }
 
   // Allow request calls to override the default HTTP POST verb.
   HTTPVerb verb = HTTP_POST;
   if (options_.count("verb") > 0) {
-    verb = (HTTPVerb)options_.get<int>("verb", HTTP_POST);
+    verb = (options_.get<int>("verb", HTTP_POST) == HTTP_PUT) ? HTTP_PUT
+                                                               : HTTP_POST;
   }
 
   VLOG(1) << "TLS/HTTPS " << ((verb == HTTP_POST) ? "POST" : "PUT")
@@ -219,23 +352,6 @@ Status TLSTransport::sendRequest(const std::string& params, bool compress) {
     fprintf(stdout, "%s\n", params.c_str());
   }
 
-  try {
-    if (verb == HTTP_POST) {
-      response_ = client.post(r, (compress) ? compressString(params) : params);
-    } else {
-      response_ = client.put(r, (compress) ? compressString(params) : params);
-    }
-
-    const auto& response_body = body(response_);
-    if (FLAGS_verbose && FLAGS_tls_dump) {
-      fprintf(stdout, "%s\n", std::string(response_body).c_str());
-    }
-    response_status_ =
-        serializer_->deserialize(response_body, response_params_);
-  } catch (const std::exception& e) {
-    return Status((tlsFailure(e.what())) ? 2 : 1,
-                  std::string("Request error: ") + e.what());
-  }
-  return response_status_;
+  return send(verb, r, (compress) ? compressString(params) : params);
 }
 }
@@ -10,6 +10,8 @@
 
 #pragma once
 
+#include <memory>
+
 #include <openssl/ssl.h>
 #include <openssl/crypto.h>
 
@@ -63,12 +65,16 @@ DECLARE_string(tls_client_cert);
 /// TLS server hostname.
 DECLARE_string(tls_hostname);
 
+/// Reuse keep-alive connections and TLS sessions between requests.
+DECLARE_bool(tls_session_reuse);
+
 /**
  * @brief HTTP verb selections.
  */
 enum HTTPVerb {
   HTTP_POST = 0,
   HTTP_PUT,
+  HTTP_GET,
 };
 
 /**
@@ -105,7 +111,35 @@ class TLSTransport : public Transport {
   TLSTransport();
 
  protected:
-  boost::network::http::client getClient();
+  /**
+   * @brief Get the client shared by transports with the same TLS options.
+   *
+   * Clients, and their keep-alive connections, are shared by the config,
+   * logger, distributed, and enroll plugins. A client is replaced after the
+   * tls_session_timeout, or when a request on a reused connection fails.
+   */
+  std::shared_ptr<boost::network::http::client> getClient();
+
+  /// Stop sharing the transport's client, its connections may be stale.
+  void resetClient();
+
+  /// Drop all shared clients.
+  static void resetClients();
+
+ private:
+  /// Send a GET, POST, or PUT request, retrying once on a stale connection.
+  Status send(HTTPVerb verb,
+              const boost::network::http::client::request& r,
+              const std::string& params);
+
+  /// Build a client using the transport's TLS options.
+  std::shared_ptr<boost::network::http::client> makeClient();
+
+  /// The options distinguishing shared clients.
+  std::string getClientKey() const;
+
+  /// Seconds to wait for a response.
+  size_t getTimeout() const;
 
  private:
   /// Testing-only, disable peer verification.
@@ -136,6 +170,12 @@ class TLSTransport : public Transport {
   /// Testing-only, disable peer verification.
   bool verify_peer_;
 
+  /// The shared client used for the last request.
+  std::shared_ptr<boost::network::http::client> client_;
+
+  /// True if the shared client had completed requests before this one.
+  bool client_reused_{false};
+
  protected:
   /**
     * @brief Modify a request object with base modifications
@@ -155,6 +195,7 @@ class TLSTransport : public Transport {
   FRIEND_TEST(TLSTransportsTests, test_call_server_cert_pinning);
   FRIEND_TEST(TLSTransportsTests, test_call_client_auth);
   FRIEND_TEST(TLSTransportsTests, test_call_http);
+  FRIEND_TEST(TLSTransportsTests, test_client_reuse);
 
   friend class TestDistributedPlugin;
 };
@@ -97,8 +97,29 @@ class TLSRequestHelper : private boost::noncopyable {
       force_post = (params.get<std::string>("verb") == "POST");
       params.erase("verb");
     }
+
+    // The caller-supplied parameters may request a compressed body.
+    auto compression = params.get<std::string>("compression", "");
+    if (!compression.empty()) {
+      request.setOption("compression", compression);
+      params.erase("compression");
+    }
+
+    // A long-polling caller waits longer than the default for a response.
+    auto timeout = params.get<size_t>("timeout", 0);
+    if (timeout > 0) {
+      request.setOption("timeout", timeout);
+      params.erase("timeout");
+    }
     auto status = (FLAGS_tls_node_api && !force_post) ? request.call()
                                                       : request.call(params);
+    if (!compression.empty()) {
+      // Retries of the same parameters are compressed too.
+      params.put("compression", compression);
+    }
+    if (timeout > 0) {
+      params.put("timeout", timeout);
+    }
     if (!status.ok()) {
       return status;
     }
@@ -210,6 +231,37 @@ class TLSRequestHelper : private boost::noncopyable {
     return s;
   }
 
+  /**
+   * @brief Send a TLS request
+   *
+   * @param uri is the URI to send the request to
+   * @param params is a ptree of the params to send to the server. This isn't
+   * const because it will be modified to include node_key.
+   * @param output is the ptree which will be populated with the deserialized
+   * results
+   * @param attempts is the number of attempts to make if the request fails
+   *
+   * @return a Status object indicating the success or failure of the operation
+   */
+  template <class TSerializer>
+  static Status go(const std::string& uri,
+                   boost::property_tree::ptree& params,
+                   boost::property_tree::ptree& output,
+                   const size_t attempts) {
+    Status s;
+    for (size_t i = 1; i <= attempts; i++) {
+      s = TLSRequestHelper::go<TSerializer>(uri, params, output);
+      if (s.ok()) {
+        return s;
+      }
+      if (i == attempts) {
+        break;
+      }
+      sleepFor(i * i);
+    }
+    return s;
+  }
+
   /**
    * @brief Send a TLS request
    *
@@ -8,6 +8,9 @@
  *
  */
 
+#include <algorithm>
+#include <sstream>
+
 #include <benchmark/benchmark.h>
 
 #include <osquery/core.h>
@@ -15,10 +18,44 @@
 #include <osquery/sql.h>
 #include <osquery/tables.h>
 
+#include "osquery/core/allocations.h"
 #include "osquery/sql/virtual_table.h"
 
 namespace osquery {
 
+/**
+ * @brief Run a query and label the benchmark with its allocations.
+ *
+ * The label holds the allocations of an average iteration and the most bytes
+ * an iteration had allocated at once, see osquery/core/allocations.h.
+ */
+static void benchmarkQueryAllocations(benchmark::State& state,
+                                      const std::string& query,
+                                      const SQLiteDBInstanceRef& dbc) {
+  size_t iterations = 0;
+  unsigned long long allocations = 0;
+  unsigned long long peak = 0;
+  while (state.KeepRunning()) {
+    AllocationScope scope;
+    {
+      QueryData results;
+      queryInternal(query, results, dbc->db());
+      dbc->clearAffectedTables();
+    }
+
+    allocations += scope.allocations();
+    peak = std::max(peak, scope.peakBytes());
+    iterations++;
+  }
+
+  if (iterations > 0) {
+    std::stringstream label;
+    label << "allocations=" << allocations / iterations
+          << " peak_bytes=" << peak;
+    state.SetLabel(label.str());
+  }
+}
+
 class BenchmarkTablePlugin : public TablePlugin {
  private:
   TableColumns columns() const {
@@ -60,6 +97,7 @@ static void SQL_virtual_table_internal(benchmark::State& state) {
   while (state.KeepRunning()) {
     QueryData results;
     queryInternal("select * from benchmark", results, dbc->db());
+    dbc->clearAffectedTables();
   }
 }
 
@@ -77,6 +115,7 @@ static void SQL_virtual_table_internal_global(benchmark::State& state) {
 
     QueryData results;
     queryInternal("select * from benchmark", results, dbc->db());
+    dbc->clearAffectedTables();
   }
 }
 
@@ -94,6 +133,7 @@ static void SQL_virtual_table_internal_unique(benchmark::State& state) {
 
     QueryData results;
     queryInternal("select * from benchmark", results, dbc->db());
+    dbc->clearAffectedTables();
   }
 }
 
@@ -122,17 +162,35 @@ static void SQL_virtual_table_internal_long(benchmark::State& state) {
   PluginResponse res;
   Registry::call("table", "long_benchmark", {{"action", "columns"}}, res);
 
+  // Attach a sample virtual table.
+  auto dbc = SQLiteDBManager::getUnique();
+  attachTableInternal("long_benchmark", columnDefinition(res), dbc);
+  benchmarkQueryAllocations(state, "select * from long_benchmark", dbc);
+}
+
+BENCHMARK(SQL_virtual_table_internal_long);
+
+static void SQL_virtual_table_internal_self_join(benchmark::State& state) {
+  Registry::add<BenchmarkLongTablePlugin>("table", "long_benchmark");
+  PluginResponse res;
+  Registry::call("table", "long_benchmark", {{"action", "columns"}}, res);
+
   // Attach a sample virtual table.
   auto dbc = SQLiteDBManager::getUnique();
   attachTableInternal("long_benchmark", columnDefinition(res), dbc);
 
   while (state.KeepRunning()) {
+    // The inner cursor reuses the rows generated for the outer cursor.
     QueryData results;
-    queryInternal("select * from long_benchmark", results, dbc->db());
+    queryInternal(
+        "select a.test_int from long_benchmark a, long_benchmark b "
+        "where a.test_int = b.test_int limit 1000",
+        results, dbc->db());
+    dbc->clearAffectedTables();
   }
 }
 
-BENCHMARK(SQL_virtual_table_internal_long);
+BENCHMARK(SQL_virtual_table_internal_self_join);
 
 class BenchmarkWideTablePlugin : public TablePlugin {
  private:
@@ -166,11 +224,7 @@ static void SQL_virtual_table_internal_wide(benchmark::State& state) {
   // Attach a sample virtual table.
   auto dbc = SQLiteDBManager::getUnique();
   attachTableInternal("wide_benchmark", columnDefinition(res), dbc);
-
-  while (state.KeepRunning()) {
-    QueryData results;
-    queryInternal("select * from wide_benchmark", results, dbc->db());
-  }
+  benchmarkQueryAllocations(state, "select * from wide_benchmark", dbc);
 }
 
 BENCHMARK(SQL_virtual_table_internal_wide);
@@ -194,4 +248,27 @@ static void SQL_select_basic(benchmark::State& state) {
 }
 
 BENCHMARK(SQL_select_basic);
+
+extern void escapeNonPrintableBytesEx(std::string& data);
+
+static void SQL_escape_printable(benchmark::State& state) {
+  // Most column values are printable ASCII, and are not copied.
+  std::string value(state.range_x(), 'a');
+  while (state.KeepRunning()) {
+    escapeNonPrintableBytesEx(value);
+  }
+}
+
+BENCHMARK(SQL_escape_printable)->Arg(16)->Arg(256)->Arg(4096);
+
+static void SQL_escape_non_printable(benchmark::State& state) {
+  std::string input(state.range_x(), 'a');
+  input[input.size() / 2] = '\x01';
+  while (state.KeepRunning()) {
+    auto value = input;
+    escapeNonPrintableBytesEx(value);
+  }
+}
+
+BENCHMARK(SQL_escape_non_printable)->Arg(16)->Arg(256)->Arg(4096);
 }
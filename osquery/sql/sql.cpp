@@ -8,6 +8,8 @@
  *
  */
 
+#include <cstdint>
+#include <cstring>
 #include <sstream>
 
 #include <osquery/core.h>
@@ -24,35 +26,74 @@ SQL::SQL(const std::string& q) { status_ = query(q, results_); }
 
 const QueryData& SQL::rows() const { return results_; }
 
+QueryData& SQL::rows() { return results_; }
+
 bool SQL::ok() { return status_.ok(); }
 
 const Status& SQL::getStatus() const { return status_; }
 
 std::string SQL::getMessageString() { return status_.toString(); }
 
+/// Check if a byte is escaped, control characters and non-ASCII.
+static inline bool isNonPrintableByte(unsigned char c) {
+  return c < 0x20 || c >= 0x80;
+}
+
+/**
+ * @brief Find the first byte that must be escaped, or the data length.
+ *
+ * Bytes are checked a word at a time. For each byte in a word, subtracting
+ * 0x20 sets the high bit if the byte is below 0x20, or the byte's own high bit
+ * is set. Neither can happen for printable ASCII so most words are skipped.
+ */
+static inline size_t findNonPrintableByte(const std::string& data) {
+  const uint64_t kLow = 0x2020202020202020ULL;
+  const uint64_t kHigh = 0x8080808080808080ULL;
+
+  size_t i = 0;
+  for (; i + sizeof(uint64_t) <= data.size(); i += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, data.data() + i, sizeof(word));
+    if (((word - kLow) | word) & kHigh) {
+      break;
+    }
+  }
+
+  for (; i < data.size(); i++) {
+    if (isNonPrintableByte(static_cast<unsigned char>(data[i]))) {
+      return i;
+    }
+  }
+  return data.size();
+}
+
 static inline void escapeNonPrintableBytes(std::string& data) {
-  std::string escaped;
+  // Most values are printable ASCII and are left untouched, without a copy.
+  auto first = findNonPrintableByte(data);
+  if (first == data.size()) {
+    return;
+  }
+
   char const hex_chars[16] = {
       '0', '1', '2', '3', '4', '5', '6', '7',
       '8', '9', 'A', 'B', 'C', 'D', 'E', 'F',
   };
 
-  bool needs_replacement = false;
-  for (size_t i = 0; i < data.length(); i++) {
-    if (((unsigned char)data[i]) < 0x20 || ((unsigned char)data[i]) >= 0x80) {
-      needs_replacement = true;
+  // Each escaped byte expands to 4 characters, plan for the first at least.
+  std::string escaped;
+  escaped.reserve(data.size() + 3);
+  escaped.append(data, 0, first);
+  for (size_t i = first; i < data.length(); i++) {
+    auto c = static_cast<unsigned char>(data[i]);
+    if (isNonPrintableByte(c)) {
       escaped += "\\x";
-      escaped += hex_chars[(((unsigned char)data[i])) >> 4];
-      escaped += hex_chars[((unsigned char)data[i] & 0x0F) >> 0];
+      escaped += hex_chars[c >> 4];
+      escaped += hex_chars[c & 0x0F];
     } else {
       escaped += data[i];
     }
   }
-
-  // Only replace if any escapes were made.
-  if (needs_replacement) {
-    data = std::move(escaped);
-  }
+  data = std::move(escaped);
 }
 
 void escapeNonPrintableBytesEx(std::string& data) {
@@ -17,11 +17,11 @@
 #endif
 
 #include <functional>
+#include <memory>
 #include <string>
-#include <vector>
 
 #include <boost/regex.hpp>
-#include <boost/algorithm/string/regex.hpp>
+#include <boost/utility/string_ref.hpp>
 
 #include "osquery/core/conversions.h"
 
@@ -29,16 +29,34 @@
 
 namespace osquery {
 
-using SplitResult = std::vector<std::string>;
-using StringSplitFunction = std::function<SplitResult(
-    const std::string &input, const std::string &tokens)>;
+/// Set the result to token `index` of an input, NULL if there are fewer.
+using StringSplitFunction = std::function<void(sqlite3_context *context,
+                                               boost::string_ref input,
+                                               boost::string_ref tokens,
+                                               size_t index)>;
+
+/// Yield a selected split result, or NULL if the index was out of bounds.
+static void setSplitResult(sqlite3_context *context,
+                           bool found,
+                           boost::string_ref selected) {
+  if (!found) {
+    // Could emit a warning about a selected index that is out of bounds.
+    sqlite3_result_null(context);
+    return;
+  }
+
+  // Yield the selected index.
+  sqlite3_result_text(
+      context, selected.data(), selected.size(), SQLITE_TRANSIENT);
+}
 
 /**
  * @brief A simple SQLite column string split implementation.
  *
  * Split a column value using a single token and select an expected index.
  * If multiple characters are given to the token parameter, each is used to
- * split, similar to boost::is_any_of.
+ * split, similar to boost::is_any_of. Empty results are skipped and each
+ * result is trimmed, as osquery::split.
  *
  * Example:
  *   1. SELECT ip_address from addresses;
@@ -48,16 +66,86 @@ using StringSplitFunction = std::function<SplitResult(
  *   3. SELECT SPLIT(ip_address, ".0", 0) from addresses;
  *      192
  */
-static SplitResult tokenSplit(const std::string &input,
-                              const std::string &tokens) {
-  return osquery::split(input, tokens);
+static void tokenSplit(sqlite3_context *context,
+                       boost::string_ref input,
+                       boost::string_ref tokens,
+                       size_t index) {
+  // Only the tokens up to the selected index are found.
+  size_t count = 0;
+  while (!input.empty()) {
+    auto end = input.find_first_of(tokens);
+    auto token = input.substr(0, end);
+    input.remove_prefix(
+        (end == boost::string_ref::npos) ? input.size() : end + 1);
+    if (token.empty()) {
+      continue;
+    }
+
+    if (count++ == index) {
+      while (!token.empty() && isspace(token.front())) {
+        token.remove_prefix(1);
+      }
+      while (!token.empty() && isspace(token.back())) {
+        token.remove_suffix(1);
+      }
+      setSplitResult(context, true, token);
+      return;
+    }
+  }
+  setSplitResult(context, false, boost::string_ref());
+}
+
+/**
+ * @brief Get the compiled regex for a function's pattern argument.
+ *
+ * The pattern is compiled once per statement while the argument is constant
+ * and kept as SQLite auxiliary data. A regex compiled for a changing pattern
+ * is owned by `compiled` and freed after the call.
+ *
+ * @return nullptr and set an error result if the pattern is invalid.
+ */
+static const boost::regex *getFunctionRegex(
+    sqlite3_context *context,
+    int argument,
+    boost::string_ref pattern,
+    std::unique_ptr<boost::regex> &compiled) {
+  auto cached =
+      static_cast<const boost::regex *>(sqlite3_get_auxdata(context, argument));
+  if (cached != nullptr) {
+    return cached;
+  }
+
+  try {
+    compiled.reset(new boost::regex(pattern.begin(), pattern.end()));
+  } catch (const boost::regex_error &e) {
+    auto error = "Invalid regex: " + std::string(e.what());
+    sqlite3_result_error(context, error.c_str(), -1);
+    return nullptr;
+  }
+  return compiled.get();
+}
+
+/// Keep a regex compiled for a call, see getFunctionRegex.
+static void setFunctionRegex(sqlite3_context *context,
+                             int argument,
+                             std::unique_ptr<boost::regex> &compiled) {
+  if (compiled != nullptr) {
+    // SQLite may free the regex immediately, it is not used afterward.
+    sqlite3_set_auxdata(context,
+                        argument,
+                        compiled.release(),
+                        [](void *regex) {
+                          delete static_cast<boost::regex *>(regex);
+                        });
+  }
 }
 
 /**
  * @brief A regex SQLite column string split implementation.
  *
  * Split a column value using a single or multi-character token and select an
- * expected index. The token input is considered a regex.
+ * expected index. The token input is considered a regex. The input is only
+ * searched up to the selected index.
  *
  * Example:
  *   1. SELECT ip_address from addresses;
@@ -67,12 +155,47 @@ static SplitResult tokenSplit(const std::string &input,
  *   3. SELECT SPLIT(ip_address, "\.0", 0) from addresses;
  *      192.168
  */
-static SplitResult regexSplit(const std::string &input,
-                              const std::string &token) {
-  // Split using the token as a regex to support multi-character tokens.
-  std::vector<std::string> result;
-  boost::algorithm::split_regex(result, input, boost::regex(token));
-  return result;
+static void regexSplit(sqlite3_context *context,
+                       boost::string_ref input,
+                       boost::string_ref token,
+                       size_t index) {
+  std::unique_ptr<boost::regex> compiled;
+  auto regex = getFunctionRegex(context, 1, token, compiled);
+  if (regex == nullptr) {
+    return;
+  }
+
+  // Empty matches do not split, they would never advance.
+  bool found = false;
+  boost::string_ref selected;
+  auto start = input.begin();
+  boost::cmatch match;
+  for (size_t i = 0; i <= index; i++) {
+    if (!boost::regex_search(
+            start, input.end(), match, *regex, boost::match_not_null)) {
+      // The remaining input is the last result.
+      if (i == index) {
+        selected = boost::string_ref(start, input.end() - start);
+        found = true;
+      }
+      break;
+    }
+
+    if (i == index) {
+      selected = boost::string_ref(start, match[0].first - start);
+      found = true;
+    }
+    start = match[0].second;
+  }
+
+  setSplitResult(context, found, selected);
+  setFunctionRegex(context, 1, compiled);
+}
+
+/// The text of a value, which must not be NULL.
+static boost::string_ref getValueText(sqlite3_value *value) {
+  auto text = reinterpret_cast<const char *>(sqlite3_value_text(value));
+  return boost::string_ref(text, sqlite3_value_bytes(value));
 }
 
 static void callStringSplitFunc(sqlite3_context *context,
@@ -87,9 +210,9 @@ static void callStringSplitFunc(sqlite3_context *context,
     return;
   }
 
-  // Parse and verify the split input parameters.
-  std::string input((char *)sqlite3_value_text(argv[0]));
-  std::string token((char *)sqlite3_value_text(argv[1]));
+  // Parse and verify the split input parameters, the text is not copied.
+  auto input = getValueText(argv[0]);
+  auto token = getValueText(argv[1]);
   auto index = static_cast<size_t>(sqlite3_value_int(argv[2]));
   if (token.empty()) {
     // Allow the input string to be empty.
@@ -97,17 +220,7 @@ static void callStringSplitFunc(sqlite3_context *context,
     return;
   }
 
-  auto result = f(input, token);
-  if (index >= result.size()) {
-    // Could emit a warning about a selected index that is out of bounds.
-    sqlite3_result_null(context);
-    return;
-  }
-
-  // Yield the selected index.
-  const auto &selected = result[index];
-  sqlite3_result_text(context, selected.c_str(), selected.size(),
-                      SQLITE_TRANSIENT);
+  f(context, input, token, index);
 }
 
 static void tokenStringSplitFunc(sqlite3_context *context,
@@ -122,6 +235,76 @@ static void regexStringSplitFunc(sqlite3_context *context,
   callStringSplitFunc(context, argc, argv, regexSplit);
 }
 
+/**
+ * @brief Check if a regex matches anywhere within a column value.
+ *
+ * Example:
+ *   1. SELECT * FROM processes WHERE REGEX_MATCH(cmdline, "--port=[0-9]+");
+ */
+static void regexMatchFunc(sqlite3_context *context,
+                           int argc,
+                           sqlite3_value **argv) {
+  assert(argc == 2);
+  if (SQLITE_NULL == sqlite3_value_type(argv[0]) ||
+      SQLITE_NULL == sqlite3_value_type(argv[1])) {
+    sqlite3_result_null(context);
+    return;
+  }
+
+  auto input = getValueText(argv[0]);
+  std::unique_ptr<boost::regex> compiled;
+  auto regex = getFunctionRegex(context, 1, getValueText(argv[1]), compiled);
+  if (regex == nullptr) {
+    return;
+  }
+
+  bool matched = boost::regex_search(input.begin(), input.end(), *regex);
+  setFunctionRegex(context, 1, compiled);
+  sqlite3_result_int(context, matched ? 1 : 0);
+}
+
+/**
+ * @brief Select a group of a regex's first match within a column value.
+ *
+ * Group 0 is the entire match. If the regex does not match, or the group did
+ * not participate in the match, a NULL type is returned.
+ *
+ * Example:
+ *   1. SELECT REGEX_EXTRACT(cmdline, "--port=([0-9]+)", 1) FROM processes;
+ *      8080
+ */
+static void regexExtractFunc(sqlite3_context *context,
+                             int argc,
+                             sqlite3_value **argv) {
+  assert(argc == 3);
+  if (SQLITE_NULL == sqlite3_value_type(argv[0]) ||
+      SQLITE_NULL == sqlite3_value_type(argv[1]) ||
+      SQLITE_NULL == sqlite3_value_type(argv[2])) {
+    sqlite3_result_null(context);
+    return;
+  }
+
+  auto input = getValueText(argv[0]);
+  auto index = static_cast<size_t>(sqlite3_value_int(argv[2]));
+  std::unique_ptr<boost::regex> compiled;
+  auto regex = getFunctionRegex(context, 1, getValueText(argv[1]), compiled);
+  if (regex == nullptr) {
+    return;
+  }
+
+  boost::cmatch match;
+  if (boost::regex_search(input.begin(), input.end(), match, *regex) &&
+      index < match.size() && match[index].matched) {
+    sqlite3_result_text(context,
+                        match[index].first,
+                        match[index].length(),
+                        SQLITE_TRANSIENT);
+  } else {
+    sqlite3_result_null(context);
+  }
+  setFunctionRegex(context, 1, compiled);
+}
+
 /**
  * @brief Convert an IPv4 string address to decimal.
  */
@@ -155,6 +338,10 @@ void registerStringExtensions(sqlite3 *db) {
                           tokenStringSplitFunc, nullptr, nullptr);
   sqlite3_create_function(db, "regex_split", 3, SQLITE_UTF8, nullptr,
                           regexStringSplitFunc, nullptr, nullptr);
+  sqlite3_create_function(db, "regex_match", 2, SQLITE_UTF8, nullptr,
+                          regexMatchFunc, nullptr, nullptr);
+  sqlite3_create_function(db, "regex_extract", 3, SQLITE_UTF8, nullptr,
+                          regexExtractFunc, nullptr, nullptr);
   sqlite3_create_function(db, "inet_aton", 1, SQLITE_UTF8, nullptr,
                           ip4StringToDecimalFunc, nullptr, nullptr);
 }
@@ -8,11 +8,16 @@
  *
  */
 
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
 #include <osquery/core.h>
 #include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/sql.h>
 
+#include "osquery/core/process.h"
 #include "osquery/sql/sqlite_util.h"
 #include "osquery/sql/virtual_table.h"
 
@@ -28,6 +33,30 @@ FLAG(string,
      "Not Specified",
      "Comma-delimited list of table names to be disabled");
 
+FLAG(uint64,
+     sqlite_pool_size,
+     4,
+     "Maximum number of idle transient SQLite connections to keep");
+
+FLAG(uint64,
+     sqlite_statement_cache,
+     64,
+     "Maximum number of prepared statements kept per SQLite connection");
+
+FLAG(uint64,
+     table_max_staleness,
+     0,
+     "Seconds distributed and decorator queries may reuse scheduled tables");
+
+/// The SQL executed once is forgotten beyond this many statements per cache.
+const size_t kSQLiteStatementsSeen = 4096;
+
+/// The cached query columns are cleared beyond this many statements.
+const size_t kSQLiteColumnsCached = 1024;
+
+/// Returned connections are only pooled while the manager is alive.
+static std::atomic<bool> kSQLitePoolActive{true};
+
 using SQLiteDBInstanceRef = std::shared_ptr<SQLiteDBInstance>;
 
 /**
@@ -119,37 +148,46 @@ std::string getStringForSQLiteReturnCode(int code) {
 
 Status SQLiteSQLPlugin::query(const std::string& q, QueryData& results) const {
   auto dbc = SQLiteDBManager::get();
-  auto result = queryInternal(q, results, dbc->db());
+  auto result = queryInternal(q, results, dbc);
   dbc->clearAffectedTables();
   return result;
 }
 
 Status SQLiteSQLPlugin::getQueryColumns(const std::string& q,
                                         TableColumns& columns) const {
+  auto& cache = SQLiteColumnCache::get();
+  size_t generation = 0;
+  if (cache.find(q, columns, generation)) {
+    return Status(0, "OK");
+  }
+
   auto dbc = SQLiteDBManager::get();
-  return getQueryColumnsInternal(q, columns, dbc->db());
+  auto status = getQueryColumnsInternal(q, columns, dbc->db());
+  // Preparing the SQL planned its tables, which are not filtered.
+  dbc->clearAffectedTables();
+  if (status.ok()) {
+    cache.set(q, columns, generation);
+  }
+  return status;
 }
 
 SQLInternal::SQLInternal(const std::string& q) {
   auto dbc = SQLiteDBManager::get();
-  status_ = queryInternal(q, results_, dbc->db());
+  status_ = queryInternal(q, results_, dbc);
   dbc->clearAffectedTables();
 }
 
 Status SQLiteSQLPlugin::attach(const std::string& name) {
-  PluginResponse response;
-  auto status =
-      Registry::call("table", name, {{"action", "columns"}}, response);
-  if (!status.ok()) {
-    return status;
-  }
-
-  auto statement = columnDefinition(response);
   // Attach requests occurring via the plugin/registry APIs must act on the
   // primary database. To allow this, getConnection can explicitly request the
   // primary instance and avoid the contention decisions.
   auto dbc = SQLiteDBManager::getConnection(true);
-  return attachTableInternal(name, statement, dbc);
+  // Cached statements may have prepared a previous table of the same name.
+  dbc->statements().clear();
+  auto status = attachTable(name, dbc);
+  // Pooled connections do not include the new table.
+  SQLiteDBManager::resetPool();
+  return status;
 }
 
 void SQLiteSQLPlugin::detach(const std::string& name) {
@@ -157,7 +195,9 @@ void SQLiteSQLPlugin::detach(const std::string& name) {
   if (!dbc->isPrimary()) {
     return;
   }
+  dbc->statements().clear();
   detachTableInternal(name, dbc->db());
+  SQLiteDBManager::resetPool();
 }
 
 SQLiteDBInstance::SQLiteDBInstance(sqlite3*& db, std::mutex& mtx)
@@ -165,9 +205,8 @@ SQLiteDBInstance::SQLiteDBInstance(sqlite3*& db, std::mutex& mtx)
   if (lock_.owns_lock()) {
     primary_ = true;
   } else {
+    // The manager will provide a pooled transient connection instead.
     db_ = nullptr;
-    VLOG(1) << "DBManager contention: opening transient SQLite database";
-    init();
   }
 }
 
@@ -190,6 +229,133 @@ void SQLiteDBInstance::init() {
   openOptimized(db_);
 }
 
+SQLiteStatementCache& SQLiteDBInstance::statements() {
+  if (isPrimary() && !managed_) {
+    // A temporary primary instance uses the DB manager's 'connection' cache.
+    return SQLiteDBManager::getConnection(true)->statements();
+  }
+  return statements_;
+}
+
+sqlite3_stmt* SQLiteStatementCache::get(const std::string& q, sqlite3* db) {
+  if (FLAGS_sqlite_statement_cache == 0) {
+    return nullptr;
+  }
+
+  auto it = index_.find(q);
+  if (it != index_.end()) {
+    statements_.splice(statements_.begin(), statements_, it->second);
+    return it->second->stmt;
+  }
+
+  // Only keep statements for SQL that was executed before.
+  if (seen_.size() >= kSQLiteStatementsSeen) {
+    seen_.clear();
+  }
+  if (seen_.insert(std::hash<std::string>()(q)).second) {
+    return nullptr;
+  }
+
+  Statement statement;
+  statement.sql = q;
+  const char* tail = nullptr;
+  auto first = nextConstraintIndex();
+  auto rc = sqlite3_prepare_v2(
+      db, q.c_str(), static_cast<int>(q.size() + 1), &statement.stmt, &tail);
+  if (rc != SQLITE_OK || statement.stmt == nullptr) {
+    // The error is reported when the SQL is executed.
+    sqlite3_finalize(statement.stmt);
+    return nullptr;
+  }
+
+  // SQL with several statements is executed instead.
+  while (tail != nullptr && (*tail == ' ' || *tail == '\t' || *tail == '\n' ||
+                             *tail == '\r' || *tail == ';')) {
+    tail++;
+  }
+  if (tail != nullptr && *tail != '\0') {
+    sqlite3_finalize(statement.stmt);
+    return nullptr;
+  }
+
+  statements_.push_front(std::move(statement));
+  pin(statements_.front(), first, nextConstraintIndex());
+  index_[q] = statements_.begin();
+  while (statements_.size() > FLAGS_sqlite_statement_cache) {
+    index_.erase(statements_.back().sql);
+    release(statements_.back());
+    statements_.pop_back();
+  }
+  return statements_.front().stmt;
+}
+
+void SQLiteStatementCache::planned(const std::string& q,
+                                   size_t first,
+                                   size_t last) {
+  auto it = index_.find(q);
+  if (it != index_.end()) {
+    pin(*it->second, first, last);
+  }
+}
+
+void SQLiteStatementCache::pin(Statement& statement,
+                               size_t first,
+                               size_t last) {
+  for (auto index = first; index < last; index++) {
+    statement.plans.push_back(index);
+    pinned_.insert(index);
+  }
+}
+
+void SQLiteStatementCache::release(Statement& statement) {
+  sqlite3_finalize(statement.stmt);
+  statement.stmt = nullptr;
+  for (const auto& index : statement.plans) {
+    pinned_.erase(index);
+  }
+}
+
+std::vector<size_t> SQLiteStatementCache::plans(size_t index) const {
+  for (const auto& statement : statements_) {
+    if (std::find(statement.plans.begin(), statement.plans.end(), index) !=
+        statement.plans.end()) {
+      return statement.plans;
+    }
+  }
+  return {};
+}
+
+void SQLiteStatementCache::evict(const std::string& q) {
+  auto it = index_.find(q);
+  if (it == index_.end()) {
+    return;
+  }
+  release(*it->second);
+  statements_.erase(it->second);
+  index_.erase(it);
+}
+
+void SQLiteStatementCache::clear() {
+  for (auto& statement : statements_) {
+    release(statement);
+  }
+  statements_.clear();
+  index_.clear();
+  seen_.clear();
+}
+
+/// Remove the constraint sets that are not pinned by a kept statement.
+template <typename T>
+static void clearPlans(T& plans, const SQLiteStatementCache& statements) {
+  for (auto it = plans.begin(); it != plans.end();) {
+    if (statements.pinned(it->first)) {
+      ++it;
+    } else {
+      it = plans.erase(it);
+    }
+  }
+}
+
 void SQLiteDBInstance::addAffectedTable(VirtualTableContent* table) {
   // An xFilter/scan was requested for this virtual table.
   affected_tables_.insert(std::make_pair(table->name, table));
@@ -204,15 +370,367 @@ void SQLiteDBInstance::clearAffectedTables() {
   }
 
   for (const auto& table : affected_tables_) {
-    table.second->constraints.clear();
+    // Kept statements are stepped again without planning their constraints.
+    clearPlans(table.second->constraints, statements_);
+    clearPlans(table.second->colsUsed, statements_);
     table.second->cache.clear();
   }
   // Since the affected tables are cleared, there are no more affected tables.
   // There is no concept of compounding tables between queries.
   affected_tables_.clear();
+  generated_.clear();
+  // Releasing a pending generation waits for it to finish.
+  pending_.clear();
+  clearPlans(plans_, statements_);
+  started_pending_ = false;
+}
+
+std::shared_ptr<const QueryData> SQLiteDBInstance::getGenerated(
+    const std::string& key) const {
+  auto it = generated_.find(key);
+  if (it != generated_.end()) {
+    return it->second;
+  }
+  auto pending = pending_.find(key);
+  if (pending != pending_.end()) {
+    return pending->second.get();
+  }
+  return nullptr;
+}
+
+void SQLiteDBInstance::setGenerated(const std::string& key,
+                                    std::shared_ptr<const QueryData> data) {
+  generated_[key] = std::move(data);
+}
+
+void SQLiteDBInstance::setPending(
+    const std::string& key,
+    std::shared_future<std::shared_ptr<const QueryData>> data) {
+  pending_[key] = std::move(data);
+}
+
+void SQLiteDBInstance::addPlan(size_t index,
+                               VirtualTableContent* table,
+                               bool literal) {
+  auto& plan = plans_[index];
+  plan.table = table;
+  plan.literal = literal;
+}
+
+std::vector<std::pair<size_t, SQLiteTablePlan>>
+SQLiteDBInstance::statementPlans(size_t index) const {
+  std::vector<std::pair<size_t, SQLiteTablePlan>> plans;
+  if (statements_.pinned(index)) {
+    // A kept statement is stepped again without planning, use its sets.
+    for (const auto& planned : statements_.plans(index)) {
+      auto it = plans_.find(planned);
+      if (it != plans_.end()) {
+        plans.push_back(*it);
+      }
+    }
+    return plans;
+  }
+
+  // Otherwise the sets not pinned by kept statements were planned for it.
+  for (const auto& plan : plans_) {
+    if (!statements_.pinned(plan.first)) {
+      plans.push_back(plan);
+    }
+  }
+  return plans;
+}
+
+bool SQLiteDBInstance::startPending() {
+  auto started = started_pending_;
+  started_pending_ = true;
+  return !started;
+}
+
+/// The snapshot active for this thread, see TableSnapshotScope.
+static thread_local TableSnapshot* kTableSnapshot{nullptr};
+
+/// Number of generations this thread reused from snapshots.
+static thread_local size_t kTableSnapshotSaved{0};
+
+std::shared_ptr<const QueryData> TableSnapshot::get(const std::string& key) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = generated_.find(key);
+  if (it == generated_.end()) {
+    return nullptr;
+  }
+  saved_++;
+  kTableSnapshotSaved++;
+  return it->second;
+}
+
+void TableSnapshot::set(const std::string& key,
+                        std::shared_ptr<const QueryData> data) {
+  if (FLAGS_table_max_staleness > 0) {
+    RecentGenerations::get().set(key, data);
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  generated_[key] = std::move(data);
+}
+
+TableSnapshot* TableSnapshot::current() { return kTableSnapshot; }
+
+TableSnapshotScope::TableSnapshotScope(std::shared_ptr<TableSnapshot> snapshot)
+    : snapshot_(std::move(snapshot)),
+      previous_(kTableSnapshot),
+      start_(kTableSnapshotSaved) {
+  kTableSnapshot = snapshot_.get();
+}
+
+TableSnapshotScope::~TableSnapshotScope() { kTableSnapshot = previous_; }
+
+size_t TableSnapshotScope::saved() const {
+  return kTableSnapshotSaved - start_;
+}
+
+/// The staleness allowed for this thread, see TableStalenessScope.
+static thread_local size_t kTableStaleness{0};
+
+/// Number of generations this thread reused from RecentGenerations.
+static thread_local size_t kTableStalenessSaved{0};
+
+RecentGenerations& RecentGenerations::get() {
+  static RecentGenerations generations;
+  return generations;
+}
+
+void RecentGenerations::set(const std::string& key,
+                            std::shared_ptr<const QueryData> data) {
+  auto now = std::chrono::steady_clock::now();
+  auto expired = now - std::chrono::seconds(FLAGS_table_max_staleness);
+  std::lock_guard<std::mutex> lock(mutex_);
+  // Generations too old for any reader are dropped as new ones are kept.
+  for (auto it = generations_.begin(); it != generations_.end();) {
+    if (it->second.time < expired) {
+      it = generations_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  auto& generation = generations_[key];
+  generation.time = now;
+  generation.data = std::move(data);
+}
+
+std::shared_ptr<const QueryData> RecentGenerations::find(
+    const std::string& key, size_t max_staleness) {
+  auto oldest = std::chrono::steady_clock::now() -
+                std::chrono::seconds(max_staleness);
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = generations_.find(key);
+  if (it == generations_.end() || it->second.time < oldest) {
+    return nullptr;
+  }
+  kTableStalenessSaved++;
+  return it->second.data;
+}
+
+size_t RecentGenerations::size() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return generations_.size();
+}
+
+void RecentGenerations::clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  generations_.clear();
+}
+
+TableStalenessScope::TableStalenessScope(size_t max_staleness)
+    : previous_(kTableStaleness), start_(kTableStalenessSaved) {
+  kTableStaleness = max_staleness;
+}
+
+TableStalenessScope::~TableStalenessScope() { kTableStaleness = previous_; }
+
+size_t TableStalenessScope::saved() const {
+  return kTableStalenessSaved - start_;
+}
+
+size_t TableStalenessScope::current() { return kTableStaleness; }
+
+/// The budget active for this thread, see QueryBudgetScope.
+static thread_local QueryBudgetScope* kQueryBudget{nullptr};
+
+/// Milliseconds of user and system CPU time used by the calling thread.
+static size_t getThreadCPUTime() {
+  ProcessResourceUsage usage;
+  if (!getThreadResourceUsage(usage)) {
+    return 0;
+  }
+  return static_cast<size_t>(usage.user_time + usage.system_time);
+}
+
+QueryBudgetScope::QueryBudgetScope(const QueryBudget& budget)
+    : budget_(budget),
+      start_(std::chrono::steady_clock::now()),
+      previous_(kQueryBudget) {
+  if (budget_.max_cpu_time > 0) {
+    cpu_start_ = getThreadCPUTime();
+  }
+  kQueryBudget = this;
+}
+
+QueryBudgetScope::~QueryBudgetScope() { kQueryBudget = previous_; }
+
+bool QueryBudgetScope::consume(size_t rows, size_t bytes) {
+  auto* budget = kQueryBudget;
+  if (budget == nullptr) {
+    return true;
+  }
+
+  budget->rows_ += rows;
+  budget->bytes_ += bytes;
+  if (budget->budget_.max_rows > 0 &&
+      budget->rows_ > budget->budget_.max_rows) {
+    budget->reason_ = "generated more than " +
+                      std::to_string(budget->budget_.max_rows) + " rows";
+    return false;
+  }
+
+  if (budget->budget_.max_bytes > 0 &&
+      budget->bytes_ > budget->budget_.max_bytes) {
+    budget->reason_ = "generated more than " +
+                      std::to_string(budget->budget_.max_bytes) + " bytes";
+    return false;
+  }
+  return check();
+}
+
+bool QueryBudgetScope::check() {
+  auto* budget = kQueryBudget;
+  if (budget == nullptr) {
+    return true;
+  }
+
+  if (budget->exceeded()) {
+    // Once exceeded, every following check fails until the scope ends.
+    return false;
+  }
+
+  if (budget->budget_.max_time > 0) {
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - budget->start_);
+    if (static_cast<size_t>(elapsed.count()) > budget->budget_.max_time) {
+      budget->reason_ = "executed longer than " +
+                        std::to_string(budget->budget_.max_time) + "ms";
+      return false;
+    }
+  }
+
+  if (budget->budget_.max_cpu_time > 0) {
+    auto cpu = getThreadCPUTime();
+    auto used = cpu - std::min(budget->cpu_start_, cpu);
+    if (used > budget->budget_.max_cpu_time) {
+      budget->reason_ = "used more than " +
+                        std::to_string(budget->budget_.max_cpu_time) +
+                        "ms of CPU time";
+      return false;
+    }
+  }
+  return true;
+}
+
+bool QueryBudgetScope::active() { return kQueryBudget != nullptr; }
+
+/// The profile active for this thread, see QueryProfileScope.
+static thread_local QueryProfileScope* kQueryProfile{nullptr};
+
+QueryProfileScope::QueryProfileScope() : previous_(kQueryProfile) {
+  kQueryProfile = this;
+}
+
+QueryProfileScope::~QueryProfileScope() { kQueryProfile = previous_; }
+
+CursorProfile* QueryProfileScope::cursor(size_t id, const std::string& table) {
+  auto* profile = kQueryProfile;
+  if (profile == nullptr) {
+    return nullptr;
+  }
+
+  auto it = profile->cursors_.find(id);
+  if (it == profile->cursors_.end()) {
+    it = profile->cursors_.emplace(id, CursorProfile()).first;
+    it->second.table = table;
+  }
+  return &it->second;
+}
+
+bool QueryProfileScope::active() { return kQueryProfile != nullptr; }
+
+/// The estimates recorded for this thread, see QueryScanScope.
+static thread_local QueryScanScope* kQueryScans{nullptr};
+
+QueryScanScope::QueryScanScope() : previous_(kQueryScans) {
+  kQueryScans = this;
+}
+
+QueryScanScope::~QueryScanScope() { kQueryScans = previous_; }
+
+void QueryScanScope::record(size_t index, QueryScanEstimate&& estimate) {
+  if (kQueryScans != nullptr) {
+    kQueryScans->estimates_[index] = std::move(estimate);
+  }
+}
+
+bool QueryScanScope::active() { return kQueryScans != nullptr; }
+
+Status getQueryScans(const std::string& q,
+                     std::vector<QueryScanEstimate>& scans,
+                     sqlite3* db) {
+  // The statement is always prepared, a kept statement is not planned again.
+  QueryScanScope scope;
+  auto explain = "EXPLAIN QUERY PLAN " + q;
+  sqlite3_stmt* stmt{nullptr};
+  auto rc = sqlite3_prepare_v2(
+      db, explain.c_str(), explain.length() + 1, &stmt, nullptr);
+  if (rc != SQLITE_OK || stmt == nullptr) {
+    if (stmt != nullptr) {
+      sqlite3_finalize(stmt);
+    }
+    return Status(1, sqlite3_errmsg(db));
+  }
+
+  // Each virtual table scan reports the index of its constraint set.
+  const std::string kIndex = "VIRTUAL TABLE INDEX ";
+  scans.clear();
+  while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+    auto detail = (const char*)sqlite3_column_text(stmt, 3);
+    if (detail == nullptr) {
+      continue;
+    }
+    auto found = std::strstr(detail, kIndex.c_str());
+    if (found == nullptr) {
+      continue;
+    }
+    auto index = std::strtoull(found + kIndex.size(), nullptr, 10);
+    auto estimate = scope.estimates().find(index);
+    if (estimate != scope.estimates().end()) {
+      scans.push_back(estimate->second);
+    }
+  }
+  sqlite3_finalize(stmt);
+  if (rc != SQLITE_DONE) {
+    return Status(1, sqlite3_errmsg(db));
+  }
+  return Status(0, "OK");
+}
+
+/// Number of SQLite virtual machine instructions between budget checks.
+const int kQueryBudgetProgressSteps = 10000;
+
+static int queryBudgetProgress(void*) {
+  // A non-zero return interrupts the statement.
+  return QueryBudgetScope::check() ? 0 : 1;
 }
 
 SQLiteDBInstance::~SQLiteDBInstance() {
+  // A connection with unfinalized statements cannot be closed.
+  statements_.clear();
   if (!isPrimary()) {
     sqlite3_close(db_);
   } else {
@@ -260,13 +778,125 @@ SQLiteDBInstanceRef SQLiteDBManager::getConnection(bool primary) {
 
   // Create a 'database connection' for the managed database instance.
   auto instance = std::make_shared<SQLiteDBInstance>(self.db_, self.mutex_);
-  if (!instance->isPrimary()) {
-    attachVirtualTables(instance);
+  if (instance->isPrimary()) {
+    return instance;
   }
-  return instance;
+
+  // The primary database is in use, do not block other connection requests
+  // while a transient connection is attached.
+  lock.unlock();
+  return getPooledConnection();
+}
+
+SQLiteDBInstanceRef SQLiteDBManager::getPooledConnection() {
+  auto& self = instance();
+  auto release = [](SQLiteDBInstance* dbc) { SQLiteDBManager::release(dbc); };
+
+  size_t generation = 0;
+  {
+    std::unique_lock<std::mutex> lock(self.pool_mutex_);
+    if (!self.pool_.empty()) {
+      auto dbc = self.pool_.front().release();
+      self.pool_.pop_front();
+      return SQLiteDBInstanceRef(dbc, release);
+    }
+    generation = self.pool_generation_;
+  }
+
+  VLOG(1) << "DBManager contention: opening transient SQLite database";
+  auto dbc = SQLiteDBInstanceRef(new SQLiteDBInstance(), release);
+  dbc->generation_ = generation;
+  attachVirtualTables(dbc);
+  return dbc;
+}
+
+void SQLiteDBManager::release(SQLiteDBInstance* dbc) {
+  std::unique_ptr<SQLiteDBInstance> connection(dbc);
+  if (!kSQLitePoolActive) {
+    return;
+  }
+
+  // Per-query state must not leak into the next use of the connection.
+  connection->clearAffectedTables();
+  auto& self = instance();
+  std::unique_lock<std::mutex> lock(self.pool_mutex_);
+  if (connection->generation_ != self.pool_generation_) {
+    // Virtual tables were attached or detached since this connection was.
+    return;
+  }
+
+  self.pool_.push_front(std::move(connection));
+  while (self.pool_.size() > FLAGS_sqlite_pool_size) {
+    // Close the least recently used connections.
+    self.pool_.pop_back();
+  }
+}
+
+void SQLiteDBManager::resetPool() {
+  // Query columns may reference the tables that changed.
+  SQLiteColumnCache::get().clear();
+  auto& self = instance();
+  std::unique_lock<std::mutex> lock(self.pool_mutex_);
+  self.pool_generation_++;
+  self.pool_.clear();
+}
+
+/// Remove the whitespace and semicolons surrounding SQL.
+static std::string columnsKey(const std::string& q) {
+  const char* kSurrounding = " \t\r\n;";
+  auto start = q.find_first_not_of(kSurrounding);
+  if (start == std::string::npos) {
+    return "";
+  }
+  return q.substr(start, q.find_last_not_of(kSurrounding) - start + 1);
+}
+
+SQLiteColumnCache& SQLiteColumnCache::get() {
+  static SQLiteColumnCache cache;
+  return cache;
+}
+
+bool SQLiteColumnCache::find(const std::string& q,
+                             TableColumns& columns,
+                             size_t& generation) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  generation = generation_;
+  auto it = columns_.find(columnsKey(q));
+  if (it == columns_.end()) {
+    return false;
+  }
+  columns = it->second;
+  return true;
+}
+
+void SQLiteColumnCache::set(const std::string& q,
+                            const TableColumns& columns,
+                            size_t generation) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (generation != generation_) {
+    // The columns were computed with tables that changed since.
+    return;
+  }
+  if (columns_.size() >= kSQLiteColumnsCached) {
+    columns_.clear();
+  }
+  columns_[columnsKey(q)] = columns;
+}
+
+void SQLiteColumnCache::clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  generation_++;
+  columns_.clear();
+}
+
+size_t SQLiteColumnCache::size() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return columns_.size();
 }
 
 SQLiteDBManager::~SQLiteDBManager() {
+  kSQLitePoolActive = false;
+  pool_.clear();
   connection_ = nullptr;
   if (db_ != nullptr) {
     sqlite3_close(db_);
@@ -329,6 +959,7 @@ int queryDataCallback(void* argument, int argc, char* argv[], char* column[]) {
 
   QueryData* qData = (QueryData*)argument;
   Row r;
+  r.reserve(argc);
   for (int i = 0; i < argc; i++) {
     if (column[i] != nullptr) {
       r[column[i]] = (argv[i] != nullptr) ? argv[i] : "";
@@ -339,8 +970,18 @@ int queryDataCallback(void* argument, int argc, char* argv[], char* column[]) {
 }
 
 Status queryInternal(const std::string& q, QueryData& results, sqlite3* db) {
+  // Check the calling thread's budget while non-virtual table work executes.
+  bool budget = QueryBudgetScope::active();
+  if (budget) {
+    sqlite3_progress_handler(
+        db, kQueryBudgetProgressSteps, queryBudgetProgress, nullptr);
+  }
+
   char* err = nullptr;
   sqlite3_exec(db, q.c_str(), queryDataCallback, &results, &err);
+  if (budget) {
+    sqlite3_progress_handler(db, 0, nullptr, nullptr);
+  }
   sqlite3_db_release_memory(db);
   if (err != nullptr) {
     auto error_string = std::string(err);
@@ -350,6 +991,148 @@ Status queryInternal(const std::string& q, QueryData& results, sqlite3* db) {
   return Status(0, "OK");
 }
 
+/// Step a prepared statement, accumulating its rows as queryDataCallback does.
+static Status stepStatement(sqlite3_stmt* stmt,
+                            QueryData& results,
+                            sqlite3* db) {
+  // Column names are copied once for the statement, not for each row.
+  auto count = sqlite3_column_count(stmt);
+  std::vector<std::pair<int, std::string>> columns;
+  columns.reserve(count);
+  for (int i = 0; i < count; i++) {
+    auto name = sqlite3_column_name(stmt, i);
+    if (name != nullptr) {
+      columns.push_back(std::make_pair(i, std::string(name)));
+    }
+  }
+
+  int rc = SQLITE_OK;
+  while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+    Row r;
+    r.reserve(columns.size());
+    for (const auto& column : columns) {
+      auto& value = r[column.second];
+      switch (sqlite3_column_type(stmt, column.first)) {
+      case SQLITE_NULL:
+        value.clear();
+        break;
+      case SQLITE_INTEGER:
+        // Integers are not converted to text within SQLite.
+        value = std::to_string(sqlite3_column_int64(stmt, column.first));
+        break;
+      default: {
+        auto text = sqlite3_column_text(stmt, column.first);
+        value = (text != nullptr) ? reinterpret_cast<const char*>(text) : "";
+      }
+      }
+    }
+    results.push_back(std::move(r));
+  }
+
+  Status status(0, "OK");
+  if (rc != SQLITE_DONE) {
+    status = Status(1, "Error running query: " +
+                           std::string(sqlite3_errmsg(db)));
+  }
+  sqlite3_reset(stmt);
+  return status;
+}
+
+/// The number of times SQLite prepared a statement again, -1 if unknown.
+static inline int reprepareCount(sqlite3_stmt* stmt) {
+#if defined(SQLITE_STMTSTATUS_REPREPARE)
+  return sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_REPREPARE, 0);
+#else
+  return -1;
+#endif
+}
+
+Status queryInternal(const std::string& q,
+                     QueryData& results,
+                     const SQLiteDBInstanceRef& dbc) {
+  auto& statements = dbc->statements();
+  auto* stmt = statements.get(q, dbc->db());
+  if (stmt == nullptr) {
+    return queryInternal(q, results, dbc->db());
+  }
+
+  bool budget = QueryBudgetScope::active();
+  if (budget) {
+    sqlite3_progress_handler(
+        dbc->db(), kQueryBudgetProgressSteps, queryBudgetProgress, nullptr);
+  }
+
+  // A statement is prepared again while stepping if the schema changed.
+  auto first = nextConstraintIndex();
+  auto prepares = reprepareCount(stmt);
+  auto status = stepStatement(stmt, results, dbc->db());
+  if (budget) {
+    sqlite3_progress_handler(dbc->db(), 0, nullptr, nullptr);
+  }
+  sqlite3_db_release_memory(dbc->db());
+  if (!status.ok()) {
+    // The statement is prepared again when the SQL is next repeated.
+    statements.evict(q);
+  } else if (prepares < 0 && first != nextConstraintIndex()) {
+    // Without the count, a statement that may have planned again is not kept.
+    statements.evict(q);
+  } else if (prepares != reprepareCount(stmt)) {
+    statements.planned(q, first, nextConstraintIndex());
+  }
+  return status;
+}
+
+/// The state of a streaming query, see queryInternal.
+struct RowCallbackState {
+  explicit RowCallbackState(const RowCallback& cb) : callback(cb) {}
+
+  const RowCallback& callback;
+  bool stopped{false};
+};
+
+static int rowCallback(void* argument, int argc, char* argv[], char* column[]) {
+  auto* state = static_cast<RowCallbackState*>(argument);
+  Row r;
+  r.reserve(argc);
+  for (int i = 0; i < argc; i++) {
+    if (column[i] != nullptr) {
+      r[column[i]] = (argv[i] != nullptr) ? argv[i] : "";
+    }
+  }
+  if (!state->callback(std::move(r))) {
+    // A non-zero return aborts the statement.
+    state->stopped = true;
+    return 1;
+  }
+  return 0;
+}
+
+Status queryInternal(const std::string& q,
+                     const RowCallback& callback,
+                     sqlite3* db) {
+  bool budget = QueryBudgetScope::active();
+  if (budget) {
+    sqlite3_progress_handler(
+        db, kQueryBudgetProgressSteps, queryBudgetProgress, nullptr);
+  }
+
+  char* err = nullptr;
+  RowCallbackState state(callback);
+  sqlite3_exec(db, q.c_str(), rowCallback, &state, &err);
+  if (budget) {
+    sqlite3_progress_handler(db, 0, nullptr, nullptr);
+  }
+  sqlite3_db_release_memory(db);
+  if (err != nullptr) {
+    auto error_string = std::string(err);
+    sqlite3_free(err);
+    if (!state.stopped) {
+      return Status(1, "Error running query: " + error_string);
+    }
+  }
+  return Status(0, "OK");
+}
+
 Status getQueryColumnsInternal(const std::string& q,
                                TableColumns& columns,
                                sqlite3* db) {
@@ -11,8 +11,14 @@
 #pragma once
 
 #include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <list>
 #include <map>
 #include <mutex>
+#include <set>
+#include <unordered_map>
 #include <unordered_set>
 
 #include <sqlite3.h>
@@ -27,6 +33,89 @@ namespace osquery {
 
 class SQLiteDBManager;
 
+/**
+ * @brief Prepared statements kept by a connection, keyed by their SQL.
+ *
+ * Scheduled and decorator queries execute the same SQL many times, a cached
+ * statement is stepped again without parsing and planning the SQL. The SQL
+ * of a statement is only prepared and kept once it is executed a second
+ * time, so one-off queries do not evict the repeated statements. The most
+ * recently used `--sqlite_statement_cache` statements are kept.
+ *
+ * The virtual tables keep the constraint sets planned for a statement by
+ * their xBestIndex IDs, a kept statement pins its sets so they are not cleared
+ * with the affected tables after each query.
+ *
+ * A cache is only used by the thread holding its connection.
+ */
+class SQLiteStatementCache : private boost::noncopyable {
+ public:
+  ~SQLiteStatementCache() { clear(); }
+
+  /**
+   * @brief Get a statement to step and then reset for a single SQL statement.
+   *
+   * @param q the SQL to prepare.
+   * @param db the connection owning this cache.
+   * @return a kept statement, or nullptr if the SQL should be executed.
+   */
+  sqlite3_stmt* get(const std::string& q, sqlite3* db);
+
+  /// Pin the constraint sets planned while re-preparing a kept statement.
+  void planned(const std::string& q, size_t first, size_t last);
+
+  /// Check if a constraint set was planned for a kept statement.
+  bool pinned(size_t index) const { return pinned_.count(index) > 0; }
+
+  /// The constraint set IDs planned for the kept statement planning a set.
+  std::vector<size_t> plans(size_t index) const;
+
+  /// Finalize the statement for the SQL, such as when its tables changed.
+  void evict(const std::string& q);
+
+  /// Finalize every statement, before the connection is closed.
+  void clear();
+
+  /// The number of kept statements.
+  size_t size() const { return statements_.size(); }
+
+ private:
+  struct Statement {
+    std::string sql;
+    sqlite3_stmt* stmt{nullptr};
+
+    /// The constraint set IDs planned for the statement.
+    std::vector<size_t> plans;
+  };
+
+  /// Pin the constraint sets with IDs from first up to last.
+  void pin(Statement& statement, size_t first, size_t last);
+
+  /// Finalize a statement and unpin its constraint sets.
+  void release(Statement& statement);
+
+ private:
+  /// Kept statements, the most recently used first.
+  std::list<Statement> statements_;
+
+  /// Kept statements by their SQL.
+  std::unordered_map<std::string, std::list<Statement>::iterator> index_;
+
+  /// Constraint set IDs planned for kept statements.
+  std::unordered_set<size_t> pinned_;
+
+  /// Hashes of SQL executed once, cleared when it grows too large.
+  std::unordered_set<size_t> seen_;
+};
+
+/// The table planning a constraint set, see SQLiteDBInstance::addPlan.
+struct SQLiteTablePlan {
+  VirtualTableContent* table{nullptr};
+
+  /// Every constraint of the set compares with a literal value.
+  bool literal{false};
+};
+
 /**
  * @brief An RAII wrapper around an `sqlite3` object.
  *
@@ -36,7 +125,7 @@ class SQLiteDBManager;
  *
  * If there is resource contention (multiple threads want access to the SQLite
  * abstraction layer), then the SQLiteDBManager will provide a transient
- * SQLiteDBInstance.
+ * SQLiteDBInstance from a pool of connections with virtual tables attached.
  */
 class SQLiteDBInstance : private boost::noncopyable {
  public:
@@ -62,6 +151,45 @@ class SQLiteDBInstance : private boost::noncopyable {
   /// Clear per-query state of a table affected by the use of this instance.
   void clearAffectedTables();
 
+  /**
+   * @brief Retrieve rows generated by a table earlier in the same statement.
+   *
+   * A statement may open several cursors on a table, such as self-joins and
+   * correlated subqueries. Cursors with equivalent constraints share a single
+   * generation, the results are released in clearAffectedTables.
+   *
+   * @param key A table name and normalized constraint set.
+   * @return The generated rows, or nullptr if they are not cached.
+   */
+  std::shared_ptr<const QueryData> getGenerated(const std::string& key) const;
+
+  /// Keep generated rows for the duration of the statement, see getGenerated.
+  void setGenerated(const std::string& key,
+                    std::shared_ptr<const QueryData> data);
+
+  /**
+   * @brief Keep a generation started before a cursor filters its table.
+   *
+   * Tables planned with only literal constraints do not depend on the rows of
+   * other tables, and their generation may start as the statement is first
+   * filtered. getGenerated waits for a pending generation with the key.
+   */
+  void setPending(const std::string& key,
+                  std::shared_future<std::shared_ptr<const QueryData>> data);
+
+  /// Record the table planning a constraint set, see statementPlans.
+  void addPlan(size_t index, VirtualTableContent* table, bool literal);
+
+  /// The tables planning each constraint set of the statement using a set.
+  std::vector<std::pair<size_t, SQLiteTablePlan>> statementPlans(
+      size_t index) const;
+
+  /// Check and mark if pending generations were started for the statement.
+  bool startPending();
+
+  /// Prepared statements for this connection, see SQLiteStatementCache.
+  SQLiteStatementCache& statements();
+
  private:
   /// An opaque constructor only used by the DBManager.
   explicit SQLiteDBInstance(sqlite3* db)
@@ -83,6 +211,26 @@ class SQLiteDBInstance : private boost::noncopyable {
   /// Vector of tables that need their constraints cleared after execution.
   std::map<std::string, VirtualTableContent*> affected_tables_;
 
+  /// Statement-scoped table generation results, keyed by table and context.
+  std::unordered_map<std::string, std::shared_ptr<const QueryData>> generated_;
+
+  /// Generations started before their tables were filtered, see setPending.
+  std::unordered_map<std::string,
+                     std::shared_future<std::shared_ptr<const QueryData>>>
+      pending_;
+
+  /// The table planning each constraint set, keyed like the constraints.
+  std::unordered_map<size_t, SQLiteTablePlan> plans_;
+
+  /// Set once the statement's pending generations were started.
+  bool started_pending_{false};
+
+  /// The connection pool generation this transient instance was attached in.
+  size_t generation_{0};
+
+  /// Prepared statements, finalized before the database is closed.
+  SQLiteStatementCache statements_;
+
  private:
   friend class SQLiteDBManager;
 
@@ -92,6 +240,52 @@ class SQLiteDBInstance : private boost::noncopyable {
 
 using SQLiteDBInstanceRef = std::shared_ptr<SQLiteDBInstance>;
 
+/**
+ * @brief The result columns and types of SQL, see SQLiteSQLPlugin.
+ *
+ * Distributed queries and extensions ask for the columns of the same SQL
+ * repeatedly, and each request prepares the SQL and may run a QueryPlanner.
+ * The columns only change when virtual tables are attached or detached, which
+ * clears the cache. SQL is keyed without its surrounding whitespace and
+ * semicolons.
+ */
+class SQLiteColumnCache : private boost::noncopyable {
+ public:
+  /// The cache shared by every connection of the SQLiteDBManager.
+  static SQLiteColumnCache& get();
+
+  /**
+   * @brief Retrieve the columns of SQL.
+   *
+   * @param q the SQL.
+   * @param columns the output columns, if they are kept.
+   * @param generation the output generation to keep columns computed later.
+   * @return true if the columns were kept.
+   */
+  bool find(const std::string& q, TableColumns& columns, size_t& generation);
+
+  /// Keep columns computed since find, unless the cache was cleared since.
+  void set(const std::string& q,
+           const TableColumns& columns,
+           size_t generation);
+
+  /// Drop every entry, the attached virtual tables changed.
+  void clear();
+
+  /// The number of SQL statements with kept columns.
+  size_t size() const;
+
+ private:
+  /// Columns by SQL.
+  std::unordered_map<std::string, TableColumns> columns_;
+
+  /// Incremented each time the cache is cleared.
+  size_t generation_{0};
+
+  /// Protection around the columns, extensions may request concurrently.
+  mutable std::mutex mutex_;
+};
+
 /**
  * @brief osquery internal SQLite DB abstraction resource management.
  *
@@ -170,11 +364,357 @@ class SQLiteDBManager : private boost::noncopyable {
   /// Request a connection, optionally request the primary connection.
   static SQLiteDBInstanceRef getConnection(bool primary = false);
 
+  /// Reuse an idle transient connection, or create and attach a new one.
+  static SQLiteDBInstanceRef getPooledConnection();
+
+  /// Return a transient connection to the pool, or close it.
+  static void release(SQLiteDBInstance* dbc);
+
+  /// Close idle connections, their attached virtual tables are outdated.
+  static void resetPool();
+
+ private:
+  /// Idle transient connections, the most recently used first.
+  std::list<std::unique_ptr<SQLiteDBInstance>> pool_;
+
+  /// Incremented when the set of attached virtual tables changes.
+  size_t pool_generation_{0};
+
+  /// Mutex around the connection pool.
+  std::mutex pool_mutex_;
+
  private:
   friend class SQLiteDBInstance;
   friend class SQLiteSQLPlugin;
+
+ private:
+  FRIEND_TEST(SQLiteUtilTests, test_sqlite_connection_pool);
+  FRIEND_TEST(SQLiteUtilTests, test_query_columns_cache);
+};
+
+/**
+ * @brief Table generations shared by the scheduled queries of a schedule step.
+ *
+ * Scheduled queries due in the same step often scan the same tables. While a
+ * snapshot is active for the calling thread, see TableSnapshotScope, a scan of
+ * one of its tables generates every column once and the rows are reused by
+ * each query with equivalent constraints until the snapshot is released.
+ */
+class TableSnapshot : private boost::noncopyable {
+ public:
+  explicit TableSnapshot(std::set<std::string> tables)
+      : tables_(std::move(tables)) {}
+
+  /// Check if scans of a table are shared by the snapshot.
+  bool contains(const std::string& table) const {
+    return tables_.count(table) > 0;
+  }
+
+  /// Retrieve previously generated rows, see SQLiteDBInstance::getGenerated.
+  std::shared_ptr<const QueryData> get(const std::string& key);
+
+  /// Keep generated rows for the life of the snapshot.
+  void set(const std::string& key, std::shared_ptr<const QueryData> data);
+
+  /// Number of table generations avoided by reusing the snapshot.
+  size_t saved() const { return saved_; }
+
+  /// The snapshot active for the calling thread, or nullptr.
+  static TableSnapshot* current();
+
+ private:
+  /// The tables whose scans are shared.
+  std::set<std::string> tables_;
+
+  /// Generated rows, keyed by table and normalized constraints.
+  std::unordered_map<std::string, std::shared_ptr<const QueryData>> generated_;
+
+  /// Number of table generations avoided.
+  std::atomic<size_t> saved_{0};
+
+  /// Protection around generated rows, queries may execute concurrently.
+  std::mutex mutex_;
+};
+
+/// Activate a TableSnapshot for the calling thread while in scope.
+class TableSnapshotScope : private boost::noncopyable {
+ public:
+  explicit TableSnapshotScope(std::shared_ptr<TableSnapshot> snapshot);
+  ~TableSnapshotScope();
+
+  /// Number of table generations the calling thread reused while in scope.
+  size_t saved() const;
+
+ private:
+  /// The active snapshot, kept alive while in scope.
+  std::shared_ptr<TableSnapshot> snapshot_;
+
+  /// A previously active snapshot, restored when the scope ends.
+  TableSnapshot* previous_{nullptr};
+
+  /// The calling thread's count of reused generations when scope began.
+  size_t start_{0};
+};
+
+/**
+ * @brief The newest table generations of the scheduled queries' snapshots.
+ *
+ * With `--table_max_staleness`, the rows generated for a TableSnapshot are
+ * also kept here, by table and normalized constraints, for that many seconds.
+ * Statements executed within a TableStalenessScope, such as distributed and
+ * decorator queries, reuse a generation young enough for the scope instead of
+ * generating the table again.
+ */
+class RecentGenerations : private boost::noncopyable {
+ public:
+  /// The generations shared by every connection.
+  static RecentGenerations& get();
+
+  /// Keep a table generation, replacing an older one with the key.
+  void set(const std::string& key, std::shared_ptr<const QueryData> data);
+
+  /// Retrieve a generation at most a number of seconds old, or nullptr.
+  std::shared_ptr<const QueryData> find(const std::string& key,
+                                        size_t max_staleness);
+
+  /// The number of generations kept.
+  size_t size() const;
+
+  /// Drop every generation.
+  void clear();
+
+ private:
+  struct Generation {
+    std::chrono::steady_clock::time_point time;
+    std::shared_ptr<const QueryData> data;
+  };
+
+  /// The newest generation of each table and constraints.
+  std::unordered_map<std::string, Generation> generations_;
+
+  /// Protection around the generations, queries may execute concurrently.
+  mutable std::mutex mutex_;
+};
+
+/// Allow reads of RecentGenerations by the calling thread while in scope.
+class TableStalenessScope : private boost::noncopyable {
+ public:
+  /// Allow generations at most a number of seconds old, 0 for none.
+  explicit TableStalenessScope(size_t max_staleness);
+  ~TableStalenessScope();
+
+  /// Number of table generations the calling thread reused while in scope.
+  size_t saved() const;
+
+  /// The seconds of staleness allowed for the calling thread, or 0.
+  static size_t current();
+
+ private:
+  /// A previously allowed staleness, restored when the scope ends.
+  size_t previous_{0};
+
+  /// The calling thread's count of reused generations when scope began.
+  size_t start_{0};
+};
+
+/// Limits applied to the statements executed by a thread, 0 for no limit.
+struct QueryBudget {
+  /// Maximum number of rows generated by virtual tables.
+  size_t max_rows{0};
+
+  /// Maximum number of bytes, column names and values, generated.
+  size_t max_bytes{0};
+
+  /// Maximum number of milliseconds spent executing.
+  size_t max_time{0};
+
+  /// Maximum milliseconds of user and system CPU time used by the thread.
+  size_t max_cpu_time{0};
+
+  /// Check if any limit is set.
+  bool empty() const {
+    return max_rows == 0 && max_bytes == 0 && max_time == 0 &&
+           max_cpu_time == 0;
+  }
+};
+
+/**
+ * @brief Apply a QueryBudget to statements executed by the calling thread.
+ *
+ * While in scope, virtual table cursors account for the rows and bytes they
+ * generate and a progress handler checks the elapsed time. A statement that
+ * exceeds the budget is aborted with SQLITE_INTERRUPT.
+ */
+class QueryBudgetScope : private boost::noncopyable {
+ public:
+  explicit QueryBudgetScope(const QueryBudget& budget);
+  ~QueryBudgetScope();
+
+  /// Check if the budget was exceeded while in scope.
+  bool exceeded() const { return !reason_.empty(); }
+
+  /// A description of the exceeded limit.
+  const std::string& reason() const { return reason_; }
+
+  /**
+   * @brief Account for generated rows within the calling thread's budget.
+   *
+   * @return false if a budget is active and was exceeded, otherwise true.
+   */
+  static bool consume(size_t rows, size_t bytes);
+
+  /// Check the elapsed time of the calling thread's budget, see consume.
+  static bool check();
+
+  /// Check if a budget is active for the calling thread.
+  static bool active();
+
+ private:
+  /// The limits.
+  QueryBudget budget_;
+
+  /// Rows generated while in scope.
+  size_t rows_{0};
+
+  /// Bytes generated while in scope.
+  size_t bytes_{0};
+
+  /// When the scope began.
+  std::chrono::steady_clock::time_point start_;
+
+  /// Milliseconds of CPU time the thread used when the scope began.
+  size_t cpu_start_{0};
+
+  /// A description of the exceeded limit, empty if within budget.
+  std::string reason_;
+
+  /// A previously active budget, restored when the scope ends.
+  QueryBudgetScope* previous_{nullptr};
+};
+
+/// The generation cost of one virtual table cursor, see QueryProfileScope.
+struct CursorProfile {
+  /// The cursor's table name.
+  std::string table;
+
+  /// Number of xFilter calls, one per scan of the table.
+  size_t filters{0};
+
+  /// Rows produced by the table's generator, including reused rows.
+  size_t rows_generated{0};
+
+  /// Rows presented to SQLite, fewer than generated if the scan stopped.
+  size_t rows_returned{0};
+
+  /// Microseconds spent filtering and generating within the cursor.
+  size_t generate_time{0};
+
+  /// Bytes of generated column values, column names included for row data.
+  size_t bytes{0};
+
+  /// Heap allocations made filtering and generating, see allocations.h.
+  size_t allocations{0};
+
+  /// Bytes of heap allocations made filtering and generating.
+  size_t allocated_bytes{0};
 };
 
+/**
+ * @brief Record the generation cost of each cursor opened by the calling
+ * thread's statements.
+ *
+ * While in scope each virtual table cursor counts its filters, generated and
+ * returned rows, the time spent generating, and the bytes generated. The
+ * shell's `.profile` mode reports the cursors of each statement.
+ */
+class QueryProfileScope : private boost::noncopyable {
+ public:
+  QueryProfileScope();
+  ~QueryProfileScope();
+
+  /// The profiled cursors by cursor id.
+  const std::map<size_t, CursorProfile>& cursors() const { return cursors_; }
+
+  /**
+   * @brief Access a cursor's profile within the calling thread's scope.
+   *
+   * @param id the cursor id.
+   * @param table the cursor's table name, used for a new profile.
+   * @return nullptr if no profile scope is active.
+   */
+  static CursorProfile* cursor(size_t id, const std::string& table);
+
+  /// Check if a profile is active for the calling thread.
+  static bool active();
+
+ private:
+  /// The profiled cursors.
+  std::map<size_t, CursorProfile> cursors_;
+
+  /// A previously active profile, restored when the scope ends.
+  QueryProfileScope* previous_{nullptr};
+};
+
+/// The planner's estimate of one table scan, see getQueryScans.
+struct QueryScanEstimate {
+  /// The scanned table name.
+  std::string table;
+
+  /// Rows expected from a scan, from the table's hints, 0 if unknown.
+  double rows{0};
+
+  /// The relative expense of a row, see TableStatistics.
+  double cost{1};
+
+  /// The scan is constrained by other tables, and filtered for each row.
+  bool dependent{false};
+};
+
+/**
+ * @brief Record the planner's estimates while the calling thread plans.
+ *
+ * While in scope xBestIndex records the estimate of each constraint set it
+ * plans, by the set's index, which the plan of the statement reports.
+ */
+class QueryScanScope : private boost::noncopyable {
+ public:
+  QueryScanScope();
+  ~QueryScanScope();
+
+  /// The estimates by constraint set index.
+  const std::map<size_t, QueryScanEstimate>& estimates() const {
+    return estimates_;
+  }
+
+  /// Record a constraint set's estimate within the calling thread's scope.
+  static void record(size_t index, QueryScanEstimate&& estimate);
+
+  /// Check if a scope is active for the calling thread.
+  static bool active();
+
+ private:
+  std::map<size_t, QueryScanEstimate> estimates_;
+
+  /// A previously active scope, restored when the scope ends.
+  QueryScanScope* previous_{nullptr};
+};
+
+/**
+ * @brief Estimate the virtual table scans of a query without executing it.
+ *
+ * The query is planned with EXPLAIN QUERY PLAN, and the scans are returned
+ * in the order of the plan's loops, outermost first. Planning records the
+ * constraints of the tables, clear the affected tables of the connection
+ * after use.
+ *
+ * @param q the query.
+ * @param scans output, the estimate of each virtual table scan.
+ * @param db the SQLite database.
+ */
+Status getQueryScans(const std::string& q,
+                     std::vector<QueryScanEstimate>& scans,
+                     sqlite3* db);
+
 /**
  * @brief A barebones query planner based on SQLite explain statement results.
  *
@@ -256,6 +796,41 @@ extern const std::map<std::string, QueryPlanner::Opcode> kSQLOpcodes;
  */
 Status queryInternal(const std::string& q, QueryData& results, sqlite3* db);
 
+/**
+ * @brief SQLite Internal: Execute a query using the connection's statements.
+ *
+ * Repeated SQL is stepped from a cached prepared statement, see
+ * SQLiteStatementCache. The results are the same as the uncached queryInternal.
+ *
+ * @param q the query to execute
+ * @param results The QueryData struct to emit row on query success.
+ * @param dbc the connection to execute query q against
+ *
+ * @return A status indicating SQL query results.
+ */
+Status queryInternal(const std::string& q,
+                     QueryData& results,
+                     const SQLiteDBInstanceRef& dbc);
+
+/// Receive a result row as it is produced, return false to stop the query.
+using RowCallback = std::function<bool(Row&& row)>;
+
+/**
+ * @brief SQLite Internal: Execute a query, streaming each row to a callback.
+ *
+ * Rows are not accumulated, the caller bounds the memory used by results.
+ * A query stopped by the callback still returns success.
+ *
+ * @param q the query to execute
+ * @param callback called with each row
+ * @param db the SQLite3 database to execute query q against
+ *
+ * @return A status indicating SQL query results.
+ */
+Status queryInternal(const std::string& q,
+                     const RowCallback& callback,
+                     sqlite3* db);
+
 /**
  * @brief SQLite Intern: Analyze a query, providing information about the
  * result columns
@@ -104,5 +104,27 @@ TEST_F(SQLTests, test_sql_escape) {
   input = "The quick brown fox jumps over the lazy dog.";
   escapeNonPrintableBytesEx(input);
   EXPECT_EQ(input, "The quick brown fox jumps over the lazy dog.");
+
+  // Control characters are escaped at any offset within or after a word.
+  input = std::string("0123456789abcdef\x01", 17);
+  escapeNonPrintableBytesEx(input);
+  EXPECT_EQ(input, "0123456789abcdef\\x01");
+
+  input = std::string("01234567\x1f", 9);
+  escapeNonPrintableBytesEx(input);
+  EXPECT_EQ(input, "01234567\\x1F");
+
+  input = std::string("\t0123456789", 11);
+  escapeNonPrintableBytesEx(input);
+  EXPECT_EQ(input, "\\x090123456789");
+
+  // Space and DEL are not escaped.
+  input = " ~\x7f";
+  escapeNonPrintableBytesEx(input);
+  EXPECT_EQ(input, " ~\x7f");
+
+  input = std::string("ab\0cd", 5);
+  escapeNonPrintableBytesEx(input);
+  EXPECT_EQ(input, "ab\\x00cd");
 }
 }
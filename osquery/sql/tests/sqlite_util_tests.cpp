@@ -55,6 +55,34 @@ TEST_F(SQLiteUtilTests, test_sqlite_instance_manager) {
   EXPECT_EQ(dbc1->db(), dbc1->db());
 }
 
+TEST_F(SQLiteUtilTests, test_sqlite_connection_pool) {
+  auto primary = SQLiteDBManager::get();
+  EXPECT_TRUE(primary->isPrimary());
+
+  // A contended request uses a transient connection that is then pooled.
+  sqlite3* transient = nullptr;
+  {
+    auto dbc = SQLiteDBManager::get();
+    EXPECT_FALSE(dbc->isPrimary());
+    transient = dbc->db();
+  }
+  EXPECT_FALSE(SQLiteDBManager::instance().pool_.empty());
+
+  // The next contended request reuses the attached connection.
+  {
+    auto dbc = SQLiteDBManager::get();
+    EXPECT_EQ(dbc->db(), transient);
+    QueryData results;
+    auto status = queryInternal("SELECT * FROM time", results, dbc->db());
+    EXPECT_TRUE(status.ok());
+    EXPECT_EQ(results.size(), 1U);
+  }
+
+  // Changes to the attached tables close idle connections.
+  SQLiteDBManager::resetPool();
+  EXPECT_TRUE(SQLiteDBManager::instance().pool_.empty());
+}
+
 TEST_F(SQLiteUtilTests, test_sqlite_instance) {
   // Don't do this at home kids.
   // Keep a copy of the internal DB and let the SQLiteDBInstance go oos.
@@ -72,6 +100,40 @@ TEST_F(SQLiteUtilTests, test_direct_query_execution) {
   EXPECT_EQ(results, getTestDBExpectedResults());
 }
 
+TEST_F(SQLiteUtilTests, test_statement_cache) {
+  auto dbc = getTestDBC();
+  auto& statements = dbc->statements();
+
+  // A statement is kept once its SQL is repeated, with the same results.
+  for (size_t i = 0; i < 3; i++) {
+    QueryData results;
+    auto status = queryInternal(kTestQuery, results, dbc);
+    EXPECT_TRUE(status.ok());
+    EXPECT_EQ(results, getTestDBExpectedResults());
+    EXPECT_EQ(statements.size(), (i > 0) ? 1U : 0U);
+  }
+
+  // Kept statements on virtual tables keep their planned constraints.
+  for (size_t i = 0; i < 3; i++) {
+    QueryData results;
+    auto status =
+        queryInternal("SELECT * FROM time WHERE hour >= 0", results, dbc);
+    dbc->clearAffectedTables();
+    EXPECT_TRUE(status.ok());
+    EXPECT_EQ(results.size(), 1U);
+  }
+  EXPECT_EQ(statements.size(), 2U);
+
+  // Several statements are not kept, and errors are reported.
+  auto queries = kTestQuery + "; " + kTestQuery;
+  for (size_t i = 0; i < 2; i++) {
+    QueryData results;
+    EXPECT_TRUE(queryInternal(queries, results, dbc).ok());
+    EXPECT_FALSE(queryInternal("SELECT * FROM no_table", results, dbc).ok());
+  }
+  EXPECT_EQ(statements.size(), 2U);
+}
+
 TEST_F(SQLiteUtilTests, test_passing_callback_no_data_param) {
   char* err = nullptr;
   auto dbc = getTestDBC();
@@ -137,6 +199,47 @@ TEST_F(SQLiteUtilTests, test_get_query_columns) {
   ASSERT_FALSE(status.ok());
 }
 
+TEST_F(SQLiteUtilTests, test_query_columns_cache) {
+  auto& cache = SQLiteColumnCache::get();
+  cache.clear();
+  TableColumns columns;
+  size_t generation = 0;
+  EXPECT_FALSE(cache.find("SELECT 1", columns, generation));
+  cache.set(
+      "SELECT 1", {std::make_tuple("1", INTEGER_TYPE, DEFAULT)}, generation);
+
+  // Whitespace and semicolons surrounding the SQL are ignored.
+  ASSERT_TRUE(cache.find("  SELECT 1;\n", columns, generation));
+  ASSERT_EQ(columns.size(), 1U);
+  EXPECT_EQ(std::get<0>(columns[0]), "1");
+
+  // Columns computed before the cache is cleared are not kept.
+  EXPECT_FALSE(cache.find("SELECT 2", columns, generation));
+  cache.clear();
+  cache.set("SELECT 2", columns, generation);
+  EXPECT_FALSE(cache.find("SELECT 2", columns, generation));
+  EXPECT_EQ(cache.size(), 0U);
+
+  // The SQL plugin keeps the columns it introspects.
+  SQLiteSQLPlugin plugin;
+  auto status = plugin.getQueryColumns("SELECT seconds FROM time", columns);
+  ASSERT_TRUE(status.ok());
+  EXPECT_EQ(cache.size(), 1U);
+  columns.clear();
+  status = plugin.getQueryColumns("SELECT seconds FROM time;", columns);
+  ASSERT_TRUE(status.ok());
+  ASSERT_EQ(columns.size(), 1U);
+  EXPECT_EQ(std::make_tuple(std::string("seconds"), INTEGER_TYPE, DEFAULT),
+            columns[0]);
+
+  // Errors are not kept, and changing the tables clears the cache.
+  status = plugin.getQueryColumns("SELECT * FROM foo", columns);
+  EXPECT_FALSE(status.ok());
+  EXPECT_EQ(cache.size(), 1U);
+  SQLiteDBManager::resetPool();
+  EXPECT_EQ(cache.size(), 0U);
+}
+
 std::vector<ColumnType> getTypes(const TableColumns& columns) {
   std::vector<ColumnType> types;
   for (const auto& col : columns) {
@@ -145,6 +248,46 @@ std::vector<ColumnType> getTypes(const TableColumns& columns) {
   return types;
 }
 
+TEST_F(SQLiteUtilTests, test_string_functions) {
+  auto dbc = getTestDBC();
+  QueryData results;
+  auto status = queryInternal(
+      "select split('192.168.0.1', '.', 1) as a, "
+      "split(' a , ,b', ',', 1) as b, split('a.b', '.', 2) as c, "
+      "regex_split('192.168.0.1', '\\.0', 0) as d, "
+      "regex_split('a.', '\\.', 1) as e, regex_split('abc', 'x*', 0) as f",
+      results,
+      dbc->db());
+  ASSERT_TRUE(status.ok());
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0]["a"], "168");
+  EXPECT_EQ(results[0]["b"], "");
+  EXPECT_EQ(results[0]["c"], "");
+  EXPECT_EQ(results[0]["d"], "192.168");
+  EXPECT_EQ(results[0]["e"], "");
+  EXPECT_EQ(results[0]["f"], "abc");
+
+  // The compiled pattern is reused for each row.
+  results.clear();
+  status = queryInternal(
+      "with t(v) as (values ('x=1'), ('y=22'), ('z')) select "
+      "regex_match(v, '=[0-9]+$') as m, "
+      "regex_extract(v, '(\\w)=([0-9]+)', 2) as e from t",
+      results,
+      dbc->db());
+  ASSERT_TRUE(status.ok());
+  ASSERT_EQ(results.size(), 3U);
+  EXPECT_EQ(results[0]["m"], "1");
+  EXPECT_EQ(results[1]["e"], "22");
+  EXPECT_EQ(results[2]["m"], "0");
+  EXPECT_EQ(results[2]["e"], "");
+
+  // An invalid pattern is a query error.
+  results.clear();
+  status = queryInternal("select regex_match('a', '(')", results, dbc->db());
+  EXPECT_FALSE(status.ok());
+}
+
 TEST_F(SQLiteUtilTests, test_query_planner) {
   using TypeList = std::vector<ColumnType>;
 
@@ -8,6 +8,8 @@
  *
  */
 
+#include <thread>
+
 #include <gtest/gtest.h>
 
 #include <osquery/core.h>
@@ -19,6 +21,9 @@
 
 namespace osquery {
 
+DECLARE_uint64(table_parallel_generation);
+DECLARE_uint64(table_max_staleness);
+
 class VirtualTableTests : public testing::Test {};
 
 // sample plugin used on tests
@@ -415,4 +420,729 @@ TEST_F(VirtualTableTests, test_table_cache) {
   ASSERT_EQ(results.size(), 1U);
   ASSERT_EQ(results[0]["data"], "awesome_data");
 }
+
+class columnarTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const override {
+    return {
+        std::make_tuple("id", INTEGER_TYPE, DEFAULT),
+        std::make_tuple("value", DOUBLE_TYPE, DEFAULT),
+        std::make_tuple("name", TEXT_TYPE, DEFAULT),
+    };
+  }
+
+  ColumnAliasSet columnAliases() const override {
+    return {{"name", {"label"}}};
+  }
+
+  bool usesColumnarData() const override { return true; }
+
+ public:
+  void generateColumns(QueryContext&, ColumnarData& results) override {
+    for (long long i = 0; i < 3; i++) {
+      auto r = results.addRow();
+      results.setInteger(r, 0, i);
+      results.setDouble(r, 1, i / 2.0);
+      if (i != 1) {
+        results.setText(r, 2, "name" + std::to_string(i));
+      }
+    }
+  }
+
+ private:
+  FRIEND_TEST(VirtualTableTests, test_columnar_table);
+};
+
+TEST_F(VirtualTableTests, test_columnar_table) {
+  Registry::add<columnarTablePlugin>("table", "columnar");
+  auto dbc = SQLiteDBManager::getUnique();
+  {
+    auto columnar = std::make_shared<columnarTablePlugin>();
+    attachTableInternal("columnar", columnar->columnDefinition(), dbc);
+  }
+
+  QueryData results;
+  std::string statement =
+      "SELECT id, value, name, typeof(id) as t FROM columnar WHERE id > 0;";
+  auto status = queryInternal(statement, results, dbc->db());
+  EXPECT_TRUE(status.ok());
+  ASSERT_EQ(results.size(), 2U);
+  EXPECT_EQ(results[0]["t"], "integer");
+  EXPECT_EQ(results[0]["value"], "0.5");
+  EXPECT_EQ(results[0]["name"], "");
+  EXPECT_EQ(results[1]["name"], "name2");
+
+  // Column aliases read the cells of the aliased column index.
+  results.clear();
+  statement = "SELECT label FROM columnar WHERE id = 2;";
+  status = queryInternal(statement, results, dbc->db());
+  EXPECT_TRUE(status.ok());
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0]["label"], "name2");
+
+  // Registry calls (such as extensions) receive the adapted QueryData.
+  PluginResponse response;
+  status = Registry::call("table", "columnar", {{"action", "generate"}},
+                          response);
+  EXPECT_TRUE(status.ok());
+  ASSERT_EQ(response.size(), 3U);
+  EXPECT_EQ(response[2]["name"], "name2");
+  EXPECT_EQ(response[1].count("name"), 0U);
+}
+
+/// Count the rows requested from the streaming generator table.
+static size_t kGeneratedRows{0};
+
+class countingRowGenerator : public RowGenerator {
+ public:
+  bool next(Row& r) override {
+    if (i_ >= 1000) {
+      return false;
+    }
+    kGeneratedRows++;
+    r["i"] = INTEGER(i_++);
+    return true;
+  }
+
+ private:
+  size_t i_{0};
+};
+
+class generatorTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const override {
+    return {
+        std::make_tuple("i", INTEGER_TYPE, DEFAULT),
+    };
+  }
+
+  bool usesGenerator() const override { return true; }
+
+  RowGeneratorRef generator(QueryContext&) override {
+    return RowGeneratorRef(new countingRowGenerator());
+  }
+
+ private:
+  FRIEND_TEST(VirtualTableTests, test_generator_table);
+};
+
+TEST_F(VirtualTableTests, test_generator_table) {
+  Registry::add<generatorTablePlugin>("table", "generator");
+  auto dbc = SQLiteDBManager::getUnique();
+  {
+    auto generator = std::make_shared<generatorTablePlugin>();
+    attachTableInternal("generator", generator->columnDefinition(), dbc);
+  }
+
+  // A LIMIT stops the generator early.
+  QueryData results;
+  kGeneratedRows = 0;
+  auto status =
+      queryInternal("SELECT i FROM generator LIMIT 10;", results, dbc->db());
+  EXPECT_TRUE(status.ok());
+  ASSERT_EQ(results.size(), 10U);
+  EXPECT_EQ(results[9]["i"], "9");
+  EXPECT_LE(kGeneratedRows, 11U);
+
+  // A full scan drains the generator.
+  results.clear();
+  status = queryInternal("SELECT count(*) as c FROM generator;", results,
+                         dbc->db());
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(results[0]["c"], "1000");
+
+  // Registry calls (such as extensions) receive the drained QueryData.
+  PluginResponse response;
+  status = Registry::call("table", "generator", {{"action", "generate"}},
+                          response);
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(response.size(), 1000U);
+}
+
+/// The columns the projection table was asked to generate.
+static UsedColumns kProjectedColumns;
+
+class projectionTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const override {
+    return {
+        std::make_tuple("a", INTEGER_TYPE, DEFAULT),
+        std::make_tuple("b", INTEGER_TYPE, DEFAULT),
+        std::make_tuple("c", INTEGER_TYPE, DEFAULT),
+    };
+  }
+
+ public:
+  QueryData generate(QueryContext& context) override {
+    kProjectedColumns.clear();
+    Row r;
+    for (const auto& column : {"a", "b", "c"}) {
+      if (context.isColumnUsed(column)) {
+        kProjectedColumns.insert(column);
+        r[column] = "1";
+      }
+    }
+    return {r};
+  }
+
+ private:
+  FRIEND_TEST(VirtualTableTests, test_column_projection);
+};
+
+TEST_F(VirtualTableTests, test_column_projection) {
+  Registry::add<projectionTablePlugin>("table", "projection");
+  auto dbc = SQLiteDBManager::getUnique();
+  {
+    auto projection = std::make_shared<projectionTablePlugin>();
+    attachTableInternal("projection", projection->columnDefinition(), dbc);
+  }
+
+  // Selected and constrained columns are both referenced.
+  QueryData results;
+  auto status = queryInternal("SELECT a FROM projection WHERE c = 1;", results,
+                              dbc->db());
+  dbc->clearAffectedTables();
+  EXPECT_TRUE(status.ok());
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0]["a"], "1");
+  EXPECT_EQ(kProjectedColumns, UsedColumns({"a", "c"}));
+
+  // A star select references every column.
+  results.clear();
+  queryInternal("SELECT * FROM projection;", results, dbc->db());
+  dbc->clearAffectedTables();
+  EXPECT_EQ(kProjectedColumns.size(), 3U);
+
+  // Registry calls without a known column set generate every column.
+  PluginResponse response;
+  status = Registry::call("table", "projection", {{"action", "generate"}},
+                          response);
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(kProjectedColumns.size(), 3U);
+
+  // The referenced column set is forwarded through a serialized context.
+  QueryContext context;
+  context.colsUsed = UsedColumns({"b"});
+  PluginRequest request = {{"action", "generate"}};
+  TablePlugin::setRequestFromContext(context, request);
+  status = Registry::call("table", "projection", request, response);
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(kProjectedColumns, UsedColumns({"b"}));
+}
+
+class cheapTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const override {
+    return {
+        std::make_tuple("id", INTEGER_TYPE, DEFAULT),
+    };
+  }
+
+  TableStatistics statistics() const override { return TableStatistics(10); }
+
+ private:
+  FRIEND_TEST(VirtualTableTests, test_table_statistics);
+};
+
+class costlyTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const override {
+    return {
+        std::make_tuple("id", INTEGER_TYPE, INDEX),
+    };
+  }
+
+  TableStatistics statistics() const override {
+    return TableStatistics(1000, 100);
+  }
+
+ private:
+  FRIEND_TEST(VirtualTableTests, test_table_statistics);
+};
+
+TEST_F(VirtualTableTests, test_table_statistics) {
+  Registry::add<cheapTablePlugin>("table", "cheap");
+  Registry::add<costlyTablePlugin>("table", "costly");
+  auto dbc = SQLiteDBManager::getUnique();
+  {
+    auto cheap = std::make_shared<cheapTablePlugin>();
+    attachTableInternal("cheap", cheap->columnDefinition(), dbc);
+    auto costly = std::make_shared<costlyTablePlugin>();
+    attachTableInternal("costly", costly->columnDefinition(), dbc);
+  }
+
+  // The hints are included in the table's route info.
+  PluginResponse response;
+  auto status =
+      Registry::call("table", "costly", {{"action", "columns"}}, response);
+  EXPECT_TRUE(status.ok());
+  ASSERT_FALSE(response.empty());
+  EXPECT_EQ(response.back()["id"], "statistics");
+
+  // The costly table should be the inner loop, constrained on its index.
+  QueryData plan;
+  status = queryInternal(
+      "EXPLAIN QUERY PLAN SELECT * FROM costly c JOIN cheap s ON c.id = s.id;",
+      plan, dbc->db());
+  EXPECT_TRUE(status.ok());
+  ASSERT_EQ(plan.size(), 2U);
+  EXPECT_NE(plan[0]["detail"].find("cheap"), std::string::npos);
+  EXPECT_NE(plan[1]["detail"].find("costly"), std::string::npos);
+}
+
+/// Count the generate calls and constraints received by the probe table.
+static size_t kProbeGenerates{0};
+static size_t kProbeConstraints{0};
+
+class probeTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const override {
+    return {
+        std::make_tuple("id", INTEGER_TYPE, INDEX),
+    };
+  }
+
+ public:
+  QueryData generate(QueryContext& context) override {
+    kProbeGenerates++;
+    QueryData results;
+    auto ids = context.constraints["id"].getAll(EQUALS);
+    kProbeConstraints += ids.size();
+    for (const auto& id : ids) {
+      results.push_back({{"id", id}});
+    }
+    return results;
+  }
+
+ private:
+  FRIEND_TEST(VirtualTableTests, test_in_constraints);
+};
+
+TEST_F(VirtualTableTests, test_in_constraints) {
+  Registry::add<probeTablePlugin>("table", "probe");
+  auto dbc = SQLiteDBManager::getUnique();
+  {
+    auto probe = std::make_shared<probeTablePlugin>();
+    attachTableInternal("probe", probe->columnDefinition(), dbc);
+  }
+
+  kProbeGenerates = 0;
+  kProbeConstraints = 0;
+  QueryData results;
+  auto status = queryInternal("SELECT * FROM probe WHERE id IN (1, 2, 3);",
+                              results, dbc->db());
+  dbc->clearAffectedTables();
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(results.size(), 3U);
+  EXPECT_EQ(kProbeConstraints, 3U);
+#if SQLITE_VERSION_NUMBER >= 3038000
+  // Every IN value is provided within a single generate call.
+  EXPECT_EQ(kProbeGenerates, 1U);
+#else
+  EXPECT_EQ(kProbeGenerates, 3U);
+#endif
+}
+
+/// Count the generate calls received by the memoized table.
+static size_t kMemoGenerates{0};
+
+class memoTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const override {
+    return {
+        std::make_tuple("id", INTEGER_TYPE, DEFAULT),
+    };
+  }
+
+ public:
+  QueryData generate(QueryContext& context) override {
+    kMemoGenerates++;
+    return {{{"id", "1"}}, {{"id", "2"}}};
+  }
+
+ private:
+  FRIEND_TEST(VirtualTableTests, test_statement_generation_cache);
+  FRIEND_TEST(VirtualTableTests, test_table_snapshot);
+  FRIEND_TEST(VirtualTableTests, test_recent_generations);
+  FRIEND_TEST(VirtualTableTests, test_query_budget);
+  FRIEND_TEST(VirtualTableTests, test_query_profile);
+};
+
+TEST_F(VirtualTableTests, test_statement_generation_cache) {
+  Registry::add<memoTablePlugin>("table", "memo");
+  auto dbc = SQLiteDBManager::getUnique();
+  {
+    auto memo = std::make_shared<memoTablePlugin>();
+    attachTableInternal("memo", memo->columnDefinition(), dbc);
+  }
+
+  // Both cursors of a self-join share a single generation.
+  kMemoGenerates = 0;
+  QueryData results;
+  auto status = queryInternal(
+      "SELECT a.id, b.id AS b_id FROM memo a, memo b;", results, dbc->db());
+  dbc->clearAffectedTables();
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(results.size(), 4U);
+  EXPECT_EQ(kMemoGenerates, 1U);
+
+  // A different constraint set is generated separately.
+  results.clear();
+  status = queryInternal(
+      "SELECT a.id FROM memo a, memo b WHERE b.id = 2;", results, dbc->db());
+  dbc->clearAffectedTables();
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(results.size(), 2U);
+  EXPECT_EQ(kMemoGenerates, 3U);
+
+  // The cache does not outlive the statement.
+  results.clear();
+  queryInternal("SELECT id FROM memo;", results, dbc->db());
+  dbc->clearAffectedTables();
+  EXPECT_EQ(kMemoGenerates, 4U);
+}
+
+TEST_F(VirtualTableTests, test_table_snapshot) {
+  Registry::add<memoTablePlugin>("table", "memo");
+  auto dbc = SQLiteDBManager::getUnique();
+  {
+    auto memo = std::make_shared<memoTablePlugin>();
+    attachTableInternal("memo", memo->columnDefinition(), dbc);
+  }
+
+  kMemoGenerates = 0;
+  auto snapshot = std::make_shared<TableSnapshot>(std::set<std::string>{"memo"});
+  {
+    TableSnapshotScope scope(snapshot);
+    EXPECT_EQ(TableSnapshot::current(), snapshot.get());
+
+    // Separate statements, with different columns, share one generation.
+    QueryData results;
+    queryInternal("SELECT id FROM memo;", results, dbc->db());
+    dbc->clearAffectedTables();
+    EXPECT_EQ(results.size(), 2U);
+
+    results.clear();
+    queryInternal("SELECT * FROM memo;", results, dbc->db());
+    dbc->clearAffectedTables();
+    EXPECT_EQ(results.size(), 2U);
+    EXPECT_EQ(kMemoGenerates, 1U);
+    EXPECT_EQ(scope.saved(), 1U);
+
+    // Different constraints are generated separately.
+    results.clear();
+    queryInternal("SELECT * FROM memo WHERE id = 1;", results, dbc->db());
+    dbc->clearAffectedTables();
+    EXPECT_EQ(kMemoGenerates, 2U);
+  }
+  EXPECT_EQ(snapshot->saved(), 1U);
+
+  // Generations are not shared once the scope ends.
+  EXPECT_EQ(TableSnapshot::current(), nullptr);
+  QueryData results;
+  queryInternal("SELECT id FROM memo;", results, dbc->db());
+  dbc->clearAffectedTables();
+  EXPECT_EQ(kMemoGenerates, 3U);
+
+  // Tables not included in the snapshot are not shared.
+  auto other = std::make_shared<TableSnapshot>(std::set<std::string>{"time"});
+  {
+    TableSnapshotScope scope(other);
+    queryInternal("SELECT id FROM memo;", results, dbc->db());
+    dbc->clearAffectedTables();
+    queryInternal("SELECT id FROM memo;", results, dbc->db());
+    dbc->clearAffectedTables();
+    EXPECT_EQ(scope.saved(), 0U);
+  }
+  EXPECT_EQ(kMemoGenerates, 5U);
+}
+
+TEST_F(VirtualTableTests, test_recent_generations) {
+  Registry::add<memoTablePlugin>("table", "memo");
+  auto dbc = SQLiteDBManager::getUnique();
+  {
+    auto memo = std::make_shared<memoTablePlugin>();
+    attachTableInternal("memo", memo->columnDefinition(), dbc);
+  }
+
+  auto max_staleness = FLAGS_table_max_staleness;
+  FLAGS_table_max_staleness = 60;
+  RecentGenerations::get().clear();
+  kMemoGenerates = 0;
+
+  // A scheduled query's snapshot generation is kept.
+  QueryData results;
+  {
+    auto snapshot =
+        std::make_shared<TableSnapshot>(std::set<std::string>{"memo"});
+    TableSnapshotScope scope(snapshot);
+    queryInternal("SELECT id FROM memo;", results, dbc->db());
+    dbc->clearAffectedTables();
+  }
+  EXPECT_EQ(kMemoGenerates, 1U);
+  EXPECT_EQ(RecentGenerations::get().size(), 1U);
+
+  // Statements outside of a staleness scope generate the table.
+  results.clear();
+  queryInternal("SELECT id FROM memo;", results, dbc->db());
+  dbc->clearAffectedTables();
+  EXPECT_EQ(kMemoGenerates, 2U);
+
+  {
+    TableStalenessScope scope(30);
+    EXPECT_EQ(TableStalenessScope::current(), 30U);
+
+    // Any columns of a generation with equivalent constraints are reused.
+    results.clear();
+    queryInternal("SELECT * FROM memo;", results, dbc->db());
+    dbc->clearAffectedTables();
+    EXPECT_EQ(results.size(), 2U);
+    EXPECT_EQ(kMemoGenerates, 2U);
+    EXPECT_EQ(scope.saved(), 1U);
+
+    // Different constraints are generated.
+    results.clear();
+    queryInternal("SELECT * FROM memo WHERE id = 1;", results, dbc->db());
+    dbc->clearAffectedTables();
+    EXPECT_EQ(results.size(), 1U);
+    EXPECT_EQ(kMemoGenerates, 3U);
+  }
+  EXPECT_EQ(TableStalenessScope::current(), 0U);
+
+  RecentGenerations::get().clear();
+  FLAGS_table_max_staleness = max_staleness;
+}
+
+TEST_F(VirtualTableTests, test_query_budget) {
+  Registry::add<memoTablePlugin>("table", "memo");
+  auto dbc = SQLiteDBManager::getUnique();
+  {
+    auto memo = std::make_shared<memoTablePlugin>();
+    attachTableInternal("memo", memo->columnDefinition(), dbc);
+  }
+
+  // Generations within the budget execute.
+  QueryBudget budget;
+  budget.max_rows = 2;
+  {
+    QueryBudgetScope scope(budget);
+    EXPECT_TRUE(QueryBudgetScope::active());
+    QueryData results;
+    auto status = queryInternal("SELECT id FROM memo;", results, dbc->db());
+    dbc->clearAffectedTables();
+    EXPECT_TRUE(status.ok());
+    EXPECT_FALSE(scope.exceeded());
+
+    // The budget applies to every generation while in scope.
+    results.clear();
+    status = queryInternal("SELECT id FROM memo;", results, dbc->db());
+    dbc->clearAffectedTables();
+    EXPECT_FALSE(status.ok());
+    EXPECT_TRUE(scope.exceeded());
+    EXPECT_FALSE(scope.reason().empty());
+  }
+  EXPECT_FALSE(QueryBudgetScope::active());
+
+  // A byte limit aborts the statement.
+  budget = QueryBudget();
+  budget.max_bytes = 3;
+  {
+    QueryBudgetScope scope(budget);
+    QueryData results;
+    auto status = queryInternal("SELECT id FROM memo;", results, dbc->db());
+    dbc->clearAffectedTables();
+    EXPECT_FALSE(status.ok());
+    EXPECT_TRUE(scope.exceeded());
+  }
+
+  // Without a budget the same statement succeeds.
+  QueryData results;
+  auto status = queryInternal("SELECT id FROM memo;", results, dbc->db());
+  dbc->clearAffectedTables();
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(results.size(), 2U);
+}
+
+TEST_F(VirtualTableTests, test_query_profile) {
+  Registry::add<memoTablePlugin>("table", "memo");
+  auto dbc = SQLiteDBManager::getUnique();
+  {
+    auto memo = std::make_shared<memoTablePlugin>();
+    attachTableInternal("memo", memo->columnDefinition(), dbc);
+  }
+
+  EXPECT_FALSE(QueryProfileScope::active());
+  {
+    QueryProfileScope profile;
+    EXPECT_TRUE(QueryProfileScope::active());
+    QueryData results;
+    auto status =
+        queryInternal("SELECT id FROM memo LIMIT 1;", results, dbc->db());
+    dbc->clearAffectedTables();
+    EXPECT_TRUE(status.ok());
+    EXPECT_EQ(results.size(), 1U);
+
+    // The LIMIT stops the scan after the first of the generated rows.
+    ASSERT_EQ(profile.cursors().size(), 1U);
+    const auto& cursor = profile.cursors().begin()->second;
+    EXPECT_EQ(cursor.table, "memo");
+    EXPECT_EQ(cursor.filters, 1U);
+    EXPECT_EQ(cursor.rows_generated, 2U);
+    EXPECT_EQ(cursor.rows_returned, 1U);
+    EXPECT_EQ(cursor.bytes, 6U);
+  }
+  EXPECT_FALSE(QueryProfileScope::active());
+}
+
+/// Count the columns requests received by the lazily attached table.
+static size_t kLazyColumns{0};
+
+class lazyTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const override {
+    kLazyColumns++;
+    return {
+        std::make_tuple("id", INTEGER_TYPE, DEFAULT),
+    };
+  }
+
+  std::vector<std::string> aliases() const override { return {"lazy_alias"}; }
+
+ public:
+  QueryData generate(QueryContext& context) override {
+    return {{{"id", "1"}}};
+  }
+};
+
+TEST_F(VirtualTableTests, test_lazy_attach) {
+  Registry::add<lazyTablePlugin>("table", "lazy");
+  kLazyColumns = 0;
+  auto dbc = SQLiteDBManager::getUnique();
+
+  // Tables are not created until a statement references them.
+  QueryData results;
+  auto status = queryInternal(
+      "SELECT count(*) AS tables FROM sqlite_temp_master;", results, dbc->db());
+  EXPECT_TRUE(status.ok());
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0]["tables"], "0");
+
+  results.clear();
+  status = queryInternal("SELECT id FROM lazy;", results, dbc->db());
+  dbc->clearAffectedTables();
+  EXPECT_TRUE(status.ok());
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0]["id"], "1");
+
+  // Aliases are attached without views.
+  results.clear();
+  status = queryInternal("SELECT id FROM lazy_alias;", results, dbc->db());
+  dbc->clearAffectedTables();
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(results.size(), 1U);
+
+  // Another instance uses the cached column definitions.
+  auto columns = kLazyColumns;
+  EXPECT_GT(columns, 0U);
+  auto other = SQLiteDBManager::getUnique();
+  results.clear();
+  status = queryInternal("SELECT id FROM lazy;", results, other->db());
+  other->clearAffectedTables();
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(results.size(), 1U);
+  EXPECT_EQ(kLazyColumns, columns);
+}
+
+/// The threads generating the pending tables.
+static std::vector<std::thread::id> kPendingThreads;
+static Mutex kPendingMutex;
+
+class pendingTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const override {
+    return {
+        std::make_tuple("id", INTEGER_TYPE, DEFAULT),
+    };
+  }
+
+ public:
+  QueryData generate(QueryContext& context) override {
+    {
+      WriteLock lock(kPendingMutex);
+      kPendingThreads.push_back(std::this_thread::get_id());
+    }
+    QueryData results;
+    for (const auto& id : {"1", "2"}) {
+      if (!context.constraints["id"].exists(EQUALS) ||
+          context.constraints["id"].matches<int>(std::stoi(id))) {
+        results.push_back({{"id", id}});
+      }
+    }
+    return results;
+  }
+
+ private:
+  FRIEND_TEST(VirtualTableTests, test_parallel_generation);
+};
+
+/// The number of pending table generations on other threads.
+static size_t pendingElsewhere() {
+  size_t elsewhere = 0;
+  for (const auto& thread : kPendingThreads) {
+    elsewhere += (thread != std::this_thread::get_id()) ? 1 : 0;
+  }
+  return elsewhere;
+}
+
+TEST_F(VirtualTableTests, test_parallel_generation) {
+  Registry::add<pendingTablePlugin>("table", "pending_a");
+  Registry::add<pendingTablePlugin>("table", "pending_b");
+  auto dbc = SQLiteDBManager::getUnique();
+  {
+    auto pending = std::make_shared<pendingTablePlugin>();
+    attachTableInternal("pending_a", pending->columnDefinition(), dbc);
+    attachTableInternal("pending_b", pending->columnDefinition(), dbc);
+  }
+
+  // Tables are generated by the calling thread by default.
+  auto parallel = FLAGS_table_parallel_generation;
+  kPendingThreads.clear();
+  QueryData results;
+  auto status = queryInternal(
+      "SELECT a.id FROM pending_a a, pending_b b WHERE b.id = 2;",
+      results,
+      dbc->db());
+  dbc->clearAffectedTables();
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(results.size(), 2U);
+  EXPECT_EQ(kPendingThreads.size(), 2U);
+  EXPECT_EQ(pendingElsewhere(), 0U);
+
+  // The inner table of independent tables is generated on another thread.
+  FLAGS_table_parallel_generation = 2;
+  kPendingThreads.clear();
+  results.clear();
+  status = queryInternal(
+      "SELECT a.id FROM pending_a a, pending_b b WHERE b.id = 2;",
+      results,
+      dbc->db());
+  dbc->clearAffectedTables();
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(results.size(), 2U);
+  EXPECT_EQ(kPendingThreads.size(), 2U);
+  EXPECT_EQ(pendingElsewhere(), 1U);
+
+  // Tables joined on their columns depend on each other's rows.
+  kPendingThreads.clear();
+  results.clear();
+  status = queryInternal(
+      "SELECT a.id FROM pending_a a, pending_b b WHERE a.id = b.id;",
+      results,
+      dbc->db());
+  dbc->clearAffectedTables();
+  FLAGS_table_parallel_generation = parallel;
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(results.size(), 2U);
+  EXPECT_EQ(pendingElsewhere(), 0U);
+}
 }
@@ -8,11 +8,16 @@
  *
  */
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <future>
 
 #include <osquery/flags.h>
 #include <osquery/logger.h>
 
+#include "osquery/core/allocations.h"
+#include "osquery/core/tracing.h"
 #include "osquery/sql/virtual_table.h"
 
 namespace osquery {
@@ -21,6 +26,11 @@ FLAG(bool, enable_foreign, false, "Enable noop foreign virtual tables");
 
 SHELL_FLAG(bool, planner, false, "Enable osquery runtime planner output");
 
+FLAG(uint64,
+     table_parallel_generation,
+     0,
+     "Tables of a statement with literal constraints generated concurrently");
+
 /**
  * @brief A protection around concurrent table attach requests.
  *
@@ -41,6 +51,78 @@ Mutex kAttachMutex;
  */
 void registerForeignTables();
 
+/**
+ * @brief Column definitions of the registered tables.
+ *
+ * Every new SQLite instance attaches every table, and a table's columns are
+ * requested again when it is connected. The responses are kept until the
+ * registry's plugins change, which also covers extension tables.
+ */
+struct TableDefinitions {
+  /// The registries generation when filled, see RegistryFactory.
+  size_t generation{0};
+
+  /// The "columns" action response of each table.
+  std::map<std::string, PluginResponse> columns;
+
+  /// Table aliases mapped to the aliased table, of every generation.
+  std::map<std::string, std::string> aliases;
+};
+
+static TableDefinitions kTableDefinitions;
+
+static Mutex kTableDefinitionsMutex;
+
+static Status getTableColumns(const std::string &name,
+                              PluginResponse &response) {
+  auto generation = RegistryFactory::generation();
+  {
+    WriteLock lock(kTableDefinitionsMutex);
+    auto &definitions = kTableDefinitions;
+    if (definitions.generation != generation) {
+      // Aliases are kept, an alias table may connect after the change.
+      definitions.columns.clear();
+      definitions.generation = generation;
+    }
+
+    auto cached = definitions.columns.find(name);
+    if (cached != definitions.columns.end()) {
+      response = cached->second;
+      return Status(0, "OK");
+    }
+  }
+
+  // Extension tables are called outside of the lock.
+  auto status =
+      Registry::call("table", name, {{"action", "columns"}}, response);
+  if (!status.ok() || response.empty()) {
+    return Status(1, "Cannot get columns of table: " + name);
+  }
+
+  WriteLock lock(kTableDefinitionsMutex);
+  auto &definitions = kTableDefinitions;
+  if (definitions.generation == generation) {
+    definitions.columns[name] = response;
+    for (const auto &column : response) {
+      if (column.count("id") && column.at("id") == "alias" &&
+          column.count("alias")) {
+        definitions.aliases[column.at("alias")] = name;
+      }
+    }
+  }
+  return status;
+}
+
+/// The table a virtual table module name refers to, resolving aliases.
+static std::string getModuleTable(const std::string &module) {
+  WriteLock lock(kTableDefinitionsMutex);
+  auto alias = kTableDefinitions.aliases.find(module);
+  if (alias != kTableDefinitions.aliases.end()) {
+    return alias->second;
+  }
+  return module;
+}
+
 namespace tables {
 namespace sqlite {
 
@@ -55,6 +137,8 @@ static std::atomic<size_t> kPlannerCursorID{0};
  */
 static std::atomic<size_t> kConstraintIndexID{0};
 
+size_t nextConstraintIndex() { return kConstraintIndexID; }
+
 static inline std::string opString(unsigned char op) {
   switch (op) {
   case EQUALS:
@@ -110,14 +194,51 @@ int xClose(sqlite3_vtab_cursor *cur) {
   return SQLITE_OK;
 }
 
+/// The profile of a cursor within the calling thread's QueryProfileScope.
+static inline CursorProfile *cursorProfile(const BaseCursor *pCur) {
+  if (!QueryProfileScope::active()) {
+    return nullptr;
+  }
+  auto *pVtab = (VirtualTable *)pCur->base.pVtab;
+  return QueryProfileScope::cursor(pCur->id, pVtab->content->name);
+}
+
+/// Add the time and allocations until the end of scope to a cursor's profile.
+class CursorProfileTimer : private boost::noncopyable {
+ public:
+  explicit CursorProfileTimer(CursorProfile *profile) : profile_(profile) {
+    if (profile_ != nullptr) {
+      start_ = std::chrono::steady_clock::now();
+    }
+  }
+
+  ~CursorProfileTimer() {
+    if (profile_ != nullptr) {
+      auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - start_);
+      profile_->generate_time += static_cast<size_t>(elapsed.count());
+      profile_->allocations += allocations_.allocations();
+      profile_->allocated_bytes += allocations_.bytes();
+    }
+  }
+
+ private:
+  CursorProfile *profile_{nullptr};
+  std::chrono::steady_clock::time_point start_;
+  AllocationScope allocations_;
+};
+
 int xEof(sqlite3_vtab_cursor *cur) {
   BaseCursor *pCur = (BaseCursor *)cur;
-  if (pCur->row >= pCur->n) {
-    // If the requested row exceeds the size of the row set then all rows
-    // have been visited, clear the data container.
-    return true;
+  bool eof = (pCur->generator != nullptr) ? pCur->done : pCur->row >= pCur->n;
+  if (!eof) {
+    // SQLite checks for the end once per row it reads from the cursor.
+    auto *profile = cursorProfile(pCur);
+    if (profile != nullptr) {
+      profile->rows_returned++;
+    }
   }
-  return false;
+  return eof;
 }
 
 int xDestroy(sqlite3_vtab *p) {
@@ -127,9 +248,88 @@ int xDestroy(sqlite3_vtab *p) {
   return SQLITE_OK;
 }
 
+/// The bytes of column names and values in a row, for query budgets.
+static inline size_t rowBytes(const Row &row) {
+  size_t bytes = 0;
+  for (const auto &column : row) {
+    bytes += column.first.size() + column.second.size();
+  }
+  return bytes;
+}
+
+/// Abort the statement, the calling thread's query budget was exceeded.
+static inline int budgetExceeded(sqlite3_vtab *pVtab) {
+  sqlite3_free(pVtab->zErrMsg);
+  pVtab->zErrMsg = sqlite3_mprintf("Query budget exceeded");
+  return SQLITE_INTERRUPT;
+}
+
+/// The bytes of the values in typed data, 8 bytes for each numeric cell.
+static size_t columnarBytes(const ColumnarData &data) {
+  size_t bytes = 0;
+  for (size_t column = 0; column < data.columns(); ++column) {
+    auto type = data.type(column);
+    if (type == INTEGER_TYPE || type == BIGINT_TYPE ||
+        type == UNSIGNED_BIGINT_TYPE || type == DOUBLE_TYPE) {
+      bytes += data.rows() * sizeof(long long);
+      continue;
+    }
+    for (size_t row = 0; row < data.rows(); ++row) {
+      bytes += data.getText(row, column).size();
+    }
+  }
+  return bytes;
+}
+
+/// Pull the next row from a cursor's streaming generator.
+static inline bool nextGeneratedRow(BaseCursor *pCur, CursorProfile *profile) {
+  pCur->current.clear();
+  pCur->done = !pCur->generator->next(pCur->current);
+  if (pCur->done) {
+    return true;
+  }
+
+  auto bytes = rowBytes(pCur->current);
+  if (profile != nullptr) {
+    profile->rows_generated++;
+    profile->bytes += bytes;
+  }
+  return QueryBudgetScope::consume(1, bytes);
+}
+
+/// Replace the columnar rows with the next batch from a streaming cursor.
+static inline bool nextBatch(BaseCursor *pCur, CursorProfile *profile) {
+  pCur->offset = pCur->row;
+  pCur->columnar = ColumnarData();
+  pCur->done = !pCur->batches->next(pCur->columnar);
+  if (pCur->done) {
+    pCur->columnar = ColumnarData();
+  }
+  pCur->n = pCur->offset + pCur->columnar.rows();
+  if (profile != nullptr) {
+    profile->rows_generated += pCur->columnar.rows();
+    profile->bytes += columnarBytes(pCur->columnar);
+  }
+  return QueryBudgetScope::consume(pCur->columnar.rows(), 0);
+}
+
 int xNext(sqlite3_vtab_cursor *cur) {
   BaseCursor *pCur = (BaseCursor *)cur;
   pCur->row++;
+  if (pCur->generator != nullptr && !pCur->done) {
+    auto *profile = cursorProfile(pCur);
+    CursorProfileTimer timer(profile);
+    if (!nextGeneratedRow(pCur, profile)) {
+      return budgetExceeded(cur->pVtab);
+    }
+  } else if (pCur->batches != nullptr && !pCur->done &&
+             pCur->row >= pCur->n) {
+    auto *profile = cursorProfile(pCur);
+    CursorProfileTimer timer(profile);
+    if (!nextBatch(pCur, profile)) {
+      return budgetExceeded(cur->pVtab);
+    }
+  }
   return SQLITE_OK;
 }
 
@@ -139,6 +339,22 @@ int xRowid(sqlite3_vtab_cursor *cur, sqlite_int64 *pRowid) {
   return SQLITE_OK;
 }
 
+/// Read a non-negative planner hint from a table route info response.
+static double hintFromString(const Row &info,
+                             const std::string &key,
+                             double default_value) {
+  if (info.count(key) == 0) {
+    return default_value;
+  }
+  const auto &value = info.at(key);
+  char *end = nullptr;
+  double hint = strtod(value.c_str(), &end);
+  if (end == nullptr || end == value.c_str() || *end != '\0' || hint < 0) {
+    return default_value;
+  }
+  return hint;
+}
+
 int xCreate(sqlite3 *db,
             void *pAux,
             int argc,
@@ -156,13 +372,14 @@ int xCreate(sqlite3 *db,
   pVtab->instance = (SQLiteDBInstance *)pAux;
 
   // Create a TablePlugin Registry call, expect column details as the response.
+  // The module of an eponymous table alias is the alias name.
   PluginResponse response;
-  pVtab->content->name = std::string(argv[0]);
+  pVtab->content->name = getModuleTable(argv[0]);
+  pVtab->content->table = RegistryHandle("table", pVtab->content->name);
   const auto &name = pVtab->content->name;
   // Get the table column information.
-  auto status =
-      Registry::call("table", name, {{"action", "columns"}}, response);
-  if (!status.ok() || response.size() == 0) {
+  auto status = getTableColumns(name, response);
+  if (!status.ok()) {
     delete pVtab->content;
     delete pVtab;
     return SQLITE_ERROR;
@@ -172,7 +389,7 @@ int xCreate(sqlite3 *db,
   // This call to columnDefinition requests column aliases (as HIDDEN columns).
   auto statement = "CREATE TABLE " + name + columnDefinition(response, true);
   int rc = sqlite3_declare_vtab(db, statement.c_str());
-  if (rc != SQLITE_OK || !status.ok() || response.size() == 0) {
+  if (rc != SQLITE_OK) {
     LOG(ERROR) << "Error creating virtual table: " << name << " (" << rc << ")";
     delete pVtab->content;
     delete pVtab;
@@ -217,10 +434,28 @@ int xCreate(sqlite3 *db,
         }
       }
       pVtab->content->aliases[column.at("name")] = target_index;
+    } else if (column.at("id") == "statistics") {
+      // Planner hints for estimating the cost of a table scan.
+      auto &stats = pVtab->content->statistics;
+      stats.rows = hintFromString(column, "rows", stats.rows);
+      stats.cost = hintFromString(column, "cost", stats.cost);
     }
   }
 
+  // Resolve the aliased columns once, xColumn reads cells by column index.
+  auto &content = *pVtab->content;
+  for (size_t i = 0; i < content.columns.size(); i++) {
+    auto alias = content.aliases.find(std::get<0>(content.columns[i]));
+    content.sources.push_back((alias != content.aliases.end()) ? alias->second
+                                                               : i);
+  }
+
   // Create the requested 'aliases'.
+  // Eponymous tables are connected without module arguments, and their
+  // aliases are attached as eponymous tables too, see attachTable.
+  if (argc <= 3) {
+    views.clear();
+  }
   for (const auto &view : views) {
     auto statement = "CREATE VIEW " + view + " AS SELECT * FROM " + name;
     sqlite3_exec(db, statement.c_str(), nullptr, nullptr, nullptr);
@@ -229,6 +464,45 @@ int xCreate(sqlite3 *db,
   return rc;
 }
 
+static int xColumnarColumn(BaseCursor *pCur,
+                           const VirtualTable *pVtab,
+                           sqlite3_context *ctx,
+                           size_t col) {
+  // Streaming cursors keep the rows of the current batch.
+  auto row = pCur->row - pCur->offset;
+  if (pCur->row < pCur->offset || row >= pCur->columnar.rows()) {
+    // Request row index greater than row set size.
+    return SQLITE_ERROR;
+  }
+
+  // Read from the aliased column index.
+  col = pVtab->content->sources[col];
+  const auto &data = pCur->columnar;
+  if (col >= data.columns() || data.isNull(row, col)) {
+    sqlite3_result_null(ctx);
+    return SQLITE_OK;
+  }
+
+  // The typed data is already in the SQLite type, no casting is needed.
+  auto type = data.type(col);
+  if (type == INTEGER_TYPE) {
+    auto afinite = data.getInteger(row, col);
+    if (afinite < INT_MIN || afinite > INT_MAX) {
+      sqlite3_result_null(ctx);
+    } else {
+      sqlite3_result_int(ctx, (int)afinite);
+    }
+  } else if (type == BIGINT_TYPE || type == UNSIGNED_BIGINT_TYPE) {
+    sqlite3_result_int64(ctx, data.getInteger(row, col));
+  } else if (type == DOUBLE_TYPE) {
+    sqlite3_result_double(ctx, data.getDouble(row, col));
+  } else {
+    const auto &value = data.getText(row, col);
+    sqlite3_result_text(ctx, value.c_str(), value.size(), SQLITE_STATIC);
+  }
+  return SQLITE_OK;
+}
+
 int xColumn(sqlite3_vtab_cursor *cur, sqlite3_context *ctx, int col) {
   BaseCursor *pCur = (BaseCursor *)cur;
   const auto *pVtab = (VirtualTable *)cur->pVtab;
@@ -236,28 +510,34 @@ int xColumn(sqlite3_vtab_cursor *cur, sqlite3_context *ctx, int col) {
     // Requested column index greater than column set size.
     return SQLITE_ERROR;
   }
-  if (pCur->row >= pCur->data.size()) {
+  if (pCur->is_columnar) {
+    return xColumnarColumn(pCur, pVtab, ctx, static_cast<size_t>(col));
+  }
+  if (pCur->generator == nullptr &&
+      (pCur->data == nullptr || pCur->row >= pCur->data->size())) {
     // Request row index greater than row set size.
     return SQLITE_ERROR;
   }
 
-  auto &column_name = std::get<0>(pVtab->content->columns[col]);
-  auto &type = std::get<1>(pVtab->content->columns[col]);
-  if (pVtab->content->aliases.count(column_name)) {
-    // Overwrite the aliased column with the type and name of the new column.
-    type = std::get<1>(
-        pVtab->content->columns[pVtab->content->aliases.at(column_name)]);
-    column_name = std::get<0>(
-        pVtab->content->columns[pVtab->content->aliases.at(column_name)]);
-  }
+  // Streaming generators only keep the current row.
+  const auto &row = (pCur->generator != nullptr) ? pCur->current
+                                                  : (*pCur->data)[pCur->row];
+  // An aliased column reads the content and type of the new column.
+  const auto &column = pVtab->content->columns[pVtab->content->sources[col]];
+  const auto &column_name = std::get<0>(column);
+  const auto &type = std::get<1>(column);
 
   // Attempt to cast each xFilter-populated row/column to the SQLite type.
-  const auto &value = pCur->data[pCur->row][column_name];
-  if (pCur->data[pCur->row].count(column_name) == 0) {
+  auto it = row.find(column_name);
+  if (it == row.end()) {
     // Missing content.
     VLOG(1) << "Error " << column_name << " is empty";
     sqlite3_result_null(ctx);
-  } else if (type == TEXT_TYPE) {
+    return SQLITE_OK;
+  }
+
+  const auto &value = it->second;
+  if (type == TEXT_TYPE) {
     sqlite3_result_text(ctx, value.c_str(), value.size(), SQLITE_STATIC);
   } else if (type == INTEGER_TYPE) {
     long afinite;
@@ -295,9 +575,57 @@ int xColumn(sqlite3_vtab_cursor *cur, sqlite3_context *ctx, int col) {
   return SQLITE_OK;
 }
 
+/**
+ * @brief Estimate the rows generated after applying a usable constraint.
+ *
+ * An equality on an INDEX column selects a single row. Constraints on columns
+ * the table uses to optimize generation select a fraction of the rows.
+ */
+static double estimateConstrainedRows(double rows,
+                                      ColumnOptions options,
+                                      unsigned char op) {
+  if ((options & INDEX) && op == EQUALS) {
+    return 1;
+  }
+  if (options & (REQUIRED | ADDITIONAL | OPTIMIZED | INDEX)) {
+    return std::max(1.0, rows / 10);
+  }
+  return rows;
+}
+
+/**
+ * @brief Record the set of columns a query plan references.
+ *
+ * SQLite reports referenced columns as a bitmask, where the highest bit covers
+ * every column at or beyond that index. Hidden alias columns are recorded as
+ * their target column, since the table generates content for the target.
+ */
+static void recordUsedColumns(VirtualTableContent *content,
+                              const sqlite3_index_info *pIdxInfo) {
+#if SQLITE_VERSION_NUMBER >= 3010000
+  const auto &columns = content->columns;
+  const size_t kMaskBits = sizeof(pIdxInfo->colUsed) * 8;
+  UsedColumns used;
+  for (size_t i = 0; i < columns.size(); i++) {
+    auto bit = (i < kMaskBits - 1) ? i : kMaskBits - 1;
+    if ((pIdxInfo->colUsed & ((sqlite3_uint64)1 << bit)) == 0) {
+      continue;
+    }
+    const auto &name = std::get<0>(columns[i]);
+    if (content->aliases.count(name)) {
+      used.insert(std::get<0>(columns[content->aliases.at(name)]));
+    } else {
+      used.insert(name);
+    }
+  }
+  content->colsUsed[pIdxInfo->idxNum] = std::move(used);
+#endif
+}
+
 static int xBestIndex(sqlite3_vtab *tab, sqlite3_index_info *pIdxInfo) {
   auto *pVtab = (VirtualTable *)tab;
   const auto &columns = pVtab->content->columns;
+  const auto &stats = pVtab->content->statistics;
 
   ConstraintSet constraints;
   // Keep track of the index used for each valid constraint.
@@ -305,6 +633,11 @@ static int xBestIndex(sqlite3_vtab *tab, sqlite3_index_info *pIdxInfo) {
   size_t expr_index = 0;
   // If any constraints are unusable increment the cost of the index.
   double cost = 1;
+  // Sets of only literal constraints do not depend on other tables' rows.
+  bool literal =
+      (FLAGS_table_parallel_generation > 0 || QueryScanScope::active());
+  // Tables with planner hints estimate the rows a scan will generate.
+  double rows = (stats.rows > 0) ? stats.rows : 1;
   // Expressions operating on the same virtual table are loosely identified by
   // the consecutive sets of terms each of the constraint sets are applied onto.
   // Subsequent attempts from failed (unusable) constraints replace the set,
@@ -323,6 +656,7 @@ static int xBestIndex(sqlite3_vtab *tab, sqlite3_index_info *pIdxInfo) {
       if (!constraint_info.usable) {
         // A higher cost less priority, prefer more usable query constraints.
         cost += 10;
+        literal = false;
         continue;
       }
 
@@ -340,6 +674,28 @@ static int xBestIndex(sqlite3_vtab *tab, sqlite3_index_info *pIdxInfo) {
       constraints.push_back(
           std::make_pair(name, Constraint(constraint_info.op)));
       pIdxInfo->aConstraintUsage[i].argvIndex = ++expr_index;
+#if SQLITE_VERSION_NUMBER >= 3038000
+      // Keep a literal value, an xFilter argument replaces the expression.
+      sqlite3_value *value = nullptr;
+      if (literal && sqlite3_vtab_rhs_value(pIdxInfo, i, &value) == SQLITE_OK &&
+          sqlite3_value_text(value) != nullptr) {
+        constraints.back().second.expr =
+            (const char *)sqlite3_value_text(value);
+      } else {
+        literal = false;
+      }
+#else
+      literal = false;
+#endif
+#if SQLITE_VERSION_NUMBER >= 3038000
+      // Receive every value of an IN operator within a single xFilter.
+      if (constraint_info.op == EQUALS && sqlite3_vtab_in(pIdxInfo, i, -1)) {
+        sqlite3_vtab_in(pIdxInfo, i, 1);
+      }
+#endif
+      rows = estimateConstrainedRows(
+          rows, std::get<2>(columns[constraint_info.iColumn]),
+          constraint_info.op);
 #if defined(DEBUG)
       plan("Adding constraint for table: " + pVtab->content->name +
            " [column=" + name + " arg_index=" + std::to_string(expr_index) +
@@ -380,6 +736,15 @@ static int xBestIndex(sqlite3_vtab *tab, sqlite3_index_info *pIdxInfo) {
     cost += 1e10;
   }
 
+  // Replace the base cost of 1 with the expense of generating the rows.
+  // Without planner hints this expense is 1, and only penalties apply.
+  cost += rows * stats.cost - 1;
+#if SQLITE_VERSION_NUMBER >= 3008002
+  if (stats.rows > 0) {
+    pIdxInfo->estimatedRows = static_cast<sqlite3_int64>(rows);
+  }
+#endif
+
   pIdxInfo->idxNum = kConstraintIndexID++;
 #if defined(DEBUG)
   plan("Recording constraint set for table: " + pVtab->content->name +
@@ -389,10 +754,162 @@ static int xBestIndex(sqlite3_vtab *tab, sqlite3_index_info *pIdxInfo) {
 #endif
   // Add the constraint set to the table's tracked constraints.
   pVtab->content->constraints[pIdxInfo->idxNum] = std::move(constraints);
+  recordUsedColumns(pVtab->content, pIdxInfo);
+  if (FLAGS_table_parallel_generation > 0) {
+    pVtab->instance->addPlan(pIdxInfo->idxNum, pVtab->content, literal);
+  }
+  if (QueryScanScope::active()) {
+    QueryScanEstimate estimate;
+    estimate.table = pVtab->content->name;
+    estimate.rows = (stats.rows > 0) ? rows : 0;
+    estimate.cost = stats.cost;
+    estimate.dependent = !literal;
+    QueryScanScope::record(pIdxInfo->idxNum, std::move(estimate));
+  }
   pIdxInfo->estimatedCost = cost;
   return SQLITE_OK;
 }
 
+/// Append a length-prefixed token to a cache key.
+static inline void appendKey(std::string &key, const std::string &token) {
+  key += std::to_string(token.size()) + ":" + token;
+}
+
+/**
+ * @brief Build a statement-scoped generation cache key.
+ *
+ * The key normalizes the constraints, sorted by column then operator and
+ * expression, and the referenced columns, since rows generated for one set of
+ * columns may omit another. Rows of every column are keyed without columns.
+ */
+static std::string generatedKey(const std::string &table,
+                                const QueryContext &context,
+                                bool columns = true) {
+  std::string key;
+  appendKey(key, table);
+  for (const auto &column : context.constraints) {
+    std::vector<std::string> terms;
+    for (const auto &constraint : column.second.getAll()) {
+      terms.push_back(std::to_string(constraint.op) + " " + constraint.expr);
+    }
+    if (terms.empty()) {
+      continue;
+    }
+    std::sort(terms.begin(), terms.end());
+    appendKey(key, column.first);
+    for (const auto &term : terms) {
+      appendKey(key, term);
+    }
+  }
+
+  if (columns && context.colsUsed) {
+    std::vector<std::string> used(context.colsUsed->begin(),
+                                  context.colsUsed->end());
+    std::sort(used.begin(), used.end());
+    key += "|";
+    for (const auto &column : used) {
+      appendKey(key, column);
+    }
+  }
+  return key;
+}
+
+/// Set a constraint's expression from an xFilter argument and add it.
+static void addConstraint(const BaseCursor *pCur,
+                          QueryContext &context,
+                          std::pair<std::string, Constraint> &constraint,
+                          sqlite3_value *value) {
+  auto expr = (const char *)sqlite3_value_text(value);
+  if (expr == nullptr || expr[0] == 0) {
+    // SQLite did not expose the expression value.
+    return;
+  }
+  // Set the expression from SQLite's now-populated argv.
+  constraint.second.expr = std::string(expr);
+  plan("Adding constraint to cursor (" + std::to_string(pCur->id) + "): " +
+       constraint.first + " " + opString(constraint.second.op) + " " +
+       constraint.second.expr);
+  // Add the constraint to the column-sorted query request map.
+  context.constraints[constraint.first].add(constraint.second);
+}
+
+/**
+ * @brief Start generating the statement's independent tables concurrently.
+ *
+ * SQLite filters the tables of a join one after another. A table whose every
+ * planned constraint set compares only with literals does not depend on the
+ * rows of the other tables, once the statement is first filtered its rows are
+ * generated on another thread. The set with the most constraints is assumed
+ * to be the plan's, its cursor waits for the pending rows within getGenerated.
+ * A generation for another set is not used and only costs the work.
+ */
+static void startPendingTables(VirtualTable *pVtab, size_t idxNum) {
+  auto *instance = pVtab->instance;
+  if (FLAGS_table_parallel_generation == 0 || !instance->startPending()) {
+    return;
+  }
+
+  std::map<VirtualTableContent *, size_t> chosen;
+  std::set<VirtualTableContent *> dependent;
+  for (const auto &plan : instance->statementPlans(idxNum)) {
+    auto *content = plan.second.table;
+    if (!plan.second.literal) {
+      dependent.insert(content);
+      continue;
+    }
+    auto it = chosen.find(content);
+    if (it == chosen.end() || content->constraints[plan.first].size() >
+                                  content->constraints[it->second].size()) {
+      chosen[content] = plan.first;
+    }
+  }
+
+  size_t started = 0;
+  for (const auto &table : chosen) {
+    auto *content = table.first;
+    // The filtered table is generated by the calling cursor.
+    if (content == pVtab->content || dependent.count(content) > 0) {
+      continue;
+    }
+    if (started >= FLAGS_table_parallel_generation) {
+      break;
+    }
+    // Only row data is shared between the cursors of a statement.
+    if (!Registry::generatesRows(content->table)) {
+      continue;
+    }
+
+    // The context does not use the table's cache, which is not protected.
+    auto context = std::make_shared<QueryContext>();
+    for (const auto &column : content->columns) {
+      context->constraints[std::get<0>(column)].affinity = std::get<1>(column);
+    }
+    for (const auto &constraint : content->constraints[table.second]) {
+      if (!constraint.second.expr.empty()) {
+        context->constraints[constraint.first].add(constraint.second);
+      }
+    }
+    if (content->colsUsed.count(table.second) > 0) {
+      context->colsUsed = content->colsUsed[table.second];
+    }
+
+    auto key = generatedKey(content->name, *context);
+    if (instance->getGenerated(key) != nullptr) {
+      continue;
+    }
+    plan("Generating rows for table: " + content->name + " [idx=" +
+         std::to_string(table.second) + "]");
+    auto handle = content->table;
+    instance->setPending(
+        key, std::async(std::launch::async, [handle, context]() {
+          auto data = std::make_shared<QueryData>();
+          Registry::callTable(handle, *context, *data);
+          return std::shared_ptr<const QueryData>(std::move(data));
+        }).share());
+    started++;
+  }
+}
+
 static int xFilter(sqlite3_vtab_cursor *pVtabCursor,
                    int idxNum,
                    const char *idxStr,
@@ -402,10 +919,22 @@ static int xFilter(sqlite3_vtab_cursor *pVtabCursor,
   auto *pVtab = (VirtualTable *)pVtabCursor->pVtab;
   auto *content = pVtab->content;
   pVtab->instance->addAffectedTable(content);
+  OSQUERY_TRACE_SPAN("xFilter");
+
+  auto *profile = cursorProfile(pCur);
+  CursorProfileTimer timer(profile);
+  if (profile != nullptr) {
+    profile->filters++;
+  }
 
   pCur->row = 0;
   pCur->n = 0;
-  QueryContext context(content);
+  pCur->offset = 0;
+  // Release a previous generator before its context.
+  pCur->generator.reset();
+  pCur->batches.reset();
+  pCur->context.reset(new QueryContext(content));
+  auto &context = *pCur->context;
 
   for (size_t i = 0; i < content->columns.size(); ++i) {
     // Set the column affinity for each optional constraint list.
@@ -427,38 +956,170 @@ static int xFilter(sqlite3_vtab_cursor *pVtabCursor,
     auto &constraints = content->constraints[idxNum];
     if (argc > 0) {
       for (size_t i = 0; i < static_cast<size_t>(argc); ++i) {
-        auto expr = (const char *)sqlite3_value_text(argv[i]);
-        if (expr == nullptr || expr[0] == 0) {
-          // SQLite did not expose the expression value.
+        auto &constraint = constraints[i];
+#if SQLITE_VERSION_NUMBER >= 3038000
+        // An IN operator provides each of its values as an EQUALS.
+        sqlite3_value *value = nullptr;
+        auto rc = sqlite3_vtab_in_first(argv[i], &value);
+        if (rc != SQLITE_ERROR) {
+          while (rc == SQLITE_OK && value != nullptr) {
+            addConstraint(pCur, context, constraint, value);
+            rc = sqlite3_vtab_in_next(argv[i], &value);
+          }
           continue;
         }
-        // Set the expression from SQLite's now-populated argv.
-        auto &constraint = constraints[i];
-        constraint.second.expr = std::string(expr);
-        plan("Adding constraint to cursor (" + std::to_string(pCur->id) +
-             "): " + constraint.first + " " + opString(constraint.second.op) +
-             " " + constraint.second.expr);
-        // Add the constraint to the column-sorted query request map.
-        context.constraints[constraint.first].add(constraint.second);
+#endif
+        addConstraint(pCur, context, constraint, argv[i]);
       }
     } else if (constraints.size() > 0) {
       // Constraints failed.
     }
   }
 
+  // Parse each column's constraints once, before the table checks values.
+  for (const auto &constraint : context.constraints) {
+    if (constraint.second.exists()) {
+      constraint.second.view();
+    }
+  }
+
+  // Allow the table to skip generating columns the query does not reference.
+  if (content->colsUsed.count(idxNum) > 0) {
+    context.colsUsed = content->colsUsed[idxNum];
+  }
+
+  // Scheduled queries in the same step share every column of a snapshot.
+  auto *snapshot = TableSnapshot::current();
+  if (snapshot != nullptr && !snapshot->contains(content->name)) {
+    snapshot = nullptr;
+  }
+  if (snapshot != nullptr) {
+    context.colsUsed = boost::none;
+  } else {
+    startPendingTables(pVtab, idxNum);
+  }
+
+  // Distributed and decorator queries may reuse a scheduled query's rows.
+  std::shared_ptr<const QueryData> recent;
+  if (snapshot == nullptr && TableStalenessScope::current() > 0) {
+    recent = RecentGenerations::get().find(
+        generatedKey(content->name, context, false),
+        TableStalenessScope::current());
+  }
+  auto rows_only = (snapshot != nullptr || recent != nullptr);
+
   // Reset the virtual table contents.
-  pCur->data.clear();
-  // Generate the row data set.
+  pCur->data = nullptr;
+  pCur->columnar = ColumnarData();
+  // Generate the row data set, prefer typed data if the table supports it.
+  // Snapshot and recent rows are kept as row data such that they are shared.
   plan("Scanning rows for cursor (" + std::to_string(pCur->id) + ")");
-  Registry::callTable(pVtab->content->name, context, pCur->data);
+  if (!rows_only &&
+      Registry::callTable(content->table, context, pCur->batches)) {
+    // Extension tables stream typed batches as SQLite steps the cursor.
+    pCur->is_columnar = true;
+    if (!nextBatch(pCur, profile)) {
+      return budgetExceeded(pVtabCursor->pVtab);
+    }
+    return SQLITE_OK;
+  }
+  pCur->is_columnar =
+      !rows_only &&
+      Registry::callTable(content->table, context, pCur->columnar).ok();
+  if (!pCur->is_columnar && !rows_only &&
+      Registry::callTable(content->table, context, pCur->generator)) {
+    // Rows are pulled as SQLite steps the cursor, generate the first.
+    pCur->done = true;
+    if (pCur->generator != nullptr && !nextGeneratedRow(pCur, profile)) {
+      return budgetExceeded(pVtabCursor->pVtab);
+    }
+    return SQLITE_OK;
+  } else if (!pCur->is_columnar) {
+    // Reuse rows generated by another cursor within the same statement.
+    auto key = generatedKey(content->name, context);
+    pCur->data = pVtab->instance->getGenerated(key);
+    if (pCur->data == nullptr && recent != nullptr) {
+      plan("Reusing recent rows for cursor (" + std::to_string(pCur->id) +
+           ")");
+      pCur->data = std::move(recent);
+    }
+    if (pCur->data == nullptr && snapshot != nullptr) {
+      pCur->data = snapshot->get(key);
+      if (pCur->data != nullptr) {
+        plan("Reusing snapshot rows for cursor (" + std::to_string(pCur->id) +
+             ")");
+        pVtab->instance->setGenerated(key, pCur->data);
+      }
+    }
+    if (pCur->data == nullptr) {
+      auto data = std::make_shared<QueryData>();
+      Registry::callTable(content->table, context, *data);
+      pVtab->instance->setGenerated(key, data);
+      if (snapshot != nullptr) {
+        snapshot->set(key, data);
+      }
+      pCur->data = std::move(data);
+    } else {
+      plan("Reusing generated rows for cursor (" + std::to_string(pCur->id) +
+           ")");
+    }
+  }
 
   // Set the number of rows.
-  pCur->n = pCur->data.size();
+  pCur->n = (pCur->is_columnar) ? pCur->columnar.rows() : pCur->data->size();
+
+  // Account for the rows within the calling thread's query budget.
+  bool budget = QueryBudgetScope::active();
+  if (budget || profile != nullptr) {
+    size_t bytes = 0;
+    if (!pCur->is_columnar) {
+      for (const auto &row : *pCur->data) {
+        bytes += rowBytes(row);
+      }
+    }
+    if (profile != nullptr) {
+      profile->rows_generated += pCur->n;
+      profile->bytes += (pCur->is_columnar) ? columnarBytes(pCur->columnar)
+                                            : bytes;
+    }
+    if (budget && !QueryBudgetScope::consume(pCur->n, bytes)) {
+      return budgetExceeded(pVtabCursor->pVtab);
+    }
+  }
   return SQLITE_OK;
 }
 }
 }
 
+// A static module structure does not need specific logic per-table.
+// clang-format off
+static sqlite3_module kTableModule = {
+    0,
+    tables::sqlite::xCreate,
+    tables::sqlite::xCreate,
+    tables::sqlite::xBestIndex,
+    tables::sqlite::xDestroy,
+    tables::sqlite::xDestroy,
+    tables::sqlite::xOpen,
+    tables::sqlite::xClose,
+    tables::sqlite::xFilter,
+    tables::sqlite::xNext,
+    tables::sqlite::xEof,
+    tables::sqlite::xColumn,
+    tables::sqlite::xRowid,
+    nullptr, /* Update */
+    nullptr, /* Begin */
+    nullptr, /* Sync */
+    nullptr, /* Commit */
+    nullptr, /* Rollback */
+    nullptr, /* FindFunction */
+    nullptr, /* Rename */
+    nullptr, /* Savepoint */
+    nullptr, /* Release */
+    nullptr, /* RollbackTo */
+};
+// clang-format on
+
 Status attachTableInternal(const std::string &name,
                            const std::string &statement,
                            const SQLiteDBInstanceRef &instance) {
@@ -467,39 +1128,10 @@ Status attachTableInternal(const std::string &name,
     return Status(0, getStringForSQLiteReturnCode(0));
   }
 
-  // A static module structure does not need specific logic per-table.
-  // clang-format off
-  static sqlite3_module module = {
-      0,
-      tables::sqlite::xCreate,
-      tables::sqlite::xCreate,
-      tables::sqlite::xBestIndex,
-      tables::sqlite::xDestroy,
-      tables::sqlite::xDestroy,
-      tables::sqlite::xOpen,
-      tables::sqlite::xClose,
-      tables::sqlite::xFilter,
-      tables::sqlite::xNext,
-      tables::sqlite::xEof,
-      tables::sqlite::xColumn,
-      tables::sqlite::xRowid,
-      nullptr, /* Update */
-      nullptr, /* Begin */
-      nullptr, /* Sync */
-      nullptr, /* Commit */
-      nullptr, /* Rollback */
-      nullptr, /* FindFunction */
-      nullptr, /* Rename */
-      nullptr, /* Savepoint */
-      nullptr, /* Release */
-      nullptr, /* RollbackTo */
-  };
-  // clang-format on
-
   // Note, if the clientData API is used then this will save a registry call
   // within xCreate.
   WriteLock lock(kAttachMutex);
-  int rc = sqlite3_create_module(instance->db(), name.c_str(), &module,
+  int rc = sqlite3_create_module(instance->db(), name.c_str(), &kTableModule,
                                  (void *)&(*instance));
   if (rc == SQLITE_OK || rc == SQLITE_MISUSE) {
     auto format =
@@ -511,6 +1143,47 @@ Status attachTableInternal(const std::string &name,
   return Status(rc, getStringForSQLiteReturnCode(rc));
 }
 
+Status attachTable(const std::string &name,
+                   const SQLiteDBInstanceRef &instance) {
+  if (SQLiteDBManager::isDisabled(name)) {
+    VLOG(1) << "Table " << name << " is disabled, not attaching";
+    return Status(0, getStringForSQLiteReturnCode(0));
+  }
+
+  // Column information is nice for virtual table create call.
+  PluginResponse response;
+  auto status = getTableColumns(name, response);
+  if (!status.ok()) {
+    return status;
+  }
+
+#if SQLITE_VERSION_NUMBER >= 3030000
+  // A module whose xCreate is its xConnect is an eponymous table. SQLite
+  // connects the table when a statement first references it. Registering a
+  // module again replaces it, and drops a connected table with old columns.
+  std::vector<std::string> modules = {name};
+  for (const auto &column : response) {
+    if (column.count("id") && column.at("id") == "alias" &&
+        column.count("alias")) {
+      modules.push_back(column.at("alias"));
+    }
+  }
+
+  WriteLock lock(kAttachMutex);
+  for (const auto &module : modules) {
+    int rc = sqlite3_create_module(instance->db(), module.c_str(),
+                                   &kTableModule, (void *)&(*instance));
+    if (rc != SQLITE_OK) {
+      LOG(ERROR) << "Error attaching table: " << module << " (" << rc << ")";
+      return Status(rc, getStringForSQLiteReturnCode(rc));
+    }
+  }
+  return Status(0, getStringForSQLiteReturnCode(0));
+#else
+  return attachTableInternal(name, columnDefinition(response, true), instance);
+#endif
+}
+
 Status detachTableInternal(const std::string &name, sqlite3 *db) {
   WriteLock lock(kAttachMutex);
   auto format = "DROP TABLE IF EXISTS temp." + name;
@@ -519,6 +1192,11 @@ Status detachTableInternal(const std::string &name, sqlite3 *db) {
     LOG(ERROR) << "Error detaching table: " << name << " (" << rc << ")";
   }
 
+#if SQLITE_VERSION_NUMBER >= 3030000
+  // Drop the module, and its eponymous table, too.
+  sqlite3_create_module(db, name.c_str(), nullptr, nullptr);
+#endif
+
   return Status(rc, getStringForSQLiteReturnCode(rc));
 }
 
@@ -547,15 +1225,8 @@ void attachVirtualTables(const SQLiteDBInstanceRef &instance) {
     registerForeignTables();
   }
 
-  PluginResponse response;
   for (const auto &name : Registry::names("table")) {
-    // Column information is nice for virtual table create call.
-    auto status =
-        Registry::call("table", name, {{"action", "columns"}}, response);
-    if (status.ok()) {
-      auto statement = columnDefinition(response, true);
-      attachTableInternal(name, statement, instance);
-    }
+    attachTable(name, instance);
   }
 }
 }
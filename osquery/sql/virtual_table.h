@@ -29,8 +29,24 @@ struct BaseCursor : private boost::noncopyable {
   sqlite3_vtab_cursor base;
   /// Track cursors for optional planner output.
   size_t id{0};
-  /// Table data generated from last access.
-  QueryData data;
+  /// Table data generated from last access, may be shared within a statement.
+  std::shared_ptr<const QueryData> data;
+  /// Typed table data generated from last access, if the table supports it.
+  ColumnarData columnar;
+  /// True if the last access generated typed data into columnar.
+  bool is_columnar{false};
+  /// The query context for the last access, kept for streaming generators.
+  std::unique_ptr<QueryContext> context;
+  /// A streaming row generator, if the table supports it.
+  RowGeneratorRef generator;
+  /// The current row yielded from generator.
+  Row current;
+  /// True when generator has no more rows.
+  bool done{false};
+  /// A streaming source of typed batches for columnar, if the table uses it.
+  ColumnarGeneratorRef batches;
+  /// The cursor position of the first row within the columnar batch.
+  size_t offset{0};
   /// Current cursor position.
   size_t row{0};
   /// Total number of rows.
@@ -59,6 +75,16 @@ Status attachTableInternal(const std::string &name,
                            const std::string &statement,
                            const SQLiteDBInstanceRef &instance);
 
+/**
+ * @brief Attach a table plugin name, and its aliases, to an SQLite database.
+ *
+ * The table is created when a statement first references it, using cached
+ * column definitions. Unlike attachTableInternal it is not listed in
+ * sqlite_temp_master.
+ */
+Status attachTable(const std::string &name,
+                   const SQLiteDBInstanceRef &instance);
+
 /// Detach (drop) a table.
 Status detachTableInternal(const std::string &name, sqlite3 *db);
 
@@ -69,4 +95,7 @@ Status attachFunctionInternal(
 
 /// Attach all table plugins to an in-memory SQLite database.
 void attachVirtualTables(const SQLiteDBInstanceRef &instance);
+
+/// The ID of the next constraint set planned by a virtual table's xBestIndex.
+size_t nextConstraintIndex();
 }
@@ -11,6 +11,7 @@
 #include <osquery/logger.h>
 #include <osquery/tables/applications/browser_utils.h>
 
+#include "osquery/tables/system/file_rows_cache.h"
 #include "osquery/tables/system/system_utils.h"
 
 namespace osquery {
@@ -27,13 +28,11 @@ const std::map<std::string, std::string> kExtensionKeys = {
     {"author", "author"},
     {"background.persistent", "persistent"}};
 
-void genExtension(const std::string& uid,
-                  const std::string& path,
-                  QueryData& results) {
+static Status parseExtension(const std::string& path, QueryData& results) {
   std::string json_data;
   if (!forensicReadFile(path + kManifestFile, json_data).ok()) {
     VLOG(1) << "Could not read file: " << path + kManifestFile;
-    return;
+    return Status(1, "Cannot read manifest");
   }
 
   // Read the extensions data into a JSON blob, then property tree.
@@ -44,11 +43,10 @@ void genExtension(const std::string& uid,
     pt::read_json(json_stream, tree);
   } catch (const pt::json_parser::json_parser_error& e) {
     VLOG(1) << "Could not parse JSON from: " << path + kManifestFile;
-    return;
+    return Status(1, "Cannot parse manifest");
   }
 
   Row r;
-  r["uid"] = uid;
   // Most of the keys are in the top-level JSON dictionary.
   for (const auto& it : kExtensionKeys) {
     r[it.second] = tree.get<std::string>(it.first, "");
@@ -69,42 +67,55 @@ void genExtension(const std::string& uid,
   r["identifier"] = fs::path(path).parent_path().parent_path().leaf().string();
   r["path"] = path;
   results.push_back(r);
+  return Status(0, "OK");
 }
 
-QueryData genChromeBasedExtensions(QueryContext& context,
-                                   const fs::path& sub_dir) {
-  QueryData results;
-
-  auto users = usersFromContext(context);
-  for (const auto& row : users) {
-    if (row.count("uid") > 0 && row.count("directory") > 0) {
-      // For each user, enumerate all of their chrome profiles.
-      std::vector<std::string> profiles;
-      fs::path extension_path = row.at("directory") / sub_dir;
-      if (!resolveFilePattern(extension_path, profiles, GLOB_FOLDERS).ok()) {
-        continue;
-      }
-
-      // For each profile list each extension in the Extensions directory.
-      std::vector<std::string> extensions;
-      for (const auto& profile : profiles) {
-        listDirectoriesInDirectory(profile, extensions);
-      }
-
-      // Generate an addons list from their extensions JSON.
-      std::vector<std::string> versions;
-      for (const auto& extension : extensions) {
-        listDirectoriesInDirectory(extension, versions);
-      }
-
-      // Extensions use /<EXTENSION>/<VERSION>/manifest.json.
-      for (const auto& version : versions) {
-        genExtension(row.at("uid"), version, results);
-      }
-    }
+void genExtension(const std::string& uid,
+                  const std::string& path,
+                  QueryData& results) {
+  static FileRowsCache kManifestCache;
+
+  // Users sharing a profile directory share its cached manifests.
+  QueryData rows;
+  kManifestCache.get(path + kManifestFile,
+                     [&path](const std::string&, QueryData& manifest_rows) {
+                       return parseExtension(path, manifest_rows);
+                     },
+                     rows);
+  for (auto& r : rows) {
+    r["uid"] = uid;
+    results.push_back(std::move(r));
   }
+}
 
-  return results;
+QueryData genChromeBasedExtensions(QueryContext& context,
+                                   const fs::path& sub_dir) {
+  return genRowsForUsers(
+      context, ([&sub_dir](const Row& user, QueryData& results) {
+        // For each user, enumerate all of their chrome profiles.
+        std::vector<std::string> profiles;
+        fs::path extension_path = user.at("directory") / sub_dir;
+        if (!resolveFilePattern(extension_path, profiles, GLOB_FOLDERS).ok()) {
+          return;
+        }
+
+        // For each profile list each extension in the Extensions directory.
+        std::vector<std::string> extensions;
+        for (const auto& profile : profiles) {
+          listDirectoriesInDirectory(profile, extensions);
+        }
+
+        // Generate an addons list from their extensions JSON.
+        std::vector<std::string> versions;
+        for (const auto& extension : extensions) {
+          listDirectoriesInDirectory(extension, versions);
+        }
+
+        // Extensions use /<EXTENSION>/<VERSION>/manifest.json.
+        for (const auto& version : versions) {
+          genExtension(user.at("uid"), version, results);
+        }
+      }));
 }
 }
 }
@@ -87,12 +87,15 @@ Status FileEventSubscriber::Callback(const FSEventsEventContextRef& ec,
   r["target_path"] = ec->path;
   r["category"] = sc->category;
   r["transaction_id"] = INTEGER(ec->transaction_id);
+  r["count"] = "1";
 
   // Add hashing and 'join' against the file table for stat-information.
-  decorateFileEvent(
-      ec->path, (ec->action == "CREATED" || ec->action == "UPDATED"), r);
-
-  add(r, ec->time);
+  // The event may be added after hashing on another thread.
+  auto time = ec->time;
+  decorateFileEvent(ec->path,
+                    (ec->action == "CREATED" || ec->action == "UPDATED"),
+                    std::move(r),
+                    [this, time](Row& row) { add(row, time); });
   return Status(0, "OK");
 }
 }
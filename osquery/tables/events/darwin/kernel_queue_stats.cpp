@@ -0,0 +1,45 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <osquery/tables.h>
+
+#include "osquery/events/kernel.h"
+
+namespace osquery {
+namespace tables {
+
+QueryData genKernelQueueStats(QueryContext& context) {
+  QueryData results;
+
+  auto pubref = EventFactory::getEventPublisher("kernel");
+  auto publisher = std::dynamic_pointer_cast<KernelEventPublisher>(pubref);
+  if (publisher == nullptr) {
+    return results;
+  }
+
+  // The statistics are kept while the queue is replaced or torn down.
+  auto stats = publisher->stats();
+  Row r;
+  r["size"] = BIGINT(stats.size);
+  r["rings"] = INTEGER(stats.rings);
+  r["fill"] = INTEGER(stats.fill);
+  r["peak_fill"] = INTEGER(stats.peak_fill);
+  r["syncs"] = BIGINT(stats.syncs);
+  r["events"] = BIGINT(stats.events);
+  r["drops"] = BIGINT(stats.drops);
+  r["last_drop"] = BIGINT(stats.last_drop);
+  r["resizes"] = INTEGER(stats.resizes);
+  r["active"] =
+      (publisher->hasStarted() && !publisher->isEnding()) ? "1" : "0";
+  results.push_back(std::move(r));
+  return results;
+}
+}
+}
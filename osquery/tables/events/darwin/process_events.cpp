@@ -22,6 +22,9 @@ class ProcessEventSubscriber : public EventSubscriber<KernelEventPublisher> {
   /// The process event subscriber declares a kernel event type subscription.
   Status init() override;
 
+  /// Replace the subscription, the kernel selects the configured filters.
+  void configure() override;
+
   /// Kernel events matching the event type will fire.
   Status Callback(const TypedKernelEventContextRef<osquery_process_event_t> &ec,
                   const KernelSubscriptionContextRef &sc);
@@ -35,11 +38,17 @@ Status ProcessEventSubscriber::init() {
     return Status(1, "No kernel event publisher");
   }
 
+  configure();
+  return Status(0, "OK");
+}
+
+void ProcessEventSubscriber::configure() {
+  removeSubscriptions();
+
   auto sc = createSubscriptionContext();
   sc->event_type = OSQUERY_PROCESS_EVENT;
+  sc->filters = getKernelFilters(OSQUERY_PROCESS_EVENT, *getFilters());
   subscribe(&ProcessEventSubscriber::Callback, sc);
-
-  return Status(0, "OK");
 }
 
 Status ProcessEventSubscriber::Callback(
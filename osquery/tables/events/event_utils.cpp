@@ -8,19 +8,50 @@
  *
  */
 
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+
+#include <osquery/dispatcher.h>
 #include <osquery/events.h>
+#include <osquery/flags.h>
 #include <osquery/hash.h>
+#include <osquery/logger.h>
 #include <osquery/sql.h>
 
+#include "osquery/core/conversions.h"
 #include "osquery/tables/events/event_utils.h"
 
 namespace osquery {
 
+FLAG(bool,
+     file_events_hash_async,
+     false,
+     "Hash file event targets on a background service");
+
+FLAG(uint64,
+     file_events_hash_queue,
+     1024,
+     "Maximum file events waiting for asynchronous hashing");
+
+FLAG(uint64,
+     file_events_hash_cache,
+     4096,
+     "Maximum file hashes cached by (inode, mtime, size)");
+
+FLAG(uint64,
+     file_events_hash_budget,
+     0,
+     "Maximum bytes per second read for asynchronous hashing (0 unlimited)");
+
 const std::set<std::string> kCommonFileColumns = {
     "inode", "uid", "gid", "mode", "size", "atime", "mtime", "ctime",
 };
 
-void decorateFileEvent(const std::string& path, bool hash, Row& r) {
+/// Copy a file's common columns from the file table.
+static void decorateFileColumns(const std::string& path, Row& r) {
   auto results = SQL::selectAllFrom("file", "path", EQUALS, path);
   if (results.size() == 1) {
     auto& row = results.at(0);
@@ -30,18 +61,216 @@ void decorateFileEvent(const std::string& path, bool hash, Row& r) {
       }
     }
   }
+}
+
+/// Set the hash columns, and the status of hashing, from computed hashes.
+static void decorateFileHashes(const MultiHashes& hashes, Row& r) {
+  r["md5"] = hashes.md5;
+  r["sha1"] = hashes.sha1;
+  r["sha256"] = hashes.sha256;
+  // Hashed determines the success/status of hashing, -1 failed, 1 success.
+  r["hashed"] = (r.at("md5").empty()) ? "-1" : "1";
+}
 
+static MultiHashes hashFileEvent(const std::string& path) {
+  return hashMultiFromFile(HASH_TYPE_MD5 | HASH_TYPE_SHA1 | HASH_TYPE_SHA256,
+                           path);
+}
+
+void decorateFileEvent(const std::string& path, bool hash, Row& r) {
+  decorateFileColumns(path, r);
   if (hash) {
-    auto hashes = hashMultiFromFile(
-        HASH_TYPE_MD5 | HASH_TYPE_SHA1 | HASH_TYPE_SHA256, path);
-    r["md5"] = std::move(hashes.md5);
-    r["sha1"] = std::move(hashes.sha1);
-    r["sha256"] = std::move(hashes.sha256);
-    // Hashed determines the success/status of hashing, -1 failed, 1 success.
-    r["hashed"] = (r.at("md5").empty()) ? "-1" : "1";
+    decorateFileHashes(hashFileEvent(path), r);
   } else {
     // Alternatively if hashing wasn't needed hashed is a 0.
     r["hashed"] = "0";
   }
 }
+
+/**
+ * @brief A service hashing file event targets from a bounded queue.
+ *
+ * Rows are decorated with hashes in the order they were queued, then passed
+ * to their callback. Hashes are cached by the file's identity columns, so
+ * repeated events for an unchanged file read it once.
+ */
+class FileHashService : public InternalRunnable {
+ public:
+  /// Queue a row for hashing, false if the queue is full.
+  bool push(const std::string& path, Row&& r, FileEventCallback&& callback);
+
+ protected:
+  /// Hash queued rows until interrupted.
+  void start() override;
+
+  /// Wake the service to stop.
+  void stop() override;
+
+  /// Hashing runs in the bulk thread class.
+  ThreadClass threadClass() const override { return THREAD_CLASS_BULK; }
+
+ private:
+  /// Get cached or computed hashes for a row, applying the I/O budget.
+  MultiHashes getHashes(const std::string& path, const Row& r);
+
+  /// Wait until the budget allows reading this many bytes.
+  void spend(size_t bytes);
+
+ private:
+  /// A row waiting for its target's hashes.
+  struct HashRequest {
+    std::string path;
+    Row row;
+    FileEventCallback callback;
+  };
+
+  /// Rows waiting to be hashed.
+  std::deque<HashRequest> queue_;
+
+  /// Hashes of recently hashed files by identity.
+  std::unordered_map<std::string, MultiHashes> cache_;
+
+  /// Insertion order of cached hashes, the oldest is evicted first.
+  std::deque<std::string> cache_order_;
+
+  /// The start of the current budget second and the bytes read within it.
+  std::chrono::steady_clock::time_point budget_start_;
+  size_t budget_spent_{0};
+
+  /// Set when the service is stopping.
+  bool stopping_{false};
+
+  /// Protects the queue and stopping state.
+  std::mutex mutex_;
+
+  /// Signaled when a row is queued or the service is stopping.
+  std::condition_variable condition_;
+};
+
+bool FileHashService::push(const std::string& path,
+                           Row&& r,
+                           FileEventCallback&& callback) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stopping_ || queue_.size() >= FLAGS_file_events_hash_queue) {
+      return false;
+    }
+    HashRequest request;
+    request.path = path;
+    request.row = std::move(r);
+    request.callback = std::move(callback);
+    queue_.push_back(std::move(request));
+  }
+  condition_.notify_one();
+  return true;
+}
+
+void FileHashService::start() {
+  while (!interrupted()) {
+    HashRequest request;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      condition_.wait(lock, [this]() { return stopping_ || !queue_.empty(); });
+      if (queue_.empty()) {
+        return;
+      }
+      request = std::move(queue_.front());
+      queue_.pop_front();
+    }
+
+    decorateFileHashes(getHashes(request.path, request.row), request.row);
+    request.callback(request.row);
+  }
+}
+
+void FileHashService::stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  condition_.notify_all();
+}
+
+MultiHashes FileHashService::getHashes(const std::string& path, const Row& r) {
+  // Files are identified by their inode, modification time and size.
+  std::string identity;
+  if (r.count("inode") > 0 && r.count("mtime") > 0 && r.count("size") > 0) {
+    identity = r.at("inode") + ":" + r.at("mtime") + ":" + r.at("size");
+    auto cached = cache_.find(identity);
+    if (cached != cache_.end()) {
+      return cached->second;
+    }
+
+    long long size = 0;
+    if (safeStrtoll(r.at("size"), 10, size).ok() && size > 0) {
+      spend(static_cast<size_t>(size));
+    }
+  }
+
+  auto hashes = hashFileEvent(path);
+  if (!identity.empty() && !hashes.md5.empty() &&
+      FLAGS_file_events_hash_cache > 0) {
+    if (cache_order_.size() >= FLAGS_file_events_hash_cache) {
+      cache_.erase(cache_order_.front());
+      cache_order_.pop_front();
+    }
+    cache_[identity] = hashes;
+    cache_order_.push_back(identity);
+  }
+  return hashes;
+}
+
+void FileHashService::spend(size_t bytes) {
+  if (FLAGS_file_events_hash_budget == 0) {
+    return;
+  }
+
+  auto now = std::chrono::steady_clock::now();
+  if (now - budget_start_ >= std::chrono::seconds(1)) {
+    budget_start_ = now;
+    budget_spent_ = 0;
+  }
+
+  // A file larger than the budget is read at the start of a second.
+  if (budget_spent_ > 0 &&
+      budget_spent_ + bytes > FLAGS_file_events_hash_budget) {
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        now - budget_start_);
+    pauseMilli(std::chrono::milliseconds(1000) - elapsed);
+    budget_start_ = std::chrono::steady_clock::now();
+    budget_spent_ = 0;
+  }
+  budget_spent_ += bytes;
+}
+
+/// The hashing service, started when the first row is queued.
+static std::shared_ptr<FileHashService> getFileHashService() {
+  static std::shared_ptr<FileHashService> service{nullptr};
+  static std::once_flag started;
+  std::call_once(started, []() {
+    service = std::make_shared<FileHashService>();
+    Dispatcher::addService(service);
+  });
+  return service;
+}
+
+void decorateFileEvent(const std::string& path,
+                       bool hash,
+                       Row r,
+                       FileEventCallback callback) {
+  if (!hash || !FLAGS_file_events_hash_async) {
+    decorateFileEvent(path, hash, r);
+    callback(r);
+    return;
+  }
+
+  decorateFileColumns(path, r);
+  auto service = getFileHashService();
+  if (!service->push(path, std::move(r), std::move(callback))) {
+    // The row and callback were not moved from if the queue was full.
+    VLOG(1) << "File event hashing queue is full, not hashing: " << path;
+    r["hashed"] = "0";
+    callback(r);
+  }
+}
 }
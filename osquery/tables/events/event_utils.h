@@ -10,6 +10,7 @@
 
 #pragma once
 
+#include <functional>
 #include <set>
 #include <string>
 
@@ -31,4 +32,27 @@ extern const std::set<std::string> kCommonFileColumns;
  * @param r The output parameter row structure.
  */
 void decorateFileEvent(const std::string& path, bool hash, Row& r);
+
+/// Receives a decorated file event row, for example to add the event.
+using FileEventCallback = std::function<void(Row&)>;
+
+/**
+ * @brief Decorate a file event, hashing the file outside the caller's thread.
+ *
+ * With --file_events_hash_async the file is hashed by a background service,
+ * after the common columns are decorated. The service keeps a bounded queue,
+ * reuses the hashes of files with the same (inode, mtime, size), and limits
+ * the bytes read per second. The callback is called with the completed row on
+ * the service's thread. Without hashing, or without the flag, the row is
+ * completed and the callback is called before this returns.
+ *
+ * @param path The target path from the file event.
+ * @param hash Should the target path be read and hashed.
+ * @param r The row structure, moved into the callback.
+ * @param callback Called with the decorated row.
+ */
+void decorateFileEvent(const std::string& path,
+                       bool hash,
+                       Row r,
+                       FileEventCallback callback);
 }
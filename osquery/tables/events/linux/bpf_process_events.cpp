@@ -0,0 +1,149 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <algorithm>
+
+#include <linux/limits.h>
+#include <unistd.h>
+
+#include <boost/algorithm/string.hpp>
+
+#include <osquery/filesystem.h>
+#include <osquery/sql.h>
+#include <osquery/system.h>
+
+#include "osquery/core/conversions.h"
+#include "osquery/events/linux/bpf.h"
+#include "osquery/tables/system/linux/process_cache.h"
+
+namespace osquery {
+
+DECLARE_bool(process_cache);
+
+// Depend on the external getUptime table method.
+namespace tables {
+extern long getUptime();
+}
+
+class BPFProcessEventSubscriber : public EventSubscriber<BPFEventPublisher> {
+ public:
+  /// The process event subscriber declares an exec event type subscription.
+  Status init() override;
+
+  /// Completed execve syscalls will fire.
+  Status Callback(const ECRef& ec, const SCRef& sc);
+};
+
+REGISTER(BPFProcessEventSubscriber, "event_subscriber", "bpf_process_events");
+
+/// Resolve the executable of a process, which may have already exited.
+std::string getBPFProcessPath(const BPFEventContextRef& ec) {
+  char path[PATH_MAX] = {0};
+  auto link = "/proc/" + std::to_string(ec->pid) + "/exe";
+  auto size = ::readlink(link.c_str(), path, sizeof(path) - 1);
+  return (size > 0) ? std::string(path, size) : ec->path;
+}
+
+/// Read a value from the Linux /proc/<pid>/status file.
+static std::string getStatusValue(const std::string& status,
+                                  const std::string& key,
+                                  size_t index) {
+  for (const auto& line : osquery::split(status, "\n")) {
+    if (line.compare(0, key.size() + 1, key + ":") != 0) {
+      continue;
+    }
+    auto values = osquery::split(line.substr(key.size() + 1), "\t ");
+    return (values.size() > index) ? values[index] : "";
+  }
+  return "";
+}
+
+Status BPFProcessEventSubscriber::init() {
+  auto sc = createSubscriptionContext();
+  sc->types.insert(BPF_EVENT_EXEC);
+  subscribe(&BPFProcessEventSubscriber::Callback, sc);
+
+  tables::ProcessCache::start();
+  return Status(0, "OK");
+}
+
+Status BPFProcessEventSubscriber::Callback(const ECRef& ec, const SCRef& sc) {
+  // Only successful executions are published.
+  if (ec->result != 0) {
+    return Status(0, "OK");
+  }
+
+  Row r;
+  auto proc = "/proc/" + std::to_string(ec->pid);
+  r["pid"] = INTEGER(ec->pid);
+  r["path"] = getBPFProcessPath(ec);
+  r["uid"] = INTEGER(ec->uid);
+  r["gid"] = INTEGER(ec->gid);
+
+  // The new image's arguments are read from the process when the exit is
+  // published, a short-lived process may have exited.
+  std::string cmdline;
+  if (readFile(proc + "/cmdline", cmdline).ok()) {
+    r["cmdline_size"] = INTEGER(cmdline.size());
+    std::replace(cmdline.begin(), cmdline.end(), '\0', ' ');
+    boost::trim_right(cmdline);
+    r["cmdline"] = std::move(cmdline);
+  } else {
+    r["cmdline"] = ec->path;
+    r["cmdline_size"] = "";
+  }
+
+  std::string status;
+  readFile(proc + "/status", status);
+  auto euid = getStatusValue(status, "Uid", 1);
+  auto egid = getStatusValue(status, "Gid", 1);
+  auto ppid = getStatusValue(status, "PPid", 0);
+  r["euid"] = (euid.empty()) ? r.at("uid") : euid;
+  r["egid"] = (egid.empty()) ? r.at("gid") : egid;
+  r["parent"] = (ppid.empty()) ? "0" : ppid;
+
+  if (FLAGS_process_cache) {
+    tables::ProcessCacheEntry process;
+    process.name = getStatusValue(status, "Name", 0);
+    process.path = r.at("path");
+    process.cmdline = r.at("cmdline");
+    process.parent = r.at("parent");
+    process.uid = r.at("uid");
+    process.euid = r.at("euid");
+    process.gid = r.at("gid");
+    process.egid = r.at("egid");
+    tables::ProcessCache::get().exec(r.at("pid"), std::move(process));
+  }
+
+  r["mode"] = "";
+  r["owner_uid"] = "0";
+  r["owner_gid"] = "0";
+  auto qd = SQL::selectAllFrom("file", "path", EQUALS, r.at("path"));
+  if (qd.size() == 1) {
+    r["mode"] = qd.front().at("mode");
+    r["owner_uid"] = qd.front().at("uid");
+    r["owner_gid"] = qd.front().at("gid");
+    r["ctime"] = qd.front().at("ctime");
+    r["atime"] = qd.front().at("atime");
+    r["mtime"] = qd.front().at("mtime");
+    r["btime"] = "0";
+  }
+
+  r["overflows"] = "";
+  r["env_size"] = "0";
+  r["env_count"] = "0";
+  r["env"] = "";
+
+  // Uptime is helpful for execution-based events.
+  r["uptime"] = std::to_string(tables::getUptime());
+  add(r, ec->time);
+  return Status(0, "OK");
+}
+} // namespace osquery
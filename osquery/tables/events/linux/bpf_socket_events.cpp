@@ -0,0 +1,132 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <arpa/inet.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <osquery/system.h>
+
+#include "osquery/events/linux/bpf.h"
+#include "osquery/tables/events/linux/socket_flows.h"
+
+namespace osquery {
+
+#define BPF_EINPROGRESS -115
+
+// Depend on the external getUptime table method.
+namespace tables {
+extern long getUptime();
+}
+
+/// Resolve the executable of a process, see bpf_process_events.
+extern std::string getBPFProcessPath(const BPFEventContextRef& ec);
+
+class BPFSocketEventSubscriber : public EventSubscriber<BPFEventPublisher> {
+ public:
+  /// The socket event subscriber declares socket event type subscriptions.
+  Status init() override;
+
+  /// Completed connect, bind, and accept syscalls will fire.
+  Status Callback(const ECRef& ec, const SCRef& sc);
+
+  /// Store the flows whose window passed before selecting events.
+  QueryData genTable(QueryContext& context) override;
+
+ private:
+  /// Repeated events are rolled up, see --socket_events_window.
+  SocketFlowAggregator flows_;
+};
+
+REGISTER(BPFSocketEventSubscriber, "event_subscriber", "bpf_socket_events");
+
+/// Parse the raw socket address structure copied by the BPF programs.
+void parseBPFSockAddr(const std::string& saddr, Row& r, bool local) {
+  uint16_t family = 0;
+  if (saddr.size() >= sizeof(family)) {
+    memcpy(&family, saddr.data(), sizeof(family));
+  }
+
+  auto port_column = (local) ? "local_port" : "remote_port";
+  auto address_column = (local) ? "local_address" : "remote_address";
+  char address[INET6_ADDRSTRLEN] = {0};
+  uint16_t port = 0;
+  if (family == AF_INET && saddr.size() >= 8) {
+    r["family"] = "2";
+    memcpy(&port, saddr.data() + 2, sizeof(port));
+    r[port_column] = INTEGER(ntohs(port));
+    if (inet_ntop(AF_INET, saddr.data() + 4, address, sizeof(address))) {
+      r[address_column] = address;
+    }
+  } else if (family == AF_INET6 && saddr.size() >= 24) {
+    r["family"] = "10";
+    memcpy(&port, saddr.data() + 2, sizeof(port));
+    r[port_column] = INTEGER(ntohs(port));
+    if (inet_ntop(AF_INET6, saddr.data() + 8, address, sizeof(address))) {
+      r[address_column] = address;
+    }
+  } else if (family == AF_UNIX) {
+    // Only the start of a local path fits within the copied structure.
+    r["family"] = "1";
+    auto path = saddr.substr(sizeof(family));
+    r["socket"] = path.substr(0, path.find('\0'));
+  } else {
+    r["family"] = "-1";
+    r["local_address"] = "unknown";
+    r["remote_address"] = "unknown";
+  }
+}
+
+Status BPFSocketEventSubscriber::init() {
+  auto sc = createSubscriptionContext();
+  sc->types = {BPF_EVENT_CONNECT, BPF_EVENT_BIND, BPF_EVENT_ACCEPT};
+  subscribe(&BPFSocketEventSubscriber::Callback, sc);
+
+  return Status(0, "OK");
+}
+
+QueryData BPFSocketEventSubscriber::genTable(QueryContext& context) {
+  flows_.expire(getUnixTime(),
+                [this](Row& r, EventTime t) { add(r, t); });
+  return EventSubscriberPlugin::genTable(context);
+}
+
+Status BPFSocketEventSubscriber::Callback(const ECRef& ec, const SCRef& sc) {
+  Row r;
+  if (ec->type == BPF_EVENT_CONNECT) {
+    r["action"] = "connect";
+    // Non-blocking sockets connect asynchronously.
+    r["success"] =
+        (ec->result == 0 || ec->result == BPF_EINPROGRESS) ? "1" : "0";
+  } else if (ec->type == BPF_EVENT_BIND) {
+    r["action"] = "bind";
+    r["success"] = (ec->result == 0) ? "1" : "0";
+  } else if (ec->type == BPF_EVENT_ACCEPT) {
+    r["action"] = "accept";
+    r["success"] = (ec->result >= 0) ? "1" : "0";
+  } else {
+    return Status(0, "OK");
+  }
+
+  r["pid"] = INTEGER(ec->pid);
+  r["path"] = getBPFProcessPath(ec);
+  r["fd"] = INTEGER(ec->fd);
+  // The protocol is not included in the socket address.
+  r["protocol"] = "0";
+  r["local_port"] = "0";
+  r["remote_port"] = "0";
+  parseBPFSockAddr(ec->address, r, (ec->type == BPF_EVENT_BIND));
+  r["uptime"] = BIGINT(tables::getUptime());
+  flows_.add(std::move(r), ec->time, [this](Row& row, EventTime t) {
+    add(row, t);
+  });
+  return Status(0, "OK");
+}
+} // namespace osquery
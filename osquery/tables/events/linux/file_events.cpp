@@ -13,14 +13,18 @@
 
 #include <osquery/core.h>
 #include <osquery/config.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
+#include "osquery/events/linux/fanotify.h"
 #include "osquery/events/linux/inotify.h"
 #include "osquery/tables/events/event_utils.h"
 
 namespace osquery {
 
+DECLARE_bool(disable_fanotify);
+
 /**
  * @brief Track time, action changes to /etc/passwd
  *
@@ -36,6 +40,13 @@ class FileEventSubscriber : public EventSubscriber<INotifyEventPublisher> {
   /// Walk the configuration's file paths, create subscriptions.
   void configure() override;
 
+  /// Subscribe to the fanotify publisher instead of inotify if enabled.
+  EventPublisherID& getType() const override {
+    static EventPublisherID inotify = "inotify";
+    static EventPublisherID fanotify = "fanotify";
+    return (FLAGS_disable_fanotify) ? inotify : fanotify;
+  }
+
   /**
    * @brief This exports a single Callback for INotifyEventPublisher events.
    *
@@ -91,22 +102,28 @@ Status FileEventSubscriber::Callback(const ECRef& ec, const SCRef& sc) {
   r["target_path"] = ec->path;
   r["category"] = sc->category;
   r["transaction_id"] = INTEGER(ec->event->cookie);
+  r["count"] = INTEGER(ec->count);
 
+  auto time = ec->time;
   if ((sc->mask & kFileAccessMasks) != kFileAccessMasks) {
     // Add hashing and 'join' against the file table for stat-information.
+    // The event may be added after hashing on another thread.
     decorateFileEvent(ec->path,
-                      (ec->action == "CREATED" || ec->action == "UPDATED"), r);
-  } else {
-    // The access event on Linux would generate additional events if stated.
-    for (const auto& column : kCommonFileColumns) {
-      r[column] = "0";
-    }
-    r["hashed"] = "0";
+                      (ec->action == "CREATED" || ec->action == "UPDATED"),
+                      std::move(r),
+                      [this, time](Row& row) { add(row, time); });
+    return Status(0, "OK");
+  }
+
+  // The access event on Linux would generate additional events if stated.
+  for (const auto& column : kCommonFileColumns) {
+    r[column] = "0";
   }
+  r["hashed"] = "0";
 
   // A callback is somewhat useless unless it changes the EventSubscriber
   // state or calls `add` to store a marked up event.
-  add(r, ec->time);
+  add(r, time);
   return Status(0, "OK");
 }
 }
@@ -16,10 +16,14 @@
 #include <osquery/system.h>
 
 #include "osquery/events/linux/audit.h"
+#include "osquery/tables/system/linux/process_cache.h"
 
 namespace osquery {
 
+DECLARE_bool(process_cache);
+
 #define AUDIT_SYSCALL_EXECVE 59
+#define AUDIT_SYSCALL_EXIT_GROUP 231
 
 // Depend on the external getUptime table method.
 namespace tables {
@@ -33,13 +37,6 @@ class ProcessEventSubscriber : public EventSubscriber<AuditEventPublisher> {
 
   /// Kernel events matching the event type will fire.
   Status Callback(const ECRef& ec, const SCRef& sc);
-
- private:
-  /// The next expected process event state.
-  AuditProcessEventState state_{STATE_SYSCALL};
-
-  /// Along with the state, track the building row.
-  Row row_;
 };
 
 inline std::string decodeAuditValue(const std::string& s) {
@@ -53,29 +50,6 @@ inline std::string decodeAuditValue(const std::string& s) {
   }
 }
 
-Status validAuditState(int type, AuditProcessEventState& state) {
-  // Define some acceptable transitions outside of the default state.
-  bool acceptable = (type == STATE_PATH && state == STATE_EXECVE);
-  acceptable |= (type == STATE_PATH && state == STATE_CWD);
-  if (type != state && !acceptable) {
-    // This is an out-of-order event, drop it.
-    return Status(1, "Out of order");
-  }
-
-  // Update the next expected state.
-  if (type == AUDIT_SYSCALL) {
-    state = STATE_EXECVE;
-  } else if (type == AUDIT_EXECVE) {
-    state = STATE_CWD;
-  } else if (type == AUDIT_CWD) {
-    state = STATE_PATH;
-  } else {
-    state = STATE_SYSCALL;
-  }
-
-  return Status(0, "OK");
-}
-
 inline void updateAuditRow(const AuditEventContextRef& ec, Row& r) {
   const auto& fields = ec->fields;
   if (ec->type == AUDIT_SYSCALL) {
@@ -85,10 +59,10 @@ inline void updateAuditRow(const AuditEventContextRef& ec, Row& r) {
     r["euid"] = fields.count("euid") ? fields.at("euid") : "0";
     r["gid"] = fields.count("gid") ? fields.at("gid") : "0";
     r["egid"] = fields.count("egid") ? fields.at("euid") : "0";
-    r["path"] = (fields.count("exe")) ? decodeAuditValue(fields.at("exe")) : "";
+    r["path"] = decodeAuditValue(fields.get("exe"));
 
     // This should get overwritten during the EXECVE state.
-    r["cmdline"] = (fields.count("comm")) ? fields.at("comm") : "";
+    r["cmdline"] = fields.get("comm");
     // Do not record a cmdline size. If the final state is reached and no 'argc'
     // has been filled in then the EXECVE state was not used.
     r["cmdline_size"] = "";
@@ -101,17 +75,18 @@ inline void updateAuditRow(const AuditEventContextRef& ec, Row& r) {
 
   if (ec->type == AUDIT_EXECVE) {
     // Reset the temporary storage from the SYSCALL state.
-    r["cmdline"] = "";
-    for (const auto& arg : fields) {
-      if (arg.first == "argc") {
+    auto& cmdline = r["cmdline"];
+    cmdline.clear();
+    for (size_t i = 0; i < fields.size(); i++) {
+      if (fields.key(i) == "argc") {
         continue;
       }
 
-      // Amalgamate all the "arg*" fields.
-      if (r.at("cmdline").size() > 0) {
-        r["cmdline"] += " ";
+      // Amalgamate all the "arg*" fields, in message order.
+      if (cmdline.size() > 0) {
+        cmdline += " ";
       }
-      r["cmdline"] += decodeAuditValue(arg.second);
+      cmdline += decodeAuditValue(fields.value(i).to_string());
     }
 
     // There may be a better way to calculate actual size from audit.
@@ -119,8 +94,12 @@ inline void updateAuditRow(const AuditEventContextRef& ec, Row& r) {
     r["cmdline_size"] = std::to_string(r.at("cmdline").size());
   }
 
+  if (ec->type == AUDIT_CWD) {
+    r["cwd"] = decodeAuditValue(fields.get("cwd"));
+  }
+
   if (ec->type == AUDIT_PATH) {
-    r["mode"] = (fields.count("mode")) ? fields.at("mode") : "";
+    r["mode"] = fields.get("mode");
     r["owner_uid"] = fields.count("ouid") ? fields.at("ouid") : "0";
     r["owner_gid"] = fields.count("ogid") ? fields.at("ogid") : "0";
 
@@ -145,43 +124,78 @@ Status ProcessEventSubscriber::init() {
   // Monitor for execve syscalls.
   sc->rules.push_back({AUDIT_SYSCALL_EXECVE, ""});
 
-  // Request call backs for all parts of the process execution state.
-  // Drop events if they are encountered outside of the expected state.
-  sc->types = {AUDIT_SYSCALL, AUDIT_EXECVE, AUDIT_CWD, AUDIT_PATH};
+  // Exits remove processes from the cache used to enrich events.
+  if (FLAGS_process_cache) {
+    sc->rules.push_back({AUDIT_SYSCALL_EXIT_GROUP, ""});
+    tables::ProcessCache::start();
+  }
+
+  // Request each execve as one event, with its SYSCALL, EXECVE, CWD, and PATH
+  // records correlated by the publisher. The rule's syscall matches the event.
+  sc->records = true;
   subscribe(&ProcessEventSubscriber::Callback, sc);
 
   return Status(0, "OK");
 }
 
 Status ProcessEventSubscriber::Callback(const ECRef& ec, const SCRef& sc) {
-  // Check and set the valid state change.
-  // If this is an unacceptable change reset the state and clear row data.
-  if (ec->fields.count("success") && ec->fields.at("success") == "no") {
+  // The first record is always the SYSCALL.
+  if (ec->records.empty() ||
+      ec->records.front()->fields.getRef("success") == "no") {
     return Status(0, "OK");
   }
 
-  if (!validAuditState(ec->type, state_).ok()) {
-    state_ = STATE_SYSCALL;
-    Row().swap(row_);
+  const auto& fields = ec->records.front()->fields;
+  if (ec->syscall == AUDIT_SYSCALL_EXIT_GROUP) {
+    tables::ProcessCache::get().exit(fields.get("pid"));
     return Status(0, "OK");
   }
 
-  // Fill in row fields based on the event state.
-  updateAuditRow(ec, row_);
-
-  // Only add the event if finished (aka a PATH event was emitted).
-  if (state_ == STATE_SYSCALL) {
-    // If the EXECVE state was not used, decode the cmdline value.
-    if (row_.at("cmdline_size").size() == 0) {
-      // This allows at most 1 decode call per potentially-encoded item.
-      row_["cmdline"] = decodeAuditValue(row_.at("cmdline"));
-      row_["cmdline_size"] = "1";
+  // Fill in row fields from each record, using the first PATH (the binary).
+  Row r;
+  bool found_path = false;
+  for (const auto& record : ec->records) {
+    if (record->type == AUDIT_PATH) {
+      if (found_path) {
+        continue;
+      }
+      found_path = true;
     }
+    updateAuditRow(record, r);
+  }
+
+  // Only add the event if it is complete (aka a PATH record was emitted).
+  if (!found_path) {
+    return Status(0, "OK");
+  }
+
+  // If the EXECVE record was not used, decode the cmdline value.
+  if (r.at("cmdline_size").size() == 0) {
+    // This allows at most 1 decode call per potentially-encoded item.
+    r["cmdline"] = decodeAuditValue(r.at("cmdline"));
+    r["cmdline_size"] = "1";
+  }
 
-    add(row_, getUnixTime());
-    Row().swap(row_);
+  // The parent was recorded by its own exec, or read from /proc.
+  auto& cache = tables::ProcessCache::get();
+  tables::ProcessCacheEntry parent;
+  r["parent_path"] = (cache.lookup(r.at("parent"), parent)) ? parent.path : "";
+
+  if (FLAGS_process_cache) {
+    tables::ProcessCacheEntry process;
+    process.name = decodeAuditValue(fields.get("comm"));
+    process.path = r.at("path");
+    process.cmdline = r.at("cmdline");
+    process.cwd = r["cwd"];
+    process.parent = r.at("parent");
+    process.uid = r.at("uid");
+    process.euid = r.at("euid");
+    process.gid = r.at("gid");
+    process.egid = r.at("egid");
+    cache.exec(r.at("pid"), std::move(process));
   }
 
+  add(r, getUnixTime());
   return Status(0, "OK");
 }
 } // namespace osquery
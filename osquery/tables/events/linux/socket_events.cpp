@@ -16,6 +16,8 @@
 
 #include "osquery/core/conversions.h"
 #include "osquery/events/linux/audit.h"
+#include "osquery/tables/events/linux/socket_flows.h"
+#include "osquery/tables/system/linux/process_cache.h"
 
 namespace osquery {
 
@@ -38,12 +40,18 @@ class SocketEventSubscriber : public EventSubscriber<AuditEventPublisher> {
   /// Kernel events matching the event type will fire.
   Status Callback(const ECRef& ec, const SCRef& sc);
 
+  /// Store the flows whose window passed before selecting events.
+  QueryData genTable(QueryContext& context) override;
+
  private:
   /// Socket events come in pairs, first the syscall then the structure.
   bool waiting_for_saddr_{false};
 
   /// The intermediate row structure.
   Row row_;
+
+  /// Repeated events are rolled up, see --socket_events_window.
+  SocketFlowAggregator flows_;
 };
 
 REGISTER(SocketEventSubscriber, "event_subscriber", "socket_events");
@@ -61,6 +69,7 @@ Status SocketEventSubscriber::init() {
   // sc->types = {AUDIT_SYSCALL};
   subscribe(&SocketEventSubscriber::Callback, sc);
 
+  tables::ProcessCache::start();
   return Status(0, "OK");
 }
 
@@ -114,10 +123,16 @@ void parseSockAddr(const std::string& saddr, Row& r, bool local) {
   }
 }
 
+QueryData SocketEventSubscriber::genTable(QueryContext& context) {
+  flows_.expire(getUnixTime(),
+                [this](Row& r, EventTime t) { add(r, t); });
+  return EventSubscriberPlugin::genTable(context);
+}
+
 Status SocketEventSubscriber::Callback(const ECRef& ec, const SCRef&) {
   if (waiting_for_saddr_) {
     if (ec->type == AUDIT_TYPE_SOCKADDR) {
-      auto& saddr = ec->fields["saddr"];
+      auto saddr = ec->fields.get("saddr");
       if (saddr.size() < 4 || saddr[0] == '1') {
         return Status(0);
       }
@@ -126,7 +141,9 @@ Status SocketEventSubscriber::Callback(const ECRef& ec, const SCRef&) {
       row_["remote_port"] = "0";
       // Parse the struct and emit the row.
       parseSockAddr(saddr, row_, (row_.at("action") == "bind"));
-      add(row_, getUnixTime());
+      flows_.add(std::move(row_), getUnixTime(), [this](Row& r, EventTime t) {
+        add(r, t);
+      });
       Row().swap(row_);
       waiting_for_saddr_ = false;
     }
@@ -136,7 +153,7 @@ Status SocketEventSubscriber::Callback(const ECRef& ec, const SCRef&) {
 
   if (ec->syscall == AUDIT_SYSCALL_CONNECT) {
     // The connect syscall must exit with EINPROGRESS
-    if (ec->fields.count("exit") && ec->fields.at("exit") != "-115") {
+    if (ec->fields.count("exit") && ec->fields.getRef("exit") != "-115") {
       return Status(0);
     }
     row_["action"] = "connect";
@@ -146,12 +163,22 @@ Status SocketEventSubscriber::Callback(const ECRef& ec, const SCRef&) {
     return Status(0);
   }
 
-  row_["pid"] = ec->fields["pid"];
-  row_["path"] = ec->fields["exe"];
+  row_["pid"] = ec->fields.get("pid");
+  row_["path"] = ec->fields.get("exe");
+
+  // A process forked without an exec runs its parent's image.
+  auto& cache = tables::ProcessCache::get();
+  tables::ProcessCacheEntry process;
+  if (cache.lookup(row_.at("pid"), process) ||
+      cache.lookup(ec->fields.get("ppid"), process)) {
+    row_["cmdline"] = std::move(process.cmdline);
+  } else {
+    row_["cmdline"] = "";
+  }
   // TODO: This is a hex value.
-  row_["fd"] = ec->fields["a0"];
+  row_["fd"] = ec->fields.get("a0");
   // The open/bind success status.
-  row_["success"] = (ec->fields["success"] == "yes") ? "1" : "0";
+  row_["success"] = (ec->fields.getRef("success") == "yes") ? "1" : "0";
   row_["uptime"] = BIGINT(tables::getUptime());
   waiting_for_saddr_ = true;
   return Status(0);
@@ -0,0 +1,125 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <algorithm>
+#include <vector>
+
+#include <osquery/flags.h>
+
+#include "osquery/tables/events/linux/socket_flows.h"
+
+namespace osquery {
+
+FLAG(uint64,
+     socket_events_window,
+     0,
+     "Seconds to roll up repeated socket events into one row, 0 stores each");
+
+/// Events beyond this many flows are stored without rolling up.
+const size_t kSocketFlowsMax = 65536;
+
+/// The columns identifying a flow, in key order.
+const std::vector<std::string> kSocketFlowColumns = {
+    "action",
+    "success",
+    "pid",
+    "path",
+    "family",
+    "local_address",
+    "local_port",
+    "remote_address",
+    "remote_port",
+    "socket",
+};
+
+std::string SocketFlowAggregator::getFlowKey(const Row& r) {
+  std::string key;
+  for (const auto& column : kSocketFlowColumns) {
+    auto it = r.find(column);
+    if (it != r.end()) {
+      key += it->second;
+    }
+    key += '\0';
+  }
+  return key;
+}
+
+void SocketFlowAggregator::storeFlow(Flow& flow,
+                                     EventTime time,
+                                     const Adder& adder) {
+  flow.row["count"] = INTEGER(flow.count);
+  flow.row["first_time"] = BIGINT(flow.first);
+  flow.row["last_time"] = BIGINT(flow.last);
+  adder(flow.row, time);
+}
+
+void SocketFlowAggregator::add(Row r, EventTime time, const Adder& adder) {
+  Flow flow;
+  flow.row = std::move(r);
+  flow.first = time;
+  flow.last = time;
+  flow.count = 1;
+  if (FLAGS_socket_events_window == 0) {
+    storeFlow(flow, time, adder);
+    return;
+  }
+
+  expire(time, adder);
+  auto key = getFlowKey(flow.row);
+  {
+    WriteLock lock(mutex_);
+    auto it = flows_.find(key);
+    if (it != flows_.end()) {
+      it->second.count++;
+      it->second.last = std::max(it->second.last, time);
+      return;
+    }
+    if (flows_.size() < kSocketFlowsMax) {
+      flows_.emplace(std::move(key), std::move(flow));
+      return;
+    }
+  }
+
+  // Too many flows are within their window.
+  storeFlow(flow, time, adder);
+}
+
+void SocketFlowAggregator::expire(EventTime now, const Adder& adder) {
+  std::vector<Flow> expired;
+  {
+    WriteLock lock(mutex_);
+    if (now == expired_) {
+      return;
+    }
+    expired_ = now;
+    for (auto it = flows_.begin(); it != flows_.end();) {
+      if (now >= it->second.first + FLAGS_socket_events_window) {
+        expired.push_back(std::move(it->second));
+        it = flows_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  // Flows are stored when they end, optimized selects find them after.
+  std::sort(expired.begin(),
+            expired.end(),
+            [](const Flow& l, const Flow& r) { return l.first < r.first; });
+  for (auto& flow : expired) {
+    storeFlow(flow, now, adder);
+  }
+}
+
+size_t SocketFlowAggregator::size() const {
+  WriteLock lock(mutex_);
+  return flows_.size();
+}
+}
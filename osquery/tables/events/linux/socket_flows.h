@@ -0,0 +1,72 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <functional>
+#include <string>
+#include <unordered_map>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/core.h>
+#include <osquery/events.h>
+
+namespace osquery {
+
+/**
+ * @brief Roll up repeated socket events into flows before they are stored.
+ *
+ * With --socket_events_window, the events of a process and path with the same
+ * action, success, and addresses are counted into the row of the flow's first
+ * event. The flow is stored once the window since its first event passes,
+ * with the count, first_time, and last_time columns; its fd and uptime are
+ * those of the first event. Without a window every event is stored.
+ */
+class SocketFlowAggregator : private boost::noncopyable {
+ public:
+  /// Store a row at an event time, such as EventSubscriber::add.
+  using Adder = std::function<void(Row& r, EventTime time)>;
+
+  /// Add a socket event, flows whose window passed are also stored.
+  void add(Row r, EventTime time, const Adder& adder);
+
+  /// Store each flow whose window passed, at most once a second.
+  void expire(EventTime now, const Adder& adder);
+
+  /// The number of flows within their window.
+  size_t size() const;
+
+ private:
+  /// A socket event's row and the events rolled up into it.
+  struct Flow {
+    Row row;
+    EventTime first{0};
+    EventTime last{0};
+    size_t count{0};
+  };
+
+  /// The columns identifying a flow.
+  static std::string getFlowKey(const Row& r);
+
+  /// Fill in the rolled up columns and store a flow at an event time.
+  static void storeFlow(Flow& flow, EventTime time, const Adder& adder);
+
+ private:
+  /// Flows within their window by key.
+  std::unordered_map<std::string, Flow> flows_;
+
+  /// The last time flows were expired.
+  EventTime expired_{0};
+
+  /// Events are added by the subscriber and expired by selects.
+  mutable Mutex mutex_;
+};
+}
@@ -0,0 +1,100 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <gtest/gtest.h>
+
+#include <osquery/flags.h>
+
+#include "osquery/tables/events/linux/socket_flows.h"
+#include "osquery/tests/test_util.h"
+
+namespace osquery {
+
+DECLARE_uint64(socket_events_window);
+
+class SocketFlowsTests : public testing::Test {
+ protected:
+  void SetUp() override { window_ = FLAGS_socket_events_window; }
+
+  void TearDown() override { FLAGS_socket_events_window = window_; }
+
+  /// A connect from the same process to the same remote address.
+  static Row getConnect(const std::string& fd) {
+    return {
+        {"action", "connect"},
+        {"success", "1"},
+        {"pid", "100"},
+        {"path", "/usr/bin/curl"},
+        {"fd", fd},
+        {"family", "2"},
+        {"remote_address", "10.0.0.1"},
+        {"remote_port", "443"},
+    };
+  }
+
+ protected:
+  QueryData rows_;
+
+  std::vector<EventTime> times_;
+
+  SocketFlowAggregator::Adder adder_ = [this](Row& r, EventTime time) {
+    rows_.push_back(r);
+    times_.push_back(time);
+  };
+
+ private:
+  unsigned long long window_{0};
+};
+
+TEST_F(SocketFlowsTests, test_without_window) {
+  FLAGS_socket_events_window = 0;
+  SocketFlowAggregator flows;
+  flows.add(getConnect("3"), 100, adder_);
+  flows.add(getConnect("4"), 100, adder_);
+
+  ASSERT_EQ(rows_.size(), 2U);
+  EXPECT_EQ(rows_[0]["count"], "1");
+  EXPECT_EQ(rows_[0]["first_time"], "100");
+  EXPECT_EQ(rows_[0]["last_time"], "100");
+  EXPECT_EQ(flows.size(), 0U);
+}
+
+TEST_F(SocketFlowsTests, test_window) {
+  FLAGS_socket_events_window = 10;
+  SocketFlowAggregator flows;
+  flows.add(getConnect("3"), 100, adder_);
+  flows.add(getConnect("4"), 101, adder_);
+  flows.add(getConnect("5"), 105, adder_);
+
+  // Another remote port is another flow.
+  auto other = getConnect("6");
+  other["remote_port"] = "80";
+  flows.add(other, 106, adder_);
+  EXPECT_EQ(flows.size(), 2U);
+
+  flows.expire(109, adder_);
+  EXPECT_TRUE(rows_.empty());
+
+  flows.expire(110, adder_);
+  ASSERT_EQ(rows_.size(), 1U);
+  EXPECT_EQ(rows_[0]["count"], "3");
+  EXPECT_EQ(rows_[0]["fd"], "3");
+  EXPECT_EQ(rows_[0]["first_time"], "100");
+  EXPECT_EQ(rows_[0]["last_time"], "105");
+  EXPECT_EQ(times_[0], 110U);
+
+  // A later event for the stored flow starts a new flow.
+  flows.add(getConnect("7"), 116, adder_);
+  ASSERT_EQ(rows_.size(), 2U);
+  EXPECT_EQ(rows_[1]["remote_port"], "80");
+  EXPECT_EQ(rows_[1]["count"], "1");
+  EXPECT_EQ(flows.size(), 1U);
+}
+}
@@ -47,13 +47,13 @@ Status UserEventSubscriber::init() {
 
 Status UserEventSubscriber::Callback(const ECRef& ec, const SCRef& sc) {
   Row r;
-  r["uid"] = ec->fields["uid"];
-  r["pid"] = ec->fields["pid"];
-  r["message"] = ec->fields["msg"];
+  r["uid"] = ec->fields.get("uid");
+  r["pid"] = ec->fields.get("pid");
+  r["message"] = ec->fields.get("msg");
   r["type"] = INTEGER(ec->type);
-  r["path"] = decodeAuditValue(ec->fields["exe"]);
-  r["address"] = ec->fields["addr"];
-  r["terminal"] = ec->fields["terminal"];
+  r["path"] = decodeAuditValue(ec->fields.get("exe"));
+  r["address"] = ec->fields.get("addr");
+  r["terminal"] = ec->fields.get("terminal");
   r["uptime"] = INTEGER(tables::getUptime());
 
   add(r, getUnixTime());
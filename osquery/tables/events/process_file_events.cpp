@@ -49,14 +49,12 @@ void ProcessFileEventSubscriber::configure() {
     for (const auto &file : files) {
       auto sc = createSubscriptionContext();
       sc->event_type = OSQUERY_FILE_EVENT;
-      osquery_file_event_subscription_t sub = {
-          .actions = (osquery_file_action_t)(
-              OSQUERY_FILE_ACTION_OPEN | OSQUERY_FILE_ACTION_CLOSE |
-              OSQUERY_FILE_ACTION_CLOSE_MODIFIED)};
       auto path = file;
       replaceGlobWildcards(path);
       path = path.substr(0, path.find("*"));
-      strncpy(sub.path, path.c_str(), MAXPATHLEN);
+      // Only events within the path prefix are copied from the kernel.
+      sc->filters.push_back(
+          createKernelFilter(OSQUERY_FILE_EVENT, OSQUERY_FILTER_INCLUDE, path));
       sc->category = category;
       VLOG(1) << "Added process file event listener to: " << path;
       subscribe(&ProcessFileEventSubscriber::Callback, sc);
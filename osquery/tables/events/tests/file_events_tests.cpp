@@ -8,6 +8,11 @@
  *
  */
 
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+
 #include <gtest/gtest.h>
 
 #include <boost/property_tree/json_parser.hpp>
@@ -25,6 +30,7 @@
 namespace osquery {
 
 DECLARE_bool(registry_exceptions);
+DECLARE_bool(file_events_hash_async);
 
 class FileEventSubscriber;
 
@@ -103,4 +109,48 @@ TEST_F(FileEventsTableTests, test_configure_subscriptions) {
   auto& row2 = results.rows()[0];
   EXPECT_EQ(row2.at("subscriptions"), "0");
 }
+
+TEST_F(FileEventsTableTests, test_async_hashing) {
+  auto path = kTestWorkingDirectory + "file-events-hashing";
+  {
+    std::ofstream out(path);
+    out << "osquery";
+  }
+
+  std::mutex mutex;
+  std::condition_variable condition;
+  std::vector<Row> added;
+  auto callback = [&mutex, &condition, &added](Row& row) {
+    std::lock_guard<std::mutex> lock(mutex);
+    added.push_back(row);
+    condition.notify_all();
+  };
+
+  // Rows that do not need hashing are completed immediately.
+  FLAGS_file_events_hash_async = true;
+  Row r;
+  r["target_path"] = path;
+  decorateFileEvent(path, false, r, callback);
+  ASSERT_EQ(added.size(), 1U);
+  EXPECT_EQ(added[0]["hashed"], "0");
+
+  // Hashed rows are completed by the hashing service, twice for the same file.
+  decorateFileEvent(path, true, r, callback);
+  decorateFileEvent(path, true, r, callback);
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    condition.wait_for(lock, std::chrono::seconds(5), [&added]() {
+      return added.size() == 3;
+    });
+  }
+  FLAGS_file_events_hash_async = false;
+
+  ASSERT_EQ(added.size(), 3U);
+  for (size_t i = 1; i < added.size(); i++) {
+    EXPECT_EQ(added[i]["hashed"], "1");
+    EXPECT_EQ(added[i]["md5"], "6f03171b2dc830e8a8a1337212417c74");
+    EXPECT_EQ(added[i]["target_path"], path);
+  }
+  EXPECT_EQ(added[1]["inode"], added[2]["inode"]);
+}
 }
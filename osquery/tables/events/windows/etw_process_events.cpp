@@ -0,0 +1,70 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <osquery/flags.h>
+#include <osquery/tables.h>
+
+#include "osquery/events/windows/etw.h"
+
+namespace osquery {
+
+FLAG(bool,
+     etw_image_loads,
+     false,
+     "Include image loads in etw_process_events (Windows)");
+
+class EtwProcessEventSubscriber : public EventSubscriber<EtwEventPublisher> {
+ public:
+  /// The process event subscriber declares process event type subscriptions.
+  Status init() override;
+
+  /// Process starts, stops, and image loads will fire.
+  Status Callback(const ECRef& ec, const SCRef& sc);
+};
+
+REGISTER(EtwProcessEventSubscriber, "event_subscriber", "etw_process_events");
+
+Status EtwProcessEventSubscriber::init() {
+  auto sc = createSubscriptionContext();
+  sc->types = {ETW_EVENT_PROCESS_START, ETW_EVENT_PROCESS_STOP};
+  if (FLAGS_etw_image_loads) {
+    // Every module mapped by every process is a load.
+    sc->types.insert(ETW_EVENT_IMAGE_LOAD);
+  }
+  subscribe(&EtwProcessEventSubscriber::Callback, sc);
+
+  return Status(0, "OK");
+}
+
+Status EtwProcessEventSubscriber::Callback(const ECRef& ec, const SCRef& sc) {
+  Row r;
+  if (ec->type == ETW_EVENT_PROCESS_START) {
+    r["action"] = "start";
+    r["parent"] = BIGINT(ec->parent);
+    r["exit_code"] = "";
+  } else if (ec->type == ETW_EVENT_PROCESS_STOP) {
+    r["action"] = "stop";
+    r["parent"] = "";
+    r["exit_code"] = BIGINT(ec->exit_code);
+  } else if (ec->type == ETW_EVENT_IMAGE_LOAD) {
+    r["action"] = "load";
+    r["parent"] = "";
+    r["exit_code"] = "";
+  } else {
+    return Status(0, "OK");
+  }
+
+  r["pid"] = BIGINT(ec->pid);
+  r["path"] = ec->path;
+  r["uptime"] = BIGINT(ec->uptime);
+  add(r, ec->time);
+  return Status(0, "OK");
+}
+}
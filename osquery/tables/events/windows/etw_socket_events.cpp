@@ -0,0 +1,81 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <map>
+#include <string>
+
+#include <winsock2.h>
+
+#include <osquery/tables.h>
+
+#include "osquery/events/windows/etw.h"
+
+namespace osquery {
+
+class EtwSocketEventSubscriber : public EventSubscriber<EtwEventPublisher> {
+ public:
+  /// The socket event subscriber declares TCP event type subscriptions.
+  Status init() override;
+
+  /// TCP connects and accepts will fire, process events track the paths.
+  Status Callback(const ECRef& ec, const SCRef& sc);
+
+ private:
+  /// The path of each process started while the subscriber runs.
+  std::map<unsigned long, std::string> paths_;
+};
+
+REGISTER(EtwSocketEventSubscriber, "event_subscriber", "etw_socket_events");
+
+Status EtwSocketEventSubscriber::init() {
+  auto sc = createSubscriptionContext();
+  sc->types = {ETW_EVENT_CONNECT,
+               ETW_EVENT_ACCEPT,
+               ETW_EVENT_PROCESS_START,
+               ETW_EVENT_PROCESS_STOP};
+  subscribe(&EtwSocketEventSubscriber::Callback, sc);
+
+  return Status(0, "OK");
+}
+
+Status EtwSocketEventSubscriber::Callback(const ECRef& ec, const SCRef& sc) {
+  if (ec->type == ETW_EVENT_PROCESS_START) {
+    paths_[ec->pid] = ec->path;
+    return Status(0, "OK");
+  } else if (ec->type == ETW_EVENT_PROCESS_STOP) {
+    paths_.erase(ec->pid);
+    return Status(0, "OK");
+  }
+
+  Row r;
+  if (ec->type == ETW_EVENT_CONNECT) {
+    r["action"] = "connect";
+  } else if (ec->type == ETW_EVENT_ACCEPT) {
+    r["action"] = "accept";
+  } else {
+    return Status(0, "OK");
+  }
+
+  // The provider only reports established connections.
+  r["success"] = "1";
+  r["pid"] = BIGINT(ec->pid);
+  auto path = paths_.find(ec->pid);
+  r["path"] = (path != paths_.end()) ? path->second : "";
+  r["family"] = INTEGER(ec->family);
+  r["protocol"] = INTEGER(IPPROTO_TCP);
+  r["local_address"] = ec->local_address;
+  r["remote_address"] = ec->remote_address;
+  r["local_port"] = INTEGER(ec->local_port);
+  r["remote_port"] = INTEGER(ec->remote_port);
+  r["uptime"] = BIGINT(ec->uptime);
+  add(r, ec->time);
+  return Status(0, "OK");
+}
+}
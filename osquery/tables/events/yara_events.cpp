@@ -8,10 +8,17 @@
  *
  */
 
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <map>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 
 #include <osquery/config.h>
+#include <osquery/dispatcher.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 
 /// The file change event publishers are slightly different in OS X and Linux.
@@ -29,6 +36,17 @@
 #include <yara.h>
 
 namespace osquery {
+
+FLAG(uint64,
+     yara_events_queue,
+     4096,
+     "Maximum changed files waiting for a yara_events scan");
+
+FLAG(uint64,
+     yara_events_cpu_limit,
+     50,
+     "Percent of time yara_events may spend scanning files, 0 for no limit");
+
 namespace tables {
 
 /// The file change event publishers are slightly different in OS X and Linux.
@@ -47,6 +65,77 @@ using FileSubscriptionContextRef = INotifySubscriptionContextRef;
   ((IN_CREATE) | (IN_CLOSE_WRITE) | (IN_MODIFY) | (IN_MOVED_TO))
 #endif
 
+/// A changed file waiting for a scan.
+struct YARAScanRequest {
+  std::string path;
+  std::string category;
+  std::string action;
+  size_t transaction_id{0};
+  EventTime time{0};
+};
+
+/// Receives each scanned file's row and event time.
+using YARAScanCallback = std::function<void(Row&, EventTime)>;
+
+/**
+ * @brief A service scanning changed files from a bounded queue.
+ *
+ * Changes to a file that is already queued, for the same category, are
+ * coalesced into one scan that keeps the first action and the latest event
+ * time. Files are scanned in the order they were first queued. After each
+ * scan the service rests so that scanning uses at most
+ * `--yara_events_cpu_limit` percent of its time.
+ */
+class YARAScanService : public InternalRunnable {
+ public:
+  explicit YARAScanService(YARAScanCallback callback)
+      : callback_(std::move(callback)) {}
+
+  /// Queue a changed file, false if the queue is full.
+  bool push(YARAScanRequest&& request);
+
+  /// The number of files waiting for a scan.
+  size_t depth() const;
+
+  /// The number of changes dropped because the queue was full.
+  size_t drops() const { return drops_; }
+
+ protected:
+  /// Scan queued files until interrupted.
+  void start() override;
+
+  /// Wake the service to stop.
+  void stop() override;
+
+  /// Scanning runs in the bulk thread class.
+  ThreadClass threadClass() const override { return THREAD_CLASS_BULK; }
+
+ private:
+  /// Scan one file with each signature group of its category.
+  void scan(const YARAScanRequest& request);
+
+ private:
+  YARAScanCallback callback_;
+
+  /// Keys of queued files, by path and category, in scan order.
+  std::deque<std::string> queue_;
+
+  /// Queued files by key.
+  std::unordered_map<std::string, YARAScanRequest> requests_;
+
+  /// Set when the service is stopping.
+  bool stopping_{false};
+
+  /// Protects the queue and stopping state.
+  mutable std::mutex mutex_;
+
+  /// Signaled when a file is queued or the service is stopping.
+  std::condition_variable condition_;
+
+  /// Count of changes dropped.
+  std::atomic<size_t> drops_{0};
+};
+
 /**
  * @brief Track YARA matches to files.
  */
@@ -59,6 +148,16 @@ class YARAEventSubscriber : public FileEventSubscriber {
 
   void configure() override;
 
+  /// Include the files waiting for a scan.
+  size_t queueDepth() const override;
+
+  /// Include the changes dropped by a full scan queue.
+  size_t queueDrops() const override;
+
+ private:
+  /// The scanning service, started when the first file is queued.
+  std::shared_ptr<YARAScanService> getScanService();
+
  private:
   /**
    * @brief This exports a single Callback for FSEventsEventPublisher events.
@@ -70,6 +169,12 @@ class YARAEventSubscriber : public FileEventSubscriber {
    */
   Status Callback(const FileEventContextRef& ec,
                   const FileSubscriptionContextRef& sc);
+
+ private:
+  std::shared_ptr<YARAScanService> service_{nullptr};
+
+  /// Protects starting the service.
+  mutable std::mutex service_mutex_;
 };
 
 /**
@@ -128,19 +233,91 @@ void YARAEventSubscriber::configure() {
   }
 }
 
-Status YARAEventSubscriber::Callback(const FileEventContextRef& ec,
-                                     const FileSubscriptionContextRef& sc) {
-  if (ec->action != "UPDATED" && ec->action != "CREATED") {
-    return Status(1, "Invalid action");
+bool YARAScanService::push(YARAScanRequest&& request) {
+  auto key = request.path + "\n" + request.category;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stopping_) {
+      return false;
+    }
+
+    auto queued = requests_.find(key);
+    if (queued != requests_.end()) {
+      queued->second.transaction_id = request.transaction_id;
+      queued->second.time = request.time;
+      return true;
+    }
+
+    if (queue_.size() >= FLAGS_yara_events_queue) {
+      drops_++;
+      return false;
+    }
+    requests_[key] = std::move(request);
+    queue_.push_back(std::move(key));
+  }
+  condition_.notify_one();
+  return true;
+}
+
+size_t YARAScanService::depth() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return queue_.size();
+}
+
+void YARAScanService::start() {
+  while (!interrupted()) {
+    YARAScanRequest request;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      condition_.wait(lock, [this]() { return stopping_ || !queue_.empty(); });
+      if (stopping_) {
+        break;
+      }
+      auto queued = requests_.find(queue_.front());
+      request = std::move(queued->second);
+      requests_.erase(queued);
+      queue_.pop_front();
+    }
+
+    auto scan_start = std::chrono::steady_clock::now();
+    scan(request);
+
+    auto limit = FLAGS_yara_events_cpu_limit;
+    if (limit > 0 && limit < 100) {
+      auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::steady_clock::now() - scan_start);
+      auto rest = elapsed * (100 - limit) / limit;
+      if (rest.count() > 0) {
+        pauseMilli(rest);
+      }
+    }
+  }
+
+  // YARA keeps per-thread state for each scanning thread.
+  yr_finalize_thread();
+}
+
+void YARAScanService::stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  condition_.notify_all();
+}
+
+void YARAScanService::scan(const YARAScanRequest& request) {
+  auto yaraParser = getYARAParser();
+  if (yaraParser == nullptr) {
+    return;
   }
 
   Row r;
-  r["action"] = ec->action;
-  r["target_path"] = ec->path;
-  r["category"] = sc->category;
+  r["action"] = request.action;
+  r["target_path"] = request.path;
+  r["category"] = request.category;
 
   // Only FSEvents transactions updates (inotify is a no-op).
-  r["transaction_id"] = INTEGER(ec->transaction_id);
+  r["transaction_id"] = INTEGER(request.transaction_id);
 
   // These are default values, to be updated in YARACallback.
   r["count"] = INTEGER(0);
@@ -148,47 +325,75 @@ Status YARAEventSubscriber::Callback(const FileEventContextRef& ec,
   r["strings"] = std::string("");
   r["tags"] = std::string("");
 
-  auto parser = Config::getParser("yara");
-  if (parser == nullptr || parser.get() == nullptr) {
-    return Status(1, "ConfigParser unknown.");
-  }
-
-  std::shared_ptr<YARAConfigParserPlugin> yaraParser;
-  try {
-    yaraParser = std::dynamic_pointer_cast<YARAConfigParserPlugin>(parser);
-  } catch (const std::bad_cast& e) {
-    return Status(1, "Error casting yara config parser plugin");
-  }
-  if (yaraParser == nullptr || yaraParser.get() == nullptr) {
-    return Status(1, "Yara parser unknown.");
-  }
-
-  auto rules = yaraParser->rules();
-
   // Use the category as a lookup into the yara file_paths. The value will be
   // a list of signature groups to scan with.
-  auto category = r.at("category");
-  const auto& yara_config = parser->getData();
+  const auto& yara_config = yaraParser->getData();
+  if (yara_config.count("file_paths") == 0) {
+    return;
+  }
   const auto& yara_paths = yara_config.get_child("file_paths");
-  const auto& sig_groups = yara_paths.find(category);
+  const auto& sig_groups = yara_paths.find(request.category);
+  if (sig_groups == yara_paths.not_found()) {
+    return;
+  }
+
   for (const auto& rule : sig_groups->second) {
     const std::string group = rule.second.data();
-    int result = yr_rules_scan_file(rules[group],
-                                    ec->path.c_str(),
-                                    SCAN_FLAGS_FAST_MODE,
-                                    YARACallback,
-                                    (void*)&r,
-                                    0);
-
-    if (result != ERROR_SUCCESS) {
-      return Status(1, "YARA error: " + std::to_string(result));
+    auto rules = yaraParser->getRules(group);
+    if (rules == nullptr) {
+      continue;
     }
+
+    auto status = scanYARAFile(rules.get(), request.path, r);
+    if (!status.ok()) {
+      VLOG(1) << "Cannot scan changed file: " << status.getMessage();
+      return;
+    }
+  }
+
+  if (r.at("matches").size() > 0) {
+    callback_(r, request.time);
+  }
+}
+
+std::shared_ptr<YARAScanService> YARAEventSubscriber::getScanService() {
+  std::lock_guard<std::mutex> lock(service_mutex_);
+  if (service_ == nullptr) {
+    service_ = std::make_shared<YARAScanService>(
+        [this](Row& r, EventTime time) { add(r, time); });
+    Dispatcher::addService(service_);
   }
+  return service_;
+}
+
+size_t YARAEventSubscriber::queueDepth() const {
+  std::lock_guard<std::mutex> lock(service_mutex_);
+  auto depth = FileEventSubscriber::queueDepth();
+  return (service_ != nullptr) ? depth + service_->depth() : depth;
+}
+
+size_t YARAEventSubscriber::queueDrops() const {
+  std::lock_guard<std::mutex> lock(service_mutex_);
+  auto drops = FileEventSubscriber::queueDrops();
+  return (service_ != nullptr) ? drops + service_->drops() : drops;
+}
 
-  if (ec->action != "" && r.at("matches").size() > 0) {
-    add(r, ec->time);
+Status YARAEventSubscriber::Callback(const FileEventContextRef& ec,
+                                     const FileSubscriptionContextRef& sc) {
+  if (ec->action != "UPDATED" && ec->action != "CREATED") {
+    return Status(1, "Invalid action");
   }
 
+  // Scanning is deferred, the publisher's thread only queues the file.
+  YARAScanRequest request;
+  request.path = ec->path;
+  request.category = sc->category;
+  request.action = ec->action;
+  request.transaction_id = ec->transaction_id;
+  request.time = ec->time;
+  if (!getScanService()->push(std::move(request))) {
+    VLOG(1) << "YARA scan queue is full, not scanning: " << ec->path;
+  }
   return Status(0, "OK");
 }
 }
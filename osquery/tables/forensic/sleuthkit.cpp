@@ -8,8 +8,17 @@
  *
  */
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <future>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <set>
+#include <thread>
+#include <unordered_set>
+#include <vector>
 
 #include <boost/noncopyable.hpp>
 #include <boost/filesystem.hpp>
@@ -17,6 +26,7 @@
 #include <tsk/libtsk.h>
 
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/hash.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
@@ -26,8 +36,25 @@
 namespace fs = boost::filesystem;
 
 namespace osquery {
+
+FLAG(uint64,
+     device_file_threads,
+     4,
+     "Number of partitions the device_file table walks in parallel");
+
+FLAG(uint64,
+     device_hash_threads,
+     4,
+     "Number of threads hashing inodes for the device_hash table");
+
 namespace tables {
 
+/// The most directory levels a device_file walk descends.
+const size_t kDeviceFileMaxDepth = 1024;
+
+/// The most walked rows waiting for a device_file cursor.
+const size_t kDeviceFileQueueSize = 1024;
+
 const std::map<TSK_FS_META_TYPE_ENUM, std::string> kTSKTypeNames{
     {TSK_FS_META_TYPE_REG, "regular"},   {TSK_FS_META_TYPE_DIR, "directory"},
     {TSK_FS_META_TYPE_LNK, "symlink"},   {TSK_FS_META_TYPE_BLK, "block"},
@@ -63,30 +90,33 @@ class DeviceHelper : private boost::noncopyable {
       std::function<void(const std::string&, TskFsFile*, const std::string&)>
           predicate);
 
-  /// Provide a partition description for context and iterate from path.
-  void generateFiles(const std::string& partition,
-                     TskFsInfo* fs,
-                     const std::string& path,
-                     QueryData& results,
-                     TSK_INUM_T inode = 0);
+  /// Open the filesystem of a partition by address, nullptr if it fails.
+  std::unique_ptr<TskFsInfo> openPartition(const std::string& address);
+
+  /// Fill in a row for a file within a partition.
+  void generateFile(const std::string& partition,
+                    TskFsFile* file,
+                    TskFsInfo* fs,
+                    const std::string& path,
+                    Row& r);
 
-  /// Similar to generateFiles but only yield a row to results.
+  /// Similar to generateFile but yield the row to results.
   void generateFile(const std::string& partition,
                     TskFsFile* file,
                     TskFsInfo* fs,
                     const std::string& path,
-                    QueryData& results);
+                    QueryData& results) {
+    Row r;
+    generateFile(partition, file, fs, path, r);
+    results.push_back(std::move(r));
+  }
+
+  /// The device node path.
+  const std::string& getDevicePath() const { return device_path_; }
 
   /// Volume accessor, used for computing offsets using block/sector size.
   const std::shared_ptr<TskVsInfo>& getVolume() { return volume_; }
 
-  /// Reset stack counting for directory iteration.
-  void resetStack() {
-    stack_ = 0;
-    count_ = 0;
-    std::set<std::string>().swap(loops_);
-  }
-
  private:
   /// Attempt to open the provided device image and volume.
   bool open();
@@ -106,10 +136,6 @@ class DeviceHelper : private boost::noncopyable {
 
   /// Filesystem path to the device node.
   std::string device_path_;
-
-  size_t stack_{0};
-  size_t count_{0};
-  std::set<std::string> loops_;
 };
 
 bool DeviceHelper::open() {
@@ -159,15 +185,32 @@ void DeviceHelper::inodes(
   }
 }
 
+std::unique_ptr<TskFsInfo> DeviceHelper::openPartition(
+    const std::string& address) {
+  std::unique_ptr<TskFsInfo> fs;
+  partitions(([&fs, &address](const TskVsPartInfo* part) {
+    if (fs != nullptr || std::to_string(part->getAddr()) != address) {
+      return;
+    }
+
+    fs.reset(new TskFsInfo());
+    // Cannot retrieve file information without accessing the filesystem.
+    if (fs->open(part, TSK_FS_TYPE_DETECT)) {
+      fs.reset();
+    }
+  }));
+  return fs;
+}
+
 void DeviceHelper::generateFile(const std::string& partition,
                                 TskFsFile* file,
                                 TskFsInfo* fs,
                                 const std::string& path,
-                                QueryData& results) {
-  Row r;
+                                Row& r) {
   r["device"] = device_path_;
   r["partition"] = partition;
   r["path"] = path;
+  r["directory"] = fs::path(path).parent_path().string();
   r["filename"] = fs::path(path).leaf().string();
 
   if (fs != nullptr) {
@@ -192,121 +235,255 @@ void DeviceHelper::generateFile(const std::string& partition,
     }
     delete meta;
   }
-  results.push_back(r);
 }
 
-void DeviceHelper::generateFiles(const std::string& partition,
-                                 TskFsInfo* fs,
-                                 const std::string& path,
-                                 QueryData& results,
-                                 TSK_INUM_T inode) {
-  if (stack_++ > 1024) {
-    return;
+/// A directory to walk within a partition.
+struct DeviceWalkRoot {
+  std::string directory;
+
+  /// Descend into subdirectories.
+  bool recursive;
+
+  /// Only files, and directories that may contain files, with this prefix.
+  std::string prefix;
+};
+
+/**
+ * @brief A resumable walk of the regular files below directories.
+ *
+ * Entries are typed from their directory listing, an inode is only read for
+ * a file that is generated, or when the filesystem does not type its names.
+ * Directories that cannot contain a file with the root's prefix are not
+ * opened. Each directory level and the file structure are reused.
+ */
+class DeviceFileWalker : private boost::noncopyable {
+ public:
+  DeviceFileWalker(DeviceHelper& dh,
+                   TskFsInfo* fs,
+                   const std::string& partition,
+                   std::vector<DeviceWalkRoot> roots)
+      : dh_(dh), fs_(fs), partition_(partition), roots_(std::move(roots)) {}
+
+  /// Generate the next file's row, false when the walk is complete.
+  bool next(Row& r);
+
+ private:
+  /// Open a directory as the next level, by path or by inode.
+  bool push(const std::string& path, TSK_INUM_T inode);
+
+  /// True if a path below the root may have the root's prefix.
+  bool mayContain(const std::string& directory) const;
+
+ private:
+  /// An open directory and the next entry to read.
+  struct Level {
+    TskFsDir dir;
+    std::string path;
+    size_t index{0};
+  };
+
+  DeviceHelper& dh_;
+  TskFsInfo* fs_{nullptr};
+  std::string partition_;
+
+  std::vector<DeviceWalkRoot> roots_;
+
+  /// The next root to walk, the current root is the one before.
+  size_t root_{0};
+
+  /// Directory levels, reused as the walk descends.
+  std::vector<std::unique_ptr<Level>> levels_;
+
+  /// The number of open levels.
+  size_t depth_{0};
+
+  /// Reused to read the inode of each file.
+  TskFsFile file_;
+
+  /// Directory inodes already walked, a link cannot cause a loop.
+  std::unordered_set<TSK_INUM_T> visited_;
+};
+
+bool DeviceFileWalker::push(const std::string& path, TSK_INUM_T inode) {
+  if (depth_ >= kDeviceFileMaxDepth) {
+    return false;
   }
 
-  auto* dir = new TskFsDir();
-  if (dir->open(fs, ((inode == 0) ? fs->getRootINum() : inode))) {
-    delete dir;
-    return;
+  if (levels_.size() <= depth_) {
+    levels_.emplace_back(new Level());
+  }
+  auto& level = *levels_[depth_];
+  level.dir.close();
+  auto status = (inode != 0) ? level.dir.open(fs_, inode)
+                             : level.dir.open(fs_, path.c_str());
+  if (status) {
+    return false;
   }
 
-  // Iterate through the directory.
-  std::map<TSK_INUM_T, std::string> additional;
-  for (size_t i = 0; i < dir->getSize(); i++) {
-    if (count_++ > 1024 * 10) {
-      break;
+  level.path = path;
+  level.index = 0;
+  depth_++;
+  return true;
+}
+
+bool DeviceFileWalker::mayContain(const std::string& directory) const {
+  const auto& prefix = roots_[root_ - 1].prefix;
+  auto length = std::min(prefix.size(), directory.size() + 1);
+  return (directory + "/").compare(0, length, prefix, 0, length) == 0;
+}
+
+bool DeviceFileWalker::next(Row& r) {
+  while (true) {
+    if (depth_ == 0) {
+      if (root_ >= roots_.size()) {
+        return false;
+      }
+
+      const auto& root = roots_[root_++];
+      auto inode = (root.directory == "/") ? fs_->getRootINum() : 0;
+      if (push(root.directory, inode)) {
+        visited_.insert(levels_[0]->dir.getMetaAddr());
+      }
+      continue;
     }
 
-    auto* file = dir->getFile(i);
-    if (file == nullptr) {
+    auto& level = *levels_[depth_ - 1];
+    if (level.index >= level.dir.getSize()) {
+      level.dir.close();
+      depth_--;
       continue;
     }
 
-    // Failure to access the file's metadata information.
-    auto* meta = file->getMeta();
-    if (meta == nullptr) {
-      delete file;
+    std::unique_ptr<const TskFsName> name(level.dir.getName(level.index++));
+    if (name == nullptr || name->getName() == nullptr ||
+        TSK_FS_ISDOT(name->getName())) {
       continue;
     }
 
-    std::string leaf;
-    auto* name = file->getName();
-    if (name != nullptr) {
-      leaf = (fs::path(path) / name->getName()).string();
+    auto path = level.path;
+    if (path.empty() || path.back() != '/') {
+      path += '/';
     }
+    path += name->getName();
+
+    const auto& root = roots_[root_ - 1];
+    auto type = name->getType();
+    if (type == TSK_FS_NAME_TYPE_UNDEF || type == TSK_FS_NAME_TYPE_REG) {
+      if (path.compare(0, root.prefix.size(), root.prefix) != 0 ||
+          file_.open(fs_, &file_, name->getMetaAddr())) {
+        continue;
+      }
 
-    if (meta->getType() == TSK_FS_META_TYPE_REG) {
-      generateFile(partition, file, fs, leaf, results);
-    } else if (meta->getType() == TSK_FS_META_TYPE_DIR) {
-      if (name != nullptr && !TSK_FS_ISDOT(name->getName())) {
-        additional[meta->getAddr()] = leaf;
+      std::unique_ptr<TskFsMeta> meta(file_.getMeta());
+      if (meta == nullptr) {
+        continue;
       }
-    }
 
-    if (name != nullptr) {
-      delete name;
+      if (meta->getType() == TSK_FS_META_TYPE_REG) {
+        dh_.generateFile(partition_, &file_, fs_, path, r);
+        return true;
+      }
+      if (meta->getType() != TSK_FS_META_TYPE_DIR) {
+        continue;
+      }
+    } else if (type != TSK_FS_NAME_TYPE_DIR) {
+      continue;
     }
-    delete meta;
-    delete file;
-  }
-  delete dir;
 
-  // If we are recursing.
-  for (const auto& dir : additional) {
-    if (std::find(loops_.begin(), loops_.end(), dir.second) == loops_.end()) {
-      generateFiles(partition, fs, dir.second, results, dir.first);
-      loops_.insert(dir.second);
+    // The entry is a directory.
+    if (root.recursive && mayContain(path) &&
+        visited_.count(name->getMetaAddr()) == 0) {
+      visited_.insert(name->getMetaAddr());
+      push(path, name->getMetaAddr());
     }
   }
 }
 
-MultiHashes hashInode(TskFsFile* file) {
-  Hash md5(HASH_TYPE_MD5);
-  Hash sha1(HASH_TYPE_SHA1);
-  Hash sha256(HASH_TYPE_SHA256);
+/// The bytes read from an inode at a time while hashing.
+const size_t kDeviceHashReadSize = 1024 * 1024;
 
+/**
+ * @brief Hash the content of an inode with the requested digests.
+ *
+ * The next part of the content is read on another thread while the current
+ * part is hashed, reading from the device overlaps hashing.
+ */
+MultiHashes hashInode(TskFsFile* file, int mask) {
   // We are guaranteed by the expected callsite to have a valid meta.
-  auto* meta = file->getMeta();
+  std::unique_ptr<TskFsMeta> meta(file->getMeta());
   if (meta == nullptr) {
     return MultiHashes();
   }
 
-  // Set a maximum 'chunk' or block size to 1 page or the file size.
+  // Set a maximum 'chunk' or block size to the read size or the file size.
   TSK_OFF_T size = meta->getSize();
   if (size == 0) {
     return MultiHashes();
   }
 
-  // Allocate some heap memory and iterate over reading a chunk and updating.
-  auto buffer_size = (size < 4096) ? size : 4096;
-  auto* buffer = (char*)malloc(buffer_size * sizeof(char));
-  if (buffer != nullptr) {
-    ssize_t chunk_size = 0;
-    for (ssize_t offset = 0; offset < size; offset += chunk_size) {
-      // Here max represents the local max requested bytes.
-      auto max = (size - offset < buffer_size) ? (size - offset) : buffer_size;
-      chunk_size =
-          file->read(offset, buffer, max, (TSK_FS_FILE_READ_FLAG_ENUM)0U);
-      if (chunk_size == -1 || chunk_size != max) {
-        // Huge problem, either a read failed or didn't read the max size.
-        free(buffer);
-        delete meta;
-        return MultiHashes();
-      }
+  std::unique_ptr<Hash> md5;
+  std::unique_ptr<Hash> sha1;
+  std::unique_ptr<Hash> sha256;
+  if (mask & HASH_TYPE_MD5) {
+    md5.reset(new Hash(HASH_TYPE_MD5));
+  }
+  if (mask & HASH_TYPE_SHA1) {
+    sha1.reset(new Hash(HASH_TYPE_SHA1));
+  }
+  if (mask & HASH_TYPE_SHA256) {
+    sha256.reset(new Hash(HASH_TYPE_SHA256));
+  }
 
-      md5.update(buffer, chunk_size);
-      sha1.update(buffer, chunk_size);
-      sha256.update(buffer, chunk_size);
+  auto buffer_size = std::min<TSK_OFF_T>(size, kDeviceHashReadSize);
+  std::vector<char> current(static_cast<size_t>(buffer_size));
+  std::vector<char> ahead(static_cast<size_t>(buffer_size));
+  auto read = ([file, size](TSK_OFF_T offset,
+                            std::vector<char>& buffer) -> ssize_t {
+    // Here max represents the local max requested bytes.
+    auto max = std::min<TSK_OFF_T>(size - offset, buffer.size());
+    auto chunk_size = file->read(
+        offset, buffer.data(), max, (TSK_FS_FILE_READ_FLAG_ENUM)0U);
+    // Either a read failed or didn't read the max size.
+    return (chunk_size == max) ? chunk_size : -1;
+  });
+
+  TSK_OFF_T offset = 0;
+  auto chunk_size = read(offset, current);
+  while (chunk_size > 0) {
+    std::future<ssize_t> next;
+    auto next_offset = offset + chunk_size;
+    if (next_offset < size) {
+      next = std::async(std::launch::async, read, next_offset, std::ref(ahead));
     }
-    free(buffer);
+
+    if (md5 != nullptr) {
+      md5->update(current.data(), chunk_size);
+    }
+    if (sha1 != nullptr) {
+      sha1->update(current.data(), chunk_size);
+    }
+    if (sha256 != nullptr) {
+      sha256->update(current.data(), chunk_size);
+    }
+
+    if (!next.valid()) {
+      break;
+    }
+    chunk_size = next.get();
+    current.swap(ahead);
+    offset = next_offset;
+  }
+
+  if (chunk_size < 0) {
+    return MultiHashes();
   }
-  delete meta;
 
   // Convert the set of hashes into a device hashes transport.
   MultiHashes dhs;
-  dhs.md5 = md5.digest();
-  dhs.sha1 = sha1.digest();
-  dhs.sha256 = sha256.digest();
+  dhs.mask = mask;
+  dhs.md5 = (md5 != nullptr) ? md5->digest() : "";
+  dhs.sha1 = (sha1 != nullptr) ? sha1->digest() : "";
+  dhs.sha256 = (sha256 != nullptr) ? sha256->digest() : "";
   return dhs;
 }
 
@@ -317,79 +494,310 @@ QueryData genDeviceHash(QueryContext& context) {
   // This table requires three columns to determine an action.
   auto parts = context.constraints["partition"].getAll(EQUALS);
   auto inodes = context.constraints["inode"].getAll(EQUALS);
+  if (parts.empty() || inodes.empty()) {
+    return results;
+  }
+
+  // Only compute the selected digests.
+  int mask = 0;
+  mask |= context.isColumnUsed("md5") ? HASH_TYPE_MD5 : 0;
+  mask |= context.isColumnUsed("sha1") ? HASH_TYPE_SHA1 : 0;
+  mask |= context.isColumnUsed("sha256") ? HASH_TYPE_SHA256 : 0;
 
+  // The table also requires a partition for searching.
+  const auto& address = *parts.begin();
+  std::vector<std::string> inode_list(inodes.begin(), inodes.end());
   for (const auto& dev : devices) {
-    // For each require device path, open a device helper that checks the
-    // image, checks the volume, and allows partition iteration.
-    DeviceHelper dh(dev);
-    dh.partitions(([&results, &dev, &dh, &parts, &inodes](
-        const TskVsPartInfo* part) {
-      // The table also requires a partition for searching.
-      auto address = std::to_string(part->getAddr());
-      if (address != *parts.begin()) {
-        // If this partition does not match the requested, continue.
+    // Each thread opens the device, checks the image and volume, and opens
+    // the partition, then hashes inodes from a shared cursor.
+    std::vector<Row> rows(inode_list.size());
+    std::atomic<size_t> cursor(0);
+    auto hasher = ([&]() {
+      DeviceHelper dh(dev);
+      auto fs = dh.openPartition(address);
+      if (fs == nullptr) {
         return;
       }
 
-      auto* fs = new TskFsInfo();
-      auto status = fs->open(part, TSK_FS_TYPE_DETECT);
-      // Cannot retrieve file information without accessing the filesystem.
-      if (status) {
-        delete fs;
-        return;
+      TskFsFile file;
+      while (true) {
+        auto index = cursor.fetch_add(1);
+        if (index >= inode_list.size()) {
+          break;
+        }
+
+        long int meta = 0;
+        safeStrtol(inode_list[index], 10, meta);
+        if (file.open(fs.get(), &file, static_cast<TSK_INUM_T>(meta)) != 0) {
+          continue;
+        }
+
+        auto& r = rows[index];
+        r["device"] = dev;
+        r["partition"] = address;
+        r["inode"] = inode_list[index];
+
+        auto hashes = hashInode(&file, mask);
+        r["md5"] = std::move(hashes.md5);
+        r["sha1"] = std::move(hashes.sha1);
+        r["sha256"] = std::move(hashes.sha256);
       }
+    });
 
-      dh.inodes(inodes,
-                fs,
-                ([&results, &address, &dev, &dh, &fs](const std::string& inode,
-                                                      TskFsFile* file,
-                                                      const std::string& path) {
-                  Row r;
-                  r["device"] = dev;
-                  r["partition"] = address;
-                  r["inode"] = inode;
-
-                  auto hashes = hashInode(file);
-                  r["md5"] = std::move(hashes.md5);
-                  r["sha1"] = std::move(hashes.sha1);
-                  r["sha256"] = std::move(hashes.sha256);
-                  results.push_back(r);
-                }));
-      delete fs;
-    }));
+    auto threads =
+        std::min<size_t>(FLAGS_device_hash_threads, inode_list.size());
+    std::vector<std::thread> hashers;
+    for (size_t i = 1; i < threads; i++) {
+      hashers.emplace_back(hasher);
+    }
+    hasher();
+    for (auto& thread : hashers) {
+      thread.join();
+    }
+
+    for (auto& r : rows) {
+      if (!r.empty()) {
+        results.push_back(std::move(r));
+      }
+    }
   }
 
   return results;
 }
 
-QueryData genDeviceFile(QueryContext& context) {
+/// The literal start of a LIKE pattern.
+static std::string getLikePrefix(const std::string& pattern) {
+  return pattern.substr(0, pattern.find_first_of("%_"));
+}
+
+/// Walk the directory of a pattern's literal start, or a directory.
+static DeviceWalkRoot getWalkRoot(const std::string& prefix, bool recursive) {
+  DeviceWalkRoot root;
+  root.recursive = recursive;
+  if (recursive) {
+    root.prefix = prefix;
+    root.directory = prefix.substr(0, prefix.rfind('/') + 1);
+  } else {
+    root.directory = prefix;
+  }
+
+  while (root.directory.size() > 1 && root.directory.back() == '/') {
+    root.directory.pop_back();
+  }
+  if (root.directory.empty()) {
+    root.directory = "/";
+  }
+  return root;
+}
+
+/// Walk the files of a partition, using a device helper of its own.
+class DevicePartitionWalk : private boost::noncopyable {
+ public:
+  DevicePartitionWalk(const std::string& device,
+                      const std::string& partition,
+                      const std::vector<DeviceWalkRoot>& roots)
+      : dh_(device), partition_(partition), roots_(roots) {}
+
+  /// Generate the next file's row, opening the partition on first use.
+  bool next(Row& r) {
+    if (walker_ == nullptr) {
+      fs_ = dh_.openPartition(partition_);
+      if (fs_ == nullptr) {
+        return false;
+      }
+      walker_.reset(new DeviceFileWalker(dh_, fs_.get(), partition_, roots_));
+    }
+    return walker_->next(r);
+  }
+
+ private:
+  DeviceHelper dh_;
+  std::string partition_;
+  std::vector<DeviceWalkRoot> roots_;
+  std::unique_ptr<TskFsInfo> fs_;
+  std::unique_ptr<DeviceFileWalker> walker_;
+};
+
+/**
+ * @brief Stream the device_file rows of each requested partition.
+ *
+ * Rows for path and inode constraints are generated first, then partitions
+ * are walked as rows are pulled. With more than one partition, up to
+ * `--device_file_threads` partitions are walked concurrently into a bounded
+ * queue; a walker waits while the queue is full.
+ */
+class DeviceFileGenerator : public RowGenerator {
+ public:
+  DeviceFileGenerator(QueryData rows,
+                      std::vector<std::unique_ptr<DevicePartitionWalk>> walks)
+      : rows_(std::move(rows)), walks_(std::move(walks)) {
+    threads_count_ =
+        std::min<size_t>(FLAGS_device_file_threads, walks_.size());
+  }
+
+  ~DeviceFileGenerator() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    not_full_.notify_all();
+    for (auto& thread : threads_) {
+      thread.join();
+    }
+  }
+
+  bool next(Row& r) override;
+
+ private:
+  /// Walk partitions from the shared cursor into the queue.
+  void walk();
+
+ private:
+  /// Rows generated before walking.
+  QueryData rows_;
+  size_t row_{0};
+
+  std::vector<std::unique_ptr<DevicePartitionWalk>> walks_;
+
+  /// The number of concurrent walkers, 1 to walk as rows are pulled.
+  size_t threads_count_{1};
+
+  /// The next partition to walk.
+  std::atomic<size_t> cursor_{0};
+
+  /// Walked rows, when partitions are walked concurrently.
+  std::deque<Row> queue_;
+
+  /// The number of walking threads that have not finished.
+  size_t walking_{0};
+
+  /// Set when the cursor is closed, walkers stop.
+  bool stopping_{false};
+
+  std::mutex mutex_;
+  std::condition_variable not_empty_;
+  std::condition_variable not_full_;
+  std::vector<std::thread> threads_;
+};
+
+void DeviceFileGenerator::walk() {
+  while (true) {
+    auto index = cursor_.fetch_add(1);
+    if (index >= walks_.size()) {
+      break;
+    }
+
+    Row r;
+    while (walks_[index]->next(r)) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      not_full_.wait(lock, [this]() {
+        return stopping_ || queue_.size() < kDeviceFileQueueSize;
+      });
+      if (stopping_) {
+        return;
+      }
+      queue_.push_back(std::move(r));
+      not_empty_.notify_one();
+      r.clear();
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  walking_--;
+  not_empty_.notify_one();
+}
+
+bool DeviceFileGenerator::next(Row& r) {
+  if (row_ < rows_.size()) {
+    r = std::move(rows_[row_++]);
+    return true;
+  }
+
+  if (threads_count_ <= 1) {
+    // A single partition is walked as rows are pulled.
+    while (cursor_ < walks_.size()) {
+      if (walks_[cursor_]->next(r)) {
+        return true;
+      }
+      walks_[cursor_++].reset();
+    }
+    return false;
+  }
+
+  if (threads_.empty()) {
+    walking_ = threads_count_;
+    for (size_t i = 0; i < threads_count_; i++) {
+      threads_.emplace_back([this]() { walk(); });
+    }
+  }
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  not_empty_.wait(lock, [this]() { return !queue_.empty() || walking_ == 0; });
+  if (queue_.empty()) {
+    return false;
+  }
+  r = std::move(queue_.front());
+  queue_.pop_front();
+  not_full_.notify_one();
+  return true;
+}
+
+RowGeneratorRef genDeviceFile(QueryContext& context) {
   QueryData results;
 
   auto devices = context.constraints["device"].getAll(EQUALS);
   // This table requires two or more columns to determine an action.
   auto parts = context.constraints["partition"].getAll(EQUALS);
-  // Additionally, paths or inodes can be used to search.
+  // Additionally, paths, directories, or inodes can be used to search.
   auto paths = context.constraints["path"].getAll(EQUALS);
+  auto path_patterns = context.constraints["path"].getAll(LIKE);
+  auto directories = context.constraints["directory"].getAll(EQUALS);
+  auto directory_patterns = context.constraints["directory"].getAll(LIKE);
   auto inodes = context.constraints["inode"].getAll(EQUALS);
 
-  if (devices.empty() || parts.size() != 1) {
-    TLOG << "Device files require at least one device and a single partition";
-    return {};
+  if (devices.empty() || parts.empty()) {
+    TLOG << "Device files require at least one device and a partition";
+    return nullptr;
+  }
+
+  // Walks are limited to the directories that may contain a match.
+  std::vector<DeviceWalkRoot> roots;
+  for (const auto& directory : directories) {
+    roots.push_back(getWalkRoot(directory, false));
+  }
+  for (const auto& pattern : path_patterns) {
+    roots.push_back(getWalkRoot(getLikePrefix(pattern), true));
+  }
+  for (const auto& pattern : directory_patterns) {
+    roots.push_back(getWalkRoot(getLikePrefix(pattern), true));
+  }
+
+  // If no inodes or paths were provided as constraints assume a walk of
+  // the partition was requested.
+  if (roots.empty() && inodes.empty() && paths.empty()) {
+    roots.push_back(getWalkRoot("/", true));
   }
 
+  std::vector<std::unique_ptr<DevicePartitionWalk>> walks;
   for (const auto& dev : devices) {
     // For each require device path, open a device helper that checks the
     // image, checks the volume, and allows partition iteration.
     DeviceHelper dh(dev);
-    dh.partitions(([&results, &dev, &dh, &parts, &inodes, &paths](
-        const TskVsPartInfo* part) {
+    dh.partitions(([&](const TskVsPartInfo* part) {
       // The table also requires a partition for searching.
       auto address = std::to_string(part->getAddr());
-      if (address != *parts.begin()) {
+      if (parts.count(address) == 0) {
         // If this partition does not match the requested, continue.
         return;
       }
 
+      if (!roots.empty()) {
+        walks.emplace_back(new DevicePartitionWalk(dev, address, roots));
+      }
+      if (paths.empty() && inodes.empty()) {
+        return;
+      }
+
       auto* fs = new TskFsInfo();
       auto status = fs->open(part, TSK_FS_TYPE_DETECT);
       // Cannot retrieve file information without accessing the filesystem.
@@ -398,20 +806,12 @@ QueryData genDeviceFile(QueryContext& context) {
         return;
       }
 
-      // If no inodes or paths were provided as constraints assume a walk of
-      // the partition was requested.
-      if (inodes.empty() && paths.empty()) {
-        dh.generateFiles(address, fs, "/", results);
-        dh.resetStack();
-      }
-
       // For each path the canonical name must be mapped to an inode address.
+      TskFsFile file;
       for (const auto& path : paths) {
-        auto* file = new TskFsFile();
-        if (file->open(fs, file, path.c_str()) == 0) {
-          dh.generateFile(address, file, fs, path, results);
+        if (file.open(fs, &file, path.c_str()) == 0) {
+          dh.generateFile(address, &file, fs, path, results);
         }
-        delete file;
       }
 
       dh.inodes(inodes,
@@ -425,7 +825,8 @@ QueryData genDeviceFile(QueryContext& context) {
     }));
   }
 
-  return results;
+  return RowGeneratorRef(
+      new DeviceFileGenerator(std::move(results), std::move(walks)));
 }
 
 QueryData genDevicePartitions(QueryContext& context) {
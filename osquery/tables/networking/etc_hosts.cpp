@@ -11,15 +11,13 @@
 #include <vector>
 #include <string>
 
-#include <boost/algorithm/string/join.hpp>
-#include <boost/algorithm/string/predicate.hpp>
-
 #include <osquery/core.h>
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/tables/system/file_rows_cache.h"
 
 namespace osquery {
 namespace tables {
@@ -27,37 +25,48 @@ namespace tables {
 QueryData parseEtcHostsContent(const std::string& content) {
   QueryData results;
 
-  for (const auto& i : osquery::split(content, "\n")) {
-    auto line = split(i);
-    if (line.size() == 0 || boost::starts_with(line[0], "#")) {
+  Tokenizer lines(content, "\n");
+  boost::string_ref i;
+  std::vector<boost::string_ref> line;
+  std::vector<boost::string_ref> hostnames;
+  while (lines.next(i)) {
+    tokenize(i, "\t ", line);
+    if (line.size() == 0 || line[0].starts_with("#")) {
       continue;
     }
     Row r;
-    r["address"] = line[0];
+    r["address"] = line[0].to_string();
     if (line.size() > 1) {
-      std::vector<std::string> hostnames;
+      hostnames.clear();
       for (size_t i = 1; i < line.size(); ++i) {
-        if (boost::starts_with(line[i], "#")) {
+        if (line[i].starts_with("#")) {
           break;
         }
         hostnames.push_back(line[i]);
       }
-      r["hostnames"] = boost::algorithm::join(hostnames, " ");
+      r["hostnames"] = osquery::join(hostnames, " ");
     }
-    results.push_back(r);
+    results.push_back(std::move(r));
   }
 
   return results;
 }
 
 QueryData genEtcHosts(QueryContext& context) {
-  std::string content;
-  auto s = readFile("/etc/hosts", content);
-  if (s.ok()) {
-    return parseEtcHostsContent(content);
-  } else {
-    return {};
-  }
+  static FileRowsCache kHostsCache;
+
+  QueryData results;
+  kHostsCache.get("/etc/hosts",
+                  [](const std::string& path, QueryData& rows) {
+                    std::string content;
+                    auto s = readFile(path, content);
+                    if (s.ok()) {
+                      rows = parseEtcHostsContent(content);
+                    }
+                    return s;
+                  },
+                  results);
+  return results;
 }
 }
 }
@@ -11,15 +11,13 @@
 #include <vector>
 #include <string>
 
-#include <boost/algorithm/string/join.hpp>
-#include <boost/algorithm/string/predicate.hpp>
-
 #include <osquery/core.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 #include <osquery/filesystem.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/tables/system/file_rows_cache.h"
 
 namespace osquery {
 namespace tables {
@@ -27,9 +25,13 @@ namespace tables {
 QueryData parseEtcProtocolsContent(const std::string& content) {
   QueryData results;
 
-  for (const auto& line : osquery::split(content, "\n")) {
+  Tokenizer lines(content, "\n");
+  boost::string_ref line;
+  std::vector<boost::string_ref> protocol_comment;
+  std::vector<boost::string_ref> protocol_fields;
+  while (lines.next(line)) {
     // Empty line or comment.
-    if (line.size() == 0 || boost::starts_with(line, "#")) {
+    if (line.size() == 0 || line.starts_with("#")) {
       continue;
     }
 
@@ -37,21 +39,21 @@ QueryData parseEtcProtocolsContent(const std::string& content) {
     // [1]: [comment part1]
     // [2]: [comment part2]
     // [n]: [comment partn]
-    auto protocol_comment = osquery::split(line, "#");
+    tokenize(line, "#", protocol_comment);
 
     // [0]: name
     // [1]: protocol_number
     // [2]: alias
-    auto protocol_fields = osquery::split(protocol_comment[0]);
+    tokenize(protocol_comment[0], "\t ", protocol_fields);
     if (protocol_fields.size() < 2) {
       continue;
     }
 
     Row r;
-    r["name"] = TEXT(protocol_fields[0]);
-    r["number"] = INTEGER(protocol_fields[1]);
+    r["name"] = protocol_fields[0].to_string();
+    r["number"] = protocol_fields[1].to_string();
     if (protocol_fields.size() > 2) {
-      r["alias"] = TEXT(protocol_fields[2]);
+      r["alias"] = protocol_fields[2].to_string();
     }
 
     // If there is a comment for the service.
@@ -59,22 +61,31 @@ QueryData parseEtcProtocolsContent(const std::string& content) {
       // Removes everything except the comment (parts of the comment).
       protocol_comment.erase(protocol_comment.begin(),
                              protocol_comment.begin() + 1);
-      r["comment"] = TEXT(boost::algorithm::join(protocol_comment, " # "));
+      r["comment"] = osquery::join(protocol_comment, " # ");
     }
-    results.push_back(r);
+    results.push_back(std::move(r));
   }
   return results;
 }
 
 QueryData genEtcProtocols(QueryContext& context) {
-  std::string content;
-  auto s = readFile("/etc/protocols", content);
-  if (s.ok()) {
-    return parseEtcProtocolsContent(content);
-  } else {
+  static FileRowsCache kProtocolsCache;
+
+  QueryData results;
+  auto s = kProtocolsCache.get("/etc/protocols",
+                               [](const std::string& path, QueryData& rows) {
+                                 std::string content;
+                                 auto s = readFile(path, content);
+                                 if (s.ok()) {
+                                   rows = parseEtcProtocolsContent(content);
+                                 }
+                                 return s;
+                               },
+                               results);
+  if (!s.ok()) {
     TLOG << "Error reading /etc/protocols: " << s.toString();
-    return {};
   }
+  return results;
 }
 }
 }
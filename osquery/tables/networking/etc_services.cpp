@@ -11,15 +11,13 @@
 #include <vector>
 #include <string>
 
-#include <boost/algorithm/string/join.hpp>
-#include <boost/algorithm/string/predicate.hpp>
-
 #include <osquery/core.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 #include <osquery/filesystem.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/tables/system/file_rows_cache.h"
 
 namespace osquery {
 namespace tables {
@@ -27,9 +25,14 @@ namespace tables {
 QueryData parseEtcServicesContent(const std::string& content) {
   QueryData results;
 
-  for (const auto& line : osquery::split(content, "\n")) {
+  Tokenizer lines(content, "\n");
+  boost::string_ref line;
+  std::vector<boost::string_ref> service_info_comment;
+  std::vector<boost::string_ref> service_info;
+  std::vector<boost::string_ref> service_port_protocol;
+  while (lines.next(line)) {
     // Empty line or comment.
-    if (line.size() == 0 || boost::starts_with(line, "#")) {
+    if (line.size() == 0 || line.starts_with("#")) {
       continue;
     }
 
@@ -37,53 +40,60 @@ QueryData parseEtcServicesContent(const std::string& content) {
     // [1]: [comment part1]
     // [2]: [comment part2]
     // [n]: [comment partn]
-    auto service_info_comment = osquery::split(line, "#");
+    tokenize(line, "#", service_info_comment);
 
     // [0]: name
     // [1]: port/protocol
     // [2]: [aliases0]
     // [3]: [aliases1]
     // [n]: [aliasesn]
-    auto service_info = osquery::split(service_info_comment[0]);
+    tokenize(service_info_comment[0], "\t ", service_info);
     if (service_info.size() < 2) {
       continue;
     }
 
     // [0]: port [1]: protocol
-    auto service_port_protocol = osquery::split(service_info[1], "/");
+    tokenize(service_info[1], "/", service_port_protocol);
     if (service_port_protocol.size() != 2) {
       continue;
     }
 
     Row r;
-    r["name"] = TEXT(service_info[0]);
-    r["port"] = INTEGER(service_port_protocol[0]);
-    r["protocol"] = TEXT(service_port_protocol[1]);
+    r["name"] = service_info[0].to_string();
+    r["port"] = service_port_protocol[0].to_string();
+    r["protocol"] = service_port_protocol[1].to_string();
 
     // Removes the name and the port/protcol elements.
     service_info.erase(service_info.begin(), service_info.begin() + 2);
-    r["aliases"] = TEXT(boost::algorithm::join(service_info, " "));
+    r["aliases"] = osquery::join(service_info, " ");
 
     // If there is a comment for the service.
     if (service_info_comment.size() > 1) {
       // Removes everything except the comment (parts of the comment).
       service_info_comment.erase(service_info_comment.begin(),
                                  service_info_comment.begin() + 1);
-      r["comment"] = TEXT(boost::algorithm::join(service_info_comment, " # "));
+      r["comment"] = osquery::join(service_info_comment, " # ");
     }
-    results.push_back(r);
+    results.push_back(std::move(r));
   }
   return results;
 }
 
 QueryData genEtcServices(QueryContext& context) {
-  std::string content;
-  auto s = readFile("/etc/services", content);
-  if (s.ok()) {
-    return parseEtcServicesContent(content);
-  } else {
-    return {};
-  }
+  static FileRowsCache kServicesCache;
+
+  QueryData results;
+  kServicesCache.get("/etc/services",
+                     [](const std::string& path, QueryData& rows) {
+                       std::string content;
+                       auto s = readFile(path, content);
+                       if (s.ok()) {
+                         rows = parseEtcServicesContent(content);
+                       }
+                       return s;
+                     },
+                     results);
+  return results;
 }
 }
 }
@@ -27,6 +27,10 @@
 
 #include "osquery/tables/networking/utils.h"
 
+#ifdef __linux__
+#include "osquery/tables/networking/linux/netlink.h"
+#endif
+
 namespace osquery {
 namespace tables {
 
@@ -131,8 +135,137 @@ void genDetailsFromAddr(const struct ifaddrs *addr, QueryData &results) {
   results.push_back(r);
 }
 
+#ifdef __linux__
+/// The netmask of a prefix length, formatted as an address of the family.
+static std::string getNetlinkMask(int family, unsigned int prefix) {
+  unsigned char mask[16] = {0};
+  size_t bytes = (family == AF_INET6) ? 16 : 4;
+  for (size_t i = 0; i < bytes && prefix > 0; i++) {
+    auto bits = std::min(prefix, 8U);
+    mask[i] = static_cast<unsigned char>(0xff << (8 - bits));
+    prefix -= bits;
+  }
+  return getNetlinkIP(family, mask);
+}
+
+static void genNetlinkAddress(const struct nlmsghdr *message,
+                              const NetlinkLinks &links,
+                              QueryContext &context,
+                              NetlinkAttributes &attributes,
+                              QueryData &results) {
+  auto info = static_cast<const struct ifaddrmsg *>(NLMSG_DATA(message));
+  if (info->ifa_family != AF_INET && info->ifa_family != AF_INET6) {
+    return;
+  }
+  parseNetlinkAttributes(IFA_RTA(info), IFA_PAYLOAD(message), attributes);
+
+  // IPv4 addresses are named by their label, which includes an alias.
+  std::string interface = getNetlinkLinkName(links, info->ifa_index);
+  if (attributes[IFA_LABEL] != nullptr) {
+    interface = static_cast<const char *>(RTA_DATA(attributes[IFA_LABEL]));
+  }
+  if (!context.constraints["interface"].notExistsOrMatches(interface)) {
+    return;
+  }
+
+  // The local address of a point-to-point link is IFA_LOCAL, the peer is
+  // IFA_ADDRESS. Other links report their address as both.
+  auto local = attributes[IFA_LOCAL];
+  auto address = attributes[IFA_ADDRESS];
+  if (local == nullptr) {
+    local = address;
+    address = nullptr;
+  }
+  if (local == nullptr) {
+    return;
+  }
+
+  Row r;
+  r["interface"] = std::move(interface);
+  r["address"] = getNetlinkIP(info->ifa_family, RTA_DATA(local));
+  r["mask"] = getNetlinkMask(info->ifa_family, info->ifa_prefixlen);
+
+  // The destination is either a broadcast or point-to-point address.
+  auto destination =
+      (attributes[IFA_BROADCAST] != nullptr) ? attributes[IFA_BROADCAST]
+                                             : address;
+  if (destination != nullptr) {
+    auto link = links.find(info->ifa_index);
+    auto flags = (link == links.end()) ? 0 : link->second.flags;
+    auto dest_address = getNetlinkIP(info->ifa_family, RTA_DATA(destination));
+    if ((flags & IFF_BROADCAST) == IFF_BROADCAST) {
+      r["broadcast"] = std::move(dest_address);
+    } else {
+      r["point_to_point"] = std::move(dest_address);
+    }
+  }
+  results.push_back(std::move(r));
+}
+
+/// Dump every address with its link flags in one pass over NETLINK.
+static Status genNetlinkAddresses(QueryContext &context, QueryData &results) {
+  NetlinkLinks links;
+  auto status = getNetlinkLinks(links);
+  if (!status.ok()) {
+    return status;
+  }
+
+  NetlinkAttributes attributes(IFA_MAX + 1);
+  QueryData addresses;
+  status = netlinkDump(
+      RTM_GETADDR, AF_UNSPEC, [&](const struct nlmsghdr *message) {
+        genNetlinkAddress(message, links, context, attributes, addresses);
+      });
+  if (status.ok()) {
+    results = std::move(addresses);
+  }
+  return status;
+}
+
+/// Report each link's details and counters from one RTM_GETLINK dump.
+static Status genNetlinkDetails(QueryContext &context, QueryData &results) {
+  NetlinkLinks links;
+  auto status = getNetlinkLinks(links);
+  if (!status.ok()) {
+    return status;
+  }
+
+  for (const auto &link : links) {
+    if (!context.constraints["interface"].notExistsOrMatches(
+            link.second.name)) {
+      continue;
+    }
+
+    Row r;
+    r["interface"] = link.second.name;
+    r["mac"] = link.second.mac;
+    r["type"] = INTEGER(link.second.type);
+    r["mtu"] = BIGINT(link.second.mtu);
+    // Linux does not use interface metrics.
+    r["metric"] = "0";
+    if (link.second.has_stats) {
+      r["ipackets"] = BIGINT(link.second.rx_packets);
+      r["opackets"] = BIGINT(link.second.tx_packets);
+      r["ibytes"] = BIGINT(link.second.rx_bytes);
+      r["obytes"] = BIGINT(link.second.tx_bytes);
+      r["ierrors"] = BIGINT(link.second.rx_errors);
+      r["oerrors"] = BIGINT(link.second.tx_errors);
+    }
+    // Last change is not implemented in Linux.
+    r["last_change"] = "-1";
+    results.push_back(std::move(r));
+  }
+  return Status(0, "OK");
+}
+#endif
+
 QueryData genInterfaceAddresses(QueryContext &context) {
   QueryData results;
+#ifdef __linux__
+  if (genNetlinkAddresses(context, results).ok()) {
+    return results;
+  }
+#endif
 
   struct ifaddrs *if_addrs = nullptr;
   struct ifaddrs *if_addr = nullptr;
@@ -156,6 +289,11 @@ QueryData genInterfaceAddresses(QueryContext &context) {
 
 QueryData genInterfaceDetails(QueryContext &context) {
   QueryData results;
+#ifdef __linux__
+  if (genNetlinkDetails(context, results).ok()) {
+    return results;
+  }
+#endif
 
   struct ifaddrs *if_addrs = nullptr;
   struct ifaddrs *if_addr = nullptr;
@@ -10,6 +10,8 @@
 
 #include <fstream>
 
+#include <linux/neighbour.h>
+
 #include <boost/algorithm/string/split.hpp>
 #include <boost/algorithm/string/trim.hpp>
 
@@ -17,13 +19,69 @@
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
 
+#include "osquery/tables/networking/linux/netlink.h"
+
 namespace osquery {
 namespace tables {
 
 const std::string kLinuxArpTable = "/proc/net/arp";
 
+static void genNetlinkNeighbor(const struct nlmsghdr* message,
+                               const NetlinkLinks& links,
+                               QueryContext& context,
+                               NetlinkAttributes& attributes,
+                               QueryData& results) {
+  auto neighbor = static_cast<const struct ndmsg*>(NLMSG_DATA(message));
+  // The ARP table does not list entries of interfaces without ARP.
+  if (neighbor->ndm_family != AF_INET || (neighbor->ndm_state & NUD_NOARP) ||
+      !context.constraints["interface"].notExistsOrMatches(
+          getNetlinkLinkName(links, neighbor->ndm_ifindex))) {
+    return;
+  }
+
+  parseNetlinkAttributes(
+      reinterpret_cast<const struct rtattr*>(
+          reinterpret_cast<const char*>(neighbor) +
+          NLMSG_ALIGN(sizeof(struct ndmsg))),
+      NLMSG_PAYLOAD(message, sizeof(struct ndmsg)),
+      attributes);
+  if (attributes[NDA_DST] == nullptr) {
+    return;
+  }
+
+  Row r;
+  r["address"] = getNetlinkIP(AF_INET, RTA_DATA(attributes[NDA_DST]));
+  r["mac"] = getNetlinkMAC(attributes[NDA_LLADDR]);
+  r["interface"] = getNetlinkLinkName(links, neighbor->ndm_ifindex);
+  r["permanent"] = (neighbor->ndm_state & NUD_PERMANENT) ? "1" : "0";
+  results.push_back(std::move(r));
+}
+
+/// Read the ARP table from NETLINK, without the text of /proc/net/arp.
+static Status genNetlinkArpCache(QueryContext& context, QueryData& results) {
+  NetlinkLinks links;
+  auto status = getNetlinkLinks(links);
+  if (!status.ok()) {
+    return status;
+  }
+
+  NetlinkAttributes attributes(NDA_MAX + 1);
+  QueryData neighbors;
+  status = netlinkDump(
+      RTM_GETNEIGH, AF_INET, [&](const struct nlmsghdr* message) {
+        genNetlinkNeighbor(message, links, context, attributes, neighbors);
+      });
+  if (status.ok()) {
+    results = std::move(neighbors);
+  }
+  return status;
+}
+
 QueryData genArpCache(QueryContext& context) {
   QueryData results;
+  if (genNetlinkArpCache(context, results).ok()) {
+    return results;
+  }
 
   boost::filesystem::path arp_path = kLinuxArpTable;
   if (!osquery::isReadable(arp_path).ok()) {
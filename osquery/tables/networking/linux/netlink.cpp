@@ -0,0 +1,222 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+
+#include <arpa/inet.h>
+#include <linux/if_link.h>
+#include <linux/neighbour.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "osquery/tables/networking/linux/netlink.h"
+
+namespace osquery {
+namespace tables {
+
+/// The receive buffer, larger than any datagram of a dump.
+const size_t kNetlinkBufferSize = 32768;
+
+/// Seconds to wait for each datagram of a dump.
+const time_t kNetlinkTimeout = 1;
+
+/// Each dump uses a new sequence number to ignore stale replies.
+static std::atomic<unsigned int> kNetlinkSequence{1};
+
+/// The size of the family header of a dump request and its messages.
+static size_t netlinkHeaderSize(unsigned short type) {
+  switch (type) {
+  case RTM_GETLINK:
+  case RTM_NEWLINK:
+    return sizeof(struct ifinfomsg);
+  case RTM_GETADDR:
+  case RTM_NEWADDR:
+    return sizeof(struct ifaddrmsg);
+  case RTM_GETROUTE:
+  case RTM_NEWROUTE:
+    return sizeof(struct rtmsg);
+  case RTM_GETNEIGH:
+  case RTM_NEWNEIGH:
+    return sizeof(struct ndmsg);
+  default:
+    return sizeof(struct rtgenmsg);
+  }
+}
+
+Status netlinkDump(
+    unsigned short type,
+    unsigned char family,
+    const std::function<void(const struct nlmsghdr*)>& predicate) {
+  int fd = ::socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+  if (fd < 0) {
+    return Status(1, "Cannot open NETLINK socket");
+  }
+
+  struct timeval timeout = {kNetlinkTimeout, 0};
+  ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  // Every family header begins with the address family.
+  struct {
+    struct nlmsghdr header;
+    char family_header[NLMSG_ALIGN(sizeof(struct ifinfomsg))];
+  } request;
+  memset(&request, 0, sizeof(request));
+  auto sequence = kNetlinkSequence++;
+  request.header.nlmsg_len = NLMSG_LENGTH(netlinkHeaderSize(type));
+  request.header.nlmsg_type = type;
+  request.header.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+  request.header.nlmsg_seq = sequence;
+  request.family_header[0] = static_cast<char>(family);
+
+  if (::send(fd, &request, request.header.nlmsg_len, 0) < 0) {
+    ::close(fd);
+    return Status(1, "Cannot write NETLINK request");
+  }
+
+  std::vector<char> buffer(kNetlinkBufferSize);
+  while (true) {
+    auto bytes = ::recv(fd, buffer.data(), buffer.size(), 0);
+    if (bytes < 0 && errno == EINTR) {
+      continue;
+    } else if (bytes <= 0) {
+      ::close(fd);
+      return Status(1, "Cannot read NETLINK response");
+    }
+
+    auto size = static_cast<unsigned int>(bytes);
+    auto message = reinterpret_cast<const struct nlmsghdr*>(buffer.data());
+    for (; NLMSG_OK(message, size); message = NLMSG_NEXT(message, size)) {
+      if (message->nlmsg_seq != sequence) {
+        continue;
+      }
+
+      if (message->nlmsg_type == NLMSG_DONE) {
+        ::close(fd);
+        return Status(0, "OK");
+      } else if (message->nlmsg_type == NLMSG_ERROR) {
+        ::close(fd);
+        return Status(1, "NETLINK dump failed");
+      } else if (message->nlmsg_type != NLMSG_NOOP &&
+                 NLMSG_PAYLOAD(message, 0) >=
+                     netlinkHeaderSize(message->nlmsg_type)) {
+        predicate(message);
+      }
+    }
+  }
+}
+
+void parseNetlinkAttributes(const struct rtattr* attr,
+                            int size,
+                            NetlinkAttributes& attributes) {
+  for (auto& attribute : attributes) {
+    attribute = nullptr;
+  }
+
+  for (; RTA_OK(attr, size); attr = RTA_NEXT(attr, size)) {
+    if (attr->rta_type < attributes.size()) {
+      attributes[attr->rta_type] = attr;
+    }
+  }
+}
+
+std::string getNetlinkIP(int family, const void* address) {
+  char dst[INET6_ADDRSTRLEN] = {0};
+  if (inet_ntop(family, address, dst, sizeof(dst)) == nullptr) {
+    return "";
+  }
+  return dst;
+}
+
+std::string getNetlinkMAC(const struct rtattr* attr) {
+  if (attr == nullptr) {
+    return "00:00:00:00:00:00";
+  }
+
+  std::stringstream mac;
+  auto data = static_cast<const unsigned char*>(RTA_DATA(attr));
+  for (size_t i = 0; i < RTA_PAYLOAD(attr); i++) {
+    if (i > 0) {
+      mac << ":";
+    }
+    mac << std::hex << std::setfill('0') << std::setw(2)
+        << static_cast<int>(data[i]);
+  }
+  return mac.str();
+}
+
+/// Read the link counters, preferring the 64-bit statistics.
+static void getNetlinkLinkStats(const NetlinkAttributes& attributes,
+                                NetlinkLink& link) {
+  auto stats64 = attributes[IFLA_STATS64];
+  if (stats64 != nullptr &&
+      RTA_PAYLOAD(stats64) >= sizeof(struct rtnl_link_stats64)) {
+    struct rtnl_link_stats64 stats;
+    memcpy(&stats, RTA_DATA(stats64), sizeof(stats));
+    link.rx_packets = stats.rx_packets;
+    link.tx_packets = stats.tx_packets;
+    link.rx_bytes = stats.rx_bytes;
+    link.tx_bytes = stats.tx_bytes;
+    link.rx_errors = stats.rx_errors;
+    link.tx_errors = stats.tx_errors;
+    link.has_stats = true;
+    return;
+  }
+
+  auto stats32 = attributes[IFLA_STATS];
+  if (stats32 != nullptr &&
+      RTA_PAYLOAD(stats32) >= sizeof(struct rtnl_link_stats)) {
+    struct rtnl_link_stats stats;
+    memcpy(&stats, RTA_DATA(stats32), sizeof(stats));
+    link.rx_packets = stats.rx_packets;
+    link.tx_packets = stats.tx_packets;
+    link.rx_bytes = stats.rx_bytes;
+    link.tx_bytes = stats.tx_bytes;
+    link.rx_errors = stats.rx_errors;
+    link.tx_errors = stats.tx_errors;
+    link.has_stats = true;
+  }
+}
+
+Status getNetlinkLinks(NetlinkLinks& links) {
+  NetlinkAttributes attributes(IFLA_MAX + 1);
+  return netlinkDump(
+      RTM_GETLINK, AF_UNSPEC, [&](const struct nlmsghdr* message) {
+        auto info = static_cast<const struct ifinfomsg*>(NLMSG_DATA(message));
+        parseNetlinkAttributes(
+            IFLA_RTA(info), IFLA_PAYLOAD(message), attributes);
+
+        auto& link = links[info->ifi_index];
+        link.flags = info->ifi_flags;
+        link.type = info->ifi_type;
+        if (attributes[IFLA_IFNAME] != nullptr) {
+          link.name =
+              static_cast<const char*>(RTA_DATA(attributes[IFLA_IFNAME]));
+        }
+        link.mac = getNetlinkMAC(attributes[IFLA_ADDRESS]);
+        if (attributes[IFLA_MTU] != nullptr) {
+          link.mtu = *static_cast<const unsigned int*>(
+              RTA_DATA(attributes[IFLA_MTU]));
+        }
+        getNetlinkLinkStats(attributes, link);
+      });
+}
+
+const std::string& getNetlinkLinkName(const NetlinkLinks& links, int index) {
+  static const std::string kUnknownLink;
+  auto link = links.find(index);
+  return (link == links.end()) ? kUnknownLink : link->second.name;
+}
+}
+}
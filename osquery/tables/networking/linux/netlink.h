@@ -0,0 +1,86 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include <osquery/status.h>
+
+namespace osquery {
+namespace tables {
+
+/// A message's route attributes indexed by type, unset types are nullptr.
+using NetlinkAttributes = std::vector<const struct rtattr*>;
+
+/// The details of a link reported by an RTM_GETLINK dump.
+struct NetlinkLink {
+  std::string name;
+  std::string mac;
+  unsigned int flags{0};
+  unsigned short type{0};
+  unsigned int mtu{0};
+
+  /// Set if the link reported counters.
+  bool has_stats{false};
+  unsigned long long rx_packets{0};
+  unsigned long long tx_packets{0};
+  unsigned long long rx_bytes{0};
+  unsigned long long tx_bytes{0};
+  unsigned long long rx_errors{0};
+  unsigned long long tx_errors{0};
+};
+
+/// Links by interface index.
+using NetlinkLinks = std::map<int, NetlinkLink>;
+
+/**
+ * @brief Request a NETLINK_ROUTE dump and visit each message of the response.
+ *
+ * The kernel answers a dump with many messages in each datagram, they are
+ * parsed in place as they are received, so the size of the response is not
+ * limited by a buffer.
+ *
+ * @param type One of RTM_GETLINK, RTM_GETADDR, RTM_GETROUTE, or RTM_GETNEIGH.
+ * @param family An address family to dump, or AF_UNSPEC.
+ * @param predicate Called with each message of the requested type.
+ * @return Failure if the dump could not be requested or was cut short.
+ */
+Status netlinkDump(
+    unsigned short type,
+    unsigned char family,
+    const std::function<void(const struct nlmsghdr*)>& predicate);
+
+/// Index the attributes following a message's family header.
+void parseNetlinkAttributes(const struct rtattr* attr,
+                            int size,
+                            NetlinkAttributes& attributes);
+
+/// Format an IPv4 or IPv6 address attribute.
+std::string getNetlinkIP(int family, const void* address);
+
+/// Format a link-layer address attribute as colon-separated hex bytes.
+std::string getNetlinkMAC(const struct rtattr* attr);
+
+/// Dump every link, required to name the interface index of other dumps.
+Status getNetlinkLinks(NetlinkLinks& links);
+
+/// The name of a link, empty if the index is unknown.
+const std::string& getNetlinkLinkName(const NetlinkLinks& links, int index);
+}
+}
@@ -8,17 +8,64 @@
  *
  */
 
+#include <atomic>
+#include <iterator>
+#include <mutex>
+#include <vector>
+
 #include <arpa/inet.h>
+#include <errno.h>
+#include <linux/netlink.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 #include <osquery/core.h>
 #include <osquery/filesystem.h>
 #include <osquery/tables.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/filesystem/linux/proc.h"
+#include "osquery/tables/networking/linux/inet_diag.h"
+
+#ifndef SOCK_DIAG_BY_FAMILY
+#define SOCK_DIAG_BY_FAMILY 20
+#endif
 
 namespace osquery {
 namespace tables {
 
+/// Every socket state, see idiag_states.
+const uint32_t kSockDiagAllStates = 0xffffffff;
+
+/// Sockets without a remote peer: TCP listeners and unconnected UDP sockets.
+const uint32_t kSockDiagUnconnectedStates =
+    (1 << TCP_LISTEN) | (1 << TCP_CLOSE);
+
+/// TCP sockets accepting connections, a closed TCP socket is not listening.
+const uint32_t kSockDiagListenStates = (1 << TCP_LISTEN);
+
+/// Protocols the kernel's sock_diag interface reports, the others use /proc.
+const std::set<int> kSockDiagProtocols = {
+    IPPROTO_TCP, IPPROTO_UDP, IPPROTO_UDPLITE,
+};
+
+/// The size of the buffer receiving sock_diag responses.
+const size_t kSockDiagBufferSize = 32 * 1024;
+
+/// Columns known without walking process descriptors.
+const std::vector<std::string> kSocketColumns = {
+    "socket",
+    "family",
+    "protocol",
+    "local_address",
+    "remote_address",
+    "local_port",
+    "remote_port",
+    "path",
+};
+
 // Linux proc protocol define to net stats file name.
 const std::map<int, std::string> kLinuxProtocolNames = {
     {IPPROTO_ICMP, "icmp"},
@@ -63,6 +110,18 @@ unsigned short portFromHex(const std::string &encoded_port) {
   return decoded;
 }
 
+/// Set the pid and fd of a socket row from its inode.
+static inline void setSocketOwner(const InodeMap &inodes, Row &r) {
+  auto owner = inodes.find(r["socket"]);
+  if (owner != inodes.end()) {
+    r["pid"] = owner->second.second;
+    r["fd"] = owner->second.first;
+  } else {
+    r["pid"] = "-1";
+    r["fd"] = "-1";
+  }
+}
+
 void genSocketsFromProc(const InodeMap &inodes,
                         int protocol,
                         int family,
@@ -83,11 +142,16 @@ void genSocketsFromProc(const InodeMap &inodes,
 
   // The system's socket information is tokenized by line.
   size_t index = 0;
-  for (const auto &line : osquery::split(content, "\n")) {
+  Tokenizer lines(content, "\n");
+  boost::string_ref line;
+  std::vector<boost::string_ref> fields;
+  std::vector<boost::string_ref> locals;
+  std::vector<boost::string_ref> remotes;
+  while (lines.next(line)) {
     if (++index == 1) {
       // The first line is a textual header and will be ignored.
-      if (line.find("sl") != 0 && line.find("sk") != 0 &&
-          line.find("Num") != 0) {
+      if (!line.starts_with("sl") && !line.starts_with("sk") &&
+          !line.starts_with("Num")) {
         // Header fields are unknown, stop parsing.
         break;
       }
@@ -95,7 +159,7 @@ void genSocketsFromProc(const InodeMap &inodes,
     }
 
     // The socket information is tokenized by spaces, each a field.
-    auto fields = osquery::split(line, " ");
+    tokenize(line, " ", fields);
     // UNIX socket reporting has a smaller number of fields.
     size_t min_fields = (family == AF_UNIX) ? 7 : 10;
     if (fields.size() < min_fields) {
@@ -105,81 +169,323 @@ void genSocketsFromProc(const InodeMap &inodes,
 
     Row r;
     if (family == AF_UNIX) {
-      r["socket"] = fields[6];
+      r["socket"] = fields[6].to_string();
       r["family"] = "0";
-      r["protocol"] = fields[2];
+      r["protocol"] = fields[2].to_string();
       r["local_address"] = "";
       r["local_port"] = "0";
       r["remote_address"] = "";
       r["remote_port"] = "0";
-      r["path"] = (fields.size() >= 8) ? fields[7] : "";
+      r["path"] = (fields.size() >= 8) ? fields[7].to_string() : "";
     } else {
       // Two of the fields are the local/remote address/port pairs.
-      auto locals = osquery::split(fields[1], ":");
-      auto remotes = osquery::split(fields[2], ":");
+      tokenize(fields[1], ":", locals);
+      tokenize(fields[2], ":", remotes);
       if (locals.size() != 2 || remotes.size() != 2) {
         // Unknown/malformed socket information.
         continue;
       }
 
-      r["socket"] = fields[9];
+      r["socket"] = fields[9].to_string();
       r["family"] = INTEGER(family);
       r["protocol"] = INTEGER(protocol);
-      r["local_address"] = addressFromHex(locals[0], family);
-      r["local_port"] = INTEGER(portFromHex(locals[1]));
-      r["remote_address"] = addressFromHex(remotes[0], family);
-      r["remote_port"] = INTEGER(portFromHex(remotes[1]));
+      r["local_address"] = addressFromHex(locals[0].to_string(), family);
+      r["local_port"] = INTEGER(portFromHex(locals[1].to_string()));
+      r["remote_address"] = addressFromHex(remotes[0].to_string(), family);
+      r["remote_port"] = INTEGER(portFromHex(remotes[1].to_string()));
       // Path is only used for UNIX domain sockets.
       r["path"] = "";
     }
 
-    if (inodes.count(r["socket"]) > 0) {
-      r["pid"] = inodes.at(r["socket"]).second;
-      r["fd"] = inodes.at(r["socket"]).first;
-    } else {
-      r["pid"] = "-1";
-      r["fd"] = "-1";
+    setSocketOwner(inodes, r);
+    results.push_back(r);
+  }
+}
+
+/// Append a row for each socket in a sock_diag response.
+static void genSocketsFromDiagMessage(const struct inet_diag_msg *msg,
+                                      const InodeMap &inodes,
+                                      int protocol,
+                                      QueryData &results) {
+  char local[INET6_ADDRSTRLEN] = {0};
+  char remote[INET6_ADDRSTRLEN] = {0};
+  int family = msg->idiag_family;
+  inet_ntop(family, msg->id.idiag_src, local, sizeof(local));
+  inet_ntop(family, msg->id.idiag_dst, remote, sizeof(remote));
+
+  Row r;
+  r["socket"] = BIGINT(msg->idiag_inode);
+  r["family"] = INTEGER(family);
+  r["protocol"] = INTEGER(protocol);
+  r["local_address"] = local;
+  r["local_port"] = INTEGER(ntohs(msg->id.idiag_sport));
+  r["remote_address"] = remote;
+  r["remote_port"] = INTEGER(ntohs(msg->id.idiag_dport));
+  r["path"] = "";
+  setSocketOwner(inodes, r);
+  results.push_back(std::move(r));
+}
+
+/**
+ * @brief Request sockets from the kernel using NETLINK_SOCK_DIAG.
+ *
+ * The kernel filters the sockets by state and replies with binary socket
+ * information, which is far cheaper than formatting and parsing /proc/net.
+ * A failure, such as a kernel without the protocol's diag module, returns
+ * without results so the caller may read /proc.
+ */
+Status genSocketsFromNetlink(const InodeMap &inodes,
+                             int protocol,
+                             int family,
+                             uint32_t states,
+                             QueryData &results) {
+  auto fd = ::socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_SOCK_DIAG);
+  if (fd < 0) {
+    return Status(1, "Cannot open sock_diag socket");
+  }
+
+  struct {
+    struct nlmsghdr header;
+    struct inet_diag_req_v2 request;
+  } message;
+  memset(&message, 0, sizeof(message));
+  message.header.nlmsg_len = sizeof(message);
+  message.header.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+  message.header.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+  message.request.sdiag_family = family;
+  message.request.sdiag_protocol = protocol;
+  message.request.idiag_states = states;
+
+  struct sockaddr_nl kernel;
+  memset(&kernel, 0, sizeof(kernel));
+  kernel.nl_family = AF_NETLINK;
+  if (::sendto(fd,
+               &message,
+               sizeof(message),
+               0,
+               reinterpret_cast<struct sockaddr *>(&kernel),
+               sizeof(kernel)) < 0) {
+    ::close(fd);
+    return Status(1, "Cannot send sock_diag request");
+  }
+
+  QueryData sockets;
+  std::vector<char> buffer(kSockDiagBufferSize);
+  Status status(1, "Incomplete sock_diag response");
+  bool done = false;
+  while (!done) {
+    auto size = ::recv(fd, buffer.data(), buffer.size(), 0);
+    if (size < 0 && errno == EINTR) {
+      continue;
+    } else if (size <= 0) {
+      break;
     }
 
-    results.push_back(r);
+    auto header = reinterpret_cast<struct nlmsghdr *>(buffer.data());
+    auto remaining = static_cast<int>(size);
+    while (NLMSG_OK(header, remaining)) {
+      if (header->nlmsg_type == NLMSG_DONE) {
+        status = Status(0, "OK");
+        done = true;
+        break;
+      } else if (header->nlmsg_type == NLMSG_ERROR) {
+        status = Status(1, "sock_diag request failed");
+        done = true;
+        break;
+      } else if (header->nlmsg_type == SOCK_DIAG_BY_FAMILY &&
+                 header->nlmsg_len >=
+                     NLMSG_LENGTH(sizeof(struct inet_diag_msg))) {
+        auto msg = static_cast<struct inet_diag_msg *>(NLMSG_DATA(header));
+        genSocketsFromDiagMessage(msg, inodes, protocol, sockets);
+      }
+      header = NLMSG_NEXT(header, remaining);
+    }
+  }
+  ::close(fd);
+
+  if (status.ok()) {
+    std::move(sockets.begin(), sockets.end(), std::back_inserter(results));
+  }
+  return status;
+}
+
+/**
+ * @brief Map socket inodes to the descriptor and pid owning them.
+ *
+ * If a set of inodes is given the walk stops once each has an owner.
+ */
+static InodeMap genSocketOwners(const std::set<std::string> &pids,
+                                const std::set<std::string> *wanted) {
+  std::atomic<bool> done(wanted != nullptr && wanted->empty());
+  std::mutex found_mutex;
+  std::set<std::string> found;
+
+  // Collect the socket descriptors of each process.
+  QueryData sockets;
+  procScan(pids,
+           [&](const ProcessDirectory &process, QueryData &rows) {
+             std::map<std::string, std::string> descriptors;
+             if (!process.descriptors(descriptors).ok()) {
+               return;
+             }
+             for (const auto &fd : descriptors) {
+               if (fd.second.find("socket:[") != 0) {
+                 continue;
+               }
+               // See #792: std::regex is incomplete until GCC 4.9 (skip 8)
+               auto inode = fd.second.substr(8);
+               inode.resize(inode.size() - 1);
+               if (wanted != nullptr) {
+                 if (wanted->count(inode) == 0) {
+                   continue;
+                 }
+                 std::lock_guard<std::mutex> lock(found_mutex);
+                 found.insert(inode);
+                 if (found.size() == wanted->size()) {
+                   done = true;
+                 }
+               }
+               rows.push_back({{"inode", std::move(inode)},
+                               {"fd", fd.first},
+                               {"pid", process.pid()}});
+             }
+           },
+           sockets,
+           &done);
+
+  InodeMap socket_inodes;
+  for (auto &socket : sockets) {
+    socket_inodes[socket.at("inode")] =
+        std::make_pair(std::move(socket["fd"]), std::move(socket["pid"]));
   }
+  return socket_inodes;
+}
+
+/// Generate the sockets of every protocol and family.
+static void genSockets(const InodeMap &inodes,
+                       uint32_t states,
+                       QueryData &results) {
+  // Request socket information using netlink (Ref: #1094), use proc messages
+  // for protocols and kernels without sock_diag support.
+  for (const auto &protocol : kLinuxProtocolNames) {
+    for (const auto &family : {AF_INET, AF_INET6}) {
+      if (kSockDiagProtocols.count(protocol.first) > 0 &&
+          genSocketsFromNetlink(inodes, protocol.first, family, states, results)
+              .ok()) {
+        continue;
+      }
+      genSocketsFromProc(inodes, protocol.first, family, results);
+    }
+  }
+
+  genSocketsFromProc(inodes, IPPROTO_IP, AF_UNIX, results);
+}
+
+QueryData genListeningSockets(bool owners) {
+  // Only listening TCP and unconnected UDP sockets are requested, sockets of
+  // other protocols are read from /proc and filtered by their remote port.
+  QueryData sockets;
+  for (const auto &protocol : kLinuxProtocolNames) {
+    auto states = (protocol.first == IPPROTO_TCP) ? kSockDiagListenStates
+                                                  : kSockDiagUnconnectedStates;
+    for (const auto &family : {AF_INET, AF_INET6}) {
+      if (kSockDiagProtocols.count(protocol.first) > 0 &&
+          genSocketsFromNetlink({}, protocol.first, family, states, sockets)
+              .ok()) {
+        continue;
+      }
+      genSocketsFromProc({}, protocol.first, family, sockets);
+    }
+  }
+
+  QueryData results;
+  std::set<std::string> wanted;
+  for (auto &socket : sockets) {
+    if (socket["remote_port"] == "0") {
+      if (socket["socket"] != "0") {
+        wanted.insert(socket["socket"]);
+      }
+      results.push_back(std::move(socket));
+    }
+  }
+
+  // Walk descriptors only until the owner of each listening socket is found.
+  InodeMap socket_inodes;
+  if (owners && !wanted.empty()) {
+    std::set<std::string> pids;
+    osquery::procProcesses(pids);
+    socket_inodes = genSocketOwners(pids, &wanted);
+  }
+  for (auto &socket : results) {
+    setSocketOwner(socket_inodes, socket);
+  }
+  return results;
 }
 
 QueryData genOpenSockets(QueryContext &context) {
   QueryData results;
 
   // If a pid is given then set that as the only item in processes.
+  // Walking every process descriptor is only needed for the pid and fd.
   std::set<std::string> pids;
-  if (context.constraints["pid"].exists(EQUALS)) {
+  bool pid_constraint = context.constraints["pid"].exists(EQUALS);
+  if (pid_constraint) {
     pids = context.constraints["pid"].getAll(EQUALS);
-  } else {
+  } else if (context.isAnyColumnUsed({"pid", "fd"})) {
     osquery::procProcesses(pids);
   }
 
-  // Generate a map of socket inode to process tid.
-  InodeMap socket_inodes;
-  for (const auto &process : pids) {
-    std::map<std::string, std::string> descriptors;
-    if (osquery::procDescriptors(process, descriptors).ok()) {
-      for (const auto &fd : descriptors) {
-        if (fd.second.find("socket:[") == 0) {
-          // See #792: std::regex is incomplete until GCC 4.9 (skip 8 chars)
-          auto inode = fd.second.substr(8);
-          socket_inodes[inode.substr(0, inode.size() - 1)] =
-              std::make_pair(fd.first, process);
-        }
-      }
+  // Sockets without a remote port, for example all of listening_ports, are
+  // filtered by the kernel.
+  auto states = kSockDiagAllStates;
+  if (context.constraints["remote_port"].exists(EQUALS)) {
+    auto ports = context.constraints["remote_port"].getAll(EQUALS);
+    if (ports.size() == 1 && *ports.begin() == "0") {
+      states = kSockDiagUnconnectedStates;
     }
   }
 
-  // This used to use netlink (Ref: #1094) to request socket information.
-  // Use proc messages to query socket information.
-  for (const auto &protocol : kLinuxProtocolNames) {
-    genSocketsFromProc(socket_inodes, protocol.first, AF_INET, results);
-    genSocketsFromProc(socket_inodes, protocol.first, AF_INET6, results);
+  bool socket_constraints = false;
+  for (const auto &column : kSocketColumns) {
+    socket_constraints |= context.constraints[column].exists();
   }
 
-  genSocketsFromProc(socket_inodes, IPPROTO_IP, AF_UNIX, results);
+  if (pid_constraint || !socket_constraints || pids.empty()) {
+    genSockets(genSocketOwners(pids, nullptr), states, results);
+    return results;
+  }
+
+  // Read the sockets first, then walk descriptors only until the owner of
+  // each matching socket is found.
+  QueryData sockets;
+  genSockets({}, states, sockets);
+  std::vector<std::pair<std::string, const ConstraintView *>> views;
+  for (const auto &column : kSocketColumns) {
+    if (context.constraints[column].exists()) {
+      views.push_back(
+          std::make_pair(column, &context.constraints[column].view()));
+    }
+  }
+
+  std::set<std::string> wanted;
+  for (auto &socket : sockets) {
+    bool matches = true;
+    for (const auto &view : views) {
+      matches = matches && view.second->matches(socket[view.first]);
+    }
+    if (matches) {
+      // Sockets in TIME_WAIT have no inode and no owner.
+      if (socket["socket"] != "0") {
+        wanted.insert(socket["socket"]);
+      }
+      results.push_back(std::move(socket));
+    }
+  }
+
+  auto socket_inodes = genSocketOwners(pids, &wanted);
+  for (auto &socket : results) {
+    setSocketOwner(socket_inodes, socket);
+  }
   return results;
 }
 }
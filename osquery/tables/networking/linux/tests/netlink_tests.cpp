@@ -0,0 +1,67 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <net/if.h>
+
+#include "osquery/tables/networking/linux/netlink.h"
+#include "osquery/tests/test_util.h"
+
+namespace osquery {
+namespace tables {
+
+class NetlinkTests : public testing::Test {};
+
+TEST_F(NetlinkTests, test_parse_attributes) {
+  // Two attributes, the second is beyond the indexed types.
+  std::vector<char> buffer(RTA_SPACE(4) * 2, 0);
+  auto first = reinterpret_cast<struct rtattr*>(buffer.data());
+  first->rta_type = 1;
+  first->rta_len = RTA_LENGTH(4);
+  auto second = reinterpret_cast<struct rtattr*>(buffer.data() + RTA_SPACE(4));
+  second->rta_type = 8;
+  second->rta_len = RTA_LENGTH(4);
+
+  NetlinkAttributes attributes(4, first);
+  parseNetlinkAttributes(first, buffer.size(), attributes);
+  EXPECT_EQ(attributes[0], nullptr);
+  EXPECT_EQ(attributes[1], first);
+  EXPECT_EQ(attributes[3], nullptr);
+}
+
+TEST_F(NetlinkTests, test_format_addresses) {
+  std::vector<char> buffer(RTA_SPACE(6), 0);
+  auto attr = reinterpret_cast<struct rtattr*>(buffer.data());
+  attr->rta_len = RTA_LENGTH(6);
+  auto mac = static_cast<unsigned char*>(RTA_DATA(attr));
+  mac[0] = 0x0a;
+  mac[5] = 0xff;
+  EXPECT_EQ(getNetlinkMAC(attr), "0a:00:00:00:00:ff");
+  EXPECT_EQ(getNetlinkMAC(nullptr), "00:00:00:00:00:00");
+
+  unsigned char address[4] = {127, 0, 0, 1};
+  EXPECT_EQ(getNetlinkIP(AF_INET, address), "127.0.0.1");
+}
+
+TEST_F(NetlinkTests, test_links) {
+  NetlinkLinks links;
+  ASSERT_TRUE(getNetlinkLinks(links).ok());
+
+  // Every host has a loopback link, named as if_indextoname names it.
+  auto index = static_cast<int>(if_nametoindex("lo"));
+  ASSERT_GT(index, 0);
+  EXPECT_EQ(getNetlinkLinkName(links, index), "lo");
+  EXPECT_TRUE(getNetlinkLinkName(links, -1).empty());
+}
+}
+}
@@ -0,0 +1,151 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include <osquery/tables.h>
+
+namespace osquery {
+namespace tables {
+
+typedef std::map<std::string, std::pair<std::string, std::string> > InodeMap;
+
+Status genSocketsFromNetlink(const InodeMap &inodes,
+                             int protocol,
+                             int family,
+                             uint32_t states,
+                             QueryData &results);
+
+void genSocketsFromProc(const InodeMap &inodes,
+                        int protocol,
+                        int family,
+                        QueryData &results);
+
+QueryData genOpenSockets(QueryContext &context);
+QueryData genListeningSockets(bool owners);
+
+class ProcessOpenSocketsTests : public testing::Test {};
+
+/// Find the row of a socket bound to a local port.
+static const Row *findPort(const QueryData &results, const std::string &port) {
+  for (const auto &r : results) {
+    if (r.at("local_port") == port) {
+      return &r;
+    }
+  }
+  return nullptr;
+}
+
+TEST_F(ProcessOpenSocketsTests, test_sockets_from_netlink) {
+  auto fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  ASSERT_GE(fd, 0);
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t length = sizeof(address);
+  ASSERT_EQ(::bind(fd, (struct sockaddr *)&address, sizeof(address)), 0);
+  ASSERT_EQ(::listen(fd, 1), 0);
+  ASSERT_EQ(::getsockname(fd, (struct sockaddr *)&address, &length), 0);
+  auto port = std::to_string(ntohs(address.sin_port));
+
+  QueryData proc;
+  genSocketsFromProc({}, IPPROTO_TCP, AF_INET, proc);
+  auto expected = findPort(proc, port);
+  ASSERT_NE(expected, nullptr);
+
+  // The kernel may not support sock_diag, the caller then uses /proc.
+  QueryData netlink;
+  auto states = (1 << TCP_LISTEN) | (1 << TCP_CLOSE);
+  if (genSocketsFromNetlink({}, IPPROTO_TCP, AF_INET, states, netlink).ok()) {
+    auto actual = findPort(netlink, port);
+    ASSERT_NE(actual, nullptr);
+    EXPECT_EQ(*actual, *expected);
+    EXPECT_EQ(actual->at("local_address"), "127.0.0.1");
+
+    // Filtering by state excludes the listener.
+    netlink.clear();
+    auto established = 1 << TCP_ESTABLISHED;
+    EXPECT_TRUE(
+        genSocketsFromNetlink({}, IPPROTO_TCP, AF_INET, established, netlink)
+            .ok());
+    EXPECT_EQ(findPort(netlink, port), nullptr);
+  }
+  ::close(fd);
+}
+
+TEST_F(ProcessOpenSocketsTests, test_sockets_by_port) {
+  auto fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  ASSERT_GE(fd, 0);
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t length = sizeof(address);
+  ASSERT_EQ(::bind(fd, (struct sockaddr *)&address, sizeof(address)), 0);
+  ASSERT_EQ(::listen(fd, 1), 0);
+  ASSERT_EQ(::getsockname(fd, (struct sockaddr *)&address, &length), 0);
+  auto port = std::to_string(ntohs(address.sin_port));
+
+  // Socket constraints are applied before the owning process is found.
+  QueryContext context;
+  context.constraints["local_port"].add(Constraint(EQUALS, port));
+  auto results = genOpenSockets(context);
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0].at("local_port"), port);
+  EXPECT_EQ(results[0].at("pid"), std::to_string(getpid()));
+  EXPECT_EQ(results[0].at("fd"), std::to_string(fd));
+  ::close(fd);
+}
+
+TEST_F(ProcessOpenSocketsTests, test_listening_sockets) {
+  auto listening = ::socket(AF_INET, SOCK_STREAM, 0);
+  auto bound = ::socket(AF_INET, SOCK_STREAM, 0);
+  ASSERT_GE(listening, 0);
+  ASSERT_GE(bound, 0);
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t length = sizeof(address);
+  ASSERT_EQ(::bind(listening, (struct sockaddr *)&address, sizeof(address)), 0);
+  ASSERT_EQ(::listen(listening, 1), 0);
+  ASSERT_EQ(::getsockname(listening, (struct sockaddr *)&address, &length), 0);
+  auto port = std::to_string(ntohs(address.sin_port));
+
+  // A bound TCP socket that is not listening is not reported.
+  address.sin_port = 0;
+  length = sizeof(address);
+  ASSERT_EQ(::bind(bound, (struct sockaddr *)&address, sizeof(address)), 0);
+  ASSERT_EQ(::getsockname(bound, (struct sockaddr *)&address, &length), 0);
+  auto bound_port = std::to_string(ntohs(address.sin_port));
+
+  auto results = genListeningSockets(true);
+  const Row *row = findPort(results, port);
+  ASSERT_NE(row, nullptr);
+  EXPECT_EQ(row->at("pid"), std::to_string(getpid()));
+  EXPECT_EQ(row->at("fd"), std::to_string(listening));
+  EXPECT_EQ(findPort(results, bound_port), nullptr);
+
+  // Without owners the descriptors are not walked.
+  results = genListeningSockets(false);
+  row = findPort(results, port);
+  ASSERT_NE(row, nullptr);
+  EXPECT_EQ(row->at("pid"), "-1");
+  ::close(listening);
+  ::close(bound);
+}
+}
+}
@@ -17,10 +17,23 @@ namespace tables {
 typedef std::pair<std::string, std::string> ProtoFamilyPair;
 typedef std::map<std::string, std::vector<ProtoFamilyPair> > PortMap;
 
+#ifdef __linux__
+/// Listening sockets, with an owner pid if requested, see process_open_sockets.
+QueryData genListeningSockets(bool owners);
+#endif
+
 QueryData genListeningPorts(QueryContext& context) {
   QueryData results;
 
-  auto sockets = SQL::selectAllFrom("process_open_sockets");
+#ifdef __linux__
+  // The kernel reports only listening sockets, descriptors are walked until
+  // each of their owners is found.
+  auto sockets = genListeningSockets(context.isColumnUsed("pid"));
+#else
+  // Only sockets without a remote port are needed.
+  auto sockets =
+      SQL::selectAllFrom("process_open_sockets", "remote_port", EQUALS, "0");
+#endif
 
   PortMap ports;
   for (const auto& socket : sockets) {
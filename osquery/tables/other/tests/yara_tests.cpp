@@ -8,14 +8,19 @@
  *
  */
 
+#include <boost/filesystem.hpp>
+
 #include <gtest/gtest.h>
 
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 
 #include "osquery/tables/other/yara_utils.h"
 
 namespace osquery {
 
+DECLARE_string(yara_rules_cache);
+
 const std::string ruleFile = "/tmp/osquery-yara.sig";
 const std::string ls = "/bin/ls";
 const std::string alwaysTrue = "rule always_true { condition: true }";
@@ -73,4 +78,77 @@ TEST_F(YARATest, test_match_false) {
   // Should have 0 count
   EXPECT_TRUE(r["count"] == "0");
 }
+
+TEST_F(YARATest, test_scan_yara_file) {
+  YR_RULES* rules = nullptr;
+  EXPECT_EQ(yr_initialize(), ERROR_SUCCESS);
+  writeTextFile(ruleFile, alwaysTrue);
+  ASSERT_TRUE(compileSingleFile(ruleFile, &rules).ok());
+
+  Row r;
+  r["count"] = "0";
+  r["matches"] = "";
+  auto status = scanYARAFile(rules, ls, r);
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(r["count"], "1");
+  EXPECT_EQ(r["matches"], "always_true");
+
+  // Only regular files are scanned.
+  Row special;
+  EXPECT_FALSE(scanYARAFile(rules, "/dev/null", special).ok());
+  EXPECT_FALSE(scanYARAFile(rules, "/tmp", special).ok());
+
+  yr_rules_destroy(rules);
+}
+
+TEST_F(YARATest, test_load_rule_files) {
+  EXPECT_EQ(yr_initialize(), ERROR_SUCCESS);
+  auto cache = FLAGS_yara_rules_cache;
+  FLAGS_yara_rules_cache = "/tmp/osquery-yara-cache";
+  boost::filesystem::remove_all(FLAGS_yara_rules_cache);
+
+  writeTextFile(ruleFile, alwaysTrue);
+  std::string key;
+  ASSERT_TRUE(getRuleFilesKey({ruleFile}, key).ok());
+  EXPECT_FALSE(key.empty());
+
+  // Compiled rules are saved by content key, then loaded.
+  YARARules rules;
+  ASSERT_TRUE(loadRuleFiles({ruleFile}, key, rules).ok());
+  auto saved = FLAGS_yara_rules_cache + "/" + key + ".yarc";
+  EXPECT_TRUE(pathExists(saved).ok());
+
+  YARARules loaded;
+  ASSERT_TRUE(loadRuleFiles({ruleFile}, key, loaded).ok());
+  Row r;
+  r["count"] = "0";
+  r["matches"] = "";
+  EXPECT_TRUE(scanYARAFile(loaded.get(), ls, r).ok());
+  EXPECT_EQ(r["count"], "1");
+
+  // A group is only replaced when its content changes.
+  YARAConfigParserPlugin parser;
+  ASSERT_TRUE(parser.loadRules("group", {ruleFile}).ok());
+  auto version = parser.version();
+  auto group_rules = parser.getRules("group");
+  ASSERT_TRUE(parser.loadRules("group", {ruleFile}).ok());
+  EXPECT_EQ(parser.version(), version);
+  EXPECT_EQ(parser.getRules("group"), group_rules);
+
+  // Groups with the same content share rules.
+  ASSERT_TRUE(parser.loadRules("other", {ruleFile}).ok());
+  EXPECT_EQ(parser.getRules("other"), group_rules);
+
+  writeTextFile(ruleFile, alwaysFalse);
+  std::string changed;
+  ASSERT_TRUE(getRuleFilesKey({ruleFile}, changed).ok());
+  EXPECT_NE(changed, key);
+  ASSERT_TRUE(parser.loadRules("group", {ruleFile}).ok());
+  EXPECT_GT(parser.version(), version);
+  EXPECT_NE(parser.getRules("group"), group_rules);
+  EXPECT_EQ(parser.getRules("missing"), nullptr);
+
+  boost::filesystem::remove_all(FLAGS_yara_rules_cache);
+  FLAGS_yara_rules_cache = cache;
+}
 }
@@ -8,9 +8,14 @@
  *
  */
 
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
 #include <boost/filesystem.hpp>
 
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 #include <osquery/status.h>
@@ -23,13 +28,53 @@
 #include <yara.h>
 
 namespace osquery {
+
+FLAG(uint64,
+     yara_scan_threads,
+     4,
+     "Number of threads scanning files for the yara table, 1 to disable");
+
+FLAG(uint64,
+     yara_cache_max,
+     50000,
+     "Most yara table results kept for unchanged files, 0 to disable");
+
 namespace tables {
 
-void doYARAScan(YR_RULES* rules,
-                const std::string& path,
-                QueryData& results,
-                const std::string& group,
-                const std::string& sigfile) {
+/// YARA limits the concurrent scans using one set of rules.
+const size_t kYARAMaxScanThreads = 16;
+
+/// A scan result, reused while the file and the rules are unchanged.
+struct YARAScanResult {
+  /// The file's change key, see getFileChangeKey.
+  std::string file;
+
+  /// The version of the configured rules.
+  size_t version;
+
+  Row row;
+};
+
+/// Scan results by path and signature group.
+static std::map<std::string, YARAScanResult> kYARAScanResults;
+
+/// Protect the scan results.
+static Mutex kYARAScanResultsMutex;
+
+/// A path to scan with a signature group, and the resulting row.
+struct YARAScan {
+  std::string path;
+  std::string group;
+  YARARules rules;
+
+  /// The file's change key before the scan, empty if results are not kept.
+  std::string file;
+
+  bool done{false};
+  Row row;
+};
+
+static void doYARAScan(YARAScan& scan, size_t version) {
   Row r;
 
   // These are default values, to be updated in YARACallback.
@@ -39,15 +84,80 @@ void doYARAScan(YR_RULES* rules,
   r["tags"] = std::string("");
 
   // This could use target_path instead to be consistent with yara_events.
-  r["path"] = path;
-  r["sig_group"] = std::string(group);
-  r["sigfile"] = std::string(sigfile);
+  r["path"] = scan.path;
+  r["sig_group"] = scan.group;
+  r["sigfile"] = scan.group;
 
   // Perform the scan, using the static YARA subscriber callback.
-  int result = yr_rules_scan_file(
-      rules, path.c_str(), SCAN_FLAGS_FAST_MODE, YARACallback, (void*)&r, 0);
-  if (result == ERROR_SUCCESS) {
-    results.push_back(std::move(r));
+  if (!scanYARAFile(scan.rules.get(), scan.path, r).ok()) {
+    return;
+  }
+  scan.done = true;
+  scan.row = std::move(r);
+
+  // Only keep the result if the file did not change while it was scanned.
+  std::string after;
+  if (scan.file.empty() || !getFileChangeKey(scan.path, after) ||
+      after != scan.file) {
+    return;
+  }
+
+  WriteLock lock(kYARAScanResultsMutex);
+  if (kYARAScanResults.size() >= FLAGS_yara_cache_max) {
+    kYARAScanResults.clear();
+  }
+  kYARAScanResults[scan.path + "\n" + scan.group] = {
+      scan.file, version, scan.row};
+}
+
+/// Scan the paths that do not have a kept result, using a pool of threads.
+static void doYARAScans(std::vector<YARAScan>& scans, size_t version) {
+  if (FLAGS_yara_cache_max > 0) {
+    for (auto& scan : scans) {
+      getFileChangeKey(scan.path, scan.file);
+    }
+
+    WriteLock lock(kYARAScanResultsMutex);
+    for (auto& scan : scans) {
+      if (scan.file.empty()) {
+        continue;
+      }
+      auto result = kYARAScanResults.find(scan.path + "\n" + scan.group);
+      if (result != kYARAScanResults.end() &&
+          result->second.file == scan.file &&
+          result->second.version == version) {
+        scan.done = true;
+        scan.row = result->second.row;
+      }
+    }
+  }
+
+  std::atomic<size_t> cursor(0);
+  auto scanner = [&scans, &cursor, version]() {
+    while (true) {
+      auto index = cursor.fetch_add(1);
+      if (index >= scans.size()) {
+        break;
+      }
+      if (!scans[index].done) {
+        doYARAScan(scans[index], version);
+      }
+    }
+  };
+
+  auto threads = std::max<size_t>(FLAGS_yara_scan_threads, 1);
+  threads = std::min({threads, kYARAMaxScanThreads, scans.size()});
+  std::vector<std::thread> scanners;
+  for (size_t i = 1; i < threads; i++) {
+    scanners.emplace_back([&scanner]() {
+      scanner();
+      // YARA keeps per-thread state for each scanning thread.
+      yr_finalize_thread();
+    });
+  }
+  scanner();
+  for (auto& thread : scanners) {
+    thread.join();
   }
 }
 
@@ -61,26 +171,11 @@ QueryData genYara(QueryContext& context) {
     return results;
   }
 
-  // This could be abstracted into a common "get rules for group" function.
-  auto parser = Config::getParser("yara");
-  if (parser == nullptr || parser.get() == nullptr) {
+  auto yaraParser = getYARAParser();
+  if (yaraParser == nullptr) {
     LOG(ERROR) << "YARA config parser plugin has no pointer";
     return results;
   }
-
-  std::shared_ptr<YARAConfigParserPlugin> yaraParser = nullptr;
-  try {
-    yaraParser = std::dynamic_pointer_cast<YARAConfigParserPlugin>(parser);
-  } catch (const std::bad_cast& e) {
-    LOG(ERROR) << "Error casting yara config parser plugin";
-    return results;
-  }
-  if (yaraParser == nullptr || yaraParser.get() == nullptr) {
-    LOG(ERROR) << "YARA config parser plugin has no pointer";
-    return results;
-  }
-  auto& rules = yaraParser->rules();
-
   // Collect all paths specified too.
   auto paths = context.constraints["path"].getAll(EQUALS);
   context.expandConstraints(
@@ -104,34 +199,47 @@ QueryData genYara(QueryContext& context) {
 
   // Compile all sigfiles into a map.
   for (const auto& file : sigfiles) {
-    // Check if this "ad-hoc" signature file has not been used/compiled.
-    if (rules.count(file) == 0) {
-      // If this is a relative path append the default yara search path.
-      auto path = (file[0] != '/') ? std::string("/etc/osquery/yara/") : "";
-      path += file;
-
-      YR_RULES* tmp_rules = nullptr;
-      auto status = compileSingleFile(path, &tmp_rules);
-      if (!status.ok()) {
-        VLOG(1) << "YARA compile error: " << status.toString();
-        continue;
-      }
-      // Cache the compiled rules by setting the unique signature file path
-      // as the lookup name. Additional signature file uses will skip the
-      // compile step and be added as rule groups.
-      rules[file] = tmp_rules;
+    // If this is a relative path append the default yara search path.
+    auto path = (file[0] != '/') ? std::string("/etc/osquery/yara/") : "";
+    path += file;
+
+    // Cache the compiled rules by setting the unique signature file path
+    // as the lookup name. Additional signature file uses will skip the
+    // compile step, until the file changes, and be added as rule groups.
+    auto status = yaraParser->loadRules(file, {path});
+    if (!status.ok()) {
+      VLOG(1) << "YARA compile error: " << status.toString();
+      continue;
     }
     // Assemble an "ad-hoc" group using the signature file path as the name.
     groups.insert(file);
   }
 
-  // Scan every path pair.
+  // Scan every path pair, using the signature groups.
+  std::map<std::string, YARARules> rules;
+  for (const auto& group : groups) {
+    auto group_rules = yaraParser->getRules(group);
+    if (group_rules != nullptr) {
+      rules[group] = group_rules;
+    }
+  }
+
+  auto version = yaraParser->version();
+  std::vector<YARAScan> scans;
   for (const auto& path : paths) {
-    // Scan using the signature groups.
-    for (const auto& group : groups) {
-      if (rules.count(group) > 0) {
-        doYARAScan(rules[group], path.c_str(), results, group, group);
-      }
+    for (const auto& group : rules) {
+      YARAScan scan;
+      scan.path = path;
+      scan.group = group.first;
+      scan.rules = group.second;
+      scans.push_back(std::move(scan));
+    }
+  }
+
+  doYARAScans(scans, version);
+  for (auto& scan : scans) {
+    if (scan.done) {
+      results.push_back(std::move(scan.row));
     }
   }
 
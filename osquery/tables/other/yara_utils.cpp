@@ -8,16 +8,33 @@
  *
  */
 
+#include <atomic>
 #include <map>
 #include <string>
 
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <osquery/config.h>
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
+#include <osquery/hash.h>
 #include <osquery/logger.h>
 
 #include "osquery/tables/other/yara_utils.h"
 
 namespace osquery {
 
+FLAG(string,
+     yara_rules_cache,
+     "/var/osquery/yara",
+     "Directory of compiled YARA rules by signature content, empty to disable");
+
+FLAG(uint64,
+     yara_scan_timeout,
+     60,
+     "Seconds a YARA scan of one file may take, 0 for no limit");
+
 /**
  * The callback used when there are compilation problems in the rules.
  */
@@ -103,12 +120,11 @@ Status compileSingleFile(const std::string &file, YR_RULES **rules) {
 }
 
 /**
- * Given a vector of strings, attempt to compile them and store the result
- * in the map under the given category.
+ * Given a vector of strings, attempt to compile them into a single set of
+ * rules.
  */
-Status handleRuleFiles(const std::string &category,
-                       const pt::ptree &rule_files,
-                       std::map<std::string, YR_RULES *> &rules) {
+static Status compileRuleFiles(const std::vector<std::string> &files,
+                               YR_RULES **rules) {
   YR_COMPILER *compiler = nullptr;
   int result = yr_compiler_create(&compiler);
   if (result != ERROR_SUCCESS) {
@@ -119,12 +135,9 @@ Status handleRuleFiles(const std::string &category,
   yr_compiler_set_callback(compiler, YARACompilerCallback, nullptr);
 
   bool compiled = false;
-  for (const auto &item : rule_files) {
+  *rules = nullptr;
+  for (const auto &rule : files) {
     YR_RULES *tmp_rules = nullptr;
-    auto rule = item.second.get("", "");
-    if (rule[0] != '/') {
-      rule = std::string("/etc/osquery/yara/") + rule;
-    }
 
     // First attempt to load the file, in case it is saved (pre-compiled)
     // rules. Sadly there is no way to load multiple compiled rules in
@@ -144,14 +157,17 @@ Status handleRuleFiles(const std::string &category,
     result = yr_rules_load(rule.c_str(), &tmp_rules);
     if (result != ERROR_SUCCESS && result != ERROR_INVALID_FILE) {
       yr_compiler_destroy(compiler);
+      if (*rules != nullptr) {
+        yr_rules_destroy(*rules);
+      }
       return Status(1, "YARA load error " + std::to_string(result));
     } else if (result == ERROR_SUCCESS) {
       // If there are already rules there, destroy them and put new ones in.
-      if (rules.count(category) > 0) {
-        yr_rules_destroy(rules[category]);
+      if (*rules != nullptr) {
+        yr_rules_destroy(*rules);
       }
 
-      rules[category] = tmp_rules;
+      *rules = tmp_rules;
     } else {
       compiled = true;
       // Try to compile the rules.
@@ -159,6 +175,9 @@ Status handleRuleFiles(const std::string &category,
 
       if (rule_file == nullptr) {
         yr_compiler_destroy(compiler);
+        if (*rules != nullptr) {
+          yr_rules_destroy(*rules);
+        }
         return Status(1, "Could not open file: " + rule);
       }
 
@@ -170,6 +189,9 @@ Status handleRuleFiles(const std::string &category,
 
       if (errors > 0) {
         yr_compiler_destroy(compiler);
+        if (*rules != nullptr) {
+          yr_rules_destroy(*rules);
+        }
         // Errors printed via callback.
         return Status(1, "Compilation errors");
       }
@@ -177,8 +199,13 @@ Status handleRuleFiles(const std::string &category,
   }
 
   if (compiled) {
-    // All the rules for this category have been compiled, save them in the map.
-    result = yr_compiler_get_rules(compiler, &rules[category]);
+    if (*rules != nullptr) {
+      yr_rules_destroy(*rules);
+      *rules = nullptr;
+    }
+
+    // All the rules for this category have been compiled.
+    result = yr_compiler_get_rules(compiler, rules);
 
     if (result != ERROR_SUCCESS) {
       yr_compiler_destroy(compiler);
@@ -191,9 +218,83 @@ Status handleRuleFiles(const std::string &category,
     compiler = nullptr;
   }
 
+  if (*rules == nullptr) {
+    return Status(1, "No YARA rules");
+  }
+  return Status(0, "OK");
+}
+
+/// Number the temporary files of concurrent saves.
+static std::atomic<size_t> kRulesSaves(0);
+
+/// The rules cache directory, if it exists or was created and is private.
+static bool getRulesCacheDirectory(std::string &directory) {
+  if (FLAGS_yara_rules_cache.empty()) {
+    return false;
+  }
+
+  directory = FLAGS_yara_rules_cache;
+  ::mkdir(directory.c_str(), 0700);
+
+  // Saved rules are trusted, they cannot be writable by other users.
+  struct stat dir_stat;
+  if (::lstat(directory.c_str(), &dir_stat) != 0 ||
+      !S_ISDIR(dir_stat.st_mode) || dir_stat.st_uid != ::geteuid() ||
+      (dir_stat.st_mode & (S_IWGRP | S_IWOTH)) != 0) {
+    VLOG(1) << "Not using YARA rules cache: " << directory;
+    return false;
+  }
+  return true;
+}
+
+Status getRuleFilesKey(const std::vector<std::string> &files,
+                       std::string &key) {
+  std::string content;
+  for (const auto &file : files) {
+    auto digest = hashFromFile(HASH_TYPE_SHA256, file);
+    if (digest.empty()) {
+      return Status(1, "Could not read file: " + file);
+    }
+    content += file + "\n" + digest + "\n";
+  }
+  key = hashFromBuffer(HASH_TYPE_SHA256, content.data(), content.size());
   return Status(0, "OK");
 }
 
+Status loadRuleFiles(const std::vector<std::string> &files,
+                     const std::string &key,
+                     YARARules &rules) {
+  std::string directory;
+  auto cached = getRulesCacheDirectory(directory);
+  auto path = directory + "/" + key + ".yarc";
+
+  YR_RULES *tmp_rules = nullptr;
+  if (cached && yr_rules_load(path.c_str(), &tmp_rules) == ERROR_SUCCESS) {
+    VLOG(1) << "Loaded cached YARA rules: " << path;
+    rules = YARARules(tmp_rules, yr_rules_destroy);
+    return Status(0, "OK");
+  }
+
+  auto status = compileRuleFiles(files, &tmp_rules);
+  if (!status.ok()) {
+    return status;
+  }
+
+  // Saving relocates the rules in place, they are not yet used by a scan.
+  if (cached) {
+    auto temp_path = path + "." + std::to_string(::getpid()) + "." +
+                     std::to_string(kRulesSaves++);
+    if (yr_rules_save(tmp_rules, temp_path.c_str()) != ERROR_SUCCESS ||
+        ::rename(temp_path.c_str(), path.c_str()) != 0) {
+      VLOG(1) << "Could not save YARA rules: " << path;
+      ::unlink(temp_path.c_str());
+    }
+  }
+
+  rules = YARARules(tmp_rules, yr_rules_destroy);
+  return status;
+}
+
 /**
  * This is the YARA callback. Used to store matching rules in the row which is
  * passed in as user_data.
@@ -240,6 +341,101 @@ int YARACallback(int message, void *message_data, void *user_data) {
   return CALLBACK_CONTINUE;
 }
 
+Status scanYARAFile(YR_RULES* rules, const std::string& path, Row& r) {
+  // YARA could not map a special file either.
+  struct stat file_stat;
+  if (::stat(path.c_str(), &file_stat) != 0 || !S_ISREG(file_stat.st_mode)) {
+    return Status(1, "Not a regular file: " + path);
+  }
+
+  auto timeout = static_cast<int>(FLAGS_yara_scan_timeout);
+  int result = ERROR_SUCCESS;
+  bool scanned = false;
+  auto scan = ([&](boost::string_ref content) {
+    scanned = true;
+    result = yr_rules_scan_mem(rules,
+                               reinterpret_cast<const uint8_t*>(content.data()),
+                               content.size(),
+                               SCAN_FLAGS_FAST_MODE,
+                               YARACallback,
+                               (void*)&r,
+                               timeout);
+  });
+
+  readFileView(path, 4096, false, scan);
+  if (!scanned) {
+    result = yr_rules_scan_file(rules,
+                                path.c_str(),
+                                SCAN_FLAGS_FAST_MODE,
+                                YARACallback,
+                                (void*)&r,
+                                timeout);
+  }
+
+  if (result != ERROR_SUCCESS) {
+    return Status(1, "YARA error: " + std::to_string(result));
+  }
+  return Status(0, "OK");
+}
+
+YARARules YARAConfigParserPlugin::getRules(const std::string &group) {
+  WriteLock lock(rules_mutex_);
+  auto rules = rules_.find(group);
+  if (rules == rules_.end()) {
+    return nullptr;
+  }
+  return rules->second;
+}
+
+Status YARAConfigParserPlugin::loadRules(
+    const std::string &group, const std::vector<std::string> &files) {
+  std::string key;
+  auto status = getRuleFilesKey(files, key);
+  if (!status.ok()) {
+    return status;
+  }
+
+  YARARules rules;
+  {
+    WriteLock lock(rules_mutex_);
+    auto current = keys_.find(group);
+    if (current != keys_.end() && current->second == key) {
+      return Status(0, "OK");
+    }
+
+    // Another group may use the same signature files.
+    for (const auto &other : keys_) {
+      if (other.second == key) {
+        rules = rules_[other.first];
+        break;
+      }
+    }
+  }
+
+  if (rules == nullptr) {
+    VLOG(1) << "Compiling YARA signature group: " << group;
+    status = loadRuleFiles(files, key, rules);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+
+  // Scans using the replaced rules keep them until they return.
+  WriteLock lock(rules_mutex_);
+  rules_[group] = rules;
+  keys_[group] = key;
+  version_++;
+  return Status(0, "OK");
+}
+
+std::shared_ptr<YARAConfigParserPlugin> getYARAParser() {
+  auto parser = Config::getParser("yara");
+  if (parser == nullptr) {
+    return nullptr;
+  }
+  return std::dynamic_pointer_cast<YARAConfigParserPlugin>(parser);
+}
+
 Status YARAConfigParserPlugin::setUp() {
   int result = yr_initialize();
   if (result != ERROR_SUCCESS) {
@@ -260,8 +456,16 @@ Status YARAConfigParserPlugin::update(const std::string &source,
     const auto &signatures = yara_config.get_child("signatures");
     data_.add_child("signatures", signatures);
     for (const auto &element : signatures) {
-      VLOG(1) << "Compiling YARA signature group: " << element.first;
-      auto status = handleRuleFiles(element.first, element.second, rules_);
+      std::vector<std::string> files;
+      for (const auto &item : element.second) {
+        auto rule = item.second.get("", "");
+        if (rule[0] != '/') {
+          rule = std::string("/etc/osquery/yara/") + rule;
+        }
+        files.push_back(std::move(rule));
+      }
+
+      auto status = loadRules(element.first, files);
       if (!status.ok()) {
         VLOG(1) << "YARA rule compile error: " << status.getMessage();
         return status;
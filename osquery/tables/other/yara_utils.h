@@ -8,6 +8,9 @@
  *
  */
 
+#include <atomic>
+#include <memory>
+
 #include <osquery/config.h>
 #include <osquery/tables.h>
 
@@ -28,12 +31,47 @@ void YARACompilerCallback(int error_level,
 
 Status compileSingleFile(const std::string& file, YR_RULES** rule);
 
-Status handleRuleFiles(const std::string& category,
-                       const pt::ptree& rule_files,
-                       std::map<std::string, YR_RULES*>& rules);
+/// Compiled rules, destroyed when the last user releases them.
+using YARARules = std::shared_ptr<YR_RULES>;
+
+/**
+ * @brief Get the content key of a set of signature files.
+ *
+ * The key is a digest of each file's path and content, the content digest
+ * is reused while the file is unchanged, see hashFromFile.
+ */
+Status getRuleFilesKey(const std::vector<std::string>& files,
+                       std::string& key);
+
+/**
+ * @brief Get the compiled rules of a set of signature files.
+ *
+ * Rules compiled from source are saved in `--yara_rules_cache` by content
+ * key, and are loaded instead of compiled while the files are unchanged.
+ *
+ * @param files the signature file paths, sources or saved rules.
+ * @param key the files' content key, see getRuleFilesKey.
+ * @param rules the output compiled rules.
+ */
+Status loadRuleFiles(const std::vector<std::string>& files,
+                     const std::string& key,
+                     YARARules& rules);
 
 int YARACallback(int message, void* message_data, void* user_data);
 
+/**
+ * @brief Scan a file with a set of rules, matches are added to the row.
+ *
+ * The content is scanned in place from a read-only mapping, see
+ * readFileView. Files that cannot be read this way, such as files over the
+ * read limits, are scanned by YARA. A scan stops after
+ * `--yara_scan_timeout` seconds.
+ *
+ * Scans may run concurrently. The rules must not be replaced until they
+ * return.
+ */
+Status scanYARAFile(YR_RULES* rules, const std::string& path, Row& r);
+
 /**
  * @brief A simple ConfigParserPlugin for a "yara" dictionary key.
  *
@@ -49,16 +87,41 @@ class YARAConfigParserPlugin : public ConfigParserPlugin {
   /// Request a single "yara" top level key.
   std::vector<std::string> keys() const override { return {"yara"}; }
 
-  // Retrieve compiled rules.
-  std::map<std::string, YR_RULES*>& rules() { return rules_; }
+  /// Retrieve a signature group's compiled rules, nullptr if not compiled.
+  YARARules getRules(const std::string& group);
+
+  /**
+   * @brief Compile, or reuse, the rules of a signature group.
+   *
+   * The group's rules are only replaced when the content of its files
+   * changes. Rules with the same content are shared by groups, such as an
+   * "ad-hoc" signature file used by the yara table and a configured group.
+   */
+  Status loadRules(const std::string& group,
+                   const std::vector<std::string>& files);
+
+  /// Incremented each time a signature group's rules are replaced.
+  size_t version() const { return version_; }
 
   Status setUp() override;
 
  private:
   // Store compiled rules in a map (group => rules).
-  std::map<std::string, YR_RULES*> rules_;
+  std::map<std::string, YARARules> rules_;
+
+  /// The content key of each group's rules, see loadRuleFiles.
+  std::map<std::string, std::string> keys_;
+
+  /// Protect the compiled rules, scans hold their own references.
+  Mutex rules_mutex_;
+
+  /// See version, scan results of older rules are not reused.
+  std::atomic<size_t> version_{0};
 
   /// Store the signatures and file_paths and compile the rules.
   Status update(const std::string& source, const ParserConfig& config) override;
 };
+
+/// Get the YARA config parser, nullptr if it is not registered.
+std::shared_ptr<YARAConfigParserPlugin> getYARAParser();
 }
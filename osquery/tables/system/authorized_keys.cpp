@@ -16,6 +16,7 @@
 #include <osquery/filesystem.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/tables/system/file_rows_cache.h"
 #include "osquery/tables/system/system_utils.h"
 
 namespace osquery {
@@ -24,45 +25,56 @@ namespace tables {
 const std::vector<std::string> kSSHAuthorizedkeys = {".ssh/authorized_keys",
                                                      ".ssh/authorized_keys2"};
 
+static Status parseSSHKeysFile(const std::string& path, QueryData& rows) {
+  std::string keys_content;
+  auto status = osquery::forensicReadFile(path, keys_content);
+  if (!status.ok()) {
+    return status;
+  }
+
+  // Protocol 1 public key consist of: options, bits, exponent, modulus,
+  // comment; Protocol 2 public key consist of: options, keytype,
+  // base64-encoded key, comment.
+  for (const auto& line : split(keys_content, "\n")) {
+    if (!line.empty() && line[0] != '#') {
+      Row r;
+      r["key"] = line;
+      r["key_file"] = path;
+      rows.push_back(r);
+    }
+  }
+  return Status(0, "OK");
+}
+
 void genSSHkeysForUser(const std::string& uid,
                        const std::string& directory,
                        QueryData& results) {
+  static FileRowsCache kAuthorizedKeysCache;
+
   for (const auto& kfile : kSSHAuthorizedkeys) {
     boost::filesystem::path keys_file = directory;
     keys_file /= kfile;
 
-    std::string keys_content;
-    if (!osquery::forensicReadFile(keys_file, keys_content).ok()) {
+    QueryData keys;
+    if (!kAuthorizedKeysCache.get(keys_file.string(), parseSSHKeysFile, keys)
+             .ok()) {
       // Cannot read a specific keys file.
       continue;
     }
-    // Protocol 1 public key consist of: options, bits, exponent, modulus,
-    // comment; Protocol 2 public key consist of: options, keytype,
-    // base64-encoded key, comment.
-    for (const auto& line : split(keys_content, "\n")) {
-      if (!line.empty() && line[0] != '#') {
-        Row r;
-        r["uid"] = uid;
-        r["key"] = line;
-        r["key_file"] = keys_file.string();
-        results.push_back(r);
-      }
+
+    // The cached rows are shared by every user of a keys file.
+    for (auto& r : keys) {
+      r["uid"] = uid;
+      results.push_back(std::move(r));
     }
   }
 }
 
 QueryData getAuthorizedKeys(QueryContext& context) {
-  QueryData results;
-
-  // Iterate over each user
-  QueryData users = usersFromContext(context);
-  for (const auto& row : users) {
-    if (row.count("uid") > 0 && row.count("directory") > 0) {
-      genSSHkeysForUser(row.at("uid"), row.at("directory"), results);
-    }
-  }
-
-  return results;
+  return genRowsForUsers(context, ([](const Row& user, QueryData& results) {
+                           genSSHkeysForUser(
+                               user.at("uid"), user.at("directory"), results);
+                         }));
 }
 }
 }
@@ -18,6 +18,7 @@
 #include <osquery/logger.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/tables/system/file_rows_cache.h"
 
 namespace osquery {
 namespace tables {
@@ -97,13 +98,18 @@ void genCronLine(const std::string& path,
   results.push_back(r);
 }
 
+static Status parseCronFile(const std::string& path, QueryData& rows) {
+  for (const auto& line : cronFromFile(path)) {
+    genCronLine(path, line, rows);
+  }
+  return Status(0, "OK");
+}
+
 QueryData genCronTab(QueryContext& context) {
-  QueryData results;
+  static FileRowsCache kCronCache;
 
-  auto system_lines = cronFromFile(kSystemCron);
-  for (const auto& line : system_lines) {
-    genCronLine(kSystemCron, line, results);
-  }
+  QueryData results;
+  kCronCache.get(kSystemCron, parseCronFile, results);
 
   std::vector<std::string> user_crons;
   for (const auto cron_path : kUserCronPaths) {
@@ -112,10 +118,7 @@ QueryData genCronTab(QueryContext& context) {
 
   // The user-based crons are identified by their path.
   for (const auto& user_path : user_crons) {
-    auto user_lines = cronFromFile(user_path);
-    for (const auto& line : user_lines) {
-      genCronLine(user_path, line, results);
-    }
+    kCronCache.get(user_path, parseCronFile, results);
   }
 
   return results;
@@ -8,6 +8,11 @@
  *
  */
 
+#include <map>
+#include <unordered_map>
+
+#include <boost/noncopyable.hpp>
+
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
@@ -16,76 +21,144 @@
 namespace osquery {
 namespace tables {
 
-void genIOKitDevice(const io_service_t& device,
-                    const io_service_t& parent,
+/// The attributes of a registry entry, constant while the entry exists.
+struct IOKitEntry {
+  std::string name;
+  std::string device_class;
+  std::string device_path;
+  bool service{false};
+};
+
+/// A registry plane's entries, and its last walk.
+struct IOKitPlane {
+  /// Entry attributes by registry entry ID, from the last walk.
+  std::unordered_map<uint64_t, IOKitEntry> entries;
+
+  /// The last walk's rows, and the retained entry of each row.
+  QueryData rows;
+  std::vector<io_registry_entry_t> devices;
+
+  /// The hardware generation of the last walk.
+  size_t generation{0};
+};
+
+/**
+ * @brief Registry walks, reusing what is known about each entry.
+ *
+ * An entry's name, class, and path are read once, later walks only read the
+ * registry entry IDs of the plane's entries. The busy state and retain count
+ * change and are read when their columns are used.
+ *
+ * A plane's last walk is also kept, and used again instead of walking while
+ * TablePlugin::watchingHardware reports no hardware changes. The IOKit
+ * publisher's matching and termination notifications count changes for
+ * devices, not for user clients, so only the DeviceTree plane is reused.
+ */
+class IOKitRegistryCache : private boost::noncopyable {
+ public:
+  virtual ~IOKitRegistryCache();
+
+  /// The process's shared cache.
+  static IOKitRegistryCache& get();
+
+  /// Generate the rows of a plane's entries.
+  void genPlane(const io_name_t plane,
+                bool reuse,
+                const QueryContext& context,
+                QueryData& results);
+
+ private:
+  /// Walk a plane from the root, replacing the plane's last walk.
+  void walk(const io_name_t plane, bool dynamic, IOKitPlane& cached);
+
+  /// Walk an entry's children depth first, in the order of the rows.
+  void walkChildren(const io_registry_entry_t& service,
+                    uint64_t parent_id,
                     const io_name_t plane,
                     int depth,
-                    QueryData& results) {
-  Row r;
-  io_name_t name, device_class;
-  auto kr = IORegistryEntryGetName(device, name);
-  if (kr == KERN_SUCCESS) {
-    r["name"] = std::string(name);
+                    bool dynamic,
+                    IOKitPlane& previous,
+                    IOKitPlane& cached);
+
+  /// Read the busy state and retain count of a row's entry.
+  void genDynamicColumns(const io_registry_entry_t& device, Row& r) const;
+
+  /// Release the retained entries of a plane's last walk.
+  void release(IOKitPlane& cached) const;
+
+ private:
+  std::map<std::string, IOKitPlane> planes_;
+
+  /// Protect the planes, both tables may be queried together.
+  Mutex mutex_;
+};
+
+IOKitRegistryCache::~IOKitRegistryCache() {
+  for (auto& plane : planes_) {
+    release(plane.second);
   }
+}
 
-  // Get the device class.
-  kr = IOObjectGetClass(device, device_class);
-  if (kr == KERN_SUCCESS) {
-    r["class"] = std::string(device_class);
+IOKitRegistryCache& IOKitRegistryCache::get() {
+  static IOKitRegistryCache cache;
+  return cache;
+}
+
+void IOKitRegistryCache::release(IOKitPlane& cached) const {
+  for (const auto& device : cached.devices) {
+    IOObjectRelease(device);
   }
+  cached.devices.clear();
+  cached.rows.clear();
+}
 
-  // The entry into the registry is the ID, and is used for children as parent.
-  uint64_t device_id, parent_id;
-  kr = IORegistryEntryGetRegistryEntryID(device, &device_id);
+void IOKitRegistryCache::genDynamicColumns(const io_registry_entry_t& device,
+                                           Row& r) const {
+  uint32_t busy_state;
+  auto kr = IOServiceGetBusyState(device, &busy_state);
   if (kr == KERN_SUCCESS) {
-    r["id"] = BIGINT(device_id);
+    r["busy_state"] = INTEGER(busy_state);
   } else {
-    r["id"] = "-1";
+    r["busy_state"] = "0";
   }
 
-  kr = IORegistryEntryGetRegistryEntryID(parent, &parent_id);
+  auto retain_count = IOObjectGetKernelRetainCount(device);
+  r["retain_count"] = INTEGER(retain_count);
+}
+
+static void genIOKitEntry(const io_service_t& device, IOKitEntry& entry) {
+  io_name_t name, device_class;
+  auto kr = IORegistryEntryGetName(device, name);
   if (kr == KERN_SUCCESS) {
-    r["parent"] = BIGINT(parent_id);
-  } else {
-    r["parent"] = "-1";
+    entry.name = std::string(name);
   }
 
-  r["depth"] = INTEGER(depth);
+  // Get the device class.
+  kr = IOObjectGetClass(device, device_class);
+  if (kr == KERN_SUCCESS) {
+    entry.device_class = std::string(device_class);
+  }
 
   if (IORegistryEntryInPlane(device, kIODeviceTreePlane)) {
     io_string_t device_path;
     kr = IORegistryEntryGetPath(device, kIODeviceTreePlane, device_path);
     if (kr == KERN_SUCCESS) {
       // Remove the "IODeviceTree:" from the device tree path.
-      r["device_path"] = std::string(device_path).substr(13);
+      entry.device_path = std::string(device_path).substr(13);
     }
   }
 
-  // Fill in service bits and busy/latency time.
-  if (IOObjectConformsTo(device, "IOService")) {
-    r["service"] = "1";
-  } else {
-    r["service"] = "0";
-  }
-
-  uint32_t busy_state;
-  kr = IOServiceGetBusyState(device, &busy_state);
-  if (kr == KERN_SUCCESS) {
-    r["busy_state"] = INTEGER(busy_state);
-  } else {
-    r["busy_state"] = "0";
-  }
-
-  auto retain_count = IOObjectGetKernelRetainCount(device);
-  r["retain_count"] = INTEGER(retain_count);
-
-  results.push_back(r);
+  // Fill in service bits.
+  entry.service = IOObjectConformsTo(device, "IOService");
 }
 
-void genIOKitDeviceChildren(const io_registry_entry_t& service,
-                            const io_name_t plane,
-                            int depth,
-                            QueryData& results) {
+void IOKitRegistryCache::walkChildren(const io_registry_entry_t& service,
+                                      uint64_t parent_id,
+                                      const io_name_t plane,
+                                      int depth,
+                                      bool dynamic,
+                                      IOKitPlane& previous,
+                                      IOKitPlane& cached) {
   io_iterator_t it;
   auto kr = IORegistryEntryGetChildIterator(service, plane, &it);
   if (kr != KERN_SUCCESS) {
@@ -94,38 +167,113 @@ void genIOKitDeviceChildren(const io_registry_entry_t& service,
 
   io_service_t device;
   while ((device = IOIteratorNext(it))) {
-    // Use this entry as the parent, and generate a result row.
-    genIOKitDevice(device, service, plane, depth, results);
-    genIOKitDeviceChildren(device, plane, depth + 1, results);
-    IOObjectRelease(device);
+    // The entry into the registry is the ID, and is used for children as
+    // parent.
+    Row r;
+    uint64_t device_id = 0;
+    kr = IORegistryEntryGetRegistryEntryID(device, &device_id);
+    if (kr == KERN_SUCCESS) {
+      r["id"] = BIGINT(device_id);
+    } else {
+      r["id"] = "-1";
+    }
+    r["parent"] = (parent_id != 0) ? BIGINT(parent_id) : "-1";
+    r["depth"] = INTEGER(depth);
+
+    // Only entries new since the last walk are read.
+    auto known = previous.entries.find(device_id);
+    auto& entry = cached.entries[device_id];
+    if (kr == KERN_SUCCESS && known != previous.entries.end()) {
+      entry = std::move(known->second);
+    } else {
+      genIOKitEntry(device, entry);
+    }
+
+    r["name"] = entry.name;
+    r["class"] = entry.device_class;
+    if (!entry.device_path.empty()) {
+      r["device_path"] = entry.device_path;
+    }
+    r["service"] = (entry.service) ? "1" : "0";
+
+    if (dynamic) {
+      genDynamicColumns(device, r);
+    } else {
+      r["busy_state"] = "0";
+      r["retain_count"] = "0";
+    }
+
+    // The entry is retained with its row.
+    cached.rows.push_back(std::move(r));
+    cached.devices.push_back(device);
+    walkChildren(device,
+                 (kr == KERN_SUCCESS) ? device_id : 0,
+                 plane,
+                 depth + 1,
+                 dynamic,
+                 previous,
+                 cached);
   }
 
   IOObjectRelease(it);
 }
 
-QueryData genIOKitDeviceTree(QueryContext& context) {
-  QueryData results;
+void IOKitRegistryCache::walk(const io_name_t plane,
+                              bool dynamic,
+                              IOKitPlane& cached) {
+  IOKitPlane previous;
+  std::swap(previous, cached);
+  release(previous);
+
+  // A change while walking leaves the walk out of date.
+  cached.generation = TablePlugin::hardwareGeneration();
 
   // Get the IO registry root node.
   auto service = IORegistryGetRootEntry(kIOMasterPortDefault);
+  uint64_t root_id = 0;
+  IORegistryEntryGetRegistryEntryID(service, &root_id);
 
-  // Begin recursing along the IODeviceTree "plane".
-  genIOKitDeviceChildren(service, kIODeviceTreePlane, 0, results);
-
+  // Begin recursing along the plane, entries not seen again are dropped.
+  walkChildren(service, root_id, plane, 0, dynamic, previous, cached);
   IOObjectRelease(service);
-  return results;
 }
 
-QueryData genIOKitRegistry(QueryContext& context) {
-  QueryData results;
+void IOKitRegistryCache::genPlane(const io_name_t plane,
+                                  bool reuse,
+                                  const QueryContext& context,
+                                  QueryData& results) {
+  auto dynamic = context.isAnyColumnUsed({"busy_state", "retain_count"});
 
-  // Get the IO registry root node.
-  auto service = IORegistryGetRootEntry(kIOMasterPortDefault);
+  WriteLock lock(mutex_);
+  auto& cached = planes_[plane];
+  if (!reuse || !TablePlugin::watchingHardware() || cached.rows.empty() ||
+      cached.generation != TablePlugin::hardwareGeneration()) {
+    walk(plane, dynamic, cached);
+  } else if (dynamic) {
+    // The rows are current, their changing columns are read again.
+    for (size_t i = 0; i < cached.rows.size(); i++) {
+      genDynamicColumns(cached.devices[i], cached.rows[i]);
+    }
+  }
 
-  // Begin recursing along the IODeviceTree "plane".
-  genIOKitDeviceChildren(service, kIOServicePlane, 0, results);
+  results = cached.rows;
+  if (!reuse) {
+    // Only the attributes are kept for the next walk.
+    release(cached);
+  }
+}
 
-  IOObjectRelease(service);
+QueryData genIOKitDeviceTree(QueryContext& context) {
+  QueryData results;
+  auto& cache = IOKitRegistryCache::get();
+  cache.genPlane(kIODeviceTreePlane, true, context, results);
+  return results;
+}
+
+QueryData genIOKitRegistry(QueryContext& context) {
+  QueryData results;
+  auto& cache = IOKitRegistryCache::get();
+  cache.genPlane(kIOServicePlane, false, context, results);
   return results;
 }
 }
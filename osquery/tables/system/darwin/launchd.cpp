@@ -19,6 +19,7 @@
 #include <osquery/tables.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/tables/system/file_rows_cache.h"
 
 namespace fs = boost::filesystem;
 namespace pt = boost::property_tree;
@@ -94,6 +95,8 @@ void genLaunchdItem(const pt::ptree& tree,
 }
 
 QueryData genLaunchd(QueryContext& context) {
+  static FileRowsCache kLaunchdCache;
+
   QueryData results;
 
   std::vector<std::string> launchers;
@@ -113,6 +116,14 @@ QueryData genLaunchd(QueryContext& context) {
   // Keeping the data structure in a larger scope preserves allocations
   // between similar-sized trees.
   pt::ptree tree;
+  auto parser = [&tree](const std::string& path, QueryData& rows) {
+    auto status = osquery::parsePlist(path, tree);
+    if (status.ok()) {
+      // Using the parsed plist, pull out each set of interesting keys.
+      genLaunchdItem(tree, path, rows);
+    }
+    return status;
+  };
 
   // For each found launcher (plist in known paths) parse the plist.
   for (const auto& path : launchers) {
@@ -121,13 +132,10 @@ QueryData genLaunchd(QueryContext& context) {
       continue;
     }
 
-    if (!osquery::parsePlist(path, tree).ok()) {
+    // Unchanged plists reuse the rows from their last parse.
+    if (!kLaunchdCache.get(path, parser, results).ok()) {
       TLOG << "Error parsing launch daemon/agent plist: " << path;
-      continue;
     }
-
-    // Using the parsed plist, pull out each set of interesting keys.
-    genLaunchdItem(tree, path, results);
   }
 
   return results;
@@ -8,12 +8,22 @@
  *
  */
 
+#include <string.h>
+
+#include <unordered_map>
+
+#include <boost/utility/string_ref.hpp>
+
+#include <osquery/database.h>
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/hash.h>
 #include <osquery/sql.h>
 #include <osquery/tables.h>
 
+#include "osquery/core/conversions.h"
+
 // Package BOM structure headers
 #include "osquery/tables/system/darwin/packages.h"
 
@@ -21,6 +31,12 @@ namespace fs = boost::filesystem;
 namespace pt = boost::property_tree;
 
 namespace osquery {
+
+FLAG(bool,
+     package_bom_cache,
+     true,
+     "Cache the parsed file lists of package BOMs until they change");
+
 namespace tables {
 
 const std::vector<std::string> kPkgReceiptPaths = {
@@ -145,14 +161,25 @@ const BOMPaths* BOM::getPaths(int index) const {
   return paths;
 }
 
-void genBOMPaths(const std::string& path,
-                 const BOM& bom,
+/// A file or directory listed in a BOM's paths tree.
+struct BOMEntry {
+  std::string filepath;
+  uint32_t uid;
+  uint32_t gid;
+  uint32_t mode;
+  uint32_t size;
+  uint32_t modified_time;
+};
+
+void genBOMPaths(const BOM& bom,
                  const BOMPaths* paths,
-                 QueryData& results) {
-  std::map<uint32_t, std::string> filenames;
-  std::map<uint32_t, uint32_t> parents;
+                 std::vector<BOMEntry>& entries) {
+  // The full path of each BOM file id, parents are listed before children.
+  std::unordered_map<uint32_t, std::string> filenames;
 
-  while (paths != nullptr) {
+  // A malformed BOM may link its leaves in a cycle.
+  size_t leaves = 0;
+  while (paths != nullptr && leaves++ <= ntohl(bom.Table->count)) {
     for (unsigned j = 0; j < ntohs(paths->count); j++) {
       uint32_t index0 = paths->indices[j].index0;
       uint32_t index1 = paths->indices[j].index1;
@@ -176,30 +203,28 @@ void genBOMPaths(const std::string& path,
         // Invalid BOMFile structure or size out of bounds.
         return;
       }
-      std::string filename(file->name, file_size - sizeof(BOMFile));
-      filename = std::string(filename.c_str());
 
-      // Maintain a lookup from BOM file index to filename.
-      filenames[info1->id] = filename;
+      // The name is nul-terminated within the pointer's size.
+      auto name_size = file_size - sizeof(BOMFile);
+      auto name_end = (const char*)memchr(file->name, 0, name_size);
+      std::string filename(file->name,
+                           (name_end != nullptr) ? name_end - file->name
+                                                 : name_size);
       if (file->parent) {
-        parents[info1->id] = file->parent;
-      }
-
-      auto it = parents.find(info1->id);
-      while (it != parents.end()) {
-        filename = filenames[it->second] + "/" + filename;
-        it = parents.find(it->second);
+        auto parent = filenames.find(file->parent);
+        filename = ((parent != filenames.end()) ? parent->second : "") + "/" +
+                   filename;
       }
+      filenames[info1->id] = filename;
 
-      Row r;
-      r["filepath"] = filename;
-      r["uid"] = INTEGER(ntohl(info2->user));
-      r["gid"] = INTEGER(ntohl(info2->group));
-      r["mode"] = INTEGER(ntohs(info2->mode));
-      r["size"] = INTEGER(ntohl(info2->size));
-      r["modified_time"] = INTEGER(ntohl(info2->modtime));
-      r["path"] = path;
-      results.push_back(r);
+      BOMEntry entry;
+      entry.filepath = std::move(filename);
+      entry.uid = ntohl(info2->user);
+      entry.gid = ntohl(info2->group);
+      entry.mode = ntohs(info2->mode);
+      entry.size = ntohl(info2->size);
+      entry.modified_time = ntohl(info2->modtime);
+      entries.push_back(std::move(entry));
     }
 
     if (paths->forward == htonl(0)) {
@@ -210,15 +235,11 @@ void genBOMPaths(const std::string& path,
   }
 }
 
-void genPackageBOM(const std::string& path, QueryData& results) {
-  std::string content;
-  // Read entire BOM file.
-  if (!forensicReadFile(path, content).ok()) {
-    return;
-  }
-
+/// Parse the paths tree of a BOM file's content.
+static void parsePackageBOM(boost::string_ref content,
+                            std::vector<BOMEntry>& entries) {
   // Create a BOM representation.
-  BOM bom(content.c_str(), content.size());
+  BOM bom(content.data(), content.size());
   if (!bom.isValid()) {
     return;
   }
@@ -246,28 +267,177 @@ void genPackageBOM(const std::string& path, QueryData& results) {
 
     const BOMTree* tree = (const BOMTree*)var_data;
     auto paths = bom.getPaths(tree->child);
-    while (paths != nullptr && paths->isLeaf == htons(0)) {
-      if ((BOMPathIndices*)paths->indices == nullptr) {
+    size_t depth = 0;
+    while (paths != nullptr && paths->isLeaf == htons(0) &&
+           depth++ <= ntohl(bom.Table->count)) {
+      if ((BOMPathIndices*)paths->indices == nullptr ||
+          paths->count == htons(0)) {
+        paths = nullptr;
         break;
       }
       paths = bom.getPaths(paths->indices[0].index0);
     }
 
-    genBOMPaths(path, bom, paths, results);
+    if (paths != nullptr && paths->isLeaf != htons(0)) {
+      genBOMPaths(bom, paths, entries);
+    }
     break;
   }
 }
 
+/// The version of the cached BOM entry encoding.
+const std::string kBOMCacheVersion = "1";
+
+/**
+ * @brief Encode parsed BOM entries for the database.
+ *
+ * The value is the version and the receipt's change key, each followed by a
+ * newline, then each entry's five 32-bit fields in host order followed by
+ * its nul-terminated path. BOM file names cannot contain a nul.
+ */
+static std::string encodeBOMEntries(const std::string& change_key,
+                                    const std::vector<BOMEntry>& entries) {
+  std::string value = kBOMCacheVersion + "\n" + change_key + "\n";
+  for (const auto& entry : entries) {
+    uint32_t fields[] = {
+        entry.uid, entry.gid, entry.mode, entry.size, entry.modified_time};
+    value.append(reinterpret_cast<const char*>(fields), sizeof(fields));
+    value.append(entry.filepath.c_str(), entry.filepath.size() + 1);
+  }
+  return value;
+}
+
+/// Decode cached BOM entries, false if the cache is for another change key.
+static bool decodeBOMEntries(const std::string& value,
+                             const std::string& change_key,
+                             std::vector<BOMEntry>& entries) {
+  auto header = kBOMCacheVersion + "\n" + change_key + "\n";
+  if (value.compare(0, header.size(), header) != 0) {
+    return false;
+  }
+
+  size_t offset = header.size();
+  uint32_t fields[5];
+  while (offset < value.size()) {
+    if (value.size() - offset < sizeof(fields)) {
+      return false;
+    }
+    memcpy(fields, value.data() + offset, sizeof(fields));
+    offset += sizeof(fields);
+
+    auto end = value.find('\0', offset);
+    if (end == std::string::npos) {
+      return false;
+    }
+
+    BOMEntry entry;
+    entry.filepath = value.substr(offset, end - offset);
+    entry.uid = fields[0];
+    entry.gid = fields[1];
+    entry.mode = fields[2];
+    entry.size = fields[3];
+    entry.modified_time = fields[4];
+    entries.push_back(std::move(entry));
+    offset = end + 1;
+  }
+  return true;
+}
+
+/// Read the entries of a BOM file, parsing it only if it has changed.
+static void getPackageBOMEntries(const std::string& path,
+                                 std::vector<BOMEntry>& entries) {
+  std::string change_key;
+  bool cached = FLAGS_package_bom_cache && getFileChangeKey(path, change_key);
+  auto key = "package_bom." + path;
+  if (cached) {
+    std::string value;
+    if (getDatabaseValue(kPersistentSettings, key, value).ok() &&
+        decodeBOMEntries(value, change_key, entries)) {
+      return;
+    }
+    entries.clear();
+  }
+
+  // Parse the BOM in place from a read-only mapping.
+  auto status = readFileView(path,
+                             4096,
+                             true,
+                             ([&entries](boost::string_ref content) {
+                               parsePackageBOM(content, entries);
+                             }));
+  if (status.ok() && cached) {
+    setDatabaseValue(
+        kPersistentSettings, key, encodeBOMEntries(change_key, entries));
+  }
+}
+
+void genPackageBOM(const std::string& path,
+                   const std::vector<Constraint>& filepaths,
+                   QueryData& results) {
+  std::vector<BOMEntry> entries;
+  getPackageBOMEntries(path, entries);
+  for (const auto& entry : entries) {
+    // Only EQUALS and LIKE are checked, SQLite applies all constraints.
+    bool matches = true;
+    for (const auto& constraint : filepaths) {
+      if ((constraint.op == EQUALS && constraint.expr != entry.filepath) ||
+          (constraint.op == LIKE &&
+           !likeMatches(constraint.expr, entry.filepath))) {
+        matches = false;
+        break;
+      }
+    }
+    if (!matches) {
+      continue;
+    }
+
+    Row r;
+    r["filepath"] = entry.filepath;
+    r["uid"] = INTEGER(entry.uid);
+    r["gid"] = INTEGER(entry.gid);
+    r["mode"] = INTEGER(entry.mode);
+    r["size"] = INTEGER(entry.size);
+    r["modified_time"] = INTEGER(entry.modified_time);
+    r["path"] = path;
+    results.push_back(std::move(r));
+  }
+}
+
 QueryData genPackageBOM(QueryContext& context) {
   QueryData results;
-  if (context.constraints["path"].exists(EQUALS)) {
-    // If an explicit path was given, generate and return.
-    auto paths = context.constraints["path"].getAll(EQUALS);
-    for (const auto& path : paths) {
-      genPackageBOM(path, results);
+
+  // Resolve receipt paths for EQUALS and LIKE operations.
+  auto paths = context.constraints["path"].getAll(EQUALS);
+  context.expandConstraints(
+      "path",
+      LIKE,
+      paths,
+      ([&](const std::string& pattern, std::set<std::string>& out) {
+        std::vector<std::string> patterns;
+        auto status =
+            resolveFilePattern(pattern, patterns, GLOB_FILES | GLOB_NO_CANON);
+        if (status.ok()) {
+          for (const auto& resolved : patterns) {
+            out.insert(resolved);
+          }
+        }
+        return status;
+      }));
+
+  std::vector<Constraint> filepaths;
+  if (context.constraints.count("filepath") > 0) {
+    for (const auto& constraint :
+         context.constraints["filepath"].getAll()) {
+      if (constraint.op == EQUALS || constraint.op == LIKE) {
+        filepaths.push_back(constraint);
+      }
     }
   }
 
+  for (const auto& path : paths) {
+    genPackageBOM(path, filepaths, results);
+  }
+
   return results;
 }
 
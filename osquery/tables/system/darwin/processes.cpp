@@ -8,8 +8,11 @@
  *
  */
 
+#include <algorithm>
+#include <atomic>
 #include <map>
 #include <set>
+#include <thread>
 
 #include <libproc.h>
 #include <mach/mach.h>
@@ -22,14 +25,24 @@
 
 #include <osquery/core.h>
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
 namespace fs = boost::filesystem;
 
 namespace osquery {
+
+FLAG(uint64,
+     proc_scan_threads,
+     4,
+     "Number of threads reading process details, 1 to disable");
+
 namespace tables {
 
+/// The number of pids a collecting thread takes at a time.
+const size_t kProcScanBatch = 32;
+
 // The maximum number of expected memory regions per process.
 #define MAX_MEMORY_MAPS 512
 
@@ -184,12 +197,24 @@ struct proc_args {
   std::map<std::string, std::string> env;
 };
 
-proc_args getProcRawArgs(int pid, size_t argmax) {
+/**
+ * @brief Read a process's arguments and environment.
+ *
+ * The buffer is reused between calls, a collecting thread sizes it to the
+ * max args space once.
+ */
+proc_args getProcRawArgs(int pid, std::vector<char> &buffer) {
   proc_args args;
   uid_t euid = geteuid();
-  char procargs[argmax];
+  if (buffer.empty()) {
+    buffer.resize(genMaxArgs());
+  }
+
+  char *procargs = buffer.data();
+  size_t argmax = buffer.size();
   int mib[3] = {CTL_KERN, KERN_PROCARGS2, pid};
-  if (sysctl(mib, 3, &procargs, &argmax, nullptr, 0) == -1 || argmax == 0) {
+  if (argmax == 0 || sysctl(mib, 3, procargs, &argmax, nullptr, 0) == -1 ||
+      argmax < sizeof(int)) {
     if (euid == 0) {
       TLOG << "An error occurred retrieving the env for pid: " << pid;
     }
@@ -202,17 +227,18 @@ proc_args getProcRawArgs(int pid, size_t argmax) {
   // Walk the \0-tokenized list of arguments until reaching the returned 'max'
   // number of arguments or the number appended to the front.
   const char *current_arg = &procargs[0] + sizeof(nargs);
+  const char *end = &procargs[argmax];
   // Then skip the exec/program name.
-  auto exec_name = std::string(current_arg);
-  current_arg += exec_name.size() + 1;
-  while (current_arg < &procargs[argmax]) {
+  current_arg += strnlen(current_arg, end - current_arg) + 1;
+  while (current_arg < end) {
     // Skip optional null-character padding.
     if (*current_arg == '\0') {
       current_arg++;
       continue;
     }
 
-    auto string_arg = std::string(current_arg);
+    auto string_arg =
+        std::string(current_arg, strnlen(current_arg, end - current_arg));
     if (string_arg.size() > 0) {
       if (nargs > 0) {
         // The first nargs are CLI arguments, afterward they are environment.
@@ -231,92 +257,151 @@ proc_args getProcRawArgs(int pid, size_t argmax) {
   return args;
 }
 
-QueryData genProcesses(QueryContext &context) {
-  QueryData results;
-
-  // Initialize time conversions.
-  static mach_timebase_info_data_t time_base;
-  if (time_base.denom == 0) {
-    mach_timebase_info(&time_base);
+static void genProcess(int pid,
+                       const QueryContext &context,
+                       const mach_timebase_info_data_t &time_base,
+                       std::vector<char> &buffer,
+                       QueryData &results) {
+  // The credentials are always read, they also skip processes that exited.
+  proc_cred cred;
+  if (!getProcCred(pid, cred)) {
+    return;
   }
 
-  auto pidlist = getProcList(context);
-  int argmax = genMaxArgs();
-
-  for (auto &pid : pidlist) {
-    Row r;
-    r["pid"] = INTEGER(pid);
+  Row r;
+  r["pid"] = INTEGER(pid);
+  r["parent"] = BIGINT(cred.parent);
+  r["pgroup"] = BIGINT(cred.group);
+  // check if process state is one of the expected ones
+  r["state"] = (1 <= cred.status && cred.status <= 5)
+                   ? TEXT(kProcessStateMapping[cred.status])
+                   : TEXT('?');
+  r["nice"] = INTEGER(cred.nice);
+  r["uid"] = BIGINT(cred.real.uid);
+  r["gid"] = BIGINT(cred.real.gid);
+  r["euid"] = BIGINT(cred.effective.uid);
+  r["egid"] = BIGINT(cred.effective.gid);
+  r["suid"] = BIGINT(cred.saved.uid);
+  r["sgid"] = BIGINT(cred.saved.gid);
+
+  if (context.isAnyColumnUsed({"path", "name", "on_disk"})) {
     r["path"] = getProcPath(pid);
     // OS X proc_name only returns 16 bytes, use the basename of the path.
     r["name"] = fs::path(r["path"]).filename().string();
+    // If the path of the executable that started the process is available
+    // and the path exists on disk, set on_disk to 1. If the path is not
+    // available, set on_disk to -1. If, and only if, the path of the
+    // executable is available and the file does NOT exist on disk, set
+    // on_disk to 0.
+    r["on_disk"] = osquery::pathExists(r["path"]).toString();
+  } else {
+    r["path"] = "";
+    r["name"] = "";
+    r["on_disk"] = "-1";
+  }
 
-    {
-      // The command line invocation including arguments.
-      auto args = getProcRawArgs(pid, argmax);
-      std::string cmdline = boost::algorithm::join(args.args, " ");
-      r["cmdline"] = cmdline;
-    }
+  if (context.isColumnUsed("cmdline")) {
+    // The command line invocation including arguments.
+    auto args = getProcRawArgs(pid, buffer);
+    r["cmdline"] = boost::algorithm::join(args.args, " ");
+  } else {
+    r["cmdline"] = "";
+  }
 
-    // The process relative root and current working directory.
+  // The process relative root and current working directory.
+  if (context.isAnyColumnUsed({"cwd", "root"})) {
     genProcRootAndCWD(pid, r);
+  } else {
+    r["cwd"] = "";
+    r["root"] = "";
+  }
 
-    proc_cred cred;
-    if (getProcCred(pid, cred)) {
-      r["parent"] = BIGINT(cred.parent);
-      r["pgroup"] = BIGINT(cred.group);
-      // check if process state is one of the expected ones
-      r["state"] = (1 <= cred.status && cred.status <= 5)
-                       ? TEXT(kProcessStateMapping[cred.status])
-                       : TEXT('?');
-      r["nice"] = INTEGER(cred.nice);
-      r["uid"] = BIGINT(cred.real.uid);
-      r["gid"] = BIGINT(cred.real.gid);
-      r["euid"] = BIGINT(cred.effective.uid);
-      r["egid"] = BIGINT(cred.effective.gid);
-      r["suid"] = BIGINT(cred.saved.uid);
-      r["sgid"] = BIGINT(cred.saved.gid);
-    } else {
-      continue;
-    }
+  // systems usage and time information
+  struct rusage_info_v2 rusage_info_data;
+  int rusage_status = -1;
+  if (context.isAnyColumnUsed({"wired_size",
+                               "resident_size",
+                               "phys_footprint",
+                               "user_time",
+                               "system_time",
+                               "start_time"})) {
+    rusage_status = proc_pid_rusage(
+        pid, RUSAGE_INFO_V2, (rusage_info_t *)&rusage_info_data);
+  }
+  // proc_pid_rusage returns -1 if it was unable to gather information
+  if (rusage_status == 0) {
+    // size/memory information
+    r["wired_size"] = TEXT(rusage_info_data.ri_wired_size);
+    r["resident_size"] = TEXT(rusage_info_data.ri_resident_size);
+    r["phys_footprint"] = TEXT(rusage_info_data.ri_phys_footprint);
+
+    // time information
+    r["user_time"] = TEXT(rusage_info_data.ri_user_time / CPU_TIME_RATIO);
+    r["system_time"] = TEXT(rusage_info_data.ri_system_time / CPU_TIME_RATIO);
+    // Convert the time in CPU ticks since boot to seconds.
+    // This is relative to time not-sleeping since boot.
+    r["start_time"] =
+        TEXT((rusage_info_data.ri_proc_start_abstime / START_TIME_RATIO) *
+             time_base.numer / time_base.denom);
+  } else {
+    r["wired_size"] = "-1";
+    r["resident_size"] = "-1";
+    r["phys_footprint"] = "-1";
+    r["user_time"] = "-1";
+    r["system_time"] = "-1";
+    r["start_time"] = "-1";
+  }
 
-    // If the path of the executable that started the process is available and
-    // the path exists on disk, set on_disk to 1. If the path is not
-    // available, set on_disk to -1. If, and only if, the path of the
-    // executable is available and the file does NOT exist on disk, set on_disk
-    // to 0.
-    r["on_disk"] = osquery::pathExists(r["path"]).toString();
+  results.push_back(std::move(r));
+}
 
-    // systems usage and time information
-    struct rusage_info_v2 rusage_info_data;
-    int rusage_status = proc_pid_rusage(
-        pid, RUSAGE_INFO_V2, (rusage_info_t *)&rusage_info_data);
-    // proc_pid_rusage returns -1 if it was unable to gather information
-    if (rusage_status == 0) {
-      // size/memory information
-      r["wired_size"] = TEXT(rusage_info_data.ri_wired_size);
-      r["resident_size"] = TEXT(rusage_info_data.ri_resident_size);
-      r["phys_footprint"] = TEXT(rusage_info_data.ri_phys_footprint);
-
-      // time information
-      r["user_time"] = TEXT(rusage_info_data.ri_user_time / CPU_TIME_RATIO);
-      r["system_time"] = TEXT(rusage_info_data.ri_system_time / CPU_TIME_RATIO);
-      // Convert the time in CPU ticks since boot to seconds.
-      // This is relative to time not-sleeping since boot.
-      r["start_time"] =
-          TEXT((rusage_info_data.ri_proc_start_abstime / START_TIME_RATIO) *
-               time_base.numer / time_base.denom);
-    } else {
-      r["wired_size"] = "-1";
-      r["resident_size"] = "-1";
-      r["phys_footprint"] = "-1";
-      r["user_time"] = "-1";
-      r["system_time"] = "-1";
-      r["start_time"] = "-1";
+QueryData genProcesses(QueryContext &context) {
+  QueryData results;
+
+  // Initialize time conversions.
+  static mach_timebase_info_data_t time_base;
+  if (time_base.denom == 0) {
+    mach_timebase_info(&time_base);
+  }
+
+  auto pidlist = getProcList(context);
+  // Fill in the max args space before the collecting threads read it.
+  genMaxArgs();
+
+  // Each process's rows are kept separately to preserve the process order.
+  std::vector<int> pids(pidlist.begin(), pidlist.end());
+  std::vector<QueryData> rows(pids.size());
+  std::atomic<size_t> cursor(0);
+  auto collector = [&]() {
+    std::vector<char> buffer;
+    while (true) {
+      auto start = cursor.fetch_add(kProcScanBatch);
+      if (start >= pids.size()) {
+        break;
+      }
+      auto end = std::min(start + kProcScanBatch, pids.size());
+      for (auto i = start; i < end; i++) {
+        genProcess(pids[i], context, time_base, buffer, rows[i]);
+      }
     }
+  };
 
-    results.push_back(r);
+  auto threads = std::max<size_t>(FLAGS_proc_scan_threads, 1);
+  threads = std::min(threads, pids.size() / kProcScanBatch + 1);
+  std::vector<std::thread> collectors;
+  for (size_t i = 1; i < threads; i++) {
+    collectors.emplace_back(collector);
+  }
+  collector();
+  for (auto &thread : collectors) {
+    thread.join();
   }
 
+  for (auto &process_rows : rows) {
+    std::move(process_rows.begin(),
+              process_rows.end(),
+              std::back_inserter(results));
+  }
   return results;
 }
 
@@ -324,9 +409,9 @@ QueryData genProcessEnvs(QueryContext &context) {
   QueryData results;
 
   auto pidlist = getProcList(context);
-  int argmax = genMaxArgs();
+  std::vector<char> buffer;
   for (const auto &pid : pidlist) {
-    auto args = getProcRawArgs(pid, argmax);
+    auto args = getProcRawArgs(pid, buffer);
     for (const auto &env : args.env) {
       Row r;
       r["pid"] = INTEGER(pid);
@@ -9,6 +9,7 @@
  */
 
 #include <iomanip>
+#include <map>
 #include <sstream>
 
 #include <IOKit/IOKitLib.h>
@@ -17,6 +18,7 @@
 #include <boost/format.hpp>
 #include <boost/noncopyable.hpp>
 
+#include <osquery/core.h>
 #include <osquery/tables.h>
 
 namespace osquery {
@@ -288,6 +290,15 @@ const std::map<std::string, std::string> kSMCKeyDescriptions = {
     {"PDTR", "DC In Total"},
     {"PSTR", "System Total"}};
 
+/**
+ * @brief A shared connection to the AppleSMC service.
+ *
+ * The SMC tables are polled often and read the same keys on each query. The
+ * connection is opened once and kept, and the key set and each key's type
+ * information, which do not change until a reboot, are read once. A key read
+ * is then a single service call, and the keys the SMC does not know are not
+ * called again.
+ */
 class SMCHelper : private boost::noncopyable {
  public:
   virtual ~SMCHelper() {
@@ -296,22 +307,26 @@ class SMCHelper : private boost::noncopyable {
     }
   }
 
+  /// The process's shared helper.
+  static SMCHelper &get();
+
   /**
    * @brief Open the IOKit master port, device driver, and service.
    *
    * This will find the userland SMC interface driver and open the service.
-   * It will remain open until the helper is deleted.
+   * It will remain open until the helper is deleted, an open helper is not
+   * opened again.
    */
   bool open();
 
   /// Shutdown the IOKit connection.
-  void close() { IOServiceClose(connection_); }
+  void close();
 
   /// Read a given SMC key into an output parameter value.
-  bool read(const std::string &key, SMCValue_t *val) const;
+  bool read(const std::string &key, SMCValue_t *val);
 
   /// Read all keys (a service API call) into a string vector.
-  std::vector<std::string> getKeys() const;
+  std::vector<std::string> getKeys();
 
  private:
   /// Perform an API call to the IOKit AppleSMC service.
@@ -319,17 +334,47 @@ class SMCHelper : private boost::noncopyable {
                      SMCKeyData_t *in,
                      SMCKeyData_t *out) const;
 
+  /// Read a key's size and type, cached for later reads.
+  bool getKeyInfo(UInt32 key, SMCKeyDataKeyInfo_t &info);
+
   /// Read the size of the internal SMC key structure.
-  size_t getKeysCount() const;
+  size_t getKeysCount();
 
  private:
   /// IOKit master port.
   mach_port_t master_port_{0};
   /// IOKit service connection.
   io_connect_t connection_{0};
+
+  /// The type information of read keys, a zero size if the key is unknown.
+  std::map<UInt32, SMCKeyDataKeyInfo_t> key_info_;
+
+  /// The enumerated keys, empty until they are first read.
+  std::vector<std::string> keys_;
+
+  /// Protect the connection and caches, the tables may be queried together.
+  Mutex mutex_;
 };
 
+SMCHelper &SMCHelper::get() {
+  static SMCHelper smc;
+  return smc;
+}
+
+void SMCHelper::close() {
+  WriteLock lock(mutex_);
+  if (connection_ != 0) {
+    IOServiceClose(connection_);
+    connection_ = 0;
+  }
+}
+
 bool SMCHelper::open() {
+  WriteLock lock(mutex_);
+  if (connection_ != 0) {
+    return true;
+  }
+
   auto result = IOMasterPort(MACH_PORT_NULL, &master_port_);
   if (result != kIOReturnSuccess) {
     return false;
@@ -356,6 +401,7 @@ bool SMCHelper::open() {
   result = IOServiceOpen(device, mach_task_self(), 0, &connection_);
   IOObjectRelease(device);
   if (result != kIOReturnSuccess) {
+    connection_ = 0;
     return false;
   }
 
@@ -421,32 +467,75 @@ float getConvertedValue(const std::string &smcType, const std::string &smcVal) {
   return convertedVal;
 }
 
-bool SMCHelper::read(const std::string &key, SMCValue_t *val) const {
+bool SMCHelper::getKeyInfo(UInt32 key, SMCKeyDataKeyInfo_t &info) {
+  auto cached = key_info_.find(key);
+  if (cached != key_info_.end()) {
+    info = cached->second;
+    return true;
+  }
+
   SMCKeyData_t in;
   SMCKeyData_t out;
 
   memset(&in, 0, sizeof(SMCKeyData_t));
   memset(&out, 0, sizeof(SMCKeyData_t));
-  memset(val, 0, sizeof(SMCValue_t));
 
-  in.key = strtoul(key.c_str(), 4, 16);
-  memcpy(val->key.bytes, key.c_str(), 4);
+  in.key = key;
   in.data8 = SMCCMDType::READ_KEYINFO;
 
   auto result = call(KERNEL_INDEX_SMC, &in, &out);
   if (result != kIOReturnSuccess) {
+    // The service call failed, the key is not known to be missing.
+    return false;
+  }
+
+  // An unknown key's information has a zero size, it is cached as well.
+  info = out.keyInfo;
+  if (out.result != 0) {
+    info.dataSize = 0;
+  }
+  key_info_[key] = info;
+  return true;
+}
+
+bool SMCHelper::read(const std::string &key, SMCValue_t *val) {
+  memset(val, 0, sizeof(SMCValue_t));
+  if (key.size() < 4) {
+    return false;
+  }
+  memcpy(val->key.bytes, key.c_str(), 4);
+
+  WriteLock lock(mutex_);
+  if (connection_ == 0) {
+    return false;
+  }
+
+  SMCKeyData_t in;
+  SMCKeyData_t out;
+
+  memset(&in, 0, sizeof(SMCKeyData_t));
+  memset(&out, 0, sizeof(SMCKeyData_t));
+
+  in.key = strtoul(key.c_str(), 4, 16);
+  SMCKeyDataKeyInfo_t info;
+  if (!getKeyInfo(in.key, info)) {
+    return false;
+  }
+
+  val->dataSize = info.dataSize;
+  val->dataType.bytes[0] = (uint32_t)info.dataType >> 24;
+  val->dataType.bytes[1] = (uint32_t)info.dataType >> 16;
+  val->dataType.bytes[2] = (uint32_t)info.dataType >> 8;
+  val->dataType.bytes[3] = (uint32_t)info.dataType;
+  if (info.dataSize == 0) {
+    // The SMC does not know this key, there are no bytes to read.
     return false;
   }
 
-  val->dataSize = out.keyInfo.dataSize;
-  val->dataType.bytes[0] = (uint32_t)out.keyInfo.dataType >> 24;
-  val->dataType.bytes[1] = (uint32_t)out.keyInfo.dataType >> 16;
-  val->dataType.bytes[2] = (uint32_t)out.keyInfo.dataType >> 8;
-  val->dataType.bytes[3] = (uint32_t)out.keyInfo.dataType;
   in.keyInfo.dataSize = val->dataSize;
   in.data8 = SMCCMDType::READ_BYTES;
 
-  result = call(KERNEL_INDEX_SMC, &in, &out);
+  auto result = call(KERNEL_INDEX_SMC, &in, &out);
   if (result != kIOReturnSuccess) {
     return false;
   }
@@ -455,13 +544,20 @@ bool SMCHelper::read(const std::string &key, SMCValue_t *val) const {
   return true;
 }
 
-size_t SMCHelper::getKeysCount() const {
+size_t SMCHelper::getKeysCount() {
   SMCValue_t val;
   read("#KEY", &val);
   return ((int)val.bytes.bytes[2] << 8) + ((unsigned)val.bytes.bytes[3] & 0xff);
 }
 
-std::vector<std::string> SMCHelper::getKeys() const {
+std::vector<std::string> SMCHelper::getKeys() {
+  {
+    WriteLock lock(mutex_);
+    if (!keys_.empty()) {
+      return keys_;
+    }
+  }
+
   std::vector<std::string> keys;
   size_t totalKeys = getKeysCount();
   for (size_t i = 0; i < totalKeys; i++) {
@@ -474,6 +570,10 @@ std::vector<std::string> SMCHelper::getKeys() const {
     in.data8 = SMCCMDType::READ_INDEX;
     in.data32 = i;
 
+    WriteLock lock(mutex_);
+    if (connection_ == 0) {
+      break;
+    }
     auto result = call(KERNEL_INDEX_SMC, &in, &out);
     if (result != kIOReturnSuccess) {
       continue;
@@ -487,11 +587,17 @@ std::vector<std::string> SMCHelper::getKeys() const {
     key.bytes[4] = 0;
     keys.push_back(key.bytes);
   }
+
+  if (keys.size() == totalKeys) {
+    // Only a complete enumeration is reused.
+    WriteLock lock(mutex_);
+    keys_ = keys;
+  }
   return keys;
 }
 
 void genSMCKey(const std::string &key,
-               const SMCHelper &smc,
+               SMCHelper &smc,
                QueryData &results,
                bool hidden = false) {
   Row r;
@@ -519,7 +625,7 @@ void genSMCKey(const std::string &key,
 QueryData genSMCKeys(QueryContext &context) {
   QueryData results;
 
-  SMCHelper smc;
+  auto &smc = SMCHelper::get();
   if (!smc.open()) {
     return {};
   }
@@ -554,7 +660,7 @@ inline QueryData getSMCKeysUsingPredicate(
     const QueryContext &context,
     const std::set<std::string> &keys,
     std::function<void(const Row &r, QueryData &results)> predicate) {
-  SMCHelper smc;
+  auto &smc = SMCHelper::get();
   if (!smc.open()) {
     return {};
   }
@@ -681,7 +787,7 @@ std::string getFanName(const std::string &smcVal) {
 QueryData genFanSpeedSensors(QueryContext &context) {
   QueryData results;
 
-  SMCHelper smc;
+  auto &smc = SMCHelper::get();
   if (!smc.open()) {
     return {};
   }
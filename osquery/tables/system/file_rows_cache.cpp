@@ -0,0 +1,76 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
+
+#include "osquery/tables/system/file_rows_cache.h"
+
+namespace osquery {
+
+FLAG(uint64,
+     table_file_cache_size,
+     4096,
+     "Files each table keeps parsed rows for, 0 to disable the cache");
+
+namespace tables {
+
+Status FileRowsCache::get(const std::string& path,
+                          const Parser& parser,
+                          QueryData& results) {
+  std::string key;
+  bool cacheable =
+      FLAGS_table_file_cache_size > 0 && getFileChangeKey(path, key);
+  if (cacheable) {
+    WriteLock lock(mutex_);
+    auto it = entries_.find(path);
+    if (it != entries_.end() && it->second.key == key) {
+      results.insert(
+          results.end(), it->second.rows.begin(), it->second.rows.end());
+      return Status(0, "OK");
+    }
+  }
+
+  QueryData rows;
+  auto status = parser(path, rows);
+  if (!status.ok()) {
+    return status;
+  }
+
+  // A file changed while it was parsed is parsed again by the next query.
+  std::string parsed_key;
+  if (cacheable && getFileChangeKey(path, parsed_key) && parsed_key == key) {
+    WriteLock lock(mutex_);
+    if (entries_.size() >= FLAGS_table_file_cache_size &&
+        entries_.count(path) == 0) {
+      entries_.erase(entries_.begin());
+    }
+    auto& entry = entries_[path];
+    entry.key = std::move(key);
+    entry.rows = rows;
+  }
+
+  results.insert(results.end(),
+                 std::make_move_iterator(rows.begin()),
+                 std::make_move_iterator(rows.end()));
+  return Status(0, "OK");
+}
+
+void FileRowsCache::clear() {
+  WriteLock lock(mutex_);
+  entries_.clear();
+}
+
+size_t FileRowsCache::size() const {
+  WriteLock lock(mutex_);
+  return entries_.size();
+}
+}
+}
@@ -0,0 +1,74 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <functional>
+#include <string>
+#include <unordered_map>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/core.h>
+#include <osquery/database.h>
+#include <osquery/status.h>
+
+namespace osquery {
+namespace tables {
+
+/**
+ * @brief Rows parsed from files, reused until a file changes.
+ *
+ * Tables that parse small files on every query keep each file's rows by path
+ * along with the file's change key, see getFileChangeKey. A file is parsed
+ * again only once its device, inode, size or times change. A table creates
+ * one static cache; the parser must only produce rows derived from the file,
+ * columns particular to the caller such as a uid are added to the results.
+ *
+ * @code{.cpp}
+ *   static FileRowsCache kHostsCache;
+ *   kHostsCache.get("/etc/hosts", parseEtcHosts, results);
+ * @endcode
+ */
+class FileRowsCache : private boost::noncopyable {
+ public:
+  /// Parse a file's rows, a failure is returned to the caller and not kept.
+  using Parser =
+      std::function<Status(const std::string& path, QueryData& rows)>;
+
+  /**
+   * @brief Append a file's rows, parsing the file if it changed.
+   *
+   * Paths that are not regular files, such as missing files, are always
+   * given to the parser.
+   */
+  Status get(const std::string& path, const Parser& parser, QueryData& results);
+
+  /// Remove every file's rows.
+  void clear();
+
+  /// The number of files with rows.
+  size_t size() const;
+
+ private:
+  /// A file's change key when parsed and its rows.
+  struct Entry {
+    std::string key;
+    QueryData rows;
+  };
+
+  /// Parsed files by path.
+  std::unordered_map<std::string, Entry> entries_;
+
+  /// Several queries may use a table at once.
+  mutable Mutex mutex_;
+};
+}
+}
@@ -16,6 +16,7 @@
 #include <osquery/filesystem.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/tables/system/file_rows_cache.h"
 #include "osquery/tables/system/system_utils.h"
 
 namespace osquery {
@@ -23,43 +24,52 @@ namespace tables {
 
 const std::vector<std::string> kSSHKnownHostskeys = {".ssh/known_hosts"};
 
+static Status parseKnownHostsFile(const std::string& path, QueryData& rows) {
+  std::string keys_content;
+  auto status = forensicReadFile(path, keys_content);
+  if (!status.ok()) {
+    return status;
+  }
+
+  for (const auto& line : split(keys_content, "\n")) {
+    if (!line.empty() && line[0] != '#') {
+      Row r;
+      r["key"] = line;
+      r["key_file"] = path;
+      rows.push_back(r);
+    }
+  }
+  return Status(0, "OK");
+}
+
 void genSSHkeysForHosts(const std::string& uid,
                         const std::string& directory,
                         QueryData& results) {
+  static FileRowsCache kKnownHostsCache;
+
   for (const auto& kfile : kSSHKnownHostskeys) {
     boost::filesystem::path keys_file = directory;
     keys_file /= kfile;
 
-    std::string keys_content;
-    if (!forensicReadFile(keys_file, keys_content).ok()) {
+    QueryData keys;
+    if (!kKnownHostsCache.get(keys_file.string(), parseKnownHostsFile, keys)
+             .ok()) {
       // Cannot read a specific keys file.
       continue;
     }
 
-    for (const auto& line : split(keys_content, "\n")) {
-      if (!line.empty() && line[0] != '#') {
-        Row r;
-        r["uid"] = uid;
-        r["key"] = line;
-        r["key_file"] = keys_file.string();
-        results.push_back(r);
-      }
+    for (auto& r : keys) {
+      r["uid"] = uid;
+      results.push_back(std::move(r));
     }
   }
 }
 
 QueryData getKnownHostsKeys(QueryContext& context) {
-  QueryData results;
-
-  // Iterate over each user
-  auto users = usersFromContext(context);
-  for (const auto& row : users) {
-    if (row.count("uid") > 0 && row.count("directory") > 0) {
-      genSSHkeysForHosts(row.at("uid"), row.at("directory"), results);
-    }
-  }
-
-  return results;
+  return genRowsForUsers(context, ([](const Row& user, QueryData& results) {
+                           genSSHkeysForHosts(
+                               user.at("uid"), user.at("directory"), results);
+                         }));
 }
 }
 }
@@ -8,43 +8,238 @@
  *
  */
 
-#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <map>
 #include <string>
+#include <vector>
 
 #include <utmpx.h>
 
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #include <osquery/core.h>
+#include <osquery/flags.h>
 #include <osquery/tables.h>
 
+#include "osquery/core/conversions.h"
+
 namespace osquery {
+
+FLAG(bool,
+     last_incremental,
+     false,
+     "Only report wtmp entries appended since the last query (Linux)");
+
 namespace tables {
 
+/// A fixed-size record field, which is not terminated when it is full.
+template <size_t N>
+static std::string utmpField(const char (&field)[N]) {
+  return std::string(field, ::strnlen(field, N));
+}
+
+static void genLastRow(const struct utmpx& ut, QueryData& results) {
+  Row r;
+  r["username"] = utmpField(ut.ut_user);
+  r["tty"] = utmpField(ut.ut_line);
+  r["pid"] = INTEGER(ut.ut_pid);
+  r["type"] = INTEGER(ut.ut_type);
+  r["time"] = INTEGER(ut.ut_tv.tv_sec);
+  r["host"] = utmpField(ut.ut_host);
+  results.push_back(std::move(r));
+}
+
+#ifdef __linux__
+
+/// The login records, the glibc utmpx layout is the file's record layout.
+const std::string kWtmpPath = "/var/log/wtmp";
+
+/// Records read from the file at once.
+const size_t kWtmpBlockRecords = 1024;
+
+/// The record following the last reported record of the wtmp file.
+struct WtmpOffset {
+  dev_t device;
+  ino_t inode;
+  off_t record;
+};
+
+/// Offsets of wtmp files, see --last_incremental.
+static std::map<std::string, WtmpOffset> kWtmpOffsets;
+
+/// Protect the wtmp file offsets.
+static Mutex kWtmpOffsetsMutex;
+
+/**
+ * @brief The inclusive range of times the constraints allow.
+ *
+ * The range is unbounded above unless bounded is set. Returns false if no
+ * time may match.
+ */
+static bool getLastTimeRange(QueryContext& context,
+                             long long& min_time,
+                             long long& max_time,
+                             bool& bounded) {
+  min_time = 0;
+  max_time = 0;
+  bounded = false;
+  if (context.constraints.count("time") == 0) {
+    return true;
+  }
+
+  auto lower = [&min_time](long long t) { min_time = std::max(min_time, t); };
+  auto upper = [&max_time, &bounded](long long t) {
+    max_time = (bounded) ? std::min(max_time, t) : t;
+    bounded = true;
+  };
+  for (const auto& constraint : context.constraints["time"].getAll()) {
+    long long time = 0;
+    if (!safeStrtoll(constraint.expr, 10, time).ok()) {
+      continue;
+    }
+
+    if (constraint.op == EQUALS) {
+      lower(time);
+      upper(time);
+    } else if (constraint.op == GREATER_THAN) {
+      lower(time + 1);
+    } else if (constraint.op == GREATER_THAN_OR_EQUALS) {
+      lower(time);
+    } else if (constraint.op == LESS_THAN) {
+      upper(time - 1);
+    } else if (constraint.op == LESS_THAN_OR_EQUALS) {
+      upper(time);
+    }
+  }
+  return !bounded || min_time <= max_time;
+}
+
+/**
+ * @brief Find the first record at or after a time.
+ *
+ * Records are appended in time order, so the record times are searched
+ * between the first and count records. A clock set backwards may hide a
+ * record logged just before the change from a time constraint.
+ */
+static off_t findWtmpRecord(int fd,
+                            off_t first,
+                            off_t count,
+                            long long min_time) {
+  struct utmpx ut;
+  while (first < count) {
+    auto middle = first + (count - first) / 2;
+    if (::pread(fd, &ut, sizeof(ut), middle * sizeof(ut)) !=
+        static_cast<ssize_t>(sizeof(ut))) {
+      break;
+    }
+    if (ut.ut_tv.tv_sec < min_time) {
+      first = middle + 1;
+    } else {
+      count = middle;
+    }
+  }
+  return first;
+}
+
+void genLastAccessFromFile(const std::string& path,
+                           QueryContext& context,
+                           QueryData& results) {
+  long long min_time = 0;
+  long long max_time = 0;
+  bool bounded = false;
+  if (!getLastTimeRange(context, min_time, max_time, bounded)) {
+    return;
+  }
+
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return;
+  }
+
+  struct stat file_stat;
+  if (::fstat(fd, &file_stat) != 0 || !S_ISREG(file_stat.st_mode)) {
+    ::close(fd);
+    return;
+  }
+
+  // A partial record may still be written.
+  off_t count = file_stat.st_size / sizeof(struct utmpx);
+  off_t record = 0;
+  if (FLAGS_last_incremental) {
+    WriteLock lock(kWtmpOffsetsMutex);
+    auto known = kWtmpOffsets.find(path);
+    if (known != kWtmpOffsets.end() &&
+        known->second.device == file_stat.st_dev &&
+        known->second.inode == file_stat.st_ino &&
+        known->second.record <= count) {
+      record = known->second.record;
+    }
+  }
+
+  if (min_time > 0) {
+    record = findWtmpRecord(fd, record, count, min_time);
+  }
+
+  std::vector<struct utmpx> block(kWtmpBlockRecords);
+  bool done = false;
+  while (!done && record < count) {
+    auto records = std::min(static_cast<off_t>(block.size()), count - record);
+    auto bytes = ::pread(fd,
+                         block.data(),
+                         records * sizeof(struct utmpx),
+                         record * sizeof(struct utmpx));
+    if (bytes <= 0) {
+      break;
+    }
+
+    records = bytes / sizeof(struct utmpx);
+    for (off_t i = 0; i < records; i++) {
+      if (bounded && block[i].ut_tv.tv_sec > max_time) {
+        // Later records are reported by a query allowing their times.
+        done = true;
+        break;
+      }
+      genLastRow(block[i], results);
+      record++;
+    }
+    if (records == 0) {
+      break;
+    }
+  }
+  ::close(fd);
+
+  if (FLAGS_last_incremental) {
+    WriteLock lock(kWtmpOffsetsMutex);
+    kWtmpOffsets[path] = {file_stat.st_dev, file_stat.st_ino, record};
+  }
+}
+
+QueryData genLastAccess(QueryContext& context) {
+  QueryData results;
+  genLastAccessFromFile(kWtmpPath, context, results);
+  return results;
+}
+
+#else
+
 QueryData genLastAccess(QueryContext& context) {
   QueryData results;
-  struct utmpx *ut;
+  struct utmpx* ut;
 #ifdef __APPLE__
   setutxent_wtmp(0); // 0 = reverse chronological order
 
   while ((ut = getutxent_wtmp()) != nullptr) {
 #else
-
-#ifndef __FreeBSD__
-  utmpxname("/var/log/wtmpx");
-#endif
   setutxent();
 
   while ((ut = getutxent()) != nullptr) {
 #endif
-
-    Row r;
-    r["username"] = TEXT(ut->ut_user);
-    r["tty"] = TEXT(ut->ut_line);
-    r["pid"] = INTEGER(ut->ut_pid);
-    r["type"] = INTEGER(ut->ut_type);
-    r["time"] = INTEGER(ut->ut_tv.tv_sec);
-    r["host"] = TEXT(ut->ut_host);
-
-    results.push_back(r);
+    genLastRow(*ut, results);
   }
 
 #ifdef __APPLE__
@@ -55,5 +250,7 @@ QueryData genLastAccess(QueryContext& context) {
 
   return results;
 }
+
+#endif
 }
 }
@@ -0,0 +1,72 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
+#include <osquery/registry.h>
+#include <osquery/tables.h>
+
+#include "osquery/filesystem/linux/proc.h"
+
+namespace osquery {
+
+DECLARE_uint64(proc_scan_threads);
+
+static void TABLES_proc_scan(benchmark::State& state) {
+  FLAGS_proc_scan_threads = state.range_x();
+  std::set<std::string> processes;
+  procProcesses(processes);
+  while (state.KeepRunning()) {
+    QueryData results;
+    procScan(processes,
+             [](const ProcessDirectory& process, QueryData& rows) {
+               std::string content;
+               process.read("stat", content);
+               process.read("status", content);
+               rows.push_back({{"pid", process.pid()}});
+             },
+             results);
+  }
+  FLAGS_proc_scan_threads = 4;
+}
+
+BENCHMARK(TABLES_proc_scan)->Arg(1)->Arg(4);
+
+/// Generate a /proc-backed table with a number of scanning threads.
+static void generateProcTable(benchmark::State& state,
+                              const std::string& table) {
+  FLAGS_proc_scan_threads = state.range_x();
+  while (state.KeepRunning()) {
+    PluginResponse res;
+    Registry::call("table", table, {{"action", "generate"}}, res);
+  }
+  FLAGS_proc_scan_threads = 4;
+}
+
+static void TABLES_processes(benchmark::State& state) {
+  generateProcTable(state, "processes");
+}
+
+BENCHMARK(TABLES_processes)->Arg(1)->Arg(4);
+
+static void TABLES_process_open_files(benchmark::State& state) {
+  generateProcTable(state, "process_open_files");
+}
+
+BENCHMARK(TABLES_process_open_files)->Arg(1)->Arg(4);
+
+static void TABLES_process_open_sockets(benchmark::State& state) {
+  generateProcTable(state, "process_open_sockets");
+}
+
+BENCHMARK(TABLES_process_open_sockets)->Arg(1)->Arg(4);
+}
@@ -8,13 +8,11 @@
  *
  */
 
-#include <boost/algorithm/string/predicate.hpp>
-#include <boost/algorithm/string/trim.hpp>
-
-#include "osquery/core/conversions.h"
 #include <osquery/filesystem.h>
 #include <osquery/tables.h>
 
+#include "osquery/core/conversions.h"
+
 namespace osquery {
 namespace tables {
 
@@ -31,12 +29,12 @@ std::vector<std::string> procFromFile(const std::string &path) {
     return {};
   }
 
-  auto lines = split(content, "\n");
   std::vector<std::string> proc_lines;
-  for (auto &line : lines) {
-    boost::trim(line);
-    if (boost::starts_with(line, "cpu")) {
-      proc_lines.push_back(line);
+  Tokenizer lines(content, "\n");
+  boost::string_ref line;
+  while (lines.next(line)) {
+    if (line.starts_with("cpu")) {
+      proc_lines.push_back(line.to_string());
     }
   }
 
@@ -49,43 +47,46 @@ std::vector<std::string> procFromFile(const std::string &path) {
   return proc_lines;
 }
 
-static void genCpuTimeLine(const std::string &line, QueryData &results) {
+static void genCpuTimeLine(const std::string &line,
+                           std::vector<boost::string_ref> &words,
+                           QueryData &results) {
 
-  auto words = osquery::split(line, " ");
+  tokenize(line, " ", words);
 
   if (words.size() < 11) {
     // This probably means there's an error in the /proc/stat file.
     return;
   }
 
-  if (words[0].size() > 3 && words[0].substr(0, 3).compare("cpu") == 0) {
-    words[0].erase(0, 3);
+  if (words[0].size() > 3 && words[0].starts_with("cpu")) {
+    words[0].remove_prefix(3);
   } else {
     // First column must start with "cpu" followed by a number
     return;
   }
   Row r;
-  r["core"] = words[0];
-  r["user"] = words[1];
-  r["nice"] = words[2];
-  r["system"] = words[3];
-  r["idle"] = words[4];
-  r["iowait"] = words[5];
-  r["irq"] = words[6];
-  r["softirq"] = words[7];
-  r["steal"] = words[8];
-  r["guest"] = words[9];
-  r["guest_nice"] = words[10];
-
-  results.push_back(r);
+  r["core"] = words[0].to_string();
+  r["user"] = words[1].to_string();
+  r["nice"] = words[2].to_string();
+  r["system"] = words[3].to_string();
+  r["idle"] = words[4].to_string();
+  r["iowait"] = words[5].to_string();
+  r["irq"] = words[6].to_string();
+  r["softirq"] = words[7].to_string();
+  r["steal"] = words[8].to_string();
+  r["guest"] = words[9].to_string();
+  r["guest_nice"] = words[10].to_string();
+
+  results.push_back(std::move(r));
 }
 
 QueryData genCpuTime(QueryContext &context) {
   QueryData results;
 
   auto proc_lines = procFromFile(kProcStat);
+  std::vector<boost::string_ref> words;
   for (const auto &line : proc_lines) {
-    genCpuTimeLine(line, results);
+    genCpuTimeLine(line, words, results);
   }
 
   return results;
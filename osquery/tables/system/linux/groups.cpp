@@ -9,38 +9,32 @@
  */
 
 #include <set>
-#include <mutex>
-
-#include <grp.h>
+#include <vector>
 
 #include <osquery/core.h>
 #include <osquery/tables.h>
 
+#include "osquery/tables/system/nss_cache.h"
+
 namespace osquery {
 namespace tables {
 
-std::mutex grpEnumerationMutex;
-
 QueryData genGroups(QueryContext &context) {
-  std::lock_guard<std::mutex> lock(grpEnumerationMutex);
   QueryData results;
-  struct group *grp = nullptr;
-  std::set<long> groups_in;
+  std::set<gid_t> groups_in;
 
-  setgrent();
-  while ((grp = getgrent()) != nullptr) {
-    if (std::find(groups_in.begin(), groups_in.end(), grp->gr_gid) ==
-        groups_in.end()) {
+  std::vector<GroupEntry> groups;
+  getAllGroups(groups);
+  for (const auto& group : groups) {
+    if (groups_in.count(group.gid) == 0) {
       Row r;
-      r["gid"] = INTEGER(grp->gr_gid);
-      r["gid_signed"] = INTEGER((int32_t) grp->gr_gid);
-      r["groupname"] = TEXT(grp->gr_name);
+      r["gid"] = INTEGER(group.gid);
+      r["gid_signed"] = INTEGER((int32_t) group.gid);
+      r["groupname"] = TEXT(group.name);
       results.push_back(r);
-      groups_in.insert(grp->gr_gid);
+      groups_in.insert(group.gid);
     }
   }
-  endgrent();
-  groups_in.clear();
 
   return results;
 }
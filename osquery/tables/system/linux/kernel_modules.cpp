@@ -10,8 +10,6 @@
 
 #include <fstream>
 
-#include <boost/algorithm/string/trim.hpp>
-
 #include <osquery/core.h>
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
@@ -19,54 +17,54 @@
 
 #include "osquery/core/conversions.h"
 
+#include "columns/kernel_modules.h"
+
 namespace osquery {
 namespace tables {
 
 static const std::string kKernelModulePath = "/proc/modules";
 
-QueryData genKernelModules(QueryContext& context) {
-  QueryData results;
-
+void genKernelModules(QueryContext& context, ColumnarData& results) {
   if (!pathExists(kKernelModulePath).ok()) {
     VLOG(1) << "Cannot find kernel modules proc file: " << kKernelModulePath;
-    return {};
+    return;
   }
 
   // Cannot seek to the end of procfs.
   std::ifstream fd(kKernelModulePath, std::ios::in);
   if (!fd) {
     VLOG(1) << "Cannot read kernel modules from: " << kKernelModulePath;
-    return {};
+    return;
   }
 
   auto module_info = std::string(std::istreambuf_iterator<char>(fd),
                                  std::istreambuf_iterator<char>());
 
-  for (const auto& module : osquery::split(module_info, "\n")) {
-    Row r;
-    auto module_info = osquery::split(module, " ");
-    if (module_info.size() < 6) {
+  using Columns = kernelModulesColumns;
+  Tokenizer lines(module_info, "\n");
+  boost::string_ref module;
+  std::vector<boost::string_ref> details;
+  while (lines.next(module)) {
+    tokenize(module, " ", details);
+    if (details.size() < 6) {
       // Interesting error case, this module line is not well formed.
       continue;
     }
 
-    for (auto& detail : module_info) {
+    for (auto& detail : details) {
       // Clean up the delimiters
-      boost::trim(detail);
-      if (detail.back() == ',') {
-        detail.pop_back();
+      if (!detail.empty() && detail.back() == ',') {
+        detail.remove_suffix(1);
       }
     }
 
-    r["name"] = module_info[0];
-    r["size"] = module_info[1];
-    r["used_by"] = module_info[3];
-    r["status"] = module_info[4];
-    r["address"] = module_info[5];
-    results.push_back(r);
+    auto r = results.addRow();
+    results.setText(r, Columns::kName, details[0].to_string());
+    results.setText(r, Columns::kSize, details[1].to_string());
+    results.setText(r, Columns::kUsedBy, details[3].to_string());
+    results.setText(r, Columns::kStatus, details[4].to_string());
+    results.setText(r, Columns::kAddress, details[5].to_string());
   }
-
-  return results;
 }
 }
 }
@@ -0,0 +1,183 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <set>
+
+#include <osquery/dispatcher.h>
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
+
+#include "osquery/filesystem/linux/proc.h"
+#include "osquery/tables/system/linux/process_cache.h"
+
+namespace osquery {
+
+FLAG(bool,
+     process_cache,
+     true,
+     "Keep running processes from process events for event enrichment");
+
+FLAG(uint64,
+     process_cache_interval,
+     60,
+     "Seconds between reconciling the process cache with /proc");
+
+FLAG(bool,
+     processes_from_cache,
+     false,
+     "Serve processes queries using only cached columns from the cache");
+
+namespace tables {
+
+void genProcess(const QueryContext& context,
+                const ProcessDirectory& process,
+                QueryData& results);
+
+/// The processes columns read for a process not seen executing.
+const UsedColumns kProcessCacheReadColumns = {
+    "pid", "parent", "name", "path", "cmdline", "cwd", "uid", "euid", "gid",
+    "egid",
+};
+
+/// The processes columns filled in from the cache.
+const UsedColumns kProcessCacheColumns = {"pid", "name", "path", "cmdline"};
+
+class ProcessCacheRunner : public InternalRunnable {
+ public:
+  /// Reconcile the shared cache, then again every interval.
+  void start() override;
+
+ protected:
+  ThreadClass threadClass() const override { return THREAD_CLASS_BULK; }
+};
+
+void ProcessCacheRunner::start() {
+  while (!interrupted()) {
+    ProcessCache::get().reconcile();
+    pauseMilli(FLAGS_process_cache_interval * 1000);
+  }
+}
+
+ProcessCache& ProcessCache::get() {
+  static ProcessCache cache;
+  return cache;
+}
+
+void ProcessCache::start() {
+  static std::atomic<bool> started{false};
+  if (FLAGS_process_cache && !started.exchange(true)) {
+    Dispatcher::addService(std::make_shared<ProcessCacheRunner>());
+  }
+}
+
+void ProcessCache::exec(const std::string& pid, ProcessCacheEntry entry) {
+  WriteLock lock(mutex_);
+  processes_[pid] = std::move(entry);
+}
+
+void ProcessCache::exit(const std::string& pid) {
+  WriteLock lock(mutex_);
+  processes_.erase(pid);
+}
+
+bool ProcessCache::lookup(const std::string& pid,
+                          ProcessCacheEntry& entry) const {
+  WriteLock lock(mutex_);
+  auto it = processes_.find(pid);
+  if (it == processes_.end()) {
+    return false;
+  }
+  entry = it->second;
+  return true;
+}
+
+Status ProcessCache::reconcile() {
+  std::set<std::string> running;
+  auto status = procProcesses(running);
+  if (!status.ok()) {
+    return status;
+  }
+
+  std::set<std::string> missing;
+  {
+    WriteLock lock(mutex_);
+    for (auto it = processes_.begin(); it != processes_.end();) {
+      if (running.count(it->first) == 0) {
+        it = processes_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    for (const auto& pid : running) {
+      if (processes_.count(pid) == 0) {
+        missing.insert(pid);
+      }
+    }
+  }
+
+  // The unknown processes are read without holding the cache.
+  QueryContext context;
+  context.colsUsed = kProcessCacheReadColumns;
+  QueryData rows;
+  procScan(missing,
+           [&context](const ProcessDirectory& process, QueryData& results) {
+             genProcess(context, process, results);
+           },
+           rows);
+
+  WriteLock lock(mutex_);
+  for (auto& r : rows) {
+    ProcessCacheEntry entry;
+    entry.name = std::move(r["name"]);
+    entry.path = std::move(r["path"]);
+    entry.cmdline = std::move(r["cmdline"]);
+    entry.cwd = std::move(r["cwd"]);
+    entry.parent = std::move(r["parent"]);
+    entry.uid = std::move(r["uid"]);
+    entry.euid = std::move(r["euid"]);
+    entry.gid = std::move(r["gid"]);
+    entry.egid = std::move(r["egid"]);
+    // An exec recorded while reading is more recent than the read.
+    processes_.emplace(r["pid"], std::move(entry));
+  }
+  reconciled_ = true;
+  return Status(0, "OK");
+}
+
+void ProcessCache::genRows(QueryData& results) const {
+  WriteLock lock(mutex_);
+  for (const auto& process : processes_) {
+    Row r;
+    r["pid"] = process.first;
+    r["name"] = process.second.name;
+    r["path"] = process.second.path;
+    r["cmdline"] = process.second.cmdline;
+    results.push_back(std::move(r));
+  }
+}
+
+bool ProcessCache::covers(const QueryContext& context) {
+  if (!context.colsUsed) {
+    return false;
+  }
+  for (const auto& column : *context.colsUsed) {
+    if (kProcessCacheColumns.count(column) == 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+size_t ProcessCache::size() const {
+  WriteLock lock(mutex_);
+  return processes_.size();
+}
+}
+}
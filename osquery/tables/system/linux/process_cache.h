@@ -0,0 +1,98 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <map>
+#include <string>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/core.h>
+#include <osquery/database.h>
+#include <osquery/status.h>
+#include <osquery/tables.h>
+
+namespace osquery {
+namespace tables {
+
+/// A running process's details as of its exec.
+struct ProcessCacheEntry {
+  std::string name;
+  std::string path;
+  std::string cmdline;
+  std::string cwd;
+  std::string parent;
+  std::string uid;
+  std::string euid;
+  std::string gid;
+  std::string egid;
+};
+
+/**
+ * @brief Running processes, maintained from process events.
+ *
+ * Event subscribers record each exec and exit, and look up the details of a
+ * process, or its parent, without reading /proc. Processes started before
+ * the subscriber, or forked without an exec, are found when the cache is
+ * reconciled with /proc every `--process_cache_interval` seconds; the
+ * reconciliation also drops processes whose exit was missed.
+ *
+ * The details are those known at exec. A process that later changes its
+ * directory or credentials keeps the values it was executed with.
+ */
+class ProcessCache : private boost::noncopyable {
+ public:
+  /// The cache maintained by the process event subscribers.
+  static ProcessCache& get();
+
+  /// Start reconciling the shared cache, once.
+  static void start();
+
+  /// Record a process's new image, replacing a previous process with its pid.
+  void exec(const std::string& pid, ProcessCacheEntry entry);
+
+  /// Remove an exited process.
+  void exit(const std::string& pid);
+
+  /// Find a process's details, false if the process is not known.
+  bool lookup(const std::string& pid, ProcessCacheEntry& entry) const;
+
+  /// Drop exited processes and read the processes not yet known from /proc.
+  Status reconcile();
+
+  /// True once the cache was reconciled, it then includes every process.
+  bool live() const { return reconciled_; }
+
+  /**
+   * @brief Append a processes table row for each known process.
+   *
+   * Only the pid, name, path, and cmdline columns are filled in.
+   */
+  void genRows(QueryData& results) const;
+
+  /// True if a processes query only uses the columns of genRows.
+  static bool covers(const QueryContext& context);
+
+  /// The number of known processes.
+  size_t size() const;
+
+ private:
+  /// Known processes by pid.
+  std::map<std::string, ProcessCacheEntry> processes_;
+
+  /// Set after the first reconciliation.
+  std::atomic<bool> reconciled_{false};
+
+  mutable Mutex mutex_;
+};
+}
+}
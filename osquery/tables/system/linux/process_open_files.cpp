@@ -13,6 +13,8 @@
 #include <osquery/tables.h>
 #include <osquery/filesystem.h>
 
+#include "osquery/filesystem/linux/proc.h"
+
 namespace osquery {
 namespace tables {
 
@@ -47,12 +49,14 @@ QueryData genOpenFiles(QueryContext& context) {
     osquery::procProcesses(pids);
   }
 
-  for (const auto& process : pids) {
-    std::map<std::string, std::string> descriptors;
-    if (osquery::procDescriptors(process, descriptors).ok()) {
-      genDescriptors(process, descriptors, results);
-    }
-  }
+  procScan(pids,
+           [](const ProcessDirectory& process, QueryData& rows) {
+             std::map<std::string, std::string> descriptors;
+             if (process.descriptors(descriptors).ok()) {
+               genDescriptors(process.pid(), descriptors, rows);
+             }
+           },
+           results);
 
   return results;
 }
@@ -10,6 +10,9 @@
 
 #include <map>
 #include <string>
+#include <vector>
+
+#include <limits.h>
 
 #include <stdlib.h>
 #include <unistd.h>
@@ -18,27 +21,27 @@
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/algorithm/string/trim.hpp>
 #include <boost/regex.hpp>
+#include <boost/utility/string_ref.hpp>
 
 #include <osquery/core.h>
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/filesystem/linux/proc.h"
+#include "osquery/tables/system/linux/process_cache.h"
 
 namespace osquery {
-namespace tables {
 
-inline std::string getProcAttr(const std::string& attr,
-                               const std::string& pid) {
-  return "/proc/" + pid + "/" + attr;
-}
+DECLARE_bool(processes_from_cache);
 
-inline std::string readProcCMDLine(const std::string& pid) {
-  auto attr = getProcAttr("cmdline", pid);
+namespace tables {
 
+inline std::string readProcCMDLine(const ProcessDirectory& process) {
   std::string content;
-  readFile(attr, content);
+  process.read("cmdline", content);
   // Remove \0 delimiters.
   std::replace_if(content.begin(),
                   content.end(),
@@ -49,28 +52,22 @@ inline std::string readProcCMDLine(const std::string& pid) {
   return content;
 }
 
-inline std::string readProcLink(const std::string& attr,
-                                const std::string& pid) {
+inline std::string readProcLink(const char* attr,
+                                const ProcessDirectory& process) {
   // The exe is a symlink to the binary on-disk.
-  auto attr_path = getProcAttr(attr, pid);
-
   std::string result;
-  char link_path[PATH_MAX] = {0};
-  auto bytes = readlink(attr_path.c_str(), link_path, sizeof(link_path) - 1);
-  if (bytes >= 0) {
-    result = std::string(link_path);
-  }
-
+  process.readLink(attr, result);
   return result;
 }
 
 // In the case where the linked binary path ends in " (deleted", and a file
 // actually exists at that path, check whether the inode of that file matches
 // the inode of the mapped file in /proc/%pid/maps
-Status deletedMatchesInode(const std::string& path, const std::string& pid) {
-  const std::string maps_path = getProcAttr("maps", pid);
+Status deletedMatchesInode(const std::string& path,
+                           const ProcessDirectory& process) {
+  const std::string maps_path = "/proc/" + process.pid() + "/maps";
   std::string maps_contents;
-  auto s = osquery::readFile(maps_path, maps_contents);
+  auto s = process.read("maps", maps_contents);
   if (!s.ok()) {
     return Status(-1, "Cannot read maps file: " + maps_path);
   }
@@ -113,11 +110,10 @@ std::set<std::string> getProcList(const QueryContext& context) {
   return pidlist;
 }
 
-void genProcessEnvironment(const std::string& pid, QueryData& results) {
-  auto attr = getProcAttr("environ", pid);
-
+void genProcessEnvironment(const ProcessDirectory& process,
+                           QueryData& results) {
   std::string content;
-  readFile(attr, content);
+  process.read("environ", content);
   const char* variable = content.c_str();
 
   // Stop at the end of nul-delimited string content.
@@ -126,7 +122,7 @@ void genProcessEnvironment(const std::string& pid, QueryData& results) {
     size_t idx = buf.find_first_of("=");
 
     Row r;
-    r["pid"] = pid;
+    r["pid"] = process.pid();
     r["key"] = buf.substr(0, idx);
     r["value"] = buf.substr(idx + 1);
     results.push_back(r);
@@ -134,51 +130,168 @@ void genProcessEnvironment(const std::string& pid, QueryData& results) {
   }
 }
 
-void genProcessMap(const std::string& pid, QueryData& results) {
-  auto map = getProcAttr("maps", pid);
+/**
+ * @brief Column constraints checked before a mapping's row is built.
+ *
+ * Only EQUALS and LIKE are checked, SQLite applies every constraint to the
+ * returned rows; a mapping is only skipped if it cannot match.
+ */
+struct ProcessMapFilter {
+  std::vector<Constraint> path;
+  std::vector<Constraint> permissions;
+  std::vector<Constraint> pseudo;
+};
 
-  std::string content;
-  readFile(map, content);
-  for (auto& line : osquery::split(content, "\n")) {
-    auto fields = osquery::split(line, " ");
-    // If can't read address, not sure.
-    if (fields.size() < 5) {
-      continue;
+static ProcessMapFilter getProcessMapFilter(QueryContext& context) {
+  ProcessMapFilter filter;
+  auto add = [&context](const std::string& column,
+                        std::vector<Constraint>& constraints) {
+    if (context.constraints.count(column) == 0) {
+      return;
+    }
+    for (const auto& constraint : context.constraints[column].getAll()) {
+      if (constraint.op == EQUALS || constraint.op == LIKE) {
+        constraints.push_back(constraint);
+      }
     }
+  };
 
-    Row r;
-    r["pid"] = pid;
-    if (!fields[0].empty()) {
-      auto addresses = osquery::split(fields[0], "-");
-      if (addresses.size() >= 2) {
-        r["start"] = "0x" + addresses[0];
-        r["end"] = "0x" + addresses[1];
-      } else {
-        // Problem with the address format.
-        continue;
+  add("path", filter.path);
+  add("permissions", filter.permissions);
+  add("pseudo", filter.pseudo);
+  return filter;
+}
+
+static bool mapColumnMatches(const std::vector<Constraint>& constraints,
+                             boost::string_ref value) {
+  for (const auto& constraint : constraints) {
+    if (constraint.op == EQUALS) {
+      if (value != constraint.expr) {
+        return false;
       }
+    } else if (!likeMatches(constraint.expr, value)) {
+      return false;
     }
+  }
+  return true;
+}
 
-    r["permissions"] = fields[1];
-    try {
-      auto offset = std::stoll(fields[2], nullptr, 16);
-      r["offset"] = (offset != 0) ? BIGINT(offset) : r["start"];
+static bool mapPseudoMatches(const std::vector<Constraint>& constraints,
+                             bool pseudo) {
+  for (const auto& constraint : constraints) {
+    long long expected = 0;
+    if (constraint.op == EQUALS &&
+        safeStrtoll(constraint.expr, 10, expected).ok() &&
+        expected != (pseudo ? 1 : 0)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/// Remove and return the next space-delimited field of a line.
+static boost::string_ref nextMapField(boost::string_ref& line) {
+  while (!line.empty() && line.front() == ' ') {
+    line.remove_prefix(1);
+  }
+  auto end = line.find(' ');
+  auto field = line.substr(0, end);
+  line.remove_prefix(field.size());
+  return field;
+}
 
-    } catch (const std::exception& e) {
-      // Value was out of range or could not be interpreted as a hex long long.
-      r["offset"] = "-1";
+/// Parse a hex offset, -1 if it is not a hex value within a BIGINT.
+static long long parseMapOffset(boost::string_ref field) {
+  if (field.empty() || field.size() > 16) {
+    return -1;
+  }
+
+  unsigned long long value = 0;
+  for (auto c : field) {
+    int digit = 0;
+    if (c >= '0' && c <= '9') {
+      digit = c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      digit = c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+      digit = c - 'A' + 10;
+    } else {
+      return -1;
+    }
+    value = (value << 4) | digit;
+  }
+
+  if (value > static_cast<unsigned long long>(LLONG_MAX)) {
+    return -1;
+  }
+  return static_cast<long long>(value);
+}
+
+/**
+ * @brief Generate a row for each mapping in a process's maps file.
+ *
+ * Lines are tokenized in place and the filter's columns are checked first,
+ * only the matching mappings are copied into rows. The path is the rest of
+ * the line, including spaces and a " (deleted)" suffix.
+ */
+void genProcessMap(const ProcessDirectory& process,
+                   const ProcessMapFilter& filter,
+                   QueryData& results) {
+  std::string content;
+  process.read("maps", content);
+
+  boost::string_ref remaining(content);
+  while (!remaining.empty()) {
+    auto eol = remaining.find('\n');
+    auto line = remaining.substr(0, eol);
+    remaining.remove_prefix(
+        (eol == boost::string_ref::npos) ? remaining.size() : eol + 1);
+
+    auto address = nextMapField(line);
+    auto permissions = nextMapField(line);
+    auto offset = nextMapField(line);
+    auto device = nextMapField(line);
+    auto inode = nextMapField(line);
+    // If can't read address, not sure.
+    if (inode.empty()) {
+      continue;
     }
-    r["device"] = fields[3];
-    r["inode"] = fields[4];
 
     // Path name must be trimmed.
-    if (fields.size() > 5) {
-      boost::trim(fields[5]);
-      r["path"] = fields[5];
+    while (!line.empty() && isspace(line.front())) {
+      line.remove_prefix(1);
+    }
+    while (!line.empty() && isspace(line.back())) {
+      line.remove_suffix(1);
     }
 
     // BSS with name in pathname.
-    r["pseudo"] = (fields[4] == "0" && !r["path"].empty()) ? "1" : "0";
+    bool pseudo = (inode == "0" && !line.empty());
+    if (!mapColumnMatches(filter.path, line) ||
+        !mapColumnMatches(filter.permissions, permissions) ||
+        !mapPseudoMatches(filter.pseudo, pseudo)) {
+      continue;
+    }
+
+    auto dash = address.find('-');
+    if (dash == boost::string_ref::npos || dash == 0 ||
+        dash + 1 == address.size()) {
+      // Problem with the address format.
+      continue;
+    }
+
+    Row r;
+    r["pid"] = process.pid();
+    r["start"] = "0x" + address.substr(0, dash).to_string();
+    r["end"] = "0x" + address.substr(dash + 1).to_string();
+    r["permissions"] = permissions.to_string();
+
+    auto offset_value = parseMapOffset(offset);
+    r["offset"] = (offset_value != 0) ? BIGINT(offset_value) : r["start"];
+    r["device"] = device.to_string();
+    r["inode"] = inode.to_string();
+    r["path"] = line.to_string();
+    r["pseudo"] = pseudo ? "1" : "0";
     results.push_back(std::move(r));
   }
 }
@@ -207,11 +320,13 @@ struct SimpleProcStat {
   std::string start_time;
 };
 
-static inline SimpleProcStat getProcStat(const std::string& pid) {
+static inline SimpleProcStat getProcStat(const ProcessDirectory& process,
+                                         bool with_stat = true,
+                                         bool with_status = true) {
   SimpleProcStat stat;
   std::string content;
 
-  if (readFile(getProcAttr("stat", pid), content).ok()) {
+  if (with_stat && process.read("stat", content).ok()) {
     auto start = content.find_last_of(")");
     // Start parsing stats from ") <MODE>..."
     if (start == std::string::npos || content.size() <= start + 2) {
@@ -235,7 +350,7 @@ static inline SimpleProcStat getProcStat(const std::string& pid) {
     }
   }
 
-  if (readFile(getProcAttr("status", pid), content).ok()) {
+  if (with_status && process.read("status", content).ok()) {
     for (const auto& line : osquery::split(content, "\n")) {
       // Status lines are formatted: Key: Value....\n.
       auto detail = osquery::split(line, ":", 1);
@@ -276,29 +391,9 @@ static inline SimpleProcStat getProcStat(const std::string& pid) {
   return stat;
 }
 
-void genProcess(const std::string& pid, QueryData& results) {
-  // Parse the process stat and status.
-  auto proc_stat = getProcStat(pid);
-
-  Row r;
-  r["pid"] = pid;
-  r["parent"] = proc_stat.parent;
-  r["path"] = readProcLink("exe", pid);
-  r["name"] = proc_stat.name;
-  r["pgroup"] = proc_stat.group;
-  r["state"] = proc_stat.state;
-  r["nice"] = proc_stat.nice;
-  // Read/parse cmdline arguments.
-  r["cmdline"] = readProcCMDLine(pid);
-  r["cwd"] = readProcLink("cwd", pid);
-  r["root"] = readProcLink("root", pid);
-  r["uid"] = proc_stat.real_uid;
-  r["euid"] = proc_stat.effective_uid;
-  r["suid"] = proc_stat.saved_uid;
-  r["gid"] = proc_stat.real_gid;
-  r["egid"] = proc_stat.effective_gid;
-  r["sgid"] = proc_stat.saved_gid;
-
+/// Set on_disk from the exe link path, which may be rewritten.
+static inline void genProcessOnDisk(const ProcessDirectory& process,
+                                    Row& r) {
   // If the path of the executable that started the process is available and
   // the path exists on disk, set on_disk to 1. If the path is not
   // available, set on_disk to -1. If, and only if, the path of the
@@ -322,7 +417,7 @@ void genProcess(const std::string& pid, QueryData& results) {
         // process is actually running from a binary file ending with
         // " (deleted)". See #1607
         std::string maps_contents;
-        Status deleted = deletedMatchesInode(r["path"], r["pid"]);
+        Status deleted = deletedMatchesInode(r["path"], process);
         if (deleted.getCode() == -1) {
           LOG(ERROR) << deleted.getMessage();
           r["on_disk"] = "";
@@ -339,6 +434,48 @@ void genProcess(const std::string& pid, QueryData& results) {
       }
     }
   }
+}
+
+void genProcess(const QueryContext& context,
+                const ProcessDirectory& process,
+                QueryData& results) {
+  // Parse the process stat and status, only if their columns are used.
+  auto proc_stat = getProcStat(
+      process,
+      context.isAnyColumnUsed({"parent", "pgroup", "state", "nice",
+                               "user_time", "system_time", "start_time"}),
+      context.isAnyColumnUsed({"name", "uid", "euid", "suid", "gid", "egid",
+                               "sgid", "resident_size", "phys_footprint"}));
+
+  Row r;
+  r["pid"] = process.pid();
+  r["parent"] = proc_stat.parent;
+  r["name"] = proc_stat.name;
+  r["pgroup"] = proc_stat.group;
+  r["state"] = proc_stat.state;
+  r["nice"] = proc_stat.nice;
+  // Read/parse cmdline arguments.
+  if (context.isColumnUsed("cmdline")) {
+    r["cmdline"] = readProcCMDLine(process);
+  }
+  if (context.isColumnUsed("cwd")) {
+    r["cwd"] = readProcLink("cwd", process);
+  }
+  if (context.isColumnUsed("root")) {
+    r["root"] = readProcLink("root", process);
+  }
+  r["uid"] = proc_stat.real_uid;
+  r["euid"] = proc_stat.effective_uid;
+  r["suid"] = proc_stat.saved_uid;
+  r["gid"] = proc_stat.real_gid;
+  r["egid"] = proc_stat.effective_gid;
+  r["sgid"] = proc_stat.saved_gid;
+
+  // The on_disk state is derived from, and may rewrite, the path.
+  if (context.isAnyColumnUsed({"path", "on_disk"})) {
+    r["path"] = readProcLink("exe", process);
+    genProcessOnDisk(process, r);
+  }
 
   // size/memory information
   r["wired_size"] = "0"; // No support for unpagable counters in linux.
@@ -356,11 +493,21 @@ void genProcess(const std::string& pid, QueryData& results) {
 QueryData genProcesses(QueryContext& context) {
   QueryData results;
 
-  auto pidlist = getProcList(context);
-  for (const auto& pid : pidlist) {
-    genProcess(pid, results);
+  // The process events keep the executed image of each running process.
+  auto& cache = ProcessCache::get();
+  if (FLAGS_processes_from_cache && cache.live() &&
+      ProcessCache::covers(context)) {
+    cache.genRows(results);
+    return results;
   }
 
+  auto pidlist = getProcList(context);
+  procScan(pidlist,
+           [&context](const ProcessDirectory& process, QueryData& rows) {
+             genProcess(context, process, rows);
+           },
+           results);
+
   return results;
 }
 
@@ -368,9 +515,7 @@ QueryData genProcessEnvs(QueryContext& context) {
   QueryData results;
 
   auto pidlist = getProcList(context);
-  for (const auto& pid : pidlist) {
-    genProcessEnvironment(pid, results);
-  }
+  procScan(pidlist, genProcessEnvironment, results);
 
   return results;
 }
@@ -379,9 +524,12 @@ QueryData genProcessMemoryMap(QueryContext& context) {
   QueryData results;
 
   auto pidlist = getProcList(context);
-  for (const auto& pid : pidlist) {
-    genProcessMap(pid, results);
-  }
+  auto filter = getProcessMapFilter(context);
+  procScan(pidlist,
+           [&filter](const ProcessDirectory& process, QueryData& rows) {
+             genProcessMap(process, filter, rows);
+           },
+           results);
 
   return results;
 }
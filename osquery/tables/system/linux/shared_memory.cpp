@@ -9,13 +9,14 @@
  */
 
 #include <sys/shm.h>
-#include <pwd.h>
 
 #include <osquery/core.h>
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
+#include "osquery/tables/system/nss_cache.h"
+
 namespace osquery {
 namespace tables {
 
@@ -53,14 +54,13 @@ QueryData genSharedMemory(QueryContext &context) {
     Row r;
     r["shmid"] = INTEGER(shmid);
 
-    struct passwd *pw = getpwuid(shmseg.shm_perm.uid);
-    if (pw != nullptr) {
-      r["owner_uid"] = BIGINT(pw->pw_uid);
+    UserEntry user;
+    if (getUserByUid(shmseg.shm_perm.uid, user)) {
+      r["owner_uid"] = BIGINT(user.uid);
     }
 
-    pw = getpwuid(shmseg.shm_perm.cuid);
-    if (pw != nullptr) {
-      r["creator_uid"] = BIGINT(pw->pw_uid);
+    if (getUserByUid(shmseg.shm_perm.cuid, user)) {
+      r["creator_uid"] = BIGINT(user.uid);
     }
 
     // Accessor, creator pids.
@@ -0,0 +1,319 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <osquery/dispatcher.h>
+#include <osquery/flags.h>
+#include <osquery/tables.h>
+
+#include "osquery/tables/system/linux/system_samples.h"
+
+namespace osquery {
+
+FLAG(uint64,
+     system_sample_milli,
+     1000,
+     "Milliseconds between samples of the system_samples table");
+
+FLAG(uint64,
+     system_sample_window,
+     900,
+     "Seconds of samples kept for the system_samples table");
+
+namespace tables {
+
+const char* const kSystemMetricNames[SYSTEM_METRIC_COUNT] = {
+    "cpu_busy_percent",
+    "cpu_iowait_percent",
+    "context_switches",
+    "procs_running",
+    "procs_blocked",
+    "load",
+    "memory_used",
+    "memory_available",
+    "swap_used",
+};
+
+/// The windows, in seconds, aggregated when the query does not select any.
+const std::vector<uint64_t> kSystemSampleWindows = {60, 300, 900};
+
+class SystemSamplerRunner : public InternalRunnable {
+ public:
+  /// Sample the shared sampler every interval.
+  void start() override;
+};
+
+void SystemSamplerRunner::start() {
+  auto interval = std::max(FLAGS_system_sample_milli, (uint64_t)10);
+  while (!interrupted()) {
+    SystemSampler::get().sample();
+    pauseMilli(interval);
+  }
+}
+
+static uint64_t getMonotonicMilli() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+/// Find the value following a label at the start of a line.
+static const char* findField(const char* buffer, const char* label) {
+  auto found = std::strstr(buffer, label);
+  while (found != nullptr && found != buffer && found[-1] != '\n') {
+    found = std::strstr(found + 1, label);
+  }
+  return (found == nullptr) ? nullptr : found + std::strlen(label);
+}
+
+/// Read an integer following a label, 0 if the label is missing.
+static uint64_t readField(const char* buffer, const char* label) {
+  auto field = findField(buffer, label);
+  return (field == nullptr) ? 0 : std::strtoull(field, nullptr, 10);
+}
+
+SystemSampler::SystemSampler(size_t capacity)
+    : ring_(std::max(capacity, (size_t)1)) {}
+
+SystemSampler& SystemSampler::get() {
+  auto interval = std::max(FLAGS_system_sample_milli, (uint64_t)10);
+  static SystemSampler sampler(FLAGS_system_sample_window * 1000 / interval +
+                               1);
+  return sampler;
+}
+
+void SystemSampler::start() {
+  static std::atomic<bool> started{false};
+  if (!started.exchange(true)) {
+    Dispatcher::addService(std::make_shared<SystemSamplerRunner>());
+  }
+}
+
+bool SystemSampler::readProcFile(const char* path) {
+  int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+
+  // The buffer grows to fit the file, such as the interrupts of /proc/stat.
+  if (buffer_.size() < 16384) {
+    buffer_.resize(16384);
+  }
+  size_t size = 0;
+  while (true) {
+    if (size + 1 >= buffer_.size()) {
+      buffer_.resize(buffer_.size() * 2);
+    }
+    auto bytes = ::read(fd, buffer_.data() + size, buffer_.size() - size - 1);
+    if (bytes <= 0) {
+      break;
+    }
+    size += bytes;
+  }
+  ::close(fd);
+  buffer_[size] = 0;
+  return size > 0;
+}
+
+Status SystemSampler::sample() {
+  SystemSample sample;
+  sample.time = getMonotonicMilli();
+  if (!readProcFile("/proc/stat")) {
+    return Status(1, "Cannot read /proc/stat");
+  }
+
+  // The first line sums the time of every CPU, in clock ticks.
+  const char* cpu = findField(buffer_.data(), "cpu ");
+  uint64_t total = 0;
+  uint64_t idle = 0;
+  uint64_t iowait = 0;
+  for (size_t i = 0; cpu != nullptr && i < 8; i++) {
+    char* end = nullptr;
+    auto ticks = std::strtoull(cpu, &end, 10);
+    if (end == cpu) {
+      break;
+    }
+    // Guest time is included in user time.
+    total += ticks;
+    idle += (i == 3) ? ticks : 0;
+    iowait += (i == 4) ? ticks : 0;
+    cpu = end;
+  }
+  auto context_switches = readField(buffer_.data(), "ctxt ");
+  sample.values[SYSTEM_METRIC_PROCS_RUNNING] =
+      static_cast<double>(readField(buffer_.data(), "procs_running "));
+  sample.values[SYSTEM_METRIC_PROCS_BLOCKED] =
+      static_cast<double>(readField(buffer_.data(), "procs_blocked "));
+
+  if (readProcFile("/proc/meminfo")) {
+    auto total_kb = readField(buffer_.data(), "MemTotal:");
+    auto available_kb = readField(buffer_.data(), "MemAvailable:");
+    auto swap_kb = readField(buffer_.data(), "SwapTotal:");
+    auto swap_free_kb = readField(buffer_.data(), "SwapFree:");
+    sample.values[SYSTEM_METRIC_MEMORY_USED] =
+        static_cast<double>((total_kb - std::min(available_kb, total_kb)) *
+                            1024);
+    sample.values[SYSTEM_METRIC_MEMORY_AVAILABLE] =
+        static_cast<double>(available_kb * 1024);
+    sample.values[SYSTEM_METRIC_SWAP_USED] =
+        static_cast<double>((swap_kb - std::min(swap_free_kb, swap_kb)) * 1024);
+  }
+
+  if (readProcFile("/proc/loadavg")) {
+    sample.values[SYSTEM_METRIC_LOAD] = std::strtod(buffer_.data(), nullptr);
+  }
+
+  // Rates need the previous counters, the first read only keeps them.
+  bool rates = counters_time_ > 0 && sample.time > counters_time_ &&
+               total > cpu_total_;
+  if (rates) {
+    auto ticks = static_cast<double>(total - cpu_total_);
+    auto idle_ticks = static_cast<double>(idle - std::min(idle, cpu_idle_));
+    auto iowait_ticks =
+        static_cast<double>(iowait - std::min(iowait, cpu_iowait_));
+    sample.values[SYSTEM_METRIC_CPU_BUSY] =
+        std::max(0.0, 100.0 * (ticks - idle_ticks - iowait_ticks) / ticks);
+    sample.values[SYSTEM_METRIC_CPU_IOWAIT] = 100.0 * iowait_ticks / ticks;
+    sample.values[SYSTEM_METRIC_CONTEXT_SWITCHES] =
+        static_cast<double>(context_switches -
+                            std::min(context_switches, context_switches_)) *
+        1000.0 / static_cast<double>(sample.time - counters_time_);
+  }
+  cpu_total_ = total;
+  cpu_idle_ = idle;
+  cpu_iowait_ = iowait;
+  context_switches_ = context_switches;
+  counters_time_ = sample.time;
+
+  if (rates) {
+    record(sample);
+  }
+  return Status(0, "OK");
+}
+
+void SystemSampler::record(const SystemSample& sample) {
+  WriteLock lock(mutex_);
+  ring_[next_] = sample;
+  next_ = (next_ + 1) % ring_.size();
+  size_ = std::min(size_ + 1, ring_.size());
+}
+
+size_t SystemSampler::size() const {
+  WriteLock lock(mutex_);
+  return size_;
+}
+
+bool SystemSampler::aggregate(SystemMetric metric,
+                              uint64_t window,
+                              SystemMetricWindow& result) const {
+  std::vector<double> values;
+  {
+    WriteLock lock(mutex_);
+    if (size_ == 0) {
+      return false;
+    }
+
+    // Walk back from the newest sample until the window's start.
+    auto newest = ring_[(next_ + ring_.size() - 1) % ring_.size()].time;
+    values.reserve(size_);
+    for (size_t i = 1; i <= size_; i++) {
+      const auto& sample = ring_[(next_ + ring_.size() - i) % ring_.size()];
+      if (newest - sample.time >= window && i > 1) {
+        break;
+      }
+      values.push_back(sample.values[metric]);
+    }
+  }
+
+  std::sort(values.begin(), values.end());
+  double sum = 0;
+  for (const auto& value : values) {
+    sum += value;
+  }
+
+  // Percentiles are the nearest rank.
+  auto percentile = [&values](double p) {
+    auto rank = static_cast<size_t>(std::ceil(p / 100 * values.size()));
+    return values[std::max(rank, (size_t)1) - 1];
+  };
+  result.samples = values.size();
+  result.min = values.front();
+  result.max = values.back();
+  result.avg = sum / values.size();
+  result.p50 = percentile(50);
+  result.p95 = percentile(95);
+  result.p99 = percentile(99);
+  return true;
+}
+
+/// Format an aggregate with two decimals, as the percent metrics are.
+static std::string formatValue(double value) {
+  char buffer[64];
+  std::snprintf(buffer, sizeof(buffer), "%.2f", value);
+  return buffer;
+}
+
+QueryData genSystemSamples(QueryContext& context) {
+  QueryData results;
+  SystemSampler::start();
+
+  std::set<uint64_t> windows;
+  if (context.constraints["window"].exists(EQUALS)) {
+    for (const auto& window :
+         context.constraints["window"].getAll<long long>(EQUALS)) {
+      if (window > 0) {
+        windows.insert(static_cast<uint64_t>(window));
+      }
+    }
+  } else {
+    for (const auto& window : kSystemSampleWindows) {
+      if (window <= FLAGS_system_sample_window) {
+        windows.insert(window);
+      }
+    }
+  }
+
+  const auto& sampler = SystemSampler::get();
+  for (size_t metric = 0; metric < SYSTEM_METRIC_COUNT; metric++) {
+    for (const auto& window : windows) {
+      SystemMetricWindow aggregates;
+      if (!sampler.aggregate(
+              static_cast<SystemMetric>(metric), window * 1000, aggregates)) {
+        return results;
+      }
+
+      Row r;
+      r["metric"] = kSystemMetricNames[metric];
+      r["window"] = BIGINT(window);
+      r["samples"] = BIGINT(aggregates.samples);
+      r["min"] = formatValue(aggregates.min);
+      r["max"] = formatValue(aggregates.max);
+      r["avg"] = formatValue(aggregates.avg);
+      r["p50"] = formatValue(aggregates.p50);
+      r["p95"] = formatValue(aggregates.p95);
+      r["p99"] = formatValue(aggregates.p99);
+      results.push_back(std::move(r));
+    }
+  }
+  return results;
+}
+}
+}
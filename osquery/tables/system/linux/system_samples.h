@@ -0,0 +1,129 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/core.h>
+#include <osquery/status.h>
+
+namespace osquery {
+namespace tables {
+
+/// The sampled metrics, each sample has a value for every metric.
+enum SystemMetric {
+  SYSTEM_METRIC_CPU_BUSY = 0,
+  SYSTEM_METRIC_CPU_IOWAIT,
+  SYSTEM_METRIC_CONTEXT_SWITCHES,
+  SYSTEM_METRIC_PROCS_RUNNING,
+  SYSTEM_METRIC_PROCS_BLOCKED,
+  SYSTEM_METRIC_LOAD,
+  SYSTEM_METRIC_MEMORY_USED,
+  SYSTEM_METRIC_MEMORY_AVAILABLE,
+  SYSTEM_METRIC_SWAP_USED,
+  SYSTEM_METRIC_COUNT,
+};
+
+/// The metric column value of each SystemMetric.
+extern const char* const kSystemMetricNames[SYSTEM_METRIC_COUNT];
+
+/// The value of each metric at one time.
+struct SystemSample {
+  /// Milliseconds of a monotonic clock when the sample was taken.
+  uint64_t time{0};
+
+  double values[SYSTEM_METRIC_COUNT]{};
+};
+
+/// The aggregates of a metric's samples within a window.
+struct SystemMetricWindow {
+  size_t samples{0};
+  double min{0};
+  double max{0};
+  double avg{0};
+  double p50{0};
+  double p95{0};
+  double p99{0};
+};
+
+/**
+ * @brief System counters, sampled in the background into a ring buffer.
+ *
+ * Once started, /proc/stat, /proc/meminfo, and /proc/loadavg are read every
+ * `--system_sample_milli` milliseconds and the newest samples, covering
+ * `--system_sample_window` seconds, are kept in memory. CPU utilization and
+ * context switches are rates between consecutive samples.
+ *
+ * Queries aggregate the samples of a window instead of reading the counters,
+ * so fine-grained metrics are available to a query scheduled every minute
+ * without the cost of executing, diffing, and logging a query every second.
+ */
+class SystemSampler : private boost::noncopyable {
+ public:
+  /// Keep up to a number of samples, the oldest are replaced.
+  explicit SystemSampler(size_t capacity);
+
+  /// The sampler started by the system_samples table.
+  static SystemSampler& get();
+
+  /// Start sampling into the shared sampler, once.
+  static void start();
+
+  /// Read the counters and record a sample, the first read has no rates.
+  Status sample();
+
+  /// Record a sample, newer than the samples already recorded.
+  void record(const SystemSample& sample);
+
+  /**
+   * @brief Aggregate a metric's samples within a window.
+   *
+   * The window ends with the newest sample, and includes the samples taken
+   * within the window's milliseconds before it.
+   *
+   * @return false if no samples were recorded.
+   */
+  bool aggregate(SystemMetric metric,
+                 uint64_t window,
+                 SystemMetricWindow& result) const;
+
+  /// The number of samples kept.
+  size_t size() const;
+
+ private:
+  /// Read a proc file into the reused buffer.
+  bool readProcFile(const char* path);
+
+ private:
+  /// The samples, the next sample replaces ring_[next_] once full.
+  std::vector<SystemSample> ring_;
+  size_t next_{0};
+  size_t size_{0};
+
+  /// The previous sample's cumulative CPU and context switch counters.
+  uint64_t cpu_total_{0};
+  uint64_t cpu_idle_{0};
+  uint64_t cpu_iowait_{0};
+  uint64_t context_switches_{0};
+  uint64_t counters_time_{0};
+
+  /// Read buffer, kept between samples to avoid allocations.
+  std::vector<char> buffer_;
+
+  /// Protects the ring, queries aggregate while the sampler records.
+  mutable Mutex mutex_;
+};
+}
+}
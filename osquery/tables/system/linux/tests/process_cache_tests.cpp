@@ -0,0 +1,93 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <gtest/gtest.h>
+
+#include <unistd.h>
+
+#include "osquery/tables/system/linux/process_cache.h"
+#include "osquery/tests/test_util.h"
+
+namespace osquery {
+namespace tables {
+
+class ProcessCacheTests : public testing::Test {};
+
+TEST_F(ProcessCacheTests, test_exec_exit) {
+  ProcessCache cache;
+  ProcessCacheEntry entry;
+  EXPECT_FALSE(cache.lookup("100", entry));
+
+  entry.path = "/bin/sh";
+  entry.cmdline = "sh -c true";
+  cache.exec("100", entry);
+
+  // A later exec replaces the process's image.
+  entry.path = "/bin/true";
+  entry.cmdline = "true";
+  cache.exec("100", entry);
+  EXPECT_EQ(cache.size(), 1U);
+
+  ProcessCacheEntry found;
+  ASSERT_TRUE(cache.lookup("100", found));
+  EXPECT_EQ(found.path, "/bin/true");
+  EXPECT_EQ(found.cmdline, "true");
+
+  cache.exit("100");
+  EXPECT_FALSE(cache.lookup("100", found));
+  EXPECT_EQ(cache.size(), 0U);
+}
+
+TEST_F(ProcessCacheTests, test_reconcile) {
+  ProcessCache cache;
+  EXPECT_FALSE(cache.live());
+
+  // A pid beyond the kernel's limit has exited, or never existed.
+  ProcessCacheEntry entry;
+  entry.path = "/bin/exited";
+  cache.exec("4194305", entry);
+
+  // An exec of a running process is kept over the details from /proc.
+  auto ppid = std::to_string(::getppid());
+  entry.path = "/bin/parent";
+  cache.exec(ppid, entry);
+
+  ASSERT_TRUE(cache.reconcile().ok());
+  EXPECT_TRUE(cache.live());
+
+  ProcessCacheEntry found;
+  EXPECT_FALSE(cache.lookup("4194305", found));
+  ASSERT_TRUE(cache.lookup(ppid, found));
+  EXPECT_EQ(found.path, "/bin/parent");
+
+  // This process was not seen executing, it is read from /proc.
+  ASSERT_TRUE(cache.lookup(std::to_string(::getpid()), found));
+  EXPECT_FALSE(found.path.empty());
+  EXPECT_FALSE(found.cwd.empty());
+  EXPECT_EQ(found.parent, ppid);
+  EXPECT_EQ(found.uid, std::to_string(::getuid()));
+
+  QueryData rows;
+  cache.genRows(rows);
+  EXPECT_EQ(rows.size(), cache.size());
+}
+
+TEST_F(ProcessCacheTests, test_covers) {
+  QueryContext context;
+  EXPECT_FALSE(ProcessCache::covers(context));
+
+  context.colsUsed = UsedColumns({"pid", "path"});
+  EXPECT_TRUE(ProcessCache::covers(context));
+
+  context.colsUsed = UsedColumns({"pid", "resident_size"});
+  EXPECT_FALSE(ProcessCache::covers(context));
+}
+}
+}
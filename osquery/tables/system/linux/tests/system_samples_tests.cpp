@@ -0,0 +1,90 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <gtest/gtest.h>
+
+#include <unistd.h>
+
+#include "osquery/tables/system/linux/system_samples.h"
+
+namespace osquery {
+namespace tables {
+
+class SystemSamplesTests : public testing::Test {};
+
+/// Record a sample with a value for every metric.
+static void recordValue(SystemSampler& sampler, uint64_t time, double value) {
+  SystemSample sample;
+  sample.time = time;
+  for (size_t i = 0; i < SYSTEM_METRIC_COUNT; i++) {
+    sample.values[i] = value;
+  }
+  sampler.record(sample);
+}
+
+TEST_F(SystemSamplesTests, test_aggregate) {
+  SystemSampler sampler(100);
+  SystemMetricWindow result;
+  EXPECT_FALSE(sampler.aggregate(SYSTEM_METRIC_LOAD, 1000, result));
+
+  // Samples each second, valued 1 through 10.
+  for (size_t i = 1; i <= 10; i++) {
+    recordValue(sampler, i * 1000, static_cast<double>(i));
+  }
+
+  ASSERT_TRUE(sampler.aggregate(SYSTEM_METRIC_LOAD, 60000, result));
+  EXPECT_EQ(result.samples, 10U);
+  EXPECT_EQ(result.min, 1);
+  EXPECT_EQ(result.max, 10);
+  EXPECT_EQ(result.avg, 5.5);
+  EXPECT_EQ(result.p50, 5);
+  EXPECT_EQ(result.p95, 10);
+
+  // A window includes the samples within its milliseconds of the newest.
+  ASSERT_TRUE(sampler.aggregate(SYSTEM_METRIC_LOAD, 3000, result));
+  EXPECT_EQ(result.samples, 3U);
+  EXPECT_EQ(result.min, 8);
+  EXPECT_EQ(result.avg, 9);
+}
+
+TEST_F(SystemSamplesTests, test_ring) {
+  // The oldest samples are replaced once the ring is full.
+  SystemSampler sampler(4);
+  for (size_t i = 1; i <= 6; i++) {
+    recordValue(sampler, i * 1000, static_cast<double>(i));
+  }
+  EXPECT_EQ(sampler.size(), 4U);
+
+  SystemMetricWindow result;
+  ASSERT_TRUE(sampler.aggregate(SYSTEM_METRIC_CPU_BUSY, 60000, result));
+  EXPECT_EQ(result.samples, 4U);
+  EXPECT_EQ(result.min, 3);
+  EXPECT_EQ(result.max, 6);
+}
+
+TEST_F(SystemSamplesTests, test_sample) {
+  // The first read keeps the counters, rates need a second read.
+  SystemSampler sampler(10);
+  ASSERT_TRUE(sampler.sample().ok());
+  EXPECT_EQ(sampler.size(), 0U);
+
+  ::usleep(20 * 1000);
+  ASSERT_TRUE(sampler.sample().ok());
+  SystemMetricWindow result;
+  if (sampler.size() > 0) {
+    ASSERT_TRUE(
+        sampler.aggregate(SYSTEM_METRIC_MEMORY_AVAILABLE, 1000, result));
+    EXPECT_GT(result.max, 0);
+    ASSERT_TRUE(sampler.aggregate(SYSTEM_METRIC_CPU_BUSY, 1000, result));
+    EXPECT_LE(result.max, 100);
+  }
+}
+}
+}
@@ -8,46 +8,46 @@
  *
  */
 
+#include <set>
+#include <vector>
+
 #include "osquery/core/conversions.h"
+#include "osquery/tables/system/nss_cache.h"
 #include "osquery/tables/system/user_groups.h"
 
 namespace osquery {
 namespace tables {
 
-extern std::mutex pwdEnumerationMutex;
-
 QueryData genUserGroups(QueryContext &context) {
   QueryData results;
-  struct passwd *pwd = nullptr;
 
   if (context.constraints["uid"].exists(EQUALS)) {
     std::set<std::string> uids = context.constraints["uid"].getAll(EQUALS);
     for (const auto &uid : uids) {
       long auid{0};
-      if (safeStrtol(uid, 10, auid) && (pwd = getpwuid(auid)) != nullptr) {
+      UserEntry entry;
+      if (safeStrtol(uid, 10, auid) && getUserByUid(auid, entry)) {
         user_t<uid_t, gid_t> user;
-        user.name = pwd->pw_name;
-        user.uid = pwd->pw_uid;
-        user.gid = pwd->pw_gid;
+        user.name = entry.name.c_str();
+        user.uid = entry.uid;
+        user.gid = entry.gid;
         getGroupsForUser<uid_t, gid_t>(results, user);
       }
     }
   } else {
-    std::lock_guard<std::mutex> lock(pwdEnumerationMutex);
-    std::set<gid_t> users_in;
-    while ((pwd = getpwent()) != nullptr) {
-      if (std::find(users_in.begin(), users_in.end(), pwd->pw_uid) ==
-          users_in.end()) {
+    std::set<uid_t> users_in;
+    std::vector<UserEntry> entries;
+    getAllUsers(entries);
+    for (const auto &entry : entries) {
+      if (users_in.count(entry.uid) == 0) {
         user_t<uid_t, gid_t> user;
-        user.name = pwd->pw_name;
-        user.uid = pwd->pw_uid;
-        user.gid = pwd->pw_gid;
+        user.name = entry.name.c_str();
+        user.uid = entry.uid;
+        user.gid = entry.gid;
         getGroupsForUser<uid_t, gid_t>(results, user);
-        users_in.insert(pwd->pw_uid);
+        users_in.insert(entry.uid);
       }
     }
-    endpwent();
-    users_in.clear();
   }
 
   return results;
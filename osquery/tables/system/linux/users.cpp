@@ -9,53 +9,58 @@
  */
 
 #include <set>
-#include <mutex>
-#include <vector>
 #include <string>
-
-#include <pwd.h>
+#include <vector>
 
 #include <osquery/core.h>
 #include <osquery/tables.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/tables/system/nss_cache.h"
 
 namespace osquery {
 namespace tables {
 
-std::mutex pwdEnumerationMutex;
-
-void genUser(const struct passwd* pwd, QueryData& results) {
+void genUser(const QueryContext& context,
+             const UserEntry& user,
+             QueryData& results) {
   Row r;
-  r["uid"] = BIGINT(pwd->pw_uid);
-  r["gid"] = BIGINT(pwd->pw_gid);
-  r["uid_signed"] = BIGINT((int32_t)pwd->pw_uid);
-  r["gid_signed"] = BIGINT((int32_t)pwd->pw_gid);
-  r["username"] = TEXT(pwd->pw_name);
-  r["description"] = TEXT(pwd->pw_gecos);
-  r["directory"] = TEXT(pwd->pw_dir);
-  r["shell"] = TEXT(pwd->pw_shell);
-  results.push_back(r);
+  r["uid"] = BIGINT(user.uid);
+  r["gid"] = BIGINT(user.gid);
+  r["uid_signed"] = BIGINT((int32_t)user.uid);
+  r["gid_signed"] = BIGINT((int32_t)user.gid);
+  r["username"] = TEXT(user.name);
+  // The free-form account strings are only copied when referenced.
+  if (context.isColumnUsed("description")) {
+    r["description"] = TEXT(user.description);
+  }
+  if (context.isColumnUsed("directory")) {
+    r["directory"] = TEXT(user.directory);
+  }
+  if (context.isColumnUsed("shell")) {
+    r["shell"] = TEXT(user.shell);
+  }
+  results.push_back(std::move(r));
 }
 
 QueryData genUsers(QueryContext& context) {
   QueryData results;
-  struct passwd *pwd = nullptr;
 
   if (context.constraints["uid"].exists(EQUALS)) {
     std::set<std::string> uids = context.constraints["uid"].getAll(EQUALS);
     for (const auto& uid : uids) {
       long auid{0};
-      if (safeStrtol(uid, 10, auid) && (pwd = getpwuid(auid)) != nullptr) {
-        genUser(pwd, results);
+      UserEntry user;
+      if (safeStrtol(uid, 10, auid) && getUserByUid(auid, user)) {
+        genUser(context, user, results);
       }
     }
   } else {
-    std::lock_guard<std::mutex> lock(pwdEnumerationMutex);
-    while ((pwd = getpwent()) != nullptr) {
-      genUser(pwd, results);
+    std::vector<UserEntry> users;
+    getAllUsers(users);
+    for (const auto& user : users) {
+      genUser(context, user, results);
     }
-    endpwent();
   }
 
   return results;
@@ -0,0 +1,269 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <chrono>
+#include <map>
+#include <mutex>
+
+#include <errno.h>
+#include <unistd.h>
+
+#include <osquery/flags.h>
+
+#include "osquery/tables/system/nss_cache.h"
+
+namespace osquery {
+
+FLAG(uint64,
+     nss_cache_ttl,
+     60,
+     "Seconds to keep user and group lookups, 0 to disable the cache");
+
+namespace tables {
+
+/// The most bytes used for the strings of one database entry.
+const size_t kNSSMaxBuffer = 1 << 20;
+
+using NSSClock = std::chrono::steady_clock;
+
+/// A cached lookup, including lookups without an entry.
+template <typename T>
+struct NSSCacheEntry {
+  NSSClock::time_point expires;
+  bool found;
+  T entry;
+};
+
+/// An entry type's cached lookups and enumeration.
+template <typename K, typename T>
+struct NSSCache {
+  std::mutex mutex;
+  std::map<K, NSSCacheEntry<T>> lookups;
+  NSSClock::time_point enumeration_expires;
+  std::vector<T> enumeration;
+};
+
+static NSSCache<uid_t, UserEntry> kUserCache;
+static NSSCache<gid_t, GroupEntry> kGroupCache;
+
+/// Serialize getpwent and getgrent, their iteration state is global.
+static std::mutex kPasswdEnumerationMutex;
+static std::mutex kGroupEnumerationMutex;
+
+static NSSClock::time_point getNSSExpiry() {
+  return NSSClock::now() + std::chrono::seconds(FLAGS_nss_cache_ttl);
+}
+
+template <typename K, typename T>
+static bool findNSSEntry(NSSCache<K, T>& cache, K key, T& entry, bool& found) {
+  if (FLAGS_nss_cache_ttl == 0) {
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(cache.mutex);
+  auto it = cache.lookups.find(key);
+  if (it == cache.lookups.end() || it->second.expires <= NSSClock::now()) {
+    return false;
+  }
+  found = it->second.found;
+  if (found) {
+    entry = it->second.entry;
+  }
+  return true;
+}
+
+template <typename K, typename T>
+static void addNSSEntry(NSSCache<K, T>& cache,
+                        K key,
+                        const T& entry,
+                        bool found) {
+  if (FLAGS_nss_cache_ttl == 0) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(cache.mutex);
+  auto& cached = cache.lookups[key];
+  cached.expires = getNSSExpiry();
+  cached.found = found;
+  cached.entry = entry;
+}
+
+static void copyUserEntry(const struct passwd* pwd, UserEntry& user) {
+  user.uid = pwd->pw_uid;
+  user.gid = pwd->pw_gid;
+  user.name = (pwd->pw_name != nullptr) ? pwd->pw_name : "";
+  user.description = (pwd->pw_gecos != nullptr) ? pwd->pw_gecos : "";
+  user.directory = (pwd->pw_dir != nullptr) ? pwd->pw_dir : "";
+  user.shell = (pwd->pw_shell != nullptr) ? pwd->pw_shell : "";
+}
+
+static void copyGroupEntry(const struct group* grp, GroupEntry& group) {
+  group.gid = grp->gr_gid;
+  group.name = (grp->gr_name != nullptr) ? grp->gr_name : "";
+}
+
+/// The initial size of a reentrant lookup's string buffer.
+static size_t getNSSBufferSize(int name) {
+  auto size = ::sysconf(name);
+  return (size > 0) ? static_cast<size_t>(size) : 1024;
+}
+
+bool getUserByUid(uid_t uid, UserEntry& user) {
+  bool found = false;
+  if (findNSSEntry(kUserCache, uid, user, found)) {
+    return found;
+  }
+
+  // The lookup is not made under the cache lock, a slow directory service
+  // only holds back the callers resolving the same uncached uid.
+  std::vector<char> buffer(getNSSBufferSize(_SC_GETPW_R_SIZE_MAX));
+  struct passwd pwd;
+  struct passwd* result = nullptr;
+  int error = 0;
+  while ((error = ::getpwuid_r(
+              uid, &pwd, buffer.data(), buffer.size(), &result)) == ERANGE &&
+         buffer.size() < kNSSMaxBuffer) {
+    buffer.resize(buffer.size() * 2);
+  }
+
+  found = (error == 0 && result != nullptr);
+  if (found) {
+    copyUserEntry(result, user);
+  }
+
+  // Errors other than a missing entry are not cached.
+  if (error == 0) {
+    addNSSEntry(kUserCache, uid, user, found);
+  }
+  return found;
+}
+
+bool getGroupByGid(gid_t gid, GroupEntry& group) {
+  bool found = false;
+  if (findNSSEntry(kGroupCache, gid, group, found)) {
+    return found;
+  }
+
+  std::vector<char> buffer(getNSSBufferSize(_SC_GETGR_R_SIZE_MAX));
+  struct group grp;
+  struct group* result = nullptr;
+  int error = 0;
+  while ((error = ::getgrgid_r(
+              gid, &grp, buffer.data(), buffer.size(), &result)) == ERANGE &&
+         buffer.size() < kNSSMaxBuffer) {
+    buffer.resize(buffer.size() * 2);
+  }
+
+  found = (error == 0 && result != nullptr);
+  if (found) {
+    copyGroupEntry(result, group);
+  }
+
+  if (error == 0) {
+    addNSSEntry(kGroupCache, gid, group, found);
+  }
+  return found;
+}
+
+std::string getUserName(uid_t uid) {
+  UserEntry user;
+  if (getUserByUid(uid, user)) {
+    return user.name;
+  }
+  return std::to_string(uid);
+}
+
+std::string getGroupName(gid_t gid) {
+  GroupEntry group;
+  if (getGroupByGid(gid, group)) {
+    return group.name;
+  }
+  return std::to_string(gid);
+}
+
+/// Return a fresh cached enumeration, true if there was one.
+template <typename K, typename T>
+static bool findNSSEnumeration(NSSCache<K, T>& cache,
+                               std::vector<T>& entries) {
+  if (FLAGS_nss_cache_ttl == 0) {
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(cache.mutex);
+  if (cache.enumeration_expires <= NSSClock::now()) {
+    return false;
+  }
+  entries = cache.enumeration;
+  return true;
+}
+
+/// Keep an enumeration and each listed entry.
+template <typename K, typename T>
+static void addNSSEnumeration(NSSCache<K, T>& cache,
+                              const std::vector<T>& entries,
+                              K T::*key) {
+  if (FLAGS_nss_cache_ttl == 0) {
+    return;
+  }
+
+  auto expires = getNSSExpiry();
+  std::lock_guard<std::mutex> lock(cache.mutex);
+  cache.enumeration = entries;
+  cache.enumeration_expires = expires;
+  for (auto it = entries.rbegin(); it != entries.rend(); ++it) {
+    // Iterate backwards so the first entry listed for a key is kept.
+    auto& cached = cache.lookups[(*it).*key];
+    cached.expires = expires;
+    cached.found = true;
+    cached.entry = *it;
+  }
+}
+
+void getAllUsers(std::vector<UserEntry>& users) {
+  if (findNSSEnumeration(kUserCache, users)) {
+    return;
+  }
+
+  users.clear();
+  {
+    std::lock_guard<std::mutex> lock(kPasswdEnumerationMutex);
+    struct passwd* pwd = nullptr;
+    setpwent();
+    while ((pwd = getpwent()) != nullptr) {
+      UserEntry user;
+      copyUserEntry(pwd, user);
+      users.push_back(std::move(user));
+    }
+    endpwent();
+  }
+  addNSSEnumeration(kUserCache, users, &UserEntry::uid);
+}
+
+void getAllGroups(std::vector<GroupEntry>& groups) {
+  if (findNSSEnumeration(kGroupCache, groups)) {
+    return;
+  }
+
+  groups.clear();
+  {
+    std::lock_guard<std::mutex> lock(kGroupEnumerationMutex);
+    struct group* grp = nullptr;
+    setgrent();
+    while ((grp = getgrent()) != nullptr) {
+      GroupEntry group;
+      copyGroupEntry(grp, group);
+      groups.push_back(std::move(group));
+    }
+    endgrent();
+  }
+  addNSSEnumeration(kGroupCache, groups, &GroupEntry::gid);
+}
+}
+}
@@ -0,0 +1,69 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <grp.h>
+#include <pwd.h>
+
+namespace osquery {
+namespace tables {
+
+/// A copy of a password database entry.
+struct UserEntry {
+  uid_t uid;
+  gid_t gid;
+  std::string name;
+  std::string description;
+  std::string directory;
+  std::string shell;
+};
+
+/// A copy of a group database entry.
+struct GroupEntry {
+  gid_t gid;
+  std::string name;
+};
+
+/**
+ * @brief Look up a user by uid through the process-wide NSS cache.
+ *
+ * Entries, and uids without an entry, are kept for `--nss_cache_ttl`
+ * seconds. A directory service is asked at most once per uid per period
+ * however many tables or rows resolve the uid.
+ *
+ * @return false if there is no user with the uid.
+ */
+bool getUserByUid(uid_t uid, UserEntry& user);
+
+/// Look up a group by gid through the process-wide NSS cache.
+bool getGroupByGid(gid_t gid, GroupEntry& group);
+
+/// The name of a uid's user, or the decimal uid if there is no user.
+std::string getUserName(uid_t uid);
+
+/// The name of a gid's group, or the decimal gid if there is no group.
+std::string getGroupName(gid_t gid);
+
+/**
+ * @brief Enumerate every user in the password database.
+ *
+ * The enumeration is kept for `--nss_cache_ttl` seconds and fills the uid
+ * cache. Duplicate uids are returned as listed, the first entry is cached.
+ */
+void getAllUsers(std::vector<UserEntry>& users);
+
+/// Enumerate every group in the group database, see getAllUsers.
+void getAllGroups(std::vector<GroupEntry>& groups);
+}
+}
@@ -8,87 +8,319 @@
  *
  */
 
+#include <map>
 #include <string>
 #include <vector>
 
-#include <boost/xpressive/xpressive.hpp>
+#include <sys/stat.h>
+
+#include <boost/utility/string_ref.hpp>
 
 #include <osquery/core.h>
-#include <osquery/tables.h>
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
+#include <osquery/tables.h>
 
 #include "osquery/core/conversions.h"
 #include "osquery/tables/system/system_utils.h"
 
-namespace xp = boost::xpressive;
-
 namespace osquery {
+
+FLAG(bool,
+     shell_history_incremental,
+     false,
+     "Only report shell history lines appended since the last query");
+
 namespace tables {
 
 const std::vector<std::string> kShellHistoryFiles = {
     ".bash_history", ".zsh_history", ".zhistory", ".history", ".sh_history",
 };
 
+/// The offset following a history file's last reported line.
+struct ShellHistoryOffset {
+  dev_t device;
+  ino_t inode;
+  size_t offset;
+};
+
+/// Offsets of history files, see --shell_history_incremental.
+static std::map<std::string, ShellHistoryOffset> kShellHistoryOffsets;
+
+/// Protect the history file offsets.
+static Mutex kShellHistoryOffsetsMutex;
+
+static bool isHistorySpace(char c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\f' ||
+         c == '\v';
+}
+
+static boost::string_ref trimHistoryLine(boost::string_ref line) {
+  while (!line.empty() && isHistorySpace(line.front())) {
+    line.remove_prefix(1);
+  }
+  while (!line.empty() && isHistorySpace(line.back())) {
+    line.remove_suffix(1);
+  }
+  return line;
+}
+
+/// Consume 1 to max digits from the start of a line.
+static bool consumeDigits(boost::string_ref& line,
+                          size_t max,
+                          boost::string_ref& digits) {
+  size_t count = 0;
+  while (count < line.size() && count < max && line[count] >= '0' &&
+         line[count] <= '9') {
+    count++;
+  }
+  if (count == 0) {
+    return false;
+  }
+  digits = line.substr(0, count);
+  line.remove_prefix(count);
+  return true;
+}
+
+/// Match a bash timestamp comment, "#<timestamp>".
+static bool parseBashTimestamp(boost::string_ref line,
+                               boost::string_ref& timestamp) {
+  if (line.size() < 2 || line[0] != '#') {
+    return false;
+  }
+  line.remove_prefix(1);
+  return consumeDigits(line, line.size(), timestamp) && line.empty();
+}
+
+/// Match a zsh extended history line, ": <timestamp>:<duration>;<command>".
+static bool parseZshEntry(boost::string_ref line,
+                          boost::string_ref& timestamp,
+                          boost::string_ref& command) {
+  if (line.empty() || line[0] != ':') {
+    return false;
+  }
+  line.remove_prefix(1);
+
+  // Up to 10 spaces may pad the timestamp.
+  for (size_t i = 0; i < 10 && !line.empty() && line[0] == ' '; i++) {
+    line.remove_prefix(1);
+  }
+
+  boost::string_ref duration;
+  if (!consumeDigits(line, 11, timestamp) || line.empty() || line[0] != ':') {
+    return false;
+  }
+  line.remove_prefix(1);
+  if (!consumeDigits(line, line.size(), duration) || line.empty() ||
+      line[0] != ';') {
+    return false;
+  }
+  line.remove_prefix(1);
+  command = line;
+  return true;
+}
+
+/// The time of a timestamped history line, -1 if it has none.
+static long long getHistoryLineTime(boost::string_ref line, bool& bash) {
+  boost::string_ref timestamp;
+  boost::string_ref command;
+  bash = parseBashTimestamp(line, timestamp);
+  if (!bash && !parseZshEntry(line, timestamp, command)) {
+    return -1;
+  }
+
+  long long time = 0;
+  if (!safeStrtoll(timestamp.to_string(), 10, time).ok()) {
+    return -1;
+  }
+  return time;
+}
+
+/**
+ * @brief Find the start of the lines that may be at or after a time.
+ *
+ * History is appended in time order, lines are read backwards from the end
+ * until one is timestamped before the time. The lines start after that
+ * entry, a bash timestamp is followed by its command.
+ */
+static size_t findHistoryTail(boost::string_ref content, long long min_time) {
+  size_t end = content.size();
+  while (end > 0) {
+    auto newline = content.substr(0, end - 1).rfind('\n');
+    size_t begin = (newline == boost::string_ref::npos) ? 0 : newline + 1;
+    bool bash = false;
+    auto line = trimHistoryLine(content.substr(begin, end - begin));
+    auto time = getHistoryLineTime(line, bash);
+    if (time >= 0 && time < min_time) {
+      if (!bash) {
+        return end;
+      }
+      auto command = content.substr(end).find('\n');
+      return (command == boost::string_ref::npos) ? content.size()
+                                                  : end + command + 1;
+    }
+    end = begin;
+  }
+  return 0;
+}
+
+/**
+ * @brief Generate a row for each history line.
+ *
+ * @return the offset following the last line with a row.
+ */
+static size_t parseHistory(boost::string_ref content,
+                           size_t start,
+                           const std::string& uid,
+                           const std::string& history_file,
+                           QueryData& results) {
+  boost::string_ref prev_bash_timestamp;
+  size_t parsed = start;
+  size_t begin = start;
+  while (begin < content.size()) {
+    auto newline = content.substr(begin).find('\n');
+    auto end = (newline == boost::string_ref::npos) ? content.size()
+                                                    : begin + newline;
+    auto raw = content.substr(begin, end - begin);
+    begin = (newline == boost::string_ref::npos) ? end : end + 1;
+    if (raw.empty()) {
+      continue;
+    }
+
+    // A line without a newline may still be written.
+    if (newline == boost::string_ref::npos &&
+        FLAGS_shell_history_incremental) {
+      break;
+    }
+
+    auto line = trimHistoryLine(raw);
+    boost::string_ref timestamp;
+    if (prev_bash_timestamp.empty() && parseBashTimestamp(line, timestamp)) {
+      prev_bash_timestamp = timestamp;
+      continue;
+    }
+
+    Row r;
+    boost::string_ref command;
+    if (!prev_bash_timestamp.empty()) {
+      r["time"] = INTEGER(prev_bash_timestamp.to_string());
+      r["command"] = line.to_string();
+      prev_bash_timestamp.clear();
+    } else if (parseZshEntry(line, timestamp, command)) {
+      r["time"] = INTEGER(timestamp.to_string());
+      r["command"] = command.to_string();
+    } else {
+      r["command"] = line.to_string();
+    }
+
+    r["uid"] = uid;
+    r["history_file"] = history_file;
+    results.push_back(std::move(r));
+    parsed = begin;
+  }
+  return parsed;
+}
+
 void genShellHistoryForUser(const std::string& uid,
                             const std::string& directory,
+                            long long min_time,
                             QueryData& results) {
-  auto bash_timestamp_rx = xp::sregex::compile("^#(?P<timestamp>[0-9]+)$");
-  xp::smatch bash_timestamp_matches;
-  auto zsh_timestamp_rx = xp::sregex::compile(
-      "^: {0,10}(?P<timestamp>[0-9]{1,11}):[0-9]+;(?P<command>.*)$");
-  xp::smatch zsh_timestamp_matches;
-
   for (const auto& hfile : kShellHistoryFiles) {
     boost::filesystem::path history_file = directory;
     history_file /= hfile;
 
-    std::string history_content;
-    if (!forensicReadFile(history_file, history_content).ok()) {
-      // Cannot read a specific history file.
+    struct stat file_stat;
+    if (::stat(history_file.string().c_str(), &file_stat) != 0) {
       continue;
     }
 
-    std::string prev_bash_timestamp;
-    for (const auto& line : split(history_content, "\n")) {
-      if (prev_bash_timestamp.empty() &&
-          xp::regex_search(line, bash_timestamp_matches, bash_timestamp_rx)) {
-        prev_bash_timestamp = bash_timestamp_matches["timestamp"];
-        continue;
+    // Only a regular file is read as one span, that can be resumed.
+    bool regular = S_ISREG(file_stat.st_mode);
+    size_t offset = 0;
+    if (regular && FLAGS_shell_history_incremental) {
+      WriteLock lock(kShellHistoryOffsetsMutex);
+      auto known = kShellHistoryOffsets.find(history_file.string());
+      if (known != kShellHistoryOffsets.end() &&
+          known->second.device == file_stat.st_dev &&
+          known->second.inode == file_stat.st_ino &&
+          known->second.offset <= static_cast<size_t>(file_stat.st_size)) {
+        offset = known->second.offset;
       }
+    }
 
-      Row r;
-
-      if (!prev_bash_timestamp.empty()) {
-        r["time"] = INTEGER(prev_bash_timestamp);
-        r["command"] = line;
-        prev_bash_timestamp.clear();
-      } else if (xp::regex_search(
-                     line, zsh_timestamp_matches, zsh_timestamp_rx)) {
-        r["time"] = INTEGER(zsh_timestamp_matches["timestamp"]);
-        r["command"] = zsh_timestamp_matches["command"];
-      } else {
-        r["command"] = line;
-      }
+    std::string special;
+    size_t parsed = 0;
+    auto status = readFileView(
+        history_file, 4096, true, ([&](boost::string_ref content) {
+          if (!regular) {
+            special.append(content.data(), content.size());
+            return;
+          }
+
+          // A file rewritten in place does not resume within a line.
+          auto start = offset;
+          if (start > content.size() ||
+              (start > 0 && content[start - 1] != '\n')) {
+            start = 0;
+          }
+          if (min_time > 0) {
+            start = std::max(start, findHistoryTail(content, min_time));
+          }
+          parsed = parseHistory(
+              content, start, uid, history_file.string(), results);
+        }));
+    if (!status.ok()) {
+      // Cannot read a specific history file.
+      continue;
+    }
 
-      r["uid"] = uid;
-      r["history_file"] = history_file.string();
-      results.push_back(r);
+    if (!regular) {
+      parseHistory(special, 0, uid, history_file.string(), results);
+    } else if (FLAGS_shell_history_incremental) {
+      WriteLock lock(kShellHistoryOffsetsMutex);
+      kShellHistoryOffsets[history_file.string()] = {
+          file_stat.st_dev, file_stat.st_ino, parsed};
     }
   }
 }
 
-QueryData genShellHistory(QueryContext& context) {
-  QueryData results;
+/// The earliest time the constraints allow, 0 if there is no bound.
+static long long getShellHistoryMinTime(QueryContext& context) {
+  long long min_time = 0;
+  for (const auto op : {GREATER_THAN, GREATER_THAN_OR_EQUALS}) {
+    for (const auto& value : context.constraints["time"].getAll(op)) {
+      long long time = 0;
+      if (safeStrtoll(value, 10, time).ok()) {
+        min_time = std::max(min_time, time);
+      }
+    }
+  }
 
-  // Iterate over each user
-  QueryData users = usersFromContext(context);
-  for (const auto& row : users) {
-    if (row.count("uid") > 0 && row.count("directory") > 0) {
-      genShellHistoryForUser(row.at("uid"), row.at("directory"), results);
+  // Each equal time is allowed, the earliest bounds the lines.
+  auto equals = context.constraints["time"].getAll(EQUALS);
+  if (!equals.empty()) {
+    long long earliest = -1;
+    for (const auto& value : equals) {
+      long long time = 0;
+      if (!safeStrtoll(value, 10, time).ok()) {
+        return min_time;
+      }
+      earliest = (earliest < 0) ? time : std::min(earliest, time);
     }
+    min_time = std::max(min_time, earliest);
   }
+  return min_time;
+}
+
+QueryData genShellHistory(QueryContext& context) {
+  auto min_time = getShellHistoryMinTime(context);
 
-  return results;
+  // Read each user's history files concurrently.
+  return genRowsForUsers(
+      context, ([min_time](const Row& user, QueryData& results) {
+        genShellHistoryForUser(
+            user.at("uid"), user.at("directory"), min_time, results);
+      }));
 }
 }
 }
@@ -8,19 +8,38 @@
  *
  */
 
-#include <pwd.h>
-#include <grp.h>
+#include <atomic>
+#include <map>
+#include <thread>
+
+#include <dirent.h>
+#include <fcntl.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 #include <boost/filesystem.hpp>
+#include <boost/property_tree/json_parser.hpp>
 
+#include <osquery/database.h>
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
+#include "osquery/tables/system/nss_cache.h"
+
 namespace fs = boost::filesystem;
+namespace pt = boost::property_tree;
 
 namespace osquery {
+
+DECLARE_uint64(glob_threads);
+
+FLAG(bool,
+     suid_bin_directory_cache,
+     false,
+     "Reuse suid_bin results for directories with an unchanged mtime");
+
 namespace tables {
 
 std::vector<std::string> kBinarySearchPaths = {
@@ -33,99 +52,261 @@ std::vector<std::string> kBinarySearchPaths = {
   "/tmp",
 };
 
-Status genBin(const fs::path& path, int perms, QueryData& results) {
-  struct stat info;
-  // store user and group
-  if (stat(path.c_str(), &info) != 0) {
-    return Status(1, "stat failed");
-  }
+/// The most directory levels walked below a search path.
+const size_t kSuidBinMaxDepth = 64;
 
-  // store path
-  Row r;
-  r["path"] = path.string();
-  struct passwd *pw = getpwuid(info.st_uid);
-  struct group *gr = getgrgid(info.st_gid);
+/// A setuid or setgid file found by a walk.
+struct SuidFile {
+  std::string path;
+  uid_t uid;
+  gid_t gid;
+  mode_t mode;
+};
 
-  // get user name + group
-  std::string user;
-  if (pw != nullptr) {
-    user = std::string(pw->pw_name);
-  } else {
-    user = boost::lexical_cast<std::string>(info.st_uid);
-  }
+/// The walk of one directory, reused while its mtime is unchanged.
+struct SuidDirectory {
+  std::string mtime;
+  std::vector<std::string> directories;
+  std::vector<SuidFile> files;
+};
 
-  std::string group;
-  if (gr != nullptr) {
-    group = std::string(gr->gr_name);
-  } else {
-    group = boost::lexical_cast<std::string>(info.st_gid);
-  }
+/// Walked directories by path.
+using SuidDirectories = std::map<std::string, SuidDirectory>;
 
-  r["username"] = user;
-  r["groupname"] = group;
+/// The database key of a search path's directory cache.
+static std::string getSuidCacheKey(const std::string& path) {
+  return "suid_bin." + path;
+}
 
-  r["permissions"] = "";
-  if ((perms & 04000) == 04000) {
-    r["permissions"] += "S";
+static void loadSuidDirectories(const std::string& path,
+                                SuidDirectories& directories) {
+  std::string content;
+  if (!getDatabaseValue(kPersistentSettings, getSuidCacheKey(path), content)
+           .ok() ||
+      content.empty()) {
+    return;
   }
 
-  if ((perms & 02000) == 02000) {
-    r["permissions"] += "G";
+  pt::ptree tree;
+  try {
+    std::stringstream input(content);
+    pt::read_json(input, tree);
+  } catch (const pt::json_parser::json_parser_error& /* e */) {
+    return;
   }
 
-  results.push_back(r);
-  return Status(0, "OK");
+  // Keys are paths, which may contain the ptree separator.
+  for (const auto& node : tree) {
+    auto& directory = directories[node.first];
+    directory.mtime = node.second.get("mtime", "");
+    for (const auto& name : node.second.get_child("dirs", pt::ptree())) {
+      directory.directories.push_back(name.second.data());
+    }
+    for (const auto& file : node.second.get_child("files", pt::ptree())) {
+      directory.files.push_back({file.second.get("path", ""),
+                                 file.second.get<uid_t>("uid", 0),
+                                 file.second.get<gid_t>("gid", 0),
+                                 file.second.get<mode_t>("mode", 0)});
+    }
+  }
 }
 
-bool isSuidBin(const fs::path& path, int perms) {
-  if (!fs::is_regular_file(path)) {
-    return false;
-  }
+static void saveSuidDirectories(const std::string& path,
+                                const SuidDirectories& directories) {
+  pt::ptree tree;
+  for (const auto& directory : directories) {
+    pt::ptree node;
+    node.put("mtime", directory.second.mtime);
 
-  if ((perms & 04000) == 04000 || (perms & 02000) == 02000) {
-    return true;
+    pt::ptree dirs;
+    for (const auto& name : directory.second.directories) {
+      dirs.push_back(std::make_pair("", pt::ptree(name)));
+    }
+    node.add_child("dirs", dirs);
+
+    pt::ptree files;
+    for (const auto& file : directory.second.files) {
+      pt::ptree entry;
+      entry.put("path", file.path);
+      entry.put("uid", file.uid);
+      entry.put("gid", file.gid);
+      entry.put("mode", file.mode);
+      files.push_back(std::make_pair("", entry));
+    }
+    node.add_child("files", files);
+    tree.push_back(std::make_pair(directory.first, node));
   }
-  return false;
+
+  std::stringstream output;
+  pt::write_json(output, tree, false);
+  setDatabaseValue(kPersistentSettings, getSuidCacheKey(path), output.str());
+}
+
+static bool isSuidMode(mode_t mode) {
+  return S_ISREG(mode) && (mode & (S_ISUID | S_ISGID)) != 0;
 }
 
-void genSuidBinsFromPath(const std::string& path, QueryData& results) {
-  if (!pathExists(path).ok()) {
-    // Creating an iterator on a missing path will except.
+/**
+ * @brief Find the setuid and setgid files below an open directory.
+ *
+ * Entries are typed from the directory listing, only regular files, links
+ * and untyped entries are stat'd relative to the directory. Links to files
+ * are reported by the link's path, links to directories are not followed.
+ */
+static void walkSuidDirectory(int dir_fd,
+                              const std::string& path,
+                              size_t depth,
+                              const SuidDirectories& cached,
+                              SuidDirectories& walked,
+                              std::vector<SuidFile>& files) {
+  struct stat dir_stat;
+  if (::fstat(dir_fd, &dir_stat) != 0) {
+    ::close(dir_fd);
     return;
   }
 
-  auto it = fs::recursive_directory_iterator(fs::path(path));
-  fs::recursive_directory_iterator end;
-  while (it != end) {
-    fs::path path = *it;
-    try {
-      // Do not traverse symlinked directories.
-      if (fs::is_directory(path) && fs::is_symlink(path)) {
-        it.no_push();
+  auto mtime = std::to_string(dir_stat.st_ino) + "." +
+               std::to_string(dir_stat.st_mtim.tv_sec) + "." +
+               std::to_string(dir_stat.st_mtim.tv_nsec);
+  auto& directory = walked[path];
+  auto previous = cached.find(path);
+  if (FLAGS_suid_bin_directory_cache && previous != cached.end() &&
+      previous->second.mtime == mtime) {
+    directory = previous->second;
+  } else {
+    auto dir = ::fdopendir(dir_fd);
+    if (dir == nullptr) {
+      ::close(dir_fd);
+      walked.erase(path);
+      return;
+    }
+    // The directory stream owns the descriptor, keep one for the children.
+    dir_fd = ::dup(::dirfd(dir));
+
+    directory.mtime = mtime;
+    struct dirent* entry = nullptr;
+    while ((entry = ::readdir(dir)) != nullptr) {
+      const char* name = entry->d_name;
+      if (name[0] == '.' &&
+          (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+        continue;
+      }
+
+      if (entry->d_type == DT_DIR) {
+        directory.directories.push_back(name);
+        continue;
+      } else if (entry->d_type != DT_REG && entry->d_type != DT_LNK &&
+                 entry->d_type != DT_UNKNOWN) {
+        continue;
       }
 
-      int perms = it.status().permissions();
-      if (isSuidBin(path, perms)) {
-        // Only emit suid bins.
-        genBin(path, perms, results);
+      struct stat entry_stat;
+      int flags = (entry->d_type == DT_LNK) ? 0 : AT_SYMLINK_NOFOLLOW;
+      if (::fstatat(::dirfd(dir), name, &entry_stat, flags) != 0) {
+        continue;
       }
 
-      ++it;
-    } catch (fs::filesystem_error& e) {
-      VLOG(1) << "Cannot read binary from " << path;
-      it.no_push();
-      // Try to recover, otherwise break.
-      try { ++it; } catch(fs::filesystem_error& e) { break; }
+      if (entry->d_type == DT_UNKNOWN && S_ISDIR(entry_stat.st_mode)) {
+        directory.directories.push_back(name);
+      } else if (isSuidMode(entry_stat.st_mode)) {
+        directory.files.push_back({(fs::path(path) / name).string(),
+                                   entry_stat.st_uid,
+                                   entry_stat.st_gid,
+                                   entry_stat.st_mode});
+      }
+    }
+    ::closedir(dir);
+    if (dir_fd < 0) {
+      return;
+    }
+  }
+
+  files.insert(files.end(), directory.files.begin(), directory.files.end());
+  if (depth + 1 < kSuidBinMaxDepth) {
+    // Copy the names, the walked map may be modified by the children.
+    auto subdirectories = directory.directories;
+    for (const auto& name : subdirectories) {
+      auto child_fd = ::openat(dir_fd,
+                               name.c_str(),
+                               O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+      if (child_fd >= 0) {
+        walkSuidDirectory(child_fd,
+                          (fs::path(path) / name).string(),
+                          depth + 1,
+                          cached,
+                          walked,
+                          files);
+      }
     }
   }
+  ::close(dir_fd);
+}
+
+void genSuidBinsFromPath(const std::string& path,
+                         std::vector<SuidFile>& files) {
+  // The search path itself may be a link, such as /bin to /usr/bin.
+  auto dir_fd = ::open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd < 0) {
+    return;
+  }
+
+  SuidDirectories cached;
+  if (FLAGS_suid_bin_directory_cache) {
+    loadSuidDirectories(path, cached);
+  }
+
+  SuidDirectories walked;
+  walkSuidDirectory(dir_fd, path, 0, cached, walked, files);
+  if (FLAGS_suid_bin_directory_cache) {
+    saveSuidDirectories(path, walked);
+  }
 }
 
 QueryData genSuidBin(QueryContext& context) {
   QueryData results;
 
   // Todo: add hidden column to select on that triggers non-std path searches.
-  for (const auto& path : kBinarySearchPaths) {
-    genSuidBinsFromPath(path, results);
+  std::vector<std::vector<SuidFile>> files(kBinarySearchPaths.size());
+  std::atomic<size_t> cursor(0);
+  auto walker = [&files, &cursor]() {
+    while (true) {
+      auto index = cursor.fetch_add(1);
+      if (index >= kBinarySearchPaths.size()) {
+        break;
+      }
+      genSuidBinsFromPath(kBinarySearchPaths[index], files[index]);
+    }
+  };
+
+  // Search paths are walked concurrently.
+  auto threads = std::max<size_t>(FLAGS_glob_threads, 1);
+  threads = std::min(threads, kBinarySearchPaths.size());
+  std::vector<std::thread> walkers;
+  for (size_t i = 1; i < threads; i++) {
+    walkers.emplace_back(walker);
+  }
+  walker();
+  for (auto& thread : walkers) {
+    thread.join();
+  }
+
+  for (const auto& search_path : files) {
+    for (const auto& file : search_path) {
+      Row r;
+      r["path"] = file.path;
+      r["username"] = getUserName(file.uid);
+      r["groupname"] = getGroupName(file.gid);
+
+      r["permissions"] = "";
+      if ((file.mode & 04000) == 04000) {
+        r["permissions"] += "S";
+      }
+
+      if ((file.mode & 02000) == 02000) {
+        r["permissions"] += "G";
+      }
+      results.push_back(r);
+    }
   }
 
   return results;
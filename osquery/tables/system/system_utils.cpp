@@ -8,9 +8,22 @@
  *
  */
 
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#include <osquery/flags.h>
 #include <osquery/sql.h>
 
+#include "osquery/tables/system/system_utils.h"
+
 namespace osquery {
+
+FLAG(uint64,
+     user_table_threads,
+     4,
+     "Number of threads generating the rows of users for user tables");
+
 namespace tables {
 
 QueryData usersFromContext(const QueryContext& context, bool all) {
@@ -32,6 +45,68 @@ QueryData usersFromContext(const QueryContext& context, bool all) {
   return users;
 }
 
+QueryData genRowsForUsers(const QueryContext& context,
+                          const UserRowsGenerator& generator,
+                          bool all) {
+  QueryData users;
+  if (!context.hasConstraint("uid", EQUALS) &&
+      context.hasConstraint("username", EQUALS)) {
+    context.forEachConstraint(
+        "username",
+        EQUALS,
+        ([&users](const std::string& expr) {
+          auto user = SQL::selectAllFrom("users", "username", EQUALS, expr);
+          users.insert(users.end(), user.begin(), user.end());
+        }));
+  } else {
+    users = usersFromContext(context, all);
+  }
+
+  // Drop the users the uid constraints exclude before reading their homes.
+  auto uid = context.constraints.find("uid");
+  bool constrained =
+      (uid != context.constraints.end() && uid->second.exists());
+  users.erase(std::remove_if(users.begin(),
+                             users.end(),
+                             [&](const Row& user) {
+                               return user.count("uid") == 0 ||
+                                      user.count("directory") == 0 ||
+                                      (constrained &&
+                                       !uid->second.matches(user.at("uid")));
+                             }),
+              users.end());
+
+  std::vector<QueryData> rows(users.size());
+  std::atomic<size_t> cursor(0);
+  auto worker = [&]() {
+    while (true) {
+      auto index = cursor.fetch_add(1);
+      if (index >= users.size()) {
+        break;
+      }
+      generator(users[index], rows[index]);
+    }
+  };
+
+  auto threads = std::max<size_t>(FLAGS_user_table_threads, 1);
+  threads = std::min(threads, users.size());
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < threads; i++) {
+    workers.emplace_back(worker);
+  }
+  worker();
+  for (auto& thread : workers) {
+    thread.join();
+  }
+
+  QueryData results;
+  for (auto& user_rows : rows) {
+    std::move(
+        user_rows.begin(), user_rows.end(), std::back_inserter(results));
+  }
+  return results;
+}
+
 QueryData pidsFromContext(const QueryContext& context, bool all) {
   QueryData procs;
   if (context.hasConstraint("pid", EQUALS)) {
@@ -10,6 +10,8 @@
 
 #pragma once
 
+#include <functional>
+
 #include <osquery/tables.h>
 
 namespace osquery {
@@ -26,6 +28,32 @@ namespace tables {
  */
 QueryData usersFromContext(const QueryContext& context, bool all = false);
 
+/// Generate a user's rows, given the user's row from the users table.
+using UserRowsGenerator =
+    std::function<void(const Row& user, QueryData& results)>;
+
+/**
+ * @brief Generate rows for each user given a context, users concurrently.
+ *
+ * Users are selected as in usersFromContext, or by an equal `username`
+ * constraint. Other `uid` constraints, such as ranges, drop users before
+ * their rows are generated, and users without a uid or home directory are
+ * skipped.
+ *
+ * Each user's rows are generated on up to `--user_table_threads` threads,
+ * as reading home directories on network filesystems mostly waits for I/O.
+ * The generator must be safe to call concurrently, keep parsed files in a
+ * FileRowsCache. Rows are appended in the order of the users.
+ *
+ * @param context The context given to a table implementation.
+ * @param generator Called with each user's row.
+ * @param optional all Generate rows for all users regardless of context.
+ * @return The rows of every user.
+ */
+QueryData genRowsForUsers(const QueryContext& context,
+                          const UserRowsGenerator& generator,
+                          bool all = false);
+
 /**
  * Get a list of pids given a context.
  *
@@ -8,18 +8,43 @@
  *
  */
 
+#ifdef __linux__
+#include <utmpx.h>
+#endif
+
+#include <boost/filesystem.hpp>
+
 #include <gtest/gtest.h>
 
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 #include <osquery/sql.h>
 
+#include "osquery/tables/system/file_rows_cache.h"
+#include "osquery/tables/system/nss_cache.h"
+#include "osquery/tables/system/system_utils.h"
 #include "osquery/tests/test_util.h"
 
 namespace osquery {
+
+DECLARE_bool(shell_history_incremental);
+DECLARE_bool(last_incremental);
+DECLARE_uint64(nss_cache_ttl);
+
 namespace tables {
 
 QueryData genOSVersion(QueryContext& context);
+void genShellHistoryForUser(const std::string& uid,
+                            const std::string& directory,
+                            long long min_time,
+                            QueryData& results);
+#ifdef __linux__
+void genLastAccessFromFile(const std::string& path,
+                           QueryContext& context,
+                           QueryData& results);
+#endif
 
 class SystemsTablesTests : public testing::Test {};
 
@@ -40,6 +65,54 @@ TEST_F(SystemsTablesTests, test_os_version) {
   EXPECT_FALSE(result[0]["name"].empty());
 }
 
+TEST_F(SystemsTablesTests, test_shell_history) {
+  auto directory = kTestWorkingDirectory + "shell_history";
+  boost::filesystem::create_directories(directory);
+  writeTextFile(directory + "/.bash_history",
+                "#100\nls -la\nuntimed\n\n#200\ncd /tmp\n");
+  writeTextFile(directory + "/.zsh_history",
+                ": 150:0;make\n:  250:3;make install\n");
+
+  QueryData results;
+  genShellHistoryForUser("0", directory, 0, results);
+  ASSERT_EQ(results.size(), 5U);
+  EXPECT_EQ(results[0]["time"], "100");
+  EXPECT_EQ(results[0]["command"], "ls -la");
+  EXPECT_EQ(results[1].count("time"), 0U);
+  EXPECT_EQ(results[1]["command"], "untimed");
+  EXPECT_EQ(results[2]["time"], "200");
+  EXPECT_EQ(results[3]["time"], "150");
+  EXPECT_EQ(results[3]["command"], "make");
+  EXPECT_EQ(results[4]["time"], "250");
+  EXPECT_EQ(results[4]["command"], "make install");
+
+  // With a time constraint only the tail of each file is parsed.
+  results.clear();
+  genShellHistoryForUser("0", directory, 200, results);
+  ASSERT_EQ(results.size(), 3U);
+  EXPECT_EQ(results[0]["command"], "untimed");
+  EXPECT_EQ(results[1]["time"], "200");
+  EXPECT_EQ(results[2]["time"], "250");
+
+  // Incremental reads only report appended lines.
+  FLAGS_shell_history_incremental = true;
+  results.clear();
+  genShellHistoryForUser("0", directory, 0, results);
+  EXPECT_EQ(results.size(), 5U);
+
+  results.clear();
+  genShellHistoryForUser("0", directory, 0, results);
+  EXPECT_EQ(results.size(), 0U);
+
+  writeTextFile(directory + "/.zsh_history",
+                ": 150:0;make\n:  250:3;make install\n: 300:0;exit\n");
+  results.clear();
+  genShellHistoryForUser("0", directory, 0, results);
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0]["command"], "exit");
+  FLAGS_shell_history_incremental = false;
+}
+
 TEST_F(SystemsTablesTests, test_process_info) {
   auto results = SQL("select * from osquery_info join processes using (pid)");
   ASSERT_EQ(results.rows().size(), 1U);
@@ -62,6 +135,193 @@ TEST_F(SystemsTablesTests, test_processes) {
   EXPECT_EQ(results.rows().size(), 0U);
 }
 
+TEST_F(SystemsTablesTests, test_nss_cache) {
+  auto ttl = FLAGS_nss_cache_ttl;
+  for (auto flag : {0, 60}) {
+    FLAGS_nss_cache_ttl = flag;
+
+    // Each lookup, cached or not, matches the password database.
+    for (size_t i = 0; i < 2; i++) {
+      UserEntry user;
+      ASSERT_TRUE(getUserByUid(0, user));
+      EXPECT_EQ(user.uid, 0U);
+      EXPECT_EQ(user.name, getpwuid(0)->pw_name);
+      EXPECT_EQ(getUserName(0), user.name);
+    }
+
+    GroupEntry group;
+    ASSERT_TRUE(getGroupByGid(0, group));
+    EXPECT_EQ(group.name, getgrgid(0)->gr_name);
+
+    // Missing entries resolve to the decimal id.
+    UserEntry user;
+    EXPECT_FALSE(getUserByUid(4000000123U, user));
+    EXPECT_EQ(getUserName(4000000123U), "4000000123");
+    EXPECT_EQ(getGroupName(4000000123U), "4000000123");
+
+    // The enumeration includes root and fills the uid cache.
+    std::vector<UserEntry> users;
+    getAllUsers(users);
+    bool root = false;
+    for (const auto& entry : users) {
+      root = root || (entry.uid == 0);
+    }
+    EXPECT_TRUE(root);
+
+    std::vector<GroupEntry> groups;
+    getAllGroups(groups);
+    EXPECT_FALSE(groups.empty());
+  }
+  FLAGS_nss_cache_ttl = ttl;
+}
+
+TEST_F(SystemsTablesTests, test_rows_for_users) {
+  auto generator = [](const Row& user, QueryData& results) {
+    results.push_back({{"uid", user.at("uid")}});
+    results.push_back({{"uid", user.at("uid")}});
+  };
+
+  // Every user's rows are appended in the order of the users.
+  QueryContext context;
+  auto users = usersFromContext(context, true);
+  auto results = genRowsForUsers(context, generator, true);
+  std::vector<std::string> expected;
+  for (const auto& user : users) {
+    if (user.count("uid") > 0 && user.count("directory") > 0) {
+      expected.push_back(user.at("uid"));
+      expected.push_back(user.at("uid"));
+    }
+  }
+  ASSERT_EQ(results.size(), expected.size());
+  for (size_t i = 0; i < expected.size(); i++) {
+    EXPECT_EQ(results[i].at("uid"), expected[i]);
+  }
+
+  // A username selects its user.
+  context.constraints["username"].add(Constraint(EQUALS, "root"));
+  results = genRowsForUsers(context, generator);
+  ASSERT_EQ(results.size(), 2U);
+  EXPECT_EQ(results[0].at("uid"), "0");
+
+  // Other uid constraints drop users before generating their rows.
+  QueryContext range;
+  range.constraints["uid"].affinity = INTEGER_TYPE;
+  range.constraints["uid"].add(Constraint(GREATER_THAN, "0"));
+  results = genRowsForUsers(range, generator, true);
+  for (const auto& row : results) {
+    EXPECT_NE(row.at("uid"), "0");
+  }
+}
+
+TEST_F(SystemsTablesTests, test_process_memory_map) {
+  std::string self =
+      "select * from process_memory_map where pid = (select pid from "
+      "osquery_info)";
+  auto all = SQL(self);
+  ASSERT_GT(all.rows().size(), 0U);
+
+  // Filtering within the table must agree with filtering every mapping.
+  size_t pseudo = 0;
+  size_t stack = 0;
+  for (const auto& row : all.rows()) {
+    pseudo += (row.at("pseudo") == "1") ? 1 : 0;
+    stack += (row.at("path") == "[stack]") ? 1 : 0;
+  }
+  EXPECT_EQ(SQL(self + " and pseudo = 1").rows().size(), pseudo);
+  EXPECT_EQ(SQL(self + " and path LIKE '%[STACK]%'").rows().size(), stack);
+  EXPECT_EQ(SQL(self + " and path = '[stack]'").rows().size(), stack);
+  EXPECT_EQ(SQL(self + " and permissions LIKE '%'").rows().size(),
+            all.rows().size());
+}
+
+TEST_F(SystemsTablesTests, test_file_rows_cache) {
+  auto path = kTestWorkingDirectory + "file_rows_cache";
+  writeTextFile(path, "first");
+
+  size_t parses = 0;
+  auto parser = [&parses](const std::string& file, QueryData& rows) {
+    parses++;
+    std::string content;
+    auto status = readFile(file, content);
+    if (status.ok()) {
+      rows.push_back({{"content", content}});
+    }
+    return status;
+  };
+
+  FileRowsCache cache;
+  QueryData results;
+  EXPECT_TRUE(cache.get(path, parser, results).ok());
+  EXPECT_TRUE(cache.get(path, parser, results).ok());
+  EXPECT_EQ(parses, 1U);
+  EXPECT_EQ(cache.size(), 1U);
+  ASSERT_EQ(results.size(), 2U);
+  EXPECT_EQ(results[1]["content"], "first");
+
+  // A change in size changes the file's key.
+  writeTextFile(path, "second");
+  results.clear();
+  EXPECT_TRUE(cache.get(path, parser, results).ok());
+  EXPECT_EQ(parses, 2U);
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0]["content"], "second");
+
+  // Missing files are given to the parser each time and not kept.
+  auto missing = kTestWorkingDirectory + "file_rows_cache_missing";
+  EXPECT_FALSE(cache.get(missing, parser, results).ok());
+  EXPECT_FALSE(cache.get(missing, parser, results).ok());
+  EXPECT_EQ(parses, 4U);
+  EXPECT_EQ(cache.size(), 1U);
+
+  cache.clear();
+  EXPECT_EQ(cache.size(), 0U);
+  boost::filesystem::remove(path);
+}
+
+#ifdef __linux__
+TEST_F(SystemsTablesTests, test_last_wtmp) {
+  std::vector<struct utmpx> records(3);
+  for (size_t i = 0; i < records.size(); i++) {
+    memset(&records[i], 0, sizeof(struct utmpx));
+    records[i].ut_type = USER_PROCESS;
+    records[i].ut_pid = 100 + i;
+    records[i].ut_tv.tv_sec = 1000 * (i + 1);
+    strncpy(records[i].ut_user, "osquery", sizeof(records[i].ut_user));
+  }
+  auto path = kTestWorkingDirectory + "wtmp";
+  writeTextFile(path,
+                std::string(reinterpret_cast<const char*>(records.data()),
+                            records.size() * sizeof(struct utmpx)));
+
+  QueryContext context;
+  QueryData results;
+  genLastAccessFromFile(path, context, results);
+  ASSERT_EQ(results.size(), 3U);
+  EXPECT_EQ(results[0]["username"], "osquery");
+  EXPECT_EQ(results[2]["pid"], "102");
+
+  // Time constraints seek to and stop at the matching records.
+  context.constraints["time"].add(Constraint(GREATER_THAN, "1000"));
+  context.constraints["time"].add(Constraint(LESS_THAN_OR_EQUALS, "2000"));
+  results.clear();
+  genLastAccessFromFile(path, context, results);
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0]["time"], "2000");
+
+  // Incremental reads only report appended records.
+  FLAGS_last_incremental = true;
+  QueryContext unconstrained;
+  results.clear();
+  genLastAccessFromFile(path, unconstrained, results);
+  EXPECT_EQ(results.size(), 3U);
+  results.clear();
+  genLastAccessFromFile(path, unconstrained, results);
+  EXPECT_EQ(results.size(), 0U);
+  FLAGS_last_incremental = false;
+  boost::filesystem::remove(path);
+}
+#endif
+
 TEST_F(SystemsTablesTests, test_abstract_joins) {
   // Codify several assumptions about how tables should be joined into tests.
   // The first is an implicit inner join from processes to file information.
@@ -8,14 +8,15 @@
  *
  */
 
+#include <algorithm>
 #include <map>
+#include <set>
 #include <string>
 #include <sstream>
+#include <vector>
 
 #include <stdlib.h>
 
-#include <boost/algorithm/string/trim.hpp>
-
 #include <osquery/core.h>
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
@@ -24,82 +25,292 @@
 #include "osquery/core/conversions.h"
 #include "osquery/tables/system/windows/system_util.h"
 
+#include <winternl.h>
+
 namespace osquery {
 namespace tables {
- 
-std::set<long> getProcList(const QueryContext &context) {
-  std::set<long> pidlist;
-  if (context.constraints.count("pid") > 0 &&
-    context.constraints.at("pid").exists(EQUALS)) {
-    for (const auto &pid : context.constraints.at("pid").getAll<int>(EQUALS)) {
-      if (pid > 0) {
-        pidlist.insert(pid);
-      }
+
+/// The SystemProcessInformation class of NtQuerySystemInformation.
+const ULONG kSystemProcessInformation = 5;
+
+/// The status returned when the snapshot buffer is too small.
+const NTSTATUS kStatusInfoLengthMismatch = static_cast<NTSTATUS>(0xC0000004L);
+
+/// FILETIME and process times are counted in 100 nanosecond intervals.
+const ULONGLONG kFileTimeTicksPerMilli = 10000;
+
+/**
+ * @brief An entry of the SystemProcessInformation snapshot.
+ *
+ * The winternl.h structure leaves most of these members reserved. Entries
+ * are followed by the process's thread entries, the next entry is found
+ * using NextEntryOffset.
+ */
+struct SystemProcessEntry {
+  ULONG NextEntryOffset;
+  ULONG NumberOfThreads;
+  LARGE_INTEGER WorkingSetPrivateSize;
+  ULONG HardFaultCount;
+  ULONG NumberOfThreadsHighWatermark;
+  ULONGLONG CycleTime;
+  LARGE_INTEGER CreateTime;
+  LARGE_INTEGER UserTime;
+  LARGE_INTEGER KernelTime;
+  UNICODE_STRING ImageName;
+  LONG BasePriority;
+  HANDLE UniqueProcessId;
+  HANDLE InheritedFromUniqueProcessId;
+  ULONG HandleCount;
+  ULONG SessionId;
+  ULONG_PTR UniqueProcessKey;
+  SIZE_T PeakVirtualSize;
+  SIZE_T VirtualSize;
+  ULONG PageFaultCount;
+  SIZE_T PeakWorkingSetSize;
+  SIZE_T WorkingSetSize;
+  SIZE_T QuotaPeakPagedPoolUsage;
+  SIZE_T QuotaPagedPoolUsage;
+  SIZE_T QuotaPeakNonPagedPoolUsage;
+  SIZE_T QuotaNonPagedPoolUsage;
+  SIZE_T PagefileUsage;
+  SIZE_T PeakPagefileUsage;
+  SIZE_T PrivatePageCount;
+};
+
+using NtQuerySystemInformationFn = NTSTATUS(WINAPI*)(ULONG,
+                                                     PVOID,
+                                                     ULONG,
+                                                     PULONG);
+
+static std::string wideToString(const wchar_t* src, size_t length) {
+  if (src == nullptr || length == 0) {
+    return "";
+  }
+
+  auto size = ::WideCharToMultiByte(CP_UTF8,
+                                    0,
+                                    src,
+                                    static_cast<int>(length),
+                                    nullptr,
+                                    0,
+                                    nullptr,
+                                    nullptr);
+  if (size <= 0) {
+    return "";
+  }
+
+  std::string result(size, '\0');
+  ::WideCharToMultiByte(CP_UTF8,
+                        0,
+                        src,
+                        static_cast<int>(length),
+                        &result[0],
+                        size,
+                        nullptr,
+                        nullptr);
+  return result;
+}
+
+/**
+ * @brief Read every process's entry at once.
+ *
+ * The snapshot grows between the size query and the read as processes
+ * start, so the read is retried with the size reported.
+ */
+static Status getProcessSnapshot(std::vector<char>& snapshot) {
+  static auto query = reinterpret_cast<NtQuerySystemInformationFn>(
+      ::GetProcAddress(::GetModuleHandleA("ntdll.dll"),
+                       "NtQuerySystemInformation"));
+  if (query == nullptr) {
+    return Status(1, "Cannot resolve NtQuerySystemInformation");
+  }
+
+  snapshot.resize(512 * 1024);
+  for (size_t attempt = 0; attempt < 8; attempt++) {
+    ULONG needed = 0;
+    auto status = query(kSystemProcessInformation,
+                        snapshot.data(),
+                        static_cast<ULONG>(snapshot.size()),
+                        &needed);
+    if (status == kStatusInfoLengthMismatch) {
+      // Leave room for processes started before the next attempt.
+      snapshot.resize(std::max(snapshot.size() * 2,
+                               static_cast<size_t>(needed) + 64 * 1024));
+      continue;
     }
-    return pidlist;
-  } else {
-    WmiRequest request("SELECT ProcessId FROM Win32_Process");
-    if (request.ok()) {
-      for (auto const& result : request.results()) {
-        pidlist.insert(result.GetLong("ProcessId"));
-      }
+
+    if (!NT_SUCCESS(status)) {
+      return Status(1, "Cannot read the process snapshot");
     }
-    return pidlist;
+    return Status(0, "OK");
   }
+  return Status(1, "The process snapshot kept growing");
 }
 
+/// The pids the query is constrained to, false if every process is used.
+static bool getProcList(const QueryContext& context, std::set<long>& pidlist) {
+  if (context.constraints.count("pid") == 0 ||
+      !context.constraints.at("pid").exists(EQUALS)) {
+    return false;
+  }
 
-void genProcess(long pid, QueryData& results_data) {
+  for (const auto& pid : context.constraints.at("pid").getAll<int>(EQUALS)) {
+    if (pid > 0) {
+      pidlist.insert(pid);
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Read the command lines of the processes.
+ *
+ * A command line is only readable from the process's memory, WMI reads them
+ * for all processes with a single query.
+ */
+static void getProcessCommandLines(const std::set<long>& pidlist,
+                                   std::map<long, std::string>& cmdlines) {
   std::stringstream ss;
-  ss << "SELECT * FROM Win32_Process WHERE ProcessId=" << pid;
+  ss << "SELECT ProcessId, CommandLine FROM Win32_Process";
+  for (auto pid = pidlist.begin(); pid != pidlist.end(); ++pid) {
+    ss << ((pid == pidlist.begin()) ? " WHERE " : " OR ");
+    ss << "ProcessId=" << *pid;
+  }
 
   WmiRequest request(ss.str());
   if (request.ok()) {
-    std::vector<WmiResultItem> &results = request.results();
-    if (results.size() == 1) {
-      Row r;
-
-      r["pid"] = BIGINT(results[0].GetLong("ProcessId"));
-      r["name"] = SQL_TEXT(results[0].GetString("Name"));
-      r["path"] = SQL_TEXT(results[0].GetString("ExecutablePath"));
-      r["cmdline"] = SQL_TEXT(results[0].GetString("CommandLine"));
-      r["state"] = SQL_TEXT(results[0].GetString("ExecutionState"));
-      r["parent"] = BIGINT(results[0].GetLong("ParentProcessId"));
-      r["nice"] = INTEGER(results[0].GetLong("Priority"));
-      r["on_disk"] = osquery::pathExists(r["path"]).toString();
-
-      // TODO: some of these such as cwd, wired_size, phys_footprint
-      // should be retrievable either via Windows API or WMI
-      r["cwd"] = "";
-      r["root"] = "";
-
-      r["pgroup"] = "-1";
-      r["uid"] = "-1";
-      r["euid"] = "-1";
-      r["suid"] = "-1";
-      r["gid"] = "-1";
-      r["egid"] = "-1";
-      r["sgid"] = "-1";
-
-      r["wired_size"] = "0";
-      r["resident_size"] = "0";
-      r["phys_footprint"] = "0";
-
-      r["user_time"] = "0";
-      r["system_time"] = "0";
-      r["start_time"] = "0";
-
-      results_data.push_back(r);
+    for (const auto& result : request.results()) {
+      cmdlines[result.GetLong("ProcessId")] = result.GetString("CommandLine");
     }
   }
 }
 
+/// Find the path of a process's image, empty if it cannot be opened.
+static std::string getProcessPath(long pid) {
+  auto process = ::OpenProcess(
+      PROCESS_QUERY_LIMITED_INFORMATION, FALSE, static_cast<DWORD>(pid));
+  if (process == nullptr) {
+    return "";
+  }
+
+  std::vector<wchar_t> path(MAX_PATH * 4);
+  auto size = static_cast<DWORD>(path.size());
+  std::string result;
+  if (::QueryFullProcessImageNameW(process, 0, path.data(), &size)) {
+    result = wideToString(path.data(), size);
+  }
+  ::CloseHandle(process);
+  return result;
+}
+
+/// The system start, as a FILETIME, for process start times since boot.
+static ULONGLONG getBootFileTime() {
+  FILETIME now;
+  ::GetSystemTimeAsFileTime(&now);
+  ULARGE_INTEGER ticks;
+  ticks.LowPart = now.dwLowDateTime;
+  ticks.HighPart = now.dwHighDateTime;
+  return ticks.QuadPart - ::GetTickCount64() * kFileTimeTicksPerMilli;
+}
+
+static void genProcess(const SystemProcessEntry& entry,
+                       const QueryContext& context,
+                       const std::map<long, std::string>& cmdlines,
+                       ULONGLONG boot_time,
+                       QueryData& results) {
+  auto pid = static_cast<long>(
+      reinterpret_cast<ULONG_PTR>(entry.UniqueProcessId));
+
+  Row r;
+  r["pid"] = BIGINT(pid);
+  r["parent"] = BIGINT(static_cast<long>(
+      reinterpret_cast<ULONG_PTR>(entry.InheritedFromUniqueProcessId)));
+  if (entry.ImageName.Buffer != nullptr) {
+    r["name"] = wideToString(entry.ImageName.Buffer,
+                             entry.ImageName.Length / sizeof(wchar_t));
+  } else if (pid == 0) {
+    r["name"] = "System Idle Process";
+  }
+
+  // The process is only opened for the columns the snapshot lacks.
+  if (context.isAnyColumnUsed({"path", "on_disk"})) {
+    r["path"] = getProcessPath(pid);
+    r["on_disk"] = (r["path"].empty())
+                       ? "-1"
+                       : osquery::pathExists(r["path"]).toString();
+  } else {
+    r["path"] = "";
+    r["on_disk"] = "-1";
+  }
+
+  auto cmdline = cmdlines.find(pid);
+  r["cmdline"] = (cmdline != cmdlines.end()) ? cmdline->second : "";
+  r["state"] = "";
+  r["nice"] = INTEGER(entry.BasePriority);
+
+  // TODO: cwd is only readable from the process's memory.
+  r["cwd"] = "";
+  r["root"] = "";
+
+  r["pgroup"] = "-1";
+  r["uid"] = "-1";
+  r["euid"] = "-1";
+  r["suid"] = "-1";
+  r["gid"] = "-1";
+  r["egid"] = "-1";
+  r["sgid"] = "-1";
+
+  r["wired_size"] = "0";
+  r["resident_size"] = BIGINT(entry.PrivatePageCount);
+  r["phys_footprint"] = BIGINT(entry.WorkingSetSize);
+
+  r["user_time"] = BIGINT(entry.UserTime.QuadPart / kFileTimeTicksPerMilli);
+  r["system_time"] =
+      BIGINT(entry.KernelTime.QuadPart / kFileTimeTicksPerMilli);
+  auto create_time = static_cast<ULONGLONG>(entry.CreateTime.QuadPart);
+  r["start_time"] =
+      BIGINT((create_time > boot_time)
+                 ? (create_time - boot_time) / (kFileTimeTicksPerMilli * 1000)
+                 : 0);
+  results.push_back(std::move(r));
+}
+
 QueryData genProcesses(QueryContext& context) {
   QueryData results;
 
-  auto pidlist = getProcList(context);
-  for (const auto& pid : pidlist) {
-    genProcess(pid, results);
+  std::vector<char> snapshot;
+  auto status = getProcessSnapshot(snapshot);
+  if (!status.ok()) {
+    VLOG(1) << status.getMessage();
+    return results;
+  }
+
+  std::set<long> pidlist;
+  auto constrained = getProcList(context, pidlist);
+  if (constrained && pidlist.empty()) {
+    return results;
+  }
+
+  std::map<long, std::string> cmdlines;
+  if (context.isColumnUsed("cmdline")) {
+    getProcessCommandLines(pidlist, cmdlines);
+  }
+
+  auto boot_time = getBootFileTime();
+  size_t offset = 0;
+  while (offset + sizeof(SystemProcessEntry) <= snapshot.size()) {
+    const auto& entry =
+        *reinterpret_cast<const SystemProcessEntry*>(snapshot.data() + offset);
+    auto pid = static_cast<long>(
+        reinterpret_cast<ULONG_PTR>(entry.UniqueProcessId));
+    if (!constrained || pidlist.count(pid) > 0) {
+      genProcess(entry, context, cmdlines, boot_time, results);
+    }
+
+    if (entry.NextEntryOffset == 0) {
+      break;
+    }
+    offset += entry.NextEntryOffset;
   }
 
   return results;
@@ -8,8 +8,13 @@
  *
  */
 
+#include <fcntl.h>
 #include <sys/stat.h>
 
+#ifdef __linux__
+#include <sys/sysmacros.h>
+#endif
+
 #include <boost/filesystem.hpp>
 
 #include <osquery/filesystem.h>
@@ -21,78 +26,286 @@ namespace fs = boost::filesystem;
 namespace osquery {
 namespace tables {
 
-const std::map<fs::file_type, std::string> kTypeNames{
-    {fs::regular_file, "regular"},
-    {fs::directory_file, "directory"},
-    {fs::symlink_file, "symlink"},
-    {fs::block_file, "block"},
-    {fs::character_file, "character"},
-    {fs::fifo_file, "fifo"},
-    {fs::socket_file, "socket"},
-    {fs::type_unknown, "unknown"},
-    {fs::status_error, "error"},
+/// The status fields a column needs, these match the statx mask bits.
+enum FileStatFields : unsigned int {
+  FILE_STAT_TYPE = 0x1,
+  FILE_STAT_MODE = 0x2,
+  FILE_STAT_NLINK = 0x4,
+  FILE_STAT_UID = 0x8,
+  FILE_STAT_GID = 0x10,
+  FILE_STAT_ATIME = 0x20,
+  FILE_STAT_MTIME = 0x40,
+  FILE_STAT_CTIME = 0x80,
+  FILE_STAT_INO = 0x100,
+  FILE_STAT_SIZE = 0x200,
+  FILE_STAT_BTIME = 0x800,
+};
+
+#if defined(__linux__) && defined(STATX_BASIC_STATS)
+static_assert(FILE_STAT_TYPE == STATX_TYPE && FILE_STAT_INO == STATX_INO &&
+                  FILE_STAT_BTIME == STATX_BTIME,
+              "File status fields must match the statx mask");
+#endif
+
+/// Columns filled from the file's status, the device and block size are
+/// always returned.
+const std::map<std::string, unsigned int> kFileStatColumns{
+    {"inode", FILE_STAT_INO},
+    {"uid", FILE_STAT_UID},
+    {"gid", FILE_STAT_GID},
+    {"mode", FILE_STAT_TYPE | FILE_STAT_MODE},
+    {"device", 0},
+    {"size", FILE_STAT_SIZE},
+    {"block_size", 0},
+    {"atime", FILE_STAT_ATIME},
+    {"mtime", FILE_STAT_MTIME},
+    {"ctime", FILE_STAT_CTIME},
+    {"btime", FILE_STAT_BTIME},
+    {"hard_links", FILE_STAT_NLINK},
+    {"type", FILE_STAT_TYPE},
+};
+
+/// The status columns a query references and the fields they need.
+struct FileColumns {
+  std::set<std::string> used;
+  unsigned int mask{0};
+};
+
+/// The parts of a file's status used by the file table.
+struct FileStatus {
+  uint64_t inode{0};
+  uint64_t uid{0};
+  uint64_t gid{0};
+  mode_t mode{0};
+  uint64_t device{0};
+  uint64_t size{0};
+  uint64_t block_size{0};
+  uint64_t hard_links{0};
+  int64_t atime{0};
+  int64_t mtime{0};
+  int64_t ctime{0};
+  int64_t btime{0};
 };
 
-void genFileInfo(const fs::path& path,
+static bool statFile(const fs::path& path,
+                     unsigned int mask,
+                     FileStatus& status) {
+#if defined(__linux__) && defined(STATX_BASIC_STATS)
+  // Only the requested fields are fetched, a filesystem may skip the rest.
+  struct statx file_stat;
+  if (::statx(AT_FDCWD, path.string().c_str(), 0, mask, &file_stat) < 0) {
+    return false;
+  }
+
+  status.inode = file_stat.stx_ino;
+  status.uid = file_stat.stx_uid;
+  status.gid = file_stat.stx_gid;
+  status.mode = file_stat.stx_mode;
+  status.device = makedev(file_stat.stx_rdev_major, file_stat.stx_rdev_minor);
+  status.size = file_stat.stx_size;
+  status.block_size = file_stat.stx_blksize;
+  status.hard_links = file_stat.stx_nlink;
+  status.atime = file_stat.stx_atime.tv_sec;
+  status.mtime = file_stat.stx_mtime.tv_sec;
+  status.ctime = file_stat.stx_ctime.tv_sec;
+  // Not every filesystem records a birth time.
+  if (file_stat.stx_mask & STATX_BTIME) {
+    status.btime = file_stat.stx_btime.tv_sec;
+  }
+  return true;
+#elif !defined(WIN32)
+  struct stat file_stat;
+  if (::stat(path.string().c_str(), &file_stat) < 0) {
+    return false;
+  }
+
+  status.inode = file_stat.st_ino;
+  status.uid = file_stat.st_uid;
+  status.gid = file_stat.st_gid;
+  status.mode = file_stat.st_mode;
+  status.device = file_stat.st_rdev;
+  status.size = file_stat.st_size;
+  status.block_size = file_stat.st_blksize;
+  status.hard_links = file_stat.st_nlink;
+  status.atime = file_stat.st_atime;
+  status.mtime = file_stat.st_mtime;
+  status.ctime = file_stat.st_ctime;
+#if !defined(__linux__)
+  status.btime = file_stat.st_birthtimespec.tv_sec;
+#endif
+  return true;
+#else
+  return false;
+#endif
+}
+
+#ifndef WIN32
+static std::string getFileType(mode_t mode) {
+  if (S_ISREG(mode)) {
+    return "regular";
+  } else if (S_ISDIR(mode)) {
+    return "directory";
+  } else if (S_ISLNK(mode)) {
+    return "symlink";
+  } else if (S_ISBLK(mode)) {
+    return "block";
+  } else if (S_ISCHR(mode)) {
+    return "character";
+  } else if (S_ISFIFO(mode)) {
+    return "fifo";
+  } else if (S_ISSOCK(mode)) {
+    return "socket";
+  }
+  return "unknown";
+}
+#endif
+
+bool genFileInfo(const fs::path& path,
                  const fs::path& parent,
                  const std::string& pattern,
-                 QueryData& results) {
+                 const FileColumns& columns,
+                 Row& r) {
 #ifndef WIN32
-  // Must provide the path, filename, directory separate from boost path->string
-  // helpers to match any explicit (query-parsed) predicate constraints.
-  struct stat file_stat, link_stat;
-  if (lstat(path.string().c_str(), &link_stat) < 0 ||
-      stat(path.string().c_str(), &file_stat)) {
+  // Links are followed, the status is also the check that the path is real.
+  FileStatus status;
+  if (!statFile(path, columns.mask, status)) {
     // Path was not real, had too may links, or could not be accessed.
-    return;
+    return false;
   }
 
-  Row r;
+  // Must provide the path, filename, directory separate from boost path->string
+  // helpers to match any explicit (query-parsed) predicate constraints.
   r["path"] = path.string();
   r["filename"] = path.filename().string();
   r["directory"] = parent.string();
 
-  r["inode"] = BIGINT(file_stat.st_ino);
-  r["uid"] = BIGINT(file_stat.st_uid);
-  r["gid"] = BIGINT(file_stat.st_gid);
-  r["mode"] = lsperms(file_stat.st_mode);
-  r["device"] = BIGINT(file_stat.st_rdev);
-  r["size"] = BIGINT(file_stat.st_size);
-  r["block_size"] = INTEGER(file_stat.st_blksize);
-  r["hard_links"] = INTEGER(file_stat.st_nlink);
+  // Only the referenced columns are formatted.
+  const auto& used = columns.used;
+  if (used.count("inode")) {
+    r["inode"] = BIGINT(status.inode);
+  }
+  if (used.count("uid")) {
+    r["uid"] = BIGINT(status.uid);
+  }
+  if (used.count("gid")) {
+    r["gid"] = BIGINT(status.gid);
+  }
+  if (used.count("mode")) {
+    r["mode"] = lsperms(status.mode);
+  }
+  if (used.count("device")) {
+    r["device"] = BIGINT(status.device);
+  }
+  if (used.count("size")) {
+    r["size"] = BIGINT(status.size);
+  }
+  if (used.count("block_size")) {
+    r["block_size"] = INTEGER(status.block_size);
+  }
+  if (used.count("hard_links")) {
+    r["hard_links"] = INTEGER(status.hard_links);
+  }
 
   // Times
-  r["atime"] = BIGINT(file_stat.st_atime);
-  r["mtime"] = BIGINT(file_stat.st_mtime);
-  r["ctime"] = BIGINT(file_stat.st_ctime);
-#if defined(__linux__)
-  // No 'birth' or create time in Linux.
-  r["btime"] = "0";
-#else
-  r["btime"] = BIGINT(file_stat.st_birthtimespec.tv_sec);
-#endif
+  if (used.count("atime")) {
+    r["atime"] = BIGINT(status.atime);
+  }
+  if (used.count("mtime")) {
+    r["mtime"] = BIGINT(status.mtime);
+  }
+  if (used.count("ctime")) {
+    r["ctime"] = BIGINT(status.ctime);
+  }
+  if (used.count("btime")) {
+    r["btime"] = BIGINT(status.btime);
+  }
 
-  // Type booleans
-  boost::system::error_code ec;
-  auto status = fs::status(path, ec);
-  if (kTypeNames.count(status.type())) {
-    r["type"] = kTypeNames.at(status.type());
-  } else {
-    r["type"] = "unknown";
-  }
-
-  r["is_file"] = (!S_ISDIR(file_stat.st_mode)) ? "1" : "0";
-  r["is_dir"] = (S_ISDIR(file_stat.st_mode)) ? "1" : "0";
-  r["is_link"] = (S_ISLNK(link_stat.st_mode)) ? "1" : "0";
-  r["is_char"] = (S_ISCHR(file_stat.st_mode)) ? "1" : "0";
-  r["is_block"] = (S_ISBLK(file_stat.st_mode)) ? "1" : "0";
-  results.push_back(r);
+  if (used.count("type")) {
+    r["type"] = getFileType(status.mode);
+  }
+  return true;
+#else
+  return false;
 #endif
 }
 
-QueryData genFile(QueryContext& context) {
-  QueryData results;
+/**
+ * @brief Stream file rows for resolved paths then each directory's contents.
+ *
+ * Each file is only stat'd when SQLite requests the next row, so a query
+ * with a LIMIT stops walking directories once it is satisfied.
+ */
+class FileRowGenerator : public RowGenerator {
+ public:
+  FileRowGenerator(std::set<std::string> paths,
+                   std::set<std::string> directories,
+                   FileColumns columns)
+      : paths_(std::move(paths)),
+        directories_(std::move(directories)),
+        columns_(std::move(columns)) {
+    path_ = paths_.begin();
+    directory_ = directories_.begin();
+  }
+
+  bool next(Row& r) override {
+    // Iterate through each of the resolved/supplied paths.
+    while (path_ != paths_.end()) {
+      fs::path path = *(path_++);
+      if (genFileInfo(path, path.parent_path(), "", columns_, r)) {
+        return true;
+      }
+    }
+
+    // Then iterate over each directory and generate info for each file.
+    fs::directory_iterator end;
+    while (true) {
+      while (entry_ != end) {
+        auto path = entry_->path();
+        boost::system::error_code ec;
+        entry_.increment(ec);
+        if (ec) {
+          entry_ = end;
+        }
+        if (genFileInfo(path, current_, "", columns_, r)) {
+          return true;
+        }
+      }
+
+      if (directory_ == directories_.end()) {
+        return false;
+      }
+
+      current_ = *(directory_++);
+      if (!isReadable(current_) || !isDirectory(current_)) {
+        continue;
+      }
+
+      boost::system::error_code ec;
+      entry_ = fs::directory_iterator(current_, ec);
+      if (ec) {
+        entry_ = end;
+      }
+    }
+  }
+
+ private:
+  /// Resolved file paths, and the next path to generate.
+  std::set<std::string> paths_;
+  std::set<std::string>::const_iterator path_;
 
+  /// Resolved directories, and the next directory to iterate.
+  std::set<std::string> directories_;
+  std::set<std::string>::const_iterator directory_;
+
+  /// The directory being iterated, and the position within.
+  std::string current_;
+  fs::directory_iterator entry_;
+
+  /// The referenced status columns.
+  FileColumns columns_;
+};
+
+RowGeneratorRef genFile(QueryContext& context) {
   // Resolve file paths for EQUALS and LIKE operations.
   auto paths = context.constraints["path"].getAll(EQUALS);
   context.expandConstraints(
@@ -111,12 +324,6 @@ QueryData genFile(QueryContext& context) {
         return status;
       }));
 
-  // Iterate through each of the resolved/supplied paths.
-  for (const auto& path_string : paths) {
-    fs::path path = path_string;
-    genFileInfo(path, path.parent_path(), "", results);
-  }
-
   // Resolve directories for EQUALS and LIKE operations.
   auto directories = context.constraints["directory"].getAll(EQUALS);
   context.expandConstraints(
@@ -135,24 +342,16 @@ QueryData genFile(QueryContext& context) {
         return status;
       }));
 
-  // Now loop through constraints using the directory column constraint.
-  for (const auto& directory_string : directories) {
-    if (!isReadable(directory_string) || !isDirectory(directory_string)) {
-      continue;
-    }
-
-    try {
-      // Iterate over the directory and generate info for each regular file.
-      fs::directory_iterator begin(directory_string), end;
-      for (; begin != end; ++begin) {
-        genFileInfo(begin->path(), directory_string, "", results);
-      }
-    } catch (const fs::filesystem_error& e) {
-      continue;
+  FileColumns columns;
+  for (const auto& column : kFileStatColumns) {
+    if (context.isColumnUsed(column.first)) {
+      columns.used.insert(column.first);
+      columns.mask |= column.second;
     }
   }
 
-  return results;
+  return RowGeneratorRef(new FileRowGenerator(
+      std::move(paths), std::move(directories), std::move(columns)));
 }
 }
 }
@@ -8,47 +8,106 @@
  *
  */
 
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
 #include <boost/filesystem.hpp>
 
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/hash.h>
 #include <osquery/tables.h>
 
 namespace fs = boost::filesystem;
 
 namespace osquery {
+
+FLAG(uint64, hash_threads, 4, "Number of threads hashing files for a query");
 namespace tables {
 
-void genHashForFile(const std::string& path,
-                    const std::string& dir,
-                    QueryContext& context,
-                    QueryData& results) {
+/// Map each digest column to its hash type.
+const std::map<std::string, HashType> kHashColumns = {
+    {"md5", HASH_TYPE_MD5},
+    {"sha1", HASH_TYPE_SHA1},
+    {"sha256", HASH_TYPE_SHA256},
+};
+
+/// A file whose row is generated by genHash.
+struct HashEntry {
+  std::string path;
+  std::string directory;
+  Row row;
+
+  /// The digests to compute, not present in a cached row.
+  int missing{0};
+};
+
+/// Prepare a file's row from the query cache, see completeHashEntry.
+static void genHashEntry(const std::string& path,
+                         const std::string& dir,
+                         int mask,
+                         QueryContext& context,
+                         std::vector<HashEntry>& entries) {
   // Must provide the path, filename, directory separate from boost path->string
   // helpers to match any explicit (query-parsed) predicate constraints.
-  Row r;
+  HashEntry entry;
+  entry.path = path;
+  entry.directory = dir;
   if (context.isCached(path)) {
-    r = context.getCache(path);
-  } else {
-    auto hashes = hashMultiFromFile(
-        HASH_TYPE_MD5 | HASH_TYPE_SHA1 | HASH_TYPE_SHA256, path);
-
-    r["path"] = path;
-    r["directory"] = dir;
-    r["md5"] = std::move(hashes.md5);
-    r["sha1"] = std::move(hashes.sha1);
-    r["sha256"] = std::move(hashes.sha256);
-    context.setCache(path, r);
+    entry.row = context.getCache(path);
+  }
+
+  // A cached row may have been generated without some of the digests.
+  for (const auto& column : kHashColumns) {
+    if ((mask & column.second) && entry.row.count(column.first) == 0) {
+      entry.missing |= column.second;
+    }
+  }
+  entries.push_back(std::move(entry));
+}
+
+/// Compute the digests a file's row is missing, called concurrently.
+static void completeHashEntry(HashEntry& entry) {
+  if (!entry.row.empty() && entry.missing == 0) {
+    return;
+  }
+
+  auto& r = entry.row;
+  r["path"] = entry.path;
+  r["directory"] = entry.directory;
+  if (entry.missing != 0) {
+    // Avoid reading the file content if no digest is needed.
+    auto hashes = hashMultiFromFile(entry.missing, entry.path);
+    if (entry.missing & HASH_TYPE_MD5) {
+      r["md5"] = std::move(hashes.md5);
+    }
+    if (entry.missing & HASH_TYPE_SHA1) {
+      r["sha1"] = std::move(hashes.sha1);
+    }
+    if (entry.missing & HASH_TYPE_SHA256) {
+      r["sha256"] = std::move(hashes.sha256);
+    }
   }
-  results.push_back(r);
 }
 
 QueryData genHash(QueryContext& context) {
   QueryData results;
   boost::system::error_code ec;
 
+  // Only compute the digests referenced by the query.
+  int mask = 0;
+  for (const auto& column : kHashColumns) {
+    if (context.isColumnUsed(column.first)) {
+      mask |= column.second;
+    }
+  }
+
   // The query must provide a predicate with constraints including path or
   // directory. We search for the parsed predicate constraints with the equals
   // operator.
+  std::vector<HashEntry> entries;
   auto paths = context.constraints["path"].getAll(EQUALS);
   for (const auto& path_string : paths) {
     boost::filesystem::path path = path_string;
@@ -56,7 +115,8 @@ QueryData genHash(QueryContext& context) {
       continue;
     }
 
-    genHashForFile(path_string, path.parent_path().string(), context, results);
+    genHashEntry(
+        path_string, path.parent_path().string(), mask, context, entries);
   }
 
   // Now loop through constraints using the directory column constraint.
@@ -71,12 +131,36 @@ QueryData genHash(QueryContext& context) {
     boost::filesystem::directory_iterator begin(directory), end;
     for (; begin != end; ++begin) {
       if (boost::filesystem::is_regular_file(begin->path(), ec)) {
-        genHashForFile(
-            begin->path().string(), directory_string, context, results);
+        genHashEntry(
+            begin->path().string(), directory_string, mask, context, entries);
       }
     }
   }
 
+  // Files are hashed by a pool of threads, each taking the next file.
+  std::atomic<size_t> cursor(0);
+  auto hasher = [&entries, &cursor]() {
+    size_t i = 0;
+    while ((i = cursor++) < entries.size()) {
+      completeHashEntry(entries[i]);
+    }
+  };
+
+  auto threads = std::max<size_t>(FLAGS_hash_threads, 1);
+  threads = std::min(threads, entries.size());
+  std::vector<std::thread> hashers;
+  for (size_t i = 1; i < threads; i++) {
+    hashers.emplace_back(hasher);
+  }
+  hasher();
+  for (auto& thread : hashers) {
+    thread.join();
+  }
+
+  for (auto& entry : entries) {
+    context.setCache(entry.path, entry.row);
+    results.push_back(std::move(entry.row));
+  }
   return results;
 }
 }
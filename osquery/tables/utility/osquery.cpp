@@ -10,6 +10,7 @@
 
 #include <osquery/config.h>
 #include <osquery/core.h>
+#include <osquery/database.h>
 #include <osquery/extensions.h>
 #include <osquery/events.h>
 #include <osquery/flags.h>
@@ -21,6 +22,7 @@
 #include <osquery/filesystem.h>
 
 #include "osquery/core/process.h"
+#include "osquery/core/startup.h"
 
 namespace osquery {
 
@@ -38,6 +40,12 @@ QueryData genOsqueryEvents(QueryContext& context) {
     r["name"] = publisher;
     r["publisher"] = publisher;
     r["type"] = "publisher";
+    // Publishers fire into subscriber queues.
+    r["queue_depth"] = "0";
+    r["queue_drops"] = "0";
+    r["filtered"] = "0";
+    r["allocations"] = "0";
+    r["allocated_bytes"] = "0";
 
     auto pubref = EventFactory::getEventPublisher(publisher);
     if (pubref != nullptr) {
@@ -67,12 +75,22 @@ QueryData genOsqueryEvents(QueryContext& context) {
       r["publisher"] = subref->getType();
       r["subscriptions"] = INTEGER(subref->numSubscriptions());
       r["events"] = INTEGER(subref->numEvents());
+      r["queue_depth"] = INTEGER(subref->queueDepth());
+      r["queue_drops"] = INTEGER(subref->queueDrops());
+      r["filtered"] = INTEGER(subref->numFiltered());
+      r["allocations"] = BIGINT(subref->numAllocations());
+      r["allocated_bytes"] = BIGINT(subref->allocatedBytes());
 
       // Subscribers are always active, even if their publisher is not.
       r["active"] = (subref->state() == SUBSCRIBER_RUNNING) ? "1" : "0";
     } else {
       r["subscriptions"] = "0";
       r["events"] = "0";
+      r["queue_depth"] = "0";
+      r["queue_drops"] = "0";
+      r["filtered"] = "0";
+      r["allocations"] = "0";
+      r["allocated_bytes"] = "0";
       r["active"] = "-1";
     }
     results.push_back(r);
@@ -81,6 +99,25 @@ QueryData genOsqueryEvents(QueryContext& context) {
   return results;
 }
 
+QueryData genOsqueryDatabaseStatistics(QueryContext& context) {
+  QueryData results;
+
+  std::map<std::string, std::string> stats;
+  auto status = getDatabaseStatistics(stats);
+  if (!status.ok()) {
+    VLOG(1) << "Cannot read database statistics: " << status.getMessage();
+    return results;
+  }
+
+  for (const auto& stat : stats) {
+    Row r;
+    r["name"] = stat.first;
+    r["value"] = stat.second;
+    results.push_back(r);
+  }
+  return results;
+}
+
 QueryData genOsqueryPacks(QueryContext& context) {
   QueryData results;
 
@@ -241,6 +278,20 @@ QueryData genOsquerySchedule(QueryContext& context) {
         r["system_time"] = "0";
         r["average_memory"] = "0";
         r["last_executed"] = "0";
+        r["late_executions"] = "0";
+        r["missed_executions"] = "0";
+        r["lateness"] = "0";
+        r["shared_generations"] = "0";
+        r["shared_executions"] = "0";
+        r["wall_time_p50"] = "0";
+        r["wall_time_p95"] = "0";
+        r["wall_time_p99"] = "0";
+        r["wall_time_max"] = "0";
+        r["rows_p50"] = "0";
+        r["rows_p99"] = "0";
+        r["allocations"] = "0";
+        r["allocated_bytes"] = "0";
+        r["peak_allocated_bytes"] = "0";
 
         // Report optional performance information.
         Config::getInstance().getPerformanceStats(
@@ -253,11 +304,62 @@ QueryData genOsquerySchedule(QueryContext& context) {
               r["user_time"] = BIGINT(perf.user_time);
               r["system_time"] = BIGINT(perf.system_time);
               r["average_memory"] = BIGINT(perf.average_memory);
+              r["late_executions"] = BIGINT(perf.late_executions);
+              r["missed_executions"] = BIGINT(perf.missed_executions);
+              r["lateness"] = BIGINT(perf.lateness);
+              r["shared_generations"] = BIGINT(perf.shared_generations);
+              r["shared_executions"] = BIGINT(perf.shared_executions);
+
+              // Percentiles are within an eighth of the recorded values.
+              const auto& latency = perf.wall_time_histogram;
+              r["wall_time_p50"] = BIGINT(latency.percentile(50));
+              r["wall_time_p95"] = BIGINT(latency.percentile(95));
+              r["wall_time_p99"] = BIGINT(latency.percentile(99));
+              r["wall_time_max"] = BIGINT(latency.max());
+              r["rows_p50"] = BIGINT(perf.rows_histogram.percentile(50));
+              r["rows_p99"] = BIGINT(perf.rows_histogram.percentile(99));
+              r["allocations"] = BIGINT(perf.allocations);
+              r["allocated_bytes"] = BIGINT(perf.allocated_bytes);
+              r["peak_allocated_bytes"] = BIGINT(perf.peak_allocated_bytes);
             });
 
         results.push_back(r);
       });
   return results;
 }
+
+QueryData genOsqueryStartup(QueryContext& context) {
+  QueryData results;
+  for (const auto& phase : getStartupPhases()) {
+    Row r;
+    r["name"] = TEXT(phase.name);
+    r["start_time"] = BIGINT(phase.start);
+    r["duration"] = BIGINT(phase.duration);
+    results.push_back(r);
+  }
+  return results;
+}
+
+QueryData genOsqueryTablePerformance(QueryContext& context) {
+  QueryData results;
+
+  Config::getInstance().tablePerformance(
+      [&results](const std::string& table, const TablePerformance& perf) {
+        Row r;
+        r["name"] = TEXT(table);
+        r["generations"] = BIGINT(perf.generations);
+        r["filters"] = BIGINT(perf.filters);
+        r["rows"] = BIGINT(perf.rows);
+        r["generate_time"] = BIGINT(perf.generate_time);
+        const auto& generate = perf.generate_time_histogram;
+        r["generate_time_p50"] = BIGINT(generate.percentile(50));
+        r["generate_time_p99"] = BIGINT(generate.percentile(99));
+        r["generate_time_max"] = BIGINT(generate.max());
+        r["allocations"] = BIGINT(perf.allocations);
+        r["allocated_bytes"] = BIGINT(perf.allocated_bytes);
+        results.push_back(r);
+      });
+  return results;
+}
 }
 }
@@ -0,0 +1,107 @@
+#!/usr/bin/env python
+
+#  Copyright (c) 2014-present, Facebook, Inc.
+#  All rights reserved.
+#
+#  This source code is licensed under the BSD-style license found in the
+#  LICENSE file in the root directory of this source tree. An additional grant
+#  of patent rights can be found in the PATENTS file in the same directory.
+
+from __future__ import absolute_import
+from __future__ import division
+from __future__ import print_function
+from __future__ import unicode_literals
+
+import argparse
+import ast
+import jinja2
+import os
+import sys
+
+from gentable import *
+
+TEMPLATE_NAME = "benchmarks.cpp.in"
+
+
+def read_blacklist(specs_path):
+    blacklist_path = os.path.join(specs_path, "blacklist")
+    if not os.path.exists(blacklist_path):
+        return []
+    with open(blacklist_path, "r") as fh:
+        return [
+            line.strip() for line in fh.read().split("\n")
+            if len(line.strip()) > 0 and line.strip()[0] != "#"
+        ]
+
+
+def to_cpp_string(value):
+    return value.replace("\\", "\\\\").replace("\"", "\\\"")
+
+
+def gen_benchmark(tree):
+    """Given a table tree, produce the queries used to benchmark the table."""
+    exec(compile(tree, "<string>", "exec"))
+    if "event_subscriber" in table.attributes:
+        # Event tables read the backing store, see the events benchmarks.
+        return None
+
+    # Tables without required columns are also benchmarked unconstrained.
+    queries = []
+    required = [c for c in table.columns() if "required" in c.options]
+    if len(required) == 0:
+        queries.append("select * from %s" % (table.table_name))
+    for example in table.examples:
+        if example not in queries:
+            queries.append(example)
+    if len(queries) == 0:
+        print(lightred("Cannot benchmark %s: no example constraints" % (
+            table.table_name)))
+        return None
+    return {
+        "name": table.table_name,
+        "queries": [to_cpp_string(query) for query in queries],
+    }
+
+
+def main(argc, argv):
+    parser = argparse.ArgumentParser(
+        "Generate C++ table benchmarks from table specs")
+    parser.add_argument("--specs", default="specs",
+        help="Path to osquery table specs")
+    parser.add_argument("codegen", help="Path to this codegen folder")
+    parser.add_argument("output", help="Path to output .cpp file")
+    parser.add_argument("spec_files", nargs="*",
+        help="Paths to the platform's .table spec files")
+    args = parser.parse_args()
+
+    template = os.path.join(args.codegen, "templates", TEMPLATE_NAME)
+    with open(template, "rU") as fh:
+        template_data = fh.read().replace("\\\n", "")
+
+    blacklist = read_blacklist(args.specs)
+    benchmarks = []
+    for spec_file in sorted(args.spec_files):
+        if os.path.basename(spec_file).find("example") == 0:
+            continue
+        with open(spec_file, "rU") as fh:
+            tree = ast.parse(fh.read())
+        benchmark = gen_benchmark(tree)
+        if benchmark is None:
+            continue
+        if is_blacklisted(benchmark["name"], blacklist=blacklist):
+            continue
+        benchmarks.append(benchmark)
+
+    output = jinja2.Template(template_data).render(tables=benchmarks)
+    try:
+        os.makedirs(os.path.dirname(args.output))
+    except:
+        # Generated folder already exists
+        pass
+    with open(args.output, "w") as fh:
+        fh.write(output)
+    return 0
+
+
+if __name__ == "__main__":
+    exit(main(len(sys.argv), sys.argv))
@@ -81,6 +81,12 @@ NON_CACHEABLE = [
     "OPTIMIZED",
 ]
 
+# Memoized table results are kept until a reboot or a hardware change.
+MEMOIZE_KINDS = [
+    "boot",
+    "hardware",
+]
+
 
 def usage():
     """ print program usage """
@@ -94,6 +100,11 @@ def to_camel_case(snake_case):
     return components[0] + "".join(x.title() for x in components[1:])
 
 
+def to_index_name(column_name):
+    """ convert a snake_case column name to a kCamelCase column index """
+    return "k" + "".join(x.title() for x in column_name.split('_'))
+
+
 def lightred(msg):
     return "\033[1;31m %s \033[0m" % str(msg)
 
@@ -176,6 +187,7 @@ class TableState(Singleton):
         self.class_name = ""
         self.description = ""
         self.attributes = {}
+        self.statistics = {}
         self.examples = []
         self.aliases = []
         self.has_options = False
@@ -209,17 +221,56 @@ class TableState(Singleton):
             if len(set(all_options).intersection(NON_CACHEABLE)) > 0:
                 print(lightred("Table cannot be marked cacheable: %s" % (path)))
                 exit(1)
+            if "generator" in self.attributes:
+                print(lightred(
+                    "Generator tables cannot be cacheable: %s" % (path)))
+                exit(1)
+            if "columnar" in self.attributes:
+                print(lightred(
+                    "Columnar tables cannot be cacheable: %s" % (path)))
+                exit(1)
+        if "memoize" in self.attributes:
+            if self.attributes["memoize"] not in MEMOIZE_KINDS:
+                print(lightred(
+                    "Tables are memoized until %s: %s" % (
+                        " or ".join(MEMOIZE_KINDS), path)))
+                exit(1)
+            if len(set(all_options).intersection(NON_CACHEABLE)) > 0:
+                print(lightred("Table cannot be memoized: %s" % (path)))
+                exit(1)
+            for attribute in ["cacheable", "generator", "columnar"]:
+                if attribute in self.attributes:
+                    print(lightred("Table cannot be %s and memoized: %s" % (
+                        attribute, path)))
+                    exit(1)
+            if self.class_name != "":
+                print(lightred(
+                    "Subscriber tables cannot be memoized: %s" % (path)))
+                exit(1)
+        if "columnar" in self.attributes:
+            if "generator" in self.attributes or self.class_name != "":
+                print(lightred(
+                    "Columnar tables cannot use a generator or subscriber: %s"
+                    % (path)))
+                exit(1)
         if self.table_name == "" or self.function == "":
             print(lightred("Invalid table spec: %s" % (path)))
             exit(1)
 
         # Check for reserved column names
+        index_names = set()
         for column in self.columns():
             if column.name in RESERVED:
                 print(lightred(("Cannot use column name: %s in table: %s "
                                 "(the column name is reserved)" % (
                                     column.name, self.table_name))))
                 exit(1)
+            column.index_name = to_index_name(column.name)
+            if column.index_name in index_names:
+                print(lightred(("Duplicate column index: %s in table: %s" % (
+                    column.index_name, self.table_name))))
+                exit(1)
+            index_names.add(column.index_name)
 
         path_bits = path.split("/")
         for i in range(1, len(path_bits)):
@@ -242,6 +293,7 @@ class TableState(Singleton):
             function=self.function,
             class_name=self.class_name,
             attributes=self.attributes,
+            statistics=self.statistics,
             examples=self.examples,
             aliases=self.aliases,
             has_options=self.has_options,
@@ -251,6 +303,22 @@ class TableState(Singleton):
         with open(path, "w+") as file_h:
             file_h.write(self.impl_content)
 
+    def generate_header(self, path):
+        """Generate the column indices used by the table implementation"""
+        try:
+            os.makedirs(os.path.dirname(path))
+        except:
+            # Generated folder already exists
+            pass
+        logging.debug("generating %s" % path)
+        content = jinja2.Template(TEMPLATES["columns"]).render(
+            table_name=self.table_name,
+            table_name_cc=to_camel_case(self.table_name),
+            schema=self.columns(),
+        )
+        with open(path, "w+") as file_h:
+            file_h.write(content)
+
     def blacklist(self, path):
         print(lightred("Blacklisting generated %s" % path))
         logging.debug("blacklisting %s" % path)
@@ -294,6 +362,7 @@ def table_name(name, aliases=[]):
     table.table_name = name
     table.description = ""
     table.attributes = {}
+    table.statistics = {}
     table.examples = []
     table.aliases = aliases
 
@@ -331,6 +400,18 @@ def attributes(**kwargs):
         table.attributes[attr] = kwargs[attr]
 
 
+def statistics(rows=0, cost=1):
+    """
+    define planner hints: the expected number of rows generated without
+    constraints and the relative cost of generating each row
+    """
+    if rows < 0 or cost < 0:
+        print(lightred("Table statistics must not be negative: %s" % (
+            table.table_name)))
+        sys.exit(1)
+    table.statistics = {"rows": float(rows), "cost": float(cost)}
+
+
 def implementation(impl_string):
     """
     define the path to the implementation file and the function which
@@ -382,6 +463,8 @@ def main(argc, argv):
         help="Generate a foreign table")
     parser.add_argument("--templates", default=SCRIPT_DIR + "/templates",
                         help="Path to codegen output .cpp.in templates")
+    parser.add_argument("--header", default=None,
+                        help="Path to output column indices .h file")
     parser.add_argument("spec_file", help="Path to input .table spec file")
     parser.add_argument("output", help="Path to output .cpp file")
     args = parser.parse_args()
@@ -395,7 +478,7 @@ def main(argc, argv):
     output = args.output
     if filename.endswith(".table"):
         # Adding a 3rd parameter will enable the blacklist
-        disable_blacklist = argc > 3
+        disable_blacklist = argc - (2 if args.header else 0) > 3
 
         setup_templates(args.templates)
         with open(filename, "rU") as file_handle:
@@ -407,6 +490,9 @@ def main(argc, argv):
             else:
                 template_type = "default" if not args.foreign else "foreign"
                 table.generate(output, template=template_type)
+            if args.header is not None:
+                # Blacklisted table implementations are still compiled.
+                table.generate_header(args.header)
 
 if __name__ == "__main__":
     SCRIPT_DIR = os.path.dirname(os.path.realpath(__file__))
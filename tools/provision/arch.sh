@@ -31,6 +31,7 @@ function main_arch() {
   package yara
 
   install_aws_sdk
+  install_librdkafka
 
   echo ""
   echo "The following packages need to be installed from the AUR:"
@@ -121,4 +121,5 @@ function main_centos() {
   gem_install fpm -v 1.3.3
 
   install_aws_sdk
+  install_librdkafka
 }
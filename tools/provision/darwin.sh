@@ -36,6 +36,7 @@ function main_darwin() {
   package google-benchmark
   package libmagic
   package sleuthkit
+  package librdkafka
 
   local_brew aws-sdk-cpp
 }
@@ -106,4 +106,5 @@ function main_debian() {
   fi
 
   install_aws_sdk
+  install_librdkafka
 }
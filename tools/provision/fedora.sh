@@ -77,4 +77,5 @@ function main_fedora() {
   gem_install fpm
 
   install_aws_sdk
+  install_librdkafka
 }
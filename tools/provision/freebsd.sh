@@ -26,4 +26,5 @@ function main_freebsd() {
   package cpp-netlib
   package magic
   install_aws_sdk
+  install_librdkafka
 }
@@ -442,6 +442,22 @@ function install_aws_sdk() {
   fi
 }
 
+function install_librdkafka() {
+  SOURCE=librdkafka-0.9.1
+  TARBALL=$SOURCE.tar.gz
+  URL=$DEPS_URL/$TARBALL
+
+  if provision librdkafka /usr/local/lib/librdkafka.a; then
+    pushd $SOURCE
+    CC="$CC" CXX="$CXX" ./configure --prefix=/usr/local \
+      --disable-sasl CFLAGS="$CFLAGS -fPIC" \
+      CXXFLAGS="$CXXFLAGS -fPIC"
+    make -j $THREADS libs
+    sudo make install
+    popd
+  fi
+}
+
 #############################################################################
 ## The following package installs are utilities not statically linked.
 #############################################################################
@@ -161,4 +161,5 @@ function main_rhel() {
   gem_install fpm
 
   install_aws_sdk
+  install_librdkafka
 }
@@ -122,4 +122,5 @@ function main_scientific() {
   gem_install fpm
 
   install_aws_sdk
+  install_librdkafka
 }
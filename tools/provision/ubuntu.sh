@@ -180,4 +180,5 @@ function main_ubuntu() {
   fi
 
   install_aws_sdk
+  install_librdkafka
 }
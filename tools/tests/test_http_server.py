@@ -28,6 +28,7 @@ EXAMPLE_CONFIG = {
         "tls_proc": {"query": "select * from processes", "interval": 0},
     },
     "node_invalid": False,
+    "config_hash": "tls_proc_v1",
 }
 
 EXAMPLE_DISTRIBUTED = {
@@ -139,6 +140,12 @@ class RealSimpleHandler(BaseHTTPRequestHandler):
             ENROLL_RESET["first"] = 0
             self._reply(FAILED_ENROLL_RESPONSE)
             return
+
+        # The client echoes the hash of the last config it received, an
+        # unchanged config is not sent again.
+        if request.get("config_hash") == EXAMPLE_CONFIG["config_hash"]:
+            self._reply({"config_unchanged": True})
+            return
         self._reply(EXAMPLE_CONFIG)
 
     def distributed_read(self, request):